@@ -15,15 +15,20 @@
 #cmakedefine HAVE_SYS_IOCTL_H
 #cmakedefine HAVE_SYS_FILIO_H
 #cmakedefine HAVE_SYS_PARAM_H
+#cmakedefine HAVE_SYS_MMAN_H
 #cmakedefine HAVE_SYS_RESOURCE_H
 #cmakedefine HAVE_SYS_SOCKET_H
 #cmakedefine HAVE_SYS_SOCKIO_H
 #cmakedefine HAVE_SYS_TIME_H
 #cmakedefine HAVE_SYS_TYPES_H
 #cmakedefine HAVE_SYS_UIO_H
+#cmakedefine HAVE_SYS_EVENTFD_H
 #cmakedefine HAVE_SYS_UN_H
 #cmakedefine HAVE_TIME_H
 #cmakedefine HAVE_UNISTD_H
+#cmakedefine HAVE_ZLIB_H
+#cmakedefine HAVE_OPENSSL_SSL_H
+#cmakedefine HAVE_JEMALLOC_JEMALLOC_H
 #cmakedefine HAVE_SYSLOG_H
 
 #cmakedefine HAVE_INET_NTOP
@@ -32,6 +37,11 @@
 #cmakedefine HAVE_SRANDOM
 #cmakedefine HAVE_STRERROR
 #cmakedefine HAVE_WRITEV
+#cmakedefine HAVE_SCHED_SETAFFINITY
+#cmakedefine HAVE_ACCEPT4
+#cmakedefine HAVE_MALLINFO2
+#cmakedefine HAVE_MALLINFO
+#cmakedefine HAVE_MALLOC_INFO
 
 #cmakedefine HAVE_SOCKLEN_T
 #cmakedefine HAVE_ULONG
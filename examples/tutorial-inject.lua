@@ -40,7 +40,9 @@ function read_query( packet )
 	if string.byte(packet) == proxy.COM_QUERY then
 		print("we got a normal query: " .. string.sub(packet, 2))
 
-		proxy.queries:append(1, packet )
+		-- the rows of the client's query are passed to read_query_result_rows()
+		-- in batches of 100 while they are forwarded
+		proxy.queries:append(1, packet, { rows_batch_size = 100 } )
 		-- generate a new COM_QUERY packet
 		--   [ \3SELECT NOW() ]
 		-- and inject it with the id = 2
@@ -50,6 +52,21 @@ function read_query( packet )
 	end
 end
 
+---
+-- read_query_result_rows() is called for each batch of rows of a query
+-- that was appended with { rows_batch_size = ... }
+--
+-- the rows are tables of strings, NULL is nil. Only the batch is buffered,
+-- not the whole result-set.
+--
+-- @return 
+--   * nothing to pass on the rows as they are
+--   * a table of rows to send instead, to filter or mask them
+--
+function read_query_result_rows(inj, rows)
+	print("got " .. #rows .. " rows of injection " .. inj.id)
+end
+
 ---
 -- read_query_result() is called when we receive a query result 
 -- from the server
@@ -75,6 +92,13 @@ function read_query_result(inj)
 			print("injected query returned: " .. row[1])
 		end
 
+		-- .indexed_rows gives direct access to a row and only
+		-- decodes the fields that are read
+		local rows = inj.resultset.indexed_rows
+		if rows and #rows > 0 then
+			print("last row: " .. tostring(rows[#rows][1]))
+		end
+
 		return proxy.PROXY_IGNORE_RESULT
 	end
 end
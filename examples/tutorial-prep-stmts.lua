@@ -64,6 +64,18 @@ function read_query_result(inj)
 				print((" [%d] %s (type = %d)"):format(ndx, tostring(v.value), v.type))
 			end
 		end
+
+		-- the binary rows are decoded column by column
+		local cols = inj.resultset.columns
+		if cols then
+			for row = 1, cols.row_count do
+				local values = {}
+				for col = 1, cols.column_count do
+					values[col] = tostring(cols:get(row, col))
+				end
+				print(("< EXECUTE: [%d] %s"):format(row, table.concat(values, ", ")))
+			end
+		end
 	elseif inj.id == 3 then
 		local stmt_close = assert(proto.from_stmt_close_packet(inj.query))
 		print(("> CLOSE: stmt-id = %d"):format(stmt_close.stmt_id))
@@ -18,6 +18,13 @@
 
  $%ENDLICENSE%$ --]]
 
+--[[
+
+the proxy tracks the running statements of the connections itself,
+SELECT * FROM transactions in the admin plugin shows them without this script
+
+--]]
+
 -- proxy.auto-config will pick them up
 local commands = require("proxy.commands")
 local auto_config = require("proxy.auto-config")
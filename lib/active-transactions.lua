@@ -25,6 +25,9 @@ for now we know about:
 * Lock wait timeout exceeded
 * Deadlock found when trying to get lock
 
+the proxy tracks the open transactions of the connections itself,
+SELECT * FROM transactions in the admin plugin shows them without this script
+
 --]]
 
 if not proxy.global.trxs then
@@ -46,6 +46,8 @@ function read_query(packet)
 			  type = proxy.MYSQL_TYPE_STRING },
 			{ name = "state",
 			  type = proxy.MYSQL_TYPE_STRING },
+			{ name = "breaker",
+			  type = proxy.MYSQL_TYPE_STRING },
 			{ name = "type",
 			  type = proxy.MYSQL_TYPE_STRING },
 			{ name = "uuid",
@@ -71,11 +73,411 @@ function read_query(packet)
 				i,
 				b.dst.name,          -- configured backend address
 				states[b.state + 1], -- the C-id is pushed down starting at 0
+				b.breaker,           -- closed, open or half_open
 				types[b.type + 1],   -- the C-id is pushed down starting at 0
 				b.uuid,              -- the MySQL Server's UUID if it is managed
 				b.connected_clients  -- currently connected clients
 			}
 		end
+	elseif query:lower() == "select * from pools" then
+		fields = { 
+			{ name = "backend_ndx", 
+			  type = proxy.MYSQL_TYPE_LONG },
+			{ name = "hits_session", 
+			  type = proxy.MYSQL_TYPE_LONG },
+			{ name = "hits_default_db", 
+			  type = proxy.MYSQL_TYPE_LONG },
+			{ name = "hits_user", 
+			  type = proxy.MYSQL_TYPE_LONG },
+			{ name = "hits_donor", 
+			  type = proxy.MYSQL_TYPE_LONG },
+			{ name = "misses", 
+			  type = proxy.MYSQL_TYPE_LONG },
+		}
+
+		for i = 1, #proxy.global.backends do
+			local pool = proxy.global.backends[i].pool_stats -- summed up over all event-threads
+
+			rows[#rows + 1] = {
+				i,
+				pool.hits_session,    -- same user, default-db, charset and autocommit
+				pool.hits_default_db, -- same user and default-db
+				pool.hits_user,       -- same user
+				pool.hits_donor,      -- connection of another user, needs a COM_CHANGE_USER
+				pool.misses           -- no idle connection
+			}
+		end
+	elseif query:lower() == "select * from backend_latency" then
+		fields = { 
+			{ name = "backend_ndx", 
+			  type = proxy.MYSQL_TYPE_LONG },
+			{ name = "address",
+			  type = proxy.MYSQL_TYPE_STRING },
+			{ name = "latency",
+			  type = proxy.MYSQL_TYPE_STRING },
+			{ name = "count", 
+			  type = proxy.MYSQL_TYPE_LONGLONG },
+			{ name = "p50_usec", 
+			  type = proxy.MYSQL_TYPE_LONGLONG },
+			{ name = "p95_usec", 
+			  type = proxy.MYSQL_TYPE_LONGLONG },
+			{ name = "p99_usec", 
+			  type = proxy.MYSQL_TYPE_LONGLONG },
+			{ name = "p999_usec", 
+			  type = proxy.MYSQL_TYPE_LONGLONG },
+			{ name = "max_usec", 
+			  type = proxy.MYSQL_TYPE_LONGLONG },
+		}
+
+		for i = 1, #proxy.global.backends do
+			local b = proxy.global.backends[i]
+			local latency = b.latency -- merged over all event-threads
+
+			for _, name in ipairs({ "connect", "first_byte", "query" }) do
+				local h = latency[name]
+
+				rows[#rows + 1] = {
+					i,
+					b.dst.name,
+					name,
+					h.count,
+					h.p50,
+					h.p95,
+					h.p99,
+					h.p999,
+					h.max
+				}
+			end
+		end
+	elseif query:lower() == "select * from query_cache" then
+		fields = { 
+			{ name = "hits", 
+			  type = proxy.MYSQL_TYPE_LONGLONG },
+			{ name = "misses", 
+			  type = proxy.MYSQL_TYPE_LONGLONG },
+			{ name = "hit_rate", 
+			  type = proxy.MYSQL_TYPE_DOUBLE },
+			{ name = "entries", 
+			  type = proxy.MYSQL_TYPE_LONG },
+			{ name = "bytes", 
+			  type = proxy.MYSQL_TYPE_LONGLONG },
+			{ name = "max_bytes", 
+			  type = proxy.MYSQL_TYPE_LONGLONG },
+			{ name = "evictions", 
+			  type = proxy.MYSQL_TYPE_LONGLONG },
+			{ name = "invalidations", 
+			  type = proxy.MYSQL_TYPE_LONGLONG },
+		}
+
+		local qc = proxy.global.query_cache
+		local lookups = qc.hits + qc.misses
+
+		rows[#rows + 1] = {
+			qc.hits,
+			qc.misses,
+			lookups > 0 and qc.hits / lookups or 0,
+			qc.entries,
+			qc.bytes,            -- size of the cached results
+			qc.max_bytes,        -- --proxy-query-cache-size, 0 if disabled
+			qc.evictions,        -- dropped to stay below max_bytes
+			qc.invalidations     -- dropped by writes to their tables
+		}
+	elseif query:lower() == "select * from timings" then
+		fields = { 
+			{ name = "timing", 
+			  type = proxy.MYSQL_TYPE_STRING },
+			{ name = "count", 
+			  type = proxy.MYSQL_TYPE_LONGLONG },
+			{ name = "avg_usec", 
+			  type = proxy.MYSQL_TYPE_DOUBLE },
+			{ name = "max_usec", 
+			  type = proxy.MYSQL_TYPE_DOUBLE },
+		}
+
+		for _, name in ipairs({ "accept_to_auth", "query_to_send", "query_to_first_byte", "query_to_last_byte" }) do
+			local t = proxy.global.timings[name] -- summed up over all event-threads
+
+			rows[#rows + 1] = {
+				name,
+				t.count,
+				t.avg_usec,
+				t.max_usec
+			}
+		end
+	elseif query:lower() == "select * from query_digest" then
+		fields = { 
+			{ name = "digest", 
+			  type = proxy.MYSQL_TYPE_STRING },
+			{ name = "count", 
+			  type = proxy.MYSQL_TYPE_LONGLONG },
+			{ name = "sum_usec", 
+			  type = proxy.MYSQL_TYPE_LONGLONG },
+			{ name = "avg_usec", 
+			  type = proxy.MYSQL_TYPE_DOUBLE },
+			{ name = "max_usec", 
+			  type = proxy.MYSQL_TYPE_LONGLONG },
+			{ name = "rows", 
+			  type = proxy.MYSQL_TYPE_LONGLONG },
+			{ name = "bytes", 
+			  type = proxy.MYSQL_TYPE_LONGLONG },
+			{ name = "errors", 
+			  type = proxy.MYSQL_TYPE_LONGLONG },
+			{ name = "backend_ndx", 
+			  type = proxy.MYSQL_TYPE_LONG },
+		}
+
+		local entries = proxy.global.query_digest.entries -- merged over all event-threads
+		table.sort(entries, function (a, b) return a.sum_usec > b.sum_usec end)
+
+		for _, e in ipairs(entries) do
+			rows[#rows + 1] = {
+				e.digest,
+				e.count,
+				e.sum_usec,
+				e.avg_usec,
+				e.max_usec,
+				e.rows,
+				e.bytes,
+				e.errors,
+				e.backend_ndx        -- of the last execution, 0 if none was used
+			}
+		end
+
+		local evicted = proxy.global.query_digest.evicted
+		if evicted.count > 0 then
+			rows[#rows + 1] = {
+				"(evicted)",         -- the queries dropped for --proxy-query-digest-size
+				evicted.count,
+				evicted.sum_usec,
+				evicted.avg_usec,
+				evicted.max_usec,
+				evicted.rows,
+				evicted.bytes,
+				evicted.errors,
+				evicted.backend_ndx
+			}
+		end
+	elseif query:lower() == "select * from rate_limits" then
+		fields = { 
+			{ name = "key", 
+			  type = proxy.MYSQL_TYPE_STRING },
+			{ name = "match", 
+			  type = proxy.MYSQL_TYPE_STRING },
+			{ name = "rate", 
+			  type = proxy.MYSQL_TYPE_DOUBLE },
+			{ name = "burst", 
+			  type = proxy.MYSQL_TYPE_DOUBLE },
+			{ name = "max_wait_ms", 
+			  type = proxy.MYSQL_TYPE_LONG },
+			{ name = "allowed", 
+			  type = proxy.MYSQL_TYPE_LONGLONG },
+			{ name = "delayed", 
+			  type = proxy.MYSQL_TYPE_LONGLONG },
+			{ name = "rejected", 
+			  type = proxy.MYSQL_TYPE_LONGLONG },
+		}
+
+		-- in the order they are checked, the counters are merged over all event-threads
+		for _, r in ipairs(proxy.global.rate_limits:rules()) do
+			rows[#rows + 1] = {
+				r.key,
+				r.match,
+				r.rate,
+				r.burst,
+				r.max_wait_ms,
+				r.allowed,
+				r.delayed,             -- queries that waited for a token, they are counted as allowed or rejected too
+				r.rejected
+			}
+		end
+	elseif query:lower() == "select * from firewall" then
+		fields = { 
+			{ name = "action", 
+			  type = proxy.MYSQL_TYPE_STRING },
+			{ name = "match", 
+			  type = proxy.MYSQL_TYPE_STRING },
+			{ name = "pattern", 
+			  type = proxy.MYSQL_TYPE_STRING },
+			{ name = "hits", 
+			  type = proxy.MYSQL_TYPE_LONGLONG },
+		}
+
+		local rules, default = proxy.global.firewall:rules()
+		for _, r in ipairs(rules) do
+			rows[#rows + 1] = { r.action, r.match, r.pattern, r.hits }
+		end
+		if default then
+			rows[#rows + 1] = { default.action, "(default)", nil, default.hits }
+		end
+	elseif query:lower() == "reload firewall" then
+		local ok, err = proxy.global.firewall:reload()
+		if not ok then
+			set_error(err)
+			return proxy.PROXY_SEND_RESULT
+		end
+
+		proxy.response = {
+			type = proxy.MYSQLD_PACKET_OK,
+		}
+		return proxy.PROXY_SEND_RESULT
+	elseif query:lower():match("^set rate limit ") then
+		-- SET RATE LIMIT <user|client|digest> '<match>' <rate> [<burst> [<max_wait_ms>]]
+		local key, match, args = query:match("^%a+%s+%a+%s+%a+%s+(%a+)%s+'(.*)'%s+([%d%.%s]+)$")
+		local rate, burst, max_wait_ms
+
+		if args then
+			rate, burst, max_wait_ms = args:match("^([%d%.]+)%s*([%d%.]*)%s*(%d*)%s*$")
+		end
+		if not rate then
+			set_error("expected SET RATE LIMIT <user|client|digest> '<match>' <rate> [<burst> [<max_wait_ms>]]")
+			return proxy.PROXY_SEND_RESULT
+		end
+
+		local ok, err = proxy.global.rate_limits:set(key:lower(), match, tonumber(rate), tonumber(burst), tonumber(max_wait_ms))
+		if not ok then
+			set_error(err)
+			return proxy.PROXY_SEND_RESULT
+		end
+
+		proxy.response = {
+			type = proxy.MYSQLD_PACKET_OK,
+		}
+		return proxy.PROXY_SEND_RESULT
+	elseif query:lower():match("^drop rate limit ") then
+		local key, match = query:match("^%a+%s+%a+%s+%a+%s+(%a+)%s+'(.*)'%s*$")
+
+		if not key then
+			set_error("expected DROP RATE LIMIT <user|client|digest> '<match>'")
+			return proxy.PROXY_SEND_RESULT
+		end
+
+		if not proxy.global.rate_limits:remove(key:lower(), match) then
+			set_error("there is no " .. key:lower() .. " rate limit for '" .. match .. "'")
+			return proxy.PROXY_SEND_RESULT
+		end
+
+		proxy.response = {
+			type = proxy.MYSQLD_PACKET_OK,
+		}
+		return proxy.PROXY_SEND_RESULT
+	elseif query:lower() == "select * from connections" then
+		fields = { 
+			{ name = "client", 
+			  type = proxy.MYSQL_TYPE_STRING },
+			{ name = "state", 
+			  type = proxy.MYSQL_TYPE_STRING },
+			{ name = "is_parked", 
+			  type = proxy.MYSQL_TYPE_LONG },
+			{ name = "bytes", 
+			  type = proxy.MYSQL_TYPE_LONGLONG },
+		}
+
+		local conns = proxy.global.connections.entries
+		table.sort(conns, function (a, b) return a.bytes > b.bytes end)
+
+		for _, c in ipairs(conns) do
+			rows[#rows + 1] = {
+				c.client,
+				c.state,
+				c.is_parked and 1 or 0, -- idles with its queues released
+				c.bytes                 -- when it last waited for a query
+			}
+		end
+	elseif query:lower() == "select * from transactions" then
+		fields = { 
+			{ name = "client", 
+			  type = proxy.MYSQL_TYPE_STRING },
+			{ name = "thread_id", 
+			  type = proxy.MYSQL_TYPE_LONG },
+			{ name = "in_trans", 
+			  type = proxy.MYSQL_TYPE_LONG },
+			{ name = "trx_ms", 
+			  type = proxy.MYSQL_TYPE_LONGLONG },
+			{ name = "trx_statements", 
+			  type = proxy.MYSQL_TYPE_LONG },
+			{ name = "trx_query", 
+			  type = proxy.MYSQL_TYPE_STRING },
+			{ name = "command", 
+			  type = proxy.MYSQL_TYPE_STRING },
+			{ name = "query_ms", 
+			  type = proxy.MYSQL_TYPE_LONGLONG },
+			{ name = "query", 
+			  type = proxy.MYSQL_TYPE_STRING },
+		}
+
+		-- the connections that run a statement or hold a transaction open
+		local conns = {}
+		for _, c in ipairs(proxy.global.connections.entries) do
+			if c.in_trans or c.command then
+				conns[#conns + 1] = c
+			end
+		end
+		table.sort(conns, function (a, b) return (a.trx_usec or a.query_usec) > (b.trx_usec or b.query_usec) end)
+
+		for _, c in ipairs(conns) do
+			rows[#rows + 1] = {
+				c.client,
+				c.thread_id,
+				c.in_trans and 1 or 0,
+				c.trx_usec and math.floor(c.trx_usec / 1000),
+				c.trx_statements,
+				c.trx_query,      -- the statement that opened the transaction
+				c.command,
+				c.query_usec and math.floor(c.query_usec / 1000),
+				c.query
+			}
+		end
+	elseif query:lower() == "select * from lua_profile" then
+		fields = { 
+			{ name = "stack", 
+			  type = proxy.MYSQL_TYPE_STRING },
+			{ name = "samples", 
+			  type = proxy.MYSQL_TYPE_LONGLONG },
+		}
+
+		-- the folded format of flamegraph.pl:
+		--   mysql -N -B -e "SELECT * FROM lua_profile" | tr '\t' ' ' | flamegraph.pl
+		local samples = require("chassis").profiler_samples()
+		table.sort(samples, function (a, b) return a.samples > b.samples end)
+
+		for _, s in ipairs(samples) do
+			rows[#rows + 1] = { s.stack, s.samples }
+		end
+	elseif query:lower() == "start lua profiler" then
+		-- the connections pick up the hook the next time they run a script
+		require("chassis").profiler_reset()
+		require("chassis").profiler_start()
+
+		proxy.response = {
+			type = proxy.MYSQLD_PACKET_OK,
+		}
+		return proxy.PROXY_SEND_RESULT
+	elseif query:lower() == "stop lua profiler" then
+		require("chassis").profiler_stop()
+
+		proxy.response = {
+			type = proxy.MYSQLD_PACKET_OK,
+		}
+		return proxy.PROXY_SEND_RESULT
+	elseif query:lower() == "reload scripts" then
+		-- the connections load the changed scripts when they start
+		require("chassis").reload_scripts()
+
+		proxy.response = {
+			type = proxy.MYSQLD_PACKET_OK,
+		}
+		return proxy.PROXY_SEND_RESULT
+	elseif query:lower() == "reload config" then
+		-- like SIGHUP: the proxy applies the backends of the --defaults-file
+		if not require("chassis").reload_config() then
+			set_error("reloading the config failed, check the error-log")
+			return proxy.PROXY_SEND_RESULT
+		end
+
+		proxy.response = {
+			type = proxy.MYSQLD_PACKET_OK,
+		}
+		return proxy.PROXY_SEND_RESULT
 	elseif query:lower() == "select * from help" then
 		fields = { 
 			{ name = "command", 
@@ -85,6 +487,23 @@ function read_query(packet)
 		}
 		rows[#rows + 1] = { "SELECT * FROM help", "shows this help" }
 		rows[#rows + 1] = { "SELECT * FROM backends", "lists the backends and their state" }
+		rows[#rows + 1] = { "SELECT * FROM pools", "shows the connection pool hits and misses of the backends" }
+		rows[#rows + 1] = { "SELECT * FROM backend_latency", "shows the connect and query latency percentiles of the backends" }
+		rows[#rows + 1] = { "SELECT * FROM query_cache", "shows the hits, misses and size of the query-cache" }
+		rows[#rows + 1] = { "SELECT * FROM timings", "shows how long the connections spend in the phases of auth and queries" }
+		rows[#rows + 1] = { "SELECT * FROM query_digest", "shows the count and time of the normalized queries, slowest first" }
+		rows[#rows + 1] = { "SELECT * FROM rate_limits", "shows the rate limits and how many queries they allowed, delayed and rejected" }
+		rows[#rows + 1] = { "SET RATE LIMIT <user|client|digest> '<match>' <rate> [<burst> [<max_wait_ms>]]", "limits the queries of a user, client address or fingerprint ('*' for each) to <rate> per second" }
+		rows[#rows + 1] = { "DROP RATE LIMIT <user|client|digest> '<match>'", "removes a rate limit" }
+		rows[#rows + 1] = { "SELECT * FROM firewall", "shows the rules of the --proxy-firewall-file and how many queries they decided on" }
+		rows[#rows + 1] = { "RELOAD FIREWALL", "reads the --proxy-firewall-file again, the old rules stay if it has errors" }
+		rows[#rows + 1] = { "SELECT * FROM connections", "shows the client connections and their memory, largest first" }
+		rows[#rows + 1] = { "SELECT * FROM transactions", "shows the running statements and open transactions, longest first" }
+		rows[#rows + 1] = { "RELOAD SCRIPTS", "makes the new connections load the lua scripts again" }
+		rows[#rows + 1] = { "RELOAD CONFIG", "re-reads the backends from the --defaults-file, like SIGHUP" }
+		rows[#rows + 1] = { "START LUA PROFILER", "starts sampling the lua stacks of the connections, drops the old samples" }
+		rows[#rows + 1] = { "STOP LUA PROFILER", "stops sampling the lua stacks" }
+		rows[#rows + 1] = { "SELECT * FROM lua_profile", "shows the sampled lua stacks in the folded format of flamegraph.pl" }
 	else
 		set_error("use 'SELECT * FROM help' to see the supported commands")
 		return proxy.PROXY_SEND_RESULT
@@ -40,6 +40,8 @@
 #include "chassis-plugin.h"
 #include "chassis-stats.h"
 #include "lua-registry-keys.h"
+#include "lua-scope.h"
+#include "lua-profiler.h"
 
 static int lua_chassis_set_shutdown (lua_State G_GNUC_UNUSED *L) {
 	chassis_set_shutdown();
@@ -271,6 +273,93 @@ static int lua_g_mem_profile(lua_State G_GNUC_UNUSED *L) {
 	g_mem_profile();
 	return 0;
 }
+
+/**
+ * reload the lua scripts even if they didn't change
+ *
+ * the lua-scopes reload them the next time they load the script
+ */
+static int lua_chassis_reload_scripts(lua_State G_GNUC_UNUSED *L) {
+	lua_scope_scripts_reload();
+	return 0;
+}
+/**
+ * chassis.reload_config()
+ *
+ * re-read the --defaults-file like on SIGHUP
+ *
+ * @return true on success, false if the file couldn't be read or a plugin failed
+ */
+static int lua_chassis_reload_config(lua_State *L) {
+	chassis *chas;
+
+	lua_getfield(L, LUA_REGISTRYINDEX, CHASSIS_LUA_REGISTRY_KEY);
+	chas = (chassis*) lua_topointer(L, -1);
+	lua_pop(L, 1);
+
+	if (!chas) return luaL_error(L, "chassis isn't available in this lua-state");
+
+	lua_pushboolean(L, 0 == chassis_reload_config(chas));
+	return 1;
+}
+
+/**
+ * chassis.profiler_start([count])
+ *
+ * sample the lua stacks of the connections every <count> instructions
+ */
+static int lua_chassis_profiler_start(lua_State *L) {
+	lua_Integer count = luaL_optinteger(L, 1, LUA_PROFILER_DEFAULT_COUNT);
+
+	if (count <= 0) return luaL_argerror(L, 1, "the count has to be > 0");
+
+	lua_profiler_start(count);
+	return 0;
+}
+
+static int lua_chassis_profiler_stop(lua_State G_GNUC_UNUSED *L) {
+	lua_profiler_stop();
+	return 0;
+}
+
+static int lua_chassis_profiler_reset(lua_State G_GNUC_UNUSED *L) {
+	lua_profiler_reset();
+	return 0;
+}
+
+/**
+ * chassis.profiler_samples()
+ *
+ * @return a table of { stack = <folded stack>, samples = <int> }, see lua_profiler_get_folded()
+ */
+static int lua_chassis_profiler_samples(lua_State *L) {
+	GString *folded = lua_profiler_get_folded();
+	gchar **lines;
+	int i, n = 0;
+
+	lines = g_strsplit(folded->str, "\n", -1);
+	g_string_free(folded, TRUE);
+
+	lua_newtable(L);
+	for (i = 0; lines[i]; i++) {
+		gchar *sep = strrchr(lines[i], ' ');
+
+		if (NULL == sep) continue;
+		*sep = '\0';
+
+		lua_newtable(L);
+		lua_pushstring(L, lines[i]);
+		lua_setfield(L, -2, "stack");
+		lua_pushnumber(L, g_ascii_strtoull(sep + 1, NULL, 10));
+		lua_setfield(L, -2, "samples");
+
+		lua_rawseti(L, -2, ++n);
+	}
+	g_strfreev(lines);
+
+	return 1;
+}
+
 /*
 ** Assumes the table is on top of the stack.
 */
@@ -301,6 +390,12 @@ static const struct luaL_reg chassislib[] = {
 /* to get the stats of a plugin, exposed as a table */
     {"get_stats", lua_chassis_stats},
     {"mem_profile", lua_g_mem_profile},
+    {"reload_scripts", lua_chassis_reload_scripts},
+    {"reload_config", lua_chassis_reload_config},
+    {"profiler_start", lua_chassis_profiler_start},
+    {"profiler_stop", lua_chassis_profiler_stop},
+    {"profiler_reset", lua_chassis_profiler_reset},
+    {"profiler_samples", lua_chassis_profiler_samples},
 	{NULL, NULL},
 };
 
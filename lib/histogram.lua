@@ -49,8 +49,7 @@ function read_query(packet)
 	if r then return r end
 
 	if cmd.type == proxy.COM_QUERY then
-		local tokens     = assert(tokenizer.tokenize(cmd.query))
-		local norm_query = tokenizer.normalize(tokens)
+		local norm_query = tokenizer.fingerprint(cmd.query)
 
 		-- print("normalized query: " .. norm_query)
 
@@ -144,8 +143,7 @@ function read_query_result(inj)
 	local cmd = commands.parse(inj.query)
 
 	if cmd.type == proxy.COM_QUERY then
-		local tokens     = assert(tokenizer.tokenize(cmd.query))
-		local norm_query = tokenizer.normalize(tokens)
+		local norm_query = tokenizer.fingerprint(cmd.query)
 
 		if proxy.global.config.histogram.collect_queries then
 			if not proxy.global.norm_queries[norm_query] then
@@ -171,7 +169,7 @@ function read_query_result(inj)
 	
 		if proxy.global.config.histogram.collect_tables then
 			-- extract the tables from the queries
-			tables = parser.get_tables(tokens)
+			tables = parser.get_tables(assert(tokenizer.tokenize(cmd.query)))
 	
 			for table, qtype in pairs(tables) do
 				if not proxy.global.tables[table] then
@@ -24,6 +24,8 @@
  */
 
 
+#include <string.h>
+
 #include <lua.h>
 #include <lauxlib.h>
 #include <lualib.h>
@@ -31,6 +33,7 @@
 #include "network-mysqld-proto.h"
 #include "network-mysqld-packet.h"
 #include "network_mysqld_type.h"
+#include "network_mysqld_proto_binary.h"
 #include "network-mysqld-masterinfo.h"
 #include "glib-ext.h"
 #include "lua-env.h"
@@ -584,6 +587,88 @@ static int lua_proto_get_stmt_prepare_ok_packet (lua_State *L) {
 	return 1;
 }
 
+/**
+ * push the value of a param of a COM_STMT_EXECUTE
+ *
+ * nil for a NULL, a number for the ints and floats and a string for the rest
+ */
+static int lua_proto_push_type(lua_State *L, network_mysqld_type_t *param) {
+	const char *const_s;
+	char *_s;
+	gsize s_len;
+	guint64 _i;
+	gboolean is_unsigned;
+	double d;
+
+	if (param->is_null) {
+		lua_pushnil(L);
+
+		return 1;
+	}
+
+	switch (param->type) {
+	case MYSQL_TYPE_BLOB:
+	case MYSQL_TYPE_MEDIUM_BLOB:
+	case MYSQL_TYPE_LONG_BLOB:
+	case MYSQL_TYPE_STRING:
+	case MYSQL_TYPE_VARCHAR:
+	case MYSQL_TYPE_VAR_STRING:
+		if (0 != network_mysqld_type_get_string_const(param, &const_s, &s_len)) {
+			return luaL_error(L, "%s: _get_string_const() failed for type = %d",
+					G_STRLOC,
+					param->type);
+		}
+
+		lua_pushlstring(L, const_s, s_len);
+		break;
+	case MYSQL_TYPE_TINY:
+	case MYSQL_TYPE_SHORT:
+	case MYSQL_TYPE_LONG:
+	case MYSQL_TYPE_LONGLONG:
+		if (0 != network_mysqld_type_get_int(param, &_i, &is_unsigned)) {
+			return luaL_error(L, "%s: _get_int() failed for type = %d",
+					G_STRLOC,
+					param->type);
+		}
+
+		lua_pushinteger(L, _i);
+		break;
+	case MYSQL_TYPE_DOUBLE:
+	case MYSQL_TYPE_FLOAT:
+		if (0 != network_mysqld_type_get_double(param, &d)) {
+			return luaL_error(L, "%s: _get_double() failed for type = %d",
+					G_STRLOC,
+					param->type);
+		}
+
+		lua_pushnumber(L, d);
+		break;
+	case MYSQL_TYPE_DATETIME:
+	case MYSQL_TYPE_TIMESTAMP:
+	case MYSQL_TYPE_DATE:
+	case MYSQL_TYPE_TIME:
+		_s = NULL;
+		s_len = 0;
+
+		if (0 != network_mysqld_type_get_string(param, &_s, &s_len)) {
+			return luaL_error(L, "%s: _get_string() failed for type = %d",
+					G_STRLOC,
+					param->type);
+		}
+
+		lua_pushlstring(L, _s, s_len);
+
+		if (NULL != _s) g_free(_s);
+		break;
+	default:
+		return luaL_error(L, "%s: can't decode type %d yet",
+				G_STRLOC,
+				param->type); /* we don't have that value yet */
+	}
+
+	return 1;
+}
+
 /**
  * get the stmt-id from the com-stmt-execute packet 
  */
@@ -630,77 +715,7 @@ static int lua_proto_get_stmt_execute_packet (lua_State *L) {
 			lua_pushnumber(L, param->type);
 			lua_setfield(L, -2, "type");
 
-			if (param->is_null) {
-				lua_pushnil(L);
-			} else {
-				const char *const_s;
-				char *_s;
-				gsize s_len;
-				guint64 _i;
-				gboolean is_unsigned;
-				double d;
-
-				switch (param->type) {
-				case MYSQL_TYPE_BLOB:
-				case MYSQL_TYPE_MEDIUM_BLOB:
-				case MYSQL_TYPE_LONG_BLOB:
-				case MYSQL_TYPE_STRING:
-				case MYSQL_TYPE_VARCHAR:
-				case MYSQL_TYPE_VAR_STRING:
-					if (0 != network_mysqld_type_get_string_const(param, &const_s, &s_len)) {
-						return luaL_error(L, "%s: _get_string_const() failed for type = %d",
-								G_STRLOC,
-								param->type);
-					}
-
-					lua_pushlstring(L, const_s, s_len);
-					break;
-				case MYSQL_TYPE_TINY:
-				case MYSQL_TYPE_SHORT:
-				case MYSQL_TYPE_LONG:
-				case MYSQL_TYPE_LONGLONG:
-					if (0 != network_mysqld_type_get_int(param, &_i, &is_unsigned)) {
-						return luaL_error(L, "%s: _get_int() failed for type = %d",
-								G_STRLOC,
-								param->type);
-					}
-
-					lua_pushinteger(L, _i);
-					break;
-				case MYSQL_TYPE_DOUBLE:
-				case MYSQL_TYPE_FLOAT:
-					if (0 != network_mysqld_type_get_double(param, &d)) {
-						return luaL_error(L, "%s: _get_double() failed for type = %d",
-								G_STRLOC,
-								param->type);
-					}
-
-					lua_pushnumber(L, d);
-					break;
-				case MYSQL_TYPE_DATETIME:
-				case MYSQL_TYPE_TIMESTAMP:
-				case MYSQL_TYPE_DATE:
-				case MYSQL_TYPE_TIME:
-					_s = NULL;
-					s_len = 0;
-
-					if (0 != network_mysqld_type_get_string(param, &_s, &s_len)) {
-						return luaL_error(L, "%s: _get_string() failed for type = %d",
-								G_STRLOC,
-								param->type);
-					}
-
-					lua_pushlstring(L, _s, s_len);
-
-					if (NULL != _s) g_free(_s);
-					break;
-				default:
-					luaL_error(L, "%s: can't decode type %d yet",
-							G_STRLOC,
-							param->type); /* we don't have that value yet */
-					break;
-				}
-			}
+			lua_proto_push_type(L, param);
 			lua_setfield(L, -2, "value");
 			lua_rawseti(L, -2, i + 1);
 		}
@@ -774,6 +789,402 @@ static int lua_proto_get_stmt_close_packet (lua_State *L) {
 
 
 
+/**
+ * the lazy decoders: proto.lazy_from_*_packet()
+ *
+ * the from_*_packet() decoders build a table with all the fields of the packet. The lazy
+ * ones return a userdata that keeps the parsed struct and only pushes the field a script
+ * reads. Fields that are empty strings are nil, like in the tables.
+ */
+#define LUA_PROTO_LAZY_METATABLE         "mysql.proto.lazy"
+#define LUA_PROTO_STMT_EXECUTE_METATABLE "mysql.proto.stmt_execute"
+
+typedef enum {
+	LUA_PROTO_FIELD_INT8,
+	LUA_PROTO_FIELD_INT16,
+	LUA_PROTO_FIELD_INT32,
+	LUA_PROTO_FIELD_GSTRING
+} lua_proto_field_type_t;
+
+typedef struct {
+	const char *name;
+	lua_proto_field_type_t type;
+	glong offset;
+} lua_proto_field_t;
+
+#define LUA_PROTO_FIELD(_struct, _struct_field, _lua_field, _type) \
+	{ _lua_field, _type, G_STRUCT_OFFSET(_struct, _struct_field) }
+
+static const lua_proto_field_t lua_proto_challenge_fields[] = {
+	LUA_PROTO_FIELD(network_mysqld_auth_challenge, protocol_version, "protocol_version", LUA_PROTO_FIELD_INT8),
+	LUA_PROTO_FIELD(network_mysqld_auth_challenge, server_version, "server_version", LUA_PROTO_FIELD_INT32),
+	LUA_PROTO_FIELD(network_mysqld_auth_challenge, thread_id, "thread_id", LUA_PROTO_FIELD_INT32),
+	LUA_PROTO_FIELD(network_mysqld_auth_challenge, capabilities, "capabilities", LUA_PROTO_FIELD_INT32),
+	LUA_PROTO_FIELD(network_mysqld_auth_challenge, charset, "charset", LUA_PROTO_FIELD_INT8),
+	LUA_PROTO_FIELD(network_mysqld_auth_challenge, server_status, "server_status", LUA_PROTO_FIELD_INT16),
+	LUA_PROTO_FIELD(network_mysqld_auth_challenge, auth_plugin_data, "challenge", LUA_PROTO_FIELD_GSTRING),
+	LUA_PROTO_FIELD(network_mysqld_auth_challenge, auth_plugin_name, "auth_plugin_name", LUA_PROTO_FIELD_GSTRING),
+	{ NULL, 0, 0 }
+};
+
+static const lua_proto_field_t lua_proto_response_fields[] = {
+	LUA_PROTO_FIELD(network_mysqld_auth_response, client_capabilities, "capabilities", LUA_PROTO_FIELD_INT32),
+	LUA_PROTO_FIELD(network_mysqld_auth_response, server_capabilities, "server_capabilities", LUA_PROTO_FIELD_INT32),
+	LUA_PROTO_FIELD(network_mysqld_auth_response, max_packet_size, "max_packet_size", LUA_PROTO_FIELD_INT32),
+	LUA_PROTO_FIELD(network_mysqld_auth_response, charset, "charset", LUA_PROTO_FIELD_INT8),
+	LUA_PROTO_FIELD(network_mysqld_auth_response, username, "username", LUA_PROTO_FIELD_GSTRING),
+	LUA_PROTO_FIELD(network_mysqld_auth_response, auth_plugin_data, "response", LUA_PROTO_FIELD_GSTRING),
+	LUA_PROTO_FIELD(network_mysqld_auth_response, auth_plugin_name, "auth_plugin_name", LUA_PROTO_FIELD_GSTRING),
+	LUA_PROTO_FIELD(network_mysqld_auth_response, database, "database", LUA_PROTO_FIELD_GSTRING),
+	{ NULL, 0, 0 }
+};
+
+typedef struct {
+	gpointer data;                   /**< the parsed struct */
+	const lua_proto_field_t *fields; /**< the fields of .data that can be read */
+	GDestroyNotify data_free;
+} lua_proto_lazy_t;
+
+static int lua_proto_lazy_get (lua_State *L) {
+	lua_proto_lazy_t *lazy = luaL_checkudata(L, 1, LUA_PROTO_LAZY_METATABLE);
+	const char *key = luaL_checkstring(L, 2);
+	const lua_proto_field_t *field;
+
+	for (field = lazy->fields; field->name; field++) {
+		gpointer p;
+
+		if (0 != strcmp(field->name, key)) continue;
+
+		p = G_STRUCT_MEMBER_P(lazy->data, field->offset);
+
+		switch (field->type) {
+		case LUA_PROTO_FIELD_INT8:
+			lua_pushinteger(L, *(guint8 *)p);
+			break;
+		case LUA_PROTO_FIELD_INT16:
+			lua_pushinteger(L, *(guint16 *)p);
+			break;
+		case LUA_PROTO_FIELD_INT32:
+			lua_pushinteger(L, *(guint32 *)p);
+			break;
+		case LUA_PROTO_FIELD_GSTRING: {
+			GString *str = *(GString **)p;
+
+			if (str && str->len) {
+				lua_pushlstring(L, S(str));
+			} else {
+				lua_pushnil(L);
+			}
+			break; }
+		}
+
+		return 1;
+	}
+
+	lua_pushnil(L);
+
+	return 1;
+}
+
+static int lua_proto_lazy_gc (lua_State *L) {
+	lua_proto_lazy_t *lazy = luaL_checkudata(L, 1, LUA_PROTO_LAZY_METATABLE);
+
+	if (lazy->data) lazy->data_free(lazy->data);
+	lazy->data = NULL;
+
+	return 0;
+}
+
+/**
+ * push a lazy userdata for the parsed struct, takes over data
+ */
+static void lua_proto_lazy_push (lua_State *L, gpointer data, const lua_proto_field_t *fields, GDestroyNotify data_free) {
+	lua_proto_lazy_t *lazy = lua_newuserdata(L, sizeof(*lazy));
+
+	lazy->data = data;
+	lazy->fields = fields;
+	lazy->data_free = data_free;
+
+	luaL_getmetatable(L, LUA_PROTO_LAZY_METATABLE);
+	lua_setmetatable(L, -2);
+}
+
+/**
+ * decode the challenge packet lazily, see lua_proto_get_challenge_packet()
+ */
+static int lua_proto_lazy_get_challenge_packet (lua_State *L) {
+	size_t packet_len;
+	const char *packet_str = luaL_checklstring(L, 1, &packet_len);
+	network_mysqld_auth_challenge *auth_challenge;
+	network_packet packet;
+	GString s;
+
+	s.str = (char *)packet_str;
+	s.len = packet_len;
+
+	packet.data = &s;
+	packet.offset = 0;
+
+	auth_challenge = network_mysqld_auth_challenge_new();
+
+	if (network_mysqld_proto_get_auth_challenge(&packet, auth_challenge)) {
+		network_mysqld_auth_challenge_free(auth_challenge);
+
+		return luaL_error(L, "%s: network_mysqld_proto_get_auth_challenge() failed", G_STRLOC);
+	}
+
+	lua_proto_lazy_push(L, auth_challenge, lua_proto_challenge_fields, (GDestroyNotify)network_mysqld_auth_challenge_free);
+
+	return 1;
+}
+
+/**
+ * decode the response packet lazily, see lua_proto_get_response_packet()
+ */
+static int lua_proto_lazy_get_response_packet (lua_State *L) {
+	size_t packet_len;
+	const char *packet_str = luaL_checklstring(L, 1, &packet_len);
+	guint32 server_capabilities = luaL_checkint(L, 2);
+	network_mysqld_auth_response *auth_response;
+	network_packet packet;
+	GString s;
+
+	s.str = (char *)packet_str;
+	s.len = packet_len;
+
+	packet.data = &s;
+	packet.offset = 0;
+
+	auth_response = network_mysqld_auth_response_new(server_capabilities);
+
+	if (network_mysqld_proto_get_auth_response(&packet, auth_response)) {
+		network_mysqld_auth_response_free(auth_response);
+
+		return luaL_error(L, "%s: network_mysqld_proto_get_auth_response() failed", G_STRLOC);
+	}
+
+	lua_proto_lazy_push(L, auth_response, lua_proto_response_fields, (GDestroyNotify)network_mysqld_auth_response_free);
+
+	return 1;
+}
+
+/**
+ * a param of a lazily decoded COM_STMT_EXECUTE
+ */
+typedef struct {
+	guint16 type;     /**< the type as sent, with the unsigned-flag 0x8000 */
+	gboolean is_null;
+	gsize offset;     /**< where the value starts in the packet */
+} lua_proto_stmt_param_t;
+
+/**
+ * a lazily decoded COM_STMT_EXECUTE
+ *
+ * only the header is decoded and the values are skipped to find where each one starts.
+ * A param is decoded into a network_mysqld_type_t when the script asks for it.
+ */
+typedef struct {
+	guint32 stmt_id;
+	guint8  flags;
+	guint32 iteration_count;
+	guint8  new_params_bound;
+
+	GString *packet;                 /**< a copy of the packet, the params are decoded from it */
+	guint param_count;               /**< the params in .params, 0 if no new params are bound */
+	lua_proto_stmt_param_t *params;
+} lua_proto_stmt_execute_t;
+
+static int lua_proto_stmt_execute_parse(lua_proto_stmt_execute_t *cmd, guint param_count) {
+	network_packet packet;
+	gsize nul_bits_offset;
+	int err = 0;
+	guint i;
+
+	packet.data = cmd->packet;
+	packet.offset = 0;
+
+	err = err || network_mysqld_proto_get_stmt_execute_packet_stmt_id(&packet, &cmd->stmt_id);
+	err = err || network_mysqld_proto_get_int8(&packet, &cmd->flags);
+	err = err || network_mysqld_proto_get_int32(&packet, &cmd->iteration_count);
+
+	if (0 == param_count) {
+		return err ? -1 : 0;
+	}
+
+	nul_bits_offset = packet.offset;
+	err = err || network_mysqld_proto_skip(&packet, (param_count + 7) / 8);
+	err = err || network_mysqld_proto_get_int8(&packet, &cmd->new_params_bound);
+
+	if (err || !cmd->new_params_bound) {
+		return err ? -1 : 0;
+	}
+
+	cmd->params = g_new0(lua_proto_stmt_param_t, param_count);
+	cmd->param_count = param_count;
+
+	for (i = 0; 0 == err && i < param_count; i++) {
+		lua_proto_stmt_param_t *param = &cmd->params[i];
+
+		err = err || network_mysqld_proto_get_int16(&packet, &param->type);
+		param->is_null = (cmd->packet->str[nul_bits_offset + i / 8] & (1 << (i % 8))) != 0;
+	}
+
+	for (i = 0; 0 == err && i < param_count; i++) {
+		lua_proto_stmt_param_t *param = &cmd->params[i];
+
+		param->offset = packet.offset;
+
+		if (!param->is_null) {
+			err = err || network_mysqld_proto_binary_skip_type(&packet, param->type & 0xff);
+		}
+	}
+
+	return err ? -1 : 0;
+}
+
+/**
+ * push the value of the param ndx of the COM_STMT_EXECUTE
+ */
+static int lua_proto_stmt_execute_push_param (lua_State *L, lua_proto_stmt_execute_t *cmd, guint ndx) {
+	lua_proto_stmt_param_t *p = &cmd->params[ndx];
+	network_mysqld_type_t *param;
+	network_packet packet;
+
+	if (NULL == (param = network_mysqld_type_new(p->type & 0xff))) {
+		return luaL_error(L, "%s: couldn't create type = %d", G_STRLOC, p->type & 0xff);
+	}
+	param->is_null = p->is_null;
+	param->is_unsigned = (p->type & 0x8000) != 0;
+
+	packet.data = cmd->packet;
+	packet.offset = p->offset;
+
+	if (!param->is_null && 0 != network_mysqld_proto_binary_get_type(&packet, param)) {
+		network_mysqld_type_free(param);
+
+		return luaL_error(L, "%s: decoding param %d failed", G_STRLOC, ndx + 1);
+	}
+
+	/* raises an error for the types we can't decode yet, like from_stmt_execute_packet() */
+	lua_proto_push_type(L, param);
+
+	network_mysqld_type_free(param);
+
+	return 1;
+}
+
+/**
+ * value, type = execute:param(ndx)
+ *
+ * decodes only the param ndx, starting at 1
+ */
+static int lua_proto_stmt_execute_param (lua_State *L) {
+	lua_proto_stmt_execute_t *cmd = luaL_checkudata(L, 1, LUA_PROTO_STMT_EXECUTE_METATABLE);
+	int ndx = luaL_checkint(L, 2);
+
+	if (ndx < 1 || (guint)ndx > cmd->param_count) {
+		return luaL_error(L, "param %d is out of range, the packet has %d", ndx, cmd->param_count);
+	}
+
+	lua_proto_stmt_execute_push_param(L, cmd, ndx - 1);
+	lua_pushinteger(L, cmd->params[ndx - 1].type & 0xff);
+
+	return 2;
+}
+
+static int lua_proto_stmt_execute_get (lua_State *L) {
+	lua_proto_stmt_execute_t *cmd = luaL_checkudata(L, 1, LUA_PROTO_STMT_EXECUTE_METATABLE);
+	gsize keysize;
+	const char *key = luaL_checklstring(L, 2, &keysize);
+
+	if (strleq(key, keysize, C("stmt_id"))) {
+		lua_pushinteger(L, cmd->stmt_id);
+	} else if (strleq(key, keysize, C("flags"))) {
+		lua_pushinteger(L, cmd->flags);
+	} else if (strleq(key, keysize, C("iteration_count"))) {
+		lua_pushinteger(L, cmd->iteration_count);
+	} else if (strleq(key, keysize, C("new_params_bound"))) {
+		lua_pushboolean(L, cmd->new_params_bound);
+	} else if (strleq(key, keysize, C("param_count"))) {
+		lua_pushinteger(L, cmd->param_count);
+	} else if (strleq(key, keysize, C("param"))) {
+		lua_pushcfunction(L, lua_proto_stmt_execute_param);
+	} else if (strleq(key, keysize, C("params")) && cmd->new_params_bound) {
+		/* all of them, like from_stmt_execute_packet() */
+		guint i;
+
+		lua_newtable(L);
+		for (i = 0; i < cmd->param_count; i++) {
+			lua_newtable(L);
+			lua_pushinteger(L, cmd->params[i].type & 0xff);
+			lua_setfield(L, -2, "type");
+
+			lua_proto_stmt_execute_push_param(L, cmd, i);
+			lua_setfield(L, -2, "value");
+			lua_rawseti(L, -2, i + 1);
+		}
+	} else {
+		lua_pushnil(L);
+	}
+
+	return 1;
+}
+
+static int lua_proto_stmt_execute_gc (lua_State *L) {
+	lua_proto_stmt_execute_t *cmd = luaL_checkudata(L, 1, LUA_PROTO_STMT_EXECUTE_METATABLE);
+
+	if (cmd->packet) g_string_free(cmd->packet, TRUE);
+	if (cmd->params) g_free(cmd->params);
+	cmd->packet = NULL;
+	cmd->params = NULL;
+
+	return 0;
+}
+
+/**
+ * decode the COM_STMT_EXECUTE packet lazily, see lua_proto_get_stmt_execute_packet()
+ *
+ * the header fields are read like the table, the params with execute:param(ndx)
+ */
+static int lua_proto_lazy_get_stmt_execute_packet (lua_State *L) {
+	size_t packet_len;
+	const char *packet_str = luaL_checklstring(L, 1, &packet_len);
+	int param_count = luaL_checkint(L, 2);
+	lua_proto_stmt_execute_t *cmd;
+
+	luaL_argcheck(L, param_count >= 0, 2, "has to be >= 0");
+
+	cmd = lua_newuserdata(L, sizeof(*cmd));
+	memset(cmd, 0, sizeof(*cmd));
+	luaL_getmetatable(L, LUA_PROTO_STMT_EXECUTE_METATABLE);
+	lua_setmetatable(L, -2);
+
+	/* the script may drop the string, we need the values later */
+	cmd->packet = g_string_new_len(packet_str, packet_len);
+
+	if (0 != lua_proto_stmt_execute_parse(cmd, param_count)) {
+		return luaL_error(L, "%s: decoding the COM_STMT_EXECUTE packet failed", G_STRLOC);
+	}
+
+	return 1;
+}
+
+static void lua_proto_lazy_register_metatables (lua_State *L) {
+	luaL_newmetatable(L, LUA_PROTO_LAZY_METATABLE);
+	lua_pushcfunction(L, lua_proto_lazy_get);
+	lua_setfield(L, -2, "__index");
+	lua_pushcfunction(L, lua_proto_lazy_gc);
+	lua_setfield(L, -2, "__gc");
+	lua_pop(L, 1);
+
+	luaL_newmetatable(L, LUA_PROTO_STMT_EXECUTE_METATABLE);
+	lua_pushcfunction(L, lua_proto_stmt_execute_get);
+	lua_setfield(L, -2, "__index");
+	lua_pushcfunction(L, lua_proto_stmt_execute_gc);
+	lua_setfield(L, -2, "__gc");
+	lua_pop(L, 1);
+}
+
 /*
 ** Assumes the table is on top of the stack.
 */
@@ -808,6 +1219,9 @@ static const struct luaL_reg mysql_protolib[] = {
 	{"from_stmt_execute_packet", lua_proto_get_stmt_execute_packet},
 	{"stmt_id_from_stmt_execute_packet", lua_proto_get_stmt_execute_packet_stmt_id},
 	{"from_stmt_close_packet", lua_proto_get_stmt_close_packet},
+	{"lazy_from_challenge_packet", lua_proto_lazy_get_challenge_packet},
+	{"lazy_from_response_packet", lua_proto_lazy_get_response_packet},
+	{"lazy_from_stmt_execute_packet", lua_proto_lazy_get_stmt_execute_packet},
 	{NULL, NULL},
 };
 
@@ -818,6 +1232,7 @@ static const struct luaL_reg mysql_protolib[] = {
 #endif
 
 LUAEXT_API int luaopen_mysql_proto (lua_State *L) {
+	lua_proto_lazy_register_metatables (L);
 	luaL_register (L, "proto", mysql_protolib);
 	set_info (L);
 	return 1;
@@ -23,41 +23,52 @@ module("proxy.balance", package.seeall)
 
 function idle_failsafe_rw()
 	local backend_ndx = 0
+	local states, clients, types = proxy.global.backends:get_states()
 
-	for i = 1, #proxy.global.backends do
-		local s = proxy.global.backends[i]
-		local conns = s.pool.users[proxy.connection.client.username]
-		
-		if conns.cur_idle_connections > 0 and 
-		   s.state ~= proxy.BACKEND_STATE_DOWN and 
-		   s.type == proxy.BACKEND_TYPE_RW then
-			backend_ndx = i
-			break
+	for i = 1, #states do
+		if states[i] ~= proxy.BACKEND_STATE_DOWN and 
+		   types[i] == proxy.BACKEND_TYPE_RW then
+			local conns = proxy.global.backends[i].pool.users[proxy.connection.client.username]
+
+			if conns.cur_idle_connections > 0 then
+				backend_ndx = i
+				break
+			end
 		end
 	end
 
 	return backend_ndx
 end
 
+---
+-- pick a slave which has some idling connections
+--
+-- prefer the slave that answers the fastest: the average latency is weighted
+-- by the connected clients, a slow slave gets less clients instead of none.
+-- slaves without latency samples yet are tried first, lagging slaves are skipped
 function idle_ro() 
-	local max_conns = -1
-	local max_conns_ndx = 0
-
-	for i = 1, #proxy.global.backends do
-		local s = proxy.global.backends[i]
-		local conns = s.pool.users[proxy.connection.client.username]
-
-		-- pick a slave which has some idling connections
-		if s.type == proxy.BACKEND_TYPE_RO and 
-		   s.state ~= proxy.BACKEND_STATE_DOWN and 
-		   conns.cur_idle_connections > 0 then
-			if max_conns == -1 or 
-			   s.connected_clients < max_conns then
-				max_conns = s.connected_clients
-				max_conns_ndx = i
+	local min_score = -1
+	local min_score_ndx = 0
+	local states, clients, types = proxy.global.backends:get_states()
+
+	for i = 1, #states do
+		if types[i] == proxy.BACKEND_TYPE_RO and 
+		   states[i] ~= proxy.BACKEND_STATE_DOWN and 
+		   states[i] ~= proxy.BACKEND_STATE_LAGGING then
+			local s = proxy.global.backends[i]
+			local conns = s.pool.users[proxy.connection.client.username]
+
+			if conns.cur_idle_connections > 0 then
+				local score = (clients[i] + 1) * s.latency_total
+
+				if min_score == -1 or 
+				   score < min_score then
+					min_score = score
+					min_score_ndx = i
+				end
 			end
 		end
 	end
 
-	return max_conns_ndx
+	return min_score_ndx
 end
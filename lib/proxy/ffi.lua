@@ -0,0 +1,129 @@
+--[[ $%BEGINLICENSE%$
+ Copyright (c) 2012, 2014, Oracle and/or its affiliates. All rights reserved.
+
+ This program is free software; you can redistribute it and/or
+ modify it under the terms of the GNU General Public License as
+ published by the Free Software Foundation; version 2 of the
+ License.
+
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ GNU General Public License for more details.
+
+ You should have received a copy of the GNU General Public License
+ along with this program; if not, write to the Free Software
+ Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA
+ 02110-1301  USA
+
+ $%ENDLICENSE%$ --]]
+
+---
+-- read-only views of the packet and the injection of the current hook
+--
+-- only available if the proxy is built against LuaJIT (--with-lua=luajit or
+-- -DWITH_LUAJIT=ON). The views read the data of the proxy in place, no Lua
+-- string is created unless string() is called.
+--
+--   local proxyffi = require("proxy.ffi")
+--
+--   function read_query(packet)
+--     local v = proxyffi.view(proxy.connection)
+--     if proxyffi.packet_has_prefix(v, "\003SELECT ") then ... end
+--   end
+--
+-- the view is only valid while the hook runs, don't keep it around
+
+local ffi = require("ffi")
+
+module("proxy.ffi", package.seeall)
+
+-- has to match network_mysqld_lua_ffi_view_t in network-mysqld-lua.h
+ffi.cdef[[
+typedef struct {
+	const char *packet;
+	size_t packet_len;
+	const char *query;
+	size_t query_len;
+	int injection_id;
+	uint64_t ts_read_query;
+	uint64_t ts_read_query_result_first;
+	uint64_t ts_read_query_result_last;
+	uint64_t rows;
+	uint64_t bytes;
+} network_mysqld_lua_ffi_view_t;
+
+int memcmp(const void *s1, const void *s2, size_t n);
+]]
+
+local view_ptr_t = ffi.typeof("const network_mysqld_lua_ffi_view_t *")
+
+---
+-- get the view of the current hook
+--
+-- @param connection proxy.connection
+-- @return a pointer to a network_mysqld_lua_ffi_view_t
+function view(connection)
+	return ffi.cast(view_ptr_t, connection.ffi_view)
+end
+
+---
+-- the command-byte of the packet in read_query()
+--
+-- @return the command or nil if there is no packet
+function command(v)
+	if v.packet == nil or v.packet_len == 0 then return nil end
+
+	return ffi.cast("const unsigned char *", v.packet)[0]
+end
+
+---
+-- the byte at a offset of the packet, starting at 0
+function packet_byte(v, ndx)
+	if v.packet == nil or ndx < 0 or ndx >= v.packet_len then return nil end
+
+	return ffi.cast("const unsigned char *", v.packet)[ndx]
+end
+
+local function has_prefix(s, s_len, prefix)
+	if s == nil or s_len < #prefix then return false end
+
+	return ffi.C.memcmp(s, prefix, #prefix) == 0
+end
+
+---
+-- check if the packet of read_query() starts with a string, case-sensitive
+function packet_has_prefix(v, prefix)
+	return has_prefix(v.packet, v.packet_len, prefix)
+end
+
+---
+-- check if the query of the injection in read_query_result() starts with a string
+function query_has_prefix(v, prefix)
+	return has_prefix(v.query, v.query_len, prefix)
+end
+
+---
+-- copy a part of the packet into a Lua string
+--
+-- @param ofs offset into the packet, starting at 0 (default: 0)
+-- @param len bytes to copy (default: up to the end)
+function packet_string(v, ofs, len)
+	if v.packet == nil then return nil end
+
+	ofs = ofs or 0
+	if ofs > v.packet_len then ofs = v.packet_len end
+	len = len or (v.packet_len - ofs)
+	if ofs + len > v.packet_len then len = v.packet_len - ofs end
+
+	return ffi.string(v.packet + ofs, len)
+end
+
+---
+-- the time the injection took in microseconds
+--
+-- @return the time until the first and until the last packet of the result
+function query_time(v)
+	return tonumber(v.ts_read_query_result_first - v.ts_read_query),
+	       tonumber(v.ts_read_query_result_last - v.ts_read_query)
+end
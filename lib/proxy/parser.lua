@@ -33,6 +33,9 @@ end
 ---
 -- extract the table-names from tokenized SQL token stream
 --
+-- tokenizer.get_refs() does the same in C on the cached tokens of a query and
+-- also returns the "column = constant" predicates of the WHERE clause
+--
 -- @see proxy.tokenize
 function get_tables(tokens)
 	local sql_stmt = nil
@@ -109,6 +109,45 @@ function tokenize(packet)
 	return tokenizer.tokenize(packet)
 end
 
+---
+-- get the first token that isn't a comment without tokenizing the whole query
+--
+-- @param query a SQL query
+-- @return token_name and text of the first token or nil
+function first_keyword(query)
+	return tokenizer.first_keyword(query)
+end
+
+---
+-- tokenize on demand
+--
+-- the tokens are only valid as long as the stream is referenced
+--
+-- @param query a SQL query
+-- @return a stream, call stream:next() to get the next token
+function tokenize_lazy(query)
+	return tokenizer.tokenize_lazy(query)
+end
+
+---
+-- normalize a query without tokenizing it in lua
+--
+-- @param query a SQL query
+-- @return the same string as normalize(tokenize(query)) and its 64bit hash as hex-string
+function fingerprint(query)
+	return tokenizer.fingerprint(query)
+end
+
+---
+-- call the included tokenizer through its statement cache
+--
+-- the tokens are shared with other connections and are read-only
+--
+-- @return the tokens and the statement type: "read", "write", "transaction" or "unknown"
+function tokenize_cached(packet)
+	return tokenizer.tokenize_cached(packet)
+end
+
 ---
 -- return the first command token
 --
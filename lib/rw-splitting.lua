@@ -220,11 +220,15 @@ function read_query( packet )
 	-- send all non-transactional SELECTs to a slave
 	if not is_in_transaction and
 	   cmd.type == proxy.COM_QUERY then
-		tokens     = tokens or assert(tokenizer.tokenize(cmd.query))
+		local stmt_type
+
+		-- most of the traffic is the same few statements, don't tokenize them again
+		tokens, stmt_type = tokenizer.tokenize_cached(cmd.query)
 
 		local stmt = tokenizer.first_stmt_token(tokens)
 
-		if stmt.token_name == "TK_SQL_SELECT" then
+		-- SELECT ... FOR UPDATE and friends are "write"
+		if stmt and stmt.token_name == "TK_SQL_SELECT" and stmt_type == "read" then
 			is_in_select_calc_found_rows = false
 			local is_insert_id = false
 
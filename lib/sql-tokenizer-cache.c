@@ -0,0 +1,295 @@
+/* $%BEGINLICENSE%$
+ Copyright (c) 2008, 2012, Oracle and/or its affiliates. All rights reserved.
+
+ This program is free software; you can redistribute it and/or
+ modify it under the terms of the GNU General Public License as
+ published by the Free Software Foundation; version 2 of the
+ License.
+
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ GNU General Public License for more details.
+
+ You should have received a copy of the GNU General Public License
+ along with this program; if not, write to the Free Software
+ Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA
+ 02110-1301  USA
+
+ $%ENDLICENSE%$ */
+#include "glib-ext.h"
+#include "sql-tokenizer.h"
+
+/**
+ * statements that are stored as TK_LITERAL and control transactions
+ */
+static const gchar *transaction_literals[] = {
+	"BEGIN",
+	"COMMIT",
+	"ROLLBACK",
+	"START",
+	"SAVEPOINT",
+	"XA",
+	NULL
+};
+
+/**
+ * get the next non-comment token starting at *ndx
+ */
+static sql_token *sql_tokens_next_stmt_token(GPtrArray *tokens, guint *ndx) {
+	for (; *ndx < tokens->len; (*ndx)++) {
+		sql_token *token = tokens->pdata[*ndx];
+
+		if (NULL == token) continue;
+		if (token->token_id == TK_COMMENT) continue;
+
+		(*ndx)++;
+		return token;
+	}
+
+	return NULL;
+}
+
+/**
+ * check if the SELECT takes locks or writes into files or variables
+ *
+ * - SELECT ... FOR UPDATE
+ * - SELECT ... LOCK IN SHARE MODE
+ * - SELECT ... INTO ...
+ */
+static gboolean sql_tokens_select_is_write(GPtrArray *tokens, guint ndx) {
+	sql_token *token;
+	gboolean last_was_for = FALSE;
+
+	while (NULL != (token = sql_tokens_next_stmt_token(tokens, &ndx))) {
+		switch (token->token_id) {
+		case TK_SQL_LOCK:
+		case TK_SQL_INTO:
+			return TRUE;
+		case TK_SQL_UPDATE:
+			if (last_was_for) return TRUE;
+			break;
+		default:
+			break;
+		}
+		last_was_for = (token->token_id == TK_SQL_FOR);
+	}
+
+	return FALSE;
+}
+
+sql_stmt_type_t sql_tokens_get_stmt_type(GPtrArray *tokens) {
+	sql_token *token;
+	guint ndx = 0;
+	guint i;
+
+	token = sql_tokens_next_stmt_token(tokens, &ndx);
+	if (NULL == token) return SQL_STMT_UNKNOWN;
+
+	switch (token->token_id) {
+	case TK_SQL_SELECT:
+		return sql_tokens_select_is_write(tokens, ndx) ? SQL_STMT_WRITE : SQL_STMT_READ;
+	case TK_SQL_SHOW:
+	case TK_SQL_DESCRIBE:
+	case TK_SQL_EXPLAIN:
+		return SQL_STMT_READ;
+	case TK_SQL_RELEASE: /* RELEASE SAVEPOINT */
+		return SQL_STMT_TRANSACTION;
+	case TK_SQL_SET:
+		/* SET autocommit = ... and SET TRANSACTION ... */
+		token = sql_tokens_next_stmt_token(tokens, &ndx);
+		if (NULL != token &&
+		    token->token_id == TK_LITERAL &&
+		    (0 == g_ascii_strcasecmp(token->text->str, "autocommit") ||
+		     0 == g_ascii_strcasecmp(token->text->str, "transaction"))) {
+			return SQL_STMT_TRANSACTION;
+		}
+		return SQL_STMT_WRITE;
+	case TK_LITERAL:
+		for (i = 0; transaction_literals[i]; i++) {
+			if (0 == g_ascii_strcasecmp(token->text->str, transaction_literals[i])) {
+				return SQL_STMT_TRANSACTION;
+			}
+		}
+		return SQL_STMT_WRITE;
+	default:
+		/* a version-comment or anything else we don't know might change data */
+		return SQL_STMT_WRITE;
+	}
+}
+
+const gchar *sql_stmt_type_get_name(sql_stmt_type_t stmt_type) {
+	switch (stmt_type) {
+	case SQL_STMT_READ:        return "read";
+	case SQL_STMT_WRITE:       return "write";
+	case SQL_STMT_TRANSACTION: return "transaction";
+	case SQL_STMT_UNKNOWN:     break;
+	}
+
+	return "unknown";
+}
+
+static sql_tokenizer_cache_entry_t *sql_tokenizer_cache_entry_new(const gchar *str, gsize len) {
+	sql_tokenizer_cache_entry_t *entry;
+
+	entry = g_new0(sql_tokenizer_cache_entry_t, 1);
+	entry->query = g_string_new_len(str, len);
+	entry->tokens = sql_tokens_new();
+	entry->ref_count = 1;
+
+	sql_tokenizer(entry->tokens, str, len);
+	entry->stmt_type = sql_tokens_get_stmt_type(entry->tokens);
+
+	return entry;
+}
+
+static void sql_tokenizer_cache_entry_free(sql_tokenizer_cache_entry_t *entry) {
+	if (!entry) return;
+
+	g_string_free(entry->query, TRUE);
+	sql_tokens_free(entry->tokens);
+	if (entry->refs) sql_tokens_refs_free(entry->refs);
+
+	g_free(entry);
+}
+
+sql_tokenizer_cache_t *sql_tokenizer_cache_new(guint max_entries) {
+	sql_tokenizer_cache_t *cache;
+
+	cache = g_new0(sql_tokenizer_cache_t, 1);
+	/* the keys are owned by the entries, the entries by the LRU list */
+	cache->entries = g_hash_table_new(g_hash_table_string_hash, g_hash_table_string_equal);
+	g_queue_init(&cache->lru);
+	cache->max_entries = max_entries;
+	cache->max_query_len = SQL_TOKENIZER_CACHE_MAX_QUERY_LEN;
+	cache->mutex = g_mutex_new();
+	chassis_lock_stats_init(&(cache->mutex_stats), "sql_tokenizer_cache");
+
+	return cache;
+}
+
+void sql_tokenizer_cache_free(sql_tokenizer_cache_t *cache) {
+	GList *l;
+
+	if (!cache) return;
+
+	g_hash_table_destroy(cache->entries);
+
+	while (NULL != (l = g_queue_pop_head_link(&cache->lru))) {
+		sql_tokenizer_cache_entry_t *entry = l->data;
+
+		/* entries that are still referenced are freed by the last unref() */
+		entry->link.data = NULL;
+		if (--entry->ref_count == 0) {
+			sql_tokenizer_cache_entry_free(entry);
+		}
+	}
+
+	chassis_lock_stats_unregister(&(cache->mutex_stats));
+	g_mutex_free(cache->mutex);
+
+	g_free(cache);
+}
+
+/**
+ * drop the least recently used entries until we are below max_entries
+ *
+ * @note has to be called with the cache->mutex held
+ */
+static void sql_tokenizer_cache_evict(sql_tokenizer_cache_t *cache) {
+	while (cache->lru.length > cache->max_entries) {
+		GList *l = g_queue_pop_tail_link(&cache->lru);
+		sql_tokenizer_cache_entry_t *entry = l->data;
+
+		g_hash_table_remove(cache->entries, entry->query);
+
+		entry->link.data = NULL;
+		if (--entry->ref_count == 0) {
+			sql_tokenizer_cache_entry_free(entry);
+		}
+	}
+}
+
+sql_tokenizer_cache_entry_t *sql_tokenizer_cache_get(sql_tokenizer_cache_t *cache, const gchar *str, gsize len) {
+	sql_tokenizer_cache_entry_t *entry;
+	GString key;
+
+	if (len > cache->max_query_len || cache->max_entries == 0) {
+		/* big INSERTs and friends would only push out the hot statements */
+		return sql_tokenizer_cache_entry_new(str, len);
+	}
+
+	key.str = (gchar *)str;
+	key.len = len;
+	key.allocated_len = 0;
+
+	chassis_lock_stats_mutex_lock(cache->mutex, &(cache->mutex_stats));
+	entry = g_hash_table_lookup(cache->entries, &key);
+	if (NULL != entry) {
+		/* move it to the front of the LRU */
+		g_queue_unlink(&cache->lru, &entry->link);
+		g_queue_push_head_link(&cache->lru, &entry->link);
+
+		entry->ref_count++;
+		cache->hits++;
+		chassis_lock_stats_mutex_unlock(cache->mutex, &(cache->mutex_stats));
+
+		return entry;
+	}
+	cache->misses++;
+	chassis_lock_stats_mutex_unlock(cache->mutex, &(cache->mutex_stats));
+
+	/* tokenize outside of our lock */
+	entry = sql_tokenizer_cache_entry_new(str, len);
+
+	chassis_lock_stats_mutex_lock(cache->mutex, &(cache->mutex_stats));
+	if (NULL == g_hash_table_lookup(cache->entries, entry->query)) {
+		entry->link.data = entry;
+		entry->ref_count++; /* one ref for the cache, one for the caller */
+
+		g_hash_table_insert(cache->entries, entry->query, entry);
+		g_queue_push_head_link(&cache->lru, &entry->link);
+
+		sql_tokenizer_cache_evict(cache);
+	}
+	/* otherwise another thread was faster and our entry stays uncached */
+	chassis_lock_stats_mutex_unlock(cache->mutex, &(cache->mutex_stats));
+
+	return entry;
+}
+
+void sql_tokenizer_cache_entry_unref(sql_tokenizer_cache_t *cache, sql_tokenizer_cache_entry_t *entry) {
+	gboolean do_free;
+
+	chassis_lock_stats_mutex_lock(cache->mutex, &(cache->mutex_stats));
+	do_free = (--entry->ref_count == 0);
+	chassis_lock_stats_mutex_unlock(cache->mutex, &(cache->mutex_stats));
+
+	if (do_free) sql_tokenizer_cache_entry_free(entry);
+}
+
+const sql_tokens_refs_t *sql_tokenizer_cache_get_refs(sql_tokenizer_cache_t *cache, sql_tokenizer_cache_entry_t *entry) {
+	sql_tokens_refs_t *refs;
+
+	chassis_lock_stats_mutex_lock(cache->mutex, &(cache->mutex_stats));
+	refs = entry->refs;
+	chassis_lock_stats_mutex_unlock(cache->mutex, &(cache->mutex_stats));
+
+	if (NULL != refs) return refs;
+
+	/* extract outside of our lock, the tokens are read-only */
+	refs = sql_tokens_refs_new();
+	sql_tokens_get_refs(entry->tokens, refs);
+
+	chassis_lock_stats_mutex_lock(cache->mutex, &(cache->mutex_stats));
+	if (NULL == entry->refs) {
+		entry->refs = refs;
+		refs = NULL;
+	}
+	/* otherwise another thread was faster */
+	chassis_lock_stats_mutex_unlock(cache->mutex, &(cache->mutex_stats));
+
+	if (refs) sql_tokens_refs_free(refs);
+
+	return entry->refs;
+}
@@ -0,0 +1,187 @@
+/* $%BEGINLICENSE%$
+ Copyright (c) 2008, 2012, Oracle and/or its affiliates. All rights reserved.
+
+ This program is free software; you can redistribute it and/or
+ modify it under the terms of the GNU General Public License as
+ published by the Free Software Foundation; version 2 of the
+ License.
+
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ GNU General Public License for more details.
+
+ You should have received a copy of the GNU General Public License
+ along with this program; if not, write to the Free Software
+ Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA
+ 02110-1301  USA
+
+ $%ENDLICENSE%$ */
+#include "glib-ext.h"
+#include "sql-tokenizer.h"
+
+#define C(x) x, sizeof(x) - 1
+#define S(x) x->str, x->len
+
+#define FNV1A_64_INIT  G_GUINT64_CONSTANT(14695981039346656037)
+#define FNV1A_64_PRIME G_GUINT64_CONSTANT(1099511628211)
+
+/**
+ * state of the normalizer
+ *
+ * the scanner sends strings and comments in pieces, we keep the
+ * current token until the next one starts
+ */
+typedef struct {
+	GString *dst;
+	guint64 hash;
+
+	gboolean has_pending;
+	sql_token_id pending_id;
+	GString *pending;
+
+	guint normalized_tokens;   /**< tokens written to dst so far, comments don't count */
+	gboolean first_is_start;   /**< the query starts with START, uppercase a following TRANSACTION */
+} sql_fingerprint_t;
+
+static void sql_fingerprint_append(sql_fingerprint_t *fp, const gchar *text, gsize text_len) {
+	gsize i;
+
+	for (i = 0; i < text_len; i++) {
+		fp->hash ^= (guchar)text[i];
+		fp->hash *= FNV1A_64_PRIME;
+	}
+
+	g_string_append_len(fp->dst, text, text_len);
+}
+
+static void sql_fingerprint_append_upper(sql_fingerprint_t *fp, const gchar *text, gsize text_len) {
+	gsize i;
+
+	for (i = 0; i < text_len; i++) {
+		gchar c = g_ascii_toupper(text[i]);
+
+		fp->hash ^= (guchar)c;
+		fp->hash *= FNV1A_64_PRIME;
+
+		g_string_append_c(fp->dst, c);
+	}
+}
+
+/**
+ * literals that are SQL commands if they appear at the start
+ */
+static gboolean sql_fingerprint_is_literal_keyword(GString *text) {
+	return (0 == g_ascii_strcasecmp(text->str, "COMMIT") ||
+		0 == g_ascii_strcasecmp(text->str, "ROLLBACK") ||
+		0 == g_ascii_strcasecmp(text->str, "BEGIN") ||
+		0 == g_ascii_strcasecmp(text->str, "START"));
+}
+
+/**
+ * write the pending token in its normalized form
+ */
+static void sql_fingerprint_flush(sql_fingerprint_t *fp) {
+	GString *text = fp->pending;
+
+	if (!fp->has_pending) return;
+	fp->has_pending = FALSE;
+
+	switch (fp->pending_id) {
+	case TK_COMMENT:
+		return;
+	case TK_COMMENT_MYSQL:
+		/* we don't know the server-version, pass it on verbatimly */
+		sql_fingerprint_append(fp, C("/*!"));
+		sql_fingerprint_append(fp, S(text));
+		sql_fingerprint_append(fp, C("*/ "));
+		break;
+	case TK_LITERAL:
+		if (text->len > 0 && text->str[0] == '@') {
+			/* session variables stay as they are */
+			sql_fingerprint_append(fp, S(text));
+		} else if (fp->normalized_tokens == 0 && sql_fingerprint_is_literal_keyword(text)) {
+			fp->first_is_start = (0 == g_ascii_strcasecmp(text->str, "START"));
+			sql_fingerprint_append_upper(fp, S(text));
+		} else if (fp->normalized_tokens == 1 && fp->first_is_start &&
+		           0 == g_ascii_strcasecmp(text->str, "TRANSACTION")) {
+			sql_fingerprint_append_upper(fp, S(text));
+		} else {
+			sql_fingerprint_append(fp, C("`"));
+			sql_fingerprint_append(fp, S(text));
+			sql_fingerprint_append(fp, C("`"));
+		}
+		sql_fingerprint_append(fp, C(" "));
+		break;
+	case TK_STRING:
+	case TK_INTEGER:
+	case TK_FLOAT:
+		sql_fingerprint_append(fp, C("? "));
+		break;
+	case TK_FUNCTION:
+		/* the ( follows without a space */
+		sql_fingerprint_append_upper(fp, S(text));
+		break;
+	default:
+		sql_fingerprint_append_upper(fp, S(text));
+		sql_fingerprint_append(fp, C(" "));
+		break;
+	}
+
+	fp->normalized_tokens++;
+}
+
+static void sql_fingerprint_sink_append(sql_tokenizer_sink_t *sink, sql_token_id token_id, const gchar *text, gsize text_len) {
+	sql_fingerprint_t *fp = sink->udata;
+
+	sql_fingerprint_flush(fp);
+
+	fp->has_pending = TRUE;
+	fp->pending_id = token_id;
+	g_string_assign_len(fp->pending, text, text_len);
+}
+
+static void sql_fingerprint_sink_append_last(sql_tokenizer_sink_t *sink, sql_token_id token_id, const gchar *text, gsize text_len) {
+	sql_fingerprint_t *fp = sink->udata;
+
+	g_assert(fp->has_pending);
+	g_assert(fp->pending_id == token_id);
+
+	switch (token_id) {
+	case TK_STRING:
+	case TK_COMMENT:
+		/* their content doesn't end up in the fingerprint */
+		break;
+	default:
+		g_string_append_len(fp->pending, text, text_len);
+		break;
+	}
+}
+
+int sql_tokenizer_fingerprint(GString *dst, guint64 *hash, const gchar *str, gsize len) {
+	sql_tokenizer_sink_t sink;
+	sql_fingerprint_t fp;
+	int ret;
+
+	fp.dst = dst;
+	fp.hash = FNV1A_64_INIT;
+	fp.has_pending = FALSE;
+	fp.pending_id = TK_UNKNOWN;
+	fp.pending = g_string_sized_new(64);
+	fp.normalized_tokens = 0;
+	fp.first_is_start = FALSE;
+
+	sink.append = sql_fingerprint_sink_append;
+	sink.append_last = sql_fingerprint_sink_append_last;
+	sink.pause = FALSE;
+	sink.udata = &fp;
+
+	ret = sql_tokenizer_scan(&sink, str, len);
+	sql_fingerprint_flush(&fp);
+
+	g_string_free(fp.pending, TRUE);
+
+	if (hash) *hash = fp.hash;
+
+	return ret;
+}
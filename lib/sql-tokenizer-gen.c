@@ -23,25 +23,142 @@
 #include <string.h>
 
 #include "sql-tokenizer.h"
+#include "sql-tokenizer-keywords.h"
+
+/**
+ * give up if a bucket doesn't find free slots with this many displacements
+ */
+#define MAX_DISPLACEMENT (1 << 24)
+
+typedef struct {
+	const char *name;
+	gsize name_len;
+	gint id;
+	guint32 hash;
+} keyword;
+
+typedef struct {
+	guint ndx;
+	GPtrArray *keywords;
+} bucket;
 
 gboolean trav(gpointer _a, gpointer _b, gpointer _udata) {
-	gboolean *is_first = _udata;
-	const char *key = _a;
-	gint value = GPOINTER_TO_INT(_b);
+	GArray *keywords = _udata;
+	keyword kw;
 
-	if (!*is_first) {
-		printf(",");
-	}
-	printf("\n\t%d /* %s */", value, key);
+	kw.name = _a;
+	kw.name_len = strlen(kw.name);
+	kw.id = GPOINTER_TO_INT(_b);
+	kw.hash = sql_keywords_hash(kw.name, kw.name_len);
+
+	g_array_append_val(keywords, kw);
 
-	*is_first = FALSE;
 	return FALSE;
 }
 
+static int bucket_cmp(gconstpointer _a, gconstpointer _b) {
+	const bucket *a = _a;
+	const bucket *b = _b;
+
+	/* the largest buckets first, they are the hardest to place */
+	if (a->keywords->len != b->keywords->len) return (int)b->keywords->len - (int)a->keywords->len;
+
+	return (int)a->ndx - (int)b->ndx;
+}
+
+/**
+ * build a minimal perfect hash with hash-and-displace
+ *
+ * the keywords are split into buckets by their hash. For each bucket, starting with the
+ * largest, search the displacement that moves all its keywords into free slots.
+ *
+ * @param slots         the keyword for each of the keywords->len slots
+ * @param displacements the displacement for each of the n_buckets buckets
+ */
+static void perfect_hash_build(GArray *keywords, keyword **slots, guint32 *displacements, guint n_buckets) {
+	bucket *buckets;
+	guint32 *bucket_slots;
+	guint n = keywords->len;
+	guint i, j, k;
+
+	buckets = g_new0(bucket, n_buckets);
+	for (i = 0; i < n_buckets; i++) {
+		buckets[i].ndx = i;
+		buckets[i].keywords = g_ptr_array_new();
+		displacements[i] = 0;
+	}
+
+	for (i = 0; i < n; i++) {
+		keyword *kw = &g_array_index(keywords, keyword, i);
+		bucket *b = &buckets[kw->hash % n_buckets];
+
+		for (j = 0; j < b->keywords->len; j++) {
+			keyword *other = b->keywords->pdata[j];
+
+			/* the same hash would end up in the same slot for all displacements */
+			if (other->hash == kw->hash) {
+				g_error("%s: %s and %s have the same hash", G_STRLOC, kw->name, other->name);
+			}
+		}
+
+		g_ptr_array_add(b->keywords, kw);
+		slots[i] = NULL;
+	}
+
+	qsort(buckets, n_buckets, sizeof(bucket), bucket_cmp);
+
+	bucket_slots = g_new0(guint32, n);
+
+	for (i = 0; i < n_buckets; i++) {
+		bucket *b = &buckets[i];
+		guint32 d;
+
+		if (b->keywords->len == 0) break; /* the rest is empty too */
+
+		for (d = 0; d < MAX_DISPLACEMENT; d++) {
+			gboolean is_free = TRUE;
+
+			for (j = 0; is_free && j < b->keywords->len; j++) {
+				keyword *kw = b->keywords->pdata[j];
+
+				bucket_slots[j] = sql_keywords_hash_slot(kw->hash, d, n);
+
+				if (NULL != slots[bucket_slots[j]]) is_free = FALSE;
+
+				/* two keywords of the bucket in the same slot */
+				for (k = 0; is_free && k < j; k++) {
+					if (bucket_slots[k] == bucket_slots[j]) is_free = FALSE;
+				}
+			}
+
+			if (is_free) break;
+		}
+
+		if (d == MAX_DISPLACEMENT) {
+			g_error("%s: found no displacement for bucket %u", G_STRLOC, b->ndx);
+		}
+
+		for (j = 0; j < b->keywords->len; j++) {
+			slots[bucket_slots[j]] = b->keywords->pdata[j];
+		}
+		displacements[b->ndx] = d;
+	}
+
+	for (i = 0; i < n_buckets; i++) {
+		g_ptr_array_free(buckets[i].keywords, TRUE);
+	}
+	g_free(buckets);
+	g_free(bucket_slots);
+}
+
 int main() {
 	GTree *tokens;
-	gboolean is_first = TRUE;
-	gint i;
+	GArray *keywords;
+	keyword **slots;
+	guint32 *displacements;
+	guint n_buckets;
+	gsize max_len = 0;
+	guint i;
 
 	tokens = g_tree_new((GCompareFunc)g_ascii_strcasecmp);
 
@@ -52,14 +169,63 @@ int main() {
 		g_tree_insert(tokens, (sql_token_get_name(i, NULL) + sizeof("TK_SQL_") - 1), GINT_TO_POINTER(i));
 	}
 
-	/* traverse the tree and output all keywords in a sorted way */
+	/* traverse the tree to get all keywords in a sorted way */
+	keywords = g_array_new(FALSE, FALSE, sizeof(keyword));
+	g_tree_foreach(tokens, trav, keywords);
+
+	/* 2 keywords per bucket on average */
+	n_buckets = MAX(keywords->len / 2, 1);
+	slots = g_new0(keyword *, keywords->len);
+	displacements = g_new0(guint32, n_buckets);
+
+	perfect_hash_build(keywords, slots, displacements, n_buckets);
+
+	printf("#include \"sql-tokenizer.h\"\n");
+	printf("#include \"sql-tokenizer-keywords.h\"\n\n");
+
 	printf("static int sql_keywords[] = {");
-	g_tree_foreach(tokens, trav, &is_first);
+	for (i = 0; i < keywords->len; i++) {
+		keyword *kw = &g_array_index(keywords, keyword, i);
+
+		printf("%s\n\t%d /* %s */", i == 0 ? "" : ",", kw->id, kw->name);
+
+		max_len = MAX(max_len, kw->name_len);
+	}
+	printf("\n};\n");
+
+	printf("static const guint32 sql_keywords_displacements[] = {");
+	for (i = 0; i < n_buckets; i++) {
+		printf("%s%s%u", i == 0 ? "" : ",", i % 16 == 0 ? "\n\t" : " ", displacements[i]);
+	}
+	printf("\n};\n");
+
+	printf("static const int sql_keywords_slots[] = {");
+	for (i = 0; i < keywords->len; i++) {
+		printf("%s\n\t%d /* %s */", i == 0 ? "" : ",", slots[i]->id, slots[i]->name);
+	}
 	printf("\n};\n");
 
 	printf("int *sql_keywords_get() { return sql_keywords; }\n");
 	printf("int sql_keywords_get_count() { return sizeof(sql_keywords) / sizeof(sql_keywords[0]); }\n");
 
+	/* the lookup: hash, displace, compare the keyword of the slot */
+	printf("int sql_keywords_lookup(const char *name, gsize name_len) {\n");
+	printf("\tguint32 h;\n");
+	printf("\tint id;\n");
+	printf("\tconst char *keyword;\n");
+	printf("\tsize_t keyword_len;\n\n");
+	printf("\tif (name_len > %"G_GSIZE_FORMAT") return -1;\n\n", max_len);
+	printf("\th = sql_keywords_hash(name, name_len);\n");
+	printf("\tid = sql_keywords_slots[sql_keywords_hash_slot(h, sql_keywords_displacements[h %% %u], %u)];\n\n", n_buckets, keywords->len);
+	printf("\tkeyword = sql_token_get_name(id, &keyword_len) + sizeof(\"TK_SQL_\") - 1;\n");
+	printf("\tkeyword_len -= sizeof(\"TK_SQL_\") - 1;\n\n");
+	printf("\tif (keyword_len != name_len || 0 != g_ascii_strncasecmp(keyword, name, name_len)) return -1;\n\n");
+	printf("\treturn id;\n");
+	printf("}\n");
+
+	g_free(slots);
+	g_free(displacements);
+	g_array_free(keywords, TRUE);
 	g_tree_destroy(tokens);
 
 	return 0;
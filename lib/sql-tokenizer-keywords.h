@@ -20,7 +20,13 @@
 #ifndef __SQL_TOKENIZER_KEYWORDS_H__
 #define __SQL_TOKENIZER_KEYWORDS_H__
 
+#include <glib.h>
+
 int *sql_keywords_get(void);
 int sql_keywords_get_count(void);
+int sql_keywords_lookup(const char *name, gsize name_len);
+
+guint32 sql_keywords_hash(const char *name, gsize name_len);
+guint32 sql_keywords_hash_slot(guint32 hash, guint32 displacement, guint32 slots);
 
 #endif
@@ -172,6 +172,342 @@ int proxy_tokenize(lua_State *L) {
 	return 1;
 }
 
+/**
+ * the process-wide statement cache
+ *
+ * shared by all lua-states that load this module
+ */
+static sql_tokenizer_cache_t *tokenizer_cache = NULL;
+
+static sql_tokenizer_cache_t *proxy_tokenize_get_cache(void) {
+	static GStaticMutex mutex = G_STATIC_MUTEX_INIT;
+
+	g_static_mutex_lock(&mutex);
+	if (NULL == tokenizer_cache) {
+		tokenizer_cache = sql_tokenizer_cache_new(SQL_TOKENIZER_CACHE_MAX_ENTRIES);
+	}
+	g_static_mutex_unlock(&mutex);
+
+	return tokenizer_cache;
+}
+
+/**
+ * the userdata of a cached token-stream
+ *
+ * the tokens have to be first to share the settors with the uncached tokens
+ */
+typedef struct {
+	GPtrArray *tokens;
+
+	sql_tokenizer_cache_entry_t *entry;
+} proxy_tokenize_cached_t;
+
+static int proxy_tokenize_cached_set(lua_State *L) {
+	luaL_checkself(L);
+
+	return luaL_error(L, "cached tokens are read-only");
+}
+
+static int proxy_tokenize_cached_gc(lua_State *L) {
+	proxy_tokenize_cached_t *cached = luaL_checkself(L);
+
+	sql_tokenizer_cache_entry_unref(tokenizer_cache, cached->entry);
+
+	return 0;
+}
+
+static int sql_tokenizer_lua_cached_getmetatable(lua_State *L) {
+	static const struct luaL_reg methods[] = {
+		{ "__index", proxy_tokenize_get },
+		{ "__newindex", proxy_tokenize_cached_set },
+		{ "__len",   proxy_tokenize_len },
+		{ "__gc",   proxy_tokenize_cached_gc },
+		{ NULL, NULL },
+	};
+	return proxy_getmetatable(L, methods);
+}
+
+/**
+ * split the SQL query into a stream of tokens, reuse the tokens of earlier calls
+ *
+ * @return the (read-only) tokens and the statement type ("read", "write", "transaction" or "unknown")
+ */
+static int proxy_tokenize_cached(lua_State *L) {
+	size_t str_len;
+	const char *str = luaL_checklstring(L, 1, &str_len);
+	sql_tokenizer_cache_t *cache = proxy_tokenize_get_cache();
+	proxy_tokenize_cached_t *cached;
+
+	cached = lua_newuserdata(L, sizeof(*cached));                          /* (sp += 1) */
+	cached->entry = sql_tokenizer_cache_get(cache, str, str_len);
+	cached->tokens = cached->entry->tokens;
+
+	sql_tokenizer_lua_cached_getmetatable(L);
+	lua_setmetatable(L, -2);          /* tie the metatable to the udata   (sp -= 1) */
+
+	lua_pushstring(L, sql_stmt_type_get_name(cached->entry->stmt_type));
+
+	return 2;
+}
+
+/**
+ * expose the hit-rate of the statement cache
+ */
+static int proxy_tokenize_cache_stats(lua_State *L) {
+	sql_tokenizer_cache_t *cache = proxy_tokenize_get_cache();
+
+	lua_newtable(L);
+
+	g_mutex_lock(cache->mutex);
+	lua_pushinteger(L, cache->hits);
+	lua_setfield(L, -2, "hits");
+	lua_pushinteger(L, cache->misses);
+	lua_setfield(L, -2, "misses");
+	lua_pushinteger(L, cache->lru.length);
+	lua_setfield(L, -2, "entries");
+	lua_pushinteger(L, cache->max_entries);
+	lua_setfield(L, -2, "max_entries");
+	g_mutex_unlock(cache->mutex);
+
+	return 1;
+}
+
+/**
+ * set t[key] = str if str isn't NULL
+ */
+static void proxy_tokenize_set_gstring(lua_State *L, const char *key, GString *str) {
+	if (NULL == str) return;
+
+	lua_pushlstring(L, S(str));
+	lua_setfield(L, -2, key);
+}
+
+/**
+ * get the tables and the equality predicates of a query
+ *
+ * the query is tokenized through the statement cache and its refs are extracted once
+ *
+ *   {
+ *     stmt_type  = "read",
+ *     tables     = { { db = "db", name = "tbl", alias = "t", access = "read" }, ... },
+ *     predicates = { { qualifier = "t", column = "id", value = "1", token_name = "TK_INTEGER" }, ... }
+ *   }
+ *
+ * @return a table with the refs, a copy of the cached refs
+ */
+static int proxy_tokenize_get_refs(lua_State *L) {
+	size_t str_len;
+	const char *str = luaL_checklstring(L, 1, &str_len);
+	sql_tokenizer_cache_t *cache = proxy_tokenize_get_cache();
+	sql_tokenizer_cache_entry_t *entry;
+	const sql_tokens_refs_t *refs;
+	guint i;
+
+	entry = sql_tokenizer_cache_get(cache, str, str_len);
+	refs = sql_tokenizer_cache_get_refs(cache, entry);
+
+	lua_newtable(L);
+
+	lua_pushstring(L, sql_stmt_type_get_name(entry->stmt_type));
+	lua_setfield(L, -2, "stmt_type");
+
+	lua_createtable(L, refs->tables->len, 0);
+	for (i = 0; i < refs->tables->len; i++) {
+		sql_table_ref_t *ref = refs->tables->pdata[i];
+
+		lua_createtable(L, 0, 4);
+		proxy_tokenize_set_gstring(L, "db", ref->db);
+		proxy_tokenize_set_gstring(L, "name", ref->name);
+		proxy_tokenize_set_gstring(L, "alias", ref->alias);
+		lua_pushstring(L, ref->is_write ? "write" : "read");
+		lua_setfield(L, -2, "access");
+
+		lua_rawseti(L, -2, i + 1);
+	}
+	lua_setfield(L, -2, "tables");
+
+	lua_createtable(L, refs->predicates->len, 0);
+	for (i = 0; i < refs->predicates->len; i++) {
+		sql_predicate_t *pred = refs->predicates->pdata[i];
+		size_t token_name_len;
+		const char *token_name;
+
+		lua_createtable(L, 0, 4);
+		proxy_tokenize_set_gstring(L, "qualifier", pred->qualifier);
+		proxy_tokenize_set_gstring(L, "column", pred->column);
+		proxy_tokenize_set_gstring(L, "value", pred->value);
+		token_name = sql_token_get_name(pred->value_token_id, &token_name_len);
+		lua_pushlstring(L, token_name, token_name_len);
+		lua_setfield(L, -2, "token_name");
+
+		lua_rawseti(L, -2, i + 1);
+	}
+	lua_setfield(L, -2, "predicates");
+
+	sql_tokenizer_cache_entry_unref(cache, entry);
+
+	return 1;
+}
+
+static int sql_tokenizer_lua_stream_getmetatable(lua_State *L);
+
+/**
+ * push a token of the stream at index stream_ndx
+ *
+ * the token is owned by the stream: the env of the token's udata references the stream
+ * to keep it from being collected while the token is used
+ */
+static void proxy_tokenize_push_token(lua_State *L, int stream_ndx, sql_token *token) {
+	sql_token **token_p;
+
+	token_p = lua_newuserdata(L, sizeof(token));                          /* (sp += 1) */
+	*token_p = token;
+
+	sql_tokenizer_lua_token_getmetatable(L);
+	lua_setmetatable(L, -2);             /* tie the metatable to the udata   (sp -= 1) */
+
+	lua_createtable(L, 1, 0);                                             /* (sp += 1) */
+	lua_pushvalue(L, stream_ndx);                                         /* (sp += 1) */
+	lua_rawseti(L, -2, 1);                                                /* (sp -= 1) */
+	lua_setfenv(L, -2);                  /* anchor the stream in the udata   (sp -= 1) */
+}
+
+/**
+ * get the next token of a stream
+ *
+ * the token keeps the stream alive, see proxy_tokenize_push_token()
+ */
+static int proxy_tokenize_stream_next(lua_State *L) {
+	sql_tokenizer_stream_t *stream = *(sql_tokenizer_stream_t **)luaL_checkself(L);
+	sql_token *token;
+
+	token = sql_tokenizer_stream_next(stream);
+	if (NULL == token) {
+		lua_pushnil(L);
+
+		return 1;
+	}
+
+	proxy_tokenize_push_token(L, 1, token);
+
+	return 1;
+}
+
+static int proxy_tokenize_stream_get(lua_State *L) {
+	size_t keysize;
+	const char *key = luaL_checklstring(L, 2, &keysize);
+
+	if (strleq(key, keysize, C("next"))) {
+		lua_pushcfunction(L, proxy_tokenize_stream_next);
+		return 1;
+	}
+
+	return luaL_error(L, "tokens has no %s field", key);
+}
+
+static int proxy_tokenize_stream_gc(lua_State *L) {
+	sql_tokenizer_stream_t *stream = *(sql_tokenizer_stream_t **)luaL_checkself(L);
+
+	sql_tokenizer_stream_free(stream);
+
+	return 0;
+}
+
+static int sql_tokenizer_lua_stream_getmetatable(lua_State *L) {
+	static const struct luaL_reg methods[] = {
+		{ "__index", proxy_tokenize_stream_get },
+		{ "__gc",   proxy_tokenize_stream_gc },
+		{ NULL, NULL },
+	};
+	return proxy_getmetatable(L, methods);
+}
+
+/**
+ * split the SQL query into tokens on demand
+ *
+ * @return a stream with a :next() method
+ */
+static int proxy_tokenize_lazy(lua_State *L) {
+	size_t str_len;
+	const char *str = luaL_checklstring(L, 1, &str_len);
+	sql_tokenizer_stream_t **stream_p;
+
+	stream_p = lua_newuserdata(L, sizeof(*stream_p));                          /* (sp += 1) */
+	*stream_p = sql_tokenizer_stream_new(str, str_len);
+	if (NULL == *stream_p) {
+		return luaL_error(L, "%s: creating the scanner failed", G_STRLOC);
+	}
+
+	sql_tokenizer_lua_stream_getmetatable(L);
+	lua_setmetatable(L, -2);          /* tie the metatable to the udata   (sp -= 1) */
+
+	return 1;
+}
+
+/**
+ * get the first token that isn't a comment
+ *
+ * only scans the start of the query
+ *
+ * @return token_name and text of the token, or nil
+ */
+static int proxy_tokenize_first_keyword(lua_State *L) {
+	size_t str_len;
+	const char *str = luaL_checklstring(L, 1, &str_len);
+	sql_tokenizer_stream_t *stream;
+	sql_token *token;
+
+	stream = sql_tokenizer_stream_new(str, str_len);
+	if (NULL == stream) {
+		return luaL_error(L, "%s: creating the scanner failed", G_STRLOC);
+	}
+
+	while (NULL != (token = sql_tokenizer_stream_next(stream))) {
+		size_t token_name_len;
+		const char *token_name;
+
+		if (token->token_id == TK_COMMENT) continue;
+
+		token_name = sql_token_get_name(token->token_id, &token_name_len);
+		lua_pushlstring(L, token_name, token_name_len);
+		lua_pushlstring(L, S(token->text));
+
+		sql_tokenizer_stream_free(stream);
+
+		return 2;
+	}
+
+	sql_tokenizer_stream_free(stream);
+
+	lua_pushnil(L);
+
+	return 1;
+}
+
+/**
+ * normalize a query without building the tokens
+ *
+ * @return the normalized query and its 64bit hash as hex-string
+ */
+static int proxy_tokenize_fingerprint(lua_State *L) {
+	size_t str_len;
+	const char *str = luaL_checklstring(L, 1, &str_len);
+	GString *norm_query = g_string_sized_new(str_len + 16);
+	guint64 hash;
+	gchar hash_str[sizeof("0123456789abcdef")];
+
+	sql_tokenizer_fingerprint(norm_query, &hash, str, str_len);
+
+	g_snprintf(hash_str, sizeof(hash_str), "%016"G_GINT64_MODIFIER"x", hash);
+
+	lua_pushlstring(L, S(norm_query));
+	lua_pushstring(L, hash_str);
+
+	g_string_free(norm_query, TRUE);
+
+	return 2;
+}
+
 /*
 ** Assumes the table is on top of the stack.
 */
@@ -190,6 +526,12 @@ static void set_info (lua_State *L) {
 
 static const struct luaL_reg mysql_tokenizerlib[] = {
 	{"tokenize", proxy_tokenize},
+	{"tokenize_cached", proxy_tokenize_cached},
+	{"cache_stats", proxy_tokenize_cache_stats},
+	{"get_refs", proxy_tokenize_get_refs},
+	{"fingerprint", proxy_tokenize_fingerprint},
+	{"tokenize_lazy", proxy_tokenize_lazy},
+	{"first_keyword", proxy_tokenize_first_keyword},
 	{NULL, NULL},
 };
 
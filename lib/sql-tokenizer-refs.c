@@ -0,0 +1,457 @@
+/* $%BEGINLICENSE%$
+ Copyright (c) 2008, 2012, Oracle and/or its affiliates. All rights reserved.
+
+ This program is free software; you can redistribute it and/or
+ modify it under the terms of the GNU General Public License as
+ published by the Free Software Foundation; version 2 of the
+ License.
+
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ GNU General Public License for more details.
+
+ You should have received a copy of the GNU General Public License
+ along with this program; if not, write to the Free Software
+ Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA
+ 02110-1301  USA
+
+ $%ENDLICENSE%$ */
+/**
+ * the tables and the equality predicates of a statement
+ *
+ * a single pass over the tokens like lib/proxy/parser.lua does it in lua. It doesn't parse
+ * SQL, it looks for the places where table-names appear:
+ *
+ * - after FROM, JOIN, INTO, UPDATE and TABLE and after the commas of such a table-list
+ * - "<db>.<tbl>" is one table, a alias after the table-name is skipped
+ *
+ * the tables of the target of a INSERT, REPLACE, UPDATE, DELETE or DDL statement are
+ * written, the others (including the ones in sub-queries) are read.
+ *
+ * the predicates are the "[<qualifier>.]<column> = <constant>" of the top-level WHERE clause.
+ * As soon as the WHERE clause has a OR the predicates don't restrict the rows and none are
+ * returned.
+ */
+
+#include "glib-ext.h"
+#include "sql-tokenizer.h"
+
+sql_table_ref_t *sql_table_ref_new(void) {
+	sql_table_ref_t *ref;
+
+	ref = g_new0(sql_table_ref_t, 1);
+	ref->name = g_string_new(NULL);
+
+	return ref;
+}
+
+void sql_table_ref_free(sql_table_ref_t *ref) {
+	if (!ref) return;
+
+	if (ref->db) g_string_free(ref->db, TRUE);
+	g_string_free(ref->name, TRUE);
+	if (ref->alias) g_string_free(ref->alias, TRUE);
+
+	g_free(ref);
+}
+
+sql_predicate_t *sql_predicate_new(void) {
+	sql_predicate_t *pred;
+
+	pred = g_new0(sql_predicate_t, 1);
+	pred->column = g_string_new(NULL);
+	pred->value = g_string_new(NULL);
+
+	return pred;
+}
+
+void sql_predicate_free(sql_predicate_t *pred) {
+	if (!pred) return;
+
+	if (pred->qualifier) g_string_free(pred->qualifier, TRUE);
+	g_string_free(pred->column, TRUE);
+	g_string_free(pred->value, TRUE);
+
+	g_free(pred);
+}
+
+sql_tokens_refs_t *sql_tokens_refs_new(void) {
+	sql_tokens_refs_t *refs;
+
+	refs = g_new0(sql_tokens_refs_t, 1);
+	refs->tables = g_ptr_array_new();
+	refs->predicates = g_ptr_array_new();
+
+	return refs;
+}
+
+static void sql_tokens_refs_clear_predicates(sql_tokens_refs_t *refs) {
+	guint i;
+
+	for (i = 0; i < refs->predicates->len; i++) {
+		sql_predicate_free(refs->predicates->pdata[i]);
+	}
+	g_ptr_array_set_size(refs->predicates, 0);
+}
+
+void sql_tokens_refs_free(sql_tokens_refs_t *refs) {
+	guint i;
+
+	if (!refs) return;
+
+	for (i = 0; i < refs->tables->len; i++) {
+		sql_table_ref_free(refs->tables->pdata[i]);
+	}
+	g_ptr_array_free(refs->tables, TRUE);
+
+	sql_tokens_refs_clear_predicates(refs);
+	g_ptr_array_free(refs->predicates, TRUE);
+
+	g_free(refs);
+}
+
+/**
+ * get the token at ndx, skip the comments
+ *
+ * @return the token or NULL at the end of the tokens
+ */
+static sql_token *sql_tokens_peek(GPtrArray *tokens, guint *ndx) {
+	for (; *ndx < tokens->len; (*ndx)++) {
+		sql_token *token = tokens->pdata[*ndx];
+
+		if (NULL == token) continue;
+		if (token->token_id == TK_COMMENT) continue;
+
+		return token;
+	}
+
+	return NULL;
+}
+
+static sql_token_id sql_tokens_peek_id(GPtrArray *tokens, guint ndx) {
+	sql_token *token = sql_tokens_peek(tokens, &ndx);
+
+	return token ? token->token_id : TK_UNKNOWN;
+}
+
+/**
+ * the tokens that may follow a table-name in the table-list
+ */
+static gboolean sql_token_continues_table_list(sql_token_id token_id) {
+	switch (token_id) {
+	case TK_COMMA:
+	case TK_SQL_JOIN:
+	case TK_SQL_STRAIGHT_JOIN:
+	case TK_SQL_INNER:
+	case TK_SQL_CROSS:
+	case TK_SQL_LEFT:
+	case TK_SQL_RIGHT:
+	case TK_SQL_OUTER:
+	case TK_SQL_NATURAL:
+		return TRUE;
+	default:
+		return FALSE;
+	}
+}
+
+/**
+ * a constant on the right side of a predicate
+ */
+static gboolean sql_token_is_constant(sql_token_id token_id) {
+	switch (token_id) {
+	case TK_INTEGER:
+	case TK_FLOAT:
+	case TK_STRING:
+		return TRUE;
+	default:
+		return FALSE;
+	}
+}
+
+/**
+ * the tokens that may follow a complete "<column> = <constant>"
+ */
+static gboolean sql_token_ends_predicate(sql_token_id token_id) {
+	switch (token_id) {
+	case TK_UNKNOWN: /* the end of the tokens */
+	case TK_SQL_AND:
+	case TK_LOGICAL_AND:
+	case TK_CBRACE:
+	case TK_SEMICOLON:
+	case TK_SQL_GROUP:
+	case TK_SQL_ORDER:
+	case TK_SQL_LIMIT:
+	case TK_SQL_HAVING:
+	case TK_SQL_FOR:
+	case TK_SQL_LOCK:
+		return TRUE;
+	default:
+		return FALSE;
+	}
+}
+
+/**
+ * parse "<tbl>" or "<db>.<tbl>" and a optional alias at *ndx
+ *
+ * @return the table-ref or NULL if there is no table-name at *ndx
+ */
+static sql_table_ref_t *sql_tokens_get_table_ref(GPtrArray *tokens, guint *ndx) {
+	sql_table_ref_t *ref;
+	sql_token *token;
+
+	token = sql_tokens_peek(tokens, ndx);
+	if (NULL == token || token->token_id != TK_LITERAL) return NULL;
+	(*ndx)++;
+
+	ref = sql_table_ref_new();
+	g_string_assign(ref->name, token->text->str);
+
+	if (sql_tokens_peek_id(tokens, *ndx) == TK_DOT) {
+		guint name_ndx;
+
+		(*ndx)++; /* the dot */
+		name_ndx = *ndx;
+		token = sql_tokens_peek(tokens, &name_ndx);
+		if (NULL != token && token->token_id == TK_LITERAL) {
+			ref->db = ref->name;
+			ref->name = g_string_new(token->text->str);
+			*ndx = name_ndx + 1;
+		}
+	}
+
+	/* <tbl> AS <alias> or <tbl> <alias> */
+	if (sql_tokens_peek_id(tokens, *ndx) == TK_SQL_AS) (*ndx)++;
+
+	token = sql_tokens_peek(tokens, ndx);
+	if (NULL != token && token->token_id == TK_LITERAL) {
+		ref->alias = g_string_new(token->text->str);
+		(*ndx)++;
+	}
+
+	return ref;
+}
+
+/**
+ * add "[<qualifier>.]<column> = <constant>" at *ndx to the predicates
+ *
+ * @return TRUE if it was a predicate
+ */
+static gboolean sql_tokens_get_predicate(GPtrArray *tokens, guint ndx, sql_tokens_refs_t *refs) {
+	sql_token *qualifier = NULL;
+	sql_token *column;
+	sql_token *value;
+	sql_predicate_t *pred;
+
+	column = sql_tokens_peek(tokens, &ndx);
+	if (NULL == column || column->token_id != TK_LITERAL) return FALSE;
+	ndx++;
+
+	if (sql_tokens_peek_id(tokens, ndx) == TK_DOT) {
+		ndx++;
+
+		qualifier = column;
+		column = sql_tokens_peek(tokens, &ndx);
+		if (NULL == column || column->token_id != TK_LITERAL) return FALSE;
+		ndx++;
+	}
+
+	if (sql_tokens_peek_id(tokens, ndx) != TK_EQ) return FALSE;
+	ndx++;
+
+	value = sql_tokens_peek(tokens, &ndx);
+	if (NULL == value || !sql_token_is_constant(value->token_id)) return FALSE;
+	ndx++;
+
+	/* id = 1 + 2 isn't a constant */
+	if (!sql_token_ends_predicate(sql_tokens_peek_id(tokens, ndx))) return FALSE;
+
+	pred = sql_predicate_new();
+	if (qualifier) pred->qualifier = g_string_new(qualifier->text->str);
+	g_string_assign(pred->column, column->text->str);
+	g_string_assign(pred->value, value->text->str);
+	pred->value_token_id = value->token_id;
+
+	g_ptr_array_add(refs->predicates, pred);
+
+	return TRUE;
+}
+
+/**
+ * the tables and predicates of a token-stream
+ *
+ * @param tokens     a token list as filled by sql_tokenizer()
+ * @param refs       the refs to fill, as created by sql_tokens_refs_new()
+ */
+void sql_tokens_get_refs(GPtrArray *tokens, sql_tokens_refs_t *refs) {
+	sql_token *token;
+	guint ndx = 0;
+	gint depth = 0;
+	gboolean is_write_stmt = FALSE;  /* the targets of the statement are written */
+	gboolean expect_table = FALSE;
+	gboolean expect_target = FALSE; /* the next table is a target of the statement */
+	gboolean in_where = FALSE;      /* in the WHERE clause at depth 0 */
+	gboolean has_or = FALSE;
+
+	token = sql_tokens_peek(tokens, &ndx);
+	if (NULL == token) return;
+	ndx++;
+
+	switch (token->token_id) {
+	case TK_SQL_INSERT:
+	case TK_SQL_REPLACE:
+	case TK_SQL_DELETE:
+		/* INSERT [INTO] <tbl>, REPLACE [INTO] <tbl>, DELETE FROM <tbl> are handled by INTO and FROM */
+		is_write_stmt = TRUE;
+		while (NULL != (token = sql_tokens_peek(tokens, &ndx))) {
+			if (token->token_id != TK_SQL_LOW_PRIORITY &&
+			    token->token_id != TK_SQL_DELAYED &&
+			    token->token_id != TK_SQL_HIGH_PRIORITY &&
+			    token->token_id != TK_SQL_IGNORE) {
+				break;
+			}
+			ndx++;
+		}
+		/* INSERT <tbl> ... without INTO */
+		if (NULL != token && token->token_id == TK_LITERAL) {
+			expect_table = expect_target = TRUE;
+		}
+		break;
+	case TK_SQL_UPDATE:
+		is_write_stmt = TRUE;
+		while (NULL != (token = sql_tokens_peek(tokens, &ndx))) {
+			if (token->token_id != TK_SQL_LOW_PRIORITY &&
+			    token->token_id != TK_SQL_IGNORE) {
+				break;
+			}
+			ndx++;
+		}
+		expect_table = expect_target = TRUE;
+		break;
+	case TK_SQL_CREATE:
+	case TK_SQL_DROP:
+	case TK_SQL_ALTER:
+	case TK_SQL_RENAME:
+		/* CREATE TABLE <tbl>, DROP TABLE IF EXISTS <tbl>, ... the TABLE keyword decides */
+		is_write_stmt = TRUE;
+		break;
+	case TK_LITERAL:
+		/* TRUNCATE [TABLE] <tbl> */
+		if (0 == g_ascii_strcasecmp(token->text->str, "TRUNCATE")) {
+			is_write_stmt = TRUE;
+			if (sql_tokens_peek_id(tokens, ndx) == TK_LITERAL) {
+				expect_table = expect_target = TRUE;
+			}
+		}
+		break;
+	default:
+		break;
+	}
+
+	while (NULL != (token = sql_tokens_peek(tokens, &ndx))) {
+		if (expect_table) {
+			sql_table_ref_t *ref;
+
+			expect_table = FALSE;
+
+			if (NULL != (ref = sql_tokens_get_table_ref(tokens, &ndx))) {
+				ref->is_write = is_write_stmt && expect_target && depth == 0;
+				g_ptr_array_add(refs->tables, ref);
+
+				/* ... <tbl> AS <alias>, <tbl> ... and <tbl> JOIN <tbl> */
+				while (sql_token_continues_table_list(sql_tokens_peek_id(tokens, ndx))) {
+					sql_token_id token_id = sql_tokens_peek_id(tokens, ndx);
+
+					ndx++;
+					if (token_id == TK_COMMA || token_id == TK_SQL_JOIN || token_id == TK_SQL_STRAIGHT_JOIN) {
+						if (NULL == (ref = sql_tokens_get_table_ref(tokens, &ndx))) break;
+
+						ref->is_write = is_write_stmt && expect_target && depth == 0;
+						g_ptr_array_add(refs->tables, ref);
+					}
+				}
+
+				continue;
+			}
+		}
+
+		ndx++;
+
+		switch (token->token_id) {
+		case TK_SQL_FROM:
+			expect_table = TRUE;
+			/* DELETE FROM <tbl>, the FROM of a INSERT ... SELECT is read */
+			expect_target = (depth == 0 && !in_where && sql_tokens_peek_id(tokens, 0) == TK_SQL_DELETE);
+			break;
+		case TK_SQL_INTO:
+			/* SELECT ... INTO @var doesn't name a table, SELECT ... INTO OUTFILE is a TK_LITERAL we can't tell apart */
+			if (is_write_stmt) {
+				expect_table = TRUE;
+				expect_target = (depth == 0);
+			}
+			break;
+		case TK_SQL_JOIN:
+		case TK_SQL_STRAIGHT_JOIN:
+			expect_table = TRUE;
+			break;
+		case TK_SQL_TABLE:
+			if (is_write_stmt && depth == 0) {
+				/* DROP TABLE IF EXISTS <tbl> */
+				if (sql_tokens_peek_id(tokens, ndx) == TK_SQL_IF) {
+					ndx++;
+					if (sql_tokens_peek_id(tokens, ndx) == TK_SQL_NOT) ndx++;
+					if (sql_tokens_peek_id(tokens, ndx) == TK_SQL_EXISTS) ndx++;
+				}
+				expect_table = expect_target = TRUE;
+			}
+			break;
+		case TK_SQL_TO:
+			/* RENAME TABLE <tbl> TO <tbl> */
+			if (is_write_stmt && depth == 0 && sql_tokens_peek_id(tokens, 0) == TK_SQL_RENAME) {
+				expect_table = expect_target = TRUE;
+			}
+			break;
+		case TK_SQL_SELECT:
+			/* INSERT ... SELECT and sub-queries read */
+			expect_target = FALSE;
+			break;
+		case TK_OBRACE:
+			depth++;
+			break;
+		case TK_CBRACE:
+			depth--;
+			break;
+		case TK_SEMICOLON:
+			/* only the first statement */
+			in_where = FALSE;
+			ndx = tokens->len;
+			break;
+		case TK_SQL_WHERE:
+			if (depth == 0) {
+				in_where = TRUE;
+				sql_tokens_get_predicate(tokens, ndx, refs);
+			}
+			break;
+		case TK_SQL_AND:
+		case TK_LOGICAL_AND:
+			if (in_where && depth == 0) sql_tokens_get_predicate(tokens, ndx, refs);
+			break;
+		case TK_SQL_OR:
+		case TK_LOGICAL_OR:
+			/* id = 1 AND (a = 2 OR b = 3) still restricts the id */
+			if (in_where && depth == 0) has_or = TRUE;
+			break;
+		case TK_SQL_GROUP:
+		case TK_SQL_ORDER:
+		case TK_SQL_LIMIT:
+		case TK_SQL_HAVING:
+		case TK_SQL_UNION:
+			if (depth == 0) in_where = FALSE;
+			break;
+		default:
+			break;
+		}
+	}
+
+	if (has_or) sql_tokens_refs_clear_predicates(refs);
+}
@@ -322,3 +322,39 @@ int sql_token_get_last_id() {
 	return (sizeof(token_names)/sizeof(token_names[0])) - 1; /* the last one is not a token */
 }
 
+/**
+ * hash a keyword case-insensitively
+ *
+ * FNV-1a over the lower-cased bytes. Used by sql-tokenizer-gen to build the perfect
+ * hash of the keywords and by sql_keywords_lookup() to query it.
+ */
+guint32 sql_keywords_hash(const char *name, gsize name_len) {
+	guint32 h = 2166136261U;
+	gsize i;
+
+	for (i = 0; i < name_len; i++) {
+		h ^= (guchar)g_ascii_tolower(name[i]);
+		h *= 16777619U;
+	}
+
+	return h;
+}
+
+/**
+ * map the hash of a keyword to its slot with the displacement of its bucket
+ *
+ * the displacement is mixed in with the finalizer of murmur3 to get a new hash function
+ * for each displacement
+ */
+guint32 sql_keywords_hash_slot(guint32 hash, guint32 displacement, guint32 slots) {
+	guint32 h = hash ^ displacement;
+
+	h ^= h >> 16;
+	h *= 0x85ebca6bU;
+	h ^= h >> 13;
+	h *= 0xc2b2ae35U;
+	h ^= h >> 16;
+
+	return h % slots;
+}
+
@@ -24,6 +24,8 @@
 
 #include <glib.h>
 
+#include "chassis-lock-stats.h"
+
 /** @file
  *
  * a tokenizer for MySQLs SQL dialect
@@ -389,6 +391,70 @@ sql_token_id sql_token_get_id_len(const gchar *name, size_t name_len);
  */
 int sql_tokenizer(GPtrArray *tokens, const gchar *str, gsize len);
 
+typedef struct sql_tokenizer_sink sql_tokenizer_sink_t;
+
+/**
+ * a consumer of the tokens the scanner emits
+ *
+ * append() starts a new token, append_last() adds text to the token
+ * started last: quoted strings and comments arrive in pieces
+ */
+struct sql_tokenizer_sink {
+	void (*append)(sql_tokenizer_sink_t *sink, sql_token_id token_id, const gchar *text, gsize text_len);
+	void (*append_last)(sql_tokenizer_sink_t *sink, sql_token_id token_id, const gchar *text, gsize text_len);
+
+	gboolean pause;  /**< set by the sink to make the scanner return before the next token */
+
+	gpointer udata;
+};
+
+/**
+ * scan a string and pass the tokens to a sink
+ *
+ * @param sink     the consumer of the tokens
+ * @param str      SQL string to tokenize
+ * @param len      length of str
+ * @return 0 on success
+ */
+int sql_tokenizer_scan(sql_tokenizer_sink_t *sink, const gchar *str, gsize len);
+
+/**
+ * normalize a query and hash the normalized query without building a token list
+ *
+ * the normalized form is the same as the one of normalize() in lib/proxy/tokenizer.lua:
+ * comments are removed, literals are quoted, constants are replaced by ? and
+ * keywords are uppercased
+ *
+ * @param dst      the normalized query is appended to it
+ * @param hash     the 64bit FNV-1a hash of the normalized query
+ * @param str      SQL string to normalize
+ * @param len      length of str
+ * @return 0 on success
+ */
+int sql_tokenizer_fingerprint(GString *dst, guint64 *hash, const gchar *str, gsize len);
+
+/**
+ * a scanner that tokenizes on demand
+ */
+typedef struct sql_tokenizer_stream sql_tokenizer_stream_t;
+
+/**
+ * create a stream of tokens for a SQL string
+ *
+ * @param str      SQL string to tokenize, it is copied
+ * @param len      length of str
+ * @return         a stream or NULL if the scanner couldn't be created
+ */
+sql_tokenizer_stream_t *sql_tokenizer_stream_new(const gchar *str, gsize len);
+void sql_tokenizer_stream_free(sql_tokenizer_stream_t *stream);
+
+/**
+ * scan the next token
+ *
+ * @return         the next token or NULL at the end of the string. The token is owned by the stream
+ */
+sql_token *sql_tokenizer_stream_next(sql_tokenizer_stream_t *stream);
+
 /**
  * create a empty token list
  *
@@ -407,6 +473,142 @@ void sql_tokens_free(GPtrArray *tokens);
 
 int sql_token_get_last_id();
 
+/**
+ * what a statement does to the server state
+ *
+ * used to decide if a statement may go to a read-only backend
+ */
+typedef enum {
+	SQL_STMT_UNKNOWN,     /**< empty statement or only comments */
+	SQL_STMT_READ,        /**< SELECT, SHOW, DESCRIBE, EXPLAIN without locking */
+	SQL_STMT_WRITE,       /**< everything that may change data */
+	SQL_STMT_TRANSACTION  /**< BEGIN, COMMIT, ROLLBACK, SAVEPOINT, SET autocommit, ... */
+} sql_stmt_type_t;
+
+/**
+ * classify a token-stream by its first statement token
+ *
+ * @param tokens   a token list as filled by sql_tokenizer()
+ * @return         the statement type
+ */
+sql_stmt_type_t sql_tokens_get_stmt_type(GPtrArray *tokens);
+
+/**
+ * get the name of a statement type
+ *
+ * @return "unknown", "read", "write" or "transaction"
+ */
+const gchar *sql_stmt_type_get_name(sql_stmt_type_t stmt_type);
+
+/**
+ * a table a statement references
+ */
+typedef struct {
+	GString *db;        /**< the db of "<db>.<tbl>", NULL if the table isn't qualified */
+	GString *name;
+	GString *alias;     /**< NULL if the table has no alias */
+
+	gboolean is_write;  /**< the table is a target of a INSERT, REPLACE, UPDATE, DELETE or DDL statement */
+} sql_table_ref_t;
+
+/**
+ * a "[<qualifier>.]<column> = <constant>" of the WHERE clause
+ */
+typedef struct {
+	GString *qualifier; /**< the table or alias in front of the column, NULL if the column isn't qualified */
+	GString *column;
+
+	sql_token_id value_token_id; /**< TK_INTEGER, TK_FLOAT or TK_STRING */
+	GString *value;
+} sql_predicate_t;
+
+/**
+ * the tables and predicates of a statement
+ */
+typedef struct {
+	GPtrArray *tables;      /**< sql_table_ref_t, in the order they appear */
+	GPtrArray *predicates;  /**< sql_predicate_t, empty if the WHERE clause has a OR */
+} sql_tokens_refs_t;
+
+sql_table_ref_t *sql_table_ref_new(void);
+void sql_table_ref_free(sql_table_ref_t *ref);
+sql_predicate_t *sql_predicate_new(void);
+void sql_predicate_free(sql_predicate_t *pred);
+
+sql_tokens_refs_t *sql_tokens_refs_new(void);
+void sql_tokens_refs_free(sql_tokens_refs_t *refs);
+
+/**
+ * extract the tables and the equality predicates of the first statement of a token-stream
+ *
+ * @param tokens   a token list as filled by sql_tokenizer()
+ * @param refs     the refs to fill, as created by sql_tokens_refs_new()
+ */
+void sql_tokens_get_refs(GPtrArray *tokens, sql_tokens_refs_t *refs);
+
+/**
+ * a cached, read-only token-stream
+ *
+ * shared between all users of the cache, release it with sql_tokenizer_cache_entry_unref()
+ */
+typedef struct {
+	GString *query;
+
+	GPtrArray *tokens;
+	sql_stmt_type_t stmt_type;
+	sql_tokens_refs_t *refs;   /**< the tables and predicates, extracted on the first sql_tokenizer_cache_get_refs() */
+
+	gint ref_count;
+
+	GList link;             /**< position in the LRU list */
+} sql_tokenizer_cache_entry_t;
+
+/**
+ * a LRU cache of tokenized statements
+ *
+ * all functions are thread-safe
+ */
+typedef struct {
+	GHashTable *entries;    /**< query(GString *) -> sql_tokenizer_cache_entry_t, the key is owned by the entry */
+	GQueue lru;             /**< most recently used first */
+
+	guint max_entries;
+	gsize max_query_len;    /**< longer queries are tokenized, but not cached */
+
+	guint64 hits;
+	guint64 misses;
+
+	GMutex *mutex;
+	chassis_lock_stats_t mutex_stats;
+} sql_tokenizer_cache_t;
+
+#define SQL_TOKENIZER_CACHE_MAX_ENTRIES   1024
+#define SQL_TOKENIZER_CACHE_MAX_QUERY_LEN 4096
+
+sql_tokenizer_cache_t *sql_tokenizer_cache_new(guint max_entries);
+void sql_tokenizer_cache_free(sql_tokenizer_cache_t *cache);
+
+/**
+ * get the tokens of a query, tokenize it on a cache-miss
+ *
+ * @param cache    the cache
+ * @param str      SQL string to tokenize
+ * @param len      length of str
+ * @return         a referenced cache-entry
+ */
+sql_tokenizer_cache_entry_t *sql_tokenizer_cache_get(sql_tokenizer_cache_t *cache, const gchar *str, gsize len);
+
+void sql_tokenizer_cache_entry_unref(sql_tokenizer_cache_t *cache, sql_tokenizer_cache_entry_t *entry);
+
+/**
+ * get the tables and predicates of a cache-entry
+ *
+ * they are extracted once and shared by all users of the entry
+ *
+ * @return the read-only refs, owned by the entry
+ */
+const sql_tokens_refs_t *sql_tokenizer_cache_get_refs(sql_tokenizer_cache_t *cache, sql_tokenizer_cache_entry_t *entry);
+
 /*@}*/
 
 #endif
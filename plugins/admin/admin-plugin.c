@@ -88,6 +88,13 @@
 #include "network-mysqld-proto.h"
 #include "network-mysqld-packet.h"
 #include "network-mysqld-lua.h"
+#include "network-mysqld-metrics.h"
+#include "string-len.h"
+#include "chassis-event-thread.h"
+#include "chassis-stats.h"
+#include "chassis-mem.h"
+#include "chassis-lock-stats.h"
+#include "network-buffer-pool.h"
 
 #include "sys-pedantic.h"
 #include "glib-ext.h"
@@ -115,6 +122,8 @@ struct chassis_plugin_config {
 	gchar *admin_password;            /**< login password */
 
 	network_mysqld_con *listen_con;
+
+	chassis_event_thread_t *event_thread; /**< accepts and runs the admin connections and their lua-scope */
 };
 
 int network_mysqld_con_handle_stmt(chassis G_GNUC_UNUSED *chas, network_mysqld_con *con, GString *s) {
@@ -429,6 +438,551 @@ static network_mysqld_lua_stmt_ret admin_lua_read_query(network_mysqld_con *con)
 	return PROXY_NO_DECISION;
 }
 
+/**
+ * check if the COM_QUERY is the statement, ignoring the case and a trailing ;
+ */
+static gboolean admin_query_is(GString *packet, const char *stmt, gsize stmt_len) {
+	const char *query;
+	gsize query_len;
+
+	if (packet->len <= NET_HEADER_SIZE + 1 || packet->str[NET_HEADER_SIZE] != COM_QUERY) return FALSE;
+
+	query = packet->str + NET_HEADER_SIZE + 1;
+	query_len = packet->len - NET_HEADER_SIZE - 1;
+
+	while (query_len > 0 && (g_ascii_isspace(query[query_len - 1]) || query[query_len - 1] == ';')) query_len--;
+
+	return query_len == stmt_len && 0 == g_ascii_strncasecmp(query, stmt, stmt_len);
+}
+
+/**
+ * check if the COM_QUERY is the statement followed by a number, ignoring the case and a trailing ;
+ *
+ * @param value the number
+ */
+static gboolean admin_query_is_with_number(GString *packet, const char *stmt, gsize stmt_len, guint64 *value) {
+	const char *query;
+	gchar *end;
+	gsize query_len;
+
+	if (packet->len <= NET_HEADER_SIZE + 1 || packet->str[NET_HEADER_SIZE] != COM_QUERY) return FALSE;
+
+	query = packet->str + NET_HEADER_SIZE + 1;
+	query_len = packet->len - NET_HEADER_SIZE - 1;
+
+	while (query_len > 0 && (g_ascii_isspace(query[query_len - 1]) || query[query_len - 1] == ';')) query_len--;
+
+	if (query_len <= stmt_len || 0 != g_ascii_strncasecmp(query, stmt, stmt_len)) return FALSE;
+	if (!g_ascii_isspace(query[stmt_len])) return FALSE;
+
+	query += stmt_len;
+	query_len -= stmt_len;
+	while (query_len > 0 && g_ascii_isspace(*query)) {
+		query++;
+		query_len--;
+	}
+
+	if (query_len == 0 || query_len > 10 || !g_ascii_isdigit(*query)) return FALSE;
+
+	*value = g_ascii_strtoull(query, &end, 10);
+
+	return end == query + query_len;
+}
+
+/**
+ * answer SELECT * FROM proxy_connections
+ *
+ * a row per client connection, like SHOW PROCESSLIST. The statement, the user and the backend
+ * come from the activity the event-threads record (see network-mysqld-activity.h), the
+ * connections are only locked against being closed while we copy them.
+ */
+static void admin_send_proxy_connections(network_mysqld_con *con) {
+	chassis_private *g = con->srv->priv;
+	static const struct {
+		const char *name;
+		enum enum_field_types type;
+	} columns[] = {
+		{ "id",           FIELD_TYPE_LONGLONG },
+		{ "client",       FIELD_TYPE_VAR_STRING },
+		{ "user",         FIELD_TYPE_VAR_STRING },
+		{ "backend",      FIELD_TYPE_VAR_STRING },
+		{ "state",        FIELD_TYPE_VAR_STRING },
+		{ "command",      FIELD_TYPE_VAR_STRING },
+		{ "time_ms",      FIELD_TYPE_LONGLONG },
+		{ "query",        FIELD_TYPE_VAR_STRING },
+		{ "bytes_queued", FIELD_TYPE_LONGLONG },
+		{ NULL,           FIELD_TYPE_NULL }
+	};
+	network_mysqld_activity_snapshot_t activity;
+	guint64 now = chassis_get_coarse_rel_microseconds();
+	GPtrArray *fields, *rows, *row;
+	GString *client_name = g_string_sized_new(64);
+	guint i, j;
+
+	fields = network_mysqld_proto_fielddefs_new();
+	for (i = 0; columns[i].name; i++) {
+		MYSQL_FIELD *field = network_mysqld_proto_fielddef_new();
+
+		field->name = g_strdup(columns[i].name);
+		field->type = columns[i].type;
+		g_ptr_array_add(fields, field);
+	}
+
+	rows = g_ptr_array_new();
+
+	g_mutex_lock(g->cons_mutex);
+	for (i = 0; i < g->cons->len; i++) {
+		network_mysqld_con *cur = g->cons->pdata[i];
+		guint64 since;
+
+		if (!cur->is_accepted || !cur->client) continue;
+
+		network_mysqld_activity_get(&(cur->activity), &activity);
+
+		g_string_truncate(client_name, 0);
+		network_address_format_name(cur->client->src, client_name, NULL);
+
+		since = activity.command != -1 ? activity.ts_query : activity.ts_idle;
+
+		row = g_ptr_array_new();
+		g_ptr_array_add(row, g_strdup_printf("%u", i));
+		g_ptr_array_add(row, g_strndup(S(client_name)));
+		g_ptr_array_add(row, activity.user_len ? g_strndup(activity.user, MIN(activity.user_len, sizeof(activity.user))) : NULL);
+		g_ptr_array_add(row, activity.backend_len ? g_strndup(activity.backend, MIN(activity.backend_len, sizeof(activity.backend))) : NULL);
+		g_ptr_array_add(row, g_strdup(network_mysqld_con_state_get_name(cur->state)));
+		g_ptr_array_add(row, activity.command != -1 ? g_strdup(network_mysqld_metrics_command_get_name(activity.command)) : g_strdup("Sleep"));
+		g_ptr_array_add(row, since ? g_strdup_printf("%"G_GUINT64_FORMAT, now > since ? (now - since) / 1000 : 0) : NULL);
+		g_ptr_array_add(row, (activity.command != -1 && activity.query_len) ? g_strndup(activity.query, MIN(activity.query_len, sizeof(activity.query))) : NULL);
+		g_ptr_array_add(row, g_strdup_printf("%"G_GSIZE_FORMAT, cur->client->send_queue->len));
+		g_ptr_array_add(rows, row);
+	}
+	g_mutex_unlock(g->cons_mutex);
+
+	network_mysqld_con_send_resultset(con->client, fields, rows);
+
+	for (i = 0; i < rows->len; i++) {
+		row = rows->pdata[i];
+
+		for (j = 0; j < row->len; j++) {
+			if (row->pdata[j]) g_free(row->pdata[j]);
+		}
+
+		g_ptr_array_free(row, TRUE);
+	}
+	g_ptr_array_free(rows, TRUE);
+	network_mysqld_proto_fielddefs_free(fields);
+	g_string_free(client_name, TRUE);
+}
+
+/**
+ * answer SELECT * FROM proxy_event_threads
+ *
+ * a row per event-thread with its load, the counters are read without locking them. A draining
+ * thread hands its connections to the active ones, see PROXY SET EVENT THREADS
+ */
+static void admin_send_proxy_event_threads(network_mysqld_con *con) {
+	chassis_event_threads_t *threads = con->srv->threads;
+	static const char *columns[] = {
+		"thread", "connections", "events", "busy_ms", "load_permille", "queue_depth", "migrations", "is_draining", NULL
+	};
+	guint64 now_usec = chassis_get_rel_microseconds();
+	GPtrArray *fields, *rows, *row;
+	guint i, j;
+
+	fields = network_mysqld_proto_fielddefs_new();
+	for (i = 0; columns[i]; i++) {
+		MYSQL_FIELD *field = network_mysqld_proto_fielddef_new();
+
+		field->name = g_strdup(columns[i]);
+		field->type = FIELD_TYPE_LONGLONG;
+		g_ptr_array_add(fields, field);
+	}
+
+	rows = g_ptr_array_new();
+
+	for (i = 0; i < threads->event_threads->len; i++) {
+		chassis_event_thread_t *event_thread = threads->event_threads->pdata[i];
+
+		if (NULL == event_thread->event_queue) continue;
+
+		row = g_ptr_array_new();
+		g_ptr_array_add(row, g_strdup_printf("%u", event_thread->index));
+		g_ptr_array_add(row, g_strdup_printf("%d", g_atomic_int_get(&(event_thread->connections))));
+		g_ptr_array_add(row, g_strdup_printf("%"G_GUINT64_FORMAT, event_thread->events));
+		g_ptr_array_add(row, g_strdup_printf("%"G_GUINT64_FORMAT, event_thread->busy_usec / 1000));
+		g_ptr_array_add(row, g_strdup_printf("%d", chassis_event_thread_get_load(event_thread, now_usec)));
+		g_ptr_array_add(row, g_strdup_printf("%d", MAX(g_async_queue_length(event_thread->event_queue), 0)));
+		g_ptr_array_add(row, g_strdup_printf("%"G_GUINT64_FORMAT, event_thread->migrations));
+		g_ptr_array_add(row, g_strdup_printf("%d", chassis_event_threads_is_draining(threads, event_thread)));
+		g_ptr_array_add(rows, row);
+	}
+
+	network_mysqld_con_send_resultset(con->client, fields, rows);
+
+	for (i = 0; i < rows->len; i++) {
+		row = rows->pdata[i];
+
+		for (j = 0; j < row->len; j++) {
+			g_free(row->pdata[j]);
+		}
+
+		g_ptr_array_free(row, TRUE);
+	}
+	g_ptr_array_free(rows, TRUE);
+	network_mysqld_proto_fielddefs_free(fields);
+}
+
+/**
+ * answer PROXY SET EVENT THREADS <n>
+ *
+ * the threads are counted like --event-threads, at most that many get active. With
+ * --event-threads-min the load adjusts them from there on.
+ *
+ * @see chassis_event_threads_set_active()
+ */
+static void admin_set_event_threads(network_mysqld_con *con, guint64 active) {
+	chassis_event_threads_t *threads = con->srv->threads;
+	MYSQL_FIELD *field;
+	GPtrArray *fields, *rows, *row;
+
+	active = chassis_event_threads_set_active(threads, MIN(active, G_MAXUINT));
+
+	fields = network_mysqld_proto_fielddefs_new();
+	field = network_mysqld_proto_fielddef_new();
+	field->name = g_strdup("active");
+	field->type = FIELD_TYPE_LONGLONG;
+	g_ptr_array_add(fields, field);
+
+	rows = g_ptr_array_new();
+	row = g_ptr_array_new();
+	g_ptr_array_add(row, g_strdup_printf("%"G_GUINT64_FORMAT, active));
+	g_ptr_array_add(rows, row);
+
+	network_mysqld_con_send_resultset(con->client, fields, rows);
+
+	g_free(row->pdata[0]);
+	g_ptr_array_free(row, TRUE);
+	g_ptr_array_free(rows, TRUE);
+	network_mysqld_proto_fielddefs_free(fields);
+}
+
+/**
+ * answer SELECT * FROM proxy_event_thread_cpu
+ *
+ * a row per event-thread and subsystem with the CPU time spent in it and its share of the
+ * time the thread accounted, the counters are read without locking them
+ */
+static void admin_send_proxy_event_thread_cpu(network_mysqld_con *con) {
+	chassis_event_threads_t *threads = con->srv->threads;
+	static const char *columns[] = {
+		"thread", "subsystem", "cpu_ms", "share_permille", NULL
+	};
+	GPtrArray *fields, *rows, *row;
+	guint i, j;
+
+	fields = network_mysqld_proto_fielddefs_new();
+	for (i = 0; columns[i]; i++) {
+		MYSQL_FIELD *field = network_mysqld_proto_fielddef_new();
+
+		field->name = g_strdup(columns[i]);
+		field->type = (i == 1) ? FIELD_TYPE_VAR_STRING : FIELD_TYPE_LONGLONG;
+		g_ptr_array_add(fields, field);
+	}
+
+	rows = g_ptr_array_new();
+
+	for (i = 0; i < threads->event_threads->len; i++) {
+		chassis_event_thread_t *event_thread = threads->event_threads->pdata[i];
+		guint64 total = 0;
+		int cpu;
+
+		if (NULL == event_thread->event_queue) continue;
+
+		for (cpu = 0; cpu < CHASSIS_EVENT_THREAD_CPU_MAX; cpu++) {
+			total += event_thread->cpu_cycles[cpu];
+		}
+
+		for (cpu = 0; cpu < CHASSIS_EVENT_THREAD_CPU_MAX; cpu++) {
+			row = g_ptr_array_new();
+			g_ptr_array_add(row, g_strdup_printf("%u", event_thread->index));
+			g_ptr_array_add(row, g_strdup(chassis_event_thread_cpu_get_name(cpu)));
+			g_ptr_array_add(row, g_strdup_printf("%.0f", chassis_event_thread_cpu_get_seconds(event_thread, cpu) * 1000));
+			g_ptr_array_add(row, g_strdup_printf("%"G_GUINT64_FORMAT,
+						total ? event_thread->cpu_cycles[cpu] * 1000 / total : 0));
+			g_ptr_array_add(rows, row);
+		}
+	}
+
+	network_mysqld_con_send_resultset(con->client, fields, rows);
+
+	for (i = 0; i < rows->len; i++) {
+		row = rows->pdata[i];
+
+		for (j = 0; j < row->len; j++) {
+			g_free(row->pdata[j]);
+		}
+
+		g_ptr_array_free(row, TRUE);
+	}
+	g_ptr_array_free(rows, TRUE);
+	network_mysqld_proto_fielddefs_free(fields);
+}
+
+static void admin_memory_add_row(GPtrArray *rows, const char *subsystem, guint64 bytes) {
+	GPtrArray *row = g_ptr_array_new();
+
+	g_ptr_array_add(row, g_strdup(subsystem));
+	g_ptr_array_add(row, g_strdup_printf("%"G_GUINT64_FORMAT, bytes));
+	g_ptr_array_add(rows, row);
+}
+
+/**
+ * answer SELECT * FROM proxy_memory
+ *
+ * a row per subsystem with the bytes it holds. The connections count with the snapshot
+ * network_mysqld_con_get_memory() took when they went idle last, the idle packet-buffers
+ * with the size of a chunk each. What the allocator handed out beyond that is "other",
+ * what it holds without handing it out is "allocator_free": its fragmentation and the
+ * free pages it keeps. The last two need the stats of the allocator, see chassis-mem.h
+ */
+static void admin_send_proxy_memory(network_mysqld_con *con) {
+	chassis_private *g = con->srv->priv;
+	static const char *columns[] = {
+		"subsystem", "bytes", NULL
+	};
+	network_buffer_pool_stats_t buffer_stats;
+	network_shared_dict_stats_t dict_stats;
+	chassis_mem_stats_t mem_stats;
+	gint64 lua_bytes = 0;
+	guint64 con_bytes = 0, buffer_bytes, known;
+	GPtrArray *fields, *rows, *row;
+	guint i, j;
+
+	if (chassis_global_stats) {
+		for (i = 0; i < CHASSIS_STATS_SHARDS; i++) {
+			lua_bytes += chassis_global_stats->shards[i].lua_mem_bytes;
+		}
+	}
+	lua_bytes = MAX(lua_bytes, 0); /* the shards are read while they change */
+
+	g_mutex_lock(g->cons_mutex);
+	for (i = 0; i < g->cons->len; i++) {
+		network_mysqld_con *cur = g->cons->pdata[i];
+
+		con_bytes += cur->memory_bytes;
+	}
+	g_mutex_unlock(g->cons_mutex);
+
+	network_buffer_pool_get_stats(&buffer_stats);
+	buffer_bytes = (guint64)buffer_stats.idle * NETWORK_BUFFER_POOL_CHUNK_SIZE;
+
+	network_shared_dict_get_stats(g->shared_dict, &dict_stats);
+
+	known = lua_bytes + con_bytes + buffer_bytes + g->query_cache->bytes + dict_stats.bytes;
+
+	fields = network_mysqld_proto_fielddefs_new();
+	for (i = 0; columns[i]; i++) {
+		MYSQL_FIELD *field = network_mysqld_proto_fielddef_new();
+
+		field->name = g_strdup(columns[i]);
+		field->type = (i == 0) ? FIELD_TYPE_VAR_STRING : FIELD_TYPE_LONGLONG;
+		g_ptr_array_add(fields, field);
+	}
+
+	rows = g_ptr_array_new();
+
+	admin_memory_add_row(rows, "lua", lua_bytes);
+	admin_memory_add_row(rows, "connections", con_bytes);
+	admin_memory_add_row(rows, "packet_buffers", buffer_bytes);
+	admin_memory_add_row(rows, "query_cache", g->query_cache->bytes);
+	admin_memory_add_row(rows, "shared_dict", dict_stats.bytes);
+
+	if (0 == chassis_mem_get_stats(&mem_stats)) {
+		admin_memory_add_row(rows, "other", mem_stats.allocated > known ? mem_stats.allocated - known : 0);
+		admin_memory_add_row(rows, "allocator_free", mem_stats.resident > mem_stats.allocated ? mem_stats.resident - mem_stats.allocated : 0);
+	}
+
+	network_mysqld_con_send_resultset(con->client, fields, rows);
+
+	for (i = 0; i < rows->len; i++) {
+		row = rows->pdata[i];
+
+		for (j = 0; j < row->len; j++) {
+			g_free(row->pdata[j]);
+		}
+
+		g_ptr_array_free(row, TRUE);
+	}
+	g_ptr_array_free(rows, TRUE);
+	network_mysqld_proto_fielddefs_free(fields);
+}
+
+/**
+ * answer SELECT * FROM proxy_locks
+ *
+ * a row per lock with its acquisitions, the ones that had to wait and the microseconds
+ * it was waited for and held. The times stay 0 without --lock-stats, see chassis-lock-stats.h
+ */
+static void admin_send_proxy_locks(network_mysqld_con *con) {
+	static const char *columns[] = {
+		"lock", "acquisitions", "contended", "wait_us", "hold_us", NULL
+	};
+	GPtrArray *fields, *rows, *row;
+	GPtrArray *entries;
+	guint i, j;
+
+	fields = network_mysqld_proto_fielddefs_new();
+	for (i = 0; columns[i]; i++) {
+		MYSQL_FIELD *field = network_mysqld_proto_fielddef_new();
+
+		field->name = g_strdup(columns[i]);
+		field->type = (i == 0) ? FIELD_TYPE_VAR_STRING : FIELD_TYPE_LONGLONG;
+		g_ptr_array_add(fields, field);
+	}
+
+	rows = g_ptr_array_new();
+
+	entries = chassis_lock_stats_get_all();
+	for (i = 0; i < entries->len; i++) {
+		chassis_lock_stats_entry_t *entry = entries->pdata[i];
+
+		row = g_ptr_array_new();
+		g_ptr_array_add(row, g_strdup(entry->name));
+		g_ptr_array_add(row, g_strdup_printf("%"G_GUINT64_FORMAT, entry->acquisitions));
+		g_ptr_array_add(row, g_strdup_printf("%"G_GUINT64_FORMAT, entry->contended));
+		g_ptr_array_add(row, g_strdup_printf("%.0f", entry->wait_seconds * 1000000));
+		g_ptr_array_add(row, g_strdup_printf("%.0f", entry->hold_seconds * 1000000));
+		g_ptr_array_add(rows, row);
+	}
+	chassis_lock_stats_entries_free(entries);
+
+	network_mysqld_con_send_resultset(con->client, fields, rows);
+
+	for (i = 0; i < rows->len; i++) {
+		row = rows->pdata[i];
+
+		for (j = 0; j < row->len; j++) {
+			g_free(row->pdata[j]);
+		}
+
+		g_ptr_array_free(row, TRUE);
+	}
+	g_ptr_array_free(rows, TRUE);
+	network_mysqld_proto_fielddefs_free(fields);
+}
+
+/**
+ * answer SELECT * FROM proxy_workers
+ *
+ * a row per worker of --worker-processes with its open connections and the queries it
+ * received, as it published them last. Empty without --worker-processes, see chassis-prefork.h
+ */
+static void admin_send_proxy_workers(network_mysqld_con *con) {
+	static const char *columns[] = {
+		"worker", "pid", "restarts", "uptime", "connections", "queries", NULL
+	};
+	chassis_prefork_t *prefork = con->srv->prefork;
+	GPtrArray *fields, *rows, *row;
+	GArray *records;
+	GTimeVal now;
+	guint i, j;
+
+	fields = network_mysqld_proto_fielddefs_new();
+	for (i = 0; columns[i]; i++) {
+		MYSQL_FIELD *field = network_mysqld_proto_fielddef_new();
+
+		field->name = g_strdup(columns[i]);
+		field->type = FIELD_TYPE_LONGLONG;
+		g_ptr_array_add(fields, field);
+	}
+
+	rows = g_ptr_array_new();
+	records = g_array_new(FALSE, FALSE, sizeof(chassis_stats_shm_record_t));
+	g_get_current_time(&now);
+
+	for (i = 0; prefork && i < prefork->n_workers; i++) {
+		chassis_prefork_slot_t *slot = chassis_prefork_get_slot(prefork, i);
+		guint64 now_usec = (guint64)now.tv_sec * G_USEC_PER_SEC + now.tv_usec;
+		gdouble connections = 0, queries = 0;
+		gint pid;
+
+		if (0 == (pid = g_atomic_int_get(&(slot->pid)))) continue;
+
+		if (!chassis_prefork_read(prefork, i, records, NULL)) g_array_set_size(records, 0);
+
+		for (j = 0; j < records->len; j++) {
+			chassis_stats_shm_record_t *record = &g_array_index(records, chassis_stats_shm_record_t, j);
+
+			if (0 == strcmp(record->key, "mysql_proxy_connections")) {
+				connections = record->value;
+			} else if (g_str_has_prefix(record->key, "mysql_proxy_queries_total{")) {
+				queries += record->value;
+			}
+		}
+
+		row = g_ptr_array_new();
+		g_ptr_array_add(row, g_strdup_printf("%u", i));
+		g_ptr_array_add(row, g_strdup_printf("%d", pid));
+		g_ptr_array_add(row, g_strdup_printf("%d", g_atomic_int_get(&(slot->restarts))));
+		g_ptr_array_add(row, g_strdup_printf("%"G_GUINT64_FORMAT, now_usec > slot->started_at ? (now_usec - slot->started_at) / G_USEC_PER_SEC : 0));
+		g_ptr_array_add(row, g_strdup_printf("%.0f", connections));
+		g_ptr_array_add(row, g_strdup_printf("%.0f", queries));
+		g_ptr_array_add(rows, row);
+	}
+	g_array_free(records, TRUE);
+
+	network_mysqld_con_send_resultset(con->client, fields, rows);
+
+	for (i = 0; i < rows->len; i++) {
+		row = rows->pdata[i];
+
+		for (j = 0; j < row->len; j++) {
+			g_free(row->pdata[j]);
+		}
+
+		g_ptr_array_free(row, TRUE);
+	}
+	g_ptr_array_free(rows, TRUE);
+	network_mysqld_proto_fielddefs_free(fields);
+}
+
+/**
+ * answer PROXY HEAP DUMP
+ *
+ * writes a profile of the heap and returns the name of its file, see chassis_mem_dump_profile()
+ */
+static void admin_send_proxy_heap_dump(network_mysqld_con *con) {
+	GPtrArray *fields, *rows, *row;
+	MYSQL_FIELD *field;
+	GError *gerr = NULL;
+	gchar *filename;
+
+	if (NULL == (filename = chassis_mem_dump_profile(&gerr))) {
+		network_mysqld_con_send_error(con->client, gerr->message, strlen(gerr->message));
+		g_clear_error(&gerr);
+
+		return;
+	}
+
+	fields = network_mysqld_proto_fielddefs_new();
+	field = network_mysqld_proto_fielddef_new();
+	field->name = g_strdup("file");
+	field->type = FIELD_TYPE_VAR_STRING;
+	g_ptr_array_add(fields, field);
+
+	rows = g_ptr_array_new();
+	row = g_ptr_array_new();
+	g_ptr_array_add(row, filename);
+	g_ptr_array_add(rows, row);
+
+	network_mysqld_con_send_resultset(con->client, fields, rows);
+
+	g_free(filename);
+	g_ptr_array_free(row, TRUE);
+	g_ptr_array_free(rows, TRUE);
+	network_mysqld_proto_fielddefs_free(fields);
+}
+
 /**
  * gets called after a query has been read
  *
@@ -442,6 +996,7 @@ NETWORK_MYSQLD_PLUGIN_PROTO(server_read_query) {
 	network_socket *recv_sock, *send_sock;
 	network_mysqld_con_lua_t *st = con->plugin_con_state;
 	network_mysqld_lua_stmt_ret ret;
+	guint64 number;
 
 	send_sock = NULL;
 	recv_sock = con->client;
@@ -455,6 +1010,81 @@ NETWORK_MYSQLD_PLUGIN_PROTO(server_read_query) {
 	
 	packet = chunk->data;
 
+	if (admin_query_is(packet, C("SELECT * FROM proxy_connections"))) {
+		/* answered without the lua-script, it doesn't have to track the connections */
+		admin_send_proxy_connections(con);
+
+		con->state = CON_STATE_SEND_QUERY_RESULT;
+
+		g_string_free(g_queue_pop_tail(recv_sock->recv_queue->chunks), TRUE);
+
+		return NETWORK_SOCKET_SUCCESS;
+	}
+
+	if (admin_query_is(packet, C("SELECT * FROM proxy_event_threads"))) {
+		admin_send_proxy_event_threads(con);
+
+		con->state = CON_STATE_SEND_QUERY_RESULT;
+
+		g_string_free(g_queue_pop_tail(recv_sock->recv_queue->chunks), TRUE);
+
+		return NETWORK_SOCKET_SUCCESS;
+	}
+	if (admin_query_is_with_number(packet, C("PROXY SET EVENT THREADS"), &number)) {
+		admin_set_event_threads(con, number);
+
+		con->state = CON_STATE_SEND_QUERY_RESULT;
+
+		g_string_free(g_queue_pop_tail(recv_sock->recv_queue->chunks), TRUE);
+
+		return NETWORK_SOCKET_SUCCESS;
+	}
+	if (admin_query_is(packet, C("SELECT * FROM proxy_event_thread_cpu"))) {
+		admin_send_proxy_event_thread_cpu(con);
+
+		con->state = CON_STATE_SEND_QUERY_RESULT;
+
+		g_string_free(g_queue_pop_tail(recv_sock->recv_queue->chunks), TRUE);
+
+		return NETWORK_SOCKET_SUCCESS;
+	}
+	if (admin_query_is(packet, C("SELECT * FROM proxy_memory"))) {
+		admin_send_proxy_memory(con);
+
+		con->state = CON_STATE_SEND_QUERY_RESULT;
+
+		g_string_free(g_queue_pop_tail(recv_sock->recv_queue->chunks), TRUE);
+
+		return NETWORK_SOCKET_SUCCESS;
+	}
+	if (admin_query_is(packet, C("SELECT * FROM proxy_locks"))) {
+		admin_send_proxy_locks(con);
+
+		con->state = CON_STATE_SEND_QUERY_RESULT;
+
+		g_string_free(g_queue_pop_tail(recv_sock->recv_queue->chunks), TRUE);
+
+		return NETWORK_SOCKET_SUCCESS;
+	}
+	if (admin_query_is(packet, C("SELECT * FROM proxy_workers"))) {
+		admin_send_proxy_workers(con);
+
+		con->state = CON_STATE_SEND_QUERY_RESULT;
+
+		g_string_free(g_queue_pop_tail(recv_sock->recv_queue->chunks), TRUE);
+
+		return NETWORK_SOCKET_SUCCESS;
+	}
+	if (admin_query_is(packet, C("PROXY HEAP DUMP"))) {
+		admin_send_proxy_heap_dump(con);
+
+		con->state = CON_STATE_SEND_QUERY_RESULT;
+
+		g_string_free(g_queue_pop_tail(recv_sock->recv_queue->chunks), TRUE);
+
+		return NETWORK_SOCKET_SUCCESS;
+	}
+
 	ret = admin_lua_read_query(con);
 
 	switch (ret) {
@@ -484,7 +1114,7 @@ NETWORK_MYSQLD_PLUGIN_PROTO(server_read_query) {
  */
 NETWORK_MYSQLD_PLUGIN_PROTO(admin_disconnect_client) {
 	network_mysqld_con_lua_t *st = con->plugin_con_state;
-	lua_scope  *sc = con->srv->priv->sc;
+	lua_scope  *sc = network_mysqld_con_get_lua_scope(con);
 
 	if (st == NULL) return NETWORK_SOCKET_SUCCESS;
 	
@@ -528,6 +1158,9 @@ static void network_mysqld_admin_plugin_free(chassis_plugin_config *config) {
 		/* the socket will be freed by network_mysqld_free() */
 	}
 
+	/* waits until the thread left its loop */
+	if (config->event_thread) chassis_event_thread_free(config->event_thread);
+
 	if (config->address) {
 		g_free(config->address);
 	}
@@ -620,13 +1253,26 @@ static int network_mysqld_admin_plugin_apply_config(chassis *chas, chassis_plugi
 	}
 	g_message("admin-server listening on port %s", config->address);
 
+	/**
+	 * the admin connections run on a event-thread of their own with a lua-scope of their own:
+	 * a busy monitoring doesn't queue up behind the proxy traffic or wait for its lua-lock
+	 */
+	if (NULL == (config->event_thread = chassis_event_thread_new_dedicated(chas))) {
+		return -1;
+	}
+	con->sc = config->event_thread->sc;
+
 	/**
 	 * call network_mysqld_con_accept() with this connection when we are done
 	 */
 	event_set(&(listen_sock->event), listen_sock->fd, EV_READ|EV_PERSIST, network_mysqld_con_accept, con);
-	event_base_set(chas->event_base, &(listen_sock->event));
+	event_base_set(config->event_thread->event_base, &(listen_sock->event));
 	event_add(&(listen_sock->event), NULL);
 
+	if (0 != chassis_event_thread_start(config->event_thread)) {
+		return -1;
+	}
+
 	return 0;
 }
 
@@ -0,0 +1,1036 @@
+/* $%BEGINLICENSE%$
+ Copyright (c) 2008, 2013, Oracle and/or its affiliates. All rights reserved.
+
+ This program is free software; you can redistribute it and/or
+ modify it under the terms of the GNU General Public License as
+ published by the Free Software Foundation; version 2 of the
+ License.
+
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ GNU General Public License for more details.
+
+ You should have received a copy of the GNU General Public License
+ along with this program; if not, write to the Free Software
+ Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA
+ 02110-1301  USA
+
+ $%ENDLICENSE%$ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <string.h>
+#include <stdlib.h>
+#include <errno.h>
+
+#include <glib.h>
+
+#include "network-mysqld.h"
+#include "network-mysqld-proto.h"
+#include "network-mysqld-packet.h"
+#include "network-backend-client.h"
+#include "network-histogram.h"
+#include "network-capture.h"
+#include "chassis-event-thread.h"
+#include "sys-pedantic.h"
+#include "string-len.h"
+
+#include <gmodule.h>
+
+#ifndef PLUGIN_VERSION
+#ifdef CHASSIS_BUILD_TAG
+#define PLUGIN_VERSION PACKAGE_VERSION "." CHASSIS_BUILD_TAG
+#else
+#define PLUGIN_VERSION PACKAGE_VERSION
+#endif
+#endif
+
+/**
+ * loadgen plugin
+ *
+ * drives many non-blocking client connections against a MySQL server or a proxy from the
+ * event-threads and reports the throughput and the latency percentiles of the queries
+ *
+ *   mysql-proxy --plugins=loadgen --event-threads=4 \
+ *     --loadgen-address=127.0.0.1:4040 --loadgen-connections=10000 \
+ *     --loadgen-query="9:SELECT * FROM t WHERE id = 1" --loadgen-query="1:UPDATE t SET a = a + 1 WHERE id = 1" \
+ *     --loadgen-think-time=10 --loadgen-duration=60
+ *
+ * unlike tests/c-api-burst.c it doesn't need a OS thread per connection, the clients are
+ * spread over the event-threads like the connections of the proxy. Each event-thread counts
+ * the queries of its clients, the counts are only merged when the last client is done.
+ *
+ * with --loadgen-replay it replays a capture of --proxy-capture instead of the query-mix:
+ *
+ *   mysql-proxy --plugins=loadgen --event-threads=4 \
+ *     --loadgen-address=127.0.0.1:3306 --loadgen-password=secret \
+ *     --loadgen-replay=/var/tmp/proxy.cap --loadgen-replay-speed=4
+ *
+ * each connection of the capture becomes a client that logs in with the captured user and
+ * default-db and sends the captured commands at their original times, sped up by
+ * --loadgen-replay-speed. At speed 0 the clients connect at once and send the next command
+ * as soon as the result of the last one is in.
+ */
+
+#define LOADGEN_READ_TIMEOUT_SEC 30
+
+typedef struct {
+	GString *packet;             /**< the COM_QUERY without the network-header */
+	guint weight;
+} loadgen_query_t;
+
+/**
+ * a command of a captured connection
+ */
+typedef struct {
+	GString *packet;             /**< the command without the network-header */
+	guint64 offset_usec;         /**< sent at that time after the start of the capture */
+} loadgen_replay_command_t;
+
+/**
+ * a connection of the capture of --loadgen-replay
+ */
+typedef struct {
+	GString *username;
+	GString *default_db;
+	guint64 offset_usec;         /**< connected at that time after the start of the capture */
+
+	GPtrArray *commands;         /**< loadgen_replay_command_t */
+} loadgen_replay_session_t;
+
+/**
+ * the counts of the clients of one event-thread, only written by it
+ */
+typedef struct {
+	network_histogram_t latency; /**< microseconds from sending the query to the end of its result */
+
+	guint64 queries;
+	guint64 query_errors;        /**< queries that got a ERR packet */
+	guint64 failed;              /**< clients that couldn't connect or lost their connection */
+} loadgen_thread_t;
+
+struct chassis_plugin_config {
+	gchar *address;              /**< the server we send the queries to */
+	gchar *username;
+	gchar *password;
+	gint connections;
+	gchar **queries;             /**< [<weight>:]<query> */
+	gint think_time_ms;
+	gint duration_sec;
+	gchar *replay_filename;      /**< replay this capture instead of the query-mix */
+	gdouble replay_speed;        /**< 1 for the original timing, 0 to replay as fast as possible */
+
+	chassis *chas;
+
+	network_address *addr;
+	GPtrArray *query_mix;        /**< loadgen_query_t */
+	guint weight_sum;
+	GPtrArray *sessions;         /**< loadgen_replay_session_t of the --loadgen-replay */
+
+	GPtrArray *threads;          /**< a loadgen_thread_t per event-thread */
+	GPtrArray *clients;
+
+	guint64 ts_start;
+	guint64 ts_end;              /**< clients stop sending queries after it */
+	volatile gint clients_running;
+};
+
+typedef struct {
+	enum {
+		LOADGEN_CONNECT,
+		LOADGEN_READ_HANDSHAKE,
+		LOADGEN_SEND_AUTH,
+		LOADGEN_READ_AUTH_RESULT,
+		LOADGEN_THINK,
+		LOADGEN_SEND_QUERY,
+		LOADGEN_READ_QUERY_RESULT,
+		LOADGEN_DONE
+	} state;
+
+	chassis_plugin_config *config;
+
+	network_socket *server;
+	network_mysqld_com_query_result_t *query_result;
+	guint64 ts_query;
+
+	guint32 rand;                /**< xorshift state, g_random_*() takes a global lock */
+
+	loadgen_replay_session_t *session; /**< the connection we replay, NULL for the query-mix */
+	guint next_command;
+
+	struct event start_ev;       /**< connects the client and waits out the think-time */
+} loadgen_client_t;
+
+static void loadgen_client_handle(int event_fd, short events, void *user_data);
+static void loadgen_client_run(loadgen_client_t *client);
+
+static loadgen_thread_t *loadgen_get_thread(chassis_plugin_config *config) {
+	guint ndx = chassis_event_thread_get_local_index();
+
+	return config->threads->pdata[ndx < config->threads->len ? ndx : 0];
+}
+
+static guint32 loadgen_client_rand(loadgen_client_t *client) {
+	guint32 x = client->rand;
+
+	x ^= x << 13;
+	x ^= x >> 17;
+	x ^= x << 5;
+
+	return client->rand = x;
+}
+
+static loadgen_client_t *loadgen_client_new(chassis_plugin_config *config) {
+	loadgen_client_t *client;
+
+	client = g_new0(loadgen_client_t, 1);
+	client->config = config;
+	client->rand = g_random_int() | 1; /* xorshift never leaves 0 */
+
+	return client;
+}
+
+static void loadgen_client_close(loadgen_client_t *client) {
+	if (client->server) {
+		event_del(&(client->server->event));
+		network_socket_free(client->server);
+		client->server = NULL;
+	}
+
+	if (client->query_result) {
+		network_mysqld_com_query_result_free(client->query_result);
+		client->query_result = NULL;
+	}
+}
+
+static loadgen_replay_command_t *loadgen_replay_command_new(void) {
+	loadgen_replay_command_t *command;
+
+	command = g_new0(loadgen_replay_command_t, 1);
+	command->packet = g_string_new(NULL);
+
+	return command;
+}
+
+static void loadgen_replay_command_free(loadgen_replay_command_t *command) {
+	if (!command) return;
+
+	g_string_free(command->packet, TRUE);
+
+	g_free(command);
+}
+
+static loadgen_replay_session_t *loadgen_replay_session_new(void) {
+	loadgen_replay_session_t *session;
+
+	session = g_new0(loadgen_replay_session_t, 1);
+	session->username = g_string_new(NULL);
+	session->default_db = g_string_new(NULL);
+	session->commands = g_ptr_array_new();
+
+	return session;
+}
+
+static void loadgen_replay_session_free(loadgen_replay_session_t *session) {
+	guint i;
+
+	if (!session) return;
+
+	for (i = 0; i < session->commands->len; i++) {
+		loadgen_replay_command_free(session->commands->pdata[i]);
+	}
+	g_ptr_array_free(session->commands, TRUE);
+	g_string_free(session->username, TRUE);
+	g_string_free(session->default_db, TRUE);
+
+	g_free(session);
+}
+
+static void loadgen_client_free(loadgen_client_t *client) {
+	if (!client) return;
+
+	loadgen_client_close(client);
+	event_del(&(client->start_ev));
+
+	g_free(client);
+}
+
+/**
+ * merge the counts of the event-threads and log them
+ */
+static void loadgen_report(chassis_plugin_config *config) {
+	network_histogram_t *latency = network_histogram_new();
+	guint64 queries = 0, query_errors = 0, failed = 0;
+	guint64 elapsed_usec = chassis_get_rel_microseconds() - config->ts_start;
+	guint i;
+
+	for (i = 0; i < config->threads->len; i++) {
+		loadgen_thread_t *thr = config->threads->pdata[i];
+
+		network_histogram_merge(latency, &(thr->latency));
+		queries += thr->queries;
+		query_errors += thr->query_errors;
+		failed += thr->failed;
+	}
+
+	g_message("%s: loadgen: %"G_GUINT64_FORMAT" queries in %.1fs on %d connections: %.1f queries/s, %"G_GUINT64_FORMAT" failed queries, %"G_GUINT64_FORMAT" failed connections",
+			G_STRLOC,
+			queries,
+			elapsed_usec / 1000000.0,
+			config->connections,
+			elapsed_usec ? queries * 1000000.0 / elapsed_usec : 0.0,
+			query_errors,
+			failed);
+	g_message("%s: loadgen: latency in us: avg = %"G_GUINT64_FORMAT", p50 = %"G_GUINT64_FORMAT", p95 = %"G_GUINT64_FORMAT", p99 = %"G_GUINT64_FORMAT", p99.9 = %"G_GUINT64_FORMAT", max = %"G_GUINT64_FORMAT,
+			G_STRLOC,
+			latency->count ? latency->sum / latency->count : 0,
+			network_histogram_get_percentile(latency, 50.0),
+			network_histogram_get_percentile(latency, 95.0),
+			network_histogram_get_percentile(latency, 99.0),
+			network_histogram_get_percentile(latency, 99.9),
+			latency->max);
+
+	network_histogram_free(latency);
+}
+
+/**
+ * the client stops, the last one reports and shuts down the proxy
+ */
+static void loadgen_client_done(loadgen_client_t *client, const char *reason) {
+	chassis_plugin_config *config = client->config;
+
+	if (reason) {
+		g_debug("%s: loadgen: a client stopped: %s",
+				G_STRLOC,
+				reason);
+
+		loadgen_get_thread(config)->failed++;
+	}
+
+	loadgen_client_close(client);
+	client->state = LOADGEN_DONE;
+
+	if (g_atomic_int_dec_and_test(&(config->clients_running))) {
+		loadgen_report(config);
+
+		chassis_set_shutdown();
+	}
+}
+
+static void loadgen_client_wait_for_event(loadgen_client_t *client, short ev_type) {
+	network_socket *sock = client->server;
+	struct timeval tv = { LOADGEN_READ_TIMEOUT_SEC, 0 };
+
+	event_set(&(sock->event), sock->fd, ev_type, loadgen_client_handle, client);
+	chassis_event_add_with_timeout(client->config->chas, &(sock->event), &tv);
+}
+
+/**
+ * write the send-queue
+ *
+ * @return TRUE if everything is sent, FALSE if we wait for the socket or failed
+ */
+static gboolean loadgen_client_write(loadgen_client_t *client) {
+	switch (network_socket_write(client->server, -1)) {
+	case NETWORK_SOCKET_SUCCESS:
+		return TRUE;
+	case NETWORK_SOCKET_WAIT_FOR_EVENT:
+		loadgen_client_wait_for_event(client, EV_WRITE);
+		return FALSE;
+	default:
+		loadgen_client_done(client, "write failed");
+		return FALSE;
+	}
+}
+
+/**
+ * send a query picked by the weights of the query-mix, or stop if the time is up
+ *
+ * a replaying client sends its next captured command instead
+ */
+static void loadgen_client_send_query(loadgen_client_t *client) {
+	chassis_plugin_config *config = client->config;
+	GString *packet = NULL;
+
+	if (client->session) {
+		loadgen_replay_command_t *command = client->session->commands->pdata[client->next_command++];
+
+		packet = command->packet;
+	} else {
+		loadgen_query_t *query = NULL;
+		guint pick;
+		guint i;
+
+		if (chassis_get_rel_microseconds() >= config->ts_end) {
+			loadgen_client_done(client, NULL);
+			return;
+		}
+
+		pick = loadgen_client_rand(client) % config->weight_sum;
+		for (i = 0; i < config->query_mix->len; i++) {
+			query = config->query_mix->pdata[i];
+
+			if (pick < query->weight) break;
+			pick -= query->weight;
+		}
+
+		packet = query->packet;
+	}
+
+	network_mysqld_queue_reset(client->server);
+	network_mysqld_queue_append(client->server, client->server->send_queue, S(packet));
+
+	client->query_result = network_mysqld_com_query_result_new();
+	client->ts_query = chassis_get_rel_microseconds();
+	client->state = LOADGEN_SEND_QUERY;
+
+	loadgen_client_run(client);
+}
+
+static void loadgen_client_start_cb(int G_GNUC_UNUSED event_fd, short G_GNUC_UNUSED events, void *user_data) {
+	loadgen_client_t *client = user_data;
+
+	if (client->state == LOADGEN_THINK) {
+		loadgen_client_send_query(client);
+		return;
+	}
+
+	client->server = network_socket_new();
+	network_address_copy(client->server->dst, client->config->addr);
+
+	switch (network_socket_connect(client->server)) {
+	case NETWORK_SOCKET_SUCCESS:
+		client->state = LOADGEN_READ_HANDSHAKE;
+		loadgen_client_run(client);
+		break;
+	case NETWORK_SOCKET_ERROR_RETRY:
+		client->state = LOADGEN_CONNECT;
+		loadgen_client_wait_for_event(client, EV_WRITE);
+		break;
+	default:
+		loadgen_client_done(client, "connecting failed");
+		break;
+	}
+}
+
+/**
+ * wait until the next captured command is due
+ *
+ * the client is done with the last command of its connection
+ */
+static void loadgen_client_replay_wait(loadgen_client_t *client) {
+	chassis_plugin_config *config = client->config;
+	loadgen_replay_command_t *command;
+	struct timeval tv;
+	guint64 ts_due, ts_now;
+
+	if (client->next_command >= client->session->commands->len) {
+		loadgen_client_done(client, NULL);
+		return;
+	}
+
+	command = client->session->commands->pdata[client->next_command];
+
+	if (config->replay_speed == 0) {
+		loadgen_client_send_query(client);
+		return;
+	}
+
+	ts_due = config->ts_start + (guint64)(command->offset_usec / config->replay_speed);
+	ts_now = chassis_get_rel_microseconds();
+	if (ts_due <= ts_now) {
+		/* we are late, the server is slower than the captured one */
+		loadgen_client_send_query(client);
+		return;
+	}
+
+	tv.tv_sec = (ts_due - ts_now) / 1000000;
+	tv.tv_usec = (ts_due - ts_now) % 1000000;
+
+	client->state = LOADGEN_THINK;
+
+	evtimer_set(&(client->start_ev), loadgen_client_start_cb, client);
+	chassis_event_add_with_timeout(config->chas, &(client->start_ev), &tv);
+}
+
+/**
+ * the query is done, wait the think-time before the next one
+ *
+ * the think-time is uniform in [0, 2 * --loadgen-think-time] to not let the clients march in step
+ */
+static void loadgen_client_think(loadgen_client_t *client) {
+	chassis_plugin_config *config = client->config;
+	struct timeval tv;
+	guint64 think_usec;
+
+	if (client->session) {
+		loadgen_client_replay_wait(client);
+		return;
+	}
+
+	if (config->think_time_ms == 0) {
+		loadgen_client_send_query(client);
+		return;
+	}
+
+	think_usec = loadgen_client_rand(client) % (2 * (guint64)config->think_time_ms * 1000 + 1);
+	tv.tv_sec = think_usec / 1000000;
+	tv.tv_usec = think_usec % 1000000;
+
+	client->state = LOADGEN_THINK;
+
+	evtimer_set(&(client->start_ev), loadgen_client_start_cb, client);
+	chassis_event_add_with_timeout(config->chas, &(client->start_ev), &tv);
+}
+
+/**
+ * the packets of the result are counted and dropped, we don't keep them
+ *
+ * @return 1 if the result is complete, 0 if we need more packets, -1 on a protocol error
+ */
+static int loadgen_client_read_query_result(loadgen_client_t *client) {
+	GString *s;
+
+	while (NULL != (s = g_queue_pop_head(client->server->recv_queue->chunks))) {
+		network_packet packet;
+		int is_finished;
+
+		packet.data = s;
+		packet.offset = 0;
+
+		if (0 != network_mysqld_proto_skip_network_header(&packet)) {
+			g_string_free(s, TRUE);
+			return -1;
+		}
+
+		is_finished = network_mysqld_proto_get_com_query_result(&packet, client->query_result, FALSE);
+		g_string_free(s, TRUE);
+
+		if (is_finished != 0) return is_finished;
+	}
+
+	return 0;
+}
+
+static void loadgen_client_query_done(loadgen_client_t *client) {
+	loadgen_thread_t *thr = loadgen_get_thread(client->config);
+
+	network_histogram_add(&(thr->latency), chassis_get_rel_microseconds() - client->ts_query);
+	thr->queries++;
+	if (client->query_result->query_status != MYSQLD_PACKET_OK) thr->query_errors++;
+
+	network_mysqld_com_query_result_free(client->query_result);
+	client->query_result = NULL;
+}
+
+/**
+ * run the client until it has to wait for the network or the think-time
+ */
+static void loadgen_client_run(loadgen_client_t *client) {
+	for (;;) {
+		switch (client->state) {
+		case LOADGEN_CONNECT:
+			if (NETWORK_SOCKET_SUCCESS != network_socket_connect_finish(client->server)) {
+				loadgen_client_done(client, g_strerror(errno));
+				return;
+			}
+
+			client->state = LOADGEN_READ_HANDSHAKE;
+			break;
+		case LOADGEN_SEND_AUTH:
+			if (!loadgen_client_write(client)) return;
+
+			client->state = LOADGEN_READ_AUTH_RESULT;
+			break;
+		case LOADGEN_SEND_QUERY:
+			if (!loadgen_client_write(client)) return;
+
+			client->state = LOADGEN_READ_QUERY_RESULT;
+			break;
+		case LOADGEN_READ_HANDSHAKE:
+		case LOADGEN_READ_AUTH_RESULT:
+		case LOADGEN_READ_QUERY_RESULT:
+			switch (network_backend_client_read(client->server)) {
+			case NETWORK_SOCKET_SUCCESS:
+				break;
+			case NETWORK_SOCKET_WAIT_FOR_EVENT:
+				loadgen_client_wait_for_event(client, EV_READ);
+				return;
+			default:
+				loadgen_client_done(client, "read failed");
+				return;
+			}
+
+			switch (client->state) {
+			case LOADGEN_READ_HANDSHAKE: {
+				chassis_plugin_config *config = client->config;
+				int err;
+
+				if (client->session) {
+					err = network_backend_client_send_auth(client->server, client->session->username->str, config->password, client->session->default_db);
+				} else {
+					err = network_backend_client_send_auth(client->server, config->username, config->password, NULL);
+				}
+				if (0 != err) {
+					loadgen_client_done(client, "the server doesn't accept connections");
+					return;
+				}
+
+				client->state = LOADGEN_SEND_AUTH;
+				break; }
+			case LOADGEN_READ_AUTH_RESULT:
+				switch (network_backend_client_read_auth_result(client->server)) {
+				case 0:
+					break;
+				case 1:
+					if (client->session) {
+						loadgen_client_replay_wait(client);
+					} else {
+						loadgen_client_send_query(client);
+					}
+					return;
+				default:
+					loadgen_client_done(client, "the login failed");
+					return;
+				}
+				break;
+			case LOADGEN_READ_QUERY_RESULT:
+				switch (loadgen_client_read_query_result(client)) {
+				case 0:
+					loadgen_client_wait_for_event(client, EV_READ);
+					return;
+				case 1:
+					loadgen_client_query_done(client);
+					loadgen_client_think(client);
+					return;
+				default:
+					loadgen_client_done(client, "the result is invalid");
+					return;
+				}
+				break;
+			default:
+				g_assert_not_reached();
+			}
+			break;
+		case LOADGEN_THINK:
+		case LOADGEN_DONE:
+			return;
+		}
+	}
+}
+
+static void loadgen_client_handle(int G_GNUC_UNUSED event_fd, short events, void *user_data) {
+	loadgen_client_t *client = user_data;
+
+	if (events == EV_TIMEOUT) {
+		loadgen_client_done(client, "the server timed out");
+		return;
+	}
+
+	if (events & EV_READ) {
+		if (NETWORK_SOCKET_SUCCESS != network_socket_to_read(client->server)) {
+			loadgen_client_done(client, "ioctl() failed");
+			return;
+		}
+		if (client->server->to_read == 0) {
+			loadgen_client_done(client, "the server closed the connection");
+			return;
+		}
+	}
+
+	loadgen_client_run(client);
+}
+
+/**
+ * parse a [<weight>:]<query> of --loadgen-query
+ */
+static loadgen_query_t *loadgen_query_new(const gchar *spec) {
+	loadgen_query_t *query;
+	const gchar *s = spec;
+	guint weight = 0;
+
+	while (g_ascii_isdigit(*s)) {
+		weight = weight * 10 + (*s - '0');
+		s++;
+	}
+
+	if (s != spec && *s == ':') {
+		s++;
+	} else {
+		/* no weight, the digits are part of the query */
+		s = spec;
+		weight = 1;
+	}
+
+	if (weight == 0 || *s == '\0') return NULL;
+
+	query = g_new0(loadgen_query_t, 1);
+	query->weight = weight;
+	query->packet = g_string_new(NULL);
+	g_string_append_c(query->packet, COM_QUERY);
+	g_string_append(query->packet, s);
+
+	return query;
+}
+
+static void loadgen_query_free(loadgen_query_t *query) {
+	if (!query) return;
+
+	g_string_free(query->packet, TRUE);
+
+	g_free(query);
+}
+
+/**
+ * load the connections of a capture of --proxy-capture
+ *
+ * only the commands we can replay without the state of the original connection are kept:
+ * COM_QUERY, COM_INIT_DB and COM_PING. Prepared statements refer to the statement-ids
+ * of the captured server and are skipped, the client closes the connection itself.
+ *
+ * @return 0 on success, -1 on error
+ */
+static int loadgen_replay_load(chassis_plugin_config *config, GError **gerr) {
+	network_capture_reader_t *reader;
+	network_capture_record_t *record;
+	GHashTable *sessions; /* con-id -> session, only while the connection is open */
+	guint64 ts_first = 0;
+	gboolean is_first = TRUE;
+	guint64 skipped = 0;
+	int ret;
+
+	if (NULL == (reader = network_capture_reader_open(config->replay_filename, gerr))) return -1;
+
+	sessions = g_hash_table_new(g_direct_hash, g_direct_equal);
+	record = network_capture_record_new();
+
+	while (1 == (ret = network_capture_reader_next(reader, record))) {
+		loadgen_replay_session_t *session;
+		loadgen_replay_command_t *command;
+		const char *nul;
+		guint8 cmd;
+
+		/* the event-threads queue their records in about the order of their timestamps */
+		if (is_first || record->ts_usec < ts_first) {
+			ts_first = record->ts_usec;
+			is_first = FALSE;
+		}
+
+		session = g_hash_table_lookup(sessions, GUINT_TO_POINTER(record->con_id));
+
+		switch (record->type) {
+		case NETWORK_CAPTURE_CONNECT:
+			session = loadgen_replay_session_new();
+			session->offset_usec = record->ts_usec;
+
+			nul = memchr(record->payload->str, '\0', record->payload->len);
+			if (nul) {
+				g_string_assign_len(session->username, record->payload->str, nul - record->payload->str);
+				g_string_assign_len(session->default_db, nul + 1, record->payload->len - (nul + 1 - record->payload->str));
+			} else {
+				g_string_assign_len(session->username, S(record->payload));
+			}
+
+			g_ptr_array_add(config->sessions, session);
+			g_hash_table_insert(sessions, GUINT_TO_POINTER(record->con_id), session);
+			break;
+		case NETWORK_CAPTURE_PACKET:
+			/* the CONNECT got dropped, or a packet of a command that spans several packets */
+			if (NULL == session || record->payload->len <= NET_HEADER_SIZE) {
+				skipped++;
+				break;
+			}
+
+			cmd = record->payload->str[NET_HEADER_SIZE];
+			if (cmd != COM_QUERY && cmd != COM_INIT_DB && cmd != COM_PING) {
+				if (cmd != COM_QUIT) skipped++;
+				break;
+			}
+
+			command = loadgen_replay_command_new();
+			command->offset_usec = record->ts_usec;
+			g_string_assign_len(command->packet,
+					record->payload->str + NET_HEADER_SIZE,
+					record->payload->len - NET_HEADER_SIZE);
+			g_ptr_array_add(session->commands, command);
+			break;
+		case NETWORK_CAPTURE_CLOSE:
+			g_hash_table_remove(sessions, GUINT_TO_POINTER(record->con_id));
+			break;
+		default:
+			skipped++;
+			break;
+		}
+	}
+
+	network_capture_record_free(record);
+	g_hash_table_destroy(sessions);
+	network_capture_reader_free(reader);
+
+	if (ret == -1) {
+		/* the capture was still written to, replay what we have */
+		g_message("%s: loadgen: %s ends with a truncated record",
+				G_STRLOC,
+				config->replay_filename);
+	}
+
+	if (config->sessions->len == 0) {
+		g_set_error(gerr, NETWORK_CAPTURE_ERROR, NETWORK_CAPTURE_ERROR_FORMAT,
+				"%s has no connections",
+				config->replay_filename);
+		return -1;
+	}
+
+	/* make the times relative to the start of the capture */
+	{
+		guint i, j;
+
+		for (i = 0; i < config->sessions->len; i++) {
+			loadgen_replay_session_t *session = config->sessions->pdata[i];
+
+			session->offset_usec -= ts_first;
+
+			for (j = 0; j < session->commands->len; j++) {
+				loadgen_replay_command_t *command = session->commands->pdata[j];
+
+				command->offset_usec -= ts_first;
+			}
+		}
+	}
+
+	if (skipped > 0) {
+		g_message("%s: loadgen: skipped %"G_GUINT64_FORMAT" records of %s we can't replay",
+				G_STRLOC,
+				skipped,
+				config->replay_filename);
+	}
+
+	return 0;
+}
+
+static chassis_plugin_config *network_mysqld_loadgen_plugin_new(void) {
+	chassis_plugin_config *config;
+
+	config = g_new0(chassis_plugin_config, 1);
+	config->connections = 100;
+	config->duration_sec = 10;
+	config->replay_speed = 1.0;
+	config->query_mix = g_ptr_array_new();
+	config->sessions = g_ptr_array_new();
+	config->threads = g_ptr_array_new();
+	config->clients = g_ptr_array_new();
+
+	return config;
+}
+
+static void network_mysqld_loadgen_plugin_free(chassis_plugin_config *config) {
+	guint i;
+
+	/* the event-threads are stopped, nobody uses the clients anymore */
+	for (i = 0; i < config->clients->len; i++) {
+		loadgen_client_free(config->clients->pdata[i]);
+	}
+	g_ptr_array_free(config->clients, TRUE);
+
+	for (i = 0; i < config->threads->len; i++) {
+		g_free(config->threads->pdata[i]);
+	}
+	g_ptr_array_free(config->threads, TRUE);
+
+	for (i = 0; i < config->query_mix->len; i++) {
+		loadgen_query_free(config->query_mix->pdata[i]);
+	}
+	g_ptr_array_free(config->query_mix, TRUE);
+
+	for (i = 0; i < config->sessions->len; i++) {
+		loadgen_replay_session_free(config->sessions->pdata[i]);
+	}
+	g_ptr_array_free(config->sessions, TRUE);
+
+	if (config->addr) network_address_free(config->addr);
+
+	if (config->address) g_free(config->address);
+	if (config->username) g_free(config->username);
+	if (config->password) g_free(config->password);
+	if (config->queries) g_strfreev(config->queries);
+	if (config->replay_filename) g_free(config->replay_filename);
+
+	g_free(config);
+}
+
+/**
+ * add the loadgen specific options to the cmdline interface
+ */
+static GOptionEntry * network_mysqld_loadgen_plugin_get_options(chassis_plugin_config *config) {
+	guint i;
+
+	static GOptionEntry config_entries[] =
+	{
+		{ "loadgen-address",          0, 0, G_OPTION_ARG_STRING, NULL, "address:port of the server to send the queries to (default: :4040)", "<host:port>" },
+		{ "loadgen-username",         0, 0, G_OPTION_ARG_STRING, NULL, "username to log in with (default: root)", "<user>" },
+		{ "loadgen-password",         0, 0, G_OPTION_ARG_STRING, NULL, "password to log in with (default: none)", "<password>" },
+		{ "loadgen-connections",      0, 0, G_OPTION_ARG_INT, NULL, "client connections (default: 100)", "<int>" },
+		{ "loadgen-query",            0, 0, G_OPTION_ARG_STRING_ARRAY, NULL, "a query of the mix, picked by its weight (default: SELECT 1)", "[<weight>:]<query>" },
+		{ "loadgen-think-time",       0, 0, G_OPTION_ARG_INT, NULL, "average milli-seconds a client waits between its queries (default: 0)", "<ms>" },
+		{ "loadgen-duration",         0, 0, G_OPTION_ARG_INT, NULL, "seconds to send queries, then report and shut down (default: 10)", "<sec>" },
+		{ "loadgen-replay",           0, 0, G_OPTION_ARG_FILENAME, NULL, "replay the connections of a --proxy-capture instead of the query-mix", "<file>" },
+		{ "loadgen-replay-speed",     0, 0, G_OPTION_ARG_DOUBLE, NULL, "replay N times faster than captured, 0 for as fast as possible (default: 1)", "<factor>" },
+
+		{ NULL,                       0, 0, G_OPTION_ARG_NONE,   NULL, NULL, NULL }
+	};
+
+	i = 0;
+	config_entries[i++].arg_data = &(config->address);
+	config_entries[i++].arg_data = &(config->username);
+	config_entries[i++].arg_data = &(config->password);
+	config_entries[i++].arg_data = &(config->connections);
+	config_entries[i++].arg_data = &(config->queries);
+	config_entries[i++].arg_data = &(config->think_time_ms);
+	config_entries[i++].arg_data = &(config->duration_sec);
+	config_entries[i++].arg_data = &(config->replay_filename);
+	config_entries[i++].arg_data = &(config->replay_speed);
+
+	return config_entries;
+}
+
+/**
+ * init the plugin with the parsed config
+ */
+static int network_mysqld_loadgen_plugin_apply_config(chassis *chas, chassis_plugin_config *config) {
+	struct timeval tv = { 0, 0 };
+	gint i;
+
+	if (!config->address) config->address = g_strdup(":4040");
+	if (!config->username) config->username = g_strdup("root");
+
+	if (config->connections <= 0) {
+		g_critical("%s: --loadgen-connections has to be > 0, got %d",
+				G_STRLOC,
+				config->connections);
+		return -1;
+	}
+
+	if (config->duration_sec <= 0) {
+		g_critical("%s: --loadgen-duration has to be > 0, got %d",
+				G_STRLOC,
+				config->duration_sec);
+		return -1;
+	}
+
+	if (config->think_time_ms < 0) {
+		g_critical("%s: --loadgen-think-time has to be >= 0, got %d",
+				G_STRLOC,
+				config->think_time_ms);
+		return -1;
+	}
+
+	if (config->replay_speed < 0) {
+		g_critical("%s: --loadgen-replay-speed has to be >= 0, got %.2f",
+				G_STRLOC,
+				config->replay_speed);
+		return -1;
+	}
+
+	if (config->replay_filename) {
+		GError *gerr = NULL;
+
+		if (0 != loadgen_replay_load(config, &gerr)) {
+			g_critical("%s: --loadgen-replay: %s", G_STRLOC, gerr->message);
+			g_clear_error(&gerr);
+			return -1;
+		}
+
+		/* the capture sets the connections */
+		config->connections = config->sessions->len;
+	} else if (config->queries) {
+		for (i = 0; config->queries[i]; i++) {
+			loadgen_query_t *query;
+
+			if (NULL == (query = loadgen_query_new(config->queries[i]))) {
+				g_critical("%s: --loadgen-query=%s is invalid, expected [<weight>:]<query>",
+						G_STRLOC,
+						config->queries[i]);
+				return -1;
+			}
+
+			g_ptr_array_add(config->query_mix, query);
+			config->weight_sum += query->weight;
+		}
+	} else {
+		loadgen_query_t *query = loadgen_query_new("SELECT 1");
+
+		g_ptr_array_add(config->query_mix, query);
+		config->weight_sum += query->weight;
+	}
+
+	/* resolve it once, the clients copy it */
+	config->addr = network_address_new();
+	if (0 != network_address_set_address(config->addr, config->address)) {
+		return -1;
+	}
+
+	config->chas = chas;
+
+	for (i = 0; i < MAX(chas->event_thread_count, 1); i++) {
+		g_ptr_array_add(config->threads, g_new0(loadgen_thread_t, 1));
+	}
+
+	config->ts_start = chassis_get_rel_microseconds();
+	config->ts_end = config->ts_start + (guint64)config->duration_sec * G_USEC_PER_SEC;
+	config->clients_running = config->connections;
+
+	/* the main-thread spreads the clients over the event-threads, each client stays on its thread */
+	for (i = 0; i < config->connections; i++) {
+		loadgen_client_t *client = loadgen_client_new(config);
+
+		g_ptr_array_add(config->clients, client);
+
+		if (config->replay_filename) {
+			/* connect when the captured connection did */
+			client->session = config->sessions->pdata[i];
+
+			if (config->replay_speed > 0) {
+				guint64 offset_usec = client->session->offset_usec / config->replay_speed;
+
+				tv.tv_sec = offset_usec / 1000000;
+				tv.tv_usec = offset_usec % 1000000;
+			}
+		}
+
+		evtimer_set(&(client->start_ev), loadgen_client_start_cb, client);
+		chassis_event_add_with_timeout(chas, &(client->start_ev), &tv);
+	}
+
+	if (config->replay_filename) {
+		g_message("%s: loadgen: replaying %d connections of %s to %s at %.2fx",
+				G_STRLOC,
+				config->connections,
+				config->replay_filename,
+				config->address,
+				config->replay_speed);
+	} else {
+		g_message("%s: loadgen: %d connections to %s for %d seconds",
+				G_STRLOC,
+				config->connections,
+				config->address,
+				config->duration_sec);
+	}
+
+	return 0;
+}
+
+G_MODULE_EXPORT int plugin_init(chassis_plugin *p) {
+	p->magic        = CHASSIS_PLUGIN_MAGIC;
+	p->name         = g_strdup("loadgen");
+	p->version		= g_strdup(PLUGIN_VERSION);
+
+	p->init         = network_mysqld_loadgen_plugin_new;
+	p->get_options  = network_mysqld_loadgen_plugin_get_options;
+	p->apply_config = network_mysqld_loadgen_plugin_apply_config;
+	p->destroy      = network_mysqld_loadgen_plugin_free;
+
+	return 0;
+}
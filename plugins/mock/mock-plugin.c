@@ -0,0 +1,555 @@
+/* $%BEGINLICENSE%$
+ Copyright (c) 2008, 2013, Oracle and/or its affiliates. All rights reserved.
+
+ This program is free software; you can redistribute it and/or
+ modify it under the terms of the GNU General Public License as
+ published by the Free Software Foundation; version 2 of the
+ License.
+
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ GNU General Public License for more details.
+
+ You should have received a copy of the GNU General Public License
+ along with this program; if not, write to the Free Software
+ Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA
+ 02110-1301  USA
+
+ $%ENDLICENSE%$ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <string.h>
+#include <stdlib.h>
+#include <math.h>
+#include <errno.h>
+
+#include "network-mysqld.h"
+#include "network-mysqld-proto.h"
+#include "network-mysqld-packet.h"
+#include "network-mysqld-resultset-writer.h"
+#include "chassis-event-thread.h"
+#include "sys-pedantic.h"
+#include "string-len.h"
+
+#include <gmodule.h>
+
+#ifndef PLUGIN_VERSION
+#ifdef CHASSIS_BUILD_TAG
+#define PLUGIN_VERSION PACKAGE_VERSION "." CHASSIS_BUILD_TAG
+#else
+#define PLUGIN_VERSION PACKAGE_VERSION
+#endif
+#endif
+
+/**
+ * mock plugin
+ *
+ * a MySQL server that accepts any login and answers each COM_QUERY with the same canned
+ * result-set, to benchmark the proxy without measuring a mysqld:
+ *
+ *   mysql-proxy --plugins=mock --mock-address=:3307 \
+ *     --mock-rows=1000 --mock-columns=4 --mock-row-size=200 --mock-latency=exp:500
+ *
+ * the rows are written with the resultset-writer from a static buffer. Large results are
+ * written in steps of MOCK_SEND_QUEUE_SIZE, a client that reads slowly holds up its result
+ * like a real server would.
+ *
+ * --mock-latency delays the start of each result:
+ *
+ * - fixed:<usec>
+ * - uniform:<min-usec>-<max-usec>
+ * - exp:<mean-usec>, exponentially distributed
+ */
+
+#define MOCK_SEND_QUEUE_SIZE (256 * 1024) /**< stop writing rows when this much is waiting to be sent */
+
+typedef enum {
+	MOCK_LATENCY_NONE,
+	MOCK_LATENCY_FIXED,
+	MOCK_LATENCY_UNIFORM,
+	MOCK_LATENCY_EXP
+} mock_latency_t;
+
+struct chassis_plugin_config {
+	gchar *address;                   /**< listening address of the mock server */
+	gint rows;
+	gint columns;
+	gint row_size;                    /**< bytes of the values of a row */
+	gchar *latency;
+
+	mock_latency_t latency_type;
+	guint64 latency_a;                /**< fixed: the delay, uniform: the min, exp: the mean */
+	guint64 latency_b;                /**< uniform: the max */
+
+	GPtrArray *fields;
+	gchar *values;                    /**< the bytes of all values, shared by all rows */
+	const char **row_values;
+	gsize *row_values_len;
+
+	network_mysqld_con *listen_con;
+};
+
+typedef struct {
+	network_mysqld_resultset_writer_t *w; /**< set while the rows of a result are written */
+	guint64 rows_left;
+
+	guint32 rand;                     /**< xorshift state for the latencies */
+
+	struct event delay_ev;
+	gboolean is_delayed;
+	gboolean is_woken;
+} plugin_con_state;
+
+static plugin_con_state *plugin_con_state_new(void) {
+	plugin_con_state *st;
+
+	st = g_new0(plugin_con_state, 1);
+	st->rand = g_random_int() | 1; /* xorshift never leaves 0 */
+
+	return st;
+}
+
+static void plugin_con_state_free(plugin_con_state *st) {
+	if (!st) return;
+
+	if (st->w) network_mysqld_resultset_writer_free(st->w);
+	if (st->is_delayed) evtimer_del(&(st->delay_ev));
+
+	g_free(st);
+}
+
+static guint32 mock_rand(plugin_con_state *st) {
+	guint32 x = st->rand;
+
+	x ^= x << 13;
+	x ^= x >> 17;
+	x ^= x << 5;
+
+	return st->rand = x;
+}
+
+/**
+ * draw the delay of the next result
+ */
+static guint64 mock_get_latency(chassis_plugin_config *config, plugin_con_state *st) {
+	gdouble u;
+
+	switch (config->latency_type) {
+	case MOCK_LATENCY_NONE:
+		return 0;
+	case MOCK_LATENCY_FIXED:
+		return config->latency_a;
+	case MOCK_LATENCY_UNIFORM:
+		return config->latency_a + mock_rand(st) % (config->latency_b - config->latency_a + 1);
+	case MOCK_LATENCY_EXP:
+		u = (mock_rand(st) + 1.0) / 4294967297.0; /* (0, 1) */
+
+		return (guint64)(-log(u) * config->latency_a);
+	}
+
+	return 0;
+}
+
+/**
+ * parse --mock-latency
+ *
+ * @return 0 on success, -1 if it is invalid
+ */
+static int mock_parse_latency(chassis_plugin_config *config, const gchar *s) {
+	gchar *end;
+
+	if (g_str_has_prefix(s, "fixed:")) {
+		config->latency_type = MOCK_LATENCY_FIXED;
+		config->latency_a = g_ascii_strtoull(s + sizeof("fixed:") - 1, &end, 10);
+	} else if (g_str_has_prefix(s, "uniform:")) {
+		config->latency_type = MOCK_LATENCY_UNIFORM;
+		config->latency_a = g_ascii_strtoull(s + sizeof("uniform:") - 1, &end, 10);
+		if (*end != '-') return -1;
+		config->latency_b = g_ascii_strtoull(end + 1, &end, 10);
+		if (config->latency_b < config->latency_a) return -1;
+	} else if (g_str_has_prefix(s, "exp:")) {
+		config->latency_type = MOCK_LATENCY_EXP;
+		config->latency_a = g_ascii_strtoull(s + sizeof("exp:") - 1, &end, 10);
+	} else {
+		return -1;
+	}
+
+	return *end == '\0' ? 0 : -1;
+}
+
+/**
+ * write rows until the send-queue is full
+ *
+ * @return TRUE when the result is complete
+ */
+static gboolean mock_write_rows(chassis_plugin_config *config, network_mysqld_con *con) {
+	plugin_con_state *st = con->plugin_con_state;
+
+	while (st->rows_left > 0 && con->client->send_queue->len < MOCK_SEND_QUEUE_SIZE) {
+		network_mysqld_resultset_writer_write_row_len(st->w, config->row_values, config->row_values_len);
+		st->rows_left--;
+	}
+
+	if (st->rows_left > 0) {
+		network_mysqld_resultset_writer_flush(st->w);
+
+		return FALSE;
+	}
+
+	network_mysqld_resultset_writer_finish(st->w);
+	network_mysqld_resultset_writer_free(st->w);
+	st->w = NULL;
+
+	return TRUE;
+}
+
+static void mock_start_result(chassis_plugin_config *config, network_mysqld_con *con) {
+	plugin_con_state *st = con->plugin_con_state;
+
+	st->w = network_mysqld_resultset_writer_new(con->client);
+	st->rows_left = config->rows;
+
+	network_mysqld_resultset_writer_write_fields(st->w, config->fields);
+
+	mock_write_rows(config, con);
+
+	con->state = CON_STATE_SEND_QUERY_RESULT;
+}
+
+static void mock_wakeup(int G_GNUC_UNUSED event_fd, short G_GNUC_UNUSED events, void *user_data) {
+	network_mysqld_con *con = user_data;
+	plugin_con_state *st = con->plugin_con_state;
+
+	st->is_delayed = FALSE;
+	st->is_woken = TRUE;
+
+	network_mysqld_con_handle(-1, 0, con);
+}
+
+NETWORK_MYSQLD_PLUGIN_PROTO(mock_con_init) {
+	network_mysqld_auth_challenge *challenge;
+	GString *packet;
+
+	g_assert(con->plugin_con_state == NULL);
+
+	con->plugin_con_state = plugin_con_state_new();
+
+	challenge = network_mysqld_auth_challenge_new();
+	challenge->server_version_str = g_strdup("5.1.99-proxy-mock");
+	challenge->server_version     = 50199;
+	challenge->charset            = 0x08; /* latin1 */
+	challenge->server_status      = SERVER_STATUS_AUTOCOMMIT;
+	challenge->thread_id          = 1;
+
+	network_mysqld_auth_challenge_set_challenge(challenge); /* generate a random challenge */
+
+	packet = g_string_new(NULL);
+	network_mysqld_proto_append_auth_challenge(packet, challenge);
+	con->client->challenge = challenge;
+
+	network_mysqld_queue_append(con->client, con->client->send_queue, S(packet));
+
+	g_string_free(packet, TRUE);
+
+	con->state = CON_STATE_SEND_HANDSHAKE;
+
+	return NETWORK_SOCKET_SUCCESS;
+}
+
+/**
+ * any user and password is fine, we only want the capabilities of the client
+ */
+NETWORK_MYSQLD_PLUGIN_PROTO(mock_read_auth) {
+	network_socket *recv_sock = con->client;
+	network_mysqld_auth_response *auth;
+	network_packet packet;
+
+	packet.data = g_queue_peek_head(recv_sock->recv_queue->chunks);
+	packet.offset = 0;
+
+	network_mysqld_proto_skip_network_header(&packet);
+
+	auth = network_mysqld_auth_response_new(con->client->challenge->capabilities);
+	if (network_mysqld_proto_get_auth_response(&packet, auth)) {
+		network_mysqld_auth_response_free(auth);
+		return NETWORK_SOCKET_ERROR;
+	}
+
+	con->client->response = auth;
+
+	network_mysqld_con_send_ok(con->client);
+
+	g_string_free(g_queue_pop_tail(recv_sock->recv_queue->chunks), TRUE);
+
+	con->state = CON_STATE_SEND_AUTH_RESULT;
+
+	return NETWORK_SOCKET_SUCCESS;
+}
+
+NETWORK_MYSQLD_PLUGIN_PROTO(mock_read_query) {
+	chassis_plugin_config *config = con->config;
+	plugin_con_state *st = con->plugin_con_state;
+	network_socket *recv_sock = con->client;
+	network_packet packet;
+	guint8 command;
+	guint64 delay;
+	int err = 0;
+
+	packet.data = g_queue_peek_head(recv_sock->recv_queue->chunks);
+	packet.offset = 0;
+
+	err = err || network_mysqld_proto_skip_network_header(&packet);
+	err = err || network_mysqld_proto_get_int8(&packet, &command);
+	if (err) return NETWORK_SOCKET_ERROR;
+
+	g_string_free(g_queue_pop_head(recv_sock->recv_queue->chunks), TRUE);
+
+	con->state = CON_STATE_SEND_QUERY_RESULT;
+
+	switch (command) {
+	case COM_QUERY:
+		if (0 == (delay = mock_get_latency(config, st))) {
+			mock_start_result(config, con);
+		} else {
+			struct timeval tv;
+
+			tv.tv_sec  = delay / G_USEC_PER_SEC;
+			tv.tv_usec = delay % G_USEC_PER_SEC;
+
+			evtimer_set(&(st->delay_ev), mock_wakeup, con);
+			chassis_event_add_local_with_timeout(chas, &(st->delay_ev), &tv);
+			st->is_delayed = TRUE;
+
+			con->state = CON_STATE_WAIT_ASYNC;
+		}
+		break;
+	case COM_PING:
+	case COM_INIT_DB:
+		network_mysqld_con_send_ok(con->client);
+		break;
+	case COM_QUIT:
+		con->state = CON_STATE_CLOSE_CLIENT;
+		break;
+	default:
+		network_mysqld_con_send_error(con->client, C("(mock) command not supported"));
+		break;
+	}
+
+	return NETWORK_SOCKET_SUCCESS;
+}
+
+/**
+ * write the next rows once the client took the last ones
+ */
+NETWORK_MYSQLD_PLUGIN_PROTO(mock_send_query_result) {
+	chassis_plugin_config *config = con->config;
+	plugin_con_state *st = con->plugin_con_state;
+
+	if (st->w) {
+		mock_write_rows(config, con);
+
+		return NETWORK_SOCKET_SUCCESS;
+	}
+
+	con->state = CON_STATE_READ_QUERY;
+
+	return NETWORK_SOCKET_SUCCESS;
+}
+
+/**
+ * the latency of the result is over
+ */
+NETWORK_MYSQLD_PLUGIN_PROTO(mock_wait_async) {
+	chassis_plugin_config *config = con->config;
+	plugin_con_state *st = con->plugin_con_state;
+
+	if (!st->is_woken) return NETWORK_SOCKET_WAIT_FOR_EVENT; /* we just started to wait */
+
+	st->is_woken = FALSE;
+
+	mock_start_result(config, con);
+
+	return NETWORK_SOCKET_SUCCESS;
+}
+
+NETWORK_MYSQLD_PLUGIN_PROTO(mock_cleanup) {
+	plugin_con_state_free(con->plugin_con_state);
+	con->plugin_con_state = NULL;
+
+	return NETWORK_SOCKET_SUCCESS;
+}
+
+static int network_mysqld_mock_connection_init(network_mysqld_con *con) {
+	con->plugins.con_init                      = mock_con_init;
+	con->plugins.con_read_auth                 = mock_read_auth;
+	con->plugins.con_read_query                = mock_read_query;
+	con->plugins.con_send_query_result         = mock_send_query_result;
+	con->plugins.con_wait_async                = mock_wait_async;
+	con->plugins.con_cleanup                   = mock_cleanup;
+
+	return 0;
+}
+
+static chassis_plugin_config *network_mysqld_mock_plugin_new(void) {
+	chassis_plugin_config *config;
+
+	config = g_new0(chassis_plugin_config, 1);
+	config->rows = 1;
+	config->columns = 1;
+	config->row_size = 16;
+
+	return config;
+}
+
+static void network_mysqld_mock_plugin_free(chassis_plugin_config *config) {
+	if (config->listen_con) {
+		/* the socket will be freed by network_mysqld_free() */
+	}
+
+	if (config->address) g_free(config->address);
+	if (config->latency) g_free(config->latency);
+	if (config->fields) network_mysqld_proto_fielddefs_free(config->fields);
+	if (config->values) g_free(config->values);
+	if (config->row_values) g_free(config->row_values);
+	if (config->row_values_len) g_free(config->row_values_len);
+
+	g_free(config);
+}
+
+/**
+ * add the mock specific options to the cmdline interface
+ */
+static GOptionEntry * network_mysqld_mock_plugin_get_options(chassis_plugin_config *config) {
+	guint i;
+
+	static GOptionEntry config_entries[] =
+	{
+		{ "mock-address",             0, 0, G_OPTION_ARG_STRING, NULL, "listening address:port of the mock-server (default: :4044)", "<host:port>" },
+		{ "mock-rows",                0, 0, G_OPTION_ARG_INT, NULL, "rows of each result-set (default: 1)", "<int>" },
+		{ "mock-columns",             0, 0, G_OPTION_ARG_INT, NULL, "columns of each result-set (default: 1)", "<int>" },
+		{ "mock-row-size",            0, 0, G_OPTION_ARG_INT, NULL, "bytes of the values of a row, split over the columns (default: 16)", "<bytes>" },
+		{ "mock-latency",             0, 0, G_OPTION_ARG_STRING, NULL, "delay of each result in micro-seconds (default: none)", "fixed:<usec>|uniform:<min>-<max>|exp:<mean>" },
+
+		{ NULL,                       0, 0, G_OPTION_ARG_NONE,   NULL, NULL, NULL }
+	};
+
+	i = 0;
+	config_entries[i++].arg_data = &(config->address);
+	config_entries[i++].arg_data = &(config->rows);
+	config_entries[i++].arg_data = &(config->columns);
+	config_entries[i++].arg_data = &(config->row_size);
+	config_entries[i++].arg_data = &(config->latency);
+
+	return config_entries;
+}
+
+/**
+ * init the plugin with the parsed config
+ */
+static int network_mysqld_mock_plugin_apply_config(chassis *chas, chassis_plugin_config *config) {
+	network_mysqld_con *con;
+	network_socket *listen_sock;
+	gsize value_len;
+	gint i;
+
+	if (!config->address) config->address = g_strdup(":4044");
+
+	if (config->rows < 0) {
+		g_critical("%s: --mock-rows has to be >= 0, got %d",
+				G_STRLOC,
+				config->rows);
+		return -1;
+	}
+
+	if (config->columns <= 0) {
+		g_critical("%s: --mock-columns has to be > 0, got %d",
+				G_STRLOC,
+				config->columns);
+		return -1;
+	}
+
+	if (config->row_size < 0) {
+		g_critical("%s: --mock-row-size has to be >= 0, got %d",
+				G_STRLOC,
+				config->row_size);
+		return -1;
+	}
+
+	if (config->latency && 0 != mock_parse_latency(config, config->latency)) {
+		g_critical("%s: --mock-latency=%s is invalid, expected fixed:<usec>, uniform:<min>-<max> or exp:<mean>",
+				G_STRLOC,
+				config->latency);
+		return -1;
+	}
+
+	/* the canned result-set, the last column gets the rest of the row-size */
+	config->fields = network_mysqld_proto_fielddefs_new();
+	config->row_values = g_new0(const char *, config->columns);
+	config->row_values_len = g_new0(gsize, config->columns);
+	config->values = g_malloc(config->row_size + 1);
+	memset(config->values, 'x', config->row_size);
+	config->values[config->row_size] = '\0';
+
+	value_len = config->row_size / config->columns;
+
+	for (i = 0; i < config->columns; i++) {
+		MYSQL_FIELD *field = network_mysqld_proto_fielddef_new();
+
+		field->name = g_strdup_printf("c%d", i + 1);
+		field->type = FIELD_TYPE_VAR_STRING;
+		g_ptr_array_add(config->fields, field);
+
+		config->row_values[i] = config->values;
+		config->row_values_len[i] = (i == config->columns - 1) ? config->row_size - value_len * i : value_len;
+	}
+
+	/**
+	 * create a connection handle for the listen socket
+	 */
+	con = network_mysqld_con_new();
+	network_mysqld_add_connection(chas, con);
+	con->config = config;
+
+	config->listen_con = con;
+
+	listen_sock = network_socket_new();
+	con->server = listen_sock;
+
+	/* set the plugin hooks as we want to apply them to the new connections too later */
+	network_mysqld_mock_connection_init(con);
+
+	if (0 != network_address_set_address(listen_sock->dst, config->address)) {
+		return -1;
+	}
+
+	if (0 != network_socket_bind(listen_sock)) {
+		return -1;
+	}
+	g_message("mock-server listening on port %s", config->address);
+
+	/**
+	 * call network_mysqld_con_accept() with this connection when we are done
+	 */
+	event_set(&(listen_sock->event), listen_sock->fd, EV_READ|EV_PERSIST, network_mysqld_con_accept, con);
+	event_base_set(chas->event_base, &(listen_sock->event));
+	event_add(&(listen_sock->event), NULL);
+
+	return 0;
+}
+
+G_MODULE_EXPORT int plugin_init(chassis_plugin *p) {
+	p->magic        = CHASSIS_PLUGIN_MAGIC;
+	p->name         = g_strdup("mock");
+	p->version		= g_strdup(PLUGIN_VERSION);
+
+	p->init         = network_mysqld_mock_plugin_new;
+	p->get_options  = network_mysqld_mock_plugin_get_options;
+	p->apply_config = network_mysqld_mock_plugin_apply_config;
+	p->destroy      = network_mysqld_mock_plugin_free;
+
+	return 0;
+}
@@ -132,6 +132,7 @@ typedef int socklen_t;
 #include "network-mysqld-packet.h"
 
 #include "network-mysqld-lua.h"
+#include "network-mysqld-metrics.h"
 
 #include "network-conn-pool.h"
 #include "network-conn-pool-lua.h"
@@ -139,9 +140,28 @@ typedef int socklen_t;
 #include "sys-pedantic.h"
 #include "network-injection.h"
 #include "network-injection-lua.h"
+#include "network-async-query.h"
+#include "network-async-query-lua.h"
 #include "network-backend.h"
+#include "network-backend-health.h"
+#include "network-query-cache.h"
+#include "network-query-log.h"
+#include "network-trace.h"
+#include "network-capture.h"
+#include "network-admission.h"
+#include "network-auth-cache.h"
+#include "network-query-timeout.h"
+#include "network-shard-map.h"
+#include "network-query-rules.h"
+#include "network-mirror.h"
+#include "network-read-hedge.h"
+#include "network-stmt-cache.h"
+#include "network-stmt-promote.h"
+#include "network-mysqld-compress.h"
+#include "network-ssl.h"
 #include "glib-ext.h"
 #include "lua-env.h"
+#include "lua-scope.h"
 
 #include "proxy-plugin.h"
 
@@ -149,6 +169,14 @@ typedef int socklen_t;
 
 #include "chassis-timings.h"
 #include "chassis-gtimeval.h"
+#include "chassis-event-thread.h"
+
+#if defined(HAVE_SYS_SDT_H) && defined(ENABLE_DTRACE)
+#include <sys/sdt.h>
+#include "proxy-dtrace-provider.h"
+#else
+#include "disable-dtrace.h"
+#endif
 
 #define C(x) x, sizeof(x) - 1
 #define S(x) x->str, x->len
@@ -180,32 +208,363 @@ typedef int socklen_t;
 
 #define CRASHME() do { char *_crashme = NULL; *_crashme = 0; } while(0);
 
+/**
+ * what the reads stick to with --proxy-rw-split-affinity
+ */
+typedef enum {
+	PROXY_AFFINITY_NONE,
+	PROXY_AFFINITY_USER,
+	PROXY_AFFINITY_DB,
+	PROXY_AFFINITY_COLUMN              /**< the value of a column in the conditions of the query, like a shard key */
+} proxy_affinity_key_t;
+
 struct chassis_plugin_config {
 	gchar *address;                   /**< listening address of the proxy */
 
 	gchar **backend_addresses;        /**< read-write backends */
 	gchar **read_only_backend_addresses; /**< read-only  backends */
+	gchar **backend_groups;           /**< named groups of the backends, <name>[(<option>=<value>[,...])]=<address>[,...] */
+	gchar **backend_source_addresses; /**< the source IPs of the connects to the backends, [<address>=]<ip>[,...] */
 
 	gint fix_bug_25371;               /**< suppress the second ERR packet of bug #25371 */
 
 	gint profiling;                   /**< skips the execution of the read_query() function */
 	
 	gchar *lua_script;                /**< script to load at the start the connection */
+	gint lua_script_check_interval;   /**< check the scripts for changes every <secs> seconds, 0 to stat() them on each load */
+	struct event *lua_script_check_timer;
+	chassis_worker_pool_t *workers;   /**< stat()s the scripts and resolves the backends for the timers */
+
+	gint backend_dns_ttl;             /**< resolve the host-names of the backends again every <secs> seconds, 0 to only resolve them at the start */
+	struct event *backend_dns_timer;
+	network_backends_t *backend_dns_backends; /**< the backends the timer resolves */
 
 	gint pool_change_user;            /**< don't reset the connection, when a connection is taken from the pool
 					       - this safes a round-trip, but we also don't cleanup the connection
 					       - another name could be "fast-pool-connect", but that's too friendly
 					       */
+	gchar *auth_cache_filename;       /**< the double-SHA1 of the users to check logins on pooled connections, NULL to disable */
+	network_auth_cache_t *auth_cache;
+	chassis_metric_t *pool_resets_total; /**< owned by the chassis, NULL without the auth-cache */
+	gint lazy_connect;                /**< auth the clients against the auth-cache, connect to a backend at the first query */
+	network_mysqld_auth_challenge *lazy_challenge; /**< the last handshake of a backend, the clients get a copy */
+	GMutex *lazy_challenge_mutex;
 
 	gint start_proxy;
 
+	gint listen_reuseport;            /**< open a SO_REUSEPORT listen socket in each event-thread */
+
+	gint pool_max_idle_time;          /**< close pooled connections idling longer than this (in seconds), stay below the wait_timeout of the backends */
+
+	gint rw_split;                    /**< send SELECTs outside of transactions to the read-only backends without lua */
+	gint rw_split_read_your_writes;   /**< after a write, only send SELECTs to read-only backends that replicated it */
+	gchar *rw_split_affinity;         /**< user, db or column:<name>, the SELECTs of a key stick to a read-only backend, NULL to pick the fastest */
+	proxy_affinity_key_t rw_split_affinity_key;
+	network_shard_map_t *rw_split_affinity_map; /**< for column:<name>, a map without shards that only knows the key column */
+	gint rw_split_affinity_load_factor; /**< a read-only backend takes no more than this percent of the average clients */
+	gdouble read_hedge_percentile;    /**< send a read to a second read-only backend if its first packet takes longer than this percentile, 0 to disable */
+	gdouble read_hedge_budget;        /**< the percent of the reads that may be sent twice */
+	network_read_hedge_t *read_hedge; /**< NULL if disabled */
+	chassis_metric_t *read_hedges_total; /**< owned by the chassis */
+	gchar *shard_map_filename;        /**< route the queries to the backends of the shard of their key, NULL to disable */
+	network_shard_router_t *shard_router;
+	chassis_metric_t *shard_queries_total; /**< owned by the chassis */
+	chassis_metric_t *shard_scatter_queries_total; /**< owned by the chassis */
+	gchar *mirror_backend;            /**< mirror sampled reads to this backend, NULL to disable */
+	gchar *mirror_user;               /**< login as this user on the mirror */
+	gchar *mirror_password;
+	gdouble mirror_sample;            /**< the share of the reads outside of transactions that are mirrored */
+	gint mirror_queue_size;           /**< queries waiting for the mirror per event-thread, more are shed */
+	gint mirror_connections;          /**< connections to the mirror per event-thread */
+	network_mirror_t *mirror;
+	gchar **rate_limits;              /**< the rules of the rate-limiter, <key>:<rate>[:<burst>[:<max-wait-ms>]]=<match> */
+	gint rate_limit_queue_size;       /**< queries that wait for a token at once, more are rejected */
+	gchar *firewall_filename;         /**< the allow and deny rules of the queries, NULL to disable */
+	chassis_metric_t *firewall_queries_total; /**< owned by the chassis */
+	gint multiplex;                   /**< give the backend connection back to the pool between two statements */
+	gint multiplex_wait_timeout;      /**< milliseconds a statement waits for a pooled connection of its session, 0 to fail at once */
+	gint idle_release_time;           /**< give the backend connection of a client idling longer than this (in seconds) back to the pool, 0 to disable */
+	gint idle_evict_connections;      /**< over this many open client connections close the longest idling clients, 0 to disable */
+	gint idle_evict_memory;           /**< over this many MB used by the client connections close the longest idling clients, 0 to disable */
+	chassis_metric_t *idle_clients_total; /**< owned by the chassis */
+	gint pipeline_injections;         /**< send the injected queries without waiting for the results of the previous ones */
+	gint local_answers;               /**< answer COM_PING, SELECT @@version_comment and redundant SETs without the backend */
+	chassis_metric_t *local_answers_total; /**< owned by the chassis */
+	gint client_compress;             /**< offer CLIENT_COMPRESS to the clients */
+	gint backend_compress;            /**< ask the backends for CLIENT_COMPRESS */
+
+	gchar *ssl_cert;                  /**< certificate (chain) to offer TLS to the clients */
+	gchar *ssl_key;                   /**< private key of the certificate, if not in ssl_cert */
+	gchar *ssl_ticket_key;            /**< session-ticket key shared by all proxies */
+	gint backend_ssl;                 /**< use TLS to the backends which support it */
+	gchar *backend_ssl_ca;            /**< verify the certificates of the backends */
+	network_ssl_ctx_t *ssl_ctx;       /**< TLS towards the clients, NULL if disabled */
+	network_ssl_ctx_t *backend_ssl_ctx; /**< TLS towards the backends, NULL if disabled */
+	GPtrArray *pool_timers;           /**< the pool maintenance timers of the event-threads */
+
+	gdouble health_check_interval;    /**< probe the backends every <secs> seconds, 0 to let the clients find out */
+	gchar *health_check_user;         /**< login as this user for the ping query */
+	gchar *health_check_password;
+	gchar *health_check_query;        /**< the ping query, a COM_PING if not set */
+	gint health_check_max_lag;        /**< read-only backends with a bigger Seconds_Behind_Master are LAGGING, -1 to disable */
+	network_backends_health_t *health;
+
+	gint query_cache_size;            /**< cache the results of read-only queries in <bytes>, 0 to disable */
+	gdouble query_cache_ttl;          /**< serve cached results for <secs> seconds */
+
+	gint query_digest_size;           /**< keep the stats of up to <n> normalized queries per event-thread, 0 to disable */
+
+	gint shared_dict_size;            /**< proxy.shared may use up to <bytes>, 0 to disable */
+
+	gchar *query_log_filename;        /**< log the queries as JSON lines to <file>, NULL to disable */
+	gdouble query_log_min_time;       /**< only log queries that took at least <secs> */
+	gint query_log_sample;            /**< only log every <n>th of them */
+	network_query_log_t *query_log;
+
+	gchar *capture_filename;          /**< capture the packets of the clients to <file>, NULL to disable */
+	network_capture_t *capture;
+
+	gint backend_max_queries;         /**< queries in flight per backend, 0 for unlimited */
+	gint user_max_queries;            /**< queries in flight per user, 0 for unlimited */
+	gint admission_queue_size;        /**< queries waiting for the limits at most */
+	gint admission_queue_timeout;     /**< milliseconds a query waits before it gets a ERR packet */
+	network_admission_t *admission;
+	network_backends_t *admission_backends; /**< the backends whose queries the metrics report */
+	chassis_metric_t *admission_wait_duration; /**< owned by the chassis */
+
+	gint send_queue_high_watermark;   /**< stop reading the result above <bytes> in the client's send-queue */
+	gint send_queue_low_watermark;    /**< read it again below <bytes> */
+	gint send_queue_budget;           /**< megabytes in the send-queues of all clients, 0 for unlimited */
+	gint result_spool_threshold;      /**< spool the result to a temporary file above <kbytes> in the client's send-queue, 0 to disable */
+
+	gint query_hints;                 /**< act on the hints of the comment in front of a query, see network_mysqld_proto_get_query_hints() */
+	gchar *query_rules_filename;      /**< the hints of the queries by their user, db, command and class, NULL to disable */
+	network_query_rules_t *query_rules;
+
+	gchar *backend_local_socket;      /**< connect to the backends on this host through the unix-socket <path>, "auto" to look for it, NULL to disable */
+
+	gchar *trace_address;             /**< send the spans of the sampled queries to <host:port>, NULL to disable */
+	gint trace_sample;                /**< also trace every <n>th query without a trace-context, 0 for none */
+	network_trace_t *trace;
+
 	network_mysqld_con *listen_con;
 
 	gdouble connect_timeout_dbl; /* exposed in the config as double */
+	gint connect_hedge_delay;         /**< connect to a second backend if the first didn't connect within <ms>, 0 to disable */
+	gint breaker_error_rate;          /**< open the circuit-breaker of a backend if this percent of its queries failed, 0 to disable */
+	gint breaker_slow_query;          /**< a query slower than <ms> counts as failed, 0 to disable */
+	gint breaker_half_open_share;     /**< the percent of the picks a backend on probation takes part in */
+	chassis_metric_t *connect_hedges_total; /**< owned by the chassis */
 	gdouble read_timeout_dbl; /* exposed in the config as double */
 	gdouble write_timeout_dbl; /* exposed in the config as double */
+
+	gdouble query_timeout;            /**< KILL the queries that run longer than <secs> on the backend, 0 to disable */
+	gchar *query_timeout_filename;    /**< the budgets of single queries, NULL to disable */
+	network_query_timeouts_t *query_timeouts;
+	chassis_metric_t *query_timeouts_total; /**< owned by the chassis */
+
+	gint stmt_promote_threshold;      /**< execute the SELECTs whose shape was seen <n> times as prepared statements, 0 to disable */
+	network_stmt_promote_t *stmt_promote; /**< NULL if disabled */
+	chassis_metric_t *stmt_promoted_total; /**< owned by the chassis */
+	chassis_metric_t *stmt_promote_fallbacks_total; /**< owned by the chassis */
 };
 
+/**
+ * stop the second connect of --proxy-connect-hedge-delay, the first one connected or the client went away
+ */
+static void proxy_connect_hedge_cancel(network_mysqld_con *con) {
+	network_mysqld_con_lua_t *st = con->plugin_con_state;
+
+	if (st->hedge_is_armed) {
+		evtimer_del(&(st->hedge_ev));
+		st->hedge_is_armed = FALSE;
+	}
+
+	if (st->hedge_server) {
+		/* it isn't down, only slower than the other */
+		network_socket_free(st->hedge_server);
+		st->hedge_server = NULL;
+		st->hedge_backend = NULL;
+	}
+}
+
+/**
+ * the first connect failed, wait for the second one instead
+ *
+ * the state-machine waits for con->server, the event of the second connect is removed
+ *
+ * @return TRUE if there is a second connect and it is con->server now
+ */
+static gboolean proxy_connect_hedge_promote(network_mysqld_con *con) {
+	network_mysqld_con_lua_t *st = con->plugin_con_state;
+
+	if (NULL == st->hedge_server) {
+		proxy_connect_hedge_cancel(con);
+
+		return FALSE;
+	}
+
+	event_del(&(st->hedge_server->event));
+
+	con->server = st->hedge_server;
+	st->backend = st->hedge_backend;
+	st->backend_ndx = st->hedge_backend_ndx;
+	st->ts_connect = st->hedge_ts_connect;
+
+	st->hedge_server = NULL;
+	st->hedge_backend = NULL;
+
+	return TRUE;
+}
+
+/**
+ * the second connect was first, the first one is closed
+ *
+ * the first backend isn't marked as down, it was only slower
+ */
+static void proxy_connect_hedge_won(network_mysqld_con *con) {
+	network_mysqld_con_lua_t *st = con->plugin_con_state;
+
+	if (con->config->connect_hedges_total) chassis_metric_add_label(con->config->connect_hedges_total, 1, 1);
+
+	/* removes the event the state-machine waits for */
+	network_socket_free(con->server);
+	con->server = NULL;
+
+	proxy_connect_hedge_promote(con);
+
+	/* proxy_connect_server() finishes the connect */
+	network_mysqld_con_handle(-1, 0, con);
+}
+
+static void proxy_connect_hedge_ready(int G_GNUC_UNUSED event_fd, short G_GNUC_UNUSED events, void *user_data) {
+	network_mysqld_con *con = user_data;
+	network_mysqld_con_lua_t *st = con->plugin_con_state;
+
+	switch (network_socket_connect_finish(st->hedge_server)) {
+	case NETWORK_SOCKET_SUCCESS:
+		proxy_connect_hedge_won(con);
+		break;
+	default:
+		g_message("%s: connect(%s) failed: %s",
+				G_STRLOC,
+				st->hedge_server->dst->name->str, g_strerror(errno));
+
+		/* the first connect may still make it */
+		if (!network_backend_local_socket_failed(st->hedge_backend, st->hedge_server->dst)) {
+			network_backend_connect_failed(st->hedge_backend);
+		}
+		network_socket_free(st->hedge_server);
+		st->hedge_server = NULL;
+		st->hedge_backend = NULL;
+		break;
+	}
+}
+
+/**
+ * pick the backend for the second connect
+ *
+ * only backends of the same type that are UP and whose circuit-breaker is closed:
+ * the first connects to a backend that was down shouldn't be a race
+ *
+ * @return the index of the backend with the least connected clients, -1 if there is none
+ */
+static int proxy_connect_hedge_get_backend(network_mysqld_con *con) {
+	network_mysqld_con_lua_t *st = con->plugin_con_state;
+	chassis_private *g = con->srv->priv;
+	GPtrArray *backends = network_backends_get_snapshot(g->backends);
+	guint min_connected_clients = G_MAXUINT;
+	int ndx = -1;
+	guint i;
+
+	for (i = 0; i < backends->len; i++) {
+		network_backend_t *cur = backends->pdata[i];
+
+		if (cur == st->backend ||
+		    cur->state != BACKEND_STATE_UP ||
+		    cur->breaker.state != NETWORK_BACKEND_BREAKER_CLOSED ||
+		    cur->type != st->backend->type) continue;
+
+		if (cur->connected_clients < min_connected_clients) {
+			ndx = i;
+			min_connected_clients = cur->connected_clients;
+		}
+	}
+
+	return ndx;
+}
+
+/**
+ * the first connect didn't connect within --proxy-connect-hedge-delay, connect to another backend too
+ *
+ * a black-holed backend would hold up the client for --proxy-connect-timeout. The
+ * first connect that finishes is used, the other is closed.
+ */
+static void proxy_connect_hedge_start(int G_GNUC_UNUSED event_fd, short G_GNUC_UNUSED events, void *user_data) {
+	network_mysqld_con *con = user_data;
+	network_mysqld_con_lua_t *st = con->plugin_con_state;
+	chassis_private *g = con->srv->priv;
+	chassis_event_thread_t *event_thread = chassis_event_thread_get_local();
+	network_backend_t *backend;
+	network_socket *hedge;
+	int ndx;
+
+	st->hedge_is_armed = FALSE;
+
+	if (con->state != CON_STATE_CONNECT_SERVER || NULL == con->server) return;
+
+	if ((ndx = proxy_connect_hedge_get_backend(con)) < 0) return;
+	backend = network_backends_get(g->backends, ndx);
+
+	hedge = network_socket_new();
+	network_backend_get_address(backend, hedge->dst);
+	hedge->bind_src = network_backend_get_source_address(backend, hedge->dst, hedge->src);
+
+	if (con->config->connect_hedges_total) chassis_metric_add_label(con->config->connect_hedges_total, 0, 1);
+
+	st->hedge_server = hedge;
+	st->hedge_backend = backend;
+	st->hedge_backend_ndx = ndx;
+	st->hedge_ts_connect = chassis_get_rel_microseconds();
+
+	switch (network_socket_connect(hedge)) {
+	case NETWORK_SOCKET_ERROR_RETRY:
+		event_set(&(hedge->event), hedge->fd, EV_WRITE, proxy_connect_hedge_ready, con);
+		event_base_set(event_thread->event_base, &(hedge->event));
+		event_add(&(hedge->event), NULL);
+		break;
+	case NETWORK_SOCKET_SUCCESS:
+		proxy_connect_hedge_won(con);
+		break;
+	default:
+		if (!network_backend_local_socket_failed(backend, hedge->dst)) network_backend_connect_failed(backend);
+		network_socket_free(hedge);
+		st->hedge_server = NULL;
+		st->hedge_backend = NULL;
+		break;
+	}
+}
+
+/**
+ * start the second connect if the first one takes longer than --proxy-connect-hedge-delay
+ */
+static void proxy_connect_hedge_arm(network_mysqld_con *con) {
+	network_mysqld_con_lua_t *st = con->plugin_con_state;
+	chassis_event_thread_t *event_thread = chassis_event_thread_get_local();
+	struct timeval tv;
+
+	if (con->config->connect_hedge_delay <= 0 || NULL == event_thread) return;
+	if (st->hedge_is_armed || st->hedge_server) return;
+
+	tv.tv_sec = con->config->connect_hedge_delay / 1000;
+	tv.tv_usec = (con->config->connect_hedge_delay % 1000) * 1000;
+
+	evtimer_set(&(st->hedge_ev), proxy_connect_hedge_start, con);
+	event_base_set(event_thread->event_base, &(st->hedge_ev));
+	evtimer_add(&(st->hedge_ev), &tv);
+	st->hedge_is_armed = TRUE;
+}
+
 /**
  * handle event-timeouts on the different states
  *
@@ -228,12 +587,12 @@ NETWORK_MYSQLD_PLUGIN_PROTO(proxy_timeout) {
 					con->server->dst->name->str,
 					timeout);
 
-			st->backend->state = BACKEND_STATE_DOWN;
-			chassis_gtime_testset_now(&st->backend->state_since, NULL);
+			network_backend_connect_failed(st->backend);
 			network_socket_free(con->server);
 			con->server = NULL;
 
-			/* stay in this state and let it pick another backend */
+			/* wait for the second connect if there is one, otherwise stay in this state and let it pick another backend */
+			if (proxy_connect_hedge_promote(con)) st->hedge_is_promoted = TRUE;
 
 			return NETWORK_SOCKET_SUCCESS;
 		}
@@ -255,6 +614,143 @@ NETWORK_MYSQLD_PLUGIN_PROTO(proxy_timeout) {
 	}
 }
 	
+/**
+ * the injection the next result belongs to
+ */
+static injection *proxy_injection_peek(network_mysqld_con_lua_t *st) {
+	if (0 != st->injected.pipelined->length) return g_queue_peek_head(st->injected.pipelined);
+
+	return g_queue_peek_head(st->injected.queries);
+}
+
+/**
+ * can the query be sent before the result of the previous one is read
+ *
+ * only COM_QUERYs, other commands may have no result (COM_STMT_CLOSE, ...)
+ */
+static gboolean proxy_injection_is_pipelinable(injection *inj) {
+	return inj->query->len > 0 && inj->query->str[0] == COM_QUERY;
+}
+
+/**
+ * send the next injected query to the server
+ *
+ * with --proxy-pipeline-injections the COM_QUERYs at the head of the queue are
+ * sent in one go and wait in st->injected.pipelined for their results
+ */
+static void proxy_injection_send(network_mysqld_con *con) {
+	network_mysqld_con_lua_t *st = con->plugin_con_state;
+	network_socket *send_sock = con->server;
+	injection *inj;
+
+	if (!con->config->pipeline_injections) {
+		inj = g_queue_peek_head(st->injected.queries);
+
+		network_mysqld_queue_reset(send_sock);
+		network_mysqld_queue_append(send_sock, send_sock->send_queue, S(inj->query));
+		MYSQLPROXY_INJECTION_SEND(con, inj->id, inj->query->len > 0 ? inj->query->str[0] : -1);
+
+		return;
+	}
+
+	do {
+		inj = g_queue_pop_head(st->injected.queries);
+
+		/* each query starts with packet-id 0 */
+		network_mysqld_queue_reset(send_sock);
+		network_mysqld_queue_append(send_sock, send_sock->send_queue, S(inj->query));
+		MYSQLPROXY_INJECTION_SEND(con, inj->id, inj->query->len > 0 ? inj->query->str[0] : -1);
+
+		network_injection_queue_append(st->injected.pipelined, inj);
+	} while (proxy_injection_is_pipelinable(inj) &&
+	         NULL != (inj = g_queue_peek_head(st->injected.queries)) &&
+	         proxy_injection_is_pipelinable(inj));
+}
+
+/**
+ * set up the result tracking of a query we already sent
+ *
+ * the core does this for the first packet of the send-queue, the pipelined
+ * queries behind it need it once their result is next
+ */
+static void proxy_injection_track_command(network_mysqld_con *con, injection *inj) {
+	network_packet p;
+	GString *packet;
+
+	packet = g_string_sized_new(NET_HEADER_SIZE + inj->query->len);
+	network_mysqld_proto_append_packet_len(packet, inj->query->len);
+	network_mysqld_proto_append_packet_id(packet, 0);
+	g_string_append_len(packet, S(inj->query));
+
+	p.data = packet;
+	p.offset = 0;
+
+	if (0 != network_mysqld_con_command_states_init(con, &p)) {
+		g_debug("%s: tracking mysql protocol states failed", G_STRLOC);
+	}
+
+	g_string_free(packet, TRUE);
+}
+
+/**
+ * the tokenizers of the query of a COM_QUERY packet, their cycles are accounted to the
+ * tokenizer-subsystem of the event-thread
+ */
+static network_mysqld_query_rw_type_t proxy_query_get_rw_type(GString *packet) {
+	chassis_event_thread_cpu_t cpu = chassis_event_thread_cpu_enter(CHASSIS_EVENT_THREAD_CPU_TOKENIZER);
+	network_mysqld_query_rw_type_t rw_type;
+
+	rw_type = network_mysqld_proto_get_query_rw_type(packet->str + NET_HEADER_SIZE + 1, packet->len - NET_HEADER_SIZE - 1);
+
+	chassis_event_thread_cpu_leave(cpu);
+
+	return rw_type;
+}
+
+static gboolean proxy_query_has_session_state(GString *packet) {
+	chassis_event_thread_cpu_t cpu = chassis_event_thread_cpu_enter(CHASSIS_EVENT_THREAD_CPU_TOKENIZER);
+	gboolean has_session_state;
+
+	has_session_state = network_mysqld_proto_query_has_session_state(packet->str + NET_HEADER_SIZE + 1, packet->len - NET_HEADER_SIZE - 1);
+
+	chassis_event_thread_cpu_leave(cpu);
+
+	return has_session_state;
+}
+
+static gboolean proxy_query_get_hints(GString *packet, network_mysqld_query_hints_t *hints) {
+	chassis_event_thread_cpu_t cpu = chassis_event_thread_cpu_enter(CHASSIS_EVENT_THREAD_CPU_TOKENIZER);
+	gboolean has_hints;
+
+	has_hints = network_mysqld_proto_get_query_hints(packet->str + NET_HEADER_SIZE + 1, packet->len - NET_HEADER_SIZE - 1, hints);
+
+	chassis_event_thread_cpu_leave(cpu);
+
+	return has_hints;
+}
+
+static void proxy_query_fingerprint(GString *dst, guint64 *hash, GString *packet) {
+	chassis_event_thread_cpu_t cpu = chassis_event_thread_cpu_enter(CHASSIS_EVENT_THREAD_CPU_TOKENIZER);
+
+	network_query_digest_fingerprint(dst, hash, packet->str + NET_HEADER_SIZE + 1, packet->len - NET_HEADER_SIZE - 1);
+
+	chassis_event_thread_cpu_leave(cpu);
+}
+
+/**
+ * call a proxy_lua_*() hook with its cycles accounted to the lua-subsystem of the event-thread
+ */
+static network_mysqld_lua_stmt_ret proxy_lua_call(network_mysqld_lua_stmt_ret (*hook)(network_mysqld_con *con), network_mysqld_con *con) {
+	chassis_event_thread_cpu_t cpu = chassis_event_thread_cpu_enter(CHASSIS_EVENT_THREAD_CPU_LUA);
+	network_mysqld_lua_stmt_ret ret;
+
+	ret = hook(con);
+
+	chassis_event_thread_cpu_leave(cpu);
+
+	return ret;
+}
+
 static network_mysqld_lua_stmt_ret proxy_lua_read_query_result(network_mysqld_con *con) {
 	network_socket *send_sock = con->client;
 	network_socket *recv_sock = con->server;
@@ -268,11 +764,22 @@ static network_mysqld_lua_stmt_ret proxy_lua_read_query_result(network_mysqld_co
 	 * if not, clean the send-queue 
 	 */
 
-	if (0 == st->injected.queries->length) return PROXY_NO_DECISION;
-
-	inj = g_queue_pop_head(st->injected.queries);
+	if (0 != st->injected.pipelined->length) {
+		inj = g_queue_pop_head(st->injected.pipelined);
+	} else if (0 != st->injected.queries->length) {
+		inj = g_queue_pop_head(st->injected.queries);
+	} else {
+		return PROXY_NO_DECISION;
+	}
 
 #ifdef HAVE_LUA_H
+	if (network_mysqld_con_lua_skips_hook(st, NETWORK_MYSQLD_LUA_HOOK_READ_QUERY_RESULT)) {
+		/* nothing to look at, forward the result as it is */
+		injection_free(inj);
+
+		return PROXY_NO_DECISION;
+	}
+
 	/* call the lua script to pick a backend
 	 * */
 	switch(network_mysqld_con_lua_register_callback(con, con->config->lua_script)) {
@@ -309,6 +816,9 @@ static network_mysqld_lua_stmt_ret proxy_lua_read_query_result(network_mysqld_co
 			proxy_getinjectionmetatable(L);
 			lua_setmetatable(L, -2);
 
+			network_mysqld_con_lua_ffi_view_set_injection(st, inj);
+
+			MYSQLPROXY_LUA_ENTER(con, "read_query_result");
 			if (lua_pcall(L, 1, 1, 0) != 0) {
 				g_critical("(read_query_result) %s", lua_tostring(L, -1));
 
@@ -321,6 +831,8 @@ static network_mysqld_lua_stmt_ret proxy_lua_read_query_result(network_mysqld_co
 				}
 				lua_pop(L, 1);
 			}
+			network_mysqld_con_lua_ffi_view_reset(st);
+			MYSQLPROXY_LUA_LEAVE(con, "read_query_result", ret);
 
 			if (!con->resultset_is_needed && (PROXY_NO_DECISION != ret)) {
 				/* if the user asks us to work on the resultset, but hasn't buffered it ... ignore the result */
@@ -410,6 +922,7 @@ static network_mysqld_lua_stmt_ret proxy_lua_read_query_result(network_mysqld_co
 			g_message("%s.%d: (network_mysqld_con_handle_proxy_resultset) got wrong type: %s", __FILE__, __LINE__, lua_typename(L, lua_type(L, -1)));
 			lua_pop(L, 1); /* pop the nil */
 		}
+		st->hooks = network_mysqld_lua_fenv_get_hooks(L);
 		lua_pop(L, 1); /* fenv */
 
 		g_assert(lua_isfunction(L, -1));
@@ -421,59 +934,295 @@ static network_mysqld_lua_stmt_ret proxy_lua_read_query_result(network_mysqld_co
 	return ret;
 }
 
+#ifdef HAVE_LUA_H
 /**
- * call the lua function to intercept the handshake packet
+ * push a text row as table, NULL is nil like in inj.resultset.rows
  *
- * @return PROXY_SEND_QUERY  to send the packet from the client
- *         PROXY_NO_DECISION to pass the server packet unmodified
+ * @return 0 on success, -1 if the row is invalid
  */
-static network_mysqld_lua_stmt_ret proxy_lua_read_handshake(network_mysqld_con *con) {
-	network_mysqld_lua_stmt_ret ret = PROXY_NO_DECISION; /* send what the server gave us */
+static int proxy_lua_push_text_row(lua_State *L, GString *row, guint64 columns) {
+	network_packet packet;
+	guint64 i;
+	int err = 0;
+
+	packet.data = row;
+	packet.offset = 0;
+
+	err = err || network_mysqld_proto_skip_network_header(&packet);
+	if (err) return -1;
+
+	lua_newtable(L);
+
+	for (i = 0; i < columns; i++) {
+		network_mysqld_lenenc_type lenenc_type;
+		guint64 field_len;
+
+		err = err || network_mysqld_proto_peek_lenenc_type(&packet, &lenenc_type);
+		if (err) break;
+
+		if (lenenc_type == NETWORK_MYSQLD_LENENC_TYPE_NULL) {
+			err = err || network_mysqld_proto_skip(&packet, 1);
+			continue;
+		} else if (lenenc_type != NETWORK_MYSQLD_LENENC_TYPE_INT) {
+			err = 1;
+			break;
+		}
+
+		err = err || network_mysqld_proto_get_lenenc_int(&packet, &field_len);
+		err = err || !(field_len <= packet.data->len - packet.offset);
+		if (err) break;
+
+		lua_pushlstring(L, packet.data->str + packet.offset, field_len);
+		lua_rawseti(L, -2, i + 1);
+
+		err = err || network_mysqld_proto_skip(&packet, field_len);
+	}
+
+	if (err) {
+		lua_pop(L, 1); /* the row */
+		return -1;
+	}
+
+	return 0;
+}
+
+/**
+ * append the table on the top of the stack as text row, nil and what isn't a string or number is NULL
+ */
+static void proxy_lua_append_text_row(lua_State *L, GString *row, guint64 columns) {
+	guint64 i;
+
+	for (i = 0; i < columns; i++) {
+		lua_rawgeti(L, -1, i + 1);
+		if (lua_isstring(L, -1)) {
+			size_t s_len;
+			const char *s = lua_tolstring(L, -1, &s_len);
+
+			network_mysqld_proto_append_lenenc_string_len(row, s, s_len);
+		} else {
+			g_string_append_c(row, (gchar)0xfb);
+		}
+		lua_pop(L, 1);
+	}
+}
+#endif
+
+/**
+ * call read_query_result_rows(inj, rows) for the rows that are waiting in st->rows_batch
+ *
+ * the rows the hook returns are sent instead of the batch, nil sends the batch as it is
+ *
+ * @return TRUE if the hook replaced the rows, FALSE if the batch has to be sent
+ */
+static gboolean proxy_lua_read_query_result_rows(network_mysqld_con *con, injection *inj) {
+	gboolean is_replaced = FALSE;
 #ifdef HAVE_LUA_H
 	network_mysqld_con_lua_t *st = con->plugin_con_state;
-
+	GPtrArray *rows = st->rows_batch;
 	lua_State *L;
+	guint i;
 
-	/* call the lua script to pick a backend
-	   ignore the return code from network_mysqld_con_lua_register_callback, because we cannot do anything about it,
-	   it would always show up as ERROR 2013, which is not helpful.
-	 */
-	(void)network_mysqld_con_lua_register_callback(con, con->config->lua_script);
+	if (network_mysqld_con_lua_skips_hook(st, NETWORK_MYSQLD_LUA_HOOK_READ_QUERY_RESULT_ROWS)) return FALSE;
 
-	if (!st->L) return ret;
+	/* read_query() registered the script already */
+	if (REGISTER_CALLBACK_SUCCESS != network_mysqld_con_lua_register_callback(con, con->config->lua_script)) return FALSE;
+	if (!st->L) return FALSE;
 
 	L = st->L;
 
 	g_assert(lua_isfunction(L, -1));
 	lua_getfenv(L, -1);
 	g_assert(lua_istable(L, -1));
-	
-	lua_getfield_literal(L, -1, C("read_handshake"));
+
+	lua_getfield_literal(L, -1, C("read_query_result_rows"));
 	if (lua_isfunction(L, -1)) {
-		/* export
-		 *
-		 * every thing we know about it
-		 *  */
+		injection **inj_p;
 
-		if (lua_pcall(L, 0, 1, 0) != 0) {
-			g_critical("(read_handshake) %s", lua_tostring(L, -1));
+		inj_p = lua_newuserdata(L, sizeof(inj));
+		*inj_p = inj;
 
-			lua_pop(L, 1); /* errmsg */
+		proxy_getinjectionmetatable(L);
+		lua_setmetatable(L, -2);
 
-			/* the script failed, but we have a useful default */
+		lua_createtable(L, rows->len, 0);
+		for (i = 0; i < rows->len; i++) {
+			if (0 != proxy_lua_push_text_row(L, rows->pdata[i], st->rows_batch_columns)) break;
+
+			lua_rawseti(L, -2, i + 1);
+		}
+
+		if (i < rows->len) {
+			g_critical("%s: row %u of the batch is invalid, forwarding the rows as they are",
+					G_STRLOC,
+					i);
+
+			lua_pop(L, 3); /* rows, inj, function */
 		} else {
-			if (lua_isnumber(L, -1)) {
-				ret = lua_tonumber(L, -1);
+			MYSQLPROXY_LUA_ENTER(con, "read_query_result_rows");
+			if (lua_pcall(L, 2, 1, 0) != 0) {
+				g_critical("(read_query_result_rows) %s", lua_tostring(L, -1));
+			} else if (lua_istable(L, -1)) {
+				GString *row = g_string_new(NULL);
+				int n = lua_objlen(L, -1);
+				int j;
+
+				for (j = 1; j <= n; j++) {
+					lua_rawgeti(L, -1, j);
+					if (lua_istable(L, -1)) {
+						g_string_truncate(row, 0);
+						proxy_lua_append_text_row(L, row, st->rows_batch_columns);
+
+						network_mysqld_queue_append(con->client, con->client->send_queue, S(row));
+					}
+					lua_pop(L, 1);
+				}
+				g_string_free(row, TRUE);
+
+				is_replaced = TRUE;
 			}
-			lua_pop(L, 1);
+			lua_pop(L, 1); /* the result or the err-msg */
+			MYSQLPROXY_LUA_LEAVE(con, "read_query_result_rows", is_replaced);
 		}
-	
-		switch (ret) {
-		case PROXY_NO_DECISION:
-			break;
-		case PROXY_SEND_QUERY:
-			g_warning("%s.%d: (read_handshake) return proxy.PROXY_SEND_QUERY is deprecated, use PROXY_SEND_RESULT instead",
-					__FILE__, __LINE__);
+	} else {
+		lua_pop(L, 1); /* not a function */
+	}
+	st->hooks = network_mysqld_lua_fenv_get_hooks(L);
+	lua_pop(L, 1); /* fenv */
+
+	g_assert(lua_isfunction(L, -1));
+#endif
+
+	return is_replaced;
+}
+
+/**
+ * pass the rows of the batch to read_query_result_rows() and send what it returns
+ */
+static void proxy_rows_batch_flush(network_mysqld_con *con, injection *inj) {
+	network_mysqld_con_lua_t *st = con->plugin_con_state;
+	network_socket *send_sock = con->client;
+	GPtrArray *rows = st->rows_batch;
+	gboolean is_replaced;
+	guint i;
+
+	if (!rows || rows->len == 0) return;
+
+	is_replaced = proxy_lua_read_query_result_rows(con, inj);
+
+	for (i = 0; i < rows->len; i++) {
+		if (is_replaced) {
+			g_string_free(rows->pdata[i], TRUE);
+		} else {
+			network_mysqld_queue_append_raw(send_sock, send_sock->send_queue, rows->pdata[i]);
+		}
+	}
+	g_ptr_array_set_size(rows, 0);
+}
+
+/**
+ * forward a packet of a result with { rows_batch_size = ... }
+ *
+ * the header and the field-defs are forwarded right away, the rows wait until the batch is
+ * full or the result-set ends. Only the batch is buffered, not the result.
+ *
+ * @param prev_state the state of con->parse.data before the packet was parsed
+ */
+static void proxy_rows_batch_append(network_mysqld_con *con, injection *inj, GString *packet, int prev_state, int is_finished) {
+	network_mysqld_con_lua_t *st = con->plugin_con_state;
+	network_mysqld_com_query_result_t *com_query = con->parse.data;
+	network_socket *send_sock = con->client;
+
+	if (prev_state == PARSE_COM_QUERY_INIT && com_query->state == PARSE_COM_QUERY_FIELD) {
+		/* the column-count of the next result-set */
+		network_packet p;
+
+		p.data = packet;
+		p.offset = 0;
+
+		network_mysqld_con_lua_rows_batch_reset(st);
+		if (0 != network_mysqld_proto_skip_network_header(&p) ||
+		    0 != network_mysqld_proto_get_lenenc_int(&p, &st->rows_batch_columns)) {
+			st->rows_batch_is_raw = TRUE;
+		}
+	} else if (prev_state == PARSE_COM_QUERY_RESULT && com_query->state == PARSE_COM_QUERY_RESULT && !is_finished) {
+		if (!st->rows_batch_is_raw && network_mysqld_proto_get_packet_len(packet) == PACKET_LEN_MAX) {
+			/* the row continues in the next packet */
+			proxy_rows_batch_flush(con, inj);
+			st->rows_batch_is_raw = TRUE;
+		} else if (!st->rows_batch_is_raw) {
+			if (!st->rows_batch) st->rows_batch = g_ptr_array_new();
+			g_ptr_array_add(st->rows_batch, packet);
+
+			if (st->rows_batch->len >= inj->rows_batch_size) proxy_rows_batch_flush(con, inj);
+
+			return;
+		}
+	} else if (prev_state == PARSE_COM_QUERY_RESULT) {
+		/* the EOF or ERR after the rows */
+		proxy_rows_batch_flush(con, inj);
+		st->rows_batch_is_raw = FALSE;
+	}
+
+	network_mysqld_queue_append_raw(send_sock, send_sock->send_queue, packet);
+}
+
+/**
+ * call the lua function to intercept the handshake packet
+ *
+ * @return PROXY_SEND_QUERY  to send the packet from the client
+ *         PROXY_NO_DECISION to pass the server packet unmodified
+ */
+static network_mysqld_lua_stmt_ret proxy_lua_read_handshake(network_mysqld_con *con) {
+	network_mysqld_lua_stmt_ret ret = PROXY_NO_DECISION; /* send what the server gave us */
+#ifdef HAVE_LUA_H
+	network_mysqld_con_lua_t *st = con->plugin_con_state;
+
+	lua_State *L;
+
+	if (network_mysqld_con_lua_skips_hook(st, NETWORK_MYSQLD_LUA_HOOK_READ_HANDSHAKE)) return ret;
+
+	/* call the lua script to pick a backend
+	   ignore the return code from network_mysqld_con_lua_register_callback, because we cannot do anything about it,
+	   it would always show up as ERROR 2013, which is not helpful.
+	 */
+	(void)network_mysqld_con_lua_register_callback(con, con->config->lua_script);
+
+	if (!st->L) return ret;
+
+	L = st->L;
+
+	g_assert(lua_isfunction(L, -1));
+	lua_getfenv(L, -1);
+	g_assert(lua_istable(L, -1));
+	
+	lua_getfield_literal(L, -1, C("read_handshake"));
+	if (lua_isfunction(L, -1)) {
+		/* export
+		 *
+		 * every thing we know about it
+		 *  */
+
+		MYSQLPROXY_LUA_ENTER(con, "read_handshake");
+		if (lua_pcall(L, 0, 1, 0) != 0) {
+			g_critical("(read_handshake) %s", lua_tostring(L, -1));
+
+			lua_pop(L, 1); /* errmsg */
+
+			/* the script failed, but we have a useful default */
+		} else {
+			if (lua_isnumber(L, -1)) {
+				ret = lua_tonumber(L, -1);
+			}
+			lua_pop(L, 1);
+		}
+		MYSQLPROXY_LUA_LEAVE(con, "read_handshake", ret);
+	
+		switch (ret) {
+		case PROXY_NO_DECISION:
+			break;
+		case PROXY_SEND_QUERY:
+			g_warning("%s.%d: (read_handshake) return proxy.PROXY_SEND_QUERY is deprecated, use PROXY_SEND_RESULT instead",
+					__FILE__, __LINE__);
 
 			ret = PROXY_SEND_RESULT;
 		case PROXY_SEND_RESULT:
@@ -502,6 +1251,7 @@ static network_mysqld_lua_stmt_ret proxy_lua_read_handshake(network_mysqld_con *
 		g_message("%s.%d: %s", __FILE__, __LINE__, lua_typename(L, lua_type(L, -1)));
 		lua_pop(L, 1); /* pop the ... */
 	}
+	st->hooks = network_mysqld_lua_fenv_get_hooks(L);
 	lua_pop(L, 1); /* fenv */
 
 	g_assert(lua_isfunction(L, -1));
@@ -510,6 +1260,184 @@ static network_mysqld_lua_stmt_ret proxy_lua_read_handshake(network_mysqld_con *
 }
 
 
+/**
+ * forward the handshake-response of the client to the server
+ *
+ * CLIENT_COMPRESS and CLIENT_SSL towards the server don't depend on what the client
+ * uses. With TLS to the server a SSL request goes out first and the handshake-response
+ * follows through TLS. With --proxy-backend-ssl-ca a backend without TLS is refused and
+ * its certificate has to match its host.
+ *
+ * @return 0 on success, -1 on error
+ */
+static int proxy_auth_response_forward(network_mysqld_con *con, GString *packet) {
+	chassis_plugin_config *config = con->config;
+	network_mysqld_con_lua_t *st = con->plugin_con_state;
+	network_socket *server = con->server;
+	network_packet p;
+	guint32 capabilities;
+
+	p.data = packet;
+	p.offset = NET_HEADER_SIZE;
+
+	if (network_mysqld_proto_get_int32(&p, &capabilities)) return -1;
+
+	if (config->backend_compress &&
+	    (server->challenge->capabilities & CLIENT_COMPRESS)) {
+		capabilities |= CLIENT_COMPRESS;
+
+		/* the handshake-response itself is sent uncompressed */
+		server->compress_pending = TRUE;
+	} else {
+		capabilities &= ~CLIENT_COMPRESS;
+	}
+
+	if (config->backend_ssl_ctx &&
+	    (server->challenge->capabilities & CLIENT_SSL)) {
+		capabilities |= CLIENT_SSL;
+	} else if (config->backend_ssl_ctx && config->backend_ssl_ctx->verify_peer) {
+		/* with a CA the password only goes out through TLS, a stripped CLIENT_SSL doesn't downgrade us */
+		g_critical("%s: the backend %s doesn't support TLS, but --proxy-backend-ssl-ca is set",
+				G_STRLOC, server->dst->name->str);
+		return -1;
+	} else {
+		capabilities &= ~CLIENT_SSL;
+	}
+
+	/* patch the capabilities in place */
+	packet->str[NET_HEADER_SIZE + 0] = (capabilities >>  0) & 0xff;
+	packet->str[NET_HEADER_SIZE + 1] = (capabilities >>  8) & 0xff;
+	packet->str[NET_HEADER_SIZE + 2] = (capabilities >> 16) & 0xff;
+	packet->str[NET_HEADER_SIZE + 3] = (capabilities >> 24) & 0xff;
+
+	if (capabilities & CLIENT_SSL) {
+		GString *ssl_request;
+		gchar *host;
+		int ret;
+
+		/* the SSL request is the fixed-size start of the handshake-response */
+		if (packet->len < NET_HEADER_SIZE + 32) return -1;
+
+		/* the configured address: a backend on this host may be connected through its unix-socket */
+		if (st->backend) {
+			host = network_address_get_host(st->backend->hostname ? st->backend->hostname : st->backend->addr->name->str);
+		} else {
+			host = network_address_get_host(server->dst->name->str);
+		}
+		ret = network_ssl_connect(config->backend_ssl_ctx, server, host);
+		if (host) g_free(host);
+		if (0 != ret) return -1;
+
+		ssl_request = g_string_new_len(packet->str, NET_HEADER_SIZE + 32);
+		network_mysqld_proto_set_packet_len(ssl_request, 32);
+		network_mysqld_queue_append_raw(server, server->send_queue, ssl_request);
+
+		server->ssl_plain_chunks = 1;
+	}
+
+	network_mysqld_queue_append_raw(server, server->send_queue, packet);
+
+	return 0;
+}
+
+/**
+ * set the challenge we send to the client
+ *
+ * the client gets CLIENT_COMPRESS and CLIENT_SSL if we offer them, not if the backend does
+ */
+static void proxy_client_set_challenge(network_mysqld_con *con, network_mysqld_auth_challenge *challenge) {
+	g_assert(con->client->challenge == NULL);
+	con->client->challenge = challenge;
+
+	if (con->config->client_compress) {
+		challenge->capabilities |= CLIENT_COMPRESS;
+	} else {
+		challenge->capabilities &= ~(CLIENT_COMPRESS);
+	}
+
+	if (con->config->ssl_ctx) {
+		challenge->capabilities |= CLIENT_SSL;
+		con->client->ssl_is_expected = TRUE;
+	} else {
+		challenge->capabilities &= ~(CLIENT_SSL);
+	}
+}
+
+/**
+ * answer the handshake of a new client ourselves with the last handshake of a backend
+ *
+ * the client gets its own challenge and has to log in with mysql_native_password, the
+ * auth-cache checks it. The backend is attached at the first query, proxy_lazy_attach().
+ *
+ * @return 0 if the handshake is in the send-queue, -1 if we didn't see a backend yet
+ */
+static int proxy_lazy_send_handshake(network_mysqld_con *con) {
+	network_mysqld_con_lua_t *st = con->plugin_con_state;
+	chassis_plugin_config *config = con->config;
+	network_mysqld_auth_challenge *challenge = NULL;
+	GString *challenge_packet;
+
+	g_mutex_lock(config->lazy_challenge_mutex);
+	if (config->lazy_challenge) challenge = network_mysqld_auth_challenge_copy(config->lazy_challenge);
+	g_mutex_unlock(config->lazy_challenge_mutex);
+
+	if (NULL == challenge) return -1;
+
+	network_mysqld_auth_challenge_set_challenge(challenge);
+	g_string_assign_len(challenge->auth_plugin_name, C("mysql_native_password"));
+	challenge->thread_id = 0; /* the backend connection isn't known yet, don't let the client KILL someone else's */
+	challenge->server_status = SERVER_STATUS_AUTOCOMMIT;
+
+	proxy_client_set_challenge(con, challenge);
+
+	challenge_packet = g_string_new(NULL);
+	network_mysqld_proto_append_auth_challenge(challenge_packet, challenge);
+	network_mysqld_queue_append(con->client, con->client->send_queue, S(challenge_packet));
+	g_string_free(challenge_packet, TRUE);
+
+	st->lazy_is_pending = TRUE;
+
+	return 0;
+}
+
+/**
+ * log in to the backend we connected to for the first query of a lazy client
+ *
+ * the handshake-response of the client is sent with the scramble of its SHA1(password) for
+ * the challenge of the backend
+ *
+ * @return 0 on success, -1 on error
+ */
+static int proxy_lazy_send_auth(network_mysqld_con *con) {
+	network_mysqld_con_lua_t *st = con->plugin_con_state;
+	network_mysqld_auth_response *auth;
+	GString *packet;
+	int ret;
+
+	auth = network_mysqld_auth_response_copy(con->client->response);
+	auth->server_capabilities = con->server->challenge->capabilities;
+#ifdef CLIENT_CONNECT_ATTRS
+	/* we don't keep the attributes of the client */
+	auth->client_capabilities &= ~CLIENT_CONNECT_ATTRS;
+#endif
+	g_string_assign_len(auth->auth_plugin_name, C("mysql_native_password"));
+	network_mysqld_proto_password_scramble(auth->auth_plugin_data,
+			S(con->server->challenge->auth_plugin_data),
+			S(st->lazy_hashed_password));
+
+	/* the handshake-response follows the handshake of the backend */
+	packet = g_string_new_len(C("\x00\x00\x00\x01"));
+	network_mysqld_proto_append_auth_response(packet, auth);
+	network_mysqld_proto_set_packet_len(packet, packet->len - NET_HEADER_SIZE);
+
+	network_mysqld_auth_response_free(auth);
+
+	ret = proxy_auth_response_forward(con, packet);
+	if (0 != ret) g_string_free(packet, TRUE);
+
+	return ret;
+}
+
 /**
  * parse the hand-shake packet from the server
  *
@@ -520,6 +1448,8 @@ static network_mysqld_lua_stmt_ret proxy_lua_read_handshake(network_mysqld_con *
 NETWORK_MYSQLD_PLUGIN_PROTO(proxy_read_handshake) {
 	network_packet packet;
 	network_socket *recv_sock, *send_sock;
+	network_mysqld_con_lua_t *st = con->plugin_con_state;
+	chassis_plugin_config *config = con->config;
 	network_mysqld_auth_challenge *challenge;
 	GString *challenge_packet;
 	guint8 status = 0;
@@ -555,12 +1485,32 @@ NETWORK_MYSQLD_PLUGIN_PROTO(proxy_read_handshake) {
 	}
 
  	con->server->challenge = challenge;
+	con->server->server_status = challenge->server_status;
+
+	if (config->lazy_connect) {
+		/* the next clients get a copy of it */
+		g_mutex_lock(config->lazy_challenge_mutex);
+		if (config->lazy_challenge) network_mysqld_auth_challenge_free(config->lazy_challenge);
+		config->lazy_challenge = network_mysqld_auth_challenge_copy(challenge);
+		g_mutex_unlock(config->lazy_challenge_mutex);
+	}
+
+	if (st->lazy_is_connecting) {
+		/* the client is authed already, we log in for it */
+		g_string_free(g_queue_pop_tail(recv_sock->recv_queue->chunks), TRUE);
+
+		if (0 != proxy_lazy_send_auth(con)) return NETWORK_SOCKET_ERROR;
+
+		con->state = CON_STATE_SEND_AUTH;
+
+		return NETWORK_SOCKET_SUCCESS;
+	}
 
-	/* we can't sniff compressed packets nor do we support SSL */
-	challenge->capabilities &= ~(CLIENT_COMPRESS);
-	challenge->capabilities &= ~(CLIENT_SSL);
+	/* CLIENT_COMPRESS and CLIENT_SSL are negotiated for each side on its own, the sockets
+	 * handle the compressed packets and the TLS records and we only see the plain packets.
+	 * The challenge keeps what the server offers, the client gets what we offer. */
 
-	switch (proxy_lua_read_handshake(con)) {
+	switch (proxy_lua_call(proxy_lua_read_handshake, con)) {
 	case PROXY_NO_DECISION:
 		break;
 	case PROXY_SEND_RESULT:
@@ -575,18 +1525,17 @@ NETWORK_MYSQLD_PLUGIN_PROTO(proxy_read_handshake) {
 		break;
 	}
 
+	/* copy the pack to the client */
+	proxy_client_set_challenge(con, network_mysqld_auth_challenge_copy(challenge));
+
 	challenge_packet = g_string_sized_new(packet.data->len); /* the packet we generate will be likely as large as the old one. should save some reallocs */
-	network_mysqld_proto_append_auth_challenge(challenge_packet, challenge);
+	network_mysqld_proto_append_auth_challenge(challenge_packet, con->client->challenge);
 	network_mysqld_queue_sync(send_sock, recv_sock);
 	network_mysqld_queue_append(send_sock, send_sock->send_queue, S(challenge_packet));
 
 	g_string_free(challenge_packet, TRUE);
 
 	g_string_free(g_queue_pop_tail(recv_sock->recv_queue->chunks), TRUE);
-
-	/* copy the pack to the client */
-	g_assert(con->client->challenge == NULL);
-	con->client->challenge = network_mysqld_auth_challenge_copy(challenge);
 	
 	con->state = CON_STATE_SEND_HANDSHAKE;
 
@@ -600,6 +1549,8 @@ static network_mysqld_lua_stmt_ret proxy_lua_read_auth(network_mysqld_con *con)
 	network_mysqld_con_lua_t *st = con->plugin_con_state;
 	lua_State *L;
 
+	if (network_mysqld_con_lua_skips_hook(st, NETWORK_MYSQLD_LUA_HOOK_READ_AUTH)) return ret;
+
 	/* call the lua script to pick a backend
 	   ignore the return code from network_mysqld_con_lua_register_callback, because we cannot do anything about it,
 	   it would always show up as ERROR 2013, which is not helpful.	
@@ -622,6 +1573,7 @@ static network_mysqld_lua_stmt_ret proxy_lua_read_auth(network_mysqld_con *con)
 		 * every thing we know about it
 		 *  */
 
+		MYSQLPROXY_LUA_ENTER(con, "read_auth");
 		if (lua_pcall(L, 0, 1, 0) != 0) {
 			g_critical("(read_auth) %s", lua_tostring(L, -1));
 
@@ -634,6 +1586,7 @@ static network_mysqld_lua_stmt_ret proxy_lua_read_auth(network_mysqld_con *con)
 			}
 			lua_pop(L, 1);
 		}
+		MYSQLPROXY_LUA_LEAVE(con, "read_auth", ret);
 
 		switch (ret) {
 		case PROXY_NO_DECISION:
@@ -675,6 +1628,7 @@ static network_mysqld_lua_stmt_ret proxy_lua_read_auth(network_mysqld_con *con)
 		g_message("%s.%d: %s", __FILE__, __LINE__, lua_typename(L, lua_type(L, -1)));
 		lua_pop(L, 1); /* pop the ... */
 	}
+	st->hooks = network_mysqld_lua_fenv_get_hooks(L);
 	lua_pop(L, 1); /* fenv */
 
 	g_assert(lua_isfunction(L, -1));
@@ -682,6 +1636,71 @@ static network_mysqld_lua_stmt_ret proxy_lua_read_auth(network_mysqld_con *con)
 	return ret;
 }
 
+/**
+ * check if the client may take over the authed connection from the pool without a COM_CHANGE_USER
+ *
+ * the connection has to be authed as the same user with the same default-db and charset,
+ * the auth-cache checks the password. See proxy_pool_get_reset() for how its session is reset.
+ */
+static gboolean proxy_pool_auth_is_cached(network_mysqld_con *con) {
+	chassis_plugin_config *config = con->config;
+	network_mysqld_auth_response *client_auth = con->client->response;
+	network_mysqld_auth_response *server_auth = con->server->response;
+
+	if (NULL == config->auth_cache || NULL == server_auth) return FALSE;
+
+	if (!g_string_equal(client_auth->username, server_auth->username) ||
+	    !g_string_equal(con->client->default_db, con->server->default_db) ||
+	    client_auth->charset != server_auth->charset) {
+		return FALSE;
+	}
+
+	return network_auth_cache_check(config->auth_cache, client_auth->username->str,
+			S(con->client->challenge->auth_plugin_data),
+			S(client_auth->auth_plugin_data));
+}
+
+typedef enum {
+	PROXY_POOL_RESET_NONE,
+	PROXY_POOL_RESET_CONNECTION,
+	PROXY_POOL_RESET_CHANGE_USER
+} proxy_pool_reset_t;
+
+/**
+ * check how the authed connection from the pool has to be reset before the client takes it over
+ *
+ * another user, or one the auth-cache can't check, needs the COM_CHANGE_USER. For the same
+ * user the password is checked already: a session no client left state on is kept as is, else
+ * a COM_RESET_CONNECTION resets it without the re-auth if the backend has it (5.7.3+). The
+ * reset falls back to the default charset of the server, a client that asked for another one
+ * in its handshake gets the COM_CHANGE_USER.
+ *
+ * --proxy-pool-no-change-user never resets.
+ *
+ * @see proxy_session_dirty_track()
+ */
+static proxy_pool_reset_t proxy_pool_get_reset(network_mysqld_con *con, gboolean is_cached) {
+	chassis_plugin_config *config = con->config;
+	network_socket *server = con->server;
+
+	if (!config->pool_change_user) return PROXY_POOL_RESET_NONE;
+	if (!is_cached) return PROXY_POOL_RESET_CHANGE_USER;
+
+	if (!server->session_is_dirty &&
+	    NULL == server->session_vars &&
+	    (server->server_status & SERVER_STATUS_AUTOCOMMIT) &&
+	    !(server->server_status & SERVER_STATUS_IN_TRANS)) {
+		return PROXY_POOL_RESET_NONE;
+	}
+
+	if (server->challenge->server_version >= 50703 &&
+	    con->client->response->charset == server->challenge->charset) {
+		return PROXY_POOL_RESET_CONNECTION;
+	}
+
+	return PROXY_POOL_RESET_CHANGE_USER;
+}
+
 NETWORK_MYSQLD_PLUGIN_PROTO(proxy_read_auth) {
 	/* read auth from client */
 	network_packet packet;
@@ -710,6 +1729,23 @@ NETWORK_MYSQLD_PLUGIN_PROTO(proxy_read_auth) {
 	 * this is detected by con->client->response being NULL
 	 */
 
+	if (con->client->ssl_is_expected) {
+		guint32 capabilities;
+
+		con->client->ssl_is_expected = FALSE;
+
+		/* a SSL request is the fixed-size start of a handshake-response with CLIENT_SSL set */
+		if (packet.data->len == NET_HEADER_SIZE + 32 &&
+		    0 == network_mysqld_proto_peek_int32(&packet, &capabilities) &&
+		    (capabilities & CLIENT_SSL)) {
+			g_string_free(g_queue_pop_tail(recv_sock->recv_queue->chunks), TRUE);
+
+			if (0 != network_ssl_accept(config->ssl_ctx, con->client)) return NETWORK_SOCKET_ERROR;
+
+			return NETWORK_SOCKET_SUCCESS; /* stay in CON_STATE_READ_AUTH, the handshake-response comes through TLS */
+		}
+	}
+
 	if (con->client->response == NULL) {
 		auth = network_mysqld_auth_response_new(con->client->challenge->capabilities);
 
@@ -730,6 +1766,12 @@ NETWORK_MYSQLD_PLUGIN_PROTO(proxy_read_auth) {
 
 		g_string_assign_len(con->client->default_db, S(auth->database));
 
+		/* our answer to the handshake-response is compressed already */
+		if ((auth->client_capabilities & CLIENT_COMPRESS) &&
+		    (con->client->challenge->capabilities & CLIENT_COMPRESS)) {
+			network_socket_set_compressed(con->client);
+		}
+
 		/* client and server support auth-plugins and the client uses
 		 * win-auth, we may have more data to read from the client
 		 */
@@ -776,7 +1818,7 @@ NETWORK_MYSQLD_PLUGIN_PROTO(proxy_read_auth) {
 		/**
 		 * looks like we finished parsing, call the lua function
 		 */
-		switch (proxy_lua_read_auth(con)) {
+		switch (proxy_lua_call(proxy_lua_read_auth, con)) {
 		case PROXY_SEND_RESULT:
 			con->state = CON_STATE_SEND_AUTH_RESULT;
 
@@ -796,10 +1838,27 @@ NETWORK_MYSQLD_PLUGIN_PROTO(proxy_read_auth) {
 			break; }
 		case PROXY_NO_DECISION:
 			/* if we don't have a backend (con->server), we just ack the client auth
+			 *
+			 * --proxy-lazy-connect checks it against the auth-cache and keeps the SHA1(password)
+			 * to log in to the backend later
 			 */
 			if (!con->server) {
 				con->state = CON_STATE_SEND_AUTH_RESULT;
 
+				if (st->lazy_is_pending) {
+					st->lazy_hashed_password = g_string_new(NULL);
+
+					if (!network_auth_cache_unscramble(config->auth_cache, con->client->response->username->str,
+								S(con->client->challenge->auth_plugin_data),
+								S(con->client->response->auth_plugin_data),
+								st->lazy_hashed_password)) {
+						network_mysqld_con_send_error_full(recv_sock, C("(proxy-lazy-connect) login failed"), ER_ACCESS_DENIED_ERROR, "28000");
+						con->auth_result_state = MYSQLD_PACKET_ERR;
+
+						break;
+					}
+				}
+
 				network_mysqld_con_send_ok(recv_sock);
 
 				break;
@@ -810,9 +1869,18 @@ NETWORK_MYSQLD_PLUGIN_PROTO(proxy_read_auth) {
 			 *
 			 * for performance reasons this extra reauth can be disabled. But
 			 * that leaves temp-tables on the connection.
+			 *
+			 * the same user on the same connection is checked by the auth-cache
+			 * instead, if it knows the user, and only reset if a client left
+			 * state on it
 			 */
 			if (con->server->is_authed) {
-				if (config->pool_change_user) {
+				gboolean is_cached = proxy_pool_auth_is_cached(con);
+				proxy_pool_reset_t reset = proxy_pool_get_reset(con, is_cached);
+
+				if (config->pool_resets_total) chassis_metric_add_label(config->pool_resets_total, reset, 1);
+
+				if (reset == PROXY_POOL_RESET_CHANGE_USER) {
 					GString *com_change_user = g_string_new(NULL);
 
 					/* copy incl. the nul */
@@ -840,6 +1908,15 @@ NETWORK_MYSQLD_PLUGIN_PROTO(proxy_read_auth) {
 					/* we just injected a com_change_user packet so let's set the flag to track it on the connection */
 					st->is_in_com_change_user = TRUE;
 
+					/* ... which resets the session variables and closes the prepared statements */
+					if (con->server->session_vars) {
+						g_hash_table_destroy(con->server->session_vars);
+						con->server->session_vars = NULL;
+					}
+					network_stmt_cache_free(con->server->prepared_stmts);
+					con->server->prepared_stmts = NULL;
+					con->server->session_is_dirty = FALSE;
+
 					/**
 					 * the server is already authenticated, the client isn't
 					 *
@@ -848,6 +1925,21 @@ NETWORK_MYSQLD_PLUGIN_PROTO(proxy_read_auth) {
 
 					g_string_free(com_change_user, TRUE);
 				
+					con->state = CON_STATE_SEND_AUTH;
+				} else if (reset == PROXY_POOL_RESET_CONNECTION) {
+					const char com_reset_connection[] = { COM_RESET_CONNECTION };
+
+					/* its OK is the auth-result of the client, like the one of the COM_CHANGE_USER */
+					network_mysqld_queue_append(send_sock, send_sock->send_queue, com_reset_connection, sizeof(com_reset_connection));
+
+					if (con->server->session_vars) {
+						g_hash_table_destroy(con->server->session_vars);
+						con->server->session_vars = NULL;
+					}
+					network_stmt_cache_free(con->server->prepared_stmts);
+					con->server->prepared_stmts = NULL;
+					con->server->session_is_dirty = FALSE;
+
 					con->state = CON_STATE_SEND_AUTH;
 				} else {
 					GString *auth_resp;
@@ -859,8 +1951,9 @@ NETWORK_MYSQLD_PLUGIN_PROTO(proxy_read_auth) {
 
 					con->state = CON_STATE_SEND_AUTH_RESULT;
 
-					if (!g_string_equal(con->client->response->username, con->server->response->username) ||
-					    !g_string_equal(con->client->response->auth_plugin_data, con->server->response->auth_plugin_data)) {
+					if (!is_cached &&
+					    (!g_string_equal(con->client->response->username, con->server->response->username) ||
+					     !g_string_equal(con->client->response->auth_plugin_data, con->server->response->auth_plugin_data))) {
 						network_mysqld_err_packet_t *err_packet;
 
 						err_packet = network_mysqld_err_packet_new();
@@ -895,7 +1988,8 @@ NETWORK_MYSQLD_PLUGIN_PROTO(proxy_read_auth) {
 					g_string_free(auth_resp, TRUE);
 				}
 			} else {
-				network_mysqld_queue_append_raw(send_sock, send_sock->send_queue, packet.data);
+				if (0 != proxy_auth_response_forward(con, packet.data)) return NETWORK_SOCKET_ERROR;
+
 				con->state = CON_STATE_SEND_AUTH;
 
 				free_client_packet = FALSE; /* the packet.data is now part of the send-queue, don't free it further down */
@@ -934,6 +2028,8 @@ static network_mysqld_lua_stmt_ret proxy_lua_read_auth_result(network_mysqld_con
 	GString *packet = chunk->data;
 	lua_State *L;
 
+	if (network_mysqld_con_lua_skips_hook(st, NETWORK_MYSQLD_LUA_HOOK_READ_AUTH_RESULT)) return ret;
+
 	/* call the lua script to pick a backend
 	   ignore the return code from network_mysqld_con_lua_register_callback, because we cannot do anything about it,
 	   it would always show up as ERROR 2013, which is not helpful.	
@@ -961,6 +2057,7 @@ static network_mysqld_lua_stmt_ret proxy_lua_read_auth_result(network_mysqld_con
 		lua_pushlstring(L, packet->str + NET_HEADER_SIZE, packet->len - NET_HEADER_SIZE);
 		lua_setfield(L, -2, "packet");
 
+		MYSQLPROXY_LUA_ENTER(con, "read_auth_result");
 		if (lua_pcall(L, 1, 1, 0) != 0) {
 			g_critical("(read_auth_result) %s", lua_tostring(L, -1));
 
@@ -973,6 +2070,7 @@ static network_mysqld_lua_stmt_ret proxy_lua_read_auth_result(network_mysqld_con
 			}
 			lua_pop(L, 1);
 		}
+		MYSQLPROXY_LUA_LEAVE(con, "read_auth_result", ret);
 
 		switch (ret) {
 		case PROXY_NO_DECISION:
@@ -1004,6 +2102,7 @@ static network_mysqld_lua_stmt_ret proxy_lua_read_auth_result(network_mysqld_con
 		g_message("%s.%d: %s", __FILE__, __LINE__, lua_typename(L, lua_type(L, -1)));
 		lua_pop(L, 1); /* pop the ... */
 	}
+	st->hooks = network_mysqld_lua_fenv_get_hooks(L);
 	lua_pop(L, 1); /* fenv */
 
 	g_assert(lua_isfunction(L, -1));
@@ -1012,24 +2111,83 @@ static network_mysqld_lua_stmt_ret proxy_lua_read_auth_result(network_mysqld_con
 }
 
 
-NETWORK_MYSQLD_PLUGIN_PROTO(proxy_read_auth_result) {
+static network_socket_retval_t proxy_read_query_attached(network_mysqld_con *con, network_mysqld_lua_stmt_ret ret);
+
+/**
+ * the backend answered the login of a lazy client, go on with its first query
+ *
+ * the client got its OK from us already, it only sees an error if the backend refused
+ */
+static network_socket_retval_t proxy_lazy_read_auth_result(network_mysqld_con *con) {
+	network_mysqld_con_lua_t *st = con->plugin_con_state;
+	network_socket_retval_t ret;
 	GString *packet;
-	GList *chunk;
-	network_socket *recv_sock, *send_sock;
 
-	recv_sock = con->server;
-	send_sock = con->client;
+	st->lazy_is_connecting = FALSE;
 
-	chunk = recv_sock->recv_queue->chunks->tail;
-	packet = chunk->data;
+	packet = g_queue_pop_tail(con->server->recv_queue->chunks);
+	if (packet->len <= NET_HEADER_SIZE || packet->str[NET_HEADER_SIZE] != MYSQLD_PACKET_OK) {
+		g_message("%s: the backend refused the login of '%s', closing the connection",
+				G_STRLOC, con->client->response->username->str);
 
-	/* send the auth result to the client */
-	if (con->server->is_authed) {
-		/**
-		 * we injected a COM_CHANGE_USER above and have to correct to 
-		 * packet-id now 
-		 */
-		packet->str[3] = 2;
+		g_string_free(packet, TRUE);
+
+		network_mysqld_con_send_error_full(con->client, C("(proxy-lazy-connect) the backend refused the login"), ER_ACCESS_DENIED_ERROR, "28000");
+		con->state = CON_STATE_SEND_ERROR;
+
+		return NETWORK_SOCKET_SUCCESS;
+	}
+	g_string_free(packet, TRUE);
+
+	g_string_assign_len(con->server->default_db, S(con->client->default_db));
+	con->server->response = network_mysqld_auth_response_copy(con->client->response);
+
+	/* the auth phase of the backend is over, the query of the client is still in its recv-queue */
+	network_mysqld_queue_reset(con->server);
+
+	ret = proxy_read_query_attached(con, st->lazy_ret);
+
+	/* the core only resets it after CON_STATE_READ_QUERY */
+	if (con->state == CON_STATE_SEND_QUERY) {
+		network_mysqld_con_reset_command_response_state(con);
+	}
+
+	return ret;
+}
+
+NETWORK_MYSQLD_PLUGIN_PROTO(proxy_read_auth_result) {
+	GString *packet;
+	GList *chunk;
+	network_socket *recv_sock, *send_sock;
+	network_mysqld_con_lua_t *st = con->plugin_con_state;
+
+	if (st->lazy_is_connecting) return proxy_lazy_read_auth_result(con);
+
+	recv_sock = con->server;
+	send_sock = con->client;
+
+	chunk = recv_sock->recv_queue->chunks->tail;
+	packet = chunk->data;
+
+	/* the backend accepted the password, the auth-cache may trust the hash of the user now */
+	if (con->config->auth_cache &&
+	    packet->len > NET_HEADER_SIZE &&
+	    packet->str[NET_HEADER_SIZE] == MYSQLD_PACKET_OK) {
+		network_auth_cache_confirm(con->config->auth_cache, send_sock->response->username->str,
+				S(send_sock->challenge->auth_plugin_data),
+				S(send_sock->response->auth_plugin_data));
+	}
+
+	/* send the auth result to the client */
+	if (con->server->is_authed) {
+		/**
+		 * we injected a COM_CHANGE_USER above and have to correct to 
+		 * packet-id now 
+		 *
+		 * the client's auth-packet had the packet-id 1, our COM_CHANGE_USER 0. With
+		 * caching_sha2_password's fast-auth the OK packet follows as the 2nd result.
+		 */
+		network_mysqld_proto_set_packet_id(packet, network_mysqld_proto_get_packet_id(packet) + 1);
 	}
 
 	/**
@@ -1056,7 +2214,7 @@ NETWORK_MYSQLD_PLUGIN_PROTO(proxy_read_auth_result) {
 	 * backend_ndx = 0 might have reset con->server
 	 */
 
-	switch (proxy_lua_read_auth_result(con)) {
+	switch (proxy_lua_call(proxy_lua_read_auth_result, con)) {
 	case PROXY_SEND_RESULT:
 		/**
 		 * we already have content in the send-sock 
@@ -1164,6 +2322,108 @@ NETWORK_MYSQLD_PLUGIN_PROTO(proxy_read_auth_old_password) {
 	return NETWORK_SOCKET_SUCCESS;
 }
 
+/**
+ * handle the return value of read_query()
+ */
+static network_mysqld_lua_stmt_ret proxy_lua_read_query_ret(network_mysqld_con *con, network_mysqld_lua_stmt_ret ret) {
+	network_mysqld_con_lua_t *st = con->plugin_con_state;
+
+	switch (ret) {
+	case PROXY_SEND_RESULT:
+		/* check the proxy.response table for content,
+		 *
+		 */
+
+		if (network_mysqld_con_lua_handle_proxy_response(con, con->config->lua_script)) {
+			/**
+			 * handling proxy.response failed
+			 *
+			 * send a ERR packet
+			 */
+	
+			network_mysqld_con_send_error(con->client, C("(lua) handling proxy.response failed, check error-log"));
+		}
+
+		break;
+	case PROXY_NO_DECISION:
+		/* send on the data we got from the client unchanged
+		 */
+
+		if (st->injected.queries->length) {
+			injection *inj;
+
+			g_critical("%s: proxy.queue:append() or :prepend() used without 'return proxy.PROXY_SEND_QUERY'. Discarding %d elements from the queue.",
+					G_STRLOC,
+					st->injected.queries->length);
+
+			while ((inj = g_queue_pop_head(st->injected.queries))) injection_free(inj);
+		}
+	
+		break;
+	case PROXY_SEND_QUERY:
+		/* send the injected queries
+		 *
+		 * injection_new(..., query);
+		 * 
+		 *  */
+
+		if (st->injected.queries->length == 0) {
+			g_critical("%s: 'return proxy.PROXY_SEND_QUERY' used without proxy.queue:append() or :prepend(). Assuming 'nil' was returned",
+					G_STRLOC);
+		} else {
+			ret = PROXY_SEND_INJECTION;
+		}
+
+		break;
+	default:
+		break;
+	}
+
+	return ret;
+}
+
+/**
+ * get the result of read_query() after it returned, failed or yielded
+ *
+ * @param call_ret the return value of network_async_query_lua_call() or _resume()
+ */
+static network_mysqld_lua_stmt_ret proxy_lua_read_query_leave(network_mysqld_con *con, lua_State *L, int call_ret) {
+	network_mysqld_con_lua_t *st = con->plugin_con_state;
+	network_mysqld_lua_stmt_ret ret = PROXY_NO_DECISION;
+
+	switch (call_ret) {
+	case 0:
+		if (lua_isnumber(L, -1)) {
+			ret = lua_tonumber(L, -1);
+		}
+		lua_pop(L, 1);
+
+		break;
+	case LUA_YIELD:
+		/* it waits in proxy.wait_all(), the packet stays on the stack of the coroutine */
+		MYSQLPROXY_LUA_LEAVE(con, "read_query", PROXY_WAIT_ASYNC);
+
+		return PROXY_WAIT_ASYNC;
+	default:
+		network_mysqld_con_lua_ffi_view_reset(st);
+
+		/* hmm, the query failed */
+		g_critical("(read_query) %s", lua_tostring(L, -1));
+
+		lua_pop(L, 1); /* errmsg */
+
+		/* perhaps we should clean up ?*/
+
+		MYSQLPROXY_LUA_LEAVE(con, "read_query", PROXY_SEND_QUERY);
+
+		return PROXY_SEND_QUERY;
+	}
+	network_mysqld_con_lua_ffi_view_reset(st);
+	MYSQLPROXY_LUA_LEAVE(con, "read_query", ret);
+
+	return proxy_lua_read_query_ret(con, ret);
+}
+
 static network_mysqld_lua_stmt_ret proxy_lua_read_query(network_mysqld_con *con) {
 	network_mysqld_con_lua_t *st = con->plugin_con_state;
 	network_socket *recv_sock = con->client;
@@ -1176,6 +2436,8 @@ static network_mysqld_lua_stmt_ret proxy_lua_read_query(network_mysqld_con *con)
 	/* ok, here we go */
 
 #ifdef HAVE_LUA_H
+	if (network_mysqld_con_lua_skips_hook(st, NETWORK_MYSQLD_LUA_HOOK_READ_QUERY)) return PROXY_NO_DECISION;
+
 	switch(network_mysqld_con_lua_register_callback(con, con->config->lua_script)) {
 		case REGISTER_CALLBACK_SUCCESS:
 			break;
@@ -1214,6 +2476,8 @@ static network_mysqld_lua_stmt_ret proxy_lua_read_query(network_mysqld_con *con)
 		lua_getfield_literal(L, -1, C("read_query"));
 		if (lua_isfunction(L, -1)) {
 			luaL_Buffer b;
+			const char *s;
+			size_t s_len;
 			int i;
 
 			/* pass the packet as parameter */
@@ -1224,72 +2488,15 @@ static network_mysqld_lua_stmt_ret proxy_lua_read_query(network_mysqld_con *con)
 			}
 			luaL_pushresult(&b);
 
-			if (lua_pcall(L, 1, 1, 0) != 0) {
-				/* hmm, the query failed */
-				g_critical("(read_query) %s", lua_tostring(L, -1));
-
-				lua_pop(L, 2); /* fenv + errmsg */
-
-				/* perhaps we should clean up ?*/
-
-				return PROXY_SEND_QUERY;
-			} else {
-				if (lua_isnumber(L, -1)) {
-					ret = lua_tonumber(L, -1);
-				}
-				lua_pop(L, 1);
-			}
-
-			switch (ret) {
-			case PROXY_SEND_RESULT:
-				/* check the proxy.response table for content,
-				 *
-				 */
-	
-				if (network_mysqld_con_lua_handle_proxy_response(con, con->config->lua_script)) {
-					/**
-					 * handling proxy.response failed
-					 *
-					 * send a ERR packet
-					 */
-			
-					network_mysqld_con_send_error(con->client, C("(lua) handling proxy.response failed, check error-log"));
-				}
-	
-				break;
-			case PROXY_NO_DECISION:
-				/* send on the data we got from the client unchanged
-				 */
-
-				if (st->injected.queries->length) {
-					injection *inj;
-
-					g_critical("%s: proxy.queue:append() or :prepend() used without 'return proxy.PROXY_SEND_QUERY'. Discarding %d elements from the queue.",
-							G_STRLOC,
-							st->injected.queries->length);
+			/* the packet stays on the stack as argument while the hook runs */
+			s = lua_tolstring(L, -1, &s_len);
+			network_mysqld_con_lua_ffi_view_set_packet(st, s, s_len);
 
-					while ((inj = g_queue_pop_head(st->injected.queries))) injection_free(inj);
-				}
-			
-				break;
-			case PROXY_SEND_QUERY:
-				/* send the injected queries
-				 *
-				 * injection_new(..., query);
-				 * 
-				 *  */
+			/* read_query() runs in a coroutine, it may wait in proxy.wait_all() */
+			MYSQLPROXY_LUA_ENTER(con, "read_query");
+			ret = proxy_lua_read_query_leave(con, L, network_async_query_lua_call(st, L, 1));
 
-				if (st->injected.queries->length == 0) {
-					g_critical("%s: 'return proxy.PROXY_SEND_QUERY' used without proxy.queue:append() or :prepend(). Assuming 'nil' was returned",
-							G_STRLOC);
-				} else {
-					ret = PROXY_SEND_INJECTION;
-				}
-	
-				break;
-			default:
-				break;
-			}
+			st->hooks = network_mysqld_lua_fenv_get_hooks(L);
 			lua_pop(L, 1); /* fenv */
 		} else {
 			lua_pop(L, 2); /* fenv + nil */
@@ -1306,1117 +2513,6024 @@ static network_mysqld_lua_stmt_ret proxy_lua_read_query(network_mysqld_con *con)
 }
 
 /**
- * gets called after a query has been read
- *
- * - calls the lua script via network_mysqld_con_handle_proxy_stmt()
- *
- * @see network_mysqld_con_handle_proxy_stmt
+ * resume read_query() once the futures it waits for in proxy.wait_all() are done
  */
-NETWORK_MYSQLD_PLUGIN_PROTO(proxy_read_query) {
-	GString *packet;
-	network_socket *recv_sock, *send_sock;
+static network_mysqld_lua_stmt_ret proxy_lua_read_query_resume(network_mysqld_con *con) {
 	network_mysqld_con_lua_t *st = con->plugin_con_state;
-	int proxy_query = 1;
 	network_mysqld_lua_stmt_ret ret;
-	
-	NETWORK_MYSQLD_CON_TRACK_TIME(con, "proxy::ready_query::enter");
-
-	send_sock = NULL;
-	recv_sock = con->client;
-	st->injected.sent_resultset = 0;
-
-	/* we already passed the CON_STATE_READ_AUTH_OLD_PASSWORD phase and sent all packets
-	 * to the client so we need to set the COM_CHANGE_USER flag back to FALSE
-	 */
-	st->is_in_com_change_user = FALSE;
-
-	NETWORK_MYSQLD_CON_TRACK_TIME(con, "proxy::ready_query::enter_lua");
-	ret = proxy_lua_read_query(con);
-	NETWORK_MYSQLD_CON_TRACK_TIME(con, "proxy::ready_query::leave_lua");
-
-	/**
-	 * if we disconnected in read_query_result() we have no connection open
-	 * when we try to execute the next query 
-	 *
-	 * for PROXY_SEND_RESULT we don't need a server
-	 */
-	if (ret != PROXY_SEND_RESULT &&
-	    con->server == NULL) {
-		g_critical("%s.%d: I have no server backend, closing connection", __FILE__, __LINE__);
-		return NETWORK_SOCKET_ERROR;
-	}
-	
-	switch (ret) {
-	case PROXY_NO_DECISION:
-	case PROXY_SEND_QUERY:
-		send_sock = con->server;
+	lua_State *L;
 
-		/* no injection, pass on the chunks as is */
-		while ((packet = g_queue_pop_head(recv_sock->recv_queue->chunks))) {
-			network_mysqld_queue_append_raw(send_sock, send_sock->send_queue, packet);
-		}
-		con->resultset_is_needed = FALSE; /* we don't want to buffer the result-set */
+	/* other connections may have pointed _G.proxy to their proxy-table in the meantime */
+	(void)network_mysqld_con_lua_register_callback(con, con->config->lua_script);
 
-		break;
-	case PROXY_SEND_RESULT: {
-		gboolean is_first_packet = TRUE;
-		proxy_query = 0;
+	L = st->L;
 
-		send_sock = con->client;
+	g_assert(lua_isfunction(L, -1));
 
-		/* flush the recv-queue and track the command-states */
-		while ((packet = g_queue_pop_head(recv_sock->recv_queue->chunks))) {
-			if (is_first_packet) {
-				network_packet p;
+	MYSQLPROXY_LUA_ENTER(con, "read_query");
+	ret = proxy_lua_read_query_leave(con, L, network_async_query_lua_resume(st, L));
 
-				p.data = packet;
-				p.offset = 0;
+	g_assert(lua_isfunction(L, -1));
 
-				network_mysqld_con_reset_command_response_state(con);
+	return ret;
+}
 
-				if (0 != network_mysqld_con_command_states_init(con, &p)) {
-					g_debug("%s: ", G_STRLOC);
-				}
+/**
+ * take back the parked read-write connection
+ *
+ * the read-only connection goes back into the pool
+ */
+static void proxy_rw_split_unpark(network_mysqld_con *con) {
+	network_mysqld_con_lua_t *st = con->plugin_con_state;
 
-				is_first_packet = FALSE;
-			}
+	if (NULL == st->rw_split_server) return;
 
-			g_string_free(packet, TRUE);
-		}
+	network_connection_pool_lua_add_connection(con);
 
-		break; }
-	case PROXY_SEND_INJECTION: {
-		injection *inj;
+	con->server = st->rw_split_server;
+	st->backend = st->rw_split_backend;
+	st->backend_ndx = st->rw_split_backend_ndx;
 
-		inj = g_queue_peek_head(st->injected.queries);
-		con->resultset_is_needed = inj->resultset_is_needed; /* let the lua-layer decide if we want to buffer the result or not */
+	st->rw_split_server = NULL;
+	st->rw_split_backend = NULL;
+	st->rw_split_backend_ndx = -1;
+}
 
-		send_sock = con->server;
+/**
+ * the binlog position the read-only backend has to be at to see the last write of the client
+ *
+ * it is the first position the health-check got from the master after the write
+ * was done. Until then we don't know it and the reads stay on the master.
+ *
+ * @return the binlog position, 0 if the reads have to stay on the master
+ */
+static guint64 proxy_rw_split_get_min_binlog_pos(network_mysqld_con *con) {
+	network_mysqld_con_lua_t *st = con->plugin_con_state;
+	guint64 pos, pos_usec;
 
-		network_mysqld_queue_reset(send_sock);
-		network_mysqld_queue_append(send_sock, send_sock->send_queue, S(inj->query));
+	if (st->rw_split_min_binlog_pos) return st->rw_split_min_binlog_pos;
 
-		while ((packet = g_queue_pop_head(recv_sock->recv_queue->chunks))) g_string_free(packet, TRUE);
+	network_backend_get_binlog_pos(st->backend, &pos, &pos_usec);
 
-		break; }
-	default:
-		g_error("%s.%d: ", __FILE__, __LINE__);
-	}
+	if (pos == 0 || pos_usec <= st->rw_split_write_usec) return 0;
 
-	if (proxy_query) {
-		con->state = CON_STATE_SEND_QUERY;
-	} else {
-		GList *cur;
+	st->rw_split_min_binlog_pos = pos;
 
-		/* if we don't send the query to the backend, it won't be tracked. So track it here instead 
-		 * to get the packet tracking right (LOAD DATA LOCAL INFILE, ...) */
+	return pos;
+}
 
-		for (cur = send_sock->send_queue->chunks->head; cur; cur = cur->next) {
-			network_packet p;
-			int r;
+/**
+ * pick the read-only backend for a SELECT
+ *
+ * with --proxy-rw-split-affinity the SELECTs of the same user, default database or
+ * column value go to the same backend, so that its buffer pool only has to hold the
+ * data of its keys and not the whole working set. Queries without a key go to the
+ * fastest backend.
+ *
+ * @return the index of the backend, -1 if there is none
+ * @see network_backends_get_by_key_at_pos()
+ */
+static int proxy_rw_split_get_backend(network_mysqld_con *con, GString *packet, guint64 min_binlog_pos) {
+	network_mysqld_con_lua_t *st = con->plugin_con_state;
+	chassis_plugin_config *config = con->config;
+	chassis_private *g = con->srv->priv;
+	GString *key = NULL;
 
-			p.data = cur->data;
-			p.offset = 0;
+	switch (config->rw_split_affinity_key) {
+	case PROXY_AFFINITY_NONE:
+		break;
+	case PROXY_AFFINITY_USER:
+		if (con->client->response) key = con->client->response->username;
+		break;
+	case PROXY_AFFINITY_DB:
+		key = con->client->default_db;
+		break;
+	case PROXY_AFFINITY_COLUMN:
+		/* --proxy-shard-map-file and --proxy-rw-split exclude each other, the key of the shard is ours */
+		if (NULL == st->shard_key) st->shard_key = g_string_new(NULL);
 
-			r = network_mysqld_proto_get_query_result(&p, con);
+		if (network_shard_map_get_key(config->rw_split_affinity_map,
+					packet->str + NET_HEADER_SIZE + 1, packet->len - NET_HEADER_SIZE - 1, st->shard_key)) {
+			key = st->shard_key;
 		}
+		break;
+	}
 
-		con->state = CON_STATE_SEND_QUERY_RESULT;
-		con->resultset_is_finished = TRUE; /* we don't have more too send */
+	if (NULL == key || 0 == key->len) {
+		return network_backends_get_least_latency_at_pos(g->backends, BACKEND_TYPE_RO, min_binlog_pos);
 	}
-	NETWORK_MYSQLD_CON_TRACK_TIME(con, "proxy::ready_query::done");
 
-	return NETWORK_SOCKET_SUCCESS;
+	return network_backends_get_by_key_at_pos(g->backends, BACKEND_TYPE_RO, S(key),
+			min_binlog_pos, config->rw_split_affinity_load_factor);
 }
 
 /**
- * decide about the next state after the result-set has been written 
- * to the client
- * 
- * if we still have data in the queue, back to proxy_send_query()
- * otherwise back to proxy_read_query() to pick up a new client query
+ * route the query to a read-only backend if we can
  *
- * @note we should only send one result back to the client
+ * - only SELECTs without side-effects go to a read-only backend
+ * - the read-write connection stays reserved for the client, everything else goes there
+ * - transactions stay on the read-write connection, we track them through the server-status
+ *   of the last result
+ * - with --proxy-rw-split-read-your-writes a client that wrote only reads from the
+ *   read-only backends that executed the master's binlog up to its write
+ * - the read-only backend is picked by latency and connected clients, or by the key of
+ *   --proxy-rw-split-affinity. We need an idle connection in its pool, new connections
+ *   aren't opened here
+ * - with --proxy-query-hints a "ro" hint sends the query to a read-only backend even if it
+ *   has to see the writes of the client, "rw" keeps it on the read-write connection and
+ *   "group=<name>" picks the backend by the policy of the group
  */
-NETWORK_MYSQLD_PLUGIN_PROTO(proxy_send_query_result) {
-	network_socket *recv_sock, *send_sock;
-	injection *inj;
+static void proxy_rw_split_route(network_mysqld_con *con) {
 	network_mysqld_con_lua_t *st = con->plugin_con_state;
+	chassis_private *g = con->srv->priv;
+	network_socket *recv_sock = con->client;
+	GString *packet = g_queue_peek_head(recv_sock->recv_queue->chunks);
+	network_backend_t *backend;
+	network_socket *send_sock;
+	GString empty_username = { "", 0, 0 };
+	network_mysqld_query_hints_t *hints = st->query_hints;
+	network_backend_group_t *group = NULL;
+	guint64 min_binlog_pos = 0;
+	int backend_ndx;
+
+	if (NULL == con->server) return;
+
+	/* a "ro" hint trusts the application that the query only reads */
+	if (recv_sock->recv_queue->chunks->length != 1 ||
+	    packet->len <= NET_HEADER_SIZE ||
+	    packet->str[NET_HEADER_SIZE] != COM_QUERY ||
+	    hints->route == NETWORK_MYSQLD_QUERY_HINT_ROUTE_RW ||
+	    (hints->route != NETWORK_MYSQLD_QUERY_HINT_ROUTE_RO &&
+	     NETWORK_MYSQLD_QUERY_RW == proxy_query_get_rw_type(packet))) {
+		proxy_rw_split_unpark(con);
+		st->rw_split_is_write = TRUE;
+		return;
+	}
 
-	send_sock = con->server;
-	recv_sock = con->client;
+	/* already on a read-only connection */
+	if (st->rw_split_server) return;
 
-	if (st->connection_close) {
-		con->state = CON_STATE_ERROR;
+	/* the client has to be on a read-write backend and outside of a transaction */
+	if (NULL == st->backend ||
+	    st->backend->type != BACKEND_TYPE_RW ||
+	    (con->server->server_status & SERVER_STATUS_IN_TRANS) ||
+	    !(con->server->server_status & SERVER_STATUS_AUTOCOMMIT)) {
+		return;
+	}
 
-		return NETWORK_SOCKET_SUCCESS;
+	/* a "ro" hint accepts stale data, the query doesn't have to wait for the writes of the client */
+	if (con->config->rw_split_read_your_writes && st->rw_split_write_usec &&
+	    hints->route != NETWORK_MYSQLD_QUERY_HINT_ROUTE_RO) {
+		if (0 == (min_binlog_pos = proxy_rw_split_get_min_binlog_pos(con))) return;
 	}
 
-	if (con->parse.command == COM_BINLOG_DUMP) {
-		/**
-		 * the binlog dump is different as it doesn't have END packet
-		 *
-		 * @todo in 5.0.x a NON_BLOCKING option as added which sends a EOF
-		 */
-		con->state = CON_STATE_READ_QUERY_RESULT;
+	if (hints->group->len > 0 && NULL != (group = network_backends_get_group(g->backends, hints->group->str))) {
+		backend_ndx = network_backends_get_from_group(g->backends, group);
 
-		return NETWORK_SOCKET_SUCCESS;
-	}
+		if (backend_ndx >= 0 && min_binlog_pos > 0) {
+			guint64 binlog_pos;
 
-	/* if we don't have a backend, don't try to forward queries
-	 */
-	if (!send_sock) {
-		network_injection_queue_reset(st->injected.queries);
+			network_backend_get_binlog_pos(network_backends_get(g->backends, backend_ndx), &binlog_pos, NULL);
+			if (binlog_pos < min_binlog_pos) return;
+		}
+	} else {
+		backend_ndx = proxy_rw_split_get_backend(con, packet, min_binlog_pos);
 	}
+	if (backend_ndx < 0 || backend_ndx == st->backend_ndx) return;
+
+	backend = network_backends_get(g->backends, backend_ndx);
+
+	send_sock = network_connection_pool_get_full(network_backend_get_pool(backend, chassis_event_thread_get_local_index()),
+			con->client->response ? con->client->response->username : &empty_username,
+			con->client->default_db,
+			con->client->response ? con->client->response->charset : 0,
+			TRUE,
+			network_mysqld_socket_is_deprecate_eof(con->client));
+	if (NULL == send_sock) return;
+
+	st->rw_split_server = con->server;
+	st->rw_split_backend = st->backend;
+	st->rw_split_backend_ndx = st->backend_ndx;
+
+	con->server = send_sock;
+	st->backend = backend;
+	st->backend->connected_clients++;
+	st->backend_ndx = backend_ndx;
+}
 
-	if (st->injected.queries->length == 0) {
-		/* we have nothing more to send, let's see what the next state is */
+/**
+ * the connection that holds the session of the client
+ *
+ * with --proxy-rw-split the read-write connection is parked while a SELECT
+ * runs on a read-only backend, with --proxy-multiplex there may be none
+ * between two statements
+ */
+static network_socket *proxy_get_session_server(network_mysqld_con *con) {
+	network_mysqld_con_lua_t *st = con->plugin_con_state;
 
-		con->state = CON_STATE_READ_QUERY;
+	return st->rw_split_server ? st->rw_split_server : con->server;
+}
 
-		return NETWORK_SOCKET_SUCCESS;
+/**
+ * the backend of the shard with the fewest connected clients
+ *
+ * @return the index of the backend, -1 if all backends of the shard are down or unknown
+ */
+static int proxy_shard_get_backend(network_backends_t *backends, network_shard_t *shard) {
+	GPtrArray *snapshot = network_backends_get_snapshot(backends);
+	guint min_connected_clients = G_MAXUINT;
+	int ndx = -1;
+	int fallback_ndx = -1;
+	guint i, j;
+
+	for (i = 0; i < snapshot->len; i++) {
+		network_backend_t *cur = snapshot->pdata[i];
+
+		if (cur->state == BACKEND_STATE_DOWN) continue;
+
+		for (j = 0; shard->backends[j]; j++) {
+			if (0 == strcmp(shard->backends[j], cur->addr->name->str)) break;
+		}
+		if (NULL == shard->backends[j]) continue;
+
+		if (!network_backends_breaker_admit(backends, cur)) {
+			if (fallback_ndx == -1) fallback_ndx = i;
+			continue;
+		}
+
+		if (cur->connected_clients < min_connected_clients) {
+			ndx = i;
+			min_connected_clients = cur->connected_clients;
+		}
 	}
 
-	/* looks like we still have queries in the queue, 
-	 * push the next one 
-	 */
-	inj = g_queue_peek_head(st->injected.queries);
-	con->resultset_is_needed = inj->resultset_is_needed;
+	return ndx != -1 ? ndx : fallback_ndx;
+}
 
-	if (!inj->resultset_is_needed && st->injected.sent_resultset > 0) {
-		/* we already sent a resultset to the client and the next query wants to forward it's result-set too, that can't work */
-		g_critical("%s: proxy.queries:append() in %s can only have one injected query without { resultset_is_needed = true } set. We close the client connection now.",
-				G_STRLOC,
-				con->config->lua_script);
+/**
+ * pass the packets the shard sent so far to the merge
+ */
+static void proxy_shard_scatter_feed(network_mysqld_con *con, network_async_query_t *q) {
+	network_mysqld_con_lua_t *st = con->plugin_con_state;
+	GString *packet;
 
-		return NETWORK_SOCKET_ERROR;
+	while ((packet = g_queue_pop_head(q->result))) {
+		network_scatter_merge_add_packet(st->scatter_merge, q->inj->id, packet);
 	}
+}
 
-	g_assert(inj);
-	g_assert(send_sock);
+static void proxy_shard_scatter_progress(network_async_query_t *q, gpointer user_data) {
+	network_mysqld_con *con = user_data;
 
-	network_mysqld_queue_reset(send_sock);
-	network_mysqld_queue_append(send_sock, send_sock->send_queue, S(inj->query));
+	proxy_shard_scatter_feed(con, q);
 
-	network_mysqld_con_reset_command_response_state(con);
+	/* not while proxy_shard_scatter() still starts the queries */
+	if (con->state == CON_STATE_WAIT_ASYNC) network_mysqld_con_handle(-1, 0, con);
+}
 
-	con->state = CON_STATE_SEND_QUERY;
+static void proxy_shard_scatter_done(network_async_query_t *q, gpointer user_data) {
+	network_mysqld_con *con = user_data;
+	network_mysqld_con_lua_t *st = con->plugin_con_state;
+	guint shard_ndx = q->inj->id;
 
-	return NETWORK_SOCKET_SUCCESS;
+	proxy_shard_scatter_feed(con, q);
+	network_scatter_merge_add_error(st->scatter_merge, shard_ndx, "(proxy) the result of a shard ended early");
+
+	st->scatter_queries->pdata[shard_ndx] = NULL;
+	st->scatter_running--;
+	network_async_query_free(q);
+
+	if (con->state == CON_STATE_WAIT_ASYNC) network_mysqld_con_handle(-1, 0, con);
 }
 
 /**
- * handle the query-result we received from the server
+ * send the query without a shard key to all shards and merge their results
  *
- * - decode the result-set to track if we are finished already
- * - handles BUG#25371 if requested
- * - if the packet is finished, calls the network_mysqld_con_handle_proxy_resultset
- *   to handle the resultset in the lua-scripts
+ * - the query runs on a idle connection of a backend of each shard from the pool, the
+ *   connection of the client stays as it is
+ * - the merged packets are streamed to the client as soon as the merge knows them,
+ *   see proxy_shard_scatter_resume()
+ * - network_shard_map_plan_scatter() decides how the results are merged, queries whose
+ *   results can't be merged get a error
  *
- * @see network_mysqld_con_handle_proxy_resultset
+ * @return PROXY_WAIT_ASYNC if the queries run, PROXY_SEND_RESULT if the error is in the send-queue of the client
  */
-NETWORK_MYSQLD_PLUGIN_PROTO(proxy_read_query_result) {
-	int is_finished = 0;
-	network_packet packet;
-	network_socket *recv_sock, *send_sock;
+static network_mysqld_lua_stmt_ret proxy_shard_scatter(network_mysqld_con *con, network_shard_map_t *map) {
 	network_mysqld_con_lua_t *st = con->plugin_con_state;
-	injection *inj = NULL;
+	chassis_plugin_config *config = con->config;
+	chassis_private *g = con->srv->priv;
+	GString *packet = g_queue_peek_head(con->client->recv_queue->chunks);
+	GString empty_username = { "", 0, 0 };
+	network_scatter_merge_t *merge;
+	network_connection_pool **pools;
+	network_socket **socks;
+	const char *errmsg;
+	network_packet p;
+	guint i;
 
-	NETWORK_MYSQLD_CON_TRACK_TIME(con, "proxy::ready_query_result::enter");
+	merge = network_scatter_merge_new(map->shards->len, network_mysqld_socket_is_deprecate_eof(con->client));
 
-	recv_sock = con->server;
-	send_sock = con->client;
+	if (NULL != (errmsg = network_shard_map_plan_scatter(packet->str + NET_HEADER_SIZE + 1, packet->len - NET_HEADER_SIZE - 1, merge))) {
+		GString *msg = g_string_new("(proxy) the query has no shard key and its results can't be merged: ");
 
-	/* check if the last packet is valid */
-	packet.data = g_queue_peek_tail(recv_sock->recv_queue->chunks);
-	packet.offset = 0;
+		g_string_append(msg, errmsg);
+		network_mysqld_con_send_error(con->client, S(msg));
+		g_string_free(msg, TRUE);
 
-	if (0 != st->injected.queries->length) {
-		inj = g_queue_peek_head(st->injected.queries);
+		network_scatter_merge_free(merge);
+
+		return PROXY_SEND_RESULT;
 	}
 
-	if (inj && inj->ts_read_query_result_first == 0) {
-		/**
-		 * log the time of the first received packet
-		 */
-		inj->ts_read_query_result_first = chassis_get_rel_microseconds();
-		/* g_get_current_time(&(inj->ts_read_query_result_first)); */
+	pools = g_new0(network_connection_pool *, map->shards->len);
+	socks = g_new0(network_socket *, map->shards->len);
+
+	for (i = 0; i < map->shards->len; i++) {
+		int backend_ndx;
+
+		if ((backend_ndx = proxy_shard_get_backend(g->backends, map->shards->pdata[i])) < 0) {
+			errmsg = "(proxy) all backends of a shard of the query are down";
+			break;
+		}
+
+		pools[i] = network_backend_get_pool(network_backends_get(g->backends, backend_ndx), chassis_event_thread_get_local_index());
+		socks[i] = network_connection_pool_get_full(pools[i],
+				con->client->response ? con->client->response->username : &empty_username,
+				con->client->default_db,
+				con->client->response ? con->client->response->charset : 0,
+				TRUE,
+				network_mysqld_socket_is_deprecate_eof(con->client));
+		if (NULL == socks[i]) {
+			errmsg = "(proxy) no idle connection to a shard of the query in the pool";
+			break;
+		}
 	}
 
-	is_finished = network_mysqld_proto_get_query_result(&packet, con);
-	if (is_finished == -1) return NETWORK_SOCKET_ERROR; /* something happend, let's get out of here */
+	if (errmsg) {
+		for (i = 0; i < map->shards->len; i++) {
+			if (socks[i]) network_connection_pool_lua_add_socket(con->srv, pools[i], socks[i]);
+		}
+		g_free(pools);
+		g_free(socks);
+		network_scatter_merge_free(merge);
 
-	con->resultset_is_finished = is_finished;
+		network_mysqld_con_send_error(con->client, errmsg, strlen(errmsg));
 
-	/* copy the packet over to the send-queue if we don't need it */
-	if (!con->resultset_is_needed) {
-		network_mysqld_queue_append_raw(send_sock, send_sock->send_queue, g_queue_pop_tail(recv_sock->recv_queue->chunks));
+		return PROXY_SEND_RESULT;
 	}
 
-	if (is_finished) {
-		network_mysqld_lua_stmt_ret ret;
+	chassis_metric_inc(config->shard_scatter_queries_total);
 
-		/**
-		 * the resultset handler might decide to trash the send-queue
-		 * 
-		 * */
+	/* the merged packets are tracked as the result of this command */
+	p.data = packet;
+	p.offset = 0;
+	network_mysqld_con_reset_command_response_state(con);
+	if (0 != network_mysqld_con_command_states_init(con, &p)) {
+		g_debug("%s: ", G_STRLOC);
+	}
 
-		if (inj) {
-			if (con->parse.command == COM_QUERY || con->parse.command == COM_STMT_EXECUTE) {
-				network_mysqld_com_query_result_t *com_query = con->parse.data;
+	st->scatter_merge = merge;
+	st->scatter_queries = g_ptr_array_new();
+	g_ptr_array_set_size(st->scatter_queries, map->shards->len);
+	st->scatter_running = map->shards->len;
 
-				inj->bytes = com_query->bytes;
-				inj->rows  = com_query->rows;
-				inj->qstat.was_resultset = com_query->was_resultset;
-				inj->qstat.binary_encoded = com_query->binary_encoded;
+	/* the done() of a query may be called before the next one is started */
+	for (i = 0; i < map->shards->len; i++) {
+		network_async_query_t *q = network_async_query_new(i, packet->str + NET_HEADER_SIZE, packet->len - NET_HEADER_SIZE);
 
-				/* INSERTs have a affected_rows */
-				if (!com_query->was_resultset) {
-					inj->qstat.affected_rows = com_query->affected_rows;
-					inj->qstat.insert_id     = com_query->insert_id;
-				}
-				inj->qstat.server_status = com_query->server_status;
-				inj->qstat.warning_count = com_query->warning_count;
-				inj->qstat.query_status  = com_query->query_status;
-			}
-			inj->ts_read_query_result_last = chassis_get_rel_microseconds();
-			/* g_get_current_time(&(inj->ts_read_query_result_last)); */
-		}
-		
-		network_mysqld_queue_reset(recv_sock); /* reset the packet-id checks as the server-side is finished */
+		network_async_query_set_progress(q, proxy_shard_scatter_progress, con);
+		st->scatter_queries->pdata[i] = q;
+	}
 
-		NETWORK_MYSQLD_CON_TRACK_TIME(con, "proxy::ready_query_result::enter_lua");
-		ret = proxy_lua_read_query_result(con);
-		NETWORK_MYSQLD_CON_TRACK_TIME(con, "proxy::ready_query_result::leave_lua");
+	for (i = 0; i < map->shards->len; i++) {
+		network_async_query_start(st->scatter_queries->pdata[i], con->srv, pools[i], socks[i], con->client->default_db,
+				&(con->read_timeout), proxy_shard_scatter_done, con);
+	}
 
-		if (PROXY_IGNORE_RESULT != ret) {
-			/* reset the packet-id checks, if we sent something to the client */
-			network_mysqld_queue_reset(send_sock);
-		}
+	g_free(pools);
+	g_free(socks);
 
-		/**
-		 * if the send-queue is empty, we have nothing to send
-		 * and can read the next query */
-		if (send_sock->send_queue->chunks) {
-			con->state = CON_STATE_SEND_QUERY_RESULT;
-		} else {
-			g_assert_cmpint(con->resultset_is_needed, ==, 1); /* we already forwarded the resultset, no way someone has flushed the resultset-queue */
+	return PROXY_WAIT_ASYNC;
+}
 
-			con->state = CON_STATE_READ_QUERY;
+/**
+ * send the merged packets to the client
+ *
+ * the packets are written as they come, without waiting for the client to read them. Once the
+ * merge is finished the queries that still run, like after the LIMIT is reached, are
+ * cancelled and their connections closed.
+ */
+static network_socket_retval_t proxy_shard_scatter_resume(network_mysqld_con *con) {
+	network_mysqld_con_lua_t *st = con->plugin_con_state;
+	GQueue *packets = g_queue_new();
+	GString *packet;
+
+	network_scatter_merge_get_packets(st->scatter_merge, packets);
+
+	while ((packet = g_queue_pop_head(packets))) {
+		network_packet p;
+
+		p.data = packet;
+		p.offset = 0;
+		network_mysqld_proto_get_query_result(&p, con);
+
+		network_mysqld_queue_append_raw(con->client, con->client->send_queue, packet);
+	}
+	g_queue_free(packets);
+
+	if (!network_scatter_merge_is_finished(st->scatter_merge)) {
+		/* what doesn't fit into the socket now goes out with the next packets */
+		if (con->client->send_queue->chunks->length > 0 &&
+		    NETWORK_SOCKET_ERROR == network_socket_write(con->client, -1)) {
+			network_mysqld_con_lua_scatter_reset(st);
+			con->state = CON_STATE_ERROR;
+
+			return NETWORK_SOCKET_SUCCESS;
 		}
+
+		return NETWORK_SOCKET_WAIT_FOR_EVENT;
 	}
-	NETWORK_MYSQLD_CON_TRACK_TIME(con, "proxy::ready_query_result::leave");
-	
+
+	network_mysqld_con_lua_scatter_reset(st);
+
+	while ((packet = g_queue_pop_head(con->client->recv_queue->chunks))) g_string_free(packet, TRUE);
+
+	con->state = CON_STATE_SEND_QUERY_RESULT;
+	con->resultset_is_finished = TRUE;
+
 	return NETWORK_SOCKET_SUCCESS;
 }
 
-static network_mysqld_lua_stmt_ret proxy_lua_connect_server(network_mysqld_con *con) {
-	network_mysqld_lua_stmt_ret ret = PROXY_NO_DECISION;
-
-#ifdef HAVE_LUA_H
+/**
+ * route the query to the backends of the shard of its key
+ *
+ * - only single-packet COM_QUERYs with a key in autocommit mode and outside of transactions
+ *   are routed, everything else goes to the connection of the client
+ * - the queries on the sharded tables without a key go to all shards, see proxy_shard_scatter()
+ * - the connection of the client is parked like with --proxy-rw-split while the query runs
+ *   on a idle connection of the shard from the pool, new connections aren't opened here
+ *
+ * @return PROXY_SEND_RESULT if the error is in the send-queue of the client as the shard
+ *         can't take the query, PROXY_WAIT_ASYNC if it was sent to all shards,
+ *         PROXY_NO_DECISION otherwise
+ */
+static network_mysqld_lua_stmt_ret proxy_shard_route(network_mysqld_con *con) {
 	network_mysqld_con_lua_t *st = con->plugin_con_state;
-	lua_State *L;
+	chassis_plugin_config *config = con->config;
+	chassis_private *g = con->srv->priv;
+	network_shard_map_t *map = network_shard_router_get_map(config->shard_router);
+	network_socket *recv_sock = con->client;
+	network_socket *session_sock = proxy_get_session_server(con);
+	GString *packet = g_queue_peek_head(recv_sock->recv_queue->chunks);
+	network_backend_t *backend;
+	network_shard_t *shard;
+	network_socket *send_sock;
+	GString empty_username = { "", 0, 0 };
+	int backend_ndx;
+
+	if (NULL == con->server) return PROXY_NO_DECISION;
+
+	if (NULL == st->shard_key) st->shard_key = g_string_new(NULL);
+
+	if (recv_sock->recv_queue->chunks->length != 1 ||
+	    packet->len <= NET_HEADER_SIZE ||
+	    packet->str[NET_HEADER_SIZE] != COM_QUERY ||
+	    (session_sock->server_status & SERVER_STATUS_IN_TRANS) ||
+	    !(session_sock->server_status & SERVER_STATUS_AUTOCOMMIT)) {
+		proxy_rw_split_unpark(con);
+		return PROXY_NO_DECISION;
+	}
 
-	/**
-	 * if loading the script fails return a new error 
-	 */
-	switch (network_mysqld_con_lua_register_callback(con, con->config->lua_script)) {
-	case REGISTER_CALLBACK_SUCCESS:
-		break;
-	case REGISTER_CALLBACK_LOAD_FAILED:
-		/* send packet-id 0 */
-		network_mysqld_con_send_error(con->client, C("MySQL Proxy Lua script failed to load. Check the error log."));
+	if (!network_shard_map_get_key(map, packet->str + NET_HEADER_SIZE + 1, packet->len - NET_HEADER_SIZE - 1, st->shard_key)) {
+		if (network_shard_map_is_sharded(map, packet->str + NET_HEADER_SIZE + 1, packet->len - NET_HEADER_SIZE - 1)) {
+			return proxy_shard_scatter(con, map);
+		}
+
+		proxy_rw_split_unpark(con);
+		return PROXY_NO_DECISION;
+	}
+
+	if (NULL == (shard = network_shard_map_get_shard(map, S(st->shard_key)))) {
+		network_mysqld_con_send_error(con->client, C("(proxy) no shard has the key of the query"));
 		return PROXY_SEND_RESULT;
-	case REGISTER_CALLBACK_EXECUTE_FAILED:
-		/* send packet-id 0 */
-		network_mysqld_con_send_error(con->client, C("MySQL Proxy Lua script failed to execute. Check the error log."));
+	}
+
+	if ((backend_ndx = proxy_shard_get_backend(g->backends, shard)) < 0) {
+		network_mysqld_con_send_error(con->client, C("(proxy) all backends of the shard of the query are down"));
 		return PROXY_SEND_RESULT;
 	}
 
-	if (!st->L) return PROXY_NO_DECISION;
+	chassis_metric_inc(config->shard_queries_total);
 
-	L = st->L;
+	backend = network_backends_get(g->backends, backend_ndx);
 
-	g_assert(lua_isfunction(L, -1));
-	lua_getfenv(L, -1);
-	g_assert(lua_istable(L, -1));
-	
-	lua_getfield_literal(L, -1, C("connect_server"));
-	if (lua_isfunction(L, -1)) {
-		if (lua_pcall(L, 0, 1, 0) != 0) {
-			g_critical("%s: (connect_server) %s", 
-					G_STRLOC,
-					lua_tostring(L, -1));
+	/* already on a connection of the backend */
+	if (backend == st->backend) return PROXY_NO_DECISION;
 
-			lua_pop(L, 1); /* errmsg */
+	proxy_rw_split_unpark(con);
+	if (backend == st->backend) return PROXY_NO_DECISION;
 
-			/* the script failed, but we have a useful default */
-		} else {
-			if (lua_isnumber(L, -1)) {
-				ret = lua_tonumber(L, -1);
-			}
-			lua_pop(L, 1);
-		}
+	send_sock = network_connection_pool_get_full(network_backend_get_pool(backend, chassis_event_thread_get_local_index()),
+			con->client->response ? con->client->response->username : &empty_username,
+			con->client->default_db,
+			con->client->response ? con->client->response->charset : 0,
+			TRUE,
+			network_mysqld_socket_is_deprecate_eof(con->client));
+	if (NULL == send_sock) {
+		network_mysqld_con_send_error(con->client, C("(proxy) no idle connection to the shard of the query in the pool"));
+		return PROXY_SEND_RESULT;
+	}
 
-		switch (ret) {
-		case PROXY_NO_DECISION:
-		case PROXY_IGNORE_RESULT:
-			break;
-		case PROXY_SEND_RESULT:
-			/* answer directly */
+	st->rw_split_server = con->server;
+	st->rw_split_backend = st->backend;
+	st->rw_split_backend_ndx = st->backend_ndx;
 
-			if (network_mysqld_con_lua_handle_proxy_response(con, con->config->lua_script)) {
-				/**
-				 * handling proxy.response failed
-				 *
-				 * send a ERR packet
-				 */
-		
-				/* send packet-id 0 */
-				network_mysqld_con_send_error(con->client, C("(lua) handling proxy.response failed, check error-log"));
-			} else {
-				network_queue *q;
-				network_packet packet;
-				int err = 0;
-				guint8 packet_type;
-
-				/* we should have a auth-packet or a err-packet in the queue */
-				q = con->client->send_queue;
-
-				packet.data = g_queue_peek_head(q->chunks);
-				packet.offset = 0;
-
-				err = err || network_mysqld_proto_skip_network_header(&packet);
-				err = err || network_mysqld_proto_peek_int8(&packet, &packet_type);
-				if (!err && packet_type == 0x0a) {
-					network_mysqld_auth_challenge *challenge;
-
-					challenge = network_mysqld_auth_challenge_new();
-
-					err = err || network_mysqld_proto_get_auth_challenge(&packet, challenge);
-
-					if (!err) {
-						g_assert(con->client->challenge == NULL); /* make sure we don't leak memory */
-						con->client->challenge = challenge;
-					} else {
-						network_mysqld_auth_challenge_free(challenge);
-					}
-				}
-			}
+	con->server = send_sock;
+	st->backend = backend;
+	st->backend->connected_clients++;
+	st->backend_ndx = backend_ndx;
 
-			break;
-		default:
-			ret = PROXY_NO_DECISION;
-			break;
-		}
-
-		/* ret should be a index into */
-
-	} else if (lua_isnil(L, -1)) {
-		lua_pop(L, 1); /* pop the nil */
-	} else {
-		g_message("%s.%d: %s", __FILE__, __LINE__, lua_typename(L, lua_type(L, -1)));
-		lua_pop(L, 1); /* pop the ... */
-	}
-	lua_pop(L, 1); /* fenv */
-
-	g_assert(lua_isfunction(L, -1));
-#endif
-	return ret;
+	return PROXY_NO_DECISION;
 }
 
-
-
 /**
- * connect to a backend
+ * answer the query from the query-cache
  *
- * @return
- *   NETWORK_SOCKET_SUCCESS        - connected successfully
- *   NETWORK_SOCKET_ERROR_RETRY    - connecting backend failed, call again to connect to another backend
- *   NETWORK_SOCKET_ERROR          - no backends available, adds a ERR packet to the client queue
+ * - only single-packet COM_QUERYs in autocommit mode and outside of transactions are looked up
+ * - on a miss the result is captured in proxy_read_query_result()
+ *
+ * @return PROXY_SEND_RESULT if the cached result is in the send-queue of the client,
+ *         PROXY_NO_DECISION otherwise
  */
-NETWORK_MYSQLD_PLUGIN_PROTO(proxy_connect_server) {
+static network_mysqld_lua_stmt_ret proxy_query_cache_lookup(network_mysqld_con *con) {
 	network_mysqld_con_lua_t *st = con->plugin_con_state;
 	chassis_private *g = con->srv->priv;
-	guint min_connected_clients = G_MAXUINT;
+	network_socket *recv_sock = con->client;
+	network_socket *session_sock = proxy_get_session_server(con);
+	GString *packet = g_queue_peek_head(recv_sock->recv_queue->chunks);
+	network_query_cache_entry_t *entry;
+	GString *key, *charset;
 	guint i;
-	gboolean use_pooled_connection = FALSE;
-	network_backend_t *cur;
 
-	if (con->server) {
-		switch (network_socket_connect_finish(con->server)) {
-		case NETWORK_SOCKET_SUCCESS:
-			/* increment the connected clients value only if we connected successfully */
-			st->backend->connected_clients++;
-			break;
-		case NETWORK_SOCKET_ERROR:
-		case NETWORK_SOCKET_ERROR_RETRY:
-			g_message("%s.%d: connect(%s) failed: %s. Retrying with different backend.", 
-					__FILE__, __LINE__,
-					con->server->dst->name->str, g_strerror(errno));
+	network_mysqld_con_lua_query_cache_reset(st);
 
-			/* mark the backend as being DOWN and retry with a different one */
-			st->backend->state = BACKEND_STATE_DOWN;
-			chassis_gtime_testset_now(&st->backend->state_since, NULL);
-			network_socket_free(con->server);
-			con->server = NULL;
+	/* a "nocache" hint */
+	if (st->query_hints->cache_ttl_ms == 0) return PROXY_NO_DECISION;
 
-			return NETWORK_SOCKET_ERROR_RETRY;
-		default:
-			g_assert_not_reached();
-			break;
-		}
+	/* an idle multiplexed client is outside of a transaction */
+	if ((NULL == session_sock && !st->multiplex_is_idle) ||
+	    (NULL != session_sock && (session_sock->server_status & SERVER_STATUS_IN_TRANS)) ||
+	    (NULL != session_sock && !(session_sock->server_status & SERVER_STATUS_AUTOCOMMIT)) ||
+	    st->injected.queries->length != 0 ||
+	    recv_sock->recv_queue->chunks->length != 1 ||
+	    packet->len <= NET_HEADER_SIZE ||
+	    packet->str[NET_HEADER_SIZE] != COM_QUERY) {
+		return PROXY_NO_DECISION;
+	}
 
-		if (st->backend->state != BACKEND_STATE_UP) {
-			st->backend->state = BACKEND_STATE_UP;
-			chassis_gtime_testset_now(&st->backend->state_since, NULL);
-		}
+	/* with a "cache_ttl" hint the application knows the result can be cached, it only has to be a read */
+	if (st->query_hints->cache_ttl_ms > 0 ?
+	    NETWORK_MYSQLD_QUERY_RO != proxy_query_get_rw_type(packet) :
+	    !network_query_cache_is_cacheable(packet->str + NET_HEADER_SIZE + 1, packet->len - NET_HEADER_SIZE - 1)) {
+		return PROXY_NO_DECISION;
+	}
 
-		con->state = CON_STATE_READ_HANDSHAKE;
+	/* the same bytes of the query mean something else in another charset */
+	if (st->query_cache_charset_is_unknown || NULL == recv_sock->response) return PROXY_NO_DECISION;
 
-		return NETWORK_SOCKET_SUCCESS;
+	charset = g_string_new(NULL);
+	g_string_printf(charset, "%u", recv_sock->response->charset);
+	if (st->query_cache_names) {
+		g_string_append_c(charset, ' ');
+		g_string_append_len(charset, S(st->query_cache_names));
 	}
 
-	st->backend = NULL;
-	st->backend_ndx = -1;
+	key = g_string_new(NULL);
+	network_query_cache_key_set(key,
+			recv_sock->response->username,
+			recv_sock->default_db,
+			charset,
+			network_mysqld_socket_is_deprecate_eof(recv_sock),
+			packet->str + NET_HEADER_SIZE + 1, packet->len - NET_HEADER_SIZE - 1);
+	g_string_free(charset, TRUE);
 
-	network_backends_check(g->backends);
+	if (NULL == (entry = network_query_cache_get(g->query_cache, key))) {
+		st->query_cache_key = key;
+		st->query_cache_packets = g_ptr_array_new();
 
-	switch (proxy_lua_connect_server(con)) {
-	case PROXY_SEND_RESULT:
-		/* we answered directly ... like denial ...
-		 *
-		 * for sure we have something in the send-queue 
-		 *
-		 */
-		
-		return NETWORK_SOCKET_SUCCESS;
-	case PROXY_NO_DECISION:
-		/* just go on */
+		return PROXY_NO_DECISION;
+	}
+	g_string_free(key, TRUE);
 
-		break;
-	case PROXY_IGNORE_RESULT:
-		use_pooled_connection = TRUE;
+	for (i = 0; i < entry->packets->len; i++) {
+		GString *cached = entry->packets->pdata[i];
 
-		break;
-	default:
-		g_error("%s.%d: ... ", __FILE__, __LINE__);
-		break;
+		network_mysqld_queue_append_raw(recv_sock, recv_sock->send_queue, g_string_new_len(S(cached)));
 	}
+	network_query_cache_entry_unref(g->query_cache, entry);
 
-	/* protect the typecast below */
-	g_assert_cmpint(g->backends->backends->len, <, G_MAXINT);
+	return PROXY_SEND_RESULT;
+}
 
-	/**
-	 * if the current backend is down, ignore it 
-	 */
-	cur = network_backends_get(g->backends, st->backend_ndx);
+/**
+ * copy a packet of the result we capture
+ *
+ * results that are too big for the cache aren't captured any further
+ */
+static void proxy_query_cache_capture(network_mysqld_con *con, GString *packet) {
+	network_mysqld_con_lua_t *st = con->plugin_con_state;
+	chassis_private *g = con->srv->priv;
 
-	if (cur) {
-		if (cur->state == BACKEND_STATE_DOWN) {
-			st->backend_ndx = -1;
-		}
+	st->query_cache_bytes += packet->len;
+	if (st->query_cache_bytes > g->query_cache->max_entry_bytes) {
+		network_mysqld_con_lua_query_cache_reset(st);
+
+		return;
 	}
 
-	if (con->server && !use_pooled_connection) {
-		gint bndx = st->backend_ndx;
-		/* we already have a connection assigned, 
-		 * but the script said we don't want to use it
-		 */
+	g_ptr_array_add(st->query_cache_packets, g_string_new_len(S(packet)));
+}
 
-		network_connection_pool_lua_add_connection(con);
+/**
+ * add the captured result to the query-cache
+ *
+ * only complete result-sets that didn't start a transaction are cached
+ */
+static void proxy_query_cache_store(network_mysqld_con *con) {
+	network_mysqld_con_lua_t *st = con->plugin_con_state;
+	chassis_private *g = con->srv->priv;
+	network_mysqld_com_query_result_t *com_query = con->parse.data;
 
-		st->backend_ndx = bndx;
+	if (con->parse.command == COM_QUERY &&
+	    NULL != com_query &&
+	    com_query->query_status == MYSQLD_PACKET_OK &&
+	    com_query->was_resultset &&
+	    (com_query->server_status & SERVER_STATUS_AUTOCOMMIT) &&
+	    !(com_query->server_status & (SERVER_STATUS_IN_TRANS | SERVER_MORE_RESULTS_EXISTS))) {
+		network_query_cache_add_ttl(g->query_cache, st->query_cache_key, st->query_cache_packets,
+				st->query_hints->cache_ttl_ms > 0 ? st->query_hints->cache_ttl_ms * 1000 : -1);
+		st->query_cache_packets = NULL; /* owned by the cache now */
 	}
 
-	if (st->backend_ndx < 0) {
-		/**
-		 * we can choose between different back addresses 
-		 *
-		 * prefer SQF (shorted queue first) to load all backends equally
-		 */ 
+	network_mysqld_con_lua_query_cache_reset(st);
+}
 
-		for (i = 0; i < network_backends_count(g->backends); i++) {
-			cur = network_backends_get(g->backends, i);
-	
-			/**
-			 * skip backends which are down or not writable
-			 */	
-			if (cur->state == BACKEND_STATE_DOWN ||
-			    cur->type != BACKEND_TYPE_RW) continue;
-	
-			if (cur->connected_clients < min_connected_clients) {
-				st->backend_ndx = i;
-				min_connected_clients = cur->connected_clients;
-			}
-		}
+/**
+ * remember the tables the query writes to
+ *
+ * their results are dropped in proxy_query_cache_invalidate() after the write
+ */
+static void proxy_query_cache_track_writes(network_mysqld_con *con) {
+	network_mysqld_con_lua_t *st = con->plugin_con_state;
+	GString *packet = g_queue_peek_head(con->client->recv_queue->chunks);
 
-		if ((cur = network_backends_get(g->backends, st->backend_ndx))) {
-			st->backend = cur;
-		}
-	} else if (NULL == st->backend) {
-		if ((cur = network_backends_get(g->backends, st->backend_ndx))) {
-			st->backend = cur;
-		}
+	if (NULL == packet ||
+	    packet->len <= NET_HEADER_SIZE ||
+	    packet->str[NET_HEADER_SIZE] != COM_QUERY) {
+		return;
 	}
 
-	if (NULL == st->backend) {
-		network_mysqld_con_send_error_pre41(con->client, C("(proxy) all backends are down"));
-		g_critical("%s.%d: Cannot connect, all backends are down.", __FILE__, __LINE__);
-		return NETWORK_SOCKET_ERROR;
+	if (-1 == network_query_cache_get_written_tables(packet->str + NET_HEADER_SIZE + 1, packet->len - NET_HEADER_SIZE - 1,
+				st->query_cache_written_tables)) {
+		st->query_cache_written_unknown = TRUE;
 	}
+}
 
-	/**
-	 * check if we have a connection in the pool for this backend
-	 */
-	if (NULL == con->server) {
-		con->server = network_socket_new();
-		network_address_copy(con->server->dst, st->backend->addr);
+/**
+ * follow the charset of the session for the key of the cached results
+ *
+ * the charset of the handshake is replaced by the one of a SET NAMES. After any other
+ * statement that may change it, like SET CHARACTER SET or SET character_set_results, we
+ * don't know it anymore and the client doesn't use the cache until a COM_RESET_CONNECTION
+ */
+static void proxy_query_cache_track_charset(network_mysqld_con *con) {
+	network_mysqld_con_lua_t *st = con->plugin_con_state;
+	GString *packet = g_queue_peek_head(con->client->recv_queue->chunks);
+	const char *query;
+	gsize query_len;
+	GString *names;
 
-		switch(network_socket_connect(con->server)) {
-		case NETWORK_SOCKET_ERROR_RETRY:
-			/* the socket is non-blocking already, 
-			 * call getsockopt() to see if we are done */
-			return NETWORK_SOCKET_ERROR_RETRY;
-		case NETWORK_SOCKET_SUCCESS:
-			/* increment the connected clients value only if we connected successfully */
-			st->backend->connected_clients++;
-			break;
-		default:
-			g_message("%s.%d: connecting to backend (%s) failed, marking it as down for ...", 
-					__FILE__, __LINE__, con->server->dst->name->str);
+	if (NULL == packet || packet->len <= NET_HEADER_SIZE) return;
 
-			st->backend->state = BACKEND_STATE_DOWN;
-			chassis_gtime_testset_now(&st->backend->state_since, NULL);
+	switch ((guint8)packet->str[NET_HEADER_SIZE]) {
+	case COM_QUERY:
+		query = packet->str + NET_HEADER_SIZE + 1;
+		query_len = packet->len - NET_HEADER_SIZE - 1;
 
-			network_socket_free(con->server);
-			con->server = NULL;
+		if (!network_mysqld_proto_query_sets_charset(query, query_len)) break;
 
-			return NETWORK_SOCKET_ERROR_RETRY;
+		names = g_string_new(NULL);
+		if (con->client->recv_queue->chunks->length == 1 &&
+		    NETWORK_MYSQLD_QUERY_TRIVIAL_SET_NAMES == network_mysqld_proto_get_query_trivial_type(query, query_len, names)) {
+			if (st->query_cache_names) g_string_free(st->query_cache_names, TRUE);
+			st->query_cache_names = names;
+		} else {
+			g_string_free(names, TRUE);
+			st->query_cache_charset_is_unknown = TRUE;
 		}
-
-		if (st->backend->state != BACKEND_STATE_UP) {
-			st->backend->state = BACKEND_STATE_UP;
-			chassis_gtime_testset_now(&st->backend->state_since, NULL);
+		break;
+	case COM_CHANGE_USER:
+		st->query_cache_charset_is_unknown = TRUE;
+		break;
+	case COM_RESET_CONNECTION:
+		/* back to the charset of the handshake */
+		if (st->query_cache_names) {
+			g_string_free(st->query_cache_names, TRUE);
+			st->query_cache_names = NULL;
 		}
+		st->query_cache_charset_is_unknown = FALSE;
+		break;
+	default:
+		break;
+	}
+}
 
-		con->state = CON_STATE_READ_HANDSHAKE;
-	} else {
-		GString *auth_packet;
+/**
+ * drop the cached results of the tables the client wrote to
+ *
+ * inside a transaction we wait for the COMMIT as other clients still see the old rows
+ */
+static void proxy_query_cache_invalidate(network_mysqld_con *con) {
+	network_mysqld_con_lua_t *st = con->plugin_con_state;
+	chassis_private *g = con->srv->priv;
+	network_socket *session_sock = proxy_get_session_server(con);
+	guint i;
 
-		/**
-		 * send the old hand-shake packet
-		 */
+	if (session_sock && (session_sock->server_status & SERVER_STATUS_IN_TRANS)) return;
 
-		auth_packet = g_string_new(NULL);
-		network_mysqld_proto_append_auth_challenge(auth_packet, con->server->challenge);
+	if (st->query_cache_written_unknown) {
+		network_query_cache_flush(g->query_cache);
+	} else {
+		for (i = 0; i < st->query_cache_written_tables->len; i++) {
+			GString *table = st->query_cache_written_tables->pdata[i];
 
-		network_mysqld_queue_append(
-				con->client,
-				con->client->send_queue, 
-				S(auth_packet));
+			network_query_cache_invalidate_table(g->query_cache, S(table));
+		}
+	}
 
-		g_string_free(auth_packet, TRUE);
+	network_mysqld_con_lua_query_cache_clear_written(st);
+}
 
-		g_assert(con->client->challenge == NULL);
-		con->client->challenge = network_mysqld_auth_challenge_copy(con->server->challenge);
+/**
+ * normalize the COM_QUERY of the client for --proxy-query-digest-size
+ *
+ * the execution is added to the digests by proxy_query_digest_record() when its result is sent
+ */
+static void proxy_query_digest_track(network_mysqld_con *con) {
+	network_mysqld_con_lua_t *st = con->plugin_con_state;
+	GString *packet = g_queue_peek_head(con->client->recv_queue->chunks);
 
-		con->state = CON_STATE_SEND_HANDSHAKE;
+	st->digest_is_pending = FALSE;
 
-		/**
-		 * connect_clients is already incremented 
-		 */
+	if (NULL == packet ||
+	    packet->len <= NET_HEADER_SIZE ||
+	    packet->str[NET_HEADER_SIZE] != COM_QUERY) {
+		return;
 	}
 
-	return NETWORK_SOCKET_SUCCESS;
+	if (NULL == st->digest_text) st->digest_text = g_string_sized_new(packet->len);
+	g_string_truncate(st->digest_text, 0);
+
+	proxy_query_fingerprint(st->digest_text, &st->digest_hash, packet);
+	st->digest_is_pending = TRUE;
 }
 
 /**
- * convert a double into a timeval
+ * add the query of the client to the digests of our event-thread
+ *
+ * results we didn't get from a backend, like from the query-cache, are counted without a latency
  */
-static gboolean
-timeval_from_double(struct timeval *dst, double t) {
-	g_return_val_if_fail(dst != NULL, FALSE);
-	g_return_val_if_fail(t >= 0, FALSE);
+static void proxy_query_digest_record(network_mysqld_con *con) {
+	network_mysqld_con_lua_t *st = con->plugin_con_state;
+	chassis_private *g = con->srv->priv;
+	network_mysqld_com_query_result_t *com_query = NULL;
+	guint64 usec = 0;
 
-	dst->tv_sec = floor(t);
-	dst->tv_usec = floor((t - dst->tv_sec) * 1000000);
+	st->digest_is_pending = FALSE;
 
-	return TRUE;
+	if (con->ts_send_query != 0) {
+		if (con->ts_read_query_result_last >= con->ts_send_query) {
+			usec = con->ts_read_query_result_last - con->ts_send_query;
+		}
+		if (con->parse.command == COM_QUERY) com_query = con->parse.data;
+	}
+
+	network_query_digest_add(g->query_digest, chassis_event_thread_get_local_index(),
+			st->digest_hash, st->digest_text, usec,
+			com_query ? com_query->rows : 0,
+			com_query ? com_query->bytes : 0,
+			com_query ? com_query->query_status == MYSQLD_PACKET_ERR : FALSE,
+			con->ts_send_query != 0 ? st->backend_ndx : -1);
 }
 
-NETWORK_MYSQLD_PLUGIN_PROTO(proxy_init) {
+/**
+ * send a sample of the reads of the clients to --proxy-mirror-backend too
+ *
+ * the client doesn't wait for the mirror, it only reports the result of its own
+ * backend with proxy_mirror_track() for the comparison
+ */
+static void proxy_mirror_push(network_mysqld_con *con) {
 	network_mysqld_con_lua_t *st = con->plugin_con_state;
 	chassis_plugin_config *config = con->config;
+	chassis_private *g = con->srv->priv;
+	GString *packet = g_queue_peek_head(con->client->recv_queue->chunks);
+	network_socket *session_sock = proxy_get_session_server(con);
 
-	g_assert(con->plugin_con_state == NULL);
+	if (st->mirror_query) {
+		network_mirror_query_primary_failed(st->mirror_query);
+		st->mirror_query = NULL;
+	}
 
-	st = network_mysqld_con_lua_new();
+	if (con->client->recv_queue->chunks->length != 1 ||
+	    packet->len <= NET_HEADER_SIZE ||
+	    packet->str[NET_HEADER_SIZE] != COM_QUERY ||
+	    NETWORK_MYSQLD_QUERY_RW == proxy_query_get_rw_type(packet)) {
+		return;
+	}
 
-	con->plugin_con_state = st;
-	
-	con->state = CON_STATE_CONNECT_SERVER;
-
-	/* set the connection specific timeouts
-	 *
-	 * TODO: expose these settings at runtime
-	 */
-	if (config->connect_timeout_dbl >= 0) {
-		timeval_from_double(&con->connect_timeout, config->connect_timeout_dbl);
-	}
-	if (config->read_timeout_dbl >= 0) {
-		timeval_from_double(&con->read_timeout, config->read_timeout_dbl);
-	}
-	if (config->write_timeout_dbl >= 0) {
-		timeval_from_double(&con->write_timeout, config->write_timeout_dbl);
-	}
+	/* the mirror wouldn't see the snapshot of the transaction */
+	if (session_sock && (session_sock->server_status & SERVER_STATUS_IN_TRANS)) return;
 
+	if (!network_mirror_sample(config->mirror)) return;
 
+	/* the stats of the mirror are kept by fingerprint */
+	if (!network_query_digest_is_enabled(g->query_digest)) proxy_query_digest_track(con);
 
-	return NETWORK_SOCKET_SUCCESS;
+	st->mirror_query = network_mirror_push(config->mirror, chassis_event_thread_get_local_index(),
+			st->digest_hash, st->digest_text,
+			packet->str + NET_HEADER_SIZE, packet->len - NET_HEADER_SIZE,
+			con->client->default_db);
+	st->mirror_usec = chassis_get_rel_microseconds();
 }
 
-static network_mysqld_lua_stmt_ret proxy_lua_disconnect_client(network_mysqld_con *con) {
-	network_mysqld_lua_stmt_ret ret = PROXY_NO_DECISION;
-
-#ifdef HAVE_LUA_H
+/**
+ * checksum the rows of the result of a mirrored query like the mirror does
+ *
+ * @param rows the rows of the result before this packet
+ */
+static void proxy_mirror_track(network_mysqld_con *con, GString *packet, guint64 rows, int is_finished) {
 	network_mysqld_con_lua_t *st = con->plugin_con_state;
-	lua_State *L;
+	network_mysqld_com_query_result_t *com_query = con->parse.data;
 
-	/* call the lua script to pick a backend
-	 * */
-	/* this error handling is different, as we no longer have a client. */
-	switch(network_mysqld_con_lua_register_callback(con, con->config->lua_script)) {
-		case REGISTER_CALLBACK_SUCCESS:
-			break;
-		case REGISTER_CALLBACK_LOAD_FAILED:
-		case REGISTER_CALLBACK_EXECUTE_FAILED:
-			return ret;
+	if (con->parse.command != COM_QUERY || NULL == com_query) {
+		network_mirror_query_primary_failed(st->mirror_query);
+		st->mirror_query = NULL;
+		return;
 	}
 
-	if (!st->L) return 0;
+	if (com_query->rows != rows) {
+		network_mirror_result_add_row(&(st->mirror_query->primary), packet->str + NET_HEADER_SIZE, packet->len - NET_HEADER_SIZE);
+	}
 
-	L = st->L;
+	if (is_finished) {
+		network_mirror_query_primary_done(st->mirror_query, com_query->query_status, chassis_get_rel_microseconds() - st->mirror_usec);
+		st->mirror_query = NULL;
+	}
+}
 
-	g_assert(lua_isfunction(L, -1));
-	lua_getfenv(L, -1);
-	g_assert(lua_istable(L, -1));
-	
-	lua_getfield_literal(L, -1, C("disconnect_client"));
-	if (lua_isfunction(L, -1)) {
-		if (lua_pcall(L, 0, 1, 0) != 0) {
-			g_critical("%s.%d: (disconnect_client) %s", 
-					__FILE__, __LINE__,
-					lua_tostring(L, -1));
+/**
+ * fill in who sent the query and where it went
+ */
+static network_query_log_entry_t *proxy_query_log_entry_new(network_mysqld_con *con, guint64 usec, guint64 first_usec) {
+	network_query_log_entry_t *entry;
 
-			lua_pop(L, 1); /* errmsg */
+	entry = network_query_log_entry_new();
+	chassis_get_coarse_current_time(&(entry->ts));
+	entry->usec = usec;
+	entry->first_usec = first_usec;
 
-			/* the script failed, but we have a useful default */
-		} else {
-			if (lua_isnumber(L, -1)) {
-				ret = lua_tonumber(L, -1);
-			}
-			lua_pop(L, 1);
-		}
+	if (con->client->response) entry->user = g_strndup(S(con->client->response->username));
+	if (con->client->default_db->len > 0) entry->db = g_strndup(S(con->client->default_db));
+	entry->client = g_strdup(network_address_get_name(con->client->src));
+	if (con->server) entry->backend = g_strndup(S(con->server->dst->name));
 
-		switch (ret) {
-		case PROXY_NO_DECISION:
-		case PROXY_IGNORE_RESULT:
-			break;
-		default:
-			ret = PROXY_NO_DECISION;
-			break;
-		}
+	return entry;
+}
 
-		/* ret should be a index into */
+/**
+ * copy the command of the client for --proxy-query-log
+ *
+ * queries that are replaced by injections are logged by proxy_query_log_injection() instead
+ */
+static void proxy_query_log_track(network_mysqld_con *con) {
+	network_mysqld_con_lua_t *st = con->plugin_con_state;
+	GString *packet = g_queue_peek_head(con->client->recv_queue->chunks);
 
-	} else if (lua_isnil(L, -1)) {
-		lua_pop(L, 1); /* pop the nil */
-	} else {
-		g_message("%s.%d: %s", __FILE__, __LINE__, lua_typename(L, lua_type(L, -1)));
-		lua_pop(L, 1); /* pop the ... */
-	}
-	lua_pop(L, 1); /* fenv */
+	st->query_log_is_pending = FALSE;
 
-	g_assert(lua_isfunction(L, -1));
-#endif
-	return ret;
-}
+	if (NULL == packet || packet->len <= NET_HEADER_SIZE) return;
 
+	if (NULL == st->query_log_text) st->query_log_text = g_string_new(NULL);
+	g_string_assign_len(st->query_log_text,
+			packet->str + NET_HEADER_SIZE + 1,
+			MIN(packet->len - NET_HEADER_SIZE - 1, NETWORK_QUERY_LOG_MAX_QUERY_LEN));
+	st->query_log_command = packet->str[NET_HEADER_SIZE];
+	st->query_log_is_pending = TRUE;
+}
 
 /**
- * cleanup the proxy specific data on the current connection 
- *
- * move the server connection into the connection pool in case it is a 
- * good client-side close
+ * write the packets of the client to the --proxy-capture
  *
- * @return NETWORK_SOCKET_SUCCESS
- * @see plugin_call_cleanup
+ * a connection is numbered with its first command, the CONNECT record carries the
+ * user and default-db the replay logs in with
  */
-NETWORK_MYSQLD_PLUGIN_PROTO(proxy_disconnect_client) {
+static void proxy_capture_track(network_mysqld_con *con) {
 	network_mysqld_con_lua_t *st = con->plugin_con_state;
-	lua_scope  *sc = con->srv->priv->sc;
-	gboolean use_pooled_connection = FALSE;
+	network_capture_t *capture = con->config->capture;
+	GList *chunk;
 
-	if (st == NULL) return NETWORK_SOCKET_SUCCESS;
-	
-	/**
-	 * let the lua-level decide if we want to keep the connection in the pool
-	 */
+	if (0 == st->capture_id) {
+		GString *login = g_string_new(NULL);
 
-	switch (proxy_lua_disconnect_client(con)) {
-	case PROXY_NO_DECISION:
-		/* just go on */
+		if (con->client->response) g_string_append_len(login, S(con->client->response->username));
+		g_string_append_c(login, '\0');
+		g_string_append_len(login, S(con->client->default_db));
 
-		break;
-	case PROXY_IGNORE_RESULT:
-		break;
-	default:
-		g_error("%s.%d: ... ", __FILE__, __LINE__);
-		break;
-	}
+		st->capture_id = network_capture_con_id_new(capture);
+		network_capture_push(capture, st->capture_id, NETWORK_CAPTURE_CONNECT, S(login));
 
-	/**
-	 * check if one of the backends has to many open connections
-	 */
+		g_string_free(login, TRUE);
+	}
 
-	if (use_pooled_connection &&
-	    con->state == CON_STATE_CLOSE_CLIENT) {
-		/* move the connection to the connection pool
-		 *
-		 * this disconnects con->server and safes it from getting free()ed later
-		 */
+	for (chunk = con->client->recv_queue->chunks->head; chunk; chunk = chunk->next) {
+		GString *packet = chunk->data;
 
-		network_connection_pool_lua_add_connection(con);
-	} else if (st->backend) {
-		/* we have backend assigned and want to close the connection to it */
-		st->backend->connected_clients--;
+		network_capture_push(capture, st->capture_id, NETWORK_CAPTURE_PACKET, S(packet));
 	}
+}
 
-#ifdef HAVE_LUA_H
-	/* remove this cached script from registry */
-	if (st->L_ref > 0) {
-		luaL_unref(sc->L, LUA_REGISTRYINDEX, st->L_ref);
+/**
+ * log the query of the client once its result is sent
+ */
+static void proxy_query_log_record(network_mysqld_con *con) {
+	network_mysqld_con_lua_t *st = con->plugin_con_state;
+	network_query_log_t *log = con->config->query_log;
+	network_query_log_entry_t *entry;
+	network_mysqld_com_query_result_t *com_query = NULL;
+	chassis_event_thread_cpu_t cpu;
+	guint64 usec = 0, first_usec = 0;
+
+	st->query_log_is_pending = FALSE;
+
+	if (con->ts_send_query != 0) {
+		if (con->ts_read_query_result_last >= con->ts_send_query) {
+			usec = con->ts_read_query_result_last - con->ts_send_query;
+		}
+		if (con->ts_read_query_result_first >= con->ts_send_query) {
+			first_usec = con->ts_read_query_result_first - con->ts_send_query;
+		}
+		if (con->parse.command == COM_QUERY) com_query = con->parse.data;
 	}
-#endif
 
-	network_mysqld_con_lua_free(st);
+	if (!network_query_log_wants(log, usec)) return;
 
-	con->plugin_con_state = NULL;
+	cpu = chassis_event_thread_cpu_enter(CHASSIS_EVENT_THREAD_CPU_LOG);
 
-	/**
-	 * walk all pools and clean them up
-	 */
+	entry = proxy_query_log_entry_new(con, usec, first_usec);
+	entry->command = st->query_log_command;
+	g_string_assign_len(entry->query, S(st->query_log_text));
+	if (com_query) {
+		entry->rows = com_query->rows;
+		entry->bytes = com_query->bytes;
+		entry->is_error = com_query->query_status == MYSQLD_PACKET_ERR;
+	}
 
-	return NETWORK_SOCKET_SUCCESS;
+	network_query_log_push(log, entry);
+
+	chassis_event_thread_cpu_leave(cpu);
 }
 
 /**
- * read the load data infile data from the client
- *
- * - decode the result-set to track if we are finished already
- * - gets called once for each packet
+ * log a injected query when its result is read
  *
- * @FIXME stream the data to the backend
+ * the times are taken from the injection: from queueing the query until its last packet
  */
-NETWORK_MYSQLD_PLUGIN_PROTO(proxy_read_local_infile_data) {
-	int query_result = 0;
-	network_packet packet;
-	network_socket *recv_sock, *send_sock;
-	network_mysqld_com_query_result_t *com_query = con->parse.data;
-
-	NETWORK_MYSQLD_CON_TRACK_TIME(con, "proxy::ready_query_result::enter");
-	
-	recv_sock = con->client;
-	send_sock = con->server;
+static void proxy_query_log_injection(network_mysqld_con *con, injection *inj) {
+	network_mysqld_con_lua_t *st = con->plugin_con_state;
+	network_query_log_t *log = con->config->query_log;
+	network_query_log_entry_t *entry;
+	chassis_event_thread_cpu_t cpu;
+	guint64 usec = 0, first_usec = 0;
 
-	/* check if the last packet is valid */
-	packet.data = g_queue_peek_tail(recv_sock->recv_queue->chunks);
-	packet.offset = 0;
+	/* the client's query is replaced by the injections */
+	st->query_log_is_pending = FALSE;
 
-	/* if we get here from another state, src/network-mysqld.c is broken */
-	g_assert_cmpint(con->parse.command, ==, COM_QUERY);
-	g_assert_cmpint(com_query->state, ==, PARSE_COM_QUERY_LOCAL_INFILE_DATA);
+	if (inj->query->len == 0) return;
 
-	query_result = network_mysqld_proto_get_query_result(&packet, con);
+	if (inj->ts_read_query_result_last >= inj->ts_read_query) {
+		usec = inj->ts_read_query_result_last - inj->ts_read_query;
+	}
+	if (inj->ts_read_query_result_first >= inj->ts_read_query) {
+		first_usec = inj->ts_read_query_result_first - inj->ts_read_query;
+	}
 
-	/* set the testing flag for all data received or not */ 
-	con->local_file_data_is_finished = (query_result == 1);
+	if (!network_query_log_wants(log, usec)) return;
 
-	if (query_result == -1) return NETWORK_SOCKET_ERROR; /* something happend, let's get out of here */
+	cpu = chassis_event_thread_cpu_enter(CHASSIS_EVENT_THREAD_CPU_LOG);
 
-	if (con->server) {
-		/* we haven't received all data from load data infile, so let's continue reading and writing to the backend */
-		network_mysqld_queue_append_raw(send_sock, send_sock->send_queue,
-				g_queue_pop_tail(recv_sock->recv_queue->chunks));
-	} else {
-		GString *s;
-		/* we don't have a backend
-		 *
-		 * - free the received packets early
-		 * - send a OK later 
-		 */
-		while ((s = g_queue_pop_head(recv_sock->recv_queue->chunks))) g_string_free(s, TRUE);
-	}
+	entry = proxy_query_log_entry_new(con, usec, first_usec);
+	entry->command = inj->query->str[0];
+	g_string_assign_len(entry->query, inj->query->str + 1, MIN(inj->query->len - 1, NETWORK_QUERY_LOG_MAX_QUERY_LEN));
+	entry->rows = inj->rows;
+	entry->bytes = inj->bytes;
+	entry->is_error = inj->qstat.query_status == MYSQLD_PACKET_ERR;
+	entry->is_injected = TRUE;
 
-	if (query_result == 1) {
-		if (con->server) { /* we have received all data, lets move forward reading the result from the server */
-			con->state = CON_STATE_SEND_LOCAL_INFILE_DATA;
-		} else {
-			network_mysqld_con_send_ok(con->client);
-			con->state = CON_STATE_SEND_LOCAL_INFILE_RESULT;
-		}
-		g_assert_cmpint(com_query->state, ==, PARSE_COM_QUERY_LOCAL_INFILE_RESULT);
-	}
+	network_query_log_push(log, entry);
 
-	return NETWORK_SOCKET_SUCCESS;
+	chassis_event_thread_cpu_leave(cpu);
 }
 
 /**
- * read the load data infile result from the server
+ * decide if the query of the client gets traced for --proxy-trace-address
  *
- * - decode the result-set to track if we are finished already
+ * the trace-context comes from the traceparent= hint, see --proxy-query-hints
  */
-NETWORK_MYSQLD_PLUGIN_PROTO(proxy_read_local_infile_result) {
-	int query_result = 0;
-	network_packet packet;
-	network_socket *recv_sock, *send_sock;
+static void proxy_trace_track(network_mysqld_con *con) {
+	network_mysqld_con_lua_t *st = con->plugin_con_state;
+	GString *traceparent = st->query_hints->traceparent;
 
-	NETWORK_MYSQLD_CON_TRACK_TIME(con, "proxy::ready_local_infile_result::enter");
+	st->trace_is_pending = FALSE;
 
-	recv_sock = con->server;
-	send_sock = con->client;
+	if (traceparent->len > 0) {
+		network_trace_context_parse(&(st->trace_ctx), S(traceparent));
+	} else {
+		st->trace_ctx.is_set = FALSE;
+	}
 
-	/* check if the last packet is valid */
-	packet.data = g_queue_peek_tail(recv_sock->recv_queue->chunks);
-	packet.offset = 0;
-	
-	query_result = network_mysqld_proto_get_query_result(&packet, con);
-	if (query_result == -1) return NETWORK_SOCKET_ERROR; /* something happend, let's get out of here */
+	if (!network_trace_wants(con->config->trace, &(st->trace_ctx))) return;
 
-	network_mysqld_queue_append_raw(send_sock, send_sock->send_queue,
-			g_queue_pop_tail(recv_sock->recv_queue->chunks));
+	st->trace_read_usec = chassis_get_rel_microseconds();
+	st->trace_queued_usec = 0;
+	st->trace_admitted_usec = 0;
+	st->trace_is_pending = TRUE;
+}
 
-	if (query_result == 1) {
-		con->state = CON_STATE_SEND_LOCAL_INFILE_RESULT;
-	}
+/**
+ * the traced query is routed and admitted, it goes to the backend now
+ */
+static void proxy_trace_admitted(network_mysqld_con *con) {
+	network_mysqld_con_lua_t *st = con->plugin_con_state;
 
-	return NETWORK_SOCKET_SUCCESS;
+	if (0 != st->trace_admitted_usec) return;
+
+	st->trace_queued_usec = st->admission.queued_at;
+	st->trace_admitted_usec = chassis_get_rel_microseconds();
 }
 
 /**
- * cleanup after we sent to result of the LOAD DATA INFILE LOCAL data to the client
+ * queue the timestamps of the traced query for the sender of the spans
  */
-NETWORK_MYSQLD_PLUGIN_PROTO(proxy_send_local_infile_result) {
-	network_socket *recv_sock, *send_sock;
+static void proxy_trace_record(network_mysqld_con *con) {
+	network_mysqld_con_lua_t *st = con->plugin_con_state;
+	network_trace_query_t *query;
+	GTimeVal now;
+	guint64 now_usec = chassis_get_rel_microseconds();
 
-	NETWORK_MYSQLD_CON_TRACK_TIME(con, "proxy::send_local_infile_result::enter");
+	st->trace_is_pending = FALSE;
 
-	recv_sock = con->server;
-	send_sock = con->client;
+	g_get_current_time(&now);
 
-	/* reset the packet-ids */
-	if (send_sock) network_mysqld_queue_reset(send_sock);
-	if (recv_sock) network_mysqld_queue_reset(recv_sock);
+	query = network_trace_query_new();
+	query->ctx = st->trace_ctx;
+	query->unix_offset_usec = (gint64)now.tv_sec * G_USEC_PER_SEC + now.tv_usec - (gint64)now_usec;
+	query->read_usec = st->trace_read_usec;
+	query->queued_usec = st->trace_queued_usec;
+	query->admitted_usec = st->trace_admitted_usec;
+	query->last_usec = now_usec;
 
-	con->state = CON_STATE_READ_QUERY;
+	if (con->ts_send_query != 0) {
+		query->sent_usec = con->ts_send_query;
+		query->first_usec = con->ts_read_query_result_first;
+		if (con->ts_read_query_result_last >= con->ts_send_query) query->last_usec = con->ts_read_query_result_last;
 
-	return NETWORK_SOCKET_SUCCESS;
-}
+		if (con->parse.command == COM_QUERY && con->parse.data) {
+			network_mysqld_com_query_result_t *com_query = con->parse.data;
 
+			query->is_error = com_query->query_status == MYSQLD_PACKET_ERR;
+		}
+	}
+	query->command = con->parse.command;
 
-int network_mysqld_proxy_connection_init(network_mysqld_con *con) {
-	con->plugins.con_init                      = proxy_init;
-	con->plugins.con_connect_server            = proxy_connect_server;
-	con->plugins.con_read_handshake            = proxy_read_handshake;
-	con->plugins.con_read_auth                 = proxy_read_auth;
-	con->plugins.con_read_auth_result          = proxy_read_auth_result;
-	con->plugins.con_read_auth_old_password	   = proxy_read_auth_old_password;
-	con->plugins.con_read_query                = proxy_read_query;
-	con->plugins.con_read_query_result         = proxy_read_query_result;
-	con->plugins.con_send_query_result         = proxy_send_query_result;
-	con->plugins.con_read_local_infile_data = proxy_read_local_infile_data;
-	con->plugins.con_read_local_infile_result = proxy_read_local_infile_result;
-	con->plugins.con_send_local_infile_result = proxy_send_local_infile_result;
-	con->plugins.con_cleanup                   = proxy_disconnect_client;
-	con->plugins.con_timeout                   = proxy_timeout;
+	if (con->client->response) query->user = g_strndup(S(con->client->response->username));
+	if (con->client->default_db->len > 0) query->db = g_strndup(S(con->client->default_db));
+	if (con->server) query->backend = g_strndup(S(con->server->dst->name));
 
-	return 0;
+	network_trace_push(con->config->trace, query);
 }
 
 /**
- * free the global scope which is shared between all connections
+ * check if the client creates session state we can't move to another connection
  *
- * make sure that is called after all connections are closed
+ * once pinned the client keeps its backend connection until it disconnects
  */
-void network_mysqld_proxy_free(network_mysqld_con G_GNUC_UNUSED *con) {
+static void proxy_multiplex_track(network_mysqld_con *con) {
+	network_mysqld_con_lua_t *st = con->plugin_con_state;
+	GString *packet = g_queue_peek_head(con->client->recv_queue->chunks);
+
+	if (st->multiplex_is_pinned ||
+	    NULL == packet ||
+	    packet->len <= NET_HEADER_SIZE) {
+		return;
+	}
+
+	switch ((guint8)packet->str[NET_HEADER_SIZE]) {
+	case COM_QUERY:
+		/* the session variables we track follow the client to the next backend connection */
+		if (!network_mysqld_proto_get_query_session_vars(packet->str + NET_HEADER_SIZE + 1, packet->len - NET_HEADER_SIZE - 1, NULL) &&
+		    proxy_query_has_session_state(packet)) {
+			st->multiplex_is_pinned = TRUE;
+		}
+		break;
+	case COM_INIT_DB: /* tracked in the default_db of the sockets, the pool matches on it */
+	case COM_PING:
+	case COM_QUIT:
+	case COM_FIELD_LIST:
+	case COM_STATISTICS:
+		break;
+	case COM_STMT_PREPARE:
+		/* the statement-ids are mapped in proxy_stmt_lookup(), only with --proxy-multiplex */
+		if (!con->config->multiplex) st->multiplex_is_pinned = TRUE;
+		break;
+	case COM_STMT_EXECUTE:
+	case COM_STMT_SEND_LONG_DATA:
+	case COM_STMT_CLOSE:
+	case COM_STMT_RESET:
+	case COM_STMT_FETCH:
+		break;
+	default:
+		/* COM_CHANGE_USER, COM_SET_OPTION, the replication commands, ... */
+		st->multiplex_is_pinned = TRUE;
+		break;
+	}
 }
 
-chassis_plugin_config * network_mysqld_proxy_plugin_new(void) {
-	chassis_plugin_config *config;
+/**
+ * give the backend connection back to the pool after a statement
+ *
+ * only sessions outside of transactions and with autocommit enabled are released.
+ * If the statement left an insert-id or warnings behind we keep the connection for
+ * one more statement, the client may ask for them.
+ */
+static void proxy_multiplex_release(network_mysqld_con *con) {
+	network_mysqld_con_lua_t *st = con->plugin_con_state;
+	network_socket *session_sock = proxy_get_session_server(con);
+
+	if (st->multiplex_is_pinned ||
+	    st->query_timeout_is_expired ||
+	    NULL == session_sock ||
+	    NULL == st->backend ||
+	    NULL == con->client->response) {
+		return;
+	}
 
-	config = g_new0(chassis_plugin_config, 1);
-	config->fix_bug_25371   = 0; /** double ERR packet on AUTH failures */
-	config->profiling       = 1;
-	config->start_proxy     = 1;
-	config->pool_change_user = 1; /* issue a COM_CHANGE_USER to cleanup the connection 
-					 when we get back the connection from the pool */
+	if ((session_sock->server_status & SERVER_STATUS_IN_TRANS) ||
+	    !(session_sock->server_status & SERVER_STATUS_AUTOCOMMIT)) {
+		return;
+	}
 
-	/* use negative values as defaults to make them ignored */
-	config->connect_timeout_dbl = -1.0;
-	config->read_timeout_dbl = -1.0;
-	config->write_timeout_dbl = -1.0;
+	if (con->parse.command == COM_QUERY || con->parse.command == COM_STMT_EXECUTE) {
+		network_mysqld_com_query_result_t *com_query = con->parse.data;
 
-	return config;
+		/* the rows of an open cursor can only be fetched from this connection */
+		if (NULL != com_query && (com_query->server_status & SERVER_STATUS_CURSOR_EXISTS)) {
+			st->multiplex_is_pinned = TRUE;
+			return;
+		}
+
+		if (NULL == com_query ||
+		    com_query->query_status != MYSQLD_PACKET_OK ||
+		    com_query->warning_count > 0 ||
+		    (!com_query->was_resultset && com_query->insert_id > 0)) {
+			return;
+		}
+	}
+
+	proxy_rw_split_unpark(con);
+	network_connection_pool_lua_add_connection(con);
+
+	st->multiplex_is_idle = TRUE;
 }
 
-void network_mysqld_proxy_plugin_free(chassis_plugin_config *config) {
-	gsize i;
+/**
+ * take a backend connection for the next statement of an idle client
+ *
+ * we need a pooled connection of the same user and session state, the least
+ * connected read-write backend is tried first
+ *
+ * @return FALSE if no backend has a matching connection in its pool
+ */
+static gboolean proxy_multiplex_acquire(network_mysqld_con *con) {
+	network_mysqld_con_lua_t *st = con->plugin_con_state;
+	chassis_private *g = con->srv->priv;
+	network_backend_t *backend = NULL;
+	network_socket *sock = NULL;
+	int first_ndx, ndx = -1;
+	guint i, count;
 
-	if (config->listen_con) {
-		/**
-		 * the connection will be free()ed by the network_mysqld_free()
-		 */
-#if 0
-		event_del(&(config->listen_con->server->event));
-		network_mysqld_con_free(config->listen_con);
-#endif
-	}
+	first_ndx = network_backends_get_least_connected(g->backends, BACKEND_TYPE_RW);
+	count = network_backends_count(g->backends);
 
-	if (config->backend_addresses) {
-		for (i = 0; config->backend_addresses[i]; i++) {
-			g_free(config->backend_addresses[i]);
+	for (i = 0; NULL == sock && i <= count; i++) {
+		ndx = (i == 0) ? first_ndx : (int)i - 1;
+
+		if (ndx < 0 || (i > 0 && ndx == first_ndx)) continue;
+
+		backend = network_backends_get(g->backends, ndx);
+		if (NULL == backend ||
+		    backend->type != BACKEND_TYPE_RW ||
+		    backend->state == BACKEND_STATE_DOWN) {
+			continue;
 		}
-		g_free(config->backend_addresses);
+
+		sock = network_connection_pool_get_session(network_backend_get_pool(backend, chassis_event_thread_get_local_index()),
+				con->client->response,
+				con->client->default_db,
+				TRUE);
 	}
 
-	if (config->address) {
-		/* free the global scope */
-		network_mysqld_proxy_free(NULL);
+	if (NULL == sock) return FALSE;
 
-		g_free(config->address);
+	con->server = sock;
+	st->backend = backend;
+	st->backend->connected_clients++;
+	st->backend_ndx = ndx;
+	st->multiplex_is_idle = FALSE;
+
+	return TRUE;
+}
+
+/**
+ * stop waiting for a pooled connection of the session
+ */
+static void proxy_multiplex_wait_cancel(network_mysqld_con *con) {
+	network_mysqld_con_lua_t *st = con->plugin_con_state;
+	guint i;
+
+	if (!st->multiplex_is_waiting) return;
+
+	for (i = 0; i < st->multiplex_waiters->len; i++) {
+		network_connection_pool_waiter_free(st->multiplex_waiters->pdata[i]);
 	}
+	g_ptr_array_free(st->multiplex_waiters, TRUE);
+	st->multiplex_waiters = NULL;
 
-	if (config->lua_script) g_free(config->lua_script);
+	evtimer_del(&(st->multiplex_timeout_ev));
+	event_del(&(st->multiplex_wakeup_ev));
 
-	g_free(config);
+	st->multiplex_is_waiting = FALSE;
+	st->multiplex_is_woken = FALSE;
+	st->multiplex_is_timed_out = FALSE;
+}
+
+static void proxy_multiplex_woken(int G_GNUC_UNUSED event_fd, short G_GNUC_UNUSED events, void *user_data) {
+	network_mysqld_con *con = user_data;
+	network_mysqld_con_lua_t *st = con->plugin_con_state;
+
+	st->multiplex_is_woken = TRUE;
+
+	network_mysqld_con_handle(-1, 0, con);
 }
 
 /**
- * plugin options 
+ * a connection of the user of the waiting client came back into a pool of this thread
+ *
+ * called from network_connection_pool_add() while another connection is handled, the
+ * client takes it in the next round of the event-loop
  */
-static GOptionEntry * network_mysqld_proxy_plugin_get_options(chassis_plugin_config *config) {
-	guint i;
+static void proxy_multiplex_wakeup(network_connection_pool_waiter G_GNUC_UNUSED *waiter, gpointer user_data) {
+	network_mysqld_con *con = user_data;
+	network_mysqld_con_lua_t *st = con->plugin_con_state;
+	struct timeval tv = { 0, 0 };
 
-	/* make sure it isn't collected */
-	static GOptionEntry config_entries[] = 
-	{
-		{ "proxy-address",            'P', 0, G_OPTION_ARG_STRING, NULL, "listening address:port of the proxy-server (default: :4040)", "<host:port>" },
-		{ "proxy-read-only-backend-addresses", 
-					      'r', 0, G_OPTION_ARG_STRING_ARRAY, NULL, "address:port of the remote slave-server (default: not set)", "<host:port>" },
-		{ "proxy-backend-addresses",  'b', 0, G_OPTION_ARG_STRING_ARRAY, NULL, "address:port of the remote backend-servers (default: 127.0.0.1:3306)", "<host:port>" },
-		
-		{ "proxy-skip-profiling",     0, G_OPTION_FLAG_REVERSE, G_OPTION_ARG_NONE, NULL, "disables profiling of queries (default: enabled)", NULL },
+	chassis_event_add_local_with_timeout(con->srv, &(st->multiplex_wakeup_ev), &tv);
+}
 
-		{ "proxy-fix-bug-25371",      0, 0, G_OPTION_ARG_NONE, NULL, "fix bug #25371 (mysqld > 5.1.12) for older libmysql versions", NULL },
-		{ "proxy-lua-script",         's', 0, G_OPTION_ARG_FILENAME, NULL, "filename of the lua script (default: not set)", "<file>" },
-		
-		{ "no-proxy",                 0, G_OPTION_FLAG_REVERSE, G_OPTION_ARG_NONE, NULL, "don't start the proxy-module (default: enabled)", NULL },
-		
-		{ "proxy-pool-no-change-user", 0, G_OPTION_FLAG_REVERSE, G_OPTION_ARG_NONE, NULL, "don't use CHANGE_USER to reset the connection coming from the pool (default: enabled)", NULL },
+static void proxy_multiplex_timeout(int G_GNUC_UNUSED event_fd, short G_GNUC_UNUSED events, void *user_data) {
+	network_mysqld_con *con = user_data;
+	network_mysqld_con_lua_t *st = con->plugin_con_state;
 
-		{ "proxy-connect-timeout",    0, 0, G_OPTION_ARG_DOUBLE, NULL, "connect timeout in seconds (default: 2.0 seconds)", NULL },
-		{ "proxy-read-timeout",    0, 0, G_OPTION_ARG_DOUBLE, NULL, "read timeout in seconds (default: 8 hours)", NULL },
-		{ "proxy-write-timeout",    0, 0, G_OPTION_ARG_DOUBLE, NULL, "write timeout in seconds (default: 8 hours)", NULL },
-		
-		{ NULL,                       0, 0, G_OPTION_ARG_NONE,   NULL, NULL, NULL }
-	};
+	st->multiplex_is_timed_out = TRUE;
 
-	i = 0;
-	config_entries[i++].arg_data = &(config->address);
-	config_entries[i++].arg_data = &(config->read_only_backend_addresses);
-	config_entries[i++].arg_data = &(config->backend_addresses);
+	network_mysqld_con_handle(-1, 0, con);
+}
 
-	config_entries[i++].arg_data = &(config->profiling);
+/**
+ * wait for a pooled connection of the session of an idle client
+ *
+ * another client of the same user may have taken it, it comes back into the pool of one
+ * of the read-write backends once that client is done with its statement. We wait in the
+ * pools of all of them until --proxy-multiplex-wait-timeout.
+ *
+ * @return FALSE if we can't wait
+ */
+static gboolean proxy_multiplex_wait(network_mysqld_con *con, network_mysqld_lua_stmt_ret ret) {
+	network_mysqld_con_lua_t *st = con->plugin_con_state;
+	chassis_plugin_config *config = con->config;
+	chassis_private *g = con->srv->priv;
+	chassis_event_thread_t *event_thread;
+	struct timeval tv;
+	guint i, count;
 
-	config_entries[i++].arg_data = &(config->fix_bug_25371);
-	config_entries[i++].arg_data = &(config->lua_script);
-	config_entries[i++].arg_data = &(config->start_proxy);
-	config_entries[i++].arg_data = &(config->pool_change_user);
-	config_entries[i++].arg_data = &(config->connect_timeout_dbl);
-	config_entries[i++].arg_data = &(config->read_timeout_dbl);
-	config_entries[i++].arg_data = &(config->write_timeout_dbl);
+	if (config->multiplex_wait_timeout <= 0) return FALSE;
 
-	return config_entries;
+	/* the pools and their waiters belong to the event-threads */
+	if (NULL == (event_thread = chassis_event_thread_get_local())) return FALSE;
+
+	st->multiplex_waiters = g_ptr_array_new();
+
+	count = network_backends_count(g->backends);
+	for (i = 0; i < count; i++) {
+		network_backend_t *backend = network_backends_get(g->backends, i);
+		network_connection_pool_waiter *waiter;
+
+		if (NULL == backend ||
+		    backend->type != BACKEND_TYPE_RW ||
+		    backend->state == BACKEND_STATE_DOWN) {
+			continue;
+		}
+
+		waiter = network_connection_pool_waiter_new(network_backend_get_pool(backend, chassis_event_thread_get_local_index()),
+				con->client->response->username,
+				proxy_multiplex_wakeup, con);
+		network_connection_pool_wait(waiter);
+
+		g_ptr_array_add(st->multiplex_waiters, waiter);
+	}
+
+	if (st->multiplex_waiters->len == 0) {
+		/* no backend left to wait for */
+		g_ptr_array_free(st->multiplex_waiters, TRUE);
+		st->multiplex_waiters = NULL;
+
+		return FALSE;
+	}
+
+	st->multiplex_is_waiting = TRUE;
+	st->multiplex_is_woken = FALSE;
+	st->multiplex_is_timed_out = FALSE;
+	st->multiplex_ret = ret;
+
+	evtimer_set(&(st->multiplex_wakeup_ev), proxy_multiplex_woken, con);
+	event_base_set(event_thread->event_base, &(st->multiplex_wakeup_ev));
+
+	tv.tv_sec = config->multiplex_wait_timeout / 1000;
+	tv.tv_usec = (config->multiplex_wait_timeout % 1000) * 1000;
+
+	evtimer_set(&(st->multiplex_timeout_ev), proxy_multiplex_timeout, con);
+	event_base_set(event_thread->event_base, &(st->multiplex_timeout_ev));
+	evtimer_add(&(st->multiplex_timeout_ev), &tv);
+
+	return TRUE;
 }
 
 /**
- * init the plugin with the parsed config
+ * the statements prepared on a backend connection
  */
-int network_mysqld_proxy_plugin_apply_config(chassis *chas, chassis_plugin_config *config) {
-	network_mysqld_con *con;
-	network_socket *listen_sock;
-	chassis_private *g = chas->priv;
-	guint i;
+static network_stmt_cache_t *proxy_stmt_get_cache(network_socket *sock) {
+	if (NULL == sock->prepared_stmts) {
+		sock->prepared_stmts = network_stmt_cache_new(NETWORK_STMT_CACHE_MAX_ENTRIES);
+	}
 
-	if (!config->start_proxy) {
-		return 0;
+	return sock->prepared_stmts;
+}
+
+/**
+ * remember the text of a statement the client prepared
+ *
+ * most clients never prepare a statement, the table is created with the first one
+ */
+static void proxy_stmt_texts_insert(network_mysqld_con_lua_t *st, guint32 stmt_id, GString *stmt_text) {
+	if (NULL == st->stmt_texts) {
+		st->stmt_texts = g_hash_table_new_full(g_direct_hash, g_direct_equal, NULL, g_hash_table_string_free);
 	}
 
-	if (!config->address) config->address = g_strdup(":4040");
-	if (!config->backend_addresses) {
-		config->backend_addresses = g_new0(char *, 2);
-		config->backend_addresses[0] = g_strdup("127.0.0.1:3306");
+	g_hash_table_insert(st->stmt_texts, GUINT_TO_POINTER(stmt_id), stmt_text);
+}
+
+/**
+ * share the fields of a COM_STMT_EXECUTE result-set with the next executes of the statement
+ *
+ * the server sends the column-defs with each execute, they are only parsed again if
+ * they changed, see network_stmt_cache_get_coldefs()
+ */
+static void proxy_stmt_coldefs_attach(network_mysqld_con *con, injection *inj) {
+	network_packet packet;
+	guint32 stmt_id;
+	GList *head = con->server->recv_queue->chunks->head;
+
+	if (NULL == head) return;
+
+	packet.data = inj->query;
+	packet.offset = 0;
+
+	if (0 != network_mysqld_proto_get_stmt_execute_packet_stmt_id(&packet, &stmt_id)) return;
+
+	inj->fields = network_stmt_cache_get_coldefs(proxy_stmt_get_cache(con->server), stmt_id, head);
+}
+
+/**
+ * forget the column-defs of a statement the client closes on the backend connection
+ */
+static void proxy_stmt_coldefs_forget(network_mysqld_con *con) {
+	GString *packet = g_queue_peek_head(con->client->recv_queue->chunks);
+	guint32 stmt_id;
+
+	if (NULL == con->server->prepared_stmts ||
+	    NULL == packet ||
+	    packet->len <= NET_HEADER_SIZE ||
+	    (guint8)packet->str[NET_HEADER_SIZE] != COM_STMT_CLOSE ||
+	    0 != network_stmt_cache_packet_get_stmt_id(packet, &stmt_id)) {
+		return;
 	}
 
-	/** 
-	 * create a connection handle for the listen socket 
-	 */
-	con = network_mysqld_con_new();
-	network_mysqld_add_connection(chas, con);
-	con->config = config;
+	network_stmt_cache_forget_coldefs(con->server->prepared_stmts, stmt_id);
+}
 
-	config->listen_con = con;
-	
-	listen_sock = network_socket_new();
-	con->server = listen_sock;
+/**
+ * close the least recently used statement of a full backend connection
+ *
+ * COM_STMT_CLOSE has no response, it is sent behind the COM_STMT_PREPARE that
+ * is already in the send-queue
+ */
+static void proxy_stmt_cache_make_room(network_socket *send_sock) {
+	network_stmt_cache_t *cache = proxy_stmt_get_cache(send_sock);
+	network_mysqld_stmt_close_packet_t *stmt_close_packet;
+	GString *packet;
 
-	/* set the plugin hooks as we want to apply them to the new connections too later */
-	network_mysqld_proxy_connection_init(con);
+	if (!network_stmt_cache_is_full(cache)) return;
 
-	if (0 != network_address_set_address(listen_sock->dst, config->address)) {
-		return -1;
+	stmt_close_packet = network_mysqld_stmt_close_packet_new();
+	stmt_close_packet->stmt_id = network_stmt_cache_evict(cache);
+
+	packet = g_string_new(NULL);
+	network_mysqld_proto_append_stmt_close_packet(packet, stmt_close_packet);
+
+	network_mysqld_queue_reset(send_sock);
+	network_mysqld_queue_append(send_sock, send_sock->send_queue, S(packet));
+
+	g_string_free(packet, TRUE);
+	network_mysqld_stmt_close_packet_free(stmt_close_packet);
+}
+
+/**
+ * give the COM_STMT_* command of the client the statement-id of the backend connection
+ *
+ * if the backend connection doesn't know the statement yet the command waits in
+ * st->stmt_pending until it is prepared
+ *
+ * @param key the network_stmt_cache_t key of the statement, takes the ownership
+ */
+static void proxy_stmt_bind(network_mysqld_con *con, GString *key) {
+	network_mysqld_con_lua_t *st = con->plugin_con_state;
+	network_socket *recv_sock = con->client;
+	GString *packet = g_queue_peek_head(recv_sock->recv_queue->chunks);
+	network_stmt_cache_entry_t *entry;
+
+	if (NULL != (entry = network_stmt_cache_get(proxy_stmt_get_cache(con->server), key))) {
+		network_stmt_cache_packet_set_stmt_id(packet, entry->stmt_id);
+		g_string_free(key, TRUE);
+
+		return;
 	}
 
-	if (0 != network_socket_bind(listen_sock)) {
-		return -1;
+	/* the statement was prepared on another backend connection or not at all */
+	st->stmt_prepare_key = key;
+	st->stmt_prepare_id = 0;
+	st->stmt_prepare_packets = g_ptr_array_new();
+
+	while ((packet = g_queue_pop_head(recv_sock->recv_queue->chunks))) {
+		g_queue_push_tail(st->stmt_pending, packet);
 	}
-	g_message("proxy listening on port %s", config->address);
+}
 
-	for (i = 0; config->backend_addresses && config->backend_addresses[i]; i++) {
-		if (-1 == network_backends_add(g->backends, config->backend_addresses[i],
-				BACKEND_TYPE_RW)) {
-			return -1;
-		}
+/**
+ * map the statement-ids of a multiplexed client to the ones of the backend connection
+ *
+ * - a COM_STMT_PREPARE of a statement the connection already knows is answered
+ *   from the cached response, otherwise we capture the response
+ * - COM_STMT_CLOSE only forgets the statement-id of the client, the statement
+ *   stays prepared for the next client
+ * - the other COM_STMT_* commands get the statement-id of the backend connection,
+ *   if it doesn't know the statement the command waits in st->stmt_pending until
+ *   it is prepared again
+ *
+ * statement-ids we didn't hand out are passed through as is
+ *
+ * @return PROXY_SEND_RESULT if the command is answered, PROXY_NO_DECISION otherwise
+ */
+static network_mysqld_lua_stmt_ret proxy_stmt_lookup(network_mysqld_con *con) {
+	network_mysqld_con_lua_t *st = con->plugin_con_state;
+	network_socket *recv_sock = con->client;
+	GString *packet = g_queue_peek_head(recv_sock->recv_queue->chunks);
+	network_stmt_cache_entry_t *entry;
+	GString *stmt_text;
+	GString *key;
+	guint32 stmt_id;
+	guint i;
+
+	if (NULL == packet ||
+	    NULL == con->server ||
+	    packet->len <= NET_HEADER_SIZE) {
+		return PROXY_NO_DECISION;
 	}
-	
-	for (i = 0; config->read_only_backend_addresses && config->read_only_backend_addresses[i]; i++) {
-		if (-1 == network_backends_add(g->backends,
-				config->read_only_backend_addresses[i], BACKEND_TYPE_RO)) {
-			return -1;
+
+	switch ((guint8)packet->str[NET_HEADER_SIZE]) {
+	case COM_STMT_PREPARE:
+		if (recv_sock->recv_queue->chunks->length != 1) return PROXY_NO_DECISION;
+
+		key = g_string_new(NULL);
+		network_stmt_cache_key_set(key, con->server->default_db, packet->str + NET_HEADER_SIZE + 1, packet->len - NET_HEADER_SIZE - 1);
+
+		stmt_id = ++st->stmt_next_id;
+
+		if (NULL == (entry = network_stmt_cache_get(proxy_stmt_get_cache(con->server), key))) {
+			st->stmt_prepare_key = key;
+			st->stmt_prepare_id = stmt_id;
+			st->stmt_prepare_packets = g_ptr_array_new();
+
+			return PROXY_NO_DECISION;
 		}
-	}
+		g_string_free(key, TRUE);
 
-	/* load the script and setup the global tables */
-	network_mysqld_lua_setup_global(chas->priv->sc->L, g);
+		for (i = 0; i < entry->packets->len; i++) {
+			GString *cached = g_string_new_len(S(((GString *)entry->packets->pdata[i])));
 
-	/**
-	 * call network_mysqld_con_accept() with this connection when we are done
-	 */
+			if (i == 0) network_stmt_cache_packet_set_stmt_id(cached, stmt_id);
 
-	event_set(&(listen_sock->event), listen_sock->fd, EV_READ|EV_PERSIST, network_mysqld_con_accept, con);
-	event_base_set(chas->event_base, &(listen_sock->event));
-	event_add(&(listen_sock->event), NULL);
+			network_mysqld_queue_append_raw(recv_sock, recv_sock->send_queue, cached);
+		}
+
+		proxy_stmt_texts_insert(st, stmt_id,
+				g_string_new_len(packet->str + NET_HEADER_SIZE + 1, packet->len - NET_HEADER_SIZE - 1));
+
+		return PROXY_SEND_RESULT;
+	case COM_STMT_CLOSE:
+		if (0 != network_stmt_cache_packet_get_stmt_id(packet, &stmt_id) ||
+		    NULL == st->stmt_texts ||
+		    !g_hash_table_remove(st->stmt_texts, GUINT_TO_POINTER(stmt_id))) {
+			return PROXY_NO_DECISION;
+		}
+
+		/* no response */
+		return PROXY_SEND_RESULT;
+	case COM_STMT_EXECUTE:
+	case COM_STMT_SEND_LONG_DATA:
+	case COM_STMT_RESET:
+	case COM_STMT_FETCH:
+		if (0 != network_stmt_cache_packet_get_stmt_id(packet, &stmt_id) ||
+		    NULL == st->stmt_texts ||
+		    NULL == (stmt_text = g_hash_table_lookup(st->stmt_texts, GUINT_TO_POINTER(stmt_id)))) {
+			return PROXY_NO_DECISION;
+		}
+
+		key = g_string_new(NULL);
+		network_stmt_cache_key_set(key, con->server->default_db, S(stmt_text));
+
+		proxy_stmt_bind(con, key);
+
+		return PROXY_NO_DECISION;
+	default:
+		return PROXY_NO_DECISION;
+	}
+}
+
+/**
+ * execute a hot SELECT of the client as prepared statement, see --proxy-stmt-promote-threshold
+ *
+ * the COM_QUERY is replaced by a COM_STMT_EXECUTE of its statement with the literals
+ * as params and kept in st->stmt_promote_query. A backend connection that doesn't know
+ * the statement prepares it first, like for a multiplexed client.
+ *
+ * read_query_result() turns the binary rows into text rows, see proxy_stmt_promoted()
+ */
+static void proxy_stmt_promote(network_mysqld_con *con) {
+	network_mysqld_con_lua_t *st = con->plugin_con_state;
+	chassis_plugin_config *config = con->config;
+	network_socket *recv_sock = con->client;
+	GString *packet = g_queue_peek_head(recv_sock->recv_queue->chunks);
+	network_mysqld_stmt_execute_packet_t *stmt_execute_packet;
+	GString *stmt_text;
+	GString *key;
+	GString *execute;
+	guint64 hash;
+	int err = 0;
+
+	if (recv_sock->recv_queue->chunks->length != 1 ||
+	    NULL == packet ||
+	    packet->len <= NET_HEADER_SIZE + 1 ||
+	    packet->str[NET_HEADER_SIZE] != COM_QUERY) {
+		return;
+	}
+
+	stmt_execute_packet = network_mysqld_stmt_execute_packet_new();
+	stmt_text = g_string_sized_new(packet->len);
+
+	/* without literals there is nothing to bind */
+	if (0 != network_stmt_promote_parameterize(stmt_text, &hash, stmt_execute_packet->params,
+				packet->str + NET_HEADER_SIZE + 1, packet->len - NET_HEADER_SIZE - 1) ||
+	    0 == stmt_execute_packet->params->len) {
+		g_string_free(stmt_text, TRUE);
+		network_mysqld_stmt_execute_packet_free(stmt_execute_packet);
+
+		return;
+	}
+
+	key = g_string_new(NULL);
+	network_stmt_cache_key_set(key, con->server->default_db, S(stmt_text));
+	g_string_free(stmt_text, TRUE);
+
+	/* the shapes the connection prepared already are executed without counting them */
+	if ((NULL == con->server->prepared_stmts || NULL == network_stmt_cache_get(con->server->prepared_stmts, key)) &&
+	    !network_stmt_promote_is_hot(config->stmt_promote, hash)) {
+		g_string_free(key, TRUE);
+		network_mysqld_stmt_execute_packet_free(stmt_execute_packet);
+
+		return;
+	}
+
+	stmt_execute_packet->stmt_id = 0; /* set by proxy_stmt_bind() */
+	stmt_execute_packet->iteration_count = 1;
+	stmt_execute_packet->new_params_bound = 1;
+
+	execute = g_string_new(NULL);
+	g_string_append_len(execute, C("\x00\x00\x00\x00"));
+	err = err || network_mysqld_proto_append_stmt_execute_packet(execute, stmt_execute_packet, stmt_execute_packet->params->len);
+	err = err || (execute->len - NET_HEADER_SIZE >= PACKET_LEN_MAX);
+	network_mysqld_stmt_execute_packet_free(stmt_execute_packet);
+
+	if (err) {
+		g_string_free(execute, TRUE);
+		g_string_free(key, TRUE);
+
+		return;
+	}
+	network_mysqld_proto_set_packet_len(execute, execute->len - NET_HEADER_SIZE);
+	network_mysqld_proto_set_packet_id(execute, 0);
+
+	st->stmt_promote_query = g_queue_pop_head(recv_sock->recv_queue->chunks);
+	st->stmt_promote_hash = hash;
+	g_queue_push_tail(recv_sock->recv_queue->chunks, execute);
+
+	proxy_stmt_bind(con, key);
+}
+
+/**
+ * send the COM_QUERY of the client as it was, its statement couldn't be prepared or executed
+ *
+ * the shape isn't promoted again
+ */
+static void proxy_stmt_promote_fallback(network_mysqld_con *con) {
+	network_mysqld_con_lua_t *st = con->plugin_con_state;
+	chassis_plugin_config *config = con->config;
+	network_socket *send_sock = con->server;
+	GString *packet;
+
+	network_stmt_promote_block(config->stmt_promote, st->stmt_promote_hash);
+	chassis_metric_inc(config->stmt_promote_fallbacks_total);
+
+	while ((packet = g_queue_pop_head(send_sock->recv_queue->chunks))) g_string_free(packet, TRUE);
+	while ((packet = g_queue_pop_head(st->stmt_pending))) g_string_free(packet, TRUE);
+	network_mysqld_queue_reset(send_sock);
+
+	network_mysqld_queue_append_raw(send_sock, send_sock->send_queue, st->stmt_promote_query);
+	st->stmt_promote_query = NULL; /* owned by the send-queue now */
+	st->stmt_promote_hash = 0;
+
+	network_mysqld_con_reset_command_response_state(con);
+	con->resultset_is_needed = FALSE;
+	con->resultset_is_forwarded_raw = (st->injected.queries->length == 0);
+
+	con->state = CON_STATE_SEND_QUERY;
+}
+
+/**
+ * hand the result of a promoted query to the client as the result of its COM_QUERY
+ *
+ * the field-defs, EOF, OK and ERR packets are the same in both protocols, the rows are
+ * rewritten by network_mysqld_proto_binary_result_to_text()
+ *
+ * @return FALSE if the COM_QUERY is sent instead
+ */
+static gboolean proxy_stmt_promoted(network_mysqld_con *con) {
+	network_mysqld_con_lua_t *st = con->plugin_con_state;
+	network_mysqld_com_query_result_t *com_query = con->parse.data;
+	network_socket *recv_sock = con->server;
+	network_socket *send_sock = con->client;
+	GString *packet;
+
+	/* the text query may see it differently, let it tell the error itself */
+	if (NULL == com_query ||
+	    com_query->query_status == MYSQLD_PACKET_ERR ||
+	    0 != network_mysqld_proto_binary_result_to_text(recv_sock->recv_queue->chunks->head)) {
+		proxy_stmt_promote_fallback(con);
+
+		return FALSE;
+	}
+
+	while ((packet = g_queue_pop_head(recv_sock->recv_queue->chunks))) {
+		network_mysqld_queue_append_raw(send_sock, send_sock->send_queue, packet);
+	}
+
+	network_mysqld_con_lua_stmt_promote_reset(st);
+	chassis_metric_inc(con->config->stmt_promoted_total);
+
+	return TRUE;
+}
+
+/**
+ * prepare the statement of the pending command on the backend connection
+ */
+static void proxy_stmt_reprepare(network_mysqld_con *con) {
+	network_mysqld_con_lua_t *st = con->plugin_con_state;
+	network_socket *send_sock = con->server;
+	network_mysqld_stmt_prepare_packet_t *stmt_prepare_packet;
+	GString *packet;
+	const char *stmt_text;
+
+	/* the statement is behind the default-db in the key */
+	stmt_text = memchr(st->stmt_prepare_key->str, '\0', st->stmt_prepare_key->len) + 1;
+
+	stmt_prepare_packet = network_mysqld_stmt_prepare_packet_new();
+	g_string_assign_len(stmt_prepare_packet->stmt_text, stmt_text, st->stmt_prepare_key->str + st->stmt_prepare_key->len - stmt_text);
+
+	packet = g_string_new(NULL);
+	network_mysqld_proto_append_stmt_prepare_packet(packet, stmt_prepare_packet);
+
+	network_mysqld_queue_reset(send_sock);
+	network_mysqld_queue_append(send_sock, send_sock->send_queue, S(packet));
+
+	g_string_free(packet, TRUE);
+	network_mysqld_stmt_prepare_packet_free(stmt_prepare_packet);
+}
+
+/**
+ * copy a packet of the COM_STMT_PREPARE response
+ *
+ * the client gets its own statement-id in the prepare-OK
+ */
+static void proxy_stmt_capture(network_mysqld_con *con, GString *packet) {
+	network_mysqld_con_lua_t *st = con->plugin_con_state;
+
+	g_ptr_array_add(st->stmt_prepare_packets, g_string_new_len(S(packet)));
+
+	if (st->stmt_prepare_packets->len == 1 &&
+	    st->stmt_prepare_id != 0 &&
+	    packet->len > NET_HEADER_SIZE &&
+	    packet->str[NET_HEADER_SIZE] == MYSQLD_PACKET_OK) {
+		network_stmt_cache_packet_set_stmt_id(packet, st->stmt_prepare_id);
+	}
+}
+
+/**
+ * remember the statement once the COM_STMT_PREPARE is finished
+ *
+ * if we prepared it for a pending command, the command is sent next with the
+ * new statement-id. If that failed the client gets the error instead.
+ *
+ * @return TRUE if the pending command took over, FALSE to send the result to the client
+ */
+static gboolean proxy_stmt_prepared(network_mysqld_con *con) {
+	network_mysqld_con_lua_t *st = con->plugin_con_state;
+	network_socket *recv_sock = con->server;
+	network_socket *send_sock = con->client;
+	network_stmt_cache_entry_t *entry = NULL;
+	GString *first = st->stmt_prepare_packets->len > 0 ? st->stmt_prepare_packets->pdata[0] : NULL;
+	gboolean is_ok;
+	GString *packet;
+	guint8 command;
+
+	is_ok = (NULL != first &&
+	         first->len > NET_HEADER_SIZE &&
+	         first->str[NET_HEADER_SIZE] == MYSQLD_PACKET_OK);
+
+	if (is_ok) {
+		entry = network_stmt_cache_add(proxy_stmt_get_cache(recv_sock), st->stmt_prepare_key, st->stmt_prepare_packets);
+		st->stmt_prepare_packets = NULL; /* owned by the cache now */
+	}
+
+	if (st->stmt_prepare_id != 0) {
+		if (is_ok) {
+			const char *stmt_text = memchr(st->stmt_prepare_key->str, '\0', st->stmt_prepare_key->len) + 1;
+
+			proxy_stmt_texts_insert(st, st->stmt_prepare_id,
+					g_string_new_len(stmt_text, st->stmt_prepare_key->str + st->stmt_prepare_key->len - stmt_text));
+		}
+		network_mysqld_con_lua_stmt_prepare_reset(st);
+
+		return FALSE;
+	}
+	network_mysqld_con_lua_stmt_prepare_reset(st);
+
+	network_mysqld_queue_reset(recv_sock); /* the server-side is finished */
+
+	if (NULL == entry && st->stmt_promote_query) {
+		/* the client didn't ask for a prepared statement, it gets the result of its query */
+		proxy_stmt_promote_fallback(con);
+
+		return TRUE;
+	}
+
+	packet = g_queue_peek_head(st->stmt_pending);
+	command = packet->str[NET_HEADER_SIZE];
+
+	if (NULL == entry) {
+		/* only send the error if the client waits for a response */
+		if (command == COM_STMT_SEND_LONG_DATA) {
+			while ((packet = g_queue_pop_head(recv_sock->recv_queue->chunks))) g_string_free(packet, TRUE);
+		} else if (is_ok) {
+			while ((packet = g_queue_pop_head(recv_sock->recv_queue->chunks))) g_string_free(packet, TRUE);
+
+			network_mysqld_con_send_error(send_sock, C("(proxy) preparing the statement on the backend failed"));
+		} else {
+			while ((packet = g_queue_pop_head(recv_sock->recv_queue->chunks))) {
+				network_mysqld_queue_append_raw(send_sock, send_sock->send_queue, packet);
+			}
+		}
+		while ((packet = g_queue_pop_head(st->stmt_pending))) g_string_free(packet, TRUE);
+
+		network_mysqld_queue_reset(send_sock);
+
+		con->state = CON_STATE_SEND_QUERY_RESULT;
+
+		return TRUE;
+	}
+
+	/* the prepare response was buffered, the client doesn't see it */
+	while ((packet = g_queue_pop_head(recv_sock->recv_queue->chunks))) g_string_free(packet, TRUE);
+
+	network_stmt_cache_packet_set_stmt_id(g_queue_peek_head(st->stmt_pending), entry->stmt_id);
+
+	while ((packet = g_queue_pop_head(st->stmt_pending))) {
+		network_mysqld_queue_append_raw(con->server, con->server->send_queue, packet);
+	}
+
+	network_mysqld_con_reset_command_response_state(con);
+	con->resultset_is_needed = (NULL != st->stmt_promote_query);
+	con->resultset_is_forwarded_raw = (st->injected.queries->length == 0 && NULL == st->stmt_promote_query);
+
+	con->state = CON_STATE_SEND_QUERY;
+
+	return TRUE;
+}
+
+/**
+ * the session variables of the client or a backend connection
+ */
+static void proxy_session_vars_forget(GHashTable **vars) {
+	if (NULL == *vars) return;
+
+	g_hash_table_destroy(*vars);
+	*vars = NULL;
+}
+
+/**
+ * apply a SET to the session variables, a DEFAULT removes the variable
+ */
+static void proxy_session_vars_merge(GHashTable **vars, GHashTable *changes) {
+	GHashTableIter iter;
+	gpointer name, value;
+
+	if (NULL == *vars) *vars = g_hash_table_new_full(g_str_hash, g_str_equal, g_free, g_free);
+
+	g_hash_table_iter_init(&iter, changes);
+	while (g_hash_table_iter_next(&iter, &name, &value)) {
+		if (0 == strcmp(value, "default")) {
+			g_hash_table_remove(*vars, name);
+		} else {
+			g_hash_table_insert(*vars, g_strdup(name), g_strdup(value));
+		}
+	}
+}
+
+static void proxy_session_vars_append(GString **query, const char *name, const char *value) {
+	if (NULL == *query) {
+		*query = g_string_new("SET ");
+	} else {
+		g_string_append(*query, ", ");
+	}
+
+	g_string_append_printf(*query, "@@session.%s = %s", name, value);
+}
+
+/**
+ * the SET that gives the backend connection the session variables of the client
+ *
+ * the variables only the backend connection has are reset to their DEFAULT. All of them
+ * go into one statement, it doesn't need CLIENT_MULTI_STATEMENTS.
+ *
+ * @return NULL if the variables match already
+ */
+static GString *proxy_session_vars_get_delta(GHashTable *client_vars, GHashTable *server_vars) {
+	GString *query = NULL;
+	GHashTableIter iter;
+	gpointer name, value;
+
+	if (client_vars) {
+		g_hash_table_iter_init(&iter, client_vars);
+		while (g_hash_table_iter_next(&iter, &name, &value)) {
+			const char *server_value = server_vars ? g_hash_table_lookup(server_vars, name) : NULL;
+
+			if (NULL == server_value || 0 != strcmp(server_value, value)) {
+				proxy_session_vars_append(&query, name, value);
+			}
+		}
+	}
+
+	if (server_vars) {
+		g_hash_table_iter_init(&iter, server_vars);
+		while (g_hash_table_iter_next(&iter, &name, &value)) {
+			if (NULL == client_vars || NULL == g_hash_table_lookup(client_vars, name)) {
+				proxy_session_vars_append(&query, name, "DEFAULT");
+			}
+		}
+	}
+
+	return query;
+}
+
+/**
+ * track the session variables the client sets on the backend connection
+ *
+ * a SET we can track waits in st->session_vars_pending for its result, a
+ * COM_CHANGE_USER starts a new session
+ */
+static void proxy_session_vars_track(network_mysqld_con *con) {
+	network_mysqld_con_lua_t *st = con->plugin_con_state;
+	network_socket *recv_sock = con->client;
+	GString *packet = g_queue_peek_head(recv_sock->recv_queue->chunks);
+	network_socket *session_sock;
+	GHashTable *vars;
+
+	proxy_session_vars_forget(&st->session_vars_pending);
+
+	if (NULL == packet || packet->len <= NET_HEADER_SIZE) return;
+
+	switch ((guint8)packet->str[NET_HEADER_SIZE]) {
+	case COM_QUERY:
+		if (recv_sock->recv_queue->chunks->length != 1) break;
+
+		vars = g_hash_table_new_full(g_str_hash, g_str_equal, g_free, g_free);
+		if (network_mysqld_proto_get_query_session_vars(packet->str + NET_HEADER_SIZE + 1, packet->len - NET_HEADER_SIZE - 1, vars)) {
+			st->session_vars_pending = vars;
+		} else {
+			g_hash_table_destroy(vars);
+		}
+		break;
+	case COM_CHANGE_USER:
+		proxy_session_vars_forget(&st->session_vars);
+
+		session_sock = proxy_get_session_server(con);
+		if (session_sock) {
+			proxy_session_vars_forget(&session_sock->session_vars);
+
+			/* ... and closes the prepared statements */
+			network_stmt_cache_free(session_sock->prepared_stmts);
+			session_sock->prepared_stmts = NULL;
+		}
+		break;
+	default:
+		break;
+	}
+}
+
+/**
+ * remember if the command of the client leaves state on the backend connection
+ *
+ * the pool only resets the sessions the clients left state on, see proxy_pool_get_reset().
+ * The statements of the statement-cache and the session variables are tracked on their own.
+ */
+static void proxy_session_dirty_track(network_mysqld_con *con) {
+	GString *packet = g_queue_peek_head(con->client->recv_queue->chunks);
+	network_socket *send_sock = con->server;
+
+	if (NULL == packet || packet->len <= NET_HEADER_SIZE) return;
+
+	switch ((guint8)packet->str[NET_HEADER_SIZE]) {
+	case COM_QUERY:
+	case COM_STMT_PREPARE:
+		if (proxy_query_has_session_state(packet)) send_sock->session_is_dirty = TRUE;
+		break;
+	case COM_INIT_DB: /* the pool matches on the default-db */
+	case COM_PING:
+	case COM_QUIT:
+	case COM_FIELD_LIST:
+	case COM_STATISTICS:
+	case COM_STMT_EXECUTE:
+	case COM_STMT_SEND_LONG_DATA:
+	case COM_STMT_CLOSE:
+	case COM_STMT_RESET:
+	case COM_STMT_FETCH:
+		break;
+	case COM_RESET_CONNECTION:
+		send_sock->session_is_dirty = FALSE;
+		break;
+	default:
+		/* COM_CHANGE_USER, COM_SET_OPTION, the replication commands, ... */
+		send_sock->session_is_dirty = TRUE;
+		break;
+	}
+}
+
+/**
+ * the backend answered the SET of the client, the session has the variables if it succeeded
+ */
+static void proxy_session_vars_track_result(network_mysqld_con *con) {
+	network_mysqld_con_lua_t *st = con->plugin_con_state;
+	network_mysqld_com_query_result_t *com_query = con->parse.data;
+
+	if (con->parse.command == COM_QUERY &&
+	    NULL != com_query &&
+	    com_query->query_status == MYSQLD_PACKET_OK &&
+	    NULL != con->server) {
+		proxy_session_vars_merge(&st->session_vars, st->session_vars_pending);
+		proxy_session_vars_merge(&con->server->session_vars, st->session_vars_pending);
+	}
+
+	proxy_session_vars_forget(&st->session_vars_pending);
+}
+
+/**
+ * send the SET of the session variables the backend connection misses
+ *
+ * the command of the client waits in st->session_sync_pending for its result, or in
+ * st->stmt_pending if its statement has to be prepared again as well
+ *
+ * @return FALSE if the backend connection has the session variables of the client
+ */
+static gboolean proxy_session_sync(network_mysqld_con *con) {
+	network_mysqld_con_lua_t *st = con->plugin_con_state;
+	network_socket *recv_sock = con->client;
+	network_socket *send_sock = con->server;
+	GString *query;
+	GString *packet;
+
+	if (NULL == st->session_vars && NULL == send_sock->session_vars) return FALSE;
+
+	if (NULL == (query = proxy_session_vars_get_delta(st->session_vars, send_sock->session_vars))) return FALSE;
+
+	while ((packet = g_queue_pop_head(recv_sock->recv_queue->chunks))) {
+		g_queue_push_tail(st->session_sync_pending, packet);
+	}
+	st->session_sync_is_pending = TRUE;
+
+	packet = g_string_sized_new(query->len + 1);
+	g_string_append_c(packet, COM_QUERY);
+	g_string_append_len(packet, S(query));
+
+	network_mysqld_queue_reset(send_sock);
+	network_mysqld_queue_append(send_sock, send_sock->send_queue, S(packet));
+
+	g_string_free(packet, TRUE);
+	g_string_free(query, TRUE);
+
+	return TRUE;
+}
+
+/**
+ * the backend answered the SET of proxy_session_sync(), send the waiting command
+ *
+ * if the SET failed the client gets an error instead, its command would see the
+ * wrong session
+ */
+static void proxy_session_synced(network_mysqld_con *con) {
+	network_mysqld_con_lua_t *st = con->plugin_con_state;
+	network_mysqld_com_query_result_t *com_query = con->parse.data;
+	network_socket *recv_sock = con->server;
+	network_socket *send_sock = con->client;
+	GQueue *pending = st->stmt_pending->length > 0 ? st->stmt_pending : st->session_sync_pending;
+	GString *packet;
+	guint8 command;
+
+	st->session_sync_is_pending = FALSE;
+
+	/* the result of the SET was buffered, the client doesn't see it */
+	while ((packet = g_queue_pop_head(recv_sock->recv_queue->chunks))) g_string_free(packet, TRUE);
+	network_mysqld_queue_reset(recv_sock);
+
+	if (NULL == com_query || com_query->query_status != MYSQLD_PACKET_OK) {
+		packet = g_queue_peek_head(pending);
+		command = packet->str[NET_HEADER_SIZE];
+
+		/* only send the error if the client waits for a response */
+		if (command != COM_STMT_SEND_LONG_DATA && command != COM_STMT_CLOSE) {
+			network_mysqld_con_send_error(send_sock, C("(proxy) setting the session variables on the backend failed"));
+		}
+
+		while ((packet = g_queue_pop_head(st->session_sync_pending))) g_string_free(packet, TRUE);
+		while ((packet = g_queue_pop_head(st->stmt_pending))) g_string_free(packet, TRUE);
+		network_mysqld_con_lua_stmt_prepare_reset(st);
+		network_mysqld_con_lua_stmt_promote_reset(st);
+		network_mysqld_con_lua_query_cache_reset(st);
+		proxy_session_vars_forget(&st->session_vars_pending);
+
+		network_mysqld_queue_reset(send_sock);
+
+		con->state = CON_STATE_SEND_QUERY_RESULT;
+
+		return;
+	}
+
+	proxy_session_vars_forget(&recv_sock->session_vars);
+	if (st->session_vars) proxy_session_vars_merge(&recv_sock->session_vars, st->session_vars);
+
+	network_mysqld_con_reset_command_response_state(con);
+
+	if (st->stmt_pending->length > 0) {
+		/* the command waits for its statement as well */
+		proxy_stmt_reprepare(con);
+		con->resultset_is_needed = TRUE;
+		con->resultset_is_forwarded_raw = FALSE;
+	} else {
+		while ((packet = g_queue_pop_head(st->session_sync_pending))) {
+			network_mysqld_queue_append_raw(recv_sock, recv_sock->send_queue, packet);
+		}
+		con->resultset_is_needed = (NULL != st->stmt_promote_query);
+		con->resultset_is_forwarded_raw = (NULL == st->query_cache_key && NULL == st->stmt_prepare_key && NULL == st->stmt_promote_query);
+	}
+
+	con->state = CON_STATE_SEND_QUERY;
+}
+
+/**
+ * the waiting query of the connection got admitted by another query leaving
+ *
+ * called in the thread of that query, let the thread of the connection go on
+ */
+static void proxy_admission_wakeup(network_admission_ticket_t G_GNUC_UNUSED *ticket, gpointer user_data) {
+	network_mysqld_con_lua_admission_wakeup_t *wakeup = user_data;
+	struct timeval tv = { 0, 0 };
+
+	chassis_event_add_to_thread(wakeup->event_thread, &(wakeup->ev), &tv);
+}
+
+static void proxy_admission_woken(int G_GNUC_UNUSED event_fd, short G_GNUC_UNUSED events, void *user_data) {
+	network_mysqld_con_lua_admission_wakeup_t *wakeup = user_data;
+	network_mysqld_con *con = wakeup->con;
+	network_mysqld_con_lua_t *st;
+
+	/* the connection was closed while we were on our way */
+	if (NULL == con) {
+		g_free(wakeup);
+		return;
+	}
+
+	st = con->plugin_con_state;
+	st->admission_is_woken = TRUE;
+
+	network_mysqld_con_handle(-1, 0, con);
+}
+
+static void proxy_admission_timeout(int G_GNUC_UNUSED event_fd, short G_GNUC_UNUSED events, void *user_data) {
+	network_mysqld_con *con = user_data;
+
+	network_mysqld_con_handle(-1, 0, con);
+}
+
+/**
+ * ask the admission control to send the query to the backend
+ *
+ * if it has to wait the queue-timeout is started
+ */
+static network_admission_ret_t proxy_admission_enter(network_mysqld_con *con, network_mysqld_lua_stmt_ret ret) {
+	network_mysqld_con_lua_t *st = con->plugin_con_state;
+	chassis_plugin_config *config = con->config;
+	network_admission_ret_t admission_ret;
+	chassis_event_thread_t *event_thread;
+	struct timeval tv;
+
+	/* we only wait in the event-threads */
+	if (NULL == (event_thread = chassis_event_thread_get_local())) return NETWORK_ADMISSION_ADMITTED;
+
+	if (NULL == st->admission_wakeup) {
+		st->admission_wakeup = g_new0(network_mysqld_con_lua_admission_wakeup_t, 1);
+		st->admission_wakeup->con = con;
+	}
+	st->admission_wakeup->event_thread = event_thread;
+
+	/* the wakeup may come from another thread before _enter() returns */
+	st->admission_ret = ret;
+	st->admission_is_woken = FALSE;
+	event_set(&(st->admission_wakeup->ev), -1, 0, proxy_admission_woken, st->admission_wakeup);
+	network_admission_ticket_set_wakeup(&(st->admission), proxy_admission_wakeup, st->admission_wakeup);
+
+	admission_ret = network_admission_enter_group(config->admission, &(st->admission),
+			st->backend ? st->backend->addr->name->str : NULL,
+			st->backend && st->backend->group ? st->backend->group->name : NULL,
+			con->client->response ? con->client->response->username->str : NULL);
+
+	if (admission_ret != NETWORK_ADMISSION_QUEUED) return admission_ret;
+
+	st->admission_is_waiting = TRUE;
+
+	tv.tv_sec = config->admission_queue_timeout / 1000;
+	tv.tv_usec = (config->admission_queue_timeout % 1000) * 1000;
+
+	evtimer_set(&(st->admission_timeout_ev), proxy_admission_timeout, con);
+	event_base_set(event_thread->event_base, &(st->admission_timeout_ev));
+	evtimer_add(&(st->admission_timeout_ev), &tv);
+
+	return admission_ret;
+}
+
+/**
+ * answer the query with a ERR packet instead of sending it to the backend
+ */
+static void proxy_admission_send_error(network_mysqld_con *con, const char *errmsg, gsize errmsg_len) {
+	network_mysqld_con_lua_t *st = con->plugin_con_state;
+
+	network_injection_queue_reset(st->injected.queries);
+	network_mysqld_con_lua_query_cache_reset(st);
+
+	network_mysqld_con_send_error(con->client, errmsg, errmsg_len);
+}
+
+static void proxy_query_timeout_killed(network_async_query_t *q, gpointer G_GNUC_UNUSED user_data) {
+	if (q->errmsg) {
+		g_message("%s: KILL QUERY failed: %s", G_STRLOC, q->errmsg);
+	}
+
+	network_async_query_free(q);
+}
+
+/**
+ * stop the query of the connection on the backend
+ *
+ * the KILL QUERY is sent on a idle connection of the same user from the pool, the client
+ * gets the ER_QUERY_INTERRUPTED of the backend as result. Without such a connection we
+ * close the backend connection, the client gets a error too.
+ */
+static void proxy_query_timeout_kill(network_mysqld_con *con) {
+	network_mysqld_con_lua_t *st = con->plugin_con_state;
+	network_connection_pool *pool;
+	network_socket *sock = NULL;
+	network_async_query_t *q;
+	GString *packet;
+
+	if (st->backend &&
+	    con->client->response &&
+	    con->server->challenge) {
+		pool = network_backend_get_pool(st->backend, chassis_event_thread_get_local_index());
+
+		sock = network_connection_pool_get(pool, con->client->response->username, NULL);
+		if (sock && !g_string_equal(sock->response->username, con->client->response->username)) {
+			/* the pool handed us the connection of another user to re-auth it */
+			network_connection_pool_lua_add_socket(con->srv, pool, sock);
+			sock = NULL;
+		}
+	}
+
+	if (NULL == sock) {
+		g_message("%s: no idle connection to KILL QUERY on %s, closing the connection to the backend",
+				G_STRLOC, con->server->dst->name->str);
+#ifdef _WIN32
+		shutdown(con->server->fd, SD_BOTH);
+#else
+		shutdown(con->server->fd, SHUT_RDWR);
+#endif
+		return;
+	}
+
+	packet = g_string_new(NULL);
+	g_string_append_c(packet, COM_QUERY);
+	g_string_append_printf(packet, "KILL QUERY %"G_GUINT32_FORMAT, con->server->challenge->thread_id);
+
+	q = network_async_query_new(0, S(packet));
+
+	g_string_free(packet, TRUE);
+
+	network_async_query_start(q, con->srv, pool, sock, NULL, &(con->read_timeout), proxy_query_timeout_killed, NULL);
+}
+
+static void proxy_query_timeout_expired(int G_GNUC_UNUSED event_fd, short G_GNUC_UNUSED events, void *user_data) {
+	network_mysqld_con *con = user_data;
+	network_mysqld_con_lua_t *st = con->plugin_con_state;
+	chassis_plugin_config *config = con->config;
+
+	st->query_timeout_is_armed = FALSE;
+
+	if (NULL == con->server) return;
+	if (con->state != CON_STATE_SEND_QUERY && con->resultset_is_finished) return;
+
+	st->query_timeout_is_expired = TRUE;
+	if (config->query_timeouts_total) chassis_metric_inc(config->query_timeouts_total);
+
+	proxy_query_timeout_kill(con);
+}
+
+/**
+ * start the budget of the query we are about to send to the backend
+ *
+ * the budget of the fingerprint from --proxy-query-timeout-file wins over --proxy-query-timeout,
+ * prepared statements only have the latter
+ */
+static void proxy_query_timeout_arm(network_mysqld_con *con) {
+	network_mysqld_con_lua_t *st = con->plugin_con_state;
+	chassis_plugin_config *config = con->config;
+	GString *packet = g_queue_peek_head(con->client->recv_queue->chunks);
+	chassis_event_thread_t *event_thread;
+	guint64 budget_ms = (guint64)(config->query_timeout * 1000.0 + 0.5);
+	struct timeval tv;
+
+	st->query_timeout_is_expired = FALSE;
+
+	if (NULL == packet || packet->len <= NET_HEADER_SIZE) return;
+
+	switch (packet->str[NET_HEADER_SIZE]) {
+	case COM_QUERY:
+		if (st->query_hints->timeout_ms > 0) {
+			/* the "timeout" hint of the query wins */
+			budget_ms = st->query_hints->timeout_ms;
+		} else if (config->query_timeouts) {
+			guint64 hash;
+
+			if (st->digest_is_pending) {
+				hash = st->digest_hash;
+			} else {
+				GString *fingerprint = g_string_sized_new(packet->len);
+
+				proxy_query_fingerprint(fingerprint, &hash, packet);
+				g_string_free(fingerprint, TRUE);
+			}
+
+			network_query_timeouts_get(config->query_timeouts, hash, &budget_ms);
+		}
+		break;
+	case COM_STMT_EXECUTE:
+		break;
+	default:
+		return;
+	}
+
+	if (0 == budget_ms) return;
+
+	/* we only time the queries in the event-threads */
+	if (NULL == (event_thread = chassis_event_thread_get_local())) return;
+
+	tv.tv_sec = budget_ms / 1000;
+	tv.tv_usec = (budget_ms % 1000) * 1000;
+
+	evtimer_set(&(st->query_timeout_ev), proxy_query_timeout_expired, con);
+	event_base_set(event_thread->event_base, &(st->query_timeout_ev));
+	evtimer_add(&(st->query_timeout_ev), &tv);
+
+	st->query_timeout_is_armed = TRUE;
+}
+
+static void proxy_query_timeout_disarm(network_mysqld_con_lua_t *st) {
+	if (!st->query_timeout_is_armed) return;
+
+	evtimer_del(&(st->query_timeout_ev));
+	st->query_timeout_is_armed = FALSE;
+}
+
+/**
+ * stop the second read, the first one answered or the client went away
+ */
+static void proxy_read_hedge_cancel(network_mysqld_con_lua_t *st) {
+	if (st->read_hedge_is_armed) {
+		evtimer_del(&(st->read_hedge_ev));
+		st->read_hedge_is_armed = FALSE;
+	}
+
+	if (st->read_hedge_query) {
+		/* closes its connection if it still runs */
+		network_async_query_free(st->read_hedge_query);
+		st->read_hedge_query = NULL;
+	}
+
+	st->read_hedge_is_streamed = FALSE;
+}
+
+/**
+ * pick the backend of the second read
+ *
+ * @return the index of the read-only backend with the lowest time to the first packet
+ *   besides the one of the first read, -1 if there is none
+ */
+static int proxy_read_hedge_get_backend(network_mysqld_con *con) {
+	network_mysqld_con_lua_t *st = con->plugin_con_state;
+	chassis_private *g = con->srv->priv;
+	GPtrArray *backends = network_backends_get_snapshot(g->backends);
+	gint min_latency = G_MAXINT;
+	int ndx = -1;
+	guint i;
+
+	for (i = 0; i < backends->len; i++) {
+		network_backend_t *cur = backends->pdata[i];
+
+		if (cur == st->backend ||
+		    cur->state != BACKEND_STATE_UP ||
+		    cur->breaker.state != NETWORK_BACKEND_BREAKER_CLOSED ||
+		    cur->type != BACKEND_TYPE_RO) continue;
+
+		if (cur->latency_first < min_latency) {
+			ndx = i;
+			min_latency = cur->latency_first;
+		}
+	}
+
+	return ndx;
+}
+
+/**
+ * the second read answered first, its result goes to the client
+ *
+ * the connection of the first read is closed, the backend aborts the read when it notices.
+ * The client is back on its read-write connection.
+ */
+static void proxy_read_hedge_win(network_mysqld_con *con) {
+	network_mysqld_con_lua_t *st = con->plugin_con_state;
+	chassis_plugin_config *config = con->config;
+
+	if (config->read_hedges_total) chassis_metric_add_label(config->read_hedges_total, 1, 1);
+
+	st->read_hedge_is_won = TRUE;
+
+	con->ts_read_query_result_first = chassis_get_rel_microseconds();
+	network_read_hedge_record(config->read_hedge, chassis_event_thread_get_local_index(), st->read_hedge_hash,
+			con->ts_read_query_result_first - con->ts_send_query);
+	st->read_hedge_is_pending = FALSE;
+
+	/* removes the event the state-machine waits for */
+	st->backend->connected_clients--;
+	network_socket_free(con->server);
+
+	con->server = st->rw_split_server;
+	st->backend = st->rw_split_backend;
+	st->backend_ndx = st->rw_split_backend_ndx;
+	st->rw_split_server = NULL;
+	st->rw_split_backend = NULL;
+	st->rw_split_backend_ndx = -1;
+
+	/* proxy_read_hedge_resume() forwards the result */
+	con->state = CON_STATE_WAIT_ASYNC;
+	network_mysqld_con_handle(-1, 0, con);
+}
+
+/**
+ * the first read didn't answer yet when the second one has a part of its result
+ */
+static gboolean proxy_read_hedge_is_first(network_mysqld_con *con) {
+	return con->state == CON_STATE_READ_QUERY_RESULT && con->ts_read_query_result_first == 0;
+}
+
+static void proxy_read_hedge_progress(network_async_query_t G_GNUC_UNUSED *q, gpointer user_data) {
+	network_mysqld_con *con = user_data;
+	network_mysqld_con_lua_t *st = con->plugin_con_state;
+
+	if (st->read_hedge_is_won) {
+		if (con->state == CON_STATE_WAIT_ASYNC) network_mysqld_con_handle(-1, 0, con);
+	} else if (proxy_read_hedge_is_first(con)) {
+		proxy_read_hedge_win(con);
+	} else {
+		proxy_read_hedge_cancel(st);
+	}
+}
+
+static void proxy_read_hedge_done(network_async_query_t *q, gpointer user_data) {
+	network_mysqld_con *con = user_data;
+	network_mysqld_con_lua_t *st = con->plugin_con_state;
+
+	if (st->read_hedge_is_won) {
+		if (con->state == CON_STATE_WAIT_ASYNC) network_mysqld_con_handle(-1, 0, con);
+	} else if (NULL == q->errmsg && proxy_read_hedge_is_first(con)) {
+		proxy_read_hedge_win(con);
+	} else {
+		/* the first read wins, even if the second failed */
+		proxy_read_hedge_cancel(st);
+	}
+}
+
+/**
+ * the read didn't get its first packet in time, send it to another read-only backend too
+ */
+static void proxy_read_hedge_start(int G_GNUC_UNUSED event_fd, short G_GNUC_UNUSED events, void *user_data) {
+	network_mysqld_con *con = user_data;
+	network_mysqld_con_lua_t *st = con->plugin_con_state;
+	chassis_plugin_config *config = con->config;
+	chassis_private *g = con->srv->priv;
+	GString empty_username = { "", 0, 0 };
+	network_connection_pool *pool;
+	network_async_query_t *q;
+	network_socket *sock;
+	int ndx;
+
+	st->read_hedge_is_armed = FALSE;
+
+	if (!proxy_read_hedge_is_first(con)) return;
+
+	if ((ndx = proxy_read_hedge_get_backend(con)) < 0) return;
+
+	if (!network_read_hedge_spend(config->read_hedge, chassis_event_thread_get_local_index())) {
+		if (config->read_hedges_total) chassis_metric_add_label(config->read_hedges_total, 2, 1);
+		return;
+	}
+
+	pool = network_backend_get_pool(network_backends_get(g->backends, ndx), chassis_event_thread_get_local_index());
+	sock = network_connection_pool_get_full(pool,
+			con->client->response ? con->client->response->username : &empty_username,
+			con->client->default_db,
+			con->client->response ? con->client->response->charset : 0,
+			TRUE,
+			network_mysqld_socket_is_deprecate_eof(con->client));
+	if (NULL == sock) return;
+
+	if (config->read_hedges_total) chassis_metric_add_label(config->read_hedges_total, 0, 1);
+
+	/* done() may be called before network_async_query_start() returns */
+	q = network_async_query_new(0, S(st->read_hedge_packet));
+	network_async_query_set_progress(q, proxy_read_hedge_progress, con);
+	st->read_hedge_query = q;
+
+	network_async_query_start(q, con->srv, pool, sock, con->client->default_db,
+			&(con->read_timeout), proxy_read_hedge_done, con);
+}
+
+/**
+ * start the timer of a SELECT that goes to a read-only backend
+ *
+ * - the delay is the percentile of the time to the first packet of its fingerprint, a
+ *   fingerprint is only hedged once it has NETWORK_READ_HEDGE_MIN_SAMPLES
+ * - the second read runs on a pooled connection without the session variables of the
+ *   client, clients that set some aren't hedged
+ * - with --proxy-rw-split-read-your-writes only the picked backend is known to have the
+ *   write of the client, the read isn't hedged until the others caught up
+ */
+static void proxy_read_hedge_arm(network_mysqld_con *con) {
+	network_mysqld_con_lua_t *st = con->plugin_con_state;
+	chassis_plugin_config *config = con->config;
+	GString *packet = g_queue_peek_head(con->client->recv_queue->chunks);
+	chassis_event_thread_t *event_thread;
+	guint64 delay_usec;
+	struct timeval tv;
+
+	if (NULL == st->rw_split_server ||
+	    st->rw_split_min_binlog_pos != 0 ||
+	    (st->session_vars && g_hash_table_size(st->session_vars) > 0) ||
+	    NULL == packet ||
+	    packet->len <= NET_HEADER_SIZE + 1 ||
+	    packet->str[NET_HEADER_SIZE] != COM_QUERY) {
+		return;
+	}
+
+	/* we only time the reads in the event-threads */
+	if (NULL == (event_thread = chassis_event_thread_get_local())) return;
+
+	if (st->digest_is_pending) {
+		st->read_hedge_hash = st->digest_hash;
+	} else {
+		GString *fingerprint = g_string_sized_new(packet->len);
+
+		proxy_query_fingerprint(fingerprint, &(st->read_hedge_hash), packet);
+		g_string_free(fingerprint, TRUE);
+	}
+	st->read_hedge_is_pending = TRUE;
+
+	delay_usec = network_read_hedge_get_delay(config->read_hedge, chassis_event_thread_get_local_index(), st->read_hedge_hash);
+	if (0 == delay_usec) return;
+
+	if (NULL == st->read_hedge_packet) st->read_hedge_packet = g_string_sized_new(packet->len);
+	g_string_truncate(st->read_hedge_packet, 0);
+	g_string_append_len(st->read_hedge_packet, packet->str + NET_HEADER_SIZE, packet->len - NET_HEADER_SIZE);
+
+	tv.tv_sec = delay_usec / G_USEC_PER_SEC;
+	tv.tv_usec = delay_usec % G_USEC_PER_SEC;
+
+	evtimer_set(&(st->read_hedge_ev), proxy_read_hedge_start, con);
+	event_base_set(event_thread->event_base, &(st->read_hedge_ev));
+	evtimer_add(&(st->read_hedge_ev), &tv);
+
+	st->read_hedge_is_armed = TRUE;
+}
+
+/**
+ * the result of the read is sent, learn from the time to its first packet
+ */
+static void proxy_read_hedge_finish(network_mysqld_con *con) {
+	network_mysqld_con_lua_t *st = con->plugin_con_state;
+
+	proxy_read_hedge_cancel(st);
+
+	if (st->read_hedge_is_pending &&
+	    con->ts_send_query != 0 &&
+	    con->ts_read_query_result_first >= con->ts_send_query) {
+		network_read_hedge_record(con->config->read_hedge, chassis_event_thread_get_local_index(), st->read_hedge_hash,
+				con->ts_read_query_result_first - con->ts_send_query);
+	}
+
+	st->read_hedge_is_pending = FALSE;
+	st->read_hedge_is_won = FALSE;
+}
+
+/**
+ * send the result of the second read to the client
+ *
+ * the packets are written as they come like proxy_shard_scatter_resume() does. If the
+ * second read fails after a part of its result was sent, the client can't get a ERR
+ * anymore and is closed.
+ */
+static network_socket_retval_t proxy_read_hedge_resume(network_mysqld_con *con) {
+	network_mysqld_con_lua_t *st = con->plugin_con_state;
+	network_async_query_t *q = st->read_hedge_query;
+	gboolean is_done = network_async_query_is_done(q);
+	GString *packet;
+
+	if (is_done && q->errmsg && st->read_hedge_is_streamed) {
+		proxy_read_hedge_cancel(st);
+		con->state = CON_STATE_ERROR;
+
+		return NETWORK_SOCKET_SUCCESS;
+	}
+
+	while ((packet = g_queue_pop_head(q->result))) {
+		network_packet p;
+
+		p.data = packet;
+		p.offset = 0;
+		network_mysqld_proto_get_query_result(&p, con);
+
+		network_mysqld_queue_append_raw(con->client, con->client->send_queue, packet);
+		st->read_hedge_is_streamed = TRUE;
+	}
+
+	if (!is_done) {
+		/* what doesn't fit into the socket now goes out with the next packets */
+		if (con->client->send_queue->chunks->length > 0 &&
+		    NETWORK_SOCKET_ERROR == network_socket_write(con->client, -1)) {
+			proxy_read_hedge_cancel(st);
+			con->state = CON_STATE_ERROR;
+
+			return NETWORK_SOCKET_SUCCESS;
+		}
+
+		return NETWORK_SOCKET_WAIT_FOR_EVENT;
+	}
+
+	proxy_read_hedge_cancel(st);
+
+	con->ts_read_query_result_last = chassis_get_rel_microseconds();
+	con->state = CON_STATE_SEND_QUERY_RESULT;
+	con->resultset_is_finished = TRUE;
+
+	return NETWORK_SOCKET_SUCCESS;
+}
+
+/**
+ * send the query, the injected queries or the result of read_query()
+ *
+ * the query passed the admission control already
+ */
+static network_socket_retval_t proxy_read_query_admitted(network_mysqld_con *con, network_mysqld_lua_stmt_ret ret) {
+	GString *packet;
+	network_socket *recv_sock, *send_sock;
+	network_mysqld_con_lua_t *st = con->plugin_con_state;
+	chassis_plugin_config *config = con->config;
+	chassis_private *g = con->srv->priv;
+	int proxy_query = 1;
+
+	send_sock = NULL;
+	recv_sock = con->client;
+
+	if (ret == PROXY_NO_DECISION && con->config->multiplex && st->injected.queries->length == 0) {
+		ret = proxy_stmt_lookup(con);
+	}
+
+	/**
+	 * if we disconnected in read_query_result() we have no connection open
+	 * when we try to execute the next query 
+	 *
+	 * for PROXY_SEND_RESULT we don't need a server
+	 */
+	if (ret != PROXY_SEND_RESULT &&
+	    con->server == NULL) {
+		g_critical("%s.%d: I have no server backend, closing connection", __FILE__, __LINE__);
+		return NETWORK_SOCKET_ERROR;
+	}
+	
+	switch (ret) {
+	case PROXY_NO_DECISION:
+	case PROXY_SEND_QUERY:
+		send_sock = con->server;
+
+		if (g->query_cache->max_bytes > 0) {
+			proxy_query_cache_track_writes(con);
+			proxy_query_cache_track_charset(con);
+		}
+
+		proxy_session_vars_track(con);
+
+		proxy_session_dirty_track(con);
+
+		proxy_stmt_coldefs_forget(con);
+
+		if (config->mirror && st->injected.queries->length == 0) proxy_mirror_push(con);
+
+		if (config->query_timeout > 0 || config->query_timeouts || st->query_hints->timeout_ms > 0) proxy_query_timeout_arm(con);
+
+		if (config->read_hedge && st->injected.queries->length == 0) proxy_read_hedge_arm(con);
+
+		if (config->stmt_promote &&
+		    st->injected.queries->length == 0 &&
+		    NULL == st->query_cache_key &&
+		    NULL == st->mirror_query &&
+		    NULL == st->stmt_prepare_key &&
+		    st->stmt_pending->length == 0 &&
+		    !st->read_hedge_is_pending) {
+			proxy_stmt_promote(con);
+		}
+
+		if (st->injected.queries->length == 0 && proxy_session_sync(con)) {
+			/* the command waits until the backend connection has the session variables of the client */
+			con->resultset_is_needed = TRUE;
+		} else {
+			/* no injection, pass on the chunks as is */
+			while ((packet = g_queue_pop_head(recv_sock->recv_queue->chunks))) {
+				network_mysqld_queue_append_raw(send_sock, send_sock->send_queue, packet);
+			}
+			con->resultset_is_needed = (NULL != st->stmt_promote_query); /* we don't want to buffer the result-set, unless we rewrite it */
+
+			if (st->stmt_pending->length > 0) {
+				/* the command waits until its statement is prepared on this connection */
+				proxy_stmt_reprepare(con);
+				con->resultset_is_needed = TRUE;
+			}
+		}
+		if (st->stmt_prepare_key) proxy_stmt_cache_make_room(send_sock);
+
+		/* without injected queries read_query_result() isn't called, let the core forward the raw chunks
+		 * unless we capture the result for the query-cache, the statement-cache or the mirror */
+		con->resultset_is_forwarded_raw = (st->injected.queries->length == 0 &&
+				NULL == st->query_cache_key &&
+				NULL == st->stmt_prepare_key &&
+				NULL == st->stmt_promote_query &&
+				NULL == st->mirror_query &&
+				!st->session_sync_is_pending);
+
+		break;
+	case PROXY_SEND_RESULT: {
+		gboolean is_first_packet = TRUE;
+		proxy_query = 0;
+
+		send_sock = con->client;
+
+		/* flush the recv-queue and track the command-states */
+		while ((packet = g_queue_pop_head(recv_sock->recv_queue->chunks))) {
+			if (is_first_packet) {
+				network_packet p;
+
+				p.data = packet;
+				p.offset = 0;
+
+				network_mysqld_con_reset_command_response_state(con);
+
+				if (0 != network_mysqld_con_command_states_init(con, &p)) {
+					g_debug("%s: ", G_STRLOC);
+				}
+
+				is_first_packet = FALSE;
+			}
+
+			g_string_free(packet, TRUE);
+		}
+
+		break; }
+	case PROXY_SEND_INJECTION: {
+		injection *inj;
+
+		inj = g_queue_peek_head(st->injected.queries);
+		con->resultset_is_needed = inj->resultset_is_needed; /* let the lua-layer decide if we want to buffer the result or not */
+		con->resultset_is_forwarded_raw = FALSE; /* we need the stats of the injected query */
+
+		send_sock = con->server;
+
+		/* we don't look into the queries of the script */
+		send_sock->session_is_dirty = TRUE;
+
+		proxy_injection_send(con);
+
+		while ((packet = g_queue_pop_head(recv_sock->recv_queue->chunks))) g_string_free(packet, TRUE);
+
+		break; }
+	default:
+		g_error("%s.%d: ", __FILE__, __LINE__);
+	}
+
+	if (proxy_query) {
+		if (st->trace_is_pending) proxy_trace_admitted(con);
+
+		con->state = CON_STATE_SEND_QUERY;
+	} else {
+		GList *cur;
+
+		/* if we don't send the query to the backend, it won't be tracked. So track it here instead 
+		 * to get the packet tracking right (LOAD DATA LOCAL INFILE, ...) */
+
+		for (cur = send_sock->send_queue->chunks->head; cur; cur = cur->next) {
+			GString *chunk = cur->data;
+			gsize offset;
+
+			/* the result-set writer packs several packets into one chunk */
+			for (offset = 0; offset + NET_HEADER_SIZE <= chunk->len; ) {
+				GString packet_s;
+				network_packet p;
+				int r;
+
+				packet_s.str = chunk->str + offset;
+				packet_s.len = NET_HEADER_SIZE + network_mysqld_proto_get_packet_len(&packet_s);
+				packet_s.allocated_len = 0;
+
+				if (offset + packet_s.len > chunk->len) break;
+
+				p.data = &packet_s;
+				p.offset = 0;
+
+				r = network_mysqld_proto_get_query_result(&p, con);
+
+				offset += packet_s.len;
+			}
+		}
+
+		con->state = CON_STATE_SEND_QUERY_RESULT;
+		con->resultset_is_finished = TRUE; /* we don't have more too send */
+	}
+	NETWORK_MYSQLD_CON_TRACK_TIME(con, "proxy::ready_query::done");
+
+	return NETWORK_SOCKET_SUCCESS;
+}
+
+/**
+ * the pooled connections of the session were closed or didn't come back in time, like a backend that went away
+ */
+static void proxy_multiplex_send_lost(network_mysqld_con *con) {
+	network_mysqld_con_lua_t *st = con->plugin_con_state;
+
+	g_message("%s: no pooled connection for the session of the client left, closing the connection", G_STRLOC);
+
+	network_mysqld_con_send_error(con->client, C("(proxy) lost the backend connection of the session"));
+	st->connection_close = TRUE;
+}
+
+/**
+ * route the query of a client with a backend and let it pass the admission control
+ *
+ * a query over the limits of its backend or user waits in CON_STATE_WAIT_ASYNC
+ */
+static network_socket_retval_t proxy_read_query_attached(network_mysqld_con *con, network_mysqld_lua_stmt_ret ret) {
+	network_mysqld_con_lua_t *st = con->plugin_con_state;
+
+	if (ret != PROXY_SEND_RESULT && NULL == con->server && st->multiplex_is_idle &&
+	    !proxy_multiplex_acquire(con)) {
+		if (proxy_multiplex_wait(con, ret)) {
+			/* proxy_wait_async() goes on once a connection of the user is back in the pool or the wait-timeout is reached */
+			con->state = CON_STATE_WAIT_ASYNC;
+
+			return NETWORK_SOCKET_SUCCESS;
+		}
+
+		proxy_multiplex_send_lost(con);
+		ret = PROXY_SEND_RESULT;
+	}
+
+	if (ret == PROXY_NO_DECISION && con->config->shard_router) {
+		ret = proxy_shard_route(con);
+
+		if (ret == PROXY_WAIT_ASYNC) {
+			/* proxy_wait_async() streams the merged results of the shards */
+			con->state = CON_STATE_WAIT_ASYNC;
+
+			return NETWORK_SOCKET_SUCCESS;
+		}
+	}
+
+	if (ret == PROXY_NO_DECISION && con->config->rw_split) {
+		proxy_rw_split_route(con);
+	}
+
+	if (ret != PROXY_SEND_RESULT && con->server != NULL &&
+	    network_admission_is_enabled(con->config->admission)) {
+		switch (proxy_admission_enter(con, ret)) {
+		case NETWORK_ADMISSION_ADMITTED:
+			break;
+		case NETWORK_ADMISSION_QUEUED:
+			/* proxy_wait_async() goes on once it is admitted or the queue-timeout is reached */
+			con->state = CON_STATE_WAIT_ASYNC;
+
+			return NETWORK_SOCKET_SUCCESS;
+		case NETWORK_ADMISSION_REJECTED:
+			proxy_admission_send_error(con, C("(proxy) too many queries are waiting for the backend"));
+			ret = PROXY_SEND_RESULT;
+			break;
+		}
+	}
+
+	return proxy_read_query_admitted(con, ret);
+}
+
+/**
+ * attach a backend to a client authed by --proxy-lazy-connect for its first query
+ *
+ * a pooled connection of the session is taken if there is one. Otherwise we connect to a
+ * backend and log in for the client, proxy_lazy_read_auth_result() goes on with the query.
+ * A COM_QUIT or COM_PING doesn't need a backend at all.
+ *
+ * @return TRUE if the query goes on, FALSE if the next state is set already
+ */
+static gboolean proxy_lazy_attach(network_mysqld_con *con, network_mysqld_lua_stmt_ret *ret) {
+	network_mysqld_con_lua_t *st = con->plugin_con_state;
+	GString *packet = g_queue_peek_head(con->client->recv_queue->chunks);
+
+	if (*ret == PROXY_NO_DECISION && packet && packet->len > NET_HEADER_SIZE) {
+		switch ((guint8)packet->str[NET_HEADER_SIZE]) {
+		case COM_QUIT:
+			con->state = CON_STATE_CLOSE_CLIENT;
+
+			return FALSE;
+		case COM_PING:
+			network_mysqld_con_send_ok(con->client);
+			*ret = PROXY_SEND_RESULT;
+
+			return TRUE;
+		default:
+			break;
+		}
+	}
+
+	st->lazy_is_pending = FALSE;
+
+	if (proxy_multiplex_acquire(con)) return TRUE;
+
+	st->lazy_ret = *ret;
+	st->lazy_is_connecting = TRUE;
+	con->state = CON_STATE_CONNECT_SERVER;
+
+	return FALSE;
+}
+
+/**
+ * route the query read_query() decided on
+ *
+ * @see proxy_read_query_attached()
+ */
+static network_socket_retval_t proxy_read_query_decided(network_mysqld_con *con, network_mysqld_lua_stmt_ret ret) {
+	network_mysqld_con_lua_t *st = con->plugin_con_state;
+	chassis_private *g = con->srv->priv;
+
+	if (ret == PROXY_NO_DECISION && g->query_cache->max_bytes > 0) {
+		ret = proxy_query_cache_lookup(con);
+	}
+
+	if (ret != PROXY_SEND_RESULT && NULL == con->server && st->lazy_is_pending &&
+	    !proxy_lazy_attach(con, &ret)) {
+		return NETWORK_SOCKET_SUCCESS;
+	}
+
+	return proxy_read_query_attached(con, ret);
+}
+
+/**
+ * the query waiting in the admission queue got admitted or reached the queue-timeout
+ *
+ * @see proxy_admission_enter()
+ */
+static network_socket_retval_t proxy_admission_resume(network_mysqld_con *con) {
+	network_mysqld_con_lua_t *st = con->plugin_con_state;
+	chassis_plugin_config *config = con->config;
+	network_mysqld_lua_stmt_ret ret;
+
+	if (st->admission_is_woken) {
+		evtimer_del(&(st->admission_timeout_ev));
+
+		ret = st->admission_ret;
+	} else if (network_admission_cancel(config->admission, &(st->admission))) {
+		proxy_admission_send_error(con, C("(proxy) the query waited too long for the backend"));
+
+		ret = PROXY_SEND_RESULT;
+	} else {
+		/* it got admitted while the timeout fired, the wakeup is on its way */
+		return NETWORK_SOCKET_WAIT_FOR_EVENT;
+	}
+
+	st->admission_is_waiting = FALSE;
+	st->admission_is_woken = FALSE;
+
+	if (config->admission_wait_duration) {
+		chassis_metric_observe(config->admission_wait_duration, chassis_get_rel_microseconds() - st->admission.queued_at);
+	}
+
+	return proxy_read_query_admitted(con, ret);
+}
+
+/**
+ * a connection of the user of the waiting client came back into the pool or the wait-timeout is reached
+ *
+ * the connection may not fit the session or another client took it first, then we wait again
+ *
+ * @see proxy_multiplex_wait()
+ */
+static network_socket_retval_t proxy_multiplex_resume(network_mysqld_con *con) {
+	network_mysqld_con_lua_t *st = con->plugin_con_state;
+	network_mysqld_lua_stmt_ret ret = st->multiplex_ret;
+	guint i;
+
+	if (!proxy_multiplex_acquire(con)) {
+		if (!st->multiplex_is_timed_out) {
+			for (i = 0; i < st->multiplex_waiters->len; i++) {
+				network_connection_pool_wait(st->multiplex_waiters->pdata[i]);
+			}
+			st->multiplex_is_woken = FALSE;
+
+			return NETWORK_SOCKET_WAIT_FOR_EVENT;
+		}
+
+		proxy_multiplex_send_lost(con);
+		ret = PROXY_SEND_RESULT;
+	}
+
+	proxy_multiplex_wait_cancel(con);
+
+	return proxy_read_query_attached(con, ret);
+}
+
+/**
+ * forget the charset of the last SET NAMES, the next one goes to the backend again
+ */
+static void proxy_local_names_forget(network_mysqld_con_lua_t *st) {
+	if (st->local_names) {
+		g_string_free(st->local_names, TRUE);
+		st->local_names = NULL;
+	}
+	if (st->local_names_pending) {
+		g_string_free(st->local_names_pending, TRUE);
+		st->local_names_pending = NULL;
+	}
+}
+
+/**
+ * the backend answered the SET NAMES of the client, remember its charset if it succeeded
+ */
+static void proxy_local_track_result(network_mysqld_con *con) {
+	network_mysqld_con_lua_t *st = con->plugin_con_state;
+	network_mysqld_com_query_result_t *com_query = con->parse.data;
+	GString *names = st->local_names_pending;
+
+	st->local_names_pending = NULL;
+	proxy_local_names_forget(st);
+
+	if (con->parse.command == COM_QUERY &&
+	    NULL != com_query &&
+	    com_query->query_status == MYSQLD_PACKET_OK) {
+		st->local_names = names;
+	} else {
+		g_string_free(names, TRUE);
+	}
+}
+
+/**
+ * send the result of SELECT @@version_comment LIMIT 1
+ */
+static void proxy_local_send_version_comment(network_mysqld_con *con) {
+	GPtrArray *fields;
+	GPtrArray *rows;
+	GPtrArray *row;
+	MYSQL_FIELD *field;
+
+	fields = network_mysqld_proto_fielddefs_new();
+
+	field = network_mysqld_proto_fielddef_new();
+	field->name = g_strdup("@@version_comment");
+	field->type = FIELD_TYPE_VAR_STRING;
+	g_ptr_array_add(fields, field);
+
+	rows = g_ptr_array_new();
+	row = g_ptr_array_new();
+	g_ptr_array_add(row, g_strdup("mysql-proxy " PLUGIN_VERSION));
+	g_ptr_array_add(rows, row);
+
+	network_mysqld_con_send_resultset(con->client, fields, rows);
+
+	network_mysqld_proto_fielddefs_free(fields);
+	g_free(row->pdata[0]);
+	g_ptr_array_free(row, TRUE);
+	g_ptr_array_free(rows, TRUE);
+}
+
+/**
+ * answer the trivial commands of the client without the backend for --proxy-local-answers
+ *
+ * a SET NAMES is only answered if the backend confirmed the same SET NAMES before, the
+ * client-side charset is tracked in .local_names from there. Anything that may change it
+ * forgets it.
+ *
+ * @return PROXY_SEND_RESULT if the answer is in the send-queue of the client,
+ *         PROXY_IGNORE_RESULT for a COM_QUIT,
+ *         PROXY_NO_DECISION if the backend has to answer
+ */
+static network_mysqld_lua_stmt_ret proxy_local_answer(network_mysqld_con *con) {
+	network_mysqld_con_lua_t *st = con->plugin_con_state;
+	network_socket *session_sock = proxy_get_session_server(con);
+	GString *packet = g_queue_peek_head(con->client->recv_queue->chunks);
+	network_mysqld_query_trivial_type_t trivial_type;
+	guint16 server_status;
+	GString *names;
+
+	if (st->injected.queries->length != 0 ||
+	    con->client->recv_queue->chunks->length != 1 ||
+	    packet->len <= NET_HEADER_SIZE) {
+		return PROXY_NO_DECISION;
+	}
+
+	if (session_sock) {
+		server_status = session_sock->server_status;
+	} else if (st->multiplex_is_idle) {
+		/* an idle multiplexed client is in autocommit mode outside of a transaction */
+		server_status = SERVER_STATUS_AUTOCOMMIT;
+	} else {
+		return PROXY_NO_DECISION;
+	}
+
+	switch ((guint8)packet->str[NET_HEADER_SIZE]) {
+	case COM_QUIT:
+		return PROXY_IGNORE_RESULT;
+	case COM_PING:
+		network_mysqld_con_send_ok_full(con->client, 0, 0, server_status, 0);
+
+		break;
+	case COM_QUERY:
+		names = g_string_new(NULL);
+		trivial_type = network_mysqld_proto_get_query_trivial_type(packet->str + NET_HEADER_SIZE + 1, packet->len - NET_HEADER_SIZE - 1, names);
+
+		switch (trivial_type) {
+		case NETWORK_MYSQLD_QUERY_TRIVIAL_VERSION_COMMENT:
+			proxy_local_send_version_comment(con);
+			break;
+		case NETWORK_MYSQLD_QUERY_TRIVIAL_SET_NAMES:
+			if (st->local_names && g_string_equal(st->local_names, names)) {
+				network_mysqld_con_send_ok_full(con->client, 0, 0, server_status, 0);
+				break;
+			}
+
+			/* confirmed by the OK of the backend in proxy_local_track_result() */
+			if (st->local_names_pending) g_string_free(st->local_names_pending, TRUE);
+			st->local_names_pending = names;
+			names = NULL;
+
+			trivial_type = NETWORK_MYSQLD_QUERY_TRIVIAL_NONE;
+			break;
+		case NETWORK_MYSQLD_QUERY_TRIVIAL_SET_AUTOCOMMIT_ON:
+			if (server_status & SERVER_STATUS_AUTOCOMMIT) {
+				network_mysqld_con_send_ok_full(con->client, 0, 0, server_status, 0);
+				break;
+			}
+
+			trivial_type = NETWORK_MYSQLD_QUERY_TRIVIAL_NONE;
+			break;
+		case NETWORK_MYSQLD_QUERY_TRIVIAL_NONE:
+			/* SET character_set_client = ..., SET CHARACTER SET ... */
+			if (proxy_query_has_session_state(packet)) {
+				proxy_local_names_forget(st);
+			}
+			break;
+		}
+
+		if (names) g_string_free(names, TRUE);
+
+		if (trivial_type == NETWORK_MYSQLD_QUERY_TRIVIAL_NONE) return PROXY_NO_DECISION;
+
+		break;
+	case COM_INIT_DB:
+	case COM_FIELD_LIST:
+	case COM_STATISTICS:
+	case COM_STMT_PREPARE:
+	case COM_STMT_EXECUTE:
+	case COM_STMT_SEND_LONG_DATA:
+	case COM_STMT_CLOSE:
+	case COM_STMT_RESET:
+	case COM_STMT_FETCH:
+		return PROXY_NO_DECISION;
+	default:
+		/* COM_CHANGE_USER, COM_RESET_CONNECTION, ... reset the charset */
+		proxy_local_names_forget(st);
+
+		return PROXY_NO_DECISION;
+	}
+
+	chassis_metric_inc(con->config->local_answers_total);
+
+	return PROXY_SEND_RESULT;
+}
+
+/**
+ * check the query of the client against the rules of --proxy-firewall-file
+ *
+ * prepared statements are checked when they are prepared
+ *
+ * @return PROXY_NO_DECISION if the query goes on, PROXY_SEND_RESULT if it got a error
+ */
+static network_mysqld_lua_stmt_ret proxy_firewall_check(network_mysqld_con *con) {
+	network_mysqld_con_lua_t *st = con->plugin_con_state;
+	chassis_private *g = con->srv->priv;
+	GString *packet = g_queue_peek_head(con->client->recv_queue->chunks);
+	GString *fingerprint = NULL;
+	network_firewall_action_t action;
+	guint64 hash;
+
+	if (NULL == packet || packet->len <= NET_HEADER_SIZE) return PROXY_NO_DECISION;
+
+	switch (packet->str[NET_HEADER_SIZE]) {
+	case COM_QUERY:
+		/* proxy_read_query() normalized it already */
+		action = network_firewall_check(g->firewall, st->digest_text->str, st->digest_text->len);
+		break;
+	case COM_STMT_PREPARE:
+		fingerprint = g_string_sized_new(packet->len);
+		proxy_query_fingerprint(fingerprint, &hash, packet);
+
+		action = network_firewall_check(g->firewall, fingerprint->str, fingerprint->len);
+		g_string_free(fingerprint, TRUE);
+		break;
+	default:
+		return PROXY_NO_DECISION;
+	}
+
+	if (action == NETWORK_FIREWALL_ALLOW) {
+		if (con->config->firewall_queries_total) chassis_metric_add_label(con->config->firewall_queries_total, 0, 1);
+
+		return PROXY_NO_DECISION;
+	}
+
+	if (con->config->firewall_queries_total) chassis_metric_add_label(con->config->firewall_queries_total, 1, 1);
+
+	proxy_admission_send_error(con, C("(proxy) the query is denied by the firewall"));
+
+	return PROXY_SEND_RESULT;
+}
+
+static void proxy_rate_limit_timeout(int G_GNUC_UNUSED event_fd, short G_GNUC_UNUSED events, void *user_data) {
+	network_mysqld_con *con = user_data;
+
+	network_mysqld_con_handle(-1, 0, con);
+}
+
+/**
+ * take a token of the rate-limiter for the COM_QUERY of the client
+ *
+ * a query over the limit waits for the next token if its rule allows it, proxy_wait_async()
+ * asks again once the timer fired. Otherwise it gets a ERR packet.
+ *
+ * @return PROXY_NO_DECISION if the query goes on, PROXY_WAIT_ASYNC if it waits, PROXY_SEND_RESULT if it got a error
+ */
+static network_mysqld_lua_stmt_ret proxy_rate_limit_acquire(network_mysqld_con *con) {
+	network_mysqld_con_lua_t *st = con->plugin_con_state;
+	chassis_private *g = con->srv->priv;
+	GString *packet = g_queue_peek_head(con->client->recv_queue->chunks);
+	const gchar *values[NETWORK_RATE_LIMIT_KEYS] = { NULL, NULL, NULL };
+	char client_addr[256];
+	gsize client_addr_len = sizeof(client_addr);
+	chassis_event_thread_t *event_thread = chassis_event_thread_get_local();
+	guint ndx = chassis_event_thread_get_local_index();
+	network_rate_limit_verdict_t verdict;
+	guint64 now = chassis_get_rel_microseconds();
+	struct timeval tv;
+
+	if (NULL == packet ||
+	    packet->len <= NET_HEADER_SIZE ||
+	    packet->str[NET_HEADER_SIZE] != COM_QUERY) {
+		return PROXY_NO_DECISION;
+	}
+
+	if (con->client->response && network_rate_limiter_uses_key(g->rate_limiter, NETWORK_RATE_LIMIT_USER)) {
+		values[NETWORK_RATE_LIMIT_USER] = con->client->response->username->str;
+	}
+
+	if (network_rate_limiter_uses_key(g->rate_limiter, NETWORK_RATE_LIMIT_CLIENT)) {
+		values[NETWORK_RATE_LIMIT_CLIENT] = network_address_tostring(con->client->src, client_addr, &client_addr_len, NULL);
+	}
+
+	/* proxy_read_query() normalized it already */
+	if (st->digest_is_pending) values[NETWORK_RATE_LIMIT_DIGEST] = st->digest_text->str;
+
+	if (network_rate_limiter_acquire(g->rate_limiter, ndx, values, now, &verdict)) {
+		if (st->rate_limit_is_waiting) {
+			st->rate_limit_is_waiting = FALSE;
+			network_rate_limiter_undelay(g->rate_limiter);
+		}
+
+		return PROXY_NO_DECISION;
+	}
+
+	if (st->rate_limit_is_waiting) {
+		/* another query got the token first, wait for the next one if there is time left */
+		if (now + verdict.wait_usec > st->rate_limit_deadline_usec) {
+			st->rate_limit_is_waiting = FALSE;
+			network_rate_limiter_undelay(g->rate_limiter);
+		}
+	} else if (event_thread && network_rate_limiter_delay(g->rate_limiter, ndx, &verdict)) {
+		st->rate_limit_is_waiting = TRUE;
+		st->rate_limit_deadline_usec = now + (guint64)verdict.max_wait_ms * 1000;
+	}
+
+	if (!st->rate_limit_is_waiting) {
+		network_rate_limiter_reject(g->rate_limiter, ndx, &verdict);
+		proxy_admission_send_error(con, C("(proxy) the query is over its rate limit"));
+
+		return PROXY_SEND_RESULT;
+	}
+
+	tv.tv_sec = verdict.wait_usec / G_USEC_PER_SEC;
+	tv.tv_usec = verdict.wait_usec % G_USEC_PER_SEC;
+
+	evtimer_set(&(st->rate_limit_ev), proxy_rate_limit_timeout, con);
+	event_base_set(event_thread->event_base, &(st->rate_limit_ev));
+	evtimer_add(&(st->rate_limit_ev), &tv);
+
+	return PROXY_WAIT_ASYNC;
+}
+
+/**
+ * call read_query() of the script and route the query it decided on
+ *
+ * @see proxy_read_query
+ */
+static network_socket_retval_t proxy_read_query_lua(network_mysqld_con *con) {
+	network_mysqld_lua_stmt_ret ret;
+
+	NETWORK_MYSQLD_CON_TRACK_TIME(con, "proxy::ready_query::enter_lua");
+	ret = proxy_lua_call(proxy_lua_read_query, con);
+	NETWORK_MYSQLD_CON_TRACK_TIME(con, "proxy::ready_query::leave_lua");
+
+	if (ret == PROXY_WAIT_ASYNC) {
+		/* read_query() waits for proxy.query_async(), the packet of the client stays in the recv-queue */
+		con->state = CON_STATE_WAIT_ASYNC;
+
+		return NETWORK_SOCKET_SUCCESS;
+	}
+
+	if (ret == PROXY_NO_DECISION && con->config->local_answers) {
+		ret = proxy_local_answer(con);
+
+		if (ret == PROXY_IGNORE_RESULT) {
+			/* a COM_QUIT has no answer, the backend connection stays open for the pool */
+			chassis_metric_inc(con->config->local_answers_total);
+			con->state = CON_STATE_CLOSE_CLIENT;
+
+			return NETWORK_SOCKET_SUCCESS;
+		}
+	}
+
+	return proxy_read_query_decided(con, ret);
+}
+
+/**
+ * the query over its rate limit waited for a token
+ *
+ * @see proxy_rate_limit_acquire()
+ */
+static network_socket_retval_t proxy_rate_limit_resume(network_mysqld_con *con) {
+	network_mysqld_lua_stmt_ret ret;
+
+	switch ((ret = proxy_rate_limit_acquire(con))) {
+	case PROXY_WAIT_ASYNC:
+		return NETWORK_SOCKET_WAIT_FOR_EVENT;
+	case PROXY_SEND_RESULT:
+		return proxy_read_query_decided(con, ret);
+	default:
+		return proxy_read_query_lua(con);
+	}
+}
+
+/**
+ * read the hints of the comment in front of the query of the client
+ *
+ * the router, the query-cache and the query-timeout act on them without a lua hook
+ *
+ * @see network_mysqld_proto_get_query_hints()
+ */
+static void proxy_query_hints_track(network_mysqld_con *con) {
+	network_mysqld_con_lua_t *st = con->plugin_con_state;
+	GString *packet = g_queue_peek_head(con->client->recv_queue->chunks);
+
+	if (con->client->recv_queue->chunks->length != 1 ||
+	    packet->len <= NET_HEADER_SIZE ||
+	    packet->str[NET_HEADER_SIZE] != COM_QUERY) {
+		network_mysqld_query_hints_reset(st->query_hints);
+
+		return;
+	}
+
+	proxy_query_get_hints(packet, st->query_hints);
+}
+
+/**
+ * give the query the hints of the first rule of --proxy-query-rules-file that matches it
+ *
+ * the hints of the comment of the query stay, the rules only fill in the others. Without
+ * --proxy-query-hints the hints of the last query are reset first.
+ *
+ * @see network_query_ruleset_match()
+ */
+static void proxy_query_rules_apply(network_mysqld_con *con) {
+	network_mysqld_con_lua_t *st = con->plugin_con_state;
+	network_query_ruleset_t *ruleset = network_query_rules_get(con->config->query_rules);
+	GString *packet = g_queue_peek_head(con->client->recv_queue->chunks);
+	network_query_rule_t *rule;
+	gint query_class = NETWORK_QUERY_RULE_ANY;
+	guint8 command;
+
+	if (!con->config->query_hints) network_mysqld_query_hints_reset(st->query_hints);
+
+	if (NULL == ruleset || NULL == packet || packet->len <= NET_HEADER_SIZE) return;
+
+	command = packet->str[NET_HEADER_SIZE];
+
+	if (command == COM_QUERY && con->client->recv_queue->chunks->length == 1) {
+		chassis_event_thread_cpu_t cpu = chassis_event_thread_cpu_enter(CHASSIS_EVENT_THREAD_CPU_TOKENIZER);
+
+		query_class = network_mysqld_proto_get_query_class(packet->str + NET_HEADER_SIZE + 1, packet->len - NET_HEADER_SIZE - 1);
+
+		chassis_event_thread_cpu_leave(cpu);
+	}
+
+	rule = network_query_ruleset_match(ruleset,
+			con->client->response ? con->client->response->username->str : NULL,
+			con->client->default_db->len > 0 ? con->client->default_db->str : NULL,
+			command, query_class);
+
+	if (rule) network_query_rule_apply(rule, st->query_hints);
+}
+
+/**
+ * gets called after a query has been read
+ *
+ * - reads the hints of the query and adds those of the --proxy-query-rules-file
+ * - checks the query against the firewall and its rate limits
+ * - calls the lua script via network_mysqld_con_handle_proxy_stmt()
+ *
+ * @see network_mysqld_con_handle_proxy_stmt
+ */
+NETWORK_MYSQLD_PLUGIN_PROTO(proxy_read_query) {
+	network_mysqld_con_lua_t *st = con->plugin_con_state;
+	chassis_private *g = con->srv->priv;
+	network_mysqld_lua_stmt_ret ret;
+	
+	NETWORK_MYSQLD_CON_TRACK_TIME(con, "proxy::ready_query::enter");
+
+	/* the last command didn't have a result, like COM_STMT_CLOSE */
+	network_admission_leave(con->config->admission, &(st->admission));
+
+	st->injected.sent_resultset = 0;
+
+	/* we already passed the CON_STATE_READ_AUTH_OLD_PASSWORD phase and sent all packets
+	 * to the client so we need to set the COM_CHANGE_USER flag back to FALSE
+	 */
+	st->is_in_com_change_user = FALSE;
+
+	if (con->config->multiplex || con->config->idle_release_time > 0) proxy_multiplex_track(con);
+
+	if (con->config->query_hints) proxy_query_hints_track(con);
+
+	if (con->config->query_rules) proxy_query_rules_apply(con);
+
+	if (network_trace_is_open(con->config->trace)) proxy_trace_track(con);
+
+	if (network_query_digest_is_enabled(g->query_digest) ||
+	    network_firewall_is_enabled(g->firewall) ||
+	    network_rate_limiter_uses_key(g->rate_limiter, NETWORK_RATE_LIMIT_DIGEST)) {
+		proxy_query_digest_track(con);
+	}
+
+	if (network_query_log_is_open(con->config->query_log)) proxy_query_log_track(con);
+
+	if (network_capture_is_open(con->config->capture)) proxy_capture_track(con);
+
+	if (network_firewall_is_enabled(g->firewall)) {
+		ret = proxy_firewall_check(con);
+
+		if (ret == PROXY_SEND_RESULT) return proxy_read_query_decided(con, ret);
+	}
+
+	if (network_rate_limiter_is_enabled(g->rate_limiter)) {
+		ret = proxy_rate_limit_acquire(con);
+
+		if (ret == PROXY_WAIT_ASYNC) {
+			/* proxy_wait_async() goes on once the bucket has a token again */
+			con->state = CON_STATE_WAIT_ASYNC;
+
+			return NETWORK_SOCKET_SUCCESS;
+		}
+
+		if (ret == PROXY_SEND_RESULT) return proxy_read_query_decided(con, ret);
+	}
+
+	return proxy_read_query_lua(con);
+}
+
+/**
+ * resume read_query() when the queries of proxy.query_async() it waits for are done
+ *
+ * a query waiting for the admission control goes on with proxy_admission_resume(), a query
+ * sent to all shards with proxy_shard_scatter_resume(), a query over its rate limit with
+ * proxy_rate_limit_resume() and a statement waiting for a pooled connection of its session
+ * with proxy_multiplex_resume()
+ *
+ * @see proxy_read_query
+ */
+NETWORK_MYSQLD_PLUGIN_PROTO(proxy_wait_async) {
+	network_mysqld_con_lua_t *st = con->plugin_con_state;
+	network_mysqld_lua_stmt_ret ret;
+
+	if (st->scatter_merge) return proxy_shard_scatter_resume(con);
+
+	if (st->read_hedge_is_won) return proxy_read_hedge_resume(con);
+
+	if (st->multiplex_is_waiting) return proxy_multiplex_resume(con);
+
+	if (st->admission_is_waiting) return proxy_admission_resume(con);
+
+	if (st->rate_limit_is_waiting) return proxy_rate_limit_resume(con);
+
+	if (!network_async_query_lua_is_ready(st)) return NETWORK_SOCKET_WAIT_FOR_EVENT;
+
+	NETWORK_MYSQLD_CON_TRACK_TIME(con, "proxy::wait_async::enter_lua");
+	ret = proxy_lua_call(proxy_lua_read_query_resume, con);
+	NETWORK_MYSQLD_CON_TRACK_TIME(con, "proxy::wait_async::leave_lua");
+
+	/* it waits in the next proxy.wait_all() */
+	if (ret == PROXY_WAIT_ASYNC) return NETWORK_SOCKET_WAIT_FOR_EVENT;
+
+	return proxy_read_query_decided(con, ret);
+}
+
+/**
+ * account the result that came back from the backend
+ *
+ * called once per result: from proxy_send_query_result() or before, if the backend is
+ * released while the client still reads a spooled result
+ */
+static void proxy_result_done(network_mysqld_con *con) {
+	network_mysqld_con_lua_t *st = con->plugin_con_state;
+
+	if (st->result_is_done) return;
+	st->result_is_done = TRUE;
+
+	/* the result is complete, the next query may go to the backend */
+	network_admission_leave(con->config->admission, &(st->admission));
+
+	proxy_query_timeout_disarm(st);
+
+	/* feed the timings of the last result into the latency average of the backend
+	 *
+	 * the result of a second read that won isn't from this backend */
+	if (st->backend &&
+	    !st->read_hedge_is_won &&
+	    con->ts_send_query != 0 &&
+	    con->ts_read_query_result_last >= con->ts_read_query_result_first &&
+	    con->ts_read_query_result_first >= con->ts_send_query) {
+		network_backend_add_latency(st->backend,
+				con->ts_read_query_result_first - con->ts_send_query,
+				con->ts_read_query_result_last - con->ts_send_query);
+		network_backend_record_latency(st->backend, chassis_event_thread_get_local_index(),
+				NETWORK_BACKEND_LATENCY_FIRST_BYTE,
+				con->ts_read_query_result_first - con->ts_send_query);
+		network_backend_record_latency(st->backend, chassis_event_thread_get_local_index(),
+				NETWORK_BACKEND_LATENCY_QUERY,
+				con->ts_read_query_result_last - con->ts_send_query);
+		network_backends_breaker_record(((chassis_private *)con->srv->priv)->backends, st->backend,
+				st->query_timeout_is_expired,
+				con->ts_read_query_result_last - con->ts_send_query,
+				con->ts_read_query_result_last);
+	}
+
+	if (st->rw_split_is_write) {
+		/* the write is done, the master's binlog position we get from now on includes it */
+		st->rw_split_write_usec = chassis_get_rel_microseconds();
+		st->rw_split_min_binlog_pos = 0;
+		st->rw_split_is_write = FALSE;
+	}
+
+	if (con->config->read_hedge) proxy_read_hedge_finish(con);
+
+	if (st->digest_is_pending) proxy_query_digest_record(con);
+
+	if (st->query_log_is_pending) proxy_query_log_record(con);
+
+	if (st->trace_is_pending) proxy_trace_record(con);
+
+	if (st->local_names_pending) proxy_local_track_result(con);
+
+	if (st->session_vars_pending) proxy_session_vars_track_result(con);
+
+	con->ts_send_query = 0;
+
+	if (st->query_cache_written_unknown || st->query_cache_written_tables->len > 0) {
+		proxy_query_cache_invalidate(con);
+	}
+}
+
+/**
+ * decide about the next state after the result-set has been written 
+ * to the client
+ * 
+ * if we still have data in the queue, back to proxy_send_query()
+ * otherwise back to proxy_read_query() to pick up a new client query
+ *
+ * @note we should only send one result back to the client
+ */
+NETWORK_MYSQLD_PLUGIN_PROTO(proxy_send_query_result) {
+	network_socket *recv_sock, *send_sock;
+	injection *inj;
+	network_mysqld_con_lua_t *st = con->plugin_con_state;
+
+	send_sock = con->server;
+	recv_sock = con->client;
+
+	proxy_result_done(con);
+	st->result_is_done = FALSE;
+
+	if (st->connection_close) {
+		con->state = CON_STATE_ERROR;
+
+		return NETWORK_SOCKET_SUCCESS;
+	}
+
+	if (con->parse.command == COM_BINLOG_DUMP) {
+		/**
+		 * the binlog dump is different as it doesn't have END packet
+		 *
+		 * @todo in 5.0.x a NON_BLOCKING option as added which sends a EOF
+		 */
+		con->state = CON_STATE_READ_QUERY_RESULT;
+
+		return NETWORK_SOCKET_SUCCESS;
+	}
+
+	/* if we don't have a backend, don't try to forward queries
+	 */
+	if (!send_sock) {
+		network_injection_queue_reset(st->injected.queries);
+		network_injection_queue_reset(st->injected.pipelined);
+	}
+
+	if (st->injected.queries->length == 0 && st->injected.pipelined->length == 0) {
+		/* we have nothing more to send, let's see what the next state is */
+
+		if (con->config->multiplex) proxy_multiplex_release(con);
+
+		con->state = CON_STATE_READ_QUERY;
+
+		return NETWORK_SOCKET_SUCCESS;
+	}
+
+	/* looks like we still have queries in the queue, 
+	 * push the next one 
+	 */
+	inj = proxy_injection_peek(st);
+	con->resultset_is_needed = inj->resultset_is_needed;
+	con->resultset_is_forwarded_raw = FALSE;
+
+	if (!inj->resultset_is_needed && st->injected.sent_resultset > 0) {
+		/* we already sent a resultset to the client and the next query wants to forward it's result-set too, that can't work */
+		g_critical("%s: proxy.queries:append() in %s can only have one injected query without { resultset_is_needed = true } set. We close the client connection now.",
+				G_STRLOC,
+				con->config->lua_script);
+
+		return NETWORK_SOCKET_ERROR;
+	}
+
+	g_assert(inj);
+	g_assert(send_sock);
+
+	network_mysqld_con_reset_command_response_state(con);
+
+	if (st->injected.pipelined->length > 0) {
+		/* the query is already sent, read its result */
+		proxy_injection_track_command(con, inj);
+
+		con->resultset_is_finished = FALSE;
+		con->ts_send_query = 0; /* the result waited behind the previous ones, don't count it as latency */
+		con->ts_read_query_result_first = 0;
+		con->ts_read_query_result_last = 0;
+
+		con->state = CON_STATE_READ_QUERY_RESULT;
+
+		return NETWORK_SOCKET_SUCCESS;
+	}
+
+	proxy_injection_send(con);
+
+	con->state = CON_STATE_SEND_QUERY;
+
+	return NETWORK_SOCKET_SUCCESS;
+}
+
+/**
+ * handle the query-result we received from the server
+ *
+ * - decode the result-set to track if we are finished already
+ * - handles BUG#25371 if requested
+ * - if the packet is finished, calls the network_mysqld_con_handle_proxy_resultset
+ *   to handle the resultset in the lua-scripts
+ *
+ * @see network_mysqld_con_handle_proxy_resultset
+ */
+NETWORK_MYSQLD_PLUGIN_PROTO(proxy_read_query_result) {
+	int is_finished = 0;
+	network_packet packet;
+	network_socket *recv_sock, *send_sock;
+	network_mysqld_con_lua_t *st = con->plugin_con_state;
+	injection *inj = NULL;
+	guint64 mirror_rows = 0;
+	int prev_state = -1;
+
+	NETWORK_MYSQLD_CON_TRACK_TIME(con, "proxy::ready_query_result::enter");
+
+	recv_sock = con->server;
+	send_sock = con->client;
+
+	/* check if the last packet is valid */
+	packet.data = g_queue_peek_tail(recv_sock->recv_queue->chunks);
+	packet.offset = 0;
+
+	inj = proxy_injection_peek(st);
+
+	if (inj && inj->ts_read_query_result_first == 0) {
+		/**
+		 * log the time of the first received packet
+		 */
+		inj->ts_read_query_result_first = chassis_get_rel_microseconds();
+		/* g_get_current_time(&(inj->ts_read_query_result_first)); */
+	}
+
+	if (st->mirror_query && con->parse.command == COM_QUERY && con->parse.data) {
+		mirror_rows = ((network_mysqld_com_query_result_t *)con->parse.data)->rows;
+	}
+
+	if (con->parse.command == COM_QUERY && con->parse.data) {
+		prev_state = ((network_mysqld_com_query_result_t *)con->parse.data)->state;
+	}
+
+	is_finished = network_mysqld_proto_get_query_result(&packet, con);
+	if (is_finished == -1) return NETWORK_SOCKET_ERROR; /* something happend, let's get out of here */
+
+	con->resultset_is_finished = is_finished;
+
+	if (st->mirror_query && !st->session_sync_is_pending) proxy_mirror_track(con, packet.data, mirror_rows, is_finished);
+
+	if (st->stmt_prepare_key && con->parse.command == COM_STMT_PREPARE) proxy_stmt_capture(con, packet.data);
+
+	/* copy the packet over to the send-queue if we don't need it */
+	if (!con->resultset_is_needed && inj && inj->rows_batch_size > 0 && prev_state != -1) {
+		/* the client may not get the rows the backend sent */
+		if (st->query_cache_key) network_mysqld_con_lua_query_cache_reset(st);
+
+		proxy_rows_batch_append(con, inj, g_queue_pop_tail(recv_sock->recv_queue->chunks), prev_state, is_finished);
+	} else if (!con->resultset_is_needed) {
+		if (st->query_cache_key) proxy_query_cache_capture(con, packet.data);
+
+		network_mysqld_queue_append_raw(send_sock, send_sock->send_queue, g_queue_pop_tail(recv_sock->recv_queue->chunks));
+	}
+
+	if (is_finished) {
+		network_mysqld_lua_stmt_ret ret;
+
+		if (st->session_sync_is_pending) {
+			proxy_session_synced(con);
+			NETWORK_MYSQLD_CON_TRACK_TIME(con, "proxy::ready_query_result::leave");
+
+			return NETWORK_SOCKET_SUCCESS;
+		}
+
+		if (st->query_cache_key) proxy_query_cache_store(con);
+
+		if (st->stmt_prepare_key && con->parse.command == COM_STMT_PREPARE && proxy_stmt_prepared(con)) {
+			NETWORK_MYSQLD_CON_TRACK_TIME(con, "proxy::ready_query_result::leave");
+
+			return NETWORK_SOCKET_SUCCESS;
+		}
+
+		if (st->stmt_promote_query && con->parse.command == COM_STMT_EXECUTE && !proxy_stmt_promoted(con)) {
+			NETWORK_MYSQLD_CON_TRACK_TIME(con, "proxy::ready_query_result::leave");
+
+			return NETWORK_SOCKET_SUCCESS;
+		}
+
+		/**
+		 * the resultset handler might decide to trash the send-queue
+		 * 
+		 * */
+
+		if (inj) {
+			if (con->parse.command == COM_QUERY || con->parse.command == COM_STMT_EXECUTE) {
+				network_mysqld_com_query_result_t *com_query = con->parse.data;
+
+				inj->bytes = com_query->bytes;
+				inj->rows  = com_query->rows;
+				inj->qstat.was_resultset = com_query->was_resultset;
+				inj->qstat.binary_encoded = com_query->binary_encoded;
+				inj->qstat.deprecate_eof = com_query->deprecate_eof;
+
+				/* INSERTs have a affected_rows */
+				if (!com_query->was_resultset) {
+					inj->qstat.affected_rows = com_query->affected_rows;
+					inj->qstat.insert_id     = com_query->insert_id;
+				}
+				inj->qstat.server_status = com_query->server_status;
+				inj->qstat.warning_count = com_query->warning_count;
+				inj->qstat.query_status  = com_query->query_status;
+
+				if (con->parse.command == COM_STMT_EXECUTE &&
+				    com_query->was_resultset &&
+				    inj->resultset_is_needed &&
+				    NULL == inj->fields) {
+					proxy_stmt_coldefs_attach(con, inj);
+				}
+			}
+			inj->ts_read_query_result_last = chassis_get_rel_microseconds();
+			/* g_get_current_time(&(inj->ts_read_query_result_last)); */
+
+			MYSQLPROXY_INJECTION_RESULT(con, inj->id,
+					inj->ts_read_query_result_last - inj->ts_read_query,
+					inj->rows,
+					inj->qstat.query_status);
+
+			if (network_query_log_is_open(con->config->query_log)) proxy_query_log_injection(con, inj);
+		}
+		
+		network_mysqld_queue_reset(recv_sock); /* reset the packet-id checks as the server-side is finished */
+
+		NETWORK_MYSQLD_CON_TRACK_TIME(con, "proxy::ready_query_result::enter_lua");
+		ret = proxy_lua_call(proxy_lua_read_query_result, con);
+		NETWORK_MYSQLD_CON_TRACK_TIME(con, "proxy::ready_query_result::leave_lua");
+
+		if (PROXY_IGNORE_RESULT != ret) {
+			/* reset the packet-id checks, if we sent something to the client */
+			network_mysqld_queue_reset(send_sock);
+		}
+
+		/**
+		 * if the send-queue is empty, we have nothing to send
+		 * and can read the next query */
+		if (send_sock->send_queue->chunks) {
+			con->state = CON_STATE_SEND_QUERY_RESULT;
+
+			/* the client reads the result from the spool, the backend connection isn't needed for it */
+			if (con->spool && con->config->multiplex &&
+			    !st->connection_close &&
+			    con->parse.command != COM_BINLOG_DUMP &&
+			    st->injected.queries->length == 0 && st->injected.pipelined->length == 0) {
+				proxy_result_done(con);
+				proxy_multiplex_release(con);
+			}
+		} else {
+			g_assert_cmpint(con->resultset_is_needed, ==, 1); /* we already forwarded the resultset, no way someone has flushed the resultset-queue */
+
+			con->state = CON_STATE_READ_QUERY;
+		}
+	}
+	NETWORK_MYSQLD_CON_TRACK_TIME(con, "proxy::ready_query_result::leave");
+	
+	return NETWORK_SOCKET_SUCCESS;
+}
+
+static network_mysqld_lua_stmt_ret proxy_lua_connect_server(network_mysqld_con *con) {
+	network_mysqld_lua_stmt_ret ret = PROXY_NO_DECISION;
+
+#ifdef HAVE_LUA_H
+	network_mysqld_con_lua_t *st = con->plugin_con_state;
+	lua_State *L;
+
+	if (network_mysqld_con_lua_skips_hook(st, NETWORK_MYSQLD_LUA_HOOK_CONNECT_SERVER)) return ret;
+
+	/**
+	 * if loading the script fails return a new error 
+	 */
+	switch (network_mysqld_con_lua_register_callback(con, con->config->lua_script)) {
+	case REGISTER_CALLBACK_SUCCESS:
+		break;
+	case REGISTER_CALLBACK_LOAD_FAILED:
+		/* send packet-id 0 */
+		network_mysqld_con_send_error(con->client, C("MySQL Proxy Lua script failed to load. Check the error log."));
+		return PROXY_SEND_RESULT;
+	case REGISTER_CALLBACK_EXECUTE_FAILED:
+		/* send packet-id 0 */
+		network_mysqld_con_send_error(con->client, C("MySQL Proxy Lua script failed to execute. Check the error log."));
+		return PROXY_SEND_RESULT;
+	}
+
+	if (!st->L) return PROXY_NO_DECISION;
+
+	L = st->L;
+
+	g_assert(lua_isfunction(L, -1));
+	lua_getfenv(L, -1);
+	g_assert(lua_istable(L, -1));
+	
+	lua_getfield_literal(L, -1, C("connect_server"));
+	if (lua_isfunction(L, -1)) {
+		MYSQLPROXY_LUA_ENTER(con, "connect_server");
+		if (lua_pcall(L, 0, 1, 0) != 0) {
+			g_critical("%s: (connect_server) %s", 
+					G_STRLOC,
+					lua_tostring(L, -1));
+
+			lua_pop(L, 1); /* errmsg */
+
+			/* the script failed, but we have a useful default */
+		} else {
+			if (lua_isnumber(L, -1)) {
+				ret = lua_tonumber(L, -1);
+			}
+			lua_pop(L, 1);
+		}
+		MYSQLPROXY_LUA_LEAVE(con, "connect_server", ret);
+
+		switch (ret) {
+		case PROXY_NO_DECISION:
+		case PROXY_IGNORE_RESULT:
+			break;
+		case PROXY_SEND_RESULT:
+			/* answer directly */
+
+			if (network_mysqld_con_lua_handle_proxy_response(con, con->config->lua_script)) {
+				/**
+				 * handling proxy.response failed
+				 *
+				 * send a ERR packet
+				 */
+		
+				/* send packet-id 0 */
+				network_mysqld_con_send_error(con->client, C("(lua) handling proxy.response failed, check error-log"));
+			} else {
+				network_queue *q;
+				network_packet packet;
+				int err = 0;
+				guint8 packet_type;
+
+				/* we should have a auth-packet or a err-packet in the queue */
+				q = con->client->send_queue;
+
+				packet.data = g_queue_peek_head(q->chunks);
+				packet.offset = 0;
+
+				err = err || network_mysqld_proto_skip_network_header(&packet);
+				err = err || network_mysqld_proto_peek_int8(&packet, &packet_type);
+				if (!err && packet_type == 0x0a) {
+					network_mysqld_auth_challenge *challenge;
+
+					challenge = network_mysqld_auth_challenge_new();
+
+					err = err || network_mysqld_proto_get_auth_challenge(&packet, challenge);
+
+					if (!err) {
+						g_assert(con->client->challenge == NULL); /* make sure we don't leak memory */
+						con->client->challenge = challenge;
+					} else {
+						network_mysqld_auth_challenge_free(challenge);
+					}
+				}
+			}
+
+			break;
+		default:
+			ret = PROXY_NO_DECISION;
+			break;
+		}
+
+		/* ret should be a index into */
+
+	} else if (lua_isnil(L, -1)) {
+		lua_pop(L, 1); /* pop the nil */
+	} else {
+		g_message("%s.%d: %s", __FILE__, __LINE__, lua_typename(L, lua_type(L, -1)));
+		lua_pop(L, 1); /* pop the ... */
+	}
+	st->hooks = network_mysqld_lua_fenv_get_hooks(L);
+	lua_pop(L, 1); /* fenv */
+
+	g_assert(lua_isfunction(L, -1));
+#endif
+	return ret;
+}
+
+
+
+/**
+ * record how long the connect() to the backend took
+ */
+static void proxy_backend_record_connect_latency(network_mysqld_con *con) {
+	network_mysqld_con_lua_t *st = con->plugin_con_state;
+	guint64 now = chassis_get_rel_microseconds();
+
+	if (st->ts_connect == 0 || now < st->ts_connect) return;
+
+	network_backend_record_latency(st->backend, chassis_event_thread_get_local_index(),
+			NETWORK_BACKEND_LATENCY_CONNECT,
+			chassis_calc_rel_microseconds(st->ts_connect, now));
+	st->ts_connect = 0;
+}
+
+/**
+ * connect to a backend
+ *
+ * @return
+ *   NETWORK_SOCKET_SUCCESS        - connected successfully
+ *   NETWORK_SOCKET_ERROR_RETRY    - connecting backend failed, call again to connect to another backend
+ *   NETWORK_SOCKET_ERROR          - no backends available, adds a ERR packet to the client queue
+ */
+NETWORK_MYSQLD_PLUGIN_PROTO(proxy_connect_server) {
+	network_mysqld_con_lua_t *st = con->plugin_con_state;
+	chassis_private *g = con->srv->priv;
+	gboolean use_pooled_connection = FALSE;
+	network_backend_t *cur;
+
+	if (con->server && st->hedge_is_promoted) {
+		/* the first connect timed out, wait for the second one */
+		st->hedge_is_promoted = FALSE;
+
+		return NETWORK_SOCKET_ERROR_RETRY;
+	}
+
+	if (con->server) {
+		switch (network_socket_connect_finish(con->server)) {
+		case NETWORK_SOCKET_SUCCESS:
+			/* increment the connected clients value only if we connected successfully */
+			st->backend->connected_clients++;
+			proxy_backend_record_connect_latency(con);
+			proxy_connect_hedge_cancel(con);
+			break;
+		case NETWORK_SOCKET_ERROR:
+		case NETWORK_SOCKET_ERROR_RETRY:
+			g_message("%s.%d: connect(%s) failed: %s. Retrying with different backend.", 
+					__FILE__, __LINE__,
+					con->server->dst->name->str, g_strerror(errno));
+
+			/* mark the backend as being DOWN and retry with a different one,
+			 * a unix-socket that failed only sends the next connect to its TCP address */
+			if (!network_backend_local_socket_failed(st->backend, con->server->dst)) {
+				network_backend_connect_failed(st->backend);
+			}
+			network_socket_free(con->server);
+			con->server = NULL;
+
+			/* ... or wait for the second connect if there is one */
+			proxy_connect_hedge_promote(con);
+
+			return NETWORK_SOCKET_ERROR_RETRY;
+		default:
+			g_assert_not_reached();
+			break;
+		}
+
+		network_backend_connect_succeeded(st->backend);
+
+		con->state = CON_STATE_READ_HANDSHAKE;
+
+		return NETWORK_SOCKET_SUCCESS;
+	}
+
+	if (con->config->lazy_connect && !st->lazy_is_connecting &&
+	    0 == proxy_lazy_send_handshake(con)) {
+		/* the backend is attached at the first query */
+		return NETWORK_SOCKET_SUCCESS;
+	}
+
+	st->backend = NULL;
+	st->backend_ndx = -1;
+
+	network_backends_check(g->backends);
+
+	/* a lazy client had no connect_server() at its handshake, it doesn't get one now */
+	switch (st->lazy_is_connecting ? PROXY_NO_DECISION : proxy_lua_call(proxy_lua_connect_server, con)) {
+	case PROXY_SEND_RESULT:
+		/* we answered directly ... like denial ...
+		 *
+		 * for sure we have something in the send-queue 
+		 *
+		 */
+		
+		return NETWORK_SOCKET_SUCCESS;
+	case PROXY_NO_DECISION:
+		/* just go on */
+
+		break;
+	case PROXY_IGNORE_RESULT:
+		use_pooled_connection = TRUE;
+
+		break;
+	default:
+		g_error("%s.%d: ... ", __FILE__, __LINE__);
+		break;
+	}
+
+	/* protect the typecast below */
+	g_assert_cmpint(network_backends_count(g->backends), <, G_MAXINT);
+
+	/**
+	 * if the current backend is down, ignore it 
+	 */
+	cur = network_backends_get(g->backends, st->backend_ndx);
+
+	if (cur) {
+		if (cur->state == BACKEND_STATE_DOWN ||
+		    !network_backends_breaker_admit(g->backends, cur)) {
+			st->backend_ndx = -1;
+		}
+	}
+
+	if (con->server && !use_pooled_connection) {
+		gint bndx = st->backend_ndx;
+		/* we already have a connection assigned, 
+		 * but the script said we don't want to use it
+		 */
+
+		network_connection_pool_lua_add_connection(con);
+
+		st->backend_ndx = bndx;
+	}
+
+	if (st->backend_ndx < 0) {
+		/**
+		 * we can choose between different back addresses 
+		 *
+		 * prefer SQF (shorted queue first) to load all backends equally
+		 */ 
+		st->backend_ndx = network_backends_get_least_connected(g->backends, BACKEND_TYPE_RW);
+
+		if ((cur = network_backends_get(g->backends, st->backend_ndx))) {
+			st->backend = cur;
+		}
+	} else if (NULL == st->backend) {
+		if ((cur = network_backends_get(g->backends, st->backend_ndx))) {
+			st->backend = cur;
+		}
+	}
+
+	if (NULL == st->backend) {
+		if (st->lazy_is_connecting) {
+			/* the client is in the command phase already */
+			network_mysqld_con_send_error(con->client, C("(proxy) all backends are down"));
+		} else {
+			network_mysqld_con_send_error_pre41(con->client, C("(proxy) all backends are down"));
+		}
+		g_critical("%s.%d: Cannot connect, all backends are down.", __FILE__, __LINE__);
+		return NETWORK_SOCKET_ERROR;
+	}
+
+	/**
+	 * check if we have a connection in the pool for this backend
+	 */
+	if (NULL == con->server) {
+		con->server = network_socket_new();
+		network_backend_get_address(st->backend, con->server->dst);
+		con->server->bind_src = network_backend_get_source_address(st->backend, con->server->dst, con->server->src);
+
+		st->ts_connect = chassis_get_rel_microseconds();
+
+		switch(network_socket_connect(con->server)) {
+		case NETWORK_SOCKET_ERROR_RETRY:
+			/* the socket is non-blocking already, 
+			 * call getsockopt() to see if we are done */
+			proxy_connect_hedge_arm(con);
+
+			return NETWORK_SOCKET_ERROR_RETRY;
+		case NETWORK_SOCKET_SUCCESS:
+			/* increment the connected clients value only if we connected successfully */
+			st->backend->connected_clients++;
+			proxy_backend_record_connect_latency(con);
+			break;
+		default:
+			g_message("%s.%d: connecting to backend (%s) failed, marking it as down for ...", 
+					__FILE__, __LINE__, con->server->dst->name->str);
+
+			if (!network_backend_local_socket_failed(st->backend, con->server->dst)) {
+				network_backend_connect_failed(st->backend);
+			}
+
+			network_socket_free(con->server);
+			con->server = NULL;
+
+			return NETWORK_SOCKET_ERROR_RETRY;
+		}
+
+		network_backend_connect_succeeded(st->backend);
+
+		con->state = CON_STATE_READ_HANDSHAKE;
+	} else {
+		GString *auth_packet;
+
+		/**
+		 * send the old hand-shake packet
+		 */
+
+		auth_packet = g_string_new(NULL);
+		network_mysqld_proto_append_auth_challenge(auth_packet, con->server->challenge);
+
+		network_mysqld_queue_append(
+				con->client,
+				con->client->send_queue, 
+				S(auth_packet));
+
+		g_string_free(auth_packet, TRUE);
+
+		g_assert(con->client->challenge == NULL);
+		con->client->challenge = network_mysqld_auth_challenge_copy(con->server->challenge);
+
+		con->state = CON_STATE_SEND_HANDSHAKE;
+
+		/**
+		 * connect_clients is already incremented 
+		 */
+	}
+
+	return NETWORK_SOCKET_SUCCESS;
+}
+
+/**
+ * convert a double into a timeval
+ */
+static gboolean
+timeval_from_double(struct timeval *dst, double t) {
+	g_return_val_if_fail(dst != NULL, FALSE);
+	g_return_val_if_fail(t >= 0, FALSE);
+
+	dst->tv_sec = floor(t);
+	dst->tv_usec = floor((t - dst->tv_sec) * 1000000);
+
+	return TRUE;
+}
+
+NETWORK_MYSQLD_PLUGIN_PROTO(proxy_init) {
+	network_mysqld_con_lua_t *st = con->plugin_con_state;
+	chassis_plugin_config *config = con->config;
+
+	g_assert(con->plugin_con_state == NULL);
+
+	st = network_mysqld_con_lua_new();
+
+	con->plugin_con_state = st;
+	
+	con->state = CON_STATE_CONNECT_SERVER;
+
+	/* set the connection specific timeouts
+	 *
+	 * TODO: expose these settings at runtime
+	 */
+	if (config->connect_timeout_dbl >= 0) {
+		timeval_from_double(&con->connect_timeout, config->connect_timeout_dbl);
+	}
+	if (config->read_timeout_dbl >= 0) {
+		timeval_from_double(&con->read_timeout, config->read_timeout_dbl);
+	}
+	if (config->write_timeout_dbl >= 0) {
+		timeval_from_double(&con->write_timeout, config->write_timeout_dbl);
+	}
+
+	con->send_queue_high_watermark = config->send_queue_high_watermark;
+	con->send_queue_low_watermark = config->send_queue_low_watermark;
+	con->spool_threshold = (gsize)config->result_spool_threshold * 1024;
+
+
+
+	return NETWORK_SOCKET_SUCCESS;
+}
+
+static network_mysqld_lua_stmt_ret proxy_lua_disconnect_client(network_mysqld_con *con) {
+	network_mysqld_lua_stmt_ret ret = PROXY_NO_DECISION;
+
+#ifdef HAVE_LUA_H
+	network_mysqld_con_lua_t *st = con->plugin_con_state;
+	lua_State *L;
+
+	if (network_mysqld_con_lua_skips_hook(st, NETWORK_MYSQLD_LUA_HOOK_DISCONNECT_CLIENT)) return ret;
+
+	/* call the lua script to pick a backend
+	 * */
+	/* this error handling is different, as we no longer have a client. */
+	switch(network_mysqld_con_lua_register_callback(con, con->config->lua_script)) {
+		case REGISTER_CALLBACK_SUCCESS:
+			break;
+		case REGISTER_CALLBACK_LOAD_FAILED:
+		case REGISTER_CALLBACK_EXECUTE_FAILED:
+			return ret;
+	}
+
+	if (!st->L) return 0;
+
+	L = st->L;
+
+	g_assert(lua_isfunction(L, -1));
+	lua_getfenv(L, -1);
+	g_assert(lua_istable(L, -1));
+	
+	lua_getfield_literal(L, -1, C("disconnect_client"));
+	if (lua_isfunction(L, -1)) {
+		MYSQLPROXY_LUA_ENTER(con, "disconnect_client");
+		if (lua_pcall(L, 0, 1, 0) != 0) {
+			g_critical("%s.%d: (disconnect_client) %s", 
+					__FILE__, __LINE__,
+					lua_tostring(L, -1));
+
+			lua_pop(L, 1); /* errmsg */
+
+			/* the script failed, but we have a useful default */
+		} else {
+			if (lua_isnumber(L, -1)) {
+				ret = lua_tonumber(L, -1);
+			}
+			lua_pop(L, 1);
+		}
+		MYSQLPROXY_LUA_LEAVE(con, "disconnect_client", ret);
+
+		switch (ret) {
+		case PROXY_NO_DECISION:
+		case PROXY_IGNORE_RESULT:
+			break;
+		default:
+			ret = PROXY_NO_DECISION;
+			break;
+		}
+
+		/* ret should be a index into */
+
+	} else if (lua_isnil(L, -1)) {
+		lua_pop(L, 1); /* pop the nil */
+	} else {
+		g_message("%s.%d: %s", __FILE__, __LINE__, lua_typename(L, lua_type(L, -1)));
+		lua_pop(L, 1); /* pop the ... */
+	}
+	st->hooks = network_mysqld_lua_fenv_get_hooks(L);
+	lua_pop(L, 1); /* fenv */
+
+	g_assert(lua_isfunction(L, -1));
+#endif
+	return ret;
+}
+
+
+/**
+ * cleanup the proxy specific data on the current connection 
+ *
+ * move the server connection into the connection pool in case it is a 
+ * good client-side close
+ *
+ * @return NETWORK_SOCKET_SUCCESS
+ * @see plugin_call_cleanup
+ */
+NETWORK_MYSQLD_PLUGIN_PROTO(proxy_disconnect_client) {
+	network_mysqld_con_lua_t *st = con->plugin_con_state;
+	lua_scope  *sc = network_mysqld_con_get_lua_scope(con);
+	gboolean use_pooled_connection = FALSE;
+
+	if (st == NULL) return NETWORK_SOCKET_SUCCESS;
+
+	if (st->admission_is_waiting) {
+		evtimer_del(&(st->admission_timeout_ev));
+		st->admission_is_waiting = FALSE;
+
+		/* another thread admitted it, the wakeup is on its way to our thread and fires after we are gone */
+		if (network_admission_leave(con->config->admission, &(st->admission)) && !st->admission_is_woken) {
+			st->admission_wakeup->con = NULL;
+			st->admission_wakeup = NULL;
+		}
+	} else {
+		network_admission_leave(con->config->admission, &(st->admission));
+	}
+
+	proxy_multiplex_wait_cancel(con);
+
+	if (st->rate_limit_is_waiting) {
+		evtimer_del(&(st->rate_limit_ev));
+		st->rate_limit_is_waiting = FALSE;
+		network_rate_limiter_undelay(((chassis_private *)con->srv->priv)->rate_limiter);
+	}
+
+	proxy_connect_hedge_cancel(con);
+
+	proxy_query_timeout_disarm(st);
+
+	proxy_read_hedge_cancel(st);
+
+	if (st->capture_id != 0) {
+		network_capture_push(con->config->capture, st->capture_id, NETWORK_CAPTURE_CLOSE, NULL, 0);
+		st->capture_id = 0;
+	}
+	
+	/**
+	 * let the lua-level decide if we want to keep the connection in the pool
+	 */
+
+	switch (proxy_lua_call(proxy_lua_disconnect_client, con)) {
+	case PROXY_NO_DECISION:
+		/* just go on */
+
+		break;
+	case PROXY_IGNORE_RESULT:
+		break;
+	default:
+		g_error("%s.%d: ... ", __FILE__, __LINE__);
+		break;
+	}
+
+	/**
+	 * a idle read-only connection can go back to the pool, we close the read-write one
+	 */
+	if (st->rw_split_server) {
+		if (con->state == CON_STATE_CLOSE_CLIENT) {
+			proxy_rw_split_unpark(con);
+		} else {
+			st->backend->connected_clients--;
+			network_socket_free(con->server);
+
+			con->server = st->rw_split_server;
+			st->backend = st->rw_split_backend;
+			st->backend_ndx = st->rw_split_backend_ndx;
+			st->rw_split_server = NULL;
+		}
+	}
+
+	/**
+	 * check if one of the backends has to many open connections
+	 */
+
+	if (use_pooled_connection &&
+	    con->state == CON_STATE_CLOSE_CLIENT) {
+		/* move the connection to the connection pool
+		 *
+		 * this disconnects con->server and safes it from getting free()ed later
+		 */
+
+		network_connection_pool_lua_add_connection(con);
+	} else if (st->backend) {
+		/* we have backend assigned and want to close the connection to it */
+		st->backend->connected_clients--;
+	}
+
+#ifdef HAVE_LUA_H
+	/* remove this cached script from registry */
+	if (st->L_ref > 0) {
+		luaL_unref(sc->L, LUA_REGISTRYINDEX, st->L_ref);
+	}
+
+	/* and the coroutine of read_query(), the running proxy.query_async() are cancelled below */
+	network_async_query_lua_unref(st, sc->L);
+#endif
+
+	network_mysqld_con_lua_free(st);
+
+	con->plugin_con_state = NULL;
+
+	/**
+	 * walk all pools and clean them up
+	 */
+
+	return NETWORK_SOCKET_SUCCESS;
+}
+
+/**
+ * read the load data infile data from the client
+ *
+ * - decode the result-set to track if we are finished already
+ * - gets called once for each packet
+ * - only used without a backend, otherwise the data is forwarded raw, see network_mysqld_con_forward_local_infile_data()
+ */
+NETWORK_MYSQLD_PLUGIN_PROTO(proxy_read_local_infile_data) {
+	int query_result = 0;
+	network_packet packet;
+	network_socket *recv_sock, *send_sock;
+	network_mysqld_com_query_result_t *com_query = con->parse.data;
+
+	NETWORK_MYSQLD_CON_TRACK_TIME(con, "proxy::ready_query_result::enter");
+	
+	recv_sock = con->client;
+	send_sock = con->server;
+
+	/* check if the last packet is valid */
+	packet.data = g_queue_peek_tail(recv_sock->recv_queue->chunks);
+	packet.offset = 0;
+
+	/* if we get here from another state, src/network-mysqld.c is broken */
+	g_assert_cmpint(con->parse.command, ==, COM_QUERY);
+	g_assert_cmpint(com_query->state, ==, PARSE_COM_QUERY_LOCAL_INFILE_DATA);
+
+	query_result = network_mysqld_proto_get_query_result(&packet, con);
+
+	/* set the testing flag for all data received or not */ 
+	con->local_file_data_is_finished = (query_result == 1);
+
+	if (query_result == -1) return NETWORK_SOCKET_ERROR; /* something happend, let's get out of here */
+
+	if (con->server) {
+		/* we haven't received all data from load data infile, so let's continue reading and writing to the backend */
+		network_mysqld_queue_append_raw(send_sock, send_sock->send_queue,
+				g_queue_pop_tail(recv_sock->recv_queue->chunks));
+	} else {
+		GString *s;
+		/* we don't have a backend
+		 *
+		 * - free the received packets early
+		 * - send a OK later 
+		 */
+		while ((s = g_queue_pop_head(recv_sock->recv_queue->chunks))) g_string_free(s, TRUE);
+	}
+
+	if (query_result == 1) {
+		if (con->server) { /* we have received all data, lets move forward reading the result from the server */
+			con->state = CON_STATE_SEND_LOCAL_INFILE_DATA;
+		} else {
+			network_mysqld_con_send_ok(con->client);
+			con->state = CON_STATE_SEND_LOCAL_INFILE_RESULT;
+		}
+		g_assert_cmpint(com_query->state, ==, PARSE_COM_QUERY_LOCAL_INFILE_RESULT);
+	}
+
+	return NETWORK_SOCKET_SUCCESS;
+}
+
+/**
+ * read the load data infile result from the server
+ *
+ * - decode the result-set to track if we are finished already
+ */
+NETWORK_MYSQLD_PLUGIN_PROTO(proxy_read_local_infile_result) {
+	int query_result = 0;
+	network_packet packet;
+	network_socket *recv_sock, *send_sock;
+
+	NETWORK_MYSQLD_CON_TRACK_TIME(con, "proxy::ready_local_infile_result::enter");
+
+	recv_sock = con->server;
+	send_sock = con->client;
+
+	/* check if the last packet is valid */
+	packet.data = g_queue_peek_tail(recv_sock->recv_queue->chunks);
+	packet.offset = 0;
+	
+	query_result = network_mysqld_proto_get_query_result(&packet, con);
+	if (query_result == -1) return NETWORK_SOCKET_ERROR; /* something happend, let's get out of here */
+
+	network_mysqld_queue_append_raw(send_sock, send_sock->send_queue,
+			g_queue_pop_tail(recv_sock->recv_queue->chunks));
+
+	if (query_result == 1) {
+		con->state = CON_STATE_SEND_LOCAL_INFILE_RESULT;
+	}
+
+	return NETWORK_SOCKET_SUCCESS;
+}
+
+/**
+ * cleanup after we sent to result of the LOAD DATA INFILE LOCAL data to the client
+ */
+NETWORK_MYSQLD_PLUGIN_PROTO(proxy_send_local_infile_result) {
+	network_socket *recv_sock, *send_sock;
+
+	NETWORK_MYSQLD_CON_TRACK_TIME(con, "proxy::send_local_infile_result::enter");
+
+	recv_sock = con->server;
+	send_sock = con->client;
+
+	/* reset the packet-ids */
+	if (send_sock) network_mysqld_queue_reset(send_sock);
+	if (recv_sock) network_mysqld_queue_reset(recv_sock);
+
+	con->state = CON_STATE_READ_QUERY;
+
+	return NETWORK_SOCKET_SUCCESS;
+}
+
+
+int network_mysqld_proxy_connection_init(network_mysqld_con *con) {
+	con->plugins.con_init                      = proxy_init;
+	con->plugins.con_connect_server            = proxy_connect_server;
+	con->plugins.con_read_handshake            = proxy_read_handshake;
+	con->plugins.con_read_auth                 = proxy_read_auth;
+	con->plugins.con_read_auth_result          = proxy_read_auth_result;
+	con->plugins.con_read_auth_old_password	   = proxy_read_auth_old_password;
+	con->plugins.con_read_query                = proxy_read_query;
+	con->plugins.con_read_query_result         = proxy_read_query_result;
+	con->plugins.con_send_query_result         = proxy_send_query_result;
+	con->plugins.con_read_local_infile_data = proxy_read_local_infile_data;
+	con->plugins.con_read_local_infile_result = proxy_read_local_infile_result;
+	con->plugins.con_send_local_infile_result = proxy_send_local_infile_result;
+	con->plugins.con_cleanup                   = proxy_disconnect_client;
+	con->plugins.con_timeout                   = proxy_timeout;
+	con->plugins.con_wait_async                = proxy_wait_async;
+
+	/* the LOAD DATA LOCAL INFILE data isn't seen by the scripts, it goes to the backend as is */
+	con->local_infile_is_forwarded_raw = TRUE;
+	/* the statements are mapped by the statement-id in the first packet of a COM_STMT_SEND_LONG_DATA */
+	con->long_data_is_forwarded_raw = TRUE;
+
+	return 0;
+}
+
+/**
+ * free the global scope which is shared between all connections
+ *
+ * make sure that is called after all connections are closed
+ */
+void network_mysqld_proxy_free(network_mysqld_con G_GNUC_UNUSED *con) {
+}
+
+/**
+ * the pool maintenance timer of a event-thread
+ */
+typedef struct {
+	struct event ev;
+
+	chassis *chas;
+	chassis_plugin_config *config;
+
+	guint thread_ndx;     /**< the event-thread whose pools we maintain */
+} proxy_pool_timer_t;
+
+/**
+ * give the backend connections of the clients of this event-thread that idle for too long back
+ * to the pool and close the longest idling clients under pressure
+ *
+ * the clients are walked from the one that waits the longest for its next query, see
+ * network_mysqld_con_idle_enter(). A backend connection is only released like after a
+ * statement with --proxy-multiplex: outside of a transaction and without session state the
+ * next pooled connection can't take over. The next query of the client takes a pooled
+ * connection of its user again.
+ *
+ * over --proxy-idle-evict-connections or --proxy-idle-evict-memory each event-thread closes
+ * its share of the excess, the clients get a error packet. The memory is the size of the
+ * connections when they went idle last, see network_mysqld_con_get_memory().
+ */
+static void proxy_idle_clients_sweep(proxy_pool_timer_t *timer) {
+	chassis_plugin_config *config = timer->config;
+	chassis_event_thread_t *event_thread = chassis_event_thread_get_local();
+	guint64 now = chassis_get_coarse_rel_microseconds();
+	guint n_threads = MAX(timer->chas->threads->event_threads->len, 1);
+	gint64 connections = chassis_metric_get(network_mysqld_metrics_global->connections, 0);
+	gint64 memory = chassis_metric_get(network_mysqld_metrics_global->connections_memory, 0);
+	gint64 memory_limit = (gint64)config->idle_evict_memory * 1024 * 1024;
+	gint64 evict = 0;
+	GList *l, *next;
+
+	if (NULL == event_thread) return;
+
+	if (config->idle_evict_connections > 0 && connections > config->idle_evict_connections) {
+		evict = connections - config->idle_evict_connections;
+	}
+	if (memory_limit > 0 && memory > memory_limit && connections > 0) {
+		gint64 avg_memory = MAX(memory / connections, 1);
+
+		evict = MAX(evict, (memory - memory_limit + avg_memory - 1) / avg_memory);
+	}
+	evict = (evict + n_threads - 1) / n_threads;
+
+	for (l = event_thread->idle_cons.head; l; l = next) {
+		network_mysqld_con *con = l->data;
+		network_mysqld_con_lua_t *st = con->plugin_con_state;
+
+		next = l->next; /* an evicted client is freed with its link */
+
+		if (con->config != config) continue; /* a client of another plugin */
+
+		if (evict > 0) {
+			network_mysqld_con_evict(con, C("(proxy) closed the idle connection, the proxy is over its connection or memory limit"));
+			if (config->idle_clients_total) chassis_metric_add_label(config->idle_clients_total, 1, 1);
+			evict--;
+
+			continue;
+		}
+
+		if (config->idle_release_time <= 0) break;
+
+		/* the others idle for a shorter time */
+		if (now - con->idle_since < (guint64)config->idle_release_time * G_USEC_PER_SEC) break;
+
+		if (NULL == con->server || st->multiplex_is_idle) continue;
+
+		proxy_multiplex_release(con);
+
+		if (st->multiplex_is_idle && config->idle_clients_total) chassis_metric_add_label(config->idle_clients_total, 0, 1);
+	}
+}
+
+/**
+ * close the pooled connections of this event-thread that idle for too long
+ *
+ * the pools of backends that a reload removed are emptied, as are all pools of a draining
+ * event-thread: its connections moved away, see chassis_event_threads_set_active()
+ *
+ * runs once a second in the event-thread which owns the pools
+ */
+static void proxy_pool_timer_handle(int G_GNUC_UNUSED event_fd, short G_GNUC_UNUSED events, void *user_data) {
+	proxy_pool_timer_t *timer = user_data;
+	network_backends_t *backends = timer->chas->priv->backends;
+	struct timeval tv = { 1, 0 };
+	gboolean is_draining = chassis_event_threads_is_draining(timer->chas->threads, chassis_event_thread_get_local());
+	GTimeVal now;
+	guint i;
+
+	chassis_coarse_clock_update();
+	chassis_get_coarse_current_time(&now);
+
+	for (i = 0; i < network_backends_count(backends); i++) {
+		network_backend_t *backend = network_backends_get(backends, i);
+		guint expired;
+
+		if (backend->is_removed || is_draining) {
+			expired = network_connection_pool_expire(network_backend_get_pool(backend, timer->thread_ndx),
+					&now, 0);
+		} else if (timer->config->pool_max_idle_time > 0) {
+			expired = network_connection_pool_expire(network_backend_get_pool(backend, timer->thread_ndx),
+					&now, timer->config->pool_max_idle_time);
+		} else {
+			continue;
+		}
+
+		if (expired > 0) {
+			g_debug("%s: closed %u idle connections to %s", G_STRLOC, expired, backend->addr->name->str);
+		}
+	}
+
+	if (timer->config->idle_release_time > 0 ||
+	    timer->config->idle_evict_connections > 0 ||
+	    timer->config->idle_evict_memory > 0) {
+		proxy_idle_clients_sweep(timer);
+	}
+
+	evtimer_add(&(timer->ev), &tv);
+}
+
+typedef struct {
+	chassis_plugin_config *config;
+
+	int changed;
+} proxy_lua_script_check_t;
+
+static void proxy_lua_script_check(gpointer user_data) {
+	proxy_lua_script_check_t *check = user_data;
+
+	check->changed = lua_scope_scripts_check();
+}
+
+/**
+ * the scripts are checked, wait for the next check
+ */
+static void proxy_lua_script_checked(gpointer user_data) {
+	proxy_lua_script_check_t *check = user_data;
+	chassis_plugin_config *config = check->config;
+	struct timeval tv = { config->lua_script_check_interval, 0 };
+
+	if (check->changed > 0) {
+		g_debug("%s: %d lua scripts changed, the connections will reload them", G_STRLOC, check->changed);
+	}
+	g_free(check);
+
+	evtimer_add(config->lua_script_check_timer, &tv);
+}
+
+/**
+ * check the loaded scripts for changes
+ *
+ * the timer runs in the main-thread, the stat()s in a worker. The event-threads pick up the
+ * changes on their next load
+ */
+static void proxy_lua_script_check_timer_handle(int G_GNUC_UNUSED event_fd, short G_GNUC_UNUSED events, void *user_data) {
+	chassis_plugin_config *config = user_data;
+	proxy_lua_script_check_t *check;
+
+	check = g_new0(proxy_lua_script_check_t, 1);
+	check->config = config;
+
+	chassis_worker_pool_push(config->workers, proxy_lua_script_check, proxy_lua_script_checked, check);
+}
+
+typedef struct {
+	chassis_plugin_config *config;
+
+	GPtrArray *backends;     /**< the network_backend_t with a host-name */
+	GPtrArray *hostnames;    /**< copies of their host-names, the worker doesn't touch the backends */
+	GPtrArray *resolved;     /**< a GPtrArray of network_address per backend, NULL if the lookup failed */
+} proxy_backend_dns_t;
+
+static void proxy_backend_dns_resolve(gpointer user_data) {
+	proxy_backend_dns_t *dns = user_data;
+	guint i, j;
+
+	for (i = 0; i < dns->hostnames->len; i++) {
+		GPtrArray *addrs = g_ptr_array_new();
+
+		if (0 != network_address_resolve(dns->hostnames->pdata[i], addrs) || 0 == addrs->len) {
+			for (j = 0; j < addrs->len; j++) network_address_free(addrs->pdata[j]);
+			g_ptr_array_free(addrs, TRUE);
+			addrs = NULL;
+		}
+
+		g_ptr_array_add(dns->resolved, addrs);
+	}
+}
+
+/**
+ * the host-names are resolved, new connections go to the new addresses
+ *
+ * a failed lookup keeps the old addresses. The open and pooled connections to the old
+ * addresses are used until they are closed.
+ */
+static void proxy_backend_dns_resolved(gpointer user_data) {
+	proxy_backend_dns_t *dns = user_data;
+	chassis_plugin_config *config = dns->config;
+	struct timeval tv = { config->backend_dns_ttl, 0 };
+	guint i;
+
+	for (i = 0; i < dns->backends->len; i++) {
+		network_backend_t *b = dns->backends->pdata[i];
+		GPtrArray *addrs = dns->resolved->pdata[i];
+
+		if (NULL == addrs) {
+			g_warning("%s: resolving backend %s failed, keeping its addresses", G_STRLOC, b->hostname);
+		} else if (network_backend_set_resolved(b, addrs)) {
+			g_message("%s: backend %s resolves to %u addresses now, new connections go to them",
+					G_STRLOC, b->hostname, addrs->len);
+		}
+	}
+
+	g_ptr_array_free(dns->backends, TRUE);
+	for (i = 0; i < dns->hostnames->len; i++) g_free(dns->hostnames->pdata[i]);
+	g_ptr_array_free(dns->hostnames, TRUE);
+	g_ptr_array_free(dns->resolved, TRUE);
+	g_free(dns);
+
+	evtimer_add(config->backend_dns_timer, &tv);
+}
+
+/**
+ * resolve the host-names of the backends again
+ *
+ * the timer runs in the main-thread, the lookups in a worker
+ */
+static void proxy_backend_dns_timer_handle(int G_GNUC_UNUSED event_fd, short G_GNUC_UNUSED events, void *user_data) {
+	chassis_plugin_config *config = user_data;
+	GPtrArray *backends = network_backends_get_snapshot(config->backend_dns_backends);
+	proxy_backend_dns_t *dns;
+	guint i;
+
+	dns = g_new0(proxy_backend_dns_t, 1);
+	dns->config = config;
+	dns->backends = g_ptr_array_new();
+	dns->hostnames = g_ptr_array_new();
+	dns->resolved = g_ptr_array_new();
+
+	for (i = 0; i < backends->len; i++) {
+		network_backend_t *b = backends->pdata[i];
+
+		if (NULL == b->hostname || b->is_removed) continue;
+
+		g_ptr_array_add(dns->backends, b);
+		g_ptr_array_add(dns->hostnames, g_strdup(b->hostname));
+	}
+
+	chassis_worker_pool_push(config->workers, proxy_backend_dns_resolve, proxy_backend_dns_resolved, dns);
+}
+
+chassis_plugin_config * network_mysqld_proxy_plugin_new(void) {
+	chassis_plugin_config *config;
+
+	config = g_new0(chassis_plugin_config, 1);
+	config->fix_bug_25371   = 0; /** double ERR packet on AUTH failures */
+	config->profiling       = 1;
+	config->start_proxy     = 1;
+	config->pool_change_user = 1; /* issue a COM_CHANGE_USER to cleanup the connection 
+					 when we get back the connection from the pool */
+
+	/* use negative values as defaults to make them ignored */
+	config->connect_timeout_dbl = -1.0;
+	config->read_timeout_dbl = -1.0;
+	config->write_timeout_dbl = -1.0;
+
+	config->health_check_max_lag = -1;
+	config->rw_split_affinity_load_factor = 125;
+	config->read_hedge_budget = 5.0;
+	config->breaker_half_open_share = 10;
+	config->mirror_sample = 0.01;
+	config->mirror_queue_size = 64;
+	config->mirror_connections = 4;
+	config->rate_limit_queue_size = 1024;
+	config->query_cache_ttl = 5.0;
+	config->query_log_sample = 1;
+	config->admission_queue_size = 1024;
+	config->admission_queue_timeout = 5000;
+	config->multiplex_wait_timeout = 1000;
+	config->send_queue_high_watermark = 64 * 1024;
+	config->shared_dict_size = 16 * 1024 * 1024;
+	config->lua_script_check_interval = 1;
+
+	return config;
+}
+
+void network_mysqld_proxy_plugin_free(chassis_plugin_config *config) {
+	gsize i;
+
+	if (config->listen_con) {
+		/**
+		 * the connection will be free()ed by the network_mysqld_free()
+		 */
+#if 0
+		event_del(&(config->listen_con->server->event));
+		network_mysqld_con_free(config->listen_con);
+#endif
+	}
+
+	if (config->backend_addresses) {
+		for (i = 0; config->backend_addresses[i]; i++) {
+			g_free(config->backend_addresses[i]);
+		}
+		g_free(config->backend_addresses);
+	}
+
+	if (config->backend_groups) g_strfreev(config->backend_groups);
+	if (config->backend_source_addresses) g_strfreev(config->backend_source_addresses);
+
+	if (config->address) {
+		/* free the global scope */
+		network_mysqld_proxy_free(NULL);
+
+		g_free(config->address);
+	}
+
+	if (config->lua_script) g_free(config->lua_script);
+
+	if (config->lua_script_check_timer) {
+		evtimer_del(config->lua_script_check_timer);
+		g_free(config->lua_script_check_timer);
+
+		lua_scope_scripts_set_watched(FALSE);
+	}
+
+	if (config->backend_dns_timer) {
+		evtimer_del(config->backend_dns_timer);
+		g_free(config->backend_dns_timer);
+	}
+
+	if (config->pool_timers) {
+		/* the event-threads are stopped already, we can remove the events from their event-bases */
+		for (i = 0; i < config->pool_timers->len; i++) {
+			proxy_pool_timer_t *timer = config->pool_timers->pdata[i];
+
+			evtimer_del(&(timer->ev));
+			g_free(timer);
+		}
+		g_ptr_array_free(config->pool_timers, TRUE);
+	}
+
+	if (config->health) network_backends_health_free(config->health);
+
+	/* flushes the queued entries */
+	if (config->query_log) network_query_log_free(config->query_log);
+	if (config->query_log_filename) g_free(config->query_log_filename);
+	if (config->backend_local_socket) g_free(config->backend_local_socket);
+	if (config->trace) network_trace_free(config->trace);
+	if (config->trace_address) g_free(config->trace_address);
+	if (config->capture) network_capture_free(config->capture);
+	if (config->capture_filename) g_free(config->capture_filename);
+	if (config->admission) network_admission_free(config->admission);
+	if (config->auth_cache) network_auth_cache_free(config->auth_cache);
+	if (config->auth_cache_filename) g_free(config->auth_cache_filename);
+	if (config->query_timeouts) network_query_timeouts_free(config->query_timeouts);
+	if (config->shard_router) network_shard_router_free(config->shard_router);
+	if (config->query_rules) network_query_rules_free(config->query_rules);
+	if (config->query_rules_filename) g_free(config->query_rules_filename);
+	if (config->shard_map_filename) g_free(config->shard_map_filename);
+	if (config->rw_split_affinity) g_free(config->rw_split_affinity);
+	if (config->rw_split_affinity_map) network_shard_map_free(config->rw_split_affinity_map);
+	if (config->read_hedge) network_read_hedge_free(config->read_hedge);
+	if (config->stmt_promote) network_stmt_promote_free(config->stmt_promote);
+	if (config->query_timeout_filename) g_free(config->query_timeout_filename);
+	if (config->lazy_challenge) network_mysqld_auth_challenge_free(config->lazy_challenge);
+	if (config->lazy_challenge_mutex) g_mutex_free(config->lazy_challenge_mutex);
+	if (config->health_check_user) g_free(config->health_check_user);
+	if (config->health_check_password) g_free(config->health_check_password);
+	if (config->health_check_query) g_free(config->health_check_query);
+	if (config->mirror) network_mirror_free(config->mirror);
+	if (config->mirror_backend) g_free(config->mirror_backend);
+	if (config->mirror_user) g_free(config->mirror_user);
+	if (config->mirror_password) g_free(config->mirror_password);
+	if (config->rate_limits) g_strfreev(config->rate_limits);
+	if (config->firewall_filename) g_free(config->firewall_filename);
+
+	if (config->ssl_ctx) network_ssl_ctx_free(config->ssl_ctx);
+	if (config->backend_ssl_ctx) network_ssl_ctx_free(config->backend_ssl_ctx);
+	if (config->ssl_cert) g_free(config->ssl_cert);
+	if (config->ssl_key) g_free(config->ssl_key);
+	if (config->ssl_ticket_key) g_free(config->ssl_ticket_key);
+	if (config->backend_ssl_ca) g_free(config->backend_ssl_ca);
+
+	g_free(config);
+}
+
+/**
+ * plugin options 
+ */
+static GOptionEntry * network_mysqld_proxy_plugin_get_options(chassis_plugin_config *config) {
+	guint i;
+
+	/* make sure it isn't collected */
+	static GOptionEntry config_entries[] = 
+	{
+		{ "proxy-address",            'P', 0, G_OPTION_ARG_STRING, NULL, "listening address:port of the proxy-server (default: :4040)", "<host:port>" },
+		{ "proxy-read-only-backend-addresses", 
+					      'r', 0, G_OPTION_ARG_STRING_ARRAY, NULL, "address:port of the remote slave-server (default: not set)", "<host:port>" },
+		{ "proxy-backend-addresses",  'b', 0, G_OPTION_ARG_STRING_ARRAY, NULL, "address:port of the remote backend-servers (default: 127.0.0.1:3306)", "<host:port>" },
+		{ "proxy-backend-group",      0, 0, G_OPTION_ARG_STRING_ARRAY, NULL, "a named group of backends with its own policy, pool limits, max lag and max queries (default: no groups)", "<name>[(<option>=<value>[,...])]=<host:port>[,...]" },
+		
+		{ "proxy-skip-profiling",     0, G_OPTION_FLAG_REVERSE, G_OPTION_ARG_NONE, NULL, "disables profiling of queries (default: enabled)", NULL },
+
+		{ "proxy-fix-bug-25371",      0, 0, G_OPTION_ARG_NONE, NULL, "fix bug #25371 (mysqld > 5.1.12) for older libmysql versions", NULL },
+		{ "proxy-lua-script",         's', 0, G_OPTION_ARG_FILENAME, NULL, "filename of the lua script (default: not set)", "<file>" },
+		{ "proxy-lua-script-check-interval", 0, 0, G_OPTION_ARG_INT, NULL, "check the lua scripts for changes every <secs> seconds, 0 to check them on each new connection (default: 1)", "<secs>" },
+		
+		{ "no-proxy",                 0, G_OPTION_FLAG_REVERSE, G_OPTION_ARG_NONE, NULL, "don't start the proxy-module (default: enabled)", NULL },
+		
+		{ "proxy-pool-no-change-user", 0, G_OPTION_FLAG_REVERSE, G_OPTION_ARG_NONE, NULL, "don't use CHANGE_USER or RESET_CONNECTION to reset the connection coming from the pool (default: enabled)", NULL },
+		{ "proxy-auth-cache-file",    0, 0, G_OPTION_ARG_FILENAME, NULL, "check the logins of the users in <file> on pooled connections of the same user without CHANGE_USER (default: disabled)", "<file>" },
+		{ "proxy-lazy-connect",       0, 0, G_OPTION_ARG_NONE, NULL, "auth the clients against --proxy-auth-cache-file and connect to a backend at their first query (default: disabled)", NULL },
+
+		{ "proxy-connect-timeout",    0, 0, G_OPTION_ARG_DOUBLE, NULL, "connect timeout in seconds (default: 2.0 seconds)", NULL },
+		{ "proxy-breaker-error-rate", 0, 0, G_OPTION_ARG_INT, NULL, "mark a backend as down if <percent> of its queries in the last 10 seconds failed or were too slow (default: 0, only failed connects)", "<percent>" },
+		{ "proxy-breaker-slow-query", 0, 0, G_OPTION_ARG_INT, NULL, "a query that runs longer than <ms> milliseconds on a backend counts as failed (default: 0, disabled)", "<ms>" },
+		{ "proxy-breaker-half-open-share", 0, 0, G_OPTION_ARG_INT, NULL, "a backend that was down gets <percent> of its share of the clients until 20 of its connects and queries succeeded (default: 10)", "<percent>" },
+		{ "proxy-connect-hedge-delay", 0, 0, G_OPTION_ARG_INT, NULL, "also connect to another backend of the same type if the first one didn't connect within <ms> milliseconds, the first to connect is used (default: 0, disabled)", "<ms>" },
+		{ "proxy-read-timeout",    0, 0, G_OPTION_ARG_DOUBLE, NULL, "read timeout in seconds (default: 8 hours)", NULL },
+		{ "proxy-write-timeout",    0, 0, G_OPTION_ARG_DOUBLE, NULL, "write timeout in seconds (default: 8 hours)", NULL },
+		{ "proxy-query-timeout",      0, 0, G_OPTION_ARG_DOUBLE, NULL, "KILL QUERY on the backend if a query runs longer than <secs> seconds (default: 0, disabled)", "<secs>" },
+		{ "proxy-query-timeout-file", 0, 0, G_OPTION_ARG_FILENAME, NULL, "budgets of single queries, a line of <secs> and the query each, they override --proxy-query-timeout (default: not set)", "<file>" },
+
+		{ "proxy-listen-reuseport",   0, 0, G_OPTION_ARG_NONE, NULL, "each event-thread accepts and handles the connections of its own SO_REUSEPORT listen socket (default: disabled)", NULL },
+		{ "proxy-backend-dns-ttl",    0, 0, G_OPTION_ARG_INT, NULL, "resolve the host-names of the backends again every <secs> seconds, new connections go to the new addresses (default: 0, only at the start)", "<secs>" },
+		{ "proxy-pool-max-idle-time", 0, 0, G_OPTION_ARG_INT, NULL, "close pooled connections which idle for more than <secs> seconds, keep it below the wait_timeout of the backends (default: 0, disabled)", "<secs>" },
+		{ "proxy-rw-split",           0, 0, G_OPTION_ARG_NONE, NULL, "send SELECTs outside of transactions to the read-only backends (default: disabled)", NULL },
+		{ "proxy-rw-split-read-your-writes", 0, 0, G_OPTION_ARG_NONE, NULL, "after a write only send SELECTs to read-only backends that replicated it, needs the health-check (default: disabled)", NULL },
+		{ "proxy-rw-split-affinity",  0, 0, G_OPTION_ARG_STRING, NULL, "send the SELECTs of a user, a default database or a value of a column to the same read-only backend (default: the fastest backend)", "<user|db|column:<name>>" },
+		{ "proxy-rw-split-affinity-load-factor", 0, 0, G_OPTION_ARG_INT, NULL, "a read-only backend takes the keys of a full one once it has <percent> of the average clients (default: 125)", "<percent>" },
+		{ "proxy-read-hedge-percentile", 0, 0, G_OPTION_ARG_DOUBLE, NULL, "also send a SELECT to a second read-only backend if its first packet takes longer than <p> percent of the SELECTs with the same fingerprint, the first to answer is used (default: 0, disabled)", "<p>" },
+		{ "proxy-read-hedge-budget",  0, 0, G_OPTION_ARG_DOUBLE, NULL, "send at most <percent> of the SELECTs to a second read-only backend (default: 5)", "<percent>" },
+		{ "proxy-shard-map-file",     0, 0, G_OPTION_ARG_FILENAME, NULL, "send the queries with a shard key to the backends of their shard and those of the sharded tables without a key to all shards, the map is re-read on a reload (default: not set)", "<file>" },
+		{ "proxy-multiplex",          0, 0, G_OPTION_ARG_NONE, NULL, "give the backend connection back to the pool after each statement outside of a transaction (default: disabled)", NULL },
+		{ "proxy-multiplex-wait-timeout", 0, 0, G_OPTION_ARG_INT, NULL, "a statement waits up to <msecs> milliseconds for a pooled connection of its session if another client has it (default: 1000)", "<msecs>" },
+		{ "proxy-idle-release-time",  0, 0, G_OPTION_ARG_INT, NULL, "give the backend connection of a client idling for more than <secs> seconds outside of a transaction back to the pool (default: 0, disabled)", "<secs>" },
+		{ "proxy-idle-evict-connections", 0, 0, G_OPTION_ARG_INT, NULL, "over <n> open client connections close the longest idling clients (default: 0, disabled)", "<n>" },
+		{ "proxy-idle-evict-memory",  0, 0, G_OPTION_ARG_INT, NULL, "over <MB> used by the client connections close the longest idling clients (default: 0, disabled)", "<MB>" },
+		{ "proxy-pipeline-injections", 0, 0, G_OPTION_ARG_NONE, NULL, "send the queries injected by the lua script at once instead of one round-trip each (default: disabled)", NULL },
+		{ "proxy-local-answers",      0, 0, G_OPTION_ARG_NONE, NULL, "answer COM_PING, COM_QUIT, SELECT @@version_comment LIMIT 1 and SET NAMES or SET autocommit=1 that change nothing without the backend (default: disabled)", NULL },
+		{ "proxy-client-compress",    0, 0, G_OPTION_ARG_NONE, NULL, "allow the clients to use the compressed protocol (default: disabled)", NULL },
+		{ "proxy-backend-compress",   0, 0, G_OPTION_ARG_NONE, NULL, "use the compressed protocol to the backends if they support it (default: disabled)", NULL },
+		{ "proxy-ssl-cert",           0, 0, G_OPTION_ARG_FILENAME, NULL, "offer TLS to the clients with the certificate (chain) in <file> (default: not set)", "<file>" },
+		{ "proxy-ssl-key",            0, 0, G_OPTION_ARG_FILENAME, NULL, "private key of --proxy-ssl-cert (default: in the certificate file)", "<file>" },
+		{ "proxy-ssl-ticket-key",     0, 0, G_OPTION_ARG_FILENAME, NULL, "48 byte session-ticket key to share the TLS sessions between several proxies (default: random)", "<file>" },
+		{ "proxy-backend-ssl",        0, 0, G_OPTION_ARG_NONE, NULL, "use TLS to the backends if they support it (default: disabled)", NULL },
+		{ "proxy-backend-ssl-ca",     0, 0, G_OPTION_ARG_FILENAME, NULL, "verify the certificates and the host-names of the backends against the CAs in <file>, backends without TLS are refused (default: not verified)", "<file>" },
+
+		{ "proxy-health-check-interval", 0, 0, G_OPTION_ARG_DOUBLE, NULL, "check the backends every <secs> seconds in the background (default: 0, disabled)", "<secs>" },
+		{ "proxy-health-check-user",  0, 0, G_OPTION_ARG_STRING, NULL, "login as <user> for the health-check query (default: only check the handshake)", "<user>" },
+		{ "proxy-health-check-password", 0, 0, G_OPTION_ARG_STRING, NULL, "password of the health-check user (default: empty)", "<password>" },
+		{ "proxy-health-check-query", 0, 0, G_OPTION_ARG_STRING, NULL, "query to send as health-check (default: COM_PING)", "<query>" },
+		{ "proxy-health-check-max-lag", 0, 0, G_OPTION_ARG_INT, NULL, "mark read-only backends as lagging if they are more than <secs> seconds behind the master (default: disabled)", "<secs>" },
+
+		{ "proxy-mirror-backend",     0, 0, G_OPTION_ARG_STRING, NULL, "send a sample of the reads to the backend at <host:port> too and compare the results (default: disabled)", "<host:port>" },
+		{ "proxy-mirror-user",        0, 0, G_OPTION_ARG_STRING, NULL, "login as <user> on the mirror backend (default: empty)", "<user>" },
+		{ "proxy-mirror-password",    0, 0, G_OPTION_ARG_STRING, NULL, "password of the mirror user (default: empty)", "<password>" },
+		{ "proxy-mirror-sample",      0, 0, G_OPTION_ARG_DOUBLE, NULL, "mirror this share of the reads outside of transactions (default: 0.01)", "<0.0-1.0>" },
+		{ "proxy-mirror-queue-size",  0, 0, G_OPTION_ARG_INT, NULL, "let at most <n> queries per event-thread wait for the mirror, drop the others (default: 64)", "<n>" },
+		{ "proxy-mirror-connections", 0, 0, G_OPTION_ARG_INT, NULL, "open at most <n> connections per event-thread to the mirror (default: 4)", "<n>" },
+
+		{ "proxy-rate-limit",         0, 0, G_OPTION_ARG_STRING_ARRAY, NULL, "limit the queries of a user, client or digest to <rate> per second, delay them up to <ms> or reject them (default: no limits)", "<key>:<rate>[:<burst>[:<ms>]]=<match>" },
+		{ "proxy-rate-limit-queue-size", 0, 0, G_OPTION_ARG_INT, NULL, "let at most <n> queries wait for their rate limit, reject the others (default: 1024)", "<n>" },
+
+		{ "proxy-firewall-file",      0, 0, G_OPTION_ARG_FILENAME, NULL, "allow or deny the queries by the rules in <file> before the scripts see them (default: disabled)", "<file>" },
+
+		{ "proxy-query-cache-size",   0, 0, G_OPTION_ARG_INT, NULL, "cache the results of read-only queries in up to <bytes> of memory (default: 0, disabled)", "<bytes>" },
+		{ "proxy-query-cache-ttl",    0, 0, G_OPTION_ARG_DOUBLE, NULL, "serve cached results for <secs> seconds (default: 5.0)", "<secs>" },
+
+		{ "proxy-query-digest-size",  0, 0, G_OPTION_ARG_INT, NULL, "keep the stats of up to <n> normalized queries per event-thread (default: 0, disabled)", "<n>" },
+
+		{ "proxy-shared-dict-size",   0, 0, G_OPTION_ARG_INT, NULL, "let the scripts store up to <bytes> in proxy.shared (default: 16777216)", "<bytes>" },
+
+		{ "proxy-query-log",          0, 0, G_OPTION_ARG_FILENAME, NULL, "log the queries as JSON lines to <file> (default: disabled)", "<file>" },
+		{ "proxy-query-log-min-time", 0, 0, G_OPTION_ARG_DOUBLE, NULL, "only log queries that took at least <secs> seconds (default: 0, all)", "<secs>" },
+		{ "proxy-query-log-sample",   0, 0, G_OPTION_ARG_INT, NULL, "only log every <n>th of these queries (default: 1)", "<n>" },
+
+		{ "proxy-capture",            0, 0, G_OPTION_ARG_FILENAME, NULL, "capture the packets of the clients to <file> for --loadgen-replay (default: disabled)", "<file>" },
+
+		{ "proxy-backend-max-queries", 0, 0, G_OPTION_ARG_INT, NULL, "send at most <n> queries at once to each backend, the others wait (default: 0, unlimited)", "<n>" },
+		{ "proxy-user-max-queries",   0, 0, G_OPTION_ARG_INT, NULL, "send at most <n> queries of each user at once to the backends, the others wait (default: 0, unlimited)", "<n>" },
+		{ "proxy-admission-queue-size", 0, 0, G_OPTION_ARG_INT, NULL, "let at most <n> queries wait for the limits, reject the others (default: 1024)", "<n>" },
+		{ "proxy-admission-queue-timeout", 0, 0, G_OPTION_ARG_INT, NULL, "fail queries that waited for more than <msecs> milliseconds (default: 5000)", "<msecs>" },
+
+		{ "proxy-send-queue-high-watermark", 0, 0, G_OPTION_ARG_INT, NULL, "stop reading a result from the backend while more than <bytes> wait for the client (default: 65536)", "<bytes>" },
+		{ "proxy-send-queue-low-watermark", 0, 0, G_OPTION_ARG_INT, NULL, "read the result again once the client took all but <bytes> (default: 0)", "<bytes>" },
+		{ "proxy-send-queue-budget",  0, 0, G_OPTION_ARG_INT, NULL, "keep the results waiting for all clients below <mbytes>, the connections pause at their low watermark above it (default: 0, unlimited)", "<mbytes>" },
+		{ "proxy-result-spool-threshold", 0, 0, G_OPTION_ARG_INT, NULL, "read the results from the backend at full speed and spool what is above <kbytes> to a temporary file for the client (default: 0, disabled)", "<kbytes>" },
+		{ "proxy-query-hints",        0, 0, G_OPTION_ARG_NONE, NULL, "route, cache and time queries by the /*proxy: ro|rw, group=<name>, cache_ttl=<secs>, nocache, timeout=<secs> */ comment in front of them (default: disabled)", NULL },
+		{ "proxy-query-rules-file",   0, 0, G_OPTION_ARG_FILENAME, NULL, "give the queries the hints of the first rule in <file> that matches their user, db, command and statement class, the rules are re-read on a reload (default: disabled)", "<file>" },
+		{ "proxy-backend-local-socket", 0, 0, G_OPTION_ARG_STRING, NULL, "connect to the backends on this host through the unix-socket <path> instead of TCP, \"auto\" to look for the socket of a mysqld on port 3306 (default: disabled)", "<path|auto>" },
+		{ "proxy-trace-address",      0, 0, G_OPTION_ARG_STRING, NULL, "send the spans of the queries a /*proxy: traceparent=<context> */ hint samples as OTLP/JSON datagrams to <host:port> (default: disabled)", "<host:port>" },
+		{ "proxy-trace-sample",       0, 0, G_OPTION_ARG_INT, NULL, "also trace every <n>th query without a trace-context (default: 0, none)", "<n>" },
+		{ "proxy-stmt-promote-threshold", 0, 0, G_OPTION_ARG_INT, NULL, "execute the SELECTs whose shape was seen <n> times as prepared statements on the backends (default: 0, disabled)", "<n>" },
+		{ "proxy-backend-source-addresses", 0, 0, G_OPTION_ARG_STRING_ARRAY, NULL, "connect to all backends or to the backend <host:port> from these local IPs in turn, each has its own ephemeral ports (default: picked by the kernel)", "[<host:port>=]<ip>[,...]" },
+		
+		{ NULL,                       0, 0, G_OPTION_ARG_NONE,   NULL, NULL, NULL }
+	};
+
+	i = 0;
+	config_entries[i++].arg_data = &(config->address);
+	config_entries[i++].arg_data = &(config->read_only_backend_addresses);
+	config_entries[i++].arg_data = &(config->backend_addresses);
+	config_entries[i++].arg_data = &(config->backend_groups);
+
+	config_entries[i++].arg_data = &(config->profiling);
+
+	config_entries[i++].arg_data = &(config->fix_bug_25371);
+	config_entries[i++].arg_data = &(config->lua_script);
+	config_entries[i++].arg_data = &(config->lua_script_check_interval);
+	config_entries[i++].arg_data = &(config->start_proxy);
+	config_entries[i++].arg_data = &(config->pool_change_user);
+	config_entries[i++].arg_data = &(config->auth_cache_filename);
+	config_entries[i++].arg_data = &(config->lazy_connect);
+	config_entries[i++].arg_data = &(config->connect_timeout_dbl);
+	config_entries[i++].arg_data = &(config->breaker_error_rate);
+	config_entries[i++].arg_data = &(config->breaker_slow_query);
+	config_entries[i++].arg_data = &(config->breaker_half_open_share);
+	config_entries[i++].arg_data = &(config->connect_hedge_delay);
+	config_entries[i++].arg_data = &(config->read_timeout_dbl);
+	config_entries[i++].arg_data = &(config->write_timeout_dbl);
+	config_entries[i++].arg_data = &(config->query_timeout);
+	config_entries[i++].arg_data = &(config->query_timeout_filename);
+	config_entries[i++].arg_data = &(config->listen_reuseport);
+	config_entries[i++].arg_data = &(config->backend_dns_ttl);
+	config_entries[i++].arg_data = &(config->pool_max_idle_time);
+	config_entries[i++].arg_data = &(config->rw_split);
+	config_entries[i++].arg_data = &(config->rw_split_read_your_writes);
+	config_entries[i++].arg_data = &(config->rw_split_affinity);
+	config_entries[i++].arg_data = &(config->rw_split_affinity_load_factor);
+	config_entries[i++].arg_data = &(config->read_hedge_percentile);
+	config_entries[i++].arg_data = &(config->read_hedge_budget);
+	config_entries[i++].arg_data = &(config->shard_map_filename);
+	config_entries[i++].arg_data = &(config->multiplex);
+	config_entries[i++].arg_data = &(config->multiplex_wait_timeout);
+	config_entries[i++].arg_data = &(config->idle_release_time);
+	config_entries[i++].arg_data = &(config->idle_evict_connections);
+	config_entries[i++].arg_data = &(config->idle_evict_memory);
+	config_entries[i++].arg_data = &(config->pipeline_injections);
+	config_entries[i++].arg_data = &(config->local_answers);
+	config_entries[i++].arg_data = &(config->client_compress);
+	config_entries[i++].arg_data = &(config->backend_compress);
+	config_entries[i++].arg_data = &(config->ssl_cert);
+	config_entries[i++].arg_data = &(config->ssl_key);
+	config_entries[i++].arg_data = &(config->ssl_ticket_key);
+	config_entries[i++].arg_data = &(config->backend_ssl);
+	config_entries[i++].arg_data = &(config->backend_ssl_ca);
+	config_entries[i++].arg_data = &(config->health_check_interval);
+	config_entries[i++].arg_data = &(config->health_check_user);
+	config_entries[i++].arg_data = &(config->health_check_password);
+	config_entries[i++].arg_data = &(config->health_check_query);
+	config_entries[i++].arg_data = &(config->health_check_max_lag);
+	config_entries[i++].arg_data = &(config->mirror_backend);
+	config_entries[i++].arg_data = &(config->mirror_user);
+	config_entries[i++].arg_data = &(config->mirror_password);
+	config_entries[i++].arg_data = &(config->mirror_sample);
+	config_entries[i++].arg_data = &(config->mirror_queue_size);
+	config_entries[i++].arg_data = &(config->mirror_connections);
+	config_entries[i++].arg_data = &(config->rate_limits);
+	config_entries[i++].arg_data = &(config->rate_limit_queue_size);
+	config_entries[i++].arg_data = &(config->firewall_filename);
+	config_entries[i++].arg_data = &(config->query_cache_size);
+	config_entries[i++].arg_data = &(config->query_cache_ttl);
+	config_entries[i++].arg_data = &(config->query_digest_size);
+	config_entries[i++].arg_data = &(config->shared_dict_size);
+	config_entries[i++].arg_data = &(config->query_log_filename);
+	config_entries[i++].arg_data = &(config->query_log_min_time);
+	config_entries[i++].arg_data = &(config->query_log_sample);
+	config_entries[i++].arg_data = &(config->capture_filename);
+	config_entries[i++].arg_data = &(config->backend_max_queries);
+	config_entries[i++].arg_data = &(config->user_max_queries);
+	config_entries[i++].arg_data = &(config->admission_queue_size);
+	config_entries[i++].arg_data = &(config->admission_queue_timeout);
+	config_entries[i++].arg_data = &(config->send_queue_high_watermark);
+	config_entries[i++].arg_data = &(config->send_queue_low_watermark);
+	config_entries[i++].arg_data = &(config->send_queue_budget);
+	config_entries[i++].arg_data = &(config->result_spool_threshold);
+	config_entries[i++].arg_data = &(config->query_hints);
+	config_entries[i++].arg_data = &(config->query_rules_filename);
+	config_entries[i++].arg_data = &(config->backend_local_socket);
+	config_entries[i++].arg_data = &(config->trace_address);
+	config_entries[i++].arg_data = &(config->trace_sample);
+	config_entries[i++].arg_data = &(config->stmt_promote_threshold);
+	config_entries[i++].arg_data = &(config->backend_source_addresses);
+
+	return config_entries;
+}
+
+/**
+ * open a listen socket for the proxy on the event-base of a event-thread 
+ *
+ * the accepted connections are handled by the thread of the event-base as
+ * chassis_event_add() keeps the events of the worker-threads local
+ *
+ * @return the connection of the listen socket, NULL on error
+ */
+static network_mysqld_con *network_mysqld_proxy_plugin_listen(chassis *chas, chassis_plugin_config *config, struct event_base *event_base, gboolean reuse_port) {
+	network_mysqld_con *con;
+	network_socket *listen_sock;
+
+	/** 
+	 * create a connection handle for the listen socket 
+	 */
+	con = network_mysqld_con_new();
+	network_mysqld_add_connection(chas, con);
+	con->config = config;
+
+	listen_sock = network_socket_new();
+	listen_sock->reuse_port = reuse_port;
+	con->server = listen_sock;
+
+	/* set the plugin hooks as we want to apply them to the new connections too later */
+	network_mysqld_proxy_connection_init(con);
+
+	if (0 != network_address_set_address(listen_sock->dst, config->address)) {
+		return NULL;
+	}
+
+	if (0 != network_socket_bind(listen_sock)) {
+		return NULL;
+	}
+
+	/**
+	 * call network_mysqld_con_accept() with this connection when we are done
+	 */
+	event_set(&(listen_sock->event), listen_sock->fd, EV_READ|EV_PERSIST, network_mysqld_con_accept, con);
+	event_base_set(event_base, &(listen_sock->event));
+	event_add(&(listen_sock->event), NULL);
+
+	return con;
+}
+
+static gchar **proxy_keyfile_get_addresses(GKeyFile *keyfile, const gchar *key) {
+	gchar **addresses;
+	gsize i;
+
+	if (NULL == (addresses = g_key_file_get_string_list(keyfile, "mysql-proxy", key, NULL, NULL))) {
+		return NULL;
+	}
+
+	for (i = 0; addresses[i]; i++) {
+		g_strstrip(addresses[i]);
+	}
+
+	return addresses;
+}
+
+/**
+ * apply the backends of the re-read config-file and re-read the shard map and the query rules
+ *
+ * unchanged backends keep their connection pools, see network_backends_reload().
+ * If the file has neither of the backend options, the backends came from the
+ * command-line and stay as they are. A shard map or query rules with errors are
+ * ignored, the current ones stay.
+ */
+int network_mysqld_proxy_plugin_reload_config(chassis *chas, chassis_plugin_config *config, GKeyFile *keyfile) {
+	chassis_private *g = chas->priv;
+	gchar **rw_addresses, **ro_addresses;
+	int changed;
+	int ret = 0;
+
+	if (!config->start_proxy) return 0;
+
+	if (config->shard_router) {
+		GError *gerr = NULL;
+
+		if (0 != network_shard_router_load(config->shard_router, config->shard_map_filename, &gerr)) {
+			g_critical("%s: --proxy-shard-map-file: %s, keeping the current shard map", G_STRLOC, gerr->message);
+			g_clear_error(&gerr);
+			ret = -1;
+		}
+	}
+
+	if (config->query_rules) {
+		GError *gerr = NULL;
+
+		if (0 != network_query_rules_load(config->query_rules, config->query_rules_filename, &gerr)) {
+			g_critical("%s: --proxy-query-rules-file: %s, keeping the current rules", G_STRLOC, gerr->message);
+			g_clear_error(&gerr);
+			ret = -1;
+		} else {
+			g_message("%s: reloaded the query rules of %s", G_STRLOC, config->query_rules_filename);
+		}
+	}
+
+	rw_addresses = proxy_keyfile_get_addresses(keyfile, "proxy-backend-addresses");
+	ro_addresses = proxy_keyfile_get_addresses(keyfile, "proxy-read-only-backend-addresses");
+
+	if (!rw_addresses && !ro_addresses) {
+		g_message("%s: the config-file has no backends, keeping the current ones", G_STRLOC);
+		return ret;
+	}
+
+	/* the same default as in apply_config() */
+	if (!rw_addresses) {
+		rw_addresses = g_new0(gchar *, 2);
+		rw_addresses[0] = g_strdup("127.0.0.1:3306");
+	}
+
+	changed = network_backends_reload(g->backends, rw_addresses, ro_addresses);
+
+	g_strfreev(rw_addresses);
+	g_strfreev(ro_addresses);
+
+	if (changed < 0) return -1;
+
+	g_message("%s: reloaded the backends, %d changed", G_STRLOC, changed);
+
+	return ret;
+}
+
+static const guint64 proxy_admission_wait_bounds[] = {
+	100, 250, 500,
+	1000, 2500, 5000,
+	10000, 25000, 50000,
+	100000, 250000, 500000,
+	1000000, 2500000, 5000000
+};
+
+/**
+ * report the queries in flight and waiting per backend and the decisions of the admission control
+ */
+static void proxy_admission_collect_metrics(chassis_metrics_t G_GNUC_UNUSED *metrics, GString *out, gpointer user_data) {
+	chassis_plugin_config *config = user_data;
+	GPtrArray *backends = network_backends_get_snapshot(config->admission_backends);
+	GPtrArray *names = g_ptr_array_sized_new(backends->len);
+	guint i;
+
+	for (i = 0; i < backends->len; i++) {
+		network_backend_t *b = backends->pdata[i];
+
+		g_ptr_array_add(names, b->addr->name->str);
+	}
+
+	network_admission_append_metrics(config->admission, out, names);
+
+	g_ptr_array_free(names, TRUE);
+}
+
+static void proxy_auth_cache_collect_metrics(chassis_metrics_t G_GNUC_UNUSED *metrics, GString *out, gpointer user_data) {
+	chassis_plugin_config *config = user_data;
+	guint64 hits, misses;
+
+	g_mutex_lock(config->auth_cache->mutex);
+	hits = config->auth_cache->hits;
+	misses = config->auth_cache->misses;
+	g_mutex_unlock(config->auth_cache->mutex);
+
+	chassis_metrics_append_header(out, "mysql_proxy_auth_cache_total", "Logins on pooled connections of the same user by auth-cache result", CHASSIS_METRIC_COUNTER);
+	chassis_metrics_append_value(out, "mysql_proxy_auth_cache_total", "result=\"hit\"", hits);
+	chassis_metrics_append_value(out, "mysql_proxy_auth_cache_total", "result=\"miss\"", misses);
+}
+
+static void proxy_mirror_collect_metrics(chassis_metrics_t G_GNUC_UNUSED *metrics, GString *out, gpointer user_data) {
+	chassis_plugin_config *config = user_data;
+	guint64 mirrored, shed, failed, mismatches;
+	GPtrArray *entries;
+	GString *labels;
+	guint i;
+
+	entries = network_mirror_get_entries(config->mirror, &mirrored, &shed, &failed, &mismatches);
+
+	chassis_metrics_append_header(out, "mysql_proxy_mirror_queries_total", "Reads sampled for the mirror backend by result", CHASSIS_METRIC_COUNTER);
+	chassis_metrics_append_value(out, "mysql_proxy_mirror_queries_total", "result=\"mirrored\"", mirrored);
+	chassis_metrics_append_value(out, "mysql_proxy_mirror_queries_total", "result=\"shed\"", shed);
+	chassis_metrics_append_value(out, "mysql_proxy_mirror_queries_total", "result=\"failed\"", failed);
+	chassis_metrics_append_value(out, "mysql_proxy_mirror_queries_total", "result=\"mismatch\"", mismatches);
+
+	labels = g_string_new(NULL);
+
+	chassis_metrics_append_header(out, "mysql_proxy_mirror_query_seconds_total", "Time the primary and the mirror backend took for the mirrored queries by fingerprint", CHASSIS_METRIC_COUNTER);
+	for (i = 0; i < entries->len; i++) {
+		network_mirror_entry_t *entry = entries->pdata[i];
+
+		g_string_printf(labels, "digest=\"%016"G_GINT64_MODIFIER"x\",target=\"primary\"", entry->hash);
+		chassis_metrics_append_value(out, "mysql_proxy_mirror_query_seconds_total", labels->str, entry->primary_usec / (gdouble)G_USEC_PER_SEC);
+		g_string_printf(labels, "digest=\"%016"G_GINT64_MODIFIER"x\",target=\"mirror\"", entry->hash);
+		chassis_metrics_append_value(out, "mysql_proxy_mirror_query_seconds_total", labels->str, entry->mirror_usec / (gdouble)G_USEC_PER_SEC);
+	}
+
+	chassis_metrics_append_header(out, "mysql_proxy_mirror_compared_total", "Mirrored queries both backends answered by fingerprint and result", CHASSIS_METRIC_COUNTER);
+	for (i = 0; i < entries->len; i++) {
+		network_mirror_entry_t *entry = entries->pdata[i];
+
+		g_string_printf(labels, "digest=\"%016"G_GINT64_MODIFIER"x\",result=\"match\"", entry->hash);
+		chassis_metrics_append_value(out, "mysql_proxy_mirror_compared_total", labels->str, entry->count - entry->mismatches);
+		g_string_printf(labels, "digest=\"%016"G_GINT64_MODIFIER"x\",result=\"mismatch\"", entry->hash);
+		chassis_metrics_append_value(out, "mysql_proxy_mirror_compared_total", labels->str, entry->mismatches);
+
+		network_mirror_entry_free(entry);
+	}
+
+	g_string_free(labels, TRUE);
+	g_ptr_array_free(entries, TRUE);
+}
+
+/**
+ * init the plugin with the parsed config
+ */
+int network_mysqld_proxy_plugin_apply_config(chassis *chas, chassis_plugin_config *config) {
+	network_mysqld_con *con;
+	chassis_private *g = chas->priv;
+	guint i;
+
+	if (!config->start_proxy) {
+		return 0;
+	}
+
+	if (!config->address) config->address = g_strdup(":4040");
+	if (!config->backend_addresses) {
+		config->backend_addresses = g_new0(char *, 2);
+		config->backend_addresses[0] = g_strdup("127.0.0.1:3306");
+	}
+
+	if (config->listen_reuseport) {
+		GPtrArray *event_threads = chas->threads->event_threads;
+		guint first_thread = event_threads->len > 1 ? 1 : 0; /* only use the main-thread if we have no worker-threads */
+
+		/* the event-threads are already created, but not started yet */
+		for (i = first_thread; i < event_threads->len; i++) {
+			chassis_event_thread_t *event_thread = event_threads->pdata[i];
+
+			if (NULL == (con = network_mysqld_proxy_plugin_listen(chas, config, event_thread->event_base, TRUE))) {
+				return -1;
+			}
+#ifdef SO_INCOMING_CPU
+			/* let the kernel pick the socket of the thread on the CPU that got the packet from the NIC */
+			if (event_thread->cpus && event_thread->cpus->len == 1) {
+				int cpu = g_array_index(event_thread->cpus, guint, 0);
+
+				if (0 != setsockopt(con->server->fd, SOL_SOCKET, SO_INCOMING_CPU, &cpu, sizeof(cpu))) {
+					g_warning("%s: setsockopt(%s, SOL_SOCKET, SO_INCOMING_CPU) failed: %s (%d)",
+							G_STRLOC,
+							config->address,
+							g_strerror(errno), errno);
+				}
+			}
+#endif
+
+			if (!config->listen_con) config->listen_con = con;
+		}
+		g_message("proxy listening on port %s (SO_REUSEPORT, %d sockets)", config->address, event_threads->len - first_thread);
+	} else {
+		if (NULL == (con = network_mysqld_proxy_plugin_listen(chas, config, chas->event_base, FALSE))) {
+			return -1;
+		}
+		config->listen_con = con;
+
+		g_message("proxy listening on port %s", config->address);
+	}
+
+	/* each event-thread gets its own connection pool for each backend */
+	network_backends_set_pool_shards(g->backends, chas->event_thread_count);
+
+	/* the backends pick the unix-socket up as they are added */
+	if (config->backend_local_socket) {
+		if (0 == strcmp(config->backend_local_socket, "auto")) {
+			network_backends_use_local_sockets(g->backends, NULL);
+		} else if (config->backend_local_socket[0] == '/') {
+			network_backends_use_local_sockets(g->backends, config->backend_local_socket);
+		} else {
+			g_critical("%s: --proxy-backend-local-socket has to be an absolute path or \"auto\", is %s", G_STRLOC, config->backend_local_socket);
+			return -1;
+		}
+	}
+
+	for (i = 0; config->backend_addresses && config->backend_addresses[i]; i++) {
+		if (-1 == network_backends_add(g->backends, config->backend_addresses[i],
+				BACKEND_TYPE_RW)) {
+			return -1;
+		}
+	}
+	
+	for (i = 0; config->read_only_backend_addresses && config->read_only_backend_addresses[i]; i++) {
+		if (-1 == network_backends_add(g->backends,
+				config->read_only_backend_addresses[i], BACKEND_TYPE_RO)) {
+			return -1;
+		}
+	}
+
+	for (i = 0; config->backend_groups && config->backend_groups[i]; i++) {
+		GError *gerr = NULL;
+
+		if (0 != network_backends_add_group(g->backends, config->backend_groups[i], &gerr)) {
+			g_critical("%s: --proxy-backend-group: %s", G_STRLOC, gerr->message);
+			g_clear_error(&gerr);
+			return -1;
+		}
+	}
+
+	for (i = 0; config->backend_source_addresses && config->backend_source_addresses[i]; i++) {
+		GError *gerr = NULL;
+
+		if (0 != network_backends_set_source_addresses(g->backends, config->backend_source_addresses[i], &gerr)) {
+			g_critical("%s: --proxy-backend-source-addresses: %s", G_STRLOC, gerr->message);
+			g_clear_error(&gerr);
+			return -1;
+		}
+	}
+
+	/* expire the idle connections and empty the pools of removed backends */
+	{
+		GPtrArray *event_threads = chas->threads->event_threads;
+
+		config->pool_timers = g_ptr_array_new();
+
+		/* each event-thread maintains its own pools */
+		for (i = 0; i < event_threads->len; i++) {
+			chassis_event_thread_t *event_thread = event_threads->pdata[i];
+			proxy_pool_timer_t *timer;
+			struct timeval tv = { 1, 0 };
+
+			timer = g_new0(proxy_pool_timer_t, 1);
+			timer->chas = chas;
+			timer->config = config;
+			timer->thread_ndx = event_thread->index;
+
+			evtimer_set(&(timer->ev), proxy_pool_timer_handle, timer);
+			event_base_set(event_thread->event_base, &(timer->ev));
+			evtimer_add(&(timer->ev), &tv);
+
+			g_ptr_array_add(config->pool_timers, timer);
+		}
+	}
+
+	if (config->health_check_interval > 0) {
+		/* the probes run in the main-thread's event-loop */
+		config->health = network_backends_health_new(g->backends, chas->event_base);
+		network_backends_health_set_interval(config->health, config->health_check_interval);
+		network_backends_health_set_login(config->health, config->health_check_user, config->health_check_password);
+		network_backends_health_set_ping_query(config->health, config->health_check_query);
+		config->health->max_lag = config->health_check_max_lag;
+		config->health->track_binlog_pos = config->rw_split_read_your_writes;
+
+		network_backends_health_start(config->health);
+	}
+
+	if (config->rw_split_read_your_writes && (NULL == config->health || NULL == config->health_check_user)) {
+		g_warning("%s: --proxy-rw-split-read-your-writes learns the binlog positions from the health-check, without --proxy-health-check-interval and --proxy-health-check-user the reads after a write stay on the master",
+				G_STRLOC);
+	}
+
+	if (config->rw_split_affinity) {
+		if (0 == strcmp(config->rw_split_affinity, "user")) {
+			config->rw_split_affinity_key = PROXY_AFFINITY_USER;
+		} else if (0 == strcmp(config->rw_split_affinity, "db")) {
+			config->rw_split_affinity_key = PROXY_AFFINITY_DB;
+		} else if (g_str_has_prefix(config->rw_split_affinity, "column:") &&
+		           config->rw_split_affinity[sizeof("column:") - 1] != '\0') {
+			config->rw_split_affinity_key = PROXY_AFFINITY_COLUMN;
+			config->rw_split_affinity_map = network_shard_map_new();
+			config->rw_split_affinity_map->key = g_string_new(config->rw_split_affinity + sizeof("column:") - 1);
+			g_string_ascii_down(config->rw_split_affinity_map->key);
+		} else {
+			g_critical("%s: --proxy-rw-split-affinity has to be user, db or column:<name>, got '%s'", G_STRLOC, config->rw_split_affinity);
+			return -1;
+		}
+
+		if (config->rw_split_affinity_load_factor < 100) {
+			g_critical("%s: --proxy-rw-split-affinity-load-factor has to be >= 100", G_STRLOC);
+			return -1;
+		}
+
+		if (!config->rw_split) {
+			g_warning("%s: --proxy-rw-split-affinity only applies with --proxy-rw-split", G_STRLOC);
+		}
+	}
+
+	if (config->read_hedge_percentile < 0.0 || config->read_hedge_percentile >= 100.0) {
+		g_critical("%s: --proxy-read-hedge-percentile has to be between 0 and 100", G_STRLOC);
+		return -1;
+	}
+
+	if (config->read_hedge_budget < 0.0 || config->read_hedge_budget > 100.0) {
+		g_critical("%s: --proxy-read-hedge-budget has to be between 0 and 100", G_STRLOC);
+		return -1;
+	}
+
+	if (config->read_hedge_percentile > 0.0) {
+		static const gchar * const results[] = { "started", "won", "over_budget" };
+
+		if (!config->rw_split) {
+			g_warning("%s: --proxy-read-hedge-percentile only applies with --proxy-rw-split", G_STRLOC);
+		}
+
+		config->read_hedge = network_read_hedge_new();
+		config->read_hedge->percentile = config->read_hedge_percentile;
+		config->read_hedge->budget = config->read_hedge_budget;
+		network_read_hedge_set_threads(config->read_hedge, chas->event_thread_count);
+
+		config->read_hedges_total = chassis_metrics_register_counter_vec(chas->metrics,
+				"mysql_proxy_read_hedges_total", "SELECTs sent to a second read-only backend, those that answered first and those over the budget",
+				"result", results, G_N_ELEMENTS(results));
+	}
+
+	if (config->mirror_backend) {
+		if (config->mirror_sample < 0.0 || config->mirror_sample > 1.0) {
+			g_critical("%s: --proxy-mirror-sample has to be between 0.0 and 1.0", G_STRLOC);
+			return -1;
+		}
+
+		if (config->mirror_queue_size < 1 || config->mirror_connections < 1) {
+			g_critical("%s: --proxy-mirror-queue-size and --proxy-mirror-connections have to be >= 1", G_STRLOC);
+			return -1;
+		}
+
+		config->mirror = network_mirror_new(chas);
+
+		if (0 != network_mirror_set_backend(config->mirror, config->mirror_backend)) {
+			g_critical("%s: --proxy-mirror-backend: %s isn't a valid address", G_STRLOC, config->mirror_backend);
+			return -1;
+		}
+
+		network_mirror_set_login(config->mirror, config->mirror_user, config->mirror_password);
+		config->mirror->sample = config->mirror_sample;
+		config->mirror->max_queued = config->mirror_queue_size;
+		config->mirror->max_conns = config->mirror_connections;
+		network_mirror_set_threads(config->mirror, chas->event_thread_count);
+
+		chassis_metrics_register_collector(chas->metrics, proxy_mirror_collect_metrics, config);
+	}
+
+	if (config->breaker_error_rate < 0 || config->breaker_error_rate > 100) {
+		g_critical("%s: --proxy-breaker-error-rate has to be between 0 and 100", G_STRLOC);
+		return -1;
+	}
+
+	if (config->breaker_slow_query < 0) {
+		g_critical("%s: --proxy-breaker-slow-query has to be >= 0", G_STRLOC);
+		return -1;
+	}
+
+	if (config->breaker_half_open_share < 1 || config->breaker_half_open_share > 100) {
+		g_critical("%s: --proxy-breaker-half-open-share has to be between 1 and 100", G_STRLOC);
+		return -1;
+	}
+
+	g->backends->breaker_error_rate = config->breaker_error_rate;
+	g->backends->breaker_slow_usec = (guint64)config->breaker_slow_query * 1000;
+	g->backends->breaker_half_open_share = config->breaker_half_open_share;
+
+	if (config->connect_hedge_delay < 0) {
+		g_critical("%s: --proxy-connect-hedge-delay has to be >= 0", G_STRLOC);
+		return -1;
+	}
+
+	if (config->connect_hedge_delay > 0) {
+		static const gchar * const results[] = { "started", "won" };
+
+		config->connect_hedges_total = chassis_metrics_register_counter_vec(chas->metrics,
+				"mysql_proxy_connect_hedges_total", "Second connects to another backend and those that connected first",
+				"result", results, G_N_ELEMENTS(results));
+	}
+
+	/* the rules may also be set later through the admin plugin */
+	if (config->rate_limit_queue_size < 0) {
+		g_critical("%s: --proxy-rate-limit-queue-size has to be >= 0", G_STRLOC);
+		return -1;
+	}
+
+	network_rate_limiter_set_threads(g->rate_limiter, chas->event_thread_count);
+	g->rate_limiter->max_waiting = config->rate_limit_queue_size;
+
+	for (i = 0; config->rate_limits && config->rate_limits[i]; i++) {
+		GError *gerr = NULL;
+
+		if (0 != network_rate_limiter_add_rule_string(g->rate_limiter, config->rate_limits[i], &gerr)) {
+			g_critical("%s: --proxy-rate-limit: %s", G_STRLOC, gerr->message);
+			g_clear_error(&gerr);
+			return -1;
+		}
+	}
+
+	if (config->firewall_filename) {
+		static const gchar * const actions[] = { "allowed", "denied" };
+		GError *gerr = NULL;
+
+		if (0 != network_firewall_load(g->firewall, config->firewall_filename, &gerr)) {
+			g_critical("%s: --proxy-firewall-file: %s", G_STRLOC, gerr->message);
+			g_clear_error(&gerr);
+			return -1;
+		}
+
+		config->firewall_queries_total = chassis_metrics_register_counter_vec(chas->metrics,
+				"mysql_proxy_firewall_queries_total", "Queries checked by the firewall by result",
+				"result", actions, G_N_ELEMENTS(actions));
+	}
+
+	if (config->query_cache_size > 0) {
+		network_query_cache_set_limits(g->query_cache, config->query_cache_size, config->query_cache_ttl);
+	}
+
+	if (config->query_digest_size > 0) {
+		network_query_digest_set_limits(g->query_digest, chas->event_thread_count, config->query_digest_size);
+	}
+
+	if (config->shared_dict_size > 0) {
+		network_shared_dict_set_limits(g->shared_dict, config->shared_dict_size);
+	}
+
+	if (config->query_log_filename) {
+		GError *gerr = NULL;
+
+		if (config->query_log_min_time < 0 || config->query_log_sample < 1) {
+			g_critical("%s: --proxy-query-log-min-time has to be >= 0 and --proxy-query-log-sample >= 1", G_STRLOC);
+			return -1;
+		}
+
+		config->query_log = network_query_log_new();
+		network_query_log_set_filter(config->query_log,
+				(guint64)(config->query_log_min_time * G_USEC_PER_SEC),
+				config->query_log_sample);
+
+		if (0 != network_query_log_open(config->query_log, config->query_log_filename, &gerr)) {
+			g_critical("%s: --proxy-query-log: %s", G_STRLOC, gerr->message);
+			g_clear_error(&gerr);
+			return -1;
+		}
+	}
+
+	if (config->trace_address) {
+		network_address *addr;
+		GError *gerr = NULL;
+
+		if (config->trace_sample < 0) {
+			g_critical("%s: --proxy-trace-sample has to be >= 0, is %d", G_STRLOC, config->trace_sample);
+			return -1;
+		}
+
+		addr = network_address_new();
+		if (0 != network_address_set_address(addr, config->trace_address)) {
+			g_critical("%s: --proxy-trace-address=%s isn't a valid address", G_STRLOC, config->trace_address);
+			network_address_free(addr);
+			return -1;
+		}
+
+		config->trace = network_trace_new();
+		network_trace_set_sample(config->trace, config->trace_sample);
+
+		if (0 != network_trace_open(config->trace, addr, &gerr)) {
+			g_critical("%s: --proxy-trace-address: %s", G_STRLOC, gerr->message);
+			g_clear_error(&gerr);
+			return -1;
+		}
+	}
+
+	if (config->capture_filename) {
+		GError *gerr = NULL;
+
+		config->capture = network_capture_new();
+
+		if (0 != network_capture_open(config->capture, config->capture_filename, &gerr)) {
+			g_critical("%s: --proxy-capture: %s", G_STRLOC, gerr->message);
+			g_clear_error(&gerr);
+			return -1;
+		}
+	}
+
+	if (config->auth_cache_filename) {
+		GError *gerr = NULL;
+
+		config->auth_cache = network_auth_cache_new();
+
+		if (0 != network_auth_cache_load(config->auth_cache, config->auth_cache_filename, &gerr)) {
+			g_critical("%s: --proxy-auth-cache-file: %s", G_STRLOC, gerr->message);
+			g_clear_error(&gerr);
+			return -1;
+		}
+
+		chassis_metrics_register_collector(chas->metrics, proxy_auth_cache_collect_metrics, config);
+
+		if (config->pool_change_user) {
+			static const gchar * const resets[] = { "skipped", "reset_connection", "change_user" };
+
+			config->pool_resets_total = chassis_metrics_register_counter_vec(chas->metrics,
+					"mysql_proxy_pool_resets_total", "Pooled connections taken over by a client, by how their session was reset",
+					"reset", resets, G_N_ELEMENTS(resets));
+		}
+	}
+
+	if (config->shard_map_filename) {
+		GError *gerr = NULL;
+
+		if (config->rw_split) {
+			g_critical("%s: --proxy-shard-map-file and --proxy-rw-split can't be combined", G_STRLOC);
+			return -1;
+		}
+
+		config->shard_router = network_shard_router_new();
+
+		if (0 != network_shard_router_load(config->shard_router, config->shard_map_filename, &gerr)) {
+			g_critical("%s: --proxy-shard-map-file: %s", G_STRLOC, gerr->message);
+			g_clear_error(&gerr);
+			return -1;
+		}
+
+		config->shard_queries_total = chassis_metrics_register_counter(chas->metrics,
+				"mysql_proxy_shard_queries_total", "Queries routed to the backends of their shard");
+		config->shard_scatter_queries_total = chassis_metrics_register_counter(chas->metrics,
+				"mysql_proxy_shard_scatter_queries_total", "Queries without a shard key sent to all shards");
+	}
+
+	if (config->query_timeout < 0) {
+		g_critical("%s: --proxy-query-timeout has to be >= 0", G_STRLOC);
+		return -1;
+	}
+
+	if (config->query_timeout_filename) {
+		GError *gerr = NULL;
+
+		config->query_timeouts = network_query_timeouts_new();
+
+		if (0 != network_query_timeouts_load(config->query_timeouts, config->query_timeout_filename, &gerr)) {
+			g_critical("%s: --proxy-query-timeout-file: %s", G_STRLOC, gerr->message);
+			g_clear_error(&gerr);
+			return -1;
+		}
+	}
+
+	if (config->query_rules_filename) {
+		GError *gerr = NULL;
+
+		config->query_rules = network_query_rules_new();
+
+		if (0 != network_query_rules_load(config->query_rules, config->query_rules_filename, &gerr)) {
+			g_critical("%s: --proxy-query-rules-file: %s", G_STRLOC, gerr->message);
+			g_clear_error(&gerr);
+			return -1;
+		}
+	}
+
+	if (config->query_timeout > 0 || config->query_timeouts || config->query_hints || config->query_rules) {
+		config->query_timeouts_total = chassis_metrics_register_counter(chas->metrics,
+				"mysql_proxy_query_timeouts_total", "Queries that ran out of their budget and got killed on the backend");
+	}
+
+	if (config->stmt_promote_threshold < 0) {
+		g_critical("%s: --proxy-stmt-promote-threshold has to be >= 0, is %d", G_STRLOC, config->stmt_promote_threshold);
+		return -1;
+	}
+
+	if (config->stmt_promote_threshold > 0) {
+		config->stmt_promote = network_stmt_promote_new(config->stmt_promote_threshold);
+
+		config->stmt_promoted_total = chassis_metrics_register_counter(chas->metrics,
+				"mysql_proxy_stmt_promoted_total", "Queries executed as prepared statements for --proxy-stmt-promote-threshold");
+		config->stmt_promote_fallbacks_total = chassis_metrics_register_counter(chas->metrics,
+				"mysql_proxy_stmt_promote_fallbacks_total", "Promoted queries that were sent as text again, their shape isn't promoted anymore");
+	}
+
+	if (config->idle_release_time < 0 || config->idle_evict_connections < 0 || config->idle_evict_memory < 0) {
+		g_critical("%s: --proxy-idle-release-time, --proxy-idle-evict-connections and --proxy-idle-evict-memory have to be >= 0", G_STRLOC);
+		return -1;
+	}
+
+	if (config->multiplex_wait_timeout < 0) {
+		g_critical("%s: --proxy-multiplex-wait-timeout has to be >= 0", G_STRLOC);
+		return -1;
+	}
+
+	if (config->idle_release_time > 0 || config->idle_evict_connections > 0 || config->idle_evict_memory > 0) {
+		static const gchar * const actions[] = { "released", "evicted" };
+
+		if (!chassis_event_thread_keeps_events(chas)) {
+			g_warning("%s: --proxy-idle-release-time and --proxy-idle-evict-* only see the idle clients if the events stay in their event-thread", G_STRLOC);
+		}
+
+		config->idle_clients_total = chassis_metrics_register_counter_vec(chas->metrics,
+				"mysql_proxy_idle_clients_total", "Idle clients whose backend connection went back to the pool and those that were closed under pressure",
+				"action", actions, G_N_ELEMENTS(actions));
+	}
+
+	if (config->local_answers) {
+		config->local_answers_total = chassis_metrics_register_counter(chas->metrics,
+				"mysql_proxy_local_answers_total", "Commands the proxy answered without a backend");
+	}
+
+	if (config->lazy_connect) {
+		if (NULL == config->auth_cache) {
+			g_critical("%s: --proxy-lazy-connect needs --proxy-auth-cache-file to check the logins", G_STRLOC);
+			return -1;
+		}
+
+		config->lazy_challenge_mutex = g_mutex_new();
+	}
+
+	if (config->backend_max_queries < 0 || config->user_max_queries < 0 ||
+	    config->admission_queue_size < 0 || config->admission_queue_timeout < 0) {
+		g_critical("%s: --proxy-backend-max-queries, --proxy-user-max-queries, --proxy-admission-queue-size and --proxy-admission-queue-timeout have to be >= 0", G_STRLOC);
+		return -1;
+	}
+
+	{
+		GHashTable *groups = g->backends->groups;
+		GHashTableIter iter;
+		gpointer value;
+		gboolean has_group_limits = FALSE;
+
+		g_hash_table_iter_init(&iter, groups);
+		while (g_hash_table_iter_next(&iter, NULL, &value)) {
+			network_backend_group_t *group = value;
+
+			if (group->max_queries > 0) has_group_limits = TRUE;
+		}
+
+		if (config->backend_max_queries > 0 || config->user_max_queries > 0 || has_group_limits) {
+			config->admission = network_admission_new();
+
+			g_hash_table_iter_init(&iter, groups);
+			while (g_hash_table_iter_next(&iter, NULL, &value)) {
+				network_backend_group_t *group = value;
+
+				network_admission_set_group_limit(config->admission, group->name, group->max_queries);
+			}
+		}
+	}
+
+	if (config->admission) {
+		network_admission_set_limits(config->admission,
+				config->backend_max_queries,
+				config->user_max_queries,
+				config->admission_queue_size);
+		config->admission_backends = g->backends;
+
+		config->admission_wait_duration = chassis_metrics_register_histogram(chas->metrics,
+				"mysql_proxy_admission_wait_seconds", "Time queries waited for the admission control",
+				proxy_admission_wait_bounds, G_N_ELEMENTS(proxy_admission_wait_bounds), 1e-6);
+		chassis_metrics_register_collector(chas->metrics, proxy_admission_collect_metrics, config);
+	}
+
+	if (config->send_queue_low_watermark < 0 || config->send_queue_budget < 0 ||
+	    config->send_queue_high_watermark < config->send_queue_low_watermark) {
+		g_critical("%s: --proxy-send-queue-low-watermark and --proxy-send-queue-budget have to be >= 0 and --proxy-send-queue-high-watermark >= the low watermark", G_STRLOC);
+		return -1;
+	}
+
+	if (config->result_spool_threshold < 0) {
+		g_critical("%s: --proxy-result-spool-threshold has to be >= 0, is %d", G_STRLOC, config->result_spool_threshold);
+		return -1;
+	}
+
+	network_flow_control_set_budget(g->flow_control, (guint64)config->send_queue_budget * 1024 * 1024);
+
+	if ((config->client_compress || config->backend_compress) && !network_mysqld_compress_is_available()) {
+		g_warning("%s: --proxy-client-compress and --proxy-backend-compress need zlib, ignoring them", G_STRLOC);
+
+		config->client_compress = 0;
+		config->backend_compress = 0;
+	}
+
+	if (config->ssl_cert) {
+		if (NULL == (config->ssl_ctx = network_ssl_ctx_new(TRUE))) return -1;
+		if (0 != network_ssl_ctx_set_cert(config->ssl_ctx, config->ssl_cert, config->ssl_key)) return -1;
+		if (config->ssl_ticket_key &&
+		    0 != network_ssl_ctx_set_ticket_key(config->ssl_ctx, config->ssl_ticket_key)) return -1;
+	}
+
+	if (config->backend_ssl) {
+		if (NULL == (config->backend_ssl_ctx = network_ssl_ctx_new(FALSE))) return -1;
+		if (config->backend_ssl_ca &&
+		    0 != network_ssl_ctx_set_ca(config->backend_ssl_ctx, config->backend_ssl_ca)) return -1;
+	}
+
+	if (config->backend_dns_ttl < 0) {
+		g_critical("%s: --proxy-backend-dns-ttl has to be >= 0", G_STRLOC);
+		return -1;
+	}
+
+	if (config->backend_dns_ttl > 0) {
+		struct timeval tv = { config->backend_dns_ttl, 0 };
+
+		config->workers = chas->workers;
+		config->backend_dns_backends = g->backends;
+		config->backend_dns_timer = g_new0(struct event, 1);
+		evtimer_set(config->backend_dns_timer, proxy_backend_dns_timer_handle, config);
+		event_base_set(chas->event_base, config->backend_dns_timer);
+		evtimer_add(config->backend_dns_timer, &tv);
+	}
+
+	if (config->lua_script && config->lua_script_check_interval > 0) {
+		struct timeval tv = { config->lua_script_check_interval, 0 };
+
+		/* the scripts are only stat()ed by the timer from now on */
+		config->workers = chas->workers;
+		config->lua_script_check_timer = g_new0(struct event, 1);
+		evtimer_set(config->lua_script_check_timer, proxy_lua_script_check_timer_handle, config);
+		event_base_set(chas->event_base, config->lua_script_check_timer);
+		evtimer_add(config->lua_script_check_timer, &tv);
+
+		lua_scope_scripts_set_watched(TRUE);
+	}
+
+	/* load the script and setup the global tables */
+	network_mysqld_lua_setup_global(chas->priv->sc->L, g);
 
 	return 0;
 }
@@ -2429,6 +8543,7 @@ G_MODULE_EXPORT int plugin_init(chassis_plugin *p) {
 	p->init         = network_mysqld_proxy_plugin_new;
 	p->get_options  = network_mysqld_proxy_plugin_get_options;
 	p->apply_config = network_mysqld_proxy_plugin_apply_config;
+	p->reload_config = network_mysqld_proxy_plugin_reload_config;
 	p->destroy      = network_mysqld_proxy_plugin_free;
 
 	return 0;
@@ -38,17 +38,26 @@
 #include <stdlib.h>
 #include <fcntl.h>
 #include <errno.h>
+#include <time.h>
 
 #include <glib.h>
 #include <glib/gstdio.h>
 
+#include <mysqld_error.h> /** for ER_MASTER_FATAL_ERROR_READING_BINLOG */
+
 #include "network-mysqld.h"
 #include "network-mysqld-proto.h"
 #include "network-mysqld-binlog.h"
 #include "network-mysqld-packet.h"
+#include "network-mysqld-resultset-writer.h"
+#include "network-query-cache.h"
+#include "network-mysqld-compress.h"
+#include "chassis-event-thread.h"
 #include "sys-pedantic.h"
 #include "glib-ext.h"
 
+#include "replicant-spool.h"
+
 #define C(x) x, sizeof(x) - 1
 #define S(x) x->str, x->len
 
@@ -60,6 +69,7 @@
 #endif
 #endif
 
+
 /**
  * we have two phases
  * - getting the binglog-pos with SHOW MASTER STATUS
@@ -76,448 +86,1542 @@
  * - chaining of replicants is desired
  *   a delayed replicator can feed a splitter or the other way around
  *
- * - we have to maintain the last know position per backend, perhaps 
+ * - we have to maintain the last know position per backend, perhaps
  *   we want to maintain this in lua land and use the tbl2str functions
  *
  * - we may want to share the config
  *
- * - we have to parse the binlog stream and should also provide a 
+ * - we have to parse the binlog stream and should also provide a
  *   binlog reading library
  *
+ * relay mode (--replicant-relay-dir):
+ *
+ * - one connection to the master dumps the binlog into the spool, see replicant-spool.c
+ * - the replicas connect to --replicant-relay-address and get their COM_BINLOG_DUMP
+ *   served from the spool, with the binlog-file:pos of the master
+ * - --replicant-relay-compress-level compresses the segments of the binlogs the master
+ *   rotated away from in blocks, a replica only uncompresses the blocks from its position on
+ * - --replicant-compress uses the compressed protocol to the master and offers it to the
+ *   replicas, a chain of relays sends the binlogs compressed on each hop
  *
+ * query-cache invalidation (--replicant-invalidate-query-cache):
+ *
+ * - the same connection to the master decodes the TABLE_MAP, row- and QUERY events
+ *   and drops the results of the tables they change from the query-cache of the
+ *   proxy, see replicant_upstream_invalidate_query_cache()
+ * - without a relay-dir the dump starts at the current position of the master
+ * - the query-cache is flushed each time the dump (re)starts, we may have missed events
+ */
+
+#define REPLICANT_RETRY_SEC             5   /**< wait before we connect to the master again */
+#define REPLICANT_READ_TIMEOUT_SEC     30
+#define REPLICANT_HEARTBEAT_PERIOD_SEC 30   /**< the master sends a heartbeat if there were no events */
+
+#define RELAY_SEND_QUEUE_SIZE (256 * 1024) /**< stop reading events from the spool when this much is waiting to be sent */
+
+/* the row-events of 5.6+, network-mysqld-binlog.h only knows the v1 events */
+#define REPLICANT_WRITE_ROWS_EVENT_V2  30
+#define REPLICANT_UPDATE_ROWS_EVENT_V2 31
+#define REPLICANT_DELETE_ROWS_EVENT_V2 32
+
+/**
+ * the connection to the master
+ *
+ * it doesn't have a client, it isn't a network_mysqld_con
+ */
+typedef struct {
+	enum {
+		REPCLIENT_CONNECT,
+		REPCLIENT_READ_HANDSHAKE,
+		REPCLIENT_SEND_AUTH,
+		REPCLIENT_READ_AUTH_RESULT,
+		REPCLIENT_SEND_QUERY,
+		REPCLIENT_READ_QUERY_RESULT,
+		REPCLIENT_SEND_BINLOG_DUMP,
+		REPCLIENT_READ_BINLOG
+	} state;
+
+	chassis *chas;
+	chassis_plugin_config *config;
+
+	network_socket *server;
+
+	gchar *master_version;
+	gboolean has_checksums;
+
+	guint query_ndx;                 /**< the query of replicant_upstream_queries we run */
+	GQueue *result;                  /**< packets of its result */
+	network_mysqld_com_query_result_t *query_result;
+
+	gchar *binlog_file;              /**< the binlog of SHOW MASTER STATUS */
+	guint32 binlog_pos;              /**< ... and its position */
+
+	GString *event;                  /**< a event that is split over several packets */
+
+	network_mysqld_binlog *binlog;   /**< the table-maps of the dump, for the query-cache invalidation */
+	GString *decode_buf;             /**< copy of the event we decode, the decoder patches its length */
+
+	struct event retry_ev;
+} replicant_upstream_t;
+
+/**
+ * the queries we send to the master before the COM_BINLOG_DUMP
+ */
+enum {
+	REPCLIENT_QUERY_SET_CHECKSUM,
+	REPCLIENT_QUERY_GET_CHECKSUM,
+	REPCLIENT_QUERY_SET_HEARTBEAT,
+	REPCLIENT_QUERY_MASTER_STATUS,
+	REPCLIENT_QUERY_DONE
+};
+
+static const char *replicant_upstream_queries[] = {
+	"SET @master_binlog_checksum = @@global.binlog_checksum", /* 5.6+ only sends checksums if we say we know about them */
+	"SELECT @master_binlog_checksum",
+	"SET @master_heartbeat_period = " G_STRINGIFY(REPLICANT_HEARTBEAT_PERIOD_SEC) "000000000", /* in nano-seconds */
+	"SHOW MASTER STATUS",
+	NULL
+};
+
+/**
+ * a replica connected to the relay
  */
 typedef struct {
-	enum { REPCLIENT_BINLOG_GET_POS, REPCLIENT_BINLOG_DUMP } state;
-	char *binlog_file;
-	int binlog_pos;
+	replicant_spool_reader_t *reader; /**< set while we serve the COM_BINLOG_DUMP */
+	gboolean is_non_block;           /**< BINLOG_DUMP_NON_BLOCK, send a EOF instead of waiting */
+	GString *packet;
+
+	gboolean has_checksums;          /**< the replica did SET @master_binlog_checksum */
+	guint64 heartbeat_period_usec;   /**< SET @master_heartbeat_period, 0 for no heartbeats */
+
+	replicant_spool_waiter_t waiter;
+	gboolean is_woken;               /**< the spool has new events */
+
+	struct event heartbeat_ev;
+	gboolean heartbeat_is_due;
 } plugin_con_state;
 
 struct chassis_plugin_config {
 	gchar *master_address;                   /**< listening address of the proxy */
 
-	gchar *mysqld_username;
-	gchar *mysqld_password;
+	gchar *mysqld_username;
+	gchar *mysqld_password;
+
+	gchar **read_binlogs;
+	gchar **read_binlogs_filter_tables;      /**< only decode the events of these tables */
+
+	gchar *relay_dir;                        /**< spool of the binlogs, enables the relay */
+	gchar *relay_address;                    /**< listening address for the replicas */
+	gint server_id;                          /**< our server-id at the master and for the replicas */
+	gboolean invalidate_query_cache;         /**< drop the cached results of the tables the master changes */
+	gint relay_compress_level;               /**< compress the spooled segments of the older binlogs */
+	gboolean compress;                       /**< CLIENT_COMPRESS to the master and for the replicas */
+
+	replicant_spool_t *spool;
+	replicant_upstream_t *upstream;
+
+	network_mysqld_con *listen_con;
+};
+
+
+static plugin_con_state *plugin_con_state_init() {
+	plugin_con_state *st;
+
+	st = g_new0(plugin_con_state, 1);
+	st->packet = g_string_new(NULL);
+
+	return st;
+}
+
+static void plugin_con_state_free(plugin_con_state *st) {
+	if (!st) return;
+
+	if (st->reader) replicant_spool_reader_free(st->reader);
+	g_string_free(st->packet, TRUE);
+
+	g_free(st);
+}
+
+/**
+ * decode the first row of a result-set
+ *
+ * @param row the values of the row, NULL for a SQL NULL. Empty if the result-set has no rows
+ * @return 0 on success, -1 on error
+ */
+static int replicant_resultset_get_first_row(GList *chunk, GPtrArray *row) {
+	network_mysqld_proto_fielddefs_t *fields;
+	network_mysqld_lenenc_type lenenc_type;
+	network_packet packet;
+	guint fields_len;
+	guint i;
+	int err = 0;
+
+	fields = network_mysqld_proto_fielddefs_new();
+
+	if (NULL == (chunk = network_mysqld_proto_get_fielddefs(chunk, fields))) {
+		network_mysqld_proto_fielddefs_free(fields);
+		return -1;
+	}
+	fields_len = fields->len;
+	network_mysqld_proto_fielddefs_free(fields);
+
+	/* the first row or the EOF */
+	if (NULL == (chunk = chunk->next)) return -1;
+
+	packet.data = chunk->data;
+	packet.offset = 0;
+
+	err = err || network_mysqld_proto_skip_network_header(&packet);
+	err = err || network_mysqld_proto_peek_lenenc_type(&packet, &lenenc_type);
+	if (err) return -1;
+
+	if (lenenc_type == NETWORK_MYSQLD_LENENC_TYPE_EOF) return 0;
+
+	for (i = 0; !err && i < fields_len; i++) {
+		guint64 field_len;
+		gchar *field_value;
+
+		err = err || network_mysqld_proto_peek_lenenc_type(&packet, &lenenc_type);
+		if (err) break;
+
+		switch (lenenc_type) {
+		case NETWORK_MYSQLD_LENENC_TYPE_NULL:
+			err = err || network_mysqld_proto_skip(&packet, 1);
+			g_ptr_array_add(row, NULL);
+			break;
+		case NETWORK_MYSQLD_LENENC_TYPE_INT:
+			err = err || network_mysqld_proto_get_lenenc_int(&packet, &field_len);
+			err = err || !(packet.offset + field_len <= packet.data->len);
+			err = err || network_mysqld_proto_get_string_len(&packet, &field_value, field_len);
+			if (!err) g_ptr_array_add(row, field_value);
+			break;
+		default:
+			err = 1;
+			break;
+		}
+	}
+
+	return err ? -1 : 0;
+}
+
+static void replicant_upstream_handle(int event_fd, short events, void *user_data);
+static void replicant_upstream_start(replicant_upstream_t *up);
+
+static replicant_upstream_t *replicant_upstream_new(chassis *chas, chassis_plugin_config *config) {
+	replicant_upstream_t *up;
+
+	up = g_new0(replicant_upstream_t, 1);
+	up->chas = chas;
+	up->config = config;
+	up->result = g_queue_new();
+	up->event = g_string_new(NULL);
+	up->decode_buf = g_string_new(NULL);
+
+	return up;
+}
+
+static void replicant_upstream_reset(replicant_upstream_t *up) {
+	GString *packet;
+
+	if (up->server) {
+		event_del(&(up->server->event));
+		network_socket_free(up->server);
+		up->server = NULL;
+	}
+
+	while ((packet = g_queue_pop_head(up->result))) g_string_free(packet, TRUE);
+
+	if (up->query_result) {
+		network_mysqld_com_query_result_free(up->query_result);
+		up->query_result = NULL;
+	}
+
+	if (up->master_version) {
+		g_free(up->master_version);
+		up->master_version = NULL;
+	}
+
+	if (up->binlog_file) {
+		g_free(up->binlog_file);
+		up->binlog_file = NULL;
+	}
+
+	if (up->binlog) {
+		network_mysqld_binlog_free(up->binlog);
+		up->binlog = NULL;
+	}
+
+	g_string_truncate(up->event, 0);
+	up->has_checksums = FALSE;
+	up->binlog_pos = 0;
+}
+
+static void replicant_upstream_free(replicant_upstream_t *up) {
+	if (!up) return;
+
+	replicant_upstream_reset(up);
+	event_del(&(up->retry_ev));
+
+	g_queue_free(up->result);
+	g_string_free(up->event, TRUE);
+	g_string_free(up->decode_buf, TRUE);
+
+	g_free(up);
+}
+
+static void replicant_upstream_retry_cb(int G_GNUC_UNUSED event_fd, short G_GNUC_UNUSED events, void *user_data) {
+	replicant_upstream_start(user_data);
+}
+
+/**
+ * close the connection to the master and connect again in a few seconds
+ */
+static void replicant_upstream_retry(replicant_upstream_t *up, const char *reason) {
+	struct timeval tv = { REPLICANT_RETRY_SEC, 0 };
+
+	g_critical("%s: replicating from %s stopped: %s, retrying in %d seconds",
+			G_STRLOC,
+			up->config->master_address,
+			reason,
+			REPLICANT_RETRY_SEC);
+
+	replicant_upstream_reset(up);
+
+	evtimer_set(&(up->retry_ev), replicant_upstream_retry_cb, up);
+	chassis_event_add_with_timeout(up->chas, &(up->retry_ev), &tv);
+}
+
+static void replicant_upstream_wait_for_event(replicant_upstream_t *up, short ev_type) {
+	network_socket *sock = up->server;
+	struct timeval tv = { REPLICANT_READ_TIMEOUT_SEC, 0 };
+
+	/* the master sends heartbeats while we wait for events, don't wait much longer than that */
+	if (up->state == REPCLIENT_READ_BINLOG) tv.tv_sec = 3 * REPLICANT_HEARTBEAT_PERIOD_SEC;
+
+	event_set(&(sock->event), sock->fd, ev_type, replicant_upstream_handle, up);
+	chassis_event_add_with_timeout(up->chas, &(sock->event), &tv);
+}
+
+/**
+ * write the send-queue
+ *
+ * @return TRUE if everything is sent, FALSE if we wait for the socket or failed
+ */
+static gboolean replicant_upstream_write(replicant_upstream_t *up) {
+	switch (network_socket_write(up->server, -1)) {
+	case NETWORK_SOCKET_SUCCESS:
+		return TRUE;
+	case NETWORK_SOCKET_WAIT_FOR_EVENT:
+		replicant_upstream_wait_for_event(up, EV_WRITE);
+		return FALSE;
+	default:
+		replicant_upstream_retry(up, "writing to the master failed");
+		return FALSE;
+	}
+}
+
+/**
+ * move the packets that arrived to the recv-queue
+ *
+ * @return 0 on success, -1 on error
+ */
+static int replicant_upstream_read(replicant_upstream_t *up) {
+	network_socket *sock = up->server;
+
+	if (sock->to_read > 0) {
+		switch (network_socket_read(sock)) {
+		case NETWORK_SOCKET_SUCCESS:
+		case NETWORK_SOCKET_WAIT_FOR_EVENT:
+			break;
+		default:
+			return -1;
+		}
+	}
+
+	for (;;) {
+		switch (network_mysqld_con_get_packet(NULL, sock)) {
+		case NETWORK_SOCKET_SUCCESS:
+			continue;
+		case NETWORK_SOCKET_WAIT_FOR_EVENT:
+			return 0;
+		default:
+			return -1;
+		}
+	}
+}
+
+static void replicant_upstream_send_command(replicant_upstream_t *up, const char *cmd, gsize cmd_len) {
+	network_mysqld_queue_reset(up->server);
+	network_mysqld_queue_append(up->server, up->server->send_queue, cmd, cmd_len);
+}
+
+/**
+ * send the next query of replicant_upstream_queries or the COM_BINLOG_DUMP once we are through
+ */
+static void replicant_upstream_send_next(replicant_upstream_t *up) {
+	chassis_plugin_config *config = up->config;
+	network_mysqld_binlog_dump *dump;
+	GString *packet;
+	gchar *binlog_file;
+	guint32 binlog_pos;
+
+	if (up->query_ndx == REPCLIENT_QUERY_MASTER_STATUS &&
+	    config->spool &&
+	    replicant_spool_get_position(config->spool, &binlog_file, &binlog_pos)) {
+		/* we continue where the spool ends, no need to ask for the position of the master */
+		up->query_ndx++;
+	} else {
+		binlog_file = NULL;
+	}
+
+	if (up->query_ndx < REPCLIENT_QUERY_DONE) {
+		packet = g_string_new(NULL);
+		g_string_append_c(packet, COM_QUERY);
+		g_string_append(packet, replicant_upstream_queries[up->query_ndx]);
+
+		replicant_upstream_send_command(up, S(packet));
+		g_string_free(packet, TRUE);
+
+		up->query_result = network_mysqld_com_query_result_new();
+		up->state = REPCLIENT_SEND_QUERY;
+
+		return;
+	}
+
+	if (!binlog_file) {
+		/* a empty spool starts at the beginning of the current binlog of the master,
+		 * without a spool we only want to know what changes from now on */
+		binlog_file = up->binlog_file;
+		binlog_pos = config->spool ? REPLICANT_BINLOG_HEADER_SIZE : up->binlog_pos;
+		up->binlog_file = NULL;
+	}
+
+	if (config->invalidate_query_cache) {
+		/* the results may be stale by the events we didn't see */
+		network_query_cache_flush(up->chas->priv->query_cache);
+
+		up->binlog = network_mysqld_binlog_new();
+		up->binlog->checksum = up->has_checksums ? NETWORK_MYSQLD_BINLOG_CHECKSUM_CRC32 : NETWORK_MYSQLD_BINLOG_CHECKSUM_OFF;
+	}
+
+	g_message("%s: dumping the binlog of %s from %s:%u",
+			G_STRLOC,
+			config->master_address,
+			binlog_file,
+			binlog_pos);
+
+	dump = network_mysqld_binlog_dump_new();
+	dump->binlog_pos  = binlog_pos;
+	dump->server_id   = config->server_id;
+	dump->binlog_file = binlog_file;
+
+	packet = g_string_new(NULL);
+	network_mysqld_proto_append_binlog_dump(packet, dump);
+	replicant_upstream_send_command(up, S(packet));
+	g_string_free(packet, TRUE);
+
+	network_mysqld_binlog_dump_free(dump);
+	g_free(binlog_file);
+
+	up->state = REPCLIENT_SEND_BINLOG_DUMP;
+}
+
+/**
+ * answer the handshake of the master
+ */
+static int replicant_upstream_read_handshake(replicant_upstream_t *up, GString *s) {
+	chassis_plugin_config *config = up->config;
+	network_mysqld_auth_challenge *shake;
+	network_mysqld_auth_response  *auth;
+	GString *auth_packet;
+	network_packet packet;
+	int err = 0;
+
+	packet.data = s;
+	packet.offset = 0;
+
+	err = err || network_mysqld_proto_skip_network_header(&packet);
+	if (err) return -1;
+
+	shake = network_mysqld_auth_challenge_new();
+	err = err || network_mysqld_proto_get_auth_challenge(&packet, shake);
+
+	if (err) {
+		network_mysqld_auth_challenge_free(shake);
+		return -1;
+	}
+
+	up->master_version = g_strdup(shake->server_version_str);
+
+	/* build the auth packet */
+	auth_packet = g_string_new(NULL);
+
+	auth = network_mysqld_auth_response_new(shake->capabilities);
+
+	/* don't ask for SSL */
+	auth->client_capabilities = shake->capabilities &
+		(CLIENT_PROTOCOL_41 | CLIENT_SECURE_CONNECTION | CLIENT_LONG_PASSWORD | CLIENT_LONG_FLAG | CLIENT_TRANSACTIONS);
+	if (config->compress && (shake->capabilities & CLIENT_COMPRESS)) {
+		auth->client_capabilities |= CLIENT_COMPRESS;
+
+		/* the handshake-response itself is sent uncompressed */
+		up->server->compress_pending = TRUE;
+	}
+	auth->charset      = shake->charset;
+
+	if (config->mysqld_username) {
+		g_string_append(auth->username, config->mysqld_username);
+	}
+
+	if (config->mysqld_password && config->mysqld_password[0] != '\0') {
+		GString *hashed_password;
+
+		hashed_password = g_string_new(NULL);
+		network_mysqld_proto_password_hash(hashed_password, config->mysqld_password, strlen(config->mysqld_password));
+
+		network_mysqld_proto_password_scramble(auth->auth_plugin_data, S(shake->auth_plugin_data), S(hashed_password));
+
+		g_string_free(hashed_password, TRUE);
+	}
+
+	network_mysqld_proto_append_auth_response(auth_packet, auth);
+
+	network_mysqld_queue_append(up->server, up->server->send_queue, S(auth_packet));
+
+	g_string_free(auth_packet, TRUE);
+	network_mysqld_auth_response_free(auth);
+	network_mysqld_auth_challenge_free(shake);
+
+	return 0;
+}
+
+/**
+ * log the ERR packet of the master
+ */
+static void replicant_upstream_log_err_packet(replicant_upstream_t *up, network_packet *packet) {
+	network_mysqld_err_packet_t *err_packet;
+
+	err_packet = network_mysqld_err_packet_new();
+
+	if (0 == network_mysqld_proto_get_err_packet(packet, err_packet)) {
+		g_critical("%s: %s returned: %s (errno = %d)",
+				G_STRLOC,
+				up->config->master_address,
+				err_packet->errmsg->len ? err_packet->errmsg->str : "",
+				err_packet->errcode);
+	}
+
+	network_mysqld_err_packet_free(err_packet);
+}
+
+static int replicant_upstream_read_auth_result(replicant_upstream_t *up, GString *s) {
+	network_packet packet;
+	guint8 status;
+	int err = 0;
+
+	packet.data = s;
+	packet.offset = 0;
+
+	err = err || network_mysqld_proto_skip_network_header(&packet);
+	err = err || network_mysqld_proto_peek_int8(&packet, &status);
+	if (err) return -1;
+
+	switch (status) {
+	case MYSQLD_PACKET_OK:
+		return 0;
+	case MYSQLD_PACKET_ERR:
+		replicant_upstream_log_err_packet(up, &packet);
+		return -1;
+	default:
+		g_critical("%s: packet should be (OK|ERR), got: 0x%02x (the master asks for another auth-method?)",
+				G_STRLOC,
+				status);
+		return -1;
+	}
+}
+
+/**
+ * look at the result of the query we sent
+ */
+static int replicant_upstream_query_done(replicant_upstream_t *up) {
+	GPtrArray *row;
+	int ret = 0;
+
+	if (up->query_result->query_status != MYSQLD_PACKET_OK) {
+		/* older masters don't know the binlog_checksum */
+		if (up->query_ndx == REPCLIENT_QUERY_SET_CHECKSUM) {
+			up->query_ndx = REPCLIENT_QUERY_SET_HEARTBEAT;
+
+			return 0;
+		}
+
+		return -1;
+	}
+
+	switch (up->query_ndx) {
+	case REPCLIENT_QUERY_GET_CHECKSUM:
+	case REPCLIENT_QUERY_MASTER_STATUS:
+		row = g_ptr_array_new();
+
+		if (0 != replicant_resultset_get_first_row(up->result->head, row)) {
+			ret = -1;
+		} else if (up->query_ndx == REPCLIENT_QUERY_GET_CHECKSUM) {
+			up->has_checksums = row->len > 0 && row->pdata[0] && 0 != g_ascii_strcasecmp(row->pdata[0], "NONE");
+		} else if (row->len > 1 && row->pdata[0] && row->pdata[1]) {
+			up->binlog_file = g_strdup(row->pdata[0]);
+			up->binlog_pos = strtoul(row->pdata[1], NULL, 10);
+		} else {
+			g_critical("%s: SHOW MASTER STATUS on %s returned no binlog, is the binlog enabled?",
+					G_STRLOC,
+					up->config->master_address);
+			ret = -1;
+		}
+
+		g_ptr_array_foreach(row, (GFunc)g_free, NULL);
+		g_ptr_array_free(row, TRUE);
+		break;
+	default:
+		break;
+	}
+
+	return ret;
+}
+
+/**
+ * read the result of the query
+ *
+ * @return 1 if the result is complete, 0 if we need more packets, -1 on error
+ */
+static int replicant_upstream_read_query_result(replicant_upstream_t *up) {
+	GString *s;
+
+	while ((s = g_queue_pop_head(up->server->recv_queue->chunks))) {
+		network_packet packet;
+		int is_finished;
+
+		packet.data = s;
+		packet.offset = 0;
+
+		g_queue_push_tail(up->result, s);
+
+		if (0 != network_mysqld_proto_skip_network_header(&packet)) return -1;
+
+		is_finished = network_mysqld_proto_get_com_query_result(&packet, up->query_result, FALSE);
+		if (is_finished != 0) return is_finished;
+	}
+
+	return 0;
+}
+
+/**
+ * drop the cached results of the tables a event changes
+ *
+ * the row-events only carry the table-id of the TABLE_MAP event in front of them,
+ * the QUERY events are the statement-based changes and the DDL. If we can't tell
+ * which tables a event changes, all results are dropped.
+ *
+ * @param data the event, starting with the event-header
+ */
+static void replicant_upstream_invalidate_query_cache(replicant_upstream_t *up, const char *data, gsize data_len) {
+	network_query_cache_t *cache = up->chas->priv->query_cache;
+	network_mysqld_binlog_event *event;
+	network_mysqld_table *tbl;
+	network_packet packet;
+	GPtrArray *tables;
+	guint64 table_id;
+	guint i;
+	int err = 0;
+
+	if (data_len < NETWORK_MYSQLD_BINLOG_EVENT_HEADER_LEN) return;
+
+	g_string_truncate(up->decode_buf, 0);
+	g_string_append_len(up->decode_buf, data, data_len);
+
+	packet.data = up->decode_buf;
+	packet.offset = 0;
+
+	event = network_mysqld_binlog_event_new();
+	err = err || network_mysqld_proto_get_binlog_event_header(&packet, event);
+
+	if (err) {
+		network_mysqld_binlog_event_free(event);
+		return;
+	}
+
+	switch ((guint8)event->event_type) {
+	case TABLE_MAP_EVENT:
+		if (0 != network_mysqld_proto_get_binlog_event(&packet, up->binlog, event) ||
+		    NULL == network_mysqld_binlog_table_map_get(up->binlog, event)) {
+			/* the row-events of this table can't be mapped */
+			network_query_cache_flush(cache);
+		}
+		break;
+	case WRITE_ROWS_EVENT:
+	case UPDATE_ROWS_EVENT:
+	case DELETE_ROWS_EVENT:
+	case REPLICANT_WRITE_ROWS_EVENT_V2:
+	case REPLICANT_UPDATE_ROWS_EVENT_V2:
+	case REPLICANT_DELETE_ROWS_EVENT_V2:
+		/* we only need the table-id of the post-header, not the rows */
+		err = err || network_mysqld_proto_get_int48(&packet, &table_id);
+
+		if (!err && NULL != (tbl = network_mysqld_binlog_get_table(up->binlog, table_id))) {
+			GString *table;
+
+			table = g_string_new(NULL);
+			g_string_append_len(table, S(tbl->table_name));
+			g_string_ascii_down(table);
+
+			network_query_cache_invalidate_table(cache, S(table));
+
+			g_string_free(table, TRUE);
+		} else {
+			network_query_cache_flush(cache);
+		}
+		break;
+	case QUERY_EVENT:
+		if (0 != network_mysqld_proto_get_binlog_event(&packet, up->binlog, event) ||
+		    NULL == event->event.query_event.query) {
+			network_query_cache_flush(cache);
+			break;
+		}
+
+		tables = g_ptr_array_new();
+		if (-1 == network_query_cache_get_written_tables(event->event.query_event.query,
+					strlen(event->event.query_event.query),
+					tables)) {
+			network_query_cache_flush(cache);
+		} else {
+			for (i = 0; i < tables->len; i++) {
+				GString *table = tables->pdata[i];
+
+				network_query_cache_invalidate_table(cache, S(table));
+			}
+		}
+
+		for (i = 0; i < tables->len; i++) {
+			g_string_free(tables->pdata[i], TRUE);
+		}
+		g_ptr_array_free(tables, TRUE);
+		break;
+	case LOAD_EVENT:
+	case NEW_LOAD_EVENT:
+	case EXEC_LOAD_EVENT:
+	case EXECUTE_LOAD_QUERY_EVENT:
+	case INCIDENT_EVENT:
+		/* LOAD DATA and the unknown changes of a incident */
+		network_query_cache_flush(cache);
+		break;
+	default:
+		/* XIDs, heartbeats, rotates, ... don't change a table */
+		break;
+	}
+
+	network_mysqld_binlog_event_free(event);
+}
+
+/**
+ * a packet of the binlog-stream
+ */
+static int replicant_upstream_read_binlog_packet(replicant_upstream_t *up, const char *data, gsize data_len) {
+	network_packet packet;
+	GString s;
+
+	if (data_len == 0) return -1;
+
+	switch ((guint8)data[0]) {
+	case MYSQLD_PACKET_OK:
+		if (up->config->spool &&
+		    0 != replicant_spool_append(up->config->spool, data + 1, data_len - 1)) {
+			g_critical("%s: spooling the event failed",
+					G_STRLOC);
+			return -1;
+		}
+
+		if (up->binlog) replicant_upstream_invalidate_query_cache(up, data + 1, data_len - 1);
+
+		return 0;
+	case MYSQLD_PACKET_ERR:
+		/* the err-packet functions want a network-header in front of it */
+		s.str = (char *)data - NET_HEADER_SIZE;
+		s.len = data_len + NET_HEADER_SIZE;
+		s.allocated_len = 0;
+
+		packet.data = &s;
+		packet.offset = NET_HEADER_SIZE;
+
+		replicant_upstream_log_err_packet(up, &packet);
+		return -1;
+	default:
+		/* EOF, the master stopped the dump */
+		return -1;
+	}
+}
+
+static int replicant_upstream_read_binlog(replicant_upstream_t *up) {
+	GString *s;
+
+	while ((s = g_queue_pop_head(up->server->recv_queue->chunks))) {
+		gsize payload_len = s->len - NET_HEADER_SIZE;
+		int ret = 0;
+
+		if (up->event->len == 0 && payload_len < PACKET_LEN_MAX) {
+			ret = replicant_upstream_read_binlog_packet(up, s->str + NET_HEADER_SIZE, payload_len);
+		} else {
+			/* events larger than 16M are split over several packets */
+			g_string_append_len(up->event, s->str + NET_HEADER_SIZE, payload_len);
+
+			if (payload_len < PACKET_LEN_MAX) {
+				ret = replicant_upstream_read_binlog_packet(up, S(up->event));
+				g_string_truncate(up->event, 0);
+			}
+		}
+
+		g_string_free(s, TRUE);
+
+		if (ret != 0) return -1;
+	}
+
+	return 0;
+}
+
+/**
+ * run the connection to the master until it has to wait for the network
+ */
+static void replicant_upstream_run(replicant_upstream_t *up) {
+	for (;;) {
+		GString *s;
+		int ret;
+
+		switch (up->state) {
+		case REPCLIENT_CONNECT:
+			if (NETWORK_SOCKET_SUCCESS != network_socket_connect_finish(up->server)) {
+				replicant_upstream_retry(up, "connecting failed");
+				return;
+			}
+
+			up->state = REPCLIENT_READ_HANDSHAKE;
+			break;
+		case REPCLIENT_SEND_AUTH:
+			if (!replicant_upstream_write(up)) return;
+
+			up->state = REPCLIENT_READ_AUTH_RESULT;
+			break;
+		case REPCLIENT_SEND_QUERY:
+			if (!replicant_upstream_write(up)) return;
+
+			up->state = REPCLIENT_READ_QUERY_RESULT;
+			break;
+		case REPCLIENT_SEND_BINLOG_DUMP:
+			if (!replicant_upstream_write(up)) return;
+
+			up->state = REPCLIENT_READ_BINLOG;
+			break;
+		case REPCLIENT_READ_HANDSHAKE:
+		case REPCLIENT_READ_AUTH_RESULT:
+		case REPCLIENT_READ_QUERY_RESULT:
+		case REPCLIENT_READ_BINLOG:
+			if (0 != replicant_upstream_read(up)) {
+				replicant_upstream_retry(up, "reading from the master failed");
+				return;
+			}
+
+			if (up->server->recv_queue->chunks->length == 0) {
+				replicant_upstream_wait_for_event(up, EV_READ);
+				return;
+			}
+
+			switch (up->state) {
+			case REPCLIENT_READ_HANDSHAKE:
+				s = g_queue_pop_head(up->server->recv_queue->chunks);
+				ret = replicant_upstream_read_handshake(up, s);
+				g_string_free(s, TRUE);
+
+				if (ret != 0) {
+					replicant_upstream_retry(up, "decoding the handshake failed");
+					return;
+				}
+
+				up->state = REPCLIENT_SEND_AUTH;
+				break;
+			case REPCLIENT_READ_AUTH_RESULT:
+				s = g_queue_pop_head(up->server->recv_queue->chunks);
+				ret = replicant_upstream_read_auth_result(up, s);
+				g_string_free(s, TRUE);
+
+				if (ret != 0) {
+					replicant_upstream_retry(up, "authentication failed");
+					return;
+				}
+
+				up->query_ndx = 0;
+				replicant_upstream_send_next(up);
+				break;
+			case REPCLIENT_READ_QUERY_RESULT:
+				switch (replicant_upstream_read_query_result(up)) {
+				case 0:
+					break;
+				case 1:
+					if (0 != replicant_upstream_query_done(up)) {
+						replicant_upstream_retry(up, replicant_upstream_queries[up->query_ndx]);
+						return;
+					}
+
+					if (up->query_ndx == REPCLIENT_QUERY_GET_CHECKSUM && up->config->spool) {
+						replicant_spool_set_master(up->config->spool, up->master_version, up->has_checksums);
+					}
+
+					while ((s = g_queue_pop_head(up->result))) g_string_free(s, TRUE);
+					network_mysqld_com_query_result_free(up->query_result);
+					up->query_result = NULL;
+
+					up->query_ndx++;
+					replicant_upstream_send_next(up);
+					break;
+				default:
+					replicant_upstream_retry(up, "decoding the result failed");
+					return;
+				}
+				break;
+			case REPCLIENT_READ_BINLOG:
+				if (0 != replicant_upstream_read_binlog(up)) {
+					replicant_upstream_retry(up, "the binlog-dump failed");
+					return;
+				}
+				break;
+			default:
+				g_assert_not_reached();
+			}
+			break;
+		}
+	}
+}
+
+static void replicant_upstream_handle(int G_GNUC_UNUSED event_fd, short events, void *user_data) {
+	replicant_upstream_t *up = user_data;
+
+	if (events == EV_TIMEOUT) {
+		replicant_upstream_retry(up, "the master timed out");
+		return;
+	}
+
+	if (events & EV_READ) {
+		if (NETWORK_SOCKET_SUCCESS != network_socket_to_read(up->server)) {
+			replicant_upstream_retry(up, "ioctl() failed");
+			return;
+		}
+		if (up->server->to_read == 0) {
+			replicant_upstream_retry(up, "the master closed the connection");
+			return;
+		}
+	}
+
+	replicant_upstream_run(up);
+}
+
+/**
+ * the name lookup of the master, runs in a worker
+ */
+typedef struct {
+	replicant_upstream_t *up;
+
+	network_address *addr;
+	gint ret;
+} replicant_upstream_resolve_t;
+
+static void replicant_upstream_resolve(gpointer user_data) {
+	replicant_upstream_resolve_t *resolve = user_data;
+
+	resolve->ret = network_address_set_address(resolve->addr, resolve->up->config->master_address);
+}
+
+/**
+ * connect to the resolved master
+ */
+static void replicant_upstream_resolved(gpointer user_data) {
+	replicant_upstream_resolve_t *resolve = user_data;
+	replicant_upstream_t *up = resolve->up;
+
+	if (0 != resolve->ret) {
+		network_address_free(resolve->addr);
+		g_free(resolve);
+
+		replicant_upstream_retry(up, "invalid address");
+		return;
+	}
+
+	up->server = network_socket_new();
+	network_address_copy(up->server->dst, resolve->addr);
+
+	network_address_free(resolve->addr);
+	g_free(resolve);
+
+	switch (network_socket_connect(up->server)) {
+	case NETWORK_SOCKET_SUCCESS:
+		up->state = REPCLIENT_READ_HANDSHAKE;
+		replicant_upstream_run(up);
+		break;
+	case NETWORK_SOCKET_ERROR_RETRY:
+		up->state = REPCLIENT_CONNECT;
+		replicant_upstream_wait_for_event(up, EV_WRITE);
+		break;
+	default:
+		replicant_upstream_retry(up, "connecting failed");
+		break;
+	}
+}
+
+/**
+ * connect to the master
+ *
+ * the name of the master is looked up in a worker, a slow DNS doesn't block the event-thread
+ */
+static void replicant_upstream_start(replicant_upstream_t *up) {
+	replicant_upstream_resolve_t *resolve;
+
+	resolve = g_new0(replicant_upstream_resolve_t, 1);
+	resolve->up = up;
+	resolve->addr = network_address_new();
+
+	chassis_worker_pool_push(up->chas->workers, replicant_upstream_resolve, replicant_upstream_resolved, resolve);
+}
+
+/**
+ * send a result-set with one row
+ */
+static void relay_send_row(network_socket *sock, const char **names, const char **values, guint values_len) {
+	network_mysqld_resultset_writer_t *w;
+	GPtrArray *fields;
+	guint i;
+
+	fields = network_mysqld_proto_fielddefs_new();
+	for (i = 0; i < values_len; i++) {
+		MYSQL_FIELD *field;
+
+		field = network_mysqld_proto_fielddef_new();
+		field->name = g_strdup(names[i]);
+		field->type = FIELD_TYPE_VAR_STRING;
+		g_ptr_array_add(fields, field);
+	}
+
+	w = network_mysqld_resultset_writer_new(sock);
+	network_mysqld_resultset_writer_write_fields(w, fields);
+
+	network_mysqld_resultset_writer_row_start(w);
+	for (i = 0; i < values_len; i++) {
+		network_mysqld_resultset_writer_row_append(w, values[i], values[i] ? strlen(values[i]) : 0);
+	}
+	network_mysqld_resultset_writer_row_end(w);
+
+	network_mysqld_resultset_writer_finish(w);
+	network_mysqld_resultset_writer_free(w);
+
+	network_mysqld_proto_fielddefs_free(fields);
+}
+
+/**
+ * answer the queries a replica sends before the COM_BINLOG_DUMP
+ */
+static void relay_handle_query(network_mysqld_con *con, const char *query, gsize query_len) {
+	plugin_con_state *st = con->plugin_con_state;
+	chassis_plugin_config *config = con->config;
+	gchar *server_id = g_strdup_printf("%d", config->server_id);
+	const char *names[2];
+	const char *values[2];
+
+	if (strleq(query, query_len, C("SELECT UNIX_TIMESTAMP()"))) {
+		gchar *now = g_strdup_printf("%ld", (long)time(NULL));
+
+		names[0] = "UNIX_TIMESTAMP()";
+		values[0] = now;
+		relay_send_row(con->client, names, values, 1);
+
+		g_free(now);
+	} else if (strleq(query, query_len, C("SHOW VARIABLES LIKE 'SERVER_ID'"))) {
+		names[0] = "Variable_name";
+		values[0] = "server_id";
+		names[1] = "Value";
+		values[1] = server_id;
+		relay_send_row(con->client, names, values, 2);
+	} else if (strleq(query, query_len, C("SELECT @@GLOBAL.SERVER_ID"))) {
+		names[0] = "@@GLOBAL.SERVER_ID";
+		values[0] = server_id;
+		relay_send_row(con->client, names, values, 1);
+	} else if (strleq(query, query_len, C("SELECT @master_binlog_checksum"))) {
+		gchar *master_version;
+		gboolean has_checksums;
+
+		replicant_spool_get_master(config->spool, &master_version, &has_checksums);
+		g_free(master_version);
+
+		names[0] = "@master_binlog_checksum";
+		values[0] = has_checksums ? "CRC32" : "NONE";
+		relay_send_row(con->client, names, values, 1);
+	} else if (query_len > 4 && 0 == g_ascii_strncasecmp(query, C("SET "))) {
+		/* SET @master_binlog_checksum = @@global.binlog_checksum, SET @master_heartbeat_period = <nsec>, SET NAMES, ... */
+		const char *value = memchr(query, '=', query_len);
+
+		if (value && 0 == g_ascii_strncasecmp(query, C("SET @master_binlog_checksum"))) {
+			st->has_checksums = TRUE;
+		} else if (value && 0 == g_ascii_strncasecmp(query, C("SET @master_heartbeat_period"))) {
+			gchar *nsec = g_strndup(value + 1, query_len - (value + 1 - query));
+
+			st->heartbeat_period_usec = g_ascii_strtoull(g_strstrip(nsec), NULL, 10) / 1000;
+			g_free(nsec);
+		}
+
+		network_mysqld_con_send_ok(con->client);
+	} else if (query_len > 9 && 0 == g_ascii_strncasecmp(query, C("SELECT @@"))) {
+		/* the replicas only treat this error as harmless */
+		network_mysqld_con_send_error_full(con->client, C("(replicant) Unknown system variable"), ER_UNKNOWN_SYSTEM_VARIABLE, "HY000");
+	} else {
+		network_mysqld_con_send_error(con->client, C("(replicant) query not known"));
+	}
+
+	g_free(server_id);
+}
+
+/**
+ * append a event as packet to the send-queue of the replica
+ */
+static void relay_queue_event(network_mysqld_con *con, GString *packet) {
+	network_mysqld_queue_append(con->client, con->client->send_queue, S(packet));
+}
+
+/**
+ * queue the events the replica doesn't have yet
+ *
+ * @return 1 if the send-queue is full, 0 if all events are queued, -1 on error
+ */
+static int relay_queue_events(network_mysqld_con *con) {
+	plugin_con_state *st = con->plugin_con_state;
+	chassis_plugin_config *config = con->config;
 
-	gchar **read_binlogs;
+	while (con->client->send_queue->len < RELAY_SEND_QUEUE_SIZE) {
+		g_string_truncate(st->packet, 0);
+		g_string_append_c(st->packet, MYSQLD_PACKET_OK);
 
-	network_mysqld_con *listen_con;
-};
+		switch (replicant_spool_read(config->spool, st->reader, st->packet)) {
+		case REPLICANT_SPOOL_READ_EVENT:
+			relay_queue_event(con, st->packet);
+			break;
+		case REPLICANT_SPOOL_READ_WAIT:
+			return 0;
+		default:
+			return -1;
+		}
+	}
 
+	return 1;
+}
 
-static plugin_con_state *plugin_con_state_init() {
-	plugin_con_state *st;
+static void relay_wakeup(int G_GNUC_UNUSED event_fd, short G_GNUC_UNUSED events, void *user_data) {
+	network_mysqld_con *con = user_data;
+	plugin_con_state *st = con->plugin_con_state;
 
-	st = g_new0(plugin_con_state, 1);
+	st->is_woken = TRUE;
 
-	return st;
+	network_mysqld_con_handle(-1, 0, con);
 }
 
-static void plugin_con_state_free(plugin_con_state *st) {
-	if (!st) return;
+static void relay_heartbeat(int G_GNUC_UNUSED event_fd, short G_GNUC_UNUSED events, void *user_data) {
+	network_mysqld_con *con = user_data;
+	plugin_con_state *st = con->plugin_con_state;
 
-	if (st->binlog_file) g_free(st->binlog_file);
+	st->heartbeat_is_due = TRUE;
 
-	g_free(st);
+	network_mysqld_con_handle(-1, 0, con);
 }
 
 /**
- * decode the result-set of SHOW MASTER STATUS
+ * send the next events to the replica or wait for them
  */
-static int network_mysqld_resultset_master_status(chassis *UNUSED_PARAM(chas), network_mysqld_con *con) {
-	GList *chunk;
-	guint i;
-	network_socket *sock = con->client;
+static network_socket_retval_t relay_continue_binlog_dump(chassis *chas, network_mysqld_con *con) {
 	plugin_con_state *st = con->plugin_con_state;
-	GPtrArray *fields;
-	int err = 0;
+	chassis_plugin_config *config = con->config;
 
-	/* scan the resultset */
-	chunk = sock->send_queue->chunks->head;
+	for (;;) {
+		switch (relay_queue_events(con)) {
+		case 0:
+			break;
+		case 1:
+			con->state = CON_STATE_SEND_QUERY_RESULT;
+			return NETWORK_SOCKET_SUCCESS;
+		default:
+			g_critical("%s: reading %s:%u from the spool failed",
+					G_STRLOC,
+					st->reader->binlog_file,
+					st->reader->pos);
+			con->state = CON_STATE_ERROR;
+			return NETWORK_SOCKET_SUCCESS;
+		}
 
-	fields = network_mysqld_proto_fielddefs_new();
-	chunk = network_mysqld_proto_get_fielddefs(chunk, fields);
+		if (con->client->send_queue->len > 0) {
+			con->state = CON_STATE_SEND_QUERY_RESULT;
+			return NETWORK_SOCKET_SUCCESS;
+		}
 
-	/* a data row */
-	while (NULL != (chunk = chunk->next)) {
-		network_packet packet;
-		network_mysqld_lenenc_type lenenc_type;
+		if (st->is_non_block) {
+			/* the replica only wants what we have */
+			network_mysqld_eof_packet_t *eof = network_mysqld_eof_packet_new();
 
-		packet.data = chunk->data;
-		packet.offset = 0;
+			g_string_truncate(st->packet, 0);
+			network_mysqld_proto_append_eof_packet(st->packet, eof);
+			network_mysqld_eof_packet_free(eof);
 
-		err = err || network_mysqld_proto_peek_lenenc_type(&packet, &lenenc_type);
-		if (err) break; /* proto error */
+			relay_queue_event(con, st->packet);
 
-		if (lenenc_type == NETWORK_MYSQLD_LENENC_TYPE_EOF) break; /* last packet */
+			replicant_spool_reader_free(st->reader);
+			st->reader = NULL;
 
-		for (i = 0; i < fields->len; i++) {
-			guint64 field_len;
-			err = err || network_mysqld_proto_peek_lenenc_type(&packet, &lenenc_type);
+			con->state = CON_STATE_SEND_QUERY_RESULT;
+			return NETWORK_SOCKET_SUCCESS;
+		}
 
-			switch (lenenc_type) {
-			case NETWORK_MYSQLD_LENENC_TYPE_INT:
-				err = err || network_mysqld_proto_get_lenenc_int(&packet, &field_len);
+		event_set(&(st->waiter.ev), -1, 0, relay_wakeup, con);
+		if (replicant_spool_wait(config->spool, st->reader, &(st->waiter))) break;
 
-				if (i == 0) {
-					gchar *s;
-					/* Position */
+		/* a new event arrived in the meantime */
+	}
 
-					err = err || !(field_len > 0);
-					err = err || network_mysqld_proto_get_string_len(&packet, &s, field_len);
+	if (st->heartbeat_period_usec > 0) {
+		struct timeval tv;
 
-					if (!err) {
-						if (st->binlog_file) g_free(st->binlog_file);
-						st->binlog_file = s;
-					}
-				} else if (i == 1) {
-					/* is a string */
-					gchar *num;
-
-					err = err || !(field_len > 0);
-					err = err || network_mysqld_proto_get_string_len(&packet, &num, field_len);
-					if (!err) {
-						st->binlog_pos = g_ascii_strtoull(num, NULL, 10);
-					}
-				} else {
-					/* extra fields we don't expect */
-					err = err || network_mysqld_proto_skip(&packet, field_len);
-				}
-			default:
-				/* we don't expect a ERR, EOF or NULL here */
-				break;
-			}
-		}
+		tv.tv_sec  = st->heartbeat_period_usec / G_USEC_PER_SEC;
+		tv.tv_usec = st->heartbeat_period_usec % G_USEC_PER_SEC;
 
-		if (!err) {
-			g_message("reading binlog from: binlog-file: %s, binlog-pos: %d", 
-					st->binlog_file, st->binlog_pos);
-		}
+		evtimer_set(&(st->heartbeat_ev), relay_heartbeat, con);
+		chassis_event_add_local_with_timeout(chas, &(st->heartbeat_ev), &tv);
 	}
 
-	return err ? -1 : 0;
+	con->state = CON_STATE_WAIT_ASYNC;
+
+	return NETWORK_SOCKET_SUCCESS;
 }
 
-NETWORK_MYSQLD_PLUGIN_PROTO(repclient_read_handshake) {
-	network_packet packet;
-	network_socket *recv_sock;
-	network_socket *send_sock = NULL;
+/**
+ * COM_BINLOG_DUMP
+ *
+ * - 4byte pos
+ * - 2byte flags (BINLOG_DUMP_NON_BLOCK)
+ * - 4byte slave-server-id
+ * - binlog name
+ */
+static network_socket_retval_t relay_start_binlog_dump(chassis *chas, network_mysqld_con *con, network_packet *packet) {
+	plugin_con_state *st = con->plugin_con_state;
 	chassis_plugin_config *config = con->config;
-	network_mysqld_auth_challenge *shake;
-	network_mysqld_auth_response  *auth;
-	GString *auth_packet;
+	GString *binlog_file;
+	guint32 binlog_pos, server_id;
+	guint16 flags;
+	gchar *master_version;
+	gboolean has_checksums;
 	int err = 0;
-	
-	recv_sock = con->server;
-	send_sock = con->server;
-
-	/* there should only be on packet */
-
-	packet.data = g_queue_peek_tail(recv_sock->recv_queue->chunks);
-	packet.offset = 0;
 
-	err = err || network_mysqld_proto_skip_network_header(&packet);
-	if (err) return NETWORK_SOCKET_ERROR;
-
-	shake = network_mysqld_auth_challenge_new();
-	err = err || network_mysqld_proto_get_auth_challenge(&packet, shake);
-
-	g_string_free(g_queue_pop_tail(recv_sock->recv_queue->chunks), TRUE);
+	binlog_file = g_string_new(NULL);
 
+	err = err || network_mysqld_proto_get_int32(packet, &binlog_pos);
+	err = err || network_mysqld_proto_get_int16(packet, &flags);
+	err = err || network_mysqld_proto_get_int32(packet, &server_id);
+	err = err || network_mysqld_proto_get_gstring_len(packet, packet->data->len - packet->offset, binlog_file);
 	if (err) {
-		network_mysqld_auth_challenge_free(shake);
+		g_string_free(binlog_file, TRUE);
 		return NETWORK_SOCKET_ERROR;
 	}
 
-	/* build the auth packet */
-	auth_packet = g_string_new(NULL);
+	/* some replicas send the name with a term-nul */
+	if (binlog_file->len > 0 && binlog_file->str[binlog_file->len - 1] == '\0') g_string_truncate(binlog_file, binlog_file->len - 1);
 
-	auth = network_mysqld_auth_response_new(shake->capabilities);
+	replicant_spool_get_master(config->spool, &master_version, &has_checksums);
+	g_free(master_version);
 
-	auth->client_capabilities = shake->capabilities;
-	auth->charset      = shake->charset;
+	st->reader = replicant_spool_reader_new();
+	st->is_non_block = (flags & 0x01) != 0;
 
-	if (config->mysqld_username) {
-		g_string_append(auth->username, config->mysqld_username);
+	if (has_checksums && !st->has_checksums) {
+		network_mysqld_con_send_error_full(con->client, C("Slave can not handle replication events with the checksum that master is configured to log"), ER_MASTER_FATAL_ERROR_READING_BINLOG, "HY000");
+	} else {
+		switch (replicant_spool_reader_seek(config->spool, st->reader, binlog_file->str, binlog_pos)) {
+		case 0:
+			break;
+		case -2:
+			network_mysqld_con_send_error_full(con->client, C("Client requested master to start replication from position > file size"), ER_MASTER_FATAL_ERROR_READING_BINLOG, "HY000");
+			break;
+		default:
+			network_mysqld_con_send_error_full(con->client, C("Could not find first log file name in binary log index file"), ER_MASTER_FATAL_ERROR_READING_BINLOG, "HY000");
+			break;
+		}
 	}
+	g_string_free(binlog_file, TRUE);
 
-	if (config->mysqld_password) {
-		GString *hashed_password;
-
-		hashed_password = g_string_new(NULL);
-		network_mysqld_proto_password_hash(hashed_password, config->mysqld_password, strlen(config->mysqld_password));
+	if (con->client->send_queue->len > 0) {
+		/* the ERR */
+		replicant_spool_reader_free(st->reader);
+		st->reader = NULL;
 
-		network_mysqld_proto_password_scramble(auth->auth_plugin_data, S(shake->auth_plugin_data), S(hashed_password));
+		con->state = CON_STATE_SEND_QUERY_RESULT;
+		return NETWORK_SOCKET_SUCCESS;
 	}
 
-	network_mysqld_proto_append_auth_response(auth_packet, auth);
-
-	network_mysqld_queue_append(send_sock, send_sock->send_queue, S(auth_packet));
-
-	network_mysqld_auth_response_free(auth);
-	network_mysqld_auth_challenge_free(shake);
-
-	con->state = CON_STATE_SEND_AUTH;
+	g_message("%s: replica (server-id = %u) starts at %s:%u",
+			G_STRLOC,
+			server_id,
+			st->reader->binlog_file,
+			st->reader->pos);
+
+	/* tell the replica where we start, like the master does */
+	g_string_truncate(st->packet, 0);
+	g_string_append_c(st->packet, MYSQLD_PACKET_OK);
+	replicant_binlog_append_rotate_event(st->packet, config->server_id, st->reader->binlog_file, st->reader->pos, has_checksums);
+	relay_queue_event(con, st->packet);
+
+	if (st->reader->pos > REPLICANT_BINLOG_HEADER_SIZE) {
+		/* in the middle of a binlog, it needs the format of the events */
+		g_string_truncate(st->packet, 0);
+		g_string_append_c(st->packet, MYSQLD_PACKET_OK);
+		if (0 != replicant_spool_read_format_description(config->spool, st->reader, st->packet)) {
+			g_critical("%s: reading the format-description-event of %s failed",
+					G_STRLOC,
+					st->reader->binlog_file);
+			return NETWORK_SOCKET_ERROR;
+		}
+		relay_queue_event(con, st->packet);
+	}
 
-	return NETWORK_SOCKET_SUCCESS;
+	return relay_continue_binlog_dump(chas, con);
 }
 
-NETWORK_MYSQLD_PLUGIN_PROTO(repclient_read_auth_result) {
-	network_socket *recv_sock;
-	network_socket *send_sock = NULL;
-	network_packet packet;
-	guint8 status;
-	int err = 0;
-
-	const char query_packet[] = 
-		"\x03"                    /* COM_QUERY */
-		"SHOW MASTER STATUS"
-		;
-
-	recv_sock = con->server;
-
-	packet.data = g_queue_peek_head(recv_sock->recv_queue->chunks);
-	packet.offset = 0;
+NETWORK_MYSQLD_PLUGIN_PROTO(relay_con_init) {
+	chassis_plugin_config *config = con->config;
+	network_mysqld_auth_challenge *challenge;
+	gchar *master_version;
+	gboolean has_checksums;
+	GString *packet;
 
-	err = err || network_mysqld_proto_skip_network_header(&packet);
-	err = err || network_mysqld_proto_peek_int8(&packet, &status);
-	if (err) return NETWORK_SOCKET_ERROR;
+	g_assert(con->plugin_con_state == NULL);
 
-	/* the auth should be fine */
-	switch (status) {
-	case MYSQLD_PACKET_ERR: {
-		network_mysqld_err_packet_t *err_packet;
+	con->plugin_con_state = plugin_con_state_init();
 
-		err_packet = network_mysqld_err_packet_new();
+	replicant_spool_get_master(config->spool, &master_version, &has_checksums);
 
-		err = err || network_mysqld_proto_get_err_packet(&packet, err_packet);
+	if (!master_version) {
+		/* we don't know which events the master sends yet, let the replica try again later */
+		network_mysqld_con_send_error_full(con->client, C("(replicant) not connected to the master yet"), ER_CON_COUNT_ERROR, "08004");
+		con->state = CON_STATE_SEND_ERROR;
 
-		if (!err) {
-			g_critical("%s: repclient_read_auth_result() failed: %s (errno = %d)", 
-					G_STRLOC,
-					err_packet->errmsg->len ? err_packet->errmsg->str : "",
-					err_packet->errcode);
-		}
+		return NETWORK_SOCKET_SUCCESS;
+	}
 
-		network_mysqld_err_packet_free(err_packet);
+	challenge = network_mysqld_auth_challenge_new();
+	challenge->server_version_str = master_version; /* the replicas decide about the checksums by the version */
+	challenge->server_version     = 50099;
+	challenge->charset            = 0x08; /* latin1 */
+	challenge->capabilities       = CLIENT_PROTOCOL_41 | CLIENT_SECURE_CONNECTION | CLIENT_LONG_PASSWORD;
+	if (config->compress) challenge->capabilities |= CLIENT_COMPRESS;
+	challenge->server_status      = SERVER_STATUS_AUTOCOMMIT;
+	challenge->thread_id          = 1;
 
-		return NETWORK_SOCKET_ERROR; }
-	case MYSQLD_PACKET_OK: 
-		break; 
-	default:
-		g_critical("%s: packet should be (OK|ERR), got: 0x%02x",
-				G_STRLOC,
-				status);
+	network_mysqld_auth_challenge_set_challenge(challenge); /* generate a random challenge */
 
-		return NETWORK_SOCKET_ERROR;
-	} 
+	packet = g_string_new(NULL);
+	network_mysqld_proto_append_auth_challenge(packet, challenge);
+	con->client->challenge = challenge;
 
-	g_string_free(g_queue_pop_tail(recv_sock->recv_queue->chunks), TRUE);
+	network_mysqld_queue_append(con->client, con->client->send_queue, S(packet));
 
-	send_sock = con->server;
-	network_mysqld_queue_append(send_sock, send_sock->send_queue, C(query_packet));
+	g_string_free(packet, TRUE);
 
-	con->state = CON_STATE_SEND_QUERY;
+	con->state = CON_STATE_SEND_HANDSHAKE;
 
 	return NETWORK_SOCKET_SUCCESS;
 }
 
 /**
- * inject a COM_BINLOG_DUMP after we have sent our SHOW MASTER STATUS
+ * the replicas log in with the same user as we do at the master
  */
-NETWORK_MYSQLD_PLUGIN_PROTO(repclient_read_query_result) {
-	/* let's send the
-	 *
-	 * ask the server for the current binlog-file|pos and dump everything from there
-	 *  
-	 * - COM_BINLOG_DUMP
-	 *   - 4byte pos
-	 *   - 2byte flags (BINLOG_DUMP_NON_BLOCK)
-	 *   - 4byte slave-server-id
-	 *   - nul-term binlog name
-	 *
-	 * we don't need:
-	 * - COM_REGISTER_SLAVE
-	 *   - 4byte server-id
-	 *   - nul-term host
-	 *   - nul-term user
-	 *   - nul-term password
-	 *   - 2byte port
-	 *   - 4byte recovery rank
-	 *   - 4byte master-id
-	 */
+NETWORK_MYSQLD_PLUGIN_PROTO(relay_read_auth) {
+	chassis_plugin_config *config = con->config;
 	network_packet packet;
-	GList *chunk;
 	network_socket *recv_sock, *send_sock;
-	int is_finished = 0;
-	plugin_con_state *st = con->plugin_con_state;
-	guint8 status;
-	int err = 0;
+	network_mysqld_auth_response *auth;
+	GString *excepted_response;
+	GString *hashed_password;
 
-	recv_sock = con->server;
+	recv_sock = con->client;
 	send_sock = con->client;
 
-	chunk = recv_sock->recv_queue->chunks->tail;
-	packet.data = chunk->data;
+	packet.data = g_queue_peek_head(recv_sock->recv_queue->chunks);
 	packet.offset = 0;
 
-#if 0
-	g_message("%s.%d: packet-len: %08x, packet-id: %d, command: COM_(%02x)", 
-			__FILE__, __LINE__,
-			recv_sock->packet_len,
-			recv_sock->packet_id,
-			con->parse.command
-		);
-#endif						
+	/* decode the packet */
+	network_mysqld_proto_skip_network_header(&packet);
 
-	is_finished = network_mysqld_proto_get_query_result(&packet, con);
-	if (is_finished == -1) return NETWORK_SOCKET_ERROR;
+	auth = network_mysqld_auth_response_new(con->client->challenge->capabilities);
+	if (network_mysqld_proto_get_auth_response(&packet, auth)) {
+		network_mysqld_auth_response_free(auth);
+		return NETWORK_SOCKET_ERROR;
+	}
+	if (!(auth->client_capabilities & CLIENT_PROTOCOL_41)) {
+		/* should use packet-id 0 */
+		network_mysqld_queue_append(con->client, con->client->send_queue, C("\xff\xd7\x07" "4.0 protocol is not supported"));
+		network_mysqld_auth_response_free(auth);
+		return NETWORK_SOCKET_ERROR;
+	}
 
-	switch (con->parse.command) {
-	case COM_BINLOG_DUMP:
-		packet.offset = 0;
+	con->client->response = auth;
 
-		err = err || network_mysqld_proto_skip_network_header(&packet);
-		err = err || network_mysqld_proto_get_int8(&packet, &status);
+	/* our answer to the handshake-response is compressed already */
+	if ((auth->client_capabilities & CLIENT_COMPRESS) &&
+	    (con->client->challenge->capabilities & CLIENT_COMPRESS)) {
+		network_socket_set_compressed(con->client);
+	}
 
-		switch (status) {
-		case MYSQLD_PACKET_OK: {
-			/* looks like the binlog dump started */
-			network_mysqld_binlog *binlog;
-			network_mysqld_binlog_event *event;
+	/* check if the password matches */
+	excepted_response = g_string_new(NULL);
+	hashed_password = g_string_new(NULL);
 
-			binlog = network_mysqld_binlog_new();
-			event = network_mysqld_binlog_event_new();
+	if (config->mysqld_password[0] != '\0') {
+		network_mysqld_proto_password_hash(hashed_password, config->mysqld_password, strlen(config->mysqld_password));
+		network_mysqld_proto_password_scramble(excepted_response,
+				S(recv_sock->challenge->auth_plugin_data),
+				S(hashed_password));
+	}
 
-			network_mysqld_proto_skip_network_header(&packet);
-			network_mysqld_proto_get_binlog_status(&packet);
-			network_mysqld_proto_get_binlog_event_header(&packet, event);
-			network_mysqld_proto_get_binlog_event(&packet, binlog, event);
+	if (!strleq(S(auth->username), config->mysqld_username, strlen(config->mysqld_username))) {
+		network_mysqld_con_send_error_full(send_sock, C("unknown user"), 1045, "28000");
 
-			/* do something */
+		con->state = CON_STATE_SEND_ERROR; /* close the connection after we have sent this packet */
+	} else if (!g_string_equal(excepted_response, auth->auth_plugin_data)) {
+		network_mysqld_con_send_error_full(send_sock, C("password doesn't match"), 1045, "28000");
 
-			network_mysqld_binlog_event_free(event);
-			network_mysqld_binlog_free(binlog);
+		con->state = CON_STATE_SEND_ERROR; /* close the connection after we have sent this packet */
+	} else {
+		network_mysqld_con_send_ok(send_sock);
 
-			break; }
-		default:
-			break;
-		}
-		break;
-	default:
-		break;
+		con->state = CON_STATE_SEND_AUTH_RESULT;
 	}
 
-	network_mysqld_queue_append(send_sock,
-			send_sock->send_queue, 
-			packet.data->str + NET_HEADER_SIZE, 
-			packet.data->len - NET_HEADER_SIZE);
+	g_string_free(hashed_password, TRUE);
+	g_string_free(excepted_response, TRUE);
 
-	/* ... */
-	if (is_finished) {
-		/**
-		 * the resultset handler might decide to trash the send-queue
-		 * 
-		 * */
-		GString *query_packet;
-		int my_server_id = 2;
-		network_mysqld_binlog_dump *dump;
-		GString *s_packet;
+	g_string_free(g_queue_pop_tail(recv_sock->recv_queue->chunks), TRUE);
 
-		switch (st->state) {
-		case REPCLIENT_BINLOG_GET_POS:
-			/* parse the result-set and get the 1st and 2nd column */
+	return NETWORK_SOCKET_SUCCESS;
+}
 
-			network_mysqld_resultset_master_status(chas, con);
+NETWORK_MYSQLD_PLUGIN_PROTO(relay_read_query) {
+	network_socket *recv_sock = con->client;
+	network_socket_retval_t ret = NETWORK_SOCKET_SUCCESS;
+	network_packet packet;
+	guint8 command;
+	int err = 0;
 
-			/* remove all packets */
-			while ((s_packet = g_queue_pop_head(send_sock->send_queue->chunks))) g_string_free(s_packet, TRUE);
+	packet.data = g_queue_peek_head(recv_sock->recv_queue->chunks);
+	packet.offset = 0;
 
-			st->state = REPCLIENT_BINLOG_DUMP;
+	err = err || network_mysqld_proto_skip_network_header(&packet);
+	err = err || network_mysqld_proto_get_int8(&packet, &command);
+	if (err) return NETWORK_SOCKET_ERROR;
 
-			dump = network_mysqld_binlog_dump_new();
-			dump->binlog_pos  = st->binlog_pos;
-			dump->server_id   = my_server_id;
-			dump->binlog_file = g_strdup(st->binlog_file);
+	con->state = CON_STATE_SEND_QUERY_RESULT;
 
-			query_packet = g_string_new(NULL);
+	switch (command) {
+	case COM_QUERY:
+		relay_handle_query(con, packet.data->str + packet.offset, packet.data->len - packet.offset);
+		break;
+	case COM_BINLOG_DUMP:
+		ret = relay_start_binlog_dump(chas, con, &packet);
+		break;
+	case COM_REGISTER_SLAVE:
+	case COM_PING:
+		network_mysqld_con_send_ok(con->client);
+		break;
+	case COM_QUIT:
+		con->state = CON_STATE_CLOSE_CLIENT;
+		break;
+	default:
+		network_mysqld_con_send_error(con->client, C("(replicant) command not supported"));
+		break;
+	}
 
-			network_mysqld_proto_append_binlog_dump(query_packet, dump);
-		       	
-			send_sock = con->server;
-			network_mysqld_queue_append(send_sock, send_sock->send_queue, S(query_packet));
+	g_string_free(g_queue_pop_head(recv_sock->recv_queue->chunks), TRUE);
 
-			network_mysqld_binlog_dump_free(dump);
-		
-			g_string_free(query_packet, TRUE);
-		
-			con->state = CON_STATE_SEND_QUERY;
+	return ret;
+}
 
-			break;
-		case REPCLIENT_BINLOG_DUMP:
-			/* remove all packets */
+NETWORK_MYSQLD_PLUGIN_PROTO(relay_send_query_result) {
+	plugin_con_state *st = con->plugin_con_state;
 
-			/* trash the packets for the injection query */
-			while ((s_packet = g_queue_pop_head(send_sock->send_queue->chunks))) g_string_free(s_packet, TRUE);
+	if (!st->reader) {
+		con->state = CON_STATE_READ_QUERY;
 
-			con->state = CON_STATE_READ_QUERY_RESULT;
-			break;
-		}
+		return NETWORK_SOCKET_SUCCESS;
 	}
 
-	if (chunk->data) g_string_free(chunk->data, TRUE);
-	g_queue_delete_link(recv_sock->recv_queue->chunks, chunk);
-
-	return NETWORK_SOCKET_SUCCESS;
+	return relay_continue_binlog_dump(chas, con);
 }
 
-NETWORK_MYSQLD_PLUGIN_PROTO(repclient_connect_server) {
+/**
+ * the spool has new events or the replica needs a heartbeat
+ */
+NETWORK_MYSQLD_PLUGIN_PROTO(relay_wait_async) {
+	plugin_con_state *st = con->plugin_con_state;
 	chassis_plugin_config *config = con->config;
-	gchar *address = config->master_address;
 
-	con->server = network_socket_new();
+	if (st->is_woken) {
+		st->is_woken = FALSE;
+		st->heartbeat_is_due = FALSE;
+		if (st->heartbeat_period_usec > 0) evtimer_del(&(st->heartbeat_ev));
 
-	if (0 != network_address_set_address(con->server->dst, address)) {
-		return -1;
-	}
-    
-	/* FIXME ... add non-blocking support (getsockopt()) */
+		return relay_continue_binlog_dump(chas, con);
+	} else if (st->heartbeat_is_due) {
+		gboolean has_checksums;
+		gchar *master_version;
 
-	if (0 != network_socket_connect(con->server)) {
-		return -1;
-	}
+		st->heartbeat_is_due = FALSE;
 
-	con->state = CON_STATE_SEND_HANDSHAKE;
+		/* if the spool woke us up already, relay_wakeup() is on its way */
+		if (!replicant_spool_cancel_wait(config->spool, &(st->waiter))) return NETWORK_SOCKET_WAIT_FOR_EVENT;
 
-	return NETWORK_SOCKET_SUCCESS;
-}
+		replicant_spool_get_master(config->spool, &master_version, &has_checksums);
+		g_free(master_version);
 
-NETWORK_MYSQLD_PLUGIN_PROTO(repclient_init) {
-	g_assert(con->plugin_con_state == NULL);
+		g_string_truncate(st->packet, 0);
+		g_string_append_c(st->packet, MYSQLD_PACKET_OK);
+		replicant_binlog_append_heartbeat_event(st->packet, config->server_id, st->reader->binlog_file, st->reader->pos, has_checksums);
+		relay_queue_event(con, st->packet);
 
-	con->plugin_con_state = plugin_con_state_init();
-	
-	con->state = CON_STATE_CONNECT_SERVER;
+		con->state = CON_STATE_SEND_QUERY_RESULT;
 
-	return NETWORK_SOCKET_SUCCESS;
+		return NETWORK_SOCKET_SUCCESS;
+	}
+
+	/* we just started to wait */
+	return NETWORK_SOCKET_WAIT_FOR_EVENT;
 }
 
-NETWORK_MYSQLD_PLUGIN_PROTO(repclient_cleanup) {
-	if (con->plugin_con_state == NULL) return NETWORK_SOCKET_SUCCESS;
+NETWORK_MYSQLD_PLUGIN_PROTO(relay_cleanup) {
+	plugin_con_state *st = con->plugin_con_state;
+	chassis_plugin_config *config = con->config;
+
+	if (st == NULL) return NETWORK_SOCKET_SUCCESS;
+
+	if (st->waiter.is_waiting) replicant_spool_cancel_wait(config->spool, &(st->waiter));
+	if (st->heartbeat_period_usec > 0) evtimer_del(&(st->heartbeat_ev));
+
+	plugin_con_state_free(st);
 
-	plugin_con_state_free(con->plugin_con_state);
-	
 	con->plugin_con_state = NULL;
 
 	return NETWORK_SOCKET_SUCCESS;
 }
 
-int network_mysqld_repclient_connection_init(chassis G_GNUC_UNUSED *chas, network_mysqld_con *con) {
-	con->plugins.con_init                      = repclient_init;
-	con->plugins.con_connect_server            = repclient_connect_server;
-	con->plugins.con_read_handshake            = repclient_read_handshake;
-	con->plugins.con_read_auth_result          = repclient_read_auth_result;
-	con->plugins.con_read_query_result         = repclient_read_query_result;
-	con->plugins.con_cleanup                   = repclient_cleanup;
+static int network_mysqld_relay_connection_init(network_mysqld_con *con) {
+	con->plugins.con_init                      = relay_con_init;
+	con->plugins.con_read_auth                 = relay_read_auth;
+	con->plugins.con_read_query                = relay_read_query;
+	con->plugins.con_send_query_result         = relay_send_query_result;
+	con->plugins.con_wait_async                = relay_wait_async;
+	con->plugins.con_cleanup                   = relay_cleanup;
 
 	return 0;
 }
@@ -535,10 +1639,6 @@ void network_mysqld_replicant_plugin_free(chassis_plugin_config *config) {
 		/**
 		 * the connection will be free()ed by the network_mysqld_free()
 		 */
-#if 0
-		event_del(&(config->listen_con->server->event));
-		network_mysqld_con_free(config->listen_con);
-#endif
 	}
 
 	if (config->master_address) {
@@ -549,23 +1649,36 @@ void network_mysqld_replicant_plugin_free(chassis_plugin_config *config) {
 	if (config->mysqld_username) g_free(config->mysqld_username);
 	if (config->mysqld_password) g_free(config->mysqld_password);
 	if (config->read_binlogs) g_strfreev(config->read_binlogs);
+	if (config->read_binlogs_filter_tables) g_strfreev(config->read_binlogs_filter_tables);
+	if (config->relay_dir) g_free(config->relay_dir);
+	if (config->relay_address) g_free(config->relay_address);
+
+	if (config->upstream) replicant_upstream_free(config->upstream);
+	if (config->spool) replicant_spool_free(config->spool);
 
 	g_free(config);
 }
 
 /**
- * plugin options 
+ * plugin options
  */
 static GOptionEntry * network_mysqld_replicant_plugin_get_options(chassis_plugin_config *config) {
 	guint i;
 
 	/* make sure it isn't collected */
-	static GOptionEntry config_entries[] = 
+	static GOptionEntry config_entries[] =
 	{
 		{ "replicant-master-address",            0, 0, G_OPTION_ARG_STRING, NULL, "... (default: :4040)", "<host:port>" },
 		{ "replicant-username",                  0, 0, G_OPTION_ARG_STRING, NULL, "username", "" },
 		{ "replicant-password",                  0, 0, G_OPTION_ARG_STRING, NULL, "password", "" },
 		{ "replicant-read-binlogs",              0, 0, G_OPTION_ARG_FILENAME_ARRAY, NULL, "binlog files", "" },
+		{ "replicant-read-binlogs-filter-table", 0, 0, G_OPTION_ARG_STRING_ARRAY, NULL, "only decode the events of these tables of the binlog files", "<db>.<table>" },
+		{ "replicant-relay-dir",                 0, 0, G_OPTION_ARG_FILENAME, NULL, "spool the binlogs of the master into this directory and serve them to replicas", "<dir>" },
+		{ "replicant-relay-address",             0, 0, G_OPTION_ARG_STRING, NULL, "listening address:port for the replicas (default: :4042)", "<host:port>" },
+		{ "replicant-server-id",                 0, 0, G_OPTION_ARG_INT, NULL, "server-id at the master and for the replicas (default: 2)", "<int>" },
+		{ "replicant-invalidate-query-cache",    0, 0, G_OPTION_ARG_NONE, NULL, "drop the cached query results of the tables the binlog of the master changes", NULL },
+		{ "replicant-relay-compress-level",      0, 0, G_OPTION_ARG_INT, NULL, "compress the spooled binlogs the master rotated away from, 1 (fast) to 9 (small) (default: 0, off)", "<int>" },
+		{ "replicant-compress",                  0, 0, G_OPTION_ARG_NONE, NULL, "use the compressed protocol to the master and offer it to the replicas", NULL },
 		{ NULL,                       0, 0, G_OPTION_ARG_NONE,   NULL, NULL, NULL }
 	};
 
@@ -574,7 +1687,14 @@ static GOptionEntry * network_mysqld_replicant_plugin_get_options(chassis_plugin
 	config_entries[i++].arg_data = &(config->mysqld_username);
 	config_entries[i++].arg_data = &(config->mysqld_password);
 	config_entries[i++].arg_data = &(config->read_binlogs);
-	
+	config_entries[i++].arg_data = &(config->read_binlogs_filter_tables);
+	config_entries[i++].arg_data = &(config->relay_dir);
+	config_entries[i++].arg_data = &(config->relay_address);
+	config_entries[i++].arg_data = &(config->server_id);
+	config_entries[i++].arg_data = &(config->invalidate_query_cache);
+	config_entries[i++].arg_data = &(config->relay_compress_level);
+	config_entries[i++].arg_data = &(config->compress);
+
 	return config_entries;
 }
 
@@ -712,122 +1832,168 @@ int network_mysqld_binlog_event_print(network_mysqld_binlog_event *event) {
 	return 0;
 }
 
-int replicate_binlog_dump_file(const char *filename) {
-	int fd;
-	char binlog_header[4];
-	network_packet *packet;
+/**
+ * decode the events of a binlog file
+ *
+ * @param filter skip the unwanted events before they are decoded, may be NULL
+ */
+int replicate_binlog_dump_file(const char *filename, network_mysqld_binlog_filter *filter) {
+	network_mysqld_binlog_file *file;
+	network_packet packet;
 	network_mysqld_binlog *binlog;
 	network_mysqld_binlog_event *event;
+	GError *gerr = NULL;
+	int ret = 0;
 
-	if (-1 == (fd = g_open(filename, O_RDONLY, 0))) {
+	if (NULL == (file = network_mysqld_binlog_file_open(filename, &gerr))) {
 		g_critical("%s: opening '%s' failed: %s",
 				G_STRLOC,
 				filename,
-				g_strerror(errno));
+				gerr->message);
+		g_error_free(gerr);
 		return -1;
 	}
 
-	if (4 != read(fd, binlog_header, 4)) {
-		g_return_val_if_reached(-1);
-	}
-
-	if (binlog_header[0] != '\xfe' ||
-	    binlog_header[1] != 'b' ||
-	    binlog_header[2] != 'i' ||
-	    binlog_header[3] != 'n') {
-
-		g_critical("%s: binlog-header should be: %02x%02x%02x%02x, got %02x%02x%02x%02x",
-				G_STRLOC,
-				'\xfe', 'b', 'i', 'n',
-				binlog_header[0],
-				binlog_header[1],
-				binlog_header[2],
-				binlog_header[3]
-				);
-
-		g_return_val_if_reached(-1);
-	}
-
-	packet = network_packet_new();
-	packet->data = g_string_new(NULL);
-	g_string_set_size(packet->data, 19 + 1);
-
 	binlog = network_mysqld_binlog_new();
 
 	/* next are the events, without the mysql packet header */
-	while (19 == (packet->data->len = read(fd, packet->data->str, 19))) {
-		gssize len;
-		packet->data->str[packet->data->len] = '\0'; /* term the string */
-
-		g_assert_cmpint(packet->data->len, ==, 19);
-
+	while (0 == (ret = network_mysqld_binlog_file_get_event(file, &packet))) {
 		event = network_mysqld_binlog_event_new();
-		network_mysqld_proto_get_binlog_event_header(packet, event);
-
-		g_assert_cmpint(event->event_size, >=, 19);
-
-		g_string_set_size(packet->data, event->event_size); /* resize the string */
-		packet->data->len = 19;
+		network_mysqld_proto_get_binlog_event_header(&packet, event);
 
-		len = read(fd, packet->data->str + 19, event->event_size - 19);
-
-		if (-1 == len) {
-			g_critical("%s: lseek(..., %d, ...) failed: %s",
-					G_STRLOC,
-					event->event_size - 19,
-					g_strerror(errno));
-			return -1;
-		}
-		g_assert_cmpint(len, ==, event->event_size - 19);
-		g_assert_cmpint(packet->data->len, ==, 19);
-		packet->data->len += len;
-		g_assert_cmpint(packet->data->len, ==, event->event_size);
-		
-		if (network_mysqld_proto_get_binlog_event(packet, binlog, event)) {
-			g_debug_hexdump(G_STRLOC, packet->data->str + 19, packet->data->len - 19);
+		if (filter && network_mysqld_binlog_filter_skip_event(filter, &packet, event)) {
+			/* not wanted */
+		} else if (network_mysqld_proto_get_binlog_event(&packet, binlog, event)) {
+			g_debug_hexdump(G_STRLOC, packet.data->str + 19, packet.data->len - 19);
 		} else if (network_mysqld_binlog_event_print(event)) {
 			/* ignore it */
 		}
 	
 		network_mysqld_binlog_event_free(event);
+	}
 
-		packet->offset = 0;
+	if (ret == -1) {
+		g_critical("%s: %s: invalid or truncated event at %"G_GSIZE_FORMAT,
+				G_STRLOC,
+				filename,
+				file->pos);
 	}
-	g_string_free(packet->data, TRUE);
-	network_packet_free(packet);
 
 	network_mysqld_binlog_free(binlog);
 
-	close(fd);
+	network_mysqld_binlog_file_free(file);
 
-	return 0;
+	return ret == -1 ? -1 : 0;
 }
 
 /**
  * init the plugin with the parsed config
  */
-int network_mysqld_replicant_plugin_apply_config(chassis G_GNUC_UNUSED *chas, chassis_plugin_config *config) {
+int network_mysqld_replicant_plugin_apply_config(chassis *chas, chassis_plugin_config *config) {
+	network_mysqld_con *con;
+	network_socket *listen_sock;
+	struct timeval tv = { 0, 0 };
+
 	if (!config->master_address) config->master_address = g_strdup(":4040");
 	if (!config->mysqld_username) config->mysqld_username = g_strdup("repl");
 	if (!config->mysqld_password) config->mysqld_password = g_strdup("");
+	if (!config->relay_address) config->relay_address = g_strdup(":4042");
+	if (!config->server_id) config->server_id = 2;
 
 	if (config->read_binlogs) {
+		network_mysqld_binlog_filter *filter = NULL;
 		int i;
 
+		if (config->read_binlogs_filter_tables) {
+			filter = network_mysqld_binlog_filter_new();
+
+			for (i = 0; config->read_binlogs_filter_tables[i]; i++) {
+				network_mysqld_binlog_filter_add_table(filter, config->read_binlogs_filter_tables[i]);
+			}
+		}
+
 		/* we have a list of filenames we shall decode */
 		for (i = 0; config->read_binlogs[i]; i++) {
 			char *filename = config->read_binlogs[i];
 
-			replicate_binlog_dump_file(filename);
+			replicate_binlog_dump_file(filename, filter);
 		}
 
+		network_mysqld_binlog_filter_free(filter);
+
 		/* we are done, shutdown */
 		chassis_set_shutdown();
+
+		return 0;
+	}
+
+	if (!config->relay_dir && !config->invalidate_query_cache) return 0;
+
+	if (config->relay_compress_level < 0 || config->relay_compress_level > 9) {
+		g_critical("%s: --replicant-relay-compress-level has to be between 0 and 9, got %d",
+				G_STRLOC,
+				config->relay_compress_level);
+		return -1;
+	}
+
+	if ((config->relay_compress_level > 0 || config->compress) && !network_mysqld_compress_is_available()) {
+		g_critical("%s: --replicant-relay-compress-level and --replicant-compress need zlib",
+				G_STRLOC);
+		return -1;
+	}
+
+	if (config->relay_dir) {
+		config->spool = replicant_spool_new();
+		replicant_spool_set_compress(config->spool, config->relay_compress_level, chas->workers);
+		if (0 != replicant_spool_open(config->spool, config->relay_dir)) {
+			g_critical("%s: opening the spool in --replicant-relay-dir=%s failed",
+					G_STRLOC,
+					config->relay_dir);
+			return -1;
+		}
 	}
 
+	/* connect to the master once the event-threads are running */
+	config->upstream = replicant_upstream_new(chas, config);
+	evtimer_set(&(config->upstream->retry_ev), replicant_upstream_retry_cb, config->upstream);
+	chassis_event_add_with_timeout(chas, &(config->upstream->retry_ev), &tv);
+
+	/* only the invalidation, no relay */
+	if (!config->relay_dir) return 0;
+
+	/** 
+	 * create a connection handle for the listen socket 
+	 */
+	con = network_mysqld_con_new();
+	network_mysqld_add_connection(chas, con);
+	con->config = config;
+
+	config->listen_con = con;
+	
+	listen_sock = network_socket_new();
+	con->server = listen_sock;
+
+	/* set the plugin hooks as we want to apply them to the new connections too later */
+	network_mysqld_relay_connection_init(con);
+
+	if (0 != network_address_set_address(listen_sock->dst, config->relay_address)) {
+		return -1;
+	}
+
+	if (0 != network_socket_bind(listen_sock)) {
+		return -1;
+	}
+	g_message("replicant relay listening on port %s", config->relay_address);
+
+	/**
+	 * call network_mysqld_con_accept() with this connection when we are done
+	 */
+	event_set(&(listen_sock->event), listen_sock->fd, EV_READ|EV_PERSIST, network_mysqld_con_accept, con);
+	event_base_set(chas->event_base, &(listen_sock->event));
+	event_add(&(listen_sock->event), NULL);
+
 	return 0;
 }
-
 G_MODULE_EXPORT int plugin_init(chassis_plugin *p) {
 	p->magic        = CHASSIS_PLUGIN_MAGIC;
 	p->name         = g_strdup("replicant");
@@ -0,0 +1,1272 @@
+/* $%BEGINLICENSE%$
+ Copyright (c) 2008, 2012, Oracle and/or its affiliates. All rights reserved.
+
+ This program is free software; you can redistribute it and/or
+ modify it under the terms of the GNU General Public License as
+ published by the Free Software Foundation; version 2 of the
+ License.
+
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ GNU General Public License for more details.
+
+ You should have received a copy of the GNU General Public License
+ along with this program; if not, write to the Free Software
+ Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA
+ 02110-1301  USA
+
+ $%ENDLICENSE%$ */
+
+/** @file
+ * the binlog spool of the relay
+ *
+ * a segment-file per binlog-file of the master:
+ *
+ *   <dir>/replicant.index   names of the segments, one per line, oldest first
+ *   <dir>/<binlog-file>     "\xfebin" + the events at the positions they have on the master
+ *   <dir>/<binlog-file>.z   the same, compressed in blocks once the master rotated away from it
+ *
+ * only complete events are visible to the readers: ->pos is moved after the event is written.
+ *
+ * a compressed segment is "\xfebz1" + the zlib-compressed blocks of REPLICANT_SPOOL_BLOCK_SIZE bytes
+ * of the segment + the file-offset of each block and of the end of the last one + the block-size,
+ * the size of the segment, the number of blocks and "\xfebz1" again. A reader at any position
+ * finds its block through the offsets and only uncompresses the blocks it reads.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#ifdef HAVE_UNISTD_H
+#include <unistd.h>
+#endif
+#ifdef WIN32
+#include <io.h>
+#endif
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <string.h>
+#include <fcntl.h>
+#include <errno.h>
+
+#include <glib.h>
+#include <glib/gstdio.h>
+
+#ifdef HAVE_ZLIB_H
+#include <zlib.h>
+#endif
+
+#include "network-mysqld-binlog.h"
+#include "network-mysqld-crc32.h"
+#include "chassis-event-thread.h"
+#include "replicant-spool.h"
+
+#define S(x) x->str, x->len
+
+#define REPLICANT_SPOOL_INDEX "replicant.index"
+
+/** block-size, segment-size, block-count and the magic at the end of a compressed segment */
+#define REPLICANT_SPOOL_COMPRESSED_TRAILER_SIZE (3 * 4 + REPLICANT_SPOOL_COMPRESSED_MAGIC_SIZE)
+
+#ifndef O_BINARY
+#define O_BINARY 0
+#endif
+
+static guint32 replicant_get_int32(const char *p) {
+	return (guchar)p[0] | ((guchar)p[1] << 8) | ((guchar)p[2] << 16) | ((guint32)(guchar)p[3] << 24);
+}
+
+static void replicant_set_int32(char *p, guint32 v) {
+	p[0] = v & 0xff;
+	p[1] = (v >> 8) & 0xff;
+	p[2] = (v >> 16) & 0xff;
+	p[3] = (v >> 24) & 0xff;
+}
+
+/**
+ * the names come from the master and become filenames, don't let them leave the spool-dir
+ */
+static gboolean replicant_spool_name_is_valid(const char *name, gsize name_len) {
+	if (name_len == 0 || name_len > 255) return FALSE;
+	if (name[0] == '.') return FALSE;
+	if (memchr(name, '/', name_len) || memchr(name, '\\', name_len) || memchr(name, '\0', name_len)) return FALSE;
+	if (name_len == sizeof(REPLICANT_SPOOL_INDEX) - 1 && 0 == memcmp(name, REPLICANT_SPOOL_INDEX, name_len)) return FALSE;
+
+	return TRUE;
+}
+
+static int replicant_write_all(int fd, const char *data, gsize len) {
+	while (len > 0) {
+		gssize written = write(fd, data, len);
+
+		if (written < 0) {
+			if (errno == EINTR) continue;
+
+			return -1;
+		}
+
+		data += written;
+		len -= written;
+	}
+
+	return 0;
+}
+
+/**
+ * read exactly len bytes at offset
+ *
+ * @return len, less at the end of the file, -1 on error
+ */
+static gssize replicant_read_at(int fd, guint32 offset, char *data, gsize len) {
+	gsize done = 0;
+
+	if (-1 == lseek(fd, offset, SEEK_SET)) return -1;
+
+	while (done < len) {
+		gssize n = read(fd, data + done, len - done);
+
+		if (n < 0) {
+			if (errno == EINTR) continue;
+
+			return -1;
+		} else if (n == 0) {
+			break;
+		}
+
+		done += n;
+	}
+
+	return done;
+}
+
+replicant_spool_t *replicant_spool_new(void) {
+	replicant_spool_t *spool;
+
+	spool = g_new0(replicant_spool_t, 1);
+	spool->mutex = g_mutex_new();
+	spool->segments = g_ptr_array_new();
+	spool->fd = -1;
+	g_queue_init(&(spool->waiters));
+
+	return spool;
+}
+
+void replicant_spool_free(replicant_spool_t *spool) {
+	guint i;
+
+	if (!spool) return;
+
+	if (spool->fd != -1) close(spool->fd);
+
+	for (i = 0; i < spool->segments->len; i++) {
+		g_free(spool->segments->pdata[i]);
+	}
+	g_ptr_array_free(spool->segments, TRUE);
+
+	if (spool->dir) g_free(spool->dir);
+	if (spool->master_version) g_free(spool->master_version);
+
+	g_mutex_free(spool->mutex);
+
+	g_free(spool);
+}
+
+/**
+ * compress the segments the master rotated away from
+ *
+ * call it before replicant_spool_open(), the segments that aren't compressed yet are
+ * compressed then
+ *
+ * @param compress_level the zlib level, 0 to leave the segments as they are
+ * @param workers        compresses the segments in the background
+ */
+void replicant_spool_set_compress(replicant_spool_t *spool, int compress_level, chassis_worker_pool_t *workers) {
+	spool->compress_level = compress_level;
+	spool->workers = workers;
+}
+
+/**
+ * compress a segment in blocks
+ *
+ * the compressed segment is written next to it and replaces it. Readers that have the
+ * segment open already keep reading it.
+ *
+ * @param filename       the segment
+ * @return 0 on success, -1 on error
+ */
+int replicant_spool_compress_segment(const gchar *filename, int compress_level) {
+#ifdef HAVE_ZLIB_H
+	gchar *compressed_filename;
+	gchar *tmp_filename;
+	GString *block;
+	GString *compressed;
+	GArray *block_offsets;
+	char int32_buf[4];
+	guint32 offset = 0;
+	guint32 size;
+	guint i;
+	int fd, out_fd;
+	int err = 0;
+
+	fd = g_open(filename, O_RDONLY | O_BINARY, 0);
+	if (fd == -1) {
+		g_critical("%s: opening '%s' failed: %s",
+				G_STRLOC,
+				filename,
+				g_strerror(errno));
+		return -1;
+	}
+
+	compressed_filename = g_strconcat(filename, REPLICANT_SPOOL_COMPRESSED_SUFFIX, NULL);
+	tmp_filename = g_strconcat(compressed_filename, ".tmp", NULL);
+
+	out_fd = g_open(tmp_filename, O_WRONLY | O_CREAT | O_TRUNC | O_BINARY, 0640);
+	if (out_fd == -1) {
+		g_critical("%s: creating '%s' failed: %s",
+				G_STRLOC,
+				tmp_filename,
+				g_strerror(errno));
+		g_free(tmp_filename);
+		g_free(compressed_filename);
+		close(fd);
+		return -1;
+	}
+
+	block = g_string_sized_new(REPLICANT_SPOOL_BLOCK_SIZE);
+	compressed = g_string_sized_new(compressBound(REPLICANT_SPOOL_BLOCK_SIZE));
+	block_offsets = g_array_new(FALSE, FALSE, sizeof(guint32));
+
+	err = err || replicant_write_all(out_fd, REPLICANT_SPOOL_COMPRESSED_MAGIC, REPLICANT_SPOOL_COMPRESSED_MAGIC_SIZE);
+	offset = REPLICANT_SPOOL_COMPRESSED_MAGIC_SIZE;
+
+	for (size = 0; 0 == err; ) {
+		uLongf compressed_len = compressBound(REPLICANT_SPOOL_BLOCK_SIZE);
+		gssize n;
+
+		g_string_set_size(block, REPLICANT_SPOOL_BLOCK_SIZE);
+		n = replicant_read_at(fd, size, block->str, REPLICANT_SPOOL_BLOCK_SIZE);
+		if (n < 0) {
+			err = -1;
+			break;
+		} else if (n == 0) {
+			break;
+		}
+
+		g_string_set_size(compressed, compressed_len);
+		if (Z_OK != compress2((Bytef *)compressed->str, &compressed_len, (const Bytef *)block->str, n, compress_level)) {
+			err = -1;
+			break;
+		}
+
+		g_array_append_val(block_offsets, offset);
+		err = err || replicant_write_all(out_fd, compressed->str, compressed_len);
+
+		offset += compressed_len;
+		size += n;
+
+		if (n < REPLICANT_SPOOL_BLOCK_SIZE) break;
+	}
+	g_array_append_val(block_offsets, offset);
+
+	for (i = 0; 0 == err && i < block_offsets->len; i++) {
+		replicant_set_int32(int32_buf, g_array_index(block_offsets, guint32, i));
+		err = err || replicant_write_all(out_fd, int32_buf, sizeof(int32_buf));
+	}
+	replicant_set_int32(int32_buf, REPLICANT_SPOOL_BLOCK_SIZE);
+	err = err || replicant_write_all(out_fd, int32_buf, sizeof(int32_buf));
+	replicant_set_int32(int32_buf, size);
+	err = err || replicant_write_all(out_fd, int32_buf, sizeof(int32_buf));
+	replicant_set_int32(int32_buf, block_offsets->len - 1);
+	err = err || replicant_write_all(out_fd, int32_buf, sizeof(int32_buf));
+	err = err || replicant_write_all(out_fd, REPLICANT_SPOOL_COMPRESSED_MAGIC, REPLICANT_SPOOL_COMPRESSED_MAGIC_SIZE);
+
+#ifndef WIN32
+	/* the segment is gone once we renamed it, the compressed one has to be on disk */
+	err = err || fsync(out_fd);
+#endif
+
+	g_array_free(block_offsets, TRUE);
+	g_string_free(compressed, TRUE);
+	g_string_free(block, TRUE);
+	close(out_fd);
+	close(fd);
+
+	if (err) {
+		g_critical("%s: compressing '%s' failed: %s",
+				G_STRLOC,
+				filename,
+				g_strerror(errno));
+		g_unlink(tmp_filename);
+	} else if (0 != g_rename(tmp_filename, compressed_filename)) {
+		g_critical("%s: renaming '%s' failed: %s",
+				G_STRLOC,
+				tmp_filename,
+				g_strerror(errno));
+		g_unlink(tmp_filename);
+		err = -1;
+	} else if (0 != g_unlink(filename)) {
+		/* the readers prefer it over the compressed one, it costs only the space */
+		g_message("%s: removing '%s' failed: %s",
+				G_STRLOC,
+				filename,
+				g_strerror(errno));
+	}
+
+	g_free(tmp_filename);
+	g_free(compressed_filename);
+
+	return err ? -1 : 0;
+#else
+	g_critical("%s: can't compress '%s', built without zlib", G_STRLOC, filename);
+
+	return -1;
+#endif
+}
+
+typedef struct {
+	gchar *filename;
+	int compress_level;
+} replicant_spool_compress_job_t;
+
+static void replicant_spool_compress_job(gpointer user_data) {
+	replicant_spool_compress_job_t *job = user_data;
+
+	replicant_spool_compress_segment(job->filename, job->compress_level);
+
+	g_free(job->filename);
+	g_free(job);
+}
+
+/**
+ * compress a segment the master rotated away from in the background
+ *
+ * only a segment that isn't compressed yet, the readers that wait for events are
+ * never on it
+ */
+static void replicant_spool_compress_sealed_segment(replicant_spool_t *spool, const gchar *name) {
+	replicant_spool_compress_job_t *job;
+	gchar *filename;
+
+	if (spool->compress_level == 0 || spool->workers == NULL) return;
+
+	filename = g_build_filename(spool->dir, name, NULL);
+	if (!g_file_test(filename, G_FILE_TEST_EXISTS)) {
+		g_free(filename);
+		return;
+	}
+
+	job = g_new0(replicant_spool_compress_job_t, 1);
+	job->filename = filename;
+	job->compress_level = spool->compress_level;
+
+	chassis_worker_pool_push(spool->workers, replicant_spool_compress_job, NULL, job);
+}
+
+/**
+ * open the last segment for appending
+ *
+ * a crash may have left a half-written event at the end, it is cut off: the master
+ * sends it again when we ask for the events from the end of the segment
+ */
+static int replicant_spool_open_last_segment(replicant_spool_t *spool) {
+	const gchar *name = spool->segments->pdata[spool->segments->len - 1];
+	gchar *filename;
+	char header[REPLICANT_EVENT_HEADER_SIZE];
+	struct stat st;
+	guint32 pos;
+	int fd;
+
+	filename = g_build_filename(spool->dir, name, NULL);
+	fd = g_open(filename, O_RDWR | O_APPEND | O_BINARY, 0);
+	if (fd == -1) {
+		g_critical("%s: opening '%s' failed: %s",
+				G_STRLOC,
+				filename,
+				g_strerror(errno));
+		g_free(filename);
+		return -1;
+	}
+
+	if (0 != fstat(fd, &st) ||
+	    REPLICANT_BINLOG_HEADER_SIZE != replicant_read_at(fd, 0, header, REPLICANT_BINLOG_HEADER_SIZE) ||
+	    0 != memcmp(header, REPLICANT_BINLOG_HEADER, REPLICANT_BINLOG_HEADER_SIZE)) {
+		g_critical("%s: '%s' isn't a binlog-file",
+				G_STRLOC,
+				filename);
+		g_free(filename);
+		close(fd);
+		return -1;
+	}
+
+	for (pos = REPLICANT_BINLOG_HEADER_SIZE; pos + REPLICANT_EVENT_HEADER_SIZE <= (guint64)st.st_size; ) {
+		guint32 event_size;
+
+		if (REPLICANT_EVENT_HEADER_SIZE != replicant_read_at(fd, pos, header, REPLICANT_EVENT_HEADER_SIZE)) break;
+
+		event_size = replicant_get_int32(header + 9);
+		if (event_size < REPLICANT_EVENT_HEADER_SIZE || (guint64)pos + event_size > (guint64)st.st_size) break;
+
+		pos += event_size;
+	}
+
+	if (pos != st.st_size) {
+		g_message("%s: cutting off the incomplete event at the end of '%s', %"G_GUINT64_FORMAT" -> %u bytes",
+				G_STRLOC,
+				filename,
+				(guint64)st.st_size,
+				pos);
+
+		if (0 != ftruncate(fd, pos)) {
+			g_critical("%s: ftruncate('%s') failed: %s",
+					G_STRLOC,
+					filename,
+					g_strerror(errno));
+			g_free(filename);
+			close(fd);
+			return -1;
+		}
+	}
+
+	g_free(filename);
+
+	spool->fd = fd;
+	spool->pos = pos;
+
+	return 0;
+}
+
+/**
+ * open the spool in dir, creates it if needed
+ *
+ * @return 0 on success, -1 on error
+ */
+int replicant_spool_open(replicant_spool_t *spool, const gchar *dir) {
+	gchar *index_filename;
+	gchar *index_content = NULL;
+	GError *gerr = NULL;
+
+	g_return_val_if_fail(spool->dir == NULL, -1);
+
+	if (0 != g_mkdir_with_parents(dir, 0750)) {
+		g_critical("%s: creating the spool-dir '%s' failed: %s",
+				G_STRLOC,
+				dir,
+				g_strerror(errno));
+		return -1;
+	}
+
+	spool->dir = g_strdup(dir);
+
+	index_filename = g_build_filename(dir, REPLICANT_SPOOL_INDEX, NULL);
+
+	if (g_file_get_contents(index_filename, &index_content, NULL, &gerr)) {
+		gchar **lines = g_strsplit(index_content, "\n", -1);
+		int i;
+
+		for (i = 0; lines[i]; i++) {
+			if (lines[i][0] == '\0') continue;
+
+			if (!replicant_spool_name_is_valid(lines[i], strlen(lines[i]))) {
+				g_critical("%s: '%s' contains a invalid segment-name: %s",
+						G_STRLOC,
+						index_filename,
+						lines[i]);
+				g_strfreev(lines);
+				g_free(index_content);
+				g_free(index_filename);
+				return -1;
+			}
+
+			g_ptr_array_add(spool->segments, g_strdup(lines[i]));
+		}
+
+		g_strfreev(lines);
+		g_free(index_content);
+	} else if (g_error_matches(gerr, G_FILE_ERROR, G_FILE_ERROR_NOENT)) {
+		/* a new spool */
+		g_clear_error(&gerr);
+	} else {
+		g_critical("%s: %s",
+				G_STRLOC,
+				gerr->message);
+		g_clear_error(&gerr);
+		g_free(index_filename);
+		return -1;
+	}
+
+	g_free(index_filename);
+
+	if (spool->segments->len == 0) return 0;
+
+	if (spool->compress_level > 0) {
+		guint i;
+
+		for (i = 0; i + 1 < spool->segments->len; i++) {
+			replicant_spool_compress_sealed_segment(spool, spool->segments->pdata[i]);
+		}
+	}
+
+	return replicant_spool_open_last_segment(spool);
+}
+
+/**
+ * get the position the master has to send the events from
+ *
+ * @return FALSE if the spool is empty
+ */
+gboolean replicant_spool_get_position(replicant_spool_t *spool, gchar **binlog_file, guint32 *pos) {
+	gboolean has_position = FALSE;
+
+	g_mutex_lock(spool->mutex);
+	if (spool->segments->len > 0) {
+		*binlog_file = g_strdup(spool->segments->pdata[spool->segments->len - 1]);
+		*pos = spool->pos;
+		has_position = TRUE;
+	}
+	g_mutex_unlock(spool->mutex);
+
+	return has_position;
+}
+
+void replicant_spool_set_master(replicant_spool_t *spool, const gchar *master_version, gboolean has_checksums) {
+	g_mutex_lock(spool->mutex);
+	if (spool->master_version) g_free(spool->master_version);
+	spool->master_version = g_strdup(master_version);
+	spool->has_checksums = has_checksums;
+	g_mutex_unlock(spool->mutex);
+}
+
+/**
+ * @param master_version the version of the master, NULL if we didn't connect to the master yet. Free it with g_free()
+ */
+void replicant_spool_get_master(replicant_spool_t *spool, gchar **master_version, gboolean *has_checksums) {
+	g_mutex_lock(spool->mutex);
+	*master_version = g_strdup(spool->master_version);
+	*has_checksums = spool->has_checksums;
+	g_mutex_unlock(spool->mutex);
+}
+
+/**
+ * wake all replicas that wait for the next event
+ *
+ * the mutex has to be held
+ */
+static void replicant_spool_wake_waiters(replicant_spool_t *spool) {
+	GList *link;
+	struct timeval tv = { 0, 0 };
+
+	while ((link = g_queue_pop_head_link(&(spool->waiters)))) {
+		replicant_spool_waiter_t *waiter = link->data;
+
+		waiter->is_waiting = FALSE;
+		chassis_event_add_to_thread(waiter->event_thread, &(waiter->ev), &tv);
+	}
+}
+
+/**
+ * create the segment for the binlog-file name
+ *
+ * @return the fd of the segment, -1 on error
+ */
+static int replicant_spool_create_segment(replicant_spool_t *spool, const gchar *name) {
+	gchar *filename;
+	int fd;
+
+	filename = g_build_filename(spool->dir, name, NULL);
+	fd = g_open(filename, O_RDWR | O_APPEND | O_CREAT | O_EXCL | O_BINARY, 0640);
+	if (fd == -1) {
+		g_critical("%s: creating '%s' failed: %s",
+				G_STRLOC,
+				filename,
+				g_strerror(errno));
+		g_free(filename);
+		return -1;
+	}
+
+	if (0 != replicant_write_all(fd, REPLICANT_BINLOG_HEADER, REPLICANT_BINLOG_HEADER_SIZE)) {
+		g_critical("%s: writing '%s' failed: %s",
+				G_STRLOC,
+				filename,
+				g_strerror(errno));
+		g_free(filename);
+		close(fd);
+		return -1;
+	}
+	g_free(filename);
+
+	/* add it to the index */
+	filename = g_build_filename(spool->dir, REPLICANT_SPOOL_INDEX, NULL);
+	{
+		int index_fd = g_open(filename, O_WRONLY | O_APPEND | O_CREAT | O_BINARY, 0640);
+		GString *line = g_string_new(name);
+
+		g_string_append_c(line, '\n');
+
+		if (index_fd == -1 || 0 != replicant_write_all(index_fd, S(line))) {
+			g_critical("%s: writing '%s' failed: %s",
+					G_STRLOC,
+					filename,
+					g_strerror(errno));
+			if (index_fd != -1) close(index_fd);
+			g_string_free(line, TRUE);
+			g_free(filename);
+			close(fd);
+			return -1;
+		}
+
+		close(index_fd);
+		g_string_free(line, TRUE);
+	}
+	g_free(filename);
+
+	return fd;
+}
+
+/**
+ * switch to the segment of binlog_file
+ *
+ * called for the rotate-events of the master
+ */
+static int replicant_spool_switch_segment(replicant_spool_t *spool, const gchar *name, guint32 pos) {
+	int fd;
+	int old_fd;
+
+	if (spool->segments->len > 0 &&
+	    0 == strcmp(spool->segments->pdata[spool->segments->len - 1], name)) {
+		/* we append to it already */
+		return 0;
+	}
+
+	if (pos != REPLICANT_BINLOG_HEADER_SIZE) {
+		g_critical("%s: the master starts at %s:%u, but a segment has to start at the beginning of a binlog",
+				G_STRLOC,
+				name,
+				pos);
+		return -1;
+	}
+
+	if (-1 == (fd = replicant_spool_create_segment(spool, name))) return -1;
+
+	g_mutex_lock(spool->mutex);
+	old_fd = spool->fd;
+	spool->fd = fd;
+	spool->pos = REPLICANT_BINLOG_HEADER_SIZE;
+	g_ptr_array_add(spool->segments, g_strdup(name));
+	replicant_spool_wake_waiters(spool);
+	g_mutex_unlock(spool->mutex);
+
+	if (old_fd != -1) {
+		close(old_fd);
+
+		/* only we add segments, no need for the lock */
+		replicant_spool_compress_sealed_segment(spool, spool->segments->pdata[spool->segments->len - 2]);
+	}
+
+	return 0;
+}
+
+/**
+ * get binlog-file and position of a rotate-event
+ */
+static int replicant_binlog_get_rotate(const char *event, gsize event_len, gboolean has_checksums, gchar **name, guint32 *pos) {
+	gsize name_len;
+
+	if (event_len < REPLICANT_EVENT_HEADER_SIZE + 8 + (has_checksums ? REPLICANT_EVENT_CHECKSUM_LEN : 0)) return -1;
+
+	name_len = event_len - REPLICANT_EVENT_HEADER_SIZE - 8 - (has_checksums ? REPLICANT_EVENT_CHECKSUM_LEN : 0);
+	if (!replicant_spool_name_is_valid(event + REPLICANT_EVENT_HEADER_SIZE + 8, name_len)) return -1;
+
+	*pos = replicant_get_int32(event + REPLICANT_EVENT_HEADER_SIZE); /* the upper 4 bytes are always 0 */
+	*name = g_strndup(event + REPLICANT_EVENT_HEADER_SIZE + 8, name_len);
+
+	return 0;
+}
+
+/**
+ * append a event from the master to the spool
+ *
+ * @param event the event without the OK-byte of the packet
+ * @return 0 on success (also for events that aren't spooled), -1 on error
+ */
+int replicant_spool_append(replicant_spool_t *spool, const char *event, gsize event_len) {
+	guint8 event_type;
+	guint32 event_size, log_pos;
+	guint16 flags;
+	gchar *rotate_name = NULL;
+	guint32 rotate_pos = 0;
+	int rotate_fd = -1;
+	int old_fd = -1;
+
+	if (event_len < REPLICANT_EVENT_HEADER_SIZE) return -1;
+
+	event_type = event[4];
+	event_size = replicant_get_int32(event + 9);
+	log_pos    = replicant_get_int32(event + 13);
+	flags      = (guchar)event[17] | ((guchar)event[18] << 8);
+
+	if (event_size != event_len) return -1;
+
+	/* the replicas get the event as we spool it, don't pass on what got damaged on the way */
+	if (spool->has_checksums && !network_mysqld_binlog_event_checksum_is_valid(event, event_len)) {
+		g_critical("%s: CRC32 checksum mismatch in event %d from the master",
+				G_STRLOC,
+				event_type);
+		return -1;
+	}
+
+	if (event_type == ROTATE_EVENT) {
+		if (0 != replicant_binlog_get_rotate(event, event_len, spool->has_checksums, &rotate_name, &rotate_pos)) {
+			g_critical("%s: invalid rotate-event from the master",
+					G_STRLOC);
+			return -1;
+		}
+
+		if (log_pos == 0 || (flags & REPLICANT_EVENT_ARTIFICIAL_F)) {
+			/* the master tells us where the events come from */
+			int ret = replicant_spool_switch_segment(spool, rotate_name, rotate_pos);
+
+			g_free(rotate_name);
+
+			return ret;
+		}
+	} else if (log_pos == 0 || event_type == HEARTBEAT_LOG_EVENT) {
+		/* artificial events (like the format-description at the start of a dump) aren't in the binlog */
+		return 0;
+	}
+
+	if (spool->fd == -1) {
+		g_critical("%s: got a event before the master sent the name of the binlog",
+				G_STRLOC);
+		g_free(rotate_name);
+		return -1;
+	}
+
+	if (log_pos < event_size || log_pos - event_size < spool->pos) {
+		/* we have it already */
+		g_free(rotate_name);
+		return 0;
+	} else if (log_pos - event_size > spool->pos) {
+		g_critical("%s: the event at %u doesn't follow the end of the spool at %u",
+				G_STRLOC,
+				log_pos - event_size,
+				spool->pos);
+		g_free(rotate_name);
+		return -1;
+	}
+
+	if (0 != replicant_write_all(spool->fd, event, event_len)) {
+		g_critical("%s: writing to the spool failed: %s",
+				G_STRLOC,
+				g_strerror(errno));
+
+		/* don't leave a half-written event behind */
+		if (0 != ftruncate(spool->fd, spool->pos)) {
+			g_critical("%s: ftruncate() failed: %s",
+					G_STRLOC,
+					g_strerror(errno));
+		}
+		g_free(rotate_name);
+		return -1;
+	}
+
+	if (rotate_name) {
+		/* the real rotate-event is the last of the binlog, the next binlog starts right away */
+		if (rotate_pos != REPLICANT_BINLOG_HEADER_SIZE ||
+		    -1 == (rotate_fd = replicant_spool_create_segment(spool, rotate_name))) {
+			g_free(rotate_name);
+			return -1;
+		}
+	}
+
+	g_mutex_lock(spool->mutex);
+	if (rotate_name) {
+		old_fd = spool->fd;
+		spool->fd = rotate_fd;
+		spool->pos = REPLICANT_BINLOG_HEADER_SIZE;
+		g_ptr_array_add(spool->segments, rotate_name);
+	} else {
+		spool->pos = log_pos;
+	}
+	replicant_spool_wake_waiters(spool);
+	g_mutex_unlock(spool->mutex);
+
+	if (old_fd != -1) {
+		close(old_fd);
+
+		replicant_spool_compress_sealed_segment(spool, spool->segments->pdata[spool->segments->len - 2]);
+	}
+
+	return 0;
+}
+
+replicant_spool_reader_t *replicant_spool_reader_new(void) {
+	replicant_spool_reader_t *reader;
+
+	reader = g_new0(replicant_spool_reader_t, 1);
+	reader->fd = -1;
+	reader->block_ndx = G_MAXUINT32;
+
+	return reader;
+}
+
+void replicant_spool_reader_free(replicant_spool_reader_t *reader) {
+	if (!reader) return;
+
+	if (reader->fd != -1) close(reader->fd);
+	if (reader->binlog_file) g_free(reader->binlog_file);
+	if (reader->block_offsets) g_array_free(reader->block_offsets, TRUE);
+	if (reader->block) g_string_free(reader->block, TRUE);
+
+	g_free(reader);
+}
+
+/**
+ * load the block-index of a compressed segment
+ *
+ * @param block_offsets the file-offsets of the blocks and of the end of the last one
+ * @return 0 on success, -1 if it isn't a compressed segment
+ */
+static int replicant_spool_load_block_index(int fd, guint32 *size, guint32 *block_size, GArray *block_offsets) {
+	char trailer[REPLICANT_SPOOL_COMPRESSED_TRAILER_SIZE];
+	char magic[REPLICANT_SPOOL_COMPRESSED_MAGIC_SIZE];
+	struct stat st;
+	guint32 block_count;
+	guint32 index_offset;
+	GString *index;
+	guint32 i;
+
+	if (0 != fstat(fd, &st) ||
+	    st.st_size < REPLICANT_SPOOL_COMPRESSED_MAGIC_SIZE + 4 + REPLICANT_SPOOL_COMPRESSED_TRAILER_SIZE ||
+	    st.st_size > G_MAXUINT32) {
+		return -1;
+	}
+
+	if (REPLICANT_SPOOL_COMPRESSED_MAGIC_SIZE != replicant_read_at(fd, 0, magic, sizeof(magic)) ||
+	    0 != memcmp(magic, REPLICANT_SPOOL_COMPRESSED_MAGIC, REPLICANT_SPOOL_COMPRESSED_MAGIC_SIZE) ||
+	    (gssize)sizeof(trailer) != replicant_read_at(fd, st.st_size - sizeof(trailer), trailer, sizeof(trailer)) ||
+	    0 != memcmp(trailer + 12, REPLICANT_SPOOL_COMPRESSED_MAGIC, REPLICANT_SPOOL_COMPRESSED_MAGIC_SIZE)) {
+		return -1;
+	}
+
+	*block_size = replicant_get_int32(trailer);
+	*size       = replicant_get_int32(trailer + 4);
+	block_count = replicant_get_int32(trailer + 8);
+
+	if (*block_size == 0 ||
+	    (guint64)block_count * *block_size < *size ||
+	    (guint64)(block_count + 1) * 4 + sizeof(trailer) + REPLICANT_SPOOL_COMPRESSED_MAGIC_SIZE > (guint64)st.st_size) {
+		return -1;
+	}
+
+	index_offset = st.st_size - sizeof(trailer) - (block_count + 1) * 4;
+
+	index = g_string_sized_new((block_count + 1) * 4);
+	g_string_set_size(index, (block_count + 1) * 4);
+	if ((gssize)index->len != replicant_read_at(fd, index_offset, index->str, index->len)) {
+		g_string_free(index, TRUE);
+		return -1;
+	}
+
+	g_array_set_size(block_offsets, 0);
+	for (i = 0; i <= block_count; i++) {
+		guint32 offset = replicant_get_int32(index->str + i * 4);
+
+		/* the blocks follow each other up to the index */
+		if (offset > index_offset ||
+		    (i > 0 && offset < g_array_index(block_offsets, guint32, i - 1))) {
+			g_string_free(index, TRUE);
+			return -1;
+		}
+
+		g_array_append_val(block_offsets, offset);
+	}
+	g_string_free(index, TRUE);
+
+	return 0;
+}
+
+/**
+ * read from the segment of the reader
+ *
+ * uncompresses the blocks of a compressed segment as needed, the last one is kept
+ * for the next read
+ *
+ * @return the bytes read, less than len at the end of the segment, -1 on error
+ */
+static gssize replicant_spool_reader_read_at(replicant_spool_reader_t *reader, guint32 offset, char *data, gsize len) {
+#ifdef HAVE_ZLIB_H
+	GString *compressed;
+	gsize done = 0;
+#endif
+
+	if (!reader->is_compressed) return replicant_read_at(reader->fd, offset, data, len);
+
+#ifdef HAVE_ZLIB_H
+	compressed = g_string_new(NULL);
+
+	while (done < len && (guint64)offset + done < reader->size) {
+		guint32 block_ndx = (offset + done) / reader->block_size;
+		guint32 block_offset = (offset + done) % reader->block_size;
+		gsize n;
+
+		if (block_ndx != reader->block_ndx) {
+			guint32 compressed_offset = g_array_index(reader->block_offsets, guint32, block_ndx);
+			guint32 compressed_len = g_array_index(reader->block_offsets, guint32, block_ndx + 1) - compressed_offset;
+			uLongf block_len = reader->block_size;
+
+			reader->block_ndx = G_MAXUINT32;
+
+			g_string_set_size(compressed, compressed_len);
+			if ((gssize)compressed_len != replicant_read_at(reader->fd, compressed_offset, compressed->str, compressed_len)) {
+				g_string_free(compressed, TRUE);
+				return -1;
+			}
+
+			if (!reader->block) reader->block = g_string_sized_new(reader->block_size);
+			g_string_set_size(reader->block, reader->block_size);
+
+			if (Z_OK != uncompress((Bytef *)reader->block->str, &block_len, (const Bytef *)compressed->str, compressed_len)) {
+				g_critical("%s: block %u of '%s' is damaged",
+						G_STRLOC,
+						block_ndx,
+						reader->binlog_file);
+				g_string_free(compressed, TRUE);
+				return -1;
+			}
+			g_string_set_size(reader->block, block_len);
+			reader->block_ndx = block_ndx;
+		}
+
+		if (block_offset >= reader->block->len) break; /* a short block that isn't the last */
+
+		n = MIN(len - done, reader->block->len - block_offset);
+		memcpy(data + done, reader->block->str + block_offset, n);
+		done += n;
+	}
+
+	g_string_free(compressed, TRUE);
+
+	return done;
+#else
+	return -1;
+#endif
+}
+
+/**
+ * position the reader at binlog_file:pos
+ *
+ * @param binlog_file the segment, "" for the first one
+ * @return 0 on success, -1 if the segment isn't in the spool, -2 if pos is outside of it
+ */
+int replicant_spool_reader_seek(replicant_spool_t *spool, replicant_spool_reader_t *reader, const gchar *binlog_file, guint32 pos) {
+	gchar *name = NULL;
+	gchar *filename;
+	struct stat st;
+	GArray *block_offsets = NULL;
+	guint32 size, block_size = 0;
+	guint i;
+	int fd;
+
+	g_mutex_lock(spool->mutex);
+	for (i = 0; i < spool->segments->len; i++) {
+		if (binlog_file[0] == '\0' || 0 == strcmp(spool->segments->pdata[i], binlog_file)) {
+			name = g_strdup(spool->segments->pdata[i]);
+			break;
+		}
+	}
+	g_mutex_unlock(spool->mutex);
+
+	if (!name) return -1;
+
+	filename = g_build_filename(spool->dir, name, NULL);
+	fd = g_open(filename, O_RDONLY | O_BINARY, 0);
+	if (fd == -1 && errno == ENOENT) {
+		/* it got compressed in the meantime */
+		gchar *compressed_filename = g_strconcat(filename, REPLICANT_SPOOL_COMPRESSED_SUFFIX, NULL);
+
+		fd = g_open(compressed_filename, O_RDONLY | O_BINARY, 0);
+		if (fd != -1) {
+			block_offsets = g_array_new(FALSE, FALSE, sizeof(guint32));
+
+			if (0 != replicant_spool_load_block_index(fd, &size, &block_size, block_offsets)) {
+				g_critical("%s: '%s' isn't a compressed segment",
+						G_STRLOC,
+						compressed_filename);
+				g_array_free(block_offsets, TRUE);
+				close(fd);
+				fd = -1;
+			}
+		}
+		g_free(compressed_filename);
+	}
+	g_free(filename);
+
+	if (fd == -1) {
+		g_free(name);
+		return -1;
+	}
+
+	if (!block_offsets) {
+		if (0 != fstat(fd, &st) || st.st_size > G_MAXUINT32) {
+			close(fd);
+			g_free(name);
+			return -2;
+		}
+		size = st.st_size;
+	}
+
+	if (pos < REPLICANT_BINLOG_HEADER_SIZE) pos = REPLICANT_BINLOG_HEADER_SIZE;
+
+	if (pos > size) {
+		if (block_offsets) g_array_free(block_offsets, TRUE);
+		close(fd);
+		g_free(name);
+		return -2;
+	}
+
+	if (reader->fd != -1) close(reader->fd);
+	if (reader->binlog_file) g_free(reader->binlog_file);
+	if (reader->block_offsets) g_array_free(reader->block_offsets, TRUE);
+
+	reader->fd = fd;
+	reader->binlog_file = name;
+	reader->pos = pos;
+	reader->is_compressed = (block_offsets != NULL);
+	reader->size = size;
+	reader->block_size = block_size;
+	reader->block_offsets = block_offsets;
+	reader->block_ndx = G_MAXUINT32; /* ->block is from the old segment */
+
+	return 0;
+}
+
+/**
+ * read the next event of the replica
+ *
+ * follows the rotate-events to the next segment like the replica does
+ *
+ * @param event the event is appended to it
+ */
+replicant_spool_read_t replicant_spool_read(replicant_spool_t *spool, replicant_spool_reader_t *reader, GString *event) {
+	char header[REPLICANT_EVENT_HEADER_SIZE];
+	guint32 limit = G_MAXUINT32;
+	gchar *next_segment = NULL;
+	guint32 event_size;
+	gsize event_offset = event->len;
+	gboolean has_checksums;
+	gssize n;
+	guint i;
+
+	g_mutex_lock(spool->mutex);
+	for (i = 0; i < spool->segments->len; i++) {
+		if (0 != strcmp(spool->segments->pdata[i], reader->binlog_file)) continue;
+
+		if (i == spool->segments->len - 1) {
+			/* the segment we append to, only read the complete events */
+			limit = spool->pos;
+		} else {
+			next_segment = g_strdup(spool->segments->pdata[i + 1]);
+		}
+		break;
+	}
+	has_checksums = spool->has_checksums;
+	g_mutex_unlock(spool->mutex);
+
+	if (limit != G_MAXUINT32 && reader->pos + REPLICANT_EVENT_HEADER_SIZE > limit) return REPLICANT_SPOOL_READ_WAIT;
+
+	n = replicant_spool_reader_read_at(reader, reader->pos, header, REPLICANT_EVENT_HEADER_SIZE);
+
+	if (n == 0 && next_segment) {
+		/* the binlog ended without a rotate-event (the master restarted), tell the replica about the next one */
+		if (0 != replicant_spool_reader_seek(spool, reader, next_segment, REPLICANT_BINLOG_HEADER_SIZE)) {
+			g_free(next_segment);
+			return REPLICANT_SPOOL_READ_ERROR;
+		}
+		g_free(next_segment);
+
+		/* server-id 0 never matches the one of the replica, it won't skip it */
+		replicant_binlog_append_rotate_event(event, 0, reader->binlog_file, reader->pos, has_checksums);
+
+		return REPLICANT_SPOOL_READ_EVENT;
+	}
+	if (next_segment) g_free(next_segment);
+
+	if (n != REPLICANT_EVENT_HEADER_SIZE) return REPLICANT_SPOOL_READ_ERROR;
+
+	event_size = replicant_get_int32(header + 9);
+	if (event_size < REPLICANT_EVENT_HEADER_SIZE ||
+	    (guint64)reader->pos + event_size > limit) {
+		return REPLICANT_SPOOL_READ_ERROR;
+	}
+
+	g_string_set_size(event, event_offset + event_size);
+	memcpy(event->str + event_offset, header, REPLICANT_EVENT_HEADER_SIZE);
+
+	n = replicant_spool_reader_read_at(reader, reader->pos + REPLICANT_EVENT_HEADER_SIZE,
+			event->str + event_offset + REPLICANT_EVENT_HEADER_SIZE, event_size - REPLICANT_EVENT_HEADER_SIZE);
+	if (n != (gssize)(event_size - REPLICANT_EVENT_HEADER_SIZE)) return REPLICANT_SPOOL_READ_ERROR;
+
+	reader->pos += event_size;
+
+	if (header[4] == ROTATE_EVENT) {
+		gchar *name = NULL;
+		guint32 pos;
+
+		/* the segment it points to is created before the rotate-event is visible */
+		if (0 != replicant_binlog_get_rotate(event->str + event_offset, event_size, has_checksums, &name, &pos) ||
+		    0 != replicant_spool_reader_seek(spool, reader, name, pos)) {
+			if (name) g_free(name);
+
+			return REPLICANT_SPOOL_READ_ERROR;
+		}
+		g_free(name);
+	}
+
+	return REPLICANT_SPOOL_READ_EVENT;
+}
+
+/**
+ * read the format-description-event of the segment of the reader
+ *
+ * a replica that starts in the middle of a binlog gets it first. It is marked as
+ * artificial by setting its log-pos to 0.
+ */
+int replicant_spool_read_format_description(replicant_spool_t *spool, replicant_spool_reader_t *reader, GString *event) {
+	char header[REPLICANT_EVENT_HEADER_SIZE];
+	guint32 event_size;
+	gsize event_offset = event->len;
+	gboolean has_checksums;
+
+	g_mutex_lock(spool->mutex);
+	has_checksums = spool->has_checksums;
+	g_mutex_unlock(spool->mutex);
+
+	if (REPLICANT_EVENT_HEADER_SIZE != replicant_spool_reader_read_at(reader, REPLICANT_BINLOG_HEADER_SIZE, header, REPLICANT_EVENT_HEADER_SIZE)) return -1;
+	if (header[4] != FORMAT_DESCRIPTION_EVENT) return -1;
+
+	event_size = replicant_get_int32(header + 9);
+	if (event_size < REPLICANT_EVENT_HEADER_SIZE + (has_checksums ? REPLICANT_EVENT_CHECKSUM_LEN : 0)) return -1;
+
+	g_string_set_size(event, event_offset + event_size);
+	if ((gssize)event_size != replicant_spool_reader_read_at(reader, REPLICANT_BINLOG_HEADER_SIZE, event->str + event_offset, event_size)) return -1;
+
+	replicant_set_int32(event->str + event_offset + 13, 0);
+
+	if (has_checksums) {
+		replicant_set_int32(event->str + event->len - REPLICANT_EVENT_CHECKSUM_LEN,
+				network_mysqld_crc32(0, event->str + event_offset, event_size - REPLICANT_EVENT_CHECKSUM_LEN));
+	}
+
+	return 0;
+}
+
+/**
+ * wait for the next event
+ *
+ * ->ev of the waiter has to be set with event_set() and is added to the event-thread of
+ * the caller once the next event is spooled.
+ *
+ * @return FALSE if the reader has events already and we don't wait
+ */
+gboolean replicant_spool_wait(replicant_spool_t *spool, replicant_spool_reader_t *reader, replicant_spool_waiter_t *waiter) {
+	gboolean is_waiting = FALSE;
+
+	g_return_val_if_fail(!waiter->is_waiting, FALSE);
+
+	waiter->event_thread = chassis_event_thread_get_local();
+	g_return_val_if_fail(waiter->event_thread != NULL, FALSE);
+
+	g_mutex_lock(spool->mutex);
+	if (spool->segments->len > 0 &&
+	    0 == strcmp(spool->segments->pdata[spool->segments->len - 1], reader->binlog_file) &&
+	    reader->pos >= spool->pos) {
+		waiter->link.data = waiter;
+		g_queue_push_tail_link(&(spool->waiters), &(waiter->link));
+		waiter->is_waiting = TRUE;
+		is_waiting = TRUE;
+	}
+	g_mutex_unlock(spool->mutex);
+
+	return is_waiting;
+}
+
+/**
+ * stop waiting for the next event
+ *
+ * @return TRUE if we stopped waiting, FALSE if the waiter is woken up already: its ->ev will fire
+ */
+gboolean replicant_spool_cancel_wait(replicant_spool_t *spool, replicant_spool_waiter_t *waiter) {
+	gboolean was_waiting;
+
+	g_mutex_lock(spool->mutex);
+	was_waiting = waiter->is_waiting;
+	if (was_waiting) {
+		g_queue_unlink(&(spool->waiters), &(waiter->link));
+		waiter->is_waiting = FALSE;
+	}
+	g_mutex_unlock(spool->mutex);
+
+	return was_waiting;
+}
+
+/**
+ * append a event-header, the event-size is set by replicant_binlog_event_finish()
+ */
+static gsize replicant_binlog_event_start(GString *event, guint8 event_type, guint32 server_id, guint32 log_pos, guint16 flags) {
+	gsize event_offset = event->len;
+	char header[REPLICANT_EVENT_HEADER_SIZE];
+
+	replicant_set_int32(header + 0, 0);         /* timestamp */
+	header[4] = event_type;
+	replicant_set_int32(header + 5, server_id);
+	replicant_set_int32(header + 9, 0);         /* event-size */
+	replicant_set_int32(header + 13, log_pos);
+	header[17] = flags & 0xff;
+	header[18] = (flags >> 8) & 0xff;
+
+	g_string_append_len(event, header, sizeof(header));
+
+	return event_offset;
+}
+
+static void replicant_binlog_event_finish(GString *event, gsize event_offset, gboolean has_checksums) {
+	if (has_checksums) g_string_set_size(event, event->len + REPLICANT_EVENT_CHECKSUM_LEN);
+
+	replicant_set_int32(event->str + event_offset + 9, event->len - event_offset);
+
+	if (has_checksums) {
+		replicant_set_int32(event->str + event->len - REPLICANT_EVENT_CHECKSUM_LEN,
+				network_mysqld_crc32(0, event->str + event_offset, event->len - event_offset - REPLICANT_EVENT_CHECKSUM_LEN));
+	}
+}
+
+/**
+ * the artificial rotate-event that tells the replica which binlog-file the next events come from
+ */
+void replicant_binlog_append_rotate_event(GString *event, guint32 server_id, const gchar *binlog_file, guint32 pos, gboolean has_checksums) {
+	gsize event_offset;
+	char pos_buf[8];
+
+	event_offset = replicant_binlog_event_start(event, ROTATE_EVENT, server_id, 0, REPLICANT_EVENT_ARTIFICIAL_F);
+
+	replicant_set_int32(pos_buf, pos);
+	replicant_set_int32(pos_buf + 4, 0);
+	g_string_append_len(event, pos_buf, sizeof(pos_buf));
+	g_string_append(event, binlog_file);
+
+	replicant_binlog_event_finish(event, event_offset, has_checksums);
+}
+
+/**
+ * the heartbeat-event tells a idle replica that we are still there
+ */
+void replicant_binlog_append_heartbeat_event(GString *event, guint32 server_id, const gchar *binlog_file, guint32 pos, gboolean has_checksums) {
+	gsize event_offset;
+
+	event_offset = replicant_binlog_event_start(event, HEARTBEAT_LOG_EVENT, server_id, pos, 0);
+	g_string_append(event, binlog_file);
+
+	replicant_binlog_event_finish(event, event_offset, has_checksums);
+}
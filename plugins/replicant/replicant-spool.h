@@ -0,0 +1,134 @@
+/* $%BEGINLICENSE%$
+ Copyright (c) 2008, 2012, Oracle and/or its affiliates. All rights reserved.
+
+ This program is free software; you can redistribute it and/or
+ modify it under the terms of the GNU General Public License as
+ published by the Free Software Foundation; version 2 of the
+ License.
+
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ GNU General Public License for more details.
+
+ You should have received a copy of the GNU General Public License
+ along with this program; if not, write to the Free Software
+ Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA
+ 02110-1301  USA
+
+ $%ENDLICENSE%$ */
+#ifndef __REPLICANT_SPOOL_H__
+#define __REPLICANT_SPOOL_H__
+
+#include <glib.h>
+
+#include "chassis-event-thread.h"
+#include "chassis-worker-pool.h"
+
+#define REPLICANT_BINLOG_HEADER      "\xfe" "bin"
+#define REPLICANT_BINLOG_HEADER_SIZE 4
+
+#define REPLICANT_EVENT_HEADER_SIZE  19
+#define REPLICANT_EVENT_CHECKSUM_LEN 4
+#define REPLICANT_EVENT_ARTIFICIAL_F 0x20 /**< LOG_EVENT_ARTIFICIAL_F, the event isn't in the binlog */
+
+#define REPLICANT_SPOOL_COMPRESSED_SUFFIX ".z"
+#define REPLICANT_SPOOL_COMPRESSED_MAGIC  "\xfe" "bz1"
+#define REPLICANT_SPOOL_COMPRESSED_MAGIC_SIZE 4
+#define REPLICANT_SPOOL_BLOCK_SIZE   (64 * 1024) /**< the uncompressed size of the blocks of a compressed segment */
+
+/**
+ * the binlog stream of the master, spooled to segment-files
+ *
+ * the segments are named like the binlogs of the master and keep the events
+ * at the same offsets: a replica can ask for any binlog-file:pos of the master and
+ * we can serve it from the segment of the same name.
+ *
+ * the events are appended by the connection to the master and read by the
+ * connections of all the replicas, in any of the event-threads
+ */
+typedef struct {
+	gchar *dir;
+
+	GMutex *mutex;          /**< protects the fields below and the waiters */
+
+	GPtrArray *segments;    /**< names of the segment-files, oldest first */
+	guint32 pos;            /**< size of the last segment, position of the next event */
+
+	int fd;                 /**< the last segment, only the writer uses it */
+
+	gchar *master_version;  /**< version-string of the master, we announce it to the replicas */
+	gboolean has_checksums; /**< the events are followed by a CRC32 */
+
+	GQueue waiters;         /**< replicant_spool_waiter_t waiting for the next event */
+
+	int compress_level;     /**< compress the segments the master rotated away from, 0 to keep them as they are */
+	chassis_worker_pool_t *workers; /**< compresses them */
+} replicant_spool_t;
+
+/**
+ * a replica waiting for the next event
+ *
+ * ->ev is added to ->event_thread once the next event is spooled
+ */
+typedef struct {
+	chassis_event_thread_t *event_thread;
+	struct event ev;
+
+	gboolean is_waiting;
+	GList link;             /**< our link in the waiters of the spool */
+} replicant_spool_waiter_t;
+
+/**
+ * the position of a replica in the spool
+ */
+typedef struct {
+	gchar *binlog_file;
+	guint32 pos;
+
+	int fd;
+
+	/**
+	 * the segment is compressed in blocks, see replicant_spool_compress_segment()
+	 *
+	 * only the blocks the replica reads from are uncompressed
+	 */
+	gboolean is_compressed;
+	guint32 size;           /**< the uncompressed size of the segment */
+	guint32 block_size;
+	GArray *block_offsets;  /**< guint32 file-offset of each block and the end of the last one */
+	GString *block;         /**< the uncompressed block ->block_ndx */
+	guint32 block_ndx;      /**< G_MAXUINT32 if ->block is empty */
+} replicant_spool_reader_t;
+
+typedef enum {
+	REPLICANT_SPOOL_READ_EVENT,     /**< a event was read */
+	REPLICANT_SPOOL_READ_WAIT,      /**< no new events yet */
+	REPLICANT_SPOOL_READ_ERROR
+} replicant_spool_read_t;
+
+replicant_spool_t *replicant_spool_new(void);
+void replicant_spool_free(replicant_spool_t *spool);
+int replicant_spool_open(replicant_spool_t *spool, const gchar *dir);
+void replicant_spool_set_compress(replicant_spool_t *spool, int compress_level, chassis_worker_pool_t *workers);
+int replicant_spool_compress_segment(const gchar *filename, int compress_level);
+
+gboolean replicant_spool_get_position(replicant_spool_t *spool, gchar **binlog_file, guint32 *pos);
+void replicant_spool_set_master(replicant_spool_t *spool, const gchar *master_version, gboolean has_checksums);
+void replicant_spool_get_master(replicant_spool_t *spool, gchar **master_version, gboolean *has_checksums);
+
+int replicant_spool_append(replicant_spool_t *spool, const char *event, gsize event_len);
+
+replicant_spool_reader_t *replicant_spool_reader_new(void);
+void replicant_spool_reader_free(replicant_spool_reader_t *reader);
+int replicant_spool_reader_seek(replicant_spool_t *spool, replicant_spool_reader_t *reader, const gchar *binlog_file, guint32 pos);
+replicant_spool_read_t replicant_spool_read(replicant_spool_t *spool, replicant_spool_reader_t *reader, GString *event);
+int replicant_spool_read_format_description(replicant_spool_t *spool, replicant_spool_reader_t *reader, GString *event);
+
+gboolean replicant_spool_wait(replicant_spool_t *spool, replicant_spool_reader_t *reader, replicant_spool_waiter_t *waiter);
+gboolean replicant_spool_cancel_wait(replicant_spool_t *spool, replicant_spool_waiter_t *waiter);
+
+void replicant_binlog_append_rotate_event(GString *event, guint32 server_id, const gchar *binlog_file, guint32 pos, gboolean has_checksums);
+void replicant_binlog_append_heartbeat_event(GString *event, guint32 server_id, const gchar *binlog_file, guint32 pos, gboolean has_checksums);
+
+#endif
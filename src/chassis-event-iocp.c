@@ -0,0 +1,290 @@
+/* $%BEGINLICENSE%$
+ Copyright (c) 2008, 2012, Oracle and/or its affiliates. All rights reserved.
+
+ This program is free software; you can redistribute it and/or
+ modify it under the terms of the GNU General Public License as
+ published by the Free Software Foundation; version 2 of the
+ License.
+
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ GNU General Public License for more details.
+
+ You should have received a copy of the GNU General Public License
+ along with this program; if not, write to the Free Software
+ Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA
+ 02110-1301  USA
+
+ $%ENDLICENSE%$ */
+/**
+ * the read-waits of the connections on a I/O completion-port
+ *
+ * a armed wait is registered by its event with a generation number. The completion of
+ * the zero-byte WSARecv() only carries the event and the generation: if the wait got
+ * re-armed, deleted or timed out in the meantime the generation doesn't match anymore
+ * and the completion is dropped. The event-thread checks the generation again with
+ * chassis_event_iocp_take() before it activates the event, the timeout may have fired
+ * while the completion was in its event-queue.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#ifdef _WIN32
+#include <winsock2.h>
+#define WIN32_LEAN_AND_MEAN
+#include <windows.h>
+#undef WIN32_LEAN_AND_MEAN
+#endif
+
+#include <glib.h>
+
+#include "chassis-event-iocp.h"
+
+#ifdef _WIN32
+/**
+ * a armed wait of a event
+ */
+typedef struct {
+	chassis_event_thread_t *event_thread; /**< the thread the event gets activated in */
+	guint64 gen;
+} chassis_event_iocp_wait_t;
+
+/**
+ * a posted zero-byte WSARecv(), lives until its completion is picked up
+ */
+typedef struct {
+	OVERLAPPED ov;               /**< has to be the first member, the completion hands us a pointer to it */
+	struct event *ev;
+	guint64 gen;
+} chassis_event_iocp_op_t;
+
+typedef struct {
+	HANDLE port;
+
+	GMutex *mutex;               /**< protects .waits and .next_gen */
+	GHashTable *waits;           /**< struct event * -> chassis_event_iocp_wait_t */
+	guint64 next_gen;
+
+	chassis_event_iocp_activate_func activate;
+
+	GPtrArray *pollers;          /**< GThread */
+	volatile gint is_shutdown;
+} chassis_event_iocp_t;
+
+/**
+ * there is one chassis per process, the sockets find the port without a pointer to it
+ */
+static chassis_event_iocp_t *iocp = NULL;
+
+/**
+ * pick up the completions and hand the events to their event-threads
+ */
+static gpointer chassis_event_iocp_poller(gpointer G_GNUC_UNUSED user_data) {
+	while (!g_atomic_int_get(&iocp->is_shutdown)) {
+		chassis_event_iocp_op_t *op;
+		chassis_event_iocp_wait_t *wait;
+		chassis_event_thread_t *event_thread = NULL;
+		OVERLAPPED *ov = NULL;
+		ULONG_PTR key;
+		DWORD bytes;
+
+		/* a failed WSARecv() (the socket got closed) completes too, the handler finds out with FIONREAD */
+		if (!GetQueuedCompletionStatus(iocp->port, &bytes, &key, &ov, 1000) && NULL == ov) {
+			/* the timeout, check if we shall shut down */
+			continue;
+		}
+
+		op = (chassis_event_iocp_op_t *)ov;
+
+		g_mutex_lock(iocp->mutex);
+		wait = g_hash_table_lookup(iocp->waits, op->ev);
+		if (wait && wait->gen == op->gen) event_thread = wait->event_thread;
+		g_mutex_unlock(iocp->mutex);
+
+		if (event_thread) iocp->activate(event_thread, op->ev, op->gen);
+
+		g_free(op);
+	}
+
+	return NULL;
+}
+
+/**
+ * create the completion-port and start the poller-threads
+ *
+ * @return 0 on success, -1 if the read-waits stay with libevent
+ */
+int chassis_event_iocp_start(guint poller_count, chassis_event_iocp_activate_func activate) {
+	guint i;
+
+	g_return_val_if_fail(NULL == iocp, -1);
+
+	iocp = g_new0(chassis_event_iocp_t, 1);
+	iocp->port = CreateIoCompletionPort(INVALID_HANDLE_VALUE, NULL, 0, poller_count);
+	if (NULL == iocp->port) {
+		g_critical("%s: CreateIoCompletionPort() failed: %lu, the connections wait in select()",
+				G_STRLOC,
+				GetLastError());
+		g_free(iocp);
+		iocp = NULL;
+
+		return -1;
+	}
+	iocp->activate = activate;
+	iocp->mutex = g_mutex_new();
+	iocp->waits = g_hash_table_new_full(g_direct_hash, g_direct_equal, NULL, g_free);
+	iocp->pollers = g_ptr_array_new();
+
+	for (i = 0; i < MAX(poller_count, 1); i++) {
+		GError *gerr = NULL;
+		GThread *thr;
+
+		if (NULL == (thr = g_thread_create(chassis_event_iocp_poller, NULL, TRUE, &gerr))) {
+			g_critical("%s: starting the completion-port poller failed: %s",
+					G_STRLOC,
+					gerr->message);
+			g_error_free(gerr);
+
+			chassis_event_iocp_stop();
+
+			return -1;
+		}
+
+		g_ptr_array_add(iocp->pollers, thr);
+	}
+
+	return 0;
+}
+
+/**
+ * stop the poller-threads and close the completion-port
+ *
+ * the event-threads have to be stopped already
+ */
+void chassis_event_iocp_stop(void) {
+	guint i;
+
+	if (NULL == iocp) return;
+
+	g_atomic_int_set(&iocp->is_shutdown, 1);
+	for (i = 0; i < iocp->pollers->len; i++) {
+		g_thread_join(iocp->pollers->pdata[i]);
+	}
+	g_ptr_array_free(iocp->pollers, TRUE);
+
+	/* the WSARecv() that are still posted are cancelled by the closesocket() of their connections */
+	CloseHandle(iocp->port);
+
+	g_hash_table_destroy(iocp->waits);
+	g_mutex_free(iocp->mutex);
+
+	g_free(iocp);
+	iocp = NULL;
+}
+
+/**
+ * wait for the socket of a EV_READ event on the completion-port
+ *
+ * the event has to be set up with event_set() and event_base_set() like for event_add()
+ *
+ * @return TRUE if the wait is posted, FALSE if the caller has to event_add() it
+ */
+gboolean chassis_event_iocp_add(chassis_event_thread_t *event_thread, struct event *ev) {
+	chassis_event_iocp_wait_t *wait;
+	chassis_event_iocp_op_t *op;
+	WSABUF buf = { 0, NULL };
+	DWORD bytes = 0;
+	DWORD flags = 0;
+
+	if (NULL == iocp || NULL == event_thread) return FALSE;
+	if (ev->ev_events != EV_READ || ev->ev_fd == -1) return FALSE;
+
+	/* a socket is bound to the port once, the next call fails with ERROR_INVALID_PARAMETER */
+	if (NULL == CreateIoCompletionPort((HANDLE)ev->ev_fd, iocp->port, 0, 0) &&
+	    GetLastError() != ERROR_INVALID_PARAMETER) {
+		return FALSE;
+	}
+
+	op = g_new0(chassis_event_iocp_op_t, 1);
+	op->ev = ev;
+
+	g_mutex_lock(iocp->mutex);
+	if (NULL == (wait = g_hash_table_lookup(iocp->waits, ev))) {
+		wait = g_new0(chassis_event_iocp_wait_t, 1);
+		g_hash_table_insert(iocp->waits, ev, wait);
+	}
+	wait->event_thread = event_thread;
+	wait->gen = op->gen = ++iocp->next_gen;
+	g_mutex_unlock(iocp->mutex);
+
+	/* the wait is registered before it is posted, the completion may come before WSARecv() returns */
+	if (SOCKET_ERROR == WSARecv(ev->ev_fd, &buf, 1, &bytes, &flags, &(op->ov), NULL) &&
+	    WSAGetLastError() != WSA_IO_PENDING) {
+		chassis_event_iocp_del(ev);
+		g_free(op);
+
+		return FALSE;
+	}
+
+	return TRUE;
+}
+
+/**
+ * forget the wait of a event
+ *
+ * call it before the event is re-armed in another way, times out or is freed. The
+ * WSARecv() stays posted, its completion is dropped.
+ */
+void chassis_event_iocp_del(struct event *ev) {
+	if (NULL == iocp) return;
+
+	g_mutex_lock(iocp->mutex);
+	g_hash_table_remove(iocp->waits, ev);
+	g_mutex_unlock(iocp->mutex);
+}
+
+/**
+ * disarm the wait of a event if it is still the one that completed
+ *
+ * called by the event-thread before it activates the event
+ *
+ * @return TRUE if the event shall be activated
+ */
+gboolean chassis_event_iocp_take(struct event *ev, guint64 gen) {
+	chassis_event_iocp_wait_t *wait;
+	gboolean is_armed = FALSE;
+
+	if (NULL == iocp) return FALSE;
+
+	g_mutex_lock(iocp->mutex);
+	wait = g_hash_table_lookup(iocp->waits, ev);
+	if (wait && wait->gen == gen) {
+		g_hash_table_remove(iocp->waits, ev);
+		is_armed = TRUE;
+	}
+	g_mutex_unlock(iocp->mutex);
+
+	return is_armed;
+}
+#else
+int chassis_event_iocp_start(guint G_GNUC_UNUSED poller_count, chassis_event_iocp_activate_func G_GNUC_UNUSED activate) {
+	return -1;
+}
+
+void chassis_event_iocp_stop(void) {
+}
+
+gboolean chassis_event_iocp_add(chassis_event_thread_t G_GNUC_UNUSED *event_thread, struct event G_GNUC_UNUSED *ev) {
+	return FALSE;
+}
+
+void chassis_event_iocp_del(struct event G_GNUC_UNUSED *ev) {
+}
+
+gboolean chassis_event_iocp_take(struct event G_GNUC_UNUSED *ev, guint64 G_GNUC_UNUSED gen) {
+	return FALSE;
+}
+#endif
@@ -0,0 +1,56 @@
+/* $%BEGINLICENSE%$
+ Copyright (c) 2008, 2012, Oracle and/or its affiliates. All rights reserved.
+
+ This program is free software; you can redistribute it and/or
+ modify it under the terms of the GNU General Public License as
+ published by the Free Software Foundation; version 2 of the
+ License.
+
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ GNU General Public License for more details.
+
+ You should have received a copy of the GNU General Public License
+ along with this program; if not, write to the Free Software
+ Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA
+ 02110-1301  USA
+
+ $%ENDLICENSE%$ */
+#ifndef _CHASSIS_EVENT_IOCP_H_
+#define _CHASSIS_EVENT_IOCP_H_
+
+#include <glib.h>
+
+#include "chassis-exports.h"
+#include "chassis-event-thread.h"
+
+/**
+ * the read-waits of the connections on a I/O completion-port (win32 only)
+ *
+ * libevent 1.x only has a select() backend on win32, its cost grows with every socket
+ * in the fd-sets of a event-base. Most of the sockets of a busy proxy are idle connections
+ * that wait for their next query: these waits are posted as zero-byte WSARecv() on a
+ * completion-port instead. The poller-threads pick up the completions and hand the event
+ * back to the event-thread that armed it, which activates it like libevent would have.
+ *
+ * the writes, the connects and the listen-sockets stay in the select() of libevent.
+ *
+ * on the other platforms chassis_event_iocp_add() always returns FALSE and the events
+ * go to libevent as before.
+ */
+
+/**
+ * hands a event whose socket is readable to its event-thread
+ *
+ * @see chassis_event_activate_in_thread()
+ */
+typedef void (*chassis_event_iocp_activate_func)(chassis_event_thread_t *event_thread, struct event *ev, guint64 gen);
+
+CHASSIS_API int chassis_event_iocp_start(guint poller_count, chassis_event_iocp_activate_func activate);
+CHASSIS_API void chassis_event_iocp_stop(void);
+CHASSIS_API gboolean chassis_event_iocp_add(chassis_event_thread_t *event_thread, struct event *ev);
+CHASSIS_API void chassis_event_iocp_del(struct event *ev);
+CHASSIS_API gboolean chassis_event_iocp_take(struct event *ev, guint64 gen);
+
+#endif
@@ -18,13 +18,22 @@
 
  $%ENDLICENSE%$ */
 
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE /* for cpu_set_t and sched_setaffinity() */
+#endif
+
 #include <glib.h>
 #include <errno.h>
+#include <string.h> /* for strcmp() */
 
 #ifdef HAVE_CONFIG_H
 #include "config.h"
 #endif
 
+#ifdef HAVE_SCHED_SETAFFINITY
+#include <sched.h>
+#endif
+
 #ifdef HAVE_UNISTD_H
 #include <unistd.h> /* for write() */
 #endif
@@ -33,6 +42,10 @@
 #include <sys/socket.h>	/* for SOCK_STREAM and AF_UNIX/AF_INET */
 #endif
 
+#ifdef HAVE_SYS_EVENTFD_H
+#include <sys/eventfd.h> /* for eventfd() */
+#endif
+
 #ifdef WIN32
 #include <winsock2.h>
 #define WIN32_LEAN_AND_MEAN
@@ -45,6 +58,11 @@
 #include <event.h>
 
 #include "chassis-event-thread.h"
+#include "chassis-event-iocp.h"
+#include "chassis-timings.h"
+#include "chassis-mem.h"
+#include "lua-registry-keys.h"
+#include "my_rdtsc.h"
 
 #define C(x) x, sizeof(x) - 1
 #ifndef WIN32
@@ -106,6 +124,13 @@ void chassis_event_op_apply(chassis_event_op_t *op, struct event_base *event_bas
 		event_base_set(event_base, op->ev);
 		event_add(op->ev, op->tv);
 		break;
+	case CHASSIS_EVENT_OP_ACTIVATE:
+		/* the timeout may have fired while the op was queued */
+		if (chassis_event_iocp_take(op->ev, op->gen)) {
+			event_base_set(event_base, op->ev);
+			event_active(op->ev, EV_READ, 1);
+		}
+		break;
 	case CHASSIS_EVENT_OP_UNSET:
 		g_assert_not_reached();
 		break;
@@ -127,19 +152,23 @@ chassis_event_op_set_timeout(chassis_event_op_t *op, struct timeval *tv) {
 	}
 }
 
-void chassis_event_add_with_timeout(chassis *chas, struct event *ev, struct timeval *tv) {
-	chassis_event_op_t *op = chassis_event_op_new();
+/**
+ * wake up a event-thread
+ *
+ * the notification is only sent if the event-queue of the thread was empty. The
+ * thread drains the notification-fd and then the whole queue.
+ */
+static void chassis_event_thread_notify(chassis_event_thread_t *event_thread) {
 	gssize ret;
+#ifdef HAVE_SYS_EVENTFD_H
+	guint64 one = 1;
 
-	op->type = CHASSIS_EVENT_OP_ADD;
-	op->ev   = ev;
-	chassis_event_op_set_timeout(op, tv);
-
-	g_async_queue_lock(chas->threads->event_queue);
-	g_async_queue_push_unlocked(chas->threads->event_queue, op);
-
-	/* ping the event handler */
-	if (1 != (ret = send(chas->threads->event_notify_fds[1], C("."), 0))) {
+	ret = write(event_thread->notify_send_fd, &one, sizeof(one));
+	if (ret == sizeof(one)) return;
+#else
+	if (1 == (ret = send(event_thread->notify_send_fd, C("."), 0))) return;
+#endif
+	{
 		int last_errno; 
 
 #ifdef _WIN32
@@ -151,357 +180,1404 @@ void chassis_event_add_with_timeout(chassis *chas, struct event *ev, struct time
 		switch (last_errno) {
 		case EAGAIN:
 		case E_NET_WOULDBLOCK:
-			/* that's fine ... */
-			g_debug("%s: send() to event-notify-pipe failed: %s (len = %d)",
+			/* that's fine, the thread has enough notifications pending ... */
+			g_debug("%s: sending to event-notify-fd failed: %s",
 					G_STRLOC,
-					g_strerror(errno),
-					g_async_queue_length_unlocked(chas->threads->event_queue));
+					g_strerror(last_errno));
 			break;
 		default:
-			g_critical("%s: send() to event-notify-pipe failed: %s (len = %d)",
+			g_critical("%s: sending to event-notify-fd failed: %s",
 					G_STRLOC,
-					g_strerror(errno),
-					g_async_queue_length_unlocked(chas->threads->event_queue));
+					g_strerror(last_errno));
 			break;
 		}
 	}
-	g_async_queue_unlock(chas->threads->event_queue);
 }
 
 /**
- * add a event asynchronously
+ * push a event-op to the event-queue of a event-thread
  *
- * the event is added to the global event-queue and a fd-notification is sent allowing any
- * of the event-threads to handle it
- *
- * @see network_mysqld_con_handle()
+ * the thread is woken up if it wasn't already
  */
-void chassis_event_add(chassis *chas, struct event *ev) {
-	chassis_event_add_with_timeout(chas, ev, NULL);
-}
+static void chassis_event_thread_push_op(chassis_event_thread_t *event_thread, chassis_event_op_t *op) {
+	gboolean was_empty;
 
-GPrivate *tls_event_base_key = NULL;
+	g_async_queue_lock(event_thread->event_queue);
+	was_empty = (g_async_queue_length_unlocked(event_thread->event_queue) <= 0);
+	g_async_queue_push_unlocked(event_thread->event_queue, op);
+	g_async_queue_unlock(event_thread->event_queue);
+
+	/* only the first event needs a wakeup, the others are handled in the same run */
+	if (was_empty) chassis_event_thread_notify(event_thread);
+}
 
 /**
- * add a event to the current thread 
+ * add a event to the event-base of the given event-thread
  *
- * needs event-base stored in the thread local storage
+ * the event is pushed to the event-queue of the thread and the thread is woken up if it
+ * wasn't already. Used to explicitly move a event (and with it the connection) to another thread.
  *
- * @see network_connection_pool_lua_add_connection()
+ * @see chassis_event_add_with_timeout()
  */
-void chassis_event_add_local_with_timeout(chassis G_GNUC_UNUSED *chas, struct event *ev, struct timeval *tv) {
-	struct event_base *event_base = ev->ev_base;
-	chassis_event_op_t *op;
-
-	if (!event_base) event_base = g_private_get(tls_event_base_key);
-
-	g_assert(event_base); /* the thread-local event-base has to be initialized */
+void chassis_event_add_to_thread(chassis_event_thread_t *event_thread, struct event *ev, struct timeval *tv) {
+	chassis_event_op_t *op = chassis_event_op_new();
 
-	op = chassis_event_op_new();
+	chassis_event_iocp_del(ev);
 
 	op->type = CHASSIS_EVENT_OP_ADD;
 	op->ev   = ev;
 	chassis_event_op_set_timeout(op, tv);
 
-	chassis_event_op_apply(op, event_base);
-	
-	chassis_event_op_free(op);
+	chassis_event_thread_push_op(event_thread, op);
 }
 
-void chassis_event_add_local(chassis *chas, struct event *ev) {
-	chassis_event_add_local_with_timeout(chas, ev, NULL);
-}
 /**
- * handled events sent through the global event-queue 
+ * activate a event in its event-thread once its socket is readable
  *
- * each event-thread has its own listener on the event-queue and 
- * calls chassis_event_handle() with its own event-base
+ * called by the pollers of the completion-port, the event is only activated if its wait
+ * is still armed with the generation @p gen
  *
- * @see chassis_event_add()
+ * @see chassis_event_iocp_add()
  */
-void chassis_event_handle(int G_GNUC_UNUSED event_fd, short G_GNUC_UNUSED events, void *user_data) {
-	chassis_event_thread_t *event_thread = user_data;
-	struct event_base *event_base = event_thread->event_base;
-	chassis *chas = event_thread->chas;
-	chassis_event_op_t *op;
+void chassis_event_activate_in_thread(chassis_event_thread_t *event_thread, struct event *ev, guint64 gen) {
+	chassis_event_op_t *op = chassis_event_op_new();
 
-	do {
-		char ping[1];
+	op->type = CHASSIS_EVENT_OP_ACTIVATE;
+	op->ev   = ev;
+	op->gen  = gen;
 
-		g_async_queue_lock(chas->threads->event_queue);
-		if ((op = g_async_queue_try_pop_unlocked(chas->threads->event_queue))) {
-			gsize ret;
-			chassis_event_op_apply(op, event_base);
+	chassis_event_thread_push_op(event_thread, op);
+}
 
-			chassis_event_op_free(op);
-	       
-			if (1 != (ret = recv(event_thread->notify_fd, ping, 1, 0))) {
-				/* we failed to pull .'s from the notify-queue */
-				int last_errno; 
+/**
+ * account a handled event to the thread
+ *
+ * the busy time is summed up per load-window, .load is the busy permille of the last full window
+ */
+void chassis_event_thread_account(chassis_event_thread_t *event_thread, guint64 start_usec, guint64 end_usec) {
+	guint64 busy_usec = end_usec > start_usec ? end_usec - start_usec : 0;
 
-#ifdef WIN32
-				last_errno = WSAGetLastError();
-#else
-				last_errno = errno;
-#endif
+	event_thread->events++;
+	event_thread->busy_usec += busy_usec;
+	event_thread->load_busy_usec += busy_usec;
 
-				switch (last_errno) {
-				case EAGAIN:
-				case E_NET_WOULDBLOCK:
-					/* that's fine ... */
-					g_debug("%s: recv() from event-notify-fd failed: %s",
-							G_STRLOC,
-							g_strerror(last_errno));
-					break;
-				default:
-					g_critical("%s: recv() from event-notify-fd failed: %s",
-							G_STRLOC,
-							g_strerror(last_errno));
-					break;
-				}
-			}
+	if (end_usec - event_thread->load_start_usec >= CHASSIS_EVENT_THREAD_LOAD_WINDOW_USEC) {
+		if (event_thread->load_start_usec != 0) {
+			g_atomic_int_set(&(event_thread->load),
+					MIN(1000, event_thread->load_busy_usec * 1000 / (end_usec - event_thread->load_start_usec)));
 		}
-		g_async_queue_unlock(chas->threads->event_queue);
-	} while (op); /* even if op is 'free()d' it still is != NULL */
+		event_thread->load_start_usec = end_usec;
+		event_thread->load_busy_usec = 0;
+		event_thread->load_migrations = 0;
+	}
 }
 
 /**
- * create the data structure for a new event-thread
+ * get the busy permille of a thread
+ *
+ * a thread that handled no event for two windows didn't update its .load, it is idle
  */
-chassis_event_thread_t *chassis_event_thread_new() {
-	chassis_event_thread_t *event_thread;
+gint chassis_event_thread_get_load(chassis_event_thread_t *event_thread, guint64 now_usec) {
+	if (now_usec > event_thread->load_start_usec + 2 * CHASSIS_EVENT_THREAD_LOAD_WINDOW_USEC) return 0;
 
-	event_thread = g_new0(chassis_event_thread_t, 1);
+	return g_atomic_int_get(&(event_thread->load));
+}
 
-	return event_thread;
+/**
+ * account the cycles since the last switch to the current subsystem and switch to another
+ */
+static void chassis_event_thread_cpu_switch(chassis_event_thread_t *event_thread, chassis_event_thread_cpu_t cpu) {
+	guint64 now = my_timer_cycles();
+
+	if (event_thread->cpu_current != CHASSIS_EVENT_THREAD_CPU_NONE) {
+		event_thread->cpu_cycles[event_thread->cpu_current] += now - event_thread->cpu_since;
+	}
+
+	event_thread->cpu_current = cpu;
+	event_thread->cpu_since = now;
 }
 
 /**
- * free the data-structures for a event-thread
+ * start accounting the cycles of the thread to CHASSIS_EVENT_THREAD_CPU_CORE
  *
- * joins the event-thread, closes notification-pipe and free's the event-base
+ * called by the outermost connection handler
  */
-void chassis_event_thread_free(chassis_event_thread_t *event_thread) {
-	gboolean is_thread = (event_thread->thr != NULL);
+void chassis_event_thread_cpu_start(chassis_event_thread_t *event_thread) {
+	chassis_event_thread_cpu_switch(event_thread, CHASSIS_EVENT_THREAD_CPU_CORE);
+}
 
-	if (!event_thread) return;
+void chassis_event_thread_cpu_stop(chassis_event_thread_t *event_thread) {
+	chassis_event_thread_cpu_switch(event_thread, CHASSIS_EVENT_THREAD_CPU_NONE);
+}
 
-	if (event_thread->thr) g_thread_join(event_thread->thr);
+/**
+ * account the cycles of the current thread to a subsystem from now on
+ *
+ * a my_timer_cycles() and a few adds, cheap enough to wrap each call into a subsystem
+ *
+ * @return the subsystem to pass to chassis_event_thread_cpu_leave()
+ */
+chassis_event_thread_cpu_t chassis_event_thread_cpu_enter(chassis_event_thread_cpu_t cpu) {
+	chassis_event_thread_t *event_thread = chassis_event_thread_get_local();
+	chassis_event_thread_cpu_t prev;
 
-	if (event_thread->notify_fd != -1) {
-		event_del(&(event_thread->notify_fd_event));
-		closesocket(event_thread->notify_fd);
+	if (NULL == event_thread || event_thread->cpu_current == CHASSIS_EVENT_THREAD_CPU_NONE) return CHASSIS_EVENT_THREAD_CPU_NONE;
+
+	prev = event_thread->cpu_current;
+	if (prev != cpu) chassis_event_thread_cpu_switch(event_thread, cpu);
+
+	return prev;
+}
+
+/**
+ * switch back to the subsystem chassis_event_thread_cpu_enter() returned
+ */
+void chassis_event_thread_cpu_leave(chassis_event_thread_cpu_t prev) {
+	chassis_event_thread_t *event_thread;
+
+	if (prev == CHASSIS_EVENT_THREAD_CPU_NONE) return;
+
+	event_thread = chassis_event_thread_get_local();
+	if (NULL == event_thread || event_thread->cpu_current == CHASSIS_EVENT_THREAD_CPU_NONE) return;
+
+	if (event_thread->cpu_current != prev) chassis_event_thread_cpu_switch(event_thread, prev);
+}
+
+const char *chassis_event_thread_cpu_get_name(chassis_event_thread_cpu_t cpu) {
+	switch (cpu) {
+	case CHASSIS_EVENT_THREAD_CPU_CORE: return "core";
+	case CHASSIS_EVENT_THREAD_CPU_PROTOCOL: return "protocol";
+	case CHASSIS_EVENT_THREAD_CPU_LUA: return "lua";
+	case CHASSIS_EVENT_THREAD_CPU_TOKENIZER: return "tokenizer";
+	case CHASSIS_EVENT_THREAD_CPU_SOCKET: return "socket";
+	case CHASSIS_EVENT_THREAD_CPU_LOG: return "log";
+	case CHASSIS_EVENT_THREAD_CPU_NONE:
+	case CHASSIS_EVENT_THREAD_CPU_MAX:
+		break;
 	}
 
-	/* we don't want to free the global event-base */
-	if (is_thread && event_thread->event_base) event_base_free(event_thread->event_base);
+	return NULL;
+}
 
-	g_free(event_thread);
+/**
+ * get the CPU time of a subsystem of a thread
+ *
+ * read without a lock, a subsystem the thread is in right now only counts up to its last switch
+ *
+ * @return the seconds, 0 if the frequency of the cycle-timer is unknown
+ */
+gdouble chassis_event_thread_cpu_get_seconds(chassis_event_thread_t *event_thread, chassis_event_thread_cpu_t cpu) {
+	if (NULL == chassis_timestamps_global ||
+	    0 == chassis_timestamps_global->cycles_frequency) return 0;
+
+	return (gdouble)event_thread->cpu_cycles[cpu] / chassis_timestamps_global->cycles_frequency;
 }
 
+GPrivate *tls_event_base_key = NULL;
+GPrivate *tls_event_thread_key = NULL;
+
 /**
- * set the event-based for the current event-thread
+ * get the event-thread of the current thread
  *
- * @see chassis_event_add_local()
+ * @return NULL if the current thread isn't a event-thread (or its loop isn't running yet)
  */
-void chassis_event_thread_set_event_base(chassis_event_thread_t G_GNUC_UNUSED *e, struct event_base *event_base) {
-	g_private_set(tls_event_base_key, event_base);
+chassis_event_thread_t *chassis_event_thread_get_local(void) {
+	if (!tls_event_thread_key) return NULL;
+
+	return g_private_get(tls_event_thread_key);
 }
 
 /**
- * create the event-threads handler
+ * get the index of the current event-thread
  *
- * provides the event-queue that is contains the event_ops from the event-threads
- * and notifies all the idling event-threads for the new event-ops to process
+ * @return the index of the event-thread we run in, 0 if we aren't in one
  */
-chassis_event_threads_t *chassis_event_threads_new() {
-	chassis_event_threads_t *threads;
+guint chassis_event_thread_get_local_index(void) {
+	chassis_event_thread_t *event_thread = chassis_event_thread_get_local();
 
-	tls_event_base_key = g_private_new(NULL);
+	return event_thread ? event_thread->index : 0;
+}
 
-	threads = g_new0(chassis_event_threads_t, 1);
+/**
+ * check if the events added by a event-thread stay with it
+ *
+ * the worker threads and the dedicated threads keep their events, the main-thread spreads
+ * them over the worker threads if there are any
+ */
+static gboolean chassis_event_thread_owns_events(chassis *chas, chassis_event_thread_t *event_thread) {
+	if (!event_thread) return FALSE;
 
-	/* create the ping-fds
-	 *
-	 * the event-thread write a byte to the ping-pipe to trigger a fd-event when
-	 * something is available in the event-async-queues
-	 */
-	if (0 != evutil_socketpair(AF_UNIX, SOCK_STREAM, 0, threads->event_notify_fds)) {
-		int err;
-#ifdef _WIN32
-		err = WSAGetLastError();
-#else
-		err = errno;
-#endif
-		g_error("%s: evutil_socketpair() failed: %s (%d)", 
-				G_STRLOC,
-				g_strerror(err),
-				err);
-	}
-	threads->event_threads = g_ptr_array_new();
-	threads->event_queue = g_async_queue_new();
+	return event_thread->index > 0 || event_thread->is_dedicated || chas->threads->event_threads->len == 1;
+}
 
-	/* make both ends non-blocking */
-	evutil_make_socket_nonblocking(threads->event_notify_fds[0]);
-	evutil_make_socket_nonblocking(threads->event_notify_fds[1]);
+/**
+ * check if the events the current thread adds stay with it and get their timeouts on its timer-wheel
+ *
+ * only then a event may stay registered with EV_PERSIST between two waits, see network_mysqld_con_wait_for_event()
+ */
+gboolean chassis_event_thread_keeps_events(chassis *chas) {
+	chassis_event_thread_t *event_thread = chassis_event_thread_get_local();
 
-	return threads;
+	return chassis_event_thread_owns_events(chas, event_thread) && event_thread->timer_wheel != NULL;
 }
 
 /**
- * free all event-threads
+ * add a event asynchronously
+ *
+ * If called from one of the worker event-threads, the event stays with that thread and is
+ * added right away to its event-base. Events that are added from the main-thread (like the
+ * first event of a newly accepted connection) are spread round-robin over the worker threads.
  *
- * frees all the registered event-threads and event-queue
+ * @see network_mysqld_con_handle(), chassis_event_add_to_thread()
  */
-void chassis_event_threads_free(chassis_event_threads_t *threads) {
-	guint i;
-	chassis_event_op_t *op;
+void chassis_event_add_with_timeout(chassis *chas, struct event *ev, struct timeval *tv) {
+	chassis_event_threads_t *threads = chas->threads;
+	chassis_event_thread_t *event_thread = chassis_event_thread_get_local();
+	guint worker_count;
 
-	if (!threads) return;
+	chassis_event_iocp_del(ev);
 
-	/* all threads are running, now wait until they are down again */
-	for (i = 0; i < threads->event_threads->len; i++) {
-		chassis_event_thread_t *event_thread = threads->event_threads->pdata[i];
+	if (chassis_event_thread_owns_events(chas, event_thread)) {
+		/* we are the owner of the event-base, no need to go through the queue */
+		event_base_set(event_thread->event_base, ev);
+		event_add(ev, tv);
 
-		chassis_event_thread_free(event_thread);
+		return;
 	}
 
-	g_ptr_array_free(threads->event_threads, TRUE);
+	/* the draining threads don't get new connections */
+	worker_count = chassis_event_threads_get_active(threads) - 1;
 
-	/* free the events that are still in the queue */
-	while ((op = g_async_queue_try_pop(threads->event_queue))) {
-		chassis_event_op_free(op);
-	}
-	g_async_queue_unref(threads->event_queue);
+	if (worker_count == 0) {
+		/* only the main-thread (or its loop isn't started yet) */
+		event_thread = threads->event_threads->pdata[0];
+	} else {
+		guint ndx = (guint)g_atomic_int_exchange_and_add(&(threads->next_thread_ndx), 1);
 
-	/* close the notification pipe */
-	if (threads->event_notify_fds[0] != -1) {
-		closesocket(threads->event_notify_fds[0]);
-	}
-	if (threads->event_notify_fds[1] != -1) {
-		closesocket(threads->event_notify_fds[1]);
+		event_thread = threads->event_threads->pdata[1 + (ndx % worker_count)];
 	}
 
-
-	g_free(threads);
+	chassis_event_add_to_thread(event_thread, ev, tv);
 }
 
 /**
- * add a event-thread to the event-threads handler
+ * add a event asynchronously
+ *
+ * @see chassis_event_add_with_timeout()
  */
-void chassis_event_threads_add(chassis_event_threads_t *threads, chassis_event_thread_t *thread) {
-	g_ptr_array_add(threads->event_threads, thread);
+void chassis_event_add(chassis *chas, struct event *ev) {
+	chassis_event_add_with_timeout(chas, ev, NULL);
 }
 
-
 /**
- * setup the notification-fd of a event-thread
+ * add a event to the current thread 
  *
- * all event-threads listen on the same notification pipe
+ * needs event-base stored in the thread local storage
  *
- * @see chassis_event_handle()
- */ 
-int chassis_event_threads_init_thread(chassis_event_threads_t *threads, chassis_event_thread_t *event_thread, chassis *chas) {
-#ifdef _WIN32
-	LPWSAPROTOCOL_INFO lpProtocolInfo;
-#endif
-	event_thread->event_base = event_base_new();
-	event_thread->chas = chas;
-#ifdef _WIN32
-	lpProtocolInfo = g_malloc(sizeof(WSAPROTOCOL_INFO));
-	if (SOCKET_ERROR == WSADuplicateSocket(threads->event_notify_fds[0], GetCurrentProcessId(), lpProtocolInfo)) {
-		int _errno = WSAGetLastError();
+ * @see network_connection_pool_lua_add_connection()
+ */
+void chassis_event_add_local_with_timeout(chassis G_GNUC_UNUSED *chas, struct event *ev, struct timeval *tv) {
+	struct event_base *event_base = ev->ev_base;
+	chassis_event_op_t *op;
 
-		g_critical("%s: Could not duplicate socket: %s (%d)", G_STRLOC, g_strerror(_errno), _errno);
-		g_free(lpProtocolInfo);
-		return -1;
-	}
-	event_thread->notify_fd = WSASocket(FROM_PROTOCOL_INFO, FROM_PROTOCOL_INFO, FROM_PROTOCOL_INFO, lpProtocolInfo, 0, 0);
-	if (INVALID_SOCKET == event_thread->notify_fd) {
-		int _errno = WSAGetLastError();
+	if (!event_base) event_base = g_private_get(tls_event_base_key);
 
-		g_critical("%s: Could not create duplicated socket: %s (%d)", G_STRLOC, g_strerror(_errno), _errno);
-		g_free(lpProtocolInfo);
-		return -1;
-	}
-	g_free(lpProtocolInfo);
-#else
-	event_thread->notify_fd = dup(threads->event_notify_fds[0]);
-	if (-1 == event_thread->notify_fd) {
-		g_critical("%s: Could not create duplicated socket: %s (%d)", G_STRLOC, g_strerror(errno), errno);
-		return -1;
-	}
-#endif
+	g_assert(event_base); /* the thread-local event-base has to be initialized */
 
-	event_set(&(event_thread->notify_fd_event), event_thread->notify_fd, EV_READ | EV_PERSIST, chassis_event_handle, event_thread);
-	event_base_set(event_thread->event_base, &(event_thread->notify_fd_event));
-	event_add(&(event_thread->notify_fd_event), NULL);
+	chassis_event_iocp_del(ev);
 
-	return 0;
+	op = chassis_event_op_new();
+
+	op->type = CHASSIS_EVENT_OP_ADD;
+	op->ev   = ev;
+	chassis_event_op_set_timeout(op, tv);
+
+	chassis_event_op_apply(op, event_base);
+	
+	chassis_event_op_free(op);
+}
+
+void chassis_event_add_local(chassis *chas, struct event *ev) {
+	chassis_event_add_local_with_timeout(chas, ev, NULL);
 }
 
 /**
- * event-handler thread
+ * the timeout of a event added by chassis_event_add_with_timer() expired
  *
+ * call the handler of the event like libevent would
  */
-void *chassis_event_thread_loop(chassis_event_thread_t *event_thread) {
-	chassis_event_thread_set_event_base(event_thread, event_thread->event_base);
+static void chassis_event_timer_expired(chassis_timer_wheel_timer_t G_GNUC_UNUSED *timer, gpointer user_data) {
+	struct event *ev = user_data;
 
-	/**
-	 * check once a second if we shall shutdown the proxy
-	 */
-	while (!chassis_is_shutdown()) {
-		struct timeval timeout;
-		int r;
+	chassis_event_iocp_del(ev);
+	event_del(ev);
 
-		timeout.tv_sec = 1;
-		timeout.tv_usec = 0;
+	ev->ev_callback(ev->ev_fd, EV_TIMEOUT, ev->ev_arg);
+}
 
-		r = event_base_loopexit(event_thread->event_base, &timeout);
-		if (r == -1) {
-			g_critical("%s: leaving chassis_event_thread_loop early. event_base_loopexit() failed", G_STRLOC);
-			break;
-		}
+/**
+ * add a event with its timeout on the timer-wheel of the event-thread
+ *
+ * like chassis_event_add_with_timeout(), but re-arming the timeout is O(1). The timer is
+ * armed on the wheel of the current event-thread, the event has to stay in it. Events
+ * that are handed to another thread fall back to the timeout of libevent.
+ *
+ * if the event fires, the owner has to remove the timer with chassis_timer_wheel_remove()
+ * before it adds the event again or frees it
+ *
+ * on win32 the read-waits go to the completion-port instead of the select() of libevent,
+ * see chassis-event-iocp.c
+ *
+ * @param timer the timer of the event, removed first if it is still armed
+ */
+void chassis_event_add_with_timer(chassis *chas, struct event *ev, chassis_timer_wheel_timer_t *timer, struct timeval *tv) {
+	chassis_event_thread_t *event_thread = chassis_event_thread_get_local();
 
-		r = event_base_dispatch(event_thread->event_base);
+	chassis_timer_wheel_remove(timer);
+	chassis_event_iocp_del(ev);
 
-		if (r == -1) {
-#ifdef WIN32
-			errno = WSAGetLastError();
-#endif
-			if (errno == EINTR) continue;
-			g_critical("%s: leaving chassis_event_thread_loop early, errno != EINTR was: %s (%d)", G_STRLOC, g_strerror(errno), errno);
-			break;
-		}
+	if (tv && chassis_event_thread_owns_events(chas, event_thread) && event_thread->timer_wheel) {
+		event_base_set(event_thread->event_base, ev);
+		if (!chassis_event_iocp_add(event_thread, ev)) event_add(ev, NULL);
+
+		chassis_timer_wheel_add(event_thread->timer_wheel, timer,
+				chassis_get_coarse_rel_milliseconds(),
+				(guint64)tv->tv_sec * 1000 + (tv->tv_usec + 999) / 1000,
+				chassis_event_timer_expired, ev);
+
+		return;
 	}
 
-	return NULL;
+	chassis_event_add_with_timeout(chas, ev, tv);
 }
 
+static void chassis_event_timer_fire(chassis_timer_wheel_timer_t *wheel_timer, gpointer user_data);
+
 /**
- * start all the event-threads 
- *
- * starts all the event-threads that got added by chassis_event_threads_add()
- *
- * @see chassis_event_threads_add
+ * arm the timer for the next multiple of its interval
  */
-void chassis_event_threads_start(chassis_event_threads_t *threads) {
-	guint i;
+static void chassis_event_timer_arm(chassis_event_timer_t *timer) {
+	guint64 now_ms = chassis_get_coarse_rel_milliseconds();
 
-	g_message("%s: starting %d threads", G_STRLOC, threads->event_threads->len - 1);
+	chassis_timer_wheel_add(timer->event_thread->timer_wheel, &(timer->wheel_timer),
+			now_ms, timer->interval_ms - (now_ms % timer->interval_ms),
+			chassis_event_timer_fire, timer);
+}
 
-	for (i = 1; i < threads->event_threads->len; i++) { /* the 1st is the main-thread and already set up */
-		chassis_event_thread_t *event_thread = threads->event_threads->pdata[i];
-		GError *gerr = NULL;
+static void chassis_event_timer_destroy(chassis_event_timer_t *timer) {
+	chassis_timer_wheel_remove(&(timer->wheel_timer));
+	g_queue_unlink(&(timer->event_thread->timers), &(timer->link));
 
-		event_thread->thr = g_thread_create((GThreadFunc)chassis_event_thread_loop, event_thread, TRUE, &gerr);
+	if (timer->user_data_free) timer->user_data_free(timer->user_data);
 
-		if (gerr) {
-			g_critical("%s: %s", G_STRLOC, gerr->message);
-			g_error_free(gerr);
-			gerr = NULL;
-		}
-	}
+	g_free(timer);
 }
 
+static void chassis_event_timer_fire(chassis_timer_wheel_timer_t G_GNUC_UNUSED *wheel_timer, gpointer user_data) {
+	chassis_event_timer_t *timer = user_data;
+
+	timer->runs++;
+
+	timer->is_running = TRUE;
+	timer->func(timer, timer->user_data);
+	timer->is_running = FALSE;
 
+	if (timer->is_freed) {
+		chassis_event_timer_destroy(timer);
+	} else {
+		chassis_event_timer_arm(timer);
+	}
+}
+
+/**
+ * add a periodic timer to a event-thread
+ *
+ * the timer is owned by the thread: it has to be freed by the thread itself, the timers
+ * that are left are freed with the thread.
+ *
+ * @param event_thread the current event-thread, see chassis_event_thread_get_local()
+ * @param interval_ms  the timer fires every <interval_ms> milliseconds
+ * @param user_data_free called with user_data when the timer is freed, may be NULL
+ * @return the timer, NULL if the thread has no timer-wheel or the interval is 0
+ */
+chassis_event_timer_t *chassis_event_timer_new(chassis_event_thread_t *event_thread, guint64 interval_ms,
+		chassis_event_timer_func func, gpointer user_data, GDestroyNotify user_data_free) {
+	chassis_event_timer_t *timer;
+
+	if (NULL == event_thread || NULL == event_thread->timer_wheel || 0 == interval_ms) return NULL;
+
+	timer = g_new0(chassis_event_timer_t, 1);
+	timer->event_thread = event_thread;
+	timer->interval_ms = interval_ms;
+	timer->func = func;
+	timer->user_data = user_data;
+	timer->user_data_free = user_data_free;
+
+	timer->link.data = timer;
+	g_queue_push_tail_link(&(event_thread->timers), &(timer->link));
+
+	chassis_event_timer_arm(timer);
+
+	return timer;
+}
+
+/**
+ * stop and free a timer
+ *
+ * may be called from the function of the timer itself
+ */
+void chassis_event_timer_free(chassis_event_timer_t *timer) {
+	if (!timer) return;
+
+	if (timer->is_running) {
+		timer->is_freed = TRUE;
+
+		return;
+	}
+
+	chassis_event_timer_destroy(timer);
+}
+
+/**
+ * drain the notification-fd of a event-thread
+ */
+static void chassis_event_thread_drain_notify(chassis_event_thread_t *event_thread) {
+	gssize ret;
+#ifdef HAVE_SYS_EVENTFD_H
+	guint64 cnt;
+
+	/* a single read() resets the counter of the eventfd */
+	ret = read(event_thread->notify_fd, &cnt, sizeof(cnt));
+	if (ret == sizeof(cnt)) return;
+#else
+	char ping[256];
+
+	while ((ret = recv(event_thread->notify_fd, ping, sizeof(ping), 0)) > 0);
+#endif
+	{
+		int last_errno; 
+
+#ifdef WIN32
+		last_errno = WSAGetLastError();
+#else
+		last_errno = errno;
+#endif
+
+		switch (last_errno) {
+		case EAGAIN:
+		case E_NET_WOULDBLOCK:
+			/* that's fine ... */
+			break;
+		default:
+			g_critical("%s: reading from event-notify-fd failed: %s",
+					G_STRLOC,
+					g_strerror(last_errno));
+			break;
+		}
+	}
+}
+
+/**
+ * handle the events sent through the event-queue of the event-thread
+ *
+ * each event-thread has its own event-queue and notification-fd and calls 
+ * chassis_event_handle() with its own event-base
+ *
+ * @see chassis_event_add_to_thread()
+ */
+void chassis_event_handle(int G_GNUC_UNUSED event_fd, short G_GNUC_UNUSED events, void *user_data) {
+	chassis_event_thread_t *event_thread = user_data;
+	struct event_base *event_base = event_thread->event_base;
+	chassis_event_op_t *op;
+
+	/* drain the notifications first, events that are pushed after this will send a new one */
+	chassis_event_thread_drain_notify(event_thread);
+
+	while ((op = g_async_queue_try_pop(event_thread->event_queue))) {
+		chassis_event_op_apply(op, event_base);
+
+		chassis_event_op_free(op);
+	}
+}
+
+/**
+ * create the data structure for a new event-thread
+ */
+chassis_event_thread_t *chassis_event_thread_new() {
+	chassis_event_thread_t *event_thread;
+
+	event_thread = g_new0(chassis_event_thread_t, 1);
+	event_thread->notify_fd = -1;
+	event_thread->notify_send_fd = -1;
+	event_thread->cpu_current = CHASSIS_EVENT_THREAD_CPU_NONE;
+
+	return event_thread;
+}
+
+/**
+ * free the data-structures for a event-thread
+ *
+ * joins the event-thread, closes notification-fds and free's the event-base
+ */
+void chassis_event_thread_free(chassis_event_thread_t *event_thread) {
+	gboolean is_thread;
+	chassis_event_op_t *op;
+
+	if (!event_thread) return;
+
+	is_thread = (event_thread->thr != NULL);
+
+	if (event_thread->thr) g_thread_join(event_thread->thr);
+
+	if (event_thread->notify_fd != -1) {
+		event_del(&(event_thread->notify_fd_event));
+		closesocket(event_thread->notify_fd);
+	}
+	if (event_thread->notify_send_fd != -1 &&
+	    event_thread->notify_send_fd != event_thread->notify_fd) {
+		closesocket(event_thread->notify_send_fd);
+	}
+
+	if (event_thread->event_queue) {
+		/* free the events that are still in the queue */
+		while ((op = g_async_queue_try_pop(event_thread->event_queue))) {
+			chassis_event_op_free(op);
+		}
+		g_async_queue_unref(event_thread->event_queue);
+	}
+
+	while (event_thread->timers.head) {
+		chassis_event_timer_destroy(event_thread->timers.head->data);
+	}
+
+	chassis_timer_wheel_free(event_thread->timer_wheel);
+
+	/* we don't want to free the global event-base */
+	if ((is_thread || event_thread->is_dedicated) && event_thread->event_base) event_base_free(event_thread->event_base);
+
+	if (event_thread->sc) lua_scope_free(event_thread->sc);
+
+	g_free(event_thread);
+}
+
+/**
+ * set the event-based for the current event-thread
+ *
+ * @see chassis_event_add_local()
+ */
+void chassis_event_thread_set_event_base(chassis_event_thread_t *e, struct event_base *event_base) {
+	g_private_set(tls_event_base_key, event_base);
+	g_private_set(tls_event_thread_key, e);
+}
+
+/**
+ * create the event-threads handler
+ *
+ * provides the list of event-threads. Each event-thread has its own event-queue, see
+ * chassis_event_threads_init_thread()
+ */
+chassis_event_threads_t *chassis_event_threads_new() {
+	chassis_event_threads_t *threads;
+
+	tls_event_base_key = g_private_new(NULL);
+	tls_event_thread_key = g_private_new(NULL);
+
+	threads = g_new0(chassis_event_threads_t, 1);
+
+	threads->event_threads = g_ptr_array_new();
+
+	return threads;
+}
+
+/**
+ * free all event-threads
+ *
+ * frees all the registered event-threads and their event-queues
+ */
+void chassis_event_threads_free(chassis_event_threads_t *threads) {
+	guint i;
+
+	if (!threads) return;
+
+	/* all threads are running, now wait until they are down again */
+	for (i = 0; i < threads->event_threads->len; i++) {
+		chassis_event_thread_t *event_thread = threads->event_threads->pdata[i];
+
+		chassis_event_thread_free(event_thread);
+	}
+
+	g_ptr_array_free(threads->event_threads, TRUE);
+
+	/* the event-threads are joined, nobody arms a wait anymore */
+	chassis_event_iocp_stop();
+
+	if (threads->placement) {
+		for (i = 0; i < threads->placement->len; i++) {
+			g_array_free(threads->placement->pdata[i], TRUE);
+		}
+		g_ptr_array_free(threads->placement, TRUE);
+	}
+
+	g_free(threads);
+}
+
+/**
+ * add a event-thread to the event-threads handler
+ */
+void chassis_event_threads_add(chassis_event_threads_t *threads, chassis_event_thread_t *thread) {
+	thread->index = threads->event_threads->len;
+
+	g_ptr_array_add(threads->event_threads, thread);
+}
+
+
+#ifdef HAVE_SCHED_SETAFFINITY
+/**
+ * pin the calling thread to the CPUs of a event-thread
+ *
+ * @return 0 on success, -1 on error
+ */
+static int chassis_event_thread_pin(chassis_event_thread_t *event_thread) {
+	cpu_set_t cpus;
+	guint i;
+
+	CPU_ZERO(&cpus);
+	for (i = 0; i < event_thread->cpus->len; i++) {
+		CPU_SET(g_array_index(event_thread->cpus, guint, i), &cpus);
+	}
+
+	return sched_setaffinity(0, sizeof(cpus), &cpus);
+}
+#endif
+
+/**
+ * the backends of libevent 1.x, most preferred first
+ *
+ * libevent picks the first one that works unless it is disabled by its EVENT_NO* environment variable
+ */
+static const struct {
+	const char *name;
+	const char *env;
+} chassis_event_methods[] = {
+	{ "evport",  "EVENT_NOEVPORT" },
+	{ "kqueue",  "EVENT_NOKQUEUE" },
+	{ "epoll",   "EVENT_NOEPOLL" },
+	{ "devpoll", "EVENT_NODEVPOLL" },
+	{ "poll",    "EVENT_NOPOLL" },
+	{ "select",  "EVENT_NOSELECT" },
+	{ NULL, NULL }
+};
+
+/**
+ * make the event-bases use the backend of libevent named by --event-method
+ *
+ * libevent 1.x has no per-base configuration, the other backends are disabled through
+ * the environment before the event-bases are created
+ *
+ * @return 0 on success, -1 if the method is unknown
+ */
+int chassis_event_set_method(const gchar *method, GError **gerr) {
+	gboolean is_known = FALSE;
+	int i;
+
+	for (i = 0; chassis_event_methods[i].name; i++) {
+		if (0 == strcmp(method, chassis_event_methods[i].name)) is_known = TRUE;
+	}
+
+	if (!is_known) {
+		g_set_error(gerr, CHASSIS_EVENT_THREADS_ERROR, CHASSIS_EVENT_THREADS_ERROR_METHOD,
+				"unknown event-method '%s', expected one of evport, kqueue, epoll, devpoll, poll or select",
+				method);
+
+		return -1;
+	}
+
+	for (i = 0; chassis_event_methods[i].name; i++) {
+		if (0 == strcmp(method, chassis_event_methods[i].name)) {
+			g_unsetenv(chassis_event_methods[i].env);
+		} else {
+			g_setenv(chassis_event_methods[i].env, "1", TRUE);
+		}
+	}
+
+	return 0;
+}
+
+/**
+ * setup the notification-fd and the event-queue of a event-thread
+ *
+ * uses a eventfd() if available, a socketpair otherwise
+ *
+ * @see chassis_event_handle()
+ */ 
+int chassis_event_threads_init_thread(chassis_event_threads_t *threads, chassis_event_thread_t *event_thread, chassis *chas) {
+	guint ndx = threads->event_threads->len; /* the index chassis_event_threads_add() will give the thread */
+#ifdef HAVE_SCHED_SETAFFINITY
+	cpu_set_t old_cpus;
+	gboolean is_moved = FALSE;
+#endif
+
+	if (!event_thread->is_dedicated && threads->placement && ndx < threads->placement->len) {
+		event_thread->cpus = threads->placement->pdata[ndx];
+	}
+
+#ifdef HAVE_SCHED_SETAFFINITY
+	/* move to the CPUs of the thread while we allocate its data-structures to get them on its NUMA node */
+	if (event_thread->cpus &&
+	    0 == sched_getaffinity(0, sizeof(old_cpus), &old_cpus) &&
+	    0 == chassis_event_thread_pin(event_thread)) {
+		is_moved = TRUE;
+	}
+#endif
+
+	event_thread->event_base = event_base_new();
+	event_thread->chas = chas;
+	event_thread->event_queue = g_async_queue_new();
+	event_thread->timer_wheel = chassis_timer_wheel_new(event_thread->event_base);
+
+	if (chas->lua_per_event_thread || event_thread->is_dedicated) {
+		/* each thread loads its own copy of the scripts into its own lua_State */
+		event_thread->sc = lua_scope_new();
+#ifdef HAVE_LUA_H
+		/* store the pointer to the chassis in the Lua registry, like network_mysqld_init() does */
+		lua_pushlightuserdata(event_thread->sc->L, (void *)chas);
+		lua_setfield(event_thread->sc->L, LUA_REGISTRYINDEX, CHASSIS_LUA_REGISTRY_KEY);
+#endif
+	}
+
+#ifdef HAVE_SCHED_SETAFFINITY
+	if (is_moved) sched_setaffinity(0, sizeof(old_cpus), &old_cpus);
+#endif
+
+#ifdef HAVE_SYS_EVENTFD_H
+	if (-1 == (event_thread->notify_fd = eventfd(0, 0))) {
+		g_critical("%s: eventfd() failed: %s (%d)", G_STRLOC, g_strerror(errno), errno);
+		return -1;
+	}
+	event_thread->notify_send_fd = event_thread->notify_fd;
+#else
+	{
+		int fds[2];
+
+		if (0 != evutil_socketpair(AF_UNIX, SOCK_STREAM, 0, fds)) {
+			int err;
+#ifdef _WIN32
+			err = WSAGetLastError();
+#else
+			err = errno;
+#endif
+			g_critical("%s: evutil_socketpair() failed: %s (%d)", 
+					G_STRLOC,
+					g_strerror(err),
+					err);
+			return -1;
+		}
+		event_thread->notify_fd = fds[0];
+		event_thread->notify_send_fd = fds[1];
+
+		evutil_make_socket_nonblocking(event_thread->notify_send_fd);
+	}
+#endif
+	evutil_make_socket_nonblocking(event_thread->notify_fd);
+
+	event_set(&(event_thread->notify_fd_event), event_thread->notify_fd, EV_READ | EV_PERSIST, chassis_event_handle, event_thread);
+	event_base_set(event_thread->event_base, &(event_thread->notify_fd_event));
+	event_add(&(event_thread->notify_fd_event), NULL);
+
+	return 0;
+}
+
+/**
+ * dispatch the events like event_base_dispatch(), but poll without sleeping first
+ *
+ * as long as events came in during the last spin_usec we poll the event-base without
+ * blocking, only after that we sleep in the backend. A idle thread burns spin_usec
+ * of CPU after each wakeup, a busy thread never sleeps.
+ *
+ * @return 0 once the loopexit timeout fired, -1 on error
+ */
+static int chassis_event_thread_dispatch_spinning(chassis_event_thread_t *event_thread, guint64 spin_usec) {
+	guint64 start_usec = chassis_get_rel_microseconds();
+	guint64 now_usec = start_usec;
+
+	/* the loopexit of the caller fires after a second, we don't see it from here */
+	while (now_usec - start_usec < G_USEC_PER_SEC && !chassis_is_shutdown()) {
+		guint64 events = event_thread->events;
+		guint64 idle_since_usec = now_usec;
+
+		while (now_usec - idle_since_usec < spin_usec) {
+			if (-1 == event_base_loop(event_thread->event_base, EVLOOP_NONBLOCK)) return -1;
+
+			now_usec = chassis_get_rel_microseconds();
+			if (event_thread->events != events) {
+				events = event_thread->events;
+				idle_since_usec = now_usec;
+			}
+		}
+
+		if (-1 == event_base_loop(event_thread->event_base, EVLOOP_ONCE)) return -1;
+
+		now_usec = chassis_get_rel_microseconds();
+	}
+
+	return 0;
+}
+
+/**
+ * event-handler thread
+ *
+ */
+void *chassis_event_thread_loop(chassis_event_thread_t *event_thread) {
+	chassis_event_thread_set_event_base(event_thread, event_thread->event_base);
+	chassis_mem_thread_init();
+
+#ifdef HAVE_SCHED_SETAFFINITY
+	if (event_thread->cpus && 0 != chassis_event_thread_pin(event_thread)) {
+		g_critical("%s: pinning event-thread %u to its CPUs failed: %s (%d)",
+				G_STRLOC,
+				event_thread->index,
+				g_strerror(errno), errno);
+	}
+#endif
+
+	/**
+	 * check once a second if we shall shutdown the proxy
+	 */
+	while (!chassis_is_shutdown()) {
+		struct timeval timeout;
+		int r;
+
+		timeout.tv_sec = 1;
+		timeout.tv_usec = 0;
+
+		r = event_base_loopexit(event_thread->event_base, &timeout);
+		if (r == -1) {
+			g_critical("%s: leaving chassis_event_thread_loop early. event_base_loopexit() failed", G_STRLOC);
+			break;
+		}
+
+		if (event_thread->chas && event_thread->chas->event_threads_spin > 0) {
+			r = chassis_event_thread_dispatch_spinning(event_thread, event_thread->chas->event_threads_spin);
+		} else {
+			r = event_base_dispatch(event_thread->event_base);
+		}
+
+		if (r == -1) {
+#ifdef WIN32
+			errno = WSAGetLastError();
+#endif
+			if (errno == EINTR) continue;
+			g_critical("%s: leaving chassis_event_thread_loop early, errno != EINTR was: %s (%d)", G_STRLOC, g_strerror(errno), errno);
+			break;
+		}
+	}
+
+	return NULL;
+}
+
+/**
+ * start all the event-threads 
+ *
+ * starts all the event-threads that got added by chassis_event_threads_add()
+ *
+ * @see chassis_event_threads_add
+ */
+void chassis_event_threads_start(chassis_event_threads_t *threads) {
+	guint i;
+
+	g_message("%s: starting %d threads", G_STRLOC, threads->event_threads->len - 1);
+
+	for (i = 1; i < threads->event_threads->len; i++) { /* the 1st is the main-thread and already set up */
+		chassis_event_thread_start(threads->event_threads->pdata[i]);
+	}
+}
+
+/**
+ * start the loop of a event-thread in a thread of its own
+ *
+ * @return 0 on success, -1 if the thread couldn't be created
+ */
+int chassis_event_thread_start(chassis_event_thread_t *event_thread) {
+	GError *gerr = NULL;
+
+	event_thread->thr = g_thread_create((GThreadFunc)chassis_event_thread_loop, event_thread, TRUE, &gerr);
+
+	if (gerr) {
+		g_critical("%s: %s", G_STRLOC, gerr->message);
+		g_error_free(gerr);
+		return -1;
+	}
+
+	return 0;
+}
+
+/**
+ * set up a event-thread for the connections of one listener
+ *
+ * it isn't one of the event-threads the connections are spread over: the events that are
+ * added from it stay on it and it gets a lua-scope of its own. The owner adds its listen-event
+ * to the event-base of the thread, starts it with chassis_event_thread_start() and frees it
+ * with chassis_event_thread_free() which waits until the thread ended on shutdown.
+ *
+ * @return the thread, NULL on error
+ */
+chassis_event_thread_t *chassis_event_thread_new_dedicated(chassis *chas) {
+	chassis_event_thread_t *event_thread;
+
+	event_thread = chassis_event_thread_new();
+	event_thread->is_dedicated = TRUE;
+
+	if (0 != chassis_event_threads_init_thread(chas->threads, event_thread, chas)) {
+		chassis_event_thread_free(event_thread);
+		return NULL;
+	}
+
+	return event_thread;
+}
+
+/**
+ * get the lua-scope of the ndx'th event-thread
+ *
+ * the active event-threads are picked round-robin, ndx may be larger than the number of threads
+ *
+ * @return the lua-scope of the thread or NULL if the threads don't have their own lua-scope 
+ */
+lua_scope *chassis_event_threads_get_lua_scope(chassis_event_threads_t *threads, guint ndx) {
+	chassis_event_thread_t *event_thread;
+
+	if (!threads || threads->event_threads->len == 0) return NULL;
+
+	event_thread = threads->event_threads->pdata[ndx % chassis_event_threads_get_active(threads)];
+
+	return event_thread->sc;
+}
+
+static gdouble chassis_event_thread_get_queue_depth(chassis_event_thread_t *event_thread, guint64 G_GNUC_UNUSED now_usec) {
+	return MAX(g_async_queue_length(event_thread->event_queue), 0);
+}
+
+static gdouble chassis_event_thread_get_connections(chassis_event_thread_t *event_thread, guint64 G_GNUC_UNUSED now_usec) {
+	return g_atomic_int_get(&(event_thread->connections));
+}
+
+static gdouble chassis_event_thread_get_events(chassis_event_thread_t *event_thread, guint64 G_GNUC_UNUSED now_usec) {
+	return event_thread->events;
+}
+
+static gdouble chassis_event_thread_get_busy_seconds(chassis_event_thread_t *event_thread, guint64 G_GNUC_UNUSED now_usec) {
+	return event_thread->busy_usec / (gdouble)G_USEC_PER_SEC;
+}
+
+static gdouble chassis_event_thread_get_load_fraction(chassis_event_thread_t *event_thread, guint64 now_usec) {
+	return chassis_event_thread_get_load(event_thread, now_usec) / 1000.0;
+}
+
+static gdouble chassis_event_thread_get_migrations(chassis_event_thread_t *event_thread, guint64 G_GNUC_UNUSED now_usec) {
+	return event_thread->migrations;
+}
+
+/**
+ * the collector of the load of the event-threads
+ *
+ * the depth of the event-queue (the event-ops other threads sent to a event-thread that it
+ * didn't handle yet), the connections, the events, the busy time and the CPU time per
+ * subsystem of each thread
+ */
+void chassis_event_threads_collect_metrics(chassis_metrics_t G_GNUC_UNUSED *metrics, GString *out, gpointer user_data) {
+	static const struct {
+		const char *name;
+		const char *help;
+		chassis_metric_type_t type;
+		gdouble (*get)(chassis_event_thread_t *event_thread, guint64 now_usec);
+	} metrics_defs[] = {
+		{ "mysql_proxy_event_queue_depth",               "Event-ops queued for the event-thread", CHASSIS_METRIC_GAUGE, chassis_event_thread_get_queue_depth },
+		{ "mysql_proxy_event_thread_connections",        "Connections handled by the event-thread", CHASSIS_METRIC_GAUGE, chassis_event_thread_get_connections },
+		{ "mysql_proxy_event_thread_events_total",       "Events handled by the event-thread", CHASSIS_METRIC_COUNTER, chassis_event_thread_get_events },
+		{ "mysql_proxy_event_thread_busy_seconds_total", "Time the event-thread spent handling events", CHASSIS_METRIC_COUNTER, chassis_event_thread_get_busy_seconds },
+		{ "mysql_proxy_event_thread_load",               "Busy fraction of the event-thread in the last load-window", CHASSIS_METRIC_GAUGE, chassis_event_thread_get_load_fraction },
+		{ "mysql_proxy_event_thread_migrations_total",   "Idle connections moved to a less busy event-thread", CHASSIS_METRIC_COUNTER, chassis_event_thread_get_migrations },
+		{ NULL, NULL, CHASSIS_METRIC_GAUGE, NULL }
+	};
+	chassis_event_threads_t *threads = user_data;
+	GString *labels;
+	guint64 now_usec = chassis_get_rel_microseconds();
+	guint i, m;
+
+	labels = g_string_new(NULL);
+	for (m = 0; metrics_defs[m].name; m++) {
+		chassis_metrics_append_header(out, metrics_defs[m].name, metrics_defs[m].help, metrics_defs[m].type);
+
+		for (i = 0; i < threads->event_threads->len; i++) {
+			chassis_event_thread_t *event_thread = threads->event_threads->pdata[i];
+
+			if (NULL == event_thread->event_queue) continue;
+
+			g_string_printf(labels, "thread=\"%u\"", event_thread->index);
+			chassis_metrics_append_value(out, metrics_defs[m].name, labels->str, metrics_defs[m].get(event_thread, now_usec));
+		}
+	}
+
+	chassis_metrics_append_header(out, "mysql_proxy_event_threads_active", "Event-threads that take new connections", CHASSIS_METRIC_GAUGE);
+	chassis_metrics_append_value(out, "mysql_proxy_event_threads_active", NULL, chassis_event_threads_get_active(threads));
+
+	chassis_metrics_append_header(out, "mysql_proxy_event_thread_cpu_seconds_total", "CPU time of the event-thread by subsystem", CHASSIS_METRIC_COUNTER);
+	for (i = 0; i < threads->event_threads->len; i++) {
+		chassis_event_thread_t *event_thread = threads->event_threads->pdata[i];
+		chassis_event_thread_cpu_t cpu;
+
+		if (NULL == event_thread->event_queue) continue;
+
+		for (cpu = 0; cpu < CHASSIS_EVENT_THREAD_CPU_MAX; cpu++) {
+			g_string_printf(labels, "thread=\"%u\",subsystem=\"%s\"", event_thread->index, chassis_event_thread_cpu_get_name(cpu));
+			chassis_metrics_append_value(out, "mysql_proxy_event_thread_cpu_seconds_total", labels->str, chassis_event_thread_cpu_get_seconds(event_thread, cpu));
+		}
+	}
+	g_string_free(labels, TRUE);
+}
+
+/**
+ * pick the event-thread a idle connection of a busy thread moves to
+ *
+ * called by the busy thread itself. A draining thread hands its connections to the least
+ * busy active thread, whatever their load is.
+ *
+ * @return the least busy thread if it is at most half as busy, NULL if the connection stays
+ */
+chassis_event_thread_t *chassis_event_threads_pick_idle(chassis_event_threads_t *threads, chassis_event_thread_t *busy) {
+	chassis_event_thread_t *idle = NULL;
+	guint64 now_usec = chassis_get_rel_microseconds();
+	gint busy_load = 0, idle_load = 0;
+	gboolean is_draining = chassis_event_threads_is_draining(threads, busy);
+	guint active = chassis_event_threads_get_active(threads);
+	guint i;
+
+	if (!is_draining) {
+		if (busy->load_migrations >= CHASSIS_EVENT_THREAD_MAX_MIGRATIONS) return NULL;
+
+		busy_load = chassis_event_thread_get_load(busy, now_usec);
+		if (busy_load < CHASSIS_EVENT_THREAD_LOAD_BUSY) return NULL;
+	}
+
+	/* the main-thread only gets connections if it is the only thread */
+	for (i = 1; i < active; i++) {
+		chassis_event_thread_t *event_thread = threads->event_threads->pdata[i];
+		gint load;
+
+		if (event_thread == busy || event_thread->is_dedicated) continue;
+
+		load = chassis_event_thread_get_load(event_thread, now_usec);
+		if (NULL == idle || load < idle_load) {
+			idle = event_thread;
+			idle_load = load;
+		}
+	}
+
+	if (NULL == idle) return NULL;
+	if (!is_draining && idle_load * 2 > busy_load) return NULL;
+
+	busy->load_migrations++;
+	busy->migrations++;
+
+	return idle;
+}
+
+/**
+ * get the number of event-threads that take new connections
+ *
+ * counted like --event-threads, with the main-thread
+ */
+guint chassis_event_threads_get_active(chassis_event_threads_t *threads) {
+	guint active = g_atomic_int_get(&(threads->active_count));
+
+	if (active == 0 || active > threads->event_threads->len) return MAX(threads->event_threads->len, 1);
+
+	return active;
+}
+
+/**
+ * set the number of event-threads that take new connections
+ *
+ * the main-thread only takes connections if there are no other threads, at least one worker
+ * thread stays active
+ *
+ * @param active the threads counted like --event-threads, with the main-thread
+ * @return the threads that are active now
+ */
+guint chassis_event_threads_set_active(chassis_event_threads_t *threads, guint active) {
+	guint prev = chassis_event_threads_get_active(threads);
+
+	active = CLAMP(active, MIN(threads->event_threads->len, 2), MAX(threads->event_threads->len, 1));
+
+	if (active != prev) {
+		g_message("%s: %u of %u event-threads are active", G_STRLOC, active, threads->event_threads->len);
+	}
+
+	g_atomic_int_set(&(threads->active_count), active);
+	threads->autoscale_idle_windows = 0;
+
+	return active;
+}
+
+/**
+ * check if a event-thread hands its connections to the active threads
+ */
+gboolean chassis_event_threads_is_draining(chassis_event_threads_t *threads, chassis_event_thread_t *event_thread) {
+	if (NULL == event_thread || event_thread->is_dedicated || event_thread->index == 0) return FALSE;
+
+	return event_thread->index >= chassis_event_threads_get_active(threads);
+}
+
+/**
+ * adjust the active event-threads to their load (--event-threads-min)
+ *
+ * called once per load-window by the main-thread
+ *
+ * @param min_active the threads that stay active, counted like --event-threads
+ * @return the threads that are active now
+ */
+guint chassis_event_threads_autoscale(chassis_event_threads_t *threads, guint min_active, guint64 now_usec) {
+	guint active = chassis_event_threads_get_active(threads);
+	guint64 sum_load = 0;
+	guint i;
+
+	if (active < 2) return active; /* only the main-thread */
+
+	for (i = 1; i < active; i++) {
+		sum_load += chassis_event_thread_get_load(threads->event_threads->pdata[i], now_usec);
+	}
+
+	if (sum_load >= (guint64)CHASSIS_EVENT_THREAD_LOAD_BUSY * (active - 1)) {
+		if (active < threads->event_threads->len) return chassis_event_threads_set_active(threads, active + 1);
+	} else if (active > MAX(min_active, 2) &&
+	           sum_load < (guint64)CHASSIS_EVENT_THREADS_AUTOSCALE_IDLE * (active - 2)) {
+		if (++threads->autoscale_idle_windows >= CHASSIS_EVENT_THREADS_AUTOSCALE_IDLE_WINDOWS) {
+			return chassis_event_threads_set_active(threads, active - 1);
+		}
+
+		return active;
+	}
+
+	threads->autoscale_idle_windows = 0;
+
+	return active;
+}
+
+GQuark chassis_event_threads_error(void) {
+	return g_quark_from_static_string("chassis-event-threads-error-quark");
+}
+
+/**
+ * parse a list of CPUs
+ *
+ * the CPUs are separated by "," and a range of CPUs is written as "<first>-<last>", like
+ * the cpulist of /sys/devices/system/node/node<n>/ or taskset -c
+ *
+ * @return a GArray of guint in the order of the list, NULL on error
+ */
+GArray *chassis_event_threads_parse_cpus(const gchar *cpus, GError **gerr) {
+	GArray *arr;
+	gchar **ranges;
+	guint i;
+
+	arr = g_array_new(FALSE, FALSE, sizeof(guint));
+
+	ranges = g_strsplit(cpus, ",", -1);
+	for (i = 0; ranges[i]; i++) {
+		gchar *range = g_strstrip(ranges[i]);
+		gchar *end;
+		guint64 first, last, cpu;
+
+		if (!g_ascii_isdigit(range[0])) break;
+
+		first = last = g_ascii_strtoull(range, &end, 10);
+		if (*end == '-') {
+			if (!g_ascii_isdigit(end[1])) break;
+
+			last = g_ascii_strtoull(end + 1, &end, 10);
+		}
+		if (*end != '\0' || first > last || last >= 65536) break;
+
+		for (cpu = first; cpu <= last; cpu++) {
+			guint c = cpu;
+
+			g_array_append_val(arr, c);
+		}
+	}
+
+	if (ranges[i] != NULL || arr->len == 0) {
+		g_set_error(gerr, CHASSIS_EVENT_THREADS_ERROR, CHASSIS_EVENT_THREADS_ERROR_CPUS,
+				"expected a list of CPUs like 0-3,8,10-11, got '%s'",
+				cpus);
+		g_strfreev(ranges);
+		g_array_free(arr, TRUE);
+		return NULL;
+	}
+	g_strfreev(ranges);
+
+	return arr;
+}
+
+#ifdef HAVE_SCHED_SETAFFINITY
+/**
+ * get the CPUs of each NUMA node we are allowed to run on
+ *
+ * nodes without such a CPU are skipped. If the kernel doesn't expose the nodes all the
+ * allowed CPUs are put into one node.
+ *
+ * @return a GPtrArray of GArray of guint
+ */
+static GPtrArray *chassis_event_threads_get_numa_nodes(cpu_set_t *allowed) {
+	GPtrArray *nodes;
+	guint node_id;
+	guint cpu;
+
+	nodes = g_ptr_array_new();
+
+	/* node-ids are dense on all machines we know of, stop at the first missing one */
+	for (node_id = 0; ; node_id++) {
+		gchar *filename;
+		gchar *cpulist = NULL;
+		GArray *node_cpus;
+		GArray *cpus;
+		guint i;
+
+		filename = g_strdup_printf("/sys/devices/system/node/node%u/cpulist", node_id);
+		if (!g_file_get_contents(filename, &cpulist, NULL, NULL)) {
+			g_free(filename);
+			break;
+		}
+		g_free(filename);
+
+		node_cpus = chassis_event_threads_parse_cpus(cpulist, NULL); /* empty for memory-only nodes */
+		g_free(cpulist);
+
+		if (!node_cpus) continue;
+
+		cpus = g_array_new(FALSE, FALSE, sizeof(guint));
+		for (i = 0; i < node_cpus->len; i++) {
+			cpu = g_array_index(node_cpus, guint, i);
+
+			if (cpu < CPU_SETSIZE && CPU_ISSET(cpu, allowed)) g_array_append_val(cpus, cpu);
+		}
+		g_array_free(node_cpus, TRUE);
+
+		if (cpus->len == 0) {
+			g_array_free(cpus, TRUE);
+			continue;
+		}
+
+		g_ptr_array_add(nodes, cpus);
+	}
+
+	if (nodes->len == 0) {
+		GArray *cpus = g_array_new(FALSE, FALSE, sizeof(guint));
+
+		for (cpu = 0; cpu < CPU_SETSIZE; cpu++) {
+			if (CPU_ISSET(cpu, allowed)) g_array_append_val(cpus, cpu);
+		}
+
+		g_ptr_array_add(nodes, cpus);
+	}
+
+	return nodes;
+}
+#endif
+
+/**
+ * assign the CPUs to the event-threads
+ *
+ * has to be called before the event-threads are set up with chassis_event_threads_init_thread()
+ * as they allocate their data-structures on their CPUs
+ *
+ * each event-thread is pinned to one CPU:
+ *
+ * - with a list of CPUs the n-th thread gets the n-th CPU of the list, the list is reused
+ *   if there are more threads than CPUs
+ * - with "numa" the threads are split into as many blocks as we have NUMA nodes, the threads
+ *   of a block run on the CPUs of their node
+ *
+ * @param cpus         a list of CPUs or "numa"
+ * @param thread_count the number of event-threads including the main-thread
+ * @return 0 on success, -1 on error
+ */
+int chassis_event_threads_set_cpus(chassis_event_threads_t *threads, const gchar *cpus, guint thread_count, GError **gerr) {
+#ifdef HAVE_SCHED_SETAFFINITY
+	GPtrArray *placement;
+	cpu_set_t allowed;
+	guint i;
+
+	if (0 != sched_getaffinity(0, sizeof(allowed), &allowed)) {
+		g_set_error(gerr, CHASSIS_EVENT_THREADS_ERROR, CHASSIS_EVENT_THREADS_ERROR_UNSUPPORTED,
+				"sched_getaffinity() failed: %s (%d)",
+				g_strerror(errno), errno);
+		return -1;
+	}
+
+	placement = g_ptr_array_new();
+
+	if (0 == strcmp(cpus, "numa")) {
+		GPtrArray *nodes = chassis_event_threads_get_numa_nodes(&allowed);
+		guint *node_threads = g_new0(guint, nodes->len);
+
+		for (i = 0; i < thread_count; i++) {
+			guint node_ndx = (guint)(((guint64)i * nodes->len) / thread_count);
+			GArray *node_cpus = nodes->pdata[node_ndx];
+			GArray *thread_cpus = g_array_new(FALSE, FALSE, sizeof(guint));
+			guint cpu = g_array_index(node_cpus, guint, node_threads[node_ndx]++ % node_cpus->len);
+
+			g_array_append_val(thread_cpus, cpu);
+			g_ptr_array_add(placement, thread_cpus);
+		}
+
+		g_free(node_threads);
+		for (i = 0; i < nodes->len; i++) {
+			g_array_free(nodes->pdata[i], TRUE);
+		}
+		g_ptr_array_free(nodes, TRUE);
+	} else {
+		GArray *list;
+
+		if (NULL == (list = chassis_event_threads_parse_cpus(cpus, gerr))) {
+			g_ptr_array_free(placement, TRUE);
+			return -1;
+		}
+
+		for (i = 0; i < list->len; i++) {
+			guint cpu = g_array_index(list, guint, i);
+
+			if (cpu >= CPU_SETSIZE || !CPU_ISSET(cpu, &allowed)) {
+				g_set_error(gerr, CHASSIS_EVENT_THREADS_ERROR, CHASSIS_EVENT_THREADS_ERROR_CPUS,
+						"we aren't allowed to run on CPU %u",
+						cpu);
+				g_array_free(list, TRUE);
+				g_ptr_array_free(placement, TRUE);
+				return -1;
+			}
+		}
+
+		for (i = 0; i < thread_count; i++) {
+			GArray *thread_cpus = g_array_new(FALSE, FALSE, sizeof(guint));
+			guint cpu = g_array_index(list, guint, i % list->len);
+
+			g_array_append_val(thread_cpus, cpu);
+			g_ptr_array_add(placement, thread_cpus);
+		}
+		g_array_free(list, TRUE);
+	}
+
+	for (i = 0; i < placement->len; i++) {
+		g_message("%s: event-thread %u runs on CPU %u",
+				G_STRLOC,
+				i,
+				g_array_index((GArray *)placement->pdata[i], guint, 0));
+	}
+
+	threads->placement = placement;
+
+	return 0;
+#else
+	g_set_error(gerr, CHASSIS_EVENT_THREADS_ERROR, CHASSIS_EVENT_THREADS_ERROR_UNSUPPORTED,
+			"pinning threads to CPUs isn't supported on this platform");
+	return -1;
+#endif
+}
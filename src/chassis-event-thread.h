@@ -26,6 +26,8 @@
 
 #include "chassis-exports.h"
 #include "chassis-mainloop.h"
+#include "chassis-timer-wheel.h"
+#include "lua-scope.h"
 
 /**
  * event operations
@@ -36,10 +38,12 @@
 typedef struct {
 	enum {
 		CHASSIS_EVENT_OP_UNSET,
-		CHASSIS_EVENT_OP_ADD
+		CHASSIS_EVENT_OP_ADD,
+		CHASSIS_EVENT_OP_ACTIVATE  /**< the socket of a wait of the completion-port is readable */
 	} type;
 
 	struct event *ev;
+	guint64 gen;        /**< the generation of the wait for CHASSIS_EVENT_OP_ACTIVATE */
 
 	struct timeval _tv_storage;
 	struct timeval *tv; /* points to ._tv_storage or to NULL */
@@ -52,6 +56,29 @@ CHASSIS_API void chassis_event_add(chassis *chas, struct event *ev);
 CHASSIS_API void chassis_event_add_with_timeout(chassis *chas, struct event *ev, struct timeval *tv);
 CHASSIS_API void chassis_event_add_local(chassis *chas, struct event *ev);
 CHASSIS_API void chassis_event_add_local_with_timeout(chassis *chas, struct event *ev, struct timeval *tv);
+CHASSIS_API void chassis_event_add_with_timer(chassis *chas, struct event *ev, chassis_timer_wheel_timer_t *timer, struct timeval *tv);
+CHASSIS_API gboolean chassis_event_thread_keeps_events(chassis *chas);
+
+/**
+ * the subsystems the CPU time of a event-thread is accounted to
+ *
+ * network_mysqld_con_handle() accounts its cycles to CHASSIS_EVENT_THREAD_CPU_CORE, the
+ * subsystems it calls into switch the account with chassis_event_thread_cpu_enter() and back
+ * with chassis_event_thread_cpu_leave(). The cycles of a nested subsystem only count for the
+ * inner one.
+ */
+typedef enum {
+	CHASSIS_EVENT_THREAD_CPU_NONE = -1, /**< not accounting, outside of the connection handler */
+
+	CHASSIS_EVENT_THREAD_CPU_CORE,      /**< the state-machine of the connections */
+	CHASSIS_EVENT_THREAD_CPU_PROTOCOL,  /**< the hooks of the plugins: decoding and encoding packets, routing */
+	CHASSIS_EVENT_THREAD_CPU_LUA,       /**< the hooks of the lua-scripts */
+	CHASSIS_EVENT_THREAD_CPU_TOKENIZER, /**< classifying and normalizing the queries */
+	CHASSIS_EVENT_THREAD_CPU_SOCKET,    /**< reading from and writing to the sockets, with TLS and compression */
+	CHASSIS_EVENT_THREAD_CPU_LOG,       /**< writing the error-log and the query-log */
+
+	CHASSIS_EVENT_THREAD_CPU_MAX
+} chassis_event_thread_cpu_t;
 
 /**
  * a event-thread
@@ -59,25 +86,111 @@ CHASSIS_API void chassis_event_add_local_with_timeout(chassis *chas, struct even
 typedef struct {
 	chassis *chas;
 
-	int notify_fd;
+	guint index;                  /**< index in chassis_event_threads_t.event_threads, 0 is the main-thread */
+
+	int notify_fd;                /**< read-end of the notification-fd */
+	int notify_send_fd;           /**< write-end of the notification-fd, the same as notify_fd for a eventfd() */
 	struct event notify_fd_event;
 
+	GAsyncQueue *event_queue;     /**< event-ops sent to this thread by other threads */
+
 	GThread *thr;
 
 	struct event_base *event_base;
+
+	lua_scope *sc; /**< the lua-scope of this thread, only set if --lua-per-event-thread is used */
+
+	GArray *cpus;  /**< the CPUs (guint) the thread is pinned to, NULL if it isn't pinned. Owned by chassis_event_threads_t */
+
+	chassis_timer_wheel_t *timer_wheel; /**< the timeouts of the connections of this thread */
+	GQueue timers;                      /**< the periodic timers of this thread, see chassis_event_timer_new() */
+	GQueue idle_cons;                   /**< the clients of this thread that wait for their next query, the longest waiting first, see network_mysqld_con_idle_enter() */
+
+	gboolean is_dedicated; /**< not one of the threads connections are spread over, see chassis_event_thread_new_dedicated() */
+
+	/* the load of the thread, written by the thread itself and read unlocked by the metrics and the admin-plugin */
+	volatile gint connections;    /**< connections whose events this thread handles, see network_mysqld_con_handle() */
+	guint64 events;               /**< events handled */
+	guint64 busy_usec;            /**< time spent handling them */
+	volatile gint load;           /**< permille of the last load-window the thread was busy, see chassis_event_thread_get_load() */
+	guint64 load_start_usec;      /**< start of the current load-window */
+	guint64 load_busy_usec;       /**< busy time in the current load-window */
+	guint load_migrations;        /**< connections moved away in the current load-window */
+	guint64 migrations;           /**< connections moved away to other threads */
+	guint handle_depth;           /**< nested calls of the connection handler, only the outermost is accounted */
+
+	guint64 cpu_cycles[CHASSIS_EVENT_THREAD_CPU_MAX]; /**< cycles spent in each subsystem */
+	chassis_event_thread_cpu_t cpu_current;            /**< the subsystem the cycles since .cpu_since go to */
+	guint64 cpu_since;
 } chassis_event_thread_t;
 
 CHASSIS_API chassis_event_thread_t *chassis_event_thread_new();
+CHASSIS_API chassis_event_thread_t *chassis_event_thread_new_dedicated(chassis *chas);
+CHASSIS_API int chassis_event_thread_start(chassis_event_thread_t *event_thread);
 CHASSIS_API void chassis_event_thread_free(chassis_event_thread_t *e);
 CHASSIS_API void chassis_event_handle(int event_fd, short events, void *user_data);
 CHASSIS_API void chassis_event_thread_set_event_base(chassis_event_thread_t *e, struct event_base *event_base);
 CHASSIS_API void *chassis_event_thread_loop(chassis_event_thread_t *);
+CHASSIS_API chassis_event_thread_t *chassis_event_thread_get_local(void);
+CHASSIS_API guint chassis_event_thread_get_local_index(void);
+CHASSIS_API void chassis_event_add_to_thread(chassis_event_thread_t *event_thread, struct event *ev, struct timeval *tv);
+CHASSIS_API void chassis_event_activate_in_thread(chassis_event_thread_t *event_thread, struct event *ev, guint64 gen);
+CHASSIS_API void chassis_event_thread_account(chassis_event_thread_t *event_thread, guint64 start_usec, guint64 end_usec);
+CHASSIS_API gint chassis_event_thread_get_load(chassis_event_thread_t *event_thread, guint64 now_usec);
+CHASSIS_API void chassis_event_thread_cpu_start(chassis_event_thread_t *event_thread);
+CHASSIS_API void chassis_event_thread_cpu_stop(chassis_event_thread_t *event_thread);
+CHASSIS_API chassis_event_thread_cpu_t chassis_event_thread_cpu_enter(chassis_event_thread_cpu_t cpu);
+CHASSIS_API void chassis_event_thread_cpu_leave(chassis_event_thread_cpu_t prev);
+CHASSIS_API const char *chassis_event_thread_cpu_get_name(chassis_event_thread_cpu_t cpu);
+CHASSIS_API gdouble chassis_event_thread_cpu_get_seconds(chassis_event_thread_t *event_thread, chassis_event_thread_cpu_t cpu);
+
+/**
+ * a periodic timer of a event-thread
+ *
+ * the timers run on the timer-wheel of their event-thread, off the path of the queries. A
+ * timer fires at the multiples of its interval: the timers of the same interval wake up the
+ * thread together, even if they were added at different times. A timer that fired late waits
+ * for the next multiple, the runs it missed are skipped.
+ *
+ * @see chassis_event_timer_new()
+ */
+typedef struct chassis_event_timer chassis_event_timer_t;
+
+/**
+ * called each time the timer fires, it may free the timer
+ */
+typedef void (*chassis_event_timer_func)(chassis_event_timer_t *timer, gpointer user_data);
+
+struct chassis_event_timer {
+	chassis_event_thread_t *event_thread;
+	guint64 interval_ms;
+
+	chassis_event_timer_func func;
+	gpointer user_data;
+	GDestroyNotify user_data_free;
+
+	guint64 runs;                       /**< times .func was called */
+
+	chassis_timer_wheel_timer_t wheel_timer;
+	GList link;                         /**< our link in chassis_event_thread_t.timers */
+
+	gboolean is_running;                /**< .func is running, a free is deferred until it returned */
+	gboolean is_freed;
+};
+
+CHASSIS_API chassis_event_timer_t *chassis_event_timer_new(chassis_event_thread_t *event_thread, guint64 interval_ms,
+		chassis_event_timer_func func, gpointer user_data, GDestroyNotify user_data_free);
+CHASSIS_API void chassis_event_timer_free(chassis_event_timer_t *timer);
 
 struct chassis_event_threads_t {
  	GPtrArray *event_threads;
 
-	GAsyncQueue *event_queue;
-	int event_notify_fds[2];
+	volatile gint next_thread_ndx; /**< round-robin counter for events added from outside the worker-threads */
+
+	GPtrArray *placement;          /**< the CPUs of the n-th event-thread, a GArray of guint each, see chassis_event_threads_set_cpus() */
+
+	volatile gint active_count;    /**< the event-threads (with the main-thread) that take connections, 0 for all, see chassis_event_threads_set_active() */
+	guint autoscale_idle_windows;  /**< load-windows the active threads could have been one less, see chassis_event_threads_autoscale() */
 };
 
 CHASSIS_API chassis_event_threads_t *chassis_event_threads_new();
@@ -85,5 +198,81 @@ CHASSIS_API void chassis_event_threads_free(chassis_event_threads_t *threads);
 CHASSIS_API int chassis_event_threads_init_thread(chassis_event_threads_t *threads, chassis_event_thread_t *event_thread, chassis *chas);
 CHASSIS_API void chassis_event_threads_add(chassis_event_threads_t *threads, chassis_event_thread_t *thread);
 CHASSIS_API void chassis_event_threads_start(chassis_event_threads_t *threads);
+CHASSIS_API lua_scope *chassis_event_threads_get_lua_scope(chassis_event_threads_t *threads, guint ndx);
+CHASSIS_API void chassis_event_threads_collect_metrics(chassis_metrics_t *metrics, GString *out, gpointer user_data);
+
+/**
+ * move idle connections away from busy event-threads (--event-threads-rebalance)
+ *
+ * a thread that was busy for more than CHASSIS_EVENT_THREAD_LOAD_BUSY permille of the last
+ * load-window hands the connections that wait for their next query to the least busy thread,
+ * if that is at most half as busy. At most CHASSIS_EVENT_THREAD_MAX_MIGRATIONS connections
+ * move per window, the load of the other thread is only known a window later.
+ */
+#define CHASSIS_EVENT_THREAD_LOAD_WINDOW_USEC  G_USEC_PER_SEC
+#define CHASSIS_EVENT_THREAD_LOAD_BUSY         750
+#define CHASSIS_EVENT_THREAD_MAX_MIGRATIONS    16
+
+CHASSIS_API chassis_event_thread_t *chassis_event_threads_pick_idle(chassis_event_threads_t *threads, chassis_event_thread_t *busy);
+
+/**
+ * scale the event-threads at runtime
+ *
+ * the shards of the per-thread resources (the connection pools, the digests, the rate-limits, ...)
+ * are sized for --event-threads at startup, the threads are all created then. Only the first
+ * active ones take new connections: the others are draining, their connections move to the
+ * active threads at their next safe point (waiting for the next query, see
+ * network_mysqld_con_migrate()) and a drained thread sleeps in its event-loop until it is
+ * active again.
+ *
+ * the active threads are set by PROXY SET EVENT THREADS on the admin-plugin or with
+ * --event-threads-min by chassis_event_threads_autoscale(), once per load-window:
+ *
+ * - if the active threads are busy for more than CHASSIS_EVENT_THREAD_LOAD_BUSY permille on
+ *   average, one more thread gets active
+ * - if their load would fit into one thread less at CHASSIS_EVENT_THREADS_AUTOSCALE_IDLE
+ *   permille for CHASSIS_EVENT_THREADS_AUTOSCALE_IDLE_WINDOWS windows in a row, the last one
+ *   is drained
+ */
+#define CHASSIS_EVENT_THREADS_AUTOSCALE_IDLE          (CHASSIS_EVENT_THREAD_LOAD_BUSY / 2)
+#define CHASSIS_EVENT_THREADS_AUTOSCALE_IDLE_WINDOWS  30
+
+CHASSIS_API guint chassis_event_threads_get_active(chassis_event_threads_t *threads);
+CHASSIS_API guint chassis_event_threads_set_active(chassis_event_threads_t *threads, guint active);
+CHASSIS_API gboolean chassis_event_threads_is_draining(chassis_event_threads_t *threads, chassis_event_thread_t *event_thread);
+CHASSIS_API guint chassis_event_threads_autoscale(chassis_event_threads_t *threads, guint min_active, guint64 now_usec);
+
+/**
+ * pin the event-threads to CPUs
+ *
+ * --event-threads-cpus takes
+ *
+ * - a list of CPUs like "0-3,8-11": the n-th event-thread runs on the n-th CPU of the list
+ * - "numa": the event-threads are split into blocks, one per NUMA node, each thread runs on
+ *   a CPU of its node
+ *
+ * the event-base, the event-queue and the lua-scope of a thread are allocated while the
+ * main-thread runs on the CPUs of the thread, the connections and the packet buffers are
+ * allocated by the thread itself. Linux places the pages on the node of the CPU that
+ * touches them first, everything a thread works on stays on its node.
+ */
+CHASSIS_API GArray *chassis_event_threads_parse_cpus(const gchar *cpus, GError **gerr);
+CHASSIS_API int chassis_event_threads_set_cpus(chassis_event_threads_t *threads, const gchar *cpus, guint thread_count, GError **gerr);
+
+/**
+ * pick the backend of libevent for the event-bases (--event-method)
+ *
+ * has to be called before the first event-base is created
+ */
+CHASSIS_API int chassis_event_set_method(const gchar *method, GError **gerr);
+
+#define CHASSIS_EVENT_THREADS_ERROR chassis_event_threads_error()
+CHASSIS_API GQuark chassis_event_threads_error(void);
+
+typedef enum {
+	CHASSIS_EVENT_THREADS_ERROR_UNSUPPORTED, /**< no sched_setaffinity() on this platform */
+	CHASSIS_EVENT_THREADS_ERROR_CPUS,        /**< the list of CPUs is invalid */
+	CHASSIS_EVENT_THREADS_ERROR_METHOD       /**< the event-method isn't known to libevent */
+} chassis_event_threads_error_t;
 
 #endif
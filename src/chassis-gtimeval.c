@@ -21,6 +21,7 @@
 #include <glib.h>
 
 #include "chassis-gtimeval.h"
+#include "chassis-timings.h"
 
 void chassis_gtime_testset_now(GTimeVal *gt, gint64 *delay)
 {
@@ -30,7 +31,7 @@ void chassis_gtime_testset_now(GTimeVal *gt, gint64 *delay)
 	if (gt == NULL)
 		return;
 
-	g_get_current_time(&now);
+	chassis_get_coarse_current_time(&now);
 	ge_gtimeval_diff(gt, &now, &tdiff);
 
 	if (tdiff < 0) {
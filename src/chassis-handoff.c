@@ -0,0 +1,648 @@
+/* $%BEGINLICENSE%$
+ Copyright (c) 2008, 2012, Oracle and/or its affiliates. All rights reserved.
+
+ This program is free software; you can redistribute it and/or
+ modify it under the terms of the GNU General Public License as
+ published by the Free Software Foundation; version 2 of the
+ License.
+
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ GNU General Public License for more details.
+
+ You should have received a copy of the GNU General Public License
+ along with this program; if not, write to the Free Software
+ Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA
+ 02110-1301  USA
+
+ $%ENDLICENSE%$ */
+/**
+ * hot upgrade: hand the listening sockets over to a new binary
+ *
+ * see chassis-handoff.h for the protocol
+ *
+ * the fds are taken and registered while the plugins are set up and handed
+ * over from the main event-loop, all of it happens in the main-thread. Only
+ * chassis_handoff_is_draining() is called from the event-threads.
+ *
+ * once we are draining the mainloop shuts down when the connections are gone
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <sys/types.h>
+#include <string.h>
+#include <errno.h>
+
+#ifndef _WIN32
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+#include <glib.h>
+#include <glib/gstdio.h>
+
+#include "chassis-handoff.h"
+
+/* wait at most that long for the old proxy to send its fds */
+#define CHASSIS_HANDOFF_RECEIVE_TIMEOUT_SEC 10
+
+typedef struct {
+	gchar *name;    /**< the address of the socket, like network_address->name */
+	int fd;
+} chassis_handoff_fd_t;
+
+typedef struct {
+	GQueue *received;      /**< chassis_handoff_fd_t from the old proxy, not taken yet */
+	GPtrArray *listening;  /**< chassis_handoff_fd_t we hand to the next proxy */
+
+	int old_fd;            /**< connection to the old proxy, acked once we are set up */
+
+	struct event_base *event_base;
+	gchar *path;
+
+	int listen_fd;         /**< the new proxy connects here */
+	struct event listen_event;
+
+	int new_fd;            /**< connection of the new proxy, waiting for its ack */
+	struct event new_event;
+
+	volatile gint is_draining;
+} chassis_handoff_t;
+
+static chassis_handoff_t *handoff = NULL;
+
+GQuark chassis_handoff_error(void) {
+	return g_quark_from_static_string("chassis-handoff-error-quark");
+}
+
+static chassis_handoff_fd_t *chassis_handoff_fd_new(const gchar *name, int fd) {
+	chassis_handoff_fd_t *hfd;
+
+	hfd = g_new0(chassis_handoff_fd_t, 1);
+	hfd->name = g_strdup(name);
+	hfd->fd = fd;
+
+	return hfd;
+}
+
+static void chassis_handoff_fd_free(chassis_handoff_fd_t *hfd) {
+	if (!hfd) return;
+
+	g_free(hfd->name);
+	g_free(hfd);
+}
+
+static chassis_handoff_t *chassis_handoff_get(void) {
+	if (handoff) return handoff;
+
+	handoff = g_new0(chassis_handoff_t, 1);
+	handoff->received = g_queue_new();
+	handoff->listening = g_ptr_array_new();
+	handoff->old_fd = -1;
+	handoff->listen_fd = -1;
+	handoff->new_fd = -1;
+
+	return handoff;
+}
+
+/**
+ * TRUE once we handed our listening sockets to a new proxy
+ *
+ * the listeners stop accepting, the new proxy takes the connections
+ */
+gboolean chassis_handoff_is_draining(void) {
+	if (!handoff) return FALSE;
+
+	return g_atomic_int_get(&(handoff->is_draining)) != 0;
+}
+
+/**
+ * take the fd the old proxy listened on for this address
+ *
+ * if the old proxy had several sockets for the same address (--proxy-reuse-port),
+ * each call takes the next one
+ *
+ * @return the fd or -1 if we didn't receive one for this address
+ */
+int chassis_handoff_take_fd(const gchar *name) {
+	GList *node;
+
+	if (!handoff) return -1;
+
+	for (node = handoff->received->head; node; node = node->next) {
+		chassis_handoff_fd_t *hfd = node->data;
+		int fd;
+
+		if (0 != strcmp(hfd->name, name)) continue;
+
+		fd = hfd->fd;
+		g_queue_delete_link(handoff->received, node);
+		chassis_handoff_fd_free(hfd);
+
+		return fd;
+	}
+
+	return -1;
+}
+
+/**
+ * register a listening socket to hand over on the next upgrade
+ *
+ * the fd stays owned by the caller
+ */
+void chassis_handoff_add_fd(const gchar *name, int fd) {
+	g_ptr_array_add(chassis_handoff_get()->listening, chassis_handoff_fd_new(name, fd));
+}
+
+/**
+ * close the sockets of the old proxy that none of our listeners took
+ *
+ * the connections that are queued on them are reset
+ */
+void chassis_handoff_close_unclaimed(void) {
+	chassis_handoff_fd_t *hfd;
+
+	if (!handoff) return;
+
+	while (NULL != (hfd = g_queue_pop_head(handoff->received))) {
+		g_warning("%s: the old proxy listened on %s, we don't. Closing it.",
+				G_STRLOC, hfd->name);
+#ifndef _WIN32
+		close(hfd->fd);
+#endif
+		chassis_handoff_fd_free(hfd);
+	}
+}
+
+#ifndef _WIN32
+static int chassis_handoff_read_full(int fd, void *_buf, gsize len) {
+	char *buf = _buf;
+
+	while (len > 0) {
+		ssize_t r = read(fd, buf, len);
+
+		if (r == -1 && errno == EINTR) continue;
+		if (r <= 0) return -1;
+
+		buf += r;
+		len -= r;
+	}
+
+	return 0;
+}
+
+static int chassis_handoff_write_full(int fd, const void *_buf, gsize len) {
+	const char *buf = _buf;
+
+	while (len > 0) {
+		ssize_t r = write(fd, buf, len);
+
+		if (r == -1 && errno == EINTR) continue;
+		if (r <= 0) return -1;
+
+		buf += r;
+		len -= r;
+	}
+
+	return 0;
+}
+
+/**
+ * send a fd and its name
+ *
+ * the fd travels with the first byte of the length
+ */
+static int chassis_handoff_send_fd(int sock, const gchar *name, int fd) {
+	struct msghdr msg;
+	struct iovec iov;
+	struct cmsghdr *cmsg;
+	union {
+		struct cmsghdr align;
+		char buf[CMSG_SPACE(sizeof(int))];
+	} ctrl;
+	unsigned char hdr[2];
+	gsize name_len = strlen(name);
+	ssize_t r;
+
+	g_return_val_if_fail(name_len > 0 && name_len <= G_MAXUINT16, -1);
+
+	hdr[0] = (name_len >> 0) & 0xff;
+	hdr[1] = (name_len >> 8) & 0xff;
+
+	iov.iov_base = hdr;
+	iov.iov_len = sizeof(hdr);
+
+	memset(&msg, 0, sizeof(msg));
+	memset(&ctrl, 0, sizeof(ctrl));
+	msg.msg_iov = &iov;
+	msg.msg_iovlen = 1;
+	msg.msg_control = ctrl.buf;
+	msg.msg_controllen = sizeof(ctrl.buf);
+
+	cmsg = CMSG_FIRSTHDR(&msg);
+	cmsg->cmsg_level = SOL_SOCKET;
+	cmsg->cmsg_type = SCM_RIGHTS;
+	cmsg->cmsg_len = CMSG_LEN(sizeof(int));
+	memcpy(CMSG_DATA(cmsg), &fd, sizeof(int));
+
+	do {
+		r = sendmsg(sock, &msg, 0);
+	} while (r == -1 && errno == EINTR);
+
+	if (r == -1) return -1;
+
+	/* sendmsg() on a stream-socket may send only the first byte */
+	if (r < (ssize_t)sizeof(hdr) &&
+	    0 != chassis_handoff_write_full(sock, hdr + r, sizeof(hdr) - r)) {
+		return -1;
+	}
+
+	return chassis_handoff_write_full(sock, name, name_len);
+}
+
+/**
+ * receive the length of the next name and the fd that comes with it
+ *
+ * @param fd  set to -1 if no fd was passed (the end of the list)
+ */
+static int chassis_handoff_recv_fd(int sock, guint16 *name_len, int *fd) {
+	struct msghdr msg;
+	struct iovec iov;
+	struct cmsghdr *cmsg;
+	union {
+		struct cmsghdr align;
+		char buf[CMSG_SPACE(sizeof(int))];
+	} ctrl;
+	unsigned char hdr[2];
+	ssize_t r;
+
+	iov.iov_base = hdr;
+	iov.iov_len = sizeof(hdr);
+
+	memset(&msg, 0, sizeof(msg));
+	msg.msg_iov = &iov;
+	msg.msg_iovlen = 1;
+	msg.msg_control = ctrl.buf;
+	msg.msg_controllen = sizeof(ctrl.buf);
+
+	do {
+		r = recvmsg(sock, &msg, 0);
+	} while (r == -1 && errno == EINTR);
+
+	if (r <= 0) return -1;
+
+	*fd = -1;
+	for (cmsg = CMSG_FIRSTHDR(&msg); cmsg; cmsg = CMSG_NXTHDR(&msg, cmsg)) {
+		if (cmsg->cmsg_level == SOL_SOCKET &&
+		    cmsg->cmsg_type == SCM_RIGHTS &&
+		    cmsg->cmsg_len == CMSG_LEN(sizeof(int))) {
+			memcpy(fd, CMSG_DATA(cmsg), sizeof(int));
+		}
+	}
+
+	if (r < (ssize_t)sizeof(hdr) &&
+	    0 != chassis_handoff_read_full(sock, hdr + r, sizeof(hdr) - r)) {
+		if (*fd != -1) close(*fd);
+		return -1;
+	}
+
+	*name_len = hdr[0] | (hdr[1] << 8);
+
+	return 0;
+}
+
+static int chassis_handoff_set_address(struct sockaddr_un *addr, const gchar *path, GError **gerr) {
+	memset(addr, 0, sizeof(*addr));
+	addr->sun_family = AF_UNIX;
+
+	if (strlen(path) >= sizeof(addr->sun_path)) {
+		g_set_error(gerr,
+				CHASSIS_HANDOFF_ERROR,
+				CHASSIS_HANDOFF_ERROR_LISTEN,
+				"--handoff-socket %s is longer than %d chars",
+				path, (int)sizeof(addr->sun_path) - 1);
+		return -1;
+	}
+	strcpy(addr->sun_path, path);
+
+	return 0;
+}
+#endif
+
+/**
+ * take the listening sockets of the old proxy
+ *
+ * if no proxy listens on the path we start without them
+ *
+ * @return 0 on success or if there is no old proxy, -1 on error
+ */
+int chassis_handoff_receive(const gchar *path, GError **gerr) {
+#ifndef _WIN32
+	chassis_handoff_t *h = chassis_handoff_get();
+	struct sockaddr_un addr;
+	struct timeval tv;
+	int sock;
+
+	if (0 != chassis_handoff_set_address(&addr, path, gerr)) return -1;
+
+	if (-1 == (sock = socket(AF_UNIX, SOCK_STREAM, 0))) {
+		g_set_error(gerr,
+				CHASSIS_HANDOFF_ERROR,
+				CHASSIS_HANDOFF_ERROR_RECEIVE,
+				"socket() for --handoff-socket %s failed: %s",
+				path, g_strerror(errno));
+		return -1;
+	}
+
+	if (0 != connect(sock, (struct sockaddr *)&addr, sizeof(addr))) {
+		int err = errno;
+
+		close(sock);
+
+		if (err == ENOENT || err == ECONNREFUSED) {
+			/* no old proxy, a fresh start */
+			g_debug("%s: no proxy listens on %s, nothing to take over", G_STRLOC, path);
+			return 0;
+		}
+
+		g_set_error(gerr,
+				CHASSIS_HANDOFF_ERROR,
+				CHASSIS_HANDOFF_ERROR_RECEIVE,
+				"connect(%s) failed: %s",
+				path, g_strerror(err));
+		return -1;
+	}
+
+	/* don't hang forever if the old proxy is stuck */
+	tv.tv_sec = CHASSIS_HANDOFF_RECEIVE_TIMEOUT_SEC;
+	tv.tv_usec = 0;
+	setsockopt(sock, SOL_SOCKET, SO_RCVTIMEO, (const void *)&tv, sizeof(tv));
+
+	for (;;) {
+		guint16 name_len;
+		gchar *name;
+		int fd;
+
+		if (0 != chassis_handoff_recv_fd(sock, &name_len, &fd)) {
+			g_set_error(gerr,
+					CHASSIS_HANDOFF_ERROR,
+					CHASSIS_HANDOFF_ERROR_RECEIVE,
+					"receiving the sockets from the old proxy on %s failed: %s",
+					path, g_strerror(errno));
+			close(sock);
+			return -1;
+		}
+
+		if (name_len == 0) {
+			if (fd != -1) close(fd);
+			break;
+		}
+
+		if (fd == -1) {
+			g_set_error(gerr,
+					CHASSIS_HANDOFF_ERROR,
+					CHASSIS_HANDOFF_ERROR_RECEIVE,
+					"the old proxy on %s sent a name without a fd",
+					path);
+			close(sock);
+			return -1;
+		}
+
+		name = g_malloc(name_len + 1);
+		if (0 != chassis_handoff_read_full(sock, name, name_len)) {
+			g_set_error(gerr,
+					CHASSIS_HANDOFF_ERROR,
+					CHASSIS_HANDOFF_ERROR_RECEIVE,
+					"receiving the sockets from the old proxy on %s failed: %s",
+					path, g_strerror(errno));
+			g_free(name);
+			close(fd);
+			close(sock);
+			return -1;
+		}
+		name[name_len] = '\0';
+
+		g_queue_push_tail(h->received, chassis_handoff_fd_new(name, fd));
+		g_free(name);
+	}
+
+	g_message("took over %u listening sockets from the proxy on %s", h->received->length, path);
+
+	h->old_fd = sock;
+
+	return 0;
+#else
+	g_set_error(gerr,
+			CHASSIS_HANDOFF_ERROR,
+			CHASSIS_HANDOFF_ERROR_UNSUPPORTED,
+			"--handoff-socket isn't supported on win32");
+	return -1;
+#endif
+}
+
+#ifndef _WIN32
+static void chassis_handoff_start_draining(chassis_handoff_t *h) {
+	/* the new proxy owns the path now, don't unlink it */
+	event_del(&(h->listen_event));
+	close(h->listen_fd);
+	h->listen_fd = -1;
+
+	g_atomic_int_set(&(h->is_draining), 1);
+}
+
+/**
+ * the new proxy acked or went away
+ */
+static void chassis_handoff_new_ack(int G_GNUC_UNUSED event_fd, short G_GNUC_UNUSED events, void *user_data) {
+	chassis_handoff_t *h = user_data;
+	char ack;
+	ssize_t r;
+
+	do {
+		r = read(h->new_fd, &ack, 1);
+	} while (r == -1 && errno == EINTR);
+
+	close(h->new_fd);
+	h->new_fd = -1;
+
+	if (r != 1) {
+		g_critical("%s: the new proxy closed the connection before it was ready, we keep serving", G_STRLOC);
+		return;
+	}
+
+	g_message("%s: the new proxy took over the listening sockets, draining the open connections", G_STRLOC);
+
+	chassis_handoff_start_draining(h);
+}
+
+/**
+ * a new proxy connected, send it our listening sockets
+ */
+static void chassis_handoff_accept(int G_GNUC_UNUSED event_fd, short G_GNUC_UNUSED events, void *user_data) {
+	chassis_handoff_t *h = user_data;
+	unsigned char end_of_list[2] = { 0, 0 };
+	guint i;
+	int fd;
+
+	if (-1 == (fd = accept(h->listen_fd, NULL, NULL))) {
+		return;
+	}
+
+	if (h->new_fd != -1) {
+		/* one upgrade at a time */
+		g_critical("%s: another proxy is already taking over, closing the new connection", G_STRLOC);
+		close(fd);
+		return;
+	}
+
+	for (i = 0; i < h->listening->len; i++) {
+		chassis_handoff_fd_t *hfd = h->listening->pdata[i];
+
+		if (0 != chassis_handoff_send_fd(fd, hfd->name, hfd->fd)) {
+			g_critical("%s: sending the socket of %s to the new proxy failed: %s",
+					G_STRLOC, hfd->name, g_strerror(errno));
+			close(fd);
+			return;
+		}
+	}
+
+	if (0 != chassis_handoff_write_full(fd, end_of_list, sizeof(end_of_list))) {
+		g_critical("%s: sending the sockets to the new proxy failed: %s",
+				G_STRLOC, g_strerror(errno));
+		close(fd);
+		return;
+	}
+
+	g_message("%s: sent %u listening sockets to the new proxy, waiting for it to be ready",
+			G_STRLOC, h->listening->len);
+
+	/* keep accepting until the new proxy is ready, it may still fail */
+	h->new_fd = fd;
+	event_set(&(h->new_event), fd, EV_READ, chassis_handoff_new_ack, h);
+	event_base_set(h->event_base, &(h->new_event));
+	event_add(&(h->new_event), NULL);
+}
+#endif
+
+/**
+ * ack the old proxy and wait for the next upgrade on path
+ *
+ * call it after all listening sockets are set up
+ */
+int chassis_handoff_listen(struct event_base *event_base, const gchar *path, GError **gerr) {
+#ifndef _WIN32
+	chassis_handoff_t *h = chassis_handoff_get();
+	struct sockaddr_un addr;
+	mode_t old_umask;
+	int fd;
+
+	if (0 != chassis_handoff_set_address(&addr, path, gerr)) return -1;
+
+	if (h->old_fd != -1) {
+		char ack = 1;
+
+		/* the old proxy stops accepting and releases the path */
+		if (0 != chassis_handoff_write_full(h->old_fd, &ack, 1)) {
+			g_critical("%s: acking the old proxy on %s failed: %s",
+					G_STRLOC, path, g_strerror(errno));
+		}
+		close(h->old_fd);
+		h->old_fd = -1;
+	}
+
+	if (0 != g_unlink(path) && errno != ENOENT) {
+		g_set_error(gerr,
+				CHASSIS_HANDOFF_ERROR,
+				CHASSIS_HANDOFF_ERROR_LISTEN,
+				"unlink(%s) failed: %s",
+				path, g_strerror(errno));
+		return -1;
+	}
+
+	if (-1 == (fd = socket(AF_UNIX, SOCK_STREAM, 0))) {
+		g_set_error(gerr,
+				CHASSIS_HANDOFF_ERROR,
+				CHASSIS_HANDOFF_ERROR_LISTEN,
+				"socket() for --handoff-socket %s failed: %s",
+				path, g_strerror(errno));
+		return -1;
+	}
+
+	/* whoever connects gets our listening sockets, only let our own user in */
+	old_umask = umask(0077);
+	if (0 != bind(fd, (struct sockaddr *)&addr, sizeof(addr)) ||
+	    0 != listen(fd, 1)) {
+		umask(old_umask);
+		g_set_error(gerr,
+				CHASSIS_HANDOFF_ERROR,
+				CHASSIS_HANDOFF_ERROR_LISTEN,
+				"listening on --handoff-socket %s failed: %s",
+				path, g_strerror(errno));
+		close(fd);
+		return -1;
+	}
+	umask(old_umask);
+
+	h->event_base = event_base;
+	h->path = g_strdup(path);
+	h->listen_fd = fd;
+
+	event_set(&(h->listen_event), fd, EV_READ | EV_PERSIST, chassis_handoff_accept, h);
+	event_base_set(event_base, &(h->listen_event));
+	event_add(&(h->listen_event), NULL);
+
+	return 0;
+#else
+	g_set_error(gerr,
+			CHASSIS_HANDOFF_ERROR,
+			CHASSIS_HANDOFF_ERROR_UNSUPPORTED,
+			"--handoff-socket isn't supported on win32");
+	return -1;
+#endif
+}
+
+/**
+ * free the handoff state
+ *
+ * the registered fds are owned by the listeners, we only close our own
+ */
+void chassis_handoff_shutdown(void) {
+	chassis_handoff_t *h = handoff;
+	guint i;
+
+	if (!h) return;
+
+#ifndef _WIN32
+	if (h->new_fd != -1) {
+		event_del(&(h->new_event));
+		close(h->new_fd);
+	}
+
+	if (h->listen_fd != -1) {
+		event_del(&(h->listen_event));
+		close(h->listen_fd);
+		g_unlink(h->path);
+	}
+
+	if (h->old_fd != -1) close(h->old_fd);
+#endif
+
+	chassis_handoff_close_unclaimed();
+	g_queue_free(h->received);
+
+	for (i = 0; i < h->listening->len; i++) {
+		chassis_handoff_fd_free(h->listening->pdata[i]);
+	}
+	g_ptr_array_free(h->listening, TRUE);
+
+	g_free(h->path);
+	g_free(h);
+
+	handoff = NULL;
+}
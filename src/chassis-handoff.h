@@ -0,0 +1,79 @@
+/* $%BEGINLICENSE%$
+ Copyright (c) 2008, 2012, Oracle and/or its affiliates. All rights reserved.
+
+ This program is free software; you can redistribute it and/or
+ modify it under the terms of the GNU General Public License as
+ published by the Free Software Foundation; version 2 of the
+ License.
+
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ GNU General Public License for more details.
+
+ You should have received a copy of the GNU General Public License
+ along with this program; if not, write to the Free Software
+ Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA
+ 02110-1301  USA
+
+ $%ENDLICENSE%$ */
+#ifndef _CHASSIS_HANDOFF_H_
+#define _CHASSIS_HANDOFF_H_
+
+#include <glib.h>
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#ifdef HAVE_SYS_TIME_H
+#include <sys/time.h>  /* event.h needs struct tm */
+#endif
+#ifdef HAVE_SYS_TYPES_H
+#include <sys/types.h>
+#endif
+#ifdef _WIN32
+#include <winsock2.h>
+#endif
+#include <event.h>     /* struct event_base */
+
+#include "chassis-exports.h"
+
+/**
+ * hand the listening sockets over to a new binary without closing them
+ *
+ * with --handoff-socket=<path> a starting proxy first connects to <path>. If a old
+ * proxy listens there it sends the fds of its listening sockets with SCM_RIGHTS,
+ * each tagged with the name of its address. network_socket_bind() takes the fd
+ * of the same name instead of binding a new socket, no connection is refused
+ * while both processes run.
+ *
+ * once the new proxy is set up it acks and listens on <path> for the next
+ * upgrade. The old proxy stops accepting, lets its connections finish and
+ * shuts down when the last one is closed or --handoff-drain-timeout is reached.
+ *
+ * the protocol on the unix-socket:
+ *
+ * - old -> new: for each fd a int2 length, the fd in a SCM_RIGHTS message, the name
+ * - old -> new: a int2 0 as end of the list
+ * - new -> old: 1 byte ack when the new proxy is listening
+ */
+
+CHASSIS_API int chassis_handoff_receive(const gchar *path, GError **gerr);
+CHASSIS_API int chassis_handoff_take_fd(const gchar *name);
+CHASSIS_API void chassis_handoff_add_fd(const gchar *name, int fd);
+CHASSIS_API void chassis_handoff_close_unclaimed(void);
+CHASSIS_API int chassis_handoff_listen(struct event_base *event_base, const gchar *path, GError **gerr);
+CHASSIS_API void chassis_handoff_shutdown(void);
+CHASSIS_API gboolean chassis_handoff_is_draining(void);
+
+#define CHASSIS_HANDOFF_ERROR chassis_handoff_error()
+CHASSIS_API GQuark chassis_handoff_error(void);
+
+typedef enum {
+	CHASSIS_HANDOFF_ERROR_UNSUPPORTED, /**< no SCM_RIGHTS on this platform */
+	CHASSIS_HANDOFF_ERROR_RECEIVE,     /**< the old proxy is there, but the handoff failed */
+	CHASSIS_HANDOFF_ERROR_LISTEN       /**< socket(), bind() or listen() failed */
+} chassis_handoff_error_t;
+
+#endif
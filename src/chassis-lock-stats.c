@@ -0,0 +1,219 @@
+/* $%BEGINLICENSE%$
+ Copyright (c) 2008, 2012, Oracle and/or its affiliates. All rights reserved.
+
+ This program is free software; you can redistribute it and/or
+ modify it under the terms of the GNU General Public License as
+ published by the Free Software Foundation; version 2 of the
+ License.
+
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ GNU General Public License for more details.
+
+ You should have received a copy of the GNU General Public License
+ along with this program; if not, write to the Free Software
+ Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA
+ 02110-1301  USA
+
+ $%ENDLICENSE%$ */
+
+/**
+ * contention stats of the process-wide locks
+ *
+ * a lock that is taken with chassis_lock_stats_mutex_lock() counts its acquisitions, the
+ * ones that had to wait and the time it was waited for and held. Without --lock-stats
+ * only the acquisitions are counted.
+ */
+
+#include <string.h>
+
+#include "chassis-lock-stats.h"
+#include "chassis-metrics.h"
+#include "chassis-timings.h"
+
+static volatile gint lock_stats_is_enabled = 0;
+
+static GStaticMutex lock_stats_mutex = G_STATIC_MUTEX_INIT; /* protects lock_stats_head and the .next of the stats */
+static chassis_lock_stats_t *lock_stats_head = NULL;
+
+/**
+ * measure the wait and hold time of the locks
+ *
+ * a uncontended acquisition costs two my_timer_cycles() more, a contended one three
+ */
+void chassis_lock_stats_set_enabled(gboolean is_enabled) {
+	g_atomic_int_set(&lock_stats_is_enabled, is_enabled ? 1 : 0);
+}
+
+gboolean chassis_lock_stats_is_enabled(void) {
+	return g_atomic_int_get(&lock_stats_is_enabled) != 0;
+}
+
+static void chassis_lock_stats_register(chassis_lock_stats_t *stats) {
+	g_static_mutex_lock(&lock_stats_mutex);
+	if (!stats->is_registered) {
+		stats->next = lock_stats_head;
+		lock_stats_head = stats;
+		stats->is_registered = TRUE;
+	}
+	g_static_mutex_unlock(&lock_stats_mutex);
+}
+
+/**
+ * set up the stats of a lock that may be freed, see chassis_lock_stats_unregister()
+ *
+ * @param name the name the lock is reported under, has to outlive the stats
+ */
+void chassis_lock_stats_init(chassis_lock_stats_t *stats, const gchar *name) {
+	memset(stats, 0, sizeof(*stats));
+	stats->name = name;
+
+	chassis_lock_stats_register(stats);
+}
+
+/**
+ * drop the stats of a lock that is about to be freed
+ *
+ * the counts of the lock are dropped from the summed up stats too
+ */
+void chassis_lock_stats_unregister(chassis_lock_stats_t *stats) {
+	chassis_lock_stats_t **p;
+
+	g_static_mutex_lock(&lock_stats_mutex);
+	for (p = &lock_stats_head; *p; p = &((*p)->next)) {
+		if (*p == stats) {
+			*p = stats->next;
+			break;
+		}
+	}
+	stats->is_registered = FALSE;
+	stats->next = NULL;
+	g_static_mutex_unlock(&lock_stats_mutex);
+}
+
+/**
+ * lock a mutex and account for it in the stats
+ *
+ * a GStaticMutex is locked with g_static_mutex_get_mutex()
+ */
+void chassis_lock_stats_mutex_lock(GMutex *mutex, chassis_lock_stats_t *stats) {
+	guint64 wait_start;
+
+	if (!g_atomic_int_get(&lock_stats_is_enabled)) {
+		g_mutex_lock(mutex);
+		stats->locked_at = 0;
+	} else if (g_mutex_trylock(mutex)) {
+		stats->locked_at = my_timer_cycles();
+	} else {
+		wait_start = my_timer_cycles();
+		g_mutex_lock(mutex);
+		stats->locked_at = my_timer_cycles();
+
+		stats->contended++;
+		stats->wait_cycles += stats->locked_at - wait_start;
+	}
+	stats->acquisitions++;
+
+	if (!stats->is_registered) chassis_lock_stats_register(stats);
+}
+
+void chassis_lock_stats_mutex_unlock(GMutex *mutex, chassis_lock_stats_t *stats) {
+	if (0 != stats->locked_at) {
+		stats->hold_cycles += my_timer_cycles() - stats->locked_at;
+		stats->locked_at = 0;
+	}
+
+	g_mutex_unlock(mutex);
+}
+
+static gdouble chassis_lock_stats_cycles_to_seconds(guint64 cycles) {
+	if (NULL == chassis_timestamps_global ||
+	    0 == chassis_timestamps_global->cycles_frequency) return 0;
+
+	return (gdouble)cycles / chassis_timestamps_global->cycles_frequency;
+}
+
+/**
+ * get the stats of the locks, summed up by name
+ *
+ * @return array(chassis_lock_stats_entry_t) sorted by name, free it with chassis_lock_stats_entries_free()
+ */
+GPtrArray *chassis_lock_stats_get_all(void) {
+	GPtrArray *entries = g_ptr_array_new();
+	chassis_lock_stats_t *stats;
+	guint i, j;
+
+	g_static_mutex_lock(&lock_stats_mutex);
+	for (stats = lock_stats_head; stats; stats = stats->next) {
+		chassis_lock_stats_entry_t *entry = NULL;
+
+		for (i = 0; i < entries->len; i++) {
+			chassis_lock_stats_entry_t *e = entries->pdata[i];
+
+			if (0 == strcmp(e->name, stats->name)) {
+				entry = e;
+				break;
+			}
+		}
+
+		if (NULL == entry) {
+			entry = g_new0(chassis_lock_stats_entry_t, 1);
+			entry->name = g_strdup(stats->name);
+
+			/* keep them sorted by name */
+			g_ptr_array_add(entries, NULL);
+			for (j = entries->len - 1; j > 0 && strcmp(((chassis_lock_stats_entry_t *)entries->pdata[j - 1])->name, entry->name) > 0; j--) {
+				entries->pdata[j] = entries->pdata[j - 1];
+			}
+			entries->pdata[j] = entry;
+		}
+
+		entry->acquisitions += stats->acquisitions;
+		entry->contended    += stats->contended;
+		entry->wait_seconds += chassis_lock_stats_cycles_to_seconds(stats->wait_cycles);
+		entry->hold_seconds += chassis_lock_stats_cycles_to_seconds(stats->hold_cycles);
+	}
+	g_static_mutex_unlock(&lock_stats_mutex);
+
+	return entries;
+}
+
+void chassis_lock_stats_entries_free(GPtrArray *entries) {
+	guint i;
+
+	for (i = 0; i < entries->len; i++) {
+		chassis_lock_stats_entry_t *entry = entries->pdata[i];
+
+		g_free(entry->name);
+		g_free(entry);
+	}
+	g_ptr_array_free(entries, TRUE);
+}
+
+/**
+ * append the lock stats to the metrics, a series per lock name
+ */
+void chassis_lock_stats_collect_metrics(chassis_metrics_t G_GNUC_UNUSED *metrics, GString *out, gpointer G_GNUC_UNUSED user_data) {
+	GPtrArray *entries = chassis_lock_stats_get_all();
+	GString *labels = g_string_new(NULL);
+	guint i;
+
+#define LOCK_STATS_METRIC(_name, _help, _field) \
+	chassis_metrics_append_header(out, _name, _help, CHASSIS_METRIC_COUNTER); \
+	for (i = 0; i < entries->len; i++) { \
+		chassis_lock_stats_entry_t *entry = entries->pdata[i]; \
+		g_string_printf(labels, "lock=\"%s\"", entry->name); \
+		chassis_metrics_append_value(out, _name, labels->str, entry->_field); \
+	}
+
+	LOCK_STATS_METRIC("mysql_proxy_lock_acquisitions_total", "Acquisitions of the lock", acquisitions);
+	LOCK_STATS_METRIC("mysql_proxy_lock_contended_total", "Acquisitions of the lock that had to wait", contended);
+	LOCK_STATS_METRIC("mysql_proxy_lock_wait_seconds_total", "Time waited for the lock, needs --lock-stats", wait_seconds);
+	LOCK_STATS_METRIC("mysql_proxy_lock_hold_seconds_total", "Time the lock was held, needs --lock-stats", hold_seconds);
+
+#undef LOCK_STATS_METRIC
+
+	g_string_free(labels, TRUE);
+	chassis_lock_stats_entries_free(entries);
+}
@@ -0,0 +1,80 @@
+/* $%BEGINLICENSE%$
+ Copyright (c) 2008, 2012, Oracle and/or its affiliates. All rights reserved.
+
+ This program is free software; you can redistribute it and/or
+ modify it under the terms of the GNU General Public License as
+ published by the Free Software Foundation; version 2 of the
+ License.
+
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ GNU General Public License for more details.
+
+ You should have received a copy of the GNU General Public License
+ along with this program; if not, write to the Free Software
+ Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA
+ 02110-1301  USA
+
+ $%ENDLICENSE%$ */
+#ifndef _CHASSIS_LOCK_STATS_H_
+#define _CHASSIS_LOCK_STATS_H_
+
+#include <glib.h>
+
+#include "chassis-exports.h"
+
+/**
+ * the contention of a lock
+ *
+ * the counters are only written by the thread that holds the lock and need no atomics,
+ * readers read them without it. Locks with the same name, like the lua-scopes of the
+ * event-threads, are reported as one.
+ *
+ * the stats of a lock that lives as long as the process are set up with
+ * CHASSIS_LOCK_STATS_INIT() and registered when they are locked first. The stats of a
+ * lock that is freed have to be unregistered with chassis_lock_stats_unregister() before.
+ *
+ * @see chassis_lock_stats_mutex_lock()
+ */
+typedef struct chassis_lock_stats {
+	const gchar *name;
+
+	guint64 acquisitions;
+	guint64 contended;          /**< acquisitions that had to wait for another thread */
+	guint64 wait_cycles;        /**< my_timer_cycles() spent waiting for the lock */
+	guint64 hold_cycles;        /**< my_timer_cycles() the lock was held */
+
+	guint64 locked_at;          /**< when the current holder got the lock, 0 if it isn't measured */
+	gboolean is_registered;
+
+	struct chassis_lock_stats *next; /**< the next registered lock */
+} chassis_lock_stats_t;
+
+#define CHASSIS_LOCK_STATS_INIT(name) { name, 0, 0, 0, 0, 0, FALSE, NULL }
+
+/**
+ * the summed up stats of the locks of a name
+ */
+typedef struct {
+	gchar *name;
+	guint64 acquisitions;
+	guint64 contended;
+	gdouble wait_seconds;
+	gdouble hold_seconds;
+} chassis_lock_stats_entry_t;
+
+CHASSIS_API void chassis_lock_stats_set_enabled(gboolean is_enabled);
+CHASSIS_API gboolean chassis_lock_stats_is_enabled(void);
+
+CHASSIS_API void chassis_lock_stats_init(chassis_lock_stats_t *stats, const gchar *name);
+CHASSIS_API void chassis_lock_stats_unregister(chassis_lock_stats_t *stats);
+
+CHASSIS_API void chassis_lock_stats_mutex_lock(GMutex *mutex, chassis_lock_stats_t *stats);
+CHASSIS_API void chassis_lock_stats_mutex_unlock(GMutex *mutex, chassis_lock_stats_t *stats);
+
+CHASSIS_API GPtrArray *chassis_lock_stats_get_all(void);
+CHASSIS_API void chassis_lock_stats_entries_free(GPtrArray *entries);
+CHASSIS_API void chassis_lock_stats_collect_metrics(struct chassis_metrics *metrics, GString *out, gpointer user_data);
+
+#endif
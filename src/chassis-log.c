@@ -54,6 +54,9 @@
 
 #include "sys-pedantic.h"
 #include "chassis-log.h"
+#include "chassis-timings.h"
+#include "chassis-event-thread.h"
+#include "chassis-lock-stats.h"
 
 #define S(x) x->str, x->len
 
@@ -99,6 +102,9 @@ chassis_log *chassis_log_new(void) {
 	log->log_ts_resolution = CHASSIS_RESOLUTION_DEFAULT;
 	log->min_lvl = G_LOG_LEVEL_CRITICAL;
 
+	log->log_ts_cache = g_string_sized_new(sizeof("2004-01-01 00:00:00"));
+	log->log_ts_cached_sec = 0;
+
 	log->last_msg = g_string_new(NULL);
 	log->last_msg_ts = 0;
 	log->last_msg_count = 0;
@@ -161,6 +167,8 @@ int chassis_log_close(chassis_log *log) {
 void chassis_log_free(chassis_log *log) {
 	if (!log) return;
 
+	chassis_log_stop_writer(log);
+
 	chassis_log_close(log);
 #ifdef _WIN32
 	if (log->event_source_handle) {
@@ -171,6 +179,7 @@ void chassis_log_free(chassis_log *log) {
 	}
 #endif
 	g_string_free(log->log_ts_str, TRUE);
+	g_string_free(log->log_ts_cache, TRUE);
 	g_string_free(log->last_msg, TRUE);
 
 	if (log->log_filename) g_free(log->log_filename);
@@ -182,19 +191,33 @@ void chassis_log_free(chassis_log *log) {
 	g_free(log);
 }
 
-static int chassis_log_update_timestamp(chassis_log *log) {
-	struct tm *tm;
-	GTimeVal tv;
-	time_t	t;
+/**
+ * format the timestamp of a message into log->log_ts_str
+ *
+ * localtime() and strftime() only run once per second, the other messages copy
+ * the cached seconds
+ *
+ * @param tv  the time the message was logged
+ */
+static int chassis_log_update_timestamp(chassis_log *log, const GTimeVal *tv) {
 	GString *s = log->log_ts_str;
 
-	g_get_current_time(&tv);
-	t = (time_t) tv.tv_sec;
-	tm = localtime(&t);
-	
-	s->len = strftime(s->str, s->allocated_len, "%Y-%m-%d %H:%M:%S", tm);
+	if ((time_t) tv->tv_sec != log->log_ts_cached_sec) {
+		struct tm *tm;
+		time_t t = (time_t) tv->tv_sec;
+		GString *cache = log->log_ts_cache;
+
+		tm = localtime(&t);
+
+		g_string_set_size(cache, sizeof("2004-01-01 00:00:00"));
+		cache->len = strftime(cache->str, cache->allocated_len, "%Y-%m-%d %H:%M:%S", tm);
+		log->log_ts_cached_sec = t;
+	}
+
+	g_string_truncate(s, 0);
+	g_string_append_len(s, S(log->log_ts_cache));
 	if (log->log_ts_resolution == CHASSIS_RESOLUTION_MS)
-		g_string_append_printf(s, ".%.3d", (int) tv.tv_usec/1000);
+		g_string_append_printf(s, ".%.3d", (int) tv->tv_usec/1000);
 	
 	return 0;
 }
@@ -366,20 +389,13 @@ chassis_log_set_rotate_func(chassis_log *log, chassis_log_rotate_func rotate_fun
 
 }
 
-static void
-chassis_log_func_locked(const gchar G_GNUC_UNUSED *log_domain, GLogLevelFlags log_level,
-		const gchar *message, gpointer user_data) {
-	chassis_log *log = user_data;
-	int i;
-	gchar *log_lvl_name = "(error)";
-	gboolean is_duplicate = FALSE;
-	const char *stripped_message = chassis_log_skip_topsrcdir(message);
-
-	/**
-	 * rotate logs straight away if log->rotate_logs is true
-	 * we do this before ignoring any log levels, so that rotation 
-	 * happens straight away - see Bug#55711 
-	 */
+/**
+ * rotate the log-file if it was requested
+ *
+ * we do this before ignoring any log levels, so that rotation 
+ * happens straight away - see Bug#55711 
+ */
+static void chassis_log_rotate_if_requested(chassis_log *log) {
 	if (-1 != log->log_file_fd) {
 		if (log->rotate_logs) {
 			gboolean is_rotated;
@@ -396,6 +412,24 @@ chassis_log_func_locked(const gchar G_GNUC_UNUSED *log_domain, GLogLevelFlags lo
 			}
 		}
 	}
+}
+
+/**
+ * filter duplicates, format and write a message
+ *
+ * called with the log-mutex held or from the writer-thread
+ *
+ * @param tv  the time the message was logged
+ */
+static void
+chassis_log_func_locked(chassis_log *log, GLogLevelFlags log_level,
+		const gchar *message, const GTimeVal *tv) {
+	int i;
+	gchar *log_lvl_name = "(error)";
+	gboolean is_duplicate = FALSE;
+	const char *stripped_message = chassis_log_skip_topsrcdir(message);
+
+	chassis_log_rotate_if_requested(log);
 
 	/* ignore the verbose log-levels */
 	if (log_level > log->min_lvl) {
@@ -423,18 +457,18 @@ chassis_log_func_locked(const gchar G_GNUC_UNUSED *log_domain, GLogLevelFlags lo
 	if (log->is_rotated ||
 	    !is_duplicate ||
 	    log->last_msg_count > 100 ||
-	    time(NULL) - log->last_msg_ts > 30) {
+	    tv->tv_sec - log->last_msg_ts > 30) {
 
 		/* if we lave the last message repeating, log it */
 		if (log->last_msg_count) {
-			chassis_log_update_timestamp(log);
+			chassis_log_update_timestamp(log, tv);
 			g_string_append_printf(log->log_ts_str, ": (%s) last message repeated %d times",
 					log_lvl_name,
 					log->last_msg_count);
 
 			chassis_log_write(log, log_level, log->log_ts_str);
 		}
-		chassis_log_update_timestamp(log);
+		chassis_log_update_timestamp(log, tv);
 		g_string_append(log->log_ts_str, ": (");
 		g_string_append(log->log_ts_str, log_lvl_name);
 		g_string_append(log->log_ts_str, ") ");
@@ -444,7 +478,7 @@ chassis_log_func_locked(const gchar G_GNUC_UNUSED *log_domain, GLogLevelFlags lo
 		/* reset the last-logged message */	
 		g_string_assign(log->last_msg, stripped_message);
 		log->last_msg_count = 0;
-		log->last_msg_ts = time(NULL);
+		log->last_msg_ts = tv->tv_sec;
 			
 		chassis_log_write(log, log_level, log->log_ts_str);
 	} else {
@@ -454,17 +488,292 @@ chassis_log_func_locked(const gchar G_GNUC_UNUSED *log_domain, GLogLevelFlags lo
 	log->is_rotated = FALSE;
 }
 
-void chassis_log_func(const gchar *log_domain, GLogLevelFlags log_level, const gchar *message, gpointer user_data) {
+/**
+ * a message for the writer-thread
+ *
+ * .seq tells the producers and the writer whose turn it is: a slot at position pos
+ * is free if .seq == pos, and filled if .seq == pos + 1
+ */
+typedef struct {
+	volatile gint seq;
+	GLogLevelFlags log_level;
+	GTimeVal tv;
+	gchar *message;
+} chassis_log_ring_slot;
+
+/**
+ * a bounded multi-producer, single-consumer queue of messages
+ *
+ * the producers claim a slot with a compare-and-swap on .enqueue_pos, the writer-thread
+ * is the only one that moves .dequeue_pos
+ */
+struct chassis_log_ring {
+	chassis_log_ring_slot slots[CHASSIS_LOG_RING_SIZE];
+
+	volatile gint enqueue_pos;
+	gint _pad[15];                  /**< keep the producers off the cache-line of the writer */
+	gint dequeue_pos;
+
+	volatile gint dropped;          /**< messages dropped since the writer reported the last drops */
+	volatile gint dropped_total;    /**< all messages dropped as the ring was full */
+
+	volatile gint writer_is_waiting;
+	GMutex *mutex;                  /**< only to sleep and wake up the writer */
+	GCond *cond;
+};
+
+static chassis_log_ring *chassis_log_ring_new(void) {
+	chassis_log_ring *ring;
+	guint i;
+
+	ring = g_new0(chassis_log_ring, 1);
+	for (i = 0; i < CHASSIS_LOG_RING_SIZE; i++) {
+		ring->slots[i].seq = i;
+	}
+	ring->mutex = g_mutex_new();
+	ring->cond = g_cond_new();
+
+	return ring;
+}
+
+static void chassis_log_ring_free(chassis_log_ring *ring) {
+	guint i;
+
+	if (!ring) return;
+
+	for (i = 0; i < CHASSIS_LOG_RING_SIZE; i++) {
+		if (ring->slots[i].message) g_free(ring->slots[i].message);
+	}
+
+	g_mutex_free(ring->mutex);
+	g_cond_free(ring->cond);
+
+	g_free(ring);
+}
+
+/**
+ * queue a message
+ *
+ * @return FALSE if the ring is full
+ */
+static gboolean chassis_log_ring_push(chassis_log_ring *ring, GLogLevelFlags log_level, const gchar *message) {
+	chassis_log_ring_slot *slot;
+	gint pos;
+
+	pos = g_atomic_int_get(&ring->enqueue_pos);
+	for (;;) {
+		gint diff;
+
+		slot = &(ring->slots[(guint)pos & (CHASSIS_LOG_RING_SIZE - 1)]);
+		diff = (gint)((guint)g_atomic_int_get(&slot->seq) - (guint)pos);
+
+		if (diff == 0) {
+			if (g_atomic_int_compare_and_exchange(&ring->enqueue_pos, pos, (gint)((guint)pos + 1))) break;
+		} else if (diff < 0) {
+			/* the writer didn't free this slot yet, the ring is full */
+			return FALSE;
+		}
+
+		pos = g_atomic_int_get(&ring->enqueue_pos);
+	}
+
+	slot->log_level = log_level;
+	chassis_get_coarse_current_time(&(slot->tv));
+	slot->message = g_strdup(message);
+
+	g_atomic_int_set(&slot->seq, (gint)((guint)pos + 1));
+
+	if (g_atomic_int_get(&ring->writer_is_waiting)) {
+		g_mutex_lock(ring->mutex);
+		g_cond_signal(ring->cond);
+		g_mutex_unlock(ring->mutex);
+	}
+
+	return TRUE;
+}
+
+/**
+ * take the next message of the ring
+ *
+ * only called by the writer-thread
+ *
+ * @return the slot of the message, NULL if the ring is empty
+ */
+static chassis_log_ring_slot *chassis_log_ring_peek(chassis_log_ring *ring) {
+	chassis_log_ring_slot *slot = &(ring->slots[(guint)ring->dequeue_pos & (CHASSIS_LOG_RING_SIZE - 1)]);
+
+	if ((gint)((guint)g_atomic_int_get(&slot->seq) - ((guint)ring->dequeue_pos + 1)) < 0) return NULL;
+
+	return slot;
+}
+
+/**
+ * give the slot of the message back to the producers
+ */
+static void chassis_log_ring_pop(chassis_log_ring *ring, chassis_log_ring_slot *slot) {
+	g_free(slot->message);
+	slot->message = NULL;
+
+	g_atomic_int_set(&slot->seq, (gint)((guint)ring->dequeue_pos + CHASSIS_LOG_RING_SIZE));
+	ring->dequeue_pos = (gint)((guint)ring->dequeue_pos + 1);
+}
+
+/**
+ * write the messages of the ring until we are shut down
+ *
+ * the duplicate-filter and the log-rotation run in this thread only
+ */
+static gpointer chassis_log_writer_thread(gpointer user_data) {
+	chassis_log *log = user_data;
+	chassis_log_ring *ring = log->ring;
+
+	for (;;) {
+		chassis_log_ring_slot *slot;
+		gint dropped;
+
+		while (NULL != (slot = chassis_log_ring_peek(ring))) {
+			chassis_log_func_locked(log, slot->log_level, slot->message, &(slot->tv));
+
+			chassis_log_ring_pop(ring, slot);
+		}
+
+		if (0 != (dropped = g_atomic_int_get(&ring->dropped))) {
+			GTimeVal tv;
+			gchar *msg;
+
+			g_atomic_int_add(&ring->dropped, -dropped);
+
+			g_get_current_time(&tv);
+			msg = g_strdup_printf("%s: the log-ring was full, dropped %d messages", G_STRLOC, dropped);
+			chassis_log_func_locked(log, G_LOG_LEVEL_CRITICAL, msg, &tv);
+			g_free(msg);
+		}
+
+		/* rotate on SIGHUP even if no message arrives */
+		chassis_log_rotate_if_requested(log);
+
+		if (g_atomic_int_get(&log->writer_is_shutdown)) {
+			if (NULL == chassis_log_ring_peek(ring)) break;
+
+			continue;
+		}
+
+		g_mutex_lock(ring->mutex);
+		g_atomic_int_set(&ring->writer_is_waiting, 1);
+		if (NULL == chassis_log_ring_peek(ring)) {
+			GTimeVal timeout;
+
+			/* wake up now and then for the drops and the log-rotation */
+			g_get_current_time(&timeout);
+			g_time_val_add(&timeout, 100 * 1000);
+
+			g_cond_timed_wait(ring->cond, ring->mutex, &timeout);
+		}
+		g_atomic_int_set(&ring->writer_is_waiting, 0);
+		g_mutex_unlock(ring->mutex);
+	}
+
+	return NULL;
+}
+
+/**
+ * write the messages from a thread of their own
+ *
+ * the threads that log only queue their message and go on, see chassis_log_func().
+ * Has to be called after the process daemonized, the thread wouldn't survive the fork().
+ *
+ * @return 0 on success, -1 if the thread couldn't be started
+ */
+int chassis_log_start_writer(chassis_log *log) {
+	GError *gerr = NULL;
+
+	if (log->ring) return 0;
+
+	log->ring = chassis_log_ring_new();
+	log->writer_is_shutdown = 0;
+
+	log->writer_thread = g_thread_create(chassis_log_writer_thread, log, TRUE, &gerr);
+	if (NULL == log->writer_thread) {
+		g_critical("%s: starting the log-writer failed: %s", G_STRLOC, gerr->message);
+		g_error_free(gerr);
+
+		chassis_log_ring_free(log->ring);
+		log->ring = NULL;
+
+		return -1;
+	}
+
+	return 0;
+}
+
+/**
+ * write the queued messages and fall back to logging synchronously
+ */
+void chassis_log_stop_writer(chassis_log *log) {
+	chassis_log_ring *ring = log->ring;
+
+	if (!ring) return;
+
+	/* the messages that are logged from now on are written synchronously */
+	log->ring = NULL;
+
+	g_atomic_int_set(&log->writer_is_shutdown, 1);
+	g_mutex_lock(ring->mutex);
+	g_cond_signal(ring->cond);
+	g_mutex_unlock(ring->mutex);
+
+	g_thread_join(log->writer_thread);
+	log->writer_thread = NULL;
+
+	chassis_log_ring_free(ring);
+}
+
+/**
+ * the messages dropped as the ring was full
+ */
+guint chassis_log_get_dropped(chassis_log *log) {
+	if (!log->ring) return 0;
+
+	return g_atomic_int_get(&log->ring->dropped_total);
+}
+
+void chassis_log_func(const gchar G_GNUC_UNUSED *log_domain, GLogLevelFlags log_level, const gchar *message, gpointer user_data) {
 	/**
 	 * make sure we syncronize the order of the write-statements 
 	 */
 	static GStaticMutex log_mutex = G_STATIC_MUTEX_INIT;
+	static chassis_lock_stats_t log_mutex_stats = CHASSIS_LOCK_STATS_INIT("log");
+	chassis_log *log = user_data;
+	chassis_log_ring *ring = log->ring;
+	chassis_event_thread_cpu_t cpu;
+	GTimeVal tv;
+
+	/* queue the message for the writer-thread, only the fatal ones are written
+	 * right away as the process is going down
+	 */
+	if (ring && !(log_level & (G_LOG_FLAG_FATAL | G_LOG_LEVEL_ERROR))) {
+		if ((log_level & G_LOG_LEVEL_MASK) > log->min_lvl) return;
+
+		cpu = chassis_event_thread_cpu_enter(CHASSIS_EVENT_THREAD_CPU_LOG);
+		if (!chassis_log_ring_push(ring, log_level & G_LOG_LEVEL_MASK, message)) {
+			g_atomic_int_inc(&ring->dropped);
+			g_atomic_int_inc(&ring->dropped_total);
+		}
+		chassis_event_thread_cpu_leave(cpu);
+		return;
+	}
+
+	cpu = chassis_event_thread_cpu_enter(CHASSIS_EVENT_THREAD_CPU_LOG);
+
+	chassis_get_coarse_current_time(&tv);
+
+	chassis_lock_stats_mutex_lock(g_static_mutex_get_mutex(&log_mutex), &log_mutex_stats);
 
-	g_static_mutex_lock(&log_mutex);
+	chassis_log_func_locked(log, log_level, message, &tv);
 
-	chassis_log_func_locked(log_domain, log_level, message, user_data);
+	chassis_lock_stats_mutex_unlock(g_static_mutex_get_mutex(&log_mutex), &log_mutex_stats);
 
-	g_static_mutex_unlock(&log_mutex);
+	chassis_event_thread_cpu_leave(cpu);
 }
 
 void chassis_log_set_logrotate(chassis_log *log) {
@@ -39,6 +39,13 @@
 
 typedef struct _chassis_log chassis_log;
 
+/**
+ * messages that can be queued for the writer-thread, a power of 2
+ */
+#define CHASSIS_LOG_RING_SIZE 4096
+
+typedef struct chassis_log_ring chassis_log_ring;
+
 /**
  * chassis_log_rotate_func:
  *
@@ -83,6 +90,19 @@ struct _chassis_log {
 	GDestroyNotify rotate_func_data_destroy;
 
 	gboolean is_rotated;
+
+	/**
+	 * the asynchronous logging, see chassis_log_start_writer()
+	 *
+	 * the threads push their messages into the ring, the writer-thread formats and
+	 * writes them. If the ring is full, the message is dropped and counted.
+	 */
+	chassis_log_ring *ring;             /**< NULL if we log synchronously */
+	GThread *writer_thread;
+	volatile gint writer_is_shutdown;
+
+	time_t   log_ts_cached_sec;         /**< the second .log_ts_cache is formatted for */
+	GString *log_ts_cache;              /**< the timestamp without the msec, formatted once per second */
 };
 
 
@@ -94,6 +114,9 @@ CHASSIS_API int chassis_log_open(chassis_log *log);
 CHASSIS_API int chassis_log_close(chassis_log *log);
 CHASSIS_API void chassis_log_func(const gchar *log_domain, GLogLevelFlags log_level, const gchar *message, gpointer user_data);
 CHASSIS_API void chassis_log_set_logrotate(chassis_log *log);
+CHASSIS_API int chassis_log_start_writer(chassis_log *log);
+CHASSIS_API void chassis_log_stop_writer(chassis_log *log);
+CHASSIS_API guint chassis_log_get_dropped(chassis_log *log);
 CHASSIS_API int chassis_log_set_event_log(chassis_log *log, const char *app_name);
 CHASSIS_API const char *chassis_log_skip_topsrcdir(const char *message);
 CHASSIS_API void chassis_set_logtimestamp_resolution(chassis_log *log, int res);
@@ -24,6 +24,7 @@
 #include <string.h>
 #include <errno.h>
 #include <stdio.h>
+#include <time.h>
 
 #ifndef _WIN32
 #include <unistd.h>
@@ -45,9 +46,12 @@
 #include "chassis-plugin.h"
 #include "chassis-mainloop.h"
 #include "chassis-event-thread.h"
+#include "chassis-event-iocp.h"
 #include "chassis-log.h"
 #include "chassis-stats.h"
+#include "chassis-lock-stats.h"
 #include "chassis-timings.h"
+#include "chassis-handoff.h"
 
 #ifdef _WIN32
 static volatile int signal_shutdown;
@@ -111,10 +115,15 @@ chassis *chassis_new() {
 	
 	chas->stats = chassis_stats_new();
 
+	chas->metrics = chassis_metrics_new();
+	chassis_metrics_register_collector(chas->metrics, chassis_stats_collect_metrics, chas->stats);
+	chassis_metrics_register_collector(chas->metrics, chassis_lock_stats_collect_metrics, NULL);
+
 	/* create a new global timer info */
 	chassis_timestamps_global_init(NULL);
 
 	chas->threads = chassis_event_threads_new();
+	chas->accept_batch = 16;
 
 	chas->event_hdr_version = g_strdup(_EVENT_VERSION);
 
@@ -141,6 +150,9 @@ void chassis_free(chassis *chas) {
 
 	/* init the shutdown, without freeing share structures */	
 	if (chas->priv_shutdown) chas->priv_shutdown(chas, chas->priv);
+
+	/* the jobs may still use the plugins */
+	if (chas->workers) chassis_worker_pool_free(chas->workers);
 	
 
 	/* call the destructor for all plugins */
@@ -166,8 +178,18 @@ void chassis_free(chassis *chas) {
 
 
 	if (chas->base_dir) g_free(chas->base_dir);
+	if (chas->default_file) g_free(chas->default_file);
 	if (chas->user) g_free(chas->user);
 	
+	if (chas->stats_shm) chassis_stats_shm_free(chas->stats_shm);
+	if (chas->stats_shm_file) g_free(chas->stats_shm_file);
+	if (chas->prefork) chassis_prefork_free(chas->prefork);
+	if (chas->metrics) chassis_metrics_free(chas->metrics);
+	if (chas->metrics_address) g_free(chas->metrics_address);
+	if (chas->handoff_socket) g_free(chas->handoff_socket);
+	if (chas->event_threads_cpus) g_free(chas->event_threads_cpus);
+	if (chas->event_method) g_free(chas->event_method);
+
 	if (chas->stats) chassis_stats_free(chas->stats);
 
 	chassis_timestamps_global_free(NULL);
@@ -189,6 +211,9 @@ void chassis_free(chassis *chas) {
 	g_free(chas->event_hdr_version);
 
 	chassis_shutdown_hooks_free(chas->shutdown_hooks);
+
+	/* the listeners are closed, drop the fds we registered for the next upgrade */
+	chassis_handoff_shutdown();
 	
 	g_free(chas);
 }
@@ -206,6 +231,54 @@ static void sigterm_handler(int G_GNUC_UNUSED fd, short G_GNUC_UNUSED event_type
 	chassis_set_shutdown_location(NULL);
 }
 
+/**
+ * re-read the --defaults-file and let the plugins apply the changes
+ *
+ * only the plugins that have a reload_config() handler pick up changes, the
+ * command-line options stay as they are.
+ *
+ * @return 0 on success, -1 if the file can't be read or a plugin failed
+ */
+int chassis_reload_config(chassis *chas) {
+	static GStaticMutex reload_mutex = G_STATIC_MUTEX_INIT; /* SIGHUP and the admin-interface may race */
+	GKeyFile *keyfile;
+	GError *gerr = NULL;
+	guint i;
+	int ret = 0;
+
+	if (!chas->default_file) {
+		g_message("%s: started without --defaults-file, nothing to reload", G_STRLOC);
+		return 0;
+	}
+
+	keyfile = g_key_file_new();
+	g_key_file_set_list_separator(keyfile, ',');
+
+	if (FALSE == g_key_file_load_from_file(keyfile, chas->default_file, G_KEY_FILE_NONE, &gerr)) {
+		g_critical("%s: reloading %s failed: %s", G_STRLOC, chas->default_file, gerr->message);
+		g_clear_error(&gerr);
+		g_key_file_free(keyfile);
+		return -1;
+	}
+
+	g_static_mutex_lock(&reload_mutex);
+	for (i = 0; i < chas->modules->len; i++) {
+		chassis_plugin *p = chas->modules->pdata[i];
+
+		if (!p->reload_config) continue;
+
+		if (0 != p->reload_config(chas, p->config, keyfile)) {
+			g_critical("%s: reloading the config of plugin %s failed", G_STRLOC, p->name);
+			ret = -1;
+		}
+	}
+	g_static_mutex_unlock(&reload_mutex);
+
+	g_key_file_free(keyfile);
+
+	return ret;
+}
+
 static void sighup_handler(int G_GNUC_UNUSED fd, short G_GNUC_UNUSED event_type, void *_data) {
 	chassis *chas = _data;
 
@@ -214,8 +287,78 @@ static void sighup_handler(int G_GNUC_UNUSED fd, short G_GNUC_UNUSED event_type,
 	chassis_log_set_logrotate(chas->log);
 	
 	g_message("re-opened log file after SIGHUP"); /* ... and this into the new one */
+
+	chassis_reload_config(chas);
+}
+
+
+/**
+ * the timer that waits for the connections to close after a handoff
+ */
+typedef struct {
+	chassis *chas;
+	struct event ev;
+	time_t deadline;        /**< set when the draining starts */
+} handoff_drain_t;
+
+/**
+ * once we handed the listening sockets to a new proxy, shutdown when the connections are closed
+ *
+ * checked once a second
+ */
+static void handoff_drain_handler(int G_GNUC_UNUSED fd, short G_GNUC_UNUSED event_type, void *_data) {
+	handoff_drain_t *drain = _data;
+	chassis *chas = drain->chas;
+	struct timeval tv;
+
+	if (chassis_handoff_is_draining()) {
+		gint open_cons = 0;
+
+		if (chas->priv_count_connections) open_cons = chas->priv_count_connections(chas, chas->priv);
+
+		if (drain->deadline == 0) drain->deadline = time(NULL) + chas->handoff_drain_timeout;
+
+		if (open_cons == 0) {
+			g_message("%s: all connections are closed after the handoff, shutting down", G_STRLOC);
+			chassis_set_shutdown();
+			return;
+		} else if (chas->handoff_drain_timeout > 0 && time(NULL) >= drain->deadline) {
+			g_message("%s: %d connections are still open after --handoff-drain-timeout, shutting down",
+					G_STRLOC, open_cons);
+			chassis_set_shutdown();
+			return;
+		}
+	}
+
+	tv.tv_sec = 1;
+	tv.tv_usec = 0;
+	evtimer_add(&(drain->ev), &tv);
 }
 
+/**
+ * the timer that adjusts the active event-threads to their load (--event-threads-min)
+ */
+typedef struct {
+	chassis *chas;
+	struct event ev;
+} event_threads_autoscale_t;
+
+/**
+ * checked once per load-window
+ *
+ * @see chassis_event_threads_autoscale()
+ */
+static void event_threads_autoscale_handler(int G_GNUC_UNUSED fd, short G_GNUC_UNUSED event_type, void *_data) {
+	event_threads_autoscale_t *autoscale = _data;
+	chassis *chas = autoscale->chas;
+	struct timeval tv;
+
+	chassis_event_threads_autoscale(chas->threads, chas->event_threads_min, chassis_get_rel_microseconds());
+
+	tv.tv_sec = CHASSIS_EVENT_THREAD_LOAD_WINDOW_USEC / G_USEC_PER_SEC;
+	tv.tv_usec = CHASSIS_EVENT_THREAD_LOAD_WINDOW_USEC % G_USEC_PER_SEC;
+	evtimer_add(&(autoscale->ev), &tv);
+}
 
 /**
  * forward libevent messages to the glib error log 
@@ -242,11 +385,35 @@ int chassis_mainloop(void *_chas) {
 	struct event ev_sighup;
 #endif
 	chassis_event_thread_t *mainloop_thread;
+	handoff_drain_t handoff_drain;
+	event_threads_autoscale_t autoscale;
 
 	/* redirect logging from libevent to glib */
 	event_set_log_callback(event_log_use_glib);
 
 
+	/* the backend of libevent has to be picked before the first event-base is created */
+	if (chas->event_method) {
+		GError *gerr = NULL;
+
+		if (0 != chassis_event_set_method(chas->event_method, &gerr)) {
+			g_critical("%s: --event-method=%s: %s", G_STRLOC, chas->event_method, gerr->message);
+			g_error_free(gerr);
+			return -1;
+		}
+	}
+
+	/* the CPUs have to be known before the threads allocate their event-bases */
+	if (chas->event_threads_cpus) {
+		GError *gerr = NULL;
+
+		if (0 != chassis_event_threads_set_cpus(chas->threads, chas->event_threads_cpus, MAX(chas->event_thread_count, 1), &gerr)) {
+			g_critical("%s: --event-threads-cpus=%s: %s", G_STRLOC, chas->event_threads_cpus, gerr->message);
+			g_error_free(gerr);
+			return -1;
+		}
+	}
+
 	/* add a event-handler for the "main" events */
 	mainloop_thread = chassis_event_thread_new();
 	if (0 != chassis_event_threads_init_thread(chas->threads, mainloop_thread, chas)) {
@@ -259,6 +426,63 @@ int chassis_mainloop(void *_chas) {
 
 	g_assert(chas->event_base);
 
+	if (chas->event_method && 0 != strcmp(event_base_get_method(chas->event_base), chas->event_method)) {
+		g_warning("%s: --event-method=%s isn't available, libevent uses %s",
+				G_STRLOC,
+				chas->event_method,
+				event_base_get_method(chas->event_base));
+	} else {
+		g_debug("%s: libevent uses %s", G_STRLOC, event_base_get_method(chas->event_base));
+	}
+
+	if (chas->event_thread_count < 1) chas->event_thread_count = 1;
+
+	/* create the event-threads
+	 *
+	 * - setup the event-queues and notification-fds
+	 *
+	 * they are created before the plugins are set up to allow them to register
+	 * events (like per-thread listen sockets) with the event-bases of the threads,
+	 * but are only started after the setup is done
+	 * */
+	for (i = 1; i < (guint)chas->event_thread_count; i++) { /* we already have 1 event-thread running, the main-thread */
+		chassis_event_thread_t *event_thread;
+	
+		event_thread = chassis_event_thread_new();
+		if (0 != chassis_event_threads_init_thread(chas->threads, event_thread, chas)) {
+			chassis_event_thread_free(event_thread);
+			return -1;
+		}
+		chassis_event_threads_add(chas->threads, event_thread);
+	}
+
+	chassis_metrics_register_collector(chas->metrics, chassis_event_threads_collect_metrics, chas->threads);
+
+	/* the plugins may push jobs from their setup on */
+	if (chas->worker_thread_count < 1) chas->worker_thread_count = 1;
+	{
+		GError *gerr = NULL;
+
+		if (NULL == (chas->workers = chassis_worker_pool_new(chas->worker_thread_count, &gerr))) {
+			g_critical("%s: creating the worker pool failed: %s", G_STRLOC, gerr->message);
+			g_error_free(gerr);
+			return -1;
+		}
+	}
+
+	memset(&handoff_drain, 0, sizeof(handoff_drain));
+	handoff_drain.chas = chas;
+
+	/* take the listening sockets of the old proxy before the plugins bind them */
+	if (chas->handoff_socket) {
+		GError *gerr = NULL;
+
+		if (0 != chassis_handoff_receive(chas->handoff_socket, &gerr)) {
+			g_critical("%s: %s", G_STRLOC, gerr->message);
+			g_clear_error(&gerr);
+			return -1;
+		}
+	}
 
 	/* setup all plugins all plugins */
 	for (i = 0; i < chas->modules->len; i++) {
@@ -272,6 +496,53 @@ int chassis_mainloop(void *_chas) {
 		}
 	}
 
+	/* the workers publish their metrics for each other, worker 0 serves the sum of all */
+	if (chas->prefork) {
+		chassis_prefork_start(chas->prefork, chas->event_base, chas->metrics, chas->stats_shm_interval);
+		chassis_metrics_set_merger(chas->metrics, chassis_prefork_merge_metrics, chas->prefork);
+	}
+
+	/* the plugins registered their metrics, serve them from the main-thread */
+	if (chas->metrics_address && (NULL == chas->prefork || 0 == chas->prefork->ndx)) {
+		GError *gerr = NULL;
+
+		if (0 != chassis_metrics_listen(chas->metrics, chas->event_base, chas->metrics_address, &gerr)) {
+			g_critical("%s: %s", G_STRLOC, gerr->message);
+			g_clear_error(&gerr);
+			return -1;
+		}
+		g_message("serving metrics on http://%s/metrics", chas->metrics_address);
+	}
+
+	if (chas->stats_shm_file && (NULL == chas->prefork || 0 == chas->prefork->ndx)) {
+		GError *gerr = NULL;
+
+		if (NULL == (chas->stats_shm = chassis_stats_shm_create(chas->stats_shm_file, &gerr))) {
+			g_critical("%s: %s", G_STRLOC, gerr->message);
+			g_clear_error(&gerr);
+			return -1;
+		}
+		chassis_stats_shm_start(chas->stats_shm, chas->event_base, chas->metrics, chas->stats_shm_interval);
+		g_message("publishing metrics in %s every %dms", chas->stats_shm_file, chas->stats_shm_interval);
+	}
+
+	/* we are listening, let the old proxy drain and wait for the next upgrade */
+	if (chas->handoff_socket) {
+		GError *gerr = NULL;
+
+		chassis_handoff_close_unclaimed();
+
+		if (0 != chassis_handoff_listen(chas->event_base, chas->handoff_socket, &gerr)) {
+			g_critical("%s: %s", G_STRLOC, gerr->message);
+			g_clear_error(&gerr);
+			return -1;
+		}
+
+		evtimer_set(&(handoff_drain.ev), handoff_drain_handler, &handoff_drain);
+		event_base_set(chas->event_base, &(handoff_drain.ev));
+		handoff_drain_handler(-1, 0, &handoff_drain);
+	}
+
 	/*
 	 * drop root privileges if requested
 	 */
@@ -328,22 +599,21 @@ int chassis_mainloop(void *_chas) {
 	}
 #endif
 
-	if (chas->event_thread_count < 1) chas->event_thread_count = 1;
+#ifdef _WIN32
+	/* the idle connections wait on the completion-port, a poller per event-thread */
+	chassis_event_iocp_start(chas->event_thread_count, chassis_event_activate_in_thread);
+#endif
 
-	/* create the event-threads
-	 *
-	 * - dup the async-queue-ping-fds
-	 * - setup the events notification
-	 * */
-	for (i = 1; i < (guint)chas->event_thread_count; i++) { /* we already have 1 event-thread running, the main-thread */
-		chassis_event_thread_t *event_thread;
-	
-		event_thread = chassis_event_thread_new();
-		if (0 != chassis_event_threads_init_thread(chas->threads, event_thread, chas)) {
-			chassis_event_thread_free(event_thread);
-			return -1;
-		}
-		chassis_event_threads_add(chas->threads, event_thread);
+	/* start with the fewest active threads, they get more as soon as they are busy */
+	memset(&autoscale, 0, sizeof(autoscale));
+	autoscale.chas = chas;
+
+	if (chas->event_threads_min > 0 && chas->event_thread_count > 1) {
+		chassis_event_threads_set_active(chas->threads, chas->event_threads_min);
+
+		evtimer_set(&(autoscale.ev), event_threads_autoscale_handler, &autoscale);
+		event_base_set(chas->event_base, &(autoscale.ev));
+		event_threads_autoscale_handler(-1, 0, &autoscale);
 	}
 
 	/* start the event threads */
@@ -363,6 +633,8 @@ int chassis_mainloop(void *_chas) {
 #ifdef SIGHUP
 	signal_del(&ev_sighup);
 #endif
+	if (chas->handoff_socket) event_del(&(handoff_drain.ev));
+	if (chas->event_threads_min > 0 && chas->event_thread_count > 1) event_del(&(autoscale.ev));
 	return 0;
 }
 
@@ -42,7 +42,11 @@
 #include "chassis-exports.h"
 #include "chassis-log.h"
 #include "chassis-stats.h"
+#include "chassis-metrics.h"
+#include "chassis-stats-shm.h"
+#include "chassis-prefork.h"
 #include "chassis-shutdown-hooks.h"
+#include "chassis-worker-pool.h"
 
 /** @defgroup chassis Chassis
  * 
@@ -61,21 +65,46 @@ struct chassis {
 	GPtrArray *modules;                       /**< array(chassis_plugin) */
 
 	gchar *base_dir;				/**< base directory for all relative paths referenced */
+	gchar *default_file;                    /**< the --defaults-file, re-read by chassis_reload_config() */
 	gchar *user;					/**< user to run as */
 
 	chassis_private *priv;
 	void (*priv_shutdown)(chassis *chas, chassis_private *priv);
 	void (*priv_free)(chassis *chas, chassis_private *priv);
+	gint (*priv_count_connections)(chassis *chas, chassis_private *priv); /**< number of open client connections */
 
 	chassis_log *log;
 	
 	chassis_stats_t *stats;			/**< the overall chassis stats, includes lua and glib allocation stats */
 
+	chassis_metrics_t *metrics;             /**< the metrics of the chassis and the plugins, see chassis-metrics.h */
+	gchar *metrics_address;                 /**< serve the metrics on GET /metrics at this address, NULL to disable */
+	gchar *stats_shm_file;                  /**< publish the metrics in this shared-memory file, NULL to disable, see chassis-stats-shm.h */
+	gint stats_shm_interval;                /**< milliseconds between two updates of the shared-memory file */
+	chassis_stats_shm_t *stats_shm;
+
+	chassis_prefork_t *prefork;             /**< the segment of the --worker-processes, NULL if we are the only process, see chassis-prefork.h */
+
+	gchar *handoff_socket;                  /**< take over the listening sockets of the proxy on this unix-socket, see chassis-handoff.h */
+	gint handoff_drain_timeout;             /**< seconds to wait for the open connections after a handoff, 0 to wait for all */
+
 	/* network-io threads */
 	gint event_thread_count;
+	gboolean lua_per_event_thread;          /**< give each event-thread its own lua-scope */
+	gchar *event_threads_cpus;              /**< pin the event-threads to these CPUs or "numa", see chassis_event_threads_set_cpus() */
+	gchar *event_method;                    /**< the backend of libevent, NULL to let libevent pick it, see chassis_event_set_method() */
+	gboolean event_persistent_waits;        /**< keep the socket of a connection registered between two waits, see network_mysqld_con_wait_for_event() */
+	gboolean event_threads_rebalance;       /**< move idle connections away from busy event-threads, see chassis_event_threads_pick_idle() */
+	gint event_threads_spin;                /**< microseconds the event-threads poll without sleeping after a event, 0 to disable */
+	gint event_threads_min;                 /**< scale the active event-threads down to this many by their load, 0 to disable, see chassis_event_threads_autoscale() */
 
 	chassis_event_threads_t *threads;
 
+	gint accept_batch;                      /**< connections accepted per wakeup of a listening socket, see network_mysqld_con_accept() */
+
+	gint worker_thread_count;               /**< threads for the blocking calls of the event-threads */
+	chassis_worker_pool_t *workers;         /**< see chassis-worker-pool.h */
+
 	chassis_shutdown_hooks_t *shutdown_hooks;
 };
 
@@ -91,6 +120,8 @@ CHASSIS_API int chassis_check_version(const char *lib_version, const char *hdr_v
  */
 CHASSIS_API int chassis_mainloop(void *user_data);
 
+CHASSIS_API int chassis_reload_config(chassis *chas);
+
 CHASSIS_API void chassis_set_shutdown_location(const gchar* location);
 CHASSIS_API gboolean chassis_is_shutdown(void);
 
@@ -0,0 +1,205 @@
+/* $%BEGINLICENSE%$
+ Copyright (c) 2008, 2012, Oracle and/or its affiliates. All rights reserved.
+
+ This program is free software; you can redistribute it and/or
+ modify it under the terms of the GNU General Public License as
+ published by the Free Software Foundation; version 2 of the
+ License.
+
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ GNU General Public License for more details.
+
+ You should have received a copy of the GNU General Public License
+ along with this program; if not, write to the Free Software
+ Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA
+ 02110-1301  USA
+
+ $%ENDLICENSE%$ */
+/**
+ * the heap of the process as the allocator sees it
+ *
+ * @see chassis-mem.h
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+
+#ifdef HAVE_JEMALLOC_JEMALLOC_H
+#include <jemalloc/jemalloc.h>
+#elif defined(HAVE_MALLINFO2) || defined(HAVE_MALLINFO) || defined(HAVE_MALLOC_INFO)
+#include <malloc.h>
+#endif
+
+#ifndef _WIN32
+#include <unistd.h>
+#else
+#include <process.h>
+#define getpid _getpid
+#endif
+
+#include <glib.h>
+#include <glib/gstdio.h>
+
+#include "chassis-mem.h"
+
+/**
+ * numbers the heap profiles of this process
+ */
+static volatile gint chassis_mem_dumps = 0;
+
+GQuark chassis_mem_error(void) {
+	return g_quark_from_static_string("chassis-mem-error-quark");
+}
+
+/**
+ * ask the allocator for its stats
+ *
+ * @return 0 on success, -1 if the allocator can't tell
+ */
+int chassis_mem_get_stats(chassis_mem_stats_t *stats) {
+#ifdef HAVE_JEMALLOC_JEMALLOC_H
+	guint64 epoch = 1;
+	size_t allocated, resident;
+	size_t len;
+
+	/* the stats are cached by jemalloc until the epoch moves on */
+	len = sizeof(epoch);
+	mallctl("epoch", &epoch, &len, &epoch, len);
+
+	len = sizeof(allocated);
+	if (0 != mallctl("stats.allocated", &allocated, &len, NULL, 0)) return -1;
+	len = sizeof(resident);
+	if (0 != mallctl("stats.resident", &resident, &len, NULL, 0)) return -1;
+
+	stats->allocator = "jemalloc";
+	stats->allocated = allocated;
+	stats->resident = resident;
+
+	return 0;
+#elif defined(HAVE_MALLINFO2)
+	struct mallinfo2 mi = mallinfo2();
+
+	stats->allocator = "glibc";
+	stats->allocated = (guint64)mi.uordblks + mi.hblkhd;
+	stats->resident = (guint64)mi.arena + mi.hblkhd;
+
+	return 0;
+#elif defined(HAVE_MALLINFO)
+	/* the fields are int and wrap above 2GB, good enough to see the trend */
+	struct mallinfo mi = mallinfo();
+
+	stats->allocator = "glibc";
+	stats->allocated = (guint64)(guint)mi.uordblks + (guint)mi.hblkhd;
+	stats->resident = (guint64)(guint)mi.arena + (guint)mi.hblkhd;
+
+	return 0;
+#else
+	(void)stats;
+
+	return -1;
+#endif
+}
+
+/**
+ * give the calling thread an arena of its own
+ *
+ * called by each event-thread before it enters its loop: the packets, the connections
+ * and the lua-states it allocates don't share the locks and the pages of the arenas
+ * of the other threads. Only done with jemalloc, glibc does it on its own.
+ */
+void chassis_mem_thread_init(void) {
+#ifdef HAVE_JEMALLOC_JEMALLOC_H
+	unsigned arena;
+	size_t len = sizeof(arena);
+
+	if (0 != mallctl("arenas.create", &arena, &len, NULL, 0)) {
+		g_debug("%s: mallctl(arenas.create) failed, the thread shares the arenas", G_STRLOC);
+		return;
+	}
+
+	if (0 != mallctl("thread.arena", NULL, NULL, &arena, sizeof(arena))) {
+		g_debug("%s: mallctl(thread.arena, %u) failed, the thread shares the arenas", G_STRLOC, arena);
+	}
+#endif
+}
+
+/**
+ * write a profile of the heap to a file
+ *
+ * jemalloc writes a heap profile for jeprof, it has to be started with profiling enabled
+ * (MALLOC_CONF=prof:true). glibc writes the state of its arenas with malloc_info().
+ *
+ * @return the name of the file, NULL on error
+ */
+gchar *chassis_mem_dump_profile(GError **gerr) {
+	gchar *filename;
+	gint seq = g_atomic_int_exchange_and_add(&chassis_mem_dumps, 1);
+#ifdef HAVE_JEMALLOC_JEMALLOC_H
+	const char *name;
+	int err;
+
+	filename = g_strdup_printf("%s/mysql-proxy-heap.%d.%d.heap", g_get_tmp_dir(), (int)getpid(), seq);
+	name = filename;
+
+	if (0 != (err = mallctl("prof.dump", NULL, NULL, &name, sizeof(name)))) {
+		if (err == ENOENT) {
+			g_set_error(gerr, CHASSIS_MEM_ERROR, CHASSIS_MEM_ERROR_UNSUPPORTED,
+					"jemalloc doesn't profile, start mysql-proxy with MALLOC_CONF=prof:true");
+		} else {
+			g_set_error(gerr, CHASSIS_MEM_ERROR, CHASSIS_MEM_ERROR_DUMP,
+					"writing the heap profile to %s failed: %s (%d)",
+					filename,
+					g_strerror(err), err);
+		}
+		g_free(filename);
+
+		return NULL;
+	}
+
+	return filename;
+#elif defined(HAVE_MALLOC_INFO)
+	FILE *f;
+
+	filename = g_strdup_printf("%s/mysql-proxy-heap.%d.%d.xml", g_get_tmp_dir(), (int)getpid(), seq);
+
+	if (NULL == (f = g_fopen(filename, "w"))) {
+		g_set_error(gerr, CHASSIS_MEM_ERROR, CHASSIS_MEM_ERROR_DUMP,
+				"opening %s failed: %s (%d)",
+				filename,
+				g_strerror(errno), errno);
+		g_free(filename);
+
+		return NULL;
+	}
+
+	if (0 != malloc_info(0, f)) {
+		g_set_error(gerr, CHASSIS_MEM_ERROR, CHASSIS_MEM_ERROR_DUMP,
+				"malloc_info() to %s failed: %s (%d)",
+				filename,
+				g_strerror(errno), errno);
+		fclose(f);
+		g_unlink(filename);
+		g_free(filename);
+
+		return NULL;
+	}
+	fclose(f);
+
+	return filename;
+#else
+	(void)filename;
+	(void)seq;
+
+	g_set_error(gerr, CHASSIS_MEM_ERROR, CHASSIS_MEM_ERROR_UNSUPPORTED,
+			"the allocator can't dump a heap profile, build with jemalloc");
+
+	return NULL;
+#endif
+}
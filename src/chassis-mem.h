@@ -0,0 +1,55 @@
+/* $%BEGINLICENSE%$
+ Copyright (c) 2008, 2012, Oracle and/or its affiliates. All rights reserved.
+
+ This program is free software; you can redistribute it and/or
+ modify it under the terms of the GNU General Public License as
+ published by the Free Software Foundation; version 2 of the
+ License.
+
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ GNU General Public License for more details.
+
+ You should have received a copy of the GNU General Public License
+ along with this program; if not, write to the Free Software
+ Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA
+ 02110-1301  USA
+
+ $%ENDLICENSE%$ */
+#ifndef _CHASSIS_MEM_H_
+#define _CHASSIS_MEM_H_
+
+#include <glib.h>
+
+#include "chassis-exports.h"
+
+/**
+ * what the malloc() of the process tells about its heap
+ *
+ * built with jemalloc (--with-jemalloc, WITH_JEMALLOC) the stats come from mallctl() and
+ * each event-thread allocates from its own arena. Otherwise the stats come from
+ * mallinfo() of glibc, which already gives the threads arenas of their own.
+ *
+ * resident - allocated is what the allocator holds without handing it out: the
+ * fragmentation and the free memory it didn't return to the OS yet.
+ */
+typedef struct {
+	const gchar *allocator;  /**< "jemalloc" or "glibc" */
+	guint64 allocated;       /**< bytes handed out to the application */
+	guint64 resident;        /**< bytes the allocator got from the OS and still holds */
+} chassis_mem_stats_t;
+
+CHASSIS_API int chassis_mem_get_stats(chassis_mem_stats_t *stats);
+CHASSIS_API void chassis_mem_thread_init(void);
+CHASSIS_API gchar *chassis_mem_dump_profile(GError **gerr);
+
+#define CHASSIS_MEM_ERROR chassis_mem_error()
+CHASSIS_API GQuark chassis_mem_error(void);
+
+typedef enum {
+	CHASSIS_MEM_ERROR_UNSUPPORTED, /**< the allocator can't do it */
+	CHASSIS_MEM_ERROR_DUMP         /**< writing the profile failed */
+} chassis_mem_error_t;
+
+#endif
@@ -0,0 +1,661 @@
+/* $%BEGINLICENSE%$
+ Copyright (c) 2008, 2012, Oracle and/or its affiliates. All rights reserved.
+
+ This program is free software; you can redistribute it and/or
+ modify it under the terms of the GNU General Public License as
+ published by the Free Software Foundation; version 2 of the
+ License.
+
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ GNU General Public License for more details.
+
+ You should have received a copy of the GNU General Public License
+ along with this program; if not, write to the Free Software
+ Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA
+ 02110-1301  USA
+
+ $%ENDLICENSE%$ */
+/**
+ * metrics in the text-format of prometheus
+ *
+ * counters, gauges and histograms are kept per event-thread on their own cache-lines.
+ * Updating them is a plain add to the shard of the current thread, only a scrape
+ * walks all the shards.
+ *
+ * GET /metrics is answered by a small HTTP listener in the main event-loop, see
+ * --metrics-address
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <sys/types.h>
+#include <string.h>
+#include <errno.h>
+#include <stdlib.h>
+
+#ifndef _WIN32
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <netdb.h>
+#include <unistd.h>
+#include <fcntl.h>
+#else
+#include <winsock2.h>
+#include <ws2tcpip.h>
+#endif
+
+#include <glib.h>
+
+#include "chassis-metrics.h"
+#include "chassis-event-thread.h"
+#include "chassis-handoff.h"
+
+#ifndef _WIN32
+#define closesocket(x) close(x)
+#endif
+
+/**
+ * close the connections of clients that don't send their request in time
+ */
+#define CHASSIS_METRICS_HTTP_TIMEOUT_SEC 5
+
+/**
+ * the largest request we accept, we only look at the request-line anyway
+ */
+#define CHASSIS_METRICS_HTTP_REQUEST_MAX 8192
+
+GQuark chassis_metrics_error(void) {
+	return g_quark_from_static_string("chassis-metrics-error-quark");
+}
+
+chassis_metrics_t *chassis_metrics_new(void) {
+	chassis_metrics_t *metrics;
+
+	metrics = g_new0(chassis_metrics_t, 1);
+	metrics->metrics = g_ptr_array_new();
+	metrics->collectors = g_ptr_array_new();
+	metrics->mutex = g_mutex_new();
+	metrics->listen_fd = -1;
+
+	return metrics;
+}
+
+static void chassis_metric_free(chassis_metric_t *metric) {
+	if (!metric) return;
+
+	g_free(metric->name);
+	g_free(metric->help);
+	g_free(metric->label_name);
+	if (metric->label_values) g_strfreev(metric->label_values);
+	g_free(metric->bounds);
+	g_free(metric->_values_mem);
+
+	g_free(metric);
+}
+
+void chassis_metrics_free(chassis_metrics_t *metrics) {
+	guint i;
+
+	if (!metrics) return;
+
+	if (metrics->listen_fd != -1) {
+		event_del(&(metrics->listen_event));
+		closesocket(metrics->listen_fd);
+	}
+
+	for (i = 0; i < metrics->metrics->len; i++) {
+		chassis_metric_free(metrics->metrics->pdata[i]);
+	}
+	g_ptr_array_free(metrics->metrics, TRUE);
+
+	for (i = 0; i < metrics->collectors->len; i++) {
+		g_free(metrics->collectors->pdata[i]);
+	}
+	g_ptr_array_free(metrics->collectors, TRUE);
+
+	g_mutex_free(metrics->mutex);
+
+	g_free(metrics);
+}
+
+/**
+ * create a metric and its shards
+ *
+ * the values of each shard start on a cache-line of their own
+ */
+static chassis_metric_t *chassis_metrics_register(chassis_metrics_t *metrics, chassis_metric_type_t type,
+		const gchar *name, const gchar *help,
+		const gchar *label_name, const gchar * const *label_values, guint n_labels,
+		const guint64 *bounds, guint n_bounds, gdouble unit) {
+	chassis_metric_t *metric;
+	const guint per_line = CHASSIS_METRICS_CACHE_LINE_SIZE / sizeof(gint64);
+	guint i;
+
+	metric = g_new0(chassis_metric_t, 1);
+	metric->name = g_strdup(name);
+	metric->help = g_strdup(help);
+	metric->type = type;
+
+	if (label_name) {
+		metric->label_name = g_strdup(label_name);
+		metric->label_values = g_new0(gchar *, n_labels + 1);
+		for (i = 0; i < n_labels; i++) {
+			metric->label_values[i] = g_strdup(label_values[i]);
+		}
+		metric->n_labels = n_labels;
+	} else {
+		metric->n_labels = 1;
+	}
+
+	if (type == CHASSIS_METRIC_HISTOGRAM) {
+		metric->bounds = g_memdup(bounds, n_bounds * sizeof(guint64));
+		metric->n_bounds = n_bounds;
+		metric->unit = unit;
+		metric->n_values = n_bounds + 1 + 2; /* the buckets with +Inf, the count and the sum */
+	} else {
+		metric->n_values = 1;
+	}
+
+	metric->stride = (metric->n_labels * metric->n_values + per_line - 1) / per_line * per_line;
+
+	metric->_values_mem = g_malloc0(CHASSIS_METRICS_SHARDS * metric->stride * sizeof(gint64) + CHASSIS_METRICS_CACHE_LINE_SIZE - 1);
+	metric->values = (gint64 *)(((gsize)metric->_values_mem + CHASSIS_METRICS_CACHE_LINE_SIZE - 1) & ~((gsize)CHASSIS_METRICS_CACHE_LINE_SIZE - 1));
+
+	g_mutex_lock(metrics->mutex);
+	g_ptr_array_add(metrics->metrics, metric);
+	g_mutex_unlock(metrics->mutex);
+
+	return metric;
+}
+
+chassis_metric_t *chassis_metrics_register_counter(chassis_metrics_t *metrics, const gchar *name, const gchar *help) {
+	return chassis_metrics_register(metrics, CHASSIS_METRIC_COUNTER, name, help, NULL, NULL, 0, NULL, 0, 1.0);
+}
+
+chassis_metric_t *chassis_metrics_register_gauge(chassis_metrics_t *metrics, const gchar *name, const gchar *help) {
+	return chassis_metrics_register(metrics, CHASSIS_METRIC_GAUGE, name, help, NULL, NULL, 0, NULL, 0, 1.0);
+}
+
+/**
+ * a counter with one label
+ *
+ * @param label_values the n_labels values of the label, chassis_metric_add_label() takes the index into it
+ */
+chassis_metric_t *chassis_metrics_register_counter_vec(chassis_metrics_t *metrics, const gchar *name, const gchar *help,
+		const gchar *label_name, const gchar * const *label_values, guint n_labels) {
+	return chassis_metrics_register(metrics, CHASSIS_METRIC_COUNTER, name, help, label_name, label_values, n_labels, NULL, 0, 1.0);
+}
+
+/**
+ * a histogram
+ *
+ * @param bounds   the ascending upper bounds of the buckets, a bucket for +Inf is added
+ * @param unit     factor to render the values in the base-unit of the metric
+ */
+chassis_metric_t *chassis_metrics_register_histogram(chassis_metrics_t *metrics, const gchar *name, const gchar *help,
+		const guint64 *bounds, guint n_bounds, gdouble unit) {
+	return chassis_metrics_register(metrics, CHASSIS_METRIC_HISTOGRAM, name, help, NULL, NULL, 0, bounds, n_bounds, unit);
+}
+
+void chassis_metrics_register_collector(chassis_metrics_t *metrics, chassis_metrics_collector_func func, gpointer user_data) {
+	chassis_metrics_collector_t *collector;
+
+	collector = g_new0(chassis_metrics_collector_t, 1);
+	collector->func = func;
+	collector->user_data = user_data;
+
+	g_mutex_lock(metrics->mutex);
+	g_ptr_array_add(metrics->collectors, collector);
+	g_mutex_unlock(metrics->mutex);
+}
+
+/**
+ * rewrite the metrics served on GET /metrics
+ *
+ * only the HTTP listener merges, chassis_metrics_render() renders the metrics as they are
+ */
+void chassis_metrics_set_merger(chassis_metrics_t *metrics, chassis_metrics_merge_func func, gpointer user_data) {
+	metrics->merge = func;
+	metrics->merge_data = user_data;
+}
+
+/**
+ * get the values of the shard of the current event-thread
+ *
+ * if there are more event-threads than shards, two threads may share a shard and
+ * lose a update now and then
+ */
+static gint64 *chassis_metric_get_local_values(chassis_metric_t *metric) {
+	return metric->values + (chassis_event_thread_get_local_index() % CHASSIS_METRICS_SHARDS) * metric->stride;
+}
+
+void chassis_metric_add_label(chassis_metric_t *metric, guint label_ndx, gint64 value) {
+	if (!metric || label_ndx >= metric->n_labels) return;
+
+	chassis_metric_get_local_values(metric)[label_ndx * metric->n_values] += value;
+}
+
+void chassis_metric_add(chassis_metric_t *metric, gint64 value) {
+	if (!metric) return;
+
+	chassis_metric_get_local_values(metric)[0] += value;
+}
+
+void chassis_metric_inc(chassis_metric_t *metric) {
+	chassis_metric_add(metric, 1);
+}
+
+void chassis_metric_dec(chassis_metric_t *metric) {
+	chassis_metric_add(metric, -1);
+}
+
+/**
+ * add a value to a histogram
+ *
+ * the bounds are few, a linear scan is good enough
+ */
+void chassis_metric_observe(chassis_metric_t *metric, guint64 value) {
+	gint64 *values;
+	guint i;
+
+	if (!metric) return;
+
+	values = chassis_metric_get_local_values(metric);
+
+	for (i = 0; i < metric->n_bounds; i++) {
+		if (value <= metric->bounds[i]) break;
+	}
+
+	values[i]++;
+	values[metric->n_bounds + 1]++;
+	values[metric->n_bounds + 2] += value;
+}
+
+/**
+ * sum up a value of all the shards
+ */
+static gint64 chassis_metric_sum(chassis_metric_t *metric, guint value_ndx) {
+	gint64 sum = 0;
+	guint i;
+
+	for (i = 0; i < CHASSIS_METRICS_SHARDS; i++) {
+		sum += metric->values[i * metric->stride + value_ndx];
+	}
+
+	return sum;
+}
+
+/**
+ * get the value of a counter or gauge
+ */
+gint64 chassis_metric_get(chassis_metric_t *metric, guint label_ndx) {
+	if (!metric || label_ndx >= metric->n_labels) return 0;
+
+	return chassis_metric_sum(metric, label_ndx * metric->n_values);
+}
+
+static const char *chassis_metric_type_get_name(chassis_metric_type_t type) {
+	switch (type) {
+	case CHASSIS_METRIC_COUNTER: return "counter";
+	case CHASSIS_METRIC_GAUGE: return "gauge";
+	case CHASSIS_METRIC_HISTOGRAM: return "histogram";
+	}
+
+	return "untyped";
+}
+
+void chassis_metrics_append_header(GString *out, const gchar *name, const gchar *help, chassis_metric_type_t type) {
+	g_string_append_printf(out, "# HELP %s %s\n", name, help);
+	g_string_append_printf(out, "# TYPE %s %s\n", name, chassis_metric_type_get_name(type));
+}
+
+/**
+ * append a sample
+ *
+ * @param labels  the labels like backend="127.0.0.1:3306",state="up", NULL if the sample has none
+ */
+void chassis_metrics_append_value(GString *out, const gchar *name, const gchar *labels, gdouble value) {
+	if (labels) {
+		g_string_append_printf(out, "%s{%s} %.15g\n", name, labels, value);
+	} else {
+		g_string_append_printf(out, "%s %.15g\n", name, value);
+	}
+}
+
+static void chassis_metrics_render_histogram(chassis_metric_t *metric, GString *out) {
+	gint64 cumulative = 0;
+	guint i;
+
+	for (i = 0; i <= metric->n_bounds; i++) {
+		cumulative += chassis_metric_sum(metric, i);
+
+		if (i < metric->n_bounds) {
+			g_string_append_printf(out, "%s_bucket{le=\"%.6g\"} %"G_GINT64_FORMAT"\n",
+					metric->name, metric->bounds[i] * metric->unit, cumulative);
+		} else {
+			g_string_append_printf(out, "%s_bucket{le=\"+Inf\"} %"G_GINT64_FORMAT"\n",
+					metric->name, cumulative);
+		}
+	}
+
+	g_string_append_printf(out, "%s_sum %.15g\n", metric->name, chassis_metric_sum(metric, metric->n_bounds + 2) * metric->unit);
+	g_string_append_printf(out, "%s_count %"G_GINT64_FORMAT"\n", metric->name, chassis_metric_sum(metric, metric->n_bounds + 1));
+}
+
+/**
+ * render all metrics in the text-format of prometheus
+ *
+ * the collectors are called after the registered metrics
+ */
+void chassis_metrics_render(chassis_metrics_t *metrics, GString *out) {
+	GString *labels = g_string_new(NULL);
+	guint i, j;
+
+	g_mutex_lock(metrics->mutex);
+	for (i = 0; i < metrics->metrics->len; i++) {
+		chassis_metric_t *metric = metrics->metrics->pdata[i];
+
+		chassis_metrics_append_header(out, metric->name, metric->help, metric->type);
+
+		if (metric->type == CHASSIS_METRIC_HISTOGRAM) {
+			chassis_metrics_render_histogram(metric, out);
+			continue;
+		}
+
+		if (!metric->label_name) {
+			chassis_metrics_append_value(out, metric->name, NULL, chassis_metric_get(metric, 0));
+			continue;
+		}
+
+		for (j = 0; j < metric->n_labels; j++) {
+			g_string_printf(labels, "%s=\"%s\"", metric->label_name, metric->label_values[j]);
+			chassis_metrics_append_value(out, metric->name, labels->str, chassis_metric_get(metric, j));
+		}
+	}
+
+	for (i = 0; i < metrics->collectors->len; i++) {
+		chassis_metrics_collector_t *collector = metrics->collectors->pdata[i];
+
+		collector->func(metrics, out, collector->user_data);
+	}
+	g_mutex_unlock(metrics->mutex);
+
+	g_string_free(labels, TRUE);
+}
+
+/**
+ * a client of the HTTP listener
+ */
+typedef struct {
+	chassis_metrics_t *metrics;
+
+	int fd;
+	struct event ev;
+
+	GString *request;
+	GString *response;
+	gsize response_ofs;
+} chassis_metrics_http_con_t;
+
+static void chassis_metrics_http_con_free(chassis_metrics_http_con_t *con) {
+	event_del(&(con->ev));
+	closesocket(con->fd);
+
+	g_string_free(con->request, TRUE);
+	g_string_free(con->response, TRUE);
+
+	g_free(con);
+}
+
+static int chassis_metrics_set_nonblocking(int fd) {
+#ifdef _WIN32
+	u_long ioctlvar = 1;
+
+	return ioctlsocket(fd, FIONBIO, &ioctlvar);
+#else
+	return fcntl(fd, F_SETFL, O_NONBLOCK | O_RDWR);
+#endif
+}
+
+static void chassis_metrics_http_respond(chassis_metrics_http_con_t *con, const char *status, const char *content_type, GString *body) {
+	g_string_append_printf(con->response,
+			"HTTP/1.0 %s\r\n"
+			"Content-Type: %s\r\n"
+			"Content-Length: %"G_GSIZE_FORMAT"\r\n"
+			"Connection: close\r\n"
+			"\r\n",
+			status, content_type, body->len);
+	g_string_append_len(con->response, body->str, body->len);
+}
+
+/**
+ * answer the request-line
+ *
+ * only GET /metrics is known, everything else is a 404
+ */
+static void chassis_metrics_http_handle_request(chassis_metrics_http_con_t *con) {
+	GString *body = g_string_sized_new(16 * 1024);
+	const char *path;
+	gsize path_len;
+
+	if (0 == strncmp(con->request->str, "GET ", 4)) {
+		path = con->request->str + 4;
+		path_len = strcspn(path, " ?\r\n");
+
+		if (path_len == sizeof("/metrics") - 1 && 0 == strncmp(path, "/metrics", path_len)) {
+			chassis_metrics_render(con->metrics, body);
+			if (con->metrics->merge) con->metrics->merge(con->metrics, body, con->metrics->merge_data);
+			chassis_metrics_http_respond(con, "200 OK", "text/plain; version=0.0.4", body);
+		} else {
+			g_string_append(body, "not found\n");
+			chassis_metrics_http_respond(con, "404 Not Found", "text/plain", body);
+		}
+	} else {
+		g_string_append(body, "only GET is supported\n");
+		chassis_metrics_http_respond(con, "405 Method Not Allowed", "text/plain", body);
+	}
+
+	g_string_free(body, TRUE);
+}
+
+static void chassis_metrics_http_con_handle(int fd, short events, void *user_data);
+
+static void chassis_metrics_http_con_wait(chassis_metrics_http_con_t *con, short events) {
+	struct timeval timeout;
+
+	timeout.tv_sec = CHASSIS_METRICS_HTTP_TIMEOUT_SEC;
+	timeout.tv_usec = 0;
+
+	event_set(&(con->ev), con->fd, events, chassis_metrics_http_con_handle, con);
+	event_base_set(con->metrics->event_base, &(con->ev));
+	event_add(&(con->ev), &timeout);
+}
+
+/**
+ * read the request until the end of its headers, then write the response and close
+ */
+static void chassis_metrics_http_con_handle(int G_GNUC_UNUSED fd, short events, void *user_data) {
+	chassis_metrics_http_con_t *con = user_data;
+	char buf[1024];
+	gssize len;
+
+	if (events & EV_TIMEOUT) {
+		chassis_metrics_http_con_free(con);
+		return;
+	}
+
+	if (events & EV_READ) {
+		len = recv(con->fd, buf, sizeof(buf), 0);
+		if (len <= 0) {
+			if (len < 0 && (errno == EAGAIN || errno == EINTR)) {
+				chassis_metrics_http_con_wait(con, EV_READ);
+				return;
+			}
+			chassis_metrics_http_con_free(con);
+			return;
+		}
+
+		g_string_append_len(con->request, buf, len);
+
+		if (NULL == strstr(con->request->str, "\r\n\r\n") &&
+		    NULL == strstr(con->request->str, "\n\n")) {
+			if (con->request->len > CHASSIS_METRICS_HTTP_REQUEST_MAX) {
+				chassis_metrics_http_con_free(con);
+				return;
+			}
+
+			chassis_metrics_http_con_wait(con, EV_READ);
+			return;
+		}
+
+		chassis_metrics_http_handle_request(con);
+	}
+
+	while (con->response_ofs < con->response->len) {
+		len = send(con->fd, con->response->str + con->response_ofs, con->response->len - con->response_ofs, 0);
+		if (len < 0) {
+			if (errno == EAGAIN || errno == EINTR) {
+				chassis_metrics_http_con_wait(con, EV_WRITE);
+				return;
+			}
+			break;
+		}
+
+		con->response_ofs += len;
+	}
+
+	chassis_metrics_http_con_free(con);
+}
+
+static void chassis_metrics_http_accept(int G_GNUC_UNUSED event_fd, short G_GNUC_UNUSED events, void *user_data) {
+	chassis_metrics_t *metrics = user_data;
+	chassis_metrics_http_con_t *con;
+	int fd;
+
+	/* the new proxy takes the scrapes */
+	if (chassis_handoff_is_draining()) {
+		event_del(&(metrics->listen_event));
+		return;
+	}
+
+	if (-1 == (fd = accept(metrics->listen_fd, NULL, NULL))) {
+		return;
+	}
+
+	if (0 != chassis_metrics_set_nonblocking(fd)) {
+		closesocket(fd);
+		return;
+	}
+
+	con = g_new0(chassis_metrics_http_con_t, 1);
+	con->metrics = metrics;
+	con->fd = fd;
+	con->request = g_string_new(NULL);
+	con->response = g_string_new(NULL);
+
+	chassis_metrics_http_con_wait(con, EV_READ);
+}
+
+/**
+ * create the listening socket for the metrics
+ *
+ * @param address  [<host>]:<port> or <port>, the host defaults to all interfaces
+ * @return the fd, -1 and gerr set on error
+ */
+static int chassis_metrics_bind(const gchar *address, GError **gerr) {
+	struct addrinfo hints, *ai = NULL;
+	const gchar *colon;
+	gchar *host = NULL;
+	const gchar *port;
+	int fd;
+	int val = 1;
+	int ret;
+
+	if (NULL != (colon = strrchr(address, ':'))) {
+		if (colon > address) host = g_strndup(address, colon - address);
+		port = colon + 1;
+	} else {
+		port = address;
+	}
+
+	memset(&hints, 0, sizeof(hints));
+	hints.ai_family = AF_UNSPEC;
+	hints.ai_socktype = SOCK_STREAM;
+	hints.ai_flags = AI_PASSIVE;
+
+	ret = getaddrinfo(host, port, &hints, &ai);
+	g_free(host);
+	if (0 != ret) {
+		g_set_error(gerr,
+				CHASSIS_METRICS_ERROR,
+				CHASSIS_METRICS_ERROR_ADDRESS,
+				"resolving --metrics-address %s failed: %s",
+				address, gai_strerror(ret));
+		return -1;
+	}
+
+	if (-1 == (fd = socket(ai->ai_family, ai->ai_socktype, ai->ai_protocol))) {
+		g_set_error(gerr,
+				CHASSIS_METRICS_ERROR,
+				CHASSIS_METRICS_ERROR_LISTEN,
+				"socket() for --metrics-address %s failed: %s",
+				address, g_strerror(errno));
+		freeaddrinfo(ai);
+		return -1;
+	}
+
+	setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, (const void *)&val, sizeof(val));
+
+	if (0 != bind(fd, ai->ai_addr, ai->ai_addrlen) ||
+	    0 != listen(fd, 16) ||
+	    0 != chassis_metrics_set_nonblocking(fd)) {
+		g_set_error(gerr,
+				CHASSIS_METRICS_ERROR,
+				CHASSIS_METRICS_ERROR_LISTEN,
+				"listening on --metrics-address %s failed: %s",
+				address, g_strerror(errno));
+		closesocket(fd);
+		freeaddrinfo(ai);
+		return -1;
+	}
+	freeaddrinfo(ai);
+
+	return fd;
+}
+
+/**
+ * listen for scrapes in the given event-base
+ *
+ * takes the socket of the old proxy on a hot upgrade, see chassis-handoff.h
+ *
+ * @param address  [<host>]:<port> or <port>, the host defaults to all interfaces
+ * @return 0 on success, -1 and gerr set on error
+ */
+int chassis_metrics_listen(chassis_metrics_t *metrics, struct event_base *event_base, const gchar *address, GError **gerr) {
+	gchar *handoff_name;
+	int fd;
+
+	handoff_name = g_strdup_printf("metrics:%s", address);
+
+	if (-1 == (fd = chassis_handoff_take_fd(handoff_name)) &&
+	    -1 == (fd = chassis_metrics_bind(address, gerr))) {
+		g_free(handoff_name);
+		return -1;
+	}
+
+	chassis_handoff_add_fd(handoff_name, fd);
+	g_free(handoff_name);
+
+	metrics->listen_fd = fd;
+	metrics->event_base = event_base;
+
+	event_set(&(metrics->listen_event), fd, EV_READ | EV_PERSIST, chassis_metrics_http_accept, metrics);
+	event_base_set(event_base, &(metrics->listen_event));
+	event_add(&(metrics->listen_event), NULL);
+
+	return 0;
+}
@@ -0,0 +1,156 @@
+/* $%BEGINLICENSE%$
+ Copyright (c) 2008, 2012, Oracle and/or its affiliates. All rights reserved.
+
+ This program is free software; you can redistribute it and/or
+ modify it under the terms of the GNU General Public License as
+ published by the Free Software Foundation; version 2 of the
+ License.
+
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ GNU General Public License for more details.
+
+ You should have received a copy of the GNU General Public License
+ along with this program; if not, write to the Free Software
+ Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA
+ 02110-1301  USA
+
+ $%ENDLICENSE%$ */
+#ifndef _CHASSIS_METRICS_H_
+#define _CHASSIS_METRICS_H_
+
+#include <glib.h>
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#ifdef HAVE_SYS_TIME_H
+#include <sys/time.h>  /* event.h needs struct tm */
+#endif
+#ifdef HAVE_SYS_TYPES_H
+#include <sys/types.h>
+#endif
+#ifdef _WIN32
+#include <winsock2.h>
+#endif
+#include <event.h>     /* struct event */
+
+#include "chassis-exports.h"
+
+/**
+ * shards of the metrics, the event-thread with index n writes to shard n % CHASSIS_METRICS_SHARDS
+ */
+#define CHASSIS_METRICS_SHARDS 64
+
+/**
+ * the values of a shard are padded to a multiple of the cache-line
+ */
+#define CHASSIS_METRICS_CACHE_LINE_SIZE 64
+
+typedef enum {
+	CHASSIS_METRIC_COUNTER,
+	CHASSIS_METRIC_GAUGE,
+	CHASSIS_METRIC_HISTOGRAM
+} chassis_metric_type_t;
+
+/**
+ * a metric with its values per event-thread
+ *
+ * each event-thread adds to its own shard without atomics or locks, a scrape sums up
+ * the shards and may miss the updates that happen while it reads. A gauge is the sum
+ * of the adds and subs of all threads, gauges that are set at once are reported by a
+ * collector.
+ *
+ * a metric may have one label with a fixed set of values, like the command of a query.
+ * A histogram keeps the counts of its buckets, a count and a sum for each label-value.
+ */
+typedef struct {
+	gchar *name;
+	gchar *help;
+	chassis_metric_type_t type;
+
+	gchar *label_name;        /**< NULL if the metric has no label */
+	gchar **label_values;     /**< n_labels values, NULL if the metric has no label */
+	guint n_labels;           /**< 1 if the metric has no label */
+
+	guint64 *bounds;          /**< upper bounds of the buckets of a histogram, the implicit last bucket is +Inf */
+	guint n_bounds;
+	gdouble unit;             /**< a histogram renders a value v as v * unit, e.g. 1e-6 for microseconds to seconds */
+
+	guint n_values;           /**< values per label-value: n_bounds + 1 buckets, count and sum for a histogram, 1 otherwise */
+	guint stride;             /**< values per shard, padded to a multiple of the cache-line */
+
+	gint64 *values;           /**< CHASSIS_METRICS_SHARDS * stride values, cache-line aligned */
+	gpointer _values_mem;     /**< the allocation .values points into */
+} chassis_metric_t;
+
+typedef struct chassis_metrics chassis_metrics_t;
+
+/**
+ * a collector appends metrics that are only known at scrape-time, like the state of the backends
+ *
+ * @see chassis_metrics_append_header(), chassis_metrics_append_value()
+ */
+typedef void (*chassis_metrics_collector_func)(chassis_metrics_t *metrics, GString *out, gpointer user_data);
+
+typedef struct {
+	chassis_metrics_collector_func func;
+	gpointer user_data;
+} chassis_metrics_collector_t;
+
+/**
+ * a merger rewrites the rendered metrics before they are served, e.g. to add those of other processes
+ *
+ * @see chassis_metrics_set_merger()
+ */
+typedef void (*chassis_metrics_merge_func)(chassis_metrics_t *metrics, GString *out, gpointer user_data);
+
+struct chassis_metrics {
+	GPtrArray *metrics;       /**< array(chassis_metric_t) */
+	GPtrArray *collectors;    /**< array(chassis_metrics_collector_t) */
+	GMutex *mutex;            /**< protects .metrics and .collectors, plugins register theirs while the others scrape */
+
+	chassis_metrics_merge_func merge; /**< applied to GET /metrics, NULL if none */
+	gpointer merge_data;
+
+	int listen_fd;            /**< the fd of the HTTP listener, -1 if it isn't listening */
+	struct event listen_event;
+	struct event_base *event_base;
+};
+
+CHASSIS_API chassis_metrics_t *chassis_metrics_new(void);
+CHASSIS_API void chassis_metrics_free(chassis_metrics_t *metrics);
+
+CHASSIS_API chassis_metric_t *chassis_metrics_register_counter(chassis_metrics_t *metrics, const gchar *name, const gchar *help);
+CHASSIS_API chassis_metric_t *chassis_metrics_register_gauge(chassis_metrics_t *metrics, const gchar *name, const gchar *help);
+CHASSIS_API chassis_metric_t *chassis_metrics_register_counter_vec(chassis_metrics_t *metrics, const gchar *name, const gchar *help,
+		const gchar *label_name, const gchar * const *label_values, guint n_labels);
+CHASSIS_API chassis_metric_t *chassis_metrics_register_histogram(chassis_metrics_t *metrics, const gchar *name, const gchar *help,
+		const guint64 *bounds, guint n_bounds, gdouble unit);
+CHASSIS_API void chassis_metrics_register_collector(chassis_metrics_t *metrics, chassis_metrics_collector_func func, gpointer user_data);
+CHASSIS_API void chassis_metrics_set_merger(chassis_metrics_t *metrics, chassis_metrics_merge_func func, gpointer user_data);
+
+CHASSIS_API void chassis_metric_add_label(chassis_metric_t *metric, guint label_ndx, gint64 value);
+CHASSIS_API void chassis_metric_add(chassis_metric_t *metric, gint64 value);
+CHASSIS_API void chassis_metric_inc(chassis_metric_t *metric);
+CHASSIS_API void chassis_metric_dec(chassis_metric_t *metric);
+CHASSIS_API void chassis_metric_observe(chassis_metric_t *metric, guint64 value);
+CHASSIS_API gint64 chassis_metric_get(chassis_metric_t *metric, guint label_ndx);
+
+CHASSIS_API void chassis_metrics_append_header(GString *out, const gchar *name, const gchar *help, chassis_metric_type_t type);
+CHASSIS_API void chassis_metrics_append_value(GString *out, const gchar *name, const gchar *labels, gdouble value);
+CHASSIS_API void chassis_metrics_render(chassis_metrics_t *metrics, GString *out);
+
+CHASSIS_API int chassis_metrics_listen(chassis_metrics_t *metrics, struct event_base *event_base, const gchar *address, GError **gerr);
+
+#define CHASSIS_METRICS_ERROR chassis_metrics_error()
+CHASSIS_API GQuark chassis_metrics_error(void);
+
+typedef enum {
+	CHASSIS_METRICS_ERROR_ADDRESS,  /**< the address couldn't be parsed or resolved */
+	CHASSIS_METRICS_ERROR_LISTEN    /**< socket(), bind() or listen() failed */
+} chassis_metrics_error_t;
+
+#endif
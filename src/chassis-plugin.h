@@ -60,6 +60,7 @@ typedef struct chassis_plugin {
 	GOptionEntry * (*get_options)(chassis_plugin_config *user_data); /**< handler function to obtain the command line argument information */
 	int      (*apply_config)(chassis *chas, chassis_plugin_config * user_data); /**< handler function to set the argument values in the plugin's config */
     void*    (*get_global_state)(chassis_plugin_config *user_data, const char* member);     /**< handler function to retrieve the plugin's global state */
+	int      (*reload_config)(chassis *chas, chassis_plugin_config *user_data, GKeyFile *keyfile); /**< handler function to apply the changed config-file, may be NULL */
     
 } chassis_plugin;
 
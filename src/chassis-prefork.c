@@ -0,0 +1,272 @@
+/* $%BEGINLICENSE%$
+ Copyright (c) 2008, 2012, Oracle and/or its affiliates. All rights reserved.
+
+ This program is free software; you can redistribute it and/or
+ modify it under the terms of the GNU General Public License as
+ published by the Free Software Foundation; version 2 of the
+ License.
+
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ GNU General Public License for more details.
+
+ You should have received a copy of the GNU General Public License
+ along with this program; if not, write to the Free Software
+ Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA
+ 02110-1301  USA
+
+ $%ENDLICENSE%$ */
+/**
+ * the shared segment of the worker processes
+ *
+ * @see chassis-prefork.h
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <string.h>
+#include <errno.h>
+
+#ifndef _WIN32
+#include <sys/types.h>
+#include <sys/mman.h>
+#include <unistd.h>
+#else
+#include <process.h>
+#define getpid _getpid
+#endif
+
+#include <glib.h>
+
+#include "glib-ext.h"
+#include "chassis-prefork.h"
+
+#if !defined(MAP_ANONYMOUS) && defined(MAP_ANON)
+#define MAP_ANONYMOUS MAP_ANON
+#endif
+
+/**
+ * the sum of a sample over the other workers
+ */
+typedef struct {
+	gdouble value;
+	gboolean is_merged;      /**< our own metrics have the sample too */
+} chassis_prefork_sum_t;
+
+GQuark chassis_prefork_error(void) {
+	return g_quark_from_static_string("chassis-prefork-error-quark");
+}
+
+/**
+ * map the segment for n_workers workers
+ *
+ * call it in the master before the workers are forked, they inherit the mapping
+ */
+chassis_prefork_t *chassis_prefork_new(guint n_workers, GError **gerr) {
+#ifndef _WIN32
+	chassis_prefork_t *prefork;
+	gsize slot_size;
+	gpointer addr;
+
+	if (n_workers < 1 || n_workers > CHASSIS_PREFORK_MAX_WORKERS) {
+		g_set_error(gerr,
+				CHASSIS_PREFORK_ERROR,
+				CHASSIS_PREFORK_ERROR_WORKERS,
+				"--worker-processes has to be between 1 and %d, is %u",
+				CHASSIS_PREFORK_MAX_WORKERS, n_workers);
+		return NULL;
+	}
+
+	slot_size = sizeof(chassis_prefork_slot_t) +
+		sizeof(chassis_stats_shm_header_t) +
+		CHASSIS_PREFORK_SLOT_CAPACITY * sizeof(chassis_stats_shm_record_t);
+
+	/* mmap() zero-fills it */
+	if (MAP_FAILED == (addr = mmap(NULL, n_workers * slot_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0))) {
+		g_set_error(gerr,
+				CHASSIS_PREFORK_ERROR,
+				CHASSIS_PREFORK_ERROR_MAP,
+				"mapping the segment of the %u worker-processes failed: %s",
+				n_workers, g_strerror(errno));
+		return NULL;
+	}
+
+	prefork = g_new0(chassis_prefork_t, 1);
+	prefork->n_workers = n_workers;
+	prefork->ndx = -1;
+	prefork->addr = addr;
+	prefork->slot_size = slot_size;
+	prefork->size = n_workers * slot_size;
+
+	return prefork;
+#else
+	g_set_error(gerr,
+			CHASSIS_PREFORK_ERROR,
+			CHASSIS_PREFORK_ERROR_UNSUPPORTED,
+			"--worker-processes: not supported on win32");
+
+	return NULL;
+#endif
+}
+
+void chassis_prefork_free(chassis_prefork_t *prefork) {
+	if (!prefork) return;
+
+	if (prefork->stats) chassis_stats_shm_free(prefork->stats);
+
+#ifndef _WIN32
+	munmap(prefork->addr, prefork->size);
+#endif
+
+	g_free(prefork);
+}
+
+chassis_prefork_slot_t *chassis_prefork_get_slot(chassis_prefork_t *prefork, guint ndx) {
+	g_return_val_if_fail(ndx < prefork->n_workers, NULL);
+
+	return (chassis_prefork_slot_t *)((gchar *)prefork->addr + ndx * prefork->slot_size);
+}
+
+static gpointer chassis_prefork_get_stats_addr(chassis_prefork_t *prefork, guint ndx) {
+	return chassis_prefork_get_slot(prefork, ndx) + 1;
+}
+
+/**
+ * take the slot of worker ndx, called in the worker after the fork()
+ */
+void chassis_prefork_attach(chassis_prefork_t *prefork, guint ndx) {
+	chassis_prefork_slot_t *slot = chassis_prefork_get_slot(prefork, ndx);
+	GTimeVal now;
+
+	g_get_current_time(&now);
+
+	if (slot->started_at != 0) g_atomic_int_inc(&(slot->restarts));
+	slot->started_at = (guint64)now.tv_sec * G_USEC_PER_SEC + now.tv_usec;
+	g_atomic_int_set(&(slot->pid), getpid());
+
+	prefork->ndx = ndx;
+	prefork->stats = chassis_stats_shm_new_mapped(chassis_prefork_get_stats_addr(prefork, ndx),
+			prefork->slot_size - sizeof(chassis_prefork_slot_t), TRUE);
+}
+
+/**
+ * publish our metrics in our slot now and then every interval_ms milliseconds
+ */
+void chassis_prefork_start(chassis_prefork_t *prefork, struct event_base *event_base, chassis_metrics_t *metrics, guint interval_ms) {
+	g_return_if_fail(prefork->stats);
+
+	chassis_stats_shm_start(prefork->stats, event_base, metrics, interval_ms);
+}
+
+/**
+ * copy the samples of a worker out of its slot
+ *
+ * @return FALSE if the worker kept updating them while we copied
+ * @see chassis_stats_shm_read()
+ */
+gboolean chassis_prefork_read(chassis_prefork_t *prefork, guint ndx, GArray *records, guint64 *updated_at) {
+	chassis_stats_shm_t *shm;
+	gboolean ret;
+
+	shm = chassis_stats_shm_new_mapped(chassis_prefork_get_stats_addr(prefork, ndx),
+			prefork->slot_size - sizeof(chassis_prefork_slot_t), FALSE);
+	ret = chassis_stats_shm_read(shm, records, updated_at);
+	chassis_stats_shm_free(shm);
+
+	return ret;
+}
+
+/**
+ * add the samples of the other workers to our rendered metrics
+ *
+ * a sample of ours gets the sum of all workers, the samples only the others have are
+ * appended. Our own samples are taken as rendered, those of the others as they were
+ * published last, at most --stats-shm-interval milliseconds ago. All samples are
+ * summed, a gauge like the state of a backend becomes the number of workers that see it.
+ *
+ * @param user_data the chassis_prefork_t
+ * @see chassis_metrics_set_merger()
+ */
+void chassis_prefork_merge_metrics(chassis_metrics_t G_GNUC_UNUSED *metrics, GString *out, gpointer user_data) {
+	chassis_prefork_t *prefork = user_data;
+	GHashTable *sums = g_hash_table_new_full(g_str_hash, g_str_equal, g_free, g_free);
+	GPtrArray *keys = g_ptr_array_new(); /* the keys of .sums in the order they were seen */
+	GArray *records = g_array_new(FALSE, FALSE, sizeof(chassis_stats_shm_record_t));
+	GString *merged, *key;
+	gchar *line, *line_end;
+	guint ndx, i;
+
+	for (ndx = 0; ndx < prefork->n_workers; ndx++) {
+		if ((gint)ndx == prefork->ndx) continue;
+
+		if (0 == g_atomic_int_get(&(chassis_prefork_get_slot(prefork, ndx)->pid))) continue;
+
+		if (!chassis_prefork_read(prefork, ndx, records, NULL)) {
+			g_debug("%s: worker %u kept updating its metrics, skipping it", G_STRLOC, ndx);
+			continue;
+		}
+
+		for (i = 0; i < records->len; i++) {
+			chassis_stats_shm_record_t *record = &g_array_index(records, chassis_stats_shm_record_t, i);
+			chassis_prefork_sum_t *sum;
+
+			if (NULL == (sum = g_hash_table_lookup(sums, record->key))) {
+				gchar *record_key = g_strdup(record->key);
+
+				sum = g_new0(chassis_prefork_sum_t, 1);
+				g_hash_table_insert(sums, record_key, sum);
+				g_ptr_array_add(keys, record_key);
+			}
+			sum->value += record->value;
+		}
+	}
+	g_array_free(records, TRUE);
+
+	if (keys->len == 0) {
+		g_ptr_array_free(keys, TRUE);
+		g_hash_table_destroy(sums);
+		return;
+	}
+
+	merged = g_string_sized_new(out->len + 1024);
+	key = g_string_new(NULL);
+
+	for (line = out->str; *line; line = line_end + 1) {
+		chassis_prefork_sum_t *sum;
+		gchar *space;
+
+		if (NULL == (line_end = strchr(line, '\n'))) break;
+
+		/* the value is after the last space, the labels may contain some */
+		for (space = line_end - 1; space > line && *space != ' '; space--);
+
+		if (*line != '#' && space != line) {
+			g_string_assign_len(key, line, space - line);
+
+			if (NULL != (sum = g_hash_table_lookup(sums, key->str))) {
+				g_string_append_printf(merged, "%s %.15g\n", key->str, g_ascii_strtod(space + 1, NULL) + sum->value);
+				sum->is_merged = TRUE;
+				continue;
+			}
+		}
+
+		g_string_append_len(merged, line, line_end - line + 1);
+	}
+
+	for (i = 0; i < keys->len; i++) {
+		chassis_prefork_sum_t *sum = g_hash_table_lookup(sums, keys->pdata[i]);
+
+		if (!sum->is_merged) g_string_append_printf(merged, "%s %.15g\n", (gchar *)keys->pdata[i], sum->value);
+	}
+
+	g_string_truncate(out, 0);
+	g_string_append_len(out, merged->str, merged->len);
+
+	g_string_free(key, TRUE);
+	g_string_free(merged, TRUE);
+	g_ptr_array_free(keys, TRUE);
+	g_hash_table_destroy(sums);
+}
@@ -0,0 +1,87 @@
+/* $%BEGINLICENSE%$
+ Copyright (c) 2008, 2012, Oracle and/or its affiliates. All rights reserved.
+
+ This program is free software; you can redistribute it and/or
+ modify it under the terms of the GNU General Public License as
+ published by the Free Software Foundation; version 2 of the
+ License.
+
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ GNU General Public License for more details.
+
+ You should have received a copy of the GNU General Public License
+ along with this program; if not, write to the Free Software
+ Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA
+ 02110-1301  USA
+
+ $%ENDLICENSE%$ */
+#ifndef _CHASSIS_PREFORK_H_
+#define _CHASSIS_PREFORK_H_
+
+#include <glib.h>
+
+#include "chassis-exports.h"
+#include "chassis-metrics.h"
+#include "chassis-stats-shm.h"
+
+/**
+ * the worker processes of --worker-processes
+ *
+ * the master maps a shared, anonymous segment before it forks the workers, see
+ * chassis_unix_proc_prefork(). Each worker has a slot in it: its pid, how often it was
+ * restarted and a stats segment it publishes its metrics in every --stats-shm-interval
+ * milliseconds, see chassis-stats-shm.h. A worker reads the slots of the others to show
+ * all of them, e.g. the /metrics of worker 0 are the sums of all workers.
+ *
+ * the workers share nothing else: each one has its own event-threads, listen sockets
+ * (SO_REUSEPORT), backends and Lua states. A worker that crashes takes only its own
+ * connections down.
+ */
+
+#define CHASSIS_PREFORK_MAX_WORKERS 64
+
+/**
+ * the samples a worker can publish
+ */
+#define CHASSIS_PREFORK_SLOT_CAPACITY 1024
+
+typedef struct {
+	volatile gint pid;       /**< of the worker, 0 if it never started */
+	volatile gint restarts;  /**< how often the worker was started again after it crashed */
+	guint64 started_at;      /**< unix-time in microseconds of the last start */
+	guint32 _pad[12];        /**< the stats segment starts on the next cache-line */
+} chassis_prefork_slot_t;
+
+typedef struct {
+	guint n_workers;
+	gint ndx;                /**< the worker we are, -1 in the master */
+
+	gpointer addr;           /**< the shared mapping */
+	gsize size;
+	gsize slot_size;         /**< a chassis_prefork_slot_t and its stats segment */
+
+	chassis_stats_shm_t *stats; /**< our stats segment, NULL in the master */
+} chassis_prefork_t;
+
+CHASSIS_API chassis_prefork_t *chassis_prefork_new(guint n_workers, GError **gerr);
+CHASSIS_API void chassis_prefork_free(chassis_prefork_t *prefork);
+
+CHASSIS_API void chassis_prefork_attach(chassis_prefork_t *prefork, guint ndx);
+CHASSIS_API void chassis_prefork_start(chassis_prefork_t *prefork, struct event_base *event_base, chassis_metrics_t *metrics, guint interval_ms);
+
+CHASSIS_API chassis_prefork_slot_t *chassis_prefork_get_slot(chassis_prefork_t *prefork, guint ndx);
+CHASSIS_API gboolean chassis_prefork_read(chassis_prefork_t *prefork, guint ndx, GArray *records, guint64 *updated_at);
+CHASSIS_API void chassis_prefork_merge_metrics(chassis_metrics_t *metrics, GString *out, gpointer user_data);
+
+#define CHASSIS_PREFORK_ERROR chassis_prefork_error()
+CHASSIS_API GQuark chassis_prefork_error(void);
+
+typedef enum {
+	CHASSIS_PREFORK_ERROR_WORKERS,    /**< too few or too many workers */
+	CHASSIS_PREFORK_ERROR_MAP,        /**< mmap() failed */
+	CHASSIS_PREFORK_ERROR_UNSUPPORTED /**< no fork() and mmap() on this platform */
+} chassis_prefork_error_t;
+
+#endif
@@ -0,0 +1,388 @@
+/* $%BEGINLICENSE%$
+ Copyright (c) 2008, 2012, Oracle and/or its affiliates. All rights reserved.
+
+ This program is free software; you can redistribute it and/or
+ modify it under the terms of the GNU General Public License as
+ published by the Free Software Foundation; version 2 of the
+ License.
+
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ GNU General Public License for more details.
+
+ You should have received a copy of the GNU General Public License
+ along with this program; if not, write to the Free Software
+ Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA
+ 02110-1301  USA
+
+ $%ENDLICENSE%$ */
+/**
+ * the metrics in a shared-memory segment
+ *
+ * @see chassis-stats-shm.h
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <string.h>
+#include <errno.h>
+#include <stdlib.h>
+#include <fcntl.h>
+
+#ifndef _WIN32
+#include <sys/mman.h>
+#include <unistd.h>
+#else
+#include <process.h>
+#define getpid _getpid
+#endif
+
+#include <glib.h>
+#include <glib/gstdio.h>
+
+#include "chassis-stats-shm.h"
+
+/**
+ * a reader gives up if the proxy updates the segment this often while it copies
+ */
+#define CHASSIS_STATS_SHM_READ_RETRIES 100
+
+GQuark chassis_stats_shm_error(void) {
+	return g_quark_from_static_string("chassis-stats-shm-error-quark");
+}
+
+static chassis_stats_shm_record_t *chassis_stats_shm_get_records(chassis_stats_shm_t *shm) {
+	return (chassis_stats_shm_record_t *)(shm->header + 1);
+}
+
+#ifndef _WIN32
+/**
+ * create the segment for the proxy to publish its metrics in
+ *
+ * a existing file is truncated, readers that still map it see it go away and have to
+ * open it again
+ */
+chassis_stats_shm_t *chassis_stats_shm_create(const gchar *filename, GError **gerr) {
+	chassis_stats_shm_t *shm;
+	gpointer addr;
+	gsize size;
+	int fd;
+
+	size = sizeof(chassis_stats_shm_header_t) + CHASSIS_STATS_SHM_CAPACITY * sizeof(chassis_stats_shm_record_t);
+
+	if (-1 == (fd = open(filename, O_RDWR | O_CREAT | O_TRUNC, 0644))) {
+		g_set_error(gerr,
+				CHASSIS_STATS_SHM_ERROR,
+				CHASSIS_STATS_SHM_ERROR_FILE,
+				"opening --stats-shm-file %s failed: %s",
+				filename, g_strerror(errno));
+		return NULL;
+	}
+
+	if (0 != ftruncate(fd, size)) {
+		g_set_error(gerr,
+				CHASSIS_STATS_SHM_ERROR,
+				CHASSIS_STATS_SHM_ERROR_FILE,
+				"resizing --stats-shm-file %s failed: %s",
+				filename, g_strerror(errno));
+		close(fd);
+		return NULL;
+	}
+
+	if (MAP_FAILED == (addr = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0))) {
+		g_set_error(gerr,
+				CHASSIS_STATS_SHM_ERROR,
+				CHASSIS_STATS_SHM_ERROR_FILE,
+				"mapping --stats-shm-file %s failed: %s",
+				filename, g_strerror(errno));
+		close(fd);
+		return NULL;
+	}
+
+	shm = g_new0(chassis_stats_shm_t, 1);
+	shm->filename = g_strdup(filename);
+	shm->is_writer = TRUE;
+	shm->fd = fd;
+	shm->header = addr;
+	shm->size = size;
+	shm->rendered = g_string_sized_new(64 * 1024);
+
+	/* ftruncate() zero-filled it, the magic goes last to not let a reader see a half-initialized header */
+	shm->header->version = CHASSIS_STATS_SHM_VERSION;
+	shm->header->pid = getpid();
+	shm->header->capacity = CHASSIS_STATS_SHM_CAPACITY;
+	g_atomic_int_set((gint *)&(shm->header->magic), CHASSIS_STATS_SHM_MAGIC);
+
+	return shm;
+}
+
+/**
+ * map the segment of a proxy read-only
+ */
+chassis_stats_shm_t *chassis_stats_shm_open(const gchar *filename, GError **gerr) {
+	chassis_stats_shm_t *shm;
+	chassis_stats_shm_header_t *header;
+	struct stat st;
+	gpointer addr;
+	int fd;
+
+	if (-1 == (fd = open(filename, O_RDONLY))) {
+		g_set_error(gerr,
+				CHASSIS_STATS_SHM_ERROR,
+				CHASSIS_STATS_SHM_ERROR_FILE,
+				"opening %s failed: %s",
+				filename, g_strerror(errno));
+		return NULL;
+	}
+
+	if (0 != fstat(fd, &st) || (gsize)st.st_size < sizeof(chassis_stats_shm_header_t)) {
+		g_set_error(gerr,
+				CHASSIS_STATS_SHM_ERROR,
+				CHASSIS_STATS_SHM_ERROR_FORMAT,
+				"%s is too small for a stats segment",
+				filename);
+		close(fd);
+		return NULL;
+	}
+
+	if (MAP_FAILED == (addr = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0))) {
+		g_set_error(gerr,
+				CHASSIS_STATS_SHM_ERROR,
+				CHASSIS_STATS_SHM_ERROR_FILE,
+				"mapping %s failed: %s",
+				filename, g_strerror(errno));
+		close(fd);
+		return NULL;
+	}
+
+	header = addr;
+	if (header->magic != CHASSIS_STATS_SHM_MAGIC ||
+	    header->version != CHASSIS_STATS_SHM_VERSION ||
+	    sizeof(chassis_stats_shm_header_t) + (gsize)header->capacity * sizeof(chassis_stats_shm_record_t) > (gsize)st.st_size) {
+		g_set_error(gerr,
+				CHASSIS_STATS_SHM_ERROR,
+				CHASSIS_STATS_SHM_ERROR_FORMAT,
+				"%s isn't a stats segment of version %d",
+				filename, CHASSIS_STATS_SHM_VERSION);
+		munmap(addr, st.st_size);
+		close(fd);
+		return NULL;
+	}
+
+	shm = g_new0(chassis_stats_shm_t, 1);
+	shm->filename = g_strdup(filename);
+	shm->fd = fd;
+	shm->header = header;
+	shm->size = st.st_size;
+
+	return shm;
+}
+
+void chassis_stats_shm_free(chassis_stats_shm_t *shm) {
+	if (!shm) return;
+
+	if (shm->ev_is_set) event_del(&(shm->ev));
+
+	if (shm->fd != -1) {
+		munmap((gpointer)shm->header, shm->size);
+		close(shm->fd);
+
+		if (shm->is_writer) g_unlink(shm->filename);
+	}
+
+	if (shm->rendered) g_string_free(shm->rendered, TRUE);
+	if (shm->filename) g_free(shm->filename);
+
+	g_free(shm);
+}
+#else
+chassis_stats_shm_t *chassis_stats_shm_create(const gchar *filename, GError **gerr) {
+	g_set_error(gerr,
+			CHASSIS_STATS_SHM_ERROR,
+			CHASSIS_STATS_SHM_ERROR_UNSUPPORTED,
+			"--stats-shm-file %s: not supported on win32",
+			filename);
+
+	return NULL;
+}
+
+chassis_stats_shm_t *chassis_stats_shm_open(const gchar *filename, GError **gerr) {
+	g_set_error(gerr,
+			CHASSIS_STATS_SHM_ERROR,
+			CHASSIS_STATS_SHM_ERROR_UNSUPPORTED,
+			"%s: not supported on win32",
+			filename);
+
+	return NULL;
+}
+
+void chassis_stats_shm_free(chassis_stats_shm_t *shm) {
+	if (!shm) return;
+
+	if (shm->rendered) g_string_free(shm->rendered, TRUE);
+
+	g_free(shm);
+}
+#endif
+
+/**
+ * use a segment in a mapping someone else owns
+ *
+ * the mapping outlives the segment and isn't unmapped on free. A writer initializes
+ * the header, the mapping has to be zero-filled.
+ *
+ * @param addr      the start of the segment
+ * @param size      the bytes of the segment, the header and the records that fit
+ * @param is_writer if we publish the samples in it
+ */
+chassis_stats_shm_t *chassis_stats_shm_new_mapped(gpointer addr, gsize size, gboolean is_writer) {
+	chassis_stats_shm_t *shm;
+
+	g_return_val_if_fail(size >= sizeof(chassis_stats_shm_header_t), NULL);
+
+	shm = g_new0(chassis_stats_shm_t, 1);
+	shm->is_writer = is_writer;
+	shm->fd = -1;
+	shm->header = addr;
+	shm->size = size;
+
+	if (is_writer) {
+		shm->rendered = g_string_sized_new(64 * 1024);
+
+		shm->header->version = CHASSIS_STATS_SHM_VERSION;
+		shm->header->pid = getpid();
+		shm->header->capacity = (size - sizeof(chassis_stats_shm_header_t)) / sizeof(chassis_stats_shm_record_t);
+		/* the previous writer may have died while it wrote */
+		if (g_atomic_int_get(&(shm->header->seq)) & 1) g_atomic_int_inc(&(shm->header->seq));
+		g_atomic_int_set((gint *)&(shm->header->magic), CHASSIS_STATS_SHM_MAGIC);
+	}
+
+	return shm;
+}
+
+/**
+ * copy the samples of the metrics into the segment
+ *
+ * the metrics are rendered like for a scrape and each sample line becomes a record.
+ * Samples that don't fit are counted in .n_dropped.
+ */
+void chassis_stats_shm_publish(chassis_stats_shm_t *shm, chassis_metrics_t *metrics) {
+	chassis_stats_shm_header_t *header = shm->header;
+	chassis_stats_shm_record_t *records = chassis_stats_shm_get_records(shm);
+	guint n_records = 0, n_dropped = 0;
+	GTimeVal now;
+	gchar *line, *line_end;
+
+	g_return_if_fail(shm->is_writer);
+
+	g_string_truncate(shm->rendered, 0);
+	chassis_metrics_render(metrics, shm->rendered);
+
+	g_get_current_time(&now);
+
+	g_atomic_int_inc(&(header->seq)); /* odd: we are writing */
+
+	for (line = shm->rendered->str; *line; line = line_end + 1) {
+		gchar *space;
+		gsize key_len;
+
+		if (NULL == (line_end = strchr(line, '\n'))) break;
+
+		if (*line == '#') continue;
+
+		/* the value is after the last space, the labels may contain some */
+		for (space = line_end - 1; space > line && *space != ' '; space--);
+		if (space == line) continue;
+
+		key_len = space - line;
+		if (key_len >= CHASSIS_STATS_SHM_KEY_LEN || n_records >= header->capacity) {
+			n_dropped++;
+			continue;
+		}
+
+		memcpy(records[n_records].key, line, key_len);
+		records[n_records].key[key_len] = '\0';
+		records[n_records].value = g_ascii_strtod(space + 1, NULL);
+		n_records++;
+	}
+
+	header->n_records = n_records;
+	header->n_dropped = n_dropped;
+	header->updated_at = (guint64)now.tv_sec * G_USEC_PER_SEC + now.tv_usec;
+
+	g_atomic_int_inc(&(header->seq)); /* even: done */
+}
+
+static void chassis_stats_shm_timer(int G_GNUC_UNUSED fd, short G_GNUC_UNUSED events, void *user_data) {
+	chassis_stats_shm_t *shm = user_data;
+	struct timeval interval;
+
+	chassis_stats_shm_publish(shm, shm->metrics);
+
+	interval.tv_sec = shm->interval_ms / 1000;
+	interval.tv_usec = (shm->interval_ms % 1000) * 1000;
+
+	evtimer_add(&(shm->ev), &interval);
+}
+
+/**
+ * publish the metrics now and then every interval_ms milliseconds from the event-base
+ */
+void chassis_stats_shm_start(chassis_stats_shm_t *shm, struct event_base *event_base, chassis_metrics_t *metrics, guint interval_ms) {
+	shm->metrics = metrics;
+	shm->interval_ms = MAX(interval_ms, 1);
+
+	evtimer_set(&(shm->ev), chassis_stats_shm_timer, shm);
+	event_base_set(event_base, &(shm->ev));
+	shm->ev_is_set = TRUE;
+
+	chassis_stats_shm_timer(-1, 0, shm);
+}
+
+/**
+ * copy the samples out of the segment
+ *
+ * @param records     set to the array(chassis_stats_shm_record_t) of the samples
+ * @param updated_at  set to the time of the update in microseconds, may be NULL
+ * @return FALSE if the proxy kept updating the segment while we copied
+ */
+gboolean chassis_stats_shm_read(chassis_stats_shm_t *shm, GArray *records, guint64 *updated_at) {
+	chassis_stats_shm_header_t *header = shm->header;
+	guint max_records = (shm->size - sizeof(chassis_stats_shm_header_t)) / sizeof(chassis_stats_shm_record_t);
+	guint attempt;
+
+	for (attempt = 0; attempt < CHASSIS_STATS_SHM_READ_RETRIES; attempt++) {
+		gint seq = g_atomic_int_get(&(header->seq));
+		guint64 ts;
+		guint n, i;
+
+		if (seq & 1) {
+			g_thread_yield();
+			continue;
+		}
+
+		n = MIN(header->n_records, max_records);
+		ts = header->updated_at;
+
+		g_array_set_size(records, n);
+		memcpy(records->data, chassis_stats_shm_get_records(shm), n * sizeof(chassis_stats_shm_record_t));
+
+		if (g_atomic_int_get(&(header->seq)) != seq) continue;
+
+		/* don't trust the terminators of a file we didn't write */
+		for (i = 0; i < n; i++) {
+			g_array_index(records, chassis_stats_shm_record_t, i).key[CHASSIS_STATS_SHM_KEY_LEN - 1] = '\0';
+		}
+
+		if (updated_at) *updated_at = ts;
+
+		return TRUE;
+	}
+
+	return FALSE;
+}
@@ -0,0 +1,106 @@
+/* $%BEGINLICENSE%$
+ Copyright (c) 2008, 2012, Oracle and/or its affiliates. All rights reserved.
+
+ This program is free software; you can redistribute it and/or
+ modify it under the terms of the GNU General Public License as
+ published by the Free Software Foundation; version 2 of the
+ License.
+
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ GNU General Public License for more details.
+
+ You should have received a copy of the GNU General Public License
+ along with this program; if not, write to the Free Software
+ Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA
+ 02110-1301  USA
+
+ $%ENDLICENSE%$ */
+#ifndef _CHASSIS_STATS_SHM_H_
+#define _CHASSIS_STATS_SHM_H_
+
+#include <glib.h>
+
+#include "chassis-exports.h"
+#include "chassis-metrics.h"
+
+/**
+ * the metrics in a shared-memory segment
+ *
+ * the main-thread renders the metrics every --stats-shm-interval milliseconds and
+ * copies their samples into a file that is mmap()ed by the proxy and its readers,
+ * ideally on a tmpfs like /dev/shm. A reader copies the samples out without a syscall
+ * and without asking the proxy for anything, see mysql-proxy-stats.
+ *
+ * the samples are protected by a seqlock: the proxy makes .seq odd before it writes
+ * and even again after it is done. A reader retries if .seq was odd or changed while
+ * it copied.
+ *
+ * the layout only changes with CHASSIS_STATS_SHM_VERSION.
+ */
+
+#define CHASSIS_STATS_SHM_MAGIC   0x5358504d /* "MPXS" */
+#define CHASSIS_STATS_SHM_VERSION 1
+
+/**
+ * the samples the segment has room for
+ */
+#define CHASSIS_STATS_SHM_CAPACITY 4096
+
+/**
+ * a sample as it is rendered: <name> or <name>{<labels>}
+ */
+#define CHASSIS_STATS_SHM_KEY_LEN  248
+
+typedef struct {
+	guint32 magic;
+	guint32 version;
+	volatile gint seq;       /**< odd while the proxy writes the samples */
+	guint32 pid;             /**< of the proxy */
+	guint64 updated_at;      /**< unix-time in microseconds of the last update */
+	guint32 capacity;        /**< records after the header */
+	guint32 n_records;       /**< records in use */
+	guint32 n_dropped;       /**< samples that didn't fit or whose key was too long */
+	guint32 _pad[7];         /**< the records start on the next cache-line */
+} chassis_stats_shm_header_t;
+
+typedef struct {
+	gdouble value;
+	gchar key[CHASSIS_STATS_SHM_KEY_LEN]; /**< \0-terminated */
+} chassis_stats_shm_record_t;
+
+typedef struct {
+	gchar *filename;         /**< NULL if the segment is part of a mapping of someone else */
+	gboolean is_writer;      /**< we publish the samples, a file we created is unlinked on free */
+
+	int fd;                  /**< -1 if the segment is part of a mapping of someone else */
+	chassis_stats_shm_header_t *header;
+	gsize size;
+
+	chassis_metrics_t *metrics;
+	GString *rendered;
+	guint interval_ms;
+	struct event ev;
+	gboolean ev_is_set;
+} chassis_stats_shm_t;
+
+CHASSIS_API chassis_stats_shm_t *chassis_stats_shm_create(const gchar *filename, GError **gerr);
+CHASSIS_API chassis_stats_shm_t *chassis_stats_shm_open(const gchar *filename, GError **gerr);
+CHASSIS_API chassis_stats_shm_t *chassis_stats_shm_new_mapped(gpointer addr, gsize size, gboolean is_writer);
+CHASSIS_API void chassis_stats_shm_free(chassis_stats_shm_t *shm);
+
+CHASSIS_API void chassis_stats_shm_publish(chassis_stats_shm_t *shm, chassis_metrics_t *metrics);
+CHASSIS_API void chassis_stats_shm_start(chassis_stats_shm_t *shm, struct event_base *event_base, chassis_metrics_t *metrics, guint interval_ms);
+CHASSIS_API gboolean chassis_stats_shm_read(chassis_stats_shm_t *shm, GArray *records, guint64 *updated_at);
+
+#define CHASSIS_STATS_SHM_ERROR chassis_stats_shm_error()
+CHASSIS_API GQuark chassis_stats_shm_error(void);
+
+typedef enum {
+	CHASSIS_STATS_SHM_ERROR_FILE,     /**< open(), ftruncate() or mmap() failed */
+	CHASSIS_STATS_SHM_ERROR_FORMAT,   /**< the file isn't a segment of this version */
+	CHASSIS_STATS_SHM_ERROR_UNSUPPORTED /**< no mmap() on this platform */
+} chassis_stats_shm_error_t;
+
+#endif
@@ -23,8 +23,11 @@
 #include "config.h"
 #endif
 
+#include <string.h>
+
 #include <glib.h>
 #include "chassis-stats.h"
+#include "chassis-event-thread.h"
 
 chassis_stats_t *chassis_global_stats = NULL;
 
@@ -37,6 +40,17 @@ chassis_stats_t * chassis_stats_new(void) {
 	return chassis_global_stats;
 }
 
+/**
+ * get the shard of the current event-thread
+ *
+ * @return the shard, NULL if there are no global stats
+ */
+chassis_stats_shard_t *chassis_stats_get_local_shard(void) {
+	if (NULL == chassis_global_stats) return NULL;
+
+	return &(chassis_global_stats->shards[chassis_event_thread_get_local_index() % CHASSIS_STATS_SHARDS]);
+}
+
 void chassis_stats_free(chassis_stats_t *stats) {
 	if (!stats) return;
 	
@@ -49,17 +63,34 @@ void chassis_stats_free(chassis_stats_t *stats) {
 	}
 }
 
+/**
+ * sum up the shards
+ *
+ * lua_mem_bytes_max is the sum of the max of each shard, the upper bound of the global max
+ */
 GHashTable* chassis_stats_get(chassis_stats_t *stats){
 	GHashTable *stats_hash;
+	chassis_stats_shard_t sum;
+	guint i;
 	
 	if (stats == NULL) return NULL;
+
+	memset(&sum, 0, sizeof(sum));
+	for (i = 0; i < CHASSIS_STATS_SHARDS; i++) {
+		chassis_stats_shard_t *shard = &(stats->shards[i]);
+
+		sum.lua_mem_alloc     += shard->lua_mem_alloc;
+		sum.lua_mem_free      += shard->lua_mem_free;
+		sum.lua_mem_bytes     += shard->lua_mem_bytes;
+		sum.lua_mem_bytes_max += shard->lua_mem_bytes_max;
+	}
 	
 	/* NOTE: the keys are strdup'ed, the values are simply integers */
 	stats_hash = g_hash_table_new_full(g_str_hash, g_str_equal, g_free, NULL);
 
 #define STR(x) #x
 #define N(x) g_strdup(x)
-#define ADD_STAT(x) g_hash_table_insert(stats_hash, N( STR(x)), GUINT_TO_POINTER(g_atomic_int_get(&(stats->x))))
+#define ADD_STAT(x) g_hash_table_insert(stats_hash, N( STR(x)), GUINT_TO_POINTER((guint)sum.x))
 #define ADD_ALLOC_STAT(x) ADD_STAT(x ## _alloc); ADD_STAT(x ## _free);
 	
 	ADD_ALLOC_STAT(lua_mem);
@@ -74,3 +105,24 @@ GHashTable* chassis_stats_get(chassis_stats_t *stats){
 	return stats_hash;
 }
 
+/**
+ * the collector of the lua memory stats
+ */
+void chassis_stats_collect_metrics(chassis_metrics_t G_GNUC_UNUSED *metrics, GString *out, gpointer user_data) {
+	chassis_stats_t *stats = user_data;
+	gint64 allocs = 0, frees = 0, bytes = 0;
+	guint i;
+
+	for (i = 0; i < CHASSIS_STATS_SHARDS; i++) {
+		allocs += stats->shards[i].lua_mem_alloc;
+		frees  += stats->shards[i].lua_mem_free;
+		bytes  += stats->shards[i].lua_mem_bytes;
+	}
+
+	chassis_metrics_append_header(out, "mysql_proxy_lua_mem_allocs_total", "Allocations of the Lua states", CHASSIS_METRIC_COUNTER);
+	chassis_metrics_append_value(out, "mysql_proxy_lua_mem_allocs_total", NULL, allocs);
+	chassis_metrics_append_header(out, "mysql_proxy_lua_mem_frees_total", "Frees of the Lua states", CHASSIS_METRIC_COUNTER);
+	chassis_metrics_append_value(out, "mysql_proxy_lua_mem_frees_total", NULL, frees);
+	chassis_metrics_append_header(out, "mysql_proxy_lua_mem_bytes", "Bytes allocated by the Lua states", CHASSIS_METRIC_GAUGE);
+	chassis_metrics_append_value(out, "mysql_proxy_lua_mem_bytes", NULL, bytes);
+}
@@ -24,31 +24,54 @@
 
 #include <glib.h>
 #include "chassis-exports.h"
+#include "chassis-metrics.h"
 
+/**
+ * shards of the stats, the event-thread with index n writes to shard n % CHASSIS_STATS_SHARDS
+ */
+#define CHASSIS_STATS_SHARDS 64
+
+typedef struct {
+	gint64 lua_mem_alloc;
+	gint64 lua_mem_free;
+	gint64 lua_mem_bytes;     /**< may be negative if a other thread frees what this thread allocated */
+	gint64 lua_mem_bytes_max; /**< the max of .lua_mem_bytes of this shard */
+
+	gint64 _pad[4]; /**< keep the shards of the event-threads on their own cache-lines */
+} chassis_stats_shard_t;
+
+/**
+ * the global stats of the chassis
+ *
+ * each event-thread only writes to its own shard without atomics, readers sum them up
+ */
 typedef struct chassis_stats {
-	volatile gint lua_mem_alloc;
-	volatile gint lua_mem_free;
-	volatile gint lua_mem_bytes;
-	volatile gint lua_mem_bytes_max;
+	chassis_stats_shard_t shards[CHASSIS_STATS_SHARDS];
 } chassis_stats_t;
 
 CHASSIS_API chassis_stats_t *chassis_global_stats;
 
 CHASSIS_API chassis_stats_t * chassis_stats_new(void);
 CHASSIS_API void chassis_stats_free(chassis_stats_t *stats);
+CHASSIS_API chassis_stats_shard_t *chassis_stats_get_local_shard(void);
 
 CHASSIS_API GHashTable* chassis_stats_get(chassis_stats_t *user_data);
+CHASSIS_API void chassis_stats_collect_metrics(chassis_metrics_t *metrics, GString *out, gpointer user_data);
 
-#define CHASSIS_STATS_ALLOC_INC_NAME(name) ((chassis_global_stats != NULL) ? g_atomic_int_inc(&(chassis_global_stats->name ## _alloc)) : (void)0)
-#define CHASSIS_STATS_FREE_INC_NAME(name) ((chassis_global_stats != NULL) ? g_atomic_int_inc(&(chassis_global_stats->name ## _free)) : (void)0)
+#define CHASSIS_STATS_ALLOC_INC_NAME(name) do { chassis_stats_shard_t *__shard = chassis_stats_get_local_shard(); if (__shard) __shard->name ## _alloc++; } while (0)
+#define CHASSIS_STATS_FREE_INC_NAME(name) do { chassis_stats_shard_t *__shard = chassis_stats_get_local_shard(); if (__shard) __shard->name ## _free++; } while (0)
 
-/* the prototype of g_atomic_int_add() changed in 2.30.0 to
- * return a gint instead of nothing (void)
+/**
+ * add to a gauge of the local shard and track its max
  */
-#if GLIB_CHECK_VERSION(2, 30, 0)
-#define CHASSIS_STATS_ADD_NAME(name, addme) ((chassis_global_stats != NULL) ? g_atomic_int_add(&(chassis_global_stats->name), addme) : 0)
-#else
-#define CHASSIS_STATS_ADD_NAME(name, addme) ((chassis_global_stats != NULL) ? g_atomic_int_add(&(chassis_global_stats->name), addme) : (void)0)
+#define CHASSIS_STATS_ADD_NAME(name, addme) do { \
+	chassis_stats_shard_t *__shard = chassis_stats_get_local_shard(); \
+	if (__shard) { \
+		__shard->name += (addme); \
+		if (__shard->name > __shard->name ## _max) __shard->name ## _max = __shard->name; \
+	} \
+} while (0)
+
 #endif
 #define CHASSIS_STATS_GET_NAME(name) ((chassis_global_stats != NULL) ? g_atomic_int_get(&(chassis_global_stats->name)) : 0)
 #define CHASSIS_STATS_SET_NAME(name, setme) ((chassis_global_stats != NULL) ? g_atomic_int_set(&(chassis_global_stats->name), setme) : (void)0)
@@ -0,0 +1,300 @@
+/* $%BEGINLICENSE%$
+ Copyright (c) 2008, 2012, Oracle and/or its affiliates. All rights reserved.
+
+ This program is free software; you can redistribute it and/or
+ modify it under the terms of the GNU General Public License as
+ published by the Free Software Foundation; version 2 of the
+ License.
+
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ GNU General Public License for more details.
+
+ You should have received a copy of the GNU General Public License
+ along with this program; if not, write to the Free Software
+ Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA
+ 02110-1301  USA
+
+ $%ENDLICENSE%$ */
+/**
+ * a hierarchical timing wheel
+ *
+ * the wheel isn't thread-safe, each event-thread has its own. The ticks are driven by a
+ * single libevent timer which is only armed while the wheel has timers. It fires at the
+ * next tick with a timer in the lowest level or when the lowest level wraps around and
+ * the next slot of the level above has to be moved down.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <string.h>
+
+#include "chassis-timer-wheel.h"
+#include "chassis-timings.h"
+
+#define SLOT_MASK (CHASSIS_TIMER_WHEEL_SLOTS - 1)
+
+/* the ticks covered by the levels 0 .. n */
+#define LEVEL_SPAN(n) (G_GUINT64_CONSTANT(1) << (CHASSIS_TIMER_WHEEL_SLOT_BITS * ((n) + 1)))
+
+/* the slot of tick t in level n */
+#define LEVEL_SLOT(t, n) (((t) >> (CHASSIS_TIMER_WHEEL_SLOT_BITS * (n))) & SLOT_MASK)
+
+static void chassis_timer_wheel_schedule(chassis_timer_wheel_t *wheel, guint64 now_ms);
+
+static void chassis_timer_wheel_tick(int G_GNUC_UNUSED event_fd, short G_GNUC_UNUSED events, void *user_data) {
+	chassis_timer_wheel_t *wheel = user_data;
+
+	wheel->tick_is_pending = FALSE;
+
+	chassis_coarse_clock_update();
+	chassis_timer_wheel_run(wheel, chassis_get_coarse_rel_milliseconds());
+}
+
+/**
+ * create a timing wheel
+ *
+ * @param event_base the event-base that runs the ticks, NULL to call chassis_timer_wheel_run() by hand
+ */
+chassis_timer_wheel_t *chassis_timer_wheel_new(struct event_base *event_base) {
+	chassis_timer_wheel_t *wheel;
+	guint level, slot;
+
+	wheel = g_new0(chassis_timer_wheel_t, 1);
+	for (level = 0; level < CHASSIS_TIMER_WHEEL_LEVELS; level++) {
+		for (slot = 0; slot < CHASSIS_TIMER_WHEEL_SLOTS; slot++) {
+			g_queue_init(&(wheel->slots[level][slot]));
+		}
+	}
+
+	wheel->event_base = event_base;
+	if (event_base) {
+		evtimer_set(&(wheel->tick_event), chassis_timer_wheel_tick, wheel);
+		event_base_set(event_base, &(wheel->tick_event));
+	}
+
+	return wheel;
+}
+
+/**
+ * free the wheel
+ *
+ * the timers that are still armed are disarmed without being called
+ */
+void chassis_timer_wheel_free(chassis_timer_wheel_t *wheel) {
+	guint level, slot;
+
+	if (!wheel) return;
+
+	if (wheel->tick_is_pending) event_del(&(wheel->tick_event));
+
+	for (level = 0; level < CHASSIS_TIMER_WHEEL_LEVELS; level++) {
+		for (slot = 0; slot < CHASSIS_TIMER_WHEEL_SLOTS; slot++) {
+			GList *link;
+
+			while ((link = g_queue_pop_head_link(&(wheel->slots[level][slot])))) {
+				chassis_timer_wheel_timer_t *timer = link->data;
+
+				timer->wheel = NULL;
+				timer->slot = NULL;
+			}
+		}
+	}
+
+	g_free(wheel);
+}
+
+/**
+ * put the timer into the slot of its expiry
+ */
+static void chassis_timer_wheel_insert(chassis_timer_wheel_t *wheel, chassis_timer_wheel_timer_t *timer) {
+	guint64 delta;
+	guint level;
+
+	if (timer->expires < wheel->now) {
+		/* already due, run it with the next tick */
+		timer->expires = wheel->now;
+	}
+
+	delta = timer->expires - wheel->now;
+
+	if (delta >= LEVEL_SPAN(CHASSIS_TIMER_WHEEL_LEVELS - 1)) {
+		/* beyond the wheel, wait at its end and try again from there */
+		timer->is_clamped = TRUE;
+		timer->real_expires = timer->expires;
+		timer->expires = wheel->now + LEVEL_SPAN(CHASSIS_TIMER_WHEEL_LEVELS - 1) - 1;
+		delta = timer->expires - wheel->now;
+	}
+
+	for (level = 0; level < CHASSIS_TIMER_WHEEL_LEVELS - 1; level++) {
+		if (delta < LEVEL_SPAN(level)) break;
+	}
+
+	timer->slot = &(wheel->slots[level][LEVEL_SLOT(timer->expires, level)]);
+	timer->link.data = timer;
+	g_queue_push_tail_link(timer->slot, &(timer->link));
+}
+
+/**
+ * arm a timer
+ *
+ * a armed timer is removed first
+ *
+ * @param now_ms     the current time in chassis_get_coarse_rel_milliseconds()
+ * @param timeout_ms the timer expires in <timeout_ms> milliseconds
+ */
+void chassis_timer_wheel_add(chassis_timer_wheel_t *wheel, chassis_timer_wheel_timer_t *timer,
+		guint64 now_ms, guint64 timeout_ms,
+		chassis_timer_wheel_func func, gpointer user_data) {
+	if (timer->wheel) chassis_timer_wheel_remove(timer);
+
+	if (wheel->count == 0) {
+		/* nothing is waiting for the old ticks, skip them */
+		wheel->now = now_ms / CHASSIS_TIMER_WHEEL_TICK_MS;
+	}
+
+	timer->wheel = wheel;
+	timer->func = func;
+	timer->user_data = user_data;
+	timer->is_clamped = FALSE;
+	/* round up, the timer may fire late, but never early */
+	timer->expires = (now_ms + timeout_ms + CHASSIS_TIMER_WHEEL_TICK_MS - 1) / CHASSIS_TIMER_WHEEL_TICK_MS;
+
+	chassis_timer_wheel_insert(wheel, timer);
+	wheel->count++;
+
+	if (wheel->event_base && (!wheel->tick_is_pending || timer->expires < wheel->tick_at)) {
+		chassis_timer_wheel_schedule(wheel, now_ms);
+	}
+}
+
+/**
+ * disarm a timer
+ *
+ * a timer that isn't armed is ignored
+ */
+void chassis_timer_wheel_remove(chassis_timer_wheel_timer_t *timer) {
+	chassis_timer_wheel_t *wheel = timer->wheel;
+
+	if (!wheel) return;
+
+	g_queue_unlink(timer->slot, &(timer->link));
+
+	timer->wheel = NULL;
+	timer->slot = NULL;
+	wheel->count--;
+}
+
+gboolean chassis_timer_wheel_timer_is_armed(chassis_timer_wheel_timer_t *timer) {
+	return timer->wheel != NULL;
+}
+
+/**
+ * move the timers of a slot down a level
+ */
+static void chassis_timer_wheel_cascade(chassis_timer_wheel_t *wheel, guint level) {
+	GQueue *slot = &(wheel->slots[level][LEVEL_SLOT(wheel->now, level)]);
+	GList *link;
+
+	while ((link = g_queue_pop_head_link(slot))) {
+		chassis_timer_wheel_insert(wheel, link->data);
+	}
+}
+
+/**
+ * run the ticks up to now and call the timers that expired
+ *
+ * @param now_ms the current time in chassis_get_coarse_rel_milliseconds()
+ */
+void chassis_timer_wheel_run(chassis_timer_wheel_t *wheel, guint64 now_ms) {
+	guint64 now_tick = now_ms / CHASSIS_TIMER_WHEEL_TICK_MS;
+
+	while (wheel->count > 0 && wheel->now <= now_tick) {
+		GQueue expired = G_QUEUE_INIT;
+		GQueue *slot;
+		GList *link;
+		guint level;
+
+		/* level 0 wrapped around: fetch the next slot of level 1, and so on */
+		for (level = 1; level < CHASSIS_TIMER_WHEEL_LEVELS; level++) {
+			if (LEVEL_SLOT(wheel->now, level - 1) != 0) break;
+
+			chassis_timer_wheel_cascade(wheel, level);
+		}
+
+		/* the callbacks may remove the other timers of the slot */
+		slot = &(wheel->slots[0][LEVEL_SLOT(wheel->now, 0)]);
+		expired = *slot;
+		g_queue_init(slot);
+		for (link = expired.head; link; link = link->next) {
+			chassis_timer_wheel_timer_t *timer = link->data;
+
+			timer->slot = &expired;
+		}
+
+		/* timers added by the callbacks go to the next tick at the earliest */
+		wheel->now++;
+
+		while ((link = g_queue_pop_head_link(&expired))) {
+			chassis_timer_wheel_timer_t *timer = link->data;
+
+			if (timer->is_clamped) {
+				/* we only waited at the end of the wheel, wait for the rest */
+				timer->is_clamped = FALSE;
+				timer->expires = timer->real_expires;
+				chassis_timer_wheel_insert(wheel, timer);
+				continue;
+			}
+
+			timer->wheel = NULL;
+			timer->slot = NULL;
+			wheel->count--;
+
+			timer->func(timer, timer->user_data);
+		}
+	}
+
+	if (wheel->count == 0) {
+		wheel->now = now_tick + 1;
+	} else if (wheel->event_base && !wheel->tick_is_pending) {
+		chassis_timer_wheel_schedule(wheel, now_ms);
+	}
+}
+
+/**
+ * set the libevent timer to the next tick with something to do
+ *
+ * that is the next timer in level 0 or the wrap-around of level 0, whatever comes first
+ */
+static void chassis_timer_wheel_schedule(chassis_timer_wheel_t *wheel, guint64 now_ms) {
+	guint64 tick;
+	guint64 wrap_at;
+	guint64 tick_ms;
+	struct timeval tv;
+
+	/* the tick that moves the next slot of level 1 down */
+	wrap_at = (LEVEL_SLOT(wheel->now, 0) == 0) ? wheel->now : (wheel->now | SLOT_MASK) + 1;
+
+	for (tick = wheel->now; tick < wrap_at; tick++) {
+		if (wheel->slots[0][LEVEL_SLOT(tick, 0)].length > 0) break;
+	}
+
+	if (wheel->tick_is_pending) {
+		if (tick >= wheel->tick_at) return;
+
+		event_del(&(wheel->tick_event));
+	}
+
+	tick_ms = tick * CHASSIS_TIMER_WHEEL_TICK_MS;
+	if (tick_ms < now_ms) tick_ms = now_ms;
+
+	tv.tv_sec = (tick_ms - now_ms) / 1000;
+	tv.tv_usec = ((tick_ms - now_ms) % 1000) * 1000;
+
+	evtimer_add(&(wheel->tick_event), &tv);
+	wheel->tick_is_pending = TRUE;
+	wheel->tick_at = tick;
+}
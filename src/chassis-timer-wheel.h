@@ -0,0 +1,110 @@
+/* $%BEGINLICENSE%$
+ Copyright (c) 2008, 2012, Oracle and/or its affiliates. All rights reserved.
+
+ This program is free software; you can redistribute it and/or
+ modify it under the terms of the GNU General Public License as
+ published by the Free Software Foundation; version 2 of the
+ License.
+
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ GNU General Public License for more details.
+
+ You should have received a copy of the GNU General Public License
+ along with this program; if not, write to the Free Software
+ Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA
+ 02110-1301  USA
+
+ $%ENDLICENSE%$ */
+#ifndef _CHASSIS_TIMER_WHEEL_H_
+#define _CHASSIS_TIMER_WHEEL_H_
+
+#include <glib.h>
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#ifdef HAVE_SYS_TIME_H
+#include <sys/time.h>  /* event.h needs struct tm */
+#endif
+#ifdef HAVE_SYS_TYPES_H
+#include <sys/types.h>
+#endif
+#ifdef _WIN32
+#include <winsock2.h>
+#endif
+#include <event.h>     /* struct event */
+
+#include "chassis-exports.h"
+
+/**
+ * a hierarchical timing wheel for the timeouts of a event-thread
+ *
+ * the connections re-arm their read-, write- and connect-timeouts each time they wait for
+ * the network. Adding and removing a timer is O(1) instead of a update of the min-heap of
+ * libevent for each wait.
+ *
+ * the time is split into ticks of CHASSIS_TIMER_WHEEL_TICK_MS. Each level has
+ * CHASSIS_TIMER_WHEEL_SLOTS slots, a slot of level n spans SLOTS^n ticks. A timer goes to
+ * the lowest level that covers its expiry and moves down a level each time the level
+ * below wrapped around. With 4 levels of 64 slots and 10ms the wheel covers 46 hours,
+ * timers further out are clamped to the end of the wheel and re-added when they expire.
+ *
+ * timers never fire early, but up to a tick late.
+ */
+
+#define CHASSIS_TIMER_WHEEL_TICK_MS 10
+#define CHASSIS_TIMER_WHEEL_LEVELS 4
+#define CHASSIS_TIMER_WHEEL_SLOT_BITS 6
+#define CHASSIS_TIMER_WHEEL_SLOTS (1 << CHASSIS_TIMER_WHEEL_SLOT_BITS)
+
+typedef struct chassis_timer_wheel chassis_timer_wheel_t;
+typedef struct chassis_timer_wheel_timer chassis_timer_wheel_timer_t;
+
+/**
+ * called when the timer expired, it is already removed from the wheel and may be added again
+ */
+typedef void (*chassis_timer_wheel_func)(chassis_timer_wheel_timer_t *timer, gpointer user_data);
+
+/**
+ * a timer, embedded in its owner
+ *
+ * a zero'ed timer is not armed
+ */
+struct chassis_timer_wheel_timer {
+	chassis_timer_wheel_t *wheel;       /**< the wheel we are armed on, NULL if not armed */
+	guint64 expires;                    /**< the tick we expire at */
+	gboolean is_clamped;                /**< .expires is the end of the wheel, not the real expiry */
+	guint64 real_expires;               /**< the real expiry if .is_clamped */
+
+	chassis_timer_wheel_func func;
+	gpointer user_data;
+
+	GQueue *slot;                       /**< the slot we are in */
+	GList link;                         /**< our link in the slot */
+};
+
+struct chassis_timer_wheel {
+	GQueue slots[CHASSIS_TIMER_WHEEL_LEVELS][CHASSIS_TIMER_WHEEL_SLOTS];
+
+	guint64 now;                        /**< the next tick to run, all ticks before are done */
+	guint count;                        /**< armed timers */
+
+	struct event_base *event_base;      /**< runs the ticks, NULL if chassis_timer_wheel_run() is called by hand */
+	struct event tick_event;
+	gboolean tick_is_pending;
+	guint64 tick_at;                    /**< the tick .tick_event is set for */
+};
+
+CHASSIS_API chassis_timer_wheel_t *chassis_timer_wheel_new(struct event_base *event_base);
+CHASSIS_API void chassis_timer_wheel_free(chassis_timer_wheel_t *wheel);
+CHASSIS_API void chassis_timer_wheel_add(chassis_timer_wheel_t *wheel, chassis_timer_wheel_timer_t *timer,
+		guint64 now_ms, guint64 timeout_ms,
+		chassis_timer_wheel_func func, gpointer user_data);
+CHASSIS_API void chassis_timer_wheel_remove(chassis_timer_wheel_timer_t *timer);
+CHASSIS_API gboolean chassis_timer_wheel_timer_is_armed(chassis_timer_wheel_timer_t *timer);
+CHASSIS_API void chassis_timer_wheel_run(chassis_timer_wheel_t *wheel, guint64 now_ms);
+
+#endif
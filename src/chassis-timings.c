@@ -61,10 +61,17 @@ chassis_timestamps_t *chassis_timestamps_new(void) {
 	return ts;
 }
 
-void chassis_timestamps_free(chassis_timestamps_t *ts) {
+/**
+ * drop the timestamps, the list can be used again
+ */
+void chassis_timestamps_reset(chassis_timestamps_t *ts) {
 	chassis_timestamp_t *t;
 
 	while ((t = g_queue_pop_head(ts->timestamps))) chassis_timestamp_free(t);
+}
+
+void chassis_timestamps_free(chassis_timestamps_t *ts) {
+	chassis_timestamps_reset(ts);
 	g_queue_free(ts->timestamps);
 	g_free(ts);
 }
@@ -108,6 +115,50 @@ guint64 chassis_get_rel_nanoseconds() {
 	return my_timer_nanoseconds();
 }
 
+typedef struct {
+	guint64 usec; /**< chassis_get_rel_microseconds() */
+	GTimeVal now; /**< g_get_current_time() */
+} chassis_coarse_clock_t;
+
+static GStaticPrivate coarse_clock_key = G_STATIC_PRIVATE_INIT;
+
+void chassis_coarse_clock_update(void) {
+	chassis_coarse_clock_t *clock;
+
+	if (NULL == (clock = g_static_private_get(&coarse_clock_key))) {
+		clock = g_new0(chassis_coarse_clock_t, 1);
+
+		g_static_private_set(&coarse_clock_key, clock, g_free);
+	}
+
+	clock->usec = chassis_get_rel_microseconds();
+	g_get_current_time(&(clock->now));
+}
+
+guint64 chassis_get_coarse_rel_microseconds(void) {
+	chassis_coarse_clock_t *clock = g_static_private_get(&coarse_clock_key);
+
+	return clock ? clock->usec : chassis_get_rel_microseconds();
+}
+
+void chassis_get_coarse_current_time(GTimeVal *tv) {
+	chassis_coarse_clock_t *clock = g_static_private_get(&coarse_clock_key);
+
+	if (clock) {
+		*tv = clock->now;
+	} else {
+		g_get_current_time(tv);
+	}
+}
+
+guint64 chassis_get_coarse_rel_milliseconds(void) {
+	GTimeVal tv;
+
+	chassis_get_coarse_current_time(&tv);
+
+	return (guint64)tv.tv_sec * 1000 + tv.tv_usec / 1000;
+}
+
 
 void chassis_timestamps_global_init(chassis_timestamps_global_t *gl) {
 	chassis_timestamps_global_t *timestamps = gl;
@@ -48,6 +48,7 @@ typedef struct {
 
 CHASSIS_API chassis_timestamps_t *chassis_timestamps_new(void);
 CHASSIS_API void chassis_timestamps_free(chassis_timestamps_t *ts);
+CHASSIS_API void chassis_timestamps_reset(chassis_timestamps_t *ts);
 
 CHASSIS_API void chassis_timestamps_add(chassis_timestamps_t *ts,
 		const char *name,
@@ -88,6 +89,34 @@ CHASSIS_API guint64 chassis_calc_rel_microseconds(guint64 start, guint64 stop);
  */
 CHASSIS_API guint64 chassis_get_rel_nanoseconds();
 
+/**
+ * the coarse clock: the time of the event that is handled, cached per thread
+ *
+ * the event-threads call chassis_coarse_clock_update() once when they start to handle a event. The
+ * timeouts, the health-checks and the log read the cached time instead of asking the clock each time.
+ * Threads that never update it get the precise time.
+ *
+ * measurements like the query-times keep using chassis_get_rel_microseconds().
+ */
+CHASSIS_API void chassis_coarse_clock_update(void);
+
+/**
+ * Retrieve the cached chassis_get_rel_microseconds() of this thread.
+ */
+CHASSIS_API guint64 chassis_get_coarse_rel_microseconds(void);
+
+/**
+ * Retrieve the cached time of this thread with a millisecond resolution.
+ *
+ * @note It is derived from the wall-clock, don't mix it with chassis_get_rel_milliseconds().
+ */
+CHASSIS_API guint64 chassis_get_coarse_rel_milliseconds(void);
+
+/**
+ * Retrieve the cached g_get_current_time() of this thread.
+ */
+CHASSIS_API void chassis_get_coarse_current_time(GTimeVal *tv);
+
 typedef struct my_timer_info chassis_timestamps_global_t;
 
 /**
@@ -224,3 +224,166 @@ int chassis_unix_proc_keepalive(int *child_exit_status) {
 #endif
 }
 
+#ifndef _WIN32
+/**
+ * start a worker, the master forwards its signals to them
+ *
+ * @return 0 in the worker, the pid of the worker in the master, -1 on error
+ */
+static pid_t chassis_unix_proc_prefork_start(guint ndx) {
+	pid_t pid = fork();
+
+	if (pid == 0) {
+		/* the master forwards the signals, the worker handles them itself */
+		signal(SIGINT, SIG_DFL);
+		signal(SIGTERM, SIG_DFL);
+		signal(SIGHUP, SIG_DFL);
+		signal(SIGUSR1, SIG_DFL);
+		signal(SIGUSR2, SIG_DFL);
+
+		g_debug("%s: we are worker %u: %d",
+				G_STRLOC,
+				ndx,
+				getpid());
+	} else if (pid < 0) {
+		g_critical("%s: fork() failed: %s (%d)",
+				G_STRLOC,
+				g_strerror(errno),
+				errno);
+	} else {
+		g_message("%s: [master] started worker %u as PID=%d",
+				G_STRLOC,
+				ndx,
+				pid);
+	}
+
+	return pid;
+}
+#endif
+
+/**
+ * fork n_workers workers and keep them alive
+ *
+ * a worker that dies on a signal is restarted, the others keep running. The first
+ * worker that exits stops all of them: the master sends the others a SIGTERM and
+ * returns once they are gone. The signals the master gets are forwarded to the
+ * workers like with chassis_unix_proc_keepalive().
+ *
+ * @param worker_ndx        set to the number of the worker in the worker, 0 .. n_workers - 1
+ * @param child_exit_status set to the exit-code of the first worker that exited
+ * @return 0 in the worker, 1 in the master after all workers exited, -1 on error
+ */
+int chassis_unix_proc_prefork(guint n_workers, guint *worker_ndx, int *child_exit_status) {
+#ifdef _WIN32
+	g_assert_not_reached(); /* shouldn't be tried to be called on win32 */
+	return 0; /* for VC++, to silence a warning */
+#else
+	pid_t *pids = g_new0(pid_t, n_workers); /* 0 if the worker has to be (re)started, -1 if it is done */
+	gboolean is_stopping = FALSE;
+	gboolean is_stop_sent = FALSE;
+	guint n_running = 0;
+	guint i;
+	int ret = 1;
+
+	for (;;) {
+		struct rusage rusage;
+		int exit_status;
+		pid_t exit_pid;
+
+		for (i = 0; i < n_workers && !is_stopping; i++) {
+			pid_t pid;
+
+			if (pids[i] != 0) continue;
+
+			if (0 == (pid = chassis_unix_proc_prefork_start(i))) {
+				g_free(pids);
+				*worker_ndx = i;
+
+				return 0;
+			} else if (pid < 0) {
+				/* let the running ones go */
+				is_stopping = TRUE;
+				ret = -1;
+				break;
+			}
+
+			pids[i] = pid;
+			n_running++;
+		}
+
+		if (n_running == 0) break;
+
+		if (is_stopping && !is_stop_sent) {
+			for (i = 0; i < n_workers; i++) {
+				if (pids[i] > 0) kill(pids[i], SIGTERM);
+			}
+			is_stop_sent = TRUE;
+		}
+
+		/* forward the signals that are sent to us to the workers instead, again after each forward */
+		signal(SIGINT, chassis_unix_signal_forward);
+		signal(SIGTERM, chassis_unix_signal_forward);
+		signal(SIGHUP, chassis_unix_signal_forward);
+		signal(SIGUSR1, chassis_unix_signal_forward);
+		signal(SIGUSR2, chassis_unix_signal_forward);
+
+#ifdef HAVE_WAIT4
+		exit_pid = wait4(-1, &exit_status, 0, &rusage);
+#else
+		memset(&rusage, 0, sizeof(rusage)); /* make sure everything is zero'ed out */
+		exit_pid = waitpid(-1, &exit_status, 0);
+#endif
+		if (-1 == exit_pid) {
+			/* EINTR is ok, all others bad */
+			if (EINTR == errno) continue;
+
+			g_critical("%s: wait4(-1, ...) failed: %s (%d)",
+					G_STRLOC,
+					g_strerror(errno),
+					errno);
+			ret = -1;
+			break;
+		}
+
+		for (i = 0; i < n_workers && pids[i] != exit_pid; i++);
+		if (i == n_workers) continue; /* not one of ours */
+
+		if (WIFEXITED(exit_status)) {
+			g_message("%s: [master] worker %u, PID=%d exited normally with exit-code = %d (it used %ld kBytes max)",
+					G_STRLOC,
+					i,
+					exit_pid,
+					WEXITSTATUS(exit_status),
+					rusage.ru_maxrss / 1024);
+
+			if (!is_stopping && child_exit_status) *child_exit_status = WEXITSTATUS(exit_status);
+			is_stopping = TRUE;
+
+			pids[i] = -1;
+			n_running--;
+		} else if (WIFSIGNALED(exit_status)) {
+			g_critical("%s: [master] worker %u, PID=%d died on signal=%d (it used %ld kBytes max)%s",
+					G_STRLOC,
+					i,
+					exit_pid,
+					WTERMSIG(exit_status),
+					rusage.ru_maxrss / 1024,
+					is_stopping ? "" : " ... restarting it");
+
+			pids[i] = is_stopping ? -1 : 0;
+			n_running--;
+
+			if (!is_stopping) {
+				int time_towait = 1;
+
+				/* don't restart a worker that crashes right away as fast as we can */
+				while (time_towait > 0) time_towait = sleep(time_towait);
+			}
+		}
+	}
+
+	g_free(pids);
+
+	return ret;
+#endif
+}
@@ -21,7 +21,10 @@
 #ifndef __CHASSIS_UNIX_DAEMON_H__
 #define __CHASSIS_UNIX_DAEMON_H__
 
+#include <glib.h>
+
 int chassis_unix_proc_keepalive(int *child_exit_status);
+int chassis_unix_proc_prefork(guint n_workers, guint *worker_ndx, int *child_exit_status);
 void chassis_unix_daemonize(void);
 
 #endif
@@ -0,0 +1,143 @@
+/* $%BEGINLICENSE%$
+ Copyright (c) 2008, 2012, Oracle and/or its affiliates. All rights reserved.
+
+ This program is free software; you can redistribute it and/or
+ modify it under the terms of the GNU General Public License as
+ published by the Free Software Foundation; version 2 of the
+ License.
+
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ GNU General Public License for more details.
+
+ You should have received a copy of the GNU General Public License
+ along with this program; if not, write to the Free Software
+ Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA
+ 02110-1301  USA
+
+ $%ENDLICENSE%$ */
+/** @file
+ * the worker pool for the blocking calls of the event-threads
+ *
+ * the done-function of a job gets back to its event-thread as a timer-event without a
+ * timeout that is added through the event-queue of the thread, see
+ * chassis_event_add_to_thread().
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include "chassis-worker-pool.h"
+#include "chassis-event-thread.h"
+
+typedef struct {
+	chassis_worker_pool_t *workers;
+
+	chassis_worker_func func;
+	chassis_worker_done_func done;
+	gpointer user_data;
+
+	chassis_event_thread_t *event_thread; /**< the thread that pushed the job, NULL if it isn't a event-thread */
+	struct event done_event;
+} chassis_worker_job_t;
+
+static void chassis_worker_job_done(chassis_worker_job_t *job) {
+	chassis_worker_pool_t *workers = job->workers;
+
+	if (job->done) job->done(job->user_data);
+
+	g_slice_free(chassis_worker_job_t, job);
+
+	g_atomic_int_inc(&workers->done_total);
+	g_atomic_int_add(&workers->pending, -1);
+}
+
+static void chassis_worker_job_done_handle(int G_GNUC_UNUSED event_fd, short G_GNUC_UNUSED events, void *user_data) {
+	chassis_worker_job_done(user_data);
+}
+
+static void chassis_worker_job_run(gpointer data, gpointer G_GNUC_UNUSED user_data) {
+	chassis_worker_job_t *job = data;
+	struct timeval tv = { 0, 0 };
+
+	job->func(job->user_data);
+
+	if (NULL == job->event_thread) {
+		chassis_worker_job_done(job);
+		return;
+	}
+
+	evtimer_set(&(job->done_event), chassis_worker_job_done_handle, job);
+	chassis_event_add_to_thread(job->event_thread, &(job->done_event), &tv);
+}
+
+/**
+ * create a worker pool
+ *
+ * the workers are started when the jobs need them
+ *
+ * @param max_threads the number of jobs that run at the same time
+ */
+chassis_worker_pool_t *chassis_worker_pool_new(guint max_threads, GError **gerr) {
+	chassis_worker_pool_t *workers;
+
+	workers = g_new0(chassis_worker_pool_t, 1);
+	workers->pool = g_thread_pool_new(chassis_worker_job_run, workers, MAX(max_threads, 1), FALSE, gerr);
+	if (NULL == workers->pool) {
+		g_free(workers);
+		return NULL;
+	}
+
+	return workers;
+}
+
+/**
+ * free the worker pool
+ *
+ * waits for the jobs that are pushed already. The event-threads have to be stopped: the
+ * done-functions of their jobs aren't called anymore.
+ */
+void chassis_worker_pool_free(chassis_worker_pool_t *workers) {
+	if (!workers) return;
+
+	g_thread_pool_free(workers->pool, FALSE, TRUE);
+
+	g_free(workers);
+}
+
+/**
+ * run a job in a worker
+ *
+ * @param func      the blocking part of the job
+ * @param done      called in the current event-thread when func() returned, may be NULL
+ */
+void chassis_worker_pool_push(chassis_worker_pool_t *workers,
+		chassis_worker_func func, chassis_worker_done_func done, gpointer user_data) {
+	chassis_worker_job_t *job;
+	GError *gerr = NULL;
+
+	job = g_slice_new0(chassis_worker_job_t);
+	job->workers = workers;
+	job->func = func;
+	job->done = done;
+	job->user_data = user_data;
+	job->event_thread = chassis_event_thread_get_local();
+
+	g_atomic_int_inc(&workers->pending);
+
+	/* the job is queued even if no new worker could be started, the running ones take it */
+	g_thread_pool_push(workers->pool, job, &gerr);
+	if (gerr) {
+		g_critical("%s: starting a worker failed: %s", G_STRLOC, gerr->message);
+		g_error_free(gerr);
+	}
+}
+
+/**
+ * get the number of jobs that aren't done yet
+ */
+guint chassis_worker_pool_get_pending(chassis_worker_pool_t *workers) {
+	return g_atomic_int_get(&workers->pending);
+}
@@ -0,0 +1,61 @@
+/* $%BEGINLICENSE%$
+ Copyright (c) 2008, 2012, Oracle and/or its affiliates. All rights reserved.
+
+ This program is free software; you can redistribute it and/or
+ modify it under the terms of the GNU General Public License as
+ published by the Free Software Foundation; version 2 of the
+ License.
+
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ GNU General Public License for more details.
+
+ You should have received a copy of the GNU General Public License
+ along with this program; if not, write to the Free Software
+ Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA
+ 02110-1301  USA
+
+ $%ENDLICENSE%$ */
+#ifndef _CHASSIS_WORKER_POOL_H_
+#define _CHASSIS_WORKER_POOL_H_
+
+#include <glib.h>
+
+#include "chassis-exports.h"
+
+/**
+ * a pool of threads for the blocking calls of the event-threads
+ *
+ * name lookups and file-system calls may block for seconds. A event-thread that makes them
+ * stalls all its connections, instead it pushes them as a job to the worker pool. The
+ * job runs in one of the workers and its done-function is called in the event-thread that
+ * pushed it, like any other event of that thread.
+ */
+
+/**
+ * the blocking part of the job, runs in a worker
+ */
+typedef void (*chassis_worker_func)(gpointer user_data);
+
+/**
+ * the job is done, runs in the event-thread that pushed it
+ *
+ * jobs that are pushed from outside of a event-thread are done in the worker
+ */
+typedef void (*chassis_worker_done_func)(gpointer user_data);
+
+typedef struct {
+	GThreadPool *pool;
+
+	volatile gint pending;    /**< jobs that are pushed, but not done yet */
+	volatile gint done_total; /**< jobs that are done */
+} chassis_worker_pool_t;
+
+CHASSIS_API chassis_worker_pool_t *chassis_worker_pool_new(guint max_threads, GError **gerr);
+CHASSIS_API void chassis_worker_pool_free(chassis_worker_pool_t *workers);
+CHASSIS_API void chassis_worker_pool_push(chassis_worker_pool_t *workers,
+		chassis_worker_func func, chassis_worker_done_func done, gpointer user_data);
+CHASSIS_API guint chassis_worker_pool_get_pending(chassis_worker_pool_t *workers);
+
+#endif
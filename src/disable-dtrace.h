@@ -36,5 +36,25 @@
 
 #define	MYSQLPROXY_STATE_CHANGE_ENABLED() FALSE
 #define	MYSQLPROXY_STATE_CHANGE(arg0, arg1, arg2)
+#define	MYSQLPROXY_STATE_DONE_ENABLED() FALSE
+#define	MYSQLPROXY_STATE_DONE(arg0, arg1, arg2)
+#define	MYSQLPROXY_SOCKET_READ_ENABLED() FALSE
+#define	MYSQLPROXY_SOCKET_READ(arg0, arg1)
+#define	MYSQLPROXY_SOCKET_WRITE_ENABLED() FALSE
+#define	MYSQLPROXY_SOCKET_WRITE(arg0, arg1)
+#define	MYSQLPROXY_PACKET_READ_ENABLED() FALSE
+#define	MYSQLPROXY_PACKET_READ(arg0, arg1, arg2)
+#define	MYSQLPROXY_POOL_GET_ENABLED() FALSE
+#define	MYSQLPROXY_POOL_GET(arg0, arg1, arg2)
+#define	MYSQLPROXY_POOL_PUT_ENABLED() FALSE
+#define	MYSQLPROXY_POOL_PUT(arg0, arg1, arg2)
+#define	MYSQLPROXY_LUA_ENTER_ENABLED() FALSE
+#define	MYSQLPROXY_LUA_ENTER(arg0, arg1)
+#define	MYSQLPROXY_LUA_LEAVE_ENABLED() FALSE
+#define	MYSQLPROXY_LUA_LEAVE(arg0, arg1, arg2)
+#define	MYSQLPROXY_INJECTION_SEND_ENABLED() FALSE
+#define	MYSQLPROXY_INJECTION_SEND(arg0, arg1, arg2)
+#define	MYSQLPROXY_INJECTION_RESULT_ENABLED() FALSE
+#define	MYSQLPROXY_INJECTION_RESULT(arg0, arg1, arg2, arg3, arg4)
 
 #endif
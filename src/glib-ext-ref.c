@@ -21,6 +21,17 @@
 #include <glib.h>
 #include "glib-ext-ref.h"
 
+/**
+ * #define DEBUG_REF_THREADS 1
+ *
+ * to assert that a GRef is only counted by the thread that owns it
+ */
+#ifdef DEBUG_REF_THREADS
+#define G_REF_ASSERT_OWNER(ref) g_assert((ref)->owner == g_thread_self())
+#else
+#define G_REF_ASSERT_OWNER(ref)
+#endif
+
 /**
  * create a new reference object 
  *
@@ -47,6 +58,9 @@ void g_ref_set(GRef *ref, gpointer udata, GDestroyNotify udata_free) {
 	ref->udata = udata;
 	ref->udata_free = udata_free;
 	ref->ref_count = 1;
+#ifdef DEBUG_REF_THREADS
+	ref->owner = g_thread_self();
+#endif
 }
 
 /**
@@ -54,10 +68,24 @@ void g_ref_set(GRef *ref, gpointer udata, GDestroyNotify udata_free) {
  */
 void g_ref_ref(GRef *ref) {
 	g_return_if_fail(ref->ref_count > 0);
+	G_REF_ASSERT_OWNER(ref);
 	
 	ref->ref_count++;
 }
 
+/**
+ * make the calling thread the owner of the reference
+ *
+ * the thread that gave it away mustn't touch it anymore
+ */
+void g_ref_set_thread(GRef *ref) {
+#ifdef DEBUG_REF_THREADS
+	ref->owner = g_thread_self();
+#else
+	(void)ref;
+#endif
+}
+
 /**
  * unreference a object
  *
@@ -66,7 +94,12 @@ void g_ref_ref(GRef *ref) {
 void g_ref_unref(GRef *ref) {
 	if (ref->ref_count == 0) {
 		/* not set yet */
-	} else if (--ref->ref_count == 0) {
+		return;
+	}
+
+	G_REF_ASSERT_OWNER(ref);
+
+	if (--ref->ref_count == 0) {
 		if (ref->udata_free) {
 			ref->udata_free(ref->udata);
 			ref->udata = NULL;
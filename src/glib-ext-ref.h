@@ -29,17 +29,23 @@
 /**
  * a ref-counted c-structure
  *
+ * the counter isn't atomic: a GRef belongs to the thread that set it, like the
+ * connection it is part of. Build with DEBUG_REF_THREADS to assert that, a owner that
+ * hands the object to another thread calls g_ref_set_thread() there.
  */
 typedef struct {
 	gpointer udata;
 	GDestroyNotify udata_free;
 
 	gint ref_count;
+
+	GThread *owner;      /**< the thread that may use it, only checked with DEBUG_REF_THREADS */
 } GRef;
 
 CHASSIS_API GRef *g_ref_new(void);
 CHASSIS_API void g_ref_set(GRef *ref, gpointer udata, GDestroyNotify udata_free);
 CHASSIS_API void g_ref_ref(GRef *ref);
 CHASSIS_API void g_ref_unref(GRef *ref);
+CHASSIS_API void g_ref_set_thread(GRef *ref);
 
 #endif
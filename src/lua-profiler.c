@@ -0,0 +1,190 @@
+/* $%BEGINLICENSE%$
+ Copyright (c) 2007, 2012, Oracle and/or its affiliates. All rights reserved.
+
+ This program is free software; you can redistribute it and/or
+ modify it under the terms of the GNU General Public License as
+ published by the Free Software Foundation; version 2 of the
+ License.
+
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ GNU General Public License for more details.
+
+ You should have received a copy of the GNU General Public License
+ along with this program; if not, write to the Free Software
+ Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA
+ 02110-1301  USA
+
+ $%ENDLICENSE%$ */
+
+/** @file
+ * a sampling profiler for the lua scripts
+ *
+ * while it is active, the lua-states of the connections get a count-hook that records
+ * the lua stack every N instructions. The samples are counted per stack, for all
+ * event-threads together, and reported in the folded format of flamegraph.pl:
+ *
+ *   proxy.lua:main:1;proxy.lua:read_query:120;proxy.lua:route:42 17
+ *
+ * a frame is script:function:line, C functions are only shown with their name.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <string.h>
+
+#include <glib.h>
+
+#ifdef HAVE_LUA_H
+#include <lua.h>
+#endif
+
+#include "lua-profiler.h"
+
+static volatile gint lua_profiler_count = 0; /**< instructions between samples, 0 if the profiler isn't active */
+
+static GMutex *lua_profiler_mutex = NULL;
+static GHashTable *lua_profiler_stacks = NULL; /**< folded stack (gchar *) -> samples (guint64 *) */
+static guint64 lua_profiler_dropped = 0;       /**< samples of stacks beyond LUA_PROFILER_MAX_STACKS */
+
+static GOnce lua_profiler_once = G_ONCE_INIT;
+
+static gpointer lua_profiler_init(gpointer G_GNUC_UNUSED udata) {
+	lua_profiler_mutex = g_mutex_new();
+	lua_profiler_stacks = g_hash_table_new_full(g_str_hash, g_str_equal, g_free, g_free);
+
+	return NULL;
+}
+
+/**
+ * start sampling the lua-states every count instructions
+ *
+ * the states get the hook the next time a connection runs a script, see lua_profiler_attach()
+ */
+void lua_profiler_start(guint count) {
+	g_once(&lua_profiler_once, lua_profiler_init, NULL);
+
+	g_atomic_int_set(&lua_profiler_count, count > 0 ? count : LUA_PROFILER_DEFAULT_COUNT);
+}
+
+/**
+ * stop sampling, the recorded samples are kept until lua_profiler_reset()
+ *
+ * the hooks remove themselves the next time they fire
+ */
+void lua_profiler_stop(void) {
+	g_atomic_int_set(&lua_profiler_count, 0);
+}
+
+gboolean lua_profiler_is_active(void) {
+	return 0 != g_atomic_int_get(&lua_profiler_count);
+}
+
+/**
+ * drop the recorded samples
+ */
+void lua_profiler_reset(void) {
+	g_once(&lua_profiler_once, lua_profiler_init, NULL);
+
+	g_mutex_lock(lua_profiler_mutex);
+	g_hash_table_remove_all(lua_profiler_stacks);
+	lua_profiler_dropped = 0;
+	g_mutex_unlock(lua_profiler_mutex);
+}
+
+/**
+ * get the recorded samples in the folded format, one "stack samples" line per stack
+ */
+GString *lua_profiler_get_folded(void) {
+	GString *out = g_string_new(NULL);
+	GHashTableIter iter;
+	gpointer key, value;
+
+	g_once(&lua_profiler_once, lua_profiler_init, NULL);
+
+	g_mutex_lock(lua_profiler_mutex);
+	g_hash_table_iter_init(&iter, lua_profiler_stacks);
+	while (g_hash_table_iter_next(&iter, &key, &value)) {
+		g_string_append_printf(out, "%s %"G_GUINT64_FORMAT"\n", (gchar *)key, *(guint64 *)value);
+	}
+	if (lua_profiler_dropped > 0) {
+		g_string_append_printf(out, "(dropped) %"G_GUINT64_FORMAT"\n", lua_profiler_dropped);
+	}
+	g_mutex_unlock(lua_profiler_mutex);
+
+	return out;
+}
+
+#ifdef HAVE_LUA_H
+static void lua_profiler_record(GString *stack) {
+	guint64 *samples;
+
+	g_mutex_lock(lua_profiler_mutex);
+	if (NULL != (samples = g_hash_table_lookup(lua_profiler_stacks, stack->str))) {
+		(*samples)++;
+	} else if (g_hash_table_size(lua_profiler_stacks) < LUA_PROFILER_MAX_STACKS) {
+		samples = g_new(guint64, 1);
+		*samples = 1;
+		g_hash_table_insert(lua_profiler_stacks, g_strndup(stack->str, stack->len), samples);
+	} else {
+		lua_profiler_dropped++;
+	}
+	g_mutex_unlock(lua_profiler_mutex);
+}
+
+static void lua_profiler_hook(lua_State *L, lua_Debug G_GNUC_UNUSED *hook_ar) {
+	lua_Debug ar;
+	GString *stack;
+	int depth, level;
+
+	if (!lua_profiler_is_active()) {
+		lua_sethook(L, NULL, 0, 0);
+		return;
+	}
+
+	depth = 0;
+	while (lua_getstack(L, depth, &ar)) depth++;
+
+	stack = g_string_sized_new(256);
+
+	/* the folded format starts at the root of the stack */
+	for (level = depth - 1; level >= 0; level--) {
+		if (!lua_getstack(L, level, &ar)) continue;
+		lua_getinfo(L, "Sln", &ar);
+
+		if (stack->len > 0) g_string_append_c(stack, ';');
+
+		if (0 == strcmp(ar.what, "C")) {
+			g_string_append(stack, ar.name ? ar.name : "?");
+		} else {
+			g_string_append_printf(stack, "%s:%s:%d",
+					ar.short_src,
+					ar.name ? ar.name : (0 == strcmp(ar.what, "main") ? "main" : "?"),
+					ar.currentline);
+		}
+	}
+
+	if (stack->len > 0) lua_profiler_record(stack);
+
+	g_string_free(stack, TRUE);
+}
+
+/**
+ * add the hook of the profiler to a lua-state if the profiler is active
+ *
+ * called before a connection runs a script, coroutines of the state inherit the hook
+ * when they are created
+ */
+void lua_profiler_attach(lua_State *L) {
+	int count = g_atomic_int_get(&lua_profiler_count);
+
+	if (0 == count) return;
+
+	if (lua_gethook(L) == lua_profiler_hook && lua_gethookcount(L) == count) return;
+
+	lua_sethook(L, lua_profiler_hook, LUA_MASKCOUNT, count);
+}
+#endif
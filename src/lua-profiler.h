@@ -0,0 +1,55 @@
+/* $%BEGINLICENSE%$
+ Copyright (c) 2007, 2012, Oracle and/or its affiliates. All rights reserved.
+
+ This program is free software; you can redistribute it and/or
+ modify it under the terms of the GNU General Public License as
+ published by the Free Software Foundation; version 2 of the
+ License.
+
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ GNU General Public License for more details.
+
+ You should have received a copy of the GNU General Public License
+ along with this program; if not, write to the Free Software
+ Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA
+ 02110-1301  USA
+
+ $%ENDLICENSE%$ */
+#ifndef _LUA_PROFILER_H_
+#define _LUA_PROFILER_H_
+
+#include <glib.h>
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#ifdef HAVE_LUA_H
+#include <lua.h>
+#endif
+
+#include "chassis-exports.h"
+
+/**
+ * sample the stack of a lua-state every this many VM instructions by default
+ */
+#define LUA_PROFILER_DEFAULT_COUNT 1000
+
+/**
+ * stop recording new stacks beyond this many, their samples are counted as "(dropped)"
+ */
+#define LUA_PROFILER_MAX_STACKS 10000
+
+CHASSIS_API void lua_profiler_start(guint count);
+CHASSIS_API void lua_profiler_stop(void);
+CHASSIS_API gboolean lua_profiler_is_active(void);
+CHASSIS_API void lua_profiler_reset(void);
+CHASSIS_API GString *lua_profiler_get_folded(void);
+
+#ifdef HAVE_LUA_H
+CHASSIS_API void lua_profiler_attach(lua_State *L);
+#endif
+
+#endif
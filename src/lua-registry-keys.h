@@ -23,5 +23,6 @@
 #define _CHASSIS_LUA_REGISTRY_KEYS_H_
 
 #define CHASSIS_LUA_REGISTRY_KEY "chassis"
+#define CHASSIS_LUA_SCOPE_REGISTRY_KEY "lua_scope" /**< the lua_scope of the lua_State, see lua_scope_new() */
 
 #endif
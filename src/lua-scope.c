@@ -40,6 +40,7 @@
 #include "lua-load-factory.h"
 #include "lua-scope.h"
 #include "chassis-stats.h"
+#include "lua-registry-keys.h"
 
 static int proxy_lua_panic (lua_State *L);
 
@@ -53,23 +54,52 @@ lua_scope *lua_scope_init(void) {
 	return lua_scope_new();
 }
 
+/**
+ * the limit of the lua-states that don't have their own, 0 for no limit
+ */
+static gint64 lua_scope_default_mem_limit = 0;
+
+/**
+ * the limit of a single hook of the connections that don't have their own, 0 for no limit
+ */
+static gint64 lua_scope_default_call_mem_limit = 0;
+
+/**
+ * keep the freed small blocks of the lua-states for their next allocations
+ */
+static gboolean lua_scope_alloc_cache_is_enabled = FALSE;
+
 lua_scope *lua_scope_new(void) {
 	lua_scope *sc;
 
 	sc = g_new0(lua_scope, 1);
 
 #ifdef HAVE_LUA_H
-	sc->L = lua_newstate(chassis_lua_alloc, NULL);
+	sc->L = lua_newstate(chassis_lua_alloc, &(sc->mem));
+#ifdef HAVE_LUAJIT
+	/* LuaJIT on 64bit refuses a custom allocator unless it is built with GC64,
+	 * the state isn't accounted nor limited then */
+	if (NULL == sc->L) sc->L = luaL_newstate();
+#endif
 	luaL_openlibs(sc->L);
 	lua_atpanic(sc->L, proxy_lua_panic);
+
+	/* the C functions find the scope of the state they are called from, see proxy.timer() */
+	lua_pushlightuserdata(sc->L, sc);
+	lua_setfield(sc->L, LUA_REGISTRYINDEX, CHASSIS_LUA_SCOPE_REGISTRY_KEY);
 #endif
 
 	sc->mutex = g_mutex_new();
+	chassis_lock_stats_init(&(sc->mutex_stats), "lua_scope");
 
 	return sc;
 }
 
 void lua_scope_free(lua_scope *sc) {
+#ifdef HAVE_LUA_H
+	guint i;
+#endif
+
 	if (!sc) return;
 
 #ifdef HAVE_LUA_H
@@ -87,15 +117,104 @@ void lua_scope_free(lua_scope *sc) {
 	/* FIXME: we might want to cleanup the cached-scripts in the registry */
 
 	lua_close(sc->L);
+
+	lua_scope_mem_fold(&(sc->mem));
+
+	for (i = 0; i < LUA_SCOPE_MEM_CLASSES; i++) {
+		gpointer p;
+
+		while (NULL != (p = sc->mem.free_blocks[i])) {
+			sc->mem.free_blocks[i] = *(gpointer *)p;
+			g_free(p);
+		}
+	}
 #endif
+	chassis_lock_stats_unregister(&(sc->mutex_stats));
 	g_mutex_free(sc->mutex);
 
 	g_free(sc);
 }
 
+/**
+ * add the pending memory stats of a lua-state to the shard of the current event-thread
+ */
+void lua_scope_mem_fold(lua_scope_mem_t *mem) {
+	chassis_stats_shard_t *shard;
+
+	if (0 == mem->pending_allocs && 0 == mem->pending_frees && 0 == mem->pending_bytes) return;
+
+	if (NULL != (shard = chassis_stats_get_local_shard())) {
+		shard->lua_mem_alloc += mem->pending_allocs;
+		shard->lua_mem_free  += mem->pending_frees;
+		shard->lua_mem_bytes += mem->pending_bytes;
+		if (shard->lua_mem_bytes > shard->lua_mem_bytes_max) shard->lua_mem_bytes_max = shard->lua_mem_bytes;
+	}
+
+	mem->pending_allocs = 0;
+	mem->pending_frees  = 0;
+	mem->pending_bytes  = 0;
+}
+
+/**
+ * limit the memory of the lua-state
+ *
+ * @param bytes_limit  the allocations that would take the state beyond it fail, 0 for the default
+ */
+void lua_scope_set_mem_limit(lua_scope *sc, gint64 bytes_limit) {
+	sc->mem.bytes_limit = bytes_limit;
+	sc->mem.limit_is_logged = FALSE;
+}
+
+/**
+ * set the memory limit of all lua-states without a limit of their own
+ *
+ * @see --lua-max-memory
+ */
+void lua_scope_set_default_mem_limit(gint64 bytes_limit) {
+	lua_scope_default_mem_limit = bytes_limit;
+}
+
+/**
+ * set the limit of a single hook of the connections without a limit of their own
+ *
+ * @see --lua-max-hook-memory
+ */
+void lua_scope_set_default_call_mem_limit(gint64 bytes_limit) {
+	lua_scope_default_call_mem_limit = bytes_limit;
+}
+
+/**
+ * cache the freed small blocks of each lua-state in per-size-class free-lists
+ *
+ * the small blocks are always allocated in their size-class, it can be switched at any time
+ *
+ * @see --lua-alloc-cache
+ */
+void lua_scope_set_alloc_cache(gboolean is_enabled) {
+	lua_scope_alloc_cache_is_enabled = is_enabled;
+}
+
+/**
+ * count the allocations of the lua-state into the account of a connection
+ *
+ * call it with the scope locked before the hooks of the connection run and with NULL
+ * after they returned
+ *
+ * @param account the account of the connection, NULL to stop counting
+ */
+void lua_scope_set_mem_account(lua_scope *sc, lua_scope_mem_account_t *account) {
+	lua_scope_mem_account_t *prev = sc->mem.account;
+
+	if (prev && prev->call_bytes > prev->call_bytes_max) prev->call_bytes_max = prev->call_bytes;
+
+	if (account) account->call_bytes = 0;
+
+	sc->mem.account = account;
+}
+
 void lua_scope_get(lua_scope *sc, const char G_GNUC_UNUSED* pos) {
 /*	g_warning("%s: === waiting for lua-scope", pos); */
-	g_mutex_lock(sc->mutex);
+	chassis_lock_stats_mutex_lock(sc->mutex, &(sc->mutex_stats));
 /*	g_warning("%s: +++ got lua-scope", pos); */
 #ifdef HAVE_LUA_H
 	sc->L_top = lua_gettop(sc->L);
@@ -110,14 +229,275 @@ void lua_scope_release(lua_scope *sc, const char* pos) {
 		g_critical("%s: lua-stack out of sync: is %d, should be %d", pos, lua_gettop(sc->L), sc->L_top);
 	}
 #endif
+	/* we are in the event-thread that did the allocations */
+	lua_scope_mem_fold(&(sc->mem));
 
-	g_mutex_unlock(sc->mutex);
+	chassis_lock_stats_mutex_unlock(sc->mutex, &(sc->mutex_stats));
 /*	g_warning("%s: --- released lua scope", pos); */
 
 	return;
 }
 
+/**
+ * the state of a script on disk when it was last checked
+ */
+typedef struct {
+	time_t mtime;
+	off_t size;
+} lua_scope_script_stat_t;
+
+/**
+ * a compiled script, shared by all lua-scopes
+ */
+typedef struct {
+	time_t mtime;
+	off_t size;
+
+	GString *bytecode;     /**< the lua_dump() of the factory of the script */
+
+	gint ref_count;        /**< protected by lua_scope_chunks_mutex */
+} lua_scope_chunk_t;
+
+/**
+ * the compiled scripts by name
+ *
+ * each event-thread has a lua-state of its own and would compile the same scripts again.
+ * The first scope that loads a script dumps the compiled chunk, the others lua_load() the
+ * bytecode as long as the mtime and size of the script match.
+ */
+static GStaticMutex lua_scope_chunks_mutex = G_STATIC_MUTEX_INIT;
+static GHashTable *lua_scope_chunks = NULL;        /**< name -> lua_scope_chunk_t */
+static guint lua_scope_chunks_generation = 0;      /**< bumped when the chunks are cleared */
+static guint lua_scope_chunks_compiled = 0;
+static guint lua_scope_chunks_loaded = 0;
+
+/**
+ * @note has to be called with the lua_scope_chunks_mutex held
+ */
+static void lua_scope_chunk_unref(gpointer data) {
+	lua_scope_chunk_t *chunk = data;
+
+	if (--chunk->ref_count > 0) return;
+
+	g_string_free(chunk->bytecode, TRUE);
+	g_free(chunk);
+}
+
+/**
+ * forget the compiled scripts, the next loads compile them again
+ */
+static void lua_scope_chunks_clear(void) {
+	g_static_mutex_lock(&lua_scope_chunks_mutex);
+	if (NULL != lua_scope_chunks) g_hash_table_remove_all(lua_scope_chunks);
+	lua_scope_chunks_generation++;
+	g_static_mutex_unlock(&lua_scope_chunks_mutex);
+}
+
+/**
+ * get how many scripts got compiled and how many got loaded from their bytecode
+ */
+void lua_scope_chunks_get_stats(guint *compiled, guint *loaded) {
+	g_static_mutex_lock(&lua_scope_chunks_mutex);
+	*compiled = lua_scope_chunks_compiled;
+	*loaded = lua_scope_chunks_loaded;
+	g_static_mutex_unlock(&lua_scope_chunks_mutex);
+}
+
+/**
+ * the scripts the lua-scopes loaded, checked by lua_scope_scripts_check()
+ *
+ * the scopes only stat() a cached script again if .generation moved since they
+ * checked it last. Without a watcher every load stat()s.
+ */
+static GStaticMutex lua_scope_scripts_mutex = G_STATIC_MUTEX_INIT;
+static GHashTable *lua_scope_scripts = NULL;                 /**< name -> lua_scope_script_stat_t */
+static volatile gint lua_scope_scripts_generation = 1;       /**< bumped if one of the scripts changed */
+static volatile gint lua_scope_scripts_forced_generation = 0; /**< scripts checked before it are reloaded even if they didn't change */
+static volatile gint lua_scope_scripts_is_watched = 0;
+
+/**
+ * start to watch a script we loaded
+ *
+ * only the first load sets the stat(), after that only lua_scope_scripts_check() updates
+ * it. Otherwise a scope that reloads a changed script would hide the change from the
+ * other scopes.
+ */
+static void lua_scope_scripts_add(const gchar *name, struct stat *st) {
+	lua_scope_script_stat_t *script_st;
+
+	g_static_mutex_lock(&lua_scope_scripts_mutex);
+	if (NULL == lua_scope_scripts) {
+		lua_scope_scripts = g_hash_table_new_full(g_str_hash, g_str_equal, g_free, g_free);
+	}
+
+	if (NULL == g_hash_table_lookup(lua_scope_scripts, name)) {
+		script_st = g_new0(lua_scope_script_stat_t, 1);
+		script_st->mtime = st->st_mtime;
+		script_st->size = st->st_size;
+
+		g_hash_table_insert(lua_scope_scripts, g_strdup(name), script_st);
+	}
+	g_static_mutex_unlock(&lua_scope_scripts_mutex);
+}
+
+/**
+ * stat() the loaded scripts and mark them stale if they changed
+ *
+ * called periodically by the watcher of the scripts, outside of the lua-scopes
+ *
+ * @return the number of scripts that changed
+ */
+int lua_scope_scripts_check(void) {
+	GHashTableIter iter;
+	gpointer key, value;
+	int changed = 0;
+
+	g_static_mutex_lock(&lua_scope_scripts_mutex);
+	if (NULL != lua_scope_scripts) {
+		g_hash_table_iter_init(&iter, lua_scope_scripts);
+		while (g_hash_table_iter_next(&iter, &key, &value)) {
+			lua_scope_script_stat_t *script_st = value;
+			struct stat st;
+
+			if (0 != g_stat(key, &st)) {
+				/* let the next load report the error */
+				st.st_mtime = 0;
+				st.st_size = 0;
+			}
+
+			if (st.st_mtime != script_st->mtime ||
+			    st.st_size  != script_st->size) {
+				script_st->mtime = st.st_mtime;
+				script_st->size = st.st_size;
+
+				changed++;
+			}
+		}
+	}
+
+	if (changed) g_atomic_int_inc(&lua_scope_scripts_generation);
+	g_static_mutex_unlock(&lua_scope_scripts_mutex);
+
+	return changed;
+}
+
+/**
+ * reload all the scripts from disk, even if they didn't change
+ *
+ * all lua-scopes see the new generation at once, each loads the scripts again when it
+ * needs them next
+ */
+void lua_scope_scripts_reload(void) {
+	g_static_mutex_lock(&lua_scope_scripts_mutex);
+	g_atomic_int_inc(&lua_scope_scripts_generation);
+	g_atomic_int_set(&lua_scope_scripts_forced_generation, g_atomic_int_get(&lua_scope_scripts_generation));
+	g_static_mutex_unlock(&lua_scope_scripts_mutex);
+
+	lua_scope_chunks_clear();
+}
+
+/**
+ * announce that lua_scope_scripts_check() is called periodically
+ *
+ * the scopes trust their cached scripts then until a check marks them stale
+ */
+void lua_scope_scripts_set_watched(gboolean is_watched) {
+	g_atomic_int_set(&lua_scope_scripts_is_watched, is_watched ? 1 : 0);
+}
+
 #ifdef HAVE_LUA_H
+typedef struct {
+	const char *str;
+	size_t len;
+} lua_scope_chunk_reader_t;
+
+static const char *lua_scope_chunk_reader(lua_State G_GNUC_UNUSED *L, void *data, size_t *size) {
+	lua_scope_chunk_reader_t *reader = data;
+
+	if (0 == reader->len) return NULL;
+
+	*size = reader->len;
+	reader->len = 0;
+
+	return reader->str;
+}
+
+static int lua_scope_chunk_writer(lua_State G_GNUC_UNUSED *L, const void *p, size_t sz, void *ud) {
+	g_string_append_len(ud, p, sz);
+
+	return 0;
+}
+
+/**
+ * load the factory of a script, from its cached bytecode if the script didn't change
+ *
+ * @see luaL_loadfile_factory
+ * @return 0 on success and the function on the stack, the error of luaL_loadfile_factory() otherwise
+ */
+static int lua_scope_load_chunk(lua_State *L, const gchar *name, struct stat *st) {
+	lua_scope_chunk_t *chunk = NULL;
+	guint generation;
+	int ret;
+
+	g_static_mutex_lock(&lua_scope_chunks_mutex);
+	if (NULL != lua_scope_chunks) chunk = g_hash_table_lookup(lua_scope_chunks, name);
+	if (NULL != chunk && chunk->mtime == st->st_mtime && chunk->size == st->st_size) {
+		chunk->ref_count++; /* keep the bytecode while we load it */
+	} else {
+		chunk = NULL;
+	}
+	generation = lua_scope_chunks_generation;
+	g_static_mutex_unlock(&lua_scope_chunks_mutex);
+
+	if (NULL != chunk) {
+		lua_scope_chunk_reader_t reader;
+
+		reader.str = chunk->bytecode->str;
+		reader.len = chunk->bytecode->len;
+
+		ret = lua_load(L, lua_scope_chunk_reader, &reader, name);
+
+		g_static_mutex_lock(&lua_scope_chunks_mutex);
+		if (0 == ret) lua_scope_chunks_loaded++;
+		lua_scope_chunk_unref(chunk);
+		g_static_mutex_unlock(&lua_scope_chunks_mutex);
+
+		if (0 == ret) return 0;
+
+		/* compile it from the source instead */
+		lua_pop(L, 1);
+	}
+
+	if (0 != (ret = luaL_loadfile_factory(L, name))) return ret;
+
+	chunk = g_new0(lua_scope_chunk_t, 1);
+	chunk->mtime = st->st_mtime;
+	chunk->size = st->st_size;
+	chunk->bytecode = g_string_new(NULL);
+	chunk->ref_count = 1;
+
+	if (0 != lua_dump(L, lua_scope_chunk_writer, chunk->bytecode)) {
+		lua_scope_chunk_unref(chunk);
+
+		return 0;
+	}
+
+	g_static_mutex_lock(&lua_scope_chunks_mutex);
+	lua_scope_chunks_compiled++;
+	if (generation == lua_scope_chunks_generation) {
+		if (NULL == lua_scope_chunks) {
+			lua_scope_chunks = g_hash_table_new_full(g_str_hash, g_str_equal, g_free, lua_scope_chunk_unref);
+		}
+		g_hash_table_replace(lua_scope_chunks, g_strdup(name), chunk);
+	} else {
+		/* the scripts got reloaded while we compiled, we may have read the old one */
+		lua_scope_chunk_unref(chunk);
+	}
+	g_static_mutex_unlock(&lua_scope_chunks_mutex);
+
+	return 0;
+}
+
 /**
  * load the lua script
  *
@@ -131,6 +511,7 @@ void lua_scope_release(lua_scope *sc, const char* pos) {
 lua_State *lua_scope_load_script(lua_scope *sc, const gchar *name) {
 	lua_State *L = sc->L;
 	int stack_top = lua_gettop(L);
+	gint generation = g_atomic_int_get(&lua_scope_scripts_generation);
 	/**
 	 * check if the script is in the cache already
 	 *
@@ -165,9 +546,16 @@ lua_State *lua_scope_load_script(lua_scope *sc, const gchar *name) {
 		struct stat st;
 		time_t cached_mtime;
 		off_t cached_size;
+		gint cached_generation;
+
+		lua_getfield(L, -1, "generation");
+		cached_generation = lua_tointeger(L, -1); /* 0 if it isn't set */
+		lua_pop(L, 1);
 
 		/** the script cached, check that it is fresh */
-		if (0 != g_stat(name, &st)) {
+		if (g_atomic_int_get(&lua_scope_scripts_is_watched) && cached_generation == generation) {
+			/* nothing changed since we checked it last */
+		} else if (0 != g_stat(name, &st)) {
 			gchar *errmsg;
 			/* stat() failed, ... not good */
 
@@ -184,46 +572,53 @@ lua_State *lua_scope_load_script(lua_scope *sc, const gchar *name) {
 			g_assert(lua_gettop(L) == stack_top + 1);
 
 			return L;
-		}
-
-		/* get the mtime from the table */
-		lua_getfield(L, -1, "mtime");
-		g_assert(lua_isnumber(L, -1));
-		cached_mtime = lua_tonumber(L, -1);
-		lua_pop(L, 1);
-
-		/* get the mtime from the table */
-		lua_getfield(L, -1, "size");
-		g_assert(lua_isnumber(L, -1));
-		cached_size = lua_tonumber(L, -1);
-		lua_pop(L, 1);
-
-		if (st.st_mtime != cached_mtime || 
-		    st.st_size  != cached_size) {
-			lua_pushnil(L);
-			lua_setfield(L, -2, "func"); /* zap the old function on the stack */
-
-			if (0 != luaL_loadfile_factory(L, name)) {
-				/* log a warning and leave the error-msg on the stack */
-				g_warning("%s: reloading '%s' failed", G_STRLOC, name);
-
-				/* cleanup a bit */
-				lua_remove(L, -2); /* remove the cachedscripts.<name> */
-				lua_remove(L, -2); /* remove cachedscripts-table */
-
-				g_assert(lua_isstring(L, -1));
-				g_assert(lua_gettop(L) == stack_top + 1);
-
-				return L;
+		} else {
+			/* get the mtime from the table */
+			lua_getfield(L, -1, "mtime");
+			g_assert(lua_isnumber(L, -1));
+			cached_mtime = lua_tonumber(L, -1);
+			lua_pop(L, 1);
+
+			/* get the mtime from the table */
+			lua_getfield(L, -1, "size");
+			g_assert(lua_isnumber(L, -1));
+			cached_size = lua_tonumber(L, -1);
+			lua_pop(L, 1);
+
+			if (st.st_mtime != cached_mtime || 
+			    st.st_size  != cached_size ||
+			    cached_generation < g_atomic_int_get(&lua_scope_scripts_forced_generation)) {
+				lua_pushnil(L);
+				lua_setfield(L, -2, "func"); /* zap the old function on the stack */
+
+				if (0 != lua_scope_load_chunk(L, name, &st)) {
+					/* log a warning and leave the error-msg on the stack */
+					g_warning("%s: reloading '%s' failed", G_STRLOC, name);
+
+					/* cleanup a bit */
+					lua_remove(L, -2); /* remove the cachedscripts.<name> */
+					lua_remove(L, -2); /* remove cachedscripts-table */
+
+					g_assert(lua_isstring(L, -1));
+					g_assert(lua_gettop(L) == stack_top + 1);
+
+					return L;
+				}
+				lua_setfield(L, -2, "func");
+
+				/* not fresh, reload */
+				lua_pushinteger(L, st.st_mtime);
+				lua_setfield(L, -2, "mtime");   /* t.mtime = ... */
+
+				lua_pushinteger(L, st.st_size);
+				lua_setfield(L, -2, "size");    /* t.size = ... */
 			}
-			lua_setfield(L, -2, "func");
 
-			/* not fresh, reload */
-			lua_pushinteger(L, st.st_mtime);
-			lua_setfield(L, -2, "mtime");   /* t.mtime = ... */
+			/* fresh until the generation moves again */
+			lua_pushinteger(L, generation);
+			lua_setfield(L, -2, "generation");
 
-			lua_pushinteger(L, st.st_size);
-			lua_setfield(L, -2, "size");    /* t.size = ... */
+			lua_scope_scripts_add(name, &st);
 		}
 	} else if (lua_isnil(L, -1)) {
 		struct stat st;
@@ -252,7 +647,7 @@ lua_State *lua_scope_load_script(lua_scope *sc, const gchar *name) {
 			return L;
 		}
 
-		if (0 != luaL_loadfile_factory(L, name)) {
+		if (0 != lua_scope_load_chunk(L, name, &st)) {
 			/* leave the error-msg on the stack */
 
 			/* cleanup a bit */
@@ -273,8 +668,13 @@ lua_State *lua_scope_load_script(lua_scope *sc, const gchar *name) {
 		lua_pushinteger(L, st.st_size);
 		lua_setfield(L, -2, "size");    /* t.size  = ... */
 
+		lua_pushinteger(L, generation);
+		lua_setfield(L, -2, "generation");
+
 		lua_setfield(L, -2, name);      /* reg.cachedscripts.<name> = t */
 
+		lua_scope_scripts_add(name, &st);
+
 		lua_getfield(L, -1, name);
 	} else {
 		/* not good */
@@ -450,59 +850,145 @@ static int proxy_lua_panic (lua_State *L) {
 	return 0;
 }
 
+#define LUA_SCOPE_MEM_IS_SMALL(size) ((size) <= LUA_SCOPE_MEM_CLASS_SIZE * LUA_SCOPE_MEM_CLASSES)
+#define LUA_SCOPE_MEM_CLASS(size)    (((size) - 1) / LUA_SCOPE_MEM_CLASS_SIZE)
+
+/**
+ * get a block of the size-class of a small allocation
+ *
+ * takes it from the free-list of the size-class if there is one
+ */
+static gpointer lua_scope_mem_block_alloc(lua_scope_mem_t *mem, size_t size) {
+	guint cls;
+	gpointer p;
+
+	if (!LUA_SCOPE_MEM_IS_SMALL(size)) return g_malloc(size);
+
+	cls = LUA_SCOPE_MEM_CLASS(size);
+	if (NULL != (p = mem->free_blocks[cls])) {
+		mem->free_blocks[cls] = *(gpointer *)p;
+		mem->free_blocks_len[cls]--;
+		mem->cached_bytes -= (cls + 1) * LUA_SCOPE_MEM_CLASS_SIZE;
+
+		return p;
+	}
+
+	return g_malloc((cls + 1) * LUA_SCOPE_MEM_CLASS_SIZE);
+}
+
+/**
+ * give a block back, small ones go to the free-list of their size-class if it isn't full
+ */
+static void lua_scope_mem_block_free(lua_scope_mem_t *mem, gpointer p, size_t size) {
+	guint cls;
+
+	if (lua_scope_alloc_cache_is_enabled && LUA_SCOPE_MEM_IS_SMALL(size)) {
+		cls = LUA_SCOPE_MEM_CLASS(size);
+
+		if (mem->free_blocks_len[cls] < LUA_SCOPE_MEM_CLASS_MAX_CACHED) {
+			*(gpointer *)p = mem->free_blocks[cls];
+			mem->free_blocks[cls] = p;
+			mem->free_blocks_len[cls]++;
+			mem->cached_bytes += (cls + 1) * LUA_SCOPE_MEM_CLASS_SIZE;
+
+			return;
+		}
+	}
+
+	g_free(p);
+}
+
 /**
  * Our own instrumented version of the lua allocator function.
  * It is handling all malloc/realloc/free cases as described in detail in the Lua reference manual.
  *
- * @param userdata NULL and unused in our case (userdata passed to lua_newstate)
+ * The accounting is kept in the lua-state and folded into the chassis-stats in batches.
+ * A growing allocation that would take the state beyond its limit fails, Lua raises a
+ * "not enough memory" error then. Shrinking must never fail.
+ *
+ * The small blocks are allocated in size-classes, a realloc within the size-class
+ * keeps the block.
+ *
+ * @param userdata the lua_scope_mem_t of the state (userdata passed to lua_newstate)
  * @param ptr the pointer to the block to be malloced/realloced/freed
  * @param osize the original size of the block
  * @param nsize the requested size of the block
  */
-static void* chassis_lua_alloc(void G_GNUC_UNUSED *userdata, void *ptr, size_t osize, size_t nsize) {
+static void* chassis_lua_alloc(void *userdata, void *ptr, size_t osize, size_t nsize) {
+	lua_scope_mem_t *mem = userdata;
+	lua_scope_mem_account_t *account = mem->account;
+	gint64 limit;
 	gpointer p;
-	gint cur_size;
 
 	/* the free case */
 	if (nsize == 0) {
 		if (osize != 0) {
-			CHASSIS_STATS_FREE_INC_NAME(lua_mem);
-			CHASSIS_STATS_ADD_NAME(lua_mem_bytes, -osize);
-			g_free(ptr);
+			mem->pending_frees++;
+			mem->pending_bytes -= (gint64)osize;
+			mem->bytes -= (gint64)osize;
+			lua_scope_mem_block_free(mem, ptr, osize);
 		}
 		return NULL;
 	} 
-	/* track the maximum of the mem-usage inside lua
-	 *
-	 * g_atomic_... works against signed integers, but we actually would need something bigger to be safe
-	 *
-	 * stats may be wrong if the lua-mem-* counters actually go about MAX_INT 
-	 */
-	if (osize == 0) { 		/* the plain malloc case */
-		CHASSIS_STATS_ALLOC_INC_NAME(lua_mem);
-		CHASSIS_STATS_ADD_NAME(lua_mem_bytes, nsize);
-		
-		cur_size = CHASSIS_STATS_GET_NAME(lua_mem_bytes);
-		if (cur_size > CHASSIS_STATS_GET_NAME(lua_mem_bytes_max)) {
-			CHASSIS_STATS_SET_NAME(lua_mem_bytes_max, cur_size);
+
+	limit = mem->bytes_limit ? mem->bytes_limit : lua_scope_default_mem_limit;
+	if (limit > 0 && nsize > osize && mem->bytes + (gint64)(nsize - osize) > limit) {
+		if (!mem->limit_is_logged) {
+			mem->limit_is_logged = TRUE;
+			g_critical("%s: lua-state hit its memory limit of %"G_GINT64_FORMAT" bytes (has %"G_GINT64_FORMAT" bytes), failing the allocation of %"G_GSIZE_FORMAT" bytes",
+					G_STRLOC, limit, mem->bytes, nsize);
 		}
-		return g_malloc(nsize);
-	} 
+		return NULL;
+	}
 
-	p = g_realloc(ptr, nsize);
+	if (account && nsize > osize) {
+		limit = account->call_bytes_limit ? account->call_bytes_limit : lua_scope_default_call_mem_limit;
+		if (limit > 0 && account->call_bytes + (gint64)(nsize - osize) > limit) {
+			if (!account->limit_is_logged) {
+				account->limit_is_logged = TRUE;
+				g_critical("%s: lua hook of a connection hit its memory limit of %"G_GINT64_FORMAT" bytes, failing the allocation of %"G_GSIZE_FORMAT" bytes",
+						G_STRLOC, limit, nsize);
+			}
+			return NULL;
+		}
+	}
 
-	if (!p) return p;
-	
-	CHASSIS_STATS_ADD_NAME(lua_mem_bytes, nsize - osize); /* might be negative if Lua tries to shrink something */
+	if (osize == 0) { 		/* the plain malloc case */
+		p = lua_scope_mem_block_alloc(mem, nsize);
+
+		mem->pending_allocs++;
+		if (account) account->allocs++;
+	} else if (LUA_SCOPE_MEM_IS_SMALL(osize) && LUA_SCOPE_MEM_IS_SMALL(nsize) &&
+	           LUA_SCOPE_MEM_CLASS(osize) == LUA_SCOPE_MEM_CLASS(nsize)) {
+		/* still fits into its size-class */
+		p = ptr;
+	} else if (LUA_SCOPE_MEM_IS_SMALL(osize) || LUA_SCOPE_MEM_IS_SMALL(nsize)) {
+		/* moves from or into a size-class */
+		p = lua_scope_mem_block_alloc(mem, nsize);
+		memcpy(p, ptr, MIN(osize, nsize));
+		lua_scope_mem_block_free(mem, ptr, osize);
+	} else {
+		p = g_realloc(ptr, nsize);
 
-	cur_size = CHASSIS_STATS_GET_NAME(lua_mem_bytes);
-	if (cur_size > CHASSIS_STATS_GET_NAME(lua_mem_bytes_max)) {
-		CHASSIS_STATS_SET_NAME(lua_mem_bytes_max, cur_size);
+		if (!p) return p;
 	}
-	
+
+	mem->pending_bytes += (gint64)nsize - (gint64)osize; /* might be negative if Lua tries to shrink something */
+	mem->bytes += (gint64)nsize - (gint64)osize;
+	if (mem->bytes > mem->bytes_max) mem->bytes_max = mem->bytes;
+
+	if (account && nsize > osize) {
+		account->alloc_bytes += nsize - osize;
+		account->call_bytes += nsize - osize;
+	}
+
+	if (mem->pending_allocs + mem->pending_frees >= LUA_SCOPE_MEM_BATCH_ALLOCS ||
+	    ABS(mem->pending_bytes) >= LUA_SCOPE_MEM_BATCH_BYTES) {
+		lua_scope_mem_fold(mem);
+	}
+
 	return p;
 }
 
-
 #endif
 
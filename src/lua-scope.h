@@ -33,6 +33,60 @@
 #endif
 
 #include "chassis-exports.h"
+#include "chassis-lock-stats.h"
+
+/**
+ * fold the memory stats of a lua-state into the chassis-stats after this many bytes or allocations
+ */
+#define LUA_SCOPE_MEM_BATCH_BYTES  (64 * 1024)
+#define LUA_SCOPE_MEM_BATCH_ALLOCS 256
+
+/**
+ * the small allocations of a lua-state are rounded up to size-classes of
+ * LUA_SCOPE_MEM_CLASS_SIZE bytes, up to LUA_SCOPE_MEM_CLASS_SIZE * LUA_SCOPE_MEM_CLASSES
+ */
+#define LUA_SCOPE_MEM_CLASS_SIZE       16
+#define LUA_SCOPE_MEM_CLASSES          16
+#define LUA_SCOPE_MEM_CLASS_MAX_CACHED 128 /**< free blocks kept per size-class if the alloc-cache is enabled */
+
+/**
+ * the lua memory of a connection
+ *
+ * the allocator of the lua-state counts into it while the hooks of the connection run,
+ * see lua_scope_set_mem_account()
+ */
+typedef struct {
+	guint64 allocs;           /**< allocations made by the hooks of the connection */
+	guint64 alloc_bytes;      /**< bytes allocated by the hooks of the connection, frees aren't subtracted */
+	gint64 call_bytes;        /**< bytes allocated by the current hook */
+	gint64 call_bytes_max;    /**< the max of .call_bytes */
+	gint64 call_bytes_limit;  /**< allocations of a hook beyond this fail, 0 to use the default of lua_scope_set_default_call_mem_limit() */
+	gboolean limit_is_logged; /**< we logged that the limit was hit */
+} lua_scope_mem_account_t;
+
+/**
+ * the memory accounting of a lua-state
+ *
+ * only touched by the allocator of the state which runs under the lock of the lua-scope.
+ * The counts are gathered here and added to the shard of the current event-thread in
+ * batches, see lua_scope_mem_fold()
+ */
+typedef struct {
+	gint64 bytes;          /**< bytes allocated by the state */
+	gint64 bytes_max;      /**< the max of .bytes */
+	gint64 bytes_limit;    /**< allocations beyond this fail, 0 to use the default of lua_scope_set_default_mem_limit() */
+	gboolean limit_is_logged; /**< we logged that the limit was hit */
+
+	gint64 pending_allocs; /**< not yet folded into the chassis-stats */
+	gint64 pending_frees;
+	gint64 pending_bytes;
+
+	lua_scope_mem_account_t *account; /**< the connection whose hook runs, NULL if none */
+
+	gpointer free_blocks[LUA_SCOPE_MEM_CLASSES]; /**< the cached free blocks of each size-class, linked through their first word */
+	guint free_blocks_len[LUA_SCOPE_MEM_CLASSES];
+	gint64 cached_bytes;   /**< bytes held in .free_blocks */
+} lua_scope_mem_t;
 
 typedef struct {
 #ifdef HAVE_LUA_H
@@ -40,8 +94,11 @@ typedef struct {
 	int L_ref;
 #endif
 	GMutex *mutex;
+	chassis_lock_stats_t mutex_stats;
 
 	int L_top;
+
+	lua_scope_mem_t mem;   /**< the userdata of the allocator of .L */
 } lua_scope;
 
 CHASSIS_API lua_scope *lua_scope_init(void) G_GNUC_DEPRECATED;
@@ -51,6 +108,18 @@ CHASSIS_API void lua_scope_free(lua_scope *sc);
 CHASSIS_API void lua_scope_get(lua_scope *sc, const char* pos);
 CHASSIS_API void lua_scope_release(lua_scope *sc, const char* pos);
 
+CHASSIS_API void lua_scope_mem_fold(lua_scope_mem_t *mem);
+CHASSIS_API void lua_scope_set_mem_limit(lua_scope *sc, gint64 bytes_limit);
+CHASSIS_API void lua_scope_set_default_mem_limit(gint64 bytes_limit);
+CHASSIS_API void lua_scope_set_alloc_cache(gboolean is_enabled);
+CHASSIS_API void lua_scope_set_mem_account(lua_scope *sc, lua_scope_mem_account_t *account);
+CHASSIS_API void lua_scope_set_default_call_mem_limit(gint64 bytes_limit);
+
+CHASSIS_API int lua_scope_scripts_check(void);
+CHASSIS_API void lua_scope_scripts_reload(void);
+CHASSIS_API void lua_scope_scripts_set_watched(gboolean is_watched);
+CHASSIS_API void lua_scope_chunks_get_stats(guint *compiled, guint *loaded);
+
 #define LOCK_LUA(sc) \
 	lua_scope_get(sc, G_STRLOC); 
 
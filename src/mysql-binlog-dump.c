@@ -22,6 +22,7 @@
 #include <fcntl.h>
 #include <errno.h>
 #include <string.h>
+#include <math.h> /* isfinite() */
 
 #include <glib/gstdio.h>
 
@@ -37,6 +38,7 @@
 #include "chassis-keyfile.h"
 #include "network-mysqld-proto.h"
 #include "network-mysqld-binlog.h"
+#include "network-address.h"
 
 #define S(x) x->str, x->len
 
@@ -82,7 +84,6 @@ void network_mysqld_proto_field_free(network_mysqld_proto_field *field) {
 	case MYSQL_TYPE_LONGLONG:
 
 	case MYSQL_TYPE_DECIMAL:
-	case MYSQL_TYPE_NEWDECIMAL:
 
 	case MYSQL_TYPE_ENUM:
 	case MYSQL_TYPE_SET:
@@ -90,6 +91,7 @@ void network_mysqld_proto_field_free(network_mysqld_proto_field *field) {
 	case MYSQL_TYPE_DOUBLE:
 	case MYSQL_TYPE_FLOAT:
 		break;
+	case MYSQL_TYPE_NEWDECIMAL:
 	case MYSQL_TYPE_BIT:
 	case MYSQL_TYPE_GEOMETRY:
 	case MYSQL_TYPE_TINY_BLOB:
@@ -112,6 +114,80 @@ void network_mysqld_proto_field_free(network_mysqld_proto_field *field) {
 	g_free(field);
 }
 
+/**
+ * decode a binary encoded DECIMAL(precision, scale) into a string
+ *
+ * the digits are stored in groups of 9 digits in 4 bytes, big-endian. The
+ * digits that don't fill a group are stored in as few bytes as possible. The
+ * first bit is inverted to get the sign, negative values have all bits inverted.
+ *
+ * @param buf the decimal, as many bytes as network_mysqld_proto_field_get() skips for it
+ */
+static gchar *network_mysqld_proto_decimal_to_string(const guchar *buf, guint precision, guint scale) {
+	static const guchar digits_per_bytes[] = { 0, 1, 1, 2, 2, 3, 3, 4, 4, 4 };
+	guint i_digits = precision - scale;
+	guint f_digits = scale;
+	guchar mask = (buf[0] & 0x80) ? 0x00 : 0xff;
+	gboolean is_first_byte = TRUE;
+	GString *out;
+	gsize int_start;
+	guint block, blocks;
+
+	out = g_string_new(mask ? "-" : "");
+	int_start = out->len;
+
+#define DECIMAL_GET_BLOCK(_n, _v) do { \
+		guint _i; \
+		_v = 0; \
+		for (_i = 0; _i < (_n); _i++) { \
+			guchar _c = *buf++ ^ mask; \
+			if (is_first_byte) { _c ^= 0x80; is_first_byte = FALSE; } \
+			_v = (_v << 8) | _c; \
+		} \
+	} while (0)
+
+	if (i_digits % 9) {
+		guint32 v;
+
+		DECIMAL_GET_BLOCK(digits_per_bytes[i_digits % 9], v);
+		g_string_append_printf(out, "%u", v);
+	}
+
+	for (block = 0, blocks = i_digits / 9; block < blocks; block++) {
+		guint32 v;
+
+		DECIMAL_GET_BLOCK(4, v);
+		g_string_append_printf(out, "%09u", v);
+	}
+
+	/* strip the leading zeros, but keep one in front of the . */
+	while (out->len - int_start > 1 && out->str[int_start] == '0') {
+		g_string_erase(out, int_start, 1);
+	}
+	if (out->len == int_start) g_string_append_c(out, '0');
+
+	if (f_digits) {
+		g_string_append_c(out, '.');
+
+		for (block = 0, blocks = f_digits / 9; block < blocks; block++) {
+			guint32 v;
+
+			DECIMAL_GET_BLOCK(4, v);
+			g_string_append_printf(out, "%09u", v);
+		}
+
+		if (f_digits % 9) {
+			guint32 v;
+
+			DECIMAL_GET_BLOCK(digits_per_bytes[f_digits % 9], v);
+			g_string_append_printf(out, "%0*u", f_digits % 9, v);
+		}
+	}
+#undef DECIMAL_GET_BLOCK
+
+	return g_string_free(out, FALSE);
+}
+
 int network_mysqld_proto_field_get(network_packet *packet, 
 		network_mysqld_proto_field *field) {
 	guint64 length;
@@ -125,6 +201,7 @@ int network_mysqld_proto_field_get(network_packet *packet,
 	switch ((guchar)field->fielddef->type) {
 	case MYSQL_TYPE_BIT:
 		err = err || network_mysqld_proto_get_string_len(packet, &field->data.s, field->fielddef->max_length);
+		if (!err) field->data_len = field->fielddef->max_length;
 		break;
 	case MYSQL_TYPE_FLOAT: /* float4store */
 		s = NULL;
@@ -254,17 +331,20 @@ int network_mysqld_proto_field_get(network_packet *packet,
 			break;
 		}
 		err = err || network_mysqld_proto_get_string_len(packet, &field->data.s, length);
+		if (!err) field->data_len = length;
 		break;
 	case MYSQL_TYPE_VARCHAR:
 	case MYSQL_TYPE_VAR_STRING:
 	case MYSQL_TYPE_STRING:
 		if (field->fielddef->max_length < 256) {
 			err = err || network_mysqld_proto_get_int8(packet, &i8);
-			err = err || network_mysqld_proto_get_string_len(packet, &field->data.s, i8);
+			if (!err) length = i8;
 		} else {
 			err = err || network_mysqld_proto_get_int16(packet, &i16);
-			err = err || network_mysqld_proto_get_string_len(packet, &field->data.s, i16);
+			if (!err) length = i16;
 		}
+		err = err || network_mysqld_proto_get_string_len(packet, &field->data.s, length);
+		if (!err) field->data_len = length;
 
 		break;
 	case MYSQL_TYPE_NEWDECIMAL: {
@@ -286,18 +366,14 @@ int network_mysqld_proto_field_get(network_packet *packet,
 		size += decimal_full_blocks * digits_per_bytes[9] + digits_per_bytes[decimal_last_block_digits];
 		size += scale_full_blocks   * digits_per_bytes[9] + digits_per_bytes[scale_last_block_digits];
 
-#if 0
-		g_debug_hexdump(G_STRLOC " (NEWDECIMAL)", packet->data->str, packet->data->len);
-#endif
-#if 0
-		g_critical("%s: don't know how to decode NEWDECIMAL(%lu, %u) at offset %u (%d)",
-				G_STRLOC,
-				field->fielddef->max_length,
-				field->fielddef->decimals,
-				packet->offset,
-				size
-				);
-#endif
+		err = err || (packet->offset + size > packet->data->len);
+		if (!err) {
+			field->data.s = network_mysqld_proto_decimal_to_string(
+					(const guchar *)packet->data->str + packet->offset,
+					field->fielddef->max_length,
+					field->fielddef->decimals);
+			field->data_len = strlen(field->data.s);
+		}
 		err = err || network_mysqld_proto_skip(packet, size);
 		break; }
 	default:
@@ -442,6 +518,21 @@ const char *network_mysqld_binlog_get_eventname(enum Log_event_type type) {
 	return unknown_type;
 }
 
+/**
+ * get the event-type by its name
+ *
+ * @return -1 if the name isn't known
+ */
+static int network_mysqld_binlog_get_eventtype(const char *name) {
+	guint i;
+
+	for (i = 0; event_type_name[i].name; i++) {
+		if (0 == g_ascii_strcasecmp(event_type_name[i].name, name)) return event_type_name[i].type;
+	}
+
+	return -1;
+}
+
 struct {
 	enum enum_field_types type;
 	const char *name;
@@ -498,10 +589,10 @@ const char *network_mysqld_proto_field_get_typestring(enum enum_field_types type
 	return unknown_type;
 }
 
-void network_mysqld_table_print(network_mysqld_table *tbl) {
-	GString *out = g_string_new(NULL);
+static void network_mysqld_table_append_to_string(GString *out, network_mysqld_table *tbl) {
 	guint i;
 
+	g_string_append_printf(out, "-- %s:\n", G_STRLOC);
 	g_string_append_printf(out, "CREATE TABLE %s.%s (\n",
 			tbl->db_name->str,
 			tbl->table_name->str);
@@ -556,12 +647,7 @@ void network_mysqld_table_print(network_mysqld_table *tbl) {
 			break;
 		}
 	}
-	g_string_append(out, "\n)");
-
-	g_print("-- %s:\n%s\n\n",
-			G_STRLOC, out->str);
-
-	g_string_free(out, TRUE);
+	g_string_append(out, "\n)\n\n");
 }
 
 static int network_mysqld_proto_field_append_to_string(GString *out, network_mysqld_proto_field *field) {
@@ -603,7 +689,7 @@ static int network_mysqld_proto_field_append_to_string(GString *out, network_mys
 		g_string_append_printf(out, "'...(bit)'");
 		break;
 	case MYSQL_TYPE_NEWDECIMAL:
-		g_string_append_printf(out, "'...(decimal)'");
+		g_string_append(out, field->data.s);
 		break;
 	default:
 		g_error("%s: field-type '%s' (%d) isn't known",
@@ -617,402 +703,1245 @@ static int network_mysqld_proto_field_append_to_string(GString *out, network_mys
 }
 
 /**
- * decode a binlog event
+ * the output formats of the events
+ *
+ * the CDC formats (JSON, BINARY) only contain the row-changes, the queries and the commits
  */
-int network_mysqld_binlog_event_print(network_mysqld_binlog *binlog, 
-		network_mysqld_binlog_event *event) {
-	guint i, field_ndx;
-	network_mysqld_table *tbl;
-	int err = 0;
-#if 0
-	g_message("%s: timestamp = %u, type = %u, server-id = %u, size = %u, pos = %u, flags = %04x",
-			G_STRLOC,
-			event->timestamp,
-			event->event_type,
-			event->server_id,
-			event->event_size,
-			event->log_pos,
-			event->flags);
-#endif
+typedef enum {
+	BINLOG_DUMP_FORMAT_SQL,    /**< SQL-like text for humans */
+	BINLOG_DUMP_FORMAT_JSON,   /**< one JSON object per line */
+	BINLOG_DUMP_FORMAT_BINARY  /**< length-prefixed records */
+} binlog_dump_format;
 
-	switch (event->event_type) {
-	case QUERY_EVENT: /* 2 */
-#if 0
-		g_message("%s: QUERY: thread_id = %d, exec_time = %d, error-code = %d\ndb = %s, query = %s",
-				G_STRLOC,
-				event->event.query_event.thread_id,
-				event->event.query_event.exec_time,
-				event->event.query_event.error_code,
-				event->event.query_event.db_name ? event->event.query_event.db_name : "(null)",
-				event->event.query_event.query ? event->event.query_event.query : "(null)"
-			 );
-#else
-		g_print("-- %s: db = %s\n%s\n\n",
-				G_STRLOC,
-				event->event.query_event.db_name ? event->event.query_event.db_name : "(null)",
-				event->event.query_event.query ? event->event.query_event.query : "(null)"
-			 );
+/**
+ * the records of BINLOG_DUMP_FORMAT_BINARY
+ *
+ * all integers are little-endian like in the mysql protocol:
+ *
+ *   int<4>        length of the record without this field
+ *   int<1>        record-type
+ *   int<4>        timestamp of the event
+ *   int<4>        binlog-position of the next event
+ *
+ * INSERT, UPDATE, DELETE:
+ *
+ *   lenenc-str    db-name
+ *   lenenc-str    table-name
+ *   lenenc-int    number of columns of the table
+ *   image         the row before the change (UPDATE, DELETE)
+ *   image         the row after the change (INSERT, UPDATE)
+ *
+ *   an image is the bitmap of the columns it has ((columns + 7) / 8 bytes) followed
+ *   by a lenenc-str per column in the bitmap: its value as text, 0xfb for NULL
+ *
+ * QUERY:
+ *
+ *   lenenc-str    default db
+ *   lenenc-str    query
+ *
+ * COMMIT:
+ *
+ *   int<8>        xid
+ */
+typedef enum {
+	BINLOG_DUMP_RECORD_INSERT = 1,
+	BINLOG_DUMP_RECORD_UPDATE = 2,
+	BINLOG_DUMP_RECORD_DELETE = 3,
+	BINLOG_DUMP_RECORD_QUERY  = 4,
+	BINLOG_DUMP_RECORD_COMMIT = 5
+} binlog_dump_record_type;
 
-#endif
+/**
+ * append the value of a field as text, strings and blobs as they are
+ */
+static void network_mysqld_proto_field_append_value(GString *out, network_mysqld_proto_field *field) {
+	switch((guchar)field->fielddef->type) {
+	case MYSQL_TYPE_FLOAT:
+	case MYSQL_TYPE_DOUBLE: {
+		gchar buf[G_ASCII_DTOSTR_BUF_SIZE];
+
+		g_string_append(out, g_ascii_dtostr(buf, sizeof(buf), field->data.d));
+		break; }
+	case MYSQL_TYPE_GEOMETRY:
+	case MYSQL_TYPE_TINY_BLOB:
+	case MYSQL_TYPE_BLOB:
+	case MYSQL_TYPE_MEDIUM_BLOB:
+	case MYSQL_TYPE_LONG_BLOB:
+	case MYSQL_TYPE_BIT:
+	case MYSQL_TYPE_VARCHAR:
+	case MYSQL_TYPE_VAR_STRING:
+	case MYSQL_TYPE_STRING:
+	case MYSQL_TYPE_NEWDECIMAL:
+		if (field->data.s) g_string_append_len(out, field->data.s, field->data_len);
 		break;
-	case STOP_EVENT:
+	default:
+		network_mysqld_proto_field_append_to_string(out, field);
 		break;
-	case TABLE_MAP_EVENT:
-		tbl = network_mysqld_table_new();
+	}
+}
 
-		network_mysqld_binlog_event_tablemap_get(event, tbl);
-	
-		g_hash_table_insert(binlog->rbr_tables, guint64_new(tbl->table_id), tbl);
+static void binlog_dump_json_append_string(GString *out, const gchar *s, gsize s_len) {
+	gsize i;
 
-		network_mysqld_table_print(tbl);
-		break; 
-	case FORMAT_DESCRIPTION_EVENT: /* 15 */
-		g_print("-- format-description:\n");
-		g_print("--   file-version: %d\n", event->event.format_event.binlog_version);
-		g_print("--   writer-version: %s\n", event->event.format_event.master_version);
-		g_print("--   created: %d\n", event->event.format_event.created_ts);
-		g_print("--   no. of known events: %"G_GSIZE_FORMAT"\n", event->event.format_event.perm_events_len);
-		break;
-	case INTVAR_EVENT: /* 5 */
-	 	break;
-	case XID_EVENT: /* 16 */
-		g_print("COMMIT /* xid = %"G_GUINT64_FORMAT" */\n", event->event.xid.xid_id);
-		break;
-	case ROTATE_EVENT: /* 4 */
-		g_print("-- rotating to %s, pos %u\n", event->event.rotate_event.binlog_file,  event->event.rotate_event.binlog_pos);
-		break;
-	case WRITE_ROWS_EVENT:
-	case UPDATE_ROWS_EVENT:
-	case DELETE_ROWS_EVENT: {
-		network_packet row_packet;
-		GString row;
-		tbl = g_hash_table_lookup(binlog->rbr_tables, &(event->event.row_event.table_id));
+	g_string_append_c(out, '"');
+	for (i = 0; i < s_len; i++) {
+		guchar c = s[i];
 
-		if (!tbl) {
-			g_critical("%s: table-id: %"G_GUINT64_FORMAT" isn't known, needed for a %d event",
-					G_STRLOC,
-					event->event.row_event.table_id,
-					event->event_type
-					);
+		switch (c) {
+		case '"':  g_string_append(out, "\\\""); break;
+		case '\\': g_string_append(out, "\\\\"); break;
+		case '\n': g_string_append(out, "\\n"); break;
+		case '\r': g_string_append(out, "\\r"); break;
+		case '\t': g_string_append(out, "\\t"); break;
+		default:
+			if (c < 0x20) {
+				g_string_append_printf(out, "\\u%04x", c);
+			} else {
+				g_string_append_c(out, c);
+			}
 			break;
 		}
+	}
+	g_string_append_c(out, '"');
+}
 
-		row.str = event->event.row_event.row;
-		row.len = event->event.row_event.row_len;
+/**
+ * append a field as JSON value
+ *
+ * numbers as numbers, DECIMALs as strings to keep their precision, blobs and
+ * bits as base64 strings
+ */
+static void network_mysqld_proto_field_append_json(GString *out, network_mysqld_proto_field *field) {
+	if (field->is_null) {
+		g_string_append(out, "null");
+		return;
+	}
 
-		row_packet.data = &row;
-		row_packet.offset = 0;
-#if 0
-		g_debug_hexdump(G_STRLOC " (used colums)", event->event.row_event.used_columns, event->event.row_event.used_columns_len);
-#endif
+	switch((guchar)field->fielddef->type) {
+	case MYSQL_TYPE_FLOAT:
+	case MYSQL_TYPE_DOUBLE:
+		if (isfinite(field->data.d)) {
+			network_mysqld_proto_field_append_value(out, field);
+		} else {
+			g_string_append(out, "null");
+		}
+		break;
+	case MYSQL_TYPE_GEOMETRY:
+	case MYSQL_TYPE_TINY_BLOB:
+	case MYSQL_TYPE_BLOB:
+	case MYSQL_TYPE_MEDIUM_BLOB:
+	case MYSQL_TYPE_LONG_BLOB:
+	case MYSQL_TYPE_BIT: {
+		gchar *b64;
+
+		b64 = g_base64_encode((const guchar *)(field->data.s ? field->data.s : ""), field->data.s ? field->data_len : 0);
+		g_string_append_printf(out, "\"%s\"", b64);
+		g_free(b64);
+		break; }
+	case MYSQL_TYPE_VARCHAR:
+	case MYSQL_TYPE_VAR_STRING:
+	case MYSQL_TYPE_STRING:
+	case MYSQL_TYPE_NEWDECIMAL:
+		binlog_dump_json_append_string(out, field->data.s ? field->data.s : "", field->data.s ? field->data_len : 0);
+		break;
+	default:
+		network_mysqld_proto_field_append_value(out, field);
+		break;
+	}
+}
 
-		do {
-			GPtrArray *pre_fields, *post_fields = NULL;
-			GString *out = g_string_new(NULL);
-			gchar *post_bits = NULL, *pre_bits;
+/**
+ * append the columns of a row-image as JSON object
+ *
+ * the TABLE_MAP has no column-names, they are named field_<n> as in the SQL output
+ */
+static void network_mysqld_binlog_row_image_append_json(GString *out,
+		network_mysqld_table *tbl,
+		const gchar *used_columns,
+		GPtrArray *fields) {
+	guint i, field_ndx;
 
-			err = err || network_mysqld_proto_get_string_len(
-					&row_packet, 
-					&pre_bits,
-					event->event.row_event.null_bits_before_len);
+	g_string_append_c(out, '{');
+	for (i = 0, field_ndx = 0; i < tbl->fields->len; i++) {
+		if (!((used_columns[i / 8] >> (i % 8)) & 0x1)) continue;
 
-			if (err) break;
+		if (field_ndx > 0) g_string_append_c(out, ',');
+		g_string_append_printf(out, "\"field_%u\":", i);
+		network_mysqld_proto_field_append_json(out, fields->pdata[field_ndx++]);
+	}
+	g_string_append_c(out, '}');
+}
 
-			pre_fields = network_mysqld_proto_fields_new_full(tbl->fields,
-					event->event.row_event.used_columns_before,
-					event->event.row_event.used_columns_before_len,
-					pre_bits, 
-					event->event.row_event.null_bits_before_len);
+static void network_mysqld_binlog_row_image_append_binary(GString *out,
+		network_mysqld_table *tbl,
+		const gchar *used_columns,
+		GPtrArray *fields,
+		GString *value) {
+	guint i;
 
-			if (NULL == pre_fields) {
-				err = 1;
-				break;
-			}
+	g_string_append_len(out, used_columns, (tbl->fields->len + 7) / 8);
 
-			if (network_mysqld_proto_fields_get(&row_packet, pre_fields)) {
-				break;
-			}
+	for (i = 0; i < fields->len; i++) {
+		network_mysqld_proto_field *field = fields->pdata[i];
 
-			if (event->event_type == UPDATE_ROWS_EVENT) {
-				err = err || network_mysqld_proto_get_string_len(
-						&row_packet, 
-						&post_bits,
-						event->event.row_event.null_bits_after_len);
+		if (field->is_null) {
+			network_mysqld_proto_append_lenenc_string_len(out, NULL, 0);
+		} else {
+			g_string_truncate(value, 0);
+			network_mysqld_proto_field_append_value(value, field);
+			network_mysqld_proto_append_lenenc_string_len(out, S(value));
+		}
+	}
+}
 
-				if (err) break;
-		
-				post_fields = network_mysqld_proto_fields_new_full(tbl->fields, 
-					event->event.row_event.used_columns_after,
-					event->event.row_event.used_columns_after_len,
-					post_bits, 
-					event->event.row_event.null_bits_after_len);
-				if (NULL == post_fields) {
-					err = 1;
-					break;
-				}
-				if (network_mysqld_proto_fields_get(&row_packet, post_fields)) {
-					break;
-				}
-			}
+/**
+ * start a record of BINLOG_DUMP_FORMAT_BINARY
+ *
+ * @return the offset of the record, pass it to binlog_dump_record_end()
+ */
+static gsize binlog_dump_record_start(GString *out, binlog_dump_record_type type, network_mysqld_binlog_event *event) {
+	gsize record_offset = out->len;
 
-			/* call lua */
-
-			switch (event->event_type) {
-			case UPDATE_ROWS_EVENT:
-				g_string_append_printf(out, "UPDATE %s.%s\n   SET ",
-						tbl->db_name->str,
-						tbl->table_name->str);
-
-				for (i = 0, field_ndx = 0; i < tbl->fields->len; i++) {
-					guint col_byteoffset = i / 8;
-					guint col_bitoffset = i % 8;
-
-					if ((event->event.row_event.used_columns_after[col_byteoffset] >> col_bitoffset) & 0x1) {
-						network_mysqld_proto_field *field = post_fields->pdata[field_ndx++];
-
-						if (field_ndx > 1) {
-							g_string_append_printf(out, ", ");
-						}
-						g_string_append_printf(out, "field_%d ", i);
-
-						if (field->is_null) {
-							g_string_append(out, "= NULL");
-						} else {
-							g_string_append(out, "= ");
-							network_mysqld_proto_field_append_to_string(out, field);
-						}
-					}
-				}
+	network_mysqld_proto_append_int32(out, 0); /* set by binlog_dump_record_end() */
+	network_mysqld_proto_append_int8(out, type);
+	network_mysqld_proto_append_int32(out, event->timestamp);
+	network_mysqld_proto_append_int32(out, event->log_pos);
 
-				g_string_append_printf(out, "\n WHERE ");
-
-				for (i = 0, field_ndx = 0; i < tbl->fields->len; i++) {
-					guint col_byteoffset = i / 8;
-					guint col_bitoffset = i % 8;
-
-					if ((event->event.row_event.used_columns_before[col_byteoffset] >> col_bitoffset) & 0x1) {
-						network_mysqld_proto_field *field = pre_fields->pdata[field_ndx++];
-						if (field_ndx > 1) {
-							g_string_append_printf(out, " AND ");
-						}
-
-						g_string_append_printf(out, "field_%d ", i);
-						if (field->is_null) {
-							g_string_append(out, "IS NULL");
-						} else {
-							g_string_append(out, "= ");
-							network_mysqld_proto_field_append_to_string(out, field);
-						}
-					}
-				}
-				break;
-			case WRITE_ROWS_EVENT:
-				g_string_append_printf(out, "INSERT INTO %s.%s ",
-						tbl->db_name->str,
-						tbl->table_name->str);
-
-				/* ... get the column-index right */
-				g_string_append(out, "(");
-				for (i = 0; i < tbl->fields->len; i++) {
-					guint col_byteoffset = i / 8;
-					guint col_bitoffset = i % 8;
-
-					if ((event->event.row_event.used_columns_before[col_byteoffset] >> col_bitoffset) & 0x1) {
-						if (out->str[out->len - 1] != '(') g_string_append(out, ", ");
-
-						g_string_append_printf(out, "field_%d", i);
-					}
-				}
-				g_string_append(out, ")");
-
-				g_string_append(out, " VALUES\n  (");
-
-				for (i = 0; i < pre_fields->len; i++) {
-					network_mysqld_proto_field *field = pre_fields->pdata[i];
-					if (i > 0) {
-						g_string_append_printf(out, ", ");
-					}
-					if (field->is_null) {
-						g_string_append(out, "NULL");
-					} else {
-						network_mysqld_proto_field_append_to_string(out, field);
-					}
-				}
+	return record_offset;
+}
 
-				g_string_append_printf(out, ")");
-				break;
-			case DELETE_ROWS_EVENT:
-				g_string_append_printf(out, "DELETE FROM %s.%s\n WHERE ",
-						tbl->db_name->str,
-						tbl->table_name->str);
-
-				for (i = 0, field_ndx = 0; i < tbl->fields->len; i++) {
-					guint col_byteoffset = i / 8;
-					guint col_bitoffset = i % 8;
-
-					if ((event->event.row_event.used_columns_before[col_byteoffset] >> col_bitoffset) & 0x1) {
-						network_mysqld_proto_field *field = pre_fields->pdata[field_ndx++];
-						if (field_ndx > 1) {
-							g_string_append_printf(out, " AND ");
-						}
-						g_string_append_printf(out, "field_%d ", i);
-						if (field->is_null) {
-							g_string_append(out, "IS NULL");
-						} else {
-							g_string_append(out, "= ");
-							network_mysqld_proto_field_append_to_string(out, field);
-						}
-					}
-				}
-				break;
+static void binlog_dump_record_end(GString *out, gsize record_offset) {
+	guint32 record_len = out->len - record_offset - 4;
 
-			default:
-				break;
-			}
+	out->str[record_offset + 0] = (record_len >>  0) & 0xff;
+	out->str[record_offset + 1] = (record_len >>  8) & 0xff;
+	out->str[record_offset + 2] = (record_len >> 16) & 0xff;
+	out->str[record_offset + 3] = (record_len >> 24) & 0xff;
+}
+
+/**
+ * append a decoded row as CDC record
+ */
+static void network_mysqld_binlog_row_append_cdc(GString *out,
+		binlog_dump_format format,
+		network_mysqld_table *tbl,
+		network_mysqld_binlog_event *event,
+		GPtrArray *pre_fields,
+		GPtrArray *post_fields) {
+	binlog_dump_record_type type;
+	const char *type_name;
 
-			g_print("%s\n\n", out->str);
+	switch (event->event_type) {
+	case WRITE_ROWS_EVENT:  type = BINLOG_DUMP_RECORD_INSERT; type_name = "insert"; break;
+	case UPDATE_ROWS_EVENT: type = BINLOG_DUMP_RECORD_UPDATE; type_name = "update"; break;
+	case DELETE_ROWS_EVENT: type = BINLOG_DUMP_RECORD_DELETE; type_name = "delete"; break;
+	default: return;
+	}
 
-			g_string_free(out, TRUE);
+	if (format == BINLOG_DUMP_FORMAT_BINARY) {
+		GString *value = g_string_new(NULL);
+		gsize record_offset;
 
-			if (pre_fields) network_mysqld_proto_fields_free(pre_fields);
-			if (post_fields) network_mysqld_proto_fields_free(post_fields);
-			if (pre_bits) g_free(pre_bits);
-			if (post_bits) g_free(post_bits);
-		} while (row_packet.data->len > row_packet.offset);
+		record_offset = binlog_dump_record_start(out, type, event);
+		network_mysqld_proto_append_lenenc_string_len(out, S(tbl->db_name));
+		network_mysqld_proto_append_lenenc_string_len(out, S(tbl->table_name));
+		network_mysqld_proto_append_lenenc_int(out, tbl->fields->len);
 
-		if (0 == err) {
-			if (row_packet.offset != row_packet.data->len) {
-				g_debug("%s: event_type %d: offset = %d, length = %"G_GSIZE_FORMAT,
-						G_STRLOC,
-						event->event_type,
-						row_packet.offset,
-						row_packet.data->len);
-			}
+		/* a WRITE_ROWS has the image after the change in the first bitmap */
+		network_mysqld_binlog_row_image_append_binary(out, tbl, event->event.row_event.used_columns_before, pre_fields, value);
+		if (post_fields) {
+			network_mysqld_binlog_row_image_append_binary(out, tbl, event->event.row_event.used_columns_after, post_fields, value);
 		}
+		binlog_dump_record_end(out, record_offset);
 
-		break; }
-	case ROWS_QUERY_LOG_EVENT:
-		g_print("-- next RBR query: %s\n", event->event.rows_query.query);
-		break;
+		g_string_free(value, TRUE);
 
-	default:
-		g_message("%s: unknown event-type: %d",
-				G_STRLOC,
-				event->event_type);
-		return -1;
+		return;
 	}
-	return err ? -1 : 0;
+
+	g_string_append_printf(out, "{\"type\":\"%s\",\"timestamp\":%u,\"log_pos\":%u,\"db\":",
+			type_name,
+			event->timestamp,
+			event->log_pos);
+	binlog_dump_json_append_string(out, S(tbl->db_name));
+	g_string_append(out, ",\"table\":");
+	binlog_dump_json_append_string(out, S(tbl->table_name));
+
+	g_string_append(out, type == BINLOG_DUMP_RECORD_INSERT ? ",\"after\":" : ",\"before\":");
+	network_mysqld_binlog_row_image_append_json(out, tbl, event->event.row_event.used_columns_before, pre_fields);
+	if (post_fields) {
+		g_string_append(out, ",\"after\":");
+		network_mysqld_binlog_row_image_append_json(out, tbl, event->event.row_event.used_columns_after, post_fields);
+	}
+	g_string_append(out, "}\n");
 }
 
 /**
- * read a binlog file
+ * append a decoded row as SQL
  */
-int replicate_binlog_dump_file(
-		const char *filename, 
-		gint startpos,
-		gboolean find_startpos,
-		gint stoppos
-		) {
-	int fd;
-	char binlog_header[4];
-	network_packet *packet;
-	network_mysqld_binlog *binlog;
-	network_mysqld_binlog_event *event;
-	off_t binlog_pos;
-	int round = 0;
-	int ret = 0;
-
-	if (-1 == (fd = g_open(filename, O_RDONLY, 0))) {
-		g_critical("%s: opening '%s' failed: %s",
-				G_STRLOC,
-				filename,
-				g_strerror(errno));
-		return -1;
-	}
-
-	if (4 != read(fd, binlog_header, 4)) {
-		g_return_val_if_reached(-1);
-	}
+static void network_mysqld_binlog_row_append_sql(GString *out,
+		network_mysqld_table *tbl,
+		network_mysqld_binlog_event *event,
+		GPtrArray *pre_fields,
+		GPtrArray *post_fields) {
+	guint i, field_ndx;
 
-	if (binlog_header[0] != '\xfe' ||
-	    binlog_header[1] != 'b' ||
-	    binlog_header[2] != 'i' ||
-	    binlog_header[3] != 'n') {
+	switch (event->event_type) {
+	case UPDATE_ROWS_EVENT:
+		g_string_append_printf(out, "UPDATE %s.%s\n   SET ",
+				tbl->db_name->str,
+				tbl->table_name->str);
 
-		g_critical("%s: binlog-header should be: %02x%02x%02x%02x, got %02x%02x%02x%02x",
-				G_STRLOC,
-				'\xfe', 'b', 'i', 'n',
-				binlog_header[0],
-				binlog_header[1],
-				binlog_header[2],
-				binlog_header[3]
-				);
-
-		g_return_val_if_reached(-1);
-	}
+		for (i = 0, field_ndx = 0; i < tbl->fields->len; i++) {
+			guint col_byteoffset = i / 8;
+			guint col_bitoffset = i % 8;
 
-	packet = network_packet_new();
-	packet->data = g_string_new(NULL);
-	g_string_set_size(packet->data, 19 + 1);
+			if ((event->event.row_event.used_columns_after[col_byteoffset] >> col_bitoffset) & 0x1) {
+				network_mysqld_proto_field *field = post_fields->pdata[field_ndx++];
 
-	binlog = network_mysqld_binlog_new();
-	binlog_pos = 4;
+				if (field_ndx > 1) {
+					g_string_append_printf(out, ", ");
+				}
+				g_string_append_printf(out, "field_%d ", i);
 
-	if (startpos) {
-		if (-1 == lseek(fd, startpos, SEEK_SET)) {
-			g_critical("%s: lseek(%d) failed: %s", 
-					G_STRLOC,
-					startpos,
-					g_strerror(errno)
-					);
-			g_return_val_if_reached(-1);
+				if (field->is_null) {
+					g_string_append(out, "= NULL");
+				} else {
+					g_string_append(out, "= ");
+					network_mysqld_proto_field_append_to_string(out, field);
+				}
+			}
 		}
 
-		binlog_pos = startpos;
-	}
-
-	if (find_startpos) {
-		/* check if the current binlog-pos is valid,
-		 *
-		 * if not, just skip a byte a retry until we found a valid header
-		 * */
-		while (19 == (packet->data->len = read(fd, packet->data->str, 19))) {
-			packet->data->str[packet->data->len] = '\0'; /* term the string */
-			packet->offset = 0;
+		g_string_append_printf(out, "\n WHERE ");
 
-			g_assert_cmpint(packet->data->len, ==, 19);
+		for (i = 0, field_ndx = 0; i < tbl->fields->len; i++) {
+			guint col_byteoffset = i / 8;
+			guint col_bitoffset = i % 8;
 
-			event = network_mysqld_binlog_event_new();
-			network_mysqld_proto_get_binlog_event_header(packet, event);
+			if ((event->event.row_event.used_columns_before[col_byteoffset] >> col_bitoffset) & 0x1) {
+				network_mysqld_proto_field *field = pre_fields->pdata[field_ndx++];
+				if (field_ndx > 1) {
+					g_string_append_printf(out, " AND ");
+				}
 
-			if (event->event_size < 19 ||
-			    binlog_pos + event->event_size != event->log_pos) {
-				if (-1 == lseek(fd, -18, SEEK_CUR)) {
-					g_critical("%s: lseek(%d) failed: %s", 
-							G_STRLOC,
-							-18,
-							g_strerror(errno)
-							);
-					g_return_val_if_reached(-1);
+				g_string_append_printf(out, "field_%d ", i);
+				if (field->is_null) {
+					g_string_append(out, "IS NULL");
+				} else {
+					g_string_append(out, "= ");
+					network_mysqld_proto_field_append_to_string(out, field);
 				}
+			}
+		}
+		break;
+	case WRITE_ROWS_EVENT:
+		g_string_append_printf(out, "INSERT INTO %s.%s ",
+				tbl->db_name->str,
+				tbl->table_name->str);
 
-				binlog_pos += 1;
+		/* ... get the column-index right */
+		g_string_append(out, "(");
+		for (i = 0; i < tbl->fields->len; i++) {
+			guint col_byteoffset = i / 8;
+			guint col_bitoffset = i % 8;
 
-				g_message("%s: --binlog-start-pos isn't valid, trying to sync at %ld (attempt: %d)", 
-						G_STRLOC,
-						binlog_pos,
-						round++
-						);
+			if ((event->event.row_event.used_columns_before[col_byteoffset] >> col_bitoffset) & 0x1) {
+				if (out->str[out->len - 1] != '(') g_string_append(out, ", ");
+
+				g_string_append_printf(out, "field_%d", i);
+			}
+		}
+		g_string_append(out, ")");
+
+		g_string_append(out, " VALUES\n  (");
+
+		for (i = 0; i < pre_fields->len; i++) {
+			network_mysqld_proto_field *field = pre_fields->pdata[i];
+			if (i > 0) {
+				g_string_append_printf(out, ", ");
+			}
+			if (field->is_null) {
+				g_string_append(out, "NULL");
 			} else {
-				if (-1 == lseek(fd, -19, SEEK_CUR)) {
-					g_critical("%s: lseek(%d) failed: %s", 
-							G_STRLOC,
-							-18,
-							g_strerror(errno)
-							);
-					g_return_val_if_reached(-1);
+				network_mysqld_proto_field_append_to_string(out, field);
+			}
+		}
+
+		g_string_append_printf(out, ")");
+		break;
+	case DELETE_ROWS_EVENT:
+		g_string_append_printf(out, "DELETE FROM %s.%s\n WHERE ",
+				tbl->db_name->str,
+				tbl->table_name->str);
+
+		for (i = 0, field_ndx = 0; i < tbl->fields->len; i++) {
+			guint col_byteoffset = i / 8;
+			guint col_bitoffset = i % 8;
+
+			if ((event->event.row_event.used_columns_before[col_byteoffset] >> col_bitoffset) & 0x1) {
+				network_mysqld_proto_field *field = pre_fields->pdata[field_ndx++];
+				if (field_ndx > 1) {
+					g_string_append_printf(out, " AND ");
+				}
+				g_string_append_printf(out, "field_%d ", i);
+				if (field->is_null) {
+					g_string_append(out, "IS NULL");
+				} else {
+					g_string_append(out, "= ");
+					network_mysqld_proto_field_append_to_string(out, field);
 				}
+			}
+		}
+		break;
+
+	default:
+		break;
+	}
+
+	g_string_append(out, "\n\n");
+}
+
+/**
+ * decode the rows of a WRITE|UPDATE|DELETE_ROWS event
+ *
+ * @param tbl the table of the TABLE_MAP event before
+ */
+static int network_mysqld_binlog_event_rows_append_to_string(GString *out,
+		binlog_dump_format format,
+		network_mysqld_table *tbl,
+		network_mysqld_binlog_event *event) {
+	network_packet row_packet;
+	GString row;
+	int err = 0;
+
+	row.str = event->event.row_event.row;
+	row.len = event->event.row_event.row_len;
+
+	row_packet.data = &row;
+	row_packet.offset = 0;
+#if 0
+	g_debug_hexdump(G_STRLOC " (used colums)", event->event.row_event.used_columns, event->event.row_event.used_columns_len);
+#endif
+
+	do {
+		GPtrArray *pre_fields, *post_fields = NULL;
+		gchar *post_bits = NULL, *pre_bits;
+
+		err = err || network_mysqld_proto_get_string_len(
+				&row_packet, 
+				&pre_bits,
+				event->event.row_event.null_bits_before_len);
+
+		if (err) break;
+
+		pre_fields = network_mysqld_proto_fields_new_full(tbl->fields,
+				event->event.row_event.used_columns_before,
+				event->event.row_event.used_columns_before_len,
+				pre_bits, 
+				event->event.row_event.null_bits_before_len);
+
+		if (NULL == pre_fields) {
+			err = 1;
+			break;
+		}
+
+		if (network_mysqld_proto_fields_get(&row_packet, pre_fields)) {
+			break;
+		}
+
+		if (event->event_type == UPDATE_ROWS_EVENT) {
+			err = err || network_mysqld_proto_get_string_len(
+					&row_packet, 
+					&post_bits,
+					event->event.row_event.null_bits_after_len);
+
+			if (err) break;
+	
+			post_fields = network_mysqld_proto_fields_new_full(tbl->fields, 
+				event->event.row_event.used_columns_after,
+				event->event.row_event.used_columns_after_len,
+				post_bits, 
+				event->event.row_event.null_bits_after_len);
+			if (NULL == post_fields) {
+				err = 1;
+				break;
+			}
+			if (network_mysqld_proto_fields_get(&row_packet, post_fields)) {
+				break;
+			}
+		}
+
+		/* call lua */
+
+		if (format == BINLOG_DUMP_FORMAT_SQL) {
+			network_mysqld_binlog_row_append_sql(out, tbl, event, pre_fields, post_fields);
+		} else {
+			network_mysqld_binlog_row_append_cdc(out, format, tbl, event, pre_fields, post_fields);
+		}
+
+		if (pre_fields) network_mysqld_proto_fields_free(pre_fields);
+		if (post_fields) network_mysqld_proto_fields_free(post_fields);
+		if (pre_bits) g_free(pre_bits);
+		if (post_bits) g_free(post_bits);
+	} while (row_packet.data->len > row_packet.offset);
+
+	if (0 == err) {
+		if (row_packet.offset != row_packet.data->len) {
+			g_debug("%s: event_type %d: offset = %d, length = %"G_GSIZE_FORMAT,
+					G_STRLOC,
+					event->event_type,
+					row_packet.offset,
+					row_packet.data->len);
+		}
+	}
+
+	return err ? -1 : 0;
+}
+
+/**
+ * decode a binlog event into CDC records
+ *
+ * only the row-changes, the queries and the commits are written, the other events
+ * are only tracked
+ */
+static int network_mysqld_binlog_event_append_cdc(GString *out,
+		binlog_dump_format format,
+		network_mysqld_binlog *binlog, 
+		network_mysqld_binlog_event *event) {
+	network_mysqld_table *tbl;
+	gsize record_offset;
+	const char *db_name, *query;
+
+	switch (event->event_type) {
+	case QUERY_EVENT:
+		db_name = event->event.query_event.db_name ? event->event.query_event.db_name : "";
+		query = event->event.query_event.query ? event->event.query_event.query : "";
+
+		if (format == BINLOG_DUMP_FORMAT_BINARY) {
+			record_offset = binlog_dump_record_start(out, BINLOG_DUMP_RECORD_QUERY, event);
+			network_mysqld_proto_append_lenenc_string(out, db_name);
+			network_mysqld_proto_append_lenenc_string(out, query);
+			binlog_dump_record_end(out, record_offset);
+		} else {
+			g_string_append_printf(out, "{\"type\":\"query\",\"timestamp\":%u,\"log_pos\":%u,\"db\":",
+					event->timestamp,
+					event->log_pos);
+			binlog_dump_json_append_string(out, db_name, strlen(db_name));
+			g_string_append(out, ",\"query\":");
+			binlog_dump_json_append_string(out, query, strlen(query));
+			g_string_append(out, "}\n");
+		}
+		break;
+	case XID_EVENT:
+		if (format == BINLOG_DUMP_FORMAT_BINARY) {
+			record_offset = binlog_dump_record_start(out, BINLOG_DUMP_RECORD_COMMIT, event);
+			network_mysqld_proto_append_int64(out, event->event.xid.xid_id);
+			binlog_dump_record_end(out, record_offset);
+		} else {
+			g_string_append_printf(out, "{\"type\":\"commit\",\"timestamp\":%u,\"log_pos\":%u,\"xid\":%"G_GUINT64_FORMAT"}\n",
+					event->timestamp,
+					event->log_pos,
+					event->event.xid.xid_id);
+		}
+		break;
+	case TABLE_MAP_EVENT:
+		if (NULL == network_mysqld_binlog_table_map_get(binlog, event)) return -1;
+		break;
+	case WRITE_ROWS_EVENT:
+	case UPDATE_ROWS_EVENT:
+	case DELETE_ROWS_EVENT:
+		tbl = network_mysqld_binlog_get_table(binlog, event->event.row_event.table_id);
+
+		if (!tbl) {
+			g_critical("%s: table-id: %"G_GUINT64_FORMAT" isn't known, needed for a %d event",
+					G_STRLOC,
+					event->event.row_event.table_id,
+					event->event_type
+					);
+			return -1;
+		}
+
+		return network_mysqld_binlog_event_rows_append_to_string(out, format, tbl, event);
+	default:
+		break;
+	}
+
+	return 0;
+}
+
+/**
+ * decode a binlog event into a string
+ *
+ * TABLE_MAP events are added to the tables of the binlog, the row-events are decoded with them
+ */
+static int network_mysqld_binlog_event_append_to_string(GString *out,
+		binlog_dump_format format,
+		network_mysqld_binlog *binlog, 
+		network_mysqld_binlog_event *event) {
+	network_mysqld_table *tbl;
+	int err = 0;
+
+	if (format != BINLOG_DUMP_FORMAT_SQL) {
+		return network_mysqld_binlog_event_append_cdc(out, format, binlog, event);
+	}
+#if 0
+	g_message("%s: timestamp = %u, type = %u, server-id = %u, size = %u, pos = %u, flags = %04x",
+			G_STRLOC,
+			event->timestamp,
+			event->event_type,
+			event->server_id,
+			event->event_size,
+			event->log_pos,
+			event->flags);
+#endif
+
+	switch (event->event_type) {
+	case QUERY_EVENT: /* 2 */
+#if 0
+		g_message("%s: QUERY: thread_id = %d, exec_time = %d, error-code = %d\ndb = %s, query = %s",
+				G_STRLOC,
+				event->event.query_event.thread_id,
+				event->event.query_event.exec_time,
+				event->event.query_event.error_code,
+				event->event.query_event.db_name ? event->event.query_event.db_name : "(null)",
+				event->event.query_event.query ? event->event.query_event.query : "(null)"
+			 );
+#else
+		g_string_append_printf(out, "-- %s: db = %s\n%s\n\n",
+				G_STRLOC,
+				event->event.query_event.db_name ? event->event.query_event.db_name : "(null)",
+				event->event.query_event.query ? event->event.query_event.query : "(null)"
+			 );
+
+#endif
+		break;
+	case STOP_EVENT:
+		break;
+	case TABLE_MAP_EVENT:
+		if (NULL == (tbl = network_mysqld_binlog_table_map_get(binlog, event))) {
+			err = 1;
+			break;
+		}
+
+		network_mysqld_table_append_to_string(out, tbl);
+		break; 
+	case FORMAT_DESCRIPTION_EVENT: /* 15 */
+		g_string_append_printf(out, "-- format-description:\n");
+		g_string_append_printf(out, "--   file-version: %d\n", event->event.format_event.binlog_version);
+		g_string_append_printf(out, "--   writer-version: %s\n", event->event.format_event.master_version);
+		g_string_append_printf(out, "--   created: %d\n", event->event.format_event.created_ts);
+		g_string_append_printf(out, "--   no. of known events: %"G_GSIZE_FORMAT"\n", event->event.format_event.perm_events_len);
+		break;
+	case INTVAR_EVENT: /* 5 */
+	 	break;
+	case XID_EVENT: /* 16 */
+		g_string_append_printf(out, "COMMIT /* xid = %"G_GUINT64_FORMAT" */\n", event->event.xid.xid_id);
+		break;
+	case ROTATE_EVENT: /* 4 */
+		g_string_append_printf(out, "-- rotating to %s, pos %u\n", event->event.rotate_event.binlog_file,  event->event.rotate_event.binlog_pos);
+		break;
+	case WRITE_ROWS_EVENT:
+	case UPDATE_ROWS_EVENT:
+	case DELETE_ROWS_EVENT:
+		tbl = network_mysqld_binlog_get_table(binlog, event->event.row_event.table_id);
+
+		if (!tbl) {
+			g_critical("%s: table-id: %"G_GUINT64_FORMAT" isn't known, needed for a %d event",
+					G_STRLOC,
+					event->event.row_event.table_id,
+					event->event_type
+					);
+			break;
+		}
+
+		err = network_mysqld_binlog_event_rows_append_to_string(out, format, tbl, event);
+		break;
+	case ROWS_QUERY_LOG_EVENT:
+		g_string_append_printf(out, "-- next RBR query: %s\n", event->event.rows_query.query);
+		break;
+
+	default:
+		g_message("%s: unknown event-type: %d",
+				G_STRLOC,
+				event->event_type);
+		return -1;
+	}
+	return err ? -1 : 0;
+}
+
+#define BINLOG_DUMP_OUTPUT_BUFFER_SIZE (1024 * 1024)
+
+/**
+ * the decoded events, collected and written in large writes to stdout, a file or a socket
+ */
+typedef struct {
+	int fd;
+	gboolean close_fd;
+
+	GString *buf;
+	gboolean has_failed;  /**< a write failed, drop everything from here on */
+} binlog_dump_output;
+
+static binlog_dump_output *binlog_dump_output_new(int fd, gboolean close_fd) {
+	binlog_dump_output *output;
+
+	output = g_new0(binlog_dump_output, 1);
+	output->fd = fd;
+	output->close_fd = close_fd;
+	output->buf = g_string_sized_new(BINLOG_DUMP_OUTPUT_BUFFER_SIZE);
+
+	return output;
+}
+
+static binlog_dump_output *binlog_dump_output_open(const gchar *filename, GError **gerr) {
+	int fd;
+
+	if (-1 == (fd = g_open(filename, O_WRONLY | O_CREAT | O_TRUNC, 0660))) {
+		g_set_error(gerr, G_FILE_ERROR, g_file_error_from_errno(errno),
+				"opening '%s' failed: %s",
+				filename,
+				g_strerror(errno));
+		return NULL;
+	}
+
+	return binlog_dump_output_new(fd, TRUE);
+}
+
+/**
+ * connect to the consumer of the output
+ *
+ * @param address host:port or the path of a unix-socket
+ */
+static binlog_dump_output *binlog_dump_output_connect(const gchar *address, GError **gerr) {
+	network_address *addr;
+	int fd;
+
+	addr = network_address_new();
+
+	if (0 != network_address_set_address(addr, address)) {
+		g_set_error(gerr, G_FILE_ERROR, G_FILE_ERROR_INVAL,
+				"'%s' isn't a valid address",
+				address);
+		network_address_free(addr);
+		return NULL;
+	}
+
+	if (-1 == (fd = socket(addr->addr.common.sa_family, SOCK_STREAM, 0)) ||
+	    -1 == connect(fd, &addr->addr.common, addr->len)) {
+		g_set_error(gerr, G_FILE_ERROR, g_file_error_from_errno(errno),
+				"connecting to '%s' failed: %s",
+				address,
+				g_strerror(errno));
+		if (fd != -1) close(fd);
+		network_address_free(addr);
+		return NULL;
+	}
+
+	network_address_free(addr);
+
+	return binlog_dump_output_new(fd, TRUE);
+}
+
+static int binlog_dump_output_flush(binlog_dump_output *output) {
+	gsize written = 0;
+
+	while (!output->has_failed && written < output->buf->len) {
+		gssize len;
+
+		len = write(output->fd, output->buf->str + written, output->buf->len - written);
+		if (len == -1) {
+			if (errno == EINTR) continue;
+
+			g_critical("%s: writing the output failed: %s",
+					G_STRLOC,
+					g_strerror(errno));
+			output->has_failed = TRUE;
+			break;
+		}
+
+		written += len;
+	}
+
+	g_string_truncate(output->buf, 0);
+
+	return output->has_failed ? -1 : 0;
+}
+
+static int binlog_dump_output_write(binlog_dump_output *output, const char *s, gsize s_len) {
+	if (output->has_failed) return -1;
+
+	g_string_append_len(output->buf, s, s_len);
+
+	if (output->buf->len >= BINLOG_DUMP_OUTPUT_BUFFER_SIZE) {
+		return binlog_dump_output_flush(output);
+	}
+
+	return 0;
+}
+
+/**
+ * flush the rest of the output and close it
+ *
+ * @return 0 if everything was written, -1 otherwise
+ */
+static int binlog_dump_output_free(binlog_dump_output *output) {
+	int ret;
+
+	if (!output) return 0;
+
+	ret = binlog_dump_output_flush(output);
+
+	if (output->close_fd) close(output->fd);
+	g_string_free(output->buf, TRUE);
+	g_free(output);
+
+	return ret;
+}
+
+typedef struct binlog_dump_pipeline binlog_dump_pipeline;
+
+/**
+ * a event in the decoding pipeline
+ */
+typedef struct {
+	network_mysqld_binlog_event *event;
+	network_mysqld_table *tbl;    /**< the table of a row-event, the rows are decoded by a worker */
+
+	GString *out;
+	gboolean is_done;
+
+	binlog_dump_pipeline *pipeline;
+} binlog_dump_job;
+
+/**
+ * a TABLE_MAP that was replaced while queued row-events may still use it
+ */
+typedef struct {
+	network_mysqld_table *tbl;
+	guint64 jobs_queued;          /**< free it once all jobs before this are printed */
+} binlog_dump_retired_table;
+
+/**
+ * decode row-events in parallel and print them in binlog order
+ *
+ * - the main thread reads the events, tracks the TABLE_MAPs and decodes all other events
+ * - the workers decode the rows of the WRITE|UPDATE|DELETE_ROWS events
+ * - the main thread prints the finished events from the head of the queue
+ */
+struct binlog_dump_pipeline {
+	GThreadPool *workers;
+
+	GMutex *mutex;
+	GCond *cond;                  /**< signaled when a job is done */
+
+	GQueue *jobs;                 /**< binlog_dump_job in binlog order */
+	guint max_jobs;               /**< wait for the head of the queue if we have more jobs queued */
+
+	guint64 jobs_queued;
+	guint64 jobs_printed;
+
+	GQueue *retired_tables;       /**< binlog_dump_retired_table */
+
+	binlog_dump_format format;
+	binlog_dump_output *output;
+};
+
+static void binlog_dump_job_decode(gpointer data, gpointer G_GNUC_UNUSED user_data) {
+	binlog_dump_job *job = data;
+	binlog_dump_pipeline *pipeline = job->pipeline;
+
+	network_mysqld_binlog_event_rows_append_to_string(job->out, pipeline->format, job->tbl, job->event);
+
+	g_mutex_lock(pipeline->mutex);
+	job->is_done = TRUE;
+	g_cond_broadcast(pipeline->cond);
+	g_mutex_unlock(pipeline->mutex);
+}
+
+static binlog_dump_pipeline *binlog_dump_pipeline_new(guint threads,
+		binlog_dump_format format,
+		binlog_dump_output *output,
+		GError **gerr) {
+	binlog_dump_pipeline *pipeline;
+
+	pipeline = g_new0(binlog_dump_pipeline, 1);
+	pipeline->format = format;
+	pipeline->output = output;
+	pipeline->mutex = g_mutex_new();
+	pipeline->cond = g_cond_new();
+	pipeline->jobs = g_queue_new();
+	pipeline->retired_tables = g_queue_new();
+	pipeline->max_jobs = threads * 64;
+
+	pipeline->workers = g_thread_pool_new(binlog_dump_job_decode, NULL, threads, TRUE, gerr);
+	if (!pipeline->workers) {
+		g_queue_free(pipeline->retired_tables);
+		g_queue_free(pipeline->jobs);
+		g_cond_free(pipeline->cond);
+		g_mutex_free(pipeline->mutex);
+		g_free(pipeline);
+
+		return NULL;
+	}
+
+	return pipeline;
+}
+
+/**
+ * print the finished jobs from the head of the queue
+ *
+ * @param max_jobs wait for the head of the queue until at most max_jobs are left
+ */
+static void binlog_dump_pipeline_flush(binlog_dump_pipeline *pipeline, guint max_jobs) {
+	binlog_dump_job *job;
+	binlog_dump_retired_table *retired;
+
+	for (;;) {
+		g_mutex_lock(pipeline->mutex);
+		job = g_queue_peek_head(pipeline->jobs);
+		while (job && !job->is_done && pipeline->jobs->length > max_jobs) {
+			g_cond_wait(pipeline->cond, pipeline->mutex);
+		}
+		if (job && job->is_done) {
+			g_queue_pop_head(pipeline->jobs);
+		} else {
+			job = NULL;
+		}
+		g_mutex_unlock(pipeline->mutex);
 
+		if (!job) break;
+
+		binlog_dump_output_write(pipeline->output, S(job->out));
+		pipeline->jobs_printed++;
+
+		g_string_free(job->out, TRUE);
+		network_mysqld_binlog_event_free(job->event);
+		g_free(job);
+	}
+
+	/* the TABLE_MAPs which no queued row-event can use anymore */
+	while ((retired = g_queue_peek_head(pipeline->retired_tables)) &&
+	       retired->jobs_queued <= pipeline->jobs_printed) {
+		g_queue_pop_head(pipeline->retired_tables);
+
+		network_mysqld_table_free(retired->tbl);
+		g_free(retired);
+	}
+}
+
+/**
+ * add a event to the pipeline
+ *
+ * @param out the decoded event, the rows are appended by a worker if tbl is set
+ * @param tbl the table of a row-event, NULL if the event is decoded already
+ */
+static void binlog_dump_pipeline_push(binlog_dump_pipeline *pipeline,
+		network_mysqld_binlog_event *event,
+		network_mysqld_table *tbl,
+		GString *out) {
+	binlog_dump_job *job;
+
+	job = g_new0(binlog_dump_job, 1);
+	job->event = event;
+	job->tbl = tbl;
+	job->out = out;
+	job->pipeline = pipeline;
+	job->is_done = (tbl == NULL);
+
+	g_mutex_lock(pipeline->mutex);
+	g_queue_push_tail(pipeline->jobs, job);
+	g_mutex_unlock(pipeline->mutex);
+
+	pipeline->jobs_queued++;
+
+	if (tbl) g_thread_pool_push(pipeline->workers, job, NULL);
+
+	binlog_dump_pipeline_flush(pipeline, pipeline->max_jobs);
+}
+
+/**
+ * take the table out of the binlog before a changed TABLE_MAP event replaces it
+ *
+ * the queued row-events may still need it
+ */
+static void binlog_dump_pipeline_retire_table(binlog_dump_pipeline *pipeline,
+		network_mysqld_binlog *binlog,
+		network_mysqld_binlog_event *event) {
+	binlog_dump_retired_table *retired;
+	network_mysqld_table *tbl;
+
+	if (network_mysqld_binlog_table_map_is_cached(binlog, event)) return;
+	if (NULL == (tbl = network_mysqld_binlog_get_table(binlog, event->event.table_map_event.table_id))) return;
+
+	g_hash_table_steal(binlog->rbr_tables, &(tbl->table_id));
+
+	retired = g_new0(binlog_dump_retired_table, 1);
+	retired->tbl = tbl;
+	retired->jobs_queued = pipeline->jobs_queued;
+
+	g_queue_push_tail(pipeline->retired_tables, retired);
+}
+
+/**
+ * decode a event in the main thread or hand its rows to the workers
+ */
+static void binlog_dump_pipeline_decode(binlog_dump_pipeline *pipeline,
+		network_mysqld_binlog *binlog,
+		network_mysqld_binlog_event *event,
+		GString *out) {
+	network_mysqld_table *tbl = NULL;
+
+	switch (event->event_type) {
+	case TABLE_MAP_EVENT:
+		binlog_dump_pipeline_retire_table(pipeline, binlog, event);
+
+		network_mysqld_binlog_event_append_to_string(out, pipeline->format, binlog, event);
+		break;
+	case WRITE_ROWS_EVENT:
+	case UPDATE_ROWS_EVENT:
+	case DELETE_ROWS_EVENT:
+		tbl = network_mysqld_binlog_get_table(binlog, event->event.row_event.table_id);
+
+		if (!tbl) {
+			/* let it complain */
+			network_mysqld_binlog_event_append_to_string(out, pipeline->format, binlog, event);
+		}
+		break;
+	default:
+		network_mysqld_binlog_event_append_to_string(out, pipeline->format, binlog, event);
+		break;
+	}
+
+	binlog_dump_pipeline_push(pipeline, event, tbl, out);
+}
+
+static void binlog_dump_pipeline_free(binlog_dump_pipeline *pipeline) {
+	if (!pipeline) return;
+
+	/* wait for the workers and print the rest */
+	g_thread_pool_free(pipeline->workers, FALSE, TRUE);
+	binlog_dump_pipeline_flush(pipeline, 0);
+
+	g_assert_cmpint(pipeline->jobs->length, ==, 0);
+	g_assert_cmpint(pipeline->retired_tables->length, ==, 0);
+
+	g_queue_free(pipeline->retired_tables);
+	g_queue_free(pipeline->jobs);
+	g_cond_free(pipeline->cond);
+	g_mutex_free(pipeline->mutex);
+
+	g_free(pipeline);
+}
+
+#define BINLOG_DUMP_INDEX_INTERVAL 256
+
+/**
+ * get the index of the binlog-file
+ *
+ * @param persist load the index from <filename>.index and save it back if it grew
+ * @return the index, NULL if the binlog can't be indexed
+ */
+static network_mysqld_binlog_index *binlog_dump_index_get(network_mysqld_binlog_file *file, const char *filename, gboolean persist) {
+	network_mysqld_binlog_index *index;
+	gchar *index_filename = NULL;
+	GError *gerr = NULL;
+	guint64 indexed_len = 0;
+
+	index = network_mysqld_binlog_index_new(BINLOG_DUMP_INDEX_INTERVAL);
+
+	if (persist) {
+		index_filename = g_strdup_printf("%s.index", filename);
+
+		if (0 != network_mysqld_binlog_index_load(index, index_filename, &gerr) ||
+		    index->indexed_len > file->len) {
+			/* missing, broken or from a older binlog with the same name: rebuild it */
+			if (gerr) {
+				g_debug("%s: %s", G_STRLOC, gerr->message);
+				g_clear_error(&gerr);
+			}
+			network_mysqld_binlog_index_free(index);
+			index = network_mysqld_binlog_index_new(BINLOG_DUMP_INDEX_INTERVAL);
+		}
+
+		indexed_len = index->indexed_len;
+	}
+
+	if (0 != network_mysqld_binlog_index_update(index, file)) {
+		g_message("%s: can't index '%s' at %"G_GUINT64_FORMAT", it has a invalid event",
+				G_STRLOC,
+				filename,
+				index->indexed_len);
+		network_mysqld_binlog_index_free(index);
+		g_free(index_filename);
+
+		return NULL;
+	}
+
+	if (persist && index->indexed_len != indexed_len) {
+		if (0 != network_mysqld_binlog_index_save(index, index_filename, &gerr)) {
+			g_message("%s: saving the index '%s' failed: %s",
+					G_STRLOC,
+					index_filename,
+					gerr->message);
+			g_clear_error(&gerr);
+		}
+	}
+
+	g_free(index_filename);
+
+	return index;
+}
+
+/**
+ * move the reader to the first event that starts at or after pos or is at or after the timestamp
+ *
+ * starts at the closest index-entry and only looks at the event-headers from there
+ *
+ * @return the offset of the event, the end of the file if there is none
+ */
+static gsize binlog_dump_index_seek(network_mysqld_binlog_index *index, network_mysqld_binlog_file *file, gsize pos, guint32 timestamp) {
+	gsize offset;
+
+	offset = timestamp ?
+		network_mysqld_binlog_index_lookup_timestamp(index, timestamp) :
+		network_mysqld_binlog_index_lookup_offset(index, pos);
+
+	while (offset + NETWORK_MYSQLD_BINLOG_EVENT_HEADER_LEN <= index->indexed_len) {
+		const guchar *header = (const guchar *)file->data + offset;
+		guint32 event_timestamp, event_size;
+
+		event_timestamp = header[0] | (header[1] << 8) | (header[2] << 16) | (header[3] << 24);
+		event_size = header[9] | (header[10] << 8) | (header[11] << 16) | (header[12] << 24);
+
+		if (timestamp ? event_timestamp >= timestamp : offset >= pos) break;
+
+		offset += event_size; /* the index checked the event-sizes already */
+	}
+
+	network_mysqld_binlog_file_seek(file, offset);
+
+	return offset;
+}
+
+/**
+ * read a binlog file
+ *
+ * the file is mapped into memory, the events are decoded in place
+ *
+ * @param threads decode the row-events with this many threads, 0 to decode them in the main thread
+ * @param filter skip the unwanted events before they are decoded, may be NULL
+ * @param starttime start at the first event at or after this unix-timestamp, 0 to start at startpos
+ * @param use_index keep the index of the binlog in <filename>.index
+ * @param format how to write the decoded events to the output
+ */
+int replicate_binlog_dump_file(
+		const char *filename, 
+		gint startpos,
+		gboolean find_startpos,
+		gint stoppos,
+		gint threads,
+		network_mysqld_binlog_filter *filter,
+		guint32 starttime,
+		gboolean use_index,
+		binlog_dump_format format,
+		binlog_dump_output *output
+		) {
+	binlog_dump_pipeline *pipeline = NULL;
+	network_mysqld_binlog_index *index = NULL;
+	network_mysqld_binlog_file *file;
+	network_packet packet;
+	network_mysqld_binlog *binlog;
+	network_mysqld_binlog_event *event;
+	GError *gerr = NULL;
+	GString *out, *event_out;
+	gsize binlog_pos;
+	int round = 0;
+	int ret = 0;
+
+	if (NULL == (file = network_mysqld_binlog_file_open(filename, &gerr))) {
+		g_critical("%s: opening '%s' failed: %s",
+				G_STRLOC,
+				filename,
+				gerr->message);
+		g_error_free(gerr);
+		return -1;
+	}
+
+	if (threads > 0) {
+		if (NULL == (pipeline = binlog_dump_pipeline_new(threads, format, output, &gerr))) {
+			g_critical("%s: starting %d decoder threads failed: %s",
+					G_STRLOC,
+					threads,
+					gerr->message);
+			g_error_free(gerr);
+			network_mysqld_binlog_file_free(file);
+			return -1;
+		}
+	}
+
+	binlog = network_mysqld_binlog_new();
+	binlog_pos = NETWORK_MYSQLD_BINLOG_HEADER_LEN;
+
+	if (startpos) {
+		if (0 != network_mysqld_binlog_file_seek(file, startpos)) {
+			g_critical("%s: --binlog-start-pos=%d is past the end of the file",
+					G_STRLOC,
+					startpos
+					);
+			binlog_dump_pipeline_free(pipeline);
+			network_mysqld_binlog_free(binlog);
+			network_mysqld_binlog_file_free(file);
+			return -1;
+		}
+
+		binlog_pos = startpos;
+	}
+
+	if (starttime || find_startpos || use_index) {
+		index = binlog_dump_index_get(file, filename, use_index);
+	}
+
+	if (starttime) {
+		if (!index) {
+			g_critical("%s: --binlog-start-time needs a index of the binlog-file",
+					G_STRLOC);
+			binlog_dump_pipeline_free(pipeline);
+			network_mysqld_binlog_free(binlog);
+			network_mysqld_binlog_file_free(file);
+			return -1;
+		}
+
+		binlog_pos = binlog_dump_index_seek(index, file, 0, starttime);
+	} else if (find_startpos && index) {
+		/* sync at the next event-boundary without probing byte by byte */
+		binlog_pos = binlog_dump_index_seek(index, file, binlog_pos, 0);
+	} else if (find_startpos) {
+		/* check if the current binlog-pos is valid,
+		 *
+		 * if not, just skip a byte a retry until we found a valid header
+		 * */
+		for (;;) {
+			int get_ret;
+
+			get_ret = network_mysqld_binlog_file_get_event(file, &packet);
+			if (get_ret == 1) break; /* end of file */
+
+			event = network_mysqld_binlog_event_new();
+			if (get_ret == 0) network_mysqld_proto_get_binlog_event_header(&packet, event);
+
+			if (get_ret != 0 ||
+			    binlog_pos + event->event_size != event->log_pos) {
+				binlog_pos += 1;
+				network_mysqld_binlog_file_seek(file, binlog_pos);
+
+				g_message("%s: --binlog-start-pos isn't valid, trying to sync at %"G_GSIZE_FORMAT" (attempt: %d)", 
+						G_STRLOC,
+						binlog_pos,
+						round++
+						);
+			} else {
+				network_mysqld_binlog_file_seek(file, binlog_pos);
 				network_mysqld_binlog_event_free(event);
 				
 				break;
@@ -1021,73 +1950,103 @@ int replicate_binlog_dump_file(
 		}
 	} 
 
-	packet->offset = 0;
+	event_out = g_string_new(NULL);
 
 	/* next are the events, without the mysql packet header */
-	while (19 == (packet->data->len = read(fd, packet->data->str, 19)) && (stoppos <= 0 || binlog_pos < stoppos)) {
-		gssize len;
-		packet->data->str[packet->data->len] = '\0'; /* term the string */
+	while ((stoppos <= 0 || binlog_pos < (gsize)stoppos)) {
+		int get_ret;
+
+		get_ret = network_mysqld_binlog_file_get_event(file, &packet);
+		if (get_ret == 1) break; /* end of file */
 
-		g_assert_cmpint(packet->data->len, ==, 19);
-	
 		event = network_mysqld_binlog_event_new();
-		network_mysqld_proto_get_binlog_event_header(packet, event);
+		if (get_ret == 0) network_mysqld_proto_get_binlog_event_header(&packet, event);
 
-		if (event->event_size < 19 ||
+		if (get_ret != 0 ||
 		    binlog_pos + event->event_size != event->log_pos) {
-			g_critical("%s: binlog-pos=%ld is invalid, you may want to start with --binlog-find-start-pos",
+			g_critical("%s: binlog-pos=%"G_GSIZE_FORMAT" is invalid, you may want to start with --binlog-find-start-pos",
 				G_STRLOC,
 				binlog_pos
 			       );
+			network_mysqld_binlog_event_free(event);
 			ret = -1;
 			break;
 		}
 
-		g_print("-- (--binlog-start-pos=%ld (next event at %"G_GUINT32_FORMAT")) event = %s (%d)\n",
-				binlog_pos,
-				event->log_pos,
-				network_mysqld_binlog_get_eventname(event->event_type),
-				event->event_type
-				);
-	
-		binlog_pos += 19;
+		if (filter && network_mysqld_binlog_filter_skip_event(filter, &packet, event)) {
+			binlog_pos += event->event_size;
+
+			network_mysqld_binlog_event_free(event);
+			continue;
+		}
 
-		g_string_set_size(packet->data, event->event_size); /* resize the string */
-		packet->data->len = 19;
+		if (output->has_failed) {
+			network_mysqld_binlog_event_free(event);
+			ret = -1;
+			break;
+		}
 
-		len = read(fd, packet->data->str + 19, event->event_size - 19);
+		if (pipeline) {
+			out = g_string_new(NULL);
 
-		if (-1 == len) {
-			g_critical("%s: lseek(..., %d, ...) failed: %s",
-					G_STRLOC,
-					event->event_size - 19,
-					g_strerror(errno));
-			return -1;
+			if (format == BINLOG_DUMP_FORMAT_SQL) {
+				g_string_append_printf(out, "-- (--binlog-start-pos=%"G_GSIZE_FORMAT" (next event at %"G_GUINT32_FORMAT")) event = %s (%d)\n",
+						binlog_pos,
+						event->log_pos,
+						network_mysqld_binlog_get_eventname(event->event_type),
+						event->event_type
+						);
+			}
+			binlog_pos += event->event_size;
+
+			/* the pipeline owns the event from here on */
+			if (network_mysqld_proto_get_binlog_event(&packet, binlog, event)) {
+				g_debug_hexdump(G_STRLOC, packet.data->str + 19, packet.data->len - 19);
+
+				binlog_dump_pipeline_push(pipeline, event, NULL, out);
+			} else {
+				binlog_dump_pipeline_decode(pipeline, binlog, event, out);
+			}
+
+			continue;
 		}
-		g_assert_cmpint(len, ==, event->event_size - 19); /* read error */
 
-		g_assert_cmpint(packet->data->len, ==, 19);
-		packet->data->len += len;
-		g_assert_cmpint(packet->data->len, ==, event->event_size);
-		
-		if (network_mysqld_proto_get_binlog_event(packet, binlog, event)) {
-			g_debug_hexdump(G_STRLOC, packet->data->str + 19, packet->data->len - 19);
-		} else if (network_mysqld_binlog_event_print(binlog, event)) {
-			g_debug_hexdump(G_STRLOC, packet->data->str + 19, packet->data->len - 19);
+		out = event_out;
+		g_string_truncate(out, 0);
+
+		if (format == BINLOG_DUMP_FORMAT_SQL) {
+			g_string_append_printf(out, "-- (--binlog-start-pos=%"G_GSIZE_FORMAT" (next event at %"G_GUINT32_FORMAT")) event = %s (%d)\n",
+					binlog_pos,
+					event->log_pos,
+					network_mysqld_binlog_get_eventname(event->event_type),
+					event->event_type
+					);
+		}
+	
+		if (network_mysqld_proto_get_binlog_event(&packet, binlog, event)) {
+			g_debug_hexdump(G_STRLOC, packet.data->str + 19, packet.data->len - 19);
+		} else if (network_mysqld_binlog_event_append_to_string(out, format, binlog, event)) {
+			g_debug_hexdump(G_STRLOC, packet.data->str + 19, packet.data->len - 19);
 			/* ignore it */
 		}
+
+		binlog_dump_output_write(output, S(out));
 	
-		network_mysqld_binlog_event_free(event);
+		binlog_pos += event->event_size;
 
-		packet->offset = 0;
-		binlog_pos += len;
+		network_mysqld_binlog_event_free(event);
 	}
-	g_string_free(packet->data, TRUE);
-	network_packet_free(packet);
+
+	/* print what the workers still have */
+	binlog_dump_pipeline_free(pipeline);
+
+	network_mysqld_binlog_index_free(index);
+
+	g_string_free(event_out, TRUE);
 
 	network_mysqld_binlog_free(binlog);
 
-	close(fd);
+	network_mysqld_binlog_file_free(file);
 
 	return ret;
 }
@@ -1114,6 +2073,17 @@ int main(int argc, char **argv) {
 	gint binlog_start_pos = 0;
 	gint binlog_stop_pos = 0;
 	gboolean binlog_find_start_pos = FALSE;
+	gint binlog_decode_threads = 0;
+	gchar **binlog_filter_tables = NULL;
+	gchar **binlog_filter_event_types = NULL;
+	network_mysqld_binlog_filter *filter = NULL;
+	gint binlog_start_time = 0;
+	gboolean binlog_index = FALSE;
+	gchar *binlog_output_format = NULL;
+	gchar *binlog_output_file = NULL;
+	gchar *binlog_output_address = NULL;
+	binlog_dump_format format = BINLOG_DUMP_FORMAT_SQL;
+	binlog_dump_output *output = NULL;
 
 	/* can't appear in the configfile */
 	GOptionEntry base_main_entries[] = 
@@ -1134,6 +2104,14 @@ int main(int argc, char **argv) {
 		{ "binlog-start-pos",         0, 0, G_OPTION_ARG_INT, NULL, "binlog start position", NULL },
 		{ "binlog-stop-pos",          0, 0, G_OPTION_ARG_INT, NULL, "binlog stop position", NULL },
 		{ "binlog-find-start-pos",    0, 0, G_OPTION_ARG_NONE, NULL, "find binlog start position", NULL },
+		{ "binlog-decode-threads",    0, 0, G_OPTION_ARG_INT, NULL, "decode the row-events in this many threads (default: 0, in the main thread)", "<num>" },
+		{ "binlog-filter-table",      0, 0, G_OPTION_ARG_STRING_ARRAY, NULL, "only decode the events of these tables, wildcards allowed (can be used multiple times)", "<db>.<table>" },
+		{ "binlog-filter-event-type", 0, 0, G_OPTION_ARG_STRING_ARRAY, NULL, "only decode events of this type (can be used multiple times)", "<QUERY_EVENT|WRITE_ROWS_EVENT|...>" },
+		{ "binlog-start-time",        0, 0, G_OPTION_ARG_INT, NULL, "start at the first event at or after this unix-timestamp", "<seconds>" },
+		{ "binlog-index",             0, 0, G_OPTION_ARG_NONE, NULL, "keep a index of the binlog-file in <binlog-file>.index to speed up the next --binlog-start-time", NULL },
+		{ "binlog-output-format",     0, 0, G_OPTION_ARG_STRING, NULL, "write the events as SQL or only the row-changes, queries and commits as JSON-lines or binary records (default: sql)", "(sql|json|binary)" },
+		{ "binlog-output-file",       0, 0, G_OPTION_ARG_FILENAME, NULL, "write the output to a file instead of stdout", "<file>" },
+		{ "binlog-output-address",    0, 0, G_OPTION_ARG_STRING, NULL, "write the output to a socket instead of stdout", "<host:port|unix-socket>" },
 		
 		{ NULL,                       0, 0, G_OPTION_ARG_NONE,   NULL, NULL, NULL }
 	};
@@ -1197,6 +2175,14 @@ int main(int argc, char **argv) {
 	main_entries[i++].arg_data  = &(binlog_start_pos);
 	main_entries[i++].arg_data  = &(binlog_stop_pos);
 	main_entries[i++].arg_data  = &(binlog_find_start_pos);
+	main_entries[i++].arg_data  = &(binlog_decode_threads);
+	main_entries[i++].arg_data  = &(binlog_filter_tables);
+	main_entries[i++].arg_data  = &(binlog_filter_event_types);
+	main_entries[i++].arg_data  = &(binlog_start_time);
+	main_entries[i++].arg_data  = &(binlog_index);
+	main_entries[i++].arg_data  = &(binlog_output_format);
+	main_entries[i++].arg_data  = &(binlog_output_file);
+	main_entries[i++].arg_data  = &(binlog_output_address);
 
 	option_ctx = g_option_context_new("- MySQL Binlog Dump");
 	g_option_context_add_main_entries(option_ctx, base_main_entries, GETTEXT_PACKAGE);
@@ -1290,18 +2276,90 @@ int main(int argc, char **argv) {
 		goto exit_nicely;
 	}
 
+	if (binlog_filter_tables || binlog_filter_event_types) {
+		filter = network_mysqld_binlog_filter_new();
+
+		for (i = 0; binlog_filter_tables && binlog_filter_tables[i]; i++) {
+			network_mysqld_binlog_filter_add_table(filter, binlog_filter_tables[i]);
+		}
+
+		for (i = 0; binlog_filter_event_types && binlog_filter_event_types[i]; i++) {
+			int event_type = network_mysqld_binlog_get_eventtype(binlog_filter_event_types[i]);
+
+			if (event_type < 0) {
+				g_critical("--binlog-filter-event-type=%s isn't known", binlog_filter_event_types[i]);
+
+				exit_code = EXIT_FAILURE;
+				goto exit_nicely;
+			}
+
+			network_mysqld_binlog_filter_add_event_type(filter, event_type);
+		}
+	}
+
+	if (binlog_output_format) {
+		if (0 == g_ascii_strcasecmp(binlog_output_format, "sql")) {
+			format = BINLOG_DUMP_FORMAT_SQL;
+		} else if (0 == g_ascii_strcasecmp(binlog_output_format, "json")) {
+			format = BINLOG_DUMP_FORMAT_JSON;
+		} else if (0 == g_ascii_strcasecmp(binlog_output_format, "binary")) {
+			format = BINLOG_DUMP_FORMAT_BINARY;
+		} else {
+			g_critical("--binlog-output-format=%s isn't known, use sql, json or binary", binlog_output_format);
+
+			exit_code = EXIT_FAILURE;
+			goto exit_nicely;
+		}
+	}
+
+	if (binlog_output_file && binlog_output_address) {
+		g_critical("--binlog-output-file and --binlog-output-address can't be used together");
+
+		exit_code = EXIT_FAILURE;
+		goto exit_nicely;
+	} else if (binlog_output_file) {
+		output = binlog_dump_output_open(binlog_output_file, &gerr);
+	} else if (binlog_output_address) {
+		output = binlog_dump_output_connect(binlog_output_address, &gerr);
+	} else {
+		output = binlog_dump_output_new(STDOUT_FILENO, FALSE);
+	}
+
+	if (!output) {
+		g_critical("%s", gerr->message);
+
+		exit_code = EXIT_FAILURE;
+		goto exit_nicely;
+	}
+
 	replicate_binlog_dump_file(
 			binlog_filename,
 			binlog_start_pos,
 			binlog_find_start_pos,
-			binlog_stop_pos
+			binlog_stop_pos,
+			binlog_decode_threads,
+			filter,
+			binlog_start_time,
+			binlog_index,
+			format,
+			output
 			);
 
+	if (0 != binlog_dump_output_free(output)) {
+		exit_code = EXIT_FAILURE;
+	}
+
 exit_nicely:
 	if (option_ctx) g_option_context_free(option_ctx);
 	if (keyfile) g_key_file_free(keyfile);
 	if (default_file) g_free(default_file);
 	if (binlog_filename) g_free(binlog_filename);
+	if (binlog_filter_tables) g_strfreev(binlog_filter_tables);
+	if (binlog_filter_event_types) g_strfreev(binlog_filter_event_types);
+	if (filter) network_mysqld_binlog_filter_free(filter);
+	if (binlog_output_format) g_free(binlog_output_format);
+	if (binlog_output_file) g_free(binlog_output_file);
+	if (binlog_output_address) g_free(binlog_output_address);
 	if (gerr) g_error_free(gerr);
 
 	if (log_level) g_free(log_level);
@@ -21,6 +21,7 @@
 #include <unistd.h>
 #include <fcntl.h>
 #include <errno.h>
+#include <string.h>
 
 #include <glib/gstdio.h>
 
@@ -28,6 +29,10 @@
 #include "config.h"
 #endif
 
+#ifdef HAVE_SYS_MMAN_H
+#include <sys/mman.h> /* madvise() */
+#endif
+
 #include <lua.h>
 
 #include "glib-ext.h"
@@ -570,7 +575,7 @@ void network_mysqld_frm_free(network_mysqld_frm *frm) {
 		GPtrArray *values = frm->col_values->pdata[i];
 
 		for (j = 0; j < values->len; j++) {
-			g_string_free(values->pdata[i], TRUE);
+			g_string_free(values->pdata[j], TRUE);
 		}
 		g_ptr_array_free(values, TRUE);
 	}
@@ -1061,12 +1066,746 @@ void network_mysqld_myd_print(network_mysqld_frm G_GNUC_UNUSED *frm, const char
 	g_string_free(packet->data, FALSE);
 	network_packet_free(packet);
 }
+/* from my_base.h and unireg.h */
+#ifndef HA_OPTION_PACK_RECORD
+#define HA_OPTION_PACK_RECORD 1
+#endif
+#ifndef HA_OPTION_CHECKSUM
+#define HA_OPTION_CHECKSUM    32
+#endif
+#define FIELDFLAG_DECIMAL     1
+#define FIELDFLAG_DEC_SHIFT   8
+#define FIELDFLAG_MAX_DEC     31
+#define FIELDFLAG_MAYBE_NULL  32768
+
+typedef enum {
+	MYD_DUMP_FORMAT_HEXDUMP,  /**< describe the .frm and hexdump the .MYD */
+	MYD_DUMP_FORMAT_CSV,      /**< one line per row, NULL is \N */
+	MYD_DUMP_FORMAT_BINARY    /**< length-prefixed rows of length-encoded strings */
+} myd_dump_format;
+
+#define MYD_DUMP_RANGE_SIZE (4 * 1024 * 1024)
+
+/**
+ * a column of a table with fixed-length rows
+ */
+typedef struct {
+	network_mysqld_column_def *col;
+
+	guint offset;          /**< offset of the field in the record */
+	guint len;             /**< bytes of the field in the record */
+	gint null_bit;         /**< bit in the null-bits of the record, -1 if the column is NOT NULL */
+	gboolean is_unsigned;
+	guint precision;       /**< of a DECIMAL */
+	guint scale;
+	GPtrArray *values;     /**< the values of a ENUM or SET */
+} myd_dump_column;
+
+/**
+ * the record layout of a .MYD file with fixed-length rows
+ *
+ * the records are stored like the record-buffer of the server: the null-bits
+ * followed by the fields at the rec_pos of the .frm. The first bit of the
+ * null-bits is always set, a deleted record starts with a 0-byte.
+ */
+typedef struct {
+	myd_dump_column *columns;
+	guint columns_len;
+
+	guint rec_length;      /**< bytes of a record in the .MYD file */
+} myd_dump_table;
+
+/**
+ * the bytes of a DECIMAL(precision, scale) in a record (decimal_bin_size())
+ */
+static guint myd_dump_decimal_bin_size(guint precision, guint scale) {
+	static const guchar digits_per_bytes[] = { 0, 1, 1, 2, 2, 3, 3, 4, 4, 4 };
+	guint i_digits = precision - scale;
+
+	return (i_digits / 9) * 4 + digits_per_bytes[i_digits % 9] +
+	       (scale / 9) * 4 + digits_per_bytes[scale % 9];
+}
+
+/**
+ * decode a binary encoded DECIMAL(precision, scale) into a string
+ *
+ * same encoding as in the row-events of the binlog, see mysql-binlog-dump.c
+ */
+static void myd_dump_decimal_append(GString *out, const guchar *buf, guint precision, guint scale) {
+	static const guchar digits_per_bytes[] = { 0, 1, 1, 2, 2, 3, 3, 4, 4, 4 };
+	guint i_digits = precision - scale;
+	guint f_digits = scale;
+	guchar mask = (buf[0] & 0x80) ? 0x00 : 0xff;
+	gboolean is_first_byte = TRUE;
+	gsize int_start;
+	guint block, blocks;
+
+	if (mask) g_string_append_c(out, '-');
+	int_start = out->len;
+
+#define DECIMAL_GET_BLOCK(_n, _v) do { \
+		guint _i; \
+		_v = 0; \
+		for (_i = 0; _i < (_n); _i++) { \
+			guchar _c = *buf++ ^ mask; \
+			if (is_first_byte) { _c ^= 0x80; is_first_byte = FALSE; } \
+			_v = (_v << 8) | _c; \
+		} \
+	} while (0)
+
+	if (i_digits % 9) {
+		guint32 v;
+
+		DECIMAL_GET_BLOCK(digits_per_bytes[i_digits % 9], v);
+		g_string_append_printf(out, "%u", v);
+	}
+
+	for (block = 0, blocks = i_digits / 9; block < blocks; block++) {
+		guint32 v;
+
+		DECIMAL_GET_BLOCK(4, v);
+		g_string_append_printf(out, "%09u", v);
+	}
+
+	/* strip the leading zeros, but keep one in front of the . */
+	while (out->len - int_start > 1 && out->str[int_start] == '0') {
+		g_string_erase(out, int_start, 1);
+	}
+	if (out->len == int_start) g_string_append_c(out, '0');
+
+	if (f_digits) {
+		g_string_append_c(out, '.');
+
+		for (block = 0, blocks = f_digits / 9; block < blocks; block++) {
+			guint32 v;
+
+			DECIMAL_GET_BLOCK(4, v);
+			g_string_append_printf(out, "%09u", v);
+		}
+
+		if (f_digits % 9) {
+			guint32 v;
+
+			DECIMAL_GET_BLOCK(digits_per_bytes[f_digits % 9], v);
+			g_string_append_printf(out, "%0*u", f_digits % 9, v);
+		}
+	}
+#undef DECIMAL_GET_BLOCK
+}
+
+static void myd_dump_table_free(myd_dump_table *table) {
+	if (!table) return;
+
+	g_free(table->columns);
+	g_free(table);
+}
+
+/**
+ * map the columns of the .frm to their place in the fixed-length records
+ *
+ * @return NULL if the table has no fixed-length rows or a column we can't decode
+ */
+static myd_dump_table *myd_dump_table_new(network_mysqld_frm *frm, GError **gerr) {
+	myd_dump_table *table;
+	guint null_bit = 1; /* the first bit marks the deleted records */
+	guint i;
+
+	if (frm->table_options & HA_OPTION_PACK_RECORD) {
+		g_set_error(gerr, G_FILE_ERROR, G_FILE_ERROR_INVAL,
+				"only tables with fixed-length rows can be dumped (ROW_FORMAT=FIXED)");
+		return NULL;
+	}
+
+	table = g_new0(myd_dump_table, 1);
+	table->columns = g_new0(myd_dump_column, frm->columns->len);
+	table->columns_len = frm->columns->len;
+	table->rec_length = frm->rec_length + ((frm->table_options & HA_OPTION_CHECKSUM) ? 1 : 0);
+
+	for (i = 0; i < frm->columns->len; i++) {
+		network_mysqld_column_def *col = frm->columns->pdata[i];
+		myd_dump_column *column = &(table->columns[i]);
+
+		column->col = col;
+		column->offset = col->rec_pos - 1;
+		column->is_unsigned = !(col->pack_flags & FIELDFLAG_DECIMAL);
+		column->null_bit = (col->pack_flags & FIELDFLAG_MAYBE_NULL) ? (gint)null_bit++ : -1;
+
+		if (col->col_values_ndx > 0 && col->col_values_ndx <= frm->col_values->len) {
+			column->values = frm->col_values->pdata[col->col_values_ndx - 1];
+		}
+
+		switch (col->field_type) {
+		case MYSQL_TYPE_TINY:
+		case MYSQL_TYPE_YEAR:
+			column->len = 1;
+			break;
+		case MYSQL_TYPE_SHORT:
+			column->len = 2;
+			break;
+		case MYSQL_TYPE_INT24:
+		case MYSQL_TYPE_NEWDATE:
+		case MYSQL_TYPE_TIME:
+			column->len = 3;
+			break;
+		case MYSQL_TYPE_LONG:
+		case MYSQL_TYPE_FLOAT:
+		case MYSQL_TYPE_TIMESTAMP:
+		case MYSQL_TYPE_DATE:
+			column->len = 4;
+			break;
+		case MYSQL_TYPE_LONGLONG:
+		case MYSQL_TYPE_DOUBLE:
+		case MYSQL_TYPE_DATETIME:
+			column->len = 8;
+			break;
+		case MYSQL_TYPE_DECIMAL:
+		case MYSQL_TYPE_STRING:
+		case MYSQL_TYPE_VAR_STRING:
+			column->len = col->field_len;
+			break;
+		case MYSQL_TYPE_VARCHAR:
+			column->len = col->field_len + (col->field_len < 256 ? 1 : 2);
+			break;
+		case MYSQL_TYPE_NEWDECIMAL:
+			column->scale = (col->pack_flags >> FIELDFLAG_DEC_SHIFT) & FIELDFLAG_MAX_DEC;
+			column->precision = col->field_len - (column->scale ? 1 : 0) - (column->is_unsigned ? 0 : 1);
+			column->len = myd_dump_decimal_bin_size(column->precision, column->scale);
+			break;
+		case MYSQL_TYPE_ENUM:
+			if (column->values) column->len = column->values->len < 256 ? 1 : 2;
+			break;
+		case MYSQL_TYPE_SET:
+			if (column->values) {
+				column->len = (column->values->len + 7) / 8;
+				if (column->len > 4) column->len = 8;
+			}
+			break;
+		default:
+			break;
+		}
+
+		if (column->len == 0 || col->rec_pos == 0 || column->offset + column->len > frm->rec_length) {
+			g_set_error(gerr, G_FILE_ERROR, G_FILE_ERROR_INVAL,
+					"can't decode column '%s' of type %s (%d) from a fixed-length row",
+					col->name->str,
+					network_mysqld_proto_field_get_typestring(col->field_type),
+					col->field_type);
+			myd_dump_table_free(table);
+			return NULL;
+		}
+	}
+
+	return table;
+}
+
+/**
+ * append the value of a column as text
+ *
+ * @param packet the record, ->offset points to the start of the field
+ */
+static int myd_dump_column_append_value(GString *out, myd_dump_column *column, network_packet *packet) {
+	const gchar *s = packet->data->str + packet->offset;
+	guint8 i8;
+	guint16 i16;
+	guint32 i32;
+	guint64 i64;
+	int err = 0;
+
+	switch (column->col->field_type) {
+	case MYSQL_TYPE_TINY:
+		err = err || network_mysqld_proto_get_int8(packet, &i8);
+		if (!err) g_string_append_printf(out, column->is_unsigned ? "%u" : "%d", column->is_unsigned ? i8 : (gint8)i8);
+		break;
+	case MYSQL_TYPE_SHORT:
+		err = err || network_mysqld_proto_get_int16(packet, &i16);
+		if (!err) g_string_append_printf(out, column->is_unsigned ? "%u" : "%d", column->is_unsigned ? i16 : (gint16)i16);
+		break;
+	case MYSQL_TYPE_INT24:
+		err = err || network_mysqld_proto_get_int24(packet, &i32);
+		if (!err && !column->is_unsigned && (i32 & 0x800000)) i32 |= 0xff000000; /* sign-extend */
+		if (!err) g_string_append_printf(out, column->is_unsigned ? "%u" : "%d", i32);
+		break;
+	case MYSQL_TYPE_LONG:
+		err = err || network_mysqld_proto_get_int32(packet, &i32);
+		if (!err) g_string_append_printf(out, column->is_unsigned ? "%u" : "%d", i32);
+		break;
+	case MYSQL_TYPE_LONGLONG:
+		err = err || network_mysqld_proto_get_int64(packet, &i64);
+		if (!err) g_string_append_printf(out, column->is_unsigned ? "%"G_GUINT64_FORMAT : "%"G_GINT64_FORMAT, i64);
+		break;
+	case MYSQL_TYPE_FLOAT: {
+		gfloat f;
+		gchar buf[G_ASCII_DTOSTR_BUF_SIZE];
+
+		err = err || network_mysqld_proto_get_int32(packet, &i32);
+		if (!err) {
+			memcpy(&f, &i32, sizeof(f));
+			g_string_append(out, g_ascii_formatd(buf, sizeof(buf), "%.7g", f));
+		}
+		break; }
+	case MYSQL_TYPE_DOUBLE: {
+		gdouble d;
+		gchar buf[G_ASCII_DTOSTR_BUF_SIZE];
+
+		err = err || network_mysqld_proto_get_int64(packet, &i64);
+		if (!err) {
+			memcpy(&d, &i64, sizeof(d));
+			g_string_append(out, g_ascii_dtostr(buf, sizeof(buf), d));
+		}
+		break; }
+	case MYSQL_TYPE_YEAR:
+		err = err || network_mysqld_proto_get_int8(packet, &i8);
+		if (!err) g_string_append_printf(out, "%04u", i8 ? 1900 + i8 : 0);
+		break;
+	case MYSQL_TYPE_TIMESTAMP: /* seconds since epoch */
+		err = err || network_mysqld_proto_get_int32(packet, &i32);
+		if (!err) g_string_append_printf(out, "%u", i32);
+		break;
+	case MYSQL_TYPE_DATE: /* YYYYMMDD */
+		err = err || network_mysqld_proto_get_int32(packet, &i32);
+		if (!err) g_string_append_printf(out, "%04u-%02u-%02u", i32 / 10000, (i32 / 100) % 100, i32 % 100);
+		break;
+	case MYSQL_TYPE_NEWDATE: /* YYYY << 9 | MM << 5 | DD */
+		err = err || network_mysqld_proto_get_int24(packet, &i32);
+		if (!err) g_string_append_printf(out, "%04u-%02u-%02u", i32 >> 9, (i32 >> 5) & 0xf, i32 & 0x1f);
+		break;
+	case MYSQL_TYPE_TIME: /* +-HHMMSS */
+		err = err || network_mysqld_proto_get_int24(packet, &i32);
+		if (!err) {
+			if (i32 & 0x800000) {
+				i32 = 0x1000000 - i32;
+				g_string_append_c(out, '-');
+			}
+			g_string_append_printf(out, "%02u:%02u:%02u", i32 / 10000, (i32 / 100) % 100, i32 % 100);
+		}
+		break;
+	case MYSQL_TYPE_DATETIME: /* YYYYMMDDhhmmss */
+		err = err || network_mysqld_proto_get_int64(packet, &i64);
+		if (!err) {
+			guint32 d = i64 / G_GUINT64_CONSTANT(1000000);
+			guint32 t = i64 % G_GUINT64_CONSTANT(1000000);
+
+			g_string_append_printf(out, "%04u-%02u-%02u %02u:%02u:%02u",
+					d / 10000, (d / 100) % 100, d % 100,
+					t / 10000, (t / 100) % 100, t % 100);
+		}
+		break;
+	case MYSQL_TYPE_NEWDECIMAL:
+		myd_dump_decimal_append(out, (const guchar *)s, column->precision, column->scale);
+		err = err || network_mysqld_proto_skip(packet, column->len);
+		break;
+	case MYSQL_TYPE_DECIMAL: /* the digits as ascii, padded with spaces in front */
+		err = err || network_mysqld_proto_skip(packet, column->len);
+		if (!err) {
+			guint i;
+
+			for (i = 0; i < column->len && s[i] == ' '; i++);
+			g_string_append_len(out, s + i, column->len - i);
+		}
+		break;
+	case MYSQL_TYPE_STRING:
+	case MYSQL_TYPE_VAR_STRING: { /* padded with spaces */
+		guint len = column->len;
+
+		err = err || network_mysqld_proto_skip(packet, column->len);
+		if (!err) {
+			while (len > 0 && s[len - 1] == ' ') len--;
+			g_string_append_len(out, s, len);
+		}
+		break; }
+	case MYSQL_TYPE_VARCHAR:
+		if (column->col->field_len < 256) {
+			err = err || network_mysqld_proto_get_int8(packet, &i8);
+			i16 = i8;
+		} else {
+			err = err || network_mysqld_proto_get_int16(packet, &i16);
+		}
+		err = err || (i16 > column->col->field_len);
+		if (!err) g_string_append_len(out, packet->data->str + packet->offset, i16);
+		break;
+	case MYSQL_TYPE_ENUM: /* 1-based index into the values, 0 is the empty string */
+		if (column->len == 1) {
+			err = err || network_mysqld_proto_get_int8(packet, &i8);
+			i16 = i8;
+		} else {
+			err = err || network_mysqld_proto_get_int16(packet, &i16);
+		}
+		if (!err && i16 > 0 && i16 <= column->values->len) {
+			GString *v = column->values->pdata[i16 - 1];
+
+			g_string_append_len(out, S(v));
+		}
+		break;
+	case MYSQL_TYPE_SET: { /* a bit per value */
+		guint64 bits;
+		gboolean is_first = TRUE;
+		guint i;
+
+		err = err || network_mysqld_proto_get_int_len(packet, &bits, column->len);
+		for (i = 0; !err && i < column->values->len && i < 64; i++) {
+			GString *v = column->values->pdata[i];
+
+			if (!(bits & (G_GUINT64_CONSTANT(1) << i))) continue;
+
+			if (!is_first) g_string_append_c(out, ',');
+			g_string_append_len(out, S(v));
+			is_first = FALSE;
+		}
+		break; }
+	default:
+		err = 1;
+		break;
+	}
+
+	return err ? -1 : 0;
+}
+
+static void myd_dump_csv_append_string(GString *out, const gchar *s, gsize s_len) {
+	gsize i;
+
+	g_string_append_c(out, '"');
+	for (i = 0; i < s_len; i++) {
+		if (s[i] == '"') g_string_append_c(out, '"');
+		g_string_append_c(out, s[i]);
+	}
+	g_string_append_c(out, '"');
+}
+
+/**
+ * append a record in the output-format
+ *
+ * CSV: the fields separated by commas, strings and temporal types quoted, NULL as \N
+ *
+ * binary: 
+ *
+ *   int4       length of the row
+ *   lenenc-str the fields as text, 0xfb for NULL (as a row of a text-resultset)
+ *
+ * @param packet the record, ->offset points to its start
+ * @return 0 if the record was appended or is deleted, -1 on error
+ */
+static int myd_dump_record_append(GString *out, myd_dump_table *table, myd_dump_format format, network_packet *packet, GString *value) {
+	const guchar *rec = (const guchar *)packet->data->str + packet->offset;
+	gsize row_start = out->len;
+	guint rec_start = packet->offset;
+	guint i;
+
+	if (rec[0] == 0) { /* a deleted record */
+		packet->offset = rec_start + table->rec_length;
+		return 0;
+	}
+
+	if (format == MYD_DUMP_FORMAT_BINARY) network_mysqld_proto_append_int32(out, 0);
+
+	for (i = 0; i < table->columns_len; i++) {
+		myd_dump_column *column = &(table->columns[i]);
+		gboolean is_null;
+
+		is_null = column->null_bit >= 0 && (rec[column->null_bit / 8] & (1 << (column->null_bit % 8)));
+
+		if (!is_null) {
+			g_string_truncate(value, 0);
+
+			packet->offset = rec_start + column->offset;
+			if (myd_dump_column_append_value(value, column, packet)) {
+				g_critical("%s: decoding column '%s' of the record at offset %u failed",
+						G_STRLOC,
+						column->col->name->str,
+						rec_start);
+				return -1;
+			}
+		}
+
+		if (format == MYD_DUMP_FORMAT_BINARY) {
+			network_mysqld_proto_append_lenenc_string_len(out, is_null ? NULL : value->str, value->len);
+			continue;
+		}
+
+		if (i > 0) g_string_append_c(out, ',');
+
+		if (is_null) {
+			g_string_append(out, "\\N");
+			continue;
+		}
+
+		switch (column->col->field_type) {
+		case MYSQL_TYPE_TINY:
+		case MYSQL_TYPE_SHORT:
+		case MYSQL_TYPE_INT24:
+		case MYSQL_TYPE_LONG:
+		case MYSQL_TYPE_LONGLONG:
+		case MYSQL_TYPE_FLOAT:
+		case MYSQL_TYPE_DOUBLE:
+		case MYSQL_TYPE_YEAR:
+		case MYSQL_TYPE_TIMESTAMP:
+		case MYSQL_TYPE_DECIMAL:
+		case MYSQL_TYPE_NEWDECIMAL:
+			g_string_append_len(out, S(value));
+			break;
+		default:
+			myd_dump_csv_append_string(out, S(value));
+			break;
+		}
+	}
+
+	if (format == MYD_DUMP_FORMAT_BINARY) {
+		guint32 row_len = out->len - row_start - 4;
+
+		out->str[row_start + 0] = (row_len >>  0) & 0xff;
+		out->str[row_start + 1] = (row_len >>  8) & 0xff;
+		out->str[row_start + 2] = (row_len >> 16) & 0xff;
+		out->str[row_start + 3] = (row_len >> 24) & 0xff;
+	} else {
+		g_string_append_c(out, '\n');
+	}
+
+	packet->offset = rec_start + table->rec_length;
+
+	return 0;
+}
+
+typedef struct myd_dump_pipeline myd_dump_pipeline;
+
+/**
+ * a range of records of the .MYD file, decoded by a worker
+ */
+typedef struct {
+	const gchar *data;
+	gsize len;             /**< a multiple of the record-length */
+
+	GString *out;
+	gboolean is_done;
+	int err;
+
+	myd_dump_pipeline *pipeline;
+} myd_dump_job;
+
+/**
+ * decode ranges of the .MYD file in parallel and write them in file order
+ */
+struct myd_dump_pipeline {
+	GThreadPool *workers;
+
+	GMutex *mutex;
+	GCond *cond;           /**< signaled when a job is done */
+
+	GQueue *jobs;          /**< myd_dump_job in file order */
+	guint max_jobs;        /**< wait for the head of the queue if we have more jobs queued */
+
+	myd_dump_table *table;
+	myd_dump_format format;
+	int fd;
+
+	gboolean has_failed;
+};
+
+static void myd_dump_job_decode(gpointer data, gpointer G_GNUC_UNUSED user_data) {
+	myd_dump_job *job = data;
+	myd_dump_pipeline *pipeline = job->pipeline;
+	network_packet packet;
+	GString rec;
+	GString *value;
+
+	/* a read-only view on the mapped range */
+	rec.str = (gchar *)job->data;
+	rec.len = job->len;
+	rec.allocated_len = job->len;
+
+	packet.data = &rec;
+	packet.offset = 0;
+
+	value = g_string_new(NULL);
+
+	while (!job->err && packet.offset < rec.len) {
+		job->err = myd_dump_record_append(job->out, pipeline->table, pipeline->format, &packet, value);
+	}
+
+	g_string_free(value, TRUE);
+
+	g_mutex_lock(pipeline->mutex);
+	job->is_done = TRUE;
+	g_cond_broadcast(pipeline->cond);
+	g_mutex_unlock(pipeline->mutex);
+}
+
+static int myd_dump_write(int fd, const char *s, gsize s_len) {
+	gsize written = 0;
+
+	while (written < s_len) {
+		gssize len;
+
+		len = write(fd, s + written, s_len - written);
+		if (len == -1) {
+			if (errno == EINTR) continue;
+
+			g_critical("%s: writing the output failed: %s",
+					G_STRLOC,
+					g_strerror(errno));
+			return -1;
+		}
+
+		written += len;
+	}
+
+	return 0;
+}
+
+/**
+ * write the finished jobs from the head of the queue
+ *
+ * @param max_jobs wait for the head of the queue until at most max_jobs are left
+ */
+static void myd_dump_pipeline_flush(myd_dump_pipeline *pipeline, guint max_jobs) {
+	myd_dump_job *job;
+
+	for (;;) {
+		g_mutex_lock(pipeline->mutex);
+		job = g_queue_peek_head(pipeline->jobs);
+		while (job && !job->is_done && pipeline->jobs->length > max_jobs) {
+			g_cond_wait(pipeline->cond, pipeline->mutex);
+		}
+		if (job && job->is_done) {
+			g_queue_pop_head(pipeline->jobs);
+		} else {
+			job = NULL;
+		}
+		g_mutex_unlock(pipeline->mutex);
+
+		if (!job) break;
+
+		if (job->err) pipeline->has_failed = TRUE;
+
+		if (!pipeline->has_failed && myd_dump_write(pipeline->fd, S(job->out))) {
+			pipeline->has_failed = TRUE;
+		}
+
+		g_string_free(job->out, TRUE);
+		g_free(job);
+	}
+}
+
+/**
+ * dump the rows of a .MYD file with fixed-length rows
+ *
+ * the file is mapped and split into ranges of whole records, the ranges are
+ * decoded by the workers and written in file order.
+ *
+ * @param threads number of workers
+ * @param fd      write the rows to it
+ * @return 0 on success, -1 on error
+ */
+int network_mysqld_myd_dump(network_mysqld_frm *frm, const char *filename, myd_dump_format format, guint threads, int fd) {
+	myd_dump_pipeline *pipeline;
+	GMappedFile *f;
+	GError *gerr = NULL;
+	const gchar *data;
+	gsize len, offset, range_size;
+	int ret;
+
+	pipeline = g_new0(myd_dump_pipeline, 1);
+
+	if (NULL == (pipeline->table = myd_dump_table_new(frm, &gerr))) {
+		g_critical("%s: %s: %s",
+				G_STRLOC,
+				filename,
+				gerr->message);
+		g_error_free(gerr);
+		g_free(pipeline);
+		return -1;
+	}
+
+	f = g_mapped_file_new(filename, FALSE, &gerr);
+	if (!f) {
+		g_critical("%s: %s",
+				G_STRLOC,
+				gerr->message);
+		g_error_free(gerr);
+		myd_dump_table_free(pipeline->table);
+		g_free(pipeline);
+		return -1;
+	}
+
+	data = g_mapped_file_get_contents(f);
+	len  = g_mapped_file_get_length(f);
+
+#if defined(HAVE_SYS_MMAN_H) && defined(MADV_SEQUENTIAL)
+	/* each worker walks its range from start to end, let the kernel read ahead */
+	if (len) madvise((void *)data, len, MADV_SEQUENTIAL);
+#endif
+
+	if (len % pipeline->table->rec_length) {
+		g_warning("%s: %s: the size (%"G_GSIZE_FORMAT") isn't a multiple of the record-length (%u), ignoring the last %"G_GSIZE_FORMAT" bytes",
+				G_STRLOC,
+				filename,
+				len,
+				pipeline->table->rec_length,
+				len % pipeline->table->rec_length);
+		len -= len % pipeline->table->rec_length;
+	}
+
+	pipeline->format = format;
+	pipeline->fd = fd;
+	pipeline->mutex = g_mutex_new();
+	pipeline->cond = g_cond_new();
+	pipeline->jobs = g_queue_new();
+	pipeline->max_jobs = threads * 4;
+
+	pipeline->workers = g_thread_pool_new(myd_dump_job_decode, NULL, threads, TRUE, &gerr);
+	if (!pipeline->workers) {
+		g_critical("%s: %s",
+				G_STRLOC,
+				gerr->message);
+		g_error_free(gerr);
+		pipeline->has_failed = TRUE;
+	}
+
+	/* whole records per range */
+	range_size = MAX(MYD_DUMP_RANGE_SIZE / pipeline->table->rec_length, 1) * pipeline->table->rec_length;
+
+	for (offset = 0; !pipeline->has_failed && offset < len; offset += range_size) {
+		myd_dump_job *job;
+
+		job = g_new0(myd_dump_job, 1);
+		job->data = data + offset;
+		job->len = MIN(range_size, len - offset);
+		job->out = g_string_sized_new(job->len * 2);
+		job->pipeline = pipeline;
+
+		g_mutex_lock(pipeline->mutex);
+		g_queue_push_tail(pipeline->jobs, job);
+		g_mutex_unlock(pipeline->mutex);
+
+		g_thread_pool_push(pipeline->workers, job, NULL);
+
+		myd_dump_pipeline_flush(pipeline, pipeline->max_jobs);
+	}
+
+	/* wait for the workers and write the rest */
+	if (pipeline->workers) g_thread_pool_free(pipeline->workers, FALSE, TRUE);
+	myd_dump_pipeline_flush(pipeline, 0);
+
+	ret = pipeline->has_failed ? -1 : 0;
+
+	g_queue_free(pipeline->jobs);
+	g_cond_free(pipeline->cond);
+	g_mutex_free(pipeline->mutex);
+	myd_dump_table_free(pipeline->table);
+	g_free(pipeline);
+
+	g_mapped_file_free(f);
+
+	return ret;
+}
+
 /**
  * read a frm file
  */
 int frm_dump_file(
 		const char *filename,
-		const char *myd_filename) {
+		const char *myd_filename,
+		myd_dump_format format,
+		guint threads,
+		int fd) {
 	network_packet *packet;
 	GMappedFile *f;
 	GError *gerr = NULL;
@@ -1091,9 +1830,14 @@ int frm_dump_file(
 	frm = network_mysqld_frm_new();
 	err = err || network_mysqld_proto_get_frm(packet, frm);
 	if (!err) {
-		network_mysqld_frm_print(frm);
-		network_mysqld_myd_print(frm, myd_filename);
+		if (format == MYD_DUMP_FORMAT_HEXDUMP) {
+			network_mysqld_frm_print(frm);
+			network_mysqld_myd_print(frm, myd_filename);
+		} else {
+			err = err || network_mysqld_myd_dump(frm, myd_filename, format, threads, fd);
+		}
 	}
+	network_mysqld_frm_free(frm);
 
 	g_mapped_file_free(f);
 
@@ -1120,6 +1864,11 @@ int main(int argc, char **argv) {
 	gchar *log_level = NULL;
 	gchar *frm_filename = NULL;
 	gchar *myd_filename = NULL;
+	gchar *myd_output_format = NULL;
+	gchar *myd_output_file = NULL;
+	gint myd_dump_threads = 1;
+	myd_dump_format format = MYD_DUMP_FORMAT_HEXDUMP;
+	int fd = STDOUT_FILENO;
 
 	GKeyFile *keyfile = NULL;
 	chassis_log *log;
@@ -1141,6 +1890,9 @@ int main(int argc, char **argv) {
 		
 		{ "frm-file",                 0, 0, G_OPTION_ARG_FILENAME, NULL, "frm filename", "<file>" },
 		{ "myd-file",                 0, 0, G_OPTION_ARG_FILENAME, NULL, "myd filename", "<file>" },
+		{ "myd-output-format",        0, 0, G_OPTION_ARG_STRING, NULL, "dump the rows of a table with fixed-length rows (default: hexdump)", "(hexdump|csv|binary)" },
+		{ "myd-output-file",          0, 0, G_OPTION_ARG_FILENAME, NULL, "write the rows to this file (default: stdout)", "<file>" },
+		{ "myd-dump-threads",         0, 0, G_OPTION_ARG_INT, NULL, "decode the rows in this many threads (default: 1)", "<num>" },
 		
 		{ NULL,                       0, 0, G_OPTION_ARG_NONE,   NULL, NULL, NULL }
 	};
@@ -1202,6 +1954,9 @@ int main(int argc, char **argv) {
 	main_entries[i++].arg_data  = &(log->use_syslog);
 	main_entries[i++].arg_data  = &(frm_filename);
 	main_entries[i++].arg_data  = &(myd_filename);
+	main_entries[i++].arg_data  = &(myd_output_format);
+	main_entries[i++].arg_data  = &(myd_output_file);
+	main_entries[i++].arg_data  = &(myd_dump_threads);
 
 	option_ctx = g_option_context_new("- MySQL MyISAM Dump");
 	g_option_context_add_main_entries(option_ctx, base_main_entries, GETTEXT_PACKAGE);
@@ -1295,7 +2050,45 @@ int main(int argc, char **argv) {
 		goto exit_nicely;
 	}
 
-	if (frm_dump_file(frm_filename, myd_filename)) {
+	if (myd_output_format) {
+		if (0 == g_ascii_strcasecmp(myd_output_format, "hexdump")) {
+			format = MYD_DUMP_FORMAT_HEXDUMP;
+		} else if (0 == g_ascii_strcasecmp(myd_output_format, "csv")) {
+			format = MYD_DUMP_FORMAT_CSV;
+		} else if (0 == g_ascii_strcasecmp(myd_output_format, "binary")) {
+			format = MYD_DUMP_FORMAT_BINARY;
+		} else {
+			g_critical("--myd-output-format=%s isn't known, use hexdump, csv or binary", myd_output_format);
+
+			exit_code = EXIT_FAILURE;
+			goto exit_nicely;
+		}
+	}
+
+	if (format != MYD_DUMP_FORMAT_HEXDUMP && !myd_filename) {
+		g_critical("--myd-output-format=%s needs a --myd-file", myd_output_format);
+
+		exit_code = EXIT_FAILURE;
+		goto exit_nicely;
+	}
+
+	if (myd_dump_threads < 1) {
+		g_critical("--myd-dump-threads has to be at least 1, got %d", myd_dump_threads);
+
+		exit_code = EXIT_FAILURE;
+		goto exit_nicely;
+	}
+
+	if (myd_output_file) {
+		if (-1 == (fd = g_open(myd_output_file, O_WRONLY | O_CREAT | O_TRUNC, 0660))) {
+			g_critical("opening '%s' failed: %s", myd_output_file, g_strerror(errno));
+
+			exit_code = EXIT_FAILURE;
+			goto exit_nicely;
+		}
+	}
+
+	if (frm_dump_file(frm_filename, myd_filename, format, myd_dump_threads, fd)) {
 		exit_code = EXIT_FAILURE;
 		goto exit_nicely;
 	}
@@ -1305,6 +2098,10 @@ exit_nicely:
 	if (keyfile) g_key_file_free(keyfile);
 	if (default_file) g_free(default_file);
 	if (frm_filename) g_free(frm_filename);
+	if (myd_filename) g_free(myd_filename);
+	if (myd_output_format) g_free(myd_output_format);
+	if (myd_output_file) g_free(myd_output_file);
+	if (fd != STDOUT_FILENO) close(fd);
 	if (gerr) g_error_free(gerr);
 
 	if (log_level) g_free(log_level);
@@ -86,6 +86,7 @@
 #include "chassis-unix-daemon.h"
 #include "chassis-frontend.h"
 #include "chassis-options.h"
+#include "chassis-lock-stats.h"
 
 #ifdef WIN32
 #define CHASSIS_NEWLINE "\r\n"
@@ -123,11 +124,39 @@ typedef struct {
 #ifndef _WIN32
 	/* the --keepalive option isn't available on Unix */
 	guint auto_restart;
+	gint worker_processes;
 #endif
 
 	gint max_files_number;
 
 	gint event_thread_count;
+	int lua_per_event_thread;
+	gchar *event_threads_cpus;
+	gchar *event_method;
+	int event_persistent_waits;
+	int event_threads_rebalance;
+	gint event_threads_spin;
+	gint event_threads_min;
+	gint worker_thread_count;
+
+	gchar *metrics_address;
+	int lock_stats;
+	gchar *stats_shm_file;
+	gint stats_shm_interval;
+
+	gchar *handoff_socket;
+	gint handoff_drain_timeout;
+
+	gint accept_batch;
+	gint listen_backlog;
+	gint tcp_defer_accept;
+	gint tcp_busy_poll;
+	gint tcp_fast_open;
+	gboolean tcp_fast_open_connect;
+
+	gint lua_max_memory;
+	gint lua_max_hook_memory;
+	int lua_alloc_cache;
 
 	gchar *log_level;
 	gchar *log_filename;
@@ -146,7 +175,15 @@ chassis_frontend_t *chassis_frontend_new(void) {
 
 	frontend = g_slice_new0(chassis_frontend_t);
 	frontend->event_thread_count = 1;
+	frontend->worker_thread_count = 2;
 	frontend->max_files_number = 0;
+	frontend->handoff_drain_timeout = 300;
+	frontend->accept_batch = 16;
+	frontend->listen_backlog = 128;
+	frontend->stats_shm_interval = 100;
+#ifndef _WIN32
+	frontend->worker_processes = 1;
+#endif
 
 	return frontend;
 }
@@ -165,6 +202,11 @@ void chassis_frontend_free(chassis_frontend_t *frontend) {
 	if (frontend->user) g_free(frontend->user);
 	if (frontend->pid_file) g_free(frontend->pid_file);
 	if (frontend->log_level) g_free(frontend->log_level);
+	if (frontend->event_threads_cpus) g_free(frontend->event_threads_cpus);
+	if (frontend->event_method) g_free(frontend->event_method);
+	if (frontend->metrics_address) g_free(frontend->metrics_address);
+	if (frontend->stats_shm_file) g_free(frontend->stats_shm_file);
+	if (frontend->handoff_socket) g_free(frontend->handoff_socket);
 	if (frontend->plugin_dir) g_free(frontend->plugin_dir);
 
 	if (frontend->plugin_names) {
@@ -220,6 +262,9 @@ int chassis_frontend_set_chassis_options(chassis_frontend_t *frontend, chassis_o
 #ifndef _WIN32
 	chassis_options_add(opts,
 		"keepalive",                0, 0, G_OPTION_ARG_NONE, &(frontend->auto_restart), "try to restart the proxy if it crashed", NULL);
+
+	chassis_options_add(opts,
+		"worker-processes",         0, 0, G_OPTION_ARG_INT, &(frontend->worker_processes), "fork this many worker-processes that share the listening TCP ports with SO_REUSEPORT and restart the ones that crash (default: 1, no workers)", "<n>");
 #endif
 
 	chassis_options_add(opts,
@@ -228,6 +273,79 @@ int chassis_frontend_set_chassis_options(chassis_frontend_t *frontend, chassis_o
 	chassis_options_add(opts,
 		"event-threads",            0, 0, G_OPTION_ARG_INT, &(frontend->event_thread_count), "number of event-handling threads (default: 1)", NULL);
 
+	chassis_options_add(opts,
+		"lua-per-event-thread",     0, 0, G_OPTION_ARG_NONE, &(frontend->lua_per_event_thread), "give each event-thread its own Lua state", NULL);
+
+	chassis_options_add(opts,
+		"event-threads-cpus",       0, 0, G_OPTION_ARG_STRING, &(frontend->event_threads_cpus), "pin the event-threads to these CPUs, or spread them over the NUMA nodes with 'numa'", "<cpus|numa>");
+
+	chassis_options_add(opts,
+		"event-method",             0, 0, G_OPTION_ARG_STRING, &(frontend->event_method), "backend of libevent (default: the best one available)", "<epoll|kqueue|evport|devpoll|poll|select>");
+
+	chassis_options_add(opts,
+		"event-persistent-waits",   0, 0, G_OPTION_ARG_NONE, &(frontend->event_persistent_waits), "keep the sockets of the connections registered with the event-backend between two waits", NULL);
+
+	chassis_options_add(opts,
+		"event-threads-rebalance",  0, 0, G_OPTION_ARG_NONE, &(frontend->event_threads_rebalance), "move idle connections from busy event-threads to idle ones", NULL);
+
+	chassis_options_add(opts,
+		"event-threads-spin",       0, 0, G_OPTION_ARG_INT, &(frontend->event_threads_spin), "microseconds the event-threads poll for more events before they sleep (default: 0, disabled)", "<usecs>");
+
+	chassis_options_add(opts,
+		"tcp-fast-open",            0, 0, G_OPTION_ARG_INT, &(frontend->tcp_fast_open), "accept TCP Fast Open on the listening TCP sockets with a queue of <qlen>, where supported (default: 0, disabled)", "<qlen>");
+
+	chassis_options_add(opts,
+		"tcp-fast-open-connect",    0, 0, G_OPTION_ARG_NONE, &(frontend->tcp_fast_open_connect), "connect to the backends with TCP Fast Open, where supported", NULL);
+
+	chassis_options_add(opts,
+		"event-threads-min",        0, 0, G_OPTION_ARG_INT, &(frontend->event_threads_min), "scale the active event-threads between this and --event-threads by their load (default: 0, disabled)", "<threads>");
+
+	chassis_options_add(opts,
+		"worker-threads",           0, 0, G_OPTION_ARG_INT, &(frontend->worker_thread_count), "number of threads for name lookups and file access (default: 2)", NULL);
+
+	chassis_options_add(opts,
+		"lock-stats",               0, 0, G_OPTION_ARG_NONE, &(frontend->lock_stats), "measure the time the process-wide locks are waited for and held (default: only count the acquisitions)", NULL);
+
+	chassis_options_add(opts,
+		"metrics-address",          0, 0, G_OPTION_ARG_STRING, &(frontend->metrics_address), "serve the metrics on GET /metrics at this address", "<host:port>");
+
+#ifndef _WIN32
+	chassis_options_add(opts,
+		"stats-shm-file",           0, 0, G_OPTION_ARG_FILENAME, &(frontend->stats_shm_file), "publish the metrics in this shared-memory file for mysql-proxy-stats, e.g. on /dev/shm", "<file>");
+
+	chassis_options_add(opts,
+		"stats-shm-interval",       0, 0, G_OPTION_ARG_INT, &(frontend->stats_shm_interval), "milliseconds between two updates of the --stats-shm-file (default: 100)", "<msec>");
+#endif
+
+#ifndef _WIN32
+	chassis_options_add(opts,
+		"handoff-socket",           0, 0, G_OPTION_ARG_FILENAME, &(frontend->handoff_socket), "take over the listening sockets of the proxy on this unix-socket and offer ours to the next one", "<path>");
+
+	chassis_options_add(opts,
+		"handoff-drain-timeout",    0, 0, G_OPTION_ARG_INT, &(frontend->handoff_drain_timeout), "seconds to wait for the open connections after handing off the listening sockets (default: 300, 0 to wait for all)", "<secs>");
+#endif
+
+	chassis_options_add(opts,
+		"accept-batch",             0, 0, G_OPTION_ARG_INT, &(frontend->accept_batch), "connections to accept per wakeup of a listening socket (default: 16)", "<n>");
+
+	chassis_options_add(opts,
+		"listen-backlog",           0, 0, G_OPTION_ARG_INT, &(frontend->listen_backlog), "backlog of the listening sockets (default: 128)", "<n>");
+
+	chassis_options_add(opts,
+		"tcp-defer-accept",         0, 0, G_OPTION_ARG_INT, &(frontend->tcp_defer_accept), "seconds to defer the accept of a TCP connection until it has data, where supported (default: 0, disabled)", "<secs>");
+
+	chassis_options_add(opts,
+		"tcp-busy-poll",            0, 0, G_OPTION_ARG_INT, &(frontend->tcp_busy_poll), "microseconds the reads on the TCP connections busy-poll the NIC, with quick ACKs, where supported (default: 0, disabled)", "<usecs>");
+
+	chassis_options_add(opts,
+		"lua-max-memory",           0, 0, G_OPTION_ARG_INT, &(frontend->lua_max_memory), "maximum megabytes each Lua state may allocate (default: 0, unlimited)", "<MB>");
+
+	chassis_options_add(opts,
+		"lua-max-hook-memory",      0, 0, G_OPTION_ARG_INT, &(frontend->lua_max_hook_memory), "maximum kilobytes a single Lua hook of a connection may allocate (default: 0, unlimited)", "<KB>");
+
+	chassis_options_add(opts,
+		"lua-alloc-cache",          0, 0, G_OPTION_ARG_NONE, &(frontend->lua_alloc_cache), "keep the freed small blocks of each Lua state in size-class free-lists (default: disabled)", NULL);
+
 	chassis_options_add(opts,
 		"lua-path",                 0, 0, G_OPTION_ARG_STRING, &(frontend->lua_path), "set the LUA_PATH", "<...>");
 
@@ -408,6 +526,16 @@ int main_cmdline(int argc, char **argv) {
 	 */
 	srv->base_dir = g_strdup(frontend->base_dir);
 
+	/* the config is re-read on SIGHUP, after --daemon changed the working directory */
+	if (frontend->default_file && !g_path_is_absolute(frontend->default_file)) {
+		gchar *cwd = g_get_current_dir();
+
+		srv->default_file = g_build_filename(cwd, frontend->default_file, NULL);
+		g_free(cwd);
+	} else {
+		srv->default_file = g_strdup(frontend->default_file);
+	}
+
 	chassis_frontend_init_plugin_dir(&frontend->plugin_dir, srv->base_dir);
 	
 	/* 
@@ -418,6 +546,8 @@ int main_cmdline(int argc, char **argv) {
 	chassis_resolve_path(srv->base_dir, &frontend->log_filename);
 	chassis_resolve_path(srv->base_dir, &frontend->pid_file);
 	chassis_resolve_path(srv->base_dir, &frontend->plugin_dir);
+	chassis_resolve_path(srv->base_dir, &frontend->handoff_socket);
+	chassis_resolve_path(srv->base_dir, &frontend->stats_shm_file);
 
 	/*
 	 * start the logging
@@ -532,7 +662,126 @@ int main_cmdline(int argc, char **argv) {
 		GOTO_EXIT(EXIT_FAILURE);
 	}
 
+	if (frontend->worker_thread_count < 1) {
+		g_critical("--worker-threads has to be >= 1, is %d", frontend->worker_thread_count);
+
+		GOTO_EXIT(EXIT_FAILURE);
+	}
+
 	srv->event_thread_count = frontend->event_thread_count;
+	srv->worker_thread_count = frontend->worker_thread_count;
+	srv->lua_per_event_thread = frontend->lua_per_event_thread;
+	srv->event_threads_cpus = g_strdup(frontend->event_threads_cpus);
+	srv->event_method = g_strdup(frontend->event_method);
+	srv->event_persistent_waits = frontend->event_persistent_waits;
+	srv->event_threads_rebalance = frontend->event_threads_rebalance;
+
+	if (frontend->event_threads_spin < 0) {
+		g_critical("--event-threads-spin has to be >= 0, is %d", frontend->event_threads_spin);
+
+		GOTO_EXIT(EXIT_FAILURE);
+	}
+	srv->event_threads_spin = frontend->event_threads_spin;
+
+	if (frontend->event_threads_min < 0 || frontend->event_threads_min > frontend->event_thread_count) {
+		g_critical("--event-threads-min has to be >= 0 and <= --event-threads (%d), is %d",
+				frontend->event_thread_count,
+				frontend->event_threads_min);
+
+		GOTO_EXIT(EXIT_FAILURE);
+	}
+	srv->event_threads_min = frontend->event_threads_min;
+
+	srv->metrics_address = g_strdup(frontend->metrics_address);
+
+	if (frontend->stats_shm_interval < 1) {
+		g_critical("--stats-shm-interval has to be >= 1, is %d", frontend->stats_shm_interval);
+
+		GOTO_EXIT(EXIT_FAILURE);
+	}
+	srv->stats_shm_file = g_strdup(frontend->stats_shm_file);
+	srv->stats_shm_interval = frontend->stats_shm_interval;
+
+	if (frontend->handoff_drain_timeout < 0) {
+		g_critical("--handoff-drain-timeout has to be >= 0, is %d", frontend->handoff_drain_timeout);
+
+		GOTO_EXIT(EXIT_FAILURE);
+	}
+	srv->handoff_socket = g_strdup(frontend->handoff_socket);
+	srv->handoff_drain_timeout = frontend->handoff_drain_timeout;
+
+#ifndef _WIN32
+	if (frontend->worker_processes > 1) {
+		/* the workers would all take the listening sockets of the old proxy */
+		if (frontend->handoff_socket) {
+			g_critical("--handoff-socket can't be used with --worker-processes");
+
+			GOTO_EXIT(EXIT_FAILURE);
+		}
+
+		if (NULL == (srv->prefork = chassis_prefork_new(frontend->worker_processes, &gerr))) {
+			g_critical("%s", gerr->message);
+
+			GOTO_EXIT(EXIT_FAILURE);
+		}
+	} else if (frontend->worker_processes < 1) {
+		g_critical("--worker-processes has to be >= 1, is %d", frontend->worker_processes);
+
+		GOTO_EXIT(EXIT_FAILURE);
+	}
+#endif
+
+	if (frontend->accept_batch < 1) {
+		g_critical("--accept-batch has to be >= 1, is %d", frontend->accept_batch);
+
+		GOTO_EXIT(EXIT_FAILURE);
+	}
+	srv->accept_batch = frontend->accept_batch;
+
+	if (frontend->listen_backlog < 1) {
+		g_critical("--listen-backlog has to be >= 1, is %d", frontend->listen_backlog);
+
+		GOTO_EXIT(EXIT_FAILURE);
+	}
+	network_socket_set_listen_backlog(frontend->listen_backlog);
+
+	if (frontend->tcp_defer_accept < 0) {
+		g_critical("--tcp-defer-accept has to be >= 0, is %d", frontend->tcp_defer_accept);
+
+		GOTO_EXIT(EXIT_FAILURE);
+	}
+	network_socket_set_defer_accept(frontend->tcp_defer_accept);
+
+	if (frontend->tcp_busy_poll < 0) {
+		g_critical("--tcp-busy-poll has to be >= 0, is %d", frontend->tcp_busy_poll);
+
+		GOTO_EXIT(EXIT_FAILURE);
+	}
+	network_socket_set_busy_poll(frontend->tcp_busy_poll);
+
+	if (frontend->tcp_fast_open < 0) {
+		g_critical("--tcp-fast-open has to be >= 0, is %d", frontend->tcp_fast_open);
+
+		GOTO_EXIT(EXIT_FAILURE);
+	}
+	network_socket_set_fast_open(frontend->tcp_fast_open);
+	network_socket_set_fast_open_connect(frontend->tcp_fast_open_connect);
+
+	if (frontend->lua_max_memory < 0) {
+		g_critical("--lua-max-memory has to be >= 0, is %d", frontend->lua_max_memory);
+
+		GOTO_EXIT(EXIT_FAILURE);
+	}
+	lua_scope_set_default_mem_limit((gint64)frontend->lua_max_memory * 1024 * 1024);
+
+	if (frontend->lua_max_hook_memory < 0) {
+		g_critical("--lua-max-hook-memory has to be >= 0, is %d", frontend->lua_max_hook_memory);
+
+		GOTO_EXIT(EXIT_FAILURE);
+	}
+	lua_scope_set_default_call_mem_limit((gint64)frontend->lua_max_hook_memory * 1024);
+	lua_scope_set_alloc_cache(frontend->lua_alloc_cache);
+	chassis_lock_stats_set_enabled(frontend->lock_stats);
 	
 #ifndef _WIN32	
 	signal(SIGPIPE, SIG_IGN);
@@ -541,7 +790,37 @@ int main_cmdline(int argc, char **argv) {
 		chassis_unix_daemonize();
 	}
 
-	if (frontend->auto_restart) {
+	if (srv->prefork) {
+		int child_exit_status = EXIT_SUCCESS; /* forward the exit-status of the first worker */
+		guint worker_ndx;
+		int ret;
+
+		/* the master is the process to signal, the workers get the signals from it */
+		if (frontend->pid_file) {
+			if (0 != chassis_frontend_write_pidfile(frontend->pid_file, &gerr)) {
+				g_critical("%s", gerr->message);
+
+				GOTO_EXIT(EXIT_FAILURE);
+			}
+		}
+
+		/* each worker binds the listening sockets itself */
+		network_socket_set_reuse_port(TRUE);
+
+		ret = chassis_unix_proc_prefork(srv->prefork->n_workers, &worker_ndx, &child_exit_status);
+
+		if (ret > 0) {
+			/* all workers stopped */
+
+			exit_code = child_exit_status;
+			goto exit_nicely;
+		} else if (ret < 0) {
+			GOTO_EXIT(EXIT_FAILURE);
+		} else {
+			/* we are a worker, go on */
+			chassis_prefork_attach(srv->prefork, worker_ndx);
+		}
+	} else if (frontend->auto_restart) {
 		int child_exit_status = EXIT_SUCCESS; /* forward the exit-status of the child */
 		int ret = chassis_unix_proc_keepalive(&child_exit_status);
 
@@ -557,7 +836,13 @@ int main_cmdline(int argc, char **argv) {
 		}
 	}
 #endif
-	if (frontend->pid_file) {
+
+	/* start the log-writer after the fork()s, the thread wouldn't survive them */
+	if (0 != chassis_log_start_writer(log)) {
+		GOTO_EXIT(EXIT_FAILURE);
+	}
+
+	if (frontend->pid_file && NULL == srv->prefork) {
 		if (0 != chassis_frontend_write_pidfile(frontend->pid_file, &gerr)) {
 			g_critical("%s", gerr->message);
 			g_clear_error(&gerr);
@@ -0,0 +1,135 @@
+/* $%BEGINLICENSE%$
+ Copyright (c) 2008, 2012, Oracle and/or its affiliates. All rights reserved.
+
+ This program is free software; you can redistribute it and/or
+ modify it under the terms of the GNU General Public License as
+ published by the Free Software Foundation; version 2 of the
+ License.
+
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ GNU General Public License for more details.
+
+ You should have received a copy of the GNU General Public License
+ along with this program; if not, write to the Free Software
+ Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA
+ 02110-1301  USA
+
+ $%ENDLICENSE%$ */
+/**
+ * read the metrics a mysql-proxy publishes with --stats-shm-file
+ *
+ *   mysql-proxy-stats --stats-shm-file=/dev/shm/mysql-proxy.stats [--interval=<msec>] [--prefix=<name>]
+ *
+ * prints a line "<name>{<labels>} <value>" per sample. With --interval it prints the
+ * samples again after each interval, separated by a line with the time of the update.
+ *
+ * the segment is only mapped, reading it doesn't involve the proxy at all
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <glib.h>
+
+#include "chassis-stats-shm.h"
+
+static void print_records(GArray *records, guint64 updated_at, const gchar *prefix, gboolean with_time) {
+	guint i;
+
+	if (with_time) {
+		printf("# %"G_GUINT64_FORMAT".%06"G_GUINT64_FORMAT"\n", updated_at / G_USEC_PER_SEC, updated_at % G_USEC_PER_SEC);
+	}
+
+	for (i = 0; i < records->len; i++) {
+		chassis_stats_shm_record_t *rec = &g_array_index(records, chassis_stats_shm_record_t, i);
+
+		if (prefix && !g_str_has_prefix(rec->key, prefix)) continue;
+
+		printf("%s %.15g\n", rec->key, rec->value);
+	}
+
+	fflush(stdout);
+}
+
+int main(int argc, char **argv) {
+	GOptionContext *option_ctx;
+	GError *gerr = NULL;
+	gchar *stats_shm_file = NULL;
+	gchar *prefix = NULL;
+	gint interval = 0;
+	chassis_stats_shm_t *shm;
+	GArray *records;
+	guint64 updated_at = 0, last_updated_at = 0;
+	int exit_code = EXIT_SUCCESS;
+
+	GOptionEntry main_entries[] = 
+	{
+		{ "stats-shm-file",           0, 0, G_OPTION_ARG_FILENAME, NULL, "the --stats-shm-file of the mysql-proxy", "<file>" },
+		{ "interval",                 0, 0, G_OPTION_ARG_INT, NULL, "print the samples again after each update, checking every <msec> (default: 0, print them once)", "<msec>" },
+		{ "prefix",                   0, 0, G_OPTION_ARG_STRING, NULL, "only print the samples whose name starts with <name>", "<name>" },
+		
+		{ NULL,                       0, 0, G_OPTION_ARG_NONE,   NULL, NULL, NULL }
+	};
+
+	main_entries[0].arg_data = &(stats_shm_file);
+	main_entries[1].arg_data = &(interval);
+	main_entries[2].arg_data = &(prefix);
+
+	g_thread_init(NULL);
+
+	option_ctx = g_option_context_new("- read the metrics of a mysql-proxy from shared memory");
+	g_option_context_add_main_entries(option_ctx, main_entries, NULL);
+
+	if (FALSE == g_option_context_parse(option_ctx, &argc, &argv, &gerr)) {
+		g_critical("%s", gerr->message);
+		g_clear_error(&gerr);
+		g_option_context_free(option_ctx);
+		return EXIT_FAILURE;
+	}
+	g_option_context_free(option_ctx);
+
+	if (NULL == stats_shm_file) {
+		g_critical("--stats-shm-file is required");
+		g_free(prefix);
+		return EXIT_FAILURE;
+	}
+
+	if (NULL == (shm = chassis_stats_shm_open(stats_shm_file, &gerr))) {
+		g_critical("%s", gerr->message);
+		g_clear_error(&gerr);
+		g_free(stats_shm_file);
+		g_free(prefix);
+		return EXIT_FAILURE;
+	}
+
+	records = g_array_new(FALSE, FALSE, sizeof(chassis_stats_shm_record_t));
+
+	do {
+		if (!chassis_stats_shm_read(shm, records, &updated_at)) {
+			g_critical("%s is updated faster than we can read it", stats_shm_file);
+			exit_code = EXIT_FAILURE;
+			break;
+		}
+
+		if (updated_at != last_updated_at) {
+			print_records(records, updated_at, prefix, interval > 0);
+			last_updated_at = updated_at;
+		}
+
+		if (interval > 0) g_usleep(interval * 1000);
+	} while (interval > 0);
+
+	g_array_free(records, TRUE);
+	chassis_stats_shm_free(shm);
+	g_free(stats_shm_file);
+	g_free(prefix);
+
+	return exit_code;
+}
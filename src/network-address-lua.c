@@ -45,7 +45,7 @@ static int proxy_address_get(lua_State *L) {
 	if (strleq(key, keysize, C("type"))) {
 		lua_pushinteger(L, addr->addr.common.sa_family);
 	} else if (strleq(key, keysize, C("name"))) {
-		lua_pushlstring(L, S(addr->name));
+		lua_pushstring(L, network_address_get_name(addr));
 	} else if (strleq(key, keysize, C("address"))) {
 		char buf[255];
 		gsize buf_len = sizeof(buf);
@@ -35,6 +35,7 @@
 
 #include <netdb.h>
 #include <unistd.h>
+#define closesocket(x) close(x)
 #else
 #include <winsock2.h>
 #include <io.h>
@@ -50,13 +51,29 @@
 
 #include "network-address.h"
 #include "glib-ext.h"
+#include "chassis-handoff.h"
+#include "network-object-pool.h"
 
 #define C(x) x, sizeof(x) - 1
 #define S(x) x->str, x->len
 
+/**
+ * each connection has a src and a dst address per socket
+ */
+#define NETWORK_ADDRESS_POOL_MAX_IDLE 128
+
+static void network_address_destroy(network_address *addr) {
+	g_string_free(addr->name, TRUE);
+	g_free(addr);
+}
+
+static network_object_pool_t address_pool = NETWORK_OBJECT_POOL_INIT(NETWORK_ADDRESS_POOL_MAX_IDLE, network_address_destroy);
+
 network_address *network_address_new() {
 	network_address *addr;
 
+	if (NULL != (addr = network_object_pool_get(&address_pool))) return addr;
+
 	addr = g_new0(network_address, 1);
 	addr->len = sizeof(addr->addr);
 	addr->name = g_string_new(NULL);
@@ -74,7 +91,8 @@ void network_address_free(network_address *addr) {
 	 * looking at a unix socket which needs to be removed
 	 */
 	if (addr->can_unlink_socket == TRUE && addr->name != NULL &&
-			addr->name->str != NULL) {
+			addr->name->str != NULL &&
+			!chassis_handoff_is_draining()) { /* the new proxy listens on it now */
 		gchar	*name;
 		int		ret;
 
@@ -94,14 +112,77 @@ void network_address_free(network_address *addr) {
 	}
 #endif /* WIN32 */
 
-	g_string_free(addr->name, TRUE);
-	g_free(addr);
+	/* back to the state of network_address_new(), the name keeps its buffer */
+	memset(&(addr->addr), 0, sizeof(addr->addr));
+	addr->len = sizeof(addr->addr);
+	addr->can_unlink_socket = FALSE;
+	addr->key = 0;
+	g_string_truncate(addr->name, 0);
+
+	if (network_object_pool_put(&address_pool, addr)) return;
+
+	network_address_destroy(addr);
 }
 
 void network_address_reset(network_address *addr) {
 	addr->len = sizeof(addr->addr.common);
 }
 
+#ifdef HAVE_GETADDRINFO
+/**
+ * resolve a host-name or a IP with getaddrinfo()
+ *
+ * AI_ADDRCONFIG filters out ::1 and link-local addresses if there is no
+ * global IPv6 address assigned to the local interfaces
+ *
+ * 1) try to resolve with ADDRCONFIG
+ * 2) if 1) fails, try without ADDRCONFIG
+ *
+ * this should handle DNS problems where
+ * - only IPv4 is configured, but DNS returns IPv6 records + IPv4 and 
+ *   we would pick IPv6 (and fail)
+ *
+ * @param first_ai the records, free them with freeaddrinfo()
+ * @return 0 on success, -1 on error
+ */
+static int network_address_getaddrinfo(const gchar *address, struct addrinfo **first_ai) {
+	struct addrinfo hint;
+	int ret;
+
+	*first_ai = NULL;
+
+	memset(&hint, 0, sizeof(hint));
+	hint.ai_family = PF_UNSPEC;
+	hint.ai_socktype = SOCK_STREAM;
+	hint.ai_protocol = 0;
+	hint.ai_flags = AI_ADDRCONFIG;
+	if ((ret = getaddrinfo(address, NULL, &hint, first_ai)) != 0) {
+		if (
+		    /* FreeBSD doesn't provide EAI_ADDRFAMILY (since 2003) */
+#ifdef EAI_ADDRFAMILY
+		    EAI_ADDRFAMILY == ret || /* AI_ADDRCONFIG with a non-global address */
+#endif
+		    EAI_BADFLAGS == ret) {   /* AI_ADDRCONFIG isn't supported */
+			if (*first_ai) freeaddrinfo(*first_ai);
+			*first_ai = NULL;
+
+			hint.ai_flags &= ~AI_ADDRCONFIG;
+
+			ret = getaddrinfo(address, NULL, &hint, first_ai);
+		}
+
+		if (ret != 0) {
+			g_critical("getaddrinfo(\"%s\") failed: %s (%d)", address, 
+					   gai_strerror(ret),
+					   ret);
+			return -1;
+		}
+	}
+
+	return 0;
+}
+#endif
+
 static gint network_address_set_address_ip(network_address *addr, const gchar *address, guint port) {
 	g_return_val_if_fail(addr, -1);
 
@@ -149,49 +230,10 @@ static gint network_address_set_address_ip(network_address *addr, const gchar *a
 	} else {
 #ifdef HAVE_GETADDRINFO
 		struct addrinfo *first_ai = NULL;
-		struct addrinfo hint;
 		struct addrinfo *ai;
 		int ret;
 
-		/* AI_ADDRCONFIG filters out ::1 and link-local addresses if there is no
-		 * global IPv6 address assigned to the local interfaces
-		 *
-		 * 1) try to resolve with ADDRCONFIG
-		 * 2) if 1) fails, try without ADDRCONFIG
-		 *
-		 * this should handle DNS problems where
-		 * - only IPv4 is configured, but DNS returns IPv6 records + IPv4 and 
-		 *   we would pick IPv6 (and fail)
-		 * - 
-		 */
-
-		memset(&hint, 0, sizeof(hint));
-		hint.ai_family = PF_UNSPEC;
-		hint.ai_socktype = SOCK_STREAM;
-		hint.ai_protocol = 0;
-		hint.ai_flags = AI_ADDRCONFIG;
-		if ((ret = getaddrinfo(address, NULL, &hint, &first_ai)) != 0) {
-			if (
-			    /* FreeBSD doesn't provide EAI_ADDRFAMILY (since 2003) */
-#ifdef EAI_ADDRFAMILY
-			    EAI_ADDRFAMILY == ret || /* AI_ADDRCONFIG with a non-global address */
-#endif
-			    EAI_BADFLAGS == ret) {   /* AI_ADDRCONFIG isn't supported */
-				if (first_ai) freeaddrinfo(first_ai);
-				first_ai = NULL;
-
-				hint.ai_flags &= ~AI_ADDRCONFIG;
-
-				ret = getaddrinfo(address, NULL, &hint, &first_ai);
-			}
-
-			if (ret != 0) {
-				g_critical("getaddrinfo(\"%s\") failed: %s (%d)", address, 
-						   gai_strerror(ret),
-						   ret);
-				return -1;
-			}
-		}
+		if (0 != network_address_getaddrinfo(address, &first_ai)) return -1;
 
 		ret = 0; /* bogus, just to make it explicit */
 
@@ -276,65 +318,85 @@ static gint network_address_set_address_un(network_address *addr, const gchar *a
 }
 
 /**
- * translate a address-string into a network_address structure
- *
- * - if the address contains a colon we assume IPv4, 
- *   - ":3306" -> (tcp) "0.0.0.0:3306"
- * - if it starts with a / it is a unix-domain socket 
- *   - "/tmp/socket" -> (unix) "/tmp/socket"
+ * split a address-string into the host and the port
  *
- * @param addr     the address-struct
- * @param address  the address string
+ * @param ip_part  the host, may be NULL. Free it with g_free()
+ * @param port     the port, 3306 if there is none
  * @return 0 on success, -1 otherwise
  */
-gint network_address_set_address(network_address *addr, const gchar *address) {
+static gint network_address_split_ip(const gchar *address, gchar **ip_part, guint *port) {
 	const gchar *port_part = NULL;
-	gchar *ip_part = NULL;
-	gint ret;
 
-	g_return_val_if_fail(addr, -1);
+	*ip_part = NULL;
+	*port = 3306; /* perhaps it is a plain IP address, lets add the default-port */
 
 	/* split the address:port */
-	if (address[0] == '/') {
-		return network_address_set_address_un(addr, address);
-	} else if (address[0] == '[') {
+	if (address[0] == '[') {
 		const gchar *s;
 		if (NULL == (s = strchr(address + 1, ']'))) {
 			return -1;
 		}
-		ip_part   = g_strndup(address + 1, s - (address + 1)); /* may be NULL for strdup(..., 0) */
+		*ip_part  = g_strndup(address + 1, s - (address + 1)); /* may be NULL for strdup(..., 0) */
 
 		if (*(s+1) == ':') {
 			port_part = s + 2;
 		}
 	} else if (NULL != (port_part = strchr(address, ':'))) {
-		ip_part = g_strndup(address, port_part - address); /* may be NULL for strdup(..., 0) */
+		*ip_part = g_strndup(address, port_part - address); /* may be NULL for strdup(..., 0) */
 		port_part++;
 	} else {
-		ip_part = g_strdup(address);
+		*ip_part = g_strdup(address);
 	}
 
 	/* if there is a colon, there should be a port number */
 	if (NULL != port_part) {
 		char *port_err = NULL;
-		guint port;
 
-		port = strtoul(port_part, &port_err, 10);
+		*port = strtoul(port_part, &port_err, 10);
 
 		if (*port_part == '\0') {
 			g_critical("%s: IP-address has to be in the form [<ip>][:<port>], is '%s'. No port number",
 					G_STRLOC, address);
-			ret = -1;
+			return -1;
 		} else if (*port_err != '\0') {
 			g_critical("%s: IP-address has to be in the form [<ip>][:<port>], is '%s'. Failed to parse the port at '%s'",
 					G_STRLOC, address, port_err);
-			ret = -1;
-		} else {
-			ret = network_address_set_address_ip(addr, ip_part, port);
+			return -1;
 		}
-	} else {
-		/* perhaps it is a plain IP address, lets add the default-port */
-		ret = network_address_set_address_ip(addr, ip_part, 3306);
+	}
+
+	return 0;
+}
+
+/**
+ * translate a address-string into a network_address structure
+ *
+ * - if the address contains a colon we assume IPv4, 
+ *   - ":3306" -> (tcp) "0.0.0.0:3306"
+ * - if it starts with a / it is a unix-domain socket 
+ *   - "/tmp/socket" -> (unix) "/tmp/socket"
+ *
+ * a host-name is resolved to its first address, see network_address_resolve() for all of them
+ *
+ * @param addr     the address-struct
+ * @param address  the address string
+ * @return 0 on success, -1 otherwise
+ */
+gint network_address_set_address(network_address *addr, const gchar *address) {
+	gchar *ip_part = NULL;
+	guint port;
+	gint ret;
+
+	g_return_val_if_fail(addr, -1);
+
+	addr->key = 0;
+
+	if (address[0] == '/') {
+		return network_address_set_address_un(addr, address);
+	}
+
+	if (0 == (ret = network_address_split_ip(address, &ip_part, &port))) {
+		ret = network_address_set_address_ip(addr, ip_part, port);
 	}
 
 	if (ip_part) g_free(ip_part);
@@ -342,6 +404,145 @@ gint network_address_set_address(network_address *addr, const gchar *address) {
 	return ret;
 }
 
+/**
+ * check if a address-string has a host-name which may resolve to other addresses later
+ *
+ * @return FALSE for IPs and unix-domain sockets
+ */
+/**
+ * get the host of a address-string
+ *
+ * @return the host without the port and the brackets of a IPv6 address, NULL for a
+ *         unix-socket or if it doesn't parse. Free it with g_free()
+ */
+gchar *network_address_get_host(const gchar *address) {
+	gchar *ip_part = NULL;
+	guint port;
+
+	if (address[0] == '/') return NULL;
+
+	if (0 != network_address_split_ip(address, &ip_part, &port) ||
+	    NULL == ip_part ||
+	    ip_part[0] == '\0') {
+		if (ip_part) g_free(ip_part);
+
+		return NULL;
+	}
+
+	return ip_part;
+}
+
+gboolean network_address_is_hostname(const gchar *address) {
+	gchar *ip_part = NULL;
+	guint port;
+	gboolean is_hostname = FALSE;
+
+	if (address[0] == '/') return FALSE;
+
+	if (0 == network_address_split_ip(address, &ip_part, &port) &&
+	    NULL != ip_part &&
+	    ip_part[0] != '\0') {
+#ifdef HAVE_GETADDRINFO
+		struct addrinfo hint;
+		struct addrinfo *first_ai = NULL;
+
+		memset(&hint, 0, sizeof(hint));
+		hint.ai_family = PF_UNSPEC;
+		hint.ai_socktype = SOCK_STREAM;
+		hint.ai_flags = AI_NUMERICHOST;
+
+		if (0 == getaddrinfo(ip_part, NULL, &hint, &first_ai)) {
+			freeaddrinfo(first_ai);
+		} else {
+			is_hostname = TRUE;
+		}
+#endif
+	}
+
+	if (ip_part) g_free(ip_part);
+
+	return is_hostname;
+}
+
+/**
+ * resolve all addresses of a address-string
+ *
+ * unlike network_address_set_address() it keeps all A and AAAA records of a host-name.
+ * The lookup blocks, call it from a worker.
+ *
+ * @param address  the address string
+ * @param addrs    a new network_address is appended for each record
+ * @return 0 on success, -1 otherwise
+ */
+gint network_address_resolve(const gchar *address, GPtrArray *addrs) {
+	gchar *ip_part = NULL;
+	guint port;
+	gint ret;
+#ifdef HAVE_GETADDRINFO
+	struct addrinfo *first_ai = NULL;
+	struct addrinfo *ai;
+#endif
+
+	if (address[0] == '/' || !network_address_is_hostname(address)) {
+		network_address *addr = network_address_new();
+
+		if (0 != network_address_set_address(addr, address)) {
+			network_address_free(addr);
+			return -1;
+		}
+		g_ptr_array_add(addrs, addr);
+
+		return 0;
+	}
+
+	if (0 != (ret = network_address_split_ip(address, &ip_part, &port))) {
+		if (ip_part) g_free(ip_part);
+		return ret;
+	}
+
+	if (port > 65535) {
+		g_critical("%s: illegal value %u for port, only 1 ... 65535 allowed",
+				G_STRLOC, port);
+		g_free(ip_part);
+		return -1;
+	}
+
+#ifdef HAVE_GETADDRINFO
+	ret = network_address_getaddrinfo(ip_part, &first_ai);
+	g_free(ip_part);
+
+	if (0 != ret) return -1;
+
+	for (ai = first_ai; ai; ai = ai->ai_next) {
+		network_address *addr;
+
+		if (ai->ai_family != PF_INET6 && ai->ai_family != PF_INET) continue;
+
+		addr = network_address_new();
+		if (ai->ai_family == PF_INET6) {
+			memcpy(&addr->addr.ipv6, ai->ai_addr, sizeof(addr->addr.ipv6));
+			addr->addr.ipv6.sin6_port = htons(port);
+			addr->len = sizeof(struct sockaddr_in6);
+		} else {
+			memcpy(&addr->addr.ipv4, ai->ai_addr, sizeof(addr->addr.ipv4));
+			addr->addr.ipv4.sin_port = htons(port);
+			addr->len = sizeof(struct sockaddr_in);
+		}
+		network_address_refresh_name(addr);
+
+		g_ptr_array_add(addrs, addr);
+	}
+
+	freeaddrinfo(first_ai);
+
+	return 0;
+#else
+	g_free(ip_part);
+
+	return -1; /* network_address_is_hostname() never says so */
+#endif
+}
+
 GQuark
 network_address_error(void) {
 	return g_quark_from_static_string("network-address-error");
@@ -514,36 +715,113 @@ network_address_tostring(network_address *addr, char *dst, gsize *dst_len, GErro
 	return dst;
 }
 
-gint network_address_refresh_name(network_address *addr) {
-	GError *gerr = NULL;
+/**
+ * append the name of the address to dst, like "127.0.0.1:3306", "[::1]:3306" or the unix-path
+ *
+ * doesn't touch addr->name, other threads may use it on a address they don't own
+ */
+gint network_address_format_name(network_address *addr, GString *dst, GError **gerr) {
 	char buf[255];
 	gsize buf_len = sizeof(buf);
 
-	if (addr->name->len > 0) return 0; /* name is already set, don't set it again */
-
-	if (NULL == network_address_tostring(addr, buf, &buf_len, &gerr)) {
-		g_critical("%s: %s",
-				G_STRLOC,
-				gerr->message);
-		g_clear_error(&gerr);
+	if (NULL == network_address_tostring(addr, buf, &buf_len, gerr)) {
 		return -1;
 	}
 
 	if (addr->addr.common.sa_family == AF_INET) {
-		g_string_printf(addr->name, "%s:%d",
+		g_string_append_printf(dst, "%s:%d",
 				buf, 
 				ntohs(addr->addr.ipv4.sin_port));
 	} else if (addr->addr.common.sa_family == AF_INET6) {
-		g_string_printf(addr->name, "[%s]:%d",
+		g_string_append_printf(dst, "[%s]:%d",
 				buf, 
 				ntohs(addr->addr.ipv6.sin6_port));
 	} else {
-		g_string_assign(addr->name, buf);
+		g_string_append(dst, buf);
 	}
 
 	return 0;
 }
 
+gint network_address_refresh_name(network_address *addr) {
+	GError *gerr = NULL;
+
+	if (addr->name->len > 0) return 0; /* name is already set, don't set it again */
+
+	if (0 != network_address_format_name(addr, addr->name, &gerr)) {
+		g_critical("%s: %s",
+				G_STRLOC,
+				gerr->message);
+		g_clear_error(&gerr);
+		return -1;
+	}
+
+	return 0;
+}
+
+/**
+ * get the name of the address, it is formatted on first use
+ *
+ * accept() and connect() leave the names of the addresses they fill in empty, most
+ * connections never need them. Only the thread that owns the address may call it.
+ *
+ * @return the name, "" if the address isn't set
+ */
+const gchar *network_address_get_name(network_address *addr) {
+	if (addr->name->len == 0) {
+		(void) network_address_format_name(addr, addr->name, NULL);
+	}
+
+	return addr->name->str;
+}
+
+/**
+ * get a numeric key of the host-part of the address, for hashing and ACL lookups
+ *
+ * the port isn't part of it. IPv4 addresses and IPv4-mapped IPv6 addresses get the same
+ * key, other IPv6 addresses are hashed and may collide. All unix-domain sockets share a key.
+ *
+ * @return the key, 0 if the address isn't set
+ */
+guint64 network_address_get_key(network_address *addr) {
+	const guint8 *b;
+	guint64 h;
+	guint i;
+
+	if (addr->key != 0) return addr->key;
+
+	switch (addr->addr.common.sa_family) {
+	case AF_INET:
+		addr->key = ((guint64)AF_INET << 32) | ntohl(addr->addr.ipv4.sin_addr.s_addr);
+		break;
+	case AF_INET6:
+		b = addr->addr.ipv6.sin6_addr.s6_addr;
+
+		if (IN6_IS_ADDR_V4MAPPED(&(addr->addr.ipv6.sin6_addr))) {
+			addr->key = ((guint64)AF_INET << 32) | ((guint32)b[12] << 24) | ((guint32)b[13] << 16) | ((guint32)b[14] << 8) | b[15];
+			break;
+		}
+
+		/* FNV-1a, the top bit keeps it apart from the IPv4 keys */
+		h = G_GUINT64_CONSTANT(14695981039346656037);
+		for (i = 0; i < 16; i++) {
+			h ^= b[i];
+			h *= G_GUINT64_CONSTANT(1099511628211);
+		}
+		addr->key = h | G_GUINT64_CONSTANT(0x8000000000000000);
+		break;
+#ifdef HAVE_SYS_UN_H
+	case AF_UNIX:
+		addr->key = 1;
+		break;
+#endif
+	default:
+		return 0;
+	}
+
+	return addr->key;
+}
+
 /**
  * check if the host-part of the address is equal
  */
@@ -607,11 +885,53 @@ gboolean network_address_is_local(network_address *dst_addr, network_address *sr
 	}
 }
 
+/**
+ * check if a TCP address is one of this host
+ *
+ * the loopback addresses are, any other is if we can bind() to it
+ *
+ * @return TRUE if a server on the address runs on this host
+ */
+gboolean network_address_is_on_host(network_address *addr) {
+	network_address probe;
+	int fd;
+	gboolean is_on_host;
+
+	switch (addr->addr.common.sa_family) {
+	case AF_INET:
+		if ((ntohl(addr->addr.ipv4.sin_addr.s_addr) >> 24) == 127) return TRUE;
+
+		break;
+	case AF_INET6:
+		if (IN6_IS_ADDR_LOOPBACK(&(addr->addr.ipv6.sin6_addr))) return TRUE;
+
+		break;
+	default:
+		return FALSE;
+	}
+
+	probe.addr = addr->addr;
+	if (addr->addr.common.sa_family == AF_INET) {
+		probe.addr.ipv4.sin_port = 0;
+	} else {
+		probe.addr.ipv6.sin6_port = 0;
+	}
+
+	if (-1 == (fd = socket(addr->addr.common.sa_family, SOCK_STREAM, 0))) return FALSE;
+
+	is_on_host = (0 == bind(fd, &(probe.addr.common), addr->len));
+
+	closesocket(fd);
+
+	return is_on_host;
+}
+
 network_address *network_address_copy(network_address *dst, network_address *src) {
 	if (!dst) dst = network_address_new();
 
 	dst->len = src->len;
 	dst->addr = src->addr;
+	dst->key = src->key;
 	g_string_assign_len(dst->name, S(src->name));
 
 	return dst;
@@ -75,8 +75,9 @@ typedef struct {
 		struct sockaddr common;
 	} addr;
 
-	GString *name; 
+	GString *name;              /**< empty until network_address_get_name() or _refresh_name() format it */
 	network_socklen_t len;
+	guint64 key;                /**< see network_address_get_key(), 0 until it is computed */
 	gboolean can_unlink_socket; /* set TRUE *only* after successful bind */
 } network_address;
 
@@ -85,8 +86,15 @@ NETWORK_API void network_address_free(network_address *);
 NETWORK_API void network_address_reset(network_address *addr);
 NETWORK_API network_address *network_address_copy(network_address *dst, network_address *src);
 NETWORK_API gint network_address_set_address(network_address *addr, const gchar *address);
+NETWORK_API gboolean network_address_is_hostname(const gchar *address);
+NETWORK_API gchar *network_address_get_host(const gchar *address);
+NETWORK_API gint network_address_resolve(const gchar *address, GPtrArray *addrs);
 NETWORK_API gint network_address_refresh_name(network_address *addr);
+NETWORK_API gint network_address_format_name(network_address *addr, GString *dst, GError **gerr);
+NETWORK_API const gchar *network_address_get_name(network_address *addr);
+NETWORK_API guint64 network_address_get_key(network_address *addr);
 NETWORK_API gint network_address_is_local(network_address *dst_addr, network_address *src_addr);
+NETWORK_API gboolean network_address_is_on_host(network_address *addr);
 NETWORK_API char *
 network_address_tostring(network_address *addr, char *dst, gsize *dst_len, GError **gerr);
 
@@ -0,0 +1,393 @@
+/* $%BEGINLICENSE%$
+ Copyright (c) 2008, 2012, Oracle and/or its affiliates. All rights reserved.
+
+ This program is free software; you can redistribute it and/or
+ modify it under the terms of the GNU General Public License as
+ published by the Free Software Foundation; version 2 of the
+ License.
+
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ GNU General Public License for more details.
+
+ You should have received a copy of the GNU General Public License
+ along with this program; if not, write to the Free Software
+ Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA
+ 02110-1301  USA
+
+ $%ENDLICENSE%$ */
+
+/** @file
+ * admission control of the queries sent to the backends
+ *
+ * a query is admitted if its backend, the group of the backend and its user are below their limits. Otherwise it
+ * waits in the queue: when a query leaves, the waiting queries are checked oldest first
+ * and all that fit now are admitted. A query stuck behind the limit of its user doesn't
+ * block the queries of other users to the same backend.
+ */
+
+#include <string.h>
+
+#include "chassis-timings.h"
+#include "chassis-metrics.h"
+#include "network-admission.h"
+
+network_admission_t *network_admission_new(void) {
+	network_admission_t *adm;
+
+	adm = g_new0(network_admission_t, 1);
+	adm->mutex = g_mutex_new();
+	adm->wakeup_done = g_cond_new();
+	adm->backend_queries = g_hash_table_new_full(g_str_hash, g_str_equal, g_free, NULL);
+	adm->user_queries = g_hash_table_new_full(g_str_hash, g_str_equal, g_free, NULL);
+	adm->group_limits = g_hash_table_new_full(g_str_hash, g_str_equal, g_free, NULL);
+	adm->group_queries = g_hash_table_new_full(g_str_hash, g_str_equal, g_free, NULL);
+
+	return adm;
+}
+
+/**
+ * free the admission control
+ *
+ * the tickets have to be left or cancelled before
+ */
+void network_admission_free(network_admission_t *adm) {
+	if (!adm) return;
+
+	g_hash_table_destroy(adm->backend_queries);
+	g_hash_table_destroy(adm->user_queries);
+	g_hash_table_destroy(adm->group_limits);
+	g_hash_table_destroy(adm->group_queries);
+	g_cond_free(adm->wakeup_done);
+	g_mutex_free(adm->mutex);
+
+	g_free(adm);
+}
+
+/**
+ * set the limits
+ *
+ * lowered limits let the queries in flight finish, raised ones apply to the queue with
+ * the next query that leaves
+ */
+void network_admission_set_limits(network_admission_t *adm, guint backend_max_queries, guint user_max_queries, guint queue_size) {
+	g_mutex_lock(adm->mutex);
+	adm->backend_max_queries = backend_max_queries;
+	adm->user_max_queries = user_max_queries;
+	adm->queue_size = queue_size;
+	g_mutex_unlock(adm->mutex);
+}
+
+/**
+ * set the limit of the queries in flight to the backends of a group
+ *
+ * @param max_queries the limit, 0 for unlimited
+ */
+void network_admission_set_group_limit(network_admission_t *adm, const gchar *group, guint max_queries) {
+	g_mutex_lock(adm->mutex);
+	if (max_queries == 0) {
+		g_hash_table_remove(adm->group_limits, group);
+	} else {
+		g_hash_table_insert(adm->group_limits, g_strdup(group), GUINT_TO_POINTER(max_queries));
+	}
+	g_mutex_unlock(adm->mutex);
+}
+
+gboolean network_admission_is_enabled(network_admission_t *adm) {
+	return adm != NULL && (adm->backend_max_queries > 0 || adm->user_max_queries > 0 ||
+			g_hash_table_size(adm->group_limits) > 0);
+}
+
+/**
+ * set the function that is called when the waiting ticket is admitted
+ */
+void network_admission_ticket_set_wakeup(network_admission_ticket_t *ticket, network_admission_wakeup_func wakeup, gpointer user_data) {
+	ticket->wakeup = wakeup;
+	ticket->wakeup_data = user_data;
+}
+
+static guint network_admission_get_count(GHashTable *counts, const gchar *key) {
+	return GPOINTER_TO_UINT(g_hash_table_lookup(counts, key));
+}
+
+/**
+ * add to the count of a key, drop the key when it gets to 0
+ */
+static void network_admission_add_count(GHashTable *counts, const gchar *key, gint delta) {
+	guint count = network_admission_get_count(counts, key) + delta;
+
+	if (count == 0) {
+		g_hash_table_remove(counts, key);
+	} else {
+		g_hash_table_insert(counts, g_strdup(key), GUINT_TO_POINTER(count));
+	}
+}
+
+/**
+ * check if the query of the ticket is below the limits of its backend and user
+ *
+ * the mutex has to be held
+ */
+static gboolean network_admission_fits(network_admission_t *adm, network_admission_ticket_t *ticket) {
+	if (ticket->backend && adm->backend_max_queries > 0 &&
+	    network_admission_get_count(adm->backend_queries, ticket->backend) >= adm->backend_max_queries) {
+		return FALSE;
+	}
+
+	if (ticket->group) {
+		guint group_max_queries = network_admission_get_count(adm->group_limits, ticket->group);
+
+		if (group_max_queries > 0 &&
+		    network_admission_get_count(adm->group_queries, ticket->group) >= group_max_queries) {
+			return FALSE;
+		}
+	}
+
+	if (ticket->username && adm->user_max_queries > 0 &&
+	    network_admission_get_count(adm->user_queries, ticket->username) >= adm->user_max_queries) {
+		return FALSE;
+	}
+
+	return TRUE;
+}
+
+/**
+ * count the query of the ticket as in flight
+ *
+ * the mutex has to be held
+ */
+static void network_admission_admit(network_admission_t *adm, network_admission_ticket_t *ticket) {
+	if (ticket->backend) network_admission_add_count(adm->backend_queries, ticket->backend, 1);
+	if (ticket->group) network_admission_add_count(adm->group_queries, ticket->group, 1);
+	if (ticket->username) network_admission_add_count(adm->user_queries, ticket->username, 1);
+
+	ticket->state = NETWORK_ADMISSION_TICKET_ADMITTED;
+}
+
+static void network_admission_ticket_reset(network_admission_ticket_t *ticket) {
+	if (ticket->backend) g_free(ticket->backend);
+	if (ticket->group) g_free(ticket->group);
+	if (ticket->username) g_free(ticket->username);
+	ticket->backend = NULL;
+	ticket->group = NULL;
+	ticket->username = NULL;
+
+	ticket->state = NETWORK_ADMISSION_TICKET_IDLE;
+}
+
+/**
+ * ask to send a query to the backend
+ *
+ * @param backend  the name of the backend, NULL to ignore the per-backend limit
+ * @param username the user of the client, NULL to ignore the per-user limit
+ * @return NETWORK_ADMISSION_QUEUED if it waits: the ticket's wakeup function is called once it
+ *   is admitted, network_admission_cancel() stops waiting
+ */
+network_admission_ret_t network_admission_enter(network_admission_t *adm, network_admission_ticket_t *ticket, const gchar *backend, const gchar *username) {
+	return network_admission_enter_group(adm, ticket, backend, NULL, username);
+}
+
+/**
+ * ask to send a query to a backend of a group
+ *
+ * @param group the name of the group of the backend, NULL to ignore the per-group limit
+ * @see network_admission_enter()
+ */
+network_admission_ret_t network_admission_enter_group(network_admission_t *adm, network_admission_ticket_t *ticket, const gchar *backend, const gchar *group, const gchar *username) {
+	network_admission_ret_t ret;
+
+	g_return_val_if_fail(ticket->state == NETWORK_ADMISSION_TICKET_IDLE, NETWORK_ADMISSION_REJECTED);
+
+	ticket->backend = g_strdup(backend);
+	ticket->group = g_strdup(group);
+	ticket->username = g_strdup(username);
+	ticket->queued_at = 0;
+
+	g_mutex_lock(adm->mutex);
+	if (network_admission_fits(adm, ticket)) {
+		network_admission_admit(adm, ticket);
+		adm->admitted++;
+		ret = NETWORK_ADMISSION_ADMITTED;
+	} else if (adm->queue.length < adm->queue_size) {
+		ticket->state = NETWORK_ADMISSION_TICKET_WAITING;
+		ticket->queued_at = chassis_get_rel_microseconds();
+		ticket->link.data = ticket;
+		g_queue_push_tail_link(&(adm->queue), &(ticket->link));
+		adm->queued++;
+		ret = NETWORK_ADMISSION_QUEUED;
+	} else {
+		adm->rejected++;
+		ret = NETWORK_ADMISSION_REJECTED;
+	}
+	g_mutex_unlock(adm->mutex);
+
+	if (ret == NETWORK_ADMISSION_REJECTED) network_admission_ticket_reset(ticket);
+
+	return ret;
+}
+
+/**
+ * take a waiting ticket out of the queue
+ *
+ * @return TRUE if the ticket was waiting
+ */
+static gboolean network_admission_unqueue(network_admission_t *adm, network_admission_ticket_t *ticket, gboolean is_timeout) {
+	gboolean was_waiting;
+
+	g_mutex_lock(adm->mutex);
+	was_waiting = (ticket->state == NETWORK_ADMISSION_TICKET_WAITING);
+	if (was_waiting) {
+		g_queue_unlink(&(adm->queue), &(ticket->link));
+		if (is_timeout) adm->timeouts++;
+	}
+	g_mutex_unlock(adm->mutex);
+
+	if (was_waiting) network_admission_ticket_reset(ticket);
+
+	return was_waiting;
+}
+
+/**
+ * stop waiting as the queue-timeout is reached
+ *
+ * @return TRUE if the ticket stopped waiting, FALSE if it got admitted already: its wakeup is on its way
+ */
+gboolean network_admission_cancel(network_admission_t *adm, network_admission_ticket_t *ticket) {
+	return network_admission_unqueue(adm, ticket, TRUE);
+}
+
+/**
+ * the query is done, admit the waiting queries that fit now
+ *
+ * a ticket that still waits is cancelled, an idle one is ignored. A ticket that another thread
+ * is just waking up is left once its wakeup function returned, the ticket can be freed afterwards.
+ *
+ * @return TRUE if the ticket was admitted, FALSE if it was idle or still waiting
+ */
+gboolean network_admission_leave(network_admission_t *adm, network_admission_ticket_t *ticket) {
+	GQueue admitted = G_QUEUE_INIT;
+	GList *link, *next;
+
+	if (ticket->state == NETWORK_ADMISSION_TICKET_IDLE) return FALSE;
+
+	/* another thread may admit it while we look */
+	if (network_admission_unqueue(adm, ticket, FALSE)) return FALSE;
+
+	g_mutex_lock(adm->mutex);
+	while (ticket->is_waking) {
+		g_cond_wait(adm->wakeup_done, adm->mutex);
+	}
+
+	if (ticket->backend) network_admission_add_count(adm->backend_queries, ticket->backend, -1);
+	if (ticket->group) network_admission_add_count(adm->group_queries, ticket->group, -1);
+	if (ticket->username) network_admission_add_count(adm->user_queries, ticket->username, -1);
+
+	for (link = adm->queue.head; link; link = next) {
+		network_admission_ticket_t *waiting = link->data;
+
+		next = link->next;
+
+		if (!network_admission_fits(adm, waiting)) continue;
+
+		g_queue_unlink(&(adm->queue), link);
+		network_admission_admit(adm, waiting);
+		waiting->is_waking = TRUE;
+		g_queue_push_tail_link(&admitted, link);
+	}
+	g_mutex_unlock(adm->mutex);
+
+	network_admission_ticket_reset(ticket);
+
+	/* the owner may leave and free the ticket as soon as it isn't waking anymore, don't touch it afterwards */
+	while ((link = g_queue_pop_head_link(&admitted))) {
+		network_admission_ticket_t *waiting = link->data;
+
+		if (waiting->wakeup) waiting->wakeup(waiting, waiting->wakeup_data);
+
+		g_mutex_lock(adm->mutex);
+		waiting->is_waking = FALSE;
+		g_cond_broadcast(adm->wakeup_done);
+		g_mutex_unlock(adm->mutex);
+	}
+
+	return TRUE;
+}
+
+void network_admission_get_stats(network_admission_t *adm, network_admission_stats_t *stats) {
+	GHashTableIter iter;
+	gpointer value;
+
+	memset(stats, 0, sizeof(*stats));
+
+	g_mutex_lock(adm->mutex);
+	g_hash_table_iter_init(&iter, adm->backend_queries);
+	while (g_hash_table_iter_next(&iter, NULL, &value)) {
+		stats->in_flight += GPOINTER_TO_UINT(value);
+	}
+	stats->waiting = adm->queue.length;
+	stats->admitted = adm->admitted;
+	stats->queued = adm->queued;
+	stats->rejected = adm->rejected;
+	stats->timeouts = adm->timeouts;
+	g_mutex_unlock(adm->mutex);
+}
+
+/**
+ * get the queries in flight and waiting for a backend
+ *
+ * only .in_flight and .waiting are set
+ */
+void network_admission_get_backend_stats(network_admission_t *adm, const gchar *backend, network_admission_stats_t *stats) {
+	GList *link;
+
+	memset(stats, 0, sizeof(*stats));
+
+	g_mutex_lock(adm->mutex);
+	stats->in_flight = network_admission_get_count(adm->backend_queries, backend);
+	for (link = adm->queue.head; link; link = link->next) {
+		network_admission_ticket_t *waiting = link->data;
+
+		if (waiting->backend && 0 == strcmp(waiting->backend, backend)) stats->waiting++;
+	}
+	g_mutex_unlock(adm->mutex);
+}
+
+/**
+ * append the queries in flight and waiting per backend and the decisions of the admission control
+ *
+ * @param backends  the names of the backends to report
+ */
+void network_admission_append_metrics(network_admission_t *adm, GString *out, GPtrArray *backends) {
+	GString *labels = g_string_new(NULL);
+	network_admission_stats_t stats;
+	guint i;
+
+	chassis_metrics_append_header(out, "mysql_proxy_admission_in_flight", "Admitted queries of the backend", CHASSIS_METRIC_GAUGE);
+	for (i = 0; i < backends->len; i++) {
+		const gchar *backend = backends->pdata[i];
+
+		network_admission_get_backend_stats(adm, backend, &stats);
+		g_string_printf(labels, "backend=\"%s\"", backend);
+		chassis_metrics_append_value(out, "mysql_proxy_admission_in_flight", labels->str, stats.in_flight);
+	}
+
+	chassis_metrics_append_header(out, "mysql_proxy_admission_queue_depth", "Queries waiting for the backend", CHASSIS_METRIC_GAUGE);
+	for (i = 0; i < backends->len; i++) {
+		const gchar *backend = backends->pdata[i];
+
+		network_admission_get_backend_stats(adm, backend, &stats);
+		g_string_printf(labels, "backend=\"%s\"", backend);
+		chassis_metrics_append_value(out, "mysql_proxy_admission_queue_depth", labels->str, stats.waiting);
+	}
+
+	network_admission_get_stats(adm, &stats);
+
+	chassis_metrics_append_header(out, "mysql_proxy_admission_total", "Queries checked by the admission control by result", CHASSIS_METRIC_COUNTER);
+	chassis_metrics_append_value(out, "mysql_proxy_admission_total", "result=\"admitted\"", stats.admitted);
+	chassis_metrics_append_value(out, "mysql_proxy_admission_total", "result=\"queued\"", stats.queued);
+	chassis_metrics_append_value(out, "mysql_proxy_admission_total", "result=\"rejected\"", stats.rejected);
+	chassis_metrics_append_value(out, "mysql_proxy_admission_total", "result=\"timeout\"", stats.timeouts);
+
+	g_string_free(labels, TRUE);
+}
@@ -0,0 +1,124 @@
+/* $%BEGINLICENSE%$
+ Copyright (c) 2008, 2012, Oracle and/or its affiliates. All rights reserved.
+
+ This program is free software; you can redistribute it and/or
+ modify it under the terms of the GNU General Public License as
+ published by the Free Software Foundation; version 2 of the
+ License.
+
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ GNU General Public License for more details.
+
+ You should have received a copy of the GNU General Public License
+ along with this program; if not, write to the Free Software
+ Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA
+ 02110-1301  USA
+
+ $%ENDLICENSE%$ */
+#ifndef __NETWORK_ADMISSION_H__
+#define __NETWORK_ADMISSION_H__
+
+#include <glib.h>
+
+#include "network-exports.h"
+
+/**
+ * admission control of the queries sent to the backends
+ *
+ * caps the queries in flight per backend, per backend group and per user. A query over a
+ * limit waits in a bounded FIFO until a query of its backend, group and user is done, the queries of the
+ * queue that fit then are admitted in order and their owners woken up.
+ *
+ * the queries are in flight from network_admission_enter() until network_admission_leave(),
+ * the event-threads share the counters
+ */
+
+typedef struct network_admission_ticket network_admission_ticket_t;
+
+/**
+ * called in the thread that admitted a waiting ticket, without a lock held
+ *
+ * the owner's network_admission_leave() waits until it returned, it mustn't leave the ticket itself
+ */
+typedef void (*network_admission_wakeup_func)(network_admission_ticket_t *ticket, gpointer user_data);
+
+typedef enum {
+	NETWORK_ADMISSION_TICKET_IDLE,     /**< neither in flight nor waiting */
+	NETWORK_ADMISSION_TICKET_WAITING,  /**< in the queue */
+	NETWORK_ADMISSION_TICKET_ADMITTED  /**< in flight */
+} network_admission_ticket_state_t;
+
+/**
+ * the slot of a query, embedded in the connection
+ */
+struct network_admission_ticket {
+	network_admission_ticket_state_t state;
+
+	gchar *backend;                    /**< name of the backend, NULL if it isn't limited */
+	gchar *group;                      /**< name of the group of the backend, NULL if it isn't limited */
+	gchar *username;                   /**< NULL if it isn't limited */
+
+	guint64 queued_at;                 /**< in chassis_get_rel_microseconds(), 0 if it didn't wait */
+
+	network_admission_wakeup_func wakeup;
+	gpointer wakeup_data;
+	gboolean is_waking;                /**< admitted, ->wakeup is running. Protected by the mutex of the admission control */
+
+	GList link;                        /**< our link in the queue */
+};
+
+typedef enum {
+	NETWORK_ADMISSION_ADMITTED,        /**< the query can be sent */
+	NETWORK_ADMISSION_QUEUED,          /**< the query waits, ->wakeup is called once it is admitted */
+	NETWORK_ADMISSION_REJECTED         /**< the queue is full */
+} network_admission_ret_t;
+
+typedef struct {
+	GMutex *mutex;                     /**< protects all fields below */
+	GCond *wakeup_done;                /**< signalled when a wakeup function returned */
+
+	guint backend_max_queries;         /**< queries in flight per backend, 0 for unlimited */
+	guint user_max_queries;            /**< queries in flight per user, 0 for unlimited */
+	guint queue_size;                  /**< queries waiting at most, 0 to reject instead of queueing */
+
+	GHashTable *backend_queries;       /**< backend -> queries in flight (GUINT_TO_POINTER) */
+	GHashTable *user_queries;          /**< username -> queries in flight (GUINT_TO_POINTER) */
+	GHashTable *group_limits;          /**< group -> queries in flight at most (GUINT_TO_POINTER), see network_admission_set_group_limit() */
+	GHashTable *group_queries;         /**< group -> queries in flight (GUINT_TO_POINTER) */
+	GQueue queue;                      /**< network_admission_ticket_t waiting, oldest first */
+
+	guint64 admitted;                  /**< queries admitted without waiting */
+	guint64 queued;                    /**< queries that had to wait */
+	guint64 rejected;                  /**< queries rejected as the queue was full */
+	guint64 timeouts;                  /**< queries that gave up waiting */
+} network_admission_t;
+
+typedef struct {
+	guint in_flight;
+	guint waiting;
+
+	guint64 admitted;
+	guint64 queued;
+	guint64 rejected;
+	guint64 timeouts;
+} network_admission_stats_t;
+
+NETWORK_API network_admission_t *network_admission_new(void);
+NETWORK_API void network_admission_free(network_admission_t *adm);
+NETWORK_API void network_admission_set_limits(network_admission_t *adm, guint backend_max_queries, guint user_max_queries, guint queue_size);
+NETWORK_API void network_admission_set_group_limit(network_admission_t *adm, const gchar *group, guint max_queries);
+NETWORK_API gboolean network_admission_is_enabled(network_admission_t *adm);
+
+NETWORK_API void network_admission_ticket_set_wakeup(network_admission_ticket_t *ticket, network_admission_wakeup_func wakeup, gpointer user_data);
+NETWORK_API network_admission_ret_t network_admission_enter(network_admission_t *adm, network_admission_ticket_t *ticket, const gchar *backend, const gchar *username);
+NETWORK_API network_admission_ret_t network_admission_enter_group(network_admission_t *adm, network_admission_ticket_t *ticket, const gchar *backend, const gchar *group, const gchar *username);
+NETWORK_API gboolean network_admission_cancel(network_admission_t *adm, network_admission_ticket_t *ticket);
+NETWORK_API gboolean network_admission_leave(network_admission_t *adm, network_admission_ticket_t *ticket);
+
+NETWORK_API void network_admission_get_stats(network_admission_t *adm, network_admission_stats_t *stats);
+NETWORK_API void network_admission_get_backend_stats(network_admission_t *adm, const gchar *backend, network_admission_stats_t *stats);
+NETWORK_API void network_admission_append_metrics(network_admission_t *adm, GString *out, GPtrArray *backends);
+
+#endif
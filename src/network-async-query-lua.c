@@ -0,0 +1,418 @@
+/* $%BEGINLICENSE%$
+ Copyright (c) 2008, 2012, Oracle and/or its affiliates. All rights reserved.
+
+ This program is free software; you can redistribute it and/or
+ modify it under the terms of the GNU General Public License as
+ published by the Free Software Foundation; version 2 of the
+ License.
+
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ GNU General Public License for more details.
+
+ You should have received a copy of the GNU General Public License
+ along with this program; if not, write to the Free Software
+ Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA
+ 02110-1301  USA
+
+ $%ENDLICENSE%$ */
+
+/** @file
+ * proxy.query_async() and proxy.wait_all()
+ *
+ * read_query() runs in a coroutine of the connection. proxy.query_async() sends a
+ * query on a pooled connection of a backend and returns a future right away,
+ * proxy.wait_all() yields the coroutine until the results of all the futures it
+ * got are read. The queries run at the same time, waiting for several backends
+ * takes as long as the slowest of them.
+ *
+ *   local a = proxy.query_async(1, "SELECT ...")
+ *   local b = proxy.query_async(2, "SELECT ...")
+ *   local res_a, res_b = proxy.wait_all(a, b)
+ *
+ * the results are injections like in read_query_result()
+ */
+
+#include <string.h>
+
+#include <lua.h>
+#include <lauxlib.h>
+
+#include "lua-env.h"
+#include "glib-ext.h"
+
+#define C(x) x, sizeof(x) - 1
+#define S(x) x->str, x->len
+
+#include "network-backend.h"
+#include "network-mysqld.h"
+#include "network-mysqld-lua.h"
+#include "network-conn-pool-lua.h"
+#include "network-injection-lua.h"
+#include "network-async-query.h"
+#include "network-async-query-lua.h"
+#include "chassis-event-thread.h"
+#include "lua-profiler.h"
+
+static int proxy_async_query_get(lua_State *L);
+static int proxy_async_query_gc(lua_State *L);
+
+static const struct luaL_reg methods_proxy_async_query[] = {
+	{ "__index", proxy_async_query_get },
+	{ "__gc", proxy_async_query_gc },
+	{ NULL, NULL },
+};
+
+/**
+ * check that the value at idx is a future of proxy.query_async()
+ */
+static network_async_query_t *proxy_async_query_check(lua_State *L, int idx) {
+	network_async_query_t **q_p = lua_touserdata(L, idx);
+
+	if (NULL == q_p || !lua_getmetatable(L, idx)) {
+		luaL_argerror(L, idx, "expected a future of proxy.query_async()");
+	}
+	proxy_getmetatable(L, methods_proxy_async_query);
+	if (!lua_rawequal(L, -1, -2)) {
+		luaL_argerror(L, idx, "expected a future of proxy.query_async()");
+	}
+	lua_pop(L, 2);
+
+	return *q_p;
+}
+
+/**
+ * push the result of a finished future as injection
+ *
+ * the injection keeps the future alive in its env, it owns the result
+ */
+static void proxy_async_query_push_result(lua_State *L, int idx) {
+	network_async_query_t *q = *(network_async_query_t **)lua_touserdata(L, idx);
+	injection **inj_p;
+
+	if (idx < 0) idx = lua_gettop(L) + idx + 1;
+
+	inj_p = lua_newuserdata(L, sizeof(injection *));
+	*inj_p = q->inj;
+
+	proxy_getinjectionmetatable(L);
+	lua_setmetatable(L, -2);
+
+	lua_newtable(L);
+	lua_pushvalue(L, idx);
+	lua_setfield(L, -2, "future");
+	lua_setfenv(L, -2);
+}
+
+/**
+ * get the state of a future
+ *
+ * future.
+ *   is_done => true if the result is read or the query failed
+ *   result  => the result as injection, nil while the query runs
+ *   errmsg  => why the query failed before it got a result, nil if it didn't
+ */
+static int proxy_async_query_get(lua_State *L) {
+	network_async_query_t *q = *(network_async_query_t **)luaL_checkself(L);
+	gsize keysize = 0;
+	const char *key = luaL_checklstring(L, 2, &keysize);
+
+	if (strleq(key, keysize, C("is_done"))) {
+		lua_pushboolean(L, network_async_query_is_done(q));
+	} else if (strleq(key, keysize, C("result"))) {
+		if (network_async_query_is_done(q)) {
+			proxy_async_query_push_result(L, 1);
+		} else {
+			lua_pushnil(L);
+		}
+	} else if (strleq(key, keysize, C("errmsg"))) {
+		if (q->errmsg) {
+			lua_pushstring(L, q->errmsg);
+		} else {
+			lua_pushnil(L);
+		}
+	} else {
+		lua_pushnil(L);
+	}
+
+	return 1;
+}
+
+/**
+ * free the query of a future
+ *
+ * a query that still runs is cancelled, its connection is closed
+ */
+static int proxy_async_query_gc(lua_State *L) {
+	network_async_query_t *q = *(network_async_query_t **)luaL_checkself(L);
+
+	if (!network_async_query_is_done(q)) {
+		network_mysqld_con *con = q->done_data;
+		network_mysqld_con_lua_t *st = con->plugin_con_state;
+
+		g_ptr_array_remove_fast(st->async_queries, q);
+	}
+
+	network_async_query_free(q);
+
+	return 0;
+}
+
+/**
+ * a query of the connection is done
+ *
+ * if the connection waits in proxy.wait_all() we let it check if it can go on
+ */
+static void proxy_async_query_done(network_async_query_t *q, gpointer user_data) {
+	network_mysqld_con *con = user_data;
+	network_mysqld_con_lua_t *st = con->plugin_con_state;
+
+	g_ptr_array_remove_fast(st->async_queries, q);
+
+	if (st->async_is_waiting) {
+		network_mysqld_con_handle(-1, 0, con);
+	}
+}
+
+/**
+ * proxy.query_async(backend_ndx, query[, id])
+ *
+ * send the query as COM_QUERY on a idle connection of the backend from the pool of
+ * this event-thread. The connection has to be authed as the user of the client, we
+ * can't re-authenticate it without the password. It is switched to the default-db
+ * of the client if it has another one.
+ *
+ * if there is no such connection the future is done right away and the result is a ERR
+ *
+ * @return a future, pass it to proxy.wait_all() to get the result
+ */
+static int proxy_query_async(lua_State *L) {
+	network_mysqld_con *con = lua_touserdata(L, lua_upvalueindex(1));
+	network_mysqld_con_lua_t *st = con->plugin_con_state;
+	chassis_private *g = con->srv->priv;
+	int backend_ndx = luaL_checkinteger(L, 1) - 1; /* in lua-land the ndx is based on 1 */
+	gsize query_len;
+	const char *query = luaL_checklstring(L, 2, &query_len);
+	int id = luaL_optinteger(L, 3, 0);
+	network_backend_t *backend;
+	network_connection_pool *pool;
+	network_socket *sock;
+	network_async_query_t *q, **q_p;
+	GString *packet;
+
+	packet = g_string_sized_new(query_len + 1);
+	g_string_append_c(packet, COM_QUERY);
+	g_string_append_len(packet, query, query_len);
+
+	q = network_async_query_new(id, S(packet));
+
+	g_string_free(packet, TRUE);
+
+	/* anchor the query in lua-land before anything can fail */
+	q_p = lua_newuserdata(L, sizeof(network_async_query_t *));
+	*q_p = q;
+
+	proxy_getmetatable(L, methods_proxy_async_query);
+	lua_setmetatable(L, -2);
+
+	if (NULL == con->client->response) {
+		network_async_query_fail(q, "(proxy) the client isn't authed yet");
+		return 1;
+	}
+
+	backend = network_backends_get(g->backends, backend_ndx);
+	if (NULL == backend || backend->state == BACKEND_STATE_DOWN) {
+		network_async_query_fail(q, "(proxy) the backend is unknown or down");
+		return 1;
+	}
+
+	/* the pool of this event-thread, the connection stays in it */
+	pool = network_backend_get_pool(backend, chassis_event_thread_get_local_index());
+
+	sock = network_connection_pool_get(pool, con->client->response->username, con->client->default_db);
+	if (NULL == sock) {
+		network_async_query_fail(q, "(proxy) no idle connection of the user in the pool of the backend");
+		return 1;
+	}
+
+	if (!g_string_equal(sock->response->username, con->client->response->username)) {
+		/* the pool handed us the connection of another user to re-auth it */
+		network_connection_pool_lua_add_socket(con->srv, pool, sock);
+
+		network_async_query_fail(q, "(proxy) no idle connection of the user in the pool of the backend");
+		return 1;
+	}
+
+	g_ptr_array_add(st->async_queries, q);
+
+	network_async_query_start(q, con->srv, pool, sock, con->client->default_db, &(con->read_timeout), proxy_async_query_done, con);
+
+	return 1;
+}
+
+/**
+ * proxy.wait_all(future, ...)
+ *
+ * wait until all the futures are done
+ *
+ * @return the results of the futures as injections, in the same order
+ */
+static int proxy_wait_all(lua_State *L) {
+	network_mysqld_con *con = lua_touserdata(L, lua_upvalueindex(1));
+	network_mysqld_con_lua_t *st = con->plugin_con_state;
+	int n = lua_gettop(L);
+	gboolean is_done = TRUE;
+	int i;
+
+	for (i = 1; i <= n; i++) {
+		if (!network_async_query_is_done(proxy_async_query_check(L, i))) is_done = FALSE;
+	}
+
+	if (is_done) {
+		for (i = 1; i <= n; i++) {
+			proxy_async_query_push_result(L, i);
+		}
+
+		return n;
+	}
+
+	if (L != st->async_L) {
+		return luaL_error(L, "proxy.wait_all() can only wait in read_query(), not in other functions or coroutines");
+	}
+
+	/* the futures are handed to network_async_query_lua_call() and stay on the stack of the coroutine */
+	st->async_is_waiting = TRUE;
+
+	return lua_yield(L, n);
+}
+
+/**
+ * add proxy.query_async() and proxy.wait_all() to the table on the top of the stack
+ */
+void network_async_query_lua_register(lua_State *L, network_mysqld_con *con) {
+	lua_pushlightuserdata(L, con);
+	lua_pushcclosure(L, proxy_query_async, 1);
+	lua_setfield(L, -2, "query_async");
+
+	lua_pushlightuserdata(L, con);
+	lua_pushcclosure(L, proxy_wait_all, 1);
+	lua_setfield(L, -2, "wait_all");
+}
+
+/**
+ * cancel the queries that still run
+ *
+ * the futures stay valid, they return the ERR when they get collected
+ */
+void network_async_query_lua_cancel(network_mysqld_con_lua_t *st) {
+	while (st->async_queries->len > 0) {
+		network_async_query_t *q = g_ptr_array_remove_index_fast(st->async_queries, st->async_queries->len - 1);
+
+		q->done = NULL; /* the connection is gone, don't call back */
+		network_async_query_fail(q, "(proxy) the client connection closed");
+	}
+}
+
+/**
+ * hand the coroutine of the connection to the GC
+ */
+void network_async_query_lua_unref(network_mysqld_con_lua_t *st, lua_State *L) {
+	if (st->async_L_ref > 0) {
+		luaL_unref(L, LUA_REGISTRYINDEX, st->async_L_ref);
+	}
+
+	st->async_L = NULL;
+	st->async_L_ref = 0;
+	st->async_is_waiting = FALSE;
+}
+
+/**
+ * resume the coroutine and move the result to L
+ */
+static int network_async_query_lua_run(network_mysqld_con_lua_t *st, lua_State *L, int nargs) {
+	lua_State *co = st->async_L;
+	int ret;
+
+	st->async_is_waiting = FALSE;
+
+	switch ((ret = lua_resume(co, nargs))) {
+	case 0:
+		/* like lua_pcall(..., 1, ...) */
+		if (lua_gettop(co) > 0) {
+			lua_settop(co, 1);
+			lua_xmove(co, L, 1);
+		} else {
+			lua_pushnil(L);
+		}
+
+		return 0;
+	case LUA_YIELD:
+		if (st->async_is_waiting) return LUA_YIELD;
+
+		lua_pushliteral(L, "read_query() yielded outside of proxy.wait_all()");
+		ret = LUA_ERRRUN;
+		break;
+	default:
+		lua_xmove(co, L, 1); /* the error-msg */
+		break;
+	}
+
+	/* a coroutine that failed can't be resumed anymore, the next call gets a new one */
+	network_async_query_lua_unref(st, L);
+
+	return ret;
+}
+
+/**
+ * call the function like lua_pcall(L, nargs, 1, 0), but in the coroutine of the connection
+ *
+ * the function and its arguments are moved from the top of the stack of L
+ *
+ * @return 0 on success, the result is on the top of the stack of L
+ *         LUA_YIELD if it waits in proxy.wait_all(), call network_async_query_lua_resume() once network_async_query_lua_is_ready()
+ *         the error-code of lua_resume(), the error-msg is on the top of the stack of L
+ */
+int network_async_query_lua_call(network_mysqld_con_lua_t *st, lua_State *L, int nargs) {
+	if (NULL == st->async_L) {
+		st->async_L = lua_newthread(L);
+		st->async_L_ref = luaL_ref(L, LUA_REGISTRYINDEX);
+	}
+	lua_profiler_attach(st->async_L);
+
+	lua_xmove(L, st->async_L, nargs + 1);
+
+	return network_async_query_lua_run(st, L, nargs);
+}
+
+/**
+ * check if all the futures the coroutine waits for are done
+ */
+gboolean network_async_query_lua_is_ready(network_mysqld_con_lua_t *st) {
+	lua_State *co = st->async_L;
+	int i;
+
+	for (i = 1; i <= lua_gettop(co); i++) {
+		if (!network_async_query_is_done(*(network_async_query_t **)lua_touserdata(co, i))) return FALSE;
+	}
+
+	return TRUE;
+}
+
+/**
+ * return the results of the futures from proxy.wait_all() and resume the coroutine
+ *
+ * @see network_async_query_lua_call()
+ */
+int network_async_query_lua_resume(network_mysqld_con_lua_t *st, lua_State *L) {
+	lua_State *co = st->async_L;
+	int n = lua_gettop(co);
+	int i;
+
+	for (i = 1; i <= n; i++) {
+		proxy_async_query_push_result(co, i);
+		lua_replace(co, i);
+	}
+
+	return network_async_query_lua_run(st, L, n);
+}
@@ -0,0 +1,415 @@
+/* $%BEGINLICENSE%$
+ Copyright (c) 2008, 2012, Oracle and/or its affiliates. All rights reserved.
+
+ This program is free software; you can redistribute it and/or
+ modify it under the terms of the GNU General Public License as
+ published by the Free Software Foundation; version 2 of the
+ License.
+
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ GNU General Public License for more details.
+
+ You should have received a copy of the GNU General Public License
+ along with this program; if not, write to the Free Software
+ Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA
+ 02110-1301  USA
+
+ $%ENDLICENSE%$ */
+
+/** @file
+ * queries on pooled backend connections, outside of the connection of the client
+ *
+ * lets the scripts send queries to several backends at once and wait for all of
+ * the results, see proxy.query_async()
+ */
+
+#include <string.h>
+#include <errno.h>
+
+#include <glib.h>
+
+#include <mysqld_error.h>
+
+#include "network-async-query.h"
+#include "network-mysqld.h"
+#include "network-mysqld-proto.h"
+#include "network-conn-pool-lua.h"
+#include "chassis-event-thread.h"
+#include "glib-ext.h"
+
+#define C(x) x, sizeof(x) - 1
+#define S(x) x->str, x->len
+
+static void network_async_query_handle(int event_fd, short events, void *user_data);
+
+network_async_query_t *network_async_query_new(int id, const char *query, gsize query_len) {
+	network_async_query_t *q;
+
+	q = g_new0(network_async_query_t, 1);
+	q->state = NETWORK_ASYNC_QUERY_IDLE;
+	q->result = g_queue_new();
+
+	q->inj = injection_new_len(id, query, query_len);
+	q->inj->result_queue = q->result;
+	q->inj->resultset_is_needed = TRUE;
+	q->inj->qstat.query_status = MYSQLD_PACKET_NULL;
+
+	return q;
+}
+
+static void network_async_query_reset_result(network_async_query_t *q) {
+	GString *packet;
+
+	while (NULL != (packet = g_queue_pop_head(q->result))) {
+		g_string_free(packet, TRUE);
+	}
+
+	if (q->query_result) {
+		network_mysqld_com_query_result_free(q->query_result);
+		q->query_result = NULL;
+	}
+}
+
+void network_async_query_free(network_async_query_t *q) {
+	if (!q) return;
+
+	if (q->is_in_progress) {
+		/* network_async_query_run() frees it once progress() returns */
+		q->is_freed = TRUE;
+		return;
+	}
+
+	if (q->sock) {
+		/* still running, the connection is in a unknown state */
+		event_del(&(q->sock->event));
+		network_socket_free(q->sock);
+	}
+
+	network_async_query_reset_result(q);
+	g_queue_free(q->result);
+
+	injection_free(q->inj);
+	if (q->default_db) g_string_free(q->default_db, TRUE);
+	if (q->errmsg) g_free(q->errmsg);
+
+	g_free(q);
+}
+
+gboolean network_async_query_is_done(network_async_query_t *q) {
+	return q->state == NETWORK_ASYNC_QUERY_DONE;
+}
+
+/**
+ * finish the query and tell the owner
+ *
+ * a connection that got its result goes back into the pool, a broken one is closed
+ */
+static void network_async_query_done(network_async_query_t *q, const char *errmsg) {
+	if (q->sock) {
+		if (NULL == errmsg) {
+			network_connection_pool_lua_add_socket(q->srv, q->pool, q->sock);
+		} else {
+			event_del(&(q->sock->event));
+			network_socket_free(q->sock);
+		}
+		q->sock = NULL;
+	}
+
+	if (errmsg) {
+		network_mysqld_err_packet_t *err_packet;
+		GString *packet;
+
+		q->errmsg = g_strdup(errmsg);
+
+		/* the scripts see a ERR like the server would have sent it */
+		network_async_query_reset_result(q);
+
+		packet = g_string_new(NULL);
+		g_string_append_len(packet, C("\x00\x00\x00\x01")); /* the network-header */
+
+		err_packet = network_mysqld_err_packet_new();
+		err_packet->errcode = ER_UNKNOWN_ERROR;
+		g_string_assign(err_packet->errmsg, errmsg);
+		network_mysqld_proto_append_err_packet(packet, err_packet);
+		network_mysqld_err_packet_free(err_packet);
+
+		network_mysqld_proto_set_packet_len(packet, packet->len - NET_HEADER_SIZE);
+		g_queue_push_tail(q->result, packet);
+
+		q->inj->qstat.query_status = MYSQLD_PACKET_ERR;
+	}
+
+	q->inj->ts_read_query_result_last = chassis_get_rel_microseconds();
+	if (0 == q->inj->ts_read_query_result_first) {
+		q->inj->ts_read_query_result_first = q->inj->ts_read_query_result_last;
+	}
+
+	q->state = NETWORK_ASYNC_QUERY_DONE;
+
+	if (q->done) q->done(q, q->done_data);
+}
+
+/**
+ * let the owner take the packets of the result as they arrive
+ *
+ * progress() may pop the packets from q->result, the rest of them is there when done()
+ * is called. A failed query replaces the result with a ERR, even if a part of it was
+ * taken already. progress() may free the query.
+ */
+void network_async_query_set_progress(network_async_query_t *q, network_async_query_progress_func progress, gpointer progress_data) {
+	q->progress = progress;
+	q->progress_data = progress_data;
+}
+
+/**
+ * fail a query that couldn't be started
+ */
+void network_async_query_fail(network_async_query_t *q, const char *errmsg) {
+	network_async_query_done(q, errmsg);
+}
+
+/**
+ * send a command and prepare for its result
+ */
+static void network_async_query_send_command(network_async_query_t *q, guint8 command, const char *arg, gsize arg_len) {
+	GString *packet;
+
+	packet = g_string_sized_new(arg_len + 1);
+	g_string_append_c(packet, command);
+	if (arg) g_string_append_len(packet, arg, arg_len);
+
+	network_mysqld_queue_reset(q->sock);
+	network_mysqld_queue_append(q->sock, q->sock->send_queue, S(packet));
+
+	g_string_free(packet, TRUE);
+
+	network_async_query_reset_result(q);
+	q->query_result = network_mysqld_com_query_result_new();
+	/* the pooled connection keeps what its client negotiated */
+	q->query_result->deprecate_eof = network_mysqld_socket_is_deprecate_eof(q->sock);
+}
+
+static void network_async_query_wait_for_event(network_async_query_t *q, short ev_type) {
+	network_socket *sock = q->sock;
+
+	event_set(&(sock->event), sock->fd, ev_type, network_async_query_handle, q);
+	chassis_event_add_local_with_timeout(q->srv, &(sock->event), &(q->timeout)); /* stay in the thread of the client */
+}
+
+/**
+ * write the send-queue
+ *
+ * @return TRUE if everything is sent, FALSE if we wait for the socket or failed
+ */
+static gboolean network_async_query_write(network_async_query_t *q) {
+	switch (network_socket_write(q->sock, -1)) {
+	case NETWORK_SOCKET_SUCCESS:
+		return TRUE;
+	case NETWORK_SOCKET_WAIT_FOR_EVENT:
+		network_async_query_wait_for_event(q, EV_WRITE);
+		return FALSE;
+	default:
+		network_async_query_done(q, "(proxy) sending the query to the backend failed");
+		return FALSE;
+	}
+}
+
+/**
+ * read the result packets that arrived
+ *
+ * @return 1 if the result is complete, 0 if we need more packets, -1 on a error
+ */
+static int network_async_query_read_result(network_async_query_t *q) {
+	network_socket *sock = q->sock;
+	GString *s;
+
+	if (sock->to_read > 0) {
+		switch (network_socket_read(sock)) {
+		case NETWORK_SOCKET_SUCCESS:
+		case NETWORK_SOCKET_WAIT_FOR_EVENT:
+			break;
+		default:
+			return -1;
+		}
+	}
+
+	for (;;) {
+		switch (network_mysqld_con_get_packet(NULL, sock)) {
+		case NETWORK_SOCKET_SUCCESS:
+			continue;
+		case NETWORK_SOCKET_WAIT_FOR_EVENT:
+			break;
+		default:
+			return -1;
+		}
+		break;
+	}
+
+	while (NULL != (s = g_queue_pop_head(sock->recv_queue->chunks))) {
+		network_packet packet;
+		int is_finished;
+
+		packet.data = s;
+		packet.offset = 0;
+
+		if (0 == q->inj->ts_read_query_result_first) {
+			q->inj->ts_read_query_result_first = chassis_get_rel_microseconds();
+		}
+
+		g_queue_push_tail(q->result, s);
+
+		if (0 != network_mysqld_proto_skip_network_header(&packet)) return -1;
+
+		is_finished = network_mysqld_proto_get_com_query_result(&packet, q->query_result, FALSE);
+		if (is_finished != 0) return is_finished;
+	}
+
+	return 0;
+}
+
+/**
+ * copy the status of the result into the injection
+ */
+static void network_async_query_set_qstat(network_async_query_t *q) {
+	network_mysqld_com_query_result_t *com_query = q->query_result;
+	injection *inj = q->inj;
+
+	inj->bytes = com_query->bytes;
+	inj->rows  = com_query->rows;
+	inj->qstat.was_resultset = com_query->was_resultset;
+	inj->qstat.binary_encoded = com_query->binary_encoded;
+	inj->qstat.deprecate_eof = com_query->deprecate_eof;
+
+	if (!com_query->was_resultset) {
+		inj->qstat.affected_rows = com_query->affected_rows;
+		inj->qstat.insert_id     = com_query->insert_id;
+	}
+	inj->qstat.server_status = com_query->server_status;
+	inj->qstat.warning_count = com_query->warning_count;
+	inj->qstat.query_status  = com_query->query_status;
+}
+
+/**
+ * run the query until it has to wait for the network or is done
+ */
+static void network_async_query_run(network_async_query_t *q) {
+	for (;;) {
+		switch (q->state) {
+		case NETWORK_ASYNC_QUERY_IDLE:
+		case NETWORK_ASYNC_QUERY_DONE:
+			return;
+		case NETWORK_ASYNC_QUERY_SEND_INIT_DB:
+			if (!network_async_query_write(q)) return;
+
+			q->state = NETWORK_ASYNC_QUERY_READ_INIT_DB_RESULT;
+			break;
+		case NETWORK_ASYNC_QUERY_SEND_QUERY:
+			if (!network_async_query_write(q)) return;
+
+			q->state = NETWORK_ASYNC_QUERY_READ_RESULT;
+			break;
+		case NETWORK_ASYNC_QUERY_READ_INIT_DB_RESULT:
+		case NETWORK_ASYNC_QUERY_READ_RESULT:
+			switch (network_async_query_read_result(q)) {
+			case 0:
+				if (q->state == NETWORK_ASYNC_QUERY_READ_RESULT &&
+				    q->progress &&
+				    q->result->length > 0) {
+					q->is_in_progress = TRUE;
+					q->progress(q, q->progress_data);
+					q->is_in_progress = FALSE;
+
+					if (q->is_freed) {
+						network_async_query_free(q);
+						return;
+					}
+				}
+
+				network_async_query_wait_for_event(q, EV_READ);
+				return;
+			case 1:
+				break;
+			default:
+				network_async_query_done(q, "(proxy) reading the result from the backend failed");
+				return;
+			}
+
+			if (q->state == NETWORK_ASYNC_QUERY_READ_INIT_DB_RESULT) {
+				if (q->query_result->query_status != MYSQLD_PACKET_OK) {
+					/* the ERR of the COM_INIT_DB is the result of the query */
+					network_async_query_set_qstat(q);
+					network_async_query_done(q, NULL);
+					return;
+				}
+				g_string_assign_len(q->sock->default_db, S(q->default_db));
+
+				network_async_query_send_command(q, q->inj->query->str[0], q->inj->query->str + 1, q->inj->query->len - 1);
+				q->inj->ts_read_query = chassis_get_rel_microseconds();
+				q->state = NETWORK_ASYNC_QUERY_SEND_QUERY;
+				break;
+			}
+
+			network_async_query_set_qstat(q);
+			network_async_query_done(q, NULL);
+			return;
+		}
+	}
+}
+
+static void network_async_query_handle(int G_GNUC_UNUSED event_fd, short events, void *user_data) {
+	network_async_query_t *q = user_data;
+
+	if (events == EV_TIMEOUT) {
+		network_async_query_done(q, "(proxy) the backend timed out");
+		return;
+	}
+
+	if (events & EV_READ) {
+		if (NETWORK_SOCKET_SUCCESS != network_socket_to_read(q->sock)) {
+			network_async_query_done(q, "(proxy) ioctl() failed");
+			return;
+		}
+		if (q->sock->to_read == 0) {
+			network_async_query_done(q, "(proxy) the backend closed the connection");
+			return;
+		}
+	}
+
+	network_async_query_run(q);
+}
+
+/**
+ * send the query on a authed connection
+ *
+ * the done() callback is called once the result is read or the query failed, it may
+ * be called before network_async_query_start() returns
+ *
+ * @param pool       the pool the connection came from and goes back to
+ * @param sock       the authed connection, owned by the query from now on
+ * @param default_db switch the connection to this default-db if it has another one, NULL to keep it
+ */
+void network_async_query_start(network_async_query_t *q, chassis *srv, network_connection_pool *pool, network_socket *sock, GString *default_db, struct timeval *timeout, network_async_query_done_func done, gpointer done_data) {
+	g_return_if_fail(q->state == NETWORK_ASYNC_QUERY_IDLE);
+
+	q->srv = srv;
+	q->pool = pool;
+	q->sock = sock;
+	q->timeout = *timeout;
+	q->done = done;
+	q->done_data = done_data;
+
+	if (default_db && default_db->len > 0 && !g_string_equal(default_db, sock->default_db)) {
+		q->default_db = g_string_new_len(S(default_db));
+
+		network_async_query_send_command(q, COM_INIT_DB, S(default_db));
+		q->state = NETWORK_ASYNC_QUERY_SEND_INIT_DB;
+	} else {
+		network_async_query_send_command(q, q->inj->query->str[0], q->inj->query->str + 1, q->inj->query->len - 1);
+		q->state = NETWORK_ASYNC_QUERY_SEND_QUERY;
+	}
+	q->inj->ts_read_query = chassis_get_rel_microseconds();
+
+	network_async_query_run(q);
+}
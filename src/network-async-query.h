@@ -0,0 +1,86 @@
+/* $%BEGINLICENSE%$
+ Copyright (c) 2008, 2012, Oracle and/or its affiliates. All rights reserved.
+
+ This program is free software; you can redistribute it and/or
+ modify it under the terms of the GNU General Public License as
+ published by the Free Software Foundation; version 2 of the
+ License.
+
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ GNU General Public License for more details.
+
+ You should have received a copy of the GNU General Public License
+ along with this program; if not, write to the Free Software
+ Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA
+ 02110-1301  USA
+
+ $%ENDLICENSE%$ */
+#ifndef __NETWORK_ASYNC_QUERY_H__
+#define __NETWORK_ASYNC_QUERY_H__
+
+#include <glib.h>
+
+#include "network-socket.h"
+#include "network-conn-pool.h"
+#include "network-injection.h"
+#include "network-mysqld-packet.h"
+#include "chassis-mainloop.h"
+
+#include "network-exports.h"
+
+typedef enum {
+	NETWORK_ASYNC_QUERY_IDLE,
+	NETWORK_ASYNC_QUERY_SEND_INIT_DB,
+	NETWORK_ASYNC_QUERY_READ_INIT_DB_RESULT,
+	NETWORK_ASYNC_QUERY_SEND_QUERY,
+	NETWORK_ASYNC_QUERY_READ_RESULT,
+	NETWORK_ASYNC_QUERY_DONE
+} network_async_query_state_t;
+
+typedef struct network_async_query network_async_query_t;
+
+typedef void (*network_async_query_done_func)(network_async_query_t *q, gpointer user_data);
+typedef void (*network_async_query_progress_func)(network_async_query_t *q, gpointer user_data);
+
+/**
+ * a query sent on a pooled backend connection besides the connection of the client
+ *
+ * the connection is taken from the pool of the event-thread and put back once the
+ * result is read. The query and its result are kept in a injection, the scripts see
+ * it like the injections of read_query_result()
+ */
+struct network_async_query {
+	network_async_query_state_t state;
+
+	chassis *srv;
+	network_connection_pool *pool;   /**< gets the connection back */
+	network_socket *sock;
+
+	GString *default_db;             /**< switch the connection to it first, NULL to keep the default-db of the connection */
+	struct timeval timeout;          /**< each step has to finish in this time */
+
+	injection *inj;                  /**< the query, its result and its timings */
+	GQueue *result;                  /**< the packets of the result, inj->result_queue points to it */
+	network_mysqld_com_query_result_t *query_result;
+
+	gchar *errmsg;                   /**< why the query failed before it got a result, NULL if it didn't */
+
+	network_async_query_done_func done;
+	gpointer done_data;
+
+	network_async_query_progress_func progress; /**< called when a part of the result arrived, NULL to wait for done() */
+	gpointer progress_data;
+	gboolean is_in_progress;         /**< progress() runs, a network_async_query_free() waits until it returns */
+	gboolean is_freed;
+};
+
+NETWORK_API network_async_query_t *network_async_query_new(int id, const char *query, gsize query_len);
+NETWORK_API void network_async_query_free(network_async_query_t *q);
+NETWORK_API void network_async_query_start(network_async_query_t *q, chassis *srv, network_connection_pool *pool, network_socket *sock, GString *default_db, struct timeval *timeout, network_async_query_done_func done, gpointer done_data);
+NETWORK_API void network_async_query_set_progress(network_async_query_t *q, network_async_query_progress_func progress, gpointer progress_data);
+NETWORK_API void network_async_query_fail(network_async_query_t *q, const char *errmsg);
+NETWORK_API gboolean network_async_query_is_done(network_async_query_t *q);
+
+#endif
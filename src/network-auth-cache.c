@@ -0,0 +1,255 @@
+/* $%BEGINLICENSE%$
+ Copyright (c) 2008, 2012, Oracle and/or its affiliates. All rights reserved.
+
+ This program is free software; you can redistribute it and/or
+ modify it under the terms of the GNU General Public License as
+ published by the Free Software Foundation; version 2 of the
+ License.
+
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ GNU General Public License for more details.
+
+ You should have received a copy of the GNU General Public License
+ along with this program; if not, write to the Free Software
+ Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA
+ 02110-1301  USA
+
+ $%ENDLICENSE%$ */
+
+/** @file
+ * the password hashes of the users for the logins on pooled connections
+ *
+ * the file has a username and its hash per line, separated by whitespace, like the output of
+ *
+ *   SELECT user, authentication_string FROM mysql.user
+ *
+ * empty lines and lines starting with a # are ignored.
+ */
+
+#include <string.h>
+
+#include "network-mysqld-proto.h"
+#include "network-auth-cache.h"
+
+#define S(x) x->str, x->len
+
+GQuark network_auth_cache_error(void) {
+	return g_quark_from_static_string("network-auth-cache-error-quark");
+}
+
+static network_auth_cache_entry_t *network_auth_cache_entry_new(void) {
+	network_auth_cache_entry_t *entry;
+
+	entry = g_new0(network_auth_cache_entry_t, 1);
+	entry->double_hashed = g_string_new(NULL);
+
+	return entry;
+}
+
+static void network_auth_cache_entry_free(network_auth_cache_entry_t *entry) {
+	if (!entry) return;
+
+	g_string_free(entry->double_hashed, TRUE);
+
+	g_free(entry);
+}
+
+network_auth_cache_t *network_auth_cache_new(void) {
+	network_auth_cache_t *cache;
+
+	cache = g_new0(network_auth_cache_t, 1);
+	cache->mutex = g_mutex_new();
+	cache->users = g_hash_table_new_full(g_str_hash, g_str_equal, g_free, (GDestroyNotify)network_auth_cache_entry_free);
+
+	return cache;
+}
+
+void network_auth_cache_free(network_auth_cache_t *cache) {
+	if (!cache) return;
+
+	g_hash_table_destroy(cache->users);
+	g_mutex_free(cache->mutex);
+
+	g_free(cache);
+}
+
+/**
+ * set the hash of a user
+ *
+ * the entry has to be confirmed by a login again
+ *
+ * @param hashed_str the double-SHA1 as 40 hex-digits, with or without the leading *
+ * @return FALSE if hashed_str isn't a double-SHA1
+ */
+gboolean network_auth_cache_set(network_auth_cache_t *cache, const gchar *username, const gchar *hashed_str) {
+	network_auth_cache_entry_t *entry;
+	gsize i;
+
+	if (hashed_str[0] == '*') hashed_str++;
+
+	if (strlen(hashed_str) != 40) return FALSE;
+
+	entry = network_auth_cache_entry_new();
+	for (i = 0; i < 40; i += 2) {
+		gint hi = g_ascii_xdigit_value(hashed_str[i]);
+		gint lo = g_ascii_xdigit_value(hashed_str[i + 1]);
+
+		if (hi < 0 || lo < 0) {
+			network_auth_cache_entry_free(entry);
+			return FALSE;
+		}
+
+		g_string_append_c(entry->double_hashed, (hi << 4) | lo);
+	}
+
+	g_mutex_lock(cache->mutex);
+	g_hash_table_insert(cache->users, g_strdup(username), entry);
+	g_mutex_unlock(cache->mutex);
+
+	return TRUE;
+}
+
+/**
+ * add the users of a file
+ *
+ * @return 0 on success, -1 on error
+ */
+int network_auth_cache_load(network_auth_cache_t *cache, const gchar *filename, GError **gerr) {
+	GError *read_gerr = NULL;
+	gchar *contents;
+	gchar **lines;
+	int ret = 0;
+	guint i;
+
+	if (!g_file_get_contents(filename, &contents, NULL, &read_gerr)) {
+		g_set_error(gerr, NETWORK_AUTH_CACHE_ERROR, NETWORK_AUTH_CACHE_ERROR_READ,
+				"reading %s failed: %s",
+				filename,
+				read_gerr->message);
+		g_error_free(read_gerr);
+
+		return -1;
+	}
+
+	lines = g_strsplit(contents, "\n", -1);
+	for (i = 0; lines[i] && ret == 0; i++) {
+		gchar *line = g_strstrip(lines[i]);
+		gchar *hashed_str;
+
+		if (line[0] == '\0' || line[0] == '#') continue;
+
+		hashed_str = strpbrk(line, " \t");
+		if (hashed_str) {
+			*hashed_str++ = '\0';
+			hashed_str = g_strchug(hashed_str);
+		}
+
+		if (!hashed_str || !network_auth_cache_set(cache, line, hashed_str)) {
+			g_set_error(gerr, NETWORK_AUTH_CACHE_ERROR, NETWORK_AUTH_CACHE_ERROR_PARSE,
+					"%s:%u: expected a username and a *HEX hash",
+					filename, i + 1);
+
+			ret = -1;
+		}
+	}
+	g_strfreev(lines);
+	g_free(contents);
+
+	return ret;
+}
+
+/**
+ * check a mysql_native_password response against a double-SHA1
+ */
+static gboolean network_auth_cache_check_entry(network_auth_cache_entry_t *entry,
+		const char *challenge, gsize challenge_len,
+		const char *response, gsize response_len) {
+	/* the other auth-methods and the empty password aren't ours to check */
+	if (response_len != 20) return FALSE;
+	if (challenge_len != 20 && challenge_len != 21) return FALSE;
+
+	return network_mysqld_proto_password_check(challenge, challenge_len,
+			response, response_len,
+			S(entry->double_hashed));
+}
+
+/**
+ * a backend accepted the login of a user
+ *
+ * confirms the hash of the user if the login matches it, drops it if a mysql_native_password
+ * login doesn't match it
+ */
+void network_auth_cache_confirm(network_auth_cache_t *cache, const gchar *username,
+		const char *challenge, gsize challenge_len,
+		const char *response, gsize response_len) {
+	network_auth_cache_entry_t *entry;
+
+	g_mutex_lock(cache->mutex);
+	entry = g_hash_table_lookup(cache->users, username);
+	if (entry && response_len == 20) {
+		if (network_auth_cache_check_entry(entry, challenge, challenge_len, response, response_len)) {
+			entry->is_confirmed = TRUE;
+		} else {
+			g_hash_table_remove(cache->users, username);
+		}
+	}
+	g_mutex_unlock(cache->mutex);
+}
+
+/**
+ * check the login of a user
+ *
+ * @return TRUE if the user has a confirmed hash and the response matches it, FALSE if the backend has to check it
+ */
+gboolean network_auth_cache_check(network_auth_cache_t *cache, const gchar *username,
+		const char *challenge, gsize challenge_len,
+		const char *response, gsize response_len) {
+	network_auth_cache_entry_t *entry;
+	gboolean is_valid = FALSE;
+
+	g_mutex_lock(cache->mutex);
+	entry = g_hash_table_lookup(cache->users, username);
+	if (entry && entry->is_confirmed) {
+		is_valid = network_auth_cache_check_entry(entry, challenge, challenge_len, response, response_len);
+	}
+	if (is_valid) {
+		cache->hits++;
+	} else {
+		cache->misses++;
+	}
+	g_mutex_unlock(cache->mutex);
+
+	return is_valid;
+}
+
+/**
+ * check the login of a user and get the SHA1() of its password
+ *
+ * unlike network_auth_cache_check() the hash doesn't have to be confirmed: the SHA1() is
+ * used to log in to a backend, a outdated hash fails there.
+ *
+ * @param hashed_password gets the SHA1(password)
+ * @return TRUE if the user is known and the response matches its hash
+ */
+gboolean network_auth_cache_unscramble(network_auth_cache_t *cache, const gchar *username,
+		const char *challenge, gsize challenge_len,
+		const char *response, gsize response_len,
+		GString *hashed_password) {
+	network_auth_cache_entry_t *entry;
+	gboolean is_valid = FALSE;
+
+	g_mutex_lock(cache->mutex);
+	entry = g_hash_table_lookup(cache->users, username);
+	if (entry && network_auth_cache_check_entry(entry, challenge, challenge_len, response, response_len)) {
+		/* the 21st byte of the challenge is the trailing \0 */
+		is_valid = (0 == network_mysqld_proto_password_unscramble(hashed_password,
+				challenge, 20,
+				response, response_len,
+				S(entry->double_hashed)));
+	}
+	g_mutex_unlock(cache->mutex);
+
+	return is_valid;
+}
@@ -0,0 +1,77 @@
+/* $%BEGINLICENSE%$
+ Copyright (c) 2008, 2012, Oracle and/or its affiliates. All rights reserved.
+
+ This program is free software; you can redistribute it and/or
+ modify it under the terms of the GNU General Public License as
+ published by the Free Software Foundation; version 2 of the
+ License.
+
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ GNU General Public License for more details.
+
+ You should have received a copy of the GNU General Public License
+ along with this program; if not, write to the Free Software
+ Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA
+ 02110-1301  USA
+
+ $%ENDLICENSE%$ */
+#ifndef __NETWORK_AUTH_CACHE_H__
+#define __NETWORK_AUTH_CACHE_H__
+
+#include <glib.h>
+
+#include "network-exports.h"
+
+/**
+ * the double-SHA1 of the passwords of the users, to check the logins on pooled connections
+ * without a COM_CHANGE_USER
+ *
+ * the mysql_native_password scramble can't be reversed, the hashes come from a file in the
+ * format of mysql.user (username and *HEX per line). A entry is only used after a backend
+ * accepted a login of its user that matches it, a mismatch drops it: the password changed.
+ *
+ * the event-threads share the cache
+ */
+
+typedef struct {
+	GString *double_hashed;            /**< SHA1(SHA1(password)), 20 bytes */
+	gboolean is_confirmed;             /**< a backend accepted a login that matches it */
+} network_auth_cache_entry_t;
+
+typedef struct {
+	GMutex *mutex;                     /**< protects all fields below */
+
+	GHashTable *users;                 /**< username -> network_auth_cache_entry_t */
+
+	guint64 hits;                      /**< logins checked by the cache */
+	guint64 misses;                    /**< logins the cache couldn't check */
+} network_auth_cache_t;
+
+NETWORK_API network_auth_cache_t *network_auth_cache_new(void);
+NETWORK_API void network_auth_cache_free(network_auth_cache_t *cache);
+
+NETWORK_API gboolean network_auth_cache_set(network_auth_cache_t *cache, const gchar *username, const gchar *hashed_str);
+NETWORK_API int network_auth_cache_load(network_auth_cache_t *cache, const gchar *filename, GError **gerr);
+
+NETWORK_API void network_auth_cache_confirm(network_auth_cache_t *cache, const gchar *username,
+		const char *challenge, gsize challenge_len,
+		const char *response, gsize response_len);
+NETWORK_API gboolean network_auth_cache_check(network_auth_cache_t *cache, const gchar *username,
+		const char *challenge, gsize challenge_len,
+		const char *response, gsize response_len);
+NETWORK_API gboolean network_auth_cache_unscramble(network_auth_cache_t *cache, const gchar *username,
+		const char *challenge, gsize challenge_len,
+		const char *response, gsize response_len,
+		GString *hashed_password);
+
+#define NETWORK_AUTH_CACHE_ERROR network_auth_cache_error()
+NETWORK_API GQuark network_auth_cache_error(void);
+
+typedef enum {
+	NETWORK_AUTH_CACHE_ERROR_READ,     /**< the file couldn't be read */
+	NETWORK_AUTH_CACHE_ERROR_PARSE     /**< a line isn't a username and a hash */
+} network_auth_cache_error_t;
+
+#endif
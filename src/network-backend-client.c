@@ -0,0 +1,155 @@
+/* $%BEGINLICENSE%$
+ Copyright (c) 2008, 2012, Oracle and/or its affiliates. All rights reserved.
+
+ This program is free software; you can redistribute it and/or
+ modify it under the terms of the GNU General Public License as
+ published by the Free Software Foundation; version 2 of the
+ License.
+
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ GNU General Public License for more details.
+
+ You should have received a copy of the GNU General Public License
+ along with this program; if not, write to the Free Software
+ Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA
+ 02110-1301  USA
+
+ $%ENDLICENSE%$ */
+
+/** @file
+ * log in to a server and send commands to it from our own connections
+ *
+ * used by the health-check, the mirror and the loadgen plugin
+ */
+
+#include <string.h>
+
+#include <glib.h>
+
+#include "network-backend-client.h"
+#include "network-mysqld.h"
+#include "network-mysqld-proto.h"
+#include "network-mysqld-packet.h"
+
+#define S(x) x->str, x->len
+
+/**
+ * move the received bytes into the recv-queue as full packets
+ *
+ * @return NETWORK_SOCKET_SUCCESS if we have a packet, NETWORK_SOCKET_WAIT_FOR_EVENT if we need more data
+ */
+network_socket_retval_t network_backend_client_read(network_socket *sock) {
+	if (sock->to_read > 0) {
+		switch (network_socket_read(sock)) {
+		case NETWORK_SOCKET_SUCCESS:
+		case NETWORK_SOCKET_WAIT_FOR_EVENT:
+			break;
+		default:
+			return NETWORK_SOCKET_ERROR;
+		}
+	}
+
+	for (;;) {
+		switch (network_mysqld_con_get_packet(NULL, sock)) {
+		case NETWORK_SOCKET_SUCCESS:
+			continue;
+		case NETWORK_SOCKET_WAIT_FOR_EVENT:
+			break;
+		default:
+			return NETWORK_SOCKET_ERROR;
+		}
+		break;
+	}
+
+	return sock->recv_queue->chunks->length > 0 ? NETWORK_SOCKET_SUCCESS : NETWORK_SOCKET_WAIT_FOR_EVENT;
+}
+
+/**
+ * get the auth-challenge from the recv-queue and answer it with our login
+ *
+ * @param default_db the default-db to log in with, may be NULL
+ * @return 0 if the auth-response is queued, -1 if the server refused us or sent garbage
+ */
+int network_backend_client_send_auth(network_socket *sock, const gchar *username, const gchar *password, const GString *default_db) {
+	network_mysqld_auth_challenge *shake;
+	network_mysqld_auth_response *auth;
+	network_packet packet;
+	GString *auth_packet;
+	guint8 status;
+	int err = 0;
+
+	packet.data = g_queue_peek_head(sock->recv_queue->chunks);
+	packet.offset = 0;
+
+	err = err || network_mysqld_proto_skip_network_header(&packet);
+	err = err || network_mysqld_proto_peek_int8(&packet, &status);
+	if (err || status == MYSQLD_PACKET_ERR) return -1; /* Too many connections, Host is blocked, ... */
+
+	shake = network_mysqld_auth_challenge_new();
+	if (0 != network_mysqld_proto_get_auth_challenge(&packet, shake)) {
+		network_mysqld_auth_challenge_free(shake);
+		return -1;
+	}
+	g_string_free(g_queue_pop_head(sock->recv_queue->chunks), TRUE);
+
+	auth = network_mysqld_auth_response_new_login(shake, username ? username : "", password);
+	if (default_db) g_string_assign_len(auth->database, S(default_db));
+
+	auth_packet = g_string_new(NULL);
+	network_mysqld_proto_append_auth_response(auth_packet, auth);
+	network_mysqld_queue_append(sock, sock->send_queue, S(auth_packet));
+
+	g_string_free(auth_packet, TRUE);
+	network_mysqld_auth_response_free(auth);
+	network_mysqld_auth_challenge_free(shake);
+
+	return 0;
+}
+
+/**
+ * take the answer to our auth-response from the recv-queue
+ *
+ * @return 1 if we are logged in, 0 if the OK packet follows, -1 if the login failed
+ */
+int network_backend_client_read_auth_result(network_socket *sock) {
+	network_packet packet;
+	guint8 status;
+	int err = 0;
+
+	packet.data = g_queue_peek_head(sock->recv_queue->chunks);
+	packet.offset = 0;
+
+	err = err || network_mysqld_proto_skip_network_header(&packet);
+	err = err || network_mysqld_proto_peek_int8(&packet, &status);
+
+	if (!err && status == 0x01 && packet.data->len == NET_HEADER_SIZE + 2 &&
+	    packet.data->str[NET_HEADER_SIZE + 1] == 0x03) {
+		/* caching_sha2_password's fast-auth-success, the OK packet follows */
+		g_string_free(g_queue_pop_head(sock->recv_queue->chunks), TRUE);
+		return 0;
+	}
+
+	g_string_free(g_queue_pop_head(sock->recv_queue->chunks), TRUE);
+
+	return (!err && status == MYSQLD_PACKET_OK) ? 1 : -1;
+}
+
+/**
+ * queue a command as the first packet of a new sequence
+ *
+ * @param arg the payload after the command-byte, may be NULL
+ */
+void network_backend_client_send_command(network_socket *sock, guint8 command, const char *arg, gsize arg_len) {
+	GString *packet;
+
+	packet = g_string_sized_new(arg_len + 1);
+	g_string_append_c(packet, command);
+	if (arg) g_string_append_len(packet, arg, arg_len);
+
+	network_mysqld_queue_reset(sock);
+	network_mysqld_queue_append(sock, sock->send_queue, S(packet));
+
+	g_string_free(packet, TRUE);
+}
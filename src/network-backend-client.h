@@ -0,0 +1,42 @@
+/* $%BEGINLICENSE%$
+ Copyright (c) 2008, 2012, Oracle and/or its affiliates. All rights reserved.
+
+ This program is free software; you can redistribute it and/or
+ modify it under the terms of the GNU General Public License as
+ published by the Free Software Foundation; version 2 of the
+ License.
+
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ GNU General Public License for more details.
+
+ You should have received a copy of the GNU General Public License
+ along with this program; if not, write to the Free Software
+ Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA
+ 02110-1301  USA
+
+ $%ENDLICENSE%$ */
+#ifndef __NETWORK_BACKEND_CLIENT_H__
+#define __NETWORK_BACKEND_CLIENT_H__
+
+#include <glib.h>
+
+#include "network-socket.h"
+
+#include "network-exports.h"
+
+/**
+ * the client side of the MySQL protocol for the connections the proxy opens on its own
+ *
+ * the health-check, the mirror and the loadgen plugin log in to a server with their own
+ * user and send their commands over a network_socket driven by their own event-loop. They
+ * share the steps of the protocol, the state-machine around them stays with the caller.
+ */
+
+NETWORK_API network_socket_retval_t network_backend_client_read(network_socket *sock);
+NETWORK_API int network_backend_client_send_auth(network_socket *sock, const gchar *username, const gchar *password, const GString *default_db);
+NETWORK_API int network_backend_client_read_auth_result(network_socket *sock);
+NETWORK_API void network_backend_client_send_command(network_socket *sock, guint8 command, const char *arg, gsize arg_len);
+
+#endif
@@ -0,0 +1,600 @@
+/* $%BEGINLICENSE%$
+ Copyright (c) 2008, 2012, Oracle and/or its affiliates. All rights reserved.
+
+ This program is free software; you can redistribute it and/or
+ modify it under the terms of the GNU General Public License as
+ published by the Free Software Foundation; version 2 of the
+ License.
+
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ GNU General Public License for more details.
+
+ You should have received a copy of the GNU General Public License
+ along with this program; if not, write to the Free Software
+ Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA
+ 02110-1301  USA
+
+ $%ENDLICENSE%$ */
+
+/** @file
+ * active health-checks of the backends
+ *
+ * without them a backend only goes DOWN when a client fails to connect to it and
+ * network_backends_check() lets the clients try again after 4 seconds. With them
+ * a probe connects to each backend in the background and clients are only routed
+ * to backends that answered.
+ */
+
+#include <string.h>
+#include <errno.h>
+
+#include <glib.h>
+
+#include "network-backend-health.h"
+#include "network-backend-client.h"
+#include "network-socket.h"
+#include "network-mysqld.h"
+#include "network-mysqld-proto.h"
+#include "network-mysqld-packet.h"
+#include "chassis-timings.h"
+#include "glib-ext.h"
+
+#define C(x) x, sizeof(x) - 1
+
+typedef enum {
+	NETWORK_BACKEND_PROBE_IDLE,
+	NETWORK_BACKEND_PROBE_CONNECT,
+	NETWORK_BACKEND_PROBE_READ_HANDSHAKE,
+	NETWORK_BACKEND_PROBE_SEND_AUTH,
+	NETWORK_BACKEND_PROBE_READ_AUTH_RESULT,
+	NETWORK_BACKEND_PROBE_SEND_PING,
+	NETWORK_BACKEND_PROBE_READ_PING_RESULT,
+	NETWORK_BACKEND_PROBE_SEND_SLAVE_STATUS,
+	NETWORK_BACKEND_PROBE_READ_SLAVE_STATUS_RESULT,
+	NETWORK_BACKEND_PROBE_SEND_MASTER_STATUS,
+	NETWORK_BACKEND_PROBE_READ_MASTER_STATUS_RESULT
+} network_backend_probe_state_t;
+
+/**
+ * the health-check of one backend
+ */
+typedef struct {
+	network_backends_health_t *health;
+	network_backend_t *backend;
+
+	network_backend_probe_state_t state;
+	network_socket *sock;
+
+	network_mysqld_com_query_result_t *query_result; /**< tracks the result of the query we sent */
+	GQueue *result;                                  /**< the packets of the result */
+	guint64 query_usec;                              /**< when the query was sent, in chassis_get_rel_microseconds() */
+} network_backend_probe_t;
+
+static void network_backend_probe_handle(int event_fd, short events, void *user_data);
+
+static network_backend_probe_t *network_backend_probe_new(network_backends_health_t *health, network_backend_t *backend) {
+	network_backend_probe_t *probe;
+
+	probe = g_new0(network_backend_probe_t, 1);
+	probe->health = health;
+	probe->backend = backend;
+	probe->state = NETWORK_BACKEND_PROBE_IDLE;
+	probe->result = g_queue_new();
+
+	return probe;
+}
+
+static void network_backend_probe_reset_result(network_backend_probe_t *probe) {
+	GString *packet;
+
+	while (NULL != (packet = g_queue_pop_head(probe->result))) {
+		g_string_free(packet, TRUE);
+	}
+
+	if (probe->query_result) {
+		network_mysqld_com_query_result_free(probe->query_result);
+		probe->query_result = NULL;
+	}
+}
+
+/**
+ * close the connection of the probe, it waits for the next round
+ */
+static void network_backend_probe_close(network_backend_probe_t *probe) {
+	network_backend_probe_reset_result(probe);
+
+	if (probe->sock) {
+		network_socket_free(probe->sock);
+		probe->sock = NULL;
+	}
+
+	probe->state = NETWORK_BACKEND_PROBE_IDLE;
+}
+
+static void network_backend_probe_free(network_backend_probe_t *probe) {
+	if (!probe) return;
+
+	network_backend_probe_close(probe);
+	g_queue_free(probe->result);
+
+	g_free(probe);
+}
+
+/**
+ * finish the round and apply the result to the backend
+ */
+static void network_backend_probe_done(network_backend_probe_t *probe, backend_state_t state, const char *reason) {
+	network_backend_t *backend = probe->backend;
+
+	if (network_backend_set_state(backend, state)) {
+		g_message("%s: health-check: backend %s is %s now%s%s",
+				G_STRLOC,
+				backend->addr->name->str,
+				network_backend_state_get_name(state),
+				reason ? ": " : "",
+				reason ? reason : "");
+	}
+
+	network_backend_probe_close(probe);
+}
+
+/**
+ * send a command to the backend and prepare for its result
+ */
+static void network_backend_probe_send_command(network_backend_probe_t *probe, guint8 command, const char *arg, gsize arg_len) {
+	network_backend_client_send_command(probe->sock, command, arg, arg_len);
+
+	network_backend_probe_reset_result(probe);
+	probe->query_result = network_mysqld_com_query_result_new();
+	probe->query_usec = chassis_get_rel_microseconds();
+}
+
+/**
+ * track the received packets of a query result
+ *
+ * @return 1 if the result is complete, 0 if we need more packets, -1 on a protocol error
+ */
+static int network_backend_probe_read_result(network_backend_probe_t *probe) {
+	GString *s;
+
+	while (NULL != (s = g_queue_pop_head(probe->sock->recv_queue->chunks))) {
+		network_packet packet;
+		int is_finished;
+
+		packet.data = s;
+		packet.offset = 0;
+
+		g_queue_push_tail(probe->result, s);
+
+		if (0 != network_mysqld_proto_skip_network_header(&packet)) return -1;
+
+		is_finished = network_mysqld_proto_get_com_query_result(&packet, probe->query_result, FALSE);
+		if (is_finished != 0) return is_finished;
+	}
+
+	return 0;
+}
+
+/**
+ * the lag the read-only backend may have, the one of its group if it sets one
+ */
+static gint network_backend_probe_get_max_lag(network_backend_probe_t *probe) {
+	network_backend_group_t *group = probe->backend->group;
+
+	if (group && group->max_lag >= 0) return group->max_lag;
+
+	return probe->health->max_lag;
+}
+
+/**
+ * the ping worked, ask read-only backends for their lag and the master for its position if we have to
+ */
+static void network_backend_probe_ping_done(network_backend_probe_t *probe) {
+	network_backends_health_t *health = probe->health;
+
+	if ((network_backend_probe_get_max_lag(probe) >= 0 || health->track_binlog_pos) && probe->backend->type == BACKEND_TYPE_RO) {
+		network_backend_probe_send_command(probe, COM_QUERY, C("SHOW SLAVE STATUS"));
+		probe->state = NETWORK_BACKEND_PROBE_SEND_SLAVE_STATUS;
+	} else if (health->track_binlog_pos && probe->backend->type == BACKEND_TYPE_RW) {
+		network_backend_probe_send_command(probe, COM_QUERY, C("SHOW MASTER STATUS"));
+		probe->state = NETWORK_BACKEND_PROBE_SEND_MASTER_STATUS;
+	} else {
+		network_backend_probe_done(probe, BACKEND_STATE_UP, NULL);
+	}
+}
+
+static void network_backend_probe_slave_status_done(network_backend_probe_t *probe) {
+	network_backends_health_t *health = probe->health;
+	network_backend_t *backend = probe->backend;
+	gint lag = -1;
+	gint max_lag;
+
+	if (health->track_binlog_pos) {
+		guint64 pos = 0;
+
+		/* the position in the binlog of the master up to which the SQL thread executed the events */
+		if (probe->query_result->query_status != MYSQLD_PACKET_OK ||
+		    0 != network_mysqld_proto_get_binlog_pos(probe->result->head, "Relay_Master_Log_File", "Exec_Master_Log_Pos", &pos)) {
+			pos = 0;
+		}
+
+		network_backend_set_binlog_pos(backend, pos, probe->query_usec);
+	}
+
+	if (probe->query_result->query_status != MYSQLD_PACKET_OK ||
+	    0 != network_mysqld_proto_get_slave_lag(probe->result->head, &lag)) {
+		/* no REPLICATION CLIENT privilege or no resultset, it answered the ping though */
+		g_debug("%s: health-check: SHOW SLAVE STATUS on %s failed, lag is unknown",
+				G_STRLOC,
+				backend->addr->name->str);
+		backend->replication_lag = -1;
+
+		network_backend_probe_done(probe, BACKEND_STATE_UP, NULL);
+
+		return;
+	}
+
+	backend->replication_lag = lag;
+	max_lag = network_backend_probe_get_max_lag(probe);
+
+	if (max_lag < 0) {
+		network_backend_probe_done(probe, BACKEND_STATE_UP, NULL);
+	} else if (lag < 0) {
+		network_backend_probe_done(probe, BACKEND_STATE_LAGGING, "the slave isn't replicating");
+	} else if (lag > max_lag) {
+		network_backend_probe_done(probe, BACKEND_STATE_LAGGING, "the slave is behind");
+	} else {
+		network_backend_probe_done(probe, BACKEND_STATE_UP, NULL);
+	}
+}
+
+static void network_backend_probe_master_status_done(network_backend_probe_t *probe) {
+	network_backend_t *backend = probe->backend;
+	guint64 pos = 0;
+
+	/* no binlog or no REPLICATION CLIENT privilege, reads after writes stay on the master then */
+	if (probe->query_result->query_status != MYSQLD_PACKET_OK ||
+	    0 != network_mysqld_proto_get_binlog_pos(probe->result->head, "File", "Position", &pos)) {
+		g_debug("%s: health-check: SHOW MASTER STATUS on %s failed, the binlog position is unknown",
+				G_STRLOC,
+				backend->addr->name->str);
+		pos = 0;
+	}
+
+	network_backend_set_binlog_pos(backend, pos, probe->query_usec);
+
+	network_backend_probe_done(probe, BACKEND_STATE_UP, NULL);
+}
+
+static void network_backend_probe_wait_for_event(network_backend_probe_t *probe, short ev_type) {
+	network_socket *sock = probe->sock;
+
+	event_set(&(sock->event), sock->fd, ev_type, network_backend_probe_handle, probe);
+	event_base_set(probe->health->event_base, &(sock->event));
+	event_add(&(sock->event), &(probe->health->timeout));
+}
+
+/**
+ * write the send-queue
+ *
+ * @return TRUE if everything is sent, FALSE if we wait for the socket or failed
+ */
+static gboolean network_backend_probe_write(network_backend_probe_t *probe) {
+	switch (network_socket_write(probe->sock, -1)) {
+	case NETWORK_SOCKET_SUCCESS:
+		return TRUE;
+	case NETWORK_SOCKET_WAIT_FOR_EVENT:
+		network_backend_probe_wait_for_event(probe, EV_WRITE);
+		return FALSE;
+	default:
+		network_backend_probe_done(probe, BACKEND_STATE_DOWN, "write failed");
+		return FALSE;
+	}
+}
+
+/**
+ * run the probe until it has to wait for the network or is done
+ */
+static void network_backend_probe_run(network_backend_probe_t *probe) {
+	network_backends_health_t *health = probe->health;
+
+	for (;;) {
+		switch (probe->state) {
+		case NETWORK_BACKEND_PROBE_IDLE:
+			return;
+		case NETWORK_BACKEND_PROBE_CONNECT:
+			switch (network_socket_connect_finish(probe->sock)) {
+			case NETWORK_SOCKET_SUCCESS:
+				probe->state = NETWORK_BACKEND_PROBE_READ_HANDSHAKE;
+				break;
+			default:
+				network_backend_probe_done(probe, BACKEND_STATE_DOWN, g_strerror(errno));
+				return;
+			}
+			break;
+		case NETWORK_BACKEND_PROBE_READ_HANDSHAKE:
+			switch (network_backend_client_read(probe->sock)) {
+			case NETWORK_SOCKET_SUCCESS:
+				break;
+			case NETWORK_SOCKET_WAIT_FOR_EVENT:
+				network_backend_probe_wait_for_event(probe, EV_READ);
+				return;
+			default:
+				network_backend_probe_done(probe, BACKEND_STATE_DOWN, "reading the handshake failed");
+				return;
+			}
+
+			if (NULL == health->username) {
+				/* the server is up and accepts connections, that's all we can check */
+				network_backend_probe_done(probe, BACKEND_STATE_UP, NULL);
+				return;
+			}
+
+			if (0 != network_backend_client_send_auth(probe->sock, health->username, health->password, NULL)) {
+				network_backend_probe_done(probe, BACKEND_STATE_DOWN, "the server doesn't accept connections");
+				return;
+			}
+			probe->state = NETWORK_BACKEND_PROBE_SEND_AUTH;
+			break;
+		case NETWORK_BACKEND_PROBE_SEND_AUTH:
+			if (!network_backend_probe_write(probe)) return;
+
+			probe->state = NETWORK_BACKEND_PROBE_READ_AUTH_RESULT;
+			break;
+		case NETWORK_BACKEND_PROBE_READ_AUTH_RESULT:
+			switch (network_backend_client_read(probe->sock)) {
+			case NETWORK_SOCKET_SUCCESS:
+				break;
+			case NETWORK_SOCKET_WAIT_FOR_EVENT:
+				network_backend_probe_wait_for_event(probe, EV_READ);
+				return;
+			default:
+				network_backend_probe_done(probe, BACKEND_STATE_DOWN, "reading the auth result failed");
+				return;
+			}
+
+			switch (network_backend_client_read_auth_result(probe->sock)) {
+			case 1:
+				break;
+			case 0:
+				/* the OK packet follows */
+				continue;
+			default:
+				/* a wrong password or a auth-method we don't speak
+				 *
+				 * the server is alive, don't take it out because of our config */
+				g_critical("%s: health-check: login as '%s' on %s failed, only checking the handshake",
+						G_STRLOC,
+						health->username,
+						probe->backend->addr->name->str);
+				network_backend_probe_done(probe, BACKEND_STATE_UP, NULL);
+				return;
+			}
+
+			if (health->ping_query) {
+				network_backend_probe_send_command(probe, COM_QUERY, health->ping_query, strlen(health->ping_query));
+			} else {
+				network_backend_probe_send_command(probe, COM_PING, NULL, 0);
+			}
+			probe->state = NETWORK_BACKEND_PROBE_SEND_PING;
+			break;
+		case NETWORK_BACKEND_PROBE_SEND_PING:
+			if (!network_backend_probe_write(probe)) return;
+
+			probe->state = NETWORK_BACKEND_PROBE_READ_PING_RESULT;
+			break;
+		case NETWORK_BACKEND_PROBE_SEND_SLAVE_STATUS:
+			if (!network_backend_probe_write(probe)) return;
+
+			probe->state = NETWORK_BACKEND_PROBE_READ_SLAVE_STATUS_RESULT;
+			break;
+		case NETWORK_BACKEND_PROBE_SEND_MASTER_STATUS:
+			if (!network_backend_probe_write(probe)) return;
+
+			probe->state = NETWORK_BACKEND_PROBE_READ_MASTER_STATUS_RESULT;
+			break;
+		case NETWORK_BACKEND_PROBE_READ_PING_RESULT:
+		case NETWORK_BACKEND_PROBE_READ_SLAVE_STATUS_RESULT:
+		case NETWORK_BACKEND_PROBE_READ_MASTER_STATUS_RESULT:
+			switch (network_backend_client_read(probe->sock)) {
+			case NETWORK_SOCKET_SUCCESS:
+				break;
+			case NETWORK_SOCKET_WAIT_FOR_EVENT:
+				network_backend_probe_wait_for_event(probe, EV_READ);
+				return;
+			default:
+				network_backend_probe_done(probe, BACKEND_STATE_DOWN, "reading the result failed");
+				return;
+			}
+
+			switch (network_backend_probe_read_result(probe)) {
+			case 0:
+				/* wait for the rest of the result */
+				network_backend_probe_wait_for_event(probe, EV_READ);
+				return;
+			case 1:
+				break;
+			default:
+				network_backend_probe_done(probe, BACKEND_STATE_DOWN, "the result is invalid");
+				return;
+			}
+
+			if (probe->state == NETWORK_BACKEND_PROBE_READ_SLAVE_STATUS_RESULT) {
+				network_backend_probe_slave_status_done(probe);
+			} else if (probe->state == NETWORK_BACKEND_PROBE_READ_MASTER_STATUS_RESULT) {
+				network_backend_probe_master_status_done(probe);
+			} else if (probe->query_result->query_status != MYSQLD_PACKET_OK) {
+				network_backend_probe_done(probe, BACKEND_STATE_DOWN, "the ping query failed");
+			} else {
+				network_backend_probe_ping_done(probe);
+			}
+			break;
+		}
+	}
+}
+
+static void network_backend_probe_handle(int G_GNUC_UNUSED event_fd, short events, void *user_data) {
+	network_backend_probe_t *probe = user_data;
+
+	if (events == EV_TIMEOUT) {
+		network_backend_probe_done(probe, BACKEND_STATE_DOWN, "timed out");
+		return;
+	}
+
+	if (events & EV_READ) {
+		if (NETWORK_SOCKET_SUCCESS != network_socket_to_read(probe->sock)) {
+			network_backend_probe_done(probe, BACKEND_STATE_DOWN, "ioctl() failed");
+			return;
+		}
+		if (probe->sock->to_read == 0) {
+			network_backend_probe_done(probe, BACKEND_STATE_DOWN, "the server closed the connection");
+			return;
+		}
+	}
+
+	network_backend_probe_run(probe);
+}
+
+/**
+ * open a connection to the backend and start the checks
+ */
+static void network_backend_probe_start(network_backend_probe_t *probe) {
+	probe->sock = network_socket_new();
+	network_backend_get_address(probe->backend, probe->sock->dst);
+	probe->sock->bind_src = network_backend_get_source_address(probe->backend, probe->sock->dst, probe->sock->src);
+
+	switch (network_socket_connect(probe->sock)) {
+	case NETWORK_SOCKET_SUCCESS:
+		probe->state = NETWORK_BACKEND_PROBE_READ_HANDSHAKE;
+		network_backend_probe_run(probe);
+		break;
+	case NETWORK_SOCKET_ERROR_RETRY:
+		/* connect() is in progress, wait until it is writable */
+		probe->state = NETWORK_BACKEND_PROBE_CONNECT;
+		network_backend_probe_wait_for_event(probe, EV_WRITE);
+		break;
+	default:
+		network_backend_probe_done(probe, BACKEND_STATE_DOWN, "connect() failed");
+		break;
+	}
+}
+
+/**
+ * start a round of checks for all backends that aren't checked right now
+ */
+static void network_backends_health_timer_handle(int G_GNUC_UNUSED event_fd, short G_GNUC_UNUSED events, void *user_data) {
+	network_backends_health_t *health = user_data;
+	GPtrArray *backends;
+	guint i;
+
+	/* backends may have been added since the last round */
+	backends = network_backends_get_snapshot(health->backends);
+
+	for (i = 0; i < backends->len; i++) {
+		network_backend_t *backend = backends->pdata[i];
+		network_backend_probe_t *probe;
+
+		/* dropped by a reload, it stays DOWN */
+		if (backend->is_removed) continue;
+
+		if (NULL == (probe = g_hash_table_lookup(health->probes, backend))) {
+			probe = network_backend_probe_new(health, backend);
+			g_hash_table_insert(health->probes, backend, probe);
+		}
+
+		/* still waiting for the last round */
+		if (probe->state != NETWORK_BACKEND_PROBE_IDLE) continue;
+
+		network_backend_probe_start(probe);
+	}
+
+	evtimer_add(&(health->timer), &(health->interval));
+}
+
+network_backends_health_t *network_backends_health_new(network_backends_t *backends, struct event_base *event_base) {
+	network_backends_health_t *health;
+
+	health = g_new0(network_backends_health_t, 1);
+	health->backends = backends;
+	health->event_base = event_base;
+	health->max_lag = -1;
+	health->probes = g_hash_table_new_full(g_direct_hash, g_direct_equal, NULL, (GDestroyNotify)network_backend_probe_free);
+
+	network_backends_health_set_interval(health, 2.0);
+
+	return health;
+}
+
+void network_backends_health_free(network_backends_health_t *health) {
+	if (!health) return;
+
+	if (health->is_started) {
+		evtimer_del(&(health->timer));
+	}
+
+	/* closes the open probes too */
+	g_hash_table_destroy(health->probes);
+
+	if (health->username) g_free(health->username);
+	if (health->password) g_free(health->password);
+	if (health->ping_query) g_free(health->ping_query);
+
+	g_free(health);
+}
+
+/**
+ * login to the backends to send the ping query
+ *
+ * @param username the user to login as, NULL to only check the handshake
+ */
+void network_backends_health_set_login(network_backends_health_t *health, const gchar *username, const gchar *password) {
+	if (health->username) g_free(health->username);
+	if (health->password) g_free(health->password);
+
+	health->username = g_strdup(username);
+	health->password = g_strdup(password);
+}
+
+/**
+ * @param query the query to send after the login, NULL to send a COM_PING
+ */
+void network_backends_health_set_ping_query(network_backends_health_t *health, const gchar *query) {
+	if (health->ping_query) g_free(health->ping_query);
+
+	health->ping_query = g_strdup(query);
+}
+
+/**
+ * set the time between two checks of a backend
+ *
+ * each step of a check has to finish in the same time
+ */
+void network_backends_health_set_interval(network_backends_health_t *health, gdouble interval_secs) {
+	if (interval_secs < 0.1) interval_secs = 0.1;
+
+	health->interval.tv_sec = (glong)interval_secs;
+	health->interval.tv_usec = (glong)((interval_secs - health->interval.tv_sec) * G_USEC_PER_SEC);
+
+	health->timeout = health->interval;
+}
+
+/**
+ * start checking the backends
+ *
+ * from now on the backends are only woken up by the health-checks
+ */
+void network_backends_health_start(network_backends_health_t *health) {
+	struct timeval now = { 0, 0 };
+
+	if (health->is_started) return;
+
+	health->backends->is_health_checked = TRUE;
+	health->is_started = TRUE;
+
+	/* run the first round right after the event-loop starts */
+	evtimer_set(&(health->timer), network_backends_health_timer_handle, health);
+	event_base_set(health->event_base, &(health->timer));
+	evtimer_add(&(health->timer), &now);
+}
@@ -0,0 +1,66 @@
+/* $%BEGINLICENSE%$
+ Copyright (c) 2008, 2012, Oracle and/or its affiliates. All rights reserved.
+
+ This program is free software; you can redistribute it and/or
+ modify it under the terms of the GNU General Public License as
+ published by the Free Software Foundation; version 2 of the
+ License.
+
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ GNU General Public License for more details.
+
+ You should have received a copy of the GNU General Public License
+ along with this program; if not, write to the Free Software
+ Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA
+ 02110-1301  USA
+
+ $%ENDLICENSE%$ */
+#ifndef __NETWORK_BACKEND_HEALTH_H__
+#define __NETWORK_BACKEND_HEALTH_H__
+
+#include <glib.h>
+
+#include "network-backend.h"
+
+#include "network-exports.h"
+
+/**
+ * probes the backends from the main event-loop
+ *
+ * each round opens a connection to each backend:
+ * - reads the handshake
+ * - logs in and sends the ping query (or COM_PING) if a username is set
+ * - asks the read-only backends for SHOW SLAVE STATUS if max_lag (or the one of their group) or track_binlog_pos is set
+ * - asks the read-write backends for SHOW MASTER STATUS if track_binlog_pos is set
+ *
+ * and marks the backends UP, DOWN or LAGGING before the clients get routed to them
+ */
+typedef struct {
+	network_backends_t *backends;
+	struct event_base *event_base;
+
+	gchar *username;         /**< login as this user, if NULL only the handshake is checked */
+	gchar *password;
+	gchar *ping_query;       /**< query to send after the login, if NULL a COM_PING is sent */
+	gint max_lag;            /**< read-only backends with a Seconds_Behind_Master above this are LAGGING, -1 to disable */
+	gboolean track_binlog_pos; /**< ask the master for its binlog position and the slaves how far they executed it */
+
+	struct timeval interval; /**< time between two checks of a backend */
+	struct timeval timeout;  /**< each step of a check has to finish in this time */
+
+	struct event timer;
+	gboolean is_started;
+
+	GHashTable *probes;      /**< the running probe of each network_backend_t */
+} network_backends_health_t;
+
+NETWORK_API network_backends_health_t *network_backends_health_new(network_backends_t *backends, struct event_base *event_base);
+NETWORK_API void network_backends_health_free(network_backends_health_t *health);
+NETWORK_API void network_backends_health_set_login(network_backends_health_t *health, const gchar *username, const gchar *password);
+NETWORK_API void network_backends_health_set_ping_query(network_backends_health_t *health, const gchar *query);
+NETWORK_API void network_backends_health_set_interval(network_backends_health_t *health, gdouble interval_secs);
+NETWORK_API void network_backends_health_start(network_backends_health_t *health);
+
+#endif
@@ -29,6 +29,7 @@
 #include "network-mysqld.h"
 #include "network-conn-pool-lua.h"
 #include "network-backend-lua.h"
+#include "chassis-event-thread.h"
 #include "network-address-lua.h"
 #include "network-mysqld-lua.h"
 
@@ -38,8 +39,19 @@
  * proxy.backend[0].
  *   connected_clients => clients using this backend
  *   address           => ip:port or unix-path of to the backend
- *   state             => int(BACKEND_STATE_UP|BACKEND_STATE_DOWN) 
+ *   state             => int(BACKEND_STATE_UP|BACKEND_STATE_DOWN|BACKEND_STATE_LAGGING) 
+ *   breaker           => the state of the circuit-breaker: "closed", "open" or "half_open"
  *   type              => int(BACKEND_TYPE_RW|BACKEND_TYPE_RO) 
+ *   pool              => the connection pool of the current event-thread
+ *   pool_stats        => the pool hits and misses summed over all event-threads
+ *   latency_first     => average microseconds to the first packet of a result, 0 if unknown
+ *   latency_total     => average microseconds to the last packet of a result, 0 if unknown
+ *   latency           => the connect, first_byte and query latency histograms summed over all event-threads,
+ *                        each a table of count, avg, p50, p95, p99, p999 and max in microseconds
+ *   replication_lag   => seconds the slave is behind as seen by the health-check, -1 if unknown
+ *   binlog_pos        => the binlog position of the master (RW) or up to which the slave executed it (RO), 0 if unknown
+ *   is_removed        => true if a config reload dropped the backend, it stays DOWN
+ *   group             => the name of the group of the backend, nil if it isn't in one
  *
  * @return nil or requested information
  * @see backend_state_t backend_type_t
@@ -55,6 +67,8 @@ static int proxy_backend_get(lua_State *L) {
 		network_address_lua_push(L, backend->addr);
 	} else if (strleq(key, keysize, C("state"))) {
 		lua_pushinteger(L, backend->state);
+	} else if (strleq(key, keysize, C("breaker"))) {
+		lua_pushstring(L, network_backend_breaker_state_get_name(backend->breaker.state));
 	} else if (strleq(key, keysize, C("type"))) {
 		lua_pushinteger(L, backend->type);
 	} else if (strleq(key, keysize, C("uuid"))) {
@@ -64,14 +78,93 @@ static int proxy_backend_get(lua_State *L) {
 			lua_pushnil(L);
 		}
 	} else if (strleq(key, keysize, C("pool"))) {
-		network_connection_pool *pool; 
+		network_connection_pool *pool = network_backend_get_pool(backend, chassis_event_thread_get_local_index());
 		network_connection_pool **pool_p;
 
-		pool_p = lua_newuserdata(L, sizeof(pool)); 
-		*pool_p = backend->pool;
+		/* the udata is cached in the env of the backend, a lua-state stays with its event-thread */
+		lua_getfenv(L, 1);                                                /* (sp += 1) */
+		lua_getfield(L, -1, "pool");                                      /* (sp += 1) */
+		if (lua_isuserdata(L, -1) &&
+		    *(network_connection_pool **)lua_touserdata(L, -1) == pool) {
+			lua_remove(L, -2);                                        /* (sp -= 1) */
+
+			return 1;
+		}
+		lua_pop(L, 1);                                                    /* (sp -= 1) */
+
+		pool_p = lua_newuserdata(L, sizeof(pool));                        /* (sp += 1) */
+		*pool_p = pool;
 
 		network_connection_pool_getmetatable(L);
 		lua_setmetatable(L, -2);
+
+		lua_pushvalue(L, -1);                                             /* (sp += 1) */
+		lua_setfield(L, -3, "pool"); /* cache.pool = <udata>              (sp -= 1) */
+		lua_remove(L, -2);                                                /* (sp -= 1) */
+	} else if (strleq(key, keysize, C("latency_first"))) {
+		lua_pushinteger(L, g_atomic_int_get(&backend->latency_first));
+	} else if (strleq(key, keysize, C("latency_total"))) {
+		lua_pushinteger(L, g_atomic_int_get(&backend->latency_total));
+	} else if (strleq(key, keysize, C("latency"))) {
+		network_histogram_t *h = network_histogram_new();
+		gint latency;
+
+		lua_newtable(L);
+		for (latency = 0; latency < NETWORK_BACKEND_LATENCY_MAX; latency++) {
+			network_backend_get_latency(backend, latency, h);
+
+			lua_newtable(L);
+			lua_pushnumber(L, h->count);
+			lua_setfield(L, -2, "count");
+			lua_pushnumber(L, h->count > 0 ? (gdouble)h->sum / h->count : 0);
+			lua_setfield(L, -2, "avg");
+			lua_pushnumber(L, network_histogram_get_percentile(h, 50));
+			lua_setfield(L, -2, "p50");
+			lua_pushnumber(L, network_histogram_get_percentile(h, 95));
+			lua_setfield(L, -2, "p95");
+			lua_pushnumber(L, network_histogram_get_percentile(h, 99));
+			lua_setfield(L, -2, "p99");
+			lua_pushnumber(L, network_histogram_get_percentile(h, 99.9));
+			lua_setfield(L, -2, "p999");
+			lua_pushnumber(L, h->max);
+			lua_setfield(L, -2, "max");
+
+			lua_setfield(L, -2, network_backend_latency_get_name(latency));
+		}
+
+		network_histogram_free(h);
+	} else if (strleq(key, keysize, C("replication_lag"))) {
+		lua_pushinteger(L, backend->replication_lag);
+	} else if (strleq(key, keysize, C("binlog_pos"))) {
+		guint64 binlog_pos;
+
+		network_backend_get_binlog_pos(backend, &binlog_pos, NULL);
+
+		lua_pushnumber(L, binlog_pos);
+	} else if (strleq(key, keysize, C("is_removed"))) {
+		lua_pushboolean(L, backend->is_removed);
+	} else if (strleq(key, keysize, C("group"))) {
+		if (backend->group) {
+			lua_pushstring(L, backend->group->name);
+		} else {
+			lua_pushnil(L);
+		}
+	} else if (strleq(key, keysize, C("pool_stats"))) {
+		network_connection_pool_stats_t stats;
+
+		network_backend_get_pool_stats(backend, &stats);
+
+		lua_newtable(L);
+		lua_pushinteger(L, stats.hits_session);
+		lua_setfield(L, -2, "hits_session");
+		lua_pushinteger(L, stats.hits_default_db);
+		lua_setfield(L, -2, "hits_default_db");
+		lua_pushinteger(L, stats.hits_user);
+		lua_setfield(L, -2, "hits_user");
+		lua_pushinteger(L, stats.hits_donor);
+		lua_setfield(L, -2, "hits_donor");
+		lua_pushinteger(L, stats.misses);
+		lua_setfield(L, -2, "misses");
 	} else {
 		lua_pushnil(L);
 	}
@@ -85,7 +178,7 @@ static int proxy_backend_set(lua_State *L) {
 	const char *key = luaL_checklstring(L, 2, &keysize);
 
 	if (strleq(key, keysize, C("state"))) {
-		backend->state = lua_tointeger(L, -1);
+		network_backend_set_state(backend, lua_tointeger(L, -1));
 	} else if (strleq(key, keysize, C("uuid"))) {
 		if (lua_isstring(L, -1)) {
 			size_t s_len = 0;
@@ -113,20 +206,246 @@ int network_backend_lua_getmetatable(lua_State *L) {
 	return proxy_getmetatable(L, methods);
 }
 
+/**
+ * the userdata of a group, picking a backend needs the backends too
+ */
+typedef struct {
+	network_backends_t *bs;
+	network_backend_group_t *group;
+} network_backend_group_lua_t;
+
+/**
+ * proxy.global.backends.groups["name"]:pick()
+ *
+ * @return the index of the backend the policy of the group picks, nil if none is up
+ * @see network_backends_get_from_group()
+ */
+static int proxy_backend_group_pick(lua_State *L) {
+	network_backend_group_lua_t *g = luaL_checkself(L);
+	int ndx = network_backends_get_from_group(g->bs, g->group);
+
+	if (ndx < 0) {
+		lua_pushnil(L);
+	} else {
+		lua_pushinteger(L, ndx + 1); /* lua indexes from 1 */
+	}
+
+	return 1;
+}
+
+/**
+ * get the info about a group
+ *
+ * proxy.global.backends.groups["name"].
+ *   name          => the name of the group
+ *   policy        => "least-connected", "least-latency" or "first"
+ *   backends      => the indexes of its backends into proxy.global.backends
+ *   max_queries   => queries in flight to the group, 0 for unlimited
+ *   pool_max_idle => max idle connections in the pools of its backends, 0 for the default
+ *   pool_min_idle => min idle connections in the pools of its backends, 0 for the default
+ *   max_lag       => the lag the health-check accepts of its backends, -1 for the global one
+ *   pick          => pick(self) returns the index of a backend by the policy, nil if none is up
+ */
+static int proxy_backend_group_get(lua_State *L) {
+	network_backend_group_lua_t *g = luaL_checkself(L);
+	network_backend_group_t *group = g->group;
+	gsize keysize = 0;
+	const char *key = luaL_checklstring(L, 2, &keysize);
+
+	if (strleq(key, keysize, C("name"))) {
+		lua_pushstring(L, group->name);
+	} else if (strleq(key, keysize, C("policy"))) {
+		lua_pushstring(L, network_backend_group_policy_get_name(group->policy));
+	} else if (strleq(key, keysize, C("backends"))) {
+		guint i;
+
+		lua_newtable(L);
+		for (i = 0; i < group->members->len; i++) {
+			lua_pushinteger(L, g_array_index(group->members, guint, i) + 1);
+			lua_rawseti(L, -2, i + 1);
+		}
+	} else if (strleq(key, keysize, C("max_queries"))) {
+		lua_pushinteger(L, group->max_queries);
+	} else if (strleq(key, keysize, C("pool_max_idle"))) {
+		lua_pushinteger(L, group->pool_max_idle);
+	} else if (strleq(key, keysize, C("pool_min_idle"))) {
+		lua_pushinteger(L, group->pool_min_idle);
+	} else if (strleq(key, keysize, C("max_lag"))) {
+		lua_pushinteger(L, group->max_lag);
+	} else if (strleq(key, keysize, C("pick"))) {
+		lua_pushcfunction(L, proxy_backend_group_pick);
+	} else {
+		lua_pushnil(L);
+	}
+
+	return 1;
+}
+
+static int network_backend_group_lua_getmetatable(lua_State *L) {
+	static const struct luaL_reg methods[] = {
+		{ "__index", proxy_backend_group_get },
+		{ NULL, NULL },
+	};
+
+	return proxy_getmetatable(L, methods);
+}
+
+/**
+ * get proxy.global.backends.groups[name]
+ *
+ * the lookup is a hash lookup in the current snapshot of the groups
+ *
+ * @return nil or the group
+ * @see proxy_backend_group_get
+ */
+static int proxy_backend_groups_get(lua_State *L) {
+	network_backends_t *bs = *(network_backends_t **)luaL_checkself(L);
+	const char *name = luaL_checkstring(L, 2);
+	network_backend_group_t *group;
+	network_backend_group_lua_t *g;
+
+	if (NULL == (group = network_backends_get_group(bs, name))) {
+		lua_pushnil(L);
+
+		return 1;
+	}
+
+	g = lua_newuserdata(L, sizeof(*g));
+	g->bs = bs;
+	g->group = group;
+
+	network_backend_group_lua_getmetatable(L);
+	lua_setmetatable(L, -2);
+
+	return 1;
+}
+
+static int network_backend_groups_lua_getmetatable(lua_State *L) {
+	static const struct luaL_reg methods[] = {
+		{ "__index", proxy_backend_groups_get },
+		{ NULL, NULL },
+	};
+
+	return proxy_getmetatable(L, methods);
+}
+
+/**
+ * proxy.global.backends:get_states()
+ *
+ * the balancers only look at a few fields of each backend, get them for all backends
+ * in one call instead of a __index call per field and backend
+ *
+ * @return a array of the states, a array of the connected_clients and a array of the types,
+ *         indexed like proxy.global.backends
+ */
+static int proxy_backends_get_states(lua_State *L) {
+	network_backends_t *bs = *(network_backends_t **)luaL_checkself(L);
+	GPtrArray *backends = network_backends_get_snapshot(bs);
+	guint i;
+
+	lua_createtable(L, backends->len, 0);
+	lua_createtable(L, backends->len, 0);
+	lua_createtable(L, backends->len, 0);
+
+	for (i = 0; i < backends->len; i++) {
+		network_backend_t *backend = backends->pdata[i];
+
+		lua_pushinteger(L, backend->state);
+		lua_rawseti(L, -4, i + 1);
+		lua_pushinteger(L, backend->connected_clients);
+		lua_rawseti(L, -3, i + 1);
+		lua_pushinteger(L, backend->type);
+		lua_rawseti(L, -2, i + 1);
+	}
+
+	return 3;
+}
+
+/**
+ * get the cache of the udata of the backends
+ *
+ * the cache is the env of proxy.global.backends and belongs to one snapshot of the
+ * backends: if a backend got added or the config got reloaded, it is replaced by an
+ * empty one.
+ *
+ * @return the cache on the stack (sp += 1)
+ */
+static void proxy_backends_get_cache(lua_State *L, network_backends_t *bs) {
+	GPtrArray *backends = network_backends_get_snapshot(bs);
+
+	lua_getfenv(L, 1);                                                        /* (sp += 1) */
+	lua_getfield(L, -1, "snapshot");                                          /* (sp += 1) */
+	if (lua_touserdata(L, -1) == backends) {
+		lua_pop(L, 1);                                                    /* (sp -= 1) */
+
+		return;
+	}
+	lua_pop(L, 2);                                                            /* (sp -= 2) */
+
+	lua_createtable(L, backends->len, 2);                                     /* (sp += 1) */
+	lua_pushlightuserdata(L, backends);
+	lua_setfield(L, -2, "snapshot");
+
+	lua_pushvalue(L, -1);                                                     /* (sp += 1) */
+	lua_setfenv(L, 1);                                                        /* (sp -= 1) */
+}
+
 /**
  * get proxy.global.backends[ndx]
  *
  * get the backend from the array of mysql backends.
  *
+ * proxy.global.backends.groups[name] gets a named group of them, 
+ * proxy.global.backends:get_states() the states of all of them.
+ *
+ * the udata of the backends are cached, a balancer that loops over the backends
+ * on each query doesn't create garbage
+ *
  * @return nil or the backend
- * @see proxy_backend_get
+ * @see proxy_backend_get, proxy_backends_get_cache
  */
 static int proxy_backends_get(lua_State *L) {
 	network_backend_t *backend; 
 	network_backend_t **backend_p;
 
 	network_backends_t *bs = *(network_backends_t **)luaL_checkself(L);
-	int backend_ndx = luaL_checkinteger(L, 2) - 1; /** lua is indexes from 1, C from 0 */
+	int backend_ndx;
+
+	if (lua_type(L, 2) == LUA_TSTRING) {
+		gsize keysize = 0;
+		const char *key = lua_tolstring(L, 2, &keysize);
+
+		if (strleq(key, keysize, C("groups"))) {
+			network_backends_t **bs_p;
+
+			proxy_backends_get_cache(L, bs);                          /* (sp += 1) */
+			lua_getfield(L, -1, "groups");                            /* (sp += 1) */
+			if (lua_isuserdata(L, -1)) {
+				lua_remove(L, -2);                                /* (sp -= 1) */
+
+				return 1;
+			}
+			lua_pop(L, 1);                                            /* (sp -= 1) */
+
+			bs_p = lua_newuserdata(L, sizeof(bs));                    /* (sp += 1) */
+			*bs_p = bs;
+
+			network_backend_groups_lua_getmetatable(L);
+			lua_setmetatable(L, -2);
+
+			lua_pushvalue(L, -1);                                     /* (sp += 1) */
+			lua_setfield(L, -3, "groups");                            /* (sp -= 1) */
+			lua_remove(L, -2);                                        /* (sp -= 1) */
+		} else if (strleq(key, keysize, C("get_states"))) {
+			lua_pushcfunction(L, proxy_backends_get_states);
+		} else {
+			lua_pushnil(L);
+		}
+
+		return 1;
+	}
+
+	backend_ndx = luaL_checkinteger(L, 2) - 1; /** lua is indexes from 1, C from 0 */
 	
 	/* check that we are in range for a _int_ */
 	if (NULL == (backend = network_backends_get(bs, backend_ndx))) {
@@ -135,12 +454,29 @@ static int proxy_backends_get(lua_State *L) {
 		return 1;
 	}
 
-	backend_p = lua_newuserdata(L, sizeof(backend)); /* the table underneath proxy.global.backends[ndx] */
+	proxy_backends_get_cache(L, bs);                                          /* (sp += 1) */
+	lua_rawgeti(L, -1, backend_ndx + 1);                                      /* (sp += 1) */
+	if (lua_isuserdata(L, -1) &&
+	    *(network_backend_t **)lua_touserdata(L, -1) == backend) {
+		lua_remove(L, -2);                                                /* (sp -= 1) */
+
+		return 1;
+	}
+	lua_pop(L, 1);                                                            /* (sp -= 1) */
+
+	backend_p = lua_newuserdata(L, sizeof(backend)); /* the table underneath proxy.global.backends[ndx] (sp += 1) */
 	*backend_p = backend;
 
 	network_backend_lua_getmetatable(L);
 	lua_setmetatable(L, -2);
 
+	lua_newtable(L);  /* caches the udata of .pool */
+	lua_setfenv(L, -2);
+
+	lua_pushvalue(L, -1);                                                     /* (sp += 1) */
+	lua_rawseti(L, -3, backend_ndx + 1); /* cache[ndx] = <udata>              (sp -= 1) */
+	lua_remove(L, -2);                                                        /* (sp -= 1) */
+
 	return 1;
 }
 
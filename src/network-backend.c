@@ -19,11 +19,16 @@
  $%ENDLICENSE%$ */
  
 #include <string.h>
+#include <sys/types.h>
+#include <sys/stat.h>
 
 #include <glib.h>
+#include <glib/gstdio.h>
 
 #include "network-backend.h"
 #include "chassis-plugin.h"
+#include "chassis-gtimeval.h"
+#include "chassis-timings.h"
 #include "glib-ext.h"
 
 #define C(x) x, sizeof(x) - 1
@@ -42,13 +47,274 @@ network_backend_t *network_backend_new() {
 
 	b = g_new0(network_backend_t, 1);
 
-	b->pool = network_connection_pool_new();
+	b->pools = g_ptr_array_new();
+	b->latencies = g_ptr_array_new();
+	network_backend_set_pool_shards(b, 1);
+	b->pool = b->pools->pdata[0];
 	b->uuid = g_string_new(NULL);
 	b->addr = network_address_new();
+	b->replication_lag = -1;
+	b->binlog_pos_mutex = g_mutex_new();
+	b->breaker_mutex = g_mutex_new();
+	b->resolved_mutex = g_mutex_new();
 
 	return b;
 }
 
+static void network_backend_resolved_free(GPtrArray *addrs) {
+	guint i;
+
+	if (!addrs) return;
+
+	for (i = 0; i < addrs->len; i++) {
+		network_address_free(addrs->pdata[i]);
+	}
+	g_ptr_array_free(addrs, TRUE);
+}
+
+/**
+ * the weight of a new sample in the latency EWMAs is 1/2^NETWORK_BACKEND_LATENCY_SHIFT
+ */
+#define NETWORK_BACKEND_LATENCY_SHIFT 3
+
+static void network_backend_ewma_add(gint *ewma, guint64 sample) {
+	gint old = g_atomic_int_get(ewma);
+	gint s = MIN(sample, G_MAXINT);
+
+	/* the first sample initializes the average
+	 *
+	 * event-threads may race here and lose a sample, that's fine for a average */
+	if (old == 0) {
+		g_atomic_int_set(ewma, MAX(s, 1));
+	} else {
+		g_atomic_int_set(ewma, MAX(old + ((s - old) >> NETWORK_BACKEND_LATENCY_SHIFT), 1));
+	}
+}
+
+/**
+ * add the timings of a query to the latency averages of the backend
+ *
+ * @param first_usec microseconds from sending the query to the first packet of the result
+ * @param total_usec microseconds from sending the query to the last packet of the result
+ */
+void network_backend_add_latency(network_backend_t *b, guint64 first_usec, guint64 total_usec) {
+	network_backend_ewma_add(&b->latency_first, first_usec);
+	network_backend_ewma_add(&b->latency_total, total_usec);
+}
+
+/**
+ * record a latency in the histograms of a event-thread
+ *
+ * only the event-thread itself writes to its histograms, they aren't locked
+ *
+ * @param ndx the index of the event-thread, see chassis_event_thread_get_local_index()
+ */
+void network_backend_record_latency(network_backend_t *b, guint ndx, network_backend_latency_t latency, guint64 usec) {
+	network_histogram_t *histograms;
+
+	histograms = b->latencies->pdata[ndx < b->latencies->len ? ndx : 0];
+
+	network_histogram_add(&(histograms[latency]), usec);
+}
+
+/**
+ * merge the histograms of all event-threads
+ *
+ * @param h the histogram to merge into, it is reset first
+ */
+void network_backend_get_latency(network_backend_t *b, network_backend_latency_t latency, network_histogram_t *h) {
+	guint i;
+
+	network_histogram_reset(h);
+
+	for (i = 0; i < b->latencies->len; i++) {
+		network_histogram_t *histograms = b->latencies->pdata[i];
+
+		network_histogram_merge(h, &(histograms[latency]));
+	}
+}
+
+const char *network_backend_latency_get_name(network_backend_latency_t latency) {
+	switch (latency) {
+	case NETWORK_BACKEND_LATENCY_CONNECT:    return "connect";
+	case NETWORK_BACKEND_LATENCY_FIRST_BYTE: return "first_byte";
+	case NETWORK_BACKEND_LATENCY_QUERY:      return "query";
+	case NETWORK_BACKEND_LATENCY_MAX:        break;
+	}
+
+	return "invalid";
+}
+
+/**
+ * open the breaker, the caller sets the backend DOWN
+ *
+ * @note the caller holds .breaker_mutex
+ */
+static void network_backend_breaker_trip(network_backend_t *b) {
+	network_backend_breaker_t *br = &(b->breaker);
+
+	br->state = NETWORK_BACKEND_BREAKER_OPEN;
+	br->trips++;
+	br->requests = 0;
+	br->failures = 0;
+}
+
+/**
+ * the backend is woken up, put it on probation
+ *
+ * @note the caller holds .breaker_mutex
+ */
+static void network_backend_breaker_half_open(network_backend_t *b) {
+	network_backend_breaker_t *br = &(b->breaker);
+
+	if (br->state != NETWORK_BACKEND_BREAKER_OPEN) return;
+
+	br->state = NETWORK_BACKEND_BREAKER_HALF_OPEN;
+	br->successes = 0;
+	g_atomic_int_set(&(br->picks), 0);
+}
+
+/**
+ * a request on the backend succeeded
+ *
+ * @note the caller holds .breaker_mutex
+ */
+static void network_backend_breaker_succeeded(network_backend_t *b, guint64 now_usec) {
+	network_backend_breaker_t *br = &(b->breaker);
+
+	if (br->state != NETWORK_BACKEND_BREAKER_HALF_OPEN) return;
+
+	if (++br->successes < NETWORK_BACKEND_BREAKER_CLOSE_AFTER) return;
+
+	br->state = NETWORK_BACKEND_BREAKER_CLOSED;
+	br->trips = 0;
+	br->window_start_usec = now_usec;
+	br->requests = 0;
+	br->failures = 0;
+}
+
+/**
+ * change the state of the backend
+ *
+ * a backend that goes DOWN opens its breaker, one that comes back is HALF_OPEN
+ *
+ * @return TRUE if the state changed
+ */
+gboolean network_backend_set_state(network_backend_t *b, backend_state_t state) {
+	if (b->state == state) return FALSE;
+
+	/* a removed backend stays DOWN until network_backends_reload() adds it again */
+	if (b->is_removed && state != BACKEND_STATE_DOWN) return FALSE;
+
+	g_mutex_lock(b->breaker_mutex);
+	if (state == BACKEND_STATE_DOWN) {
+		if (b->breaker.state != NETWORK_BACKEND_BREAKER_OPEN) network_backend_breaker_trip(b);
+	} else {
+		network_backend_breaker_half_open(b);
+	}
+	g_mutex_unlock(b->breaker_mutex);
+
+	b->state = state;
+	chassis_gtime_testset_now(&b->state_since, NULL);
+
+	return TRUE;
+}
+
+/**
+ * a connect to the backend failed or timed out
+ *
+ * opens the breaker: the backend is DOWN and skipped until network_backends_check()
+ * wakes it up again. If it fails again while it is HALF_OPEN, it stays down twice as long.
+ *
+ * @see network_backend_get_down_secs()
+ */
+void network_backend_connect_failed(network_backend_t *b) {
+	g_mutex_lock(b->breaker_mutex);
+	network_backend_breaker_trip(b);
+	g_mutex_unlock(b->breaker_mutex);
+
+	b->state = BACKEND_STATE_DOWN;
+	chassis_gtime_testset_now(&b->state_since, NULL);
+}
+
+/**
+ * a connect to the backend succeeded
+ *
+ * a connect doesn't tell us anything about the replication lag, a LAGGING backend stays LAGGING
+ */
+void network_backend_connect_succeeded(network_backend_t *b) {
+	if (b->breaker.state == NETWORK_BACKEND_BREAKER_HALF_OPEN) {
+		g_mutex_lock(b->breaker_mutex);
+		network_backend_breaker_succeeded(b, chassis_get_rel_microseconds());
+		g_mutex_unlock(b->breaker_mutex);
+	}
+
+	if (b->state != BACKEND_STATE_UP &&
+	    b->state != BACKEND_STATE_LAGGING &&
+	    !b->is_removed) {
+		b->state = BACKEND_STATE_UP;
+		chassis_gtime_testset_now(&b->state_since, NULL);
+	}
+}
+
+/**
+ * how long a DOWN backend is skipped before network_backends_check() tries it again
+ *
+ * @return NETWORK_BACKEND_DOWN_SECS doubled for each time the breaker opened since it
+ *         was closed, at most NETWORK_BACKEND_MAX_DOWN_SECS
+ */
+gint network_backend_get_down_secs(network_backend_t *b) {
+	guint trips = b->breaker.trips;
+	gint secs = NETWORK_BACKEND_DOWN_SECS;
+
+	while (trips-- > 1 && secs < NETWORK_BACKEND_MAX_DOWN_SECS) {
+		secs *= 2;
+	}
+
+	return MIN(secs, NETWORK_BACKEND_MAX_DOWN_SECS);
+}
+
+const char *network_backend_breaker_state_get_name(network_backend_breaker_state_t state) {
+	switch (state) {
+	case NETWORK_BACKEND_BREAKER_CLOSED:    return "closed";
+	case NETWORK_BACKEND_BREAKER_OPEN:      return "open";
+	case NETWORK_BACKEND_BREAKER_HALF_OPEN: return "half_open";
+	}
+
+	return "invalid";
+}
+
+/**
+ * set the binlog position the backend is at
+ *
+ * @param pos  see network_mysqld_proto_get_binlog_pos(), 0 if unknown
+ * @param usec when the position was asked for, in chassis_get_rel_microseconds()
+ */
+void network_backend_set_binlog_pos(network_backend_t *b, guint64 pos, guint64 usec) {
+	g_mutex_lock(b->binlog_pos_mutex);
+	b->binlog_pos = pos;
+	b->binlog_pos_usec = usec;
+	g_mutex_unlock(b->binlog_pos_mutex);
+}
+
+void network_backend_get_binlog_pos(network_backend_t *b, guint64 *pos, guint64 *usec) {
+	g_mutex_lock(b->binlog_pos_mutex);
+	if (pos) *pos = b->binlog_pos;
+	if (usec) *usec = b->binlog_pos_usec;
+	g_mutex_unlock(b->binlog_pos_mutex);
+}
+
+const char *network_backend_state_get_name(backend_state_t state) {
+	switch (state) {
+	case BACKEND_STATE_UNKNOWN: return "unknown";
+	case BACKEND_STATE_UP:      return "up";
+	case BACKEND_STATE_DOWN:    return "down";
+	case BACKEND_STATE_LAGGING: return "lagging";
+	}
+
+	return "invalid";
+}
+
 /**
  * @deprecated: will be removed in 1.0
  * @see network_backend_free()
@@ -58,155 +324,1583 @@ void backend_free(network_backend_t *b) {
 }
 
 void network_backend_free(network_backend_t *b) {
+	guint i;
+
 	if (!b) return;
 
-	network_connection_pool_free(b->pool);
+	for (i = 0; i < b->pools->len; i++) {
+		network_connection_pool_free(b->pools->pdata[i]);
+	}
+	g_ptr_array_free(b->pools, TRUE);
+
+	for (i = 0; i < b->latencies->len; i++) {
+		g_free(b->latencies->pdata[i]);
+	}
+	g_ptr_array_free(b->latencies, TRUE);
 
 	if (b->addr)     network_address_free(b->addr);
 	if (b->uuid)     g_string_free(b->uuid, TRUE);
+	if (b->hostname) g_free(b->hostname);
+	network_backend_resolved_free(b->resolved);
+	if (b->local_addr) network_address_free(b->local_addr);
+	network_backend_resolved_free(b->source_addrs);
+
+	g_mutex_free(b->binlog_pos_mutex);
+	g_mutex_free(b->breaker_mutex);
+	g_mutex_free(b->resolved_mutex);
 
 	g_free(b);
 }
 
-network_backends_t *network_backends_new() {
-	network_backends_t *bs;
+/**
+ * get the address the next connection to the backend goes to
+ *
+ * a backend on this host goes through its unix-socket, see network_backend_set_local_socket().
+ * A backend with a host-name takes turns over all its records. The connections that
+ * are open already stay where they are until they are closed.
+ */
+void network_backend_get_address(network_backend_t *b, network_address *dst) {
+	if (NULL == b->hostname && NULL == b->local_addr) {
+		network_address_copy(dst, b->addr);
 
-	bs = g_new0(network_backends_t, 1);
+		return;
+	}
 
-	bs->backends = g_ptr_array_new();
-	bs->backends_mutex = g_mutex_new();
+	g_mutex_lock(b->resolved_mutex);
+	if (NULL != b->local_addr) {
+		network_address_copy(dst, b->local_addr);
+	} else if (NULL == b->hostname || NULL == b->resolved || 0 == b->resolved->len) {
+		network_address_copy(dst, b->addr);
+	} else {
+		network_address_copy(dst, b->resolved->pdata[b->resolved_next++ % b->resolved->len]);
+	}
+	g_mutex_unlock(b->resolved_mutex);
+}
 
-	return bs;
+/**
+ * connect to the backend through a unix-socket instead of its TCP address
+ *
+ * the connections that are open already stay on TCP until they are closed
+ *
+ * @param path the unix-socket of the backend, NULL to connect to its TCP address again
+ * @return 0 on success, -1 if the path isn't a valid unix-socket address
+ */
+int network_backend_set_local_socket(network_backend_t *b, const gchar *path) {
+	network_address *local_addr = NULL;
+	network_address *old_addr;
+
+	if (NULL != path) {
+		local_addr = network_address_new();
+
+		if (0 != network_address_set_address(local_addr, path)) {
+			network_address_free(local_addr);
+
+			return -1;
+		}
+	}
+
+	g_mutex_lock(b->resolved_mutex);
+	old_addr = b->local_addr;
+	b->local_addr = local_addr;
+	g_mutex_unlock(b->resolved_mutex);
+
+	if (old_addr) network_address_free(old_addr);
+
+	return 0;
 }
 
-void network_backends_free(network_backends_t *bs) {
-	gsize i;
+/**
+ * a connect to the unix-socket of the backend failed, go back to TCP
+ *
+ * @param addr the address the connect failed on
+ * @return TRUE if the next connection goes to the TCP address, FALSE if it wasn't the unix-socket that failed
+ */
+gboolean network_backend_local_socket_failed(network_backend_t *b, network_address *addr) {
+	network_address *old_addr = NULL;
 
-	if (!bs) return;
+	if (NULL == b->local_addr) return FALSE;
 
-	g_mutex_lock(bs->backends_mutex);
-	for (i = 0; i < bs->backends->len; i++) {
-		network_backend_t *backend = bs->backends->pdata[i];
-		
-		network_backend_free(backend);
+	g_mutex_lock(b->resolved_mutex);
+	if (NULL != b->local_addr && strleq(S(b->local_addr->name), S(addr->name))) {
+		old_addr = b->local_addr;
+		b->local_addr = NULL;
 	}
-	g_mutex_unlock(bs->backends_mutex);
+	g_mutex_unlock(b->resolved_mutex);
 
-	g_ptr_array_free(bs->backends, TRUE);
-	g_mutex_free(bs->backends_mutex);
+	if (NULL == old_addr) return FALSE;
 
-	g_free(bs);
+	g_message("%s: connecting to backend %s through %s failed, using TCP from now on",
+			G_STRLOC,
+			b->addr->name->str,
+			old_addr->name->str);
+
+	network_address_free(old_addr);
+
+	return TRUE;
 }
 
-/*
- * FIXME: 1) remove _set_address, make this function callable with result of same
- *        2) differentiate between reasons for "we didn't add" (now -1 in all cases)
+/**
+ * parse a list of source IPs like "10.0.0.5,10.0.0.6,fd00::5"
+ *
+ * @return the network_address of each IP with port 0, NULL if one isn't an IP
  */
-int network_backends_add(network_backends_t *bs, /* const */ gchar *address, backend_type_t type) {
-	network_backend_t *new_backend;
+static GPtrArray *network_backend_source_addrs_new(const gchar *addresses) {
+	GPtrArray *addrs = g_ptr_array_new();
+	gchar **ips = g_strsplit(addresses, ",", -1);
 	guint i;
 
-	new_backend = network_backend_new();
-	new_backend->type = type;
+	for (i = 0; ips[i]; i++) {
+		network_address *addr;
+		gchar *address;
 
-	if (0 != network_address_set_address(new_backend->addr, address)) {
-		network_backend_free(new_backend);
-		return -1;
-	}
+		g_strstrip(ips[i]);
+		if (ips[i][0] == '\0') continue;
 
-	/* check if this backend is already known */
-	g_mutex_lock(bs->backends_mutex);
-	for (i = 0; i < bs->backends->len; i++) {
-		network_backend_t *old_backend = bs->backends->pdata[i];
+		/* the kernel picks the port, see IP_BIND_ADDRESS_NO_PORT in network_socket_connect() */
+		if (ips[i][0] == '[' || NULL == strchr(ips[i], ':')) {
+			address = g_strdup_printf("%s:0", ips[i]);
+		} else {
+			address = g_strdup_printf("[%s]:0", ips[i]);
+		}
 
-		if (strleq(S(old_backend->addr->name), S(new_backend->addr->name))) {
-			network_backend_free(new_backend);
+		addr = network_address_new();
+		if (network_address_is_hostname(address) ||
+		    0 != network_address_set_address(addr, address) ||
+		    (addr->addr.common.sa_family != AF_INET && addr->addr.common.sa_family != AF_INET6)) {
+			network_address_free(addr);
+			g_free(address);
+			network_backend_resolved_free(addrs);
+			g_strfreev(ips);
 
-			g_mutex_unlock(bs->backends_mutex);
-			g_critical("backend %s is already known!", address);
-			return -1;
+			return NULL;
 		}
+		g_free(address);
+
+		g_ptr_array_add(addrs, addr);
 	}
+	g_strfreev(ips);
 
+	if (0 == addrs->len) {
+		network_backend_resolved_free(addrs);
 
-	g_ptr_array_add(bs->backends, new_backend);
-	g_mutex_unlock(bs->backends_mutex);
+		return NULL;
+	}
 
-	g_message("added %s backend: %s", (type == BACKEND_TYPE_RW) ?
-			"read/write" : "read-only", address);
+	return addrs;
+}
+
+static void network_backend_replace_source_addrs(network_backend_t *b, GPtrArray *addrs) {
+	GPtrArray *old_addrs;
+
+	g_mutex_lock(b->resolved_mutex);
+	old_addrs = b->source_addrs;
+	b->source_addrs = addrs;
+	b->source_next = 0;
+	g_mutex_unlock(b->resolved_mutex);
+
+	network_backend_resolved_free(old_addrs);
+}
+
+/**
+ * bind the new connections to the backend to one of the source addresses
+ *
+ * each source address has its own range of ephemeral ports, a backend that takes
+ * more connects than one address has ports for gets several of them
+ *
+ * @param addresses the IPs, comma-separated, NULL to let the kernel pick the source address again
+ * @return 0 on success, -1 if one of the addresses isn't an IP
+ */
+int network_backend_set_source_addresses(network_backend_t *b, const gchar *addresses) {
+	GPtrArray *addrs = NULL;
+
+	if (NULL != addresses && NULL == (addrs = network_backend_source_addrs_new(addresses))) {
+		return -1;
+	}
+
+	network_backend_replace_source_addrs(b, addrs);
+	b->has_own_source_addrs = (NULL != addrs);
 
 	return 0;
 }
 
 /**
- * updated the _DOWN state to _UNKNOWN if the backends were
- * down for at least 4 seconds
+ * get the address the next connection to the backend is bound to
  *
- * we only check once a second to reduce the overhead on connection setup
+ * takes turns over the source addresses of the family of dst
  *
- * @returns   number of updated backends
+ * @param dst the address the connection goes to, see network_backend_get_address()
+ * @param src set to the source address
+ * @return TRUE if src is set, FALSE if the kernel picks the source address
  */
-int network_backends_check(network_backends_t *bs) {
-	GTimeVal now;
+gboolean network_backend_get_source_address(network_backend_t *b, network_address *dst, network_address *src) {
+	gboolean is_found = FALSE;
 	guint i;
-	int backends_woken_up = 0;
-	gint64	t_diff;
 
-	g_get_current_time(&now);
-	ge_gtimeval_diff(&bs->backend_last_check, &now, &t_diff);
+	if (NULL == b->source_addrs) return FALSE;
 
-	/* check max(once a second) */
-	/* this also covers the "time went backards" case */
-	if (t_diff < G_USEC_PER_SEC) {
-		if (t_diff < 0) {
-			g_message("%s: time went backwards (%"G_GINT64_FORMAT" usec)!",
-				G_STRLOC, t_diff);
-			bs->backend_last_check.tv_usec = 0;
-			bs->backend_last_check.tv_sec = 0;
+	g_mutex_lock(b->resolved_mutex);
+	for (i = 0; NULL != b->source_addrs && i < b->source_addrs->len; i++) {
+		network_address *addr = b->source_addrs->pdata[b->source_next++ % b->source_addrs->len];
+
+		if (addr->addr.common.sa_family == dst->addr.common.sa_family) {
+			network_address_copy(src, addr);
+			is_found = TRUE;
+			break;
 		}
-		return 0;
 	}
-	
-	/* check once a second if we have to wakeup a connection */
-	g_mutex_lock(bs->backends_mutex);
+	g_mutex_unlock(b->resolved_mutex);
 
-	bs->backend_last_check = now;
+	return is_found;
+}
 
-	for (i = 0; i < bs->backends->len; i++) {
-		network_backend_t *cur = bs->backends->pdata[i];
+/**
+ * replace the addresses of the host-name of a backend
+ *
+ * .addr and its name stay the same, the backend is still known under them
+ *
+ * @param addrs the network_address of the records, taken over
+ * @return TRUE if the addresses changed
+ */
+gboolean network_backend_set_resolved(network_backend_t *b, GPtrArray *addrs) {
+	GPtrArray *old_addrs;
+	gboolean is_changed;
+	guint i, j;
 
-		if (cur->state != BACKEND_STATE_DOWN) continue;
+	g_mutex_lock(b->resolved_mutex);
+	old_addrs = b->resolved;
+	b->resolved = addrs;
+	g_mutex_unlock(b->resolved_mutex);
 
-		/* check if a backend is marked as down for more than 4 sec */
-		if (now.tv_sec - cur->state_since.tv_sec > 4) {
-			g_debug("%s.%d: backend %s was down for more than 4 sec, waking it up", 
-					__FILE__, __LINE__,
-					cur->addr->name->str);
+	is_changed = (NULL == old_addrs || old_addrs->len != addrs->len);
+	for (i = 0; !is_changed && i < addrs->len; i++) {
+		network_address *addr = addrs->pdata[i];
 
-			cur->state = BACKEND_STATE_UNKNOWN;
-			cur->state_since = now;
-			backends_woken_up++;
+		for (j = 0; j < old_addrs->len; j++) {
+			network_address *old_addr = old_addrs->pdata[j];
+
+			if (strleq(S(addr->name), S(old_addr->name))) break;
 		}
+		if (j == old_addrs->len) is_changed = TRUE;
 	}
-	g_mutex_unlock(bs->backends_mutex);
 
-	return backends_woken_up;
+	network_backend_resolved_free(old_addrs);
+
+	return is_changed;
 }
 
-network_backend_t *network_backends_get(network_backends_t *bs, guint ndx) {
-	if (ndx >= network_backends_count(bs)) return NULL;
+GQuark network_backends_error(void) {
+	return g_quark_from_static_string("network-backends-error-quark");
+}
+
+network_backend_group_t *network_backend_group_new(const gchar *name) {
+	network_backend_group_t *group;
+
+	group = g_new0(network_backend_group_t, 1);
+	group->name = g_strdup(name);
+	group->policy = NETWORK_BACKEND_GROUP_POLICY_LEAST_CONNECTED;
+	group->members = g_array_new(FALSE, FALSE, sizeof(guint));
+	group->max_lag = -1;
 
-	/* FIXME: shouldn't we copy the backend or add ref-counting ? */	
-	return bs->backends->pdata[ndx];
+	return group;
 }
 
-guint network_backends_count(network_backends_t *bs) {
-	guint len;
+void network_backend_group_free(network_backend_group_t *group) {
+	if (!group) return;
 
-	g_mutex_lock(bs->backends_mutex);
-	len = bs->backends->len;
-	g_mutex_unlock(bs->backends_mutex);
+	g_array_free(group->members, TRUE);
+	g_free(group->name);
+
+	g_free(group);
+}
 
-	return len;
+const char *network_backend_group_policy_get_name(network_backend_group_policy_t policy) {
+	switch (policy) {
+	case NETWORK_BACKEND_GROUP_POLICY_LEAST_CONNECTED: return "least-connected";
+	case NETWORK_BACKEND_GROUP_POLICY_LEAST_LATENCY: return "least-latency";
+	case NETWORK_BACKEND_GROUP_POLICY_FIRST: return "first";
+	}
+
+	return "unknown";
+}
+
+/**
+ * apply the idle-connection limits of a group to a pool of one of its members
+ *
+ * @param group the group of the backend, may be NULL
+ */
+static void network_backend_group_apply_pool_limits(network_backend_group_t *group, network_connection_pool *pool) {
+	if (!group) return;
+
+	if (group->pool_max_idle > 0) pool->max_idle_connections = group->pool_max_idle;
+	if (group->pool_min_idle > 0) pool->min_idle_connections = group->pool_min_idle;
 }
 
+/**
+ * make sure the backend has a connection pool and latency histograms for each event-thread
+ *
+ * has to be called before the event-threads use the backend as 
+ * network_backend_get_pool() doesn't lock
+ */
+void network_backend_set_pool_shards(network_backend_t *b, guint shards) {
+	while (b->pools->len < shards) {
+		network_connection_pool *pool = network_connection_pool_new();
+
+		network_backend_group_apply_pool_limits(b->group, pool);
+		g_ptr_array_add(b->pools, pool);
+	}
+
+	while (b->latencies->len < shards) {
+		g_ptr_array_add(b->latencies, g_new0(network_histogram_t, NETWORK_BACKEND_LATENCY_MAX));
+	}
+}
+
+/**
+ * get the connection pool of a event-thread
+ *
+ * each event-thread has its own pool as the idling connections have their 
+ * events registered in the event-base of the thread that added them. As only 
+ * the owning thread touches it, the pool needs no locking.
+ *
+ * @param ndx the index of the event-thread, see chassis_event_thread_get_local_index()
+ * @return the pool of the event-thread, the main-thread's pool if we have no pool for it
+ */
+network_connection_pool *network_backend_get_pool(network_backend_t *b, guint ndx) {
+	if (ndx < b->pools->len) {
+		return b->pools->pdata[ndx];
+	}
+
+	return b->pool;
+}
+
+/**
+ * sum up the pool stats of all event-threads
+ *
+ * the counters are read without locking, they are only a snapshot
+ */
+void network_backend_get_pool_stats(network_backend_t *b, network_connection_pool_stats_t *stats) {
+	guint i;
+
+	memset(stats, 0, sizeof(*stats));
+
+	for (i = 0; i < b->pools->len; i++) {
+		network_connection_pool *pool = b->pools->pdata[i];
+
+		stats->hits_session    += pool->stats.hits_session;
+		stats->hits_default_db += pool->stats.hits_default_db;
+		stats->hits_user       += pool->stats.hits_user;
+		stats->hits_donor      += pool->stats.hits_donor;
+		stats->misses          += pool->stats.misses;
+	}
+}
+
+network_backends_t *network_backends_new() {
+	network_backends_t *bs;
+
+	bs = g_new0(network_backends_t, 1);
+
+	bs->backends = g_ptr_array_new();
+	bs->backends_mutex = g_mutex_new();
+	chassis_lock_stats_init(&bs->backends_mutex_stats, "backends");
+	bs->retired = g_ptr_array_new();
+	bs->groups = g_hash_table_new(g_str_hash, g_str_equal);
+	bs->retired_groups = g_ptr_array_new();
+	bs->pool_shards = 1;
+	bs->breaker_half_open_share = 10;
+
+	return bs;
+}
+
+void network_backends_free(network_backends_t *bs) {
+	GHashTableIter iter;
+	gpointer value;
+	gsize i;
+
+	if (!bs) return;
+
+	chassis_lock_stats_mutex_lock(bs->backends_mutex, &bs->backends_mutex_stats);
+	for (i = 0; i < bs->backends->len; i++) {
+		network_backend_t *backend = bs->backends->pdata[i];
+		
+		network_backend_free(backend);
+	}
+	chassis_lock_stats_mutex_unlock(bs->backends_mutex, &bs->backends_mutex_stats);
+
+	for (i = 0; i < bs->retired->len; i++) {
+		g_ptr_array_free(bs->retired->pdata[i], TRUE);
+	}
+	g_ptr_array_free(bs->retired, TRUE);
+
+	/* the retired snapshots of the groups share the groups with the current one */
+	g_hash_table_iter_init(&iter, bs->groups);
+	while (g_hash_table_iter_next(&iter, NULL, &value)) {
+		network_backend_group_free(value);
+	}
+	g_hash_table_destroy(bs->groups);
+
+	for (i = 0; i < bs->retired_groups->len; i++) {
+		g_hash_table_destroy(bs->retired_groups->pdata[i]);
+	}
+	g_ptr_array_free(bs->retired_groups, TRUE);
+
+	g_ptr_array_free(bs->backends, TRUE);
+	chassis_lock_stats_unregister(&bs->backends_mutex_stats);
+	g_mutex_free(bs->backends_mutex);
+
+	if (bs->local_socket) g_free(bs->local_socket);
+	if (bs->source_addresses) g_free(bs->source_addresses);
+
+	g_free(bs);
+}
+
+/**
+ * get the current list of backends without locking
+ *
+ * the array must not be changed. It stays valid until the backends are freed,
+ * even if backends get added in the meantime.
+ */
+GPtrArray *network_backends_get_snapshot(network_backends_t *bs) {
+	return g_atomic_pointer_get((gpointer *)&bs->backends);
+}
+
+/**
+ * publish a new list of backends
+ *
+ * @note has to be called with the backends_mutex held
+ */
+static void network_backends_publish(network_backends_t *bs, GPtrArray *backends) {
+	GPtrArray *old_backends = bs->backends;
+
+	g_atomic_pointer_set((gpointer *)&bs->backends, backends);
+
+	/* readers may still look at the old one */
+	g_ptr_array_add(bs->retired, old_backends);
+}
+
+/**
+ * the unix-sockets a mysqld listens on by default, by distribution
+ */
+static const gchar *network_backends_local_sockets[] = {
+	"/var/run/mysqld/mysqld.sock",  /* debian, ubuntu */
+	"/run/mysqld/mysqld.sock",
+	"/var/lib/mysql/mysql.sock",    /* red hat, suse */
+	"/tmp/mysql.sock",              /* the compiled-in default */
+	NULL
+};
+
+/**
+ * look for the unix-socket of a mysqld on this host
+ *
+ * @return the first of the default paths that is a socket, NULL if none is
+ */
+const gchar *network_backends_find_local_socket(void) {
+#ifndef WIN32
+	guint i;
+
+	for (i = 0; network_backends_local_sockets[i]; i++) {
+		struct stat st;
+
+		if (0 == g_stat(network_backends_local_sockets[i], &st) && S_ISSOCK(st.st_mode)) {
+			return network_backends_local_sockets[i];
+		}
+	}
+#endif
+
+	return NULL;
+}
+
+/**
+ * let a backend on this host use the unix-socket
+ *
+ * a socket that was found instead of configured only stands in for a mysqld on the default
+ * port, we can't tell on which port the mysqld behind it listens
+ */
+static void network_backends_use_local_socket(network_backends_t *bs, network_backend_t *b) {
+	const gchar *path = bs->local_socket;
+	guint port;
+
+	switch (b->addr->addr.common.sa_family) {
+	case AF_INET:
+		port = ntohs(b->addr->addr.ipv4.sin_port);
+		break;
+	case AF_INET6:
+		port = ntohs(b->addr->addr.ipv6.sin6_port);
+		break;
+	default:
+		/* a unix-socket already */
+		return;
+	}
+
+	if (!network_address_is_on_host(b->addr)) return;
+
+	if (NULL == path) {
+		if (port != 3306) return;
+
+		if (NULL == (path = network_backends_find_local_socket())) return;
+	}
+
+	if (0 != network_backend_set_local_socket(b, path)) return;
+
+	g_message("%s: connecting to the backend %s on this host through %s",
+			G_STRLOC,
+			b->addr->name->str,
+			path);
+}
+
+/*
+ * FIXME: 1) remove _set_address, make this function callable with result of same
+ *        2) differentiate between reasons for "we didn't add" (now -1 in all cases)
+ */
+int network_backends_add(network_backends_t *bs, /* const */ gchar *address, backend_type_t type) {
+	network_backend_t *new_backend;
+	GPtrArray *backends;
+	guint i;
+
+	new_backend = network_backend_new();
+	new_backend->type = type;
+	network_backend_set_pool_shards(new_backend, bs->pool_shards);
+
+	if (0 != network_address_set_address(new_backend->addr, address)) {
+		network_backend_free(new_backend);
+		return -1;
+	}
+
+	/* new connections follow the records of a host-name, see network_backend_get_address() */
+	if (network_address_is_hostname(address)) {
+		GPtrArray *addrs = g_ptr_array_new();
+
+		new_backend->hostname = g_strdup(address);
+		if (0 == network_address_resolve(address, addrs)) {
+			network_backend_set_resolved(new_backend, addrs);
+		} else {
+			network_backend_resolved_free(addrs);
+		}
+	}
+
+	if (bs->use_local_sockets) network_backends_use_local_socket(bs, new_backend);
+	if (bs->source_addresses) {
+		/* parsed by network_backends_set_source_addresses() already */
+		network_backend_replace_source_addrs(new_backend, network_backend_source_addrs_new(bs->source_addresses));
+	}
+
+	/* check if this backend is already known */
+	chassis_lock_stats_mutex_lock(bs->backends_mutex, &bs->backends_mutex_stats);
+	for (i = 0; i < bs->backends->len; i++) {
+		network_backend_t *old_backend = bs->backends->pdata[i];
+
+		if (strleq(S(old_backend->addr->name), S(new_backend->addr->name))) {
+			network_backend_free(new_backend);
+
+			chassis_lock_stats_mutex_unlock(bs->backends_mutex, &bs->backends_mutex_stats);
+			g_critical("backend %s is already known!", address);
+			return -1;
+		}
+	}
+
+	backends = g_ptr_array_sized_new(bs->backends->len + 1);
+	for (i = 0; i < bs->backends->len; i++) {
+		g_ptr_array_add(backends, bs->backends->pdata[i]);
+	}
+	g_ptr_array_add(backends, new_backend);
+
+	network_backends_publish(bs, backends);
+	chassis_lock_stats_mutex_unlock(bs->backends_mutex, &bs->backends_mutex_stats);
+
+	g_message("added %s backend: %s", (type == BACKEND_TYPE_RW) ?
+			"read/write" : "read-only", address);
+
+	return 0;
+}
+
+typedef struct {
+	network_address *addr;
+	const gchar *address;    /**< as configured */
+	backend_type_t type;
+	gboolean is_known;
+} network_backends_reload_entry_t;
+
+/**
+ * a backend with a host-name is known under it, its addresses may change
+ */
+static gboolean network_backends_reload_entry_is(network_backends_reload_entry_t *entry, network_backend_t *b) {
+	if (b->hostname) return (0 == strcmp(b->hostname, entry->address));
+
+	return strleq(S(b->addr->name), S(entry->addr->name));
+}
+
+static int network_backends_reload_add_entries(GPtrArray *entries, gchar **addresses, backend_type_t type) {
+	guint i, j;
+
+	for (i = 0; addresses && addresses[i]; i++) {
+		network_backends_reload_entry_t *entry;
+		gboolean is_dup = FALSE;
+
+		entry = g_new0(network_backends_reload_entry_t, 1);
+		entry->addr = network_address_new();
+		entry->address = addresses[i];
+		entry->type = type;
+
+		if (0 != network_address_set_address(entry->addr, addresses[i])) {
+			g_critical("%s: can't parse backend address %s", G_STRLOC, addresses[i]);
+			network_address_free(entry->addr);
+			g_free(entry);
+			return -1;
+		}
+
+		for (j = 0; j < entries->len; j++) {
+			network_backends_reload_entry_t *other = entries->pdata[j];
+
+			if (strleq(S(other->addr->name), S(entry->addr->name))) {
+				is_dup = TRUE;
+				break;
+			}
+		}
+
+		if (is_dup) {
+			g_warning("%s: backend %s is listed twice, ignoring it the second time", G_STRLOC, addresses[i]);
+			network_address_free(entry->addr);
+			g_free(entry);
+			continue;
+		}
+
+		g_ptr_array_add(entries, entry);
+	}
+
+	return 0;
+}
+
+/**
+ * apply a new list of backends
+ *
+ * the backends are compared by address:
+ *
+ * - new ones are added
+ * - unchanged ones keep their state and connection pools, only their type may change
+ * - the ones that are gone are marked ->is_removed and set DOWN: new connections
+ *   don't use them, open connections finish and their pooled connections get closed
+ * - removed ones that come back are UNKNOWN again
+ *
+ * @return the number of backends that changed, -1 if an address doesn't parse
+ */
+int network_backends_reload(network_backends_t *bs, gchar **rw_addresses, gchar **ro_addresses) {
+	GPtrArray *entries;
+	GPtrArray *backends;
+	int changed = 0;
+	guint i, j;
+
+	entries = g_ptr_array_new();
+
+	if (0 != network_backends_reload_add_entries(entries, rw_addresses, BACKEND_TYPE_RW) ||
+	    0 != network_backends_reload_add_entries(entries, ro_addresses, BACKEND_TYPE_RO)) {
+		changed = -1;
+		goto out;
+	}
+
+	chassis_lock_stats_mutex_lock(bs->backends_mutex, &bs->backends_mutex_stats);
+	backends = bs->backends;
+	for (i = 0; i < backends->len; i++) {
+		network_backend_t *cur = backends->pdata[i];
+		network_backends_reload_entry_t *entry = NULL;
+
+		for (j = 0; j < entries->len; j++) {
+			network_backends_reload_entry_t *e = entries->pdata[j];
+
+			if (network_backends_reload_entry_is(e, cur)) {
+				entry = e;
+				break;
+			}
+		}
+
+		if (NULL == entry) {
+			if (cur->is_removed) continue;
+
+			network_backend_set_state(cur, BACKEND_STATE_DOWN);
+			cur->is_removed = TRUE;
+			changed++;
+
+			g_message("removed backend %s, its open connections finish", cur->addr->name->str);
+			continue;
+		}
+
+		entry->is_known = TRUE;
+
+		if (cur->is_removed) {
+			cur->type = entry->type;
+			cur->is_removed = FALSE;
+			network_backend_set_state(cur, BACKEND_STATE_UNKNOWN);
+			changed++;
+
+			g_message("re-added %s backend: %s", (cur->type == BACKEND_TYPE_RW) ?
+					"read/write" : "read-only", cur->addr->name->str);
+		} else if (cur->type != entry->type) {
+			cur->type = entry->type;
+			changed++;
+
+			g_message("changed backend %s to %s", cur->addr->name->str,
+					(cur->type == BACKEND_TYPE_RW) ? "read/write" : "read-only");
+		}
+	}
+	chassis_lock_stats_mutex_unlock(bs->backends_mutex, &bs->backends_mutex_stats);
+
+	for (j = 0; j < entries->len; j++) {
+		network_backends_reload_entry_t *e = entries->pdata[j];
+
+		if (e->is_known) continue;
+
+		if (0 == network_backends_add(bs, (gchar *)e->address, e->type)) changed++;
+	}
+
+out:
+	for (j = 0; j < entries->len; j++) {
+		network_backends_reload_entry_t *e = entries->pdata[j];
+
+		network_address_free(e->addr);
+		g_free(e);
+	}
+	g_ptr_array_free(entries, TRUE);
+
+	return changed;
+}
+
+/**
+ * updated the _DOWN state to _UNKNOWN if the backends were
+ * down for at least 4 seconds, longer if their connects keep failing
+ *
+ * we only check once a second to reduce the overhead on connection setup
+ *
+ * @returns   number of updated backends
+ */
+int network_backends_check(network_backends_t *bs) {
+	GPtrArray *backends;
+	GTimeVal now;
+	guint i;
+	int backends_woken_up = 0;
+	gint64	t_diff;
+
+	chassis_get_coarse_current_time(&now);
+	ge_gtimeval_diff(&bs->backend_last_check, &now, &t_diff);
+
+	/* check max(once a second) */
+	/* this also covers the "time went backards" case */
+	if (t_diff < G_USEC_PER_SEC) {
+		if (t_diff < 0) {
+			g_message("%s: time went backwards (%"G_GINT64_FORMAT" usec)!",
+				G_STRLOC, t_diff);
+			bs->backend_last_check.tv_usec = 0;
+			bs->backend_last_check.tv_sec = 0;
+		}
+		return 0;
+	}
+
+	/* the health-checker brings them back */
+	if (bs->is_health_checked) return 0;
+	
+	/* check once a second if we have to wakeup a connection
+	 *
+	 * if another thread is already checking (or adding a backend) there is nothing left to do */
+	if (!g_mutex_trylock(bs->backends_mutex)) return 0;
+
+	bs->backend_last_check = now;
+
+	backends = network_backends_get_snapshot(bs);
+	for (i = 0; i < backends->len; i++) {
+		network_backend_t *cur = backends->pdata[i];
+
+		if (cur->state != BACKEND_STATE_DOWN || cur->is_removed) continue;
+
+		/* check if a backend is marked as down for longer than it has to wait */
+		if (now.tv_sec - cur->state_since.tv_sec > network_backend_get_down_secs(cur)) {
+			g_debug("%s.%d: backend %s was down for more than %d sec, waking it up", 
+					__FILE__, __LINE__,
+					cur->addr->name->str,
+					network_backend_get_down_secs(cur));
+
+			g_mutex_lock(cur->breaker_mutex);
+			network_backend_breaker_half_open(cur);
+			g_mutex_unlock(cur->breaker_mutex);
+
+			cur->state = BACKEND_STATE_UNKNOWN;
+			cur->state_since = now;
+			backends_woken_up++;
+		}
+	}
+	g_mutex_unlock(bs->backends_mutex);
+
+	return backends_woken_up;
+}
+
+network_backend_t *network_backends_get(network_backends_t *bs, guint ndx) {
+	GPtrArray *backends = network_backends_get_snapshot(bs);
+
+	if (ndx >= backends->len) return NULL;
+
+	/* backends are only freed with the network_backends_t */
+	return backends->pdata[ndx];
+}
+
+guint network_backends_count(network_backends_t *bs) {
+	return network_backends_get_snapshot(bs)->len;
+}
+
+/**
+ * check if a backend takes part in this pick
+ *
+ * a HALF_OPEN backend only takes part in .breaker_half_open_share percent of the picks,
+ * evenly spread. The others have their full share.
+ */
+gboolean network_backends_breaker_admit(network_backends_t *bs, network_backend_t *b) {
+	guint64 picks;
+
+	if (b->breaker.state != NETWORK_BACKEND_BREAKER_HALF_OPEN) return TRUE;
+
+	picks = (guint)g_atomic_int_exchange_and_add(&(b->breaker.picks), 1);
+
+	/* admit the picks where the share crosses a integer */
+	return (picks + 1) * bs->breaker_half_open_share / 100 != picks * bs->breaker_half_open_share / 100;
+}
+
+/**
+ * record the outcome of a query on the backend
+ *
+ * the breaker opens if .breaker_error_rate percent of the requests in the last
+ * NETWORK_BACKEND_BREAKER_WINDOW_USEC failed, or on the first failure while it is
+ * HALF_OPEN. A HALF_OPEN backend closes after NETWORK_BACKEND_BREAKER_CLOSE_AFTER
+ * successes.
+ *
+ * @param is_failed  the query failed on the backend, like a query that got killed as it timed out
+ * @param usec       how long the query took, slower than .breaker_slow_usec is a failure too
+ */
+void network_backends_breaker_record(network_backends_t *bs, network_backend_t *b, gboolean is_failed, guint64 usec, guint64 now_usec) {
+	network_backend_breaker_t *br = &(b->breaker);
+	gboolean is_tripped = FALSE;
+
+	if (bs->breaker_slow_usec > 0 && usec > bs->breaker_slow_usec) is_failed = TRUE;
+
+	/* nothing to count */
+	if (br->state == NETWORK_BACKEND_BREAKER_CLOSED && bs->breaker_error_rate == 0) return;
+
+	g_mutex_lock(b->breaker_mutex);
+	switch (br->state) {
+	case NETWORK_BACKEND_BREAKER_CLOSED:
+		if (now_usec < br->window_start_usec ||
+		    now_usec - br->window_start_usec > NETWORK_BACKEND_BREAKER_WINDOW_USEC) {
+			br->window_start_usec = now_usec;
+			br->requests = 0;
+			br->failures = 0;
+		}
+
+		br->requests++;
+		if (is_failed) br->failures++;
+
+		if (bs->breaker_error_rate > 0 &&
+		    br->requests >= NETWORK_BACKEND_BREAKER_MIN_REQUESTS &&
+		    (guint64)br->failures * 100 >= (guint64)br->requests * bs->breaker_error_rate) {
+			network_backend_breaker_trip(b);
+			is_tripped = TRUE;
+		}
+		break;
+	case NETWORK_BACKEND_BREAKER_HALF_OPEN:
+		if (is_failed) {
+			network_backend_breaker_trip(b);
+			is_tripped = TRUE;
+		} else {
+			network_backend_breaker_succeeded(b, now_usec);
+		}
+		break;
+	case NETWORK_BACKEND_BREAKER_OPEN:
+		break;
+	}
+	g_mutex_unlock(b->breaker_mutex);
+
+	if (is_tripped) {
+		g_message("%s: the circuit-breaker of backend %s opened, marking it as down for %d sec",
+				G_STRLOC,
+				b->addr->name->str,
+				network_backend_get_down_secs(b));
+
+		b->state = BACKEND_STATE_DOWN;
+		chassis_gtime_testset_now(&b->state_since, NULL);
+	}
+}
+
+/**
+ * get the backend of a type with the fewest connected clients
+ *
+ * backends that are down or lagging are skipped, HALF_OPEN ones take only part in
+ * some of the picks
+ *
+ * @return the index of the backend, -1 if there is none
+ */
+int network_backends_get_least_connected(network_backends_t *bs, backend_type_t type) {
+	guint min_connected_clients = G_MAXUINT;
+	GPtrArray *backends = network_backends_get_snapshot(bs);
+	int ndx = -1;
+	int fallback_ndx = -1;
+	guint i;
+
+	/* protect the typecast below */
+	g_assert_cmpint(backends->len, <, G_MAXINT);
+
+	for (i = 0; i < backends->len; i++) {
+		network_backend_t *cur = backends->pdata[i];
+
+		if (cur->state == BACKEND_STATE_DOWN ||
+		    cur->state == BACKEND_STATE_LAGGING ||
+		    cur->type != type) continue;
+
+		if (!network_backends_breaker_admit(bs, cur)) {
+			/* better than nothing */
+			if (fallback_ndx == -1) fallback_ndx = i;
+			continue;
+		}
+
+		if (cur->connected_clients < min_connected_clients) {
+			ndx = i;
+			min_connected_clients = cur->connected_clients;
+		}
+	}
+
+	return ndx != -1 ? ndx : fallback_ndx;
+}
+
+/**
+ * get the backend of a type that answers the fastest
+ *
+ * the latency is weighted by the connected clients: a slow backend gets less
+ * clients, but isn't dropped. Backends without latency samples are tried first,
+ * backends that are down or lagging are skipped.
+ *
+ * @return the index of the backend, -1 if there is none
+ */
+int network_backends_get_least_latency(network_backends_t *bs, backend_type_t type) {
+	return network_backends_get_least_latency_at_pos(bs, type, 0);
+}
+
+/**
+ * check if a backend of a type is up and has caught up to a binlog position
+ *
+ * @param min_binlog_pos the backends that are behind it or don't know theirs don't qualify, 0 to take any
+ */
+static gboolean network_backends_is_candidate_at_pos(network_backend_t *cur, backend_type_t type, guint64 min_binlog_pos) {
+	if (cur->state == BACKEND_STATE_DOWN ||
+	    cur->state == BACKEND_STATE_LAGGING ||
+	    cur->type != type) return FALSE;
+
+	if (min_binlog_pos > 0) {
+		guint64 binlog_pos;
+
+		network_backend_get_binlog_pos(cur, &binlog_pos, NULL);
+
+		if (binlog_pos < min_binlog_pos) return FALSE;
+	}
+
+	return TRUE;
+}
+
+/**
+ * get the backend of a type that answers the fastest and has caught up to a binlog position
+ *
+ * @param min_binlog_pos skip the backends that are behind this position or don't know theirs, 0 to take any
+ * @return the index of the backend, -1 if there is none
+ * @see network_backends_get_least_latency()
+ */
+int network_backends_get_least_latency_at_pos(network_backends_t *bs, backend_type_t type, guint64 min_binlog_pos) {
+	guint64 min_score = G_MAXUINT64;
+	GPtrArray *backends = network_backends_get_snapshot(bs);
+	int ndx = -1;
+	int fallback_ndx = -1;
+	guint i;
+
+	/* protect the typecast below */
+	g_assert_cmpint(backends->len, <, G_MAXINT);
+
+	for (i = 0; i < backends->len; i++) {
+		network_backend_t *cur = backends->pdata[i];
+		gint latency = g_atomic_int_get(&cur->latency_total);
+		guint64 score;
+
+		if (!network_backends_is_candidate_at_pos(cur, type, min_binlog_pos)) continue;
+
+		if (!network_backends_breaker_admit(bs, cur)) {
+			if (fallback_ndx == -1) fallback_ndx = i;
+			continue;
+		}
+
+		score = latency == 0 ? 0 : (guint64)(cur->connected_clients + 1) * latency;
+
+		if (score < min_score) {
+			ndx = i;
+			min_score = score;
+		}
+	}
+
+	return ndx != -1 ? ndx : fallback_ndx;
+}
+
+#define FNV1A_64_INIT  G_GUINT64_CONSTANT(14695981039346656037)
+#define FNV1A_64_PRIME G_GUINT64_CONSTANT(1099511628211)
+
+static guint64 network_backends_hash_bytes(guint64 h, const char *s, gsize len) {
+	gsize i;
+
+	for (i = 0; i < len; i++) {
+		h ^= (guchar)s[i];
+		h *= FNV1A_64_PRIME;
+	}
+
+	return h;
+}
+
+/**
+ * the weight of a backend for a key
+ *
+ * FNV-1a alone mixes the last bytes badly, the finalizer of MurmurHash3 spreads
+ * them over all bits so that each backend wins an equal share of the keys
+ */
+static guint64 network_backends_get_key_weight(guint64 key_hash, network_backend_t *b) {
+	guint64 h = network_backends_hash_bytes(key_hash, S(b->addr->name));
+
+	h ^= h >> 33;
+	h *= G_GUINT64_CONSTANT(0xff51afd7ed558ccd);
+	h ^= h >> 33;
+	h *= G_GUINT64_CONSTANT(0xc4ceb9fe1a85ec53);
+	h ^= h >> 33;
+
+	return h;
+}
+
+/**
+ * get the backend of a type a key sticks to
+ *
+ * the backends are ranked per key by rendezvous hashing: the backend with the highest
+ * weight of hash(key, address) gets the key. If a backend goes away or comes back
+ * only the keys it wins move, about 1/N of them.
+ *
+ * To keep hot keys from overloading their backend, a backend takes no more than
+ * load_factor percent of the average connected clients: a full backend passes its
+ * keys on to the next one in their ranking.
+ *
+ * @param key             the key, like the user or the default database
+ * @param min_binlog_pos  skip the backends that are behind this position or don't know theirs, 0 to take any
+ * @param load_factor     the connected clients of a backend in percent of the average it may have, at least 100
+ * @return the index of the backend, -1 if there is none
+ * @see network_backends_get_least_latency_at_pos()
+ */
+int network_backends_get_by_key_at_pos(network_backends_t *bs, backend_type_t type, const char *key, gsize key_len,
+		guint64 min_binlog_pos, guint load_factor) {
+	GPtrArray *backends = network_backends_get_snapshot(bs);
+	guint64 key_hash = network_backends_hash_bytes(FNV1A_64_INIT, key, key_len);
+	guint64 max_weight = 0;
+	guint64 connected_clients = 0;
+	guint64 max_clients;
+	guint candidates = 0;
+	int ndx = -1;
+	int fallback_ndx = -1;
+	guint i;
+
+	/* protect the typecast below */
+	g_assert_cmpint(backends->len, <, G_MAXINT);
+
+	if (load_factor < 100) load_factor = 100;
+
+	for (i = 0; i < backends->len; i++) {
+		network_backend_t *cur = backends->pdata[i];
+
+		if (!network_backends_is_candidate_at_pos(cur, type, min_binlog_pos)) continue;
+
+		candidates++;
+		connected_clients += cur->connected_clients;
+	}
+
+	if (candidates == 0) return -1;
+
+	/* the client we route counts too, the bound is at least 1 */
+	max_clients = ((connected_clients + 1) * load_factor + 100 * candidates - 1) / (100 * candidates);
+
+	for (i = 0; i < backends->len; i++) {
+		network_backend_t *cur = backends->pdata[i];
+		guint64 weight;
+
+		if (!network_backends_is_candidate_at_pos(cur, type, min_binlog_pos)) continue;
+		if (cur->connected_clients >= max_clients) continue;
+
+		/* a HALF_OPEN backend gets some of its keys, the others go to the next in their ranking */
+		if (!network_backends_breaker_admit(bs, cur)) {
+			if (fallback_ndx == -1) fallback_ndx = i;
+			continue;
+		}
+
+		weight = network_backends_get_key_weight(key_hash, cur);
+
+		if (ndx == -1 || weight > max_weight) {
+			ndx = i;
+			max_weight = weight;
+		}
+	}
+
+	return ndx != -1 ? ndx : fallback_ndx;
+}
+
+/**
+ * parse a unsigned option of a group
+ */
+static gboolean network_backends_group_parse_uint(const gchar *value, guint *dst) {
+	gchar *end = NULL;
+	guint64 v;
+
+	if (*value == '\0' || *value == '-') return FALSE;
+
+	v = g_ascii_strtoull(value, &end, 10);
+	if (*end != '\0' || v > G_MAXINT) return FALSE;
+
+	*dst = v;
+
+	return TRUE;
+}
+
+/**
+ * set a <option>=<value> of a group
+ */
+static int network_backends_group_set_option(network_backend_group_t *group, const gchar *option, GError **gerr) {
+	const gchar *eq = strchr(option, '=');
+	const gchar *value;
+	gchar *key;
+	guint n;
+	int ret = 0;
+
+	if (NULL == eq) {
+		g_set_error(gerr, NETWORK_BACKENDS_ERROR, NETWORK_BACKENDS_ERROR_GROUP_PARSE,
+				"group %s: expected <option>=<value>, got '%s'", group->name, option);
+		return -1;
+	}
+
+	key = g_strndup(option, eq - option);
+	value = eq + 1;
+
+	if (0 == strcmp(key, "policy")) {
+		if (0 == strcmp(value, "least-connected")) {
+			group->policy = NETWORK_BACKEND_GROUP_POLICY_LEAST_CONNECTED;
+		} else if (0 == strcmp(value, "least-latency")) {
+			group->policy = NETWORK_BACKEND_GROUP_POLICY_LEAST_LATENCY;
+		} else if (0 == strcmp(value, "first")) {
+			group->policy = NETWORK_BACKEND_GROUP_POLICY_FIRST;
+		} else {
+			ret = -1;
+		}
+	} else if (0 == strcmp(key, "max-queries")) {
+		if (network_backends_group_parse_uint(value, &n)) group->max_queries = n; else ret = -1;
+	} else if (0 == strcmp(key, "pool-max-idle")) {
+		if (network_backends_group_parse_uint(value, &n)) group->pool_max_idle = n; else ret = -1;
+	} else if (0 == strcmp(key, "pool-min-idle")) {
+		if (network_backends_group_parse_uint(value, &n)) group->pool_min_idle = n; else ret = -1;
+	} else if (0 == strcmp(key, "max-lag")) {
+		if (network_backends_group_parse_uint(value, &n)) group->max_lag = n; else ret = -1;
+	} else {
+		g_set_error(gerr, NETWORK_BACKENDS_ERROR, NETWORK_BACKENDS_ERROR_GROUP_PARSE,
+				"group %s: unknown option '%s'", group->name, key);
+		g_free(key);
+		return -1;
+	}
+
+	if (ret != 0) {
+		g_set_error(gerr, NETWORK_BACKENDS_ERROR, NETWORK_BACKENDS_ERROR_GROUP_PARSE,
+				"group %s: invalid value '%s' for %s", group->name, value, key);
+	}
+	g_free(key);
+
+	return ret;
+}
+
+/**
+ * find the index of the backend of a configured address
+ *
+ * @note has to be called with the backends_mutex held
+ * @return the index, -1 if the backend isn't known
+ */
+static int network_backends_find(network_backends_t *bs, const gchar *address, network_address *addr) {
+	guint i;
+
+	for (i = 0; i < bs->backends->len; i++) {
+		network_backend_t *b = bs->backends->pdata[i];
+
+		if (b->hostname ? (0 == strcmp(b->hostname, address)) : strleq(S(b->addr->name), S(addr->name))) {
+			return i;
+		}
+	}
+
+	return -1;
+}
+
+static void network_backends_group_addrs_free(GPtrArray *addrs, GPtrArray *names) {
+	guint i;
+
+	if (addrs) {
+		for (i = 0; i < addrs->len; i++) {
+			network_address_free(addrs->pdata[i]);
+		}
+		g_ptr_array_free(addrs, TRUE);
+	}
+	if (names) g_ptr_array_free(names, TRUE);
+}
+
+/**
+ * add a named group of backends
+ *
+ *   <name>[(<option>=<value>[,...])]=<address>[,<address>...]
+ *
+ * like "orders-replicas(policy=least-latency,max-lag=5)=10.0.0.2:3306,10.0.0.3:3306". The
+ * options are:
+ *
+ * - policy: least-connected (default), least-latency or first
+ * - max-queries: queries in flight to the group
+ * - pool-max-idle, pool-min-idle: the idle connections of the pools of the members
+ * - max-lag: the Seconds_Behind_Master the health-check accepts of the members
+ *
+ * the members have to be added with network_backends_add() before, a backend can only be
+ * in one group. The groups are published as a new snapshot, the readers don't lock.
+ *
+ * @return 0 on success, -1 on error
+ */
+int network_backends_add_group(network_backends_t *bs, const gchar *spec, GError **gerr) {
+	network_backend_group_t *group;
+	const gchar *eq = strchr(spec, '=');
+	const gchar *paren = strchr(spec, '(');
+	const gchar *addresses_str;
+	gchar **addresses = NULL;
+	gchar **options = NULL;
+	GPtrArray *addrs = NULL;
+	GPtrArray *names = NULL;
+	gchar *name;
+	GHashTable *groups;
+	GHashTableIter iter;
+	gpointer key, value;
+	guint i, j;
+
+	if (paren && (NULL == eq || paren < eq)) {
+		const gchar *close = strchr(paren, ')');
+		const gchar *rest = close ? close + 1 : NULL;
+
+		while (rest && g_ascii_isspace(*rest)) rest++;
+
+		if (NULL == rest || *rest != '=') {
+			g_set_error(gerr, NETWORK_BACKENDS_ERROR, NETWORK_BACKENDS_ERROR_GROUP_PARSE,
+					"expected <name>[(<option>=<value>[,...])]=<address>[,...], got '%s'", spec);
+			return -1;
+		}
+
+		name = g_strndup(spec, paren - spec);
+		{
+			gchar *options_str = g_strndup(paren + 1, close - paren - 1);
+
+			options = g_strsplit(options_str, ",", -1);
+			g_free(options_str);
+		}
+		addresses_str = rest + 1;
+	} else if (eq) {
+		name = g_strndup(spec, eq - spec);
+		addresses_str = eq + 1;
+	} else {
+		g_set_error(gerr, NETWORK_BACKENDS_ERROR, NETWORK_BACKENDS_ERROR_GROUP_PARSE,
+				"expected <name>[(<option>=<value>[,...])]=<address>[,...], got '%s'", spec);
+		return -1;
+	}
+
+	g_strstrip(name);
+	group = network_backend_group_new(name);
+	g_free(name);
+
+	if (group->name[0] == '\0') {
+		g_set_error(gerr, NETWORK_BACKENDS_ERROR, NETWORK_BACKENDS_ERROR_GROUP_PARSE,
+				"the group in '%s' has no name", spec);
+		goto err;
+	}
+
+	for (i = 0; options && options[i]; i++) {
+		g_strstrip(options[i]);
+		if (options[i][0] == '\0') continue;
+
+		if (0 != network_backends_group_set_option(group, options[i], gerr)) goto err;
+	}
+
+	addresses = g_strsplit(addresses_str, ",", -1);
+
+	/* parse the addresses before we lock, like network_backends_add() */
+	addrs = g_ptr_array_new();
+	names = g_ptr_array_new();
+	for (i = 0; addresses[i]; i++) {
+		network_address *addr;
+
+		g_strstrip(addresses[i]);
+		if (addresses[i][0] == '\0') continue;
+
+		addr = network_address_new();
+		if (0 != network_address_set_address(addr, addresses[i])) {
+			network_address_free(addr);
+			g_set_error(gerr, NETWORK_BACKENDS_ERROR, NETWORK_BACKENDS_ERROR_GROUP_MEMBER,
+					"group %s: can't parse backend address %s", group->name, addresses[i]);
+			goto err;
+		}
+		g_ptr_array_add(addrs, addr);
+		/* the address as configured, the backends with a host-name are known by it */
+		g_ptr_array_add(names, addresses[i]);
+	}
+
+	chassis_lock_stats_mutex_lock(bs->backends_mutex, &bs->backends_mutex_stats);
+	if (NULL != g_hash_table_lookup(bs->groups, group->name)) {
+		chassis_lock_stats_mutex_unlock(bs->backends_mutex, &bs->backends_mutex_stats);
+		g_set_error(gerr, NETWORK_BACKENDS_ERROR, NETWORK_BACKENDS_ERROR_GROUP_PARSE,
+				"group %s is already known", group->name);
+		goto err;
+	}
+
+	for (i = 0; i < addrs->len; i++) {
+		network_backend_t *b;
+		guint member;
+		int ndx;
+
+		if (-1 == (ndx = network_backends_find(bs, names->pdata[i], addrs->pdata[i]))) {
+			chassis_lock_stats_mutex_unlock(bs->backends_mutex, &bs->backends_mutex_stats);
+			g_set_error(gerr, NETWORK_BACKENDS_ERROR, NETWORK_BACKENDS_ERROR_GROUP_MEMBER,
+					"group %s: %s isn't a known backend", group->name, (gchar *)names->pdata[i]);
+			goto err;
+		}
+
+		b = bs->backends->pdata[ndx];
+		if (b->group) {
+			chassis_lock_stats_mutex_unlock(bs->backends_mutex, &bs->backends_mutex_stats);
+			g_set_error(gerr, NETWORK_BACKENDS_ERROR, NETWORK_BACKENDS_ERROR_GROUP_MEMBER,
+					"group %s: backend %s is in group %s already",
+					group->name, (gchar *)names->pdata[i], b->group->name);
+			goto err;
+		}
+
+		member = ndx;
+		for (j = 0; j < group->members->len; j++) {
+			if (g_array_index(group->members, guint, j) == member) break;
+		}
+		if (j < group->members->len) continue; /* listed twice */
+
+		g_array_append_val(group->members, member);
+	}
+
+	if (group->members->len == 0) {
+		chassis_lock_stats_mutex_unlock(bs->backends_mutex, &bs->backends_mutex_stats);
+		g_set_error(gerr, NETWORK_BACKENDS_ERROR, NETWORK_BACKENDS_ERROR_GROUP_PARSE,
+				"group %s has no backends", group->name);
+		goto err;
+	}
+
+	for (i = 0; i < group->members->len; i++) {
+		network_backend_t *b = bs->backends->pdata[g_array_index(group->members, guint, i)];
+
+		b->group = group;
+		for (j = 0; j < b->pools->len; j++) {
+			network_backend_group_apply_pool_limits(group, b->pools->pdata[j]);
+		}
+	}
+
+	/* copy-on-write like the backends, readers may still look at the old snapshot */
+	groups = g_hash_table_new(g_str_hash, g_str_equal);
+	g_hash_table_iter_init(&iter, bs->groups);
+	while (g_hash_table_iter_next(&iter, &key, &value)) {
+		g_hash_table_insert(groups, key, value);
+	}
+	g_hash_table_insert(groups, group->name, group);
+
+	g_ptr_array_add(bs->retired_groups, bs->groups);
+	g_atomic_pointer_set((gpointer *)&bs->groups, groups);
+	chassis_lock_stats_mutex_unlock(bs->backends_mutex, &bs->backends_mutex_stats);
+
+	g_message("added backend group %s: %u backends, policy %s",
+			group->name, group->members->len,
+			network_backend_group_policy_get_name(group->policy));
+
+	network_backends_group_addrs_free(addrs, names);
+	g_strfreev(options);
+	g_strfreev(addresses);
+
+	return 0;
+err:
+	network_backends_group_addrs_free(addrs, names);
+	network_backend_group_free(group);
+	g_strfreev(options);
+	g_strfreev(addresses);
+
+	return -1;
+}
+
+/**
+ * get a group by name without locking
+ *
+ * @return the group, NULL if there is none of that name. It stays valid until the backends are freed.
+ */
+network_backend_group_t *network_backends_get_group(network_backends_t *bs, const gchar *name) {
+	GHashTable *groups = g_atomic_pointer_get((gpointer *)&bs->groups);
+
+	return g_hash_table_lookup(groups, name);
+}
+
+/**
+ * pick a backend of a group by its policy
+ *
+ * like the other pickers, the backends that are down or lagging are skipped and
+ * HALF_OPEN ones take only part in some of the picks
+ *
+ * @return the index of the backend, -1 if there is none
+ */
+int network_backends_get_from_group(network_backends_t *bs, network_backend_group_t *group) {
+	GPtrArray *backends = network_backends_get_snapshot(bs);
+	guint64 min_score = G_MAXUINT64;
+	int ndx = -1;
+	int fallback_ndx = -1;
+	guint i;
+
+	for (i = 0; i < group->members->len; i++) {
+		guint member = g_array_index(group->members, guint, i);
+		network_backend_t *cur;
+		guint64 score;
+
+		if (member >= backends->len) continue;
+		cur = backends->pdata[member];
+
+		if (cur->state == BACKEND_STATE_DOWN ||
+		    cur->state == BACKEND_STATE_LAGGING) continue;
+
+		if (!network_backends_breaker_admit(bs, cur)) {
+			if (fallback_ndx == -1) fallback_ndx = member;
+			continue;
+		}
+
+		switch (group->policy) {
+		case NETWORK_BACKEND_GROUP_POLICY_FIRST:
+			return member;
+		case NETWORK_BACKEND_GROUP_POLICY_LEAST_LATENCY: {
+			gint latency = g_atomic_int_get(&cur->latency_total);
+
+			score = latency == 0 ? 0 : (guint64)(cur->connected_clients + 1) * latency;
+			break; }
+		default:
+			score = cur->connected_clients;
+			break;
+		}
+
+		if (score < min_score) {
+			ndx = member;
+			min_score = score;
+		}
+	}
+
+	return ndx != -1 ? ndx : fallback_ndx;
+}
+
+/**
+ * set the number of connection pools per backend
+ *
+ * call it with the number of event-threads before the threads are started
+ */
+void network_backends_set_pool_shards(network_backends_t *bs, guint shards) {
+	guint i;
+
+	if (shards < 1) shards = 1;
+
+	chassis_lock_stats_mutex_lock(bs->backends_mutex, &bs->backends_mutex_stats);
+	bs->pool_shards = shards;
+
+	for (i = 0; i < bs->backends->len; i++) {
+		network_backend_set_pool_shards(bs->backends->pdata[i], shards);
+	}
+	chassis_lock_stats_mutex_unlock(bs->backends_mutex, &bs->backends_mutex_stats);
+}
+
+/**
+ * connect to the backends on this host through a unix-socket instead of TCP
+ *
+ * applies to the backends that are added later too
+ *
+ * @param path the unix-socket of the mysqld, NULL to look for it at the default paths
+ */
+void network_backends_use_local_sockets(network_backends_t *bs, const gchar *path) {
+	guint i;
+
+	chassis_lock_stats_mutex_lock(bs->backends_mutex, &bs->backends_mutex_stats);
+	bs->use_local_sockets = TRUE;
+	if (bs->local_socket) g_free(bs->local_socket);
+	bs->local_socket = g_strdup(path);
+
+	for (i = 0; i < bs->backends->len; i++) {
+		network_backends_use_local_socket(bs, bs->backends->pdata[i]);
+	}
+	chassis_lock_stats_mutex_unlock(bs->backends_mutex, &bs->backends_mutex_stats);
+}
+
+/**
+ * set the source addresses of the connections to the backends
+ *
+ *   [<backend>=]<ip>[,<ip>...]
+ *
+ * like "10.0.0.5,10.0.0.6" for all backends or "10.0.1.2:3306=10.0.0.7" for one. The
+ * addresses of a backend win over the ones for all backends, whichever comes first. The
+ * ones for all backends apply to the backends that are added later too.
+ *
+ * @return 0 on success, -1 on error
+ */
+int network_backends_set_source_addresses(network_backends_t *bs, const gchar *spec, GError **gerr) {
+	const gchar *eq = strchr(spec, '=');
+	const gchar *addresses = eq ? eq + 1 : spec;
+	GPtrArray *addrs;
+	guint i;
+
+	/* check the addresses before we lock, a backend gets its own copy of them below */
+	if (NULL == (addrs = network_backend_source_addrs_new(addresses))) {
+		g_set_error(gerr, NETWORK_BACKENDS_ERROR, NETWORK_BACKENDS_ERROR_SOURCE_PARSE,
+				"expected [<backend>=]<ip>[,<ip>...], got '%s'", spec);
+		return -1;
+	}
+
+	if (eq) {
+		gchar *name = g_strstrip(g_strndup(spec, eq - spec));
+		network_address *addr = network_address_new();
+		int ndx;
+
+		/* a backend with a host-name is known by it, see network_backends_find() */
+		network_address_set_address(addr, name);
+
+		chassis_lock_stats_mutex_lock(bs->backends_mutex, &bs->backends_mutex_stats);
+		if (-1 != (ndx = network_backends_find(bs, name, addr))) {
+			network_backend_t *b = bs->backends->pdata[ndx];
+
+			network_backend_replace_source_addrs(b, addrs);
+			b->has_own_source_addrs = TRUE;
+		}
+		chassis_lock_stats_mutex_unlock(bs->backends_mutex, &bs->backends_mutex_stats);
+
+		network_address_free(addr);
+
+		if (-1 == ndx) {
+			g_set_error(gerr, NETWORK_BACKENDS_ERROR, NETWORK_BACKENDS_ERROR_SOURCE_PARSE,
+					"source addresses: %s isn't a known backend", name);
+			g_free(name);
+			network_backend_resolved_free(addrs);
+			return -1;
+		}
+		g_free(name);
+
+		return 0;
+	}
+
+	network_backend_resolved_free(addrs);
+
+	chassis_lock_stats_mutex_lock(bs->backends_mutex, &bs->backends_mutex_stats);
+	if (bs->source_addresses) g_free(bs->source_addresses);
+	bs->source_addresses = g_strdup(addresses);
+
+	for (i = 0; i < bs->backends->len; i++) {
+		network_backend_t *b = bs->backends->pdata[i];
+
+		if (b->has_own_source_addrs) continue;
+
+		network_backend_replace_source_addrs(b, network_backend_source_addrs_new(addresses));
+	}
+	chassis_lock_stats_mutex_unlock(bs->backends_mutex, &bs->backends_mutex_stats);
+
+	return 0;
+}
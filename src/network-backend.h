@@ -27,14 +27,17 @@
 #endif
 
 #include "network-conn-pool.h"
+#include "network-histogram.h"
 #include "chassis-mainloop.h"
+#include "chassis-lock-stats.h"
 
 #include "network-exports.h"
 
 typedef enum { 
 	BACKEND_STATE_UNKNOWN, 
 	BACKEND_STATE_UP, 
-	BACKEND_STATE_DOWN
+	BACKEND_STATE_DOWN,
+	BACKEND_STATE_LAGGING    /**< up, but the replication is behind, see network_backends_health_t */
 } backend_state_t;
 
 typedef enum { 
@@ -43,21 +46,97 @@ typedef enum {
 	BACKEND_TYPE_RO
 } backend_type_t;
 
+/**
+ * the circuit-breaker of a backend
+ *
+ * the breaker opens on a failed connect or if too many of the recent queries failed or
+ * were too slow: the backend is DOWN and gets no traffic. Once it is woken up again, by
+ * network_backends_check() or the health-check, it is HALF_OPEN and only gets a share
+ * of the picks until enough of them succeeded. A failure while it is HALF_OPEN opens
+ * it again.
+ */
+typedef enum {
+	NETWORK_BACKEND_BREAKER_CLOSED,     /**< the backend gets its full share */
+	NETWORK_BACKEND_BREAKER_OPEN,       /**< the backend is DOWN */
+	NETWORK_BACKEND_BREAKER_HALF_OPEN   /**< the backend is on probation */
+} network_backend_breaker_state_t;
+
+typedef struct {
+	network_backend_breaker_state_t state;
+	guint trips;                 /**< the times it opened since it was closed the last time */
+
+	guint64 window_start_usec;   /**< CLOSED: the counters below are since then */
+	guint requests;
+	guint failures;
+
+	volatile gint picks;         /**< HALF_OPEN: the times the backend was a candidate */
+	guint successes;             /**< HALF_OPEN: closes at NETWORK_BACKEND_BREAKER_CLOSE_AFTER */
+} network_backend_breaker_t;
+
+#define NETWORK_BACKEND_BREAKER_WINDOW_USEC  (10 * G_USEC_PER_SEC)
+#define NETWORK_BACKEND_BREAKER_MIN_REQUESTS 20  /**< don't judge a backend on less requests in the window */
+#define NETWORK_BACKEND_BREAKER_CLOSE_AFTER  20  /**< successes a HALF_OPEN backend needs to close */
+
+typedef enum {
+	NETWORK_BACKEND_LATENCY_CONNECT,    /**< connect() to the backend */
+	NETWORK_BACKEND_LATENCY_FIRST_BYTE, /**< query sent until the first packet of the result */
+	NETWORK_BACKEND_LATENCY_QUERY,      /**< query sent until the last packet of the result */
+
+	NETWORK_BACKEND_LATENCY_MAX
+} network_backend_latency_t;
+
+typedef struct network_backend_group network_backend_group_t;
+
 typedef struct {
 	network_address *addr;
    
-	backend_state_t state;   /**< UP or DOWN */
+	backend_state_t state;   /**< UP, DOWN or LAGGING */
 	backend_type_t type;     /**< ReadWrite or ReadOnly */
 
 	GTimeVal state_since;    /**< timestamp of the last state-change */
 
-	network_connection_pool *pool; /**< the pool of open connections */
+	network_connection_pool *pool; /**< the pool of open connections of the main-thread, the same as pools[0] */
+	GPtrArray *pools;              /**< a pool of open connections per event-thread, see network_backend_get_pool() */
 
 	guint connected_clients; /**< number of open connections to this backend for SQF */
 
+	gint latency_first;      /**< EWMA of the time to the first packet of a result in microseconds, 0 without samples */
+	gint latency_total;      /**< EWMA of the time to the last packet of a result in microseconds, 0 without samples */
+	GPtrArray *latencies;    /**< a network_histogram_t[NETWORK_BACKEND_LATENCY_MAX] in microseconds per event-thread, like .pools */
+
+	gint replication_lag;    /**< Seconds_Behind_Master of the last health-check, -1 if unknown or not replicating */
+
+	guint64 binlog_pos;      /**< RW: the binlog position of the master, RO: the position of the master it executed, 0 if unknown */
+	guint64 binlog_pos_usec; /**< when the health-check asked for binlog_pos, in chassis_get_rel_microseconds() */
+	GMutex *binlog_pos_mutex; /**< protects binlog_pos and binlog_pos_usec, the health-check writes them in the main-thread */
+
 	GString *uuid;           /**< the UUID of the backend */
+
+	gboolean is_removed;     /**< dropped from the config by network_backends_reload(), stays DOWN until it is added again */
+
+	network_backend_breaker_t breaker; /**< protected by .breaker_mutex, .breaker.state may be read without it */
+	GMutex *breaker_mutex;
+
+	gchar *hostname;         /**< the address as configured if it has a host-name, NULL for IPs */
+	GPtrArray *resolved;     /**< a network_address per A and AAAA record of .hostname, protected by .resolved_mutex */
+	guint resolved_next;     /**< the record the next connection goes to */
+	GMutex *resolved_mutex;  /**< protects .resolved, .resolved_next, .local_addr and .source_addrs */
+
+	network_address *local_addr; /**< the unix-socket of a backend on this host, NULL to connect to .addr */
+
+	GPtrArray *source_addrs; /**< the local addresses the connections are bound to, NULL to let the kernel pick */
+	guint source_next;       /**< the source address the next connection comes from */
+	gboolean has_own_source_addrs; /**< .source_addrs were set for this backend, not taken from the default */
+
+	network_backend_group_t *group; /**< the group the backend is in, NULL if none */
 } network_backend_t;
 
+/**
+ * a backend whose breaker keeps opening stays down longer: 4, 8, 16, 32 and then 64 seconds
+ */
+#define NETWORK_BACKEND_DOWN_SECS     4
+#define NETWORK_BACKEND_MAX_DOWN_SECS 64
+
 typedef network_backend_t backend_t G_GNUC_DEPRECATED;
 
 NETWORK_API network_backend_t *backend_init() G_GNUC_DEPRECATED;
@@ -65,20 +144,129 @@ NETWORK_API void backend_free(network_backend_t *b) G_GNUC_DEPRECATED;
 
 NETWORK_API network_backend_t *network_backend_new();
 NETWORK_API void network_backend_free(network_backend_t *b);
+NETWORK_API void network_backend_set_pool_shards(network_backend_t *b, guint shards);
+NETWORK_API network_connection_pool *network_backend_get_pool(network_backend_t *b, guint ndx);
+NETWORK_API void network_backend_get_pool_stats(network_backend_t *b, network_connection_pool_stats_t *stats);
+NETWORK_API void network_backend_add_latency(network_backend_t *b, guint64 first_usec, guint64 total_usec);
+NETWORK_API void network_backend_record_latency(network_backend_t *b, guint ndx, network_backend_latency_t latency, guint64 usec);
+NETWORK_API void network_backend_get_latency(network_backend_t *b, network_backend_latency_t latency, network_histogram_t *h);
+NETWORK_API const char *network_backend_latency_get_name(network_backend_latency_t latency);
+NETWORK_API gboolean network_backend_set_state(network_backend_t *b, backend_state_t state);
+NETWORK_API void network_backend_connect_failed(network_backend_t *b);
+NETWORK_API void network_backend_connect_succeeded(network_backend_t *b);
+NETWORK_API gint network_backend_get_down_secs(network_backend_t *b);
+NETWORK_API const char *network_backend_breaker_state_get_name(network_backend_breaker_state_t state);
+NETWORK_API void network_backend_set_binlog_pos(network_backend_t *b, guint64 pos, guint64 usec);
+NETWORK_API void network_backend_get_binlog_pos(network_backend_t *b, guint64 *pos, guint64 *usec);
+NETWORK_API const char *network_backend_state_get_name(backend_state_t state);
+NETWORK_API void network_backend_get_address(network_backend_t *b, network_address *dst);
+NETWORK_API gboolean network_backend_set_resolved(network_backend_t *b, GPtrArray *addrs);
+NETWORK_API int network_backend_set_local_socket(network_backend_t *b, const gchar *path);
+NETWORK_API gboolean network_backend_local_socket_failed(network_backend_t *b, network_address *addr);
+NETWORK_API int network_backend_set_source_addresses(network_backend_t *b, const gchar *addresses);
+NETWORK_API gboolean network_backend_get_source_address(network_backend_t *b, network_address *dst, network_address *src);
+
+/**
+ * how a group picks one of its backends
+ */
+typedef enum {
+	NETWORK_BACKEND_GROUP_POLICY_LEAST_CONNECTED, /**< the one with the fewest connected clients */
+	NETWORK_BACKEND_GROUP_POLICY_LEAST_LATENCY,   /**< the fastest, weighted by its connected clients */
+	NETWORK_BACKEND_GROUP_POLICY_FIRST            /**< the first one in the order of the group that is up, for a primary with fail-overs */
+} network_backend_group_policy_t;
+
+/**
+ * a named group of backends, like "orders-primary" or "analytics"
+ *
+ * a backend is in one group at most, the settings of the group apply to its members:
+ * the idle connections of their pools, the lag the health-check accepts and the
+ * queries in flight in the group (see network_admission_set_group_limit()).
+ *
+ * a group doesn't change once it is added, see network_backends_add_group()
+ */
+struct network_backend_group {
+	gchar *name;
+	network_backend_group_policy_t policy;
+
+	GArray *members;           /**< guint indexes into the backends, in the configured order */
+
+	guint pool_max_idle;       /**< max_idle_connections of the pools of the members, 0 to keep the default */
+	guint pool_min_idle;       /**< min_idle_connections of the pools of the members, 0 to keep the default */
+	guint max_queries;         /**< queries in flight to the members, 0 for unlimited */
+	gint max_lag;              /**< members with a bigger Seconds_Behind_Master are LAGGING, -1 to use the one of the health-check */
+};
+
+NETWORK_API network_backend_group_t *network_backend_group_new(const gchar *name);
+NETWORK_API void network_backend_group_free(network_backend_group_t *group);
+NETWORK_API const char *network_backend_group_policy_get_name(network_backend_group_policy_t policy);
 
+typedef enum {
+	NETWORK_BACKENDS_ERROR_GROUP_PARSE,   /**< the group doesn't parse */
+	NETWORK_BACKENDS_ERROR_GROUP_MEMBER,  /**< a member isn't a known backend or is in another group already */
+	NETWORK_BACKENDS_ERROR_SOURCE_PARSE   /**< the source addresses don't parse or the backend isn't known */
+} network_backends_error_t;
+
+#define NETWORK_BACKENDS_ERROR network_backends_error()
+NETWORK_API GQuark network_backends_error(void);
+
+/**
+ * the list of backends
+ *
+ * readers don't lock: backends points to a array that isn't changed once it is
+ * published. Writers take backends_mutex, publish a copy with the changes and
+ * retire the old array. As readers may still iterate a retired array, those
+ * are only freed in network_backends_free(). Backends are never removed, only
+ * the small arrays of pointers to them are kept. A backend that is dropped from
+ * the config keeps its index and is only marked as ->is_removed.
+ *
+ * @see network_backends_get_snapshot()
+ */
 typedef struct {
-	GPtrArray *backends;
-	GMutex    *backends_mutex;
+	GPtrArray *backends;       /**< the current snapshot, get it with network_backends_get_snapshot() */
+	GMutex    *backends_mutex; /**< serializes the writers */
+	chassis_lock_stats_t backends_mutex_stats;
+	GPtrArray *retired;        /**< the snapshots that got replaced */
+
+	GHashTable *groups;        /**< the current snapshot of the groups, name -> network_backend_group_t, see network_backends_get_group() */
+	GPtrArray *retired_groups; /**< the group snapshots that got replaced */
 	
 	GTimeVal backend_last_check;
+	gboolean is_health_checked; /**< the backends are probed by a network_backends_health_t, clients don't wake up DOWN backends */
+
+	guint breaker_error_rate;      /**< open the breaker of a backend if this percent of its requests failed, 0 to only open it on failed connects */
+	guint64 breaker_slow_usec;     /**< a query that took longer failed, 0 to disable */
+	guint breaker_half_open_share; /**< the percent of the picks a HALF_OPEN backend takes part in */
+
+	guint pool_shards;      /**< number of connection pools per backend, one per event-thread */
+
+	gboolean use_local_sockets; /**< connect to the backends on this host through a unix-socket, see network_backends_use_local_sockets() */
+	gchar *local_socket;        /**< the unix-socket of the mysqld on this host, NULL to look for it */
+
+	gchar *source_addresses;    /**< the source addresses of the backends without their own, see network_backends_set_source_addresses() */
 } network_backends_t;
 
 NETWORK_API network_backends_t *network_backends_new();
 NETWORK_API void network_backends_free(network_backends_t *);
 NETWORK_API int network_backends_add(network_backends_t *backends, /* const */ gchar *address, backend_type_t type);
+NETWORK_API int network_backends_reload(network_backends_t *backends, gchar **rw_addresses, gchar **ro_addresses);
 NETWORK_API int network_backends_check(network_backends_t *backends);
 NETWORK_API network_backend_t * network_backends_get(network_backends_t *backends, guint ndx);
+NETWORK_API GPtrArray *network_backends_get_snapshot(network_backends_t *backends);
 NETWORK_API guint network_backends_count(network_backends_t *backends);
+NETWORK_API void network_backends_set_pool_shards(network_backends_t *backends, guint shards);
+NETWORK_API void network_backends_use_local_sockets(network_backends_t *backends, const gchar *path);
+NETWORK_API const gchar *network_backends_find_local_socket(void);
+NETWORK_API int network_backends_set_source_addresses(network_backends_t *backends, const gchar *spec, GError **gerr);
+NETWORK_API int network_backends_get_least_connected(network_backends_t *backends, backend_type_t type);
+NETWORK_API gboolean network_backends_breaker_admit(network_backends_t *backends, network_backend_t *b);
+NETWORK_API void network_backends_breaker_record(network_backends_t *backends, network_backend_t *b, gboolean is_failed, guint64 usec, guint64 now_usec);
+NETWORK_API int network_backends_get_least_latency(network_backends_t *backends, backend_type_t type);
+NETWORK_API int network_backends_get_least_latency_at_pos(network_backends_t *backends, backend_type_t type, guint64 min_binlog_pos);
+NETWORK_API int network_backends_get_by_key_at_pos(network_backends_t *backends, backend_type_t type, const char *key, gsize key_len,
+		guint64 min_binlog_pos, guint load_factor);
+NETWORK_API int network_backends_add_group(network_backends_t *backends, const gchar *spec, GError **gerr);
+NETWORK_API network_backend_group_t *network_backends_get_group(network_backends_t *backends, const gchar *name);
+NETWORK_API int network_backends_get_from_group(network_backends_t *backends, network_backend_group_t *group);
 
 #endif /* _BACKEND_H_ */
 
@@ -0,0 +1,181 @@
+/* $%BEGINLICENSE%$
+ Copyright (c) 2009, 2012, Oracle and/or its affiliates. All rights reserved.
+
+ This program is free software; you can redistribute it and/or
+ modify it under the terms of the GNU General Public License as
+ published by the Free Software Foundation; version 2 of the
+ License.
+
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ GNU General Public License for more details.
+
+ You should have received a copy of the GNU General Public License
+ along with this program; if not, write to the Free Software
+ Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA
+ 02110-1301  USA
+
+ $%ENDLICENSE%$ */
+ 
+/**
+ * a per-thread pool of I/O buffers
+ *
+ * network_socket_read() allocates a buffer for each read() and network_queue_pop_string()
+ * frees it again as soon as all packets are taken from it. Instead of handing the buffer
+ * back to malloc() we keep them in a small free-list per thread and reuse them for the
+ * next read.
+ *
+ * the pool has a free-list for each size-class (16k, 32k, ..., 256k) to also serve the 
+ * larger reads of network_socket_read_adaptive() which grow with the traffic of the socket.
+ *
+ * buffers are plain GStrings, if they leave the network_queue (e.g. because the chunk 
+ * contains exactly one packet) they are free()d with g_string_free() as before.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include "network-buffer-pool.h"
+
+typedef struct {
+	GQueue *buffers[NETWORK_BUFFER_POOL_CLASSES];
+} network_buffer_pool;
+
+static volatile gint pool_hits = 0;
+static volatile gint pool_misses = 0;
+static volatile gint pool_idle = 0;
+static volatile gint pool_idle_max = 0;
+
+static GStaticPrivate pool_key = G_STATIC_PRIVATE_INIT;
+
+static void network_buffer_pool_free(gpointer _pool) {
+	network_buffer_pool *pool = _pool;
+	GString *buf;
+	guint i;
+
+	for (i = 0; i < NETWORK_BUFFER_POOL_CLASSES; i++) {
+		while ((buf = g_queue_pop_head(pool->buffers[i]))) {
+			g_string_free(buf, TRUE);
+			g_atomic_int_add(&pool_idle, -1);
+		}
+		g_queue_free(pool->buffers[i]);
+	}
+
+	g_free(pool);
+}
+
+/**
+ * get the pool of the current thread, create it if it doesn't exist yet
+ */
+static network_buffer_pool *network_buffer_pool_get_local(void) {
+	network_buffer_pool *pool;
+	guint i;
+
+	if (NULL == (pool = g_static_private_get(&pool_key))) {
+		pool = g_new0(network_buffer_pool, 1);
+		for (i = 0; i < NETWORK_BUFFER_POOL_CLASSES; i++) {
+			pool->buffers[i] = g_queue_new();
+		}
+
+		g_static_private_set(&pool_key, pool, network_buffer_pool_free);
+	}
+
+	return pool;
+}
+
+/**
+ * get the smallest size-class whose buffers can hold size bytes
+ *
+ * @return the size-class or -1 if size is too large for the pool
+ */
+static gint network_buffer_pool_get_class(gsize size) {
+	gint i;
+
+	for (i = 0; i < NETWORK_BUFFER_POOL_CLASSES; i++) {
+		if (size <= ((gsize)NETWORK_BUFFER_POOL_CHUNK_SIZE << i)) return i;
+	}
+
+	return -1;
+}
+
+/**
+ * get a empty buffer that can hold at least size bytes
+ *
+ * @param size   bytes we want to store in the buffer
+ * @return a empty GString
+ */
+GString *network_buffer_pool_get(gsize size) {
+	network_buffer_pool *pool;
+	GString *buf;
+	gint size_class;
+
+	if (-1 == (size_class = network_buffer_pool_get_class(size))) {
+		/* too large for the pool */
+		return g_string_sized_new(size);
+	}
+
+	pool = network_buffer_pool_get_local();
+
+	if (NULL != (buf = g_queue_pop_head(pool->buffers[size_class]))) {
+		g_atomic_int_inc(&pool_hits);
+		g_atomic_int_add(&pool_idle, -1);
+
+		return buf;
+	}
+
+	g_atomic_int_inc(&pool_misses);
+
+	return g_string_sized_new((gsize)NETWORK_BUFFER_POOL_CHUNK_SIZE << size_class);
+}
+
+/**
+ * return a buffer to the pool of the current thread
+ *
+ * buffers that don't fit into the pool or exceed the pool-size are free()d
+ */
+void network_buffer_pool_put(GString *buf) {
+	network_buffer_pool *pool;
+	gint cur_idle;
+	gint size_class;
+
+	if (!buf) return;
+
+	/* only take buffers back which have the size of a size-class, not the huge ones
+	 *
+	 * g_string_sized_new() rounds up to the next power of 2 above the requested size, 
+	 * the buffers of a class have more than (chunk-size << class) and at most twice of it allocated */
+	if (buf->allocated_len <= NETWORK_BUFFER_POOL_CHUNK_SIZE ||
+	    -1 == (size_class = network_buffer_pool_get_class(buf->allocated_len / 2))) {
+		g_string_free(buf, TRUE);
+		return;
+	}
+
+	pool = network_buffer_pool_get_local();
+
+	if (pool->buffers[size_class]->length >= (NETWORK_BUFFER_POOL_MAX_IDLE >> size_class)) {
+		g_string_free(buf, TRUE);
+		return;
+	}
+
+	g_string_truncate(buf, 0);
+	g_queue_push_head(pool->buffers[size_class], buf); /* LIFO, the last used buffer is still in the cache */
+
+	g_atomic_int_inc(&pool_idle);
+	cur_idle = g_atomic_int_get(&pool_idle);
+	if (cur_idle > g_atomic_int_get(&pool_idle_max)) {
+		g_atomic_int_set(&pool_idle_max, cur_idle);
+	}
+}
+
+/**
+ * get the counters of all buffer-pools
+ */
+void network_buffer_pool_get_stats(network_buffer_pool_stats_t *stats) {
+	stats->hits     = g_atomic_int_get(&pool_hits);
+	stats->misses   = g_atomic_int_get(&pool_misses);
+	stats->idle     = g_atomic_int_get(&pool_idle);
+	stats->idle_max = g_atomic_int_get(&pool_idle_max);
+}
+
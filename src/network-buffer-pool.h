@@ -0,0 +1,63 @@
+/* $%BEGINLICENSE%$
+ Copyright (c) 2009, 2012, Oracle and/or its affiliates. All rights reserved.
+
+ This program is free software; you can redistribute it and/or
+ modify it under the terms of the GNU General Public License as
+ published by the Free Software Foundation; version 2 of the
+ License.
+
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ GNU General Public License for more details.
+
+ You should have received a copy of the GNU General Public License
+ along with this program; if not, write to the Free Software
+ Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA
+ 02110-1301  USA
+
+ $%ENDLICENSE%$ */
+ 
+
+#ifndef _NETWORK_BUFFER_POOL_H_
+#define _NETWORK_BUFFER_POOL_H_
+
+#include <glib.h>
+
+#include "network-exports.h"
+
+/**
+ * size of the smallest buffers kept in the per-thread buffer-pools
+ *
+ * each size-class holds buffers twice as large as the one before:
+ * 16k, 32k, ... up to NETWORK_BUFFER_POOL_CHUNK_SIZE << (NETWORK_BUFFER_POOL_CLASSES - 1)
+ */
+#define NETWORK_BUFFER_POOL_CHUNK_SIZE (16 * 1024)
+
+/**
+ * number of size-classes of the pool
+ *
+ * reads up to the size of the largest class (256k) are served from the pool, 
+ * larger reads get their own buffer
+ */
+#define NETWORK_BUFFER_POOL_CLASSES 5
+
+/**
+ * number of idle buffers each thread keeps at most in the smallest class
+ *
+ * each larger class keeps half as many buffers as the one before
+ */
+#define NETWORK_BUFFER_POOL_MAX_IDLE 64
+
+typedef struct {
+	guint hits;          /**< buffers handed out from the pool */
+	guint misses;        /**< buffers that had to be allocated */
+	guint idle;          /**< buffers currently idling in all pools */
+	guint idle_max;      /**< high-water mark of .idle */
+} network_buffer_pool_stats_t;
+
+NETWORK_API GString *network_buffer_pool_get(gsize size);
+NETWORK_API void network_buffer_pool_put(GString *buf);
+NETWORK_API void network_buffer_pool_get_stats(network_buffer_pool_stats_t *stats);
+
+#endif
@@ -0,0 +1,399 @@
+/* $%BEGINLICENSE%$
+ Copyright (c) 2008, 2012, Oracle and/or its affiliates. All rights reserved.
+
+ This program is free software; you can redistribute it and/or
+ modify it under the terms of the GNU General Public License as
+ published by the Free Software Foundation; version 2 of the
+ License.
+
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ GNU General Public License for more details.
+
+ You should have received a copy of the GNU General Public License
+ along with this program; if not, write to the Free Software
+ Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA
+ 02110-1301  USA
+
+ $%ENDLICENSE%$ */
+/**
+ * the traffic capture
+ *
+ * the event-threads encode the packets of their clients as records and queue them, the
+ * writer-thread writes the queued records in batches like the query-log does. The capture
+ * is replayed by the loadgen plugin with --loadgen-replay.
+ *
+ * the file starts with NETWORK_CAPTURE_MAGIC, the records follow back to back:
+ *
+ *   ts_usec (8) | con_id (4) | type (1) | payload_len (4) | payload
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#ifndef WIN32
+#include <unistd.h> /* write, close */
+#else
+#include <io.h>
+#endif
+
+#include <glib.h>
+
+#include "network-capture.h"
+
+#define C(x) x, sizeof(x) - 1
+
+GQuark network_capture_error(void) {
+	return g_quark_from_static_string("network-capture-error-quark");
+}
+
+static void network_capture_append_int(GString *dst, guint64 v, guint size) {
+	guint i;
+
+	for (i = 0; i < size; i++) {
+		g_string_append_c(dst, (v >> (i * 8)) & 0xff);
+	}
+}
+
+static guint64 network_capture_get_int(const guchar *s, guint size) {
+	guint64 v = 0;
+	guint i;
+
+	for (i = 0; i < size; i++) {
+		v |= ((guint64)s[i]) << (i * 8);
+	}
+
+	return v;
+}
+
+/**
+ * encode a record
+ */
+void network_capture_record_append(GString *dst, guint64 ts_usec, guint32 con_id, network_capture_type_t type, const char *payload, gsize payload_len) {
+	network_capture_append_int(dst, ts_usec, 8);
+	network_capture_append_int(dst, con_id, 4);
+	network_capture_append_int(dst, type, 1);
+	network_capture_append_int(dst, payload_len, 4);
+	if (payload_len > 0) g_string_append_len(dst, payload, payload_len);
+}
+
+network_capture_t *network_capture_new(void) {
+	network_capture_t *capture;
+
+	capture = g_new0(network_capture_t, 1);
+	capture->fd = -1;
+	capture->queue = g_queue_new();
+	capture->mutex = g_mutex_new();
+	capture->cond = g_cond_new();
+
+	return capture;
+}
+
+/**
+ * write the buffer, retry on short writes
+ */
+static int network_capture_write(network_capture_t *capture, const char *s, gsize s_len) {
+	gsize written = 0;
+
+	while (written < s_len) {
+		gssize len = write(capture->fd, s + written, s_len - written);
+
+		if (len < 0) {
+			if (errno == EINTR) continue;
+
+			return -1;
+		}
+
+		written += len;
+	}
+
+	return 0;
+}
+
+/**
+ * write batches of records until we are shut down
+ */
+static gpointer network_capture_writer_thread(gpointer user_data) {
+	network_capture_t *capture = user_data;
+	GQueue *batch = g_queue_new();
+	GString *buf = g_string_sized_new(NETWORK_CAPTURE_BATCH_BYTES);
+	gboolean is_write_failed = FALSE;
+
+	for (;;) {
+		GString *record;
+		gboolean is_shutdown;
+		GQueue *q;
+
+		g_mutex_lock(capture->mutex);
+		while (0 == capture->queue->length && !g_atomic_int_get(&capture->is_shutdown)) {
+			GTimeVal timeout;
+
+			g_get_current_time(&timeout);
+			g_time_val_add(&timeout, G_USEC_PER_SEC);
+
+			g_cond_timed_wait(capture->cond, capture->mutex, &timeout);
+		}
+		is_shutdown = g_atomic_int_get(&capture->is_shutdown);
+
+		/* take all the records and leave an empty queue for the producers */
+		q = capture->queue;
+		capture->queue = batch;
+		capture->queued_bytes = 0;
+		batch = q;
+		g_mutex_unlock(capture->mutex);
+
+		g_string_truncate(buf, 0);
+		while ((record = g_queue_pop_head(batch))) {
+			g_string_append_len(buf, record->str, record->len);
+			g_string_free(record, TRUE);
+
+			g_atomic_int_inc(&capture->written);
+		}
+
+		if (buf->len > 0 && 0 != network_capture_write(capture, buf->str, buf->len)) {
+			/* don't flood the error-log, one message until a write works again */
+			if (!is_write_failed) {
+				g_critical("%s: writing to the capture %s failed: %s (%d)",
+						G_STRLOC,
+						capture->filename,
+						g_strerror(errno), errno);
+			}
+			is_write_failed = TRUE;
+		} else {
+			is_write_failed = FALSE;
+		}
+
+		/* don't keep a buffer of a burst */
+		if (buf->allocated_len > 4 * NETWORK_CAPTURE_BATCH_BYTES) {
+			g_string_free(buf, TRUE);
+			buf = g_string_sized_new(NETWORK_CAPTURE_BATCH_BYTES);
+		}
+
+		if (is_shutdown) break;
+	}
+
+	g_queue_free(batch);
+	g_string_free(buf, TRUE);
+
+	return NULL;
+}
+
+/**
+ * create the capture file and start the writer-thread
+ *
+ * @return 0 on success, -1 on error
+ */
+int network_capture_open(network_capture_t *capture, const gchar *filename, GError **gerr) {
+	GError *thread_gerr = NULL;
+
+	g_return_val_if_fail(-1 == capture->fd, -1);
+
+	capture->fd = open(filename, O_WRONLY | O_CREAT | O_TRUNC, 0660);
+	if (-1 == capture->fd) {
+		g_set_error(gerr, NETWORK_CAPTURE_ERROR, NETWORK_CAPTURE_ERROR_OPEN,
+				"opening %s failed: %s (%d)",
+				filename,
+				g_strerror(errno), errno);
+
+		return -1;
+	}
+
+	if (0 != network_capture_write(capture, C(NETWORK_CAPTURE_MAGIC))) {
+		g_set_error(gerr, NETWORK_CAPTURE_ERROR, NETWORK_CAPTURE_ERROR_OPEN,
+				"writing to %s failed: %s (%d)",
+				filename,
+				g_strerror(errno), errno);
+
+		close(capture->fd);
+		capture->fd = -1;
+
+		return -1;
+	}
+	capture->filename = g_strdup(filename);
+
+	capture->is_shutdown = 0;
+	capture->writer_thread = g_thread_create(network_capture_writer_thread, capture, TRUE, &thread_gerr);
+	if (NULL == capture->writer_thread) {
+		g_set_error(gerr, NETWORK_CAPTURE_ERROR, NETWORK_CAPTURE_ERROR_THREAD,
+				"starting the writer of %s failed: %s",
+				filename,
+				thread_gerr->message);
+		g_error_free(thread_gerr);
+
+		close(capture->fd);
+		capture->fd = -1;
+
+		return -1;
+	}
+
+	return 0;
+}
+
+/**
+ * flush the queued records and close the file
+ */
+void network_capture_free(network_capture_t *capture) {
+	GString *record;
+
+	if (!capture) return;
+
+	if (capture->writer_thread) {
+		g_mutex_lock(capture->mutex);
+		g_atomic_int_set(&capture->is_shutdown, 1);
+		g_cond_signal(capture->cond);
+		g_mutex_unlock(capture->mutex);
+
+		g_thread_join(capture->writer_thread);
+	}
+
+	if (-1 != capture->fd) close(capture->fd);
+	if (capture->filename) g_free(capture->filename);
+
+	while ((record = g_queue_pop_head(capture->queue))) g_string_free(record, TRUE);
+	g_queue_free(capture->queue);
+	g_mutex_free(capture->mutex);
+	g_cond_free(capture->cond);
+
+	g_free(capture);
+}
+
+gboolean network_capture_is_open(network_capture_t *capture) {
+	return capture != NULL && capture->writer_thread != NULL;
+}
+
+/**
+ * number a connection of the capture
+ */
+guint32 network_capture_con_id_new(network_capture_t *capture) {
+	return g_atomic_int_exchange_and_add(&capture->next_con_id, 1) + 1;
+}
+
+/**
+ * queue a record for the writer
+ *
+ * the record is encoded by the caller's thread, the lock is only held to queue it
+ *
+ * @return FALSE if the queue was full and the record got dropped
+ */
+gboolean network_capture_push(network_capture_t *capture, guint32 con_id, network_capture_type_t type, const char *payload, gsize payload_len) {
+	GString *record;
+	GTimeVal now;
+	gboolean is_queued = FALSE;
+
+	g_get_current_time(&now);
+
+	record = g_string_sized_new(NETWORK_CAPTURE_RECORD_HEADER_SIZE + payload_len);
+	network_capture_record_append(record,
+			(guint64)now.tv_sec * G_USEC_PER_SEC + now.tv_usec,
+			con_id, type, payload, payload_len);
+
+	g_mutex_lock(capture->mutex);
+	if (capture->queued_bytes + record->len <= NETWORK_CAPTURE_MAX_QUEUED_BYTES) {
+		gboolean was_below = capture->queued_bytes < NETWORK_CAPTURE_BATCH_BYTES;
+
+		g_queue_push_tail(capture->queue, record);
+		capture->queued_bytes += record->len;
+		is_queued = TRUE;
+
+		/* the writer wakes up every second anyway */
+		if (was_below && capture->queued_bytes >= NETWORK_CAPTURE_BATCH_BYTES) g_cond_signal(capture->cond);
+	}
+	g_mutex_unlock(capture->mutex);
+
+	if (!is_queued) {
+		g_atomic_int_inc(&capture->dropped);
+		g_string_free(record, TRUE);
+	}
+
+	return is_queued;
+}
+
+network_capture_record_t *network_capture_record_new(void) {
+	network_capture_record_t *record;
+
+	record = g_new0(network_capture_record_t, 1);
+	record->payload = g_string_new(NULL);
+
+	return record;
+}
+
+void network_capture_record_free(network_capture_record_t *record) {
+	if (!record) return;
+
+	g_string_free(record->payload, TRUE);
+
+	g_free(record);
+}
+
+/**
+ * open a capture file and check its magic
+ */
+network_capture_reader_t *network_capture_reader_open(const gchar *filename, GError **gerr) {
+	network_capture_reader_t *reader;
+	char magic[sizeof(NETWORK_CAPTURE_MAGIC) - 1];
+	FILE *f;
+
+	if (NULL == (f = fopen(filename, "rb"))) {
+		g_set_error(gerr, NETWORK_CAPTURE_ERROR, NETWORK_CAPTURE_ERROR_OPEN,
+				"opening %s failed: %s (%d)",
+				filename,
+				g_strerror(errno), errno);
+
+		return NULL;
+	}
+
+	if (1 != fread(magic, sizeof(magic), 1, f) ||
+	    0 != memcmp(magic, C(NETWORK_CAPTURE_MAGIC))) {
+		g_set_error(gerr, NETWORK_CAPTURE_ERROR, NETWORK_CAPTURE_ERROR_FORMAT,
+				"%s isn't a capture file",
+				filename);
+		fclose(f);
+
+		return NULL;
+	}
+
+	reader = g_new0(network_capture_reader_t, 1);
+	reader->filename = g_strdup(filename);
+	reader->f = f;
+
+	return reader;
+}
+
+void network_capture_reader_free(network_capture_reader_t *reader) {
+	if (!reader) return;
+
+	if (reader->f) fclose(reader->f);
+	g_free(reader->filename);
+
+	g_free(reader);
+}
+
+/**
+ * read the next record
+ *
+ * @return 1 if a record was read, 0 at the end of the file, -1 if the record is truncated
+ */
+int network_capture_reader_next(network_capture_reader_t *reader, network_capture_record_t *record) {
+	guchar header[NETWORK_CAPTURE_RECORD_HEADER_SIZE];
+	gsize payload_len;
+	size_t len;
+
+	len = fread(header, 1, sizeof(header), reader->f);
+	if (len == 0 && feof(reader->f)) return 0;
+	if (len != sizeof(header)) return -1;
+
+	record->ts_usec = network_capture_get_int(header, 8);
+	record->con_id  = network_capture_get_int(header + 8, 4);
+	record->type    = network_capture_get_int(header + 12, 1);
+	payload_len     = network_capture_get_int(header + 13, 4);
+
+	g_string_set_size(record->payload, payload_len);
+	if (payload_len > 0 && 1 != fread(record->payload->str, payload_len, 1, reader->f)) return -1;
+
+	return 1;
+}
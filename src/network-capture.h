@@ -0,0 +1,123 @@
+/* $%BEGINLICENSE%$
+ Copyright (c) 2008, 2012, Oracle and/or its affiliates. All rights reserved.
+
+ This program is free software; you can redistribute it and/or
+ modify it under the terms of the GNU General Public License as
+ published by the Free Software Foundation; version 2 of the
+ License.
+
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ GNU General Public License for more details.
+
+ You should have received a copy of the GNU General Public License
+ along with this program; if not, write to the Free Software
+ Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA
+ 02110-1301  USA
+
+ $%ENDLICENSE%$ */
+#ifndef __NETWORK_CAPTURE_H__
+#define __NETWORK_CAPTURE_H__
+
+#include <stdio.h> /* FILE */
+
+#include <glib.h>
+
+#include "network-exports.h"
+
+/**
+ * the first bytes of a capture file
+ */
+#define NETWORK_CAPTURE_MAGIC "MYPXCAP1"
+
+/**
+ * bytes of a record before its payload: ts (8), con-id (4), type (1), payload-len (4)
+ */
+#define NETWORK_CAPTURE_RECORD_HEADER_SIZE 17
+
+/**
+ * bytes of records that may wait for the writer, more are dropped
+ */
+#define NETWORK_CAPTURE_MAX_QUEUED_BYTES (64 * 1024 * 1024)
+
+/**
+ * wake up the writer once that many bytes are queued
+ */
+#define NETWORK_CAPTURE_BATCH_BYTES (256 * 1024)
+
+typedef enum {
+	NETWORK_CAPTURE_CONNECT = 1, /**< a client logged in, the payload is <user>\0<db> */
+	NETWORK_CAPTURE_PACKET  = 2, /**< a packet the client sent, with its network-header */
+	NETWORK_CAPTURE_CLOSE   = 3  /**< the client is gone, no payload */
+} network_capture_type_t;
+
+/**
+ * a record of a capture file
+ *
+ * all integers are little-endian
+ */
+typedef struct {
+	guint64 ts_usec;             /**< wall-clock micro-seconds */
+	guint32 con_id;              /**< numbers the connections of the capture, starts at 1 */
+	network_capture_type_t type;
+	GString *payload;
+} network_capture_record_t;
+
+/**
+ * the traffic of the clients written as binary records by a thread of its own
+ *
+ * the event-threads only queue their records. The writer swaps the queue and writes all
+ * the records at once, a slow disk only fills the queue and drops records, it never
+ * blocks a client.
+ */
+typedef struct {
+	gchar *filename;
+	int fd;                          /**< -1 if not open */
+
+	GQueue *queue;                   /**< GString of encoded records waiting for the writer */
+	gsize queued_bytes;
+	GMutex *mutex;                   /**< protects .queue and .queued_bytes */
+	GCond *cond;
+
+	GThread *writer_thread;
+	volatile gint is_shutdown;
+
+	volatile gint next_con_id;
+	volatile gint dropped;           /**< records dropped as the queue was full */
+	volatile gint written;           /**< records written to the file */
+} network_capture_t;
+
+NETWORK_API network_capture_t *network_capture_new(void);
+NETWORK_API void network_capture_free(network_capture_t *capture);
+NETWORK_API int network_capture_open(network_capture_t *capture, const gchar *filename, GError **gerr);
+NETWORK_API gboolean network_capture_is_open(network_capture_t *capture);
+NETWORK_API guint32 network_capture_con_id_new(network_capture_t *capture);
+NETWORK_API gboolean network_capture_push(network_capture_t *capture, guint32 con_id, network_capture_type_t type, const char *payload, gsize payload_len);
+NETWORK_API void network_capture_record_append(GString *dst, guint64 ts_usec, guint32 con_id, network_capture_type_t type, const char *payload, gsize payload_len);
+
+/**
+ * reads a capture file record by record
+ */
+typedef struct {
+	gchar *filename;
+	FILE *f;
+} network_capture_reader_t;
+
+NETWORK_API network_capture_reader_t *network_capture_reader_open(const gchar *filename, GError **gerr);
+NETWORK_API void network_capture_reader_free(network_capture_reader_t *reader);
+NETWORK_API int network_capture_reader_next(network_capture_reader_t *reader, network_capture_record_t *record);
+
+NETWORK_API network_capture_record_t *network_capture_record_new(void);
+NETWORK_API void network_capture_record_free(network_capture_record_t *record);
+
+#define NETWORK_CAPTURE_ERROR network_capture_error()
+NETWORK_API GQuark network_capture_error(void);
+
+typedef enum {
+	NETWORK_CAPTURE_ERROR_OPEN,      /**< the file couldn't be opened */
+	NETWORK_CAPTURE_ERROR_THREAD,    /**< the writer-thread couldn't be started */
+	NETWORK_CAPTURE_ERROR_FORMAT     /**< the file isn't a capture */
+} network_capture_error_t;
+
+#endif
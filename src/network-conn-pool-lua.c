@@ -125,6 +125,16 @@ static int proxy_pool_get(lua_State *L) {
 		lua_pushinteger(L, pool->max_idle_connections);
 	} else if (strleq(key, keysize, C("min_idle_connections"))) {
 		lua_pushinteger(L, pool->min_idle_connections);
+	} else if (strleq(key, keysize, C("hits_session"))) {
+		lua_pushinteger(L, pool->stats.hits_session);
+	} else if (strleq(key, keysize, C("hits_default_db"))) {
+		lua_pushinteger(L, pool->stats.hits_default_db);
+	} else if (strleq(key, keysize, C("hits_user"))) {
+		lua_pushinteger(L, pool->stats.hits_user);
+	} else if (strleq(key, keysize, C("hits_donor"))) {
+		lua_pushinteger(L, pool->stats.hits_donor);
+	} else if (strleq(key, keysize, C("misses"))) {
+		lua_pushinteger(L, pool->stats.misses);
 	} else if (strleq(key, keysize, C("users"))) {
 		network_connection_pool **pool_p;
 
@@ -199,25 +209,44 @@ static void network_mysqld_con_idle_handle(int event_fd, short events, void *use
 }
 
 
+/**
+ * add a authed server connection to the pool of this event-thread
+ *
+ * the pool watches the idling connection for a close from the server side
+ */
+void network_connection_pool_lua_add_socket(chassis *srv, network_connection_pool *pool, network_socket *sock) {
+	network_connection_pool_entry *pool_entry;
+
+	sock->is_authed = 1;
+
+	pool_entry = network_connection_pool_add(pool, sock);
+
+	/* the pool waits without a timeout, the connection may still have the socket registered */
+	network_socket_event_del(sock);
+	event_set(&(sock->event), sock->fd, EV_READ, network_mysqld_con_idle_handle, pool_entry);
+	chassis_event_add_local(srv, &(sock->event)); /* add a event, but stay in the same thread */
+}
+
 /**
  * move the con->server into connection pool and disconnect the 
  * proxy from its backend 
  */
 int network_connection_pool_lua_add_connection(network_mysqld_con *con) {
-	network_connection_pool_entry *pool_entry = NULL;
 	network_mysqld_con_lua_t *st = con->plugin_con_state;
 
 	/* con-server is already disconnected, got out */
 	if (!con->server) return 0;
 
-	/* the server connection is still authed */
-	con->server->is_authed = 1;
-
-	/* insert the server socket into the connection pool */
-	pool_entry = network_connection_pool_add(st->backend->pool, con->server);
-
-	event_set(&(con->server->event), con->server->fd, EV_READ, network_mysqld_con_idle_handle, pool_entry);
-	chassis_event_add_local(con->srv, &(con->server->event)); /* add a event, but stay in the same thread */
+	if (st->backend->is_removed) {
+		/* a reload dropped the backend, don't keep its connections around */
+		network_socket_free(con->server);
+	} else {
+		/* the server connection is still authed, insert it into the connection pool
+		 * the idle-event stays in this thread, use the pool of this thread */
+		network_connection_pool_lua_add_socket(con->srv,
+				network_backend_get_pool(st->backend, chassis_event_thread_get_local_index()),
+				con->server);
+	}
 	
 	st->backend->connected_clients--;
 	st->backend = NULL;
@@ -257,14 +286,18 @@ network_socket *network_connection_pool_lua_swap(network_mysqld_con *con, int ba
 	 * get a connection from the pool which matches our basic requirements
 	 * - username has to match
 	 * - default_db should match
+	 * - charset and autocommit should match the current session
 	 */
 		
 #ifdef DEBUG_CONN_POOL
 	g_debug("%s: (swap) check if we have a connection for this user in the pool '%s'", G_STRLOC, con->client->username->str);
 #endif
-	if (NULL == (send_sock = network_connection_pool_get(backend->pool, 
+	if (NULL == (send_sock = network_connection_pool_get_full(network_backend_get_pool(backend, chassis_event_thread_get_local_index()), 
 					con->client->response ? con->client->response->username : &empty_username,
-					con->client->default_db))) {
+					con->client->default_db,
+					con->client->response ? con->client->response->charset : 0,
+					con->server ? (con->server->server_status & SERVER_STATUS_AUTOCOMMIT) != 0 : TRUE,
+					network_mysqld_socket_is_deprecate_eof(con->client)))) {
 		/**
 		 * no connections in the pool
 		 */
@@ -31,5 +31,6 @@ NETWORK_API int network_connection_pool_getmetatable(lua_State *L);
 
 NETWORK_API int network_connection_pool_lua_add_connection(network_mysqld_con *con);
 NETWORK_API network_socket *network_connection_pool_lua_swap(network_mysqld_con *con, int backend_ndx);
+NETWORK_API void network_connection_pool_lua_add_socket(chassis *srv, network_connection_pool *pool, network_socket *sock);
 
 #endif
@@ -24,8 +24,16 @@
 #include "network-conn-pool.h"
 #include "network-mysqld-packet.h"
 #include "glib-ext.h"
+#include "chassis-timings.h"
 #include "sys-pedantic.h"
 
+#if defined(HAVE_SYS_SDT_H) && defined(ENABLE_DTRACE)
+#include <sys/sdt.h>
+#include "proxy-dtrace-provider.h"
+#else
+#include "disable-dtrace.h"
+#endif
+
 /** @file
  * connection pools
  *
@@ -69,22 +77,45 @@ void network_connection_pool_entry_free(network_connection_pool_entry *e, gboole
 }
 
 /**
- * free all pool entries of the queue
+ * create a empty user-bucket
+ *
+ * @param username the name of the user, is copied
+ */
+static network_connection_pool_user *network_connection_pool_user_new(GString *username) {
+	network_connection_pool_user *user;
+
+	user = g_new0(network_connection_pool_user, 1);
+	user->username = g_string_dup(username);
+	user->conns = g_queue_new();
+	/* the queues in the db-hash only reference the entries of user->conns */
+	user->dbs = g_hash_table_new_full(g_hash_table_string_hash, g_hash_table_string_equal, g_hash_table_string_free, (GDestroyNotify)g_queue_free);
+
+	return user;
+}
+
+/**
+ * free a user-bucket and all its pool entries
  *
  * used as GDestroyFunc in the user-hash of the pool
  *
- * @param q a GQueue to free
+ * @param _user a network_connection_pool_user to free
  *
  * @see network_connection_pool_new
  * @see GDestroyFunc
  */
-static void g_queue_free_all(gpointer q) {
-	GQueue *queue = q;
+static void network_connection_pool_user_free(gpointer _user) {
+	network_connection_pool_user *user = _user;
 	network_connection_pool_entry *entry;
 
-	while ((entry = g_queue_pop_head(queue))) network_connection_pool_entry_free(entry, TRUE);
+	if (!user) return;
+
+	while ((entry = g_queue_pop_head(user->conns))) network_connection_pool_entry_free(entry, TRUE);
 
-	g_queue_free(queue);
+	g_queue_free(user->conns);
+	g_hash_table_destroy(user->dbs);
+	g_string_free(user->username, TRUE);
+
+	g_free(user);
 }
 
 /**
@@ -102,7 +133,10 @@ network_connection_pool *network_connection_pool_new(void) {
 
 	pool = g_new0(network_connection_pool, 1);
 
-	pool->users = g_hash_table_new_full(g_hash_table_string_hash, g_hash_table_string_equal, g_hash_table_string_free, g_queue_free_all);
+	/* the key is owned by the user-bucket */
+	pool->users = g_hash_table_new_full(g_hash_table_string_hash, g_hash_table_string_equal, NULL, network_connection_pool_user_free);
+	pool->donors = g_queue_new();
+	pool->waiters = g_queue_new();
 
 	return pool;
 }
@@ -112,8 +146,21 @@ network_connection_pool *network_connection_pool_new(void) {
  *
  */
 void network_connection_pool_free(network_connection_pool *pool) {
+	GList *link;
+
 	if (!pool) return;
 
+	g_queue_free(pool->donors);
+
+	/* the waiters are owned by their clients, they time out */
+	while (NULL != (link = g_queue_pop_head_link(pool->waiters))) {
+		network_connection_pool_waiter *waiter = link->data;
+
+		waiter->is_waiting = FALSE;
+		waiter->pool = NULL;
+	}
+	g_queue_free(pool->waiters);
+
 	g_hash_table_foreach_remove(pool->users, g_hash_table_true, NULL);
 
 	g_hash_table_destroy(pool->users);
@@ -122,92 +169,255 @@ void network_connection_pool_free(network_connection_pool *pool) {
 }
 
 /**
- * find the entry which has more than max_idle connections idling
- * 
- * @return TRUE for the first entry having more than _user_data idling connections
- * @see network_connection_pool_get_conns 
+ * update the position of the user in the donor list
+ *
+ * called after each change of user->conns->length. As the length only changes by one
+ * a user that overtakes the current head moves to the front, everyone else stays in place.
+ * That keeps the biggest donor up front without sorting.
  */
-static gboolean find_idle_conns(gpointer UNUSED_PARAM(_key), gpointer _val, gpointer _user_data) {
-	guint min_idle_conns = *(gint *)_user_data;
-	GQueue *conns = _val;
+static void network_connection_pool_user_update_donor(network_connection_pool *pool, network_connection_pool_user *user) {
+	if (user->conns->length > pool->min_idle_connections) {
+		network_connection_pool_user *head;
+
+		if (!user->donor_link) {
+			g_queue_push_tail(pool->donors, user);
+			user->donor_link = pool->donors->tail;
+		}
 
-	return (conns->length > min_idle_conns);
+		if (user->donor_link == pool->donors->head) return;
+
+		head = pool->donors->head->data;
+
+		if (user->conns->length > head->conns->length) {
+			g_queue_unlink(pool->donors, user->donor_link);
+			g_queue_push_head_link(pool->donors, user->donor_link);
+		}
+	} else if (user->donor_link) {
+		g_queue_delete_link(pool->donors, user->donor_link);
+		user->donor_link = NULL;
+	}
 }
 
-GQueue *network_connection_pool_get_conns(network_connection_pool *pool, GString *username, GString *UNUSED_PARAM(default_db)) {
-	GQueue *conns = NULL;
+/**
+ * get the user with the biggest surplus of idling connections
+ *
+ * min_idle_connections may have been raised since the donor list was updated,
+ * drop the donors that have no surplus anymore
+ *
+ * @return NULL if no user has more than min_idle_connections idling
+ */
+static network_connection_pool_user *network_connection_pool_get_donor(network_connection_pool *pool) {
+	network_connection_pool_user *user;
+
+	while ((user = g_queue_peek_head(pool->donors))) {
+		if (user->conns->length > pool->min_idle_connections) return user;
 
+		g_queue_delete_link(pool->donors, user->donor_link);
+		user->donor_link = NULL;
+	}
+
+	return NULL;
+}
+
+/**
+ * get the user-bucket for the username or a donor if we don't know the user 
+ */
+static network_connection_pool_user *network_connection_pool_get_user(network_connection_pool *pool, GString *username) {
+	network_connection_pool_user *user = NULL;
 
 	if (username && username->len > 0) {
-		conns = g_hash_table_lookup(pool->users, username);
+		user = g_hash_table_lookup(pool->users, username);
 		/**
 		 * if we know this use, return a authed connection 
 		 */
 #ifdef DEBUG_CONN_POOL
-		g_debug("%s: (get_conns) get user-specific idling connection for '%s' -> %p", G_STRLOC, username->str, conns);
+		g_debug("%s: (get_conns) get user-specific idling connection for '%s' -> %p", G_STRLOC, username->str, user);
 #endif
-		if (conns) return conns;
+		if (user) return user;
 	}
 
 	/**
-	 * we don't have a entry yet, check the others if we have more than 
-	 * min_idle waiting
+	 * we don't have a entry yet, take the user with the most
+	 * connections above min_idle
 	 */
-
-	conns = g_hash_table_find(pool->users, find_idle_conns, &(pool->min_idle_connections));
+	user = network_connection_pool_get_donor(pool);
 #ifdef DEBUG_CONN_POOL
-	g_debug("%s: (get_conns) try to find max-idling conns for user '%s' -> %p", G_STRLOC, username ? username->str : "", conns);
+	g_debug("%s: (get_conns) try to find max-idling conns for user '%s' -> %p", G_STRLOC, username ? username->str : "", user);
 #endif
 
-	return conns;
+	return user;
+}
+
+GQueue *network_connection_pool_get_conns(network_connection_pool *pool, GString *username, GString *UNUSED_PARAM(default_db)) {
+	network_connection_pool_user *user;
+
+	user = network_connection_pool_get_user(pool, username);
+
+	return user ? user->conns : NULL;
 }
 
 /**
- * get a connection from the pool
+ * unlink the entry from its user-bucket and drop the bucket if it is empty 
+ */
+static void network_connection_pool_entry_unlink(network_connection_pool *pool, network_connection_pool_entry *entry) {
+	network_connection_pool_user *user = entry->user;
+
+	g_queue_delete_link(user->conns, entry->link);
+	entry->link = NULL;
+
+	g_queue_delete_link(entry->db_conns, entry->db_link);
+	if (entry->db_conns->length == 0) {
+		g_hash_table_remove(user->dbs, entry->sock->default_db);
+	}
+	entry->db_conns = NULL;
+	entry->db_link = NULL;
+	entry->user = NULL;
+
+	if (user->conns->length == 0) {
+		/**
+		 * all connections are gone, remove it from the hash
+		 */
+		if (user->donor_link) {
+			g_queue_delete_link(pool->donors, user->donor_link);
+			user->donor_link = NULL;
+		}
+		g_hash_table_remove(pool->users, user->username);
+	} else {
+		network_connection_pool_user_update_donor(pool, user);
+	}
+}
+
+/**
+ * check if the session-state of the pooled connection matches
+ */
+static gboolean network_connection_pool_entry_session_matches(network_connection_pool_entry *entry, guint8 charset, gboolean autocommit) {
+	network_socket *sock = entry->sock;
+
+	if (sock->response && sock->response->charset != charset) return FALSE;
+	if (((sock->server_status & SERVER_STATUS_AUTOCOMMIT) != 0) != (autocommit != FALSE)) return FALSE;
+
+	return TRUE;
+}
+
+/**
+ * check if the result-sets of the pooled connection end like the client expects
  *
- * make sure we have at lease <min-conns> for each user
- * if we have more, reuse a connect to reauth it to another user
+ * CLIENT_DEPRECATE_EOF is fixed by the handshake, a COM_CHANGE_USER doesn't change it
+ */
+static gboolean network_connection_pool_entry_eof_matches(network_connection_pool_entry *entry, gboolean deprecate_eof) {
+	return network_mysqld_socket_is_deprecate_eof(entry->sock) == (deprecate_eof != FALSE);
+}
+
+/**
+ * get the first connection of the queue
  *
- * @param pool connection pool to get the connection from
- * @param username (optional) name of the auth connection
- * @param default_db (unused) unused name of the default-db
+ * @param match_eof only take a connection that matches deprecate_eof
  */
-network_socket *network_connection_pool_get(network_connection_pool *pool,
-		GString *username,
-		GString *UNUSED_PARAM(default_db)) {
+static network_connection_pool_entry *network_connection_pool_queue_find(GQueue *conns, gboolean match_eof, gboolean deprecate_eof) {
+	GList *l;
+
+	if (!match_eof) return g_queue_peek_head(conns);
+
+	for (l = conns->head; l; l = l->next) {
+		if (network_connection_pool_entry_eof_matches(l->data, deprecate_eof)) return l->data;
+	}
+
+	return NULL;
+}
+
+/**
+ * unlink the entry from the pool and free it
+ *
+ * @return the socket of the entry
+ */
+static network_socket *network_connection_pool_entry_take(network_connection_pool *pool, network_connection_pool_entry *entry) {
+	network_socket *sock;
+
+	network_connection_pool_entry_unlink(pool, entry);
+
+	sock = entry->sock;
+
+	network_connection_pool_entry_free(entry, FALSE);
+
+	/* remove the idle handler from the socket */	
+	event_del(&(sock->event));
 
+	network_socket_unpark(sock);
+
+	return sock;
+}
+
+/**
+ * take a connection out of the pool
+ *
+ * the match levels are tried in order:
+ * - same user, default-db and session state (charset, autocommit) if match_session is set
+ * - same user and default-db
+ * - same user
+ * - any user with more than min_idle_connections idling
+ *
+ * with match_session only connections that negotiated CLIENT_DEPRECATE_EOF like the client qualify
+ */
+static network_socket *network_connection_pool_get_entry(network_connection_pool *pool,
+		GString *username,
+		GString *default_db,
+		gboolean match_session,
+		guint8 charset,
+		gboolean autocommit,
+		gboolean deprecate_eof) {
+	network_connection_pool_user *user;
 	network_connection_pool_entry *entry = NULL;
 	network_socket *sock = NULL;
 
-	GQueue *conns = network_connection_pool_get_conns(pool, username, NULL);
+	user = network_connection_pool_get_user(pool, username);
 
 	/**
 	 * if we know this use, return a authed connection 
 	 */
-	if (conns) {
-		entry = g_queue_pop_head(conns);
-
-		if (conns->length == 0) {
-			/**
-			 * all connections are gone, remove it from the hash
-			 */
-			g_hash_table_remove(pool->users, username);
+	if (user) {
+		/* a donor has to CHANGE_USER anyway which resets the session */
+		if (username && username->len > 0 && g_string_equal(user->username, username)) {
+			GQueue *db_conns = default_db ? g_hash_table_lookup(user->dbs, default_db) : NULL;
+
+			if (db_conns && match_session) {
+				GList *l;
+
+				for (l = db_conns->head; l; l = l->next) {
+					if (network_connection_pool_entry_session_matches(l->data, charset, autocommit) &&
+					    network_connection_pool_entry_eof_matches(l->data, deprecate_eof)) {
+						entry = l->data;
+						pool->stats.hits_session++;
+						break;
+					}
+				}
+			}
+
+			if (!entry && db_conns &&
+			    NULL != (entry = network_connection_pool_queue_find(db_conns, match_session, deprecate_eof))) {
+				pool->stats.hits_default_db++;
+			}
+
+			if (!entry &&
+			    NULL != (entry = network_connection_pool_queue_find(user->conns, match_session, deprecate_eof))) {
+				pool->stats.hits_user++;
+			}
+		} else if (NULL != (entry = network_connection_pool_queue_find(user->conns, match_session, deprecate_eof))) {
+			pool->stats.hits_donor++;
 		}
 	}
 
 	if (!entry) {
 #ifdef DEBUG_CONN_POOL
-		g_debug("%s: (get) no entry for user '%s' -> %p", G_STRLOC, username ? username->str : "", conns);
+		g_debug("%s: (get) no entry for user '%s' -> %p", G_STRLOC, username ? username->str : "", user);
 #endif
+		pool->stats.misses++;
+		MYSQLPROXY_POOL_GET(pool, username ? username->str : "", -1);
+
 		return NULL;
 	}
 
-	sock = entry->sock;
-
-	network_connection_pool_entry_free(entry, FALSE);
-
-	/* remove the idle handler from the socket */	
-	event_del(&(sock->event));
+	sock = network_connection_pool_entry_take(pool, entry);
+	MYSQLPROXY_POOL_GET(pool, username ? username->str : "", sock->fd);
 		
 #ifdef DEBUG_CONN_POOL
 	g_debug("%s: (get) got socket for user '%s' -> %p", G_STRLOC, username ? username->str : "", sock);
@@ -216,31 +426,214 @@ network_socket *network_connection_pool_get(network_connection_pool *pool,
 	return sock;
 }
 
+/**
+ * get a connection from the pool
+ *
+ * make sure we have at lease <min-conns> for each user
+ * if we have more, reuse a connect to reauth it to another user
+ *
+ * if the user has a connection with the same default-db we prefer it to save the COM_INIT_DB 
+ *
+ * @param pool connection pool to get the connection from
+ * @param username (optional) name of the auth connection
+ * @param default_db (optional) name of the default-db
+ */
+network_socket *network_connection_pool_get(network_connection_pool *pool,
+		GString *username,
+		GString *default_db) {
+	return network_connection_pool_get_entry(pool, username, default_db, FALSE, 0, FALSE, FALSE);
+}
+
+/**
+ * get a connection from the pool that also matches the session state
+ *
+ * like network_connection_pool_get(), but prefers a connection which has the same
+ * charset and autocommit setting to save the SET NAMES and SET autocommit. Only
+ * connections that negotiated CLIENT_DEPRECATE_EOF like the client qualify.
+ *
+ * @param pool connection pool to get the connection from
+ * @param username (optional) name of the auth connection
+ * @param default_db (optional) name of the default-db
+ * @param charset charset-number of the client connection
+ * @param autocommit TRUE if the client expects autocommit to be enabled
+ * @param deprecate_eof TRUE if the client negotiated CLIENT_DEPRECATE_EOF
+ */
+network_socket *network_connection_pool_get_full(network_connection_pool *pool,
+		GString *username,
+		GString *default_db,
+		guint8 charset,
+		gboolean autocommit,
+		gboolean deprecate_eof) {
+	return network_connection_pool_get_entry(pool, username, default_db, TRUE, charset, autocommit, deprecate_eof);
+}
+
+/**
+ * get a connection from the pool that can take over the session of a client
+ *
+ * unlike network_connection_pool_get_full() only a connection of the same user with
+ * the same default-db, charset, autocommit setting and client capabilities qualifies.
+ * We can't re-authenticate a connection without the password of the client.
+ *
+ * @param pool       connection pool to get the connection from
+ * @param response   the auth-response of the client
+ * @param default_db the default-db of the client
+ * @param autocommit TRUE if the client expects autocommit to be enabled
+ * @return NULL if no connection matches
+ */
+network_socket *network_connection_pool_get_session(network_connection_pool *pool,
+		network_mysqld_auth_response *response,
+		GString *default_db,
+		gboolean autocommit) {
+	network_connection_pool_user *user;
+	GQueue *db_conns = NULL;
+	GList *l;
+
+	if (NULL != (user = g_hash_table_lookup(pool->users, response->username))) {
+		db_conns = g_hash_table_lookup(user->dbs, default_db);
+	}
+
+	for (l = db_conns ? db_conns->head : NULL; l; l = l->next) {
+		network_connection_pool_entry *entry = l->data;
+
+		if (entry->sock->response->client_capabilities == response->client_capabilities &&
+		    network_connection_pool_entry_session_matches(entry, response->charset, autocommit)) {
+			pool->stats.hits_session++;
+			MYSQLPROXY_POOL_GET(pool, response->username->str, entry->sock->fd);
+
+			return network_connection_pool_entry_take(pool, entry);
+		}
+	}
+
+	pool->stats.misses++;
+	MYSQLPROXY_POOL_GET(pool, response->username->str, -1);
+
+	return NULL;
+}
+
+/**
+ * create a waiter for a connection of the user in the pool
+ *
+ * @see network_connection_pool_wait()
+ */
+network_connection_pool_waiter *network_connection_pool_waiter_new(network_connection_pool *pool,
+		GString *username,
+		network_connection_pool_wakeup_func wakeup,
+		gpointer wakeup_data) {
+	network_connection_pool_waiter *waiter;
+
+	waiter = g_new0(network_connection_pool_waiter, 1);
+	waiter->pool = pool;
+	waiter->username = g_string_dup(username);
+	waiter->wakeup = wakeup;
+	waiter->wakeup_data = wakeup_data;
+	waiter->link.data = waiter;
+
+	return waiter;
+}
+
+void network_connection_pool_waiter_free(network_connection_pool_waiter *waiter) {
+	if (!waiter) return;
+
+	network_connection_pool_cancel_wait(waiter);
+
+	g_string_free(waiter->username, TRUE);
+
+	g_free(waiter);
+}
+
+/**
+ * queue the waiter until a connection of its user is added to the pool
+ *
+ * the waiter is woken up once, it has to wait again if the connection doesn't fit its session
+ */
+void network_connection_pool_wait(network_connection_pool_waiter *waiter) {
+	if (waiter->is_waiting || NULL == waiter->pool) return;
+
+	g_queue_push_tail_link(waiter->pool->waiters, &(waiter->link));
+	waiter->is_waiting = TRUE;
+}
+
+/**
+ * remove the waiter from the queue of the pool
+ */
+void network_connection_pool_cancel_wait(network_connection_pool_waiter *waiter) {
+	if (!waiter->is_waiting) return;
+
+	g_queue_unlink(waiter->pool->waiters, &(waiter->link));
+	waiter->is_waiting = FALSE;
+}
+
+/**
+ * wake up the clients waiting for a connection of the user
+ *
+ * all of them are woken up as each of them may need another session, the
+ * ones that don't get the connection wait again
+ */
+static void network_connection_pool_wakeup(network_connection_pool *pool, GString *username) {
+	GList *l, *next;
+
+	for (l = pool->waiters->head; l; l = next) {
+		network_connection_pool_waiter *waiter = l->data;
+
+		next = l->next;
+
+		if (!g_string_equal(waiter->username, username)) continue;
+
+		network_connection_pool_cancel_wait(waiter);
+
+		waiter->wakeup(waiter, waiter->wakeup_data);
+	}
+}
+
 /**
  * add a connection to the connection pool
  *
+ * wakes up the clients waiting for a connection of its user
  */
 network_connection_pool_entry *network_connection_pool_add(network_connection_pool *pool, network_socket *sock) {
 	network_connection_pool_entry *entry;
-	GQueue *conns = NULL;
+	network_connection_pool_user *user;
+	GQueue *db_conns;
 
 	entry = network_connection_pool_entry_new();
 	entry->sock = sock;
 	entry->pool = pool;
 
-	g_get_current_time(&(entry->added_ts));
+	/* the queues aren't needed while the connection idles in the pool */
+	network_socket_park(sock);
+
+	chassis_get_coarse_current_time(&(entry->added_ts));
+
+	MYSQLPROXY_POOL_PUT(pool, sock->response->username->str, sock->fd);
 	
 #ifdef DEBUG_CONN_POOL
-	g_debug("%s: (add) adding socket to pool for user '%s' -> %p", G_STRLOC, sock->username->str, sock);
+	g_debug("%s: (add) adding socket to pool for user '%s' -> %p", G_STRLOC, sock->response->username->str, sock);
 #endif
 
-	if (NULL == (conns = g_hash_table_lookup(pool->users, sock->response->username))) {
-		conns = g_queue_new();
+	if (NULL == (user = g_hash_table_lookup(pool->users, sock->response->username))) {
+		user = network_connection_pool_user_new(sock->response->username);
+
+		g_hash_table_insert(pool->users, user->username, user);
+	}
+
+	if (NULL == (db_conns = g_hash_table_lookup(user->dbs, sock->default_db))) {
+		db_conns = g_queue_new();
 
-		g_hash_table_insert(pool->users, g_string_dup(sock->response->username), conns);
+		g_hash_table_insert(user->dbs, g_string_dup(sock->default_db), db_conns);
 	}
 
-	g_queue_push_tail(conns, entry);
+	g_queue_push_tail(user->conns, entry);
+	entry->link = user->conns->tail;
+
+	g_queue_push_tail(db_conns, entry);
+	entry->db_link = db_conns->tail;
+	entry->db_conns = db_conns;
+
+	entry->user = user;
+
+	network_connection_pool_user_update_donor(pool, user);
+
+	network_connection_pool_wakeup(pool, sock->response->username);
 
 	return entry;
 }
@@ -249,16 +642,50 @@ network_connection_pool_entry *network_connection_pool_add(network_connection_po
  * remove the connection referenced by entry from the pool 
  */
 void network_connection_pool_remove(network_connection_pool *pool, network_connection_pool_entry *entry) {
-	network_socket *sock = entry->sock;
-	GQueue *conns;
+	if (!entry->user) return;
 
-	if (NULL == (conns = g_hash_table_lookup(pool->users, sock->response->username))) {
-		return;
-	}
+	network_connection_pool_entry_unlink(pool, entry);
 
 	network_connection_pool_entry_free(entry, TRUE);
-
-	g_queue_remove(conns, entry);
 }
 
+/**
+ * close the connections which idle for too long
+ *
+ * the server closes connections which idle longer than its wait_timeout. Closing
+ * them on our side before that happens makes sure the clients don't get a
+ * connection from the pool that is already gone.
+ *
+ * @param pool       the connection pool to check
+ * @param now        the current time
+ * @param max_idle_secs close the connections which are idling for at least this many seconds
+ * @return number of closed connections
+ */
+guint network_connection_pool_expire(network_connection_pool *pool, GTimeVal *now, guint max_idle_secs) {
+	GList *users, *l;
+	guint expired = 0;
+
+	/* the user-buckets are removed from the hash as they get emptied */
+	users = g_hash_table_get_values(pool->users);
+
+	for (l = users; l; l = l->next) {
+		network_connection_pool_user *user = l->data;
+		gboolean user_is_gone = FALSE;
+
+		/* user->conns is sorted by age, oldest first */
+		while (!user_is_gone) {
+			network_connection_pool_entry *entry = g_queue_peek_head(user->conns);
+
+			if (now->tv_sec - entry->added_ts.tv_sec < (glong)max_idle_secs) break;
 
+			user_is_gone = (user->conns->length == 1);
+
+			network_connection_pool_remove(pool, entry);
+			expired++;
+		}
+	}
+
+	g_list_free(users);
+
+	return expired;
+}
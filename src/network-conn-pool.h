@@ -27,26 +27,103 @@
 #include "network-socket.h"
 #include "network-exports.h"
 
+/**
+ * how often a network_connection_pool_get*() found a connection, by match level
+ */
 typedef struct {
-	GHashTable *users; /** GHashTable<GString, GQueue<network_connection_pool_entry>> */
+	guint hits_session;    /** same user, default-db, charset and autocommit */
+	guint hits_default_db; /** same user and default-db */
+	guint hits_user;       /** same user */
+	guint hits_donor;      /** taken from a user with idle connections to spare */
+	guint misses;          /** no connection found */
+} network_connection_pool_stats_t;
+
+typedef struct {
+	GHashTable *users; /** GHashTable<GString, network_connection_pool_user> */
+
+	GQueue *donors;    /** users with more than min_idle_connections idling, the biggest surplus first */
+
+	GQueue *waiters;   /** GQueue<network_connection_pool_waiter>, clients waiting for a connection of their user, oldest first */
 	
 	guint max_idle_connections;
 	guint min_idle_connections;
+
+	network_connection_pool_stats_t stats;
 } network_connection_pool;
 
+/**
+ * the idling connections of one user 
+ */
+typedef struct {
+	GString *username;
+
+	GQueue *conns;         /** GQueue<network_connection_pool_entry>, oldest first */
+	GHashTable *dbs;       /** GHashTable<GString, GQueue<network_connection_pool_entry>>, the conns by default-db */
+
+	GList *donor_link;     /** our link in pool->donors, NULL if we have no surplus */
+} network_connection_pool_user;
+
 typedef struct {
 	network_socket *sock;          /** the idling socket */
 	
 	network_connection_pool *pool; /** a pointer back to the pool */
 
 	GTimeVal added_ts;             /** added at ... we want to make sure we don't hit wait_timeout */
+
+	network_connection_pool_user *user; /** the user-bucket we are in */
+	GList *link;                   /** our link in user->conns */
+	GQueue *db_conns;              /** the default-db queue we are in */
+	GList *db_link;                /** our link in db_conns */
 } network_connection_pool_entry;
 
+typedef struct network_connection_pool_waiter network_connection_pool_waiter;
+
+/**
+ * called in network_connection_pool_add() once a connection of the user of the waiter is added
+ *
+ * the waiter isn't in the queue anymore, the callback mustn't take the connection
+ * right away as the pool is still adding it
+ */
+typedef void (*network_connection_pool_wakeup_func)(network_connection_pool_waiter *waiter, gpointer user_data);
+
+/**
+ * a client that waits for a connection of its user to come back into the pool
+ */
+struct network_connection_pool_waiter {
+	GString *username;             /** wait for a connection of this user */
+
+	network_connection_pool *pool; /** the pool we wait in, NULL once the pool is freed */
+	gboolean is_waiting;           /** we are in pool->waiters */
+	GList link;                    /** our link in pool->waiters */
+
+	network_connection_pool_wakeup_func wakeup;
+	gpointer wakeup_data;
+};
+
+NETWORK_API network_connection_pool_waiter *network_connection_pool_waiter_new(network_connection_pool *pool,
+		GString *username,
+		network_connection_pool_wakeup_func wakeup,
+		gpointer wakeup_data);
+NETWORK_API void network_connection_pool_waiter_free(network_connection_pool_waiter *waiter);
+NETWORK_API void network_connection_pool_wait(network_connection_pool_waiter *waiter);
+NETWORK_API void network_connection_pool_cancel_wait(network_connection_pool_waiter *waiter);
+
 NETWORK_API network_socket *network_connection_pool_get(network_connection_pool *pool,
 		GString *username,
 		GString *default_db);
+NETWORK_API network_socket *network_connection_pool_get_full(network_connection_pool *pool,
+		GString *username,
+		GString *default_db,
+		guint8 charset,
+		gboolean autocommit,
+		gboolean deprecate_eof);
+NETWORK_API network_socket *network_connection_pool_get_session(network_connection_pool *pool,
+		network_mysqld_auth_response *response,
+		GString *default_db,
+		gboolean autocommit);
 NETWORK_API network_connection_pool_entry *network_connection_pool_add(network_connection_pool *pool, network_socket *sock);
 NETWORK_API void network_connection_pool_remove(network_connection_pool *pool, network_connection_pool_entry *entry);
+NETWORK_API guint network_connection_pool_expire(network_connection_pool *pool, GTimeVal *now, guint max_idle_secs);
 NETWORK_API GQueue *network_connection_pool_get_conns(network_connection_pool *pool, GString *username, GString *);
 
 NETWORK_API network_connection_pool *network_connection_pool_init(void) G_GNUC_DEPRECATED;
@@ -0,0 +1,117 @@
+/* $%BEGINLICENSE%$
+ Copyright (c) 2008, 2012, Oracle and/or its affiliates. All rights reserved.
+
+ This program is free software; you can redistribute it and/or
+ modify it under the terms of the GNU General Public License as
+ published by the Free Software Foundation; version 2 of the
+ License.
+
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ GNU General Public License for more details.
+
+ You should have received a copy of the GNU General Public License
+ along with this program; if not, write to the Free Software
+ Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA
+ 02110-1301  USA
+
+ $%ENDLICENSE%$ */
+#include <lua.h>
+#include <lauxlib.h>
+
+#include "lua-env.h"
+#include "glib-ext.h"
+
+#include "network-firewall.h"
+#include "network-firewall-lua.h"
+
+/**
+ * proxy.global.firewall:rules()
+ *
+ * @return a array of tables in the order of the file
+ *   action  => allow or deny
+ *   match   => query, prefix or contains
+ *   pattern => the normalized pattern
+ *   hits    => queries the rule decided on
+ *
+ * and a table of the action and hits of the queries no rule matched, nil without a firewall
+ */
+static int proxy_firewall_rules(lua_State *L) {
+	network_firewall_t *fw = *(network_firewall_t **)luaL_checkself(L);
+	network_firewall_rules_t *rules = network_firewall_get_rules(fw);
+	guint i;
+
+	lua_newtable(L);
+
+	if (!rules) {
+		lua_pushnil(L);
+
+		return 2;
+	}
+
+	for (i = 0; i < rules->rules->len; i++) {
+		network_firewall_rule_t *rule = rules->rules->pdata[i];
+
+		lua_newtable(L);
+
+		lua_pushstring(L, network_firewall_action_get_name(rule->action));
+		lua_setfield(L, -2, "action");
+		lua_pushstring(L, network_firewall_match_get_name(rule->match));
+		lua_setfield(L, -2, "match");
+		lua_pushlstring(L, rule->pattern->str, rule->pattern->len);
+		lua_setfield(L, -2, "pattern");
+		lua_pushnumber(L, (guint)g_atomic_int_get(&rule->hits));
+		lua_setfield(L, -2, "hits");
+
+		lua_rawseti(L, -2, i + 1);
+	}
+
+	lua_newtable(L);
+
+	lua_pushstring(L, network_firewall_action_get_name(rules->default_action));
+	lua_setfield(L, -2, "action");
+	lua_pushnumber(L, (guint)g_atomic_int_get(&rules->default_hits));
+	lua_setfield(L, -2, "hits");
+
+	return 2;
+}
+
+/**
+ * proxy.global.firewall:reload()
+ *
+ * read the --proxy-firewall-file again, the old rules stay if it has errors
+ *
+ * @return true on success, nil and the error otherwise
+ */
+static int proxy_firewall_reload(lua_State *L) {
+	network_firewall_t *fw = *(network_firewall_t **)luaL_checkself(L);
+	GError *gerr = NULL;
+
+	if (0 != network_firewall_reload(fw, &gerr)) {
+		lua_pushnil(L);
+		lua_pushstring(L, gerr->message);
+		g_clear_error(&gerr);
+
+		return 2;
+	}
+
+	lua_pushboolean(L, TRUE);
+
+	return 1;
+}
+
+static const struct luaL_reg methods_proxy_firewall[] = {
+	{ "rules", proxy_firewall_rules },
+	{ "reload", proxy_firewall_reload },
+	{ NULL, NULL },
+};
+
+int network_firewall_lua_getmetatable(lua_State *L) {
+	proxy_getmetatable(L, methods_proxy_firewall);
+
+	lua_pushvalue(L, -1); /* meta.__index = meta */
+	lua_setfield(L, -2, "__index");
+
+	return 1;
+}
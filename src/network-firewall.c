@@ -0,0 +1,572 @@
+/* $%BEGINLICENSE%$
+ Copyright (c) 2008, 2012, Oracle and/or its affiliates. All rights reserved.
+
+ This program is free software; you can redistribute it and/or
+ modify it under the terms of the GNU General Public License as
+ published by the Free Software Foundation; version 2 of the
+ License.
+
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ GNU General Public License for more details.
+
+ You should have received a copy of the GNU General Public License
+ along with this program; if not, write to the Free Software
+ Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA
+ 02110-1301  USA
+
+ $%ENDLICENSE%$ */
+
+/** @file
+ * the query firewall of --proxy-firewall-file
+ *
+ * the file has a rule per line, the first rule that matches the fingerprint of a query
+ * decides if it is sent to the backend:
+ *
+ *   default  allow
+ *   deny     contains  SLEEP(
+ *   allow    query     SELECT * FROM orders WHERE id = 1
+ *   deny     prefix    DELETE FROM orders
+ *
+ * the patterns are normalized like the queries, "WHERE id = 1" stands for all ids. A
+ * "query" has to match the whole fingerprint, a "prefix" its start and "contains" any part
+ * of it. The case of the letters doesn't matter. Queries no rule matches get the default,
+ * "allow" if the file has none. Empty lines and lines starting with a # are ignored.
+ */
+
+#include <string.h>
+
+#include "network-query-digest.h"
+#include "network-firewall.h"
+
+#define NETWORK_FIREWALL_NO_STATE G_MAXUINT32
+
+GQuark network_firewall_error(void) {
+	return g_quark_from_static_string("network-firewall-error-quark");
+}
+
+const gchar *network_firewall_action_get_name(network_firewall_action_t action) {
+	switch (action) {
+	case NETWORK_FIREWALL_ALLOW: return "allow";
+	case NETWORK_FIREWALL_DENY: return "deny";
+	}
+
+	return "unknown";
+}
+
+const gchar *network_firewall_match_get_name(network_firewall_match_t match) {
+	switch (match) {
+	case NETWORK_FIREWALL_MATCH_QUERY: return "query";
+	case NETWORK_FIREWALL_MATCH_PREFIX: return "prefix";
+	case NETWORK_FIREWALL_MATCH_CONTAINS: return "contains";
+	}
+
+	return "unknown";
+}
+
+network_firewall_rule_t *network_firewall_rule_new(void) {
+	network_firewall_rule_t *rule;
+
+	rule = g_new0(network_firewall_rule_t, 1);
+	rule->pattern = g_string_new(NULL);
+
+	return rule;
+}
+
+void network_firewall_rule_free(network_firewall_rule_t *rule) {
+	if (!rule) return;
+
+	g_string_free(rule->pattern, TRUE);
+
+	g_free(rule);
+}
+
+network_firewall_rules_t *network_firewall_rules_new(void) {
+	network_firewall_rules_t *rules;
+
+	rules = g_new0(network_firewall_rules_t, 1);
+	rules->rules = g_ptr_array_new();
+	rules->default_action = NETWORK_FIREWALL_ALLOW;
+
+	network_firewall_rules_compile(rules);
+
+	return rules;
+}
+
+static void network_firewall_rules_reset_automaton(network_firewall_rules_t *rules) {
+	if (rules->delta) g_free(rules->delta);
+	if (rules->out_offsets) g_free(rules->out_offsets);
+	if (rules->out_rules) g_free(rules->out_rules);
+
+	rules->delta = NULL;
+	rules->out_offsets = NULL;
+	rules->out_rules = NULL;
+}
+
+void network_firewall_rules_free(network_firewall_rules_t *rules) {
+	guint i;
+
+	if (!rules) return;
+
+	for (i = 0; i < rules->rules->len; i++) {
+		network_firewall_rule_free(rules->rules->pdata[i]);
+	}
+	g_ptr_array_free(rules->rules, TRUE);
+
+	network_firewall_rules_reset_automaton(rules);
+
+	g_free(rules);
+}
+
+/**
+ * add a rule after the others
+ *
+ * the rules have to be compiled again before they are matched
+ *
+ * @return 0 on success, -1 if the pattern is empty
+ */
+int network_firewall_rules_add(network_firewall_rules_t *rules, network_firewall_action_t action,
+		network_firewall_match_t match, const char *pattern, gsize pattern_len, GError **gerr) {
+	network_firewall_rule_t *rule = network_firewall_rule_new();
+	guint64 hash;
+
+	rule->action = action;
+	rule->match = match;
+	network_query_digest_fingerprint(rule->pattern, &hash, pattern, pattern_len);
+
+	if (rule->pattern->len == 0) {
+		g_set_error(gerr, NETWORK_FIREWALL_ERROR, NETWORK_FIREWALL_ERROR_PARSE,
+				"the pattern of the rule is empty");
+		network_firewall_rule_free(rule);
+
+		return -1;
+	}
+
+	g_ptr_array_add(rules->rules, rule);
+
+	return 0;
+}
+
+static guint32 network_firewall_add_state(GArray *delta, GPtrArray *outs, guint n_classes) {
+	guint32 no_state = NETWORK_FIREWALL_NO_STATE;
+	guint i;
+
+	for (i = 0; i < n_classes; i++) {
+		g_array_append_val(delta, no_state);
+	}
+	g_ptr_array_add(outs, g_array_new(FALSE, FALSE, sizeof(guint)));
+
+	return outs->len - 1;
+}
+
+/**
+ * add the rules of the fail-state to the rules of a state, both are sorted
+ */
+static void network_firewall_merge_outs(GArray *dst, GArray *src) {
+	GArray *merged;
+	guint i = 0, j = 0;
+
+	if (src->len == 0) return;
+
+	merged = g_array_sized_new(FALSE, FALSE, sizeof(guint), dst->len + src->len);
+
+	while (i < dst->len || j < src->len) {
+		guint a = i < dst->len ? g_array_index(dst, guint, i) : G_MAXUINT;
+		guint b = j < src->len ? g_array_index(src, guint, j) : G_MAXUINT;
+
+		if (a <= b) {
+			g_array_append_val(merged, a);
+			i++;
+			if (a == b) j++;
+		} else {
+			g_array_append_val(merged, b);
+			j++;
+		}
+	}
+
+	g_array_set_size(dst, 0);
+	g_array_append_vals(dst, merged->data, merged->len);
+	g_array_free(merged, TRUE);
+}
+
+/**
+ * build the automaton of the patterns of all rules
+ *
+ * the trie of the patterns gets its fail-links in breadth-first order and every missing
+ * edge is replaced by the edge of the fail-state, the result is a DFA. The bytes that
+ * aren't in any pattern share one column of the table, upper- and lower-case letters too.
+ */
+void network_firewall_rules_compile(network_firewall_rules_t *rules) {
+	GArray *delta_arr = g_array_new(FALSE, FALSE, sizeof(guint32));
+	GPtrArray *outs = g_ptr_array_new();
+	guint32 *delta, *fail, *queue;
+	guint n_classes = 1;
+	guint head = 0, tail = 0;
+	guint n_outs = 0;
+	guint i, j, c;
+
+	network_firewall_rules_reset_automaton(rules);
+
+	memset(rules->classes, 0, sizeof(rules->classes));
+	for (i = 0; i < rules->rules->len; i++) {
+		network_firewall_rule_t *rule = rules->rules->pdata[i];
+
+		for (j = 0; j < rule->pattern->len; j++) {
+			guchar b = g_ascii_tolower(rule->pattern->str[j]);
+
+			if (rules->classes[b] != 0) continue;
+
+			rules->classes[b] = n_classes;
+			rules->classes[(guchar)g_ascii_toupper(b)] = n_classes;
+			n_classes++;
+		}
+	}
+
+	/* the trie */
+	network_firewall_add_state(delta_arr, outs, n_classes);
+
+	for (i = 0; i < rules->rules->len; i++) {
+		network_firewall_rule_t *rule = rules->rules->pdata[i];
+		guint32 s = 0;
+
+		for (j = 0; j < rule->pattern->len; j++) {
+			guint ndx = s * n_classes + rules->classes[(guchar)rule->pattern->str[j]];
+			guint32 t = g_array_index(delta_arr, guint32, ndx);
+
+			if (t == NETWORK_FIREWALL_NO_STATE) {
+				t = network_firewall_add_state(delta_arr, outs, n_classes);
+				g_array_index(delta_arr, guint32, ndx) = t;
+			}
+			s = t;
+		}
+
+		g_array_append_val(outs->pdata[s], i);
+	}
+
+	rules->n_classes = n_classes;
+	rules->n_states = outs->len;
+
+	/* the fail-links */
+	delta = (guint32 *)delta_arr->data;
+	fail = g_new0(guint32, rules->n_states);
+	queue = g_new(guint32, rules->n_states);
+
+	for (c = 0; c < n_classes; c++) {
+		guint32 t = delta[c];
+
+		if (t == NETWORK_FIREWALL_NO_STATE) {
+			delta[c] = 0;
+		} else {
+			fail[t] = 0;
+			queue[tail++] = t;
+		}
+	}
+
+	while (head < tail) {
+		guint32 s = queue[head++];
+
+		for (c = 0; c < n_classes; c++) {
+			guint32 t = delta[s * n_classes + c];
+			guint32 f = delta[fail[s] * n_classes + c];
+
+			if (t == NETWORK_FIREWALL_NO_STATE) {
+				delta[s * n_classes + c] = f;
+			} else {
+				fail[t] = f;
+				network_firewall_merge_outs(outs->pdata[t], outs->pdata[f]);
+				queue[tail++] = t;
+			}
+		}
+	}
+
+	g_free(queue);
+	g_free(fail);
+
+	rules->delta = (guint32 *)g_array_free(delta_arr, FALSE);
+
+	/* the rules of each state in one array */
+	for (i = 0; i < outs->len; i++) {
+		n_outs += ((GArray *)outs->pdata[i])->len;
+	}
+
+	rules->out_offsets = g_new(guint, outs->len + 1);
+	rules->out_rules = g_new(guint, MAX(n_outs, 1));
+
+	for (i = 0, n_outs = 0; i < outs->len; i++) {
+		GArray *out = outs->pdata[i];
+
+		rules->out_offsets[i] = n_outs;
+		for (j = 0; j < out->len; j++) {
+			rules->out_rules[n_outs++] = g_array_index(out, guint, j);
+		}
+
+		g_array_free(out, TRUE);
+	}
+	rules->out_offsets[outs->len] = n_outs;
+
+	g_ptr_array_free(outs, TRUE);
+}
+
+/**
+ * find the first rule that matches a fingerprint
+ *
+ * @return the rule, NULL if none matches
+ */
+network_firewall_rule_t *network_firewall_rules_match(network_firewall_rules_t *rules, const char *fingerprint, gsize fingerprint_len) {
+	guint best = G_MAXUINT;
+	guint32 s = 0;
+	gsize i;
+
+	for (i = 0; i < fingerprint_len; i++) {
+		guint j;
+
+		s = rules->delta[s * rules->n_classes + rules->classes[(guchar)fingerprint[i]]];
+
+		/* the rules are sorted, the first one that fits is the best of the state */
+		for (j = rules->out_offsets[s]; j < rules->out_offsets[s + 1]; j++) {
+			guint ndx = rules->out_rules[j];
+			network_firewall_rule_t *rule = rules->rules->pdata[ndx];
+
+			if (ndx >= best) break;
+
+			if (rule->match != NETWORK_FIREWALL_MATCH_CONTAINS && i + 1 != rule->pattern->len) continue;
+			if (rule->match == NETWORK_FIREWALL_MATCH_QUERY && i + 1 != fingerprint_len) continue;
+
+			best = ndx;
+			break;
+		}
+	}
+
+	return best == G_MAXUINT ? NULL : rules->rules->pdata[best];
+}
+
+static int network_firewall_action_from_name(const gchar *name, network_firewall_action_t *action) {
+	if (0 == g_ascii_strcasecmp(name, "allow")) {
+		*action = NETWORK_FIREWALL_ALLOW;
+	} else if (0 == g_ascii_strcasecmp(name, "deny")) {
+		*action = NETWORK_FIREWALL_DENY;
+	} else {
+		return -1;
+	}
+
+	return 0;
+}
+
+static int network_firewall_match_from_name(const gchar *name, network_firewall_match_t *match) {
+	if (0 == g_ascii_strcasecmp(name, "query")) {
+		*match = NETWORK_FIREWALL_MATCH_QUERY;
+	} else if (0 == g_ascii_strcasecmp(name, "prefix")) {
+		*match = NETWORK_FIREWALL_MATCH_PREFIX;
+	} else if (0 == g_ascii_strcasecmp(name, "contains")) {
+		*match = NETWORK_FIREWALL_MATCH_CONTAINS;
+	} else {
+		return -1;
+	}
+
+	return 0;
+}
+
+/**
+ * split the next word off a line
+ *
+ * @return the word, *rest points to the text after it
+ */
+static gchar *network_firewall_next_word(gchar *line, gchar **rest) {
+	gchar *end;
+
+	for (end = line; *end != '\0' && !g_ascii_isspace(*end); end++);
+
+	if (*end != '\0') {
+		*end = '\0';
+		*rest = g_strchug(end + 1);
+	} else {
+		*rest = end;
+	}
+
+	return line;
+}
+
+/**
+ * add the rules of a file and compile them
+ *
+ * @return 0 on success, -1 on error
+ */
+int network_firewall_rules_load(network_firewall_rules_t *rules, const gchar *filename, GError **gerr) {
+	GError *read_gerr = NULL;
+	gchar *contents;
+	gchar **lines;
+	int ret = 0;
+	guint i;
+
+	if (!g_file_get_contents(filename, &contents, NULL, &read_gerr)) {
+		g_set_error(gerr, NETWORK_FIREWALL_ERROR, NETWORK_FIREWALL_ERROR_READ,
+				"reading %s failed: %s",
+				filename,
+				read_gerr->message);
+		g_error_free(read_gerr);
+
+		return -1;
+	}
+
+	lines = g_strsplit(contents, "\n", -1);
+	for (i = 0; lines[i] && ret == 0; i++) {
+		gchar *line = g_strstrip(lines[i]);
+		gchar *action_name, *match_name, *pattern;
+		network_firewall_action_t action;
+		network_firewall_match_t match;
+
+		if (line[0] == '\0' || line[0] == '#') continue;
+
+		action_name = network_firewall_next_word(line, &line);
+
+		if (0 == g_ascii_strcasecmp(action_name, "default")) {
+			if (0 != network_firewall_action_from_name(line, &rules->default_action)) {
+				g_set_error(gerr, NETWORK_FIREWALL_ERROR, NETWORK_FIREWALL_ERROR_PARSE,
+						"%s:%u: expected default allow or deny",
+						filename, i + 1);
+				ret = -1;
+			}
+			continue;
+		}
+
+		match_name = network_firewall_next_word(line, &pattern);
+
+		if (0 != network_firewall_action_from_name(action_name, &action) ||
+		    0 != network_firewall_match_from_name(match_name, &match) ||
+		    0 != network_firewall_rules_add(rules, action, match, pattern, strlen(pattern), NULL)) {
+			g_set_error(gerr, NETWORK_FIREWALL_ERROR, NETWORK_FIREWALL_ERROR_PARSE,
+					"%s:%u: expected allow or deny, query, prefix or contains and a pattern",
+					filename, i + 1);
+			ret = -1;
+		}
+	}
+	g_strfreev(lines);
+	g_free(contents);
+
+	network_firewall_rules_compile(rules);
+
+	return ret;
+}
+
+network_firewall_t *network_firewall_new(void) {
+	network_firewall_t *fw;
+
+	fw = g_new0(network_firewall_t, 1);
+	fw->mutex = g_mutex_new();
+	fw->retired = g_ptr_array_new();
+
+	return fw;
+}
+
+void network_firewall_free(network_firewall_t *fw) {
+	guint i;
+
+	if (!fw) return;
+
+	for (i = 0; i < fw->retired->len; i++) {
+		network_firewall_rules_free(fw->retired->pdata[i]);
+	}
+	g_ptr_array_free(fw->retired, TRUE);
+
+	network_firewall_rules_free(fw->rules);
+	g_mutex_free(fw->mutex);
+	if (fw->filename) g_free(fw->filename);
+
+	g_free(fw);
+}
+
+/**
+ * load the rules of a file and make them the current ones
+ *
+ * if the file has errors the current rules stay
+ *
+ * @return 0 on success, -1 on error
+ */
+int network_firewall_load(network_firewall_t *fw, const gchar *filename, GError **gerr) {
+	network_firewall_rules_t *rules = network_firewall_rules_new();
+	network_firewall_rules_t *old_rules;
+
+	if (0 != network_firewall_rules_load(rules, filename, gerr)) {
+		network_firewall_rules_free(rules);
+
+		return -1;
+	}
+
+	g_mutex_lock(fw->mutex);
+	old_rules = fw->rules;
+
+	g_atomic_pointer_set((gpointer *)&fw->rules, rules);
+
+	/* the event-threads may still match against the old ones */
+	if (old_rules) g_ptr_array_add(fw->retired, old_rules);
+
+	if (fw->filename != filename) {
+		if (fw->filename) g_free(fw->filename);
+		fw->filename = g_strdup(filename);
+	}
+	g_mutex_unlock(fw->mutex);
+
+	return 0;
+}
+
+/**
+ * load the file of the last network_firewall_load() again
+ *
+ * @return 0 on success, -1 on error
+ */
+int network_firewall_reload(network_firewall_t *fw, GError **gerr) {
+	gchar *filename;
+	int ret;
+
+	g_mutex_lock(fw->mutex);
+	filename = g_strdup(fw->filename);
+	g_mutex_unlock(fw->mutex);
+
+	if (!filename) {
+		g_set_error(gerr, NETWORK_FIREWALL_ERROR, NETWORK_FIREWALL_ERROR_NOT_LOADED,
+				"no firewall file was loaded");
+
+		return -1;
+	}
+
+	ret = network_firewall_load(fw, filename, gerr);
+	g_free(filename);
+
+	return ret;
+}
+
+/**
+ * get the current rules without locking
+ *
+ * @return the rules, they stay valid until the firewall is freed. NULL if none were loaded
+ */
+network_firewall_rules_t *network_firewall_get_rules(network_firewall_t *fw) {
+	return g_atomic_pointer_get((gpointer *)&fw->rules);
+}
+
+gboolean network_firewall_is_enabled(network_firewall_t *fw) {
+	return NULL != network_firewall_get_rules(fw);
+}
+
+/**
+ * decide on a query and count the hit of the rule
+ *
+ * @param fingerprint the normalized query, see network_query_digest_fingerprint()
+ */
+network_firewall_action_t network_firewall_check(network_firewall_t *fw, const char *fingerprint, gsize fingerprint_len) {
+	network_firewall_rules_t *rules = network_firewall_get_rules(fw);
+	network_firewall_rule_t *rule;
+
+	if (!rules) return NETWORK_FIREWALL_ALLOW;
+
+	if (NULL == (rule = network_firewall_rules_match(rules, fingerprint, fingerprint_len))) {
+		g_atomic_int_inc(&rules->default_hits);
+
+		return rules->default_action;
+	}
+
+	g_atomic_int_inc(&rule->hits);
+
+	return rule->action;
+}
@@ -0,0 +1,111 @@
+/* $%BEGINLICENSE%$
+ Copyright (c) 2008, 2012, Oracle and/or its affiliates. All rights reserved.
+
+ This program is free software; you can redistribute it and/or
+ modify it under the terms of the GNU General Public License as
+ published by the Free Software Foundation; version 2 of the
+ License.
+
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ GNU General Public License for more details.
+
+ You should have received a copy of the GNU General Public License
+ along with this program; if not, write to the Free Software
+ Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA
+ 02110-1301  USA
+
+ $%ENDLICENSE%$ */
+#ifndef __NETWORK_FIREWALL_H__
+#define __NETWORK_FIREWALL_H__
+
+#include <glib.h>
+
+#include "network-exports.h"
+
+typedef enum {
+	NETWORK_FIREWALL_ALLOW,
+	NETWORK_FIREWALL_DENY
+} network_firewall_action_t;
+
+typedef enum {
+	NETWORK_FIREWALL_MATCH_QUERY,      /**< the whole fingerprint */
+	NETWORK_FIREWALL_MATCH_PREFIX,     /**< the start of the fingerprint */
+	NETWORK_FIREWALL_MATCH_CONTAINS    /**< anywhere in the fingerprint */
+} network_firewall_match_t;
+
+typedef struct {
+	network_firewall_action_t action;
+	network_firewall_match_t match;
+	GString *pattern;                  /**< normalized like the queries, see network_query_digest_fingerprint() */
+
+	volatile gint hits;                /**< queries this rule decided on */
+} network_firewall_rule_t;
+
+NETWORK_API network_firewall_rule_t *network_firewall_rule_new(void);
+NETWORK_API void network_firewall_rule_free(network_firewall_rule_t *rule);
+
+/**
+ * the rules of a firewall file, compiled into one automaton
+ *
+ * the patterns of all rules are states of a single DFA (Aho-Corasick) over the bytes of
+ * the fingerprint, matching a query costs one table lookup per byte however many rules
+ * there are. The first rule in the file that matches decides.
+ *
+ * the rules are only read after they are compiled, the event-threads share them without
+ * a lock.
+ */
+typedef struct {
+	GPtrArray *rules;                  /**< network_firewall_rule_t in the order of the file */
+	network_firewall_action_t default_action; /**< for the queries no rule matches */
+	volatile gint default_hits;
+
+	guint8 classes[256];               /**< byte -> its column in .delta, the bytes of no pattern share column 0 */
+	guint n_classes;
+	guint n_states;
+	guint32 *delta;                    /**< state * n_classes + class -> next state */
+	guint *out_offsets;                /**< state -> its first rule in .out_rules, n_states + 1 entries */
+	guint *out_rules;                  /**< the rules whose pattern ends in the state, ascending */
+} network_firewall_rules_t;
+
+NETWORK_API network_firewall_rules_t *network_firewall_rules_new(void);
+NETWORK_API void network_firewall_rules_free(network_firewall_rules_t *rules);
+NETWORK_API int network_firewall_rules_add(network_firewall_rules_t *rules, network_firewall_action_t action,
+		network_firewall_match_t match, const char *pattern, gsize pattern_len, GError **gerr);
+NETWORK_API void network_firewall_rules_compile(network_firewall_rules_t *rules);
+NETWORK_API int network_firewall_rules_load(network_firewall_rules_t *rules, const gchar *filename, GError **gerr);
+NETWORK_API network_firewall_rule_t *network_firewall_rules_match(network_firewall_rules_t *rules, const char *fingerprint, gsize fingerprint_len);
+
+/**
+ * the current rules of --proxy-firewall-file
+ */
+typedef struct {
+	network_firewall_rules_t *rules;   /**< get them with network_firewall_get_rules() */
+
+	GMutex *mutex;                     /**< protects the fields below, serializes the writers of .rules */
+	GPtrArray *retired;                /**< replaced rules, the event-threads may still use them */
+	gchar *filename;
+} network_firewall_t;
+
+NETWORK_API network_firewall_t *network_firewall_new(void);
+NETWORK_API void network_firewall_free(network_firewall_t *fw);
+NETWORK_API int network_firewall_load(network_firewall_t *fw, const gchar *filename, GError **gerr);
+NETWORK_API int network_firewall_reload(network_firewall_t *fw, GError **gerr);
+NETWORK_API network_firewall_rules_t *network_firewall_get_rules(network_firewall_t *fw);
+NETWORK_API gboolean network_firewall_is_enabled(network_firewall_t *fw);
+NETWORK_API network_firewall_action_t network_firewall_check(network_firewall_t *fw, const char *fingerprint, gsize fingerprint_len);
+
+NETWORK_API const gchar *network_firewall_action_get_name(network_firewall_action_t action);
+NETWORK_API const gchar *network_firewall_match_get_name(network_firewall_match_t match);
+
+#define NETWORK_FIREWALL_ERROR network_firewall_error()
+NETWORK_API GQuark network_firewall_error(void);
+
+typedef enum {
+	NETWORK_FIREWALL_ERROR_READ,       /**< the file couldn't be read */
+	NETWORK_FIREWALL_ERROR_PARSE,      /**< a line isn't a rule */
+	NETWORK_FIREWALL_ERROR_NOT_LOADED  /**< there is no file to reload */
+} network_firewall_error_t;
+
+#endif
@@ -0,0 +1,140 @@
+/* $%BEGINLICENSE%$
+ Copyright (c) 2008, 2012, Oracle and/or its affiliates. All rights reserved.
+
+ This program is free software; you can redistribute it and/or
+ modify it under the terms of the GNU General Public License as
+ published by the Free Software Foundation; version 2 of the
+ License.
+
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ GNU General Public License for more details.
+
+ You should have received a copy of the GNU General Public License
+ along with this program; if not, write to the Free Software
+ Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA
+ 02110-1301  USA
+
+ $%ENDLICENSE%$ */
+
+/** @file
+ * flow control of the results forwarded to the clients
+ *
+ * the event-threads account the send-queue of each connection into the shared total,
+ * only the change since the last account is added.
+ */
+
+#include "network-flow-control.h"
+
+network_flow_control_t *network_flow_control_new(void) {
+	network_flow_control_t *fc;
+
+	fc = g_new0(network_flow_control_t, 1);
+	fc->mutex = g_mutex_new();
+
+	return fc;
+}
+
+/**
+ * free the flow control
+ *
+ * the connections have to account 0 bytes before
+ */
+void network_flow_control_free(network_flow_control_t *fc) {
+	if (!fc) return;
+
+	g_mutex_free(fc->mutex);
+
+	g_free(fc);
+}
+
+/**
+ * set the budget of all send-queues
+ *
+ * @param budget bytes, 0 for unlimited
+ */
+void network_flow_control_set_budget(network_flow_control_t *fc, guint64 budget) {
+	g_mutex_lock(fc->mutex);
+	fc->budget = budget;
+	g_mutex_unlock(fc->mutex);
+}
+
+/**
+ * account the send-queue of a connection
+ *
+ * @param accounted the bytes the connection accounted last, updated
+ * @param queued    the bytes in its send-queue now, 0 when the result is done
+ */
+void network_flow_control_account(network_flow_control_t *fc, gsize *accounted, gsize queued) {
+	if (*accounted == queued) return;
+
+	g_mutex_lock(fc->mutex);
+	fc->buffered -= *accounted;
+	fc->buffered += queued;
+	g_mutex_unlock(fc->mutex);
+
+	*accounted = queued;
+}
+
+static gboolean network_flow_control_is_over_budget(network_flow_control_t *fc) {
+	return fc->budget > 0 && fc->buffered > fc->budget;
+}
+
+/**
+ * account the send-queue and check if the connection should stop reading from the server
+ *
+ * @return TRUE if the send-queue is above the high watermark, or above the low watermark
+ *   while all send-queues are over the budget
+ */
+gboolean network_flow_control_should_pause(network_flow_control_t *fc, gsize *accounted, gsize queued, gsize high_watermark, gsize low_watermark) {
+	gboolean should_pause;
+
+	network_flow_control_account(fc, accounted, queued);
+
+	g_mutex_lock(fc->mutex);
+	should_pause = (queued > high_watermark) ||
+		(queued > low_watermark && network_flow_control_is_over_budget(fc));
+	if (should_pause) fc->pauses++;
+	g_mutex_unlock(fc->mutex);
+
+	return should_pause;
+}
+
+/**
+ * check if a paused connection may read from the server again before its send-queue is empty
+ *
+ * over the budget the send-queue has to be drained completely
+ */
+gboolean network_flow_control_may_resume(network_flow_control_t *fc, gsize queued, gsize low_watermark) {
+	gboolean may_resume;
+
+	if (queued == 0) return TRUE;
+	if (queued > low_watermark) return FALSE;
+
+	g_mutex_lock(fc->mutex);
+	may_resume = !network_flow_control_is_over_budget(fc);
+	g_mutex_unlock(fc->mutex);
+
+	return may_resume;
+}
+
+guint64 network_flow_control_get_buffered(network_flow_control_t *fc) {
+	guint64 buffered;
+
+	g_mutex_lock(fc->mutex);
+	buffered = fc->buffered;
+	g_mutex_unlock(fc->mutex);
+
+	return buffered;
+}
+
+guint64 network_flow_control_get_pauses(network_flow_control_t *fc) {
+	guint64 pauses;
+
+	g_mutex_lock(fc->mutex);
+	pauses = fc->pauses;
+	g_mutex_unlock(fc->mutex);
+
+	return pauses;
+}
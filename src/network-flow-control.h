@@ -0,0 +1,57 @@
+/* $%BEGINLICENSE%$
+ Copyright (c) 2008, 2012, Oracle and/or its affiliates. All rights reserved.
+
+ This program is free software; you can redistribute it and/or
+ modify it under the terms of the GNU General Public License as
+ published by the Free Software Foundation; version 2 of the
+ License.
+
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ GNU General Public License for more details.
+
+ You should have received a copy of the GNU General Public License
+ along with this program; if not, write to the Free Software
+ Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA
+ 02110-1301  USA
+
+ $%ENDLICENSE%$ */
+#ifndef __NETWORK_FLOW_CONTROL_H__
+#define __NETWORK_FLOW_CONTROL_H__
+
+#include <glib.h>
+
+#include "network-exports.h"
+
+/**
+ * flow control between the reads from the server and the writes to the client
+ *
+ * while a result is forwarded, the connection stops reading from the server once the
+ * send-queue to the client is above its high watermark and only reads again when it is
+ * drained below its low watermark.
+ *
+ * the send-queues of all connections share a budget: over the budget the connections
+ * pause at their low watermark already and only resume with a empty send-queue.
+ */
+typedef struct {
+	GMutex *mutex;                     /**< protects the fields below */
+
+	guint64 budget;                    /**< bytes in the send-queues of all connections, 0 for unlimited */
+	guint64 buffered;                  /**< bytes in the send-queues of the results in flight */
+
+	guint64 pauses;                    /**< times a connection stopped reading from its server */
+} network_flow_control_t;
+
+NETWORK_API network_flow_control_t *network_flow_control_new(void);
+NETWORK_API void network_flow_control_free(network_flow_control_t *fc);
+NETWORK_API void network_flow_control_set_budget(network_flow_control_t *fc, guint64 budget);
+
+NETWORK_API void network_flow_control_account(network_flow_control_t *fc, gsize *accounted, gsize queued);
+NETWORK_API gboolean network_flow_control_should_pause(network_flow_control_t *fc, gsize *accounted, gsize queued, gsize high_watermark, gsize low_watermark);
+NETWORK_API gboolean network_flow_control_may_resume(network_flow_control_t *fc, gsize queued, gsize low_watermark);
+
+NETWORK_API guint64 network_flow_control_get_buffered(network_flow_control_t *fc);
+NETWORK_API guint64 network_flow_control_get_pauses(network_flow_control_t *fc);
+
+#endif
@@ -0,0 +1,137 @@
+/* $%BEGINLICENSE%$
+ Copyright (c) 2008, 2012, Oracle and/or its affiliates. All rights reserved.
+
+ This program is free software; you can redistribute it and/or
+ modify it under the terms of the GNU General Public License as
+ published by the Free Software Foundation; version 2 of the
+ License.
+
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ GNU General Public License for more details.
+
+ You should have received a copy of the GNU General Public License
+ along with this program; if not, write to the Free Software
+ Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA
+ 02110-1301  USA
+
+ $%ENDLICENSE%$ */
+/**
+ * log-linear histograms
+ *
+ * a value v >= 2^SUB_BITS with its highest bit at position e is put into the bucket
+ * of the SUB_BITS bits below it: values with the same e share SUB_BUCKETS linear
+ * buckets. Small values get a bucket each. That's the layout of the HDR histograms
+ * with a precision of 1/16 and only needs a shift and a g_bit_storage() to record.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <string.h>
+
+#include <glib.h>
+
+#include "network-histogram.h"
+
+network_histogram_t *network_histogram_new(void) {
+	return g_new0(network_histogram_t, 1);
+}
+
+void network_histogram_free(network_histogram_t *h) {
+	if (!h) return;
+
+	g_free(h);
+}
+
+void network_histogram_reset(network_histogram_t *h) {
+	memset(h, 0, sizeof(*h));
+}
+
+static guint network_histogram_get_bucket(guint64 value) {
+	guint bits;
+
+	if (value < NETWORK_HISTOGRAM_SUB_BUCKETS) return value;
+
+	bits = g_bit_storage(value); /* position of the highest bit + 1 */
+	if (bits > NETWORK_HISTOGRAM_MAX_BITS) return NETWORK_HISTOGRAM_BUCKETS - 1;
+
+	return (bits - NETWORK_HISTOGRAM_SUB_BITS) * NETWORK_HISTOGRAM_SUB_BUCKETS +
+		((value >> (bits - 1 - NETWORK_HISTOGRAM_SUB_BITS)) & (NETWORK_HISTOGRAM_SUB_BUCKETS - 1));
+}
+
+/**
+ * the highest value of a bucket
+ */
+static guint64 network_histogram_get_bucket_max(guint bucket) {
+	guint bits;
+	guint64 sub;
+
+	if (bucket < NETWORK_HISTOGRAM_SUB_BUCKETS) return bucket;
+
+	bits = bucket / NETWORK_HISTOGRAM_SUB_BUCKETS + NETWORK_HISTOGRAM_SUB_BITS;
+	sub  = bucket % NETWORK_HISTOGRAM_SUB_BUCKETS;
+
+	return (((guint64)NETWORK_HISTOGRAM_SUB_BUCKETS + sub + 1) << (bits - 1 - NETWORK_HISTOGRAM_SUB_BITS)) - 1;
+}
+
+void network_histogram_add(network_histogram_t *h, guint64 value) {
+	h->counts[network_histogram_get_bucket(value)]++;
+	h->count++;
+	h->sum += value;
+	if (value > h->max) h->max = value;
+}
+
+void network_histogram_merge(network_histogram_t *dst, const network_histogram_t *src) {
+	guint i;
+
+	for (i = 0; i < NETWORK_HISTOGRAM_BUCKETS; i++) {
+		dst->counts[i] += src->counts[i];
+	}
+	dst->count += src->count;
+	dst->sum   += src->sum;
+	if (src->max > dst->max) dst->max = src->max;
+}
+
+/**
+ * halve the counts to let the new samples weigh more than the old ones
+ *
+ * the max is kept, it may be older than the samples that are left
+ */
+void network_histogram_halve(network_histogram_t *h) {
+	guint i;
+
+	h->count = 0;
+	for (i = 0; i < NETWORK_HISTOGRAM_BUCKETS; i++) {
+		h->counts[i] /= 2;
+		h->count += h->counts[i];
+	}
+	h->sum /= 2;
+}
+
+/**
+ * get the value below which percentile % of the samples are
+ *
+ * @param percentile 0 to 100, e.g. 99.9 for the p999
+ * @return the highest value of the bucket the percentile falls into, capped by the largest sample. 0 if there are no samples
+ */
+guint64 network_histogram_get_percentile(const network_histogram_t *h, gdouble percentile) {
+	guint64 rank, seen = 0;
+	guint i;
+
+	if (h->count == 0) return 0;
+
+	rank = (guint64)(h->count * percentile / 100.0 + 0.5);
+	if (rank < 1) rank = 1;
+	if (rank > h->count) rank = h->count;
+
+	for (i = 0; i < NETWORK_HISTOGRAM_BUCKETS; i++) {
+		seen += h->counts[i];
+
+		if (seen >= rank) return MIN(network_histogram_get_bucket_max(i), h->max);
+	}
+
+	return h->max;
+}
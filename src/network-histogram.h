@@ -0,0 +1,62 @@
+/* $%BEGINLICENSE%$
+ Copyright (c) 2008, 2012, Oracle and/or its affiliates. All rights reserved.
+
+ This program is free software; you can redistribute it and/or
+ modify it under the terms of the GNU General Public License as
+ published by the Free Software Foundation; version 2 of the
+ License.
+
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ GNU General Public License for more details.
+
+ You should have received a copy of the GNU General Public License
+ along with this program; if not, write to the Free Software
+ Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA
+ 02110-1301  USA
+
+ $%ENDLICENSE%$ */
+#ifndef __NETWORK_HISTOGRAM_H__
+#define __NETWORK_HISTOGRAM_H__
+
+#include <glib.h>
+
+#include "network-exports.h"
+
+/**
+ * each power of 2 is split into 2^SUB_BITS linear buckets, the error of a value is below 1/2^SUB_BITS
+ */
+#define NETWORK_HISTOGRAM_SUB_BITS    4
+#define NETWORK_HISTOGRAM_SUB_BUCKETS (1 << NETWORK_HISTOGRAM_SUB_BITS)
+
+/**
+ * values beyond 2^NETWORK_HISTOGRAM_MAX_BITS - 1 go into the last bucket (in microseconds that's about 19h)
+ */
+#define NETWORK_HISTOGRAM_MAX_BITS    36
+#define NETWORK_HISTOGRAM_BUCKETS     ((NETWORK_HISTOGRAM_MAX_BITS - NETWORK_HISTOGRAM_SUB_BITS + 1) * NETWORK_HISTOGRAM_SUB_BUCKETS)
+
+/**
+ * a log-linear histogram of values, like latencies in microseconds
+ *
+ * a histogram has a single writer and isn't locked. Readers merge the histograms
+ * of the writers with network_histogram_merge() and may miss the samples that are
+ * added while they read.
+ */
+typedef struct {
+	guint64 counts[NETWORK_HISTOGRAM_BUCKETS];
+
+	guint64 count;
+	guint64 sum;
+	guint64 max;
+} network_histogram_t;
+
+NETWORK_API network_histogram_t *network_histogram_new(void);
+NETWORK_API void network_histogram_free(network_histogram_t *h);
+NETWORK_API void network_histogram_reset(network_histogram_t *h);
+NETWORK_API void network_histogram_add(network_histogram_t *h, guint64 value);
+NETWORK_API void network_histogram_merge(network_histogram_t *dst, const network_histogram_t *src);
+NETWORK_API void network_histogram_halve(network_histogram_t *h);
+NETWORK_API guint64 network_histogram_get_percentile(const network_histogram_t *h, gdouble percentile);
+
+#endif
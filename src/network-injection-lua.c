@@ -61,10 +61,7 @@ static int proxy_queue_add(lua_State *L, proxy_queue_add_t type) {
 	const char *str = luaL_checklstring(L, 3, &str_len);
 	injection *inj;
 
-	GString *query = g_string_sized_new(str_len);
-	g_string_append_len(query, str, str_len);
-
-	inj = injection_new(resp_type, query);
+	inj = injection_new_len(resp_type, str, str_len);
 	inj->resultset_is_needed = FALSE;
 
 	/* check the 4th (last) param */
@@ -87,6 +84,22 @@ static int proxy_queue_add(lua_State *L, proxy_queue_add_t type) {
 			}
 		}
 
+		lua_pop(L, 1);
+
+		lua_getfield(L, 4, "rows_batch_size");
+		if (lua_isnil(L, -1)) {
+			/* no defined */
+		} else if (lua_isnumber(L, -1) && lua_tointeger(L, -1) >= 0) {
+			inj->rows_batch_size = lua_tointeger(L, -1);
+		} else {
+			switch (type) {
+			case PROXY_QUEUE_ADD_APPEND:
+				return luaL_argerror(L, 4, ":append(..., { rows_batch_size = number } ), is %s");
+			case PROXY_QUEUE_ADD_PREPEND:
+				return luaL_argerror(L, 4, ":prepend(..., { rows_batch_size = number } ), is %s");
+			}
+		}
+
 		lua_pop(L, 1);
 		break;
 	default:
@@ -118,6 +131,8 @@ static int proxy_queue_add(lua_State *L, proxy_queue_add_t type) {
  *   options: table of options (table)
  *     backend_ndx:  backend_ndx to send it to (numeric)
  *     resultset_is_needed: expose the result-set into lua (bool)
+ *     rows_batch_size: call read_query_result_rows(inj, rows) for each batch of this many
+ *                      rows while the result is forwarded (numeric)
  */
 static int proxy_queue_append(lua_State *L) {
 	return proxy_queue_add(L, PROXY_QUEUE_ADD_APPEND);
@@ -258,7 +273,8 @@ static int proxy_resultset_rows_iter(lua_State *L) {
 	int err = 0;
 	network_mysqld_lenenc_type lenenc_type;
     
-	GList *chunk = res->row;
+	/* each iterator has its own position, the result-set is shared */
+	GList *chunk = lua_touserdata(L, lua_upvalueindex(2));
     
 	g_return_val_if_fail(chunk != NULL, 0);
 
@@ -319,7 +335,8 @@ static int proxy_resultset_rows_iter(lua_State *L) {
 		g_return_val_if_fail(err == 0, 0); /* protocol error */
 	}
     
-	res->row = res->row->next;
+	lua_pushlightuserdata(L, chunk->next);
+	lua_replace(L, lua_upvalueindex(2));
     
 	return 1;
 }
@@ -341,7 +358,7 @@ static int parse_resultset_fields(proxy_resultset_t *res) {
     
 	if (!res->fields) return -1;
     
-	chunk = network_mysqld_proto_get_fielddefs(res->result_queue->head, res->fields);
+	chunk = network_mysqld_proto_get_fielddefs(res->head, res->fields);
     
 	/* no result-set found */
 	if (!chunk) return -1;
@@ -381,6 +398,348 @@ static int proxy_resultset_fields_lua_push_ref(lua_State *L, GRef *ref) {
 	return 1;
 }
 
+/**
+ * collect the row packets of the result-set in one pass
+ *
+ * the index is kept in the result-set, all later accesses are O(1)
+ *
+ * @return -1 if this is not a result-set or it is invalid
+ */
+static int parse_resultset_rows_index(proxy_resultset_t *res) {
+	GList *chunk;
+
+	if (res->rows_index) return 0;
+
+	if (0 != parse_resultset_fields(res)) return -1;
+
+	res->rows_index = g_ptr_array_sized_new(res->rows);
+
+	for (chunk = res->rows_chunk_head; chunk; chunk = chunk->next) {
+		network_packet packet;
+		network_mysqld_lenenc_type lenenc_type;
+		int err = 0;
+
+		packet.data = chunk->data;
+		packet.offset = 0;
+
+		err = err || network_mysqld_proto_skip_network_header(&packet);
+		err = err || network_mysqld_proto_peek_lenenc_type(&packet, &lenenc_type);
+		if (err) {
+			g_ptr_array_free(res->rows_index, TRUE);
+			res->rows_index = NULL;
+
+			return -1;
+		}
+
+		/* the EOF or a ERR instead of the rows, see proxy_resultset_rows_iter() */
+		if (lenenc_type == NETWORK_MYSQLD_LENENC_TYPE_EOF ||
+		    lenenc_type == NETWORK_MYSQLD_LENENC_TYPE_ERR) {
+			break;
+		}
+
+		g_ptr_array_add(res->rows_index, chunk->data);
+	}
+
+	return 0;
+}
+
+/**
+ * a row of the .indexed_rows
+ */
+typedef struct {
+	GRef *ref;
+	guint ndx;
+} proxy_resultset_row_t;
+
+/**
+ * get a field of a text-protocol row
+ *
+ * only the fields in front of it are skipped, nothing is copied
+ */
+static int proxy_resultset_row_field_get(lua_State *L) {
+	proxy_resultset_row_t *row = luaL_checkself(L);
+	proxy_resultset_t *res = row->ref->udata;
+	lua_Integer ndx = luaL_checkinteger(L, 2);
+	network_packet packet;
+	network_mysqld_lenenc_type lenenc_type;
+	guint64 field_len;
+	lua_Integer i;
+	int err = 0;
+
+	if (ndx < 1 || ndx > (lua_Integer)res->fields->len) {
+		lua_pushnil(L);
+		return 1;
+	}
+
+	packet.data = res->rows_index->pdata[row->ndx];
+	packet.offset = 0;
+
+	err = err || network_mysqld_proto_skip_network_header(&packet);
+
+	for (i = 1; 0 == err; i++) {
+		err = err || network_mysqld_proto_peek_lenenc_type(&packet, &lenenc_type);
+		if (err) break;
+
+		if (lenenc_type == NETWORK_MYSQLD_LENENC_TYPE_NULL) {
+			err = err || network_mysqld_proto_skip(&packet, 1);
+			if (i == ndx) {
+				if (err) break;
+
+				lua_pushnil(L);
+				return 1;
+			}
+			continue;
+		}
+
+		err = err || (lenenc_type != NETWORK_MYSQLD_LENENC_TYPE_INT);
+		err = err || network_mysqld_proto_get_lenenc_int(&packet, &field_len);
+		err = err || !(field_len <= packet.data->len); /* just to check that we don't overrun by the addition */
+		err = err || !(packet.offset + field_len <= packet.data->len);
+		if (err) break;
+
+		if (i == ndx) {
+			lua_pushlstring(L, packet.data->str + packet.offset, field_len);
+			return 1;
+		}
+
+		err = err || network_mysqld_proto_skip(&packet, field_len);
+	}
+
+	return luaL_error(L, "%s: row-data is invalid", G_STRLOC);
+}
+
+static int proxy_resultset_row_len(lua_State *L) {
+	proxy_resultset_row_t *row = luaL_checkself(L);
+	proxy_resultset_t *res = row->ref->udata;
+
+	lua_pushinteger(L, res->fields->len);
+
+	return 1;
+}
+
+static int proxy_resultset_row_gc(lua_State *L) {
+	proxy_resultset_row_t *row = luaL_checkself(L);
+
+	g_ref_unref(row->ref);
+
+	return 0;
+}
+
+static const struct luaL_reg methods_proxy_resultset_row[] = {
+	{ "__index", proxy_resultset_row_field_get },
+	{ "__len", proxy_resultset_row_len },
+	{ "__gc", proxy_resultset_row_gc },
+	{ NULL, NULL },
+};
+
+/**
+ * get a row of the .indexed_rows
+ *
+ * the row is a userdata, the fields are only decoded when they are accessed
+ */
+static int proxy_resultset_indexed_rows_get(lua_State *L) {
+	GRef *ref = *(GRef **)luaL_checkself(L);
+	proxy_resultset_t *res = ref->udata;
+	lua_Integer ndx = luaL_checkinteger(L, 2);
+	proxy_resultset_row_t *row;
+
+	if (ndx < 1 || ndx > (lua_Integer)res->rows_index->len) {
+		lua_pushnil(L);
+		return 1;
+	}
+
+	g_ref_ref(ref);
+
+	row = lua_newuserdata(L, sizeof(*row));
+	row->ref = ref;
+	row->ndx = ndx - 1; /** lua starts at 1, C at 0 */
+
+	proxy_getmetatable(L, methods_proxy_resultset_row);
+	lua_setmetatable(L, -2);
+
+	return 1;
+}
+
+static int proxy_resultset_indexed_rows_len(lua_State *L) {
+	GRef *ref = *(GRef **)luaL_checkself(L);
+	proxy_resultset_t *res = ref->udata;
+
+	lua_pushinteger(L, res->rows_index->len);
+
+	return 1;
+}
+
+static const struct luaL_reg methods_proxy_resultset_indexed_rows[] = {
+	{ "__index", proxy_resultset_indexed_rows_get },
+	{ "__len", proxy_resultset_indexed_rows_len },
+	{ "__gc", proxy_resultset_gc },
+	{ NULL, NULL },
+};
+
+static int proxy_resultset_indexed_rows_lua_push_ref(lua_State *L, GRef *ref) {
+	GRef **ref_p;
+
+	g_ref_ref(ref);
+	
+	ref_p = lua_newuserdata(L, sizeof(GRef *));
+	*ref_p = ref;
+
+	proxy_getmetatable(L, methods_proxy_resultset_indexed_rows);
+	lua_setmetatable(L, -2);
+
+	return 1;
+}
+
+/**
+ * decode the rows of a binary result-set into columns
+ *
+ * @return -1 if this is not a binary result-set or it can't be decoded
+ */
+static int parse_resultset_columns(proxy_resultset_t *res) {
+	if (res->columns) return 0;
+
+	if (!res->qstat.binary_encoded) return -1;
+	if (0 != parse_resultset_fields(res)) return -1;
+	if (!res->rows_chunk_head) return -1;
+
+	res->columns = network_mysqld_columns_new(res->fields, res->rows);
+	if (!res->columns) return -1;
+
+	if (NULL == network_mysqld_columns_add_binary_rows(res->columns, res->rows_chunk_head)) {
+		network_mysqld_columns_free(res->columns);
+		res->columns = NULL;
+
+		return -1;
+	}
+
+	return 0;
+}
+
+/**
+ * get a value of the decoded columns
+ *
+ *   columns:get(row, col)
+ *
+ * ints and doubles are returned as numbers, everything else as string
+ */
+static int proxy_resultset_columns_value_get(lua_State *L) {
+	GRef *ref = *(GRef **)luaL_checkself(L);
+	proxy_resultset_t *res = ref->udata;
+	network_mysqld_columns_t *cols = res->columns;
+	lua_Integer row = luaL_checkinteger(L, 2);
+	lua_Integer col_ndx = luaL_checkinteger(L, 3);
+	network_mysqld_column_t *col;
+	const char *s;
+	gsize s_len;
+	gchar *str;
+
+	/* lua starts at 1, C at 0 */
+	if (row < 1 || row > (lua_Integer)cols->rows ||
+	    col_ndx < 1 || col_ndx > (lua_Integer)cols->columns_len) {
+		lua_pushnil(L);
+		return 1;
+	}
+	row--;
+	col = &cols->columns[col_ndx - 1];
+
+	if (col->is_null[row]) {
+		lua_pushnil(L);
+		return 1;
+	}
+
+	switch (col->kind) {
+	case NETWORK_MYSQLD_COLUMN_INT:
+		if (col->is_unsigned) {
+			lua_pushnumber(L, (guint64)col->v.i[row]);
+		} else {
+			lua_pushnumber(L, col->v.i[row]);
+		}
+		break;
+	case NETWORK_MYSQLD_COLUMN_DOUBLE:
+		lua_pushnumber(L, col->v.d[row]);
+		break;
+	case NETWORK_MYSQLD_COLUMN_STRING:
+		network_mysqld_columns_get_string(cols, col_ndx - 1, row, &s, &s_len);
+		lua_pushlstring(L, s, s_len);
+		break;
+	case NETWORK_MYSQLD_COLUMN_DATE: {
+		network_mysqld_type_date_t *date = &col->v.date[row];
+
+		if (col->type == MYSQL_TYPE_DATE) {
+			str = g_strdup_printf("%04u-%02u-%02u",
+					date->year,
+					date->month,
+					date->day);
+		} else {
+			str = g_strdup_printf("%04u-%02u-%02u %02u:%02u:%02u.%09u",
+					date->year,
+					date->month,
+					date->day,
+					date->hour,
+					date->min,
+					date->sec,
+					date->nsec);
+		}
+		lua_pushstring(L, str);
+		g_free(str);
+		break; }
+	case NETWORK_MYSQLD_COLUMN_TIME: {
+		network_mysqld_type_time_t *t = &col->v.time[row];
+
+		str = g_strdup_printf("%s%d %02u:%02u:%02u.%09u",
+				t->sign ? "-" : "",
+				t->days,
+				t->hour,
+				t->min,
+				t->sec,
+				t->nsec);
+		lua_pushstring(L, str);
+		g_free(str);
+		break; }
+	}
+
+	return 1;
+}
+
+static int proxy_resultset_columns_get(lua_State *L) {
+	GRef *ref = *(GRef **)luaL_checkself(L);
+	proxy_resultset_t *res = ref->udata;
+	gsize keysize = 0;
+	const char *key = luaL_checklstring(L, 2, &keysize);
+
+	if (strleq(key, keysize, C("row_count"))) {
+		lua_pushinteger(L, res->columns->rows);
+	} else if (strleq(key, keysize, C("column_count"))) {
+		lua_pushinteger(L, res->columns->columns_len);
+	} else if (strleq(key, keysize, C("get"))) {
+		lua_pushcfunction(L, proxy_resultset_columns_value_get);
+	} else {
+		lua_pushnil(L);
+	}
+
+	return 1;
+}
+
+static const struct luaL_reg methods_proxy_resultset_columns[] = {
+	{ "__index", proxy_resultset_columns_get },
+	{ "__gc", proxy_resultset_gc },
+	{ NULL, NULL },
+};
+
+static int proxy_resultset_columns_lua_push_ref(lua_State *L, GRef *ref) {
+	GRef **ref_p;
+
+	g_ref_ref(ref);
+	
+	ref_p = lua_newuserdata(L, sizeof(GRef *));
+	*ref_p = ref;
+
+	proxy_getmetatable(L, methods_proxy_resultset_columns);
+	lua_setmetatable(L, -2);
+
+	return 1;
+}
+
 static int proxy_resultset_get(lua_State *L) {
 	GRef *ref = *(GRef **)luaL_checkself(L);
 	proxy_resultset_t *res = ref->udata;
@@ -405,7 +764,7 @@ static int proxy_resultset_get(lua_State *L) {
 		if (!res->result_queue) {
 			luaL_error(L, ".resultset.rows isn't available if 'resultset_is_needed ~= true'");
 		} else if (res->qstat.binary_encoded) {
-			luaL_error(L, ".resultset.rows isn't available for prepared statements");
+			luaL_error(L, ".resultset.rows isn't available for prepared statements, use .resultset.columns");
 		} else {
 			parse_resultset_fields(res); /* set up the ->rows_chunk_head pointer */
 		
@@ -413,8 +772,49 @@ static int proxy_resultset_get(lua_State *L) {
 				res->row    = res->rows_chunk_head;
 
 				proxy_resultset_lua_push_ref(L, ref);
+				lua_pushlightuserdata(L, res->rows_chunk_head);
 		    
-				lua_pushcclosure(L, proxy_resultset_rows_iter, 1);
+				lua_pushcclosure(L, proxy_resultset_rows_iter, 2);
+			} else {
+				lua_pushnil(L);
+			}
+		}
+	} else if (strleq(key, keysize, C("indexed_rows"))) {
+		if (!res->result_queue) {
+			luaL_error(L, ".resultset.indexed_rows isn't available if 'resultset_is_needed ~= true'");
+		} else if (res->qstat.binary_encoded) {
+			luaL_error(L, ".resultset.indexed_rows isn't available for prepared statements, use .resultset.columns");
+		} else if (0 == parse_resultset_rows_index(res)) {
+			proxy_resultset_indexed_rows_lua_push_ref(L, ref);
+		} else {
+			lua_pushnil(L);
+		}
+	} else if (strleq(key, keysize, C("columns"))) {
+		if (!res->result_queue) {
+			luaL_error(L, ".resultset.columns isn't available if 'resultset_is_needed ~= true'");
+		} else if (!res->qstat.binary_encoded) {
+			luaL_error(L, ".resultset.columns is only available for prepared statements, use .resultset.rows");
+		} else if (0 == parse_resultset_columns(res)) {
+			proxy_resultset_columns_lua_push_ref(L, ref);
+		} else {
+			lua_pushnil(L);
+		}
+	} else if (strleq(key, keysize, C("next"))) {
+		/* the next result-set of a multi-statement or a CALL, nil after the last one */
+		if (!res->result_queue) {
+			luaL_error(L, ".resultset.next isn't available if 'resultset_is_needed ~= true'");
+		} else {
+			if (NULL == res->next) {
+				proxy_resultset_t *next = proxy_resultset_get_next(res);
+
+				if (next) {
+					res->next = g_ref_new();
+					g_ref_set(res->next, next, (GDestroyNotify)proxy_resultset_free);
+				}
+			}
+
+			if (res->next) {
+				proxy_resultset_lua_push_ref(L, res->next);
 			} else {
 				lua_pushnil(L);
 			}
@@ -428,7 +828,7 @@ static int proxy_resultset_get(lua_State *L) {
 			luaL_error(L, ".resultset.raw isn't available if 'resultset_is_needed ~= true'");
 		} else {
 			GString *s;
-			s = res->result_queue->head->data;
+			s = res->head->data;
 			lua_pushlstring(L, s->str + 4, s->len - 4); /* skip the network-header */
 		}
 	} else if (strleq(key, keysize, C("flags"))) {
@@ -498,22 +898,6 @@ static int proxy_resultset_lua_push_ref(lua_State *L, GRef *ref) {
 	return 1;
 }
 
-static int proxy_resultset_lua_push(lua_State *L, proxy_resultset_t *_res) {
-	GRef **ref_p;
-	GRef *ref;
-
-	ref = g_ref_new();
-	g_ref_set(ref, _res, (GDestroyNotify)proxy_resultset_free);
-	
-	ref_p = lua_newuserdata(L, sizeof(GRef *));
-	*ref_p = ref;
-
-	proxy_getmetatable(L, methods_proxy_resultset);
-	lua_setmetatable(L, -2);
-
-	return 1;
-}
-
 static int proxy_injection_get(lua_State *L) {
 	injection *inj = *(injection **)luaL_checkself(L);
 	gsize keysize = 0;
@@ -530,22 +914,42 @@ static int proxy_injection_get(lua_State *L) {
 	} else if (strleq(key, keysize, C("response_time"))) {
 		lua_pushinteger(L, chassis_calc_rel_microseconds(inj->ts_read_query, inj->ts_read_query_result_last));
 	} else if (strleq(key, keysize, C("resultset"))) {
-		/* fields, rows */
-		proxy_resultset_t *res;
-        
-		res = proxy_resultset_new();
+		/* fields, rows
+		 *
+		 * created once per injection to keep the parsed fields and
+		 * the rows-index across all accesses of inj.resultset */
+		if (NULL == inj->resultset) {
+			proxy_resultset_t *res;
+
+			res = proxy_resultset_new();
+
+			/* only expose the resultset if really needed,
+			 * binary result-sets are decoded by .columns */
+			if (inj->resultset_is_needed) {
+				res->result_queue = inj->result_queue;
+				res->head = inj->result_queue->head;
+
+				/* a prepared statement brings the fields it had before */
+				if (inj->fields && res->head) {
+					GList *chunk = network_mysqld_proto_skip_fielddefs(res->head, ((GPtrArray *)inj->fields->udata)->len);
+
+					if (chunk) {
+						g_ref_ref(inj->fields);
+						res->fields_ref = inj->fields;
+						res->fields = inj->fields->udata;
+						res->rows_chunk_head = chunk->next;
+					}
+				}
+			}
+			res->qstat = inj->qstat;
+			res->rows  = inj->rows;
+			res->bytes = inj->bytes;
 
-		/* only expose the resultset if really needed 
-		   FIXME: if the resultset is encoded in binary form, we can't provide it either.
-		 */
-		if (inj->resultset_is_needed && !inj->qstat.binary_encoded) {	
-			res->result_queue = inj->result_queue;
+			inj->resultset = g_ref_new();
+			g_ref_set(inj->resultset, res, (GDestroyNotify)proxy_resultset_free);
 		}
-		res->qstat = inj->qstat;
-		res->rows  = inj->rows;
-		res->bytes = inj->bytes;
-	
-		proxy_resultset_lua_push(L, res);
+
+		proxy_resultset_lua_push_ref(L, inj->resultset);
 	} else {
 		g_message("%s.%d: inj[%s] ... not found", __FILE__, __LINE__, key);
         
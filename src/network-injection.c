@@ -28,6 +28,7 @@
 #include "glib-ext.h"
 #include "lua-env.h"
 #include "chassis-timings.h"
+#include "network-object-pool.h"
 
 #define C(x) x, sizeof(x) - 1
 #define S(x) x->str, x->len
@@ -37,14 +38,35 @@
 
 
 /**
- * Initialize an injection struct.
+ * each statement the scripts inject allocates a injection and its query
  */
-injection *injection_new(int id, GString *query) {
+#define NETWORK_INJECTION_POOL_MAX_IDLE 64
+
+/**
+ * a idle injection keeps its query buffer up to this size, larger ones are freed
+ */
+#define NETWORK_INJECTION_QUERY_MAX_KEEP 4096
+
+static void injection_destroy(injection *i) {
+	if (i->query) g_string_free(i->query, TRUE);
+
+	g_free(i);
+}
+
+static network_object_pool_t injection_pool = NETWORK_OBJECT_POOL_INIT(NETWORK_INJECTION_POOL_MAX_IDLE, injection_destroy);
+
+/**
+ * get a injection from the pool of the thread
+ *
+ * its .query is the kept buffer of a earlier injection or NULL
+ */
+static injection *injection_alloc(int id) {
 	injection *i;
     
-	i = g_new0(injection, 1);
+	if (NULL == (i = network_object_pool_get(&injection_pool))) {
+		i = g_new0(injection, 1);
+	}
 	i->id = id;
-	i->query = query;
 	i->resultset_is_needed = FALSE; /* don't buffer the resultset */
     
 	/**
@@ -57,15 +79,65 @@ injection *injection_new(int id, GString *query) {
 	return i;
 }
 
+/**
+ * Initialize an injection struct.
+ *
+ * takes over the query
+ */
+injection *injection_new(int id, GString *query) {
+	injection *i;
+    
+	i = injection_alloc(id);
+	if (i->query) g_string_free(i->query, TRUE);
+	i->query = query;
+    
+	return i;
+}
+
+/**
+ * Initialize an injection struct with a copy of the query
+ *
+ * reuses the query buffer of a recycled injection
+ */
+injection *injection_new_len(int id, const char *query, gsize query_len) {
+	injection *i;
+    
+	i = injection_alloc(id);
+	if (i->query) {
+		g_string_truncate(i->query, 0);
+		g_string_append_len(i->query, query, query_len);
+	} else {
+		i->query = g_string_new_len(query, query_len);
+	}
+    
+	return i;
+}
+
 /**
  * Free an injection struct
+ *
+ * the struct and a small query buffer go back to the pool of the thread
  */
 void injection_free(injection *i) {
+	GString *query;
+
 	if (!i) return;
     
-	if (i->query) g_string_free(i->query, TRUE);
-    
-	g_free(i);
+	if (i->resultset) g_ref_unref(i->resultset);
+	if (i->fields) g_ref_unref(i->fields);
+
+	query = i->query;
+	if (query && query->allocated_len > NETWORK_INJECTION_QUERY_MAX_KEEP) {
+		g_string_free(query, TRUE);
+		query = NULL;
+	}
+
+	memset(i, 0, sizeof(*i));
+	i->query = query;
+
+	if (!network_object_pool_put(&injection_pool, i)) {
+		injection_destroy(i);
+	}
 }
 
 network_injection_queue *network_injection_queue_new() {
@@ -119,11 +191,108 @@ proxy_resultset_t *proxy_resultset_new() {
 void proxy_resultset_free(proxy_resultset_t *res) {
 	if (!res) return;
     
-	if (res->fields) {
+	if (res->fields_ref) {
+		g_ref_unref(res->fields_ref);
+	} else if (res->fields) {
 		network_mysqld_proto_fielddefs_free(res->fields);
 	}
+
+	if (res->rows_index) {
+		g_ptr_array_free(res->rows_index, TRUE);
+	}
+
+	if (res->columns) {
+		network_mysqld_columns_free(res->columns);
+	}
+
+	if (res->next) {
+		g_ref_unref(res->next);
+	}
     
 	g_free(res);
 }
 
+/**
+ * run the packets of one result-set through the result-tracker
+ *
+ * @return the last packet of the result-set, NULL if the packets end before or can't be parsed
+ */
+static GList *proxy_resultset_scan(GList *chunk, network_mysqld_com_query_result_t *query, gboolean use_binary_row_data) {
+	for (; chunk; chunk = chunk->next) {
+		network_packet packet;
+		int is_finished;
+
+		packet.data = chunk->data;
+		packet.offset = NET_HEADER_SIZE;
+
+		is_finished = network_mysqld_proto_get_com_query_result(&packet, query, use_binary_row_data);
+		if (is_finished == -1) return NULL;
+
+		/* the last result-set is done or the next one starts */
+		if (is_finished == 1 || query->state == PARSE_COM_QUERY_INIT) return chunk;
+	}
+
+	return NULL;
+}
+
+/**
+ * get the result-set that follows in the same response
+ *
+ * a multi-statement or a CALL returns several result-sets in one response, all but the
+ * last one have SERVER_MORE_RESULTS_EXISTS set. The next one shares the .result_queue
+ * and gets its own status and row-count.
+ *
+ * @return a new result-set, NULL if this is the last one or the packets can't be parsed
+ */
+proxy_resultset_t *proxy_resultset_get_next(proxy_resultset_t *res) {
+	network_mysqld_com_query_result_t *query;
+	proxy_resultset_t *next;
+	GList *last;
+
+	if (!res->result_queue || !res->head) return NULL;
+
+	/* find the end of this one */
+	query = network_mysqld_com_query_result_new();
+	query->deprecate_eof = res->qstat.deprecate_eof;
+	last = proxy_resultset_scan(res->head, query, res->qstat.binary_encoded);
+
+	if (!last || !last->next || !(query->server_status & SERVER_MORE_RESULTS_EXISTS)) {
+		network_mysqld_com_query_result_free(query);
+
+		return NULL;
+	}
+	network_mysqld_com_query_result_free(query);
+
+	/* and collect the status of the next one */
+	query = network_mysqld_com_query_result_new();
+	query->deprecate_eof = res->qstat.deprecate_eof;
+
+	if (!proxy_resultset_scan(last->next, query, res->qstat.binary_encoded)) {
+		network_mysqld_com_query_result_free(query);
+
+		return NULL;
+	}
+
+	next = proxy_resultset_new();
+	next->result_queue = res->result_queue;
+	next->head = last->next;
+	next->rows = query->rows;
+	next->bytes = query->bytes;
+
+	next->qstat.was_resultset = query->was_resultset;
+	next->qstat.binary_encoded = res->qstat.binary_encoded;
+	next->qstat.deprecate_eof = res->qstat.deprecate_eof;
+	if (!query->was_resultset) {
+		next->qstat.affected_rows = query->affected_rows;
+		next->qstat.insert_id     = query->insert_id;
+	}
+	next->qstat.server_status = query->server_status;
+	next->qstat.warning_count = query->warning_count;
+	next->qstat.query_status  = query->query_status;
+
+	network_mysqld_com_query_result_free(query);
+
+	return next;
+}
+
 
@@ -28,6 +28,9 @@
 
 #include <glib.h>
 
+#include "network-mysqld-columns.h"
+#include "glib-ext-ref.h"
+
 #include "network-exports.h"
 
 typedef struct {
@@ -42,6 +45,8 @@ typedef struct {
 	gboolean was_resultset;                      /**< if set, affected_rows and insert_id are ignored */
 	
 	gboolean binary_encoded;                     /**< if set, the row data is binary encoded. we need the metadata to decode */
+
+	gboolean deprecate_eof;                      /**< if set, the result-sets end with a OK packet instead of a EOF */
     
 	/**
 	 * MYSQLD_PACKET_OK or MYSQLD_PACKET_ERR
@@ -49,6 +54,30 @@ typedef struct {
 	guint8 query_status;
 } query_status;
 
+/**
+ * parsed result set
+ */
+typedef struct {
+	GQueue *result_queue;   /**< where the packets are read from */
+	GList *head;            /**< the first packet of this result-set in .result_queue */
+    
+	GPtrArray *fields;      /**< the parsed fields */
+	GRef *fields_ref;       /**< the owner of .fields if they are shared, see network_stmt_cache_get_coldefs() */
+    
+	GList *rows_chunk_head; /**< pointer to the EOF packet after the fields */
+	GList *row;             /**< the current row */
+	GPtrArray *rows_index;  /**< the row packets in order, built on the first indexed access */
+
+	network_mysqld_columns_t *columns; /**< the binary rows decoded into columns, see .columns */
+    
+	query_status qstat;     /**< state of this query */
+	
+	guint64      rows;
+	guint64      bytes;
+
+	GRef        *next;      /**< the next result-set of a multi-result response, see proxy_resultset_get_next() */
+} proxy_resultset_t;
+
 typedef struct {
 	GString *query;
     
@@ -66,6 +95,10 @@ typedef struct {
 	guint64      bytes;
 
 	gboolean     resultset_is_needed;       /**< flag to announce if we have to buffer the result for later processing */
+	guint        rows_batch_size;           /**< pass the rows to read_query_result_rows() in batches of this size, 0 if not */
+
+	GRef        *resultset;                 /**< the proxy_resultset_t of inj.resultset, shared by all accesses */
+	GRef        *fields;                    /**< the fields of a COM_STMT_EXECUTE result-set, shared with the statement-cache */
 } injection;
 
 /**
@@ -81,28 +114,14 @@ NETWORK_API void network_injection_queue_prepend(network_injection_queue *q, inj
 NETWORK_API void network_injection_queue_append(network_injection_queue *q, injection *inj);
 NETWORK_API guint network_injection_queue_len(network_injection_queue *q);
 
-/**
- * parsed result set
- */
-typedef struct {
-	GQueue *result_queue;   /**< where the packets are read from */
-    
-	GPtrArray *fields;      /**< the parsed fields */
-    
-	GList *rows_chunk_head; /**< pointer to the EOF packet after the fields */
-	GList *row;             /**< the current row */
-    
-	query_status qstat;     /**< state of this query */
-	
-	guint64      rows;
-	guint64      bytes;
-} proxy_resultset_t;
 
 NETWORK_API injection *injection_new(int id, GString *query);
+NETWORK_API injection *injection_new_len(int id, const char *query, gsize query_len);
 NETWORK_API void injection_free(injection *i);
 
 NETWORK_API proxy_resultset_t *proxy_resultset_init() G_GNUC_DEPRECATED;
 NETWORK_API proxy_resultset_t *proxy_resultset_new();
 NETWORK_API void proxy_resultset_free(proxy_resultset_t *res);
+NETWORK_API proxy_resultset_t *proxy_resultset_get_next(proxy_resultset_t *res);
 
 #endif /* _QUERY_HANDLING_H_ */
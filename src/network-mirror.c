@@ -0,0 +1,833 @@
+/* $%BEGINLICENSE%$
+ Copyright (c) 2008, 2012, Oracle and/or its affiliates. All rights reserved.
+
+ This program is free software; you can redistribute it and/or
+ modify it under the terms of the GNU General Public License as
+ published by the Free Software Foundation; version 2 of the
+ License.
+
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ GNU General Public License for more details.
+
+ You should have received a copy of the GNU General Public License
+ along with this program; if not, write to the Free Software
+ Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA
+ 02110-1301  USA
+
+ $%ENDLICENSE%$ */
+
+/** @file
+ * mirror sampled reads of the clients to a canary backend
+ *
+ * the mirror connections run in the event-thread of the clients whose queries they
+ * send, but they never block them: the client sends its query to its backend as
+ * usual and only reports its result to the mirrored query once it is sent. If the
+ * mirror is slow its queue fills up and the next queries are shed.
+ */
+
+#include <string.h>
+#include <errno.h>
+
+#include <glib.h>
+
+#include "network-mirror.h"
+#include "network-backend-client.h"
+#include "network-socket.h"
+#include "network-mysqld.h"
+#include "network-mysqld-proto.h"
+#include "network-mysqld-packet.h"
+#include "network-mysqld-crc32.h"
+#include "chassis-event-thread.h"
+#include "chassis-timings.h"
+#include "glib-ext.h"
+
+#define S(x) x->str, x->len
+
+/**
+ * wait this long before connecting again after the mirror refused us
+ */
+#define NETWORK_MIRROR_RETRY_USEC (1 * G_USEC_PER_SEC)
+
+typedef enum {
+	NETWORK_MIRROR_CONN_CONNECT,
+	NETWORK_MIRROR_CONN_READ_HANDSHAKE,
+	NETWORK_MIRROR_CONN_SEND_AUTH,
+	NETWORK_MIRROR_CONN_READ_AUTH_RESULT,
+	NETWORK_MIRROR_CONN_IDLE,
+	NETWORK_MIRROR_CONN_SEND_INIT_DB,
+	NETWORK_MIRROR_CONN_READ_INIT_DB_RESULT,
+	NETWORK_MIRROR_CONN_SEND_QUERY,
+	NETWORK_MIRROR_CONN_READ_RESULT
+} network_mirror_conn_state_t;
+
+/**
+ * a connection to the mirror, it sends the queued queries one after the other
+ */
+typedef struct {
+	network_mirror_thread_t *thr;
+
+	network_mirror_conn_state_t state;
+	network_socket *sock;
+
+	GString *default_db;             /**< the default-db of the connection */
+
+	network_mirror_query_t *query;   /**< the query we send, NULL while idle */
+	network_mysqld_com_query_result_t *query_result;
+	guint64 query_usec;              /**< when the query was sent, in chassis_get_rel_microseconds() */
+} network_mirror_conn_t;
+
+static void network_mirror_conn_handle(int event_fd, short events, void *user_data);
+static void network_mirror_conn_run(network_mirror_conn_t *conn);
+
+static guint network_mirror_hash_func(gconstpointer key) {
+	guint64 h = *(const guint64 *)key;
+
+	return (guint)(h ^ (h >> 32));
+}
+
+static gboolean network_mirror_equal_func(gconstpointer a, gconstpointer b) {
+	return *(const guint64 *)a == *(const guint64 *)b;
+}
+
+/**
+ * add a row to the checksum of the result
+ *
+ * the CRC32s of the rows are summed up as a backend may send them in another order
+ * if the query has no ORDER BY
+ *
+ * @param row the payload of the row-packet
+ */
+void network_mirror_result_add_row(network_mirror_result_t *res, const char *row, gsize row_len) {
+	res->rows++;
+	res->checksum += network_mysqld_crc32(0, row, row_len);
+}
+
+network_mirror_entry_t *network_mirror_entry_new(void) {
+	network_mirror_entry_t *entry;
+
+	entry = g_new0(network_mirror_entry_t, 1);
+	entry->text = g_string_new(NULL);
+
+	return entry;
+}
+
+void network_mirror_entry_free(network_mirror_entry_t *entry) {
+	if (!entry) return;
+
+	g_string_free(entry->text, TRUE);
+
+	g_free(entry);
+}
+
+static void network_mirror_query_free(network_mirror_query_t *q) {
+	g_string_free(q->text, TRUE);
+	g_string_free(q->packet, TRUE);
+	if (q->default_db) g_string_free(q->default_db, TRUE);
+
+	g_free(q);
+}
+
+/**
+ * both sides are done, compare their results and add them to the stats
+ */
+static void network_mirror_query_finish(network_mirror_query_t *q) {
+	network_mirror_thread_t *thr = q->thr;
+	network_mirror_entry_t *entry;
+	gboolean is_mismatch;
+
+	if (NULL == thr || q->is_failed) {
+		network_mirror_query_free(q);
+		return;
+	}
+
+	is_mismatch = (q->primary.query_status != q->mirror.query_status ||
+			q->primary.rows != q->mirror.rows ||
+			q->primary.checksum != q->mirror.checksum);
+
+	if (is_mismatch) {
+		g_debug("%s: mirror: the result of '%s' differs: %"G_GUINT64_FORMAT" rows, %"G_GUINT64_FORMAT" rows on the mirror",
+				G_STRLOC,
+				q->text->str,
+				q->primary.rows,
+				q->mirror.rows);
+	}
+
+	g_mutex_lock(thr->mutex);
+	if (is_mismatch) thr->mismatches++;
+
+	if (NULL == (entry = g_hash_table_lookup(thr->entries, &q->hash)) &&
+	    g_hash_table_size(thr->entries) < thr->mirror->max_entries) {
+		entry = network_mirror_entry_new();
+		entry->hash = q->hash;
+		g_string_append_len(entry->text, S(q->text));
+
+		g_hash_table_insert(thr->entries, &entry->hash, entry);
+	}
+
+	if (entry) {
+		entry->count++;
+		if (is_mismatch) entry->mismatches++;
+		entry->primary_usec += q->primary.usec;
+		entry->mirror_usec  += q->mirror.usec;
+	}
+	g_mutex_unlock(thr->mutex);
+
+	network_mirror_query_free(q);
+}
+
+/**
+ * the mirror sent its result
+ */
+static void network_mirror_query_mirror_done(network_mirror_query_t *q) {
+	q->mirror_is_done = TRUE;
+
+	if (q->primary_is_done) network_mirror_query_finish(q);
+}
+
+/**
+ * the mirror didn't get a result
+ */
+static void network_mirror_query_mirror_failed(network_mirror_query_t *q) {
+	network_mirror_thread_t *thr = q->thr;
+
+	if (thr) {
+		g_mutex_lock(thr->mutex);
+		thr->failed++;
+		g_mutex_unlock(thr->mutex);
+	}
+
+	q->is_failed = TRUE;
+	network_mirror_query_mirror_done(q);
+}
+
+/**
+ * the client got the result of its query from its backend
+ *
+ * the rows were added with network_mirror_result_add_row() to q->primary already
+ */
+void network_mirror_query_primary_done(network_mirror_query_t *q, guint8 query_status, guint64 usec) {
+	q->primary.query_status = query_status;
+	q->primary.usec = usec;
+	q->primary_is_done = TRUE;
+
+	if (q->mirror_is_done) network_mirror_query_finish(q);
+}
+
+/**
+ * the client didn't get a result, like when it went away
+ */
+void network_mirror_query_primary_failed(network_mirror_query_t *q) {
+	q->is_failed = TRUE;
+	q->primary_is_done = TRUE;
+
+	if (q->mirror_is_done) network_mirror_query_finish(q);
+}
+
+static network_mirror_conn_t *network_mirror_conn_new(network_mirror_thread_t *thr) {
+	network_mirror_conn_t *conn;
+
+	conn = g_new0(network_mirror_conn_t, 1);
+	conn->thr = thr;
+	conn->default_db = g_string_new(NULL);
+
+	return conn;
+}
+
+static void network_mirror_conn_free(network_mirror_conn_t *conn) {
+	if (conn->sock) network_socket_free(conn->sock);
+	if (conn->query_result) network_mysqld_com_query_result_free(conn->query_result);
+	g_string_free(conn->default_db, TRUE);
+
+	g_free(conn);
+}
+
+/**
+ * fail the queries that wait for a connection
+ */
+static void network_mirror_thread_fail_queued(network_mirror_thread_t *thr) {
+	network_mirror_query_t *q;
+
+	while (NULL != (q = g_queue_pop_head(thr->queued))) {
+		network_mirror_query_mirror_failed(q);
+	}
+}
+
+static void network_mirror_thread_kick(network_mirror_thread_t *thr);
+
+/**
+ * close a mirror connection after a error, its query failed
+ *
+ * if it didn't get to log in, the mirror isn't tried again for a while. Otherwise
+ * the queued queries get a new connection.
+ */
+static void network_mirror_conn_close(network_mirror_conn_t *conn, const char *reason) {
+	network_mirror_thread_t *thr = conn->thr;
+	gboolean is_logged_in = (conn->state >= NETWORK_MIRROR_CONN_IDLE);
+
+	g_debug("%s: mirror: closing the connection to %s: %s",
+			G_STRLOC,
+			thr->mirror->addr->name->str,
+			reason);
+
+	g_ptr_array_remove_fast(thr->conns, conn);
+
+	if (conn->query) {
+		network_mirror_query_mirror_failed(conn->query);
+		conn->query = NULL;
+	}
+
+	network_mirror_conn_free(conn);
+
+	if (!is_logged_in) {
+		thr->down_until_usec = chassis_get_rel_microseconds() + NETWORK_MIRROR_RETRY_USEC;
+
+		network_mirror_thread_fail_queued(thr);
+	} else {
+		network_mirror_thread_kick(thr);
+	}
+}
+
+/**
+ * send a command and prepare for its result
+ */
+static void network_mirror_conn_send_command(network_mirror_conn_t *conn, guint8 command, const char *arg, gsize arg_len) {
+	network_backend_client_send_command(conn->sock, command, arg, arg_len);
+
+	if (conn->query_result) network_mysqld_com_query_result_free(conn->query_result);
+	conn->query_result = network_mysqld_com_query_result_new();
+	conn->query_usec = chassis_get_rel_microseconds();
+}
+
+static void network_mirror_conn_wait_for_event(network_mirror_conn_t *conn, short ev_type) {
+	network_socket *sock = conn->sock;
+
+	event_set(&(sock->event), sock->fd, ev_type, network_mirror_conn_handle, conn);
+	if (conn->state == NETWORK_MIRROR_CONN_IDLE) {
+		/* only to notice that the mirror closed the connection */
+		chassis_event_add_local(conn->thr->mirror->srv, &(sock->event));
+	} else {
+		chassis_event_add_local_with_timeout(conn->thr->mirror->srv, &(sock->event), &(conn->thr->mirror->timeout));
+	}
+}
+
+/**
+ * checksum the rows of the result as they arrive, we don't keep them
+ *
+ * @return 1 if the result is complete, 0 if we need more packets, -1 on a protocol error
+ */
+static int network_mirror_conn_read_result(network_mirror_conn_t *conn) {
+	GString *s;
+
+	while (NULL != (s = g_queue_pop_head(conn->sock->recv_queue->chunks))) {
+		network_packet packet;
+		guint64 rows = conn->query_result->rows;
+		int is_finished;
+
+		packet.data = s;
+		packet.offset = 0;
+
+		if (0 != network_mysqld_proto_skip_network_header(&packet)) {
+			g_string_free(s, TRUE);
+			return -1;
+		}
+
+		is_finished = network_mysqld_proto_get_com_query_result(&packet, conn->query_result, FALSE);
+		if (conn->query_result->rows != rows) {
+			network_mirror_result_add_row(&(conn->query->mirror), s->str + NET_HEADER_SIZE, s->len - NET_HEADER_SIZE);
+		}
+		g_string_free(s, TRUE);
+
+		if (is_finished != 0) return is_finished;
+	}
+
+	return 0;
+}
+
+/**
+ * write the send-queue
+ *
+ * @return TRUE if everything is sent, FALSE if we wait for the socket or the connection is closed
+ */
+static gboolean network_mirror_conn_write(network_mirror_conn_t *conn) {
+	switch (network_socket_write(conn->sock, -1)) {
+	case NETWORK_SOCKET_SUCCESS:
+		return TRUE;
+	case NETWORK_SOCKET_WAIT_FOR_EVENT:
+		network_mirror_conn_wait_for_event(conn, EV_WRITE);
+		return FALSE;
+	default:
+		network_mirror_conn_close(conn, "write failed");
+		return FALSE;
+	}
+}
+
+/**
+ * wait for the next packet
+ *
+ * @return TRUE if we have a packet, FALSE if we wait for the socket or the connection is closed
+ */
+static gboolean network_mirror_conn_wait_read(network_mirror_conn_t *conn) {
+	switch (network_backend_client_read(conn->sock)) {
+	case NETWORK_SOCKET_SUCCESS:
+		return TRUE;
+	case NETWORK_SOCKET_WAIT_FOR_EVENT:
+		network_mirror_conn_wait_for_event(conn, EV_READ);
+		return FALSE;
+	default:
+		network_mirror_conn_close(conn, "read failed");
+		return FALSE;
+	}
+}
+
+/**
+ * take the next query of the queue, switch to its default-db first
+ *
+ * @return FALSE if the queue is empty
+ */
+static gboolean network_mirror_conn_next_query(network_mirror_conn_t *conn) {
+	network_mirror_query_t *q;
+
+	if (NULL == (q = g_queue_pop_head(conn->thr->queued))) return FALSE;
+
+	/* we may have waited for the mirror to close the connection */
+	event_del(&(conn->sock->event));
+
+	conn->query = q;
+
+	if (q->default_db && q->default_db->len > 0 && !g_string_equal(q->default_db, conn->default_db)) {
+		network_mirror_conn_send_command(conn, COM_INIT_DB, S(q->default_db));
+		conn->state = NETWORK_MIRROR_CONN_SEND_INIT_DB;
+	} else {
+		network_mirror_conn_send_command(conn, q->packet->str[0], q->packet->str + 1, q->packet->len - 1);
+		conn->state = NETWORK_MIRROR_CONN_SEND_QUERY;
+	}
+
+	return TRUE;
+}
+
+/**
+ * run the connection until it has to wait for the network or is closed
+ */
+static void network_mirror_conn_run(network_mirror_conn_t *conn) {
+	network_mirror_t *mirror = conn->thr->mirror;
+
+	for (;;) {
+		switch (conn->state) {
+		case NETWORK_MIRROR_CONN_CONNECT:
+			if (NETWORK_SOCKET_SUCCESS != network_socket_connect_finish(conn->sock)) {
+				network_mirror_conn_close(conn, g_strerror(errno));
+				return;
+			}
+			conn->state = NETWORK_MIRROR_CONN_READ_HANDSHAKE;
+			break;
+		case NETWORK_MIRROR_CONN_READ_HANDSHAKE:
+			if (!network_mirror_conn_wait_read(conn)) return;
+
+			if (0 != network_backend_client_send_auth(conn->sock, mirror->username, mirror->password, NULL)) {
+				network_mirror_conn_close(conn, "the server doesn't accept connections");
+				return;
+			}
+			conn->state = NETWORK_MIRROR_CONN_SEND_AUTH;
+			break;
+		case NETWORK_MIRROR_CONN_SEND_AUTH:
+			if (!network_mirror_conn_write(conn)) return;
+
+			conn->state = NETWORK_MIRROR_CONN_READ_AUTH_RESULT;
+			break;
+		case NETWORK_MIRROR_CONN_READ_AUTH_RESULT:
+			if (!network_mirror_conn_wait_read(conn)) return;
+
+			switch (network_backend_client_read_auth_result(conn->sock)) {
+			case 1:
+				break;
+			case 0:
+				/* the OK packet follows */
+				continue;
+			default:
+				g_critical("%s: mirror: login as '%s' on %s failed",
+						G_STRLOC,
+						mirror->username ? mirror->username : "",
+						mirror->addr->name->str);
+				network_mirror_conn_close(conn, "login failed");
+				return;
+			}
+
+			conn->state = NETWORK_MIRROR_CONN_IDLE;
+			break;
+		case NETWORK_MIRROR_CONN_IDLE:
+			if (!network_mirror_conn_next_query(conn)) {
+				network_mirror_conn_wait_for_event(conn, EV_READ);
+				return;
+			}
+			break;
+		case NETWORK_MIRROR_CONN_SEND_INIT_DB:
+			if (!network_mirror_conn_write(conn)) return;
+
+			conn->state = NETWORK_MIRROR_CONN_READ_INIT_DB_RESULT;
+			break;
+		case NETWORK_MIRROR_CONN_READ_INIT_DB_RESULT: {
+			network_mirror_query_t *q = conn->query;
+			network_packet packet;
+			guint8 status;
+			int err = 0;
+
+			if (!network_mirror_conn_wait_read(conn)) return;
+
+			packet.data = g_queue_peek_head(conn->sock->recv_queue->chunks);
+			packet.offset = 0;
+
+			err = err || network_mysqld_proto_skip_network_header(&packet);
+			err = err || network_mysqld_proto_peek_int8(&packet, &status);
+			g_string_free(g_queue_pop_head(conn->sock->recv_queue->chunks), TRUE);
+
+			if (err) {
+				network_mirror_conn_close(conn, "the result of COM_INIT_DB is invalid");
+				return;
+			}
+
+			if (status != MYSQLD_PACKET_OK) {
+				/* the mirror doesn't have the database, the connection is fine */
+				conn->query = NULL;
+				network_mirror_query_mirror_failed(q);
+
+				conn->state = NETWORK_MIRROR_CONN_IDLE;
+				break;
+			}
+			g_string_assign_len(conn->default_db, S(q->default_db));
+
+			network_mirror_conn_send_command(conn, q->packet->str[0], q->packet->str + 1, q->packet->len - 1);
+			conn->state = NETWORK_MIRROR_CONN_SEND_QUERY;
+			break; }
+		case NETWORK_MIRROR_CONN_SEND_QUERY:
+			if (!network_mirror_conn_write(conn)) return;
+
+			conn->state = NETWORK_MIRROR_CONN_READ_RESULT;
+			break;
+		case NETWORK_MIRROR_CONN_READ_RESULT: {
+			network_mirror_query_t *q = conn->query;
+
+			if (!network_mirror_conn_wait_read(conn)) return;
+
+			switch (network_mirror_conn_read_result(conn)) {
+			case 0:
+				/* wait for the rest of the result */
+				network_mirror_conn_wait_for_event(conn, EV_READ);
+				return;
+			case 1:
+				break;
+			default:
+				network_mirror_conn_close(conn, "the result is invalid");
+				return;
+			}
+
+			q->mirror.query_status = conn->query_result->query_status;
+			q->mirror.usec = chassis_get_rel_microseconds() - conn->query_usec;
+
+			conn->query = NULL;
+			network_mirror_query_mirror_done(q);
+
+			conn->state = NETWORK_MIRROR_CONN_IDLE;
+			break; }
+		}
+	}
+}
+
+static void network_mirror_conn_handle(int G_GNUC_UNUSED event_fd, short events, void *user_data) {
+	network_mirror_conn_t *conn = user_data;
+
+	if (events == EV_TIMEOUT) {
+		network_mirror_conn_close(conn, "timed out");
+		return;
+	}
+
+	if (events & EV_READ) {
+		if (NETWORK_SOCKET_SUCCESS != network_socket_to_read(conn->sock)) {
+			network_mirror_conn_close(conn, "ioctl() failed");
+			return;
+		}
+		if (conn->sock->to_read == 0) {
+			network_mirror_conn_close(conn, "the server closed the connection");
+			return;
+		}
+	}
+
+	network_mirror_conn_run(conn);
+}
+
+/**
+ * open a new connection to the mirror, it takes a query from the queue once it is logged in
+ */
+static void network_mirror_conn_start(network_mirror_thread_t *thr) {
+	network_mirror_conn_t *conn;
+
+	conn = network_mirror_conn_new(thr);
+	conn->sock = network_socket_new();
+	network_address_copy(conn->sock->dst, thr->mirror->addr);
+
+	g_ptr_array_add(thr->conns, conn);
+
+	switch (network_socket_connect(conn->sock)) {
+	case NETWORK_SOCKET_SUCCESS:
+		conn->state = NETWORK_MIRROR_CONN_READ_HANDSHAKE;
+		network_mirror_conn_run(conn);
+		break;
+	case NETWORK_SOCKET_ERROR_RETRY:
+		/* connect() is in progress, wait until it is writable */
+		conn->state = NETWORK_MIRROR_CONN_CONNECT;
+		network_mirror_conn_wait_for_event(conn, EV_WRITE);
+		break;
+	default:
+		conn->state = NETWORK_MIRROR_CONN_CONNECT;
+		network_mirror_conn_close(conn, "connect() failed");
+		break;
+	}
+}
+
+/**
+ * hand the queued queries to the idle connections, open more if we may
+ */
+static void network_mirror_thread_kick(network_mirror_thread_t *thr) {
+	guint i, connecting = 0;
+
+	for (i = 0; i < thr->conns->len && thr->queued->length > 0; i++) {
+		network_mirror_conn_t *conn = thr->conns->pdata[i];
+
+		if (conn->state == NETWORK_MIRROR_CONN_IDLE) {
+			network_mirror_conn_run(conn);
+		}
+	}
+
+	for (i = 0; i < thr->conns->len; i++) {
+		network_mirror_conn_t *conn = thr->conns->pdata[i];
+
+		if (conn->state < NETWORK_MIRROR_CONN_IDLE) connecting++;
+	}
+
+	while (thr->queued->length > connecting &&
+	       thr->conns->len < thr->mirror->max_conns &&
+	       chassis_get_rel_microseconds() >= thr->down_until_usec) {
+		network_mirror_conn_start(thr);
+		connecting++;
+	}
+}
+
+static network_mirror_thread_t *network_mirror_thread_new(network_mirror_t *mirror) {
+	network_mirror_thread_t *thr;
+
+	thr = g_new0(network_mirror_thread_t, 1);
+	thr->mirror = mirror;
+	thr->queued = g_queue_new();
+	thr->conns = g_ptr_array_new();
+	thr->mutex = g_mutex_new();
+	thr->entries = g_hash_table_new_full(network_mirror_hash_func, network_mirror_equal_func,
+			NULL, (GDestroyNotify)network_mirror_entry_free);
+
+	return thr;
+}
+
+/**
+ * the clients may still hold their queries, they free them once they are done
+ */
+static void network_mirror_thread_detach_query(network_mirror_query_t *q) {
+	q->thr = NULL;
+	q->mirror_is_done = TRUE;
+
+	if (q->primary_is_done) network_mirror_query_free(q);
+}
+
+static void network_mirror_thread_free(network_mirror_thread_t *thr) {
+	network_mirror_query_t *q;
+	guint i;
+
+	while (NULL != (q = g_queue_pop_head(thr->queued))) {
+		network_mirror_thread_detach_query(q);
+	}
+	g_queue_free(thr->queued);
+
+	for (i = 0; i < thr->conns->len; i++) {
+		network_mirror_conn_t *conn = thr->conns->pdata[i];
+
+		if (conn->query) network_mirror_thread_detach_query(conn->query);
+		network_mirror_conn_free(conn);
+	}
+	g_ptr_array_free(thr->conns, TRUE);
+
+	g_hash_table_destroy(thr->entries);
+	g_mutex_free(thr->mutex);
+
+	g_free(thr);
+}
+
+network_mirror_t *network_mirror_new(chassis *srv) {
+	network_mirror_t *mirror;
+
+	mirror = g_new0(network_mirror_t, 1);
+	mirror->srv = srv;
+	mirror->addr = network_address_new();
+	mirror->max_queued = 64;
+	mirror->max_conns = 4;
+	mirror->max_entries = 100;
+	mirror->timeout.tv_sec = 10;
+	mirror->threads = g_ptr_array_new();
+
+	return mirror;
+}
+
+void network_mirror_free(network_mirror_t *mirror) {
+	guint i;
+
+	if (!mirror) return;
+
+	for (i = 0; i < mirror->threads->len; i++) {
+		network_mirror_thread_free(mirror->threads->pdata[i]);
+	}
+	g_ptr_array_free(mirror->threads, TRUE);
+
+	network_address_free(mirror->addr);
+	if (mirror->username) g_free(mirror->username);
+	if (mirror->password) g_free(mirror->password);
+
+	g_free(mirror);
+}
+
+/**
+ * @return 0 on success, -1 if the address is invalid
+ */
+int network_mirror_set_backend(network_mirror_t *mirror, const gchar *address) {
+	return network_address_set_address(mirror->addr, address);
+}
+
+/**
+ * login to the mirror as this user
+ */
+void network_mirror_set_login(network_mirror_t *mirror, const gchar *username, const gchar *password) {
+	if (mirror->username) g_free(mirror->username);
+	if (mirror->password) g_free(mirror->password);
+
+	mirror->username = g_strdup(username);
+	mirror->password = g_strdup(password);
+}
+
+/**
+ * give each event-thread its own queue and connections
+ *
+ * call it before the event-threads start
+ */
+void network_mirror_set_threads(network_mirror_t *mirror, guint threads) {
+	if (threads == 0) threads = 1;
+
+	while (mirror->threads->len < threads) {
+		g_ptr_array_add(mirror->threads, network_mirror_thread_new(mirror));
+	}
+}
+
+/**
+ * @return TRUE if this query should be mirrored
+ */
+gboolean network_mirror_sample(network_mirror_t *mirror) {
+	if (mirror->sample <= 0.0) return FALSE;
+	if (mirror->sample >= 1.0) return TRUE;
+
+	return g_random_double() < mirror->sample;
+}
+
+/**
+ * queue a query of a client for the mirror
+ *
+ * the client reports the result of its own backend with network_mirror_query_primary_done()
+ *
+ * @param ndx        the index of the event-thread of the client, see chassis_event_thread_get_local_index()
+ * @param hash       the hash of the fingerprint of the query
+ * @param text       the fingerprint
+ * @param query      COM_QUERY and the query, without the network-header
+ * @param default_db the default-db of the client
+ * @return the mirrored query, NULL if it was shed
+ */
+network_mirror_query_t *network_mirror_push(network_mirror_t *mirror, guint ndx,
+		guint64 hash, const GString *text,
+		const char *query, gsize query_len, const GString *default_db) {
+	network_mirror_thread_t *thr;
+	network_mirror_query_t *q;
+
+	thr = mirror->threads->pdata[ndx < mirror->threads->len ? ndx : 0];
+
+	if (thr->queued->length >= mirror->max_queued ||
+	    chassis_get_rel_microseconds() < thr->down_until_usec) {
+		g_mutex_lock(thr->mutex);
+		thr->shed++;
+		g_mutex_unlock(thr->mutex);
+
+		return NULL;
+	}
+
+	q = g_new0(network_mirror_query_t, 1);
+	q->thr = thr;
+	q->hash = hash;
+	q->text = g_string_new_len(S(text));
+	q->packet = g_string_new_len(query, query_len);
+	if (default_db) q->default_db = g_string_new_len(S(default_db));
+
+	g_queue_push_tail(thr->queued, q);
+
+	g_mutex_lock(thr->mutex);
+	thr->mirrored++;
+	g_mutex_unlock(thr->mutex);
+
+	network_mirror_thread_kick(thr);
+
+	return q;
+}
+
+/**
+ * merge the stats of all event-threads
+ *
+ * @return a array of network_mirror_entry_t, free them with network_mirror_entry_free()
+ */
+GPtrArray *network_mirror_get_entries(network_mirror_t *mirror, guint64 *mirrored, guint64 *shed, guint64 *failed, guint64 *mismatches) {
+	GHashTable *merged;
+	GPtrArray *entries;
+	guint i;
+
+	entries = g_ptr_array_new();
+	merged = g_hash_table_new(network_mirror_hash_func, network_mirror_equal_func);
+
+	*mirrored = *shed = *failed = *mismatches = 0;
+
+	for (i = 0; i < mirror->threads->len; i++) {
+		network_mirror_thread_t *thr = mirror->threads->pdata[i];
+		GHashTableIter iter;
+		network_mirror_entry_t *src;
+
+		g_mutex_lock(thr->mutex);
+		g_hash_table_iter_init(&iter, thr->entries);
+		while (g_hash_table_iter_next(&iter, NULL, (gpointer *)&src)) {
+			network_mirror_entry_t *dst;
+
+			if (NULL == (dst = g_hash_table_lookup(merged, &src->hash))) {
+				dst = network_mirror_entry_new();
+				dst->hash = src->hash;
+				g_string_append_len(dst->text, S(src->text));
+
+				g_hash_table_insert(merged, &dst->hash, dst);
+				g_ptr_array_add(entries, dst);
+			}
+
+			dst->count        += src->count;
+			dst->mismatches   += src->mismatches;
+			dst->primary_usec += src->primary_usec;
+			dst->mirror_usec  += src->mirror_usec;
+		}
+
+		*mirrored   += thr->mirrored;
+		*shed       += thr->shed;
+		*failed     += thr->failed;
+		*mismatches += thr->mismatches;
+		g_mutex_unlock(thr->mutex);
+	}
+
+	g_hash_table_destroy(merged);
+
+	return entries;
+}
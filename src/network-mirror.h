@@ -0,0 +1,138 @@
+/* $%BEGINLICENSE%$
+ Copyright (c) 2008, 2012, Oracle and/or its affiliates. All rights reserved.
+
+ This program is free software; you can redistribute it and/or
+ modify it under the terms of the GNU General Public License as
+ published by the Free Software Foundation; version 2 of the
+ License.
+
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ GNU General Public License for more details.
+
+ You should have received a copy of the GNU General Public License
+ along with this program; if not, write to the Free Software
+ Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA
+ 02110-1301  USA
+
+ $%ENDLICENSE%$ */
+#ifndef __NETWORK_MIRROR_H__
+#define __NETWORK_MIRROR_H__
+
+#include <glib.h>
+
+#include "network-address.h"
+#include "chassis-mainloop.h"
+
+#include "network-exports.h"
+
+/**
+ * what a backend answered to a mirrored query
+ */
+typedef struct {
+	guint8 query_status;     /**< MYSQLD_PACKET_OK or MYSQLD_PACKET_ERR */
+	guint64 rows;
+	guint64 checksum;        /**< the sum of the CRC32 of the rows, it doesn't depend on their order */
+	guint64 usec;            /**< time from sending the query to the last packet of the result */
+} network_mirror_result_t;
+
+NETWORK_API void network_mirror_result_add_row(network_mirror_result_t *res, const char *row, gsize row_len);
+
+typedef struct network_mirror_thread network_mirror_thread_t;
+
+/**
+ * a sampled query of a client, sent to the mirror besides the primary backend
+ *
+ * the client and the mirror connection both report their result, the one who is
+ * done last compares them and frees the query
+ */
+typedef struct {
+	network_mirror_thread_t *thr;  /**< NULL once the mirror is freed */
+
+	guint64 hash;                  /**< the hash of the fingerprint, see network_query_digest_fingerprint() */
+	GString *text;                 /**< the fingerprint */
+	GString *packet;               /**< COM_QUERY and the query, without the network-header */
+	GString *default_db;           /**< the default-db of the client */
+
+	network_mirror_result_t primary;
+	network_mirror_result_t mirror;
+
+	gboolean primary_is_done;
+	gboolean mirror_is_done;
+	gboolean is_failed;            /**< one of the two didn't get a result, don't compare them */
+} network_mirror_query_t;
+
+/**
+ * the stats of the mirrored queries of a fingerprint
+ */
+typedef struct {
+	guint64 hash;
+	GString *text;
+
+	guint64 count;           /**< queries both backends answered */
+	guint64 mismatches;      /**< queries with a different status, row-count or checksum */
+	guint64 primary_usec;
+	guint64 mirror_usec;
+} network_mirror_entry_t;
+
+NETWORK_API network_mirror_entry_t *network_mirror_entry_new(void);
+NETWORK_API void network_mirror_entry_free(network_mirror_entry_t *entry);
+
+/**
+ * mirrors sampled reads of the clients to a backend that isn't routed to, like a canary
+ *
+ * each event-thread has its own queue and connections to the mirror, the client never
+ * waits for them: a query that doesn't fit into the queue is dropped. The mirror
+ * connections log in as their own user like the health-check.
+ */
+typedef struct {
+	chassis *srv;
+
+	network_address *addr;   /**< the mirror backend */
+	gchar *username;
+	gchar *password;
+
+	gdouble sample;          /**< the share of the reads that are mirrored, 0.0 to 1.0 */
+	guint max_queued;        /**< queries waiting for a connection per event-thread, more are shed */
+	guint max_conns;         /**< connections per event-thread */
+	guint max_entries;       /**< fingerprints per event-thread, others are only counted in the totals */
+	struct timeval timeout;  /**< each step on a mirror connection has to finish in this time */
+
+	GPtrArray *threads;      /**< a network_mirror_thread_t per event-thread */
+} network_mirror_t;
+
+/**
+ * the mirror connections and the stats of one event-thread
+ */
+struct network_mirror_thread {
+	network_mirror_t *mirror;
+
+	GQueue *queued;          /**< network_mirror_query_t waiting for a connection */
+	GPtrArray *conns;
+	guint64 down_until_usec; /**< the mirror failed to connect, shed until then */
+
+	GMutex *mutex;           /**< protects the stats below, they are read by the metrics */
+	GHashTable *entries;     /**< hash -> network_mirror_entry_t */
+	guint64 mirrored;        /**< queries that were queued */
+	guint64 shed;            /**< queries that didn't fit into the queue or the mirror was down */
+	guint64 failed;          /**< queries that failed on the mirror connection */
+	guint64 mismatches;
+};
+
+NETWORK_API network_mirror_t *network_mirror_new(chassis *srv);
+NETWORK_API void network_mirror_free(network_mirror_t *mirror);
+NETWORK_API int network_mirror_set_backend(network_mirror_t *mirror, const gchar *address);
+NETWORK_API void network_mirror_set_login(network_mirror_t *mirror, const gchar *username, const gchar *password);
+NETWORK_API void network_mirror_set_threads(network_mirror_t *mirror, guint threads);
+
+NETWORK_API gboolean network_mirror_sample(network_mirror_t *mirror);
+NETWORK_API network_mirror_query_t *network_mirror_push(network_mirror_t *mirror, guint ndx,
+		guint64 hash, const GString *text,
+		const char *query, gsize query_len, const GString *default_db);
+NETWORK_API void network_mirror_query_primary_done(network_mirror_query_t *q, guint8 query_status, guint64 usec);
+NETWORK_API void network_mirror_query_primary_failed(network_mirror_query_t *q);
+
+NETWORK_API GPtrArray *network_mirror_get_entries(network_mirror_t *mirror, guint64 *mirrored, guint64 *shed, guint64 *failed, guint64 *mismatches);
+
+#endif
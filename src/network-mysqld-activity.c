@@ -0,0 +1,159 @@
+/* $%BEGINLICENSE%$
+ Copyright (c) 2008, 2012, Oracle and/or its affiliates. All rights reserved.
+
+ This program is free software; you can redistribute it and/or
+ modify it under the terms of the GNU General Public License as
+ published by the Free Software Foundation; version 2 of the
+ License.
+
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ GNU General Public License for more details.
+
+ You should have received a copy of the GNU General Public License
+ along with this program; if not, write to the Free Software
+ Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA
+ 02110-1301  USA
+
+ $%ENDLICENSE%$ */
+/**
+ * the running statement and the open transaction of the connections
+ *
+ * the state-machine records each statement it sends to the server and the server-status
+ * that comes back with its result. The admin plugin reads a consistent copy of it at any
+ * time without stopping the event-threads.
+ *
+ * this replaces the bookkeeping that lib/active-queries.lua and lib/active-transactions.lua
+ * did in the read_query() and read_query_result() hooks
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <string.h>
+
+#include <glib.h>
+#include <mysql.h>
+
+#include "network-mysqld-activity.h"
+
+void network_mysqld_activity_init(network_mysqld_activity_t *a) {
+	memset(a, 0, sizeof(*a));
+
+	a->cur.command = -1;
+}
+
+static void network_mysqld_activity_begin_update(network_mysqld_activity_t *a) {
+	g_atomic_int_inc(&a->seq);
+}
+
+static void network_mysqld_activity_end_update(network_mysqld_activity_t *a) {
+	g_atomic_int_inc(&a->seq);
+}
+
+/**
+ * a statement is sent to the server
+ *
+ * @param query      the text of the statement, NULL if the command has none
+ * @param query_len  its length, only the first NETWORK_MYSQLD_ACTIVITY_QUERY_LEN bytes are kept
+ */
+void network_mysqld_activity_query_start(network_mysqld_activity_t *a, gint command, const char *query, gsize query_len, guint64 now_usec) {
+	network_mysqld_activity_begin_update(a);
+
+	a->cur.command = command;
+	a->cur.ts_query = now_usec;
+	a->cur.query_len = query ? query_len : 0;
+	if (a->cur.query_len > 0) {
+		memcpy(a->cur.query, query, MIN(a->cur.query_len, sizeof(a->cur.query)));
+	}
+
+	if (!a->cur.in_trans) a->cur.trx_statements = 0;
+	a->cur.trx_statements++;
+
+	network_mysqld_activity_end_update(a);
+}
+
+/**
+ * the result of the statement is in
+ *
+ * the transaction is opened by the statement after which the server reports
+ * SERVER_STATUS_IN_TRANS first and lasts until it doesn't report it anymore
+ *
+ * @param server_status  the server-status of the server-side after the result
+ */
+void network_mysqld_activity_query_end(network_mysqld_activity_t *a, guint16 server_status, guint64 now_usec) {
+	gboolean in_trans = (server_status & SERVER_STATUS_IN_TRANS) != 0;
+
+	if (a->cur.command == -1 && a->cur.in_trans == in_trans) return;
+
+	network_mysqld_activity_begin_update(a);
+
+	if (in_trans && !a->cur.in_trans) {
+		a->cur.ts_trx = a->cur.ts_query;
+		a->cur.trx_query_len = a->cur.query_len;
+		memcpy(a->cur.trx_query, a->cur.query, MIN(a->cur.query_len, sizeof(a->cur.trx_query)));
+	} else if (!in_trans) {
+		a->cur.trx_statements = 0;
+	}
+
+	a->cur.in_trans = in_trans;
+	a->cur.command = -1;
+	a->cur.ts_idle = now_usec;
+
+	network_mysqld_activity_end_update(a);
+}
+
+static gboolean network_mysqld_activity_name_equal(const gchar *kept, gsize kept_len, const char *s, gsize len) {
+	return kept_len == len && (len == 0 || 0 == memcmp(kept, s, MIN(len, NETWORK_MYSQLD_ACTIVITY_NAME_LEN)));
+}
+
+/**
+ * the user and the backend of the next statement
+ *
+ * only updates the activity if one of them changed, a unchanged set costs three compares
+ *
+ * @param user      the user, NULL if the client didn't authenticate yet
+ * @param backend   the address of the backend, NULL if there is none
+ * @param thread_id the connection-id of the backend connection, 0 if unknown
+ */
+void network_mysqld_activity_set_peers(network_mysqld_activity_t *a, const char *user, gsize user_len, const char *backend, gsize backend_len, guint32 thread_id) {
+	if (!user) user_len = 0;
+	if (!backend) backend_len = 0;
+
+	/* only the event-thread writes, it may read without the seq */
+	if (a->cur.thread_id == thread_id &&
+	    network_mysqld_activity_name_equal(a->cur.user, a->cur.user_len, user, user_len) &&
+	    network_mysqld_activity_name_equal(a->cur.backend, a->cur.backend_len, backend, backend_len)) return;
+
+	network_mysqld_activity_begin_update(a);
+
+	a->cur.user_len = user_len;
+	if (user_len > 0) memcpy(a->cur.user, user, MIN(user_len, sizeof(a->cur.user)));
+	a->cur.backend_len = backend_len;
+	if (backend_len > 0) memcpy(a->cur.backend, backend, MIN(backend_len, sizeof(a->cur.backend)));
+	a->cur.thread_id = thread_id;
+
+	network_mysqld_activity_end_update(a);
+}
+
+/**
+ * get a consistent copy of the activity
+ *
+ * may be called from any thread, retries while the event-thread updates it
+ */
+void network_mysqld_activity_get(network_mysqld_activity_t *a, network_mysqld_activity_snapshot_t *snap) {
+	for (;;) {
+		gint seq = g_atomic_int_get(&a->seq);
+
+		if (seq & 1) {
+			g_thread_yield();
+			continue;
+		}
+
+		memcpy(snap, &a->cur, sizeof(*snap));
+
+		if (g_atomic_int_get(&a->seq) == seq) break;
+	}
+}
@@ -0,0 +1,77 @@
+/* $%BEGINLICENSE%$
+ Copyright (c) 2008, 2012, Oracle and/or its affiliates. All rights reserved.
+
+ This program is free software; you can redistribute it and/or
+ modify it under the terms of the GNU General Public License as
+ published by the Free Software Foundation; version 2 of the
+ License.
+
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ GNU General Public License for more details.
+
+ You should have received a copy of the GNU General Public License
+ along with this program; if not, write to the Free Software
+ Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA
+ 02110-1301  USA
+
+ $%ENDLICENSE%$ */
+#ifndef __NETWORK_MYSQLD_ACTIVITY_H__
+#define __NETWORK_MYSQLD_ACTIVITY_H__
+
+#include <glib.h>
+
+#include "network-exports.h"
+
+/**
+ * bytes of a statement that are kept, longer ones are truncated
+ */
+#define NETWORK_MYSQLD_ACTIVITY_QUERY_LEN 256
+
+/**
+ * bytes of the user and the backend that are kept
+ */
+#define NETWORK_MYSQLD_ACTIVITY_NAME_LEN 64
+
+/**
+ * the statement that runs on a connection and the transaction it is part of
+ *
+ * embedded in the network_mysqld_con and only written by the event-thread that owns the
+ * connection. The writer bumps .seq to a odd value before and to a even value after a
+ * update, readers copy the fields and retry if .seq changed meanwhile. Neither side takes
+ * a lock.
+ */
+typedef struct {
+	gint command;              /**< the COM_* of the running statement, -1 if none runs */
+	guint64 ts_query;          /**< microseconds when the statement was sent */
+	gchar query[NETWORK_MYSQLD_ACTIVITY_QUERY_LEN];
+	gsize query_len;           /**< the full length of the statement, may be larger than the kept bytes */
+
+	gboolean in_trans;         /**< the server reported SERVER_STATUS_IN_TRANS after the last statement */
+	guint64 ts_trx;            /**< microseconds when the statement that opened the transaction was sent */
+	guint trx_statements;      /**< statements sent since the transaction was opened, including the running one */
+	gchar trx_query[NETWORK_MYSQLD_ACTIVITY_QUERY_LEN]; /**< the statement that opened the transaction */
+	gsize trx_query_len;
+
+	guint64 ts_idle;           /**< microseconds when the last statement ended */
+	gchar user[NETWORK_MYSQLD_ACTIVITY_NAME_LEN];    /**< the user the statements run as */
+	gsize user_len;
+	gchar backend[NETWORK_MYSQLD_ACTIVITY_NAME_LEN]; /**< the address of the backend the last statement went to */
+	gsize backend_len;
+	guint32 thread_id;         /**< the connection-id of the backend connection the last statement went to, 0 if unknown */
+} network_mysqld_activity_snapshot_t;
+
+typedef struct {
+	volatile gint seq;         /**< odd while the event-thread updates .cur */
+
+	network_mysqld_activity_snapshot_t cur;
+} network_mysqld_activity_t;
+
+NETWORK_API void network_mysqld_activity_init(network_mysqld_activity_t *a);
+NETWORK_API void network_mysqld_activity_query_start(network_mysqld_activity_t *a, gint command, const char *query, gsize query_len, guint64 now_usec);
+NETWORK_API void network_mysqld_activity_query_end(network_mysqld_activity_t *a, guint16 server_status, guint64 now_usec);
+NETWORK_API void network_mysqld_activity_set_peers(network_mysqld_activity_t *a, const char *user, gsize user_len, const char *backend, gsize backend_len, guint32 thread_id);
+NETWORK_API void network_mysqld_activity_get(network_mysqld_activity_t *a, network_mysqld_activity_snapshot_t *snap);
+
+#endif
@@ -25,13 +25,19 @@
 #include <sys/types.h>
 #endif
 
+#ifdef HAVE_SYS_MMAN_H
+#include <sys/mman.h> /* madvise() */
+#endif
+
 #include <stdio.h>
+#include <string.h>
 
 /**
  * replication 
  */
 #include "glib-ext.h"
 #include "network-mysqld-binlog.h"
+#include "network-mysqld-crc32.h"
 
 #define S(x) x->str, x->len
 
@@ -43,6 +49,7 @@ network_mysqld_table *network_mysqld_table_new() {
 	tbl->table_name = g_string_new(NULL);
 
 	tbl->fields = network_mysqld_proto_fielddefs_new();
+	tbl->table_map = g_string_new(NULL);
 
 	return tbl;
 }
@@ -54,6 +61,7 @@ void network_mysqld_table_free(network_mysqld_table *tbl) {
 	g_string_free(tbl->table_name, TRUE);
 
 	network_mysqld_proto_fielddefs_free(tbl->fields);
+	g_string_free(tbl->table_map, TRUE);
 
 	g_free(tbl);
 }
@@ -87,8 +95,9 @@ network_mysqld_binlog *network_mysqld_binlog_new() {
 	binlog->rbr_tables = g_hash_table_new_full(
 			guint64_hash,
 			guint64_equal,
-			g_free,
+			NULL, /* the key is part of the table */
 			(GDestroyNotify)network_mysqld_table_free);
+	binlog->verify_checksums = TRUE;
 
 	return binlog;
 }
@@ -141,12 +150,43 @@ int network_mysqld_proto_get_binlog_event_header(network_packet *packet, network
 	return err ? -1 : 0;
 }
 
+/**
+ * check the CRC32 at the end of a event
+ *
+ * @param event     the event, starting with the event-header
+ * @param event_len length of the event including the 4 bytes of the checksum
+ */
+gboolean network_mysqld_binlog_event_checksum_is_valid(const char *event, gsize event_len) {
+	const guchar *checksum;
+
+	if (event_len < NETWORK_MYSQLD_BINLOG_EVENT_HEADER_LEN + 4) return FALSE;
+
+	checksum = (const guchar *)event + event_len - 4;
+
+	return network_mysqld_crc32(0, event, event_len - 4) ==
+		(checksum[0] | (checksum[1] << 8) | (checksum[2] << 16) | ((guint32)checksum[3] << 24));
+}
+
+/**
+ * append the CRC32 of the event that starts at event_offset in the packet
+ *
+ * the event-size in the header has to include the 4 bytes of the checksum already
+ */
+void network_mysqld_binlog_event_append_checksum(GString *packet, gsize event_offset) {
+	g_assert_cmpint(event_offset, <=, packet->len);
+
+	network_mysqld_proto_append_int32(packet,
+			network_mysqld_crc32(0, packet->str + event_offset, packet->len - event_offset));
+}
+
 int network_mysqld_proto_get_binlog_event(network_packet *packet, 
 		network_mysqld_binlog *binlog,
 		network_mysqld_binlog_event *event) {
 
 	int err = 0;
 	int maj, min, pat;
+	/* the event-header is decoded already */
+	guint event_offset = packet->offset - NETWORK_MYSQLD_BINLOG_EVENT_HEADER_LEN;
 
 	if (binlog->checksum == NETWORK_MYSQLD_BINLOG_CHECKSUM_CRC32) {
 		/* patch the packet-len for the decoders as if there would be no checksum */
@@ -420,6 +460,14 @@ int network_mysqld_proto_get_binlog_event(network_packet *packet,
 
 		/* the next 4 bytes are CRC32 if checksum is CRC32 */
 		err = err || network_mysqld_proto_skip(packet, 4);
+
+		if (!err && binlog->verify_checksums &&
+		    !network_mysqld_binlog_event_checksum_is_valid(packet->data->str + event_offset, packet->data->len - event_offset)) {
+			g_critical("%s: event_type %d: CRC32 checksum mismatch",
+					G_STRLOC,
+					event->event_type);
+			return -1;
+		}
 	}
 
 	/* check if we have handled all bytes */
@@ -504,6 +552,312 @@ void network_mysqld_binlog_dump_free(network_mysqld_binlog_dump *dump) {
 	g_free(dump);
 }
 
+/**
+ * map a binlog-file into memory
+ *
+ * the events are handed out as views into the mapping: no read() and no copy per event
+ *
+ * @return NULL if the file can't be mapped or doesn't start with the binlog-header
+ */
+network_mysqld_binlog_file *network_mysqld_binlog_file_open(const gchar *filename, GError **gerr) {
+	network_mysqld_binlog_file *file;
+	GMappedFile *mapped;
+	const char *data;
+	gsize len;
+
+	if (NULL == (mapped = g_mapped_file_new(filename, FALSE, gerr))) return NULL;
+
+	data = g_mapped_file_get_contents(mapped);
+	len  = g_mapped_file_get_length(mapped);
+
+	if (len < NETWORK_MYSQLD_BINLOG_HEADER_LEN ||
+	    0 != memcmp(data, NETWORK_MYSQLD_BINLOG_HEADER, NETWORK_MYSQLD_BINLOG_HEADER_LEN)) {
+		g_set_error(gerr, G_FILE_ERROR, G_FILE_ERROR_INVAL,
+				"%s: binlog-header should be: fe62696e",
+				filename);
+		g_mapped_file_free(mapped);
+		return NULL;
+	}
+
+#if defined(HAVE_SYS_MMAN_H) && defined(MADV_SEQUENTIAL)
+	/* we walk the file once from start to end, let the kernel read ahead */
+	madvise((void *)data, len, MADV_SEQUENTIAL);
+#endif
+
+	file = g_new0(network_mysqld_binlog_file, 1);
+	file->mapped = mapped;
+	file->data   = data;
+	file->len    = len;
+	file->pos    = NETWORK_MYSQLD_BINLOG_HEADER_LEN;
+
+	return file;
+}
+
+void network_mysqld_binlog_file_free(network_mysqld_binlog_file *file) {
+	if (!file) return;
+
+	g_mapped_file_free(file->mapped);
+
+	g_free(file);
+}
+
+/**
+ * set the position of the next event
+ *
+ * @return 0 on success, -1 if pos is past the end of the file
+ */
+int network_mysqld_binlog_file_seek(network_mysqld_binlog_file *file, gsize pos) {
+	if (pos > file->len) return -1;
+
+	file->pos = pos;
+
+	return 0;
+}
+
+/**
+ * get the event at the current position and move to the next
+ *
+ * packet->data points into the mapping and is only valid until the file is
+ * free()ed. It must not be modified.
+ *
+ * @return 0 on success, 1 at the end of the file, -1 if the event-size is invalid or the event is truncated
+ */
+int network_mysqld_binlog_file_get_event(network_mysqld_binlog_file *file, network_packet *packet) {
+	const guchar *header;
+	guint32 event_size;
+
+	if (file->pos + NETWORK_MYSQLD_BINLOG_EVENT_HEADER_LEN > file->len) return 1;
+
+	header = (const guchar *)file->data + file->pos;
+
+	/* event-size is at offset 9 of the header */
+	event_size = header[9] |
+		(header[10] <<  8) |
+		(header[11] << 16) |
+		(header[12] << 24);
+
+	if (event_size < NETWORK_MYSQLD_BINLOG_EVENT_HEADER_LEN ||
+	    event_size > file->len - file->pos) {
+		return -1;
+	}
+
+	file->event.str = (gchar *)header;
+	file->event.len = event_size;
+	file->event.allocated_len = 0; /* not ours */
+
+	packet->data = &(file->event);
+	packet->offset = 0;
+
+	file->pos += event_size;
+
+	return 0;
+}
+
+
+#define NETWORK_MYSQLD_BINLOG_INDEX_MAGIC   "MPBI"
+#define NETWORK_MYSQLD_BINLOG_INDEX_VERSION 1
+
+network_mysqld_binlog_index *network_mysqld_binlog_index_new(guint interval) {
+	network_mysqld_binlog_index *index;
+
+	index = g_new0(network_mysqld_binlog_index, 1);
+	index->entries = g_array_new(FALSE, FALSE, sizeof(network_mysqld_binlog_index_entry));
+	index->interval = MAX(interval, 1);
+
+	return index;
+}
+
+void network_mysqld_binlog_index_free(network_mysqld_binlog_index *index) {
+	if (!index) return;
+
+	g_array_free(index->entries, TRUE);
+
+	g_free(index);
+}
+
+/**
+ * add the events to the index that were appended to the binlog since the last update
+ *
+ * only the event-headers are looked at
+ *
+ * @return 0 on success, -1 if the binlog has a invalid event
+ */
+int network_mysqld_binlog_index_update(network_mysqld_binlog_index *index, network_mysqld_binlog_file *file) {
+	gsize offset;
+
+	if (index->indexed_len < NETWORK_MYSQLD_BINLOG_HEADER_LEN) index->indexed_len = NETWORK_MYSQLD_BINLOG_HEADER_LEN;
+
+	for (offset = index->indexed_len; offset + NETWORK_MYSQLD_BINLOG_EVENT_HEADER_LEN <= file->len; ) {
+		const guchar *header = (const guchar *)file->data + offset;
+		guint32 timestamp, event_size;
+
+		timestamp = header[0] | (header[1] << 8) | (header[2] << 16) | (header[3] << 24);
+		event_size = header[9] | (header[10] << 8) | (header[11] << 16) | (header[12] << 24);
+
+		if (event_size < NETWORK_MYSQLD_BINLOG_EVENT_HEADER_LEN) return -1;
+		if (event_size > file->len - offset) break; /* still being written */
+
+		/* the timestamp is the start of the statement, they aren't strictly ordered.
+		 * Keep the highest so far to keep the entries sorted */
+		index->max_timestamp = MAX(index->max_timestamp, timestamp);
+
+		if (index->events++ % index->interval == 0) {
+			network_mysqld_binlog_index_entry entry;
+
+			entry.timestamp = index->max_timestamp;
+			entry.offset = offset;
+
+			g_array_append_val(index->entries, entry);
+		}
+
+		offset += event_size;
+	}
+
+	index->indexed_len = offset;
+
+	return 0;
+}
+
+/**
+ * load a index saved by network_mysqld_binlog_index_save()
+ *
+ * @return 0 on success, -1 if the file can't be read or isn't a index
+ */
+int network_mysqld_binlog_index_load(network_mysqld_binlog_index *index, const gchar *filename, GError **gerr) {
+	network_packet packet;
+	GString s;
+	gchar *contents;
+	gsize contents_len;
+	guint32 version, interval, entries_len, events, max_timestamp, i;
+	guint64 indexed_len;
+	int err = 0;
+
+	if (!g_file_get_contents(filename, &contents, &contents_len, gerr)) return -1;
+
+	s.str = contents;
+	s.len = contents_len;
+	packet.data = &s;
+	packet.offset = 0;
+
+	err = err || (contents_len < 4 || 0 != memcmp(contents, NETWORK_MYSQLD_BINLOG_INDEX_MAGIC, 4));
+	err = err || network_mysqld_proto_skip(&packet, 4);
+	err = err || network_mysqld_proto_get_int32(&packet, &version);
+	err = err || (version != NETWORK_MYSQLD_BINLOG_INDEX_VERSION);
+	err = err || network_mysqld_proto_get_int32(&packet, &interval);
+	err = err || network_mysqld_proto_get_int64(&packet, &indexed_len);
+	err = err || network_mysqld_proto_get_int32(&packet, &events);
+	err = err || network_mysqld_proto_get_int32(&packet, &max_timestamp);
+	err = err || network_mysqld_proto_get_int32(&packet, &entries_len);
+	err = err || (packet.offset + (gsize)entries_len * (4 + 8) != contents_len);
+
+	if (err) {
+		g_set_error(gerr, G_FILE_ERROR, G_FILE_ERROR_INVAL,
+				"%s isn't a binlog index",
+				filename);
+		g_free(contents);
+		return -1;
+	}
+
+	g_array_set_size(index->entries, 0);
+	for (i = 0; i < entries_len; i++) {
+		network_mysqld_binlog_index_entry entry;
+
+		network_mysqld_proto_get_int32(&packet, &entry.timestamp);
+		network_mysqld_proto_get_int64(&packet, &entry.offset);
+
+		g_array_append_val(index->entries, entry);
+	}
+
+	index->interval = MAX(interval, 1);
+	index->indexed_len = indexed_len;
+	index->events = events;
+	index->max_timestamp = max_timestamp;
+
+	g_free(contents);
+
+	return 0;
+}
+
+/**
+ * save the index
+ *
+ * the file is replaced atomically, a reader sees the old or the new index
+ */
+int network_mysqld_binlog_index_save(network_mysqld_binlog_index *index, const gchar *filename, GError **gerr) {
+	GString *out;
+	guint i;
+	int ret;
+
+	out = g_string_sized_new(32 + index->entries->len * (4 + 8));
+
+	g_string_append_len(out, NETWORK_MYSQLD_BINLOG_INDEX_MAGIC, 4);
+	network_mysqld_proto_append_int32(out, NETWORK_MYSQLD_BINLOG_INDEX_VERSION);
+	network_mysqld_proto_append_int32(out, index->interval);
+	network_mysqld_proto_append_int64(out, index->indexed_len);
+	network_mysqld_proto_append_int32(out, index->events);
+	network_mysqld_proto_append_int32(out, index->max_timestamp);
+	network_mysqld_proto_append_int32(out, index->entries->len);
+
+	for (i = 0; i < index->entries->len; i++) {
+		network_mysqld_binlog_index_entry *entry = &g_array_index(index->entries, network_mysqld_binlog_index_entry, i);
+
+		network_mysqld_proto_append_int32(out, entry->timestamp);
+		network_mysqld_proto_append_int64(out, entry->offset);
+	}
+
+	ret = g_file_set_contents(filename, S(out), gerr) ? 0 : -1;
+
+	g_string_free(out, TRUE);
+
+	return ret;
+}
+
+/**
+ * find the last entry with entry->offset <= offset or entry->timestamp < timestamp
+ */
+static network_mysqld_binlog_index_entry *network_mysqld_binlog_index_bsearch(network_mysqld_binlog_index *index, guint32 timestamp, guint64 offset, gboolean by_timestamp) {
+	guint lo = 0, hi = index->entries->len;
+
+	/* the first entry with the key past what we look for */
+	while (lo < hi) {
+		guint mid = lo + (hi - lo) / 2;
+		network_mysqld_binlog_index_entry *entry = &g_array_index(index->entries, network_mysqld_binlog_index_entry, mid);
+
+		if (by_timestamp ? entry->timestamp < timestamp : entry->offset <= offset) {
+			lo = mid + 1;
+		} else {
+			hi = mid;
+		}
+	}
+
+	return lo > 0 ? &g_array_index(index->entries, network_mysqld_binlog_index_entry, lo - 1) : NULL;
+}
+
+/**
+ * get the offset to scan from to find the first event at or after the timestamp
+ *
+ * @return offset of a event, the first event if the timestamp is before the first entry
+ */
+guint64 network_mysqld_binlog_index_lookup_timestamp(network_mysqld_binlog_index *index, guint32 timestamp) {
+	network_mysqld_binlog_index_entry *entry;
+
+	entry = network_mysqld_binlog_index_bsearch(index, timestamp, 0, TRUE);
+
+	return entry ? entry->offset : NETWORK_MYSQLD_BINLOG_HEADER_LEN;
+}
+
+/**
+ * get the offset of a event at or before the offset
+ *
+ * used to find the start of the event that covers a offset
+ */
+guint64 network_mysqld_binlog_index_lookup_offset(network_mysqld_binlog_index *index, guint64 offset) {
+	network_mysqld_binlog_index_entry *entry;
+
+	entry = network_mysqld_binlog_index_bsearch(index, 0, offset, FALSE);
+
+	return entry ? entry->offset : NETWORK_MYSQLD_BINLOG_HEADER_LEN;
+}
 
 /**
  * decode the table-map event
@@ -730,4 +1084,306 @@ int network_mysqld_binlog_event_tablemap_get(
 	return err ? -1 : 0;
 }
 
+/**
+ * append a part of the TABLE_MAP event to the signature of the table
+ */
+static void network_mysqld_table_map_append_part(GString *table_map, const gchar *part, guint32 part_len) {
+	g_string_append_len(table_map, (const gchar *)&part_len, sizeof(part_len));
+	g_string_append_len(table_map, part, part_len);
+}
+
+/**
+ * check a part of the TABLE_MAP event against the signature of the table
+ *
+ * @param offset the position in the signature, moved to the next part
+ */
+static gboolean network_mysqld_table_map_part_equal(GString *table_map, gsize *offset, const gchar *part, guint32 part_len) {
+	guint32 len;
+
+	if (*offset + sizeof(len) > table_map->len) return FALSE;
+
+	memcpy(&len, table_map->str + *offset, sizeof(len));
+	*offset += sizeof(len);
+
+	if (len != part_len) return FALSE;
+	if (*offset + len > table_map->len) return FALSE;
+	if (0 != memcmp(table_map->str + *offset, part, len)) return FALSE;
+
+	*offset += len;
+
+	return TRUE;
+}
+
+/**
+ * check if the table was built from the same TABLE_MAP
+ *
+ * the table-id doesn't tell: the server reuses it after ALTER TABLE or FLUSH TABLES
+ */
+static gboolean network_mysqld_table_map_equal(network_mysqld_table *tbl, network_mysqld_binlog_event *event) {
+	gsize offset = 0;
+
+	return network_mysqld_table_map_part_equal(tbl->table_map, &offset, event->event.table_map_event.db_name, event->event.table_map_event.db_name_len) &&
+		network_mysqld_table_map_part_equal(tbl->table_map, &offset, event->event.table_map_event.table_name, event->event.table_map_event.table_name_len) &&
+		network_mysqld_table_map_part_equal(tbl->table_map, &offset, event->event.table_map_event.columns, event->event.table_map_event.columns_len) &&
+		network_mysqld_table_map_part_equal(tbl->table_map, &offset, event->event.table_map_event.metadata, event->event.table_map_event.metadata_len) &&
+		network_mysqld_table_map_part_equal(tbl->table_map, &offset, event->event.table_map_event.null_bits, event->event.table_map_event.null_bits_len) &&
+		offset == tbl->table_map->len;
+}
+
+/**
+ * get the table of a row-event
+ *
+ * @return NULL if no TABLE_MAP event for the table-id was seen
+ */
+network_mysqld_table *network_mysqld_binlog_get_table(network_mysqld_binlog *binlog, guint64 table_id) {
+	return g_hash_table_lookup(binlog->rbr_tables, &table_id);
+}
+
+/**
+ * check if network_mysqld_binlog_table_map_get() would reuse the known table
+ */
+gboolean network_mysqld_binlog_table_map_is_cached(network_mysqld_binlog *binlog, network_mysqld_binlog_event *event) {
+	network_mysqld_table *tbl;
+
+	g_return_val_if_fail(event->event_type == TABLE_MAP_EVENT, FALSE);
+
+	tbl = network_mysqld_binlog_get_table(binlog, event->event.table_map_event.table_id);
+
+	return tbl && network_mysqld_table_map_equal(tbl, event);
+}
+
+/**
+ * get the table of a TABLE_MAP event
+ *
+ * the same TABLE_MAP is sent before each row-event. If the table is known already and
+ * the TABLE_MAP is unchanged, the known table is returned. Otherwise the table is
+ * decoded and replaces the table with the same table-id.
+ *
+ * @return the table, owned by the binlog. NULL if the TABLE_MAP can't be decoded
+ */
+network_mysqld_table *network_mysqld_binlog_table_map_get(network_mysqld_binlog *binlog, network_mysqld_binlog_event *event) {
+	network_mysqld_table *tbl;
+
+	g_return_val_if_fail(event->event_type == TABLE_MAP_EVENT, NULL);
+
+	tbl = network_mysqld_binlog_get_table(binlog, event->event.table_map_event.table_id);
+	if (tbl && network_mysqld_table_map_equal(tbl, event)) return tbl;
+
+	tbl = network_mysqld_table_new();
+
+	if (0 != network_mysqld_binlog_event_tablemap_get(event, tbl)) {
+		network_mysqld_table_free(tbl);
+		return NULL;
+	}
+
+	network_mysqld_table_map_append_part(tbl->table_map, event->event.table_map_event.db_name, event->event.table_map_event.db_name_len);
+	network_mysqld_table_map_append_part(tbl->table_map, event->event.table_map_event.table_name, event->event.table_map_event.table_name_len);
+	network_mysqld_table_map_append_part(tbl->table_map, event->event.table_map_event.columns, event->event.table_map_event.columns_len);
+	network_mysqld_table_map_append_part(tbl->table_map, event->event.table_map_event.metadata, event->event.table_map_event.metadata_len);
+	network_mysqld_table_map_append_part(tbl->table_map, event->event.table_map_event.null_bits, event->event.table_map_event.null_bits_len);
+
+	/* frees the old table with this table-id */
+	g_hash_table_replace(binlog->rbr_tables, &(tbl->table_id), tbl);
+
+	return tbl;
+}
+
+/**
+ * a table-id of a TABLE_MAP event and if the filter wants its events
+ */
+typedef struct {
+	guint64 table_id;
+	gboolean is_wanted;
+} network_mysqld_binlog_filter_table;
+
+network_mysqld_binlog_filter *network_mysqld_binlog_filter_new(void) {
+	network_mysqld_binlog_filter *filter;
+
+	filter = g_new0(network_mysqld_binlog_filter, 1);
+	filter->db_patterns = g_ptr_array_new();
+	filter->table_patterns = g_ptr_array_new();
+	filter->table_ids = g_hash_table_new_full(
+			guint64_hash,
+			guint64_equal,
+			NULL, /* the key is part of the value */
+			g_free);
+
+	return filter;
+}
+
+void network_mysqld_binlog_filter_free(network_mysqld_binlog_filter *filter) {
+	guint i;
+
+	if (!filter) return;
+
+	for (i = 0; i < filter->db_patterns->len; i++) {
+		g_pattern_spec_free(filter->db_patterns->pdata[i]);
+		g_pattern_spec_free(filter->table_patterns->pdata[i]);
+	}
+	g_ptr_array_free(filter->db_patterns, TRUE);
+	g_ptr_array_free(filter->table_patterns, TRUE);
+
+	g_hash_table_destroy(filter->table_ids);
+
+	g_free(filter);
+}
+
+/**
+ * only decode the events of the tables matching the rule
+ *
+ * @param rule <db>.<table> or <db>, both may contain * and ? as wildcards
+ */
+void network_mysqld_binlog_filter_add_table(network_mysqld_binlog_filter *filter, const gchar *rule) {
+	const gchar *dot = strchr(rule, '.');
+	gchar *db_rule;
+
+	db_rule = dot ? g_strndup(rule, dot - rule) : g_strdup(rule);
+
+	g_ptr_array_add(filter->db_patterns, g_pattern_spec_new(db_rule));
+	g_ptr_array_add(filter->table_patterns, g_pattern_spec_new(dot ? dot + 1 : "*"));
+
+	g_free(db_rule);
+}
+
+/**
+ * only decode the events of this type
+ *
+ * TABLE_MAP, FORMAT_DESCRIPTION and ROTATE events are always decoded, the
+ * other events depend on them
+ */
+void network_mysqld_binlog_filter_add_event_type(network_mysqld_binlog_filter *filter, enum Log_event_type event_type) {
+	g_return_if_fail(event_type < ENUM_END_EVENT);
+
+	filter->has_event_types = TRUE;
+	filter->event_types[event_type] = TRUE;
+}
+
+/**
+ * check the names against the table-rules
+ *
+ * @param match_db_only only check the db-part of the rules
+ */
+static gboolean network_mysqld_binlog_filter_match(network_mysqld_binlog_filter *filter, const gchar *db_name, const gchar *table_name, gboolean match_db_only) {
+	guint i;
+
+	if (filter->db_patterns->len == 0) return TRUE;
+
+	for (i = 0; i < filter->db_patterns->len; i++) {
+		if (!g_pattern_match_string(filter->db_patterns->pdata[i], db_name ? db_name : "")) continue;
+		if (!match_db_only && !g_pattern_match_string(filter->table_patterns->pdata[i], table_name ? table_name : "")) continue;
+
+		return TRUE;
+	}
+
+	return FALSE;
+}
+
+/**
+ * peek at the db and table name of a TABLE_MAP event and remember if we want the table
+ */
+static gboolean network_mysqld_binlog_filter_table_map(network_mysqld_binlog_filter *filter, network_packet *packet) {
+	network_mysqld_binlog_filter_table *filter_tbl;
+	guint64 table_id;
+	guint8 db_name_len, table_name_len;
+	gchar *db_name = NULL, *table_name = NULL;
+	gboolean is_wanted;
+	int err = 0;
+
+	err = err || network_mysqld_proto_get_int48(packet, &table_id);
+	err = err || network_mysqld_proto_skip(packet, 2); /* flags */
+	err = err || network_mysqld_proto_get_int8(packet, &db_name_len);
+	err = err || network_mysqld_proto_get_string_len(packet, &db_name, db_name_len);
+	err = err || network_mysqld_proto_skip(packet, 1); /* NUL */
+	err = err || network_mysqld_proto_get_int8(packet, &table_name_len);
+	err = err || network_mysqld_proto_get_string_len(packet, &table_name, table_name_len);
+
+	/* let the decoder complain about it */
+	if (err) {
+		if (db_name) g_free(db_name);
+		if (table_name) g_free(table_name);
+
+		return TRUE;
+	}
+
+	is_wanted = network_mysqld_binlog_filter_match(filter, db_name, table_name, FALSE);
+
+	g_free(db_name);
+	g_free(table_name);
+
+	/* the server reuses the table-ids for other tables */
+	if (NULL == (filter_tbl = g_hash_table_lookup(filter->table_ids, &table_id))) {
+		filter_tbl = g_new0(network_mysqld_binlog_filter_table, 1);
+		filter_tbl->table_id = table_id;
+
+		g_hash_table_insert(filter->table_ids, &(filter_tbl->table_id), filter_tbl);
+	}
+	filter_tbl->is_wanted = is_wanted;
+
+	return is_wanted;
+}
+
+/**
+ * check if a event is wanted before it is decoded
+ *
+ * only looks at the table-id of row-events, the db of QUERY events and the
+ * names in TABLE_MAP events
+ *
+ * @param packet the event, the offset right after the event-header
+ * @param event the decoded event-header
+ * @return TRUE if the event can be skipped
+ */
+gboolean network_mysqld_binlog_filter_skip_event(network_mysqld_binlog_filter *filter, network_packet *packet, network_mysqld_binlog_event *event) {
+	network_packet body = *packet; /* don't move the offset of the packet */
+	network_mysqld_binlog_filter_table *filter_tbl;
+	guint64 table_id;
+	guint8 db_name_len;
+	guint16 status_vars_len;
+	gchar *db_name = NULL;
+	gboolean is_wanted;
+	int err = 0;
+
+	switch (event->event_type) {
+	case FORMAT_DESCRIPTION_EVENT:
+	case ROTATE_EVENT:
+		return FALSE;
+	case TABLE_MAP_EVENT:
+		return !network_mysqld_binlog_filter_table_map(filter, &body);
+	case WRITE_ROWS_EVENT:
+	case UPDATE_ROWS_EVENT:
+	case DELETE_ROWS_EVENT:
+		if (0 == network_mysqld_proto_get_int48(&body, &table_id) &&
+		    NULL != (filter_tbl = g_hash_table_lookup(filter->table_ids, &table_id)) &&
+		    !filter_tbl->is_wanted) {
+			return TRUE;
+		}
+		break;
+	case QUERY_EVENT:
+		if (filter->db_patterns->len == 0) break;
+
+		err = err || network_mysqld_proto_skip(&body, 4 + 4); /* thread-id, exec-time */
+		err = err || network_mysqld_proto_get_int8(&body, &db_name_len);
+		err = err || network_mysqld_proto_skip(&body, 2); /* error-code */
+		err = err || network_mysqld_proto_get_int16(&body, &status_vars_len);
+		err = err || network_mysqld_proto_skip(&body, status_vars_len);
+		err = err || network_mysqld_proto_get_string_len(&body, &db_name, db_name_len);
+		if (err) {
+			if (db_name) g_free(db_name);
+			break;
+		}
+
+		is_wanted = network_mysqld_binlog_filter_match(filter, db_name, NULL, TRUE);
+		g_free(db_name);
 
+		if (!is_wanted) return TRUE;
+		break;
+	default:
+		break;
+	}
+
+	if (filter->has_event_types &&
+	    (event->event_type >= ENUM_END_EVENT || !filter->event_types[event->event_type])) {
+		return TRUE;
+	}
+
+	return FALSE;
+}
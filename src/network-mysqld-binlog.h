@@ -102,12 +102,14 @@ enum Log_event_type
  */
 
 typedef struct {
-	guint64 table_id;
+	guint64 table_id;   /**< also the key in network_mysqld_binlog->rbr_tables */
 
 	GString *db_name;
 	GString *table_name;
 
 	GPtrArray *fields;
+
+	GString *table_map; /**< names, column-types, metadata and null-bits of the TABLE_MAP event it was built from */
 } network_mysqld_table;
 
 NETWORK_API network_mysqld_table *network_mysqld_table_new();
@@ -128,13 +130,16 @@ typedef struct {
 	guint header_len;
 
 	/* ... and the table-ids */
-	GHashTable *rbr_tables; /* hashed by table-id -> network_mysqld_table */
+	GHashTable *rbr_tables; /* hashed by &tbl->table_id -> network_mysqld_table */
 
 	network_mysqld_binlog_checksum checksum;
+	gboolean verify_checksums; /**< reject events with a wrong CRC32, default: TRUE */
 } network_mysqld_binlog;
 
 NETWORK_API network_mysqld_binlog *network_mysqld_binlog_new();
 NETWORK_API void network_mysqld_binlog_free(network_mysqld_binlog *binlog);
+NETWORK_API gboolean network_mysqld_binlog_event_checksum_is_valid(const char *event, gsize event_len);
+NETWORK_API void network_mysqld_binlog_event_append_checksum(GString *packet, gsize event_offset);
 
 typedef struct {
 	guint32 timestamp;
@@ -253,9 +258,83 @@ NETWORK_API network_mysqld_binlog_dump *network_mysqld_binlog_dump_new();
 NETWORK_API void network_mysqld_binlog_dump_free(network_mysqld_binlog_dump *dump);
 NETWORK_API int network_mysqld_proto_append_binlog_dump(GString *packet, network_mysqld_binlog_dump *dump);
 
+#define NETWORK_MYSQLD_BINLOG_HEADER           "\xfe" "bin"
+#define NETWORK_MYSQLD_BINLOG_HEADER_LEN       4
+#define NETWORK_MYSQLD_BINLOG_EVENT_HEADER_LEN 19
+
+/**
+ * a binlog-file, mapped into memory
+ */
+typedef struct {
+	GMappedFile *mapped;
+
+	const char *data;
+	gsize len;
+
+	gsize pos;       /**< position of the next event */
+
+	GString event;   /**< the last event, a view into the mapping */
+} network_mysqld_binlog_file;
+
+NETWORK_API network_mysqld_binlog_file *network_mysqld_binlog_file_open(const gchar *filename, GError **gerr);
+NETWORK_API void network_mysqld_binlog_file_free(network_mysqld_binlog_file *file);
+NETWORK_API int network_mysqld_binlog_file_seek(network_mysqld_binlog_file *file, gsize pos);
+NETWORK_API int network_mysqld_binlog_file_get_event(network_mysqld_binlog_file *file, network_packet *packet);
+
+/**
+ * a sparse index of a binlog-file: the timestamp and offset of every n-th event
+ *
+ * saved next to the binlog as <binlog>.index
+ */
+typedef struct {
+	guint32 timestamp;   /**< the highest timestamp of the events up to this one */
+	guint64 offset;      /**< offset of the event in the binlog-file */
+} network_mysqld_binlog_index_entry;
+
+typedef struct {
+	GArray *entries;     /**< network_mysqld_binlog_index_entry, ordered by offset */
+
+	guint interval;      /**< an entry every interval events */
+
+	guint64 indexed_len; /**< the binlog-file is indexed up to here */
+	guint events;        /**< events since the last entry */
+	guint32 max_timestamp;
+} network_mysqld_binlog_index;
+
+NETWORK_API network_mysqld_binlog_index *network_mysqld_binlog_index_new(guint interval);
+NETWORK_API void network_mysqld_binlog_index_free(network_mysqld_binlog_index *index);
+NETWORK_API int network_mysqld_binlog_index_update(network_mysqld_binlog_index *index, network_mysqld_binlog_file *file);
+NETWORK_API int network_mysqld_binlog_index_load(network_mysqld_binlog_index *index, const gchar *filename, GError **gerr);
+NETWORK_API int network_mysqld_binlog_index_save(network_mysqld_binlog_index *index, const gchar *filename, GError **gerr);
+NETWORK_API guint64 network_mysqld_binlog_index_lookup_timestamp(network_mysqld_binlog_index *index, guint32 timestamp);
+NETWORK_API guint64 network_mysqld_binlog_index_lookup_offset(network_mysqld_binlog_index *index, guint64 offset);
+
 
 NETWORK_API int network_mysqld_binlog_event_tablemap_get(
 		network_mysqld_binlog_event *event,
 		network_mysqld_table *tbl);
 
+NETWORK_API network_mysqld_table *network_mysqld_binlog_get_table(network_mysqld_binlog *binlog, guint64 table_id);
+
+/**
+ * decide which events to decode, before their body is decoded
+ */
+typedef struct {
+	GPtrArray *db_patterns;      /**< GPatternSpec of the db-part of the table-rules */
+	GPtrArray *table_patterns;   /**< GPatternSpec of the table-part of the table-rules */
+
+	gboolean has_event_types;
+	gboolean event_types[ENUM_END_EVENT]; /**< the wanted event-types */
+
+	GHashTable *table_ids;       /**< the TABLE_MAPs we saw: &table_id -> network_mysqld_binlog_filter_table */
+} network_mysqld_binlog_filter;
+
+NETWORK_API network_mysqld_binlog_filter *network_mysqld_binlog_filter_new(void);
+NETWORK_API void network_mysqld_binlog_filter_free(network_mysqld_binlog_filter *filter);
+NETWORK_API void network_mysqld_binlog_filter_add_table(network_mysqld_binlog_filter *filter, const gchar *rule);
+NETWORK_API void network_mysqld_binlog_filter_add_event_type(network_mysqld_binlog_filter *filter, enum Log_event_type event_type);
+NETWORK_API gboolean network_mysqld_binlog_filter_skip_event(network_mysqld_binlog_filter *filter, network_packet *packet, network_mysqld_binlog_event *event);
+NETWORK_API gboolean network_mysqld_binlog_table_map_is_cached(network_mysqld_binlog *binlog, network_mysqld_binlog_event *event);
+NETWORK_API network_mysqld_table *network_mysqld_binlog_table_map_get(network_mysqld_binlog *binlog, network_mysqld_binlog_event *event);
+
 #endif
@@ -0,0 +1,427 @@
+/* $%BEGINLICENSE%$
+ Copyright (c) 2008, 2012, Oracle and/or its affiliates. All rights reserved.
+
+ This program is free software; you can redistribute it and/or
+ modify it under the terms of the GNU General Public License as
+ published by the Free Software Foundation; version 2 of the
+ License.
+
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ GNU General Public License for more details.
+
+ You should have received a copy of the GNU General Public License
+ along with this program; if not, write to the Free Software
+ Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA
+ 02110-1301  USA
+
+ $%ENDLICENSE%$ */
+#include <string.h>
+
+#include "network-mysqld-columns.h"
+
+/**
+ * map the field-type to the storage of the column
+ *
+ * @return -1 if the type isn't supported by the binary protocol decoder
+ */
+static int network_mysqld_column_kind_get(enum enum_field_types type, network_mysqld_column_kind_t *kind) {
+	switch (type) {
+	case MYSQL_TYPE_TINY:
+	case MYSQL_TYPE_SHORT:
+	case MYSQL_TYPE_INT24:
+	case MYSQL_TYPE_LONG:
+	case MYSQL_TYPE_LONGLONG:
+	case MYSQL_TYPE_YEAR:
+		*kind = NETWORK_MYSQLD_COLUMN_INT;
+		return 0;
+	case MYSQL_TYPE_FLOAT:
+	case MYSQL_TYPE_DOUBLE:
+		*kind = NETWORK_MYSQLD_COLUMN_DOUBLE;
+		return 0;
+	case MYSQL_TYPE_BIT:
+	case MYSQL_TYPE_NEWDECIMAL:
+	case MYSQL_TYPE_TINY_BLOB:
+	case MYSQL_TYPE_BLOB:
+	case MYSQL_TYPE_MEDIUM_BLOB:
+	case MYSQL_TYPE_LONG_BLOB:
+	case MYSQL_TYPE_STRING:
+	case MYSQL_TYPE_VAR_STRING:
+		*kind = NETWORK_MYSQLD_COLUMN_STRING;
+		return 0;
+	case MYSQL_TYPE_DATE:
+	case MYSQL_TYPE_DATETIME:
+	case MYSQL_TYPE_TIMESTAMP:
+		*kind = NETWORK_MYSQLD_COLUMN_DATE;
+		return 0;
+	case MYSQL_TYPE_TIME:
+		*kind = NETWORK_MYSQLD_COLUMN_TIME;
+		return 0;
+	default:
+		return -1;
+	}
+}
+
+/**
+ * size of one value of a column
+ */
+static gsize network_mysqld_column_value_size(network_mysqld_column_kind_t kind) {
+	switch (kind) {
+	case NETWORK_MYSQLD_COLUMN_INT:    return sizeof(gint64);
+	case NETWORK_MYSQLD_COLUMN_DOUBLE: return sizeof(gdouble);
+	case NETWORK_MYSQLD_COLUMN_STRING: return sizeof(network_mysqld_column_string_t);
+	case NETWORK_MYSQLD_COLUMN_DATE:   return sizeof(network_mysqld_type_date_t);
+	case NETWORK_MYSQLD_COLUMN_TIME:   return sizeof(network_mysqld_type_time_t);
+	}
+
+	g_assert_not_reached();
+	return 0;
+}
+
+/**
+ * grow all column vectors to hold rows_allocated rows
+ */
+static void network_mysqld_columns_resize(network_mysqld_columns_t *cols, guint rows_allocated) {
+	guint i;
+
+	cols->packets = g_renew(GString *, cols->packets, rows_allocated);
+
+	for (i = 0; i < cols->columns_len; i++) {
+		network_mysqld_column_t *col = &cols->columns[i];
+
+		col->is_null = g_renew(guint8, col->is_null, rows_allocated);
+		/* all members of the union are pointers, resize through one of them */
+		col->v.i = g_realloc(col->v.i, rows_allocated * network_mysqld_column_value_size(col->kind));
+	}
+
+	cols->rows_allocated = rows_allocated;
+}
+
+/**
+ * create the column vectors for the fields of a result-set
+ *
+ * @param rows_hint number of rows to allocate upfront, the vectors grow if more rows are added
+ * @return NULL if one of the fields has a type we can't decode
+ */
+network_mysqld_columns_t *network_mysqld_columns_new(network_mysqld_proto_fielddefs_t *fielddefs, guint rows_hint) {
+	network_mysqld_columns_t *cols;
+	guint i;
+
+	cols = g_slice_new0(network_mysqld_columns_t);
+	cols->columns_len = fielddefs->len;
+	cols->columns = g_new0(network_mysqld_column_t, cols->columns_len);
+
+	for (i = 0; i < fielddefs->len; i++) {
+		network_mysqld_proto_fielddef_t *fielddef = g_ptr_array_index(fielddefs, i);
+		network_mysqld_column_t *col = &cols->columns[i];
+
+		if (0 != network_mysqld_column_kind_get(fielddef->type, &col->kind)) {
+			g_debug("%s: can't decode field-type %d of column %u",
+					G_STRLOC,
+					fielddef->type, i);
+
+			network_mysqld_columns_free(cols);
+			return NULL;
+		}
+		col->type = fielddef->type;
+		col->is_unsigned = (fielddef->flags & UNSIGNED_FLAG) ? TRUE : FALSE;
+	}
+
+	network_mysqld_columns_resize(cols, MAX(rows_hint, 1));
+
+	return cols;
+}
+
+void network_mysqld_columns_free(network_mysqld_columns_t *cols) {
+	guint i;
+
+	if (NULL == cols) return;
+
+	for (i = 0; i < cols->columns_len; i++) {
+		network_mysqld_column_t *col = &cols->columns[i];
+
+		if (col->is_null) g_free(col->is_null);
+		if (col->v.i) g_free(col->v.i);
+	}
+	g_free(cols->columns);
+
+	if (cols->packets) g_free(cols->packets);
+
+	g_slice_free(network_mysqld_columns_t, cols);
+}
+
+/**
+ * decode a int of the binary protocol and sign-extend it
+ */
+static int network_mysqld_column_get_int(network_packet *packet, network_mysqld_column_t *col, gint64 *v) {
+	int err = 0;
+	guint8 i8 = 0;
+	guint16 i16 = 0;
+	guint32 i32 = 0;
+	guint64 i64 = 0;
+
+	switch (col->type) {
+	case MYSQL_TYPE_TINY:
+		err = err || network_mysqld_proto_get_int8(packet, &i8);
+		*v = col->is_unsigned ? (gint64)i8 : (gint64)(gint8)i8;
+		break;
+	case MYSQL_TYPE_SHORT:
+	case MYSQL_TYPE_YEAR:
+		err = err || network_mysqld_proto_get_int16(packet, &i16);
+		*v = col->is_unsigned ? (gint64)i16 : (gint64)(gint16)i16;
+		break;
+	case MYSQL_TYPE_INT24:
+	case MYSQL_TYPE_LONG:
+		err = err || network_mysqld_proto_get_int32(packet, &i32);
+		*v = col->is_unsigned ? (gint64)i32 : (gint64)(gint32)i32;
+		break;
+	case MYSQL_TYPE_LONGLONG:
+		err = err || network_mysqld_proto_get_int64(packet, &i64);
+		*v = (gint64)i64;
+		break;
+	default:
+		err = -1;
+		break;
+	}
+
+	return err ? -1 : 0;
+}
+
+/**
+ * decode a FLOAT or DOUBLE
+ *
+ * the wire-format is little-endian IEEE 754, the get_int*() functions already
+ * convert to the host byte-order
+ */
+static int network_mysqld_column_get_double(network_packet *packet, network_mysqld_column_t *col, gdouble *v) {
+	int err = 0;
+
+	if (col->type == MYSQL_TYPE_FLOAT) {
+		guint32 i32;
+		gfloat f;
+
+		err = err || network_mysqld_proto_get_int32(packet, &i32);
+		if (0 == err) {
+			memcpy(&f, &i32, sizeof(f));
+			*v = f;
+		}
+	} else {
+		guint64 i64;
+
+		err = err || network_mysqld_proto_get_int64(packet, &i64);
+		if (0 == err) {
+			memcpy(v, &i64, sizeof(*v));
+		}
+	}
+
+	return err ? -1 : 0;
+}
+
+/**
+ * remember where the string is in the packet and skip it
+ */
+static int network_mysqld_column_get_string(network_packet *packet, network_mysqld_column_string_t *s) {
+	int err = 0;
+	guint64 len;
+
+	err = err || network_mysqld_proto_get_lenenc_int(packet, &len);
+	err = err || (len > packet->data->len - packet->offset);
+	if (0 != err) return -1;
+
+	s->offset = packet->offset;
+	s->len = len;
+
+	return network_mysqld_proto_skip(packet, len);
+}
+
+static int network_mysqld_column_get_date(network_packet *packet, network_mysqld_type_date_t *date) {
+	int err = 0;
+	guint8 len;
+
+	err = err || network_mysqld_proto_get_int8(packet, &len);
+	if (0 != err) return -1;
+
+	switch (len) {
+	case 11: /* date + time + ms */
+	case 7:  /* date + time ( ms is .0000 ) */
+	case 4:  /* date ( time is 00:00:00 )*/
+	case 0:  /* date == 0000-00-00 */
+		break;
+	default:
+		return -1;
+	}
+
+	memset(date, 0, sizeof(*date));
+	if (len > 0) {
+		err = err || network_mysqld_proto_get_int16(packet, &date->year);
+		err = err || network_mysqld_proto_get_int8(packet, &date->month);
+		err = err || network_mysqld_proto_get_int8(packet, &date->day);
+	}
+	if (len > 4) {
+		err = err || network_mysqld_proto_get_int8(packet, &date->hour);
+		err = err || network_mysqld_proto_get_int8(packet, &date->min);
+		err = err || network_mysqld_proto_get_int8(packet, &date->sec);
+	}
+	if (len > 7) {
+		err = err || network_mysqld_proto_get_int32(packet, &date->nsec);
+	}
+
+	return err ? -1 : 0;
+}
+
+static int network_mysqld_column_get_time(network_packet *packet, network_mysqld_type_time_t *t) {
+	int err = 0;
+	guint8 len;
+
+	err = err || network_mysqld_proto_get_int8(packet, &len);
+	if (0 != err) return -1;
+
+	switch (len) {
+	case 12: /* day + time + ms */
+	case 8:  /* day + time ( ms is .0000 ) */
+	case 0:  /* time == 00:00:00 */
+		break;
+	default:
+		return -1;
+	}
+
+	memset(t, 0, sizeof(*t));
+	if (len > 0) {
+		err = err || network_mysqld_proto_get_int8(packet, &t->sign);
+		err = err || network_mysqld_proto_get_int32(packet, &t->days);
+		err = err || network_mysqld_proto_get_int8(packet, &t->hour);
+		err = err || network_mysqld_proto_get_int8(packet, &t->min);
+		err = err || network_mysqld_proto_get_int8(packet, &t->sec);
+	}
+	if (len > 8) {
+		err = err || network_mysqld_proto_get_int32(packet, &t->nsec);
+	}
+
+	return err ? -1 : 0;
+}
+
+/**
+ * decode a binary row packet into the next row of the columns
+ *
+ * the packet isn't copied and has to stay valid as long as the strings are used
+ *
+ * @param packet a binary row packet including the network-header
+ * @return 0 on success, -1 if the packet couldn't be decoded
+ */
+int network_mysqld_columns_add_binary_row(network_mysqld_columns_t *cols, GString *packet) {
+	network_packet p;
+	const guint8 *nul_bytes;
+	gsize nul_bytes_len;
+	guint row;
+	guint i;
+	guint8 ok;
+	int err = 0;
+
+	p.data = packet;
+	p.offset = 0;
+
+	err = err || network_mysqld_proto_skip_network_header(&p);
+	err = err || network_mysqld_proto_get_int8(&p, &ok);
+	err = err || (ok != 0);
+
+	/* the NULL-bitmap is used in place, the first 2 bits are reserved */
+	nul_bytes_len = (cols->columns_len + 7 + 2) / 8;
+	nul_bytes = (const guint8 *)packet->str + p.offset;
+	err = err || network_mysqld_proto_skip(&p, nul_bytes_len);
+	if (0 != err) return -1;
+
+	if (cols->rows == cols->rows_allocated) {
+		network_mysqld_columns_resize(cols, cols->rows_allocated * 2);
+	}
+	row = cols->rows;
+
+	for (i = 0; 0 == err && i < cols->columns_len; i++) {
+		network_mysqld_column_t *col = &cols->columns[i];
+
+		col->is_null[row] = (nul_bytes[(i + 2) / 8] & (1 << ((i + 2) % 8))) ? 1 : 0;
+
+		switch (col->kind) {
+		case NETWORK_MYSQLD_COLUMN_INT:
+			if (col->is_null[row]) col->v.i[row] = 0;
+			else err = err || network_mysqld_column_get_int(&p, col, &col->v.i[row]);
+			break;
+		case NETWORK_MYSQLD_COLUMN_DOUBLE:
+			if (col->is_null[row]) col->v.d[row] = 0;
+			else err = err || network_mysqld_column_get_double(&p, col, &col->v.d[row]);
+			break;
+		case NETWORK_MYSQLD_COLUMN_STRING:
+			if (col->is_null[row]) memset(&col->v.s[row], 0, sizeof(col->v.s[row]));
+			else err = err || network_mysqld_column_get_string(&p, &col->v.s[row]);
+			break;
+		case NETWORK_MYSQLD_COLUMN_DATE:
+			if (col->is_null[row]) memset(&col->v.date[row], 0, sizeof(col->v.date[row]));
+			else err = err || network_mysqld_column_get_date(&p, &col->v.date[row]);
+			break;
+		case NETWORK_MYSQLD_COLUMN_TIME:
+			if (col->is_null[row]) memset(&col->v.time[row], 0, sizeof(col->v.time[row]));
+			else err = err || network_mysqld_column_get_time(&p, &col->v.time[row]);
+			break;
+		}
+	}
+
+	if (0 != err) return -1;
+
+	/* only count the row once all its fields are decoded */
+	cols->packets[row] = packet;
+	cols->rows++;
+
+	return 0;
+}
+
+/**
+ * decode the binary rows of a result-set until the EOF packet
+ *
+ * @param chunk the first row packet, right after the EOF of the field-defs
+ * @return the chunk of the EOF packet, NULL on error
+ */
+GList *network_mysqld_columns_add_binary_rows(network_mysqld_columns_t *cols, GList *chunk) {
+	for (; chunk; chunk = chunk->next) {
+		network_packet packet;
+		network_mysqld_lenenc_type lenenc_type;
+		int err = 0;
+
+		packet.data = chunk->data;
+		packet.offset = 0;
+
+		err = err || network_mysqld_proto_skip_network_header(&packet);
+		err = err || network_mysqld_proto_peek_lenenc_type(&packet, &lenenc_type);
+		if (0 != err) return NULL;
+
+		if (NETWORK_MYSQLD_LENENC_TYPE_EOF == lenenc_type) {
+			return chunk;
+		}
+
+		if (0 != network_mysqld_columns_add_binary_row(cols, chunk->data)) {
+			return NULL;
+		}
+	}
+
+	return NULL;
+}
+
+/**
+ * get the string value of a STRING column
+ *
+ * @return 0 on success, -1 if the column isn't a string column or the value is NULL
+ */
+int network_mysqld_columns_get_string(network_mysqld_columns_t *cols, guint col, guint row, const char **s, gsize *s_len) {
+	network_mysqld_column_t *column;
+
+	if (col >= cols->columns_len) return -1;
+	if (row >= cols->rows) return -1;
+
+	column = &cols->columns[col];
+	if (column->kind != NETWORK_MYSQLD_COLUMN_STRING) return -1;
+	if (column->is_null[row]) return -1;
+
+	*s = cols->packets[row]->str + column->v.s[row].offset;
+	*s_len = column->v.s[row].len;
+
+	return 0;
+}
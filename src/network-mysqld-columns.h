@@ -0,0 +1,94 @@
+/* $%BEGINLICENSE%$
+ Copyright (c) 2008, 2012, Oracle and/or its affiliates. All rights reserved.
+
+ This program is free software; you can redistribute it and/or
+ modify it under the terms of the GNU General Public License as
+ published by the Free Software Foundation; version 2 of the
+ License.
+
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ GNU General Public License for more details.
+
+ You should have received a copy of the GNU General Public License
+ along with this program; if not, write to the Free Software
+ Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA
+ 02110-1301  USA
+
+ $%ENDLICENSE%$ */
+#ifndef __NETWORK_MYSQLD_COLUMNS_H__
+#define __NETWORK_MYSQLD_COLUMNS_H__
+
+#ifdef _WIN32
+/* mysql.h needs SOCKET defined */
+#include <winsock2.h>
+#endif
+#include <mysql.h>
+#include <glib.h>
+
+#include "network_mysqld_type.h"
+#include "network-mysqld-proto.h"
+
+#include "network-exports.h"
+
+/**
+ * how the values of a column are stored
+ */
+typedef enum {
+	NETWORK_MYSQLD_COLUMN_INT,    /**< TINY, SHORT, INT24, LONG, LONGLONG and YEAR in ->v.i */
+	NETWORK_MYSQLD_COLUMN_DOUBLE, /**< FLOAT and DOUBLE in ->v.d */
+	NETWORK_MYSQLD_COLUMN_STRING, /**< strings, blobs, decimals and bits in ->v.s */
+	NETWORK_MYSQLD_COLUMN_DATE,   /**< DATE, DATETIME and TIMESTAMP in ->v.date */
+	NETWORK_MYSQLD_COLUMN_TIME    /**< TIME in ->v.time */
+} network_mysqld_column_kind_t;
+
+/**
+ * a string value, it points into the row packet
+ */
+typedef struct {
+	guint32 offset;  /**< offset into the row packet, including the network-header */
+	guint32 len;
+} network_mysqld_column_string_t;
+
+/**
+ * the values of one column of all rows
+ */
+typedef struct {
+	enum enum_field_types type;
+	network_mysqld_column_kind_t kind;
+	gboolean is_unsigned;   /**< the ints are guint64 and not gint64 */
+
+	guint8 *is_null;        /**< one per row */
+	union {
+		gint64 *i;          /**< unsigned ints are stored as (gint64) */
+		gdouble *d;
+		network_mysqld_column_string_t *s;
+		network_mysqld_type_date_t *date;
+		network_mysqld_type_time_t *time;
+	} v;
+} network_mysqld_column_t;
+
+/**
+ * the rows of a binary result-set decoded into typed column vectors
+ *
+ * one allocation per column instead of one network_mysqld_type_t per field.
+ * The strings aren't copied, the row packets have to stay around as long as
+ * the columns are used.
+ */
+typedef struct {
+	network_mysqld_column_t *columns;
+	guint columns_len;
+
+	GString **packets;      /**< the row packet of each row */
+	guint rows;
+	guint rows_allocated;
+} network_mysqld_columns_t;
+
+NETWORK_API network_mysqld_columns_t *network_mysqld_columns_new(network_mysqld_proto_fielddefs_t *fielddefs, guint rows_hint);
+NETWORK_API void network_mysqld_columns_free(network_mysqld_columns_t *cols);
+NETWORK_API int network_mysqld_columns_add_binary_row(network_mysqld_columns_t *cols, GString *packet);
+NETWORK_API GList *network_mysqld_columns_add_binary_rows(network_mysqld_columns_t *cols, GList *chunk);
+NETWORK_API int network_mysqld_columns_get_string(network_mysqld_columns_t *cols, guint col, guint row, const char **s, gsize *s_len);
+
+#endif
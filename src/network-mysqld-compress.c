@@ -0,0 +1,245 @@
+/* $%BEGINLICENSE%$
+ Copyright (c) 2008, 2012, Oracle and/or its affiliates. All rights reserved.
+
+ This program is free software; you can redistribute it and/or
+ modify it under the terms of the GNU General Public License as
+ published by the Free Software Foundation; version 2 of the
+ License.
+
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ GNU General Public License for more details.
+
+ You should have received a copy of the GNU General Public License
+ along with this program; if not, write to the Free Software
+ Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA
+ 02110-1301  USA
+
+ $%ENDLICENSE%$ */
+/**
+ * the framing of the compressed protocol
+ *
+ * the compressed packets are translated at the socket: network_socket_read()
+ * uncompresses the stream into the recv-queue-raw and network_socket_write()
+ * compresses the send-queue before it is written. All the code above works on
+ * normal mysql packets and doesn't know about the compression.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <string.h>
+
+#ifdef HAVE_ZLIB_H
+#include <zlib.h>
+#endif
+
+#include "network-mysqld-compress.h"
+#include "network-buffer-pool.h"
+
+/**
+ * check if we were built with zlib
+ *
+ * without zlib we can't uncompress what we get and don't announce CLIENT_COMPRESS
+ */
+gboolean network_mysqld_compress_is_available(void) {
+#ifdef HAVE_ZLIB_H
+	return TRUE;
+#else
+	return FALSE;
+#endif
+}
+
+static void network_mysqld_compress_header_set(gchar *header, gsize len, guint8 packet_id, gsize uncompressed_len) {
+	header[0] = (len >>  0) & 0xff;
+	header[1] = (len >>  8) & 0xff;
+	header[2] = (len >> 16) & 0xff;
+	header[3] = packet_id;
+	header[4] = (uncompressed_len >>  0) & 0xff;
+	header[5] = (uncompressed_len >>  8) & 0xff;
+	header[6] = (uncompressed_len >> 16) & 0xff;
+}
+
+static gsize network_mysqld_compress_header_get_len(const guchar *header, gsize off) {
+	return header[off + 0] | (header[off + 1] << 8) | (header[off + 2] << 16);
+}
+
+/**
+ * the max. size of a compressed packet for a payload of src_len bytes
+ */
+static gsize network_mysqld_compress_bound(gsize src_len) {
+#ifdef HAVE_ZLIB_H
+	return NETWORK_MYSQLD_COMPRESS_HEADER_SIZE + MAX(compressBound(src_len), src_len);
+#else
+	return NETWORK_MYSQLD_COMPRESS_HEADER_SIZE + src_len;
+#endif
+}
+
+/**
+ * append a compressed packet to dst
+ *
+ * short payloads and payloads which don't get smaller are sent as is
+ *
+ * @param dst       string to append the compressed packet to
+ * @param src       the payload
+ * @param src_len   length of the payload, at most NETWORK_MYSQLD_COMPRESS_MAX_LEN
+ * @param packet_id packet-id of the compressed packet
+ * @return 0 on success, -1 on error
+ */
+int network_mysqld_compress_append(GString *dst, const char *src, gsize src_len, guint8 packet_id) {
+	gsize header_off = dst->len;
+
+	if (src_len > NETWORK_MYSQLD_COMPRESS_MAX_LEN) {
+		g_critical("%s: payload of %"G_GSIZE_FORMAT" bytes is too large for a compressed packet", G_STRLOC, src_len);
+		return -1;
+	}
+
+#ifdef HAVE_ZLIB_H
+	if (src_len >= NETWORK_MYSQLD_COMPRESS_MIN_LEN) {
+		uLongf compressed_len = compressBound(src_len);
+		int zret;
+
+		g_string_set_size(dst, header_off + NETWORK_MYSQLD_COMPRESS_HEADER_SIZE + compressed_len);
+
+		zret = compress((Bytef *)dst->str + header_off + NETWORK_MYSQLD_COMPRESS_HEADER_SIZE, &compressed_len,
+				(const Bytef *)src, src_len);
+		if (zret != Z_OK) {
+			g_critical("%s: compress() failed: %d", G_STRLOC, zret);
+			g_string_truncate(dst, header_off);
+			return -1;
+		}
+
+		if (compressed_len < src_len) {
+			network_mysqld_compress_header_set(dst->str + header_off, compressed_len, packet_id, src_len);
+			g_string_truncate(dst, header_off + NETWORK_MYSQLD_COMPRESS_HEADER_SIZE + compressed_len);
+
+			return 0;
+		}
+
+		/* it didn't get smaller, send it as is */
+	}
+#endif
+
+	g_string_set_size(dst, header_off + NETWORK_MYSQLD_COMPRESS_HEADER_SIZE);
+	network_mysqld_compress_header_set(dst->str + header_off, src_len, packet_id, 0);
+	g_string_append_len(dst, src, src_len);
+
+	return 0;
+}
+
+/**
+ * move all of src as compressed packets to dst
+ *
+ * src is split at NETWORK_MYSQLD_COMPRESS_MAX_LEN, the small packets of a
+ * result-set get compressed together.
+ *
+ * @param dst       queue to append the compressed packets to
+ * @param src       queue of mysql packets, it is empty afterwards
+ * @param packet_id packet-id of the first compressed packet, incremented for each packet
+ * @return 0 on success, -1 on error
+ */
+int network_mysqld_compress_queue(network_queue *dst, network_queue *src, guint8 *packet_id) {
+	while (src->len > 0) {
+		gsize payload_len = MIN(src->len, NETWORK_MYSQLD_COMPRESS_MAX_LEN);
+		GString *payload;
+		GString *packet;
+
+		payload = network_queue_pop_string(src, payload_len, NULL);
+		packet = network_buffer_pool_get(network_mysqld_compress_bound(payload_len));
+
+		if (0 != network_mysqld_compress_append(packet, payload->str, payload->len, *packet_id)) {
+			network_buffer_pool_put(payload);
+			network_buffer_pool_put(packet);
+			return -1;
+		}
+		network_buffer_pool_put(payload);
+
+		(*packet_id)++;
+
+		network_queue_append(dst, packet);
+	}
+
+	return 0;
+}
+
+/**
+ * uncompress all complete compressed packets from src into dst
+ *
+ * incomplete packets stay in src until the rest of it is read
+ *
+ * @param dst       queue to append the uncompressed stream to
+ * @param src       queue of compressed packets
+ * @param packet_id set to the packet-id of the next compressed packet we send
+ * @return 0 on success, -1 on a protocol error
+ */
+int network_mysqld_decompress_queue(network_queue *dst, network_queue *src, guint8 *packet_id) {
+	gchar header_buf[NETWORK_MYSQLD_COMPRESS_HEADER_SIZE + 1]; /* + the \0 that g_string_append_len() adds */
+
+	while (src->len >= NETWORK_MYSQLD_COMPRESS_HEADER_SIZE) {
+		const guchar *header;
+		gsize compressed_len, uncompressed_len;
+		GString *packet;
+
+		if (NULL == (header = (const guchar *)network_queue_peek_str(src, NETWORK_MYSQLD_COMPRESS_HEADER_SIZE))) {
+			/* the header spans two chunks */
+			GString header_str;
+
+			header_str.str = header_buf;
+			header_str.len = 0;
+			header_str.allocated_len = sizeof(header_buf);
+
+			network_queue_peek_string(src, NETWORK_MYSQLD_COMPRESS_HEADER_SIZE, &header_str);
+			header = (const guchar *)header_buf;
+		}
+
+		compressed_len = network_mysqld_compress_header_get_len(header, 0);
+		uncompressed_len = network_mysqld_compress_header_get_len(header, 4);
+
+		if (src->len < NETWORK_MYSQLD_COMPRESS_HEADER_SIZE + compressed_len) break; /* wait for the rest */
+
+		*packet_id = header[3] + 1;
+
+		packet = network_queue_pop_string(src, NETWORK_MYSQLD_COMPRESS_HEADER_SIZE + compressed_len, NULL);
+
+		if (uncompressed_len == 0) {
+			/* sent as is */
+			g_string_erase(packet, 0, NETWORK_MYSQLD_COMPRESS_HEADER_SIZE);
+		} else {
+#ifdef HAVE_ZLIB_H
+			GString *uncompressed = network_buffer_pool_get(uncompressed_len + 1);
+			uLongf out_len = uncompressed_len;
+			int zret;
+
+			zret = uncompress((Bytef *)uncompressed->str, &out_len,
+					(const Bytef *)packet->str + NETWORK_MYSQLD_COMPRESS_HEADER_SIZE, compressed_len);
+			network_buffer_pool_put(packet);
+
+			if (zret != Z_OK || out_len != uncompressed_len) {
+				g_critical("%s: uncompress() failed: %d (got %lu bytes, expected %"G_GSIZE_FORMAT")",
+						G_STRLOC, zret, (unsigned long)out_len, uncompressed_len);
+				network_buffer_pool_put(uncompressed);
+				return -1;
+			}
+			uncompressed->len = out_len;
+			uncompressed->str[out_len] = '\0';
+
+			packet = uncompressed;
+#else
+			g_critical("%s: got a compressed packet, but we are built without zlib", G_STRLOC);
+			network_buffer_pool_put(packet);
+			return -1;
+#endif
+		}
+
+		if (packet->len == 0) {
+			network_buffer_pool_put(packet);
+			continue;
+		}
+
+		network_queue_append(dst, packet);
+	}
+
+	return 0;
+}
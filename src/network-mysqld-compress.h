@@ -0,0 +1,59 @@
+/* $%BEGINLICENSE%$
+ Copyright (c) 2008, 2012, Oracle and/or its affiliates. All rights reserved.
+
+ This program is free software; you can redistribute it and/or
+ modify it under the terms of the GNU General Public License as
+ published by the Free Software Foundation; version 2 of the
+ License.
+
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ GNU General Public License for more details.
+
+ You should have received a copy of the GNU General Public License
+ along with this program; if not, write to the Free Software
+ Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA
+ 02110-1301  USA
+
+ $%ENDLICENSE%$ */
+#ifndef __NETWORK_MYSQLD_COMPRESS_H__
+#define __NETWORK_MYSQLD_COMPRESS_H__
+
+#include <glib.h>
+
+#include "network-queue.h"
+
+#include "network-exports.h"
+
+/**
+ * the compressed protocol (CLIENT_COMPRESS)
+ *
+ * each compressed packet has a header of its own:
+ *
+ *   3 bytes  length of the payload as sent
+ *   1 byte   packet-id of the compressed packet
+ *   3 bytes  length of the payload after uncompressing it, 0 if it isn't compressed
+ *
+ * the payload is a part of the stream of normal mysql packets. A compressed
+ * packet may contain several mysql packets and a mysql packet may span several
+ * compressed packets.
+ */
+#define NETWORK_MYSQLD_COMPRESS_HEADER_SIZE 7
+
+/**
+ * payloads shorter than this are sent uncompressed as in MIN_COMPRESS_LENGTH of libmysql
+ */
+#define NETWORK_MYSQLD_COMPRESS_MIN_LEN 50
+
+/**
+ * max. size of the payload of one compressed packet
+ */
+#define NETWORK_MYSQLD_COMPRESS_MAX_LEN 0xffffff
+
+NETWORK_API gboolean network_mysqld_compress_is_available(void);
+NETWORK_API int network_mysqld_compress_append(GString *dst, const char *src, gsize src_len, guint8 packet_id);
+NETWORK_API int network_mysqld_compress_queue(network_queue *dst, network_queue *src, guint8 *packet_id);
+NETWORK_API int network_mysqld_decompress_queue(network_queue *dst, network_queue *src, guint8 *packet_id);
+
+#endif
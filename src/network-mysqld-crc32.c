@@ -0,0 +1,324 @@
+/* $%BEGINLICENSE%$
+ Copyright (c) 2008, 2012, Oracle and/or its affiliates. All rights reserved.
+
+ This program is free software; you can redistribute it and/or
+ modify it under the terms of the GNU General Public License as
+ published by the Free Software Foundation; version 2 of the
+ License.
+
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ GNU General Public License for more details.
+
+ You should have received a copy of the GNU General Public License
+ along with this program; if not, write to the Free Software
+ Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA
+ 02110-1301  USA
+
+ $%ENDLICENSE%$ */
+/**
+ * the CRC32 of the binlog-checksums
+ *
+ * picks the fastest implementation the CPU has on the first call:
+ *
+ * - ARMv8: the crc32-instructions if we are built for a CPU that has them
+ * - x86: folding 64 bytes at a time with PCLMULQDQ as in Intel's "Fast CRC
+ *   Computation for Generic Polynomials Using PCLMULQDQ Instruction"
+ * - everything else: slicing-by-8 with 8 tables of 256 entries
+ *
+ * the crc32-instruction of SSE4.2 can't be used, it only does the CRC32C polynomial.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include "network-mysqld-crc32.h"
+
+#if defined(__GNUC__) && defined(__ARM_FEATURE_CRC32)
+#define HAVE_CRC32_ARMV8
+#include <arm_acle.h>
+#elif defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__)) && \
+	(defined(__clang__) || __GNUC__ > 4 || (__GNUC__ == 4 && __GNUC_MINOR__ >= 9))
+/* gcc 4.9 is the first that allows the intrinsics in functions with a target-attribute */
+#define HAVE_CRC32_PCLMUL
+#include <cpuid.h>
+#include <emmintrin.h>
+#include <wmmintrin.h>
+#endif
+
+#define CRC32_POLY 0xedb88320
+
+static guint32 crc32_tables[8][256];
+static network_mysqld_crc32_impl crc32_impl = NETWORK_MYSQLD_CRC32_IMPL_TABLE;
+
+static gpointer network_mysqld_crc32_init(gpointer G_GNUC_UNUSED _udata) {
+	guint32 i;
+	int k;
+
+	for (i = 0; i < 256; i++) {
+		guint32 crc = i;
+
+		for (k = 0; k < 8; k++) {
+			crc = (crc >> 1) ^ (CRC32_POLY & (0 - (crc & 1)));
+		}
+		crc32_tables[0][i] = crc;
+	}
+
+	for (i = 0; i < 256; i++) {
+		for (k = 1; k < 8; k++) {
+			guint32 crc = crc32_tables[k - 1][i];
+
+			crc32_tables[k][i] = (crc >> 8) ^ crc32_tables[0][crc & 0xff];
+		}
+	}
+
+#if defined(HAVE_CRC32_ARMV8)
+	crc32_impl = NETWORK_MYSQLD_CRC32_IMPL_ARMV8;
+#elif defined(HAVE_CRC32_PCLMUL)
+	{
+		unsigned int eax, ebx, ecx, edx;
+
+		if (__get_cpuid(1, &eax, &ebx, &ecx, &edx) &&
+		    (ecx & bit_PCLMUL) &&
+		    (edx & bit_SSE2)) {
+			crc32_impl = NETWORK_MYSQLD_CRC32_IMPL_PCLMUL;
+		}
+	}
+#endif
+
+	return NULL;
+}
+
+static void network_mysqld_crc32_init_once(void) {
+	static GOnce once = G_ONCE_INIT;
+
+	g_once(&once, network_mysqld_crc32_init, NULL);
+}
+
+/**
+ * update the (inverted) crc with slicing-by-8
+ */
+static guint32 crc32_update_table(guint32 crc, const guchar *p, gsize len) {
+	while (len >= 8) {
+		guint32 lo = crc ^ (p[0] | (p[1] << 8) | (p[2] << 16) | ((guint32)p[3] << 24));
+		guint32 hi = p[4] | (p[5] << 8) | (p[6] << 16) | ((guint32)p[7] << 24);
+
+		crc = crc32_tables[7][lo & 0xff] ^
+			crc32_tables[6][(lo >> 8) & 0xff] ^
+			crc32_tables[5][(lo >> 16) & 0xff] ^
+			crc32_tables[4][lo >> 24] ^
+			crc32_tables[3][hi & 0xff] ^
+			crc32_tables[2][(hi >> 8) & 0xff] ^
+			crc32_tables[1][(hi >> 16) & 0xff] ^
+			crc32_tables[0][hi >> 24];
+
+		p += 8;
+		len -= 8;
+	}
+
+	while (len--) {
+		crc = crc32_tables[0][(crc ^ *p++) & 0xff] ^ (crc >> 8);
+	}
+
+	return crc;
+}
+
+#if defined(HAVE_CRC32_ARMV8)
+/**
+ * update the (inverted) crc with the crc32-instructions
+ */
+static guint32 crc32_update_armv8(guint32 crc, const guchar *p, gsize len) {
+	while (len > 0 && ((gsize)p & 7)) {
+		crc = __crc32b(crc, *p++);
+		len--;
+	}
+
+	while (len >= 8) {
+		crc = __crc32d(crc, *(const guint64 *)p);
+		p += 8;
+		len -= 8;
+	}
+
+	while (len--) {
+		crc = __crc32b(crc, *p++);
+	}
+
+	return crc;
+}
+#endif
+
+#if defined(HAVE_CRC32_PCLMUL)
+/* x^(4*128+32) mod P, x^(4*128-32) mod P, ... bit-reflected as in the paper */
+static const guint64 crc32_k1k2[2] = { G_GUINT64_CONSTANT(0x0154442bd4), G_GUINT64_CONSTANT(0x01c6e41596) };
+static const guint64 crc32_k3k4[2] = { G_GUINT64_CONSTANT(0x01751997d0), G_GUINT64_CONSTANT(0x00ccaa009e) };
+static const guint64 crc32_k5k0[2] = { G_GUINT64_CONSTANT(0x0163cd6124), G_GUINT64_CONSTANT(0x0000000000) };
+static const guint64 crc32_poly[2] = { G_GUINT64_CONSTANT(0x01db710641), G_GUINT64_CONSTANT(0x01f7011641) };
+
+/**
+ * update the (inverted) crc by folding
+ *
+ * @param len at least 64 and a multiple of 16
+ */
+__attribute__((target("pclmul,sse2")))
+static guint32 crc32_update_pclmul(guint32 crc, const guchar *p, gsize len) {
+	__m128i x0, x1, x2, x3, x4, x5, x6, x7, x8, y5, y6, y7, y8;
+
+	x1 = _mm_loadu_si128((const __m128i *)(p + 0x00));
+	x2 = _mm_loadu_si128((const __m128i *)(p + 0x10));
+	x3 = _mm_loadu_si128((const __m128i *)(p + 0x20));
+	x4 = _mm_loadu_si128((const __m128i *)(p + 0x30));
+
+	x1 = _mm_xor_si128(x1, _mm_cvtsi32_si128(crc));
+
+	x0 = _mm_loadu_si128((const __m128i *)crc32_k1k2);
+
+	p += 64;
+	len -= 64;
+
+	/* fold 4 x 128 bits in parallel */
+	while (len >= 64) {
+		x5 = _mm_clmulepi64_si128(x1, x0, 0x00);
+		x6 = _mm_clmulepi64_si128(x2, x0, 0x00);
+		x7 = _mm_clmulepi64_si128(x3, x0, 0x00);
+		x8 = _mm_clmulepi64_si128(x4, x0, 0x00);
+
+		x1 = _mm_clmulepi64_si128(x1, x0, 0x11);
+		x2 = _mm_clmulepi64_si128(x2, x0, 0x11);
+		x3 = _mm_clmulepi64_si128(x3, x0, 0x11);
+		x4 = _mm_clmulepi64_si128(x4, x0, 0x11);
+
+		y5 = _mm_loadu_si128((const __m128i *)(p + 0x00));
+		y6 = _mm_loadu_si128((const __m128i *)(p + 0x10));
+		y7 = _mm_loadu_si128((const __m128i *)(p + 0x20));
+		y8 = _mm_loadu_si128((const __m128i *)(p + 0x30));
+
+		x1 = _mm_xor_si128(_mm_xor_si128(x1, x5), y5);
+		x2 = _mm_xor_si128(_mm_xor_si128(x2, x6), y6);
+		x3 = _mm_xor_si128(_mm_xor_si128(x3, x7), y7);
+		x4 = _mm_xor_si128(_mm_xor_si128(x4, x8), y8);
+
+		p += 64;
+		len -= 64;
+	}
+
+	/* fold them into one 128 bit value */
+	x0 = _mm_loadu_si128((const __m128i *)crc32_k3k4);
+
+	x5 = _mm_clmulepi64_si128(x1, x0, 0x00);
+	x1 = _mm_clmulepi64_si128(x1, x0, 0x11);
+	x1 = _mm_xor_si128(_mm_xor_si128(x1, x2), x5);
+
+	x5 = _mm_clmulepi64_si128(x1, x0, 0x00);
+	x1 = _mm_clmulepi64_si128(x1, x0, 0x11);
+	x1 = _mm_xor_si128(_mm_xor_si128(x1, x3), x5);
+
+	x5 = _mm_clmulepi64_si128(x1, x0, 0x00);
+	x1 = _mm_clmulepi64_si128(x1, x0, 0x11);
+	x1 = _mm_xor_si128(_mm_xor_si128(x1, x4), x5);
+
+	/* the remaining 16 byte blocks */
+	while (len >= 16) {
+		x2 = _mm_loadu_si128((const __m128i *)p);
+
+		x5 = _mm_clmulepi64_si128(x1, x0, 0x00);
+		x1 = _mm_clmulepi64_si128(x1, x0, 0x11);
+		x1 = _mm_xor_si128(_mm_xor_si128(x1, x2), x5);
+
+		p += 16;
+		len -= 16;
+	}
+
+	/* 128 bits to 64 bits */
+	x2 = _mm_clmulepi64_si128(x1, x0, 0x10);
+	x3 = _mm_setr_epi32(~0, 0, ~0, 0);
+	x1 = _mm_srli_si128(x1, 8);
+	x1 = _mm_xor_si128(x1, x2);
+
+	x0 = _mm_loadl_epi64((const __m128i *)crc32_k5k0);
+
+	x2 = _mm_srli_si128(x1, 4);
+	x1 = _mm_and_si128(x1, x3);
+	x1 = _mm_clmulepi64_si128(x1, x0, 0x00);
+	x1 = _mm_xor_si128(x1, x2);
+
+	/* barrett-reduce to 32 bits */
+	x0 = _mm_loadu_si128((const __m128i *)crc32_poly);
+
+	x2 = _mm_and_si128(x1, x3);
+	x2 = _mm_clmulepi64_si128(x2, x0, 0x10);
+	x2 = _mm_and_si128(x2, x3);
+	x2 = _mm_clmulepi64_si128(x2, x0, 0x00);
+	x1 = _mm_xor_si128(x1, x2);
+
+	return _mm_cvtsi128_si32(_mm_srli_si128(x1, 4));
+}
+#endif
+
+/**
+ * update the crc with the slicing-by-8 tables
+ *
+ * the fallback of network_mysqld_crc32(), exported for the tests and benchmarks
+ */
+guint32 network_mysqld_crc32_table(guint32 crc, const char *data, gsize len) {
+	network_mysqld_crc32_init_once();
+
+	return ~crc32_update_table(~crc, (const guchar *)data, len);
+}
+
+/**
+ * update a CRC32
+ *
+ *   crc = network_mysqld_crc32(0, event, event_len);
+ *
+ * @param crc  the CRC32 of the data before, 0 to start
+ * @return the CRC32 of the data before and data
+ */
+guint32 network_mysqld_crc32(guint32 crc, const char *data, gsize len) {
+	const guchar *p = (const guchar *)data;
+
+	network_mysqld_crc32_init_once();
+
+	crc = ~crc;
+
+	switch (crc32_impl) {
+#if defined(HAVE_CRC32_ARMV8)
+	case NETWORK_MYSQLD_CRC32_IMPL_ARMV8:
+		crc = crc32_update_armv8(crc, p, len);
+		len = 0;
+		break;
+#endif
+#if defined(HAVE_CRC32_PCLMUL)
+	case NETWORK_MYSQLD_CRC32_IMPL_PCLMUL:
+		if (len >= 64) {
+			gsize folded_len = len & ~(gsize)15;
+
+			crc = crc32_update_pclmul(crc, p, folded_len);
+			p += folded_len;
+			len -= folded_len;
+		}
+		break;
+#endif
+	default:
+		break;
+	}
+
+	return ~crc32_update_table(crc, p, len);
+}
+
+network_mysqld_crc32_impl network_mysqld_crc32_get_impl(void) {
+	network_mysqld_crc32_init_once();
+
+	return crc32_impl;
+}
+
+const char *network_mysqld_crc32_get_impl_name(void) {
+	switch (network_mysqld_crc32_get_impl()) {
+	case NETWORK_MYSQLD_CRC32_IMPL_PCLMUL: return "pclmul";
+	case NETWORK_MYSQLD_CRC32_IMPL_ARMV8: return "armv8";
+	case NETWORK_MYSQLD_CRC32_IMPL_TABLE: return "slicing-by-8";
+	}
+
+	return "unknown";
+}
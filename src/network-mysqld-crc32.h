@@ -0,0 +1,48 @@
+/* $%BEGINLICENSE%$
+ Copyright (c) 2008, 2012, Oracle and/or its affiliates. All rights reserved.
+
+ This program is free software; you can redistribute it and/or
+ modify it under the terms of the GNU General Public License as
+ published by the Free Software Foundation; version 2 of the
+ License.
+
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ GNU General Public License for more details.
+
+ You should have received a copy of the GNU General Public License
+ along with this program; if not, write to the Free Software
+ Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA
+ 02110-1301  USA
+
+ $%ENDLICENSE%$ */
+#ifndef __NETWORK_MYSQLD_CRC32_H__
+#define __NETWORK_MYSQLD_CRC32_H__
+
+#include <glib.h>
+
+#include "network-exports.h"
+
+/**
+ * the CRC32 of the binlog-checksums
+ *
+ * it is the CRC32 of zlib (polynomial 0xedb88320), not the CRC32C the crc32-instruction
+ * of SSE4.2 implements
+ */
+
+/**
+ * the implementations of network_mysqld_crc32()
+ */
+typedef enum {
+	NETWORK_MYSQLD_CRC32_IMPL_TABLE,   /**< slicing-by-8 */
+	NETWORK_MYSQLD_CRC32_IMPL_PCLMUL,  /**< folding with the carry-less multiply of x86 */
+	NETWORK_MYSQLD_CRC32_IMPL_ARMV8    /**< the crc32-instructions of ARMv8 */
+} network_mysqld_crc32_impl;
+
+NETWORK_API guint32 network_mysqld_crc32(guint32 crc, const char *data, gsize len);
+NETWORK_API guint32 network_mysqld_crc32_table(guint32 crc, const char *data, gsize len);
+NETWORK_API network_mysqld_crc32_impl network_mysqld_crc32_get_impl(void);
+NETWORK_API const char *network_mysqld_crc32_get_impl_name(void);
+
+#endif
@@ -0,0 +1,183 @@
+/* $%BEGINLICENSE%$
+ Copyright (c) 2008, 2012, Oracle and/or its affiliates. All rights reserved.
+
+ This program is free software; you can redistribute it and/or
+ modify it under the terms of the GNU General Public License as
+ published by the Free Software Foundation; version 2 of the
+ License.
+
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ GNU General Public License for more details.
+
+ You should have received a copy of the GNU General Public License
+ along with this program; if not, write to the Free Software
+ Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA
+ 02110-1301  USA
+
+ $%ENDLICENSE%$ */
+
+/** @file
+ * the filter-chains of the connection states
+ *
+ * several C modules can hook into the same state of a connection, e.g. a firewall, a
+ * router and a audit-log on CON_STATE_READ_QUERY. Each registers a filter with a priority,
+ * plugin_call() calls them in order before the hook of the plugin until one of them
+ * doesn't return NETWORK_MYSQLD_FILTER_NEXT.
+ */
+
+#include <string.h>
+
+#include "network-mysqld-filter.h"
+
+GQuark network_mysqld_filters_error(void) {
+	return g_quark_from_static_string("network-mysqld-filters-error-quark");
+}
+
+static void network_mysqld_filter_free(network_mysqld_filter_t *filter) {
+	if (filter->user_data_free) filter->user_data_free(filter->user_data);
+
+	g_free(filter->name);
+	g_slice_free(network_mysqld_filter_t, filter);
+}
+
+network_mysqld_filters_t *network_mysqld_filters_new(void) {
+	return g_slice_new0(network_mysqld_filters_t);
+}
+
+void network_mysqld_filters_free(network_mysqld_filters_t *filters) {
+	guint state, i;
+
+	if (!filters) return;
+
+	for (state = 0; state < NETWORK_MYSQLD_FILTER_MAX_STATES; state++) {
+		GPtrArray *chain = filters->chains[state];
+
+		if (!chain) continue;
+
+		for (i = 0; i < chain->len; i++) {
+			network_mysqld_filter_free(chain->pdata[i]);
+		}
+		g_ptr_array_free(chain, TRUE);
+	}
+
+	g_slice_free(network_mysqld_filters_t, filters);
+}
+
+/**
+ * add a filter to the chain of a state
+ *
+ * a filter goes behind the filters of the same priority that are already there
+ *
+ * @param state          a network_mysqld_con_state_t
+ * @param name           unique for the state
+ * @param user_data_free frees the user_data when the filter is removed, may be NULL
+ * @return 0 on success, -1 on error
+ */
+int network_mysqld_filters_add(network_mysqld_filters_t *filters, int state, const gchar *name, gint priority,
+		network_mysqld_filter_func func, gpointer user_data, GDestroyNotify user_data_free, GError **gerr) {
+	network_mysqld_filter_t *filter;
+	GPtrArray *chain;
+	guint i;
+
+	g_return_val_if_fail(filters, -1);
+	g_return_val_if_fail(name, -1);
+	g_return_val_if_fail(func, -1);
+
+	if (state < 0 || state >= NETWORK_MYSQLD_FILTER_MAX_STATES) {
+		g_set_error(gerr, NETWORK_MYSQLD_FILTERS_ERROR, NETWORK_MYSQLD_FILTERS_ERROR_STATE,
+				"filter '%s': there is no state %d",
+				name, state);
+		return -1;
+	}
+
+	if (NULL == (chain = filters->chains[state])) {
+		chain = filters->chains[state] = g_ptr_array_new();
+	}
+
+	for (i = 0; i < chain->len; i++) {
+		network_mysqld_filter_t *other = chain->pdata[i];
+
+		if (0 == strcmp(other->name, name)) {
+			g_set_error(gerr, NETWORK_MYSQLD_FILTERS_ERROR, NETWORK_MYSQLD_FILTERS_ERROR_DUPLICATE,
+					"filter '%s' is registered for state %d already",
+					name, state);
+			return -1;
+		}
+	}
+
+	filter = g_slice_new0(network_mysqld_filter_t);
+	filter->name = g_strdup(name);
+	filter->priority = priority;
+	filter->func = func;
+	filter->user_data = user_data;
+	filter->user_data_free = user_data_free;
+
+	/* keep the chain sorted, stable for the same priority */
+	for (i = chain->len; i > 0; i--) {
+		network_mysqld_filter_t *other = chain->pdata[i - 1];
+
+		if (other->priority <= priority) break;
+	}
+
+	g_ptr_array_add(chain, NULL);
+	memmove(chain->pdata + i + 1, chain->pdata + i, (chain->len - 1 - i) * sizeof(gpointer));
+	chain->pdata[i] = filter;
+
+	return 0;
+}
+
+/**
+ * remove a filter from the chain of a state and free it
+ *
+ * @return TRUE if the state had the filter
+ */
+gboolean network_mysqld_filters_remove(network_mysqld_filters_t *filters, int state, const gchar *name) {
+	GPtrArray *chain;
+	guint i;
+
+	if (state < 0 || state >= NETWORK_MYSQLD_FILTER_MAX_STATES) return FALSE;
+	if (NULL == (chain = filters->chains[state])) return FALSE;
+
+	for (i = 0; i < chain->len; i++) {
+		network_mysqld_filter_t *filter = chain->pdata[i];
+
+		if (0 != strcmp(filter->name, name)) continue;
+
+		g_ptr_array_remove_index(chain, i); /* keeps the order */
+		network_mysqld_filter_free(filter);
+
+		if (chain->len == 0) {
+			g_ptr_array_free(chain, TRUE);
+			filters->chains[state] = NULL;
+		}
+
+		return TRUE;
+	}
+
+	return FALSE;
+}
+
+/**
+ * call the filters of a state in order
+ *
+ * @return NETWORK_MYSQLD_FILTER_NEXT if all of them passed, the result of the one that didn't otherwise
+ */
+network_mysqld_filter_ret_t network_mysqld_filters_call(network_mysqld_filters_t *filters, struct chassis *chas,
+		struct network_mysqld_con *con, int state) {
+	GPtrArray *chain;
+	guint i;
+
+	if (state < 0 || state >= NETWORK_MYSQLD_FILTER_MAX_STATES) return NETWORK_MYSQLD_FILTER_NEXT;
+	if (NULL == (chain = filters->chains[state])) return NETWORK_MYSQLD_FILTER_NEXT;
+
+	for (i = 0; i < chain->len; i++) {
+		network_mysqld_filter_t *filter = chain->pdata[i];
+		network_mysqld_filter_ret_t ret;
+
+		if (NETWORK_MYSQLD_FILTER_NEXT != (ret = filter->func(chas, con, filter->user_data))) return ret;
+	}
+
+	return NETWORK_MYSQLD_FILTER_NEXT;
+}
@@ -0,0 +1,80 @@
+/* $%BEGINLICENSE%$
+ Copyright (c) 2008, 2012, Oracle and/or its affiliates. All rights reserved.
+
+ This program is free software; you can redistribute it and/or
+ modify it under the terms of the GNU General Public License as
+ published by the Free Software Foundation; version 2 of the
+ License.
+
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ GNU General Public License for more details.
+
+ You should have received a copy of the GNU General Public License
+ along with this program; if not, write to the Free Software
+ Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA
+ 02110-1301  USA
+
+ $%ENDLICENSE%$ */
+#ifndef __NETWORK_MYSQLD_FILTER_H__
+#define __NETWORK_MYSQLD_FILTER_H__
+
+#include <glib.h>
+
+#include "network-exports.h"
+
+/**
+ * the states of a connection a filter can be registered for, the network_mysqld_con_state_t fit
+ */
+#define NETWORK_MYSQLD_FILTER_MAX_STATES 32
+
+struct chassis;
+struct network_mysqld_con;
+
+typedef enum {
+	NETWORK_MYSQLD_FILTER_NEXT,  /**< call the next filter, after the last one the hook of the plugin */
+	NETWORK_MYSQLD_FILTER_DONE,  /**< the filter handled the state and set con->state, skip the rest of the chain and the hook */
+	NETWORK_MYSQLD_FILTER_ERROR  /**< the state failed, the connection gets closed */
+} network_mysqld_filter_ret_t;
+
+typedef network_mysqld_filter_ret_t (*network_mysqld_filter_func)(struct chassis *chas, struct network_mysqld_con *con, gpointer user_data);
+
+typedef struct {
+	gchar *name;                 /**< unique per state, to remove it again */
+	gint priority;               /**< lower ones are called first */
+
+	network_mysqld_filter_func func;
+	gpointer user_data;
+	GDestroyNotify user_data_free;
+} network_mysqld_filter_t;
+
+/**
+ * the filters of the connection states, called by plugin_call() before the hook of the plugin
+ *
+ * C modules register their filters while they are set up, before the event-threads start.
+ * After that the chains are only read and the event-threads call them without a lock. A
+ * filter that returns NETWORK_MYSQLD_FILTER_NEXT leaves the state to the next one, a
+ * firewall that sent an error to the client returns NETWORK_MYSQLD_FILTER_DONE instead.
+ */
+typedef struct {
+	GPtrArray *chains[NETWORK_MYSQLD_FILTER_MAX_STATES]; /**< network_mysqld_filter_t by priority, NULL for a state without filters */
+} network_mysqld_filters_t;
+
+NETWORK_API network_mysqld_filters_t *network_mysqld_filters_new(void);
+NETWORK_API void network_mysqld_filters_free(network_mysqld_filters_t *filters);
+NETWORK_API int network_mysqld_filters_add(network_mysqld_filters_t *filters, int state, const gchar *name, gint priority,
+		network_mysqld_filter_func func, gpointer user_data, GDestroyNotify user_data_free, GError **gerr);
+NETWORK_API gboolean network_mysqld_filters_remove(network_mysqld_filters_t *filters, int state, const gchar *name);
+NETWORK_API network_mysqld_filter_ret_t network_mysqld_filters_call(network_mysqld_filters_t *filters, struct chassis *chas,
+		struct network_mysqld_con *con, int state);
+
+#define NETWORK_MYSQLD_FILTERS_ERROR network_mysqld_filters_error()
+NETWORK_API GQuark network_mysqld_filters_error(void);
+
+typedef enum {
+	NETWORK_MYSQLD_FILTERS_ERROR_STATE,     /**< there is no such state */
+	NETWORK_MYSQLD_FILTERS_ERROR_DUPLICATE  /**< the state has a filter of that name already */
+} network_mysqld_filters_error_t;
+
+#endif
@@ -38,12 +38,24 @@
 
 #include "network-mysqld.h"
 #include "network-mysqld-proto.h"
+#include "network-mysqld-resultset-writer.h"
 #include "network-mysqld-lua.h"
 #include "network-socket-lua.h"
 #include "network-backend-lua.h"
+#include "network-query-cache-lua.h"
+#include "network-mysqld-timing-lua.h"
+#include "network-query-digest-lua.h"
+#include "network-shared-dict-lua.h"
+#include "network-rate-limit-lua.h"
+#include "network-firewall-lua.h"
+#include "network-resultset-builder-lua.h"
+#include "network-timer-lua.h"
 #include "network-conn-pool.h"
 #include "network-conn-pool-lua.h"
 #include "network-injection-lua.h"
+#include "network-async-query-lua.h"
+#include "network-async-query.h"
+#include "lua-profiler.h"
 
 #define C(x) x, sizeof(x) - 1
 
@@ -53,22 +65,248 @@ network_mysqld_con_lua_t *network_mysqld_con_lua_new() {
 	st = g_new0(network_mysqld_con_lua_t, 1);
 
 	st->injected.queries = network_injection_queue_new();
+	st->injected.pipelined = network_injection_queue_new();
+	st->query_cache_written_tables = g_ptr_array_new();
+	st->stmt_pending = g_queue_new();
+	st->session_sync_pending = g_queue_new();
+	st->async_queries = g_ptr_array_new();
+	st->query_hints = network_mysqld_query_hints_new();
 	
 	return st;
 }
 
+/**
+ * stop capturing the current result for the query-cache
+ */
+void network_mysqld_con_lua_query_cache_reset(network_mysqld_con_lua_t *st) {
+	guint i;
+
+	if (st->query_cache_key) {
+		g_string_free(st->query_cache_key, TRUE);
+		st->query_cache_key = NULL;
+	}
+
+	if (st->query_cache_packets) {
+		for (i = 0; i < st->query_cache_packets->len; i++) {
+			g_string_free(st->query_cache_packets->pdata[i], TRUE);
+		}
+		g_ptr_array_free(st->query_cache_packets, TRUE);
+		st->query_cache_packets = NULL;
+	}
+	st->query_cache_bytes = 0;
+}
+
+/**
+ * drop the query sent to all shards
+ *
+ * the queries that still run are cancelled, their connections are closed
+ */
+void network_mysqld_con_lua_scatter_reset(network_mysqld_con_lua_t *st) {
+	guint i;
+
+	if (st->scatter_queries) {
+		for (i = 0; i < st->scatter_queries->len; i++) {
+			if (st->scatter_queries->pdata[i]) network_async_query_free(st->scatter_queries->pdata[i]);
+		}
+		g_ptr_array_free(st->scatter_queries, TRUE);
+		st->scatter_queries = NULL;
+	}
+	st->scatter_running = 0;
+
+	if (st->scatter_merge) {
+		network_scatter_merge_free(st->scatter_merge);
+		st->scatter_merge = NULL;
+	}
+}
+
+/**
+ * forget the tables written in the current transaction
+ */
+void network_mysqld_con_lua_query_cache_clear_written(network_mysqld_con_lua_t *st) {
+	guint i;
+
+	for (i = 0; i < st->query_cache_written_tables->len; i++) {
+		g_string_free(st->query_cache_written_tables->pdata[i], TRUE);
+	}
+	g_ptr_array_set_size(st->query_cache_written_tables, 0);
+	st->query_cache_written_unknown = FALSE;
+}
+
+/**
+ * stop capturing the response of the COM_STMT_PREPARE in flight
+ */
+void network_mysqld_con_lua_stmt_prepare_reset(network_mysqld_con_lua_t *st) {
+	guint i;
+
+	if (st->stmt_prepare_key) {
+		g_string_free(st->stmt_prepare_key, TRUE);
+		st->stmt_prepare_key = NULL;
+	}
+
+	if (st->stmt_prepare_packets) {
+		for (i = 0; i < st->stmt_prepare_packets->len; i++) {
+			g_string_free(st->stmt_prepare_packets->pdata[i], TRUE);
+		}
+		g_ptr_array_free(st->stmt_prepare_packets, TRUE);
+		st->stmt_prepare_packets = NULL;
+	}
+	st->stmt_prepare_id = 0;
+}
+
+/**
+ * forget the COM_QUERY we promoted
+ */
+void network_mysqld_con_lua_stmt_promote_reset(network_mysqld_con_lua_t *st) {
+	if (st->stmt_promote_query) {
+		g_string_free(st->stmt_promote_query, TRUE);
+		st->stmt_promote_query = NULL;
+	}
+	st->stmt_promote_hash = 0;
+}
+
+/**
+ * drop the rows that are waiting for read_query_result_rows()
+ */
+void network_mysqld_con_lua_rows_batch_reset(network_mysqld_con_lua_t *st) {
+	guint i;
+
+	if (st->rows_batch) {
+		for (i = 0; i < st->rows_batch->len; i++) {
+			g_string_free(st->rows_batch->pdata[i], TRUE);
+		}
+		g_ptr_array_set_size(st->rows_batch, 0);
+	}
+	st->rows_batch_columns = 0;
+	st->rows_batch_is_raw = FALSE;
+}
+
+/**
+ * point the FFI view at the packet read_query() gets
+ *
+ * the packet has to stay alive until network_mysqld_con_lua_ffi_view_reset()
+ */
+void network_mysqld_con_lua_ffi_view_set_packet(network_mysqld_con_lua_t *st, const char *packet, gsize packet_len) {
+	network_mysqld_con_lua_ffi_view_reset(st);
+
+	st->ffi_view.packet = packet;
+	st->ffi_view.packet_len = packet_len;
+}
+
+/**
+ * point the FFI view at the injection read_query_result() gets
+ */
+void network_mysqld_con_lua_ffi_view_set_injection(network_mysqld_con_lua_t *st, injection *inj) {
+	network_mysqld_lua_ffi_view_t *view = &(st->ffi_view);
+
+	network_mysqld_con_lua_ffi_view_reset(st);
+
+	view->query = inj->query->str;
+	view->query_len = inj->query->len;
+	view->injection_id = inj->id;
+	view->ts_read_query = inj->ts_read_query;
+	view->ts_read_query_result_first = inj->ts_read_query_result_first;
+	view->ts_read_query_result_last = inj->ts_read_query_result_last;
+	view->rows = inj->rows;
+	view->bytes = inj->bytes;
+}
+
+/**
+ * clear the FFI view once the hook returned, its pointers are dangling after that
+ */
+void network_mysqld_con_lua_ffi_view_reset(network_mysqld_con_lua_t *st) {
+	memset(&(st->ffi_view), 0, sizeof(st->ffi_view));
+}
+
 void network_mysqld_con_lua_free(network_mysqld_con_lua_t *st) {
+	GString *packet;
+
 	if (!st) return;
 
 	network_injection_queue_free(st->injected.queries);
+	network_injection_queue_free(st->injected.pipelined);
+
+	if (st->rw_split_server) network_socket_free(st->rw_split_server);
+	if (st->hedge_server) network_socket_free(st->hedge_server);
+	if (st->read_hedge_query) network_async_query_free(st->read_hedge_query);
+	if (st->read_hedge_packet) g_string_free(st->read_hedge_packet, TRUE);
+	if (st->admission_wakeup) g_free(st->admission_wakeup);
+
+	/* the mirror compares nothing without our result */
+	if (st->mirror_query) network_mirror_query_primary_failed(st->mirror_query);
+
+	network_mysqld_con_lua_query_cache_reset(st);
+	network_mysqld_con_lua_query_cache_clear_written(st);
+	g_ptr_array_free(st->query_cache_written_tables, TRUE);
+	network_mysqld_query_hints_free(st->query_hints);
+
+	network_mysqld_con_lua_stmt_prepare_reset(st);
+	network_mysqld_con_lua_stmt_promote_reset(st);
+	network_mysqld_con_lua_rows_batch_reset(st);
+	if (st->rows_batch) g_ptr_array_free(st->rows_batch, TRUE);
+	if (st->stmt_texts) g_hash_table_destroy(st->stmt_texts);
+	while ((packet = g_queue_pop_head(st->stmt_pending))) g_string_free(packet, TRUE);
+	g_queue_free(st->stmt_pending);
+
+	if (st->session_vars) g_hash_table_destroy(st->session_vars);
+	if (st->session_vars_pending) g_hash_table_destroy(st->session_vars_pending);
+	while ((packet = g_queue_pop_head(st->session_sync_pending))) g_string_free(packet, TRUE);
+	g_queue_free(st->session_sync_pending);
+
+	if (st->digest_text) g_string_free(st->digest_text, TRUE);
+	if (st->shard_key) g_string_free(st->shard_key, TRUE);
+	network_mysqld_con_lua_scatter_reset(st);
+	if (st->query_log_text) g_string_free(st->query_log_text, TRUE);
+	if (st->lazy_hashed_password) g_string_free(st->lazy_hashed_password, TRUE);
+	if (st->local_names) g_string_free(st->local_names, TRUE);
+	if (st->local_names_pending) g_string_free(st->local_names_pending, TRUE);
+	if (st->query_cache_names) g_string_free(st->query_cache_names, TRUE);
+
+	network_async_query_lua_cancel(st);
+	g_ptr_array_free(st->async_queries, TRUE);
 
 	g_free(st);
 }
 
 
+/**
+ * push the userdata of proxy.connection.client or .server
+ *
+ * the userdata is cached in the env of proxy.connection to not create
+ * a new one on each access. It is only replaced if the connection got
+ * another socket, e.g. from the connection pool.
+ */
+static int proxy_connection_push_socket(lua_State *L, network_socket *sock, const char *name) {
+	network_socket **socket_p;
+
+	lua_getfenv(L, 1);                     /* the cache of proxy.connection  (sp += 1) */
+	lua_getfield(L, -1, name);                                        /* (sp += 1) */
+	if (lua_isuserdata(L, -1) &&
+	    *(network_socket **)lua_touserdata(L, -1) == sock) {
+		lua_remove(L, -2);                                        /* (sp -= 1) */
+
+		return 1;
+	}
+	lua_pop(L, 1);                                                    /* (sp -= 1) */
+
+	socket_p = lua_newuserdata(L, sizeof(network_socket *));          /* (sp += 1) */
+	*socket_p = sock;
+
+	network_socket_lua_getmetatable(L);
+	lua_setmetatable(L, -2); /* tie the metatable to the udata        (sp -= 1) */
+
+	lua_pushvalue(L, -1);                                             /* (sp += 1) */
+	lua_setfield(L, -3, name); /* cache[name] = <udata>               (sp -= 1) */
+	lua_remove(L, -2);                                                /* (sp -= 1) */
+
+	return 1;
+}
+
 /**
  * get the connection information
  *
+ * the keys are dispatched on their length first to keep the string compares
+ * down to one or two per access
+ *
  * note: might be called in connect_server() before con->server is set 
  */
 static int proxy_connection_get(lua_State *L) {
@@ -82,33 +320,69 @@ static int proxy_connection_get(lua_State *L) {
 	/**
 	 * we to split it in .client and .server here
 	 */
-
-	if (strleq(key, keysize, C("default_db"))) {
-		return luaL_error(L, "proxy.connection.default_db is deprecated, use proxy.connection.client.default_db or proxy.connection.server.default_db instead");
-	} else if (strleq(key, keysize, C("thread_id"))) {
-		return luaL_error(L, "proxy.connection.thread_id is deprecated, use proxy.connection.server.thread_id instead");
-	} else if (strleq(key, keysize, C("mysqld_version"))) {
-		return luaL_error(L, "proxy.connection.mysqld_version is deprecated, use proxy.connection.server.mysqld_version instead");
-	} else if (strleq(key, keysize, C("backend_ndx"))) {
-		lua_pushinteger(L, st->backend_ndx + 1);
-	} else if ((con->server && (strleq(key, keysize, C("server")))) ||
-	           (con->client && (strleq(key, keysize, C("client"))))) {
-		network_socket **socket_p;
-
-		socket_p = lua_newuserdata(L, sizeof(network_socket)); /* the table underneat proxy.socket */
-
-		if (key[0] == 's') {
-			*socket_p = con->server;
-		} else {
-			*socket_p = con->client;
+	switch (keysize) {
+	case 6:
+		if (con->server && strleq(key, keysize, C("server"))) {
+			return proxy_connection_push_socket(L, con->server, "server");
+		} else if (con->client && strleq(key, keysize, C("client"))) {
+			return proxy_connection_push_socket(L, con->client, "client");
 		}
-
-		network_socket_lua_getmetatable(L);
-		lua_setmetatable(L, -2); /* tie the metatable to the table   (sp -= 1) */
-	} else {
-		lua_pushnil(L);
+		break;
+	case 7:
+		if (strleq(key, keysize, C("lua_mem"))) {
+			lua_newtable(L);
+			lua_pushnumber(L, con->lua_mem.allocs);
+			lua_setfield(L, -2, "allocs");
+			lua_pushnumber(L, con->lua_mem.alloc_bytes);
+			lua_setfield(L, -2, "alloc_bytes");
+			lua_pushnumber(L, MAX(con->lua_mem.call_bytes_max, con->lua_mem.call_bytes));
+			lua_setfield(L, -2, "hook_bytes_max");
+			return 1;
+		}
+		break;
+	case 8:
+		if (strleq(key, keysize, C("ffi_view"))) {
+			lua_pushlightuserdata(L, &(st->ffi_view));
+			return 1;
+		}
+		break;
+	case 9:
+		if (strleq(key, keysize, C("thread_id"))) {
+			return luaL_error(L, "proxy.connection.thread_id is deprecated, use proxy.connection.server.thread_id instead");
+		}
+		break;
+	case 10:
+		if (strleq(key, keysize, C("default_db"))) {
+			return luaL_error(L, "proxy.connection.default_db is deprecated, use proxy.connection.client.default_db or proxy.connection.server.default_db instead");
+		}
+		break;
+	case 11:
+		if (strleq(key, keysize, C("backend_ndx"))) {
+			lua_pushinteger(L, st->backend_ndx + 1);
+			return 1;
+		}
+		break;
+	case 14:
+		if (strleq(key, keysize, C("mysqld_version"))) {
+			return luaL_error(L, "proxy.connection.mysqld_version is deprecated, use proxy.connection.server.mysqld_version instead");
+		}
+		break;
+	case 24:
+		if (strleq(key, keysize, C("send_queue_low_watermark"))) {
+			lua_pushnumber(L, con->send_queue_low_watermark);
+			return 1;
+		}
+		break;
+	case 25:
+		if (strleq(key, keysize, C("send_queue_high_watermark"))) {
+			lua_pushnumber(L, con->send_queue_high_watermark);
+			return 1;
+		}
+		break;
 	}
 
+	lua_pushnil(L);
+
 	return 1;
 }
 
@@ -144,6 +418,22 @@ static int proxy_connection_set(lua_State *L) {
 		luaL_checktype(L, 3, LUA_TBOOLEAN);
 
 		st->connection_close = lua_toboolean(L, 3);
+	} else if (strleq(key, keysize, C("send_queue_high_watermark"))) {
+		lua_Integer bytes = luaL_checkinteger(L, 3);
+
+		if (bytes < (lua_Integer)con->send_queue_low_watermark) {
+			return luaL_error(L, "proxy.connection.send_queue_high_watermark has to be >= the low watermark");
+		}
+
+		con->send_queue_high_watermark = bytes;
+	} else if (strleq(key, keysize, C("send_queue_low_watermark"))) {
+		lua_Integer bytes = luaL_checkinteger(L, 3);
+
+		if (bytes < 0 || bytes > (lua_Integer)con->send_queue_high_watermark) {
+			return luaL_error(L, "proxy.connection.send_queue_low_watermark has to be >= 0 and <= the high watermark");
+		}
+
+		con->send_queue_low_watermark = bytes;
 	} else {
 		return luaL_error(L, "proxy.connection.%s is not writable", key);
 	}
@@ -160,6 +450,134 @@ int network_mysqld_con_getmetatable(lua_State *L) {
 	return proxy_getmetatable(L, methods);
 }
 
+/**
+ * get the client connections and their memory
+ *
+ * proxy.global.connections.
+ *   entries      => array of { client, state, is_parked, bytes, thread_id,
+ *                              command, query, query_usec,
+ *                              in_trans, trx_usec, trx_statements, trx_query }
+ *   count        => client connections
+ *   parked       => client connections that idle with their queues released
+ *   bytes        => the sum of the bytes of the client connections
+ *   transactions => client connections with a open transaction
+ *
+ * the bytes are the snapshot of network_mysqld_con_get_memory() taken when the connection
+ * started to wait for the next query, 0 if it didn't get there yet
+ *
+ * thread_id is the one of the backend connection of the last statement. command and
+ * query are only set while a statement runs, the trx_ fields only while a transaction
+ * is open. See network-mysqld-activity.h
+ */
+static int proxy_connections_get(lua_State *L) {
+	chassis_private *g = *(chassis_private **)luaL_checkself(L);
+	gsize keysize = 0;
+	const char *key = luaL_checklstring(L, 2, &keysize);
+	gboolean want_entries = FALSE;
+	network_mysqld_activity_snapshot_t activity;
+	guint64 bytes = 0;
+	guint64 now = chassis_get_rel_microseconds();
+	guint count = 0, parked = 0, transactions = 0;
+	GString *client_name = NULL;
+	guint i;
+
+	if (strleq(key, keysize, C("entries"))) {
+		want_entries = TRUE;
+		lua_newtable(L);
+	} else if (!strleq(key, keysize, C("count")) &&
+	           !strleq(key, keysize, C("parked")) &&
+	           !strleq(key, keysize, C("bytes")) &&
+	           !strleq(key, keysize, C("transactions"))) {
+		lua_pushnil(L);
+		return 1;
+	}
+
+	g_mutex_lock(g->cons_mutex);
+	for (i = 0; i < g->cons->len; i++) {
+		network_mysqld_con *con = g->cons->pdata[i];
+
+		if (!con->is_accepted) continue;
+
+		count++;
+		if (con->is_parked) parked++;
+		bytes += con->memory_bytes;
+
+		network_mysqld_activity_get(&(con->activity), &activity);
+		if (activity.in_trans) transactions++;
+
+		if (!want_entries) continue;
+
+		lua_newtable(L);
+		if (con->client) {
+			/* the name belongs to the event-thread of the connection, format our own */
+			if (!client_name) client_name = g_string_sized_new(64);
+			g_string_truncate(client_name, 0);
+
+			if (0 == network_address_format_name(con->client->src, client_name, NULL)) {
+				lua_pushlstring(L, client_name->str, client_name->len);
+				lua_setfield(L, -2, "client");
+			}
+		}
+		lua_pushstring(L, network_mysqld_con_state_get_name(con->state));
+		lua_setfield(L, -2, "state");
+		lua_pushboolean(L, con->is_parked);
+		lua_setfield(L, -2, "is_parked");
+		lua_pushnumber(L, con->memory_bytes);
+		lua_setfield(L, -2, "bytes");
+		/* con->server belongs to the event-thread of the connection, use the snapshot */
+		if (activity.thread_id != 0) {
+			lua_pushinteger(L, activity.thread_id);
+			lua_setfield(L, -2, "thread_id");
+		}
+
+		if (activity.command != -1) {
+			lua_pushstring(L, network_mysqld_metrics_command_get_name(activity.command));
+			lua_setfield(L, -2, "command");
+			lua_pushlstring(L, activity.query, MIN(activity.query_len, sizeof(activity.query)));
+			lua_setfield(L, -2, "query");
+			lua_pushnumber(L, now > activity.ts_query ? now - activity.ts_query : 0);
+			lua_setfield(L, -2, "query_usec");
+		}
+		lua_pushboolean(L, activity.in_trans);
+		lua_setfield(L, -2, "in_trans");
+		if (activity.in_trans) {
+			lua_pushnumber(L, now > activity.ts_trx ? now - activity.ts_trx : 0);
+			lua_setfield(L, -2, "trx_usec");
+			lua_pushinteger(L, activity.trx_statements);
+			lua_setfield(L, -2, "trx_statements");
+			lua_pushlstring(L, activity.trx_query, MIN(activity.trx_query_len, sizeof(activity.trx_query)));
+			lua_setfield(L, -2, "trx_query");
+		}
+		lua_rawseti(L, -2, count);
+	}
+	g_mutex_unlock(g->cons_mutex);
+
+	if (client_name) g_string_free(client_name, TRUE);
+
+	if (want_entries) return 1;
+
+	if (strleq(key, keysize, C("count"))) {
+		lua_pushinteger(L, count);
+	} else if (strleq(key, keysize, C("parked"))) {
+		lua_pushinteger(L, parked);
+	} else if (strleq(key, keysize, C("transactions"))) {
+		lua_pushinteger(L, transactions);
+	} else {
+		lua_pushnumber(L, bytes);
+	}
+
+	return 1;
+}
+
+static int network_mysqld_connections_lua_getmetatable(lua_State *L) {
+	static const struct luaL_reg methods[] = {
+		{ "__index", proxy_connections_get },
+		{ NULL, NULL },
+	};
+
+	return proxy_getmetatable(L, methods);
+}
+
 /**
  * Set up the global structures for a script.
  * 
@@ -167,6 +585,13 @@ int network_mysqld_con_getmetatable(lua_State *L) {
  */
 void network_mysqld_lua_setup_global(lua_State *L , chassis_private *g) {
 	network_backends_t **backends_p;
+	network_query_cache_t **query_cache_p;
+	network_mysqld_timings_t **timings_p;
+	network_query_digest_t **query_digest_p;
+	network_shared_dict_t **shared_dict_p;
+	network_rate_limiter_t **rate_limiter_p;
+	network_firewall_t **firewall_p;
+	chassis_private **connections_p;
 
 	int stack_top = lua_gettop(L);
 
@@ -203,8 +628,118 @@ void network_mysqld_lua_setup_global(lua_State *L , chassis_private *g) {
 	network_backends_lua_getmetatable(L);
 	lua_setmetatable(L, -2);          /* tie the metatable to the table   (sp -= 1) */
 
+	lua_newtable(L);                  /* caches the udata of the backends, see proxy_backends_get() */
+	lua_setfenv(L, -2);
+
 	lua_setfield(L, -2, "backends");
 
+	/**
+	 * register proxy.global.query_cache
+	 *
+	 * @see proxy_query_cache_get()
+	 */
+	query_cache_p = lua_newuserdata(L, sizeof(network_query_cache_t *));
+	*query_cache_p = g->query_cache;
+
+	network_query_cache_lua_getmetatable(L);
+	lua_setmetatable(L, -2);
+
+	lua_setfield(L, -2, "query_cache");
+
+	/**
+	 * register proxy.global.timings
+	 *
+	 * @see proxy_timings_get()
+	 */
+	timings_p = lua_newuserdata(L, sizeof(network_mysqld_timings_t *));
+	*timings_p = g->timings;
+
+	network_mysqld_timings_lua_getmetatable(L);
+	lua_setmetatable(L, -2);
+
+	lua_setfield(L, -2, "timings");
+
+	/**
+	 * register proxy.global.query_digest
+	 *
+	 * @see proxy_query_digest_get()
+	 */
+	query_digest_p = lua_newuserdata(L, sizeof(network_query_digest_t *));
+	*query_digest_p = g->query_digest;
+
+	network_query_digest_lua_getmetatable(L);
+	lua_setmetatable(L, -2);
+
+	lua_setfield(L, -2, "query_digest");
+
+	/**
+	 * register proxy.global.rate_limits
+	 *
+	 * @see network_rate_limiter_lua_getmetatable()
+	 */
+	rate_limiter_p = lua_newuserdata(L, sizeof(network_rate_limiter_t *));
+	*rate_limiter_p = g->rate_limiter;
+
+	network_rate_limiter_lua_getmetatable(L);
+	lua_setmetatable(L, -2);
+
+	lua_setfield(L, -2, "rate_limits");
+
+	/**
+	 * register proxy.global.firewall
+	 *
+	 * @see network_firewall_lua_getmetatable()
+	 */
+	firewall_p = lua_newuserdata(L, sizeof(network_firewall_t *));
+	*firewall_p = g->firewall;
+
+	network_firewall_lua_getmetatable(L);
+	lua_setmetatable(L, -2);
+
+	lua_setfield(L, -2, "firewall");
+
+	/**
+	 * register proxy.global.connections
+	 *
+	 * @see proxy_connections_get()
+	 */
+	connections_p = lua_newuserdata(L, sizeof(chassis_private *));
+	*connections_p = g;
+
+	network_mysqld_connections_lua_getmetatable(L);
+	lua_setmetatable(L, -2);
+
+	lua_setfield(L, -2, "connections");
+
+	/**
+	 * register proxy.shared, it is the same in the scripts of all event-threads
+	 *
+	 * @see network_shared_dict_lua_getmetatable()
+	 */
+	shared_dict_p = lua_newuserdata(L, sizeof(network_shared_dict_t *));
+	*shared_dict_p = g->shared_dict;
+
+	network_shared_dict_lua_getmetatable(L);
+	lua_setmetatable(L, -2);
+
+	lua_setfield(L, -3, "shared");
+
+	/**
+	 * register proxy.resultset_builder()
+	 *
+	 * @see network_resultset_builder_lua_new()
+	 */
+	lua_pushcfunction(L, network_resultset_builder_lua_new);
+	lua_setfield(L, -3, "resultset_builder");
+
+	/**
+	 * register proxy.timer()
+	 *
+	 * @see network_timer_lua_new()
+	 */
+	lua_pushcfunction(L, network_timer_lua_new);
+	lua_setfield(L, -3, "timer");
+
 	lua_pop(L, 2);  /* _G.proxy.global and _G.proxy */
 
 	g_assert(lua_gettop(L) == stack_top);
@@ -247,6 +782,151 @@ int network_mysqld_lua_load_script(lua_scope *sc, const char *lua_script) {
 	return 0;
 }
 
+/**
+ * the key of the connection in the __proxy table of its env
+ */
+static char network_mysqld_con_lua_con_key;
+
+/**
+ * the metatable of the envs of the connections: { __index = _G }
+ *
+ * shared by all connections of a lua-state
+ */
+static void network_mysqld_con_lua_getenvmetatable(lua_State *L) {
+	static char key;
+
+	lua_pushlightuserdata(L, &key);
+	lua_rawget(L, LUA_REGISTRYINDEX);
+
+	if (lua_isnil(L, -1)) {
+		lua_pop(L, 1);
+
+		lua_newtable(L);
+		lua_pushvalue(L, LUA_GLOBALSINDEX);
+		lua_setfield(L, -2, "__index");
+
+		lua_pushlightuserdata(L, &key);
+		lua_pushvalue(L, -2);
+		lua_rawset(L, LUA_REGISTRYINDEX);
+	}
+}
+
+/**
+ * create a field of proxy.* of a connection on its first use
+ *
+ * the connection only pays for the fields its script uses, the created field is
+ * stored in the __proxy table and the next access doesn't get here anymore
+ */
+static int network_mysqld_con_lua_proxy_get(lua_State *L) {
+	network_mysqld_con *con;
+	network_mysqld_con_lua_t *st;
+	size_t keysize;
+	const char *key;
+
+	if (lua_type(L, 2) != LUA_TSTRING) return 0;
+	key = lua_tolstring(L, 2, &keysize);
+
+	lua_pushlightuserdata(L, &network_mysqld_con_lua_con_key);
+	lua_rawget(L, 1);
+	con = lua_touserdata(L, -1);
+	lua_pop(L, 1);
+
+	if (NULL == con) return 0;
+	st = con->plugin_con_state;
+
+	if (strleq(key, keysize, C("queries"))) {
+		GQueue **q_p;
+
+		/*
+		 * proxy.queries
+		 *
+		 * implement a queue
+		 *
+		 * - append(type, query)
+		 * - prepend(type, query)
+		 * - reset()
+		 * - len() and #proxy.queue
+		 *
+		 */
+		q_p = lua_newuserdata(L, sizeof(GQueue *));
+		*q_p = st->injected.queries;
+
+		proxy_getqueuemetatable(L);
+
+		lua_pushvalue(L, -1); /* meta.__index = meta */
+		lua_setfield(L, -2, "__index");
+
+		lua_setmetatable(L, -2);
+	} else if (strleq(key, keysize, C("connection"))) {
+		network_mysqld_con **con_p;
+
+		/*
+		 * proxy.connection is (mostly) read-only
+		 *
+		 * .thread_id  = ... thread-id against this server
+		 * .backend_id = ... index into proxy.global.backends[ndx]
+		 *
+		 */
+		con_p = lua_newuserdata(L, sizeof(con));
+		*con_p = con;
+
+		network_mysqld_con_getmetatable(L);
+		lua_setmetatable(L, -2);
+
+		lua_newtable(L);  /* caches the udata of .client and .server */
+		lua_setfenv(L, -2);
+	} else if (strleq(key, keysize, C("response"))) {
+		/*
+		 * proxy.response knows 3 fields with strict types:
+		 *
+		 * .type = <int>
+		 * .errmsg = <string>
+		 * .resultset = { 
+		 *   fields = { 
+		 *     { type = <int>, name = <string > }, 
+		 *     { ... } }, 
+		 *   rows = { 
+		 *     { ..., ... }, 
+		 *     { ..., ... } }
+		 * }
+		 */
+		lua_newtable(L);
+	} else if (strleq(key, keysize, C("query_async")) ||
+	           strleq(key, keysize, C("wait_all"))) {
+		/*
+		 * proxy.query_async(backend_ndx, query) and proxy.wait_all(future, ...)
+		 */
+		lua_pushvalue(L, 1);
+		network_async_query_lua_register(L, con);
+		lua_pop(L, 1);
+
+		lua_pushvalue(L, 2);
+		lua_rawget(L, 1);
+
+		return 1;
+	} else {
+		return 0;
+	}
+
+	lua_pushvalue(L, 2);
+	lua_pushvalue(L, -2);
+	lua_rawset(L, 1); /* __proxy[key] = <field> */
+
+	return 1;
+}
+
+/**
+ * the metatable of the __proxy tables of the connections
+ */
+static void network_mysqld_con_lua_getproxymetatable(lua_State *L) {
+	static const struct luaL_reg methods[] = {
+		{ "__index", network_mysqld_con_lua_proxy_get },
+		{ NULL, NULL },
+	};
+
+	proxy_getmetatable(L, methods);
+}
+
 /**
  * setup the local script environment before we call the hook function
  *
@@ -270,10 +950,8 @@ network_mysqld_register_callback_ret network_mysqld_con_lua_register_callback(ne
 	network_mysqld_con_lua_t *st   = con->plugin_con_state;
 	chassis_private *g = con->srv->priv; 
 
-	lua_scope  *sc = g->sc;
+	lua_scope  *sc = network_mysqld_con_get_lua_scope(con); /* the global or the per-thread scope */
 
-	GQueue **q_p;
-	network_mysqld_con **con_p;
 	int stack_top;
 
 	if (!lua_script) return REGISTER_CALLBACK_SUCCESS;
@@ -300,6 +978,8 @@ network_mysqld_register_callback_ret network_mysqld_con_lua_register_callback(ne
 
 		g_assert(lua_isfunction(L, -1));
 
+		lua_profiler_attach(L);
+
 		return REGISTER_CALLBACK_SUCCESS; /* the script-env already setup, get out of here */
 	}
 
@@ -321,6 +1001,8 @@ network_mysqld_register_callback_ret network_mysqld_con_lua_register_callback(ne
 
 	st->L_ref = luaL_ref(sc->L, LUA_REGISTRYINDEX);
 
+	lua_profiler_attach(L);
+
 	stack_top = lua_gettop(L);
 
 	/* get the script from the global stack */
@@ -329,80 +1011,23 @@ network_mysqld_register_callback_ret network_mysqld_con_lua_register_callback(ne
 
 	lua_newtable(L); /* my empty environment aka {}              (sp += 1) 1 */
 
-	lua_newtable(L); /* the meta-table for the new env           (sp += 1) 2 */
-
-	lua_pushvalue(L, LUA_GLOBALSINDEX);                       /* (sp += 1) 3 */
-	lua_setfield(L, -2, "__index"); /* { __index = _G }          (sp -= 1) 2 */
+	network_mysqld_con_lua_getenvmetatable(L);                /* (sp += 1) 2 */
 	lua_setmetatable(L, -2); /* setmetatable({}, {__index = _G}) (sp -= 1) 1 */
 
-	lua_newtable(L); /* __proxy = { }                            (sp += 1) 2 */
-
-	g_assert(lua_istable(L, -1));
-
-	q_p = lua_newuserdata(L, sizeof(GQueue *));               /* (sp += 1) 3 */
-	*q_p = st->injected.queries;
-
 	/*
-	 * proxy.queries
-	 *
-	 * implement a queue
-	 *
-	 * - append(type, query)
-	 * - prepend(type, query)
-	 * - reset()
-	 * - len() and #proxy.queue
+	 * __proxy = { } creates proxy.queries, proxy.connection, proxy.response and the
+	 * async functions when they are used first
 	 *
+	 * @see network_mysqld_con_lua_proxy_get()
 	 */
-	proxy_getqueuemetatable(L);
-
-	lua_pushvalue(L, -1); /* meta.__index = meta */
-	lua_setfield(L, -2, "__index");
-
-	lua_setmetatable(L, -2);
-
-
-	lua_setfield(L, -2, "queries"); /* proxy.queries = <userdata> */
-
-	/*
-	 * proxy.connection is (mostly) read-only
-	 *
-	 * .thread_id  = ... thread-id against this server
-	 * .backend_id = ... index into proxy.global.backends[ndx]
-	 *
-	 */
-
-	con_p = lua_newuserdata(L, sizeof(con));                          /* (sp += 1) */
-	*con_p = con;
-
-	network_mysqld_con_getmetatable(L);
-	lua_setmetatable(L, -2);          /* tie the metatable to the udata   (sp -= 1) */
+	lua_newtable(L);                                          /* (sp += 1) 2 */
 
-	lua_setfield(L, -2, "connection"); /* proxy.connection = <udata>     (sp -= 1) */
+	lua_pushlightuserdata(L, &network_mysqld_con_lua_con_key);
+	lua_pushlightuserdata(L, con);
+	lua_rawset(L, -3);            /* __proxy[con_key] = con */
 
-	/*
-	 * proxy.response knows 3 fields with strict types:
-	 *
-	 * .type = <int>
-	 * .errmsg = <string>
-	 * .resultset = { 
-	 *   fields = { 
-	 *     { type = <int>, name = <string > }, 
-	 *     { ... } }, 
-	 *   rows = { 
-	 *     { ..., ... }, 
-	 *     { ..., ... } }
-	 * }
-	 */
-	lua_newtable(L);
-#if 0
-	lua_newtable(L); /* the meta-table for the response-table    (sp += 1) */
-	lua_pushcfunction(L, response_get);                       /* (sp += 1) */
-	lua_setfield(L, -2, "__index");                           /* (sp -= 1) */
-	lua_pushcfunction(L, response_set);                       /* (sp += 1) */
-	lua_setfield(L, -2, "__newindex");                        /* (sp -= 1) */
-	lua_setmetatable(L, -2); /* tie the metatable to response    (sp -= 1) */
-#endif
-	lua_setfield(L, -2, "response");
+	network_mysqld_con_lua_getproxymetatable(L);              /* (sp += 1) 3 */
+	lua_setmetatable(L, -2);                                  /* (sp -= 1) 2 */
 
 	lua_setfield(L, -2, "__proxy");
 
@@ -450,12 +1075,72 @@ network_mysqld_register_callback_ret network_mysqld_con_lua_register_callback(ne
 
 	st->L = L;
 
+	lua_getfenv(L, -1);
+	st->hooks = network_mysqld_lua_fenv_get_hooks(L);
+	lua_pop(L, 1); /* fenv */
+
 	g_assert(lua_isfunction(L, -1));
 	g_assert(lua_gettop(L) - stack_top == 1);
 
 	return REGISTER_CALLBACK_SUCCESS;
 }
 
+/**
+ * the names of the network_mysqld_lua_hook_t
+ */
+static const struct {
+	const char *name;
+	network_mysqld_lua_hook_t hook;
+} network_mysqld_lua_hooks[] = {
+	{ "connect_server",    NETWORK_MYSQLD_LUA_HOOK_CONNECT_SERVER },
+	{ "read_handshake",    NETWORK_MYSQLD_LUA_HOOK_READ_HANDSHAKE },
+	{ "read_auth",         NETWORK_MYSQLD_LUA_HOOK_READ_AUTH },
+	{ "read_auth_result",  NETWORK_MYSQLD_LUA_HOOK_READ_AUTH_RESULT },
+	{ "read_query",        NETWORK_MYSQLD_LUA_HOOK_READ_QUERY },
+	{ "read_query_result", NETWORK_MYSQLD_LUA_HOOK_READ_QUERY_RESULT },
+	{ "disconnect_client", NETWORK_MYSQLD_LUA_HOOK_DISCONNECT_CLIENT },
+	{ "read_query_result_rows", NETWORK_MYSQLD_LUA_HOOK_READ_QUERY_RESULT_ROWS },
+	{ NULL, 0 }
+};
+
+/**
+ * get the hooks the script-env on the top of the stack defines
+ *
+ * the script of a connection runs in its own env, the hooks are looked up in it like
+ * the plugins call them
+ *
+ * @return the network_mysqld_lua_hook_t that are functions
+ */
+guint network_mysqld_lua_fenv_get_hooks(lua_State *L) {
+	guint hooks = 0;
+	int i;
+
+	g_assert(lua_istable(L, -1));
+
+	for (i = 0; network_mysqld_lua_hooks[i].name; i++) {
+		lua_getfield(L, -1, network_mysqld_lua_hooks[i].name);
+		if (lua_isfunction(L, -1)) hooks |= network_mysqld_lua_hooks[i].hook;
+		lua_pop(L, 1);
+	}
+
+	return hooks;
+}
+
+/**
+ * check if the plugin can skip calling a hook of the script of the connection
+ *
+ * the script has to be registered already: until then we don't know its hooks and
+ * the first hook-call registers it. The hooks are checked again after each call of a
+ * hook, a hook that defines another hook is seen.
+ *
+ * @return TRUE if the script doesn't define the hook
+ */
+gboolean network_mysqld_con_lua_skips_hook(network_mysqld_con_lua_t *st, network_mysqld_lua_hook_t hook) {
+	if (NULL == st->L) return FALSE;
+
+	return 0 == (st->hooks & hook);
+}
+
 /**
  * init the global proxy object 
  */
@@ -477,6 +1162,7 @@ void network_mysqld_lua_init_global_fenv(lua_State *L) {
 	DEF(BACKEND_STATE_UNKNOWN);
 	DEF(BACKEND_STATE_UP);
 	DEF(BACKEND_STATE_DOWN);
+	DEF(BACKEND_STATE_LAGGING);
 
 	DEF(BACKEND_TYPE_UNKNOWN);
 	DEF(BACKEND_TYPE_RW);
@@ -573,6 +1259,7 @@ void network_mysqld_lua_init_global_fenv(lua_State *L) {
  *   .resultset (in case of OK)
  *     .fields
  *     .rows
+ *     or a proxy.resultset_builder() with the encoded rows
  *   .errmsg (in case of ERR)
  *   .packet (in case of nil)
  *
@@ -636,11 +1323,20 @@ int network_mysqld_con_lua_handle_proxy_response(network_mysqld_con *con, const
 	switch(resp_type) {
 	case MYSQLD_PACKET_OK: {
 		GPtrArray *fields = NULL;
-		GPtrArray *rows = NULL;
+		network_mysqld_resultset_writer_t *w;
 		gsize field_count = 0;
 
 		lua_getfield(L, -1, "resultset"); /* proxy.response.resultset */
-		if (lua_istable(L, -1)) {
+		if (lua_isuserdata(L, -1)) {
+			/* the rows are encoded already, just move them to the client */
+			if (0 != network_resultset_builder_lua_send(L, -1, con->client)) {
+				g_message("%s.%d: proxy.response.resultset has to be a table or a unsent proxy.resultset_builder() in %s", __FILE__, __LINE__,
+						lua_script);
+
+				lua_pop(L, 2 + 1); /* proxy + response + resultset */
+				return -1;
+			}
+		} else if (lua_istable(L, -1)) {
 			guint i;
 			lua_getfield(L, -1, "fields"); /* proxy.response.resultset.fields */
 			g_assert(lua_istable(L, -1));
@@ -701,17 +1397,19 @@ int network_mysqld_con_lua_handle_proxy_response(network_mysqld_con *con, const
 			}
 			lua_pop(L, 1);
 	
-			rows = g_ptr_array_new();
+			/* encode the rows straight from the lua-tables into the send-queue */
+			w = network_mysqld_resultset_writer_new(con->client);
+			network_mysqld_resultset_writer_write_fields(w, fields);
+
 			lua_getfield(L, -1, "rows"); /* proxy.response.resultset.rows */
 			g_assert(lua_istable(L, -1));
 			for (i = 1; ; i++) {
 				lua_rawgeti(L, -1, i);
 	
 				if (lua_istable(L, -1)) { /** proxy.response.resultset.rows[i] */
-					GPtrArray *row;
 					gsize j;
 	
-					row = g_ptr_array_new();
+					network_mysqld_resultset_writer_row_start(w);
 	
 					/* we should have as many columns as we had fields */
 		
@@ -719,15 +1417,19 @@ int network_mysqld_con_lua_handle_proxy_response(network_mysqld_con *con, const
 						lua_rawgeti(L, -1, j);
 	
 						if (lua_isnil(L, -1)) {
-							g_ptr_array_add(row, NULL);
+							network_mysqld_resultset_writer_row_append(w, NULL, 0);
 						} else {
-							g_ptr_array_add(row, g_strdup(lua_tostring(L, -1)));
+							const char *value;
+							size_t value_len;
+
+							value = lua_tolstring(L, -1, &value_len);
+							network_mysqld_resultset_writer_row_append(w, value, value_len);
 						}
 	
 						lua_pop(L, 1);
 					}
 	
-					g_ptr_array_add(rows, row);
+					network_mysqld_resultset_writer_row_end(w);
 	
 					lua_pop(L, 1); /* pop value */
 				} else if (lua_isnil(L, -1)) {
@@ -741,7 +1443,8 @@ int network_mysqld_con_lua_handle_proxy_response(network_mysqld_con *con, const
 			}
 			lua_pop(L, 1);
 
-			network_mysqld_con_send_resultset(con->client, fields, rows);
+			network_mysqld_resultset_writer_finish(w);
+			network_mysqld_resultset_writer_free(w);
 		} else {
 			guint64 affected_rows = 0;
 			guint64 insert_id = 0;
@@ -769,22 +1472,6 @@ int network_mysqld_con_lua_handle_proxy_response(network_mysqld_con *con, const
 			fields = NULL;
 		}
 
-		if (rows) {
-			guint i;
-			for (i = 0; i < rows->len; i++) {
-				GPtrArray *row = rows->pdata[i];
-				guint j;
-
-				for (j = 0; j < row->len; j++) {
-					if (row->pdata[j]) g_free(row->pdata[j]);
-				}
-
-				g_ptr_array_free(row, TRUE);
-			}
-			g_ptr_array_free(rows, TRUE);
-			rows = NULL;
-		}
-
 		
 		lua_pop(L, 1); /* .resultset */
 		
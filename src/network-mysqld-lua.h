@@ -24,6 +24,12 @@
 
 #include "network-backend.h" /* query-status */
 #include "network-injection.h" /* query-status */
+#include "network-async-query.h"
+#include "network-admission.h"
+#include "network-trace.h"
+#include "network-scatter-merge.h"
+#include "network-mirror.h"
+#include "chassis-event-thread.h"
 
 #include "network-exports.h"
 
@@ -32,7 +38,8 @@ typedef enum {
 	PROXY_SEND_QUERY,
 	PROXY_SEND_RESULT,
 	PROXY_SEND_INJECTION,
-	PROXY_IGNORE_RESULT       /** for read_query_result */
+	PROXY_IGNORE_RESULT,      /** for read_query_result */
+	PROXY_WAIT_ASYNC          /** for read_query, it waits in proxy.wait_all() */
 } network_mysqld_lua_stmt_ret;
 
 typedef enum {
@@ -53,8 +60,60 @@ NETWORK_API void network_mysqld_lua_setup_global(lua_State *L, chassis_private *
  */
 struct network_mysqld_con_lua_injection {
 	network_injection_queue *queries;	/**< An ordered list of queries we want to have executed. */
+	network_injection_queue *pipelined;	/**< Queries already sent to the server, waiting for their results in order. */
 	int sent_resultset;					/**< Flag to make sure we send only one result back to the client. */
 };
+
+/**
+ * a read-only view of the data of the current hook for the FFI of LuaJIT
+ *
+ * the scripts get it as proxy.connection.ffi_view and cast it with lib/proxy/ffi.lua
+ * to read the packet without creating Lua strings. The layout is part of the script API,
+ * it has to match the cdef in lib/proxy/ffi.lua and new fields are only appended.
+ *
+ * the pointers are only valid while the hook runs, they are NULL otherwise
+ */
+typedef struct {
+	const char *packet;                     /**< read_query(): the packet of the client without the network-header */
+	size_t packet_len;
+	const char *query;                      /**< read_query_result(): the query of the injection, starting with the command-byte */
+	size_t query_len;
+	int injection_id;
+	guint64 ts_read_query;                  /**< the timings of the injection, see injection */
+	guint64 ts_read_query_result_first;
+	guint64 ts_read_query_result_last;
+	guint64 rows;
+	guint64 bytes;
+} network_mysqld_lua_ffi_view_t;
+
+/**
+ * the hooks a script may define
+ *
+ * @see network_mysqld_lua_fenv_get_hooks()
+ */
+typedef enum {
+	NETWORK_MYSQLD_LUA_HOOK_CONNECT_SERVER    = 1 << 0,
+	NETWORK_MYSQLD_LUA_HOOK_READ_HANDSHAKE    = 1 << 1,
+	NETWORK_MYSQLD_LUA_HOOK_READ_AUTH         = 1 << 2,
+	NETWORK_MYSQLD_LUA_HOOK_READ_AUTH_RESULT  = 1 << 3,
+	NETWORK_MYSQLD_LUA_HOOK_READ_QUERY        = 1 << 4,
+	NETWORK_MYSQLD_LUA_HOOK_READ_QUERY_RESULT = 1 << 5,
+	NETWORK_MYSQLD_LUA_HOOK_DISCONNECT_CLIENT = 1 << 6,
+	NETWORK_MYSQLD_LUA_HOOK_READ_QUERY_RESULT_ROWS = 1 << 7
+} network_mysqld_lua_hook_t;
+
+/**
+ * the wakeup of a query waiting in the admission queue
+ *
+ * the thread that admits the query hands .ev to the event-thread of the connection. A connection that
+ * is closed while the event is on its way clears .con and leaves the wakeup to the event to free.
+ */
+typedef struct {
+	struct event ev;
+	chassis_event_thread_t *event_thread; /**< the thread the connection waits in */
+	struct network_mysqld_con *con;       /**< NULL once the connection is closed */
+} network_mysqld_con_lua_admission_wakeup_t;
+
 /**
  * Contains extra connection state used for Lua-based plugins.
  */
@@ -63,9 +122,11 @@ typedef struct {
 
 	lua_State *L;                  /**< The Lua interpreter state of the current connection. */
 	int L_ref;                     /**< The reference into the lua_scope's registry (a global structure in the Lua interpreter) */
+	guint hooks;                   /**< the network_mysqld_lua_hook_t the script defines, valid once .L is set */
 
 	network_backend_t *backend;
 	int backend_ndx;               /**< [lua] index into the backend-array */
+	guint64 ts_connect;            /**< when we started to connect to the backend, in chassis_get_rel_microseconds() */
 
 	gboolean connection_close;     /**< [lua] set by the lua code to close a connection */
 
@@ -78,13 +139,218 @@ typedef struct {
 	 * Flag indicating whether we injected a COM_CHANGE_USER packet on the proxy plugin side
 	 */
 	gboolean is_in_com_change_user;
+
+	/**
+	 * the connection of the client parked by --proxy-rw-split or --proxy-shard-map-file while the
+	 * queries go to another backend
+	 */
+	network_socket *rw_split_server;
+	network_backend_t *rw_split_backend;
+	int rw_split_backend_ndx;
+
+	/**
+	 * the last write of the client for --proxy-rw-split-read-your-writes
+	 */
+	gboolean rw_split_is_write;        /**< the current query went to the master as a write */
+	guint64 rw_split_write_usec;       /**< when the result of the last write was complete, 0 if the client didn't write */
+	guint64 rw_split_min_binlog_pos;   /**< the master's binlog position after the last write, 0 until the health-check saw it */
+
+	GString *shard_key;                /**< the shard key of the current query for --proxy-shard-map-file or the column of --proxy-rw-split-affinity, NULL until the first query */
+	network_scatter_merge_t *scatter_merge; /**< merges the results of a query sent to all shards, NULL if there is none */
+	GPtrArray *scatter_queries;        /**< the network_async_query_t per shard, NULL once it is done */
+	guint scatter_running;             /**< the queries of .scatter_queries that aren't done */
+
+	network_mirror_query_t *mirror_query; /**< the current query is mirrored for --proxy-mirror-backend, NULL if it isn't */
+	guint64 mirror_usec;               /**< when the mirrored query was sent to the backend of the client */
+
+	/**
+	 * the result of a cacheable query we capture for --proxy-query-cache-size
+	 */
+	GString *query_cache_key;       /**< NULL if the current result isn't captured */
+	GPtrArray *query_cache_packets; /**< copies of the packets we forwarded to the client */
+	gsize query_cache_bytes;
+
+	network_mysqld_query_hints_t *query_hints; /**< the hints of the comment in front of the current query, see --proxy-query-hints */
+
+	/**
+	 * the tables the client wrote to in the current transaction, their cached results
+	 * are dropped once the transaction is over
+	 */
+	GPtrArray *query_cache_written_tables;
+	gboolean query_cache_written_unknown; /**< we couldn't tell which tables were written, drop all */
+
+	/**
+	 * the charset of the session, part of the key of the cached results
+	 */
+	GString *query_cache_names;              /**< the charset of the last SET NAMES, NULL for the one of the handshake */
+	gboolean query_cache_charset_is_unknown; /**< the client changed its charset in a way we don't follow */
+
+	/**
+	 * --proxy-multiplex gives the backend connection back to the pool between statements
+	 */
+	gboolean multiplex_is_pinned;  /**< the client has session state, it keeps its backend connection */
+	gboolean multiplex_is_idle;    /**< the backend connection is in the pool until the next statement */
+	gboolean multiplex_is_waiting; /**< the statement waits for a pooled connection of the session, see --proxy-multiplex-wait-timeout */
+	gboolean multiplex_is_woken;   /**< a connection of the user came back into one of the pools */
+	gboolean multiplex_is_timed_out; /**< the wait-timeout is reached */
+	network_mysqld_lua_stmt_ret multiplex_ret; /**< the decision of read_query() for the waiting statement */
+	GPtrArray *multiplex_waiters;  /**< a network_connection_pool_waiter in the pool of each read-write backend */
+	struct event multiplex_wakeup_ev;  /**< added once a waiter is woken up */
+	struct event multiplex_timeout_ev; /**< the wait-timeout */
+	gboolean result_is_done;       /**< the result is accounted already, its tail is still sent from the spool */
+
+	/**
+	 * --proxy-lazy-connect authed the client itself, the backend is attached for the first query
+	 */
+	gboolean lazy_is_pending;        /**< the client has no backend yet */
+	gboolean lazy_is_connecting;     /**< we log in to a backend for the query in the recv-queue */
+	network_mysqld_lua_stmt_ret lazy_ret; /**< the decision of read_query() for that query */
+	GString *lazy_hashed_password;   /**< SHA1(password) of the client to log in with, NULL if not authed by us */
+
+	/**
+	 * the charset of the last SET NAMES the backend confirmed, for --proxy-local-answers
+	 */
+	GString *local_names;            /**< NULL if unknown */
+	GString *local_names_pending;    /**< the SET NAMES waiting for its result */
+
+	/**
+	 * the prepared statements of a multiplexed client
+	 *
+	 * the client gets its own statement-ids, the statements are prepared again on
+	 * the backend connections that don't know them yet
+	 */
+	GHashTable *stmt_texts;          /**< client statement-id -> GString statement text, NULL until the first statement */
+	guint32 stmt_next_id;            /**< the last statement-id we handed out */
+	GString *stmt_prepare_key;       /**< the network_stmt_cache_t key of the COM_STMT_PREPARE in flight, NULL if none */
+	guint32 stmt_prepare_id;         /**< the statement-id the client gets for it, 0 if we prepare it for the pending command */
+	GPtrArray *stmt_prepare_packets; /**< copies of the response */
+	GQueue *stmt_pending;            /**< the client command waiting for its statement to be prepared */
+
+	/**
+	 * the COM_QUERY we execute as prepared statement for --proxy-stmt-promote-threshold
+	 *
+	 * it is sent as it is if the statement can't be prepared
+	 */
+	GString *stmt_promote_query;     /**< the packet of the client, NULL if the query isn't promoted */
+	guint64 stmt_promote_hash;       /**< the hash of its statement text */
+
+	/**
+	 * the rows of the result read_query_result_rows() gets in batches, see
+	 * proxy.queries:append(..., { rows_batch_size = ... })
+	 */
+	GPtrArray *rows_batch;           /**< the row packets waiting for the hook, NULL until the first row */
+	guint64 rows_batch_columns;      /**< the columns of the current result-set */
+	gboolean rows_batch_is_raw;      /**< a row is split over packets, the rest of the rows is forwarded as it is */
+
+	/**
+	 * the session variables the client SET, a backend connection gets them before
+	 * the next command if it has others
+	 */
+	GHashTable *session_vars;        /**< name -> value, NULL until the first SET */
+	GHashTable *session_vars_pending; /**< the SET waiting for its result */
+	gboolean session_sync_is_pending; /**< the SET of the missing ones is in flight */
+	GQueue *session_sync_pending;    /**< the client command waiting for it, unless it waits in stmt_pending */
+
+	/**
+	 * the normalized query of the client for --proxy-query-digest-size
+	 */
+	GString *digest_text;            /**< NULL until the first query */
+	guint64 digest_hash;
+	gboolean digest_is_pending;      /**< add it to the digests when the result is sent */
+
+	/**
+	 * the command of the client for --proxy-query-log
+	 */
+	GString *query_log_text;         /**< NULL until the first query */
+	guint8 query_log_command;
+	gboolean query_log_is_pending;   /**< log it when the result is sent */
+
+	/**
+	 * the sampled query of the client for --proxy-trace-address
+	 */
+	network_trace_context_t trace_ctx;
+	guint64 trace_read_usec;
+	guint64 trace_queued_usec;       /**< 0 if it didn't wait in the admission queue */
+	guint64 trace_admitted_usec;     /**< 0 until it is admitted */
+	gboolean trace_is_pending;       /**< send its spans when the result is sent */
+
+	guint32 capture_id;              /**< the connection in the --proxy-capture, 0 until its first command */
+
+	network_mysqld_lua_ffi_view_t ffi_view; /**< [lua] proxy.connection.ffi_view */
+
+	/**
+	 * proxy.query_async() and proxy.wait_all()
+	 */
+	lua_State *async_L;              /**< the coroutine read_query() runs in, NULL until the first call */
+	int async_L_ref;                 /**< its reference in the registry */
+	gboolean async_is_waiting;       /**< it waits in proxy.wait_all(), the futures are on its stack */
+	GPtrArray *async_queries;        /**< the network_async_query_t that are still running */
+
+	/**
+	 * the slot of the current query for --proxy-backend-max-queries and --proxy-user-max-queries
+	 */
+	network_admission_ticket_t admission;
+	gboolean admission_is_waiting;   /**< the query waits in the queue */
+	gboolean admission_is_woken;     /**< .admission_wakeup fired, the query is admitted */
+	network_mysqld_lua_stmt_ret admission_ret; /**< the decision of read_query() for the waiting query */
+	network_mysqld_con_lua_admission_wakeup_t *admission_wakeup; /**< NULL until a query had to wait */
+	struct event admission_timeout_ev; /**< the queue-timeout */
+
+	/**
+	 * the budget of the query on the backend for --proxy-query-timeout
+	 */
+	struct event query_timeout_ev;
+	gboolean query_timeout_is_armed;
+	gboolean query_timeout_is_expired; /**< we sent a KILL QUERY, the connection mustn't go back to the pool */
+
+	/**
+	 * the query waits for a token of --proxy-rate-limit
+	 */
+	gboolean rate_limit_is_waiting;
+	guint64 rate_limit_deadline_usec;  /**< it gets a error if it has no token by then */
+	struct event rate_limit_ev;
+
+	/**
+	 * the second connect of --proxy-connect-hedge-delay, to another backend of the same type
+	 */
+	struct event hedge_ev;             /**< starts the second connect after the delay */
+	gboolean hedge_is_armed;
+	network_socket *hedge_server;      /**< the second connect while it is in progress, NULL if there is none */
+	network_backend_t *hedge_backend;
+	int hedge_backend_ndx;
+	guint64 hedge_ts_connect;          /**< when the second connect started */
+	gboolean hedge_is_promoted;        /**< the first connect timed out, con->server is the second one now */
+
+	/**
+	 * the second read of --proxy-read-hedge-percentile, to another read-only backend
+	 */
+	struct event read_hedge_ev;        /**< sends the read again after the delay */
+	gboolean read_hedge_is_armed;
+	gboolean read_hedge_is_pending;    /**< record the time to the first packet of the read when the result is sent */
+	guint64 read_hedge_hash;           /**< the fingerprint of the read */
+	GString *read_hedge_packet;        /**< COM_QUERY and the read, kept to send it again */
+	network_async_query_t *read_hedge_query; /**< the second read while it runs, NULL if there is none */
+	gboolean read_hedge_is_won;        /**< the second read answered first, con->server was closed */
+	gboolean read_hedge_is_streamed;   /**< a part of its result is in the send-queue of the client */
 } network_mysqld_con_lua_t;
 
 NETWORK_API network_mysqld_con_lua_t *network_mysqld_con_lua_new();
 NETWORK_API void network_mysqld_con_lua_free(network_mysqld_con_lua_t *st);
+NETWORK_API void network_mysqld_con_lua_query_cache_reset(network_mysqld_con_lua_t *st);
+NETWORK_API void network_mysqld_con_lua_query_cache_clear_written(network_mysqld_con_lua_t *st);
+NETWORK_API void network_mysqld_con_lua_scatter_reset(network_mysqld_con_lua_t *st);
+NETWORK_API void network_mysqld_con_lua_stmt_prepare_reset(network_mysqld_con_lua_t *st);
+NETWORK_API void network_mysqld_con_lua_stmt_promote_reset(network_mysqld_con_lua_t *st);
+NETWORK_API void network_mysqld_con_lua_rows_batch_reset(network_mysqld_con_lua_t *st);
+NETWORK_API void network_mysqld_con_lua_ffi_view_set_packet(network_mysqld_con_lua_t *st, const char *packet, gsize packet_len);
+NETWORK_API void network_mysqld_con_lua_ffi_view_set_injection(network_mysqld_con_lua_t *st, injection *inj);
+NETWORK_API void network_mysqld_con_lua_ffi_view_reset(network_mysqld_con_lua_t *st);
 
 /** be sure to include network-mysqld.h */
 NETWORK_API network_mysqld_register_callback_ret network_mysqld_con_lua_register_callback(network_mysqld_con *con, const char *lua_script);
 NETWORK_API int network_mysqld_con_lua_handle_proxy_response(network_mysqld_con *con, const char *lua_script);
 
+NETWORK_API guint network_mysqld_lua_fenv_get_hooks(lua_State *L);
+NETWORK_API gboolean network_mysqld_con_lua_skips_hook(network_mysqld_con_lua_t *st, network_mysqld_lua_hook_t hook);
+
 #endif
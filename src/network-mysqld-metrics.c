@@ -0,0 +1,189 @@
+/* $%BEGINLICENSE%$
+ Copyright (c) 2008, 2012, Oracle and/or its affiliates. All rights reserved.
+
+ This program is free software; you can redistribute it and/or
+ modify it under the terms of the GNU General Public License as
+ published by the Free Software Foundation; version 2 of the
+ License.
+
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ GNU General Public License for more details.
+
+ You should have received a copy of the GNU General Public License
+ along with this program; if not, write to the Free Software
+ Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA
+ 02110-1301  USA
+
+ $%ENDLICENSE%$ */
+/**
+ * the metrics of the connections and backends
+ *
+ * the event-threads add to the sharded metrics of chassis-metrics.h, the state of the
+ * backends is read when /metrics is scraped
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <glib.h>
+
+#include "network-mysqld-metrics.h"
+#include "network-backend.h"
+#include "network-flow-control.h"
+
+network_mysqld_metrics_t *network_mysqld_metrics_global = NULL;
+
+/**
+ * upper bounds of the buckets of the query duration in microseconds
+ */
+static const guint64 network_mysqld_metrics_duration_bounds[] = {
+	100, 250, 500,
+	1000, 2500, 5000,
+	10000, 25000, 50000,
+	100000, 250000, 500000,
+	1000000, 2500000, 5000000,
+	10000000
+};
+
+/**
+ * register the metrics of the connections with the chassis
+ *
+ * the first one becomes network_mysqld_metrics_global
+ */
+network_mysqld_metrics_t *network_mysqld_metrics_new(chassis *chas) {
+	network_mysqld_metrics_t *m;
+	const gchar *command_names[NETWORK_MYSQLD_METRICS_COMMANDS + 1];
+	guint command;
+
+	m = g_new0(network_mysqld_metrics_t, 1);
+
+	m->connections_total = chassis_metrics_register_counter(chas->metrics,
+			"mysql_proxy_connections_total", "Accepted client connections");
+	m->connections = chassis_metrics_register_gauge(chas->metrics,
+			"mysql_proxy_connections", "Open client connections");
+	m->connections_parked = chassis_metrics_register_gauge(chas->metrics,
+			"mysql_proxy_connections_parked", "Client connections idling with their buffers released");
+	m->connections_memory = chassis_metrics_register_gauge(chas->metrics,
+			"mysql_proxy_connections_memory_bytes", "Bytes of the client connections and their sockets when they went idle last");
+	for (command = 0; command <= NETWORK_MYSQLD_METRICS_COMMANDS; command++) {
+		command_names[command] = network_mysqld_command_get_name(command);
+	}
+	m->queries_total = chassis_metrics_register_counter_vec(chas->metrics,
+			"mysql_proxy_queries_total", "Queries received from the clients",
+			"command", command_names, G_N_ELEMENTS(command_names));
+	m->query_duration = chassis_metrics_register_histogram(chas->metrics,
+			"mysql_proxy_query_duration_seconds", "Query read until its result is sent to the client",
+			network_mysqld_metrics_duration_bounds, G_N_ELEMENTS(network_mysqld_metrics_duration_bounds), 1e-6);
+	m->queries_pipelined_total = chassis_metrics_register_counter(chas->metrics,
+			"mysql_proxy_queries_pipelined_total", "Queries received before the result of the previous query was sent");
+	m->results_spooled_total = chassis_metrics_register_counter(chas->metrics,
+			"mysql_proxy_results_spooled_total", "Results spooled to a temporary file for a slow client");
+	m->received_bytes_total = chassis_metrics_register_counter(chas->metrics,
+			"mysql_proxy_received_bytes_total", "Bytes received from clients and backends");
+	m->sent_bytes_total = chassis_metrics_register_counter(chas->metrics,
+			"mysql_proxy_sent_bytes_total", "Bytes sent to clients and backends");
+	m->connect_ports_exhausted_total = chassis_metrics_register_counter(chas->metrics,
+			"mysql_proxy_connect_ports_exhausted_total", "Connects to the backends that failed as no local port was free");
+
+	if (NULL == network_mysqld_metrics_global) network_mysqld_metrics_global = m;
+
+	return m;
+}
+
+/**
+ * free the handles
+ *
+ * the metrics themselves are owned by the chassis
+ */
+void network_mysqld_metrics_free(network_mysqld_metrics_t *m) {
+	if (!m) return;
+
+	if (network_mysqld_metrics_global == m) network_mysqld_metrics_global = NULL;
+
+	g_free(m);
+}
+
+/**
+ * get the name of a command as it is used in the labels
+ */
+const gchar *network_mysqld_metrics_command_get_name(guint8 command) {
+	return network_mysqld_command_get_name(command);
+}
+
+void network_mysqld_metrics_add_query(network_mysqld_metrics_t *m, guint8 command) {
+	if (!m) return;
+
+	chassis_metric_add_label(m->queries_total, MIN(command, NETWORK_MYSQLD_METRICS_COMMANDS), 1);
+}
+
+/**
+ * the collector of the backends
+ *
+ * the backend-state is exported as one series per state with the current one set to 1
+ *
+ * @param user_data  the network_backends_t
+ */
+void network_mysqld_metrics_collect_backends(chassis_metrics_t G_GNUC_UNUSED *metrics, GString *out, gpointer user_data) {
+	network_backends_t *bs = user_data;
+	GPtrArray *backends = network_backends_get_snapshot(bs);
+	GString *labels = g_string_new(NULL);
+	backend_state_t state;
+	guint i;
+
+	chassis_metrics_append_header(out, "mysql_proxy_backend_state", "State of the backend", CHASSIS_METRIC_GAUGE);
+	for (i = 0; i < backends->len; i++) {
+		network_backend_t *b = backends->pdata[i];
+
+		for (state = BACKEND_STATE_UNKNOWN; state <= BACKEND_STATE_LAGGING; state++) {
+			g_string_printf(labels, "backend=\"%s\",state=\"%s\"", b->addr->name->str, network_backend_state_get_name(state));
+			chassis_metrics_append_value(out, "mysql_proxy_backend_state", labels->str, b->state == state ? 1 : 0);
+		}
+	}
+
+	chassis_metrics_append_header(out, "mysql_proxy_backend_connected_clients", "Clients connected to the backend", CHASSIS_METRIC_GAUGE);
+	for (i = 0; i < backends->len; i++) {
+		network_backend_t *b = backends->pdata[i];
+
+		g_string_printf(labels, "backend=\"%s\"", b->addr->name->str);
+		chassis_metrics_append_value(out, "mysql_proxy_backend_connected_clients", labels->str, b->connected_clients);
+	}
+
+	chassis_metrics_append_header(out, "mysql_proxy_pool_gets_total", "Connections asked from the pools of the backend by result", CHASSIS_METRIC_COUNTER);
+	for (i = 0; i < backends->len; i++) {
+		network_backend_t *b = backends->pdata[i];
+		network_connection_pool_stats_t stats;
+
+		network_backend_get_pool_stats(b, &stats);
+
+#define APPEND_POOL_STAT(result, value) \
+		g_string_printf(labels, "backend=\"%s\",result=\"%s\"", b->addr->name->str, result); \
+		chassis_metrics_append_value(out, "mysql_proxy_pool_gets_total", labels->str, value);
+
+		APPEND_POOL_STAT("hit_session", stats.hits_session);
+		APPEND_POOL_STAT("hit_default_db", stats.hits_default_db);
+		APPEND_POOL_STAT("hit_user", stats.hits_user);
+		APPEND_POOL_STAT("hit_donor", stats.hits_donor);
+		APPEND_POOL_STAT("miss", stats.misses);
+#undef APPEND_POOL_STAT
+	}
+
+	g_string_free(labels, TRUE);
+}
+
+/**
+ * the collector of the flow control of the forwarded results
+ *
+ * @param user_data  the network_flow_control_t
+ */
+void network_mysqld_metrics_collect_flow_control(chassis_metrics_t G_GNUC_UNUSED *metrics, GString *out, gpointer user_data) {
+	network_flow_control_t *fc = user_data;
+
+	chassis_metrics_append_header(out, "mysql_proxy_send_queue_bytes", "Bytes of the results waiting in the send-queues to the clients", CHASSIS_METRIC_GAUGE);
+	chassis_metrics_append_value(out, "mysql_proxy_send_queue_bytes", NULL, network_flow_control_get_buffered(fc));
+
+	chassis_metrics_append_header(out, "mysql_proxy_send_queue_pauses_total", "Times a connection stopped reading its result until the client caught up", CHASSIS_METRIC_COUNTER);
+	chassis_metrics_append_value(out, "mysql_proxy_send_queue_pauses_total", NULL, network_flow_control_get_pauses(fc));
+}
@@ -0,0 +1,76 @@
+/* $%BEGINLICENSE%$
+ Copyright (c) 2008, 2012, Oracle and/or its affiliates. All rights reserved.
+
+ This program is free software; you can redistribute it and/or
+ modify it under the terms of the GNU General Public License as
+ published by the Free Software Foundation; version 2 of the
+ License.
+
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ GNU General Public License for more details.
+
+ You should have received a copy of the GNU General Public License
+ along with this program; if not, write to the Free Software
+ Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA
+ 02110-1301  USA
+
+ $%ENDLICENSE%$ */
+#ifndef __NETWORK_MYSQLD_METRICS_H__
+#define __NETWORK_MYSQLD_METRICS_H__
+
+#include <glib.h>
+
+#include "chassis-mainloop.h"
+#include "chassis-metrics.h"
+
+#include "network-mysqld-packet.h"
+
+#include "network-exports.h"
+
+/**
+ * the commands up to COM_RESET_CONNECTION get a label of their own, the rest is "other"
+ *
+ * @see network_mysqld_command_get_name()
+ */
+#define NETWORK_MYSQLD_METRICS_COMMANDS NETWORK_MYSQLD_COMMANDS
+
+/**
+ * the metrics of the connections, fed from the event-threads
+ *
+ * what can be read from the backends at scrape-time (state, pool hits) is left to
+ * network_mysqld_metrics_collect_backends()
+ */
+typedef struct {
+	chassis_metric_t *connections_total;   /**< accepted client connections */
+	chassis_metric_t *connections;         /**< open client connections */
+	chassis_metric_t *connections_parked;  /**< client connections idling with their queues released */
+	chassis_metric_t *connections_memory;  /**< bytes of the client connections when they went idle last, see network_mysqld_con_get_memory() */
+	chassis_metric_t *queries_total;       /**< queries by command */
+	chassis_metric_t *query_duration;      /**< query read until the result is sent, in microseconds */
+	chassis_metric_t *queries_pipelined_total; /**< queries that arrived before the result of the previous one was sent */
+	chassis_metric_t *results_spooled_total; /**< results whose tail went to a spool-file, see network-spool.h */
+	chassis_metric_t *received_bytes_total;
+	chassis_metric_t *sent_bytes_total;
+	chassis_metric_t *connect_ports_exhausted_total; /**< connects that found no free local port */
+} network_mysqld_metrics_t;
+
+/**
+ * the metrics of the chassis, NULL until network_mysqld_init() set them up
+ *
+ * the sockets don't know their chassis, they add to these
+ */
+NETWORK_API network_mysqld_metrics_t *network_mysqld_metrics_global;
+
+NETWORK_API network_mysqld_metrics_t *network_mysqld_metrics_new(chassis *chas);
+NETWORK_API void network_mysqld_metrics_free(network_mysqld_metrics_t *m);
+NETWORK_API void network_mysqld_metrics_add_query(network_mysqld_metrics_t *m, guint8 command);
+NETWORK_API const gchar *network_mysqld_metrics_command_get_name(guint8 command);
+NETWORK_API void network_mysqld_metrics_collect_backends(chassis_metrics_t *metrics, GString *out, gpointer user_data);
+NETWORK_API void network_mysqld_metrics_collect_flow_control(chassis_metrics_t *metrics, GString *out, gpointer user_data);
+
+#define NETWORK_MYSQLD_METRICS_ADD(name, addme) ((network_mysqld_metrics_global != NULL) ? chassis_metric_add(network_mysqld_metrics_global->name, addme) : (void)0)
+#define NETWORK_MYSQLD_METRICS_OBSERVE(name, value) ((network_mysqld_metrics_global != NULL) ? chassis_metric_observe(network_mysqld_metrics_global->name, value) : (void)0)
+
+#endif
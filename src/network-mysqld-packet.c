@@ -64,6 +64,43 @@ int network_mysqld_com_query_result_track_state(network_packet G_GNUC_UNUSED *pa
 	g_error("%s: this function is deprecated and network_mysqld_proto_get_com_query_result() should be used instead",
 			G_STRLOC);
 }
+
+/**
+ * track the status of the packet that ends the rows
+ *
+ * @return 1 if this was the last result-set, 0 if more follow
+ */
+static int network_mysqld_com_query_result_end(network_mysqld_com_query_result_t *query, guint16 server_status, guint16 warning_count) {
+	query->was_resultset = 1;
+
+#ifndef SERVER_PS_OUT_PARAMS
+#define SERVER_PS_OUT_PARAMS 4096
+#endif
+	/**
+	 * a PS_OUT_PARAMS is set if a COM_STMT_EXECUTE executes a CALL sp(?) where sp is a PROCEDURE with OUT params 
+	 *
+	 * ...
+	 * 05 00 00 12 fe 00 00 0a 10 -- end column-def (auto-commit, more-results, ps-out-params)
+	 * ...
+	 * 05 00 00 14 fe 00 00 02 00 -- end of rows (auto-commit), see the missing (more-results, ps-out-params)
+	 * 07 00 00 15 00 00 00 02 00 00 00 -- OK for the CALL
+	 *
+	 * for all other resultsets we trust the status-flags of the 2nd EOF packet
+	 */
+	if (!(query->server_status & SERVER_PS_OUT_PARAMS)) {
+		query->server_status = server_status;
+	}
+	query->warning_count = warning_count;
+
+	if (query->server_status & SERVER_MORE_RESULTS_EXISTS) {
+		query->state = PARSE_COM_QUERY_INIT;
+
+		return 0;
+	}
+
+	return 1;
+}
+
 /**
  * @return -1 on error
  *         0  on success and done
@@ -132,6 +169,11 @@ int network_mysqld_proto_get_com_query_result(network_packet *packet, network_my
 			query->query_status = MYSQLD_PACKET_OK;
 			/* looks like a result */
 			query->state = PARSE_COM_QUERY_FIELD;
+
+			/* without the EOF we have to count the field-defs to know where the rows start */
+			if (query->deprecate_eof) {
+				err = err || network_mysqld_proto_get_lenenc_int(packet, &query->fields_left);
+			}
 			break;
 		}
 		break;
@@ -198,6 +240,9 @@ int network_mysqld_proto_get_com_query_result(network_packet *packet, network_my
 			}
 			break;
 		default:
+			if (query->deprecate_eof && --query->fields_left == 0) {
+				query->state = PARSE_COM_QUERY_RESULT;
+			}
 			break;
 		}
 		break;
@@ -207,38 +252,26 @@ int network_mysqld_proto_get_com_query_result(network_packet *packet, network_my
 
 		switch (status) {
 		case MYSQLD_PACKET_EOF:
-			if (packet->data->len == 9) {
+			if (query->deprecate_eof) {
+				/* a row can only start with 0xfe if its first field is larger than a packet */
+				if (packet->data->len < NET_HEADER_SIZE + PACKET_LEN_MAX) {
+					ok_packet = network_mysqld_ok_packet_new();
+
+					err = err || network_mysqld_proto_get_eof_ok_packet(packet, ok_packet);
+
+					if (!err) {
+						is_finished = network_mysqld_com_query_result_end(query, ok_packet->server_status, ok_packet->warnings);
+					}
+
+					network_mysqld_ok_packet_free(ok_packet);
+				}
+			} else if (packet->data->len == 9) {
 				eof_packet = network_mysqld_eof_packet_new();
 
 				err = err || network_mysqld_proto_get_eof_packet(packet, eof_packet);
 
 				if (!err) {
-					query->was_resultset = 1;
-
-#ifndef SERVER_PS_OUT_PARAMS
-#define SERVER_PS_OUT_PARAMS 4096
-#endif
-					/**
-					 * a PS_OUT_PARAMS is set if a COM_STMT_EXECUTE executes a CALL sp(?) where sp is a PROCEDURE with OUT params 
-					 *
-					 * ...
-					 * 05 00 00 12 fe 00 00 0a 10 -- end column-def (auto-commit, more-results, ps-out-params)
-					 * ...
-					 * 05 00 00 14 fe 00 00 02 00 -- end of rows (auto-commit), see the missing (more-results, ps-out-params)
-					 * 07 00 00 15 00 00 00 02 00 00 00 -- OK for the CALL
-					 *
-					 * for all other resultsets we trust the status-flags of the 2nd EOF packet
-					 */
-					if (!(query->server_status & SERVER_PS_OUT_PARAMS)) {
-						query->server_status = eof_packet->server_status;
-					}
-					query->warning_count = eof_packet->warnings;
-
-					if (query->server_status & SERVER_MORE_RESULTS_EXISTS) {
-						query->state = PARSE_COM_QUERY_INIT;
-					} else {
-						is_finished = 1;
-					}
+					is_finished = network_mysqld_com_query_result_end(query, eof_packet->server_status, eof_packet->warnings);
 				}
 
 				network_mysqld_eof_packet_free(eof_packet);
@@ -357,6 +390,22 @@ int network_mysqld_proto_get_com_stmt_prepare_result(
 		case MYSQLD_PACKET_OK:
 			g_assert(packet->data->len == 12 + NET_HEADER_SIZE); 
 
+			if (udata->deprecate_eof) {
+				guint16 num_columns, num_params;
+
+				/* the stmt-id, then the number of fields and params */
+				err = err || network_mysqld_proto_skip(packet, 4);
+				err = err || network_mysqld_proto_get_int16(packet, &num_columns);
+				err = err || network_mysqld_proto_get_int16(packet, &num_params);
+
+				udata->want_defs = num_columns + num_params;
+
+				if (!err && udata->want_defs == 0) {
+					is_finished = 1;
+				}
+				break;
+			}
+
 			/* the header contains the number of EOFs we expect to see
 			 * - no params -> 0
 			 * - params | fields -> 1
@@ -385,6 +434,11 @@ int network_mysqld_proto_get_com_stmt_prepare_result(
 					status);
 			break;
 		}
+	} else if (udata->deprecate_eof) {
+		/* the param- and field-defs, no EOF after them */
+		if (--udata->want_defs == 0) {
+			is_finished = 1;
+		}
 	} else {
 		switch (status) {
 		case MYSQLD_PACKET_OK:
@@ -510,14 +564,24 @@ int network_mysqld_con_command_states_init(network_mysqld_con *con, network_pack
 	switch (con->parse.command) {
 	case COM_QUERY:
 	case COM_PROCESS_INFO:
-	case COM_STMT_EXECUTE:
-		con->parse.data = network_mysqld_com_query_result_new();
+	case COM_STMT_EXECUTE: {
+		network_mysqld_com_query_result_t *com_query;
+
+		com_query = network_mysqld_com_query_result_new();
+		com_query->deprecate_eof = network_mysqld_socket_is_deprecate_eof(con->server);
+
+		con->parse.data = com_query;
 		con->parse.data_free = (GDestroyNotify)network_mysqld_com_query_result_free;
-		break;
-	case COM_STMT_PREPARE:
-		con->parse.data = network_mysqld_com_stmt_prepare_result_new();
+		break; }
+	case COM_STMT_PREPARE: {
+		network_mysqld_com_stmt_prepare_result_t *stmt_prepare;
+
+		stmt_prepare = network_mysqld_com_stmt_prepare_result_new();
+		stmt_prepare->deprecate_eof = network_mysqld_socket_is_deprecate_eof(con->server);
+
+		con->parse.data = stmt_prepare;
 		con->parse.data_free = (GDestroyNotify)network_mysqld_com_stmt_prepare_result_free;
-		break;
+		break; }
 	case COM_INIT_DB:
 		con->parse.data = network_mysqld_com_init_db_result_new();
 		con->parse.data_free = (GDestroyNotify)network_mysqld_com_init_db_result_free;
@@ -668,6 +732,25 @@ int network_mysqld_proto_get_query_result(network_packet *packet, network_mysqld
 
 		switch (status) {
 		case MYSQLD_PACKET_EOF: 
+			if (network_mysqld_socket_is_deprecate_eof(con->server)) {
+				network_mysqld_ok_packet_t *ok_packet;
+
+				/* the binary rows start with 0x00, the 0xfe is the OK at the end */
+				ok_packet = network_mysqld_ok_packet_new();
+
+				err = err || network_mysqld_proto_get_eof_ok_packet(packet, ok_packet);
+				if (!err) {
+					if ((ok_packet->server_status & SERVER_STATUS_LAST_ROW_SENT) ||
+					    (ok_packet->server_status & SERVER_STATUS_CURSOR_EXISTS)) {
+						is_finished = 1;
+					}
+				}
+
+				network_mysqld_ok_packet_free(ok_packet);
+
+				break;
+			}
+
 			eof_packet = network_mysqld_eof_packet_new();
 
 			err = err || network_mysqld_proto_get_eof_packet(packet, eof_packet);
@@ -724,87 +807,1105 @@ int network_mysqld_proto_get_query_result(network_packet *packet, network_mysqld
 		break;
 	}
 
-	if (err) return -1;
+	if (err) return -1;
+
+	/* track the session state of the server-side for the connection pool */
+	if (is_finished == 1 && con->server) {
+		switch (con->parse.command) {
+		case COM_QUERY:
+		case COM_STMT_EXECUTE: {
+			network_mysqld_com_query_result_t *query = con->parse.data;
+
+			if (query && query->query_status == MYSQLD_PACKET_OK) {
+				con->server->server_status = query->server_status;
+			}
+			break; }
+		case COM_CHANGE_USER:
+			/* the session is reset to the server defaults */
+			if (status == MYSQLD_PACKET_OK && con->server->challenge) {
+				con->server->server_status = con->server->challenge->server_status;
+			}
+			break;
+		default:
+			break;
+		}
+
+		network_mysqld_activity_query_end(&(con->activity), con->server->server_status, chassis_get_coarse_rel_microseconds());
+	}
+
+	return is_finished;
+}
+
+/**
+ * check if a packet of the result may be forwarded before it is received completely
+ *
+ * only the rows of a result-set qualify: tracking the state of the result only needs their
+ * first byte. A row is counted like network_mysqld_proto_get_query_result() would count it.
+ *
+ * @param status     the first byte of the payload
+ * @param packet_len the length of the payload
+ * @return TRUE if the packet is a row and got counted, FALSE if it has to be parsed
+ */
+gboolean network_mysqld_proto_get_query_result_row(network_mysqld_con *con, guint8 status, guint32 packet_len) {
+	network_mysqld_com_query_result_t *query;
+
+	/* a row only starts with 0xfe if its first field fills the packet, anything shorter is
+	 * a EOF or the OK that replaces it with CLIENT_DEPRECATE_EOF */
+	if (status == MYSQLD_PACKET_ERR || (status == MYSQLD_PACKET_EOF && packet_len < PACKET_LEN_MAX)) return FALSE;
+
+	switch (con->parse.command) {
+	case COM_PROCESS_INFO:
+	case COM_QUERY:
+	case COM_STMT_EXECUTE:
+		query = con->parse.data;
+
+		if (!query || query->state != PARSE_COM_QUERY_RESULT) return FALSE;
+
+		query->rows++;
+		query->bytes += NET_HEADER_SIZE + packet_len;
+
+		return TRUE;
+#if MYSQL_VERSION_ID >= 50000
+	case COM_STMT_FETCH:
+		return TRUE;
+#endif
+	default:
+		return FALSE;
+	}
+}
+
+/**
+ * count the rows of a result-set that are complete in a buffer without parsing them
+ *
+ * jumps from header to header as long as the packets are rows with the next packet-id.
+ * It stops at the first packet that needs network_mysqld_proto_get_query_result(): the
+ * EOF, OK or ERR at the end, a packet of 0xffffff bytes, a packet-id out of sequence or a
+ * packet that continues after the buffer. The rows are counted like
+ * network_mysqld_proto_get_query_result() counts them.
+ *
+ * @param s              the packets, their packet-ids are rewritten in place
+ * @param len            bytes in s
+ * @param recv_packet_id the packet-id of the last received packet, moved to the last row
+ * @param send_packet_id the packet-id of the last sent packet, the rows continue it
+ * @return the bytes of the rows that were skipped
+ */
+gsize network_mysqld_proto_skip_query_result_rows(network_mysqld_con *con, gchar *s, gsize len, guint8 *recv_packet_id, guint8 *send_packet_id) {
+	network_mysqld_com_query_result_t *query;
+	const guchar *u = (const guchar *)s;
+	guint8 recv_id = *recv_packet_id;
+	guint8 send_id = *send_packet_id;
+	guint64 rows = 0;
+	gsize off = 0;
+
+	switch (con->parse.command) {
+	case COM_PROCESS_INFO:
+	case COM_QUERY:
+	case COM_STMT_EXECUTE:
+		break;
+	default:
+		return 0;
+	}
+
+	query = con->parse.data;
+	if (!query || query->state != PARSE_COM_QUERY_RESULT) return 0;
+
+	while (off + NET_HEADER_SIZE < len) {
+		guint32 packet_len = u[off] | (u[off + 1] << 8) | (u[off + 2] << 16);
+		guint8 status;
+
+		if (packet_len == 0 || packet_len == PACKET_LEN_MAX) break;
+		if (off + NET_HEADER_SIZE + packet_len > len) break;
+
+		/* a row only starts with 0xfe if it fills a packet of 0xffffff bytes */
+		status = u[off + NET_HEADER_SIZE];
+		if (status == MYSQLD_PACKET_EOF || status == MYSQLD_PACKET_ERR) break;
+
+		if (u[off + 3] != (guint8)(recv_id + 1)) break;
+		recv_id++;
+		send_id++;
+		if (u[off + 3] != send_id) s[off + 3] = send_id;
+
+		rows++;
+		off += NET_HEADER_SIZE + packet_len;
+	}
+
+	*recv_packet_id = recv_id;
+	*send_packet_id = send_id;
+
+	query->rows += rows;
+	query->bytes += off;
+
+	return off;
+}
+
+int network_mysqld_proto_get_fielddef(network_packet *packet, network_mysqld_proto_fielddef_t *field, guint32 capabilities) {
+	int err = 0;
+
+	if (capabilities & CLIENT_PROTOCOL_41) {
+		guint16 field_charsetnr;
+		guint32 field_length;
+		guint8 field_type;
+		guint16 field_flags;
+		guint8 field_decimals;
+
+		err = err || network_mysqld_proto_get_fielddef_string(packet, field, &field->catalog);
+		err = err || network_mysqld_proto_get_fielddef_string(packet, field, &field->db);
+		err = err || network_mysqld_proto_get_fielddef_string(packet, field, &field->table);
+		err = err || network_mysqld_proto_get_fielddef_string(packet, field, &field->org_table);
+		err = err || network_mysqld_proto_get_fielddef_string(packet, field, &field->name);
+		err = err || network_mysqld_proto_get_fielddef_string(packet, field, &field->org_name);
+        
+		err = err || network_mysqld_proto_skip(packet, 1); /* filler */
+        
+		err = err || network_mysqld_proto_get_int16(packet, &field_charsetnr);
+		err = err || network_mysqld_proto_get_int32(packet, &field_length);
+		err = err || network_mysqld_proto_get_int8(packet,  &field_type);
+		err = err || network_mysqld_proto_get_int16(packet, &field_flags);
+		err = err || network_mysqld_proto_get_int8(packet,  &field_decimals);
+        
+		err = err || network_mysqld_proto_skip(packet, 2); /* filler */
+		if (!err) {
+			field->charsetnr = field_charsetnr;
+			field->length    = field_length;
+			field->type      = field_type;
+			field->flags     = field_flags;
+			field->decimals  = field_decimals;
+		}
+	} else {
+		guint8 len;
+		guint32 field_length;
+		guint8  field_type;
+		guint8  field_decimals;
+
+		/* see protocol.cc Protocol::send_fields */
+
+		err = err || network_mysqld_proto_get_fielddef_string(packet, field, &field->table);
+		err = err || network_mysqld_proto_get_fielddef_string(packet, field, &field->name);
+		err = err || network_mysqld_proto_get_int8(packet, &len);
+		err = err || (len != 3);
+		err = err || network_mysqld_proto_get_int24(packet, &field_length);
+		err = err || network_mysqld_proto_get_int8(packet, &len);
+		err = err || (len != 1);
+		err = err || network_mysqld_proto_get_int8(packet, &field_type);
+		err = err || network_mysqld_proto_get_int8(packet, &len);
+		if (len == 3) { /* the CLIENT_LONG_FLAG is set */
+			guint16 field_flags;
+
+			err = err || network_mysqld_proto_get_int16(packet, &field_flags);
+
+			if (!err) field->flags = field_flags;
+		} else if (len == 2) {
+			guint8 field_flags;
+
+			err = err || network_mysqld_proto_get_int8(packet, &field_flags);
+
+			if (!err) field->flags = field_flags;
+		} else {
+			err = -1;
+		}
+		err = err || network_mysqld_proto_get_int8(packet, &field_decimals);
+
+		if (!err) {
+			field->charsetnr = 0x08 /* latin1_swedish_ci */;
+			field->length    = field_length;
+			field->type      = field_type;
+			field->decimals  = field_decimals;
+		}
+	}
+
+	return err ? -1 : 0;
+}
+
+/**
+ * words that make a SELECT depend on the session or the master
+ *
+ * - SELECT ... FOR UPDATE, ... LOCK IN SHARE MODE and ... INTO take locks or write
+ * - LAST_INSERT_ID() and FOUND_ROWS() need the connection of the previous statement
+ * - the lock functions are bound to the connection
+ */
+static const char *query_rw_words[] = {
+	"UPDATE",
+	"LOCK",
+	"INTO",
+	"LAST_INSERT_ID",
+	"FOUND_ROWS",
+	"SQL_CALC_FOUND_ROWS",
+	"GET_LOCK",
+	"RELEASE_LOCK",
+	"RELEASE_ALL_LOCKS",
+	"IS_FREE_LOCK",
+	"IS_USED_LOCK",
+	"MASTER_POS_WAIT",
+	NULL
+};
+
+/**
+ * skip white-space and comments
+ *
+ * version-comments are not skipped as they may contain anything
+ *
+ * @return the position of the next token, end if there is none
+ */
+const char *network_mysqld_proto_query_skip_space(const char *s, const char *end) {
+	while (s < end) {
+		if (g_ascii_isspace(*s)) {
+			s++;
+		} else if (*s == '#' ||
+		           (*s == '-' && s + 1 < end && s[1] == '-' && (s + 2 == end || g_ascii_isspace(s[2])))) {
+			while (s < end && *s != '\n') s++;
+		} else if (*s == '/' && s + 1 < end && s[1] == '*' && !(s + 2 < end && s[2] == '!')) {
+			for (s += 2; s < end && !(*s == '*' && s + 1 < end && s[1] == '/'); s++);
+			s += 2;
+		} else {
+			break;
+		}
+	}
+
+	return s < end ? s : end;
+}
+
+/**
+ * skip white-space, comments and opening parentheses
+ */
+static const char *query_skip_space(const char *s, const char *end) {
+	for (s = network_mysqld_proto_query_skip_space(s, end); s < end && *s == '('; ) {
+		s = network_mysqld_proto_query_skip_space(s + 1, end);
+	}
+
+	return s;
+}
+
+/**
+ * check if the char is part of a unquoted identifier or keyword
+ */
+gboolean network_mysqld_proto_query_is_word_char(char c) {
+	return g_ascii_isalnum(c) || c == '_' || c == '$';
+}
+
+/**
+ * scan the query for the words, session variables (@...), version-comments
+ * and multi-statements outside of quoted strings
+ *
+ * @return TRUE if we found one of them
+ */
+static gboolean query_scan_words(const char *s, const char *end, const char **words) {
+	const char *word;
+	char quote_char = 0;
+
+	while (s < end) {
+		if (quote_char) {
+			if (*s == '\\' && quote_char != '`') {
+				s += 2;
+			} else {
+				if (*s == quote_char) quote_char = 0;
+				s++;
+			}
+		} else if (*s == '\'' || *s == '"' || *s == '`') {
+			quote_char = *s++;
+		} else if (*s == '@') {
+			return TRUE;
+		} else if (*s == ';') {
+			/* a trailing ; is fine, a second statement isn't */
+			s = query_skip_space(s + 1, end);
+			if (s < end) return TRUE;
+		} else if (*s == '#' || *s == '-' || *s == '/') {
+			const char *next = query_skip_space(s, end);
+
+			if (next == s) {
+				/* an operator or a version-comment */
+				if (*s == '/' && s + 2 < end && s[1] == '*' && s[2] == '!') return TRUE;
+				s++;
+			} else {
+				s = next;
+			}
+		} else if (g_ascii_isalpha(*s) || *s == '_') {
+			gsize i;
+
+			for (word = s; s < end && network_mysqld_proto_query_is_word_char(*s); s++);
+
+			for (i = 0; words[i]; i++) {
+				if (strlen(words[i]) == (gsize)(s - word) &&
+				    0 == g_ascii_strncasecmp(word, words[i], s - word)) {
+					return TRUE;
+				}
+			}
+		} else if (network_mysqld_proto_query_is_word_char(*s)) {
+			/* numbers and the like */
+			for (; s < end && network_mysqld_proto_query_is_word_char(*s); s++);
+		} else {
+			s++;
+		}
+	}
+
+	return FALSE;
+}
+
+/**
+ * get the first word of the query
+ *
+ * @return the position after the word
+ */
+static const char *query_get_first_word(const char *query, const char *end, const char **word, gsize *word_len) {
+	const char *s;
+
+	s = query_skip_space(query, end);
+
+	for (*word = s; s < end && network_mysqld_proto_query_is_word_char(*s); s++);
+	*word_len = s - *word;
+
+	return s;
+}
+
+static gboolean query_word_is(const char *word, gsize word_len, const char *s) {
+	return strlen(s) == word_len && 0 == g_ascii_strncasecmp(word, s, word_len);
+}
+
+/**
+ * check if a query can be sent to a read-only backend
+ *
+ * only plain SELECTs qualify: we scan for the words in query_rw_words, session
+ * variables (@...), version-comments and multi-statements outside of quoted strings.
+ * The check is conservative, a SELECT that only mentions one of these words in a
+ * quoted identifier is still sent to a read-write backend.
+ *
+ * @param query     the query of a COM_QUERY without the command byte
+ * @param query_len length of the query
+ * @return NETWORK_MYSQLD_QUERY_RO if the query is a SELECT without side-effects,
+ *         NETWORK_MYSQLD_QUERY_RW otherwise
+ */
+network_mysqld_query_rw_type_t network_mysqld_proto_get_query_rw_type(const char *query, gsize query_len) {
+	const char *end = query + query_len;
+	const char *s;
+	const char *word;
+	gsize word_len;
+
+	s = query_get_first_word(query, end, &word, &word_len);
+	if (!query_word_is(word, word_len, "SELECT")) {
+		return NETWORK_MYSQLD_QUERY_RW;
+	}
+
+	return query_scan_words(s, end, query_rw_words) ? NETWORK_MYSQLD_QUERY_RW : NETWORK_MYSQLD_QUERY_RO;
+}
+
+/**
+ * statements that leave state on the connection
+ */
+static const char *query_session_first_words[] = {
+	"SET",
+	"USE",
+	"PREPARE",
+	"EXECUTE",
+	"DEALLOCATE",
+	"LOCK",
+	"HANDLER",
+	"XA",
+	NULL
+};
+
+/**
+ * words that leave state on the connection or need the state of the previous statement
+ */
+static const char *query_session_words[] = {
+	"TEMPORARY",
+	"LAST_INSERT_ID",
+	"FOUND_ROWS",
+	"SQL_CALC_FOUND_ROWS",
+	"GET_LOCK",
+	"RELEASE_LOCK",
+	"RELEASE_ALL_LOCKS",
+	"IS_FREE_LOCK",
+	"IS_USED_LOCK",
+	NULL
+};
+
+/**
+ * check if a query changes the state of the connection
+ *
+ * SET ..., USE, PREPARE, LOCK TABLES, temporary tables, user-level locks and session
+ * variables stay with the connection. Like network_mysqld_proto_get_query_rw_type()
+ * the check is conservative.
+ *
+ * @param query     the query of a COM_QUERY without the command byte
+ * @param query_len length of the query
+ * @return TRUE if the query has to stay on the connection it ran on
+ */
+gboolean network_mysqld_proto_query_has_session_state(const char *query, gsize query_len) {
+	const char *end = query + query_len;
+	const char *s;
+	const char *word;
+	gsize word_len;
+	gsize i;
+
+	s = query_get_first_word(query, end, &word, &word_len);
+
+	/* a version-comment or something we don't know */
+	if (word_len == 0) return TRUE;
+
+	for (i = 0; query_session_first_words[i]; i++) {
+		if (query_word_is(word, word_len, query_session_first_words[i])) return TRUE;
+	}
+
+	return query_scan_words(s, end, query_session_words);
+}
+
+/**
+ * the first words of the statement classes
+ */
+static const struct {
+	const char *word;
+	network_mysqld_query_class_t query_class;
+} query_class_words[] = {
+	{ "SELECT", NETWORK_MYSQLD_QUERY_CLASS_SELECT },
+	{ "INSERT", NETWORK_MYSQLD_QUERY_CLASS_INSERT },
+	{ "REPLACE", NETWORK_MYSQLD_QUERY_CLASS_INSERT },
+	{ "UPDATE", NETWORK_MYSQLD_QUERY_CLASS_UPDATE },
+	{ "DELETE", NETWORK_MYSQLD_QUERY_CLASS_DELETE },
+	{ "CREATE", NETWORK_MYSQLD_QUERY_CLASS_DDL },
+	{ "ALTER", NETWORK_MYSQLD_QUERY_CLASS_DDL },
+	{ "DROP", NETWORK_MYSQLD_QUERY_CLASS_DDL },
+	{ "TRUNCATE", NETWORK_MYSQLD_QUERY_CLASS_DDL },
+	{ "RENAME", NETWORK_MYSQLD_QUERY_CLASS_DDL },
+	{ "BEGIN", NETWORK_MYSQLD_QUERY_CLASS_TRANSACTION },
+	{ "START", NETWORK_MYSQLD_QUERY_CLASS_TRANSACTION },
+	{ "COMMIT", NETWORK_MYSQLD_QUERY_CLASS_TRANSACTION },
+	{ "ROLLBACK", NETWORK_MYSQLD_QUERY_CLASS_TRANSACTION },
+	{ "SAVEPOINT", NETWORK_MYSQLD_QUERY_CLASS_TRANSACTION },
+	{ "RELEASE", NETWORK_MYSQLD_QUERY_CLASS_TRANSACTION },
+	{ "SET", NETWORK_MYSQLD_QUERY_CLASS_SET },
+	{ "SHOW", NETWORK_MYSQLD_QUERY_CLASS_SHOW },
+	{ "DESCRIBE", NETWORK_MYSQLD_QUERY_CLASS_SHOW },
+	{ "DESC", NETWORK_MYSQLD_QUERY_CLASS_SHOW },
+	{ "EXPLAIN", NETWORK_MYSQLD_QUERY_CLASS_SHOW },
+	{ "CALL", NETWORK_MYSQLD_QUERY_CLASS_CALL },
+	{ NULL, NETWORK_MYSQLD_QUERY_CLASS_OTHER }
+};
+
+static const char *query_class_names[NETWORK_MYSQLD_QUERY_CLASS_MAX] = {
+	"other", "select", "insert", "update", "delete", "ddl", "transaction", "set", "show", "call"
+};
+
+/**
+ * get the class of a statement by its first word
+ *
+ * comments in front of the statement are skipped
+ *
+ * @param query     the query of a COM_QUERY without the command byte
+ * @param query_len length of the query
+ */
+network_mysqld_query_class_t network_mysqld_proto_get_query_class(const char *query, gsize query_len) {
+	const char *word;
+	gsize word_len;
+	gsize i;
+
+	query_get_first_word(query, query + query_len, &word, &word_len);
+
+	for (i = 0; query_class_words[i].word; i++) {
+		if (query_word_is(word, word_len, query_class_words[i].word)) return query_class_words[i].query_class;
+	}
+
+	return NETWORK_MYSQLD_QUERY_CLASS_OTHER;
+}
+
+const char *network_mysqld_query_class_get_name(network_mysqld_query_class_t query_class) {
+	if (query_class < 0 || query_class >= NETWORK_MYSQLD_QUERY_CLASS_MAX) return NULL;
+
+	return query_class_names[query_class];
+}
+
+/**
+ * get the class of a name of network_mysqld_query_class_get_name()
+ *
+ * @return the class, -1 if the name is unknown
+ */
+int network_mysqld_query_class_from_name(const char *name) {
+	int i;
+
+	for (i = 0; i < NETWORK_MYSQLD_QUERY_CLASS_MAX; i++) {
+		if (0 == g_ascii_strcasecmp(name, query_class_names[i])) return i;
+	}
+
+	return -1;
+}
+
+/**
+ * the names of the commands, indexed by the command-byte
+ */
+static const char *command_names[NETWORK_MYSQLD_COMMANDS + 1] = {
+	"sleep", "quit", "init_db", "query",
+	"field_list", "create_db", "drop_db", "refresh",
+	"shutdown", "statistics", "process_info", "connect",
+	"process_kill", "debug", "ping", "time",
+	"delayed_insert", "change_user", "binlog_dump", "table_dump",
+	"connect_out", "register_slave", "stmt_prepare", "stmt_execute",
+	"stmt_send_long_data", "stmt_close", "stmt_reset", "set_option",
+	"stmt_fetch", "daemon", "binlog_dump_gtid", "reset_connection",
+	"other"
+};
+
+/**
+ * get the name of a command-byte
+ *
+ * @return the name, "other" for the commands after COM_RESET_CONNECTION
+ */
+const char *network_mysqld_command_get_name(guint8 command) {
+	return command_names[MIN(command, NETWORK_MYSQLD_COMMANDS)];
+}
+
+/**
+ * get the command-byte of a name of network_mysqld_command_get_name()
+ *
+ * @return the command-byte, -1 if the name is unknown or "other"
+ */
+int network_mysqld_command_from_name(const char *name) {
+	int i;
+
+	for (i = 0; i < NETWORK_MYSQLD_COMMANDS; i++) {
+		if (0 == g_ascii_strcasecmp(name, command_names[i])) return i;
+	}
+
+	return -1;
+}
+
+network_mysqld_query_hints_t *network_mysqld_query_hints_new(void) {
+	network_mysqld_query_hints_t *hints;
+
+	hints = g_new0(network_mysqld_query_hints_t, 1);
+	hints->group = g_string_new(NULL);
+	hints->traceparent = g_string_new(NULL);
+	network_mysqld_query_hints_reset(hints);
+
+	return hints;
+}
+
+void network_mysqld_query_hints_free(network_mysqld_query_hints_t *hints) {
+	if (!hints) return;
+
+	g_string_free(hints->group, TRUE);
+	g_string_free(hints->traceparent, TRUE);
+
+	g_free(hints);
+}
+
+void network_mysqld_query_hints_reset(network_mysqld_query_hints_t *hints) {
+	hints->route = NETWORK_MYSQLD_QUERY_HINT_ROUTE_DEFAULT;
+	g_string_truncate(hints->group, 0);
+	hints->cache_ttl_ms = -1;
+	hints->timeout_ms = 0;
+	g_string_truncate(hints->traceparent, 0);
+}
+
+/**
+ * parse a duration like "30", "2s", "1.5s" or "500ms"
+ *
+ * a number without a unit is in seconds
+ *
+ * @return TRUE if the duration parsed
+ */
+static gboolean query_hint_get_msec(const char *value, gsize value_len, guint64 *msec) {
+	gchar *s;
+	gchar *unit = NULL;
+	gdouble d;
+	gboolean ok = TRUE;
+
+	if (NULL == value || 0 == value_len) return FALSE;
+
+	s = g_strndup(value, value_len);
+	d = g_ascii_strtod(s, &unit);
+
+	if (unit == s || d < 0 || d > G_MAXINT) {
+		ok = FALSE;
+	} else if (*unit == '\0' || 0 == g_ascii_strcasecmp(unit, "s")) {
+		*msec = (guint64)(d * 1000.0 + 0.5);
+	} else if (0 == g_ascii_strcasecmp(unit, "ms")) {
+		*msec = (guint64)(d + 0.5);
+	} else {
+		ok = FALSE;
+	}
+	g_free(s);
+
+	return ok;
+}
+
+/**
+ * apply a <key>[=<value>] of the hint comment
+ *
+ * unknown keys and values that don't parse are ignored, an old proxy runs
+ * the queries of a newer application as if they had no hints
+ */
+static void query_hint_set(network_mysqld_query_hints_t *hints, const char *key, gsize key_len, const char *value, gsize value_len) {
+	guint64 msec;
+
+	if (query_word_is(key, key_len, "ro")) {
+		hints->route = NETWORK_MYSQLD_QUERY_HINT_ROUTE_RO;
+	} else if (query_word_is(key, key_len, "rw")) {
+		hints->route = NETWORK_MYSQLD_QUERY_HINT_ROUTE_RW;
+	} else if (query_word_is(key, key_len, "group") && value_len > 0) {
+		g_string_assign_len(hints->group, value, value_len);
+	} else if (query_word_is(key, key_len, "nocache")) {
+		hints->cache_ttl_ms = 0;
+	} else if (query_word_is(key, key_len, "cache_ttl") && query_hint_get_msec(value, value_len, &msec)) {
+		hints->cache_ttl_ms = msec;
+	} else if (query_word_is(key, key_len, "timeout") && query_hint_get_msec(value, value_len, &msec)) {
+		hints->timeout_ms = msec;
+	} else if (query_word_is(key, key_len, "traceparent") && value_len > 0) {
+		g_string_assign_len(hints->traceparent, value, value_len);
+	} else {
+		g_debug("%s: ignoring the query hint '%.*s'", G_STRLOC, (int)key_len, key);
+	}
+}
+
+static gboolean query_hint_is_key_char(char c) {
+	return g_ascii_isalnum(c) || c == '_' || c == '-';
+}
+
+/**
+ * get the hints of the /\*proxy: ... *\/ comment a query starts with
+ *
+ * the comment holds a list of <key>[=<value>], separated by commas or white-space:
+ *
+ * - ro: the query may run on a read-only backend and see stale data
+ * - rw: the query has to run on the read-write backend
+ * - group=<name>: run it on a backend of the group
+ * - cache_ttl=<duration>: serve the result from the query-cache for that long, 0 to not cache it
+ * - nocache: the same as cache_ttl=0
+ * - timeout=<duration>: KILL the query on the backend after that long
+ * - traceparent=<trace-context>: the W3C trace-context of the client, see --proxy-trace-address
+ *
+ * a duration is in seconds, or in milliseconds with a "ms" suffix. The comment is left in
+ * the query, the server ignores it.
+ *
+ * @param query     the query of a COM_QUERY without the command byte
+ * @param query_len length of the query
+ * @param hints     reset and set to the hints of the query
+ * @return TRUE if the query starts with a hint comment
+ */
+gboolean network_mysqld_proto_get_query_hints(const char *query, gsize query_len, network_mysqld_query_hints_t *hints) {
+	const char *end = query + query_len;
+	const char *s = query;
+	const char *hints_end;
+
+	network_mysqld_query_hints_reset(hints);
+
+	while (s < end && g_ascii_isspace(*s)) s++;
+
+	if ((gsize)(end - s) < sizeof("/*proxy:") - 1 ||
+	    0 != g_ascii_strncasecmp(s, "/*proxy:", sizeof("/*proxy:") - 1)) {
+		return FALSE;
+	}
+	s += sizeof("/*proxy:") - 1;
+
+	for (hints_end = s; hints_end + 1 < end && !(hints_end[0] == '*' && hints_end[1] == '/'); hints_end++);
+	if (hints_end + 1 >= end) return FALSE; /* not terminated */
+
+	network_mysqld_query_hints_parse(hints, s, hints_end - s);
+
+	return TRUE;
+}
+
+/**
+ * apply a list of <key>[=<value>] like in the hint comment to the hints
+ *
+ * the hints that aren't in the list stay as they are
+ *
+ * @see network_mysqld_proto_get_query_hints()
+ */
+void network_mysqld_query_hints_parse(network_mysqld_query_hints_t *hints, const char *s, gsize len) {
+	const char *hints_end = s + len;
+
+	while (s < hints_end) {
+		const char *key, *value = NULL;
+		gsize key_len, value_len = 0;
+
+		if (g_ascii_isspace(*s) || *s == ',') {
+			s++;
+			continue;
+		}
+
+		for (key = s; s < hints_end && query_hint_is_key_char(*s); s++);
+		key_len = s - key;
+
+		while (s < hints_end && g_ascii_isspace(*s)) s++;
+
+		if (s < hints_end && *s == '=') {
+			for (s++; s < hints_end && g_ascii_isspace(*s); s++);
+			for (value = s; s < hints_end && *s != ',' && !g_ascii_isspace(*s); s++);
+			value_len = s - value;
+		}
+
+		if (key_len == 0) {
+			/* a char we don't expect, skip it */
+			if (value == NULL) s++;
+			continue;
+		}
+
+		query_hint_set(hints, key, key_len, value, value_len);
+	}
+}
+
+/**
+ * split the query into tokens
+ *
+ * words and the other chars are lower-cased tokens, quoted strings are one token and
+ * kept as they are. A trailing ; is removed.
+ *
+ * @param tokens gets the tokens as gchar *, free them with query_tokens_free()
+ * @return FALSE if the query has comments or a multi-statement
+ */
+static gboolean query_get_tokens(const char *s, const char *end, GPtrArray *tokens) {
+	guint i;
+
+	while (s < end) {
+		const char *token = s;
+
+		if (g_ascii_isspace(*s)) {
+			s++;
+			continue;
+		}
+
+		if (*s == '#' ||
+		    (*s == '-' && s + 1 < end && s[1] == '-') ||
+		    (*s == '/' && s + 1 < end && s[1] == '*')) {
+			return FALSE;
+		}
+
+		if (*s == '\'' || *s == '"' || *s == '`') {
+			char quote_char = *s++;
+
+			for (; s < end && *s != quote_char; s++) {
+				if (*s == '\\' && quote_char != '`') s++;
+			}
+			if (s >= end) return FALSE;
+			s++;
+
+			g_ptr_array_add(tokens, g_strndup(token, s - token));
+			continue;
+		}
+
+		if (network_mysqld_proto_query_is_word_char(*s)) {
+			for (; s < end && network_mysqld_proto_query_is_word_char(*s); s++);
+		} else {
+			s++;
+		}
+
+		g_ptr_array_add(tokens, g_ascii_strdown(token, s - token));
+	}
+
+	if (tokens->len > 0 && 0 == strcmp(tokens->pdata[tokens->len - 1], ";")) {
+		g_free(g_ptr_array_remove_index(tokens, tokens->len - 1));
+	}
+
+	for (i = 0; i < tokens->len; i++) {
+		if (0 == strcmp(tokens->pdata[i], ";")) return FALSE;
+	}
+
+	return TRUE;
+}
+
+static void query_tokens_free(GPtrArray *tokens) {
+	guint i;
+
+	for (i = 0; i < tokens->len; i++) {
+		g_free(tokens->pdata[i]);
+	}
+
+	g_ptr_array_free(tokens, TRUE);
+}
+
+/**
+ * the query as tokens, separated by a single space
+ *
+ * @see query_get_tokens()
+ */
+static gboolean query_normalize(const char *s, const char *end, GString *norm) {
+	GPtrArray *tokens = g_ptr_array_new();
+	gboolean is_valid;
+	guint i;
+
+	is_valid = query_get_tokens(s, end, tokens);
+
+	for (i = 0; i < tokens->len; i++) {
+		if (i > 0) g_string_append_c(norm, ' ');
+		g_string_append(norm, tokens->pdata[i]);
+	}
+
+	query_tokens_free(tokens);
+
+	return is_valid;
+}
+
+/**
+ * the ways to set the autocommit of the session, as normalized by query_normalize()
+ */
+static const char *query_set_autocommit_prefixes[] = {
+	"set autocommit = ",
+	"set session autocommit = ",
+	"set local autocommit = ",
+	"set @ @ autocommit = ",
+	"set @ @ session . autocommit = ",
+	"set @ @ local . autocommit = ",
+	NULL
+};
+
+/**
+ * check if the proxy can answer a query without the backend, see network_mysqld_query_trivial_type_t
+ *
+ * @param query     the query of a COM_QUERY without the command byte
+ * @param query_len length of the query
+ * @param names     gets the charset (and collation) of a SET NAMES as a normalized string, may be NULL
+ */
+network_mysqld_query_trivial_type_t network_mysqld_proto_get_query_trivial_type(const char *query, gsize query_len, GString *names) {
+	network_mysqld_query_trivial_type_t trivial_type = NETWORK_MYSQLD_QUERY_TRIVIAL_NONE;
+	GString *norm = g_string_sized_new(query_len);
+	gsize i;
+
+	if (!query_normalize(query, query + query_len, norm)) {
+		/* keep it as it is */
+	} else if (0 == strcmp(norm->str, "select @ @ version_comment limit 1")) {
+		trivial_type = NETWORK_MYSQLD_QUERY_TRIVIAL_VERSION_COMMENT;
+	} else if (g_str_has_prefix(norm->str, "set names ")) {
+		/* SET NAMES utf8, autocommit = 0 sets more than the names */
+		if (NULL == strchr(norm->str, ',')) {
+			trivial_type = NETWORK_MYSQLD_QUERY_TRIVIAL_SET_NAMES;
+			if (names) {
+				g_string_assign(names, norm->str + sizeof("set names ") - 1);
+				g_string_ascii_down(names);
+			}
+		}
+	} else {
+		for (i = 0; query_set_autocommit_prefixes[i]; i++) {
+			const char *value;
+
+			if (!g_str_has_prefix(norm->str, query_set_autocommit_prefixes[i])) continue;
+
+			value = norm->str + strlen(query_set_autocommit_prefixes[i]);
+			if (0 == strcmp(value, "1") || 0 == strcmp(value, "on") || 0 == strcmp(value, "true")) {
+				trivial_type = NETWORK_MYSQLD_QUERY_TRIVIAL_SET_AUTOCOMMIT_ON;
+			}
+			break;
+		}
+	}
+
+	g_string_free(norm, TRUE);
+
+	return trivial_type;
+}
+
+/**
+ * the session variables we don't track
+ *
+ * the pool matches the autocommit and the charset of the login already, the others
+ * only apply to the next statement or the binlog
+ */
+static const char *query_session_var_untracked_prefixes[] = {
+	"autocommit",
+	"character_set_",
+	"collation_",
+	"insert_id",
+	"last_insert_id",
+	"identity",
+	"timestamp",
+	"rand_seed",
+	"pseudo_",
+	"gtid_next",
+	NULL
+};
+
+#define QUERY_TOKEN(tokens, n) ((n) < (tokens)->len ? (const char *)(tokens)->pdata[n] : "")
+
+/**
+ * parse the assignment of a session variable in a SET
+ *
+ * [SESSION | LOCAL | @@ | @@SESSION. | @@LOCAL.]name = [-|+]literal
+ *
+ * @return the index of the token after the assignment, 0 if we don't track it
+ */
+static guint query_parse_session_var(GPtrArray *tokens, guint i, GHashTable *vars) {
+	const char *name;
+	const char *literal;
+	GString *value;
+	guint j;
+
+	if (0 == strcmp(QUERY_TOKEN(tokens, i), "@")) {
+		/* user-variables stay with the connection */
+		if (0 != strcmp(QUERY_TOKEN(tokens, i + 1), "@")) return 0;
+		i += 2;
+
+		if ((0 == strcmp(QUERY_TOKEN(tokens, i), "session") || 0 == strcmp(QUERY_TOKEN(tokens, i), "local")) &&
+		    0 == strcmp(QUERY_TOKEN(tokens, i + 1), ".")) {
+			i += 2;
+		}
+	} else if (0 == strcmp(QUERY_TOKEN(tokens, i), "session") || 0 == strcmp(QUERY_TOKEN(tokens, i), "local")) {
+		i++;
+	}
+
+	/* GLOBAL x = ... and @@global.x = ... fail here as the name is followed by another word or a . */
+	name = QUERY_TOKEN(tokens, i++);
+	if (!network_mysqld_proto_query_is_word_char(name[0]) || g_ascii_isdigit(name[0])) return 0;
+
+	for (j = 0; query_session_var_untracked_prefixes[j]; j++) {
+		if (g_str_has_prefix(name, query_session_var_untracked_prefixes[j])) return 0;
+	}
+
+	if (0 != strcmp(QUERY_TOKEN(tokens, i++), "=")) return 0;
+
+	value = g_string_new(NULL);
+
+	if (0 == strcmp(QUERY_TOKEN(tokens, i), "-") || 0 == strcmp(QUERY_TOKEN(tokens, i), "+")) {
+		g_string_append(value, QUERY_TOKEN(tokens, i++));
+	}
+
+	/* a number, a keyword like ON or DEFAULT or a string, but no expression */
+	literal = QUERY_TOKEN(tokens, i++);
+	if (!network_mysqld_proto_query_is_word_char(literal[0]) && literal[0] != '\'' && literal[0] != '"') {
+		g_string_free(value, TRUE);
+		return 0;
+	}
+	g_string_append(value, literal);
+
+	/* the fraction of a decimal */
+	if (0 == strcmp(QUERY_TOKEN(tokens, i), ".") && g_ascii_isdigit(QUERY_TOKEN(tokens, i + 1)[0])) {
+		g_string_append_c(value, '.');
+		g_string_append(value, QUERY_TOKEN(tokens, i + 1));
+		i += 2;
+	}
+
+	if (i < tokens->len && 0 != strcmp(QUERY_TOKEN(tokens, i), ",")) {
+		g_string_free(value, TRUE);
+		return 0;
+	}
+
+	if (vars) {
+		g_hash_table_insert(vars, g_strdup(name), g_string_free(value, FALSE));
+	} else {
+		g_string_free(value, TRUE);
+	}
+
+	return i;
+}
+
+/**
+ * get the session variables a SET assigns
+ *
+ * only SETs that assign literals to session variables qualify: a user-variable, a
+ * GLOBAL variable, an expression or a variable of query_session_var_untracked_prefixes
+ * fails the whole statement.
+ *
+ * @param query     the query of a COM_QUERY without the command byte
+ * @param query_len length of the query
+ * @param vars      gets the lower-cased name -> value as g_strdup()ed strings, values
+ *                  of strings keep their quotes. Only changed if TRUE is returned, may be NULL
+ * @return TRUE if the query is a SET of session variables we can track
+ */
+gboolean network_mysqld_proto_get_query_session_vars(const char *query, gsize query_len, GHashTable *vars) {
+	const char *word;
+	gsize word_len;
+	GPtrArray *tokens;
+	GHashTable *parsed;
+	gboolean is_tracked = FALSE;
+	guint i;
+
+	/* don't tokenize the queries that aren't a SET */
+	query_get_first_word(query, query + query_len, &word, &word_len);
+	if (!query_word_is(word, word_len, "SET")) return FALSE;
+
+	tokens = g_ptr_array_new();
+	parsed = g_hash_table_new_full(g_str_hash, g_str_equal, g_free, g_free);
+
+	if (query_get_tokens(query, query + query_len, tokens) && tokens->len > 1) {
+		for (i = 1; 0 != (i = query_parse_session_var(tokens, i, parsed)); i++) {
+			if (i == tokens->len) {
+				is_tracked = TRUE;
+				break;
+			}
+		}
+	}
+
+	if (is_tracked && vars) {
+		GHashTableIter iter;
+		gpointer name, value;
+
+		g_hash_table_iter_init(&iter, parsed);
+		while (g_hash_table_iter_next(&iter, &name, &value)) {
+			g_hash_table_insert(vars, g_strdup(name), g_strdup(value));
+		}
+	}
+
+	g_hash_table_destroy(parsed);
+	query_tokens_free(tokens);
+
+	return is_tracked;
+}
+
+/**
+ * check if a SET may change the charset of the session
+ *
+ * SET NAMES, SET CHARACTER SET and the character_set_* and collation_* variables qualify.
+ * A SET we can't split into tokens is assumed to change it.
+ *
+ * @param query     the query of a COM_QUERY without the command byte
+ * @param query_len length of the query
+ * @return TRUE if the query is a SET that may change the charset
+ */
+gboolean network_mysqld_proto_query_sets_charset(const char *query, gsize query_len) {
+	const char *word;
+	gsize word_len;
+	GPtrArray *tokens;
+	gboolean sets_charset;
+	guint i;
+
+	query_get_first_word(query, query + query_len, &word, &word_len);
+	if (!query_word_is(word, word_len, "SET")) return FALSE;
+
+	tokens = g_ptr_array_new();
 
-	return is_finished;
-}
+	sets_charset = !query_get_tokens(query, query + query_len, tokens);
 
-int network_mysqld_proto_get_fielddef(network_packet *packet, network_mysqld_proto_fielddef_t *field, guint32 capabilities) {
-	int err = 0;
+	for (i = 1; !sets_charset && i < tokens->len; i++) {
+		const char *token = tokens->pdata[i];
 
-	if (capabilities & CLIENT_PROTOCOL_41) {
-		guint16 field_charsetnr;
-		guint32 field_length;
-		guint8 field_type;
-		guint16 field_flags;
-		guint8 field_decimals;
+		/* a user-variable, but not a @@system-variable */
+		if (0 == strcmp(tokens->pdata[i - 1], "@") && (i < 2 || 0 != strcmp(tokens->pdata[i - 2], "@"))) continue;
 
-		err = err || network_mysqld_proto_get_lenenc_string(packet, &field->catalog, NULL);
-		err = err || network_mysqld_proto_get_lenenc_string(packet, &field->db, NULL);
-		err = err || network_mysqld_proto_get_lenenc_string(packet, &field->table, NULL);
-		err = err || network_mysqld_proto_get_lenenc_string(packet, &field->org_table, NULL);
-		err = err || network_mysqld_proto_get_lenenc_string(packet, &field->name, NULL);
-		err = err || network_mysqld_proto_get_lenenc_string(packet, &field->org_name, NULL);
-        
-		err = err || network_mysqld_proto_skip(packet, 1); /* filler */
-        
-		err = err || network_mysqld_proto_get_int16(packet, &field_charsetnr);
-		err = err || network_mysqld_proto_get_int32(packet, &field_length);
-		err = err || network_mysqld_proto_get_int8(packet,  &field_type);
-		err = err || network_mysqld_proto_get_int16(packet, &field_flags);
-		err = err || network_mysqld_proto_get_int8(packet,  &field_decimals);
-        
-		err = err || network_mysqld_proto_skip(packet, 2); /* filler */
-		if (!err) {
-			field->charsetnr = field_charsetnr;
-			field->length    = field_length;
-			field->type      = field_type;
-			field->flags     = field_flags;
-			field->decimals  = field_decimals;
-		}
-	} else {
-		guint8 len;
-		guint32 field_length;
-		guint8  field_type;
-		guint8  field_decimals;
+		sets_charset = 0 == strcmp(token, "names") ||
+			0 == strcmp(token, "character") ||
+			0 == strcmp(token, "charset") ||
+			g_str_has_prefix(token, "character_set_") ||
+			g_str_has_prefix(token, "collation_");
+	}
 
-		/* see protocol.cc Protocol::send_fields */
+	query_tokens_free(tokens);
 
-		err = err || network_mysqld_proto_get_lenenc_string(packet, &field->table, NULL);
-		err = err || network_mysqld_proto_get_lenenc_string(packet, &field->name, NULL);
-		err = err || network_mysqld_proto_get_int8(packet, &len);
-		err = err || (len != 3);
-		err = err || network_mysqld_proto_get_int24(packet, &field_length);
-		err = err || network_mysqld_proto_get_int8(packet, &len);
-		err = err || (len != 1);
-		err = err || network_mysqld_proto_get_int8(packet, &field_type);
-		err = err || network_mysqld_proto_get_int8(packet, &len);
-		if (len == 3) { /* the CLIENT_LONG_FLAG is set */
-			guint16 field_flags;
+	return sets_charset;
+}
 
-			err = err || network_mysqld_proto_get_int16(packet, &field_flags);
+/**
+ * find the end of the field-defs
+ *
+ * @param chunk the last field-def
+ */
+static GList *network_mysqld_proto_get_fielddefs_end(GList *chunk) {
+	network_packet packet;
+	network_mysqld_lenenc_type lenenc_type;
+	int err = 0;
 
-			if (!err) field->flags = field_flags;
-		} else if (len == 2) {
-			guint8 field_flags;
+	/* this should be EOF chunk, or the first row if CLIENT_DEPRECATE_EOF is used */
+	if (!chunk->next) return NULL;
 
-			err = err || network_mysqld_proto_get_int8(packet, &field_flags);
+	packet.data = chunk->next->data;
+	packet.offset = 0;
+	
+	err = err || network_mysqld_proto_skip_network_header(&packet);
 
-			if (!err) field->flags = field_flags;
-		} else {
-			err = -1;
-		}
-		err = err || network_mysqld_proto_get_int8(packet, &field_decimals);
+	err = err || network_mysqld_proto_peek_lenenc_type(&packet, &lenenc_type);
 
-		if (!err) {
-			field->charsetnr = 0x08 /* latin1_swedish_ci */;
-			field->length    = field_length;
-			field->type      = field_type;
-			field->decimals  = field_decimals;
-		}
-	}
+	if (err) return NULL;
 
-	return err ? -1 : 0;
+	/* a EOF that nothing follows is the OK that ends a result-set without rows */
+	if (lenenc_type == NETWORK_MYSQLD_LENENC_TYPE_EOF && chunk->next->next) {
+		return chunk->next;
+	}
+    
+	return chunk;
 }
 
 /**
@@ -813,10 +1914,17 @@ int network_mysqld_proto_get_fielddef(network_packet *packet, network_mysqld_pro
  * @param chunk  list of mysql packets 
  * @param fields empty array where the fields shall be stored in
  *
+ * the fields and their strings are put into one arena, network_mysqld_proto_fielddefs_free()
+ * frees it with the last field
+ *
  * @return NULL if there is no resultset
- *         pointer to the chunk after the fields (to the EOF packet)
+ *         pointer to the chunk after the fields (to the EOF packet), or the last
+ *         field-def if CLIENT_DEPRECATE_EOF is used
  */ 
 GList *network_mysqld_proto_get_fielddefs(GList *chunk, GPtrArray *fields) {
+	network_mysqld_proto_fielddefs_arena_t *arena;
+	gsize arena_size;
+	GList *next;
 	network_packet packet;
 	guint64 field_count;
 	guint i;
@@ -851,6 +1959,13 @@ GList *network_mysqld_proto_get_fielddefs(GList *chunk, GPtrArray *fields) {
 		return NULL;
 	}
     
+	/* the fields and their strings fit into the bytes of the field-defs */
+	arena_size = 0;
+	for (i = 0, next = chunk->next; i < field_count && next; i++, next = next->next) {
+		arena_size += sizeof(network_mysqld_proto_fielddef_t) + ((GString *)next->data)->len;
+	}
+	arena = network_mysqld_proto_fielddefs_arena_new(arena_size);
+
 	/* the next chunk, the field-def */
 	for (i = 0; i < field_count; i++) {
 		network_mysqld_proto_fielddef_t *field;
@@ -861,32 +1976,200 @@ GList *network_mysqld_proto_get_fielddefs(GList *chunk, GPtrArray *fields) {
 		packet.data = chunk->data;
 		packet.offset = 0;
 
-		field = network_mysqld_proto_fielddef_new();
+		field = network_mysqld_proto_fielddef_new_in(arena);
 
 		err = err || network_mysqld_proto_skip_network_header(&packet);
 		err = err || network_mysqld_proto_get_fielddef(&packet, field, capabilities);
 
 		g_ptr_array_add(fields, field); /* even if we had an error, append it so that we can free it later */
 
-		if (err) return NULL;
+		if (err) break;
 	}
-    
-	/* this should be EOF chunk */
-	chunk = chunk->next;
 
-	if (!chunk) return NULL;
+	/* the fields hold the arena now */
+	network_mysqld_proto_fielddefs_arena_unref(arena);
+
+	if (err) return NULL;
+
+	return network_mysqld_proto_get_fielddefs_end(chunk);
+}
+
+/**
+ * skip the field-defs of a result-set we already know the fields of
+ *
+ * @param chunk       the field-count packet of the result-set
+ * @param field_count the number of fields
+ * @return the same as network_mysqld_proto_get_fielddefs()
+ */
+GList *network_mysqld_proto_skip_fielddefs(GList *chunk, guint field_count) {
+	guint i;
+
+	if (field_count == 0) return NULL;
+
+	for (i = 0; i < field_count; i++) {
+		chunk = chunk->next;
+
+		if (!chunk) return NULL;
+	}
+
+	return network_mysqld_proto_get_fielddefs_end(chunk);
+}
+
+
+/**
+ * get the value of a column in the first row of a resultset
+ *
+ * @param chunk   the first packet of the resultset
+ * @param name    name of the column
+ * @param value   the value of the column, NULL if it is NULL or if there is no row. Free it with g_free()
+ * @param has_row FALSE if the resultset has no rows
+ * @return 0 on success, -1 if the resultset is invalid or has no such column
+ */
+static int network_mysqld_proto_get_first_row_value(GList *chunk, const char *name, gchar **value, gboolean *has_row) {
+	network_mysqld_proto_fielddefs_t *fields;
+	network_mysqld_lenenc_type lenenc_type;
+	network_packet packet;
+	guint ndx = G_MAXUINT;
+	guint i;
+	int err = 0;
+
+	*value = NULL;
+	*has_row = FALSE;
+
+	fields = network_mysqld_proto_fielddefs_new();
+
+	if (NULL == (chunk = network_mysqld_proto_get_fielddefs(chunk, fields))) {
+		network_mysqld_proto_fielddefs_free(fields);
+		return -1;
+	}
+
+	for (i = 0; i < fields->len; i++) {
+		network_mysqld_proto_fielddef_t *field = fields->pdata[i];
+
+		if (field->name && 0 == strcmp(field->name, name)) {
+			ndx = i;
+			break;
+		}
+	}
+	network_mysqld_proto_fielddefs_free(fields);
+
+	if (ndx == G_MAXUINT) return -1;
+
+	/* the first row, the EOF if there is none */
+	if (NULL == (chunk = chunk->next)) return -1;
 
 	packet.data = chunk->data;
 	packet.offset = 0;
-	
-	err = err || network_mysqld_proto_skip_network_header(&packet);
 
+	err = err || network_mysqld_proto_skip_network_header(&packet);
 	err = err || network_mysqld_proto_peek_lenenc_type(&packet, &lenenc_type);
-	err = err || (lenenc_type != NETWORK_MYSQLD_LENENC_TYPE_EOF);
+	if (err) return -1;
 
-	if (err) return NULL;
-    
-	return chunk;
+	if (lenenc_type == NETWORK_MYSQLD_LENENC_TYPE_EOF) return 0;
+
+	*has_row = TRUE;
+
+	for (i = 0; !err && i <= ndx; i++) {
+		guint64 field_len;
+
+		err = err || network_mysqld_proto_peek_lenenc_type(&packet, &lenenc_type);
+		if (err) break;
+
+		switch (lenenc_type) {
+		case NETWORK_MYSQLD_LENENC_TYPE_NULL:
+			err = err || network_mysqld_proto_skip(&packet, 1);
+			break;
+		case NETWORK_MYSQLD_LENENC_TYPE_INT:
+			err = err || network_mysqld_proto_get_lenenc_int(&packet, &field_len);
+			err = err || !(packet.offset + field_len <= packet.data->len);
+			if (err) break;
+
+			if (i == ndx) {
+				err = err || network_mysqld_proto_get_string_len(&packet, value, field_len);
+			} else {
+				err = err || network_mysqld_proto_skip(&packet, field_len);
+			}
+			break;
+		default:
+			err = 1;
+			break;
+		}
+	}
+
+	if (err && *value) {
+		g_free(*value);
+		*value = NULL;
+	}
+
+	return err ? -1 : 0;
+}
+
+/**
+ * get the Seconds_Behind_Master from the result of a SHOW SLAVE STATUS
+ *
+ * @param chunk  the first packet of the resultset
+ * @param lag    the lag in seconds, -1 if the slave isn't replicating (NULL) and 0 if the server isn't a slave
+ * @return 0 on success, -1 if the resultset is invalid or has no Seconds_Behind_Master
+ */
+int network_mysqld_proto_get_slave_lag(GList *chunk, gint *lag) {
+	gchar *value;
+	gboolean has_row;
+
+	if (0 != network_mysqld_proto_get_first_row_value(chunk, "Seconds_Behind_Master", &value, &has_row)) return -1;
+
+	if (!has_row) {
+		*lag = 0;
+	} else if (NULL == value) {
+		*lag = -1;
+	} else {
+		guint64 secs = g_ascii_strtoull(value, NULL, 10);
+
+		*lag = MIN(secs, G_MAXINT);
+		g_free(value);
+	}
+
+	return 0;
+}
+
+/**
+ * get a binlog position from the result of a SHOW MASTER STATUS or SHOW SLAVE STATUS
+ *
+ * the position is (sequence number of the binlog-file << 32 | offset in the file) which
+ * orders the positions of the same master like the events in its binlogs
+ *
+ * @param chunk      the first packet of the resultset
+ * @param file_field the column with the binlog-file, like File or Relay_Master_Log_File
+ * @param pos_field  the column with the offset, like Position or Exec_Master_Log_Pos
+ * @param pos        the binlog position
+ * @return 0 on success, -1 if the resultset is invalid, has no rows (no binlog or not a slave) or the position is unknown
+ */
+int network_mysqld_proto_get_binlog_pos(GList *chunk, const char *file_field, const char *pos_field, guint64 *pos) {
+	gchar *file, *offset;
+	const gchar *seq;
+	gboolean has_row;
+	guint64 file_seq, file_offset;
+
+	if (0 != network_mysqld_proto_get_first_row_value(chunk, file_field, &file, &has_row)) return -1;
+	if (NULL == file) return -1;
+
+	if (0 != network_mysqld_proto_get_first_row_value(chunk, pos_field, &offset, &has_row) || NULL == offset) {
+		g_free(file);
+		return -1;
+	}
+
+	/* mysql-bin.000042 */
+	seq = strrchr(file, '.');
+	file_seq = seq ? g_ascii_strtoull(seq + 1, NULL, 10) : 0;
+	file_offset = g_ascii_strtoull(offset, NULL, 10);
+
+	g_free(file);
+	g_free(offset);
+
+	if (file_seq > G_MAXUINT32 || file_offset > G_MAXUINT32) return -1;
+
+	*pos = (file_seq << 32) | file_offset;
+
+	return 0;
 }
 
 network_mysqld_ok_packet_t *network_mysqld_ok_packet_new() {
@@ -903,11 +2186,10 @@ void network_mysqld_ok_packet_free(network_mysqld_ok_packet_t *ok_packet) {
 	g_free(ok_packet);
 }
 
-
 /**
- * decode a OK packet from the network packet
+ * get a OK packet that starts with the header <header>
  */
-int network_mysqld_proto_get_ok_packet(network_packet *packet, network_mysqld_ok_packet_t *ok_packet) {
+static int network_mysqld_proto_get_ok_packet_header(network_packet *packet, network_mysqld_ok_packet_t *ok_packet, guint8 header) {
 	guint8 field_count;
 	guint64 affected, insert_id;
 	guint16 server_status, warning_count = 0;
@@ -918,9 +2200,10 @@ int network_mysqld_proto_get_ok_packet(network_packet *packet, network_mysqld_ok
 	err = err || network_mysqld_proto_get_int8(packet, &field_count);
 	if (err) return -1;
 
-	if (field_count != 0) {
-		g_critical("%s: expected the first byte to be 0, got %d",
+	if (field_count != header) {
+		g_critical("%s: expected the first byte to be %d, got %d",
 				G_STRLOC,
+				header,
 				field_count);
 		return -1;
 	}
@@ -942,6 +2225,22 @@ int network_mysqld_proto_get_ok_packet(network_packet *packet, network_mysqld_ok
 	return err ? -1 : 0;
 }
 
+/**
+ * decode a OK packet from the network packet
+ */
+int network_mysqld_proto_get_ok_packet(network_packet *packet, network_mysqld_ok_packet_t *ok_packet) {
+	return network_mysqld_proto_get_ok_packet_header(packet, ok_packet, 0);
+}
+
+/**
+ * get the OK packet that ends the rows of a result-set if CLIENT_DEPRECATE_EOF is used
+ *
+ * it has the 0xfe header of the EOF packet it replaces
+ */
+int network_mysqld_proto_get_eof_ok_packet(network_packet *packet, network_mysqld_ok_packet_t *ok_packet) {
+	return network_mysqld_proto_get_ok_packet_header(packet, ok_packet, MYSQLD_PACKET_EOF);
+}
+
 int network_mysqld_proto_append_ok_packet(GString *packet, network_mysqld_ok_packet_t *ok_packet) {
 	guint32 capabilities = CLIENT_PROTOCOL_41;
 
@@ -1429,6 +2728,43 @@ void network_mysqld_auth_response_free(network_mysqld_auth_response *auth) {
 	g_free(auth);
 }
 
+/**
+ * answer the auth-challenge of a backend with a login of our own
+ *
+ * the proxy logs in without SSL, compression or a default-db, like the health-check
+ *
+ * @param password the password in plain-text, NULL or "" for none
+ */
+network_mysqld_auth_response *network_mysqld_auth_response_new_login(network_mysqld_auth_challenge *shake, const gchar *username, const gchar *password) {
+	network_mysqld_auth_response *auth;
+
+	/* keep the default capabilities */
+	auth = network_mysqld_auth_response_new(shake->capabilities);
+	auth->charset = shake->charset;
+	g_string_assign(auth->username, username);
+
+	if (strleq(S(shake->auth_plugin_name), C("caching_sha2_password"))) {
+		/* MySQL 8.0: a server that has our password cached answers with fast-auth-success */
+		g_string_assign(auth->auth_plugin_name, "caching_sha2_password");
+
+		if (password && *password) {
+			network_mysqld_proto_password_scramble_sha256(auth->auth_plugin_data,
+					S(shake->auth_plugin_data),
+					password, strlen(password));
+		}
+	} else if (password && *password) {
+		GString *hashed_password;
+
+		hashed_password = g_string_new(NULL);
+		network_mysqld_proto_password_hash(hashed_password, password, strlen(password));
+		network_mysqld_proto_password_scramble(auth->auth_plugin_data, S(shake->auth_plugin_data), S(hashed_password));
+
+		g_string_free(hashed_password, TRUE);
+	}
+
+	return auth;
+}
+
 int network_mysqld_proto_get_auth_response(network_packet *packet, network_mysqld_auth_response *auth) {
 	int err = 0;
 	guint16 l_cap;
@@ -1585,6 +2921,19 @@ network_mysqld_auth_response *network_mysqld_auth_response_copy(network_mysqld_a
 	return dst;
 }
 
+/**
+ * check if the result-sets on this side of the connection end with a OK packet instead of EOF packets
+ *
+ * CLIENT_DEPRECATE_EOF is used if the server announced it in the challenge and the client
+ * asked for it in the response
+ */
+gboolean network_mysqld_socket_is_deprecate_eof(network_socket *sock) {
+	if (NULL == sock || NULL == sock->challenge || NULL == sock->response) return FALSE;
+
+	return (sock->challenge->capabilities & CLIENT_DEPRECATE_EOF) &&
+	       (sock->response->client_capabilities & CLIENT_DEPRECATE_EOF);
+}
+
 /*
  * prepared statements
  */
@@ -1858,6 +3207,7 @@ int network_mysqld_proto_append_stmt_execute_packet(GString *packet,
 
 	nul_bits_len = (param_count + 7) / 8;
 	nul_bits = g_string_sized_new(nul_bits_len);
+	g_string_set_size(nul_bits, nul_bits_len);
 	memset(nul_bits->str, 0, nul_bits->len); /* set it all to zero */
 
 	for (i = 0; i < param_count; i++) {
@@ -1879,7 +3229,7 @@ int network_mysqld_proto_append_stmt_execute_packet(GString *packet,
 		for (i = 0; i < stmt_execute_packet->params->len; i++) {
 			network_mysqld_type_t *param = g_ptr_array_index(stmt_execute_packet->params, i);
 
-			network_mysqld_proto_append_int16(packet, (guint16)param->type);
+			network_mysqld_proto_append_int16(packet, (guint16)param->type | (param->is_unsigned ? 0x8000 : 0));
 		}
 		for (i = 0; 0 == err && i < stmt_execute_packet->params->len; i++) {
 			network_mysqld_type_t *param = g_ptr_array_index(stmt_execute_packet->params, i);
@@ -1890,6 +3240,8 @@ int network_mysqld_proto_append_stmt_execute_packet(GString *packet,
 		}
 	}
 
+	g_string_free(nul_bits, TRUE);
+
 	return err ? -1 : 0;
 }
 
@@ -1947,6 +3299,8 @@ int network_mysqld_proto_get_binary_row(network_packet *packet, network_mysqld_p
 			break;
 		}
 
+		param->is_unsigned = (coldef->flags & UNSIGNED_FLAG) != 0;
+
 		if (nul_bytes->str[(i + 2) / 8] & (1 << ((i + 2) % 8))) {
 			param->is_null = TRUE;
 		} else {
@@ -1986,6 +3340,101 @@ GList *network_mysqld_proto_get_next_binary_row(GList *chunk, network_mysqld_pro
 	return err ? NULL : chunk->next;
 }
 
+/**
+ * rewrite the binary rows of a COM_STMT_EXECUTE result into text rows
+ *
+ * the client asked with a COM_QUERY and expects the result of it. The field-defs, the
+ * EOF and OK packets are the same for both, only the rows are decoded by
+ * network_mysqld_proto_get_binary_row() and written again as length-encoded strings
+ * in place, they keep their packet-ids.
+ *
+ * @param chunk the first packet of the result
+ * @return 0 on success, -1 if a row couldn't be decoded or its text doesn't fit into a packet
+ */
+int network_mysqld_proto_binary_result_to_text(GList *chunk) {
+	network_mysqld_proto_fielddefs_t *fields;
+	GString *text;
+	guint8 status;
+	int err = 0;
+
+	if (NULL == chunk) return -1;
+
+	/* OK and ERR are the same in both protocols */
+	if (((GString *)chunk->data)->len <= NET_HEADER_SIZE) return -1;
+	status = ((GString *)chunk->data)->str[NET_HEADER_SIZE];
+	if (status == MYSQLD_PACKET_OK || status == MYSQLD_PACKET_ERR) return 0;
+
+	fields = network_mysqld_proto_fielddefs_new();
+	if (NULL == (chunk = network_mysqld_proto_get_fielddefs(chunk, fields))) {
+		network_mysqld_proto_fielddefs_free(fields);
+
+		return -1;
+	}
+
+	text = g_string_new(NULL);
+
+	for (chunk = chunk->next; 0 == err && chunk; chunk = chunk->next) {
+		GString *packet_data = chunk->data;
+		network_mysqld_resultset_row_t *row;
+		network_packet packet;
+		guint i;
+
+		/* a binary row starts with 0x00, the rows are over at the EOF, OK or ERR */
+		if (packet_data->len <= NET_HEADER_SIZE || packet_data->str[NET_HEADER_SIZE] != 0x00) break;
+
+		/* a row that spans several packets */
+		if (packet_data->len - NET_HEADER_SIZE >= PACKET_LEN_MAX) {
+			err = -1;
+			break;
+		}
+
+		packet.data = packet_data;
+		packet.offset = 0;
+
+		row = network_mysqld_resultset_row_new();
+
+		err = err || network_mysqld_proto_skip_network_header(&packet);
+		err = err || network_mysqld_proto_get_binary_row(&packet, fields, row);
+
+		g_string_truncate(text, 0);
+		for (i = 0; 0 == err && i < row->len; i++) {
+			network_mysqld_type_t *field = row->pdata[i];
+			gsize value_start;
+
+			if (field->is_null) {
+				g_string_append_c(text, (gchar)0xfb);
+				continue;
+			}
+
+			/* the text goes behind a length we only know afterwards */
+			value_start = text->len;
+			err = err || network_mysqld_type_append_text(field, fields->pdata[i], text);
+			if (0 == err) {
+				GString *value = g_string_new_len(text->str + value_start, text->len - value_start);
+
+				g_string_truncate(text, value_start);
+				network_mysqld_proto_append_lenenc_string_len(text, S(value));
+
+				g_string_free(value, TRUE);
+			}
+		}
+		network_mysqld_resultset_row_free(row);
+
+		err = err || (text->len >= PACKET_LEN_MAX);
+
+		if (0 == err) {
+			g_string_truncate(packet_data, NET_HEADER_SIZE);
+			g_string_append_len(packet_data, S(text));
+			network_mysqld_proto_set_packet_len(packet_data, text->len);
+		}
+	}
+
+	g_string_free(text, TRUE);
+	network_mysqld_proto_fielddefs_free(fields);
+
+	return err ? -1 : 0;
+}
+
 /**
  * create a struct for a COM_STMT_CLOSE packet
  */
@@ -66,6 +66,9 @@ typedef struct {
 	guint64 bytes;
 
 	guint8  query_status;
+
+	gboolean deprecate_eof; /**< CLIENT_DEPRECATE_EOF is negotiated, see network_mysqld_socket_is_deprecate_eof() */
+	guint64 fields_left;    /**< the field-defs still to come if .deprecate_eof */
 } network_mysqld_com_query_result_t;
 
 NETWORK_API network_mysqld_com_query_result_t *network_mysqld_com_query_result_new(void);
@@ -79,10 +82,15 @@ NETWORK_API int network_mysqld_proto_get_com_query_result(network_packet *packet
  * tracking the response of a COM_STMT_PREPARE command
  *
  * depending on the kind of statement that was prepare we will receive 0-2 EOF packets
+ *
+ * with CLIENT_DEPRECATE_EOF there are no EOF packets, we count the param- and field-defs instead
  */
 typedef struct {
 	gboolean first_packet;
 	gint     want_eofs;
+
+	gboolean deprecate_eof;
+	guint    want_defs;      /**< the param- and field-defs still to come if .deprecate_eof */
 } network_mysqld_com_stmt_prepare_result_t;
 
 NETWORK_API network_mysqld_com_stmt_prepare_result_t *network_mysqld_com_stmt_prepare_result_new(void);
@@ -108,9 +116,97 @@ NETWORK_API int network_mysqld_proto_get_com_init_db_result(network_packet *pack
 		);
 
 NETWORK_API int network_mysqld_proto_get_query_result(network_packet *packet, network_mysqld_con *con);
+NETWORK_API gboolean network_mysqld_proto_get_query_result_row(network_mysqld_con *con, guint8 status, guint32 packet_len);
+NETWORK_API gsize network_mysqld_proto_skip_query_result_rows(network_mysqld_con *con, gchar *s, gsize len, guint8 *recv_packet_id, guint8 *send_packet_id);
 NETWORK_API int network_mysqld_con_command_states_init(network_mysqld_con *con, network_packet *packet);
 
 NETWORK_API GList *network_mysqld_proto_get_fielddefs(GList *chunk, GPtrArray *fields);
+NETWORK_API GList *network_mysqld_proto_skip_fielddefs(GList *chunk, guint field_count);
+NETWORK_API int network_mysqld_proto_get_slave_lag(GList *chunk, gint *lag);
+NETWORK_API int network_mysqld_proto_get_binlog_pos(GList *chunk, const char *file_field, const char *pos_field, guint64 *pos);
+
+typedef enum {
+	NETWORK_MYSQLD_QUERY_RW,   /**< has to be sent to a read-write backend */
+	NETWORK_MYSQLD_QUERY_RO    /**< can be sent to a read-only backend */
+} network_mysqld_query_rw_type_t;
+
+NETWORK_API network_mysqld_query_rw_type_t network_mysqld_proto_get_query_rw_type(const char *query, gsize query_len);
+NETWORK_API gboolean network_mysqld_proto_query_has_session_state(const char *query, gsize query_len);
+NETWORK_API gboolean network_mysqld_proto_query_sets_charset(const char *query, gsize query_len);
+NETWORK_API const char *network_mysqld_proto_query_skip_space(const char *s, const char *end);
+NETWORK_API gboolean network_mysqld_proto_query_is_word_char(char c);
+
+/**
+ * the class of a statement, by its first word
+ *
+ * @see network_mysqld_proto_get_query_class()
+ */
+typedef enum {
+	NETWORK_MYSQLD_QUERY_CLASS_OTHER,
+	NETWORK_MYSQLD_QUERY_CLASS_SELECT,
+	NETWORK_MYSQLD_QUERY_CLASS_INSERT,      /**< INSERT and REPLACE */
+	NETWORK_MYSQLD_QUERY_CLASS_UPDATE,
+	NETWORK_MYSQLD_QUERY_CLASS_DELETE,
+	NETWORK_MYSQLD_QUERY_CLASS_DDL,         /**< CREATE, ALTER, DROP, TRUNCATE, RENAME */
+	NETWORK_MYSQLD_QUERY_CLASS_TRANSACTION, /**< BEGIN, START TRANSACTION, COMMIT, ROLLBACK, SAVEPOINT, RELEASE SAVEPOINT */
+	NETWORK_MYSQLD_QUERY_CLASS_SET,
+	NETWORK_MYSQLD_QUERY_CLASS_SHOW,        /**< SHOW, DESCRIBE, EXPLAIN */
+	NETWORK_MYSQLD_QUERY_CLASS_CALL,
+
+	NETWORK_MYSQLD_QUERY_CLASS_MAX
+} network_mysqld_query_class_t;
+
+NETWORK_API network_mysqld_query_class_t network_mysqld_proto_get_query_class(const char *query, gsize query_len);
+NETWORK_API const char *network_mysqld_query_class_get_name(network_mysqld_query_class_t query_class);
+NETWORK_API int network_mysqld_query_class_from_name(const char *name);
+
+/**
+ * the commands up to COM_RESET_CONNECTION have a name of their own, the rest is "other"
+ *
+ * @see network_mysqld_command_get_name()
+ */
+#define NETWORK_MYSQLD_COMMANDS 32
+
+NETWORK_API const char *network_mysqld_command_get_name(guint8 command);
+NETWORK_API int network_mysqld_command_from_name(const char *name);
+
+typedef enum {
+	NETWORK_MYSQLD_QUERY_HINT_ROUTE_DEFAULT, /**< no hint, the router decides */
+	NETWORK_MYSQLD_QUERY_HINT_ROUTE_RO,      /**< may run on a read-only backend and see stale data */
+	NETWORK_MYSQLD_QUERY_HINT_ROUTE_RW       /**< has to run on the read-write backend */
+} network_mysqld_query_hint_route_t;
+
+/**
+ * the hints of a leading comment of a query
+ *
+ *   /\*proxy: ro, group=analytics, cache_ttl=30, timeout=2s *\/ SELECT ...
+ *   /\*proxy: traceparent=00-0af7651916cd43dd8448eb211c80319c-b7ad6b7169203331-01 *\/ SELECT ...
+ *
+ * @see network_mysqld_proto_get_query_hints()
+ */
+typedef struct {
+	network_mysqld_query_hint_route_t route;
+	GString *group;        /**< the backend group to run the query on, empty if not hinted */
+	gint64 cache_ttl_ms;   /**< cache the result this long, 0 to not cache it, -1 if not hinted */
+	guint64 timeout_ms;    /**< KILL the query on the backend after this long, 0 if not hinted */
+	GString *traceparent;  /**< the W3C trace-context of the client, empty if not hinted */
+} network_mysqld_query_hints_t;
+
+NETWORK_API network_mysqld_query_hints_t *network_mysqld_query_hints_new(void);
+NETWORK_API void network_mysqld_query_hints_free(network_mysqld_query_hints_t *hints);
+NETWORK_API void network_mysqld_query_hints_reset(network_mysqld_query_hints_t *hints);
+NETWORK_API gboolean network_mysqld_proto_get_query_hints(const char *query, gsize query_len, network_mysqld_query_hints_t *hints);
+NETWORK_API void network_mysqld_query_hints_parse(network_mysqld_query_hints_t *hints, const char *s, gsize len);
+
+typedef enum {
+	NETWORK_MYSQLD_QUERY_TRIVIAL_NONE,             /**< has to be sent to the backend */
+	NETWORK_MYSQLD_QUERY_TRIVIAL_VERSION_COMMENT,  /**< SELECT @@version_comment LIMIT 1 of the mysql client */
+	NETWORK_MYSQLD_QUERY_TRIVIAL_SET_NAMES,        /**< SET NAMES <charset> [COLLATE <collation>] */
+	NETWORK_MYSQLD_QUERY_TRIVIAL_SET_AUTOCOMMIT_ON /**< SET autocommit = 1 */
+} network_mysqld_query_trivial_type_t;
+
+NETWORK_API network_mysqld_query_trivial_type_t network_mysqld_proto_get_query_trivial_type(const char *query, gsize query_len, GString *names);
+NETWORK_API gboolean network_mysqld_proto_get_query_session_vars(const char *query, gsize query_len, GHashTable *vars);
 
 typedef struct {
 	guint64 affected_rows;
@@ -125,6 +221,7 @@ NETWORK_API network_mysqld_ok_packet_t *network_mysqld_ok_packet_new(void);
 NETWORK_API void network_mysqld_ok_packet_free(network_mysqld_ok_packet_t *udata);
 
 NETWORK_API int network_mysqld_proto_get_ok_packet(network_packet *packet, network_mysqld_ok_packet_t *ok_packet);
+NETWORK_API int network_mysqld_proto_get_eof_ok_packet(network_packet *packet, network_mysqld_ok_packet_t *ok_packet);
 NETWORK_API int network_mysqld_proto_append_ok_packet(GString *packet, network_mysqld_ok_packet_t *ok_packet);
 
 typedef struct {
@@ -188,6 +285,9 @@ NETWORK_API void network_mysqld_auth_response_free(network_mysqld_auth_response
 NETWORK_API int network_mysqld_proto_append_auth_response(GString *packet, network_mysqld_auth_response *auth);
 NETWORK_API int network_mysqld_proto_get_auth_response(network_packet *packet, network_mysqld_auth_response *auth);
 NETWORK_API network_mysqld_auth_response *network_mysqld_auth_response_copy(network_mysqld_auth_response *src);
+NETWORK_API network_mysqld_auth_response *network_mysqld_auth_response_new_login(network_mysqld_auth_challenge *shake, const gchar *username, const gchar *password);
+
+NETWORK_API gboolean network_mysqld_socket_is_deprecate_eof(network_socket *sock);
 
 /* COM_STMT_* */
 
@@ -233,6 +333,7 @@ NETWORK_API network_mysqld_resultset_row_t *network_mysqld_resultset_row_new(voi
 NETWORK_API void network_mysqld_resultset_row_free(network_mysqld_resultset_row_t *row);
 NETWORK_API int network_mysqld_proto_get_binary_row(network_packet *packet, network_mysqld_proto_fielddefs_t *fields, network_mysqld_resultset_row_t *row);
 NETWORK_API GList *network_mysqld_proto_get_next_binary_row(GList *chunk, network_mysqld_proto_fielddefs_t *fields, network_mysqld_resultset_row_t *row);
+NETWORK_API int network_mysqld_proto_binary_result_to_text(GList *chunk);
 
 typedef struct {
 	guint32 stmt_id;
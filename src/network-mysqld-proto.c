@@ -86,8 +86,10 @@ int network_mysqld_proto_peek_lenenc_type(network_packet *packet, network_mysqld
 	} else if (bytestream[off] == 253) { /* 3 byte */
 		*type = NETWORK_MYSQLD_LENENC_TYPE_INT;
 	} else if (bytestream[off] == 254) { /* 8 byte OR EOF */
-		if (off == 4 && 
-		    packet->data->len - packet->offset < 8) {
+		/* a row that starts with a 8 byte length fills the whole packet, a EOF or
+		 * the OK that replaces it with CLIENT_DEPRECATE_EOF is smaller */
+		if (off == NET_HEADER_SIZE && 
+		    packet->data->len - NET_HEADER_SIZE < PACKET_LEN_MAX) {
 			*type = NETWORK_MYSQLD_LENENC_TYPE_EOF;
 		} else {
 			*type = NETWORK_MYSQLD_LENENC_TYPE_INT;
@@ -99,6 +101,52 @@ int network_mysqld_proto_peek_lenenc_type(network_packet *packet, network_mysqld
 	return 0;
 }
 
+/**
+ * bytes that follow the first byte of a length-encoded integer, indexed by first byte - 251
+ *
+ * 0 marks NULL (251) and ERR (255) which aren't integers
+ */
+static const guint8 lenenc_int_extra_bytes[] = { 0, 2, 3, 8, 0 };
+
+/**
+ * load a little-endian integer from a possibly unaligned position
+ *
+ * the callers check the bounds, the fixed sizes become plain loads
+ */
+static guint64 network_mysqld_proto_load_le(const guchar *bytes, gsize size) {
+	guint16 v16;
+	guint32 v32;
+	guint64 v64;
+	guint64 ret = 0;
+	gsize i;
+
+	switch (size) {
+	case 1:
+		return bytes[0];
+	case 2:
+		memcpy(&v16, bytes, sizeof(v16));
+		return GUINT16_FROM_LE(v16);
+	case 3:
+		memcpy(&v16, bytes, sizeof(v16));
+		return GUINT16_FROM_LE(v16) | ((guint32)bytes[2] << 16);
+	case 4:
+		memcpy(&v32, bytes, sizeof(v32));
+		return GUINT32_FROM_LE(v32);
+	case 6:
+		memcpy(&v32, bytes, sizeof(v32));
+		memcpy(&v16, bytes + 4, sizeof(v16));
+		return GUINT32_FROM_LE(v32) | ((guint64)GUINT16_FROM_LE(v16) << 32);
+	case 8:
+		memcpy(&v64, bytes, sizeof(v64));
+		return GUINT64_FROM_LE(v64);
+	default:
+		for (i = size; i > 0; i--) {
+			ret = (ret << 8) | bytes[i - 1];
+		}
+		return ret;
+	}
+}
+
 /**
  * decode a length-encoded integer from a network packet
  *
@@ -111,41 +159,20 @@ int network_mysqld_proto_peek_lenenc_type(network_packet *packet, network_mysqld
  */
 int network_mysqld_proto_get_lenenc_int(network_packet *packet, guint64 *v) {
 	guint off = packet->offset;
-	guint64 ret = 0;
 	unsigned char *bytestream = (unsigned char *)packet->data->str;
+	gsize extra;
 
 	if (off >= packet->data->len) return -1;
-	
-	if (bytestream[off] < 251) { /* */
-		ret = bytestream[off];
-	} else if (bytestream[off] == 252) { /* 2 byte length*/
-		if (off + 2 >= packet->data->len) return -1;
-		ret = (bytestream[off + 1] << 0) | 
-			(bytestream[off + 2] << 8) ;
-		off += 2;
-	} else if (bytestream[off] == 253) { /* 3 byte */
-		if (off + 3 >= packet->data->len) return -1;
-		ret = (bytestream[off + 1]   <<  0) | 
-			(bytestream[off + 2] <<  8) |
-			(bytestream[off + 3] << 16);
-
-		off += 3;
-	} else if (bytestream[off] == 254) { /* 8 byte */
-		if (off + 8 >= packet->data->len) return -1;
-		ret = (bytestream[off + 5] << 0) |
-			(bytestream[off + 6] << 8) |
-			(bytestream[off + 7] << 16) |
-			(bytestream[off + 8] << 24);
-		ret <<= 32;
-
-		ret |= (bytestream[off + 1] <<  0) | 
-			(bytestream[off + 2] <<  8) |
-			(bytestream[off + 3] << 16) |
-			(bytestream[off + 4] << 24);
-		
-
-		off += 8;
-	} else {
+
+	if (G_LIKELY(bytestream[off] < 251)) {
+		*v = bytestream[off];
+		packet->offset = off + 1;
+
+		return 0;
+	}
+
+	extra = lenenc_int_extra_bytes[bytestream[off] - 251];
+	if (extra == 0) {
 		/* if we hit this place we complete have no idea about the protocol */
 		g_critical("%s: bytestream[%d] is %d", 
 			G_STRLOC,
@@ -155,11 +182,11 @@ int network_mysqld_proto_get_lenenc_int(network_packet *packet, guint64 *v) {
 
 		return -1;
 	}
-	off += 1;
 
-	packet->offset = off;
+	if (packet->data->len - off <= extra) return -1;
 
-	*v = ret;
+	*v = network_mysqld_proto_load_le(bytestream + off + 1, extra);
+	packet->offset = off + 1 + extra;
 
 	return 0;
 }
@@ -182,57 +209,46 @@ int network_mysqld_proto_skip(network_packet *packet, gsize size) {
 }
 
 /**
- * get a fixed-length integer from the network packet 
+ * peek a fixed-length integer with one bounds-check
  *
- * @param packet the MySQL network packet
- * @param v      destination of the integer
- * @param size   byte-len of the integer to decode
- * @return a the decoded integer
+ * static to let the compiler specialize it for the constant sizes of the
+ * network_mysqld_proto_get_int*() functions
  */
-int network_mysqld_proto_peek_int_len(network_packet *packet, guint64 *v, gsize size) {
-	gsize i;
-	int shift;
-	guint32 r_l = 0, r_h = 0;
-	guchar *bytes = (guchar *)packet->data->str + packet->offset;
-
-	if (packet->offset > packet->data->len) {
-		return -1;
-	}
-	if (packet->offset + size > packet->data->len) {
+static int network_mysqld_proto_peek_fixed_int(network_packet *packet, guint64 *v, gsize size) {
+	if (packet->offset > packet->data->len ||
+	    packet->data->len - packet->offset < size) {
 		return -1;
 	}
 
-	/**
-	 * for some reason left-shift > 32 leads to negative numbers 
-	 */
-	for (i = 0, shift = 0; 
-			i < size && i < 4; 
-			i++, shift += 8, bytes++) {
-		r_l |= ((*bytes) << shift);
-	}
-
-	for (shift = 0;
-			i < size; 
-			i++, shift += 8, bytes++) {
-		r_h |= ((*bytes) << shift);
-	}
-
-	*v = (((guint64)r_h << 32) | r_l);
+	*v = network_mysqld_proto_load_le((guchar *)packet->data->str + packet->offset, size);
 
 	return 0;
 }
 
-int network_mysqld_proto_get_int_len(network_packet *packet, guint64 *v, gsize size) {
-	int err = 0;
-
-	err = err || network_mysqld_proto_peek_int_len(packet, v, size);
-
-	if (err) return -1;
+static int network_mysqld_proto_get_fixed_int(network_packet *packet, guint64 *v, gsize size) {
+	if (network_mysqld_proto_peek_fixed_int(packet, v, size)) return -1;
 
 	packet->offset += size;
 
 	return 0;
 }
+
+/**
+ * get a fixed-length integer from the network packet 
+ *
+ * @param packet the MySQL network packet
+ * @param v      destination of the integer
+ * @param size   byte-len of the integer to decode
+ * @return 0 on success, non-0 on error
+ */
+int network_mysqld_proto_peek_int_len(network_packet *packet, guint64 *v, gsize size) {
+	return network_mysqld_proto_peek_fixed_int(packet, v, size);
+}
+
+int network_mysqld_proto_get_int_len(network_packet *packet, guint64 *v, gsize size) {
+	return network_mysqld_proto_get_fixed_int(packet, v, size);
+}
+
 /**
  * get a 8-bit integer from the network packet
  *
@@ -244,7 +260,7 @@ int network_mysqld_proto_get_int_len(network_packet *packet, guint64 *v, gsize s
 int network_mysqld_proto_get_int8(network_packet *packet, guint8 *v) {
 	guint64 v64;
 
-	if (network_mysqld_proto_get_int_len(packet, &v64, 1)) return -1;
+	if (network_mysqld_proto_get_fixed_int(packet, &v64, 1)) return -1;
 
 	g_assert_cmpint(v64 & 0xff, ==, v64); /* check that we really only got one byte back */
 
@@ -264,7 +280,7 @@ int network_mysqld_proto_get_int8(network_packet *packet, guint8 *v) {
 int network_mysqld_proto_peek_int8(network_packet *packet, guint8 *v) {
 	guint64 v64;
 
-	if (network_mysqld_proto_peek_int_len(packet, &v64, 1)) return -1;
+	if (network_mysqld_proto_peek_fixed_int(packet, &v64, 1)) return -1;
 
 	g_assert_cmpint(v64 & 0xff, ==, v64); /* check that we really only got one byte back */
 
@@ -285,7 +301,7 @@ int network_mysqld_proto_peek_int8(network_packet *packet, guint8 *v) {
 int network_mysqld_proto_get_int16(network_packet *packet, guint16 *v) {
 	guint64 v64;
 
-	if (network_mysqld_proto_get_int_len(packet, &v64, 2)) return -1;
+	if (network_mysqld_proto_get_fixed_int(packet, &v64, 2)) return -1;
 
 	g_assert_cmpint(v64 & 0xffff, ==, v64); /* check that we really only got two byte back */
 
@@ -305,7 +321,7 @@ int network_mysqld_proto_get_int16(network_packet *packet, guint16 *v) {
 int network_mysqld_proto_peek_int16(network_packet *packet, guint16 *v) {
 	guint64 v64;
 
-	if (network_mysqld_proto_peek_int_len(packet, &v64, 2)) return -1;
+	if (network_mysqld_proto_peek_fixed_int(packet, &v64, 2)) return -1;
 
 	g_assert_cmpint(v64 & 0xffff, ==, v64); /* check that we really only got two byte back */
 
@@ -326,7 +342,7 @@ int network_mysqld_proto_peek_int16(network_packet *packet, guint16 *v) {
 int network_mysqld_proto_get_int24(network_packet *packet, guint32 *v) {
 	guint64 v64;
 
-	if (network_mysqld_proto_get_int_len(packet, &v64, 3)) return -1;
+	if (network_mysqld_proto_get_fixed_int(packet, &v64, 3)) return -1;
 
 	g_assert_cmpint(v64 & 0x00ffffff, ==, v64); /* check that we really only got two byte back */
 
@@ -347,7 +363,7 @@ int network_mysqld_proto_get_int24(network_packet *packet, guint32 *v) {
 int network_mysqld_proto_get_int32(network_packet *packet, guint32 *v) {
 	guint64 v64;
 
-	if (network_mysqld_proto_get_int_len(packet, &v64, 4)) return -1;
+	if (network_mysqld_proto_get_fixed_int(packet, &v64, 4)) return -1;
 
 	*v = v64 & 0xffffffff;
 
@@ -365,7 +381,7 @@ int network_mysqld_proto_get_int32(network_packet *packet, guint32 *v) {
 int network_mysqld_proto_peek_int32(network_packet *packet, guint32 *v) {
 	guint64 v64;
 
-	if (network_mysqld_proto_peek_int_len(packet, &v64, 4)) return -1;
+	if (network_mysqld_proto_peek_fixed_int(packet, &v64, 4)) return -1;
 
 	*v = v64 & 0xffffffff;
 
@@ -384,7 +400,7 @@ int network_mysqld_proto_peek_int32(network_packet *packet, guint32 *v) {
 int network_mysqld_proto_get_int48(network_packet *packet, guint64 *v) {
 	guint64 v64;
 
-	if (network_mysqld_proto_get_int_len(packet, &v64, 6)) return -1;
+	if (network_mysqld_proto_get_fixed_int(packet, &v64, 6)) return -1;
 
 	*v = v64;
 
@@ -400,7 +416,7 @@ int network_mysqld_proto_get_int48(network_packet *packet, guint64 *v) {
  * @see network_mysqld_proto_get_int_len()
  */
 int network_mysqld_proto_get_int64(network_packet *packet, guint64 *v) {
-	return network_mysqld_proto_get_int_len(packet, v, 8);
+	return network_mysqld_proto_get_fixed_int(packet, v, 8);
 }
 
 /**
@@ -639,12 +655,129 @@ MYSQL_FIELD *network_mysqld_proto_fielddef_new() {
 	return field;
 }
 
+/**
+ * create a arena for the field-definitions of a result-set
+ *
+ * the caller holds a reference until it calls network_mysqld_proto_fielddefs_arena_unref()
+ *
+ * @param size_hint  the size of the first block, the fields and their strings should fit into it
+ */
+network_mysqld_proto_fielddefs_arena_t *network_mysqld_proto_fielddefs_arena_new(gsize size_hint) {
+	network_mysqld_proto_fielddefs_arena_t *arena;
+
+	arena = g_new0(network_mysqld_proto_fielddefs_arena_t, 1);
+	arena->refs = 1;
+	arena->block_size = MAX(size_hint, 1024);
+
+	return arena;
+}
+
+void network_mysqld_proto_fielddefs_arena_unref(network_mysqld_proto_fielddefs_arena_t *arena) {
+	GSList *node;
+
+	if (--arena->refs > 0) return;
+
+	for (node = arena->blocks; node; node = node->next) {
+		g_free(node->data);
+	}
+	g_slist_free(arena->blocks);
+
+	g_free(arena);
+}
+
+/**
+ * get size bytes from the arena, aligned for a pointer
+ */
+static gpointer network_mysqld_proto_fielddefs_arena_alloc(network_mysqld_proto_fielddefs_arena_t *arena, gsize size) {
+	gpointer p;
+
+	size = (size + sizeof(gpointer) - 1) & ~(sizeof(gpointer) - 1);
+
+	if (arena->left < size) {
+		gsize block_size = MAX(size, arena->block_size);
+
+		arena->pos = g_malloc(block_size);
+		arena->left = block_size;
+		arena->blocks = g_slist_prepend(arena->blocks, arena->pos);
+	}
+
+	p = arena->pos;
+	arena->pos += size;
+	arena->left -= size;
+
+	return p;
+}
+
+/**
+ * create a empty field in the arena
+ *
+ * network_mysqld_proto_get_fielddef() puts the strings of the field into the arena too,
+ * network_mysqld_proto_fielddef_free() drops the reference of the field. Without a arena
+ * or NETWORK_MYSQLD_PROTO_HAVE_FIELDDEF_ARENA it is a network_mysqld_proto_fielddef_new().
+ *
+ * @return a empty MYSQL_FIELD
+ */
+MYSQL_FIELD *network_mysqld_proto_fielddef_new_in(network_mysqld_proto_fielddefs_arena_t *arena) {
+#ifdef NETWORK_MYSQLD_PROTO_HAVE_FIELDDEF_ARENA
+	MYSQL_FIELD *field;
+
+	if (NULL == arena) return network_mysqld_proto_fielddef_new();
+
+	field = network_mysqld_proto_fielddefs_arena_alloc(arena, sizeof(*field));
+	memset(field, 0, sizeof(*field));
+	field->extension = arena;
+	arena->refs++;
+
+	return field;
+#else
+	return network_mysqld_proto_fielddef_new();
+#endif
+}
+
+/**
+ * get a length-encoded string of a field-definition
+ *
+ * the string goes into the arena of the field, if it has one
+ */
+int network_mysqld_proto_get_fielddef_string(network_packet *packet, MYSQL_FIELD *field, gchar **s) {
+#ifdef NETWORK_MYSQLD_PROTO_HAVE_FIELDDEF_ARENA
+	guint64 len;
+
+	if (NULL == field->extension) return network_mysqld_proto_get_lenenc_string(packet, s, NULL);
+
+	if (network_mysqld_proto_get_lenenc_int(packet, &len)) return -1;
+
+	if (packet->offset + len > packet->data->len) return -1;
+
+	if (len == 0) {
+		*s = NULL;
+		return 0;
+	}
+
+	*s = network_mysqld_proto_fielddefs_arena_alloc(field->extension, len + 1);
+	memcpy(*s, packet->data->str + packet->offset, len);
+	(*s)[len] = '\0';
+
+	packet->offset += len;
+
+	return 0;
+#else
+	return network_mysqld_proto_get_lenenc_string(packet, s, NULL);
+#endif
+}
+
 /**
  * free a MYSQL_FIELD and its components
  *
  * @param field  the MYSQL_FIELD to free
  */
 void network_mysqld_proto_fielddef_free(MYSQL_FIELD *field) {
+#ifdef NETWORK_MYSQLD_PROTO_HAVE_FIELDDEF_ARENA
+	if (field->extension) {
+		network_mysqld_proto_fielddefs_arena_unref(field->extension);
+		return;
+	}
+#endif
 	if (field->catalog) g_free(field->catalog);
 	if (field->db) g_free(field->db);
 	if (field->name) g_free(field->name);
@@ -1014,6 +1147,67 @@ int network_mysqld_proto_password_scramble(GString *response,
 	return 0;
 }
 
+/**
+ * scramble the password with the challenge for caching_sha2_password
+ *
+ *   XOR( SHA256(password), SHA256(SHA256(SHA256(password)) + challenge) )
+ *
+ * a server that has the password in its cache accepts it right away (fast-auth),
+ * otherwise it asks for the password over TLS or RSA
+ *
+ * @param response         dest, 32 bytes
+ * @param challenge        the challenge string as sent by the mysql-server
+ * @param challenge_len    length of the challenge
+ * @param password         the password in cleartext
+ * @param password_len     length of the password
+ */
+int network_mysqld_proto_password_scramble_sha256(GString *response,
+		const char *challenge, gsize challenge_len,
+		const char *password, gsize password_len) {
+	GChecksum *cs;
+	guint8 stage1[32], stage2[32];
+	gsize stage_len;
+	int i;
+
+	g_return_val_if_fail(NULL != challenge, -1);
+	g_return_val_if_fail(20 == challenge_len || 21 == challenge_len, -1);
+
+	/* the trailing '\0' of auth-plugin-data-2, see network_mysqld_proto_password_scramble() */
+	if (challenge_len == 21) challenge_len--;
+
+	/* 1. SHA256(password) */
+	cs = g_checksum_new(G_CHECKSUM_SHA256);
+	g_checksum_update(cs, (guchar *)password, password_len);
+	stage_len = sizeof(stage1);
+	g_checksum_get_digest(cs, stage1, &stage_len);
+	g_checksum_free(cs);
+
+	/* 2. SHA256(SHA256(password)) */
+	cs = g_checksum_new(G_CHECKSUM_SHA256);
+	g_checksum_update(cs, stage1, sizeof(stage1));
+	stage_len = sizeof(stage2);
+	g_checksum_get_digest(cs, stage2, &stage_len);
+	g_checksum_free(cs);
+
+	/* 3. SHA256(SHA256(SHA256(password)) + challenge) */
+	cs = g_checksum_new(G_CHECKSUM_SHA256);
+	g_checksum_update(cs, stage2, sizeof(stage2));
+	g_checksum_update(cs, (guchar *)challenge, challenge_len);
+
+	g_string_set_size(response, g_checksum_type_get_length(G_CHECKSUM_SHA256));
+	response->len = response->allocated_len;
+	g_checksum_get_digest(cs, (guchar *)response->str, &(response->len));
+
+	g_checksum_free(cs);
+
+	/* XOR SHA256(password) with it */
+	for (i = 0; i < 32; i++) {
+		response->str[i] = (guchar)response->str[i] ^ stage1[i];
+	}
+
+	return 0;
+}
+
 /**
  * unscramble the auth-response and get the hashed-password
  *
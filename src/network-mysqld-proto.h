@@ -49,6 +49,13 @@
 #define COM_STMT_RESET          COM_RESET_STMT
 #endif
 
+/**
+ * 5.7.3 added COM_RESET_CONNECTION, the enum of older headers doesn't have it
+ */
+#if MYSQL_VERSION_ID < 50703
+#define COM_RESET_CONNECTION    (0x1f)
+#endif
+
 #define MYSQLD_PACKET_OK   (0)
 #define MYSQLD_PACKET_RAW  (0xfa) /* used for proxy.response.type only */
 #define MYSQLD_PACKET_NULL (0xfb) /* 0xfb */
@@ -59,6 +66,13 @@
 
 #define PACKET_LEN_MAX     (0x00ffffff)
 
+#ifndef CLIENT_DEPRECATE_EOF
+/**
+ * no EOF packet after the field-defs, the rows end with a OK packet with a 0xfe header
+ */
+#define CLIENT_DEPRECATE_EOF (1 << 24)
+#endif
+
 #include "network-packet.h" /* for backward compat, as network_packet_new() was previously defined here */
 
 typedef enum {
@@ -106,6 +120,32 @@ NETWORK_API int network_mysqld_proto_peek_lenenc_type(network_packet *packet, ne
 NETWORK_API int network_mysqld_proto_get_lenenc_int(network_packet *packet, guint64 *v);
 
 typedef MYSQL_FIELD network_mysqld_proto_fielddef_t;
+
+/**
+ * MYSQL_FIELD has a .extension since 5.1, it points to the arena of the field
+ */
+#if MYSQL_VERSION_ID >= 50100
+#define NETWORK_MYSQLD_PROTO_HAVE_FIELDDEF_ARENA
+#endif
+
+/**
+ * the field-definitions of a result-set and their strings in a few large blocks
+ *
+ * each field holds a reference, the blocks are freed at once with the last field
+ */
+typedef struct {
+	guint refs;
+	GSList *blocks;
+	gchar *pos;          /**< free space in the current block */
+	gsize left;
+	gsize block_size;
+} network_mysqld_proto_fielddefs_arena_t;
+
+NETWORK_API network_mysqld_proto_fielddefs_arena_t *network_mysqld_proto_fielddefs_arena_new(gsize size_hint);
+NETWORK_API void network_mysqld_proto_fielddefs_arena_unref(network_mysqld_proto_fielddefs_arena_t *arena);
+NETWORK_API network_mysqld_proto_fielddef_t *network_mysqld_proto_fielddef_new_in(network_mysqld_proto_fielddefs_arena_t *arena);
+NETWORK_API int network_mysqld_proto_get_fielddef_string(network_packet *packet, network_mysqld_proto_fielddef_t *field, gchar **s);
+
 NETWORK_API network_mysqld_proto_fielddef_t *network_mysqld_proto_fielddef_new(void);
 NETWORK_API void network_mysqld_proto_fielddef_free(network_mysqld_proto_fielddef_t *fielddef);
 NETWORK_API int network_mysqld_proto_get_fielddef(network_packet *packet, network_mysqld_proto_fielddef_t *field, guint32 capabilities);
@@ -130,6 +170,9 @@ NETWORK_API int network_mysqld_proto_password_hash(GString *response,
 NETWORK_API int network_mysqld_proto_password_scramble(GString *response,
 		const char *challenge, gsize challenge_len,
 		const char *hashed_password, gsize hashed_password_len);
+NETWORK_API int network_mysqld_proto_password_scramble_sha256(GString *response,
+		const char *challenge, gsize challenge_len,
+		const char *password, gsize password_len);
 NETWORK_API gboolean network_mysqld_proto_password_check(
 		const char *challenge, gsize challenge_len,
 		const char *response, gsize response_len,
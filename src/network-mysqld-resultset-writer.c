@@ -0,0 +1,384 @@
+/* $%BEGINLICENSE%$
+ Copyright (c) 2008, 2012, Oracle and/or its affiliates. All rights reserved.
+
+ This program is free software; you can redistribute it and/or
+ modify it under the terms of the GNU General Public License as
+ published by the Free Software Foundation; version 2 of the
+ License.
+
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ GNU General Public License for more details.
+
+ You should have received a copy of the GNU General Public License
+ along with this program; if not, write to the Free Software
+ Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA
+ 02110-1301  USA
+
+ $%ENDLICENSE%$ */
+#include <string.h>
+
+#include "network-mysqld-resultset-writer.h"
+#include "network-mysqld-proto.h"
+#include "network-mysqld-packet.h"
+#include "network-buffer-pool.h"
+#include "network-queue.h"
+
+#define C(x) x, sizeof(x) - 1
+#define S(x) x->str, x->len
+
+network_mysqld_resultset_writer_t *network_mysqld_resultset_writer_new(network_socket *sock) {
+	network_mysqld_resultset_writer_t *w;
+
+	w = g_slice_new0(network_mysqld_resultset_writer_t);
+	w->sock = sock;
+	w->batch_size = NETWORK_BUFFER_POOL_CHUNK_SIZE;
+	w->deprecate_eof = network_mysqld_socket_is_deprecate_eof(sock);
+
+	return w;
+}
+
+/**
+ * free the writer
+ *
+ * packets that weren't flushed are dropped
+ */
+void network_mysqld_resultset_writer_free(network_mysqld_resultset_writer_t *w) {
+	if (!w) return;
+
+	if (w->batch) network_buffer_pool_put(w->batch);
+
+	g_slice_free(network_mysqld_resultset_writer_t, w);
+}
+
+/**
+ * size of a length-encoded integer
+ *
+ * @see network_mysqld_proto_append_lenenc_int()
+ */
+static gsize network_mysqld_lenenc_int_size(guint64 length) {
+	if (length < 251) return 1;
+	if (length < 65536) return 3;
+	if (length < 16777216) return 4;
+
+	return 9;
+}
+
+/**
+ * move the batch to the send-queue
+ *
+ * lets the caller hand out the rows it has written so far
+ */
+void network_mysqld_resultset_writer_flush(network_mysqld_resultset_writer_t *w) {
+	g_return_if_fail(!w->in_row);
+
+	if (NULL == w->batch) return;
+
+	if (w->batch->len == 0) {
+		network_buffer_pool_put(w->batch);
+	} else {
+		network_queue_append(w->sock->send_queue, w->batch);
+	}
+	w->batch = NULL;
+}
+
+/**
+ * get the batch to append the next packet to
+ */
+static GString *network_mysqld_resultset_writer_get_batch(network_mysqld_resultset_writer_t *w) {
+	if (w->batch && w->batch->len >= w->batch_size) {
+		network_mysqld_resultset_writer_flush(w);
+	}
+
+	if (NULL == w->batch) {
+		w->batch = network_buffer_pool_get(0);
+	}
+
+	return w->batch;
+}
+
+/**
+ * append the network-header with the next packet-id
+ *
+ * @see network_mysqld_queue_append()
+ */
+static void network_mysqld_resultset_writer_append_header(network_mysqld_resultset_writer_t *w, GString *batch, gsize packet_len) {
+	network_socket *sock = w->sock;
+
+	if (sock->packet_id_is_reset) {
+		sock->packet_id_is_reset = FALSE;
+		sock->last_packet_id = 0xff; /** the ++last_packet_id will make sure we send a 0 */
+	}
+
+	network_mysqld_proto_append_packet_len(batch, packet_len);
+	network_mysqld_proto_append_packet_id(batch, ++sock->last_packet_id);
+}
+
+/**
+ * append a packet, split it if it is larger than PACKET_LEN_MAX
+ */
+static void network_mysqld_resultset_writer_append_packet(network_mysqld_resultset_writer_t *w, const char *data, gsize packet_len) {
+	gsize packet_offset = 0;
+
+	do {
+		GString *batch = network_mysqld_resultset_writer_get_batch(w);
+		gsize cur_packet_len = MIN(packet_len, PACKET_LEN_MAX);
+
+		network_mysqld_resultset_writer_append_header(w, batch, cur_packet_len);
+		g_string_append_len(batch, data + packet_offset, cur_packet_len);
+
+		if (packet_len == PACKET_LEN_MAX) {
+			/* a 16M packet is followed by a empty one */
+			network_mysqld_resultset_writer_append_header(w, batch, 0);
+		}
+
+		packet_len -= cur_packet_len;
+		packet_offset += cur_packet_len;
+	} while (packet_len > 0);
+}
+
+static void network_mysqld_resultset_writer_append_eof(network_mysqld_resultset_writer_t *w) {
+	GString *batch = network_mysqld_resultset_writer_get_batch(w);
+
+	network_mysqld_resultset_writer_append_header(w, batch, 5);
+	g_string_append_len(batch, C("\xfe"));     /* EOF */
+	g_string_append_len(batch, C("\x00\x00")); /* warning count */
+	g_string_append_len(batch, C("\x02\x00")); /* flags */
+}
+
+/**
+ * append the OK packet that replaces the EOF at the end of the rows with CLIENT_DEPRECATE_EOF
+ */
+static void network_mysqld_resultset_writer_append_eof_ok(network_mysqld_resultset_writer_t *w) {
+	GString *batch = network_mysqld_resultset_writer_get_batch(w);
+
+	network_mysqld_resultset_writer_append_header(w, batch, 7);
+	g_string_append_len(batch, C("\xfe"));     /* the header of a EOF */
+	g_string_append_len(batch, C("\x00"));     /* affected rows */
+	g_string_append_len(batch, C("\x00"));     /* insert-id */
+	g_string_append_len(batch, C("\x02\x00")); /* flags */
+	g_string_append_len(batch, C("\x00\x00")); /* warning count */
+}
+
+/**
+ * write the field-count, the field-defs and the EOF packet
+ *
+ * the EOF is left out if the client uses CLIENT_DEPRECATE_EOF
+ */
+int network_mysqld_resultset_writer_write_fields(network_mysqld_resultset_writer_t *w, GPtrArray *fields) {
+	GString *s;
+	guint i;
+
+	g_return_val_if_fail(fields->len > 0, -1);
+
+	w->fields_len = fields->len;
+
+	s = g_string_new(NULL);
+
+	network_mysqld_proto_append_lenenc_int(s, fields->len); /* the field-count */
+	network_mysqld_resultset_writer_append_packet(w, S(s));
+
+	for (i = 0; i < fields->len; i++) {
+		MYSQL_FIELD *field = fields->pdata[i];
+		
+		g_string_truncate(s, 0);
+
+		network_mysqld_proto_append_lenenc_string(s, field->catalog ? field->catalog : "def");   /* catalog */
+		network_mysqld_proto_append_lenenc_string(s, field->db ? field->db : "");                /* database */
+		network_mysqld_proto_append_lenenc_string(s, field->table ? field->table : "");          /* table */
+		network_mysqld_proto_append_lenenc_string(s, field->org_table ? field->org_table : "");  /* org_table */
+		network_mysqld_proto_append_lenenc_string(s, field->name ? field->name : "");            /* name */
+		network_mysqld_proto_append_lenenc_string(s, field->org_name ? field->org_name : "");    /* org_name */
+
+		g_string_append_c(s, '\x0c');                  /* length of the following block, 12 byte */
+		g_string_append_len(s, "\x08\x00", 2);         /* charset */
+		g_string_append_c(s, (field->length >> 0) & 0xff); /* len */
+		g_string_append_c(s, (field->length >> 8) & 0xff); /* len */
+		g_string_append_c(s, (field->length >> 16) & 0xff); /* len */
+		g_string_append_c(s, (field->length >> 24) & 0xff); /* len */
+		g_string_append_c(s, field->type);             /* type */
+		g_string_append_c(s, field->flags & 0xff);     /* flags */
+		g_string_append_c(s, (field->flags >> 8) & 0xff); /* flags */
+		g_string_append_c(s, 0);                       /* decimals */
+		g_string_append_len(s, "\x00\x00", 2);         /* filler */
+
+		network_mysqld_resultset_writer_append_packet(w, S(s));
+	}
+
+	g_string_free(s, TRUE);
+
+	if (!w->deprecate_eof) network_mysqld_resultset_writer_append_eof(w);
+
+	return 0;
+}
+
+/**
+ * write a row of values_count fields in one go
+ *
+ * the size of the packet is calculated upfront and the fields are
+ * encoded straight into the batch
+ */
+static int network_mysqld_resultset_writer_append_row(network_mysqld_resultset_writer_t *w, const char **values, const gsize *values_len, guint values_count) {
+	GString *batch;
+	gsize packet_len = 0;
+	guint i;
+
+	g_return_val_if_fail(!w->in_row, -1);
+
+	for (i = 0; i < values_count; i++) {
+		if (NULL == values[i]) {
+			packet_len += 1;
+		} else {
+			packet_len += network_mysqld_lenenc_int_size(values_len[i]) + values_len[i];
+		}
+	}
+
+	if (packet_len >= PACKET_LEN_MAX) {
+		/* has to be split, take the slow path */
+		network_mysqld_resultset_writer_row_start(w);
+		for (i = 0; i < values_count; i++) {
+			network_mysqld_resultset_writer_row_append(w, values[i], values_len[i]);
+		}
+		return network_mysqld_resultset_writer_row_end(w);
+	}
+
+	batch = network_mysqld_resultset_writer_get_batch(w);
+
+	/* grow once instead of for each field */
+	if (batch->len + NET_HEADER_SIZE + packet_len > batch->allocated_len) {
+		gsize old_len = batch->len;
+
+		g_string_set_size(batch, old_len + NET_HEADER_SIZE + packet_len);
+		g_string_truncate(batch, old_len);
+	}
+
+	network_mysqld_resultset_writer_append_header(w, batch, packet_len);
+	for (i = 0; i < values_count; i++) {
+		network_mysqld_proto_append_lenenc_string_len(batch, values[i], values_len[i]);
+	}
+
+	w->rows++;
+
+	return 0;
+}
+
+/**
+ * write a row in one go
+ *
+ * @param values      one value per field, NULL for a NULL field
+ * @param values_len  the length of each value
+ */
+int network_mysqld_resultset_writer_write_row_len(network_mysqld_resultset_writer_t *w, const char **values, const gsize *values_len) {
+	return network_mysqld_resultset_writer_append_row(w, values, values_len, w->fields_len);
+}
+
+/**
+ * write a row of \0-terminated strings
+ *
+ * @param row  a GPtrArray of gchar *, NULL for a NULL field
+ */
+int network_mysqld_resultset_writer_write_row(network_mysqld_resultset_writer_t *w, GPtrArray *row) {
+	const char **values;
+	gsize *values_len;
+	guint i;
+
+	values = g_newa(const char *, row->len);
+	values_len = g_newa(gsize, row->len);
+
+	for (i = 0; i < row->len; i++) {
+		values[i] = row->pdata[i];
+		values_len[i] = values[i] ? strlen(values[i]) : 0;
+	}
+
+	return network_mysqld_resultset_writer_append_row(w, values, values_len, row->len);
+}
+
+/**
+ * start a row that is written field by field
+ *
+ * the length of the packet is set by network_mysqld_resultset_writer_row_end()
+ */
+int network_mysqld_resultset_writer_row_start(network_mysqld_resultset_writer_t *w) {
+	GString *batch;
+
+	g_return_val_if_fail(!w->in_row, -1);
+
+	batch = network_mysqld_resultset_writer_get_batch(w);
+
+	w->row_offset = batch->len;
+	w->in_row = TRUE;
+
+	network_mysqld_resultset_writer_append_header(w, batch, 0);
+
+	return 0;
+}
+
+/**
+ * append a field to the current row
+ *
+ * @param s  the field, NULL for a NULL field
+ */
+int network_mysqld_resultset_writer_row_append(network_mysqld_resultset_writer_t *w, const char *s, gsize s_len) {
+	g_return_val_if_fail(w->in_row, -1);
+
+	network_mysqld_proto_append_lenenc_string_len(w->batch, s, s_len);
+
+	return 0;
+}
+
+int network_mysqld_resultset_writer_row_end(network_mysqld_resultset_writer_t *w) {
+	GString header;
+	gsize packet_len;
+
+	g_return_val_if_fail(w->in_row, -1);
+
+	w->in_row = FALSE;
+	w->rows++;
+
+	packet_len = w->batch->len - w->row_offset - NET_HEADER_SIZE;
+
+	if (packet_len >= PACKET_LEN_MAX) {
+		GString *packet;
+
+		/* take the row out again and split it into 16M packets */
+		packet = g_string_new_len(w->batch->str + w->row_offset + NET_HEADER_SIZE, packet_len);
+		g_string_truncate(w->batch, w->row_offset);
+		w->sock->last_packet_id--; /* give back the packet-id of _row_start() */
+
+		network_mysqld_resultset_writer_append_packet(w, S(packet));
+
+		g_string_free(packet, TRUE);
+
+		return 0;
+	}
+
+	/* set the length in the header we wrote in _row_start() */
+	header.str = w->batch->str + w->row_offset;
+	header.len = NET_HEADER_SIZE;
+	header.allocated_len = 0;
+
+	network_mysqld_proto_set_packet_len(&header, packet_len);
+
+	return 0;
+}
+
+/**
+ * write the EOF packet (or the OK with CLIENT_DEPRECATE_EOF) at the end of the rows and flush the batch
+ *
+ * the packet-id of the socket is reset like network_mysqld_queue_reset() does
+ */
+int network_mysqld_resultset_writer_finish(network_mysqld_resultset_writer_t *w) {
+	g_return_val_if_fail(!w->in_row, -1);
+
+	if (w->deprecate_eof) {
+		network_mysqld_resultset_writer_append_eof_ok(w);
+	} else {
+		network_mysqld_resultset_writer_append_eof(w);
+	}
+	network_mysqld_resultset_writer_flush(w);
+
+	w->sock->packet_id_is_reset = TRUE;
+
+	return 0;
+}
@@ -0,0 +1,72 @@
+/* $%BEGINLICENSE%$
+ Copyright (c) 2008, 2012, Oracle and/or its affiliates. All rights reserved.
+
+ This program is free software; you can redistribute it and/or
+ modify it under the terms of the GNU General Public License as
+ published by the Free Software Foundation; version 2 of the
+ License.
+
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ GNU General Public License for more details.
+
+ You should have received a copy of the GNU General Public License
+ along with this program; if not, write to the Free Software
+ Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA
+ 02110-1301  USA
+
+ $%ENDLICENSE%$ */
+#ifndef __NETWORK_MYSQLD_RESULTSET_WRITER_H__
+#define __NETWORK_MYSQLD_RESULTSET_WRITER_H__
+
+#include <glib.h>
+
+#include "network-socket.h"
+
+#include "network-exports.h"
+
+/**
+ * writes a text result-set into the send-queue of a socket
+ *
+ * the packets are packed back to back into buffers of the buffer-pool
+ * instead of allocating a GString per packet. A buffer is appended to
+ * the send-queue as soon as it is full or network_mysqld_resultset_writer_flush()
+ * is called, the rows can be generated one by one.
+ *
+ *   w = network_mysqld_resultset_writer_new(con->client);
+ *   network_mysqld_resultset_writer_write_fields(w, fields);
+ *   for (...) network_mysqld_resultset_writer_write_row(w, row);
+ *   network_mysqld_resultset_writer_finish(w);
+ *   network_mysqld_resultset_writer_free(w);
+ */
+typedef struct {
+	network_socket *sock;
+
+	GString *batch;     /**< packets that aren't in the send-queue yet */
+	gsize batch_size;   /**< move the batch to the send-queue once it is this large */
+
+	gsize row_offset;   /**< start of the row packet in ->batch, see _row_start() */
+	gboolean in_row;
+
+	guint fields_len;
+	guint64 rows;       /**< rows written so far */
+
+	gboolean deprecate_eof; /**< CLIENT_DEPRECATE_EOF: no EOF after the fields, a OK ends the rows */
+} network_mysqld_resultset_writer_t;
+
+NETWORK_API network_mysqld_resultset_writer_t *network_mysqld_resultset_writer_new(network_socket *sock);
+NETWORK_API void network_mysqld_resultset_writer_free(network_mysqld_resultset_writer_t *w);
+
+NETWORK_API int network_mysqld_resultset_writer_write_fields(network_mysqld_resultset_writer_t *w, GPtrArray *fields);
+NETWORK_API int network_mysqld_resultset_writer_write_row(network_mysqld_resultset_writer_t *w, GPtrArray *row);
+NETWORK_API int network_mysqld_resultset_writer_write_row_len(network_mysqld_resultset_writer_t *w, const char **values, const gsize *values_len);
+
+NETWORK_API int network_mysqld_resultset_writer_row_start(network_mysqld_resultset_writer_t *w);
+NETWORK_API int network_mysqld_resultset_writer_row_append(network_mysqld_resultset_writer_t *w, const char *s, gsize s_len);
+NETWORK_API int network_mysqld_resultset_writer_row_end(network_mysqld_resultset_writer_t *w);
+
+NETWORK_API void network_mysqld_resultset_writer_flush(network_mysqld_resultset_writer_t *w);
+NETWORK_API int network_mysqld_resultset_writer_finish(network_mysqld_resultset_writer_t *w);
+
+#endif
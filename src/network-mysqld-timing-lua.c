@@ -0,0 +1,84 @@
+/* $%BEGINLICENSE%$
+ Copyright (c) 2008, 2012, Oracle and/or its affiliates. All rights reserved.
+
+ This program is free software; you can redistribute it and/or
+ modify it under the terms of the GNU General Public License as
+ published by the Free Software Foundation; version 2 of the
+ License.
+
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ GNU General Public License for more details.
+
+ You should have received a copy of the GNU General Public License
+ along with this program; if not, write to the Free Software
+ Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA
+ 02110-1301  USA
+
+ $%ENDLICENSE%$ */
+#include <string.h>
+
+#include <lua.h>
+
+#include "lua-env.h"
+#include "glib-ext.h"
+
+#include "network-mysqld-timing.h"
+#include "network-mysqld-timing-lua.h"
+
+/**
+ * get the aggregated timings of the connections
+ *
+ * proxy.global.timings.<name>
+ *   accept_to_auth      => accept() until the client is authed
+ *   query_to_send       => query read until it is sent to the server
+ *   query_to_first_byte => query read until the first byte of the result arrives
+ *   query_to_last_byte  => query read until the result is sent to the client
+ *
+ * each is a table of count, sum_usec, avg_usec and max_usec
+ *
+ * @return nil or requested information
+ */
+static int proxy_timings_get(lua_State *L) {
+	network_mysqld_timings_t *timings = *(network_mysqld_timings_t **)luaL_checkself(L);
+	gsize keysize = 0;
+	const char *key = luaL_checklstring(L, 2, &keysize);
+	network_mysqld_timing_stat_t stat;
+	gint timing;
+
+	for (timing = 0; timing < NETWORK_MYSQLD_TIMING_MAX; timing++) {
+		const char *name = network_mysqld_timing_get_name(timing);
+
+		if (strleq(key, keysize, name, strlen(name))) break;
+	}
+
+	if (timing == NETWORK_MYSQLD_TIMING_MAX) {
+		lua_pushnil(L);
+
+		return 1;
+	}
+
+	network_mysqld_timings_get(timings, timing, &stat);
+
+	lua_newtable(L);
+	lua_pushnumber(L, stat.count);
+	lua_setfield(L, -2, "count");
+	lua_pushnumber(L, network_mysqld_timings_cycles_to_usec(stat.sum_cycles));
+	lua_setfield(L, -2, "sum_usec");
+	lua_pushnumber(L, stat.count > 0 ? network_mysqld_timings_cycles_to_usec(stat.sum_cycles) / stat.count : 0);
+	lua_setfield(L, -2, "avg_usec");
+	lua_pushnumber(L, network_mysqld_timings_cycles_to_usec(stat.max_cycles));
+	lua_setfield(L, -2, "max_usec");
+
+	return 1;
+}
+
+int network_mysqld_timings_lua_getmetatable(lua_State *L) {
+	static const struct luaL_reg methods[] = {
+		{ "__index", proxy_timings_get },
+		{ NULL, NULL },
+	};
+
+	return proxy_getmetatable(L, methods);
+}
@@ -0,0 +1,178 @@
+/* $%BEGINLICENSE%$
+ Copyright (c) 2008, 2012, Oracle and/or its affiliates. All rights reserved.
+
+ This program is free software; you can redistribute it and/or
+ modify it under the terms of the GNU General Public License as
+ published by the Free Software Foundation; version 2 of the
+ License.
+
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ GNU General Public License for more details.
+
+ You should have received a copy of the GNU General Public License
+ along with this program; if not, write to the Free Software
+ Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA
+ 02110-1301  USA
+
+ $%ENDLICENSE%$ */
+/**
+ * always-on timings of the connections
+ *
+ * the state-machine records each state-transition with its cycle-count in a small
+ * ring in the connection. A few of the transitions close a interval which is added
+ * to the aggregates of the event-thread, the admin plugin sums them up.
+ *
+ * NETWORK_MYSQLD_CON_TRACK_TIME() is the detailed, but expensive debug-variant
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <glib.h>
+
+#include "network-mysqld.h"
+#include "network-mysqld-timing.h"
+#include "network-mysqld-metrics.h"
+#include "chassis-event-thread.h"
+#include "chassis-timings.h"
+#include "my_rdtsc.h"
+
+network_mysqld_timings_t *network_mysqld_timings_new(void) {
+	return g_new0(network_mysqld_timings_t, 1);
+}
+
+void network_mysqld_timings_free(network_mysqld_timings_t *timings) {
+	if (!timings) return;
+
+	g_free(timings);
+}
+
+/**
+ * add a interval to the shard of the current event-thread
+ *
+ * if there are more event-threads than shards, two threads may share a shard and
+ * lose a update now and then
+ */
+void network_mysqld_timings_add(network_mysqld_timings_t *timings, network_mysqld_timing_t timing, guint64 cycles) {
+	network_mysqld_timing_stat_t *stat;
+
+	if (!timings) return;
+
+	stat = &(timings->shards[chassis_event_thread_get_local_index() % NETWORK_MYSQLD_TIMINGS_SHARDS].stats[timing]);
+
+	stat->count++;
+	stat->sum_cycles += cycles;
+	if (cycles > stat->max_cycles) stat->max_cycles = cycles;
+}
+
+/**
+ * sum up the shards
+ *
+ * the shards are written without a lock, the sum may be off by the queries in flight
+ */
+void network_mysqld_timings_get(network_mysqld_timings_t *timings, network_mysqld_timing_t timing, network_mysqld_timing_stat_t *stat) {
+	guint i;
+
+	stat->count = 0;
+	stat->sum_cycles = 0;
+	stat->max_cycles = 0;
+
+	for (i = 0; i < NETWORK_MYSQLD_TIMINGS_SHARDS; i++) {
+		network_mysqld_timing_stat_t *shard = &(timings->shards[i].stats[timing]);
+
+		stat->count      += shard->count;
+		stat->sum_cycles += shard->sum_cycles;
+		if (shard->max_cycles > stat->max_cycles) stat->max_cycles = shard->max_cycles;
+	}
+}
+
+const char *network_mysqld_timing_get_name(network_mysqld_timing_t timing) {
+	switch (timing) {
+	case NETWORK_MYSQLD_TIMING_ACCEPT_TO_AUTH: return "accept_to_auth";
+	case NETWORK_MYSQLD_TIMING_QUERY_TO_SEND: return "query_to_send";
+	case NETWORK_MYSQLD_TIMING_QUERY_TO_FIRST_BYTE: return "query_to_first_byte";
+	case NETWORK_MYSQLD_TIMING_QUERY_TO_LAST_BYTE: return "query_to_last_byte";
+	case NETWORK_MYSQLD_TIMING_MAX: break;
+	}
+
+	return NULL;
+}
+
+/**
+ * convert cycles into microseconds
+ *
+ * @return the microseconds, 0 if the frequency of the cycle-timer is unknown
+ */
+gdouble network_mysqld_timings_cycles_to_usec(guint64 cycles) {
+	if (NULL == chassis_timestamps_global ||
+	    0 == chassis_timestamps_global->cycles_frequency) return 0;
+
+	return (gdouble)cycles * 1000000.0 / chassis_timestamps_global->cycles_frequency;
+}
+
+void network_mysqld_con_timing_accept(network_mysqld_con_timing_t *t) {
+	t->accept_cycles = my_timer_cycles();
+}
+
+/**
+ * record a state-transition
+ *
+ * re-entering the same state (e.g. after a event) isn't recorded
+ */
+void network_mysqld_con_timing_enter_state(network_mysqld_con_timing_t *t, network_mysqld_timings_t *timings, gint state) {
+	network_mysqld_con_timing_entry_t *entry;
+	guint64 now;
+
+	if (t->ring_pos > 0 &&
+	    t->ring[(t->ring_pos - 1) % NETWORK_MYSQLD_CON_TIMING_RING_SIZE].state == state) return;
+
+	now = my_timer_cycles();
+
+	entry = &(t->ring[t->ring_pos++ % NETWORK_MYSQLD_CON_TIMING_RING_SIZE]);
+	entry->state = state;
+	entry->cycles = now;
+
+	switch (state) {
+	case CON_STATE_READ_QUERY:
+		if (!t->is_authed) {
+			t->is_authed = TRUE;
+			if (t->accept_cycles) network_mysqld_timings_add(timings, NETWORK_MYSQLD_TIMING_ACCEPT_TO_AUTH, now - t->accept_cycles);
+		} else if (t->query_cycles) {
+			network_mysqld_timings_add(timings, NETWORK_MYSQLD_TIMING_QUERY_TO_LAST_BYTE, now - t->query_cycles);
+			NETWORK_MYSQLD_METRICS_OBSERVE(query_duration, (guint64)network_mysqld_timings_cycles_to_usec(now - t->query_cycles));
+		}
+		t->query_cycles = 0;
+		break;
+	case CON_STATE_SEND_QUERY:
+		/* only the first of the injected queries */
+		if (t->query_cycles && !t->query_is_sent) {
+			t->query_is_sent = TRUE;
+			network_mysqld_timings_add(timings, NETWORK_MYSQLD_TIMING_QUERY_TO_SEND, now - t->query_cycles);
+		}
+		break;
+	default:
+		break;
+	}
+}
+
+/**
+ * the query is read completely and is passed to the plugin
+ */
+void network_mysqld_con_timing_query_read(network_mysqld_con_timing_t *t) {
+	t->query_cycles = my_timer_cycles();
+	t->query_is_sent = FALSE;
+	t->first_byte_seen = FALSE;
+}
+
+/**
+ * we got something from the server for the query in flight
+ */
+void network_mysqld_con_timing_first_byte(network_mysqld_con_timing_t *t, network_mysqld_timings_t *timings) {
+	if (t->first_byte_seen || 0 == t->query_cycles) return;
+
+	t->first_byte_seen = TRUE;
+	network_mysqld_timings_add(timings, NETWORK_MYSQLD_TIMING_QUERY_TO_FIRST_BYTE, my_timer_cycles() - t->query_cycles);
+}
@@ -0,0 +1,102 @@
+/* $%BEGINLICENSE%$
+ Copyright (c) 2008, 2012, Oracle and/or its affiliates. All rights reserved.
+
+ This program is free software; you can redistribute it and/or
+ modify it under the terms of the GNU General Public License as
+ published by the Free Software Foundation; version 2 of the
+ License.
+
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ GNU General Public License for more details.
+
+ You should have received a copy of the GNU General Public License
+ along with this program; if not, write to the Free Software
+ Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA
+ 02110-1301  USA
+
+ $%ENDLICENSE%$ */
+#ifndef __NETWORK_MYSQLD_TIMING_H__
+#define __NETWORK_MYSQLD_TIMING_H__
+
+#include <glib.h>
+
+#include "network-exports.h"
+
+/**
+ * state-transitions kept per connection
+ */
+#define NETWORK_MYSQLD_CON_TIMING_RING_SIZE 16
+
+/**
+ * shards of the aggregates, the event-thread with index n adds to shard n % NETWORK_MYSQLD_TIMINGS_SHARDS
+ */
+#define NETWORK_MYSQLD_TIMINGS_SHARDS 64
+
+typedef enum {
+	NETWORK_MYSQLD_TIMING_ACCEPT_TO_AUTH,       /**< accept() until the client is authed */
+	NETWORK_MYSQLD_TIMING_QUERY_TO_SEND,        /**< query read until it is sent to the server, the time the plugin takes */
+	NETWORK_MYSQLD_TIMING_QUERY_TO_FIRST_BYTE,  /**< query read until the first byte of the result arrives */
+	NETWORK_MYSQLD_TIMING_QUERY_TO_LAST_BYTE,   /**< query read until the result is sent to the client */
+
+	NETWORK_MYSQLD_TIMING_MAX
+} network_mysqld_timing_t;
+
+typedef struct {
+	guint64 count;
+	guint64 sum_cycles;
+	guint64 max_cycles;
+} network_mysqld_timing_stat_t;
+
+typedef struct {
+	network_mysqld_timing_stat_t stats[NETWORK_MYSQLD_TIMING_MAX];
+
+	guint64 _pad[4]; /**< keep the shards of the event-threads on their own cache-lines */
+} network_mysqld_timings_shard_t;
+
+/**
+ * the aggregated timings of all connections
+ *
+ * each event-thread only writes to its own shard, readers sum them up without a lock
+ */
+typedef struct {
+	network_mysqld_timings_shard_t shards[NETWORK_MYSQLD_TIMINGS_SHARDS];
+} network_mysqld_timings_t;
+
+typedef struct {
+	gint    state;   /**< the network_mysqld_con_state_t that was entered */
+	guint64 cycles;  /**< my_timer_cycles() when it was entered */
+} network_mysqld_con_timing_entry_t;
+
+/**
+ * the timings of a connection
+ *
+ * embedded in the network_mysqld_con, recording a transition is a my_timer_cycles() and
+ * a store into the ring
+ */
+typedef struct {
+	network_mysqld_con_timing_entry_t ring[NETWORK_MYSQLD_CON_TIMING_RING_SIZE];
+	guint ring_pos;            /**< number of transitions seen, the last one is at (ring_pos - 1) % RING_SIZE */
+
+	guint64 accept_cycles;
+	guint64 query_cycles;      /**< the query was read, 0 if no query is in flight */
+
+	gboolean is_authed;
+	gboolean query_is_sent;
+	gboolean first_byte_seen;
+} network_mysqld_con_timing_t;
+
+NETWORK_API network_mysqld_timings_t *network_mysqld_timings_new(void);
+NETWORK_API void network_mysqld_timings_free(network_mysqld_timings_t *timings);
+NETWORK_API void network_mysqld_timings_add(network_mysqld_timings_t *timings, network_mysqld_timing_t timing, guint64 cycles);
+NETWORK_API void network_mysqld_timings_get(network_mysqld_timings_t *timings, network_mysqld_timing_t timing, network_mysqld_timing_stat_t *stat);
+NETWORK_API const char *network_mysqld_timing_get_name(network_mysqld_timing_t timing);
+NETWORK_API gdouble network_mysqld_timings_cycles_to_usec(guint64 cycles);
+
+NETWORK_API void network_mysqld_con_timing_accept(network_mysqld_con_timing_t *t);
+NETWORK_API void network_mysqld_con_timing_enter_state(network_mysqld_con_timing_t *t, network_mysqld_timings_t *timings, gint state);
+NETWORK_API void network_mysqld_con_timing_query_read(network_mysqld_con_timing_t *t);
+NETWORK_API void network_mysqld_con_timing_first_byte(network_mysqld_con_timing_t *t, network_mysqld_timings_t *timings);
+
+#endif
@@ -68,12 +68,17 @@
 #include "network-mysqld-proto.h"
 #include "network-mysqld-packet.h"
 #include "network-conn-pool.h"
+#include "network-buffer-pool.h"
+#include "network-object-pool.h"
+#include "network-mysqld-resultset-writer.h"
 #include "chassis-mainloop.h"
 #include "chassis-event-thread.h"
+#include "chassis-handoff.h"
 #include "lua-scope.h"
 #include "glib-ext.h"
 #include "network-asn1.h"
 #include "network-spnego.h"
+#include "network-spool.h"
 
 #if defined(HAVE_SYS_SDT_H) && defined(ENABLE_DTRACE)
 #include <sys/sdt.h>
@@ -132,9 +137,11 @@ network_socket_retval_t plugin_call_cleanup(chassis *srv, network_mysqld_con *co
 	
 	if (!func) return retval;
 
-	LOCK_LUA(srv->priv->sc);
+	LOCK_LUA(network_mysqld_con_get_lua_scope(con));
+	lua_scope_set_mem_account(network_mysqld_con_get_lua_scope(con), &(con->lua_mem));
 	retval = (*func)(srv, con);
-	UNLOCK_LUA(srv->priv->sc);
+	lua_scope_set_mem_account(network_mysqld_con_get_lua_scope(con), NULL);
+	UNLOCK_LUA(network_mysqld_con_get_lua_scope(con));
 
 	return retval;
 }
@@ -158,15 +165,17 @@ plugin_call_timeout(chassis *srv, network_mysqld_con *con) {
 		/* default implementation */
 		g_debug("%s: connection between %s and %s timed out. closing it",
 				G_STRLOC,
-				con->client ? con->client->src->name->str : "(client)",
+				con->client ? network_address_get_name(con->client->src) : "(client)",
 				con->server ? con->server->dst->name->str : "(server)");
 		con->state = CON_STATE_ERROR;
 		return NETWORK_SOCKET_SUCCESS;
 	}
 
-	LOCK_LUA(srv->priv->sc);
+	LOCK_LUA(network_mysqld_con_get_lua_scope(con));
+	lua_scope_set_mem_account(network_mysqld_con_get_lua_scope(con), &(con->lua_mem));
 	retval = (*func)(srv, con);
-	UNLOCK_LUA(srv->priv->sc);
+	lua_scope_set_mem_account(network_mysqld_con_get_lua_scope(con), NULL);
+	UNLOCK_LUA(network_mysqld_con_get_lua_scope(con));
 
 	return retval;
 }
@@ -178,12 +187,61 @@ chassis_private *network_mysqld_priv_init(void) {
 	priv = g_new0(chassis_private, 1);
 
 	priv->cons = g_ptr_array_new();
+	priv->cons_mutex = g_mutex_new();
 	priv->sc = lua_scope_new();
 	priv->backends  = network_backends_new();
+	priv->query_cache = network_query_cache_new();
+	priv->timings = network_mysqld_timings_new();
+	priv->query_digest = network_query_digest_new();
+	priv->shared_dict = network_shared_dict_new();
+	priv->flow_control = network_flow_control_new();
+	priv->rate_limiter = network_rate_limiter_new();
+	priv->firewall = network_firewall_new();
+	priv->filters = network_mysqld_filters_new();
 
 	return priv;
 }
 
+/**
+ * get the queues of the idle client back, see network_socket_park()
+ */
+static void network_mysqld_con_unpark(network_mysqld_con *con) {
+	if (!con->is_parked) return;
+
+	network_socket_unpark(con->client);
+	con->is_parked = FALSE;
+	NETWORK_MYSQLD_METRICS_ADD(connections_parked, -1);
+}
+
+/**
+ * add the parked client to the end of the idle clients of our event-thread
+ *
+ * the plugins walk them from the head, the longest waiting first: to give the backend
+ * connections of the idle clients back to the pool and to close them under pressure. Only if
+ * the events stay in their thread, see chassis_event_thread_keeps_events(): the next event of
+ * the client has to come in the thread that owns the list. A client that was moved to another
+ * thread is added there when it waits for its next query again.
+ */
+static void network_mysqld_con_idle_enter(network_mysqld_con *con) {
+	chassis_event_thread_t *event_thread;
+
+	if (!con->is_parked || !chassis_event_thread_keeps_events(con->srv)) return;
+	if (NULL == (event_thread = chassis_event_thread_get_local())) return;
+
+	if (0 == con->idle_since) con->idle_since = chassis_get_coarse_rel_microseconds();
+
+	con->idle_link.data = con;
+	g_queue_push_tail_link(&(event_thread->idle_cons), &(con->idle_link));
+	con->idle_thread = event_thread;
+}
+
+static void network_mysqld_con_idle_leave(network_mysqld_con *con) {
+	if (NULL == con->idle_thread) return;
+
+	g_queue_unlink(&(con->idle_thread->idle_cons), &(con->idle_link));
+	con->idle_thread = NULL;
+}
+
 void network_mysqld_priv_shutdown(chassis *chas, chassis_private *priv) {
 	if (!priv) return;
 
@@ -194,17 +252,49 @@ void network_mysqld_priv_shutdown(chassis *chas, chassis_private *priv) {
 	while (0 != priv->cons->len) {
 		network_mysqld_con *con = priv->cons->pdata[0];
 
+		network_mysqld_con_unpark(con);
+
 		plugin_call_cleanup(chas, con);
 		network_mysqld_con_free(con);
 	}
 }
 
+/**
+ * count the client connections, the listening sockets don't count
+ */
+gint network_mysqld_priv_count_connections(chassis G_GNUC_UNUSED *chas, chassis_private *priv) {
+	gint count = 0;
+	guint i;
+
+	if (!priv) return 0;
+
+	g_mutex_lock(priv->cons_mutex);
+	for (i = 0; i < priv->cons->len; i++) {
+		network_mysqld_con *con = priv->cons->pdata[i];
+
+		if (con->is_accepted) count++;
+	}
+	g_mutex_unlock(priv->cons_mutex);
+
+	return count;
+}
+
 void network_mysqld_priv_free(chassis G_GNUC_UNUSED *chas, chassis_private *priv) {
 	if (!priv) return;
 
 	g_ptr_array_free(priv->cons, TRUE);
+	g_mutex_free(priv->cons_mutex);
 
 	network_backends_free(priv->backends);
+	network_query_cache_free(priv->query_cache);
+	network_mysqld_timings_free(priv->timings);
+	network_query_digest_free(priv->query_digest);
+	network_shared_dict_free(priv->shared_dict);
+	network_mysqld_metrics_free(priv->metrics);
+	network_flow_control_free(priv->flow_control);
+	network_rate_limiter_free(priv->rate_limiter);
+	network_firewall_free(priv->firewall);
+	network_mysqld_filters_free(priv->filters);
 
 	lua_scope_free(priv->sc);
 
@@ -215,8 +305,13 @@ int network_mysqld_init(chassis *srv) {
 	lua_State *L;
 	srv->priv_free = network_mysqld_priv_free;
 	srv->priv_shutdown = network_mysqld_priv_shutdown;
+	srv->priv_count_connections = network_mysqld_priv_count_connections;
 	srv->priv      = network_mysqld_priv_init();
 
+	srv->priv->metrics = network_mysqld_metrics_new(srv);
+	chassis_metrics_register_collector(srv->metrics, network_mysqld_metrics_collect_backends, srv->priv->backends);
+	chassis_metrics_register_collector(srv->metrics, network_mysqld_metrics_collect_flow_control, srv->priv->flow_control);
+
 	/* store the pointer to the chassis in the Lua registry */
 	L = srv->priv->sc->L;
 	lua_pushlightuserdata(L, (void*)srv);
@@ -229,6 +324,22 @@ int network_mysqld_init(chassis *srv) {
 network_mysqld_con *network_mysqld_con_init() {
 	return network_mysqld_con_new();
 }
+
+/**
+ * connections each event-thread keeps for the next clients
+ */
+#define NETWORK_MYSQLD_CON_POOL_MAX_IDLE 32
+
+static void network_mysqld_con_destroy(network_mysqld_con *con) {
+	g_string_free(con->auth_switch_to_method, TRUE);
+	g_string_free(con->auth_switch_to_data, TRUE);
+	chassis_timestamps_free(con->timestamps);
+
+	g_free(con);
+}
+
+static network_object_pool_t con_pool = NETWORK_OBJECT_POOL_INIT(NETWORK_MYSQLD_CON_POOL_MAX_IDLE, network_mysqld_con_destroy);
+
 /**
  * create a connection 
  *
@@ -237,12 +348,20 @@ network_mysqld_con *network_mysqld_con_init() {
 network_mysqld_con *network_mysqld_con_new() {
 	network_mysqld_con *con;
 
-	con = g_new0(network_mysqld_con, 1);
-	con->timestamps = chassis_timestamps_new();
+	/* a connection from the pool is zero'ed, only the timestamps and the strings are kept */
+	if (NULL == (con = network_object_pool_get(&con_pool))) {
+		con = g_new0(network_mysqld_con, 1);
+		con->timestamps = chassis_timestamps_new();
+		con->auth_switch_to_method = g_string_new(NULL);
+		con->auth_switch_to_data   = g_string_new(NULL);
+	}
 	con->parse.command = -1;
-	con->auth_switch_to_method = g_string_new(NULL);
+	network_mysqld_activity_init(&(con->activity));
 	con->auth_switch_to_round  = 0;
-	con->auth_switch_to_data   = g_string_new(NULL);;
+
+	/* there is no need to try to send 5 bytes, wait for 64k and flush them all */
+	con->send_queue_high_watermark = 64 * 1024;
+	con->send_queue_low_watermark = 0;
 
 	/* some tiny helper macros */
 #define SECONDS ( 1 )
@@ -266,7 +385,9 @@ network_mysqld_con *network_mysqld_con_new() {
 void network_mysqld_add_connection(chassis *srv, network_mysqld_con *con) {
 	con->srv = srv;
 
+	g_mutex_lock(srv->priv->cons_mutex);
 	g_ptr_array_add(srv->priv->cons, con);
+	g_mutex_unlock(srv->priv->cons_mutex);
 }
 
 /**
@@ -277,24 +398,94 @@ void network_mysqld_add_connection(chassis *srv, network_mysqld_con *con) {
  * @param con    connection context
  */
 void network_mysqld_con_free(network_mysqld_con *con) {
+	chassis_timestamps_t *timestamps;
+	GString *auth_switch_to_method;
+	GString *auth_switch_to_data;
+
 	if (!con) return;
 
 	if (con->parse.data && con->parse.data_free) {
 		con->parse.data_free(con->parse.data);
 	}
 
+	/* leave the conns-array first, the admin-interface looks at the sockets of the connections in it */
+	g_mutex_lock(con->srv->priv->cons_mutex);
+	g_ptr_array_remove_fast(con->srv->priv->cons, con);
+	g_mutex_unlock(con->srv->priv->cons_mutex);
+
+	/* a plugin may still hold a socket that is registered for this connection */
+	if (con->persistent_wait_sock) network_socket_event_del(con->persistent_wait_sock);
+	if (con->is_yielding) event_del(&(con->yield_event));
+	network_mysqld_con_idle_leave(con);
+
+	if (con->spool) network_spool_free(con->spool);
+
+	if (con->event_thread) g_atomic_int_add(&(con->event_thread->connections), -1);
+
 	if (con->server) network_socket_free(con->server);
 	if (con->client) network_socket_free(con->client);
 
-	g_string_free(con->auth_switch_to_method, TRUE);
-	g_string_free(con->auth_switch_to_data, TRUE);
+	if (con->is_accepted) NETWORK_MYSQLD_METRICS_ADD(connections, -1);
+	if (con->is_parked) NETWORK_MYSQLD_METRICS_ADD(connections_parked, -1);
+	NETWORK_MYSQLD_METRICS_ADD(connections_memory, -(gint64)con->memory_bytes);
+	network_flow_control_account(con->srv->priv->flow_control, &(con->send_queue_accounted), 0);
 
-	/* we are still in the conns-array */
+	timestamps = con->timestamps;
+	auth_switch_to_method = con->auth_switch_to_method;
+	auth_switch_to_data = con->auth_switch_to_data;
 
-	g_ptr_array_remove_fast(con->srv->priv->cons, con);
-	chassis_timestamps_free(con->timestamps);
+	chassis_timestamps_reset(timestamps);
+	g_string_truncate(auth_switch_to_method, 0);
+	g_string_truncate(auth_switch_to_data, 0);
 
-	g_free(con);
+	memset(con, 0, sizeof(*con));
+	con->timestamps = timestamps;
+	con->auth_switch_to_method = auth_switch_to_method;
+	con->auth_switch_to_data = auth_switch_to_data;
+
+	if (network_object_pool_put(&con_pool, con)) return;
+
+	network_mysqld_con_destroy(con);
+}
+
+/**
+ * close a idle client with a error packet
+ *
+ * for the plugins that close the longest idle clients under pressure: called from the
+ * event-thread of the connection, outside of its state-machine, while the client waits for
+ * its next query, see network_mysqld_con_idle_enter(). The connection is freed.
+ */
+void network_mysqld_con_evict(network_mysqld_con *con, const char *errmsg, gsize errmsg_len) {
+	g_return_if_fail(con->state == CON_STATE_READ_QUERY);
+
+	/* stop waiting for the next query */
+	network_socket_event_del(con->client);
+	network_mysqld_con_idle_leave(con);
+	network_mysqld_con_unpark(con);
+
+	/* not a answer to a command of the client */
+	network_mysqld_queue_reset(con->client);
+	network_mysqld_con_send_error_full(con->client, errmsg, errmsg_len, ER_CON_COUNT_ERROR, "08004");
+
+	con->state = CON_STATE_SEND_ERROR;
+	network_mysqld_con_handle(-1, 0, con);
+}
+
+/**
+ * get the bytes allocated for the connection and its sockets
+ *
+ * the state of the plugin isn't counted. Only call it from the event-thread that handles the
+ * connection, other threads use the snapshot in con->memory_bytes.
+ */
+gsize network_mysqld_con_get_memory(network_mysqld_con *con) {
+	gsize bytes;
+
+	bytes = sizeof(*con);
+	bytes += network_socket_get_memory(con->client);
+	bytes += network_socket_get_memory(con->server);
+	bytes += con->auth_switch_to_method->allocated_len + con->auth_switch_to_data->allocated_len;
+
+	return bytes;
 }
 
 #if 0 
@@ -576,21 +767,31 @@ network_socket_retval_t network_mysqld_con_get_packet(chassis G_GNUC_UNUSED*chas
 	GString *packet = NULL;
 	GString header;
 	char header_str[NET_HEADER_SIZE + 1] = "";
+	const gchar *header_ptr;
 	guint32 packet_len;
 	guint8  packet_id;
 
 	/** 
 	 * read the packet header (4 bytes)
+	 *
+	 * usually the header is in the first chunk and we can decode it in place,
+	 * only copy it if it spans chunks
 	 */
-	header.str = header_str;
-	header.allocated_len = sizeof(header_str);
-	header.len = 0;
+	if (NULL != (header_ptr = network_queue_peek_str(con->recv_queue_raw, NET_HEADER_SIZE))) {
+		header.str = (gchar *)header_ptr;
+		header.allocated_len = NET_HEADER_SIZE;
+		header.len = NET_HEADER_SIZE;
+	} else {
+		header.str = header_str;
+		header.allocated_len = sizeof(header_str);
+		header.len = 0;
 
-	/* read the packet len if the leading packet */
-	if (!network_queue_peek_string(con->recv_queue_raw, NET_HEADER_SIZE, &header)) {
-		/* too small */
+		/* read the packet len if the leading packet */
+		if (!network_queue_peek_string(con->recv_queue_raw, NET_HEADER_SIZE, &header)) {
+			/* too small */
 
-		return NETWORK_SOCKET_WAIT_FOR_EVENT;
+			return NETWORK_SOCKET_WAIT_FOR_EVENT;
+		}
 	}
 
 	packet_len = network_mysqld_proto_get_packet_len(&header);
@@ -615,6 +816,8 @@ network_socket_retval_t network_mysqld_con_get_packet(chassis G_GNUC_UNUSED*chas
 		} else {
 			con->last_packet_id = packet_id;
 		}
+
+		MYSQLPROXY_PACKET_READ(con->fd, packet_len, packet_id);
 	
 		network_queue_append(con->recv_queue, packet);
 	} else {
@@ -631,7 +834,12 @@ network_socket_retval_t network_mysqld_con_get_packet(chassis G_GNUC_UNUSED*chas
  * with packet-header and everything 
  */
 network_socket_retval_t network_mysqld_read(chassis G_GNUC_UNUSED*chas, network_socket *con) {
-	switch (network_socket_read(con)) {
+	chassis_event_thread_cpu_t cpu = chassis_event_thread_cpu_enter(CHASSIS_EVENT_THREAD_CPU_SOCKET);
+	network_socket_retval_t ret = network_socket_read(con);
+
+	chassis_event_thread_cpu_leave(cpu);
+
+	switch (ret) {
 	case NETWORK_SOCKET_WAIT_FOR_EVENT:
 		return NETWORK_SOCKET_WAIT_FOR_EVENT;
 	case NETWORK_SOCKET_ERROR:
@@ -647,10 +855,27 @@ network_socket_retval_t network_mysqld_read(chassis G_GNUC_UNUSED*chas, network_
 }
 
 network_socket_retval_t network_mysqld_write(chassis G_GNUC_UNUSED*chas, network_socket *con) {
+	chassis_event_thread_cpu_t cpu = chassis_event_thread_cpu_enter(CHASSIS_EVENT_THREAD_CPU_SOCKET);
 	network_socket_retval_t ret;
 
 	ret = network_socket_write(con, -1);
 
+	chassis_event_thread_cpu_leave(cpu);
+
+	return ret;
+}
+
+/**
+ * network_socket_read_adaptive() with its cycles accounted to the socket-subsystem
+ */
+static network_socket_retval_t network_mysqld_read_adaptive(network_socket *sock) {
+	chassis_event_thread_cpu_t cpu = chassis_event_thread_cpu_enter(CHASSIS_EVENT_THREAD_CPU_SOCKET);
+	network_socket_retval_t ret;
+
+	ret = network_socket_read_adaptive(sock);
+
+	chassis_event_thread_cpu_leave(cpu);
+
 	return ret;
 }
 
@@ -666,8 +891,27 @@ network_socket_retval_t network_mysqld_write(chassis G_GNUC_UNUSED*chas, network
  */
 network_socket_retval_t plugin_call(chassis *srv, network_mysqld_con *con, int state) {
 	network_socket_retval_t ret;
+	chassis_event_thread_cpu_t cpu;
 	NETWORK_MYSQLD_PLUGIN_FUNC(func) = NULL;
 
+	/* the filters of the C modules come first, they may handle the state themselves */
+	if (state != CON_STATE_ERROR && srv->priv && srv->priv->filters->chains[state]) {
+		network_mysqld_filter_ret_t filter_ret;
+
+		cpu = chassis_event_thread_cpu_enter(CHASSIS_EVENT_THREAD_CPU_PROTOCOL);
+		filter_ret = network_mysqld_filters_call(srv->priv->filters, srv, con, state);
+		chassis_event_thread_cpu_leave(cpu);
+
+		switch (filter_ret) {
+		case NETWORK_MYSQLD_FILTER_NEXT:
+			break;
+		case NETWORK_MYSQLD_FILTER_DONE:
+			return NETWORK_SOCKET_SUCCESS;
+		case NETWORK_MYSQLD_FILTER_ERROR:
+			return NETWORK_SOCKET_ERROR;
+		}
+	}
+
 	switch (state) {
 	case CON_STATE_INIT:
 		func = con->plugins.con_init;
@@ -741,10 +985,12 @@ network_socket_retval_t plugin_call(chassis *srv, network_mysqld_con *con, int s
 				 * if we switched to win-auth and SPNEGO is used, check if the response packet contains:
 				 * 
 				 *   negState = accept-succeeded.
+				 *
+				 * caching_sha2_password's fast-auth-success is followed by the OK packet
+				 *
+				 * @see network_mysqld_con_track_auth_result_state()
 				 */
-				if ((strleq(S(con->auth_switch_to_method), C("authentication_windows_client"))) &&
-				    con->auth_next_packet_is_from_server) {
-					/* we either have SPNEGO or NTLM */
+				if (con->auth_next_packet_is_from_server) {
 					con->state = CON_STATE_READ_AUTH_RESULT;
 					break;
 				}
@@ -869,6 +1115,14 @@ network_socket_retval_t plugin_call(chassis *srv, network_mysqld_con *con, int s
 			con->state = CON_STATE_READ_QUERY;
 		}
 
+		break;
+	case CON_STATE_WAIT_ASYNC:
+		func = con->plugins.con_wait_async;
+
+		if (!func) { /* only plugins that know how to wake us up get here */
+			con->state = CON_STATE_ERROR;
+		}
+
 		break;
 	case CON_STATE_READ_LOCAL_INFILE_RESULT:
 		func = con->plugins.con_read_local_infile_result;
@@ -888,9 +1142,13 @@ network_socket_retval_t plugin_call(chassis *srv, network_mysqld_con *con, int s
 	}
 	if (!func) return NETWORK_SOCKET_SUCCESS;
 
-	LOCK_LUA(srv->priv->sc);
+	LOCK_LUA(network_mysqld_con_get_lua_scope(con));
+	lua_scope_set_mem_account(network_mysqld_con_get_lua_scope(con), &(con->lua_mem));
+	cpu = chassis_event_thread_cpu_enter(CHASSIS_EVENT_THREAD_CPU_PROTOCOL);
 	ret = (*func)(srv, con);
-	UNLOCK_LUA(srv->priv->sc);
+	chassis_event_thread_cpu_leave(cpu);
+	lua_scope_set_mem_account(network_mysqld_con_get_lua_scope(con), NULL);
+	UNLOCK_LUA(network_mysqld_con_get_lua_scope(con));
 
 	return ret;
 }
@@ -934,6 +1192,9 @@ const char *network_mysqld_con_state_get_name(network_mysqld_con_state_t state)
 	case CON_STATE_SEND_LOCAL_INFILE_DATA: return "CON_STATE_SEND_LOCAL_INFILE_DATA";
 	case CON_STATE_READ_LOCAL_INFILE_RESULT: return "CON_STATE_READ_LOCAL_INFILE_RESULT";
 	case CON_STATE_SEND_LOCAL_INFILE_RESULT: return "CON_STATE_SEND_LOCAL_INFILE_RESULT";
+	case CON_STATE_WAIT_ASYNC: return "CON_STATE_WAIT_ASYNC";
+	case CON_STATE_READ_LONG_DATA: return "CON_STATE_READ_LONG_DATA";
+	case CON_STATE_SEND_LONG_DATA: return "CON_STATE_SEND_LONG_DATA";
 	case CON_STATE_CLOSE_CLIENT: return "CON_STATE_CLOSE_CLIENT";
 	case CON_STATE_CLOSE_SERVER: return "CON_STATE_CLOSE_SERVER";
 	case CON_STATE_ERROR: return "CON_STATE_ERROR";
@@ -979,7 +1240,26 @@ static int network_mysqld_con_track_auth_result_state(network_mysqld_con *con) {
 		con->auth_switch_to_round = 0;
 		con->auth_next_packet_is_from_server = FALSE;
 	} else if (state == 0x01) {
-		if ((strleq(S(con->auth_switch_to_method), C("authentication_windows_client")))) {
+		GString *auth_method = con->auth_switch_to_method;
+
+		if (auth_method->len == 0 && con->client->response) {
+			/* no auth-switch, the client picked the method of the handshake */
+			auth_method = con->client->response->auth_plugin_name;
+		}
+
+		if (strleq(S(auth_method), C("caching_sha2_password"))) {
+			guint8 fast_auth_state = 0;
+
+			/* the server had the password in its cache: 0x03 (fast-auth-success) is followed
+			 * by the OK packet. 0x04 (perform-full-authentication) and the public-key
+			 * are answered by the client */
+			if (packet.data->len - packet.offset == 2) {
+				err = err || network_mysqld_proto_skip(&packet, 1);
+				err = err || network_mysqld_proto_get_int8(&packet, &fast_auth_state);
+			}
+
+			con->auth_next_packet_is_from_server = (fast_auth_state == 0x03);
+		} else if ((strleq(S(con->auth_switch_to_method), C("authentication_windows_client")))) {
 			GError *gerr = NULL;
 
 			/* if the packet comes from the server, has a 0x01, is SPNEGO and has 'accept-completed' set,
@@ -993,12 +1273,11 @@ static int network_mysqld_con_track_auth_result_state(network_mysqld_con *con) {
 				g_clear_error(&gerr);
 				err = 1;
 			} else {
-				network_spnego_response_token *token;
+				network_spnego_response_state neg_state;
 
-				token = network_spnego_response_token_new();
-
-				if (TRUE == network_spnego_proto_get_response_token(&packet, token, &gerr)) {
-					if (token->negState != SPNEGO_RESPONSE_STATE_ACCEPT_INCOMPLETE) {
+				/* only the negState is needed, the tokens aren't copied */
+				if (TRUE == network_spnego_proto_get_response_state(&packet, &neg_state, &gerr)) {
+					if (neg_state != SPNEGO_RESPONSE_STATE_ACCEPT_INCOMPLETE) {
 						con->auth_next_packet_is_from_server = TRUE;
 					}
 				} else {
@@ -1006,8 +1285,6 @@ static int network_mysqld_con_track_auth_result_state(network_mysqld_con *con) {
 					/* do we care why it failed ? */
 					g_clear_error(&gerr);
 				}
-
-				network_spnego_response_token_free(token);
 			}
 		}
 	}
@@ -1015,157 +1292,828 @@ static int network_mysqld_con_track_auth_result_state(network_mysqld_con *con) {
 }
 
 /**
- * handle the different states of the MySQL protocol
+ * check if the forwarded result should stop to wait for the client
  *
- * @param event_fd     fd on which the event was fired
- * @param events       the event that was fired
- * @param user_data    the connection handle
+ * @see network_flow_control_should_pause()
  */
-void network_mysqld_con_handle(int event_fd, short events, void *user_data) {
-	network_mysqld_con_state_t ostate;
-	network_mysqld_con *con = user_data;
-	chassis *srv = con->srv;
-	int retval;
-	network_socket_retval_t call_ret;
+static gboolean network_mysqld_con_result_should_pause(chassis *srv, network_mysqld_con *con) {
+	/* the spool keeps the send-queue small, the server is read at full speed */
+	if (con->spool_threshold > 0) return FALSE;
 
-	g_assert(srv);
-	g_assert(con);
+	return network_flow_control_should_pause(srv->priv->flow_control, &(con->send_queue_accounted),
+			con->client->send_queue->len,
+			con->send_queue_high_watermark, con->send_queue_low_watermark);
+}
 
-	if (events == EV_READ) {
-		int b = -1;
+/**
+ * bytes taken from the spool at once to refill the send-queue
+ */
+#define NETWORK_MYSQLD_CON_SPOOL_REFILL (64 * 1024)
 
-		/**
-		 * check how much data there is to read
-		 *
-		 * ioctl()
-		 * - returns 0 if connection is closed
-		 * - or -1 and ECONNRESET on solaris
-		 *   or -1 and EPIPE on HP/UX
-		 */
-		if (ioctl(event_fd, FIONREAD, &b)) {
-			switch (errno) {
-			case E_NET_CONNRESET: /* solaris */
-			case EPIPE: /* hp/ux */
-				if (con->client && event_fd == con->client->fd) {
-					/* the client closed the connection, let's keep the server side open */
-					con->state = CON_STATE_CLOSE_CLIENT;
-				} else if (con->server && event_fd == con->server->fd && con->com_quit_seen) {
-					con->state = CON_STATE_CLOSE_SERVER;
-				} else {
-					/* server side closed on use, oops, close both sides */
-					con->state = CON_STATE_ERROR;
-				}
-				break;
-			default:
-				g_critical("ioctl(%d, FIONREAD, ...) failed: %s", event_fd, g_strerror(errno));
+/**
+ * refill the send-queue of the client from the spool
+ *
+ * the send-queue has what comes before the spool, the spool is appended to it. A spool
+ * that is read back completely is closed.
+ */
+static gboolean network_mysqld_con_spool_refill(network_mysqld_con *con) {
+	network_queue *send_queue = con->client->send_queue;
+	GError *gerr = NULL;
+	GString *chunk;
 
-				con->state = CON_STATE_ERROR;
-				break;
-			}
-		} else if (b != 0) {
-			if (con->client && event_fd == con->client->fd) {
-				con->client->to_read = b;
-			} else if (con->server && event_fd == con->server->fd) {
-				con->server->to_read = b;
-			} else {
-				g_error("%s.%d: neither nor", __FILE__, __LINE__);
-			}
-		} else { /* Linux */
-			if (con->client && event_fd == con->client->fd) {
-				/* the client closed the connection, let's keep the server side open */
-				con->state = CON_STATE_CLOSE_CLIENT;
-			} else if (con->server && event_fd == con->server->fd && con->com_quit_seen) {
-				con->state = CON_STATE_CLOSE_SERVER;
-			} else {
-				/* server side closed on use, oops, close both sides */
-				con->state = CON_STATE_ERROR;
-			}
-		}
-	} else if (events == EV_TIMEOUT) {
-		/* if we got a timeout on CON_STATE_CONNECT_SERVER we should pick another backend */
-		switch ((retval = plugin_call_timeout(srv, con))) {
-		case NETWORK_SOCKET_SUCCESS:
-			/* the plugin did set a reasonable next state */
-			break;
-		default:
-			con->state = CON_STATE_ERROR;
-			break;
+	if (NULL == con->spool || send_queue->len >= NETWORK_MYSQLD_CON_SPOOL_REFILL) return TRUE;
+
+	if (NULL == (chunk = network_spool_read(con->spool, NETWORK_MYSQLD_CON_SPOOL_REFILL, &gerr))) {
+		if (gerr) {
+			g_critical("%s: %s", G_STRLOC, gerr->message);
+			g_clear_error(&gerr);
+
+			return FALSE;
 		}
+	} else {
+		network_queue_append(send_queue, chunk);
 	}
 
-#define WAIT_FOR_EVENT(ev_struct, ev_type, timeout) \
-	event_set(&(ev_struct->event), ev_struct->fd, ev_type, network_mysqld_con_handle, user_data); \
-	chassis_event_add_with_timeout(srv, &(ev_struct->event), timeout); 
+	if (0 == network_spool_get_len(con->spool)) {
+		network_spool_free(con->spool);
+		con->spool = NULL;
+	}
 
-	/**
-	 * loop on the same connection as long as we don't end up in a stable state
-	 */
+	return TRUE;
+}
 
-	if (event_fd != -1) {
-		NETWORK_MYSQLD_CON_TRACK_TIME(con, "wait_for_event::done");
-	} else {
-		NETWORK_MYSQLD_CON_TRACK_TIME(con, "con_handle_start");
+/**
+ * move what the last step of the result appended to the send-queue of the client to the spool
+ *
+ * once the send-queue is above the spool_threshold the rest of the result goes to the
+ * spool. Every NETWORK_MYSQLD_CON_SPOOL_REFILL bytes the client gets what it takes without
+ * waiting, a slow client doesn't cost a write per packet.
+ *
+ * @param first  the chunks the send-queue had before the step, they stay in front of the spool
+ * @return FALSE if the spool or the client failed
+ */
+static gboolean network_mysqld_con_spool(chassis *srv, network_mysqld_con *con, guint first) {
+	network_queue *send_queue = con->client->send_queue;
+	GError *gerr = NULL;
+	GList *link;
+
+	if (NULL == con->spool) {
+		if (send_queue->len <= con->spool_threshold) return TRUE;
+
+		con->spool = network_spool_new();
+		con->spool_unsent = 0;
+		NETWORK_MYSQLD_METRICS_ADD(results_spooled_total, 1);
 	}
 
-	do {
-		struct timeval timeout;
+	for (link = g_queue_peek_nth_link(send_queue->chunks, first); link; ) {
+		GList *next = link->next;
+		GString *chunk = link->data;
 
-		ostate = con->state;
-#ifdef NETWORK_DEBUG_TRACE_STATE_CHANGES
-		/* if you need the state-change information without dtrace, enable this */
-		g_debug("%s: [%d] %s",
-				G_STRLOC,
-				getpid(),
-				network_mysqld_con_state_get_name(con->state));
-#endif
+		if (NULL == gerr) network_spool_write(con->spool, S(chunk), &gerr);
+		con->spool_unsent += chunk->len;
 
-		MYSQLPROXY_STATE_CHANGE(event_fd, events, con->state);
-		switch (con->state) {
-		case CON_STATE_ERROR:
-			/* we can't go on, close the connection */
-			{
-				gchar *which_connection = "a"; /* some connection, don't know yet */
-				if (con->server && event_fd == con->server->fd) {
-					which_connection = "server";
-				} else if (con->client && event_fd == con->client->fd) {
-					which_connection = "client";
-				}
-				g_debug("[%s]: error on %s connection (fd: %d event: %d). closing client connection.",
-						G_STRLOC, which_connection,	event_fd, events);
-			}
-			plugin_call_cleanup(srv, con);
-			network_mysqld_con_free(con);
+		send_queue->len -= chunk->len;
+		network_buffer_pool_put(chunk);
+		g_queue_delete_link(send_queue->chunks, link);
 
-			con = NULL;
+		link = next;
+	}
 
-			return;
-		case CON_STATE_CLOSE_CLIENT:
-		case CON_STATE_CLOSE_SERVER:
-			/* FIXME: this comment has nothing to do with reality...
-			 * the server connection is still fine, 
-			 * let's keep it open for reuse */
+	if (gerr) {
+		g_critical("%s: %s", G_STRLOC, gerr->message);
+		g_clear_error(&gerr);
 
-			plugin_call_cleanup(srv, con);
-#ifdef NETWORK_MYSQLD_WANT_CON_TRACK_TIME 
-			/* dump the timestamps of this connection */
-			if (srv->log->min_lvl == G_LOG_LEVEL_DEBUG) {
-				GList *node;
-				guint64 abs_usec = 0;
-				guint64 wait_event_usec = 0;
-				guint64 lua_usec = 0;
+		return FALSE;
+	}
 
-				for (node = con->timestamps->timestamps->head; node; node = node->next) {
-					chassis_timestamp_t *prev = node->prev ? node->prev->data : NULL;
-					chassis_timestamp_t *cur = node->data;
-					guint64 rel_usec = prev ? cur->usec - prev->usec: 0;
-					guint64 rel_cycles = prev ? cur->cycles - prev->cycles: 0;
+	if (con->spool_unsent < NETWORK_MYSQLD_CON_SPOOL_REFILL) return TRUE;
+	con->spool_unsent = 0;
 
-					abs_usec += rel_usec;
+	do {
+		if (!network_mysqld_con_spool_refill(con)) return FALSE;
 
-					g_debug("%-35s usec=%8"G_GUINT64_FORMAT", cycles=%8"G_GUINT64_FORMAT", abs-usec=%8"G_GUINT64_FORMAT" (%s:%d)",
-							cur->name,
-							rel_usec,
-							rel_cycles,
+		switch (network_mysqld_write(srv, con->client)) {
+		case NETWORK_SOCKET_SUCCESS:
+			break;
+		case NETWORK_SOCKET_WAIT_FOR_EVENT:
+			return TRUE;
+		default:
+			return FALSE;
+		}
+	} while (con->spool);
+
+	return TRUE;
+}
+
+/**
+ * track the packet-id of a packet that we forward from the server to the client
+ *
+ * @see network_mysqld_con_get_packet(), network_mysqld_queue_append_raw()
+ */
+static int network_mysqld_con_forward_packet_id(network_socket *recv_sock, network_socket *send_sock, GString *packet) {
+	guint8 packet_id = network_mysqld_proto_get_packet_id(packet);
+
+	if (recv_sock->packet_id_is_reset) {
+		recv_sock->last_packet_id = packet_id;
+		recv_sock->packet_id_is_reset = FALSE;
+	} else if (packet_id != (guint8)(recv_sock->last_packet_id + 1)) {
+		g_critical("%s: received packet-id %d, but expected %d ... out of sync.",
+				G_STRLOC,
+				packet_id,
+				recv_sock->last_packet_id + 1);
+		return -1;
+	} else {
+		recv_sock->last_packet_id = packet_id;
+	}
+
+	if (send_sock->packet_id_is_reset) {
+		send_sock->last_packet_id = packet_id;
+		send_sock->packet_id_is_reset = FALSE;
+	} else {
+		send_sock->last_packet_id++;
+
+		if (packet_id != send_sock->last_packet_id) {
+			network_mysqld_proto_set_packet_id(packet, send_sock->last_packet_id);
+		}
+	}
+
+	return 0;
+}
+
+/**
+ * forward the result of a query from the server to the client without splitting it into packets
+ *
+ * the complete packets in the raw recv-queue of the server are parsed in place to find the end of 
+ * the result. Chunks which only contain complete packets are moved as is to the send-queue of the 
+ * client, only the chunks that are only partially consumed are copied. A packet which spans over 
+ * several chunks is taken from the queue with network_mysqld_con_get_packet().
+ *
+ * runs of rows are only counted, see network_mysqld_proto_skip_query_result_rows()
+ *
+ * rows of NETWORK_MYSQLD_STREAM_PACKET_MIN bytes or more are streamed: once their header is in, their
+ * payload is forwarded as it arrives. A packet of 0xffffff bytes is continued by the next packet which
+ * is streamed in any case as it isn't a packet of its own.
+ *
+ * @return NETWORK_SOCKET_SUCCESS if all available data was consumed or the result is finished,
+ *         NETWORK_SOCKET_ERROR on a protocol error
+ */
+static network_socket_retval_t network_mysqld_con_forward_query_result(chassis *srv, network_mysqld_con *con) {
+	network_socket *recv_sock = con->server;
+	network_socket *send_sock = con->client;
+	network_queue *raw = recv_sock->recv_queue_raw;
+	GString *chunk;
+
+	while (!con->resultset_is_finished && (chunk = g_queue_peek_head(raw->chunks))) {
+		gsize off = raw->offset;
+		int is_finished = 0;
+
+		if (chunk->len == 0) {
+			/* a empty chunk left behind by a failed read() */
+			network_buffer_pool_put(g_queue_pop_head(raw->chunks));
+			continue;
+		}
+
+		if (con->stream_packet_left > 0) {
+			/* forward what we have of the streamed packet */
+			gsize avail = chunk->len - raw->offset;
+
+			if (raw->offset == 0 && avail <= con->stream_packet_left) {
+				network_queue_append(send_sock->send_queue, g_queue_pop_head(raw->chunks));
+				raw->len -= chunk->len;
+			} else {
+				avail = MIN(avail, con->stream_packet_left);
+				network_queue_append(send_sock->send_queue, network_queue_pop_string(raw, avail, NULL));
+			}
+			con->stream_packet_left -= avail;
+
+			continue;
+		}
+
+		/* walk all the complete packets in this chunk */
+		while (off + NET_HEADER_SIZE <= chunk->len) {
+			GString packet;
+			network_packet p;
+			guint32 packet_len;
+			gsize skipped;
+
+			/* the rows are only counted, jump over them in bulk */
+			if (!con->stream_packet_is_continued &&
+			    !recv_sock->packet_id_is_reset &&
+			    !send_sock->packet_id_is_reset &&
+			    0 < (skipped = network_mysqld_proto_skip_query_result_rows(con, chunk->str + off, chunk->len - off,
+						&(recv_sock->last_packet_id), &(send_sock->last_packet_id)))) {
+				off += skipped;
+				continue;
+			}
+
+			packet.str = chunk->str + off;
+			packet.len = NET_HEADER_SIZE;
+			packet.allocated_len = NET_HEADER_SIZE;
+
+			packet_len = network_mysqld_proto_get_packet_len(&packet);
+			if (off + NET_HEADER_SIZE + packet_len > chunk->len) break; /* the packet continues in the next chunk */
+
+			packet.len = packet.allocated_len = NET_HEADER_SIZE + packet_len;
+
+			if (0 != network_mysqld_con_forward_packet_id(recv_sock, send_sock, &packet)) return NETWORK_SOCKET_ERROR;
+
+			off += packet.len;
+
+			if (con->stream_packet_is_continued) {
+				/* the tail of a 0xffffff packet, nothing to parse */
+				con->stream_packet_is_continued = (packet_len == PACKET_LEN_MAX);
+				continue;
+			}
+			con->stream_packet_is_continued = (packet_len == PACKET_LEN_MAX);
+
+			p.data = &packet;
+			p.offset = 0;
+
+			is_finished = network_mysqld_proto_get_query_result(&p, con);
+			if (is_finished == -1) return NETWORK_SOCKET_ERROR;
+
+			if (is_finished) break;
+		}
+
+		if (off == chunk->len && raw->offset == 0) {
+			/* the whole chunk is ours, move it over */
+			network_queue_append(send_sock->send_queue, g_queue_pop_head(raw->chunks));
+			raw->len -= chunk->len;
+		} else if (off > raw->offset) {
+			/* copy the packets we parsed and leave the rest in the raw-queue */
+			network_queue_append(send_sock->send_queue, network_queue_pop_string(raw, off - raw->offset, NULL));
+		} else {
+			/* the first packet spans several chunks, fall back to normal packet handling */
+			GString *packet;
+			network_packet p;
+			const gchar *s;
+
+			if (NULL != (s = network_queue_peek_str(raw, NET_HEADER_SIZE + 1))) {
+				GString header;
+				guint32 packet_len;
+
+				header.str = (gchar *)s;
+				header.len = header.allocated_len = NET_HEADER_SIZE;
+
+				packet_len = network_mysqld_proto_get_packet_len(&header);
+
+				if (con->stream_packet_is_continued ||
+				    (packet_len >= NETWORK_MYSQLD_STREAM_PACKET_MIN &&
+				     network_mysqld_proto_get_query_result_row(con, (guint8)s[NET_HEADER_SIZE], packet_len))) {
+					/* the header is fixed up in place and forwarded with the payload */
+					if (0 != network_mysqld_con_forward_packet_id(recv_sock, send_sock, &header)) return NETWORK_SOCKET_ERROR;
+
+					con->stream_packet_is_continued = (packet_len == PACKET_LEN_MAX);
+					con->stream_packet_left = NET_HEADER_SIZE + packet_len;
+
+					continue;
+				}
+			}
+
+			switch (network_mysqld_con_get_packet(srv, recv_sock)) {
+			case NETWORK_SOCKET_SUCCESS:
+				break;
+			case NETWORK_SOCKET_WAIT_FOR_EVENT:
+				/* the packet isn't complete yet */
+				return NETWORK_SOCKET_SUCCESS;
+			default:
+				return NETWORK_SOCKET_ERROR;
+			}
+			packet = g_queue_pop_tail(recv_sock->recv_queue->chunks);
+
+			p.data = packet;
+			p.offset = 0;
+
+			/* the tail of a 0xffffff packet isn't parsed */
+			if (!con->stream_packet_is_continued) {
+				is_finished = network_mysqld_proto_get_query_result(&p, con);
+				if (is_finished == -1) {
+					g_string_free(packet, TRUE);
+					return NETWORK_SOCKET_ERROR;
+				}
+			}
+			con->stream_packet_is_continued = (packet->len == NET_HEADER_SIZE + PACKET_LEN_MAX);
+
+			network_mysqld_queue_append_raw(send_sock, send_sock->send_queue, packet);
+		}
+
+		if (is_finished) con->resultset_is_finished = TRUE;
+	}
+
+	return NETWORK_SOCKET_SUCCESS;
+}
+
+/**
+ * track the header of a LOAD DATA LOCAL INFILE data packet
+ *
+ * the packet-id is fixed up in place, the empty packet sets .local_file_data_is_finished
+ *
+ * @return -1 on a protocol error, 0 otherwise
+ */
+static int network_mysqld_con_forward_local_infile_header(network_mysqld_con *con, GString *header) {
+	guint32 packet_len = network_mysqld_proto_get_packet_len(header);
+
+	if (0 != network_mysqld_con_forward_packet_id(con->client, con->server, header)) return -1;
+
+	if (packet_len == 0 && !con->stream_packet_is_continued) {
+		network_packet p;
+
+		/* the empty packet ends the data, let the result-tracker see it */
+		p.data = header;
+		p.offset = 0;
+
+		if (1 != network_mysqld_proto_get_query_result(&p, con)) return -1;
+
+		con->local_file_data_is_finished = TRUE;
+	}
+	con->stream_packet_is_continued = (packet_len == PACKET_LEN_MAX);
+
+	return 0;
+}
+
+/**
+ * forward the data of a LOAD DATA LOCAL INFILE from the client to the server without splitting it into packets
+ *
+ * the data packets are opaque, only their headers are looked at to fix the packet-ids and to find the
+ * empty packet that ends the data. Chunks are moved as is to the send-queue of the server, a packet
+ * that continues in the next chunks is streamed as it arrives.
+ *
+ * @return NETWORK_SOCKET_SUCCESS if all available data was consumed or the data is finished,
+ *         NETWORK_SOCKET_ERROR on a protocol error
+ */
+static network_socket_retval_t network_mysqld_con_forward_local_infile_data(network_mysqld_con *con) {
+	network_socket *send_sock = con->server;
+	network_queue *raw = con->client->recv_queue_raw;
+	GString *chunk;
+
+	while (!con->local_file_data_is_finished && (chunk = g_queue_peek_head(raw->chunks))) {
+		gsize off = raw->offset;
+
+		if (chunk->len == 0) {
+			/* a empty chunk left behind by a failed read() */
+			network_buffer_pool_put(g_queue_pop_head(raw->chunks));
+			continue;
+		}
+
+		if (con->stream_packet_left > 0) {
+			/* forward what we have of the streamed packet */
+			gsize avail = chunk->len - raw->offset;
+
+			if (raw->offset == 0 && avail <= con->stream_packet_left) {
+				network_queue_append(send_sock->send_queue, g_queue_pop_head(raw->chunks));
+				raw->len -= chunk->len;
+			} else {
+				avail = MIN(avail, con->stream_packet_left);
+				network_queue_append(send_sock->send_queue, network_queue_pop_string(raw, avail, NULL));
+			}
+			con->stream_packet_left -= avail;
+
+			continue;
+		}
+
+		/* walk the headers of the packets in this chunk */
+		while (!con->local_file_data_is_finished && off + NET_HEADER_SIZE <= chunk->len) {
+			GString header;
+			guint32 packet_len;
+
+			header.str = chunk->str + off;
+			header.len = header.allocated_len = NET_HEADER_SIZE;
+
+			packet_len = network_mysqld_proto_get_packet_len(&header);
+
+			if (0 != network_mysqld_con_forward_local_infile_header(con, &header)) return NETWORK_SOCKET_ERROR;
+
+			off += NET_HEADER_SIZE;
+
+			if (off + packet_len > chunk->len) {
+				/* stream the rest of the packet as it arrives */
+				con->stream_packet_left = off + packet_len - chunk->len;
+				off = chunk->len;
+				break;
+			}
+
+			off += packet_len;
+		}
+
+		if (off == chunk->len && raw->offset == 0) {
+			/* the whole chunk is ours, move it over */
+			network_queue_append(send_sock->send_queue, g_queue_pop_head(raw->chunks));
+			raw->len -= chunk->len;
+		} else if (off > raw->offset) {
+			/* copy the packets we walked and leave the rest in the raw-queue */
+			network_queue_append(send_sock->send_queue, network_queue_pop_string(raw, off - raw->offset, NULL));
+		} else {
+			/* the header spans several chunks, take it out and stream the payload */
+			GString *header;
+
+			if (raw->len < NET_HEADER_SIZE) break; /* wait for the rest of the header */
+
+			header = network_queue_pop_string(raw, NET_HEADER_SIZE, NULL);
+
+			if (0 != network_mysqld_con_forward_local_infile_header(con, header)) {
+				g_string_free(header, TRUE);
+				return NETWORK_SOCKET_ERROR;
+			}
+			con->stream_packet_left = network_mysqld_proto_get_packet_len(header);
+
+			network_queue_append(send_sock->send_queue, header);
+		}
+	}
+
+	return NETWORK_SOCKET_SUCCESS;
+}
+
+/**
+ * forward the packets that continue a overlong COM_STMT_SEND_LONG_DATA as they arrive
+ *
+ * the plugin only saw the first packet of the command, the rest is passed through with fixed up
+ * packet-ids. Without a send_sock the rest is dropped, the plugin didn't send the command on.
+ *
+ * @return NETWORK_SOCKET_SUCCESS if all available data was consumed or the command is complete,
+ *         NETWORK_SOCKET_ERROR on a protocol error
+ */
+static network_socket_retval_t network_mysqld_con_forward_long_data(network_mysqld_con *con, network_socket *send_sock) {
+	network_socket *recv_sock = con->client;
+	network_queue *raw = recv_sock->recv_queue_raw;
+
+	while (con->long_data_is_streamed || con->long_data_packet_left > 0) {
+		GString *chunk;
+		gsize avail;
+
+		if (con->long_data_packet_left == 0) {
+			GString *header;
+			guint32 packet_len;
+
+			if (raw->len < NET_HEADER_SIZE) break; /* wait for the rest of the header */
+
+			header = network_queue_pop_string(raw, NET_HEADER_SIZE, NULL);
+			packet_len = network_mysqld_proto_get_packet_len(header);
+
+			if (send_sock && 0 != network_mysqld_con_forward_packet_id(recv_sock, send_sock, header)) {
+				g_string_free(header, TRUE);
+				return NETWORK_SOCKET_ERROR;
+			}
+
+			/* all but the last packet have 0xffffff bytes */
+			con->long_data_is_streamed = (packet_len == PACKET_LEN_MAX);
+			con->long_data_packet_left = packet_len;
+
+			if (send_sock) {
+				network_queue_append(send_sock->send_queue, header);
+			} else {
+				g_string_free(header, TRUE);
+			}
+
+			continue;
+		}
+
+		if (NULL == (chunk = g_queue_peek_head(raw->chunks))) break;
+
+		if (chunk->len == 0) {
+			/* a empty chunk left behind by a failed read() */
+			network_buffer_pool_put(g_queue_pop_head(raw->chunks));
+			continue;
+		}
+
+		avail = MIN(chunk->len - raw->offset, con->long_data_packet_left);
+
+		if (raw->offset == 0 && avail == chunk->len) {
+			g_queue_pop_head(raw->chunks);
+			raw->len -= chunk->len;
+		} else {
+			chunk = network_queue_pop_string(raw, avail, NULL);
+		}
+		con->long_data_packet_left -= avail;
+
+		if (send_sock) {
+			network_queue_append(send_sock->send_queue, chunk);
+		} else {
+			g_string_free(chunk, TRUE);
+		}
+	}
+
+	return NETWORK_SOCKET_SUCCESS;
+}
+
+/**
+ * wait for a event on a socket of the connection
+ *
+ * a TLS handshake may have to read while we want to write, ->wait_events overrides the event of the state.
+ * The timeouts go to the timer-wheel of the event-thread, re-arming them is cheap.
+ *
+ * with --event-persistent-waits the event is added with EV_PERSIST and stays registered with the
+ * backend of libevent after it fired: if the connection waits for the same event on the same socket
+ * again (the next packets of a result-set, the next query of the client) only the timeout is re-armed
+ * and libevent doesn't call epoll_ctl(). Any other wait removes the registration first.
+ */
+static void network_mysqld_con_wait_for_event(network_mysqld_con *con, network_socket *sock, short ev_type, struct timeval *timeout) {
+	chassis *srv = con->srv;
+	short events = sock->wait_events ? sock->wait_events : ev_type;
+
+	if (con->persistent_wait_sock == sock &&
+	    sock->event.ev_events == (events | EV_PERSIST) &&
+	    event_pending(&(sock->event), events, NULL)) {
+		/* adding a event that is still registered only re-arms its timer */
+		chassis_event_add_with_timer(srv, &(sock->event), &(sock->event_timer), timeout);
+
+		return;
+	}
+
+	if (con->persistent_wait_sock) network_socket_event_del(con->persistent_wait_sock);
+
+	if (srv->event_persistent_waits && chassis_event_thread_keeps_events(srv)) {
+		event_set(&(sock->event), sock->fd, events | EV_PERSIST, network_mysqld_con_handle, con);
+		con->persistent_wait_sock = sock;
+		sock->persistent_wait_ref = (gpointer *)&(con->persistent_wait_sock);
+	} else {
+		event_set(&(sock->event), sock->fd, events, network_mysqld_con_handle, con);
+	}
+	chassis_event_add_with_timer(srv, &(sock->event), &(sock->event_timer), timeout);
+}
+
+/**
+ * move a connection that waits for its next query to a less busy event-thread
+ *
+ * with --event-threads-rebalance or if the thread is draining, see chassis_event_threads_set_active().
+ * The client has to be parked (its queues are empty and released) and the server connection
+ * mustn't have anything queued: nothing of the connection is touched by this thread anymore
+ * once the wait is queued to the other thread.
+ *
+ * @return TRUE if the wait went to the other thread
+ */
+static gboolean network_mysqld_con_migrate(network_mysqld_con *con, struct timeval *timeout) {
+	chassis *srv = con->srv;
+	chassis_event_thread_t *event_thread = chassis_event_thread_get_local();
+	chassis_event_thread_t *idle_thread;
+	network_socket *sock = con->client;
+
+	if (!chassis_event_thread_keeps_events(srv)) return FALSE;
+	if (!srv->event_threads_rebalance && !chassis_event_threads_is_draining(srv->threads, event_thread)) return FALSE;
+	if (!con->is_parked || sock->wait_events) return FALSE;
+	if (con->server &&
+	    (con->server->send_queue->chunks->length > 0 ||
+	     con->server->recv_queue->chunks->length > 0 ||
+	     con->server->recv_queue_raw->chunks->length > 0)) {
+		return FALSE;
+	}
+
+	if (NULL == (idle_thread = chassis_event_threads_pick_idle(srv->threads, event_thread))) return FALSE;
+
+	if (con->persistent_wait_sock) network_socket_event_del(con->persistent_wait_sock);
+	chassis_timer_wheel_remove(&(sock->event_timer));
+
+	/* the timer-wheel is per thread, the other thread takes the timeout from libevent */
+	event_set(&(sock->event), sock->fd, EV_READ, network_mysqld_con_handle, con);
+	chassis_event_add_to_thread(idle_thread, &(sock->event), timeout);
+
+	return TRUE;
+}
+
+static void network_mysqld_con_handle_state(int event_fd, short events, void *user_data);
+
+/**
+ * queries of a connection handled per wakeup
+ *
+ * a client that pipelines its queries could keep its event-thread busy forever, the
+ * state-machine hands the thread back to the other connections after this many
+ */
+#define NETWORK_MYSQLD_CON_QUERY_BUDGET 16
+
+/**
+ * reads of a result-set per wakeup that don't wait for the event-loop first
+ */
+#define NETWORK_MYSQLD_CON_READ_BUDGET 16
+
+static void network_mysqld_con_yield_done(int G_GNUC_UNUSED event_fd, short G_GNUC_UNUSED events, void *user_data) {
+	network_mysqld_con *con = user_data;
+
+	con->is_yielding = FALSE;
+
+	network_mysqld_con_handle(-1, 0, con);
+}
+
+/**
+ * let the other connections of the event-thread run and come back to this one
+ *
+ * the next query may already be in the recv-queue: waiting for EV_READ on the socket
+ * would miss it. The connection is re-entered with a timer that expires right away
+ * instead, behind the events that are already active.
+ */
+static void network_mysqld_con_yield(network_mysqld_con *con) {
+	struct timeval now = { 0, 0 };
+
+	if (con->persistent_wait_sock) network_socket_event_del(con->persistent_wait_sock);
+
+	con->is_yielding = TRUE;
+	evtimer_set(&(con->yield_event), network_mysqld_con_yield_done, con);
+	chassis_event_add_with_timeout(con->srv, &(con->yield_event), &now);
+}
+
+/**
+ * handle a event of a connection
+ *
+ * accounts the connection and the time spent handling its event to the event-thread, the
+ * connection moves with its events if they are handled by another thread. The cycles are
+ * accounted to the subsystems it calls, see chassis_event_thread_cpu_enter()
+ *
+ * @see network_mysqld_con_handle_state()
+ */
+void network_mysqld_con_handle(int event_fd, short events, void *user_data) {
+	network_mysqld_con *con = user_data;
+	chassis_event_thread_t *event_thread = chassis_event_thread_get_local();
+	guint64 start_usec;
+
+	if (NULL == event_thread) {
+		network_mysqld_con_handle_state(event_fd, events, user_data);
+		return;
+	}
+
+	if (con->event_thread != event_thread) {
+		if (con->event_thread) g_atomic_int_add(&(con->event_thread->connections), -1);
+		g_atomic_int_inc(&(event_thread->connections));
+		con->event_thread = event_thread;
+	}
+
+	/* a plugin may handle other connections from inside a hook, their time is already ours */
+	if (event_thread->handle_depth++ > 0) {
+		network_mysqld_con_handle_state(event_fd, events, user_data);
+		event_thread->handle_depth--;
+		return;
+	}
+
+	start_usec = chassis_get_rel_microseconds();
+	chassis_event_thread_cpu_start(event_thread);
+
+	network_mysqld_con_handle_state(event_fd, events, user_data); /* may free the connection */
+
+	chassis_event_thread_cpu_stop(event_thread);
+	chassis_event_thread_account(event_thread, start_usec, chassis_get_rel_microseconds());
+	event_thread->handle_depth--;
+}
+
+/**
+ * handle the different states of the MySQL protocol
+ *
+ * @param event_fd     fd on which the event was fired
+ * @param events       the event that was fired
+ * @param user_data    the connection handle
+ */
+static void network_mysqld_con_handle_state(int event_fd, short events, void *user_data) {
+	network_mysqld_con_state_t ostate;
+	network_mysqld_con *con = user_data;
+	chassis *srv = con->srv;
+	int retval;
+	network_socket_retval_t call_ret;
+	guint queries_handled = 0; /* see NETWORK_MYSQLD_CON_QUERY_BUDGET */
+	guint reads_handled = 0;   /* see NETWORK_MYSQLD_CON_READ_BUDGET */
+
+	g_assert(srv);
+	g_assert(con);
+
+	chassis_coarse_clock_update();
+
+	/* the event fired, its timeout is void */
+	if (con->client && event_fd == con->client->fd) chassis_timer_wheel_remove(&(con->client->event_timer));
+	if (con->server && event_fd == con->server->fd) chassis_timer_wheel_remove(&(con->server->event_timer));
+
+	network_mysqld_con_unpark(con);
+	network_mysqld_con_idle_leave(con);
+
+	if (events == EV_READ) {
+		int b = -1;
+
+		/**
+		 * check how much data there is to read
+		 *
+		 * ioctl()
+		 * - returns 0 if connection is closed
+		 * - or -1 and ECONNRESET on solaris
+		 *   or -1 and EPIPE on HP/UX
+		 */
+		if (ioctl(event_fd, FIONREAD, &b)) {
+			switch (errno) {
+			case E_NET_CONNRESET: /* solaris */
+			case EPIPE: /* hp/ux */
+				if (con->client && event_fd == con->client->fd) {
+					/* the client closed the connection, let's keep the server side open */
+					con->state = CON_STATE_CLOSE_CLIENT;
+				} else if (con->server && event_fd == con->server->fd && con->com_quit_seen) {
+					con->state = CON_STATE_CLOSE_SERVER;
+				} else {
+					/* server side closed on use, oops, close both sides */
+					con->state = CON_STATE_ERROR;
+				}
+				break;
+			default:
+				g_critical("ioctl(%d, FIONREAD, ...) failed: %s", event_fd, g_strerror(errno));
+
+				con->state = CON_STATE_ERROR;
+				break;
+			}
+		} else if (b != 0) {
+			if (con->client && event_fd == con->client->fd) {
+				con->client->to_read = b;
+			} else if (con->server && event_fd == con->server->fd) {
+				con->server->to_read = b;
+			} else {
+				g_error("%s.%d: neither nor", __FILE__, __LINE__);
+			}
+		} else { /* Linux */
+			if (con->client && event_fd == con->client->fd) {
+				/* the client closed the connection, let's keep the server side open */
+				con->state = CON_STATE_CLOSE_CLIENT;
+			} else if (con->server && event_fd == con->server->fd && con->com_quit_seen) {
+				con->state = CON_STATE_CLOSE_SERVER;
+			} else {
+				/* server side closed on use, oops, close both sides */
+				con->state = CON_STATE_ERROR;
+			}
+		}
+	} else if (events == EV_TIMEOUT) {
+		/* if we got a timeout on CON_STATE_CONNECT_SERVER we should pick another backend */
+		switch ((retval = plugin_call_timeout(srv, con))) {
+		case NETWORK_SOCKET_SUCCESS:
+			/* the plugin did set a reasonable next state */
+			break;
+		default:
+			con->state = CON_STATE_ERROR;
+			break;
+		}
+	}
+
+#define WAIT_FOR_EVENT(ev_struct, ev_type, timeout) \
+	network_mysqld_con_wait_for_event(con, ev_struct, ev_type, timeout);
+
+	/**
+	 * loop on the same connection as long as we don't end up in a stable state
+	 */
+
+	if (event_fd != -1) {
+		NETWORK_MYSQLD_CON_TRACK_TIME(con, "wait_for_event::done");
+	} else {
+		NETWORK_MYSQLD_CON_TRACK_TIME(con, "con_handle_start");
+	}
+
+	do {
+		struct timeval timeout;
+
+		ostate = con->state;
+#ifdef NETWORK_DEBUG_TRACE_STATE_CHANGES
+		/* if you need the state-change information without dtrace, enable this */
+		g_debug("%s: [%d] %s",
+				G_STRLOC,
+				getpid(),
+				network_mysqld_con_state_get_name(con->state));
+#endif
+
+		MYSQLPROXY_STATE_CHANGE(event_fd, events, con->state);
+		network_mysqld_con_timing_enter_state(&(con->timing), srv->priv->timings, con->state);
+		switch (con->state) {
+		case CON_STATE_ERROR:
+			/* we can't go on, close the connection */
+			{
+				gchar *which_connection = "a"; /* some connection, don't know yet */
+				if (con->server && event_fd == con->server->fd) {
+					which_connection = "server";
+				} else if (con->client && event_fd == con->client->fd) {
+					which_connection = "client";
+				}
+				g_debug("[%s]: error on %s connection (fd: %d event: %d). closing client connection.",
+						G_STRLOC, which_connection,	event_fd, events);
+			}
+			plugin_call_cleanup(srv, con);
+			network_mysqld_con_free(con);
+
+			con = NULL;
+
+			return;
+		case CON_STATE_CLOSE_CLIENT:
+		case CON_STATE_CLOSE_SERVER:
+			/* FIXME: this comment has nothing to do with reality...
+			 * the server connection is still fine, 
+			 * let's keep it open for reuse */
+
+			plugin_call_cleanup(srv, con);
+#ifdef NETWORK_MYSQLD_WANT_CON_TRACK_TIME 
+			/* dump the timestamps of this connection */
+			if (srv->log->min_lvl == G_LOG_LEVEL_DEBUG) {
+				GList *node;
+				guint64 abs_usec = 0;
+				guint64 wait_event_usec = 0;
+				guint64 lua_usec = 0;
+
+				for (node = con->timestamps->timestamps->head; node; node = node->next) {
+					chassis_timestamp_t *prev = node->prev ? node->prev->data : NULL;
+					chassis_timestamp_t *cur = node->data;
+					guint64 rel_usec = prev ? cur->usec - prev->usec: 0;
+					guint64 rel_cycles = prev ? cur->cycles - prev->cycles: 0;
+
+					abs_usec += rel_usec;
+
+					g_debug("%-35s usec=%8"G_GUINT64_FORMAT", cycles=%8"G_GUINT64_FORMAT", abs-usec=%8"G_GUINT64_FORMAT" (%s:%d)",
+							cur->name,
+							rel_usec,
+							rel_cycles,
 							abs_usec,
 							cur->filename, cur->line
 					       );
@@ -1359,36 +2307,39 @@ void network_mysqld_con_handle(int event_fd, short events, void *user_data) {
 
 			g_assert(events == 0 || event_fd == recv_sock->fd);
 
-			switch (network_mysqld_read(srv, recv_sock)) {
-			case NETWORK_SOCKET_SUCCESS:
-				break;
-			case NETWORK_SOCKET_WAIT_FOR_EVENT:
-				timeout = con->read_timeout;
+			/* the plugin may stay in this state to read another packet, e.g. after the SSL request */
+			do {
+				switch (network_mysqld_read(srv, recv_sock)) {
+				case NETWORK_SOCKET_SUCCESS:
+					break;
+				case NETWORK_SOCKET_WAIT_FOR_EVENT:
+					timeout = con->read_timeout;
 
-				WAIT_FOR_EVENT(con->client, EV_READ, &timeout);
-				NETWORK_MYSQLD_CON_TRACK_TIME(con, "wait_for_event::read_auth");
+					WAIT_FOR_EVENT(con->client, EV_READ, &timeout);
+					NETWORK_MYSQLD_CON_TRACK_TIME(con, "wait_for_event::read_auth");
 
-				return;
-			case NETWORK_SOCKET_ERROR_RETRY:
-			case NETWORK_SOCKET_ERROR:
-				g_critical("%s.%d: network_mysqld_read(CON_STATE_READ_AUTH) returned an error", __FILE__, __LINE__);
-				con->state = CON_STATE_ERROR;
-				break;
-			}
-			
-			if (con->state != ostate) break; /* the state has changed (e.g. CON_STATE_ERROR) */
+					return;
+				case NETWORK_SOCKET_ERROR_RETRY:
+				case NETWORK_SOCKET_ERROR:
+					g_critical("%s.%d: network_mysqld_read(CON_STATE_READ_AUTH) returned an error", __FILE__, __LINE__);
+					con->state = CON_STATE_ERROR;
+					break;
+				}
+				
+				if (con->state != ostate) break; /* the state has changed (e.g. CON_STATE_ERROR) */
 
-			switch (plugin_call(srv, con, con->state)) {
-			case NETWORK_SOCKET_SUCCESS:
-				break;
-			case NETWORK_SOCKET_ERROR:
-				con->state = CON_STATE_SEND_ERROR;
-				break;
-			default:
-				g_critical("%s.%d: plugin_call(CON_STATE_READ_AUTH) != NETWORK_SOCKET_SUCCESS", __FILE__, __LINE__);
-				con->state = CON_STATE_ERROR;
-				break;
-			}
+				switch (plugin_call(srv, con, con->state)) {
+				case NETWORK_SOCKET_SUCCESS:
+					break;
+				case NETWORK_SOCKET_ERROR:
+					con->state = CON_STATE_SEND_ERROR;
+					break;
+				default:
+					g_critical("%s.%d: plugin_call(CON_STATE_READ_AUTH) != NETWORK_SOCKET_SUCCESS", __FILE__, __LINE__);
+					con->state = CON_STATE_ERROR;
+					break;
+				}
+			} while (con->state == CON_STATE_READ_AUTH);
 
 			break; }
 		case CON_STATE_SEND_AUTH:
@@ -1567,13 +2518,76 @@ void network_mysqld_con_handle(int event_fd, short events, void *user_data) {
 
 			g_assert(events == 0 || event_fd == recv_sock->fd);
 
+			/* the queries that are already buffered are handled in this wakeup, up to the budget */
+			if (queries_handled >= NETWORK_MYSQLD_CON_QUERY_BUDGET &&
+			    (recv_sock->recv_queue_raw->chunks->length > 0 || con->client_is_pipelining)) {
+				network_mysqld_con_yield(con);
+				NETWORK_MYSQLD_CON_TRACK_TIME(con, "yield::read_query");
+				return;
+			}
+
+			if (con->long_data_is_streamed || con->long_data_packet_left > 0) {
+				/* the plugin didn't send the streamed COM_STMT_SEND_LONG_DATA on, drop the rest of it */
+				for (;;) {
+					network_mysqld_con_forward_long_data(con, NULL);
+					if (!con->long_data_is_streamed && con->long_data_packet_left == 0) break;
+
+					switch (network_mysqld_read_adaptive(recv_sock)) {
+					case NETWORK_SOCKET_SUCCESS:
+						break;
+					case NETWORK_SOCKET_WAIT_FOR_EVENT:
+						timeout = con->read_timeout;
+
+						WAIT_FOR_EVENT(con->client, EV_READ, &timeout);
+						NETWORK_MYSQLD_CON_TRACK_TIME(con, "wait_for_event::read_query");
+						return;
+					case NETWORK_SOCKET_ERROR_RETRY:
+					case NETWORK_SOCKET_ERROR:
+						g_critical("%s: network_socket_read_adaptive(CON_STATE_READ_QUERY) returned an error", G_STRLOC);
+						con->state = CON_STATE_ERROR;
+						return;
+					}
+				}
+				network_mysqld_queue_reset(recv_sock);
+			}
+
 			do { 
-				switch (network_mysqld_read(srv, recv_sock)) {
+				network_socket_retval_t read_ret = network_mysqld_read(srv, recv_sock);
+
+				if (read_ret == NETWORK_SOCKET_WAIT_FOR_EVENT && con->client_is_pipelining) {
+					/* the client sends its queries back-to-back, the next one is likely in
+					 * the socket already: fetch it without a round-trip through the event-loop */
+					con->client_is_pipelining = FALSE;
+
+					if (NETWORK_SOCKET_SUCCESS == network_mysqld_read_adaptive(recv_sock)) {
+						read_ret = network_mysqld_con_get_packet(srv, recv_sock);
+					}
+				}
+
+				switch (read_ret) {
 				case NETWORK_SOCKET_SUCCESS:
+					con->idle_since = 0; /* the client sent its next query */
 					break;
 				case NETWORK_SOCKET_WAIT_FOR_EVENT:
 					timeout = con->read_timeout;
 
+					/* the client may idle for long, give back what it doesn't need while it waits */
+					if (network_socket_park(con->client)) {
+						con->is_parked = TRUE;
+						NETWORK_MYSQLD_METRICS_ADD(connections_parked, 1);
+					}
+					{
+						gsize memory_bytes = network_mysqld_con_get_memory(con);
+
+						NETWORK_MYSQLD_METRICS_ADD(connections_memory, (gint64)memory_bytes - (gint64)con->memory_bytes);
+						con->memory_bytes = memory_bytes;
+					}
+
+					/* a safe point to move the connection to a less busy event-thread, it isn't ours anymore then */
+					if (network_mysqld_con_migrate(con, &timeout)) return;
+
+					network_mysqld_con_idle_enter(con);
+
 					WAIT_FOR_EVENT(con->client, EV_READ, &timeout);
 					NETWORK_MYSQLD_CON_TRACK_TIME(con, "wait_for_event::read_query");
 					return;
@@ -1586,8 +2600,31 @@ void network_mysqld_con_handle(int event_fd, short events, void *user_data) {
 				if (con->state != ostate) break; /* the state has changed (e.g. CON_STATE_ERROR) */
 
 				last_packet.data = g_queue_peek_tail(recv_sock->recv_queue->chunks);
+
+				if (con->long_data_is_forwarded_raw &&
+				    last_packet.data->len == PACKET_LEN_MAX + NET_HEADER_SIZE &&
+				    recv_sock->recv_queue->chunks->length == 1 &&
+				    (guint8)last_packet.data->str[NET_HEADER_SIZE] == COM_STMT_SEND_LONG_DATA) {
+					/* the plugin only needs the statement- and the param-id, stream the rest */
+					con->long_data_is_streamed = TRUE;
+					con->long_data_packet_left = 0;
+					break;
+				}
 			} while (last_packet.data->len == PACKET_LEN_MAX + NET_HEADER_SIZE); /* read all chunks of the overlong data */
 
+			/* the next query is on its way already
+			 *
+			 * the backend still gets one query at a time: the plugins decide per query where it
+			 * goes and if it goes to a backend at all. But we try to read the next one as soon as
+			 * this result is sent instead of waiting for the event-loop to tell us it is there.
+			 * The flag sticks until a try found nothing.
+			 */
+			queries_handled++;
+			if (recv_sock->recv_queue_raw->chunks->length > 0) {
+				con->client_is_pipelining = TRUE;
+				NETWORK_MYSQLD_METRICS_ADD(queries_pipelined_total, 1);
+			}
+
 			if (con->server &&
 			    con->server->challenge &&
 			    con->server->challenge->server_version > 50113 && con->server->challenge->server_version < 50118) {
@@ -1614,6 +2651,16 @@ void network_mysqld_con_handle(int event_fd, short events, void *user_data) {
 				}
 			}
 
+			network_mysqld_con_timing_query_read(&(con->timing));
+
+			if (recv_sock->recv_queue->chunks->length > 0) {
+				GString *first = g_queue_peek_head(recv_sock->recv_queue->chunks);
+
+				if (first->len > NET_HEADER_SIZE) {
+					network_mysqld_metrics_add_query(srv->priv->metrics, (guint8)first->str[NET_HEADER_SIZE]);
+				}
+			}
+
 			switch (plugin_call(srv, con, con->state)) {
 			case NETWORK_SOCKET_SUCCESS:
 				break;
@@ -1650,8 +2697,11 @@ void network_mysqld_con_handle(int event_fd, short events, void *user_data) {
 			 * this state will loop until all the packets from the send-queue are flushed 
 			 */
 
-			if (con->server->send_queue->offset == 0) {
-				/* only parse the packets once */
+			if (con->server->send_queue->offset == 0 &&
+			    con->server->send_queue->chunks->length > 0) {
+				/* only parse the packets once
+				 *
+				 * with the compressed protocol the send-queue is already empty when we come back here */
 				network_packet packet;
 
 				packet.data = g_queue_peek_head(con->server->send_queue->chunks);
@@ -1664,6 +2714,29 @@ void network_mysqld_con_handle(int event_fd, short events, void *user_data) {
 
 					break;
 				}
+
+				network_mysqld_activity_set_peers(&(con->activity),
+						con->client->response ? con->client->response->username->str : NULL,
+						con->client->response ? con->client->response->username->len : 0,
+						network_address_get_name(con->server->dst), con->server->dst->name->len,
+						con->server->challenge ? con->server->challenge->thread_id : 0);
+
+				switch (con->parse.command) {
+				case COM_STMT_SEND_LONG_DATA: /* no result ends them */
+				case COM_STMT_CLOSE:
+					break;
+				case COM_QUERY:
+				case COM_INIT_DB:
+				case COM_STMT_PREPARE:
+					network_mysqld_activity_query_start(&(con->activity), con->parse.command,
+							packet.data->str + NET_HEADER_SIZE + 1, packet.data->len - NET_HEADER_SIZE - 1,
+							chassis_get_coarse_rel_microseconds());
+					break;
+				default:
+					network_mysqld_activity_query_start(&(con->activity), con->parse.command, NULL, 0,
+							chassis_get_coarse_rel_microseconds());
+					break;
+				}
 			}
 	
 			switch (network_mysqld_write(srv, con->server)) {
@@ -1691,6 +2764,11 @@ void network_mysqld_con_handle(int event_fd, short events, void *user_data) {
 			/* some statements don't have a server response */
 			switch (con->parse.command) {
 			case COM_STMT_SEND_LONG_DATA: /* not acked */
+				if (con->long_data_is_streamed || con->long_data_packet_left > 0) {
+					con->state = CON_STATE_READ_LONG_DATA;
+					break;
+				}
+				/* fall through */
 			case COM_STMT_CLOSE:
 				con->state = CON_STATE_READ_QUERY;
 				if (con->client) network_mysqld_queue_reset(con->client);
@@ -1698,6 +2776,13 @@ void network_mysqld_con_handle(int event_fd, short events, void *user_data) {
 				break;
 			default:
 				con->state = CON_STATE_READ_QUERY_RESULT;
+				con->resultset_is_finished = FALSE;
+				con->stream_packet_left = 0;
+				con->stream_packet_is_continued = FALSE;
+
+				con->ts_send_query = chassis_get_rel_microseconds();
+				con->ts_read_query_result_first = 0;
+				con->ts_read_query_result_last = 0;
 				break;
 			}
 				
@@ -1709,19 +2794,90 @@ void network_mysqld_con_handle(int event_fd, short events, void *user_data) {
 			 */
 			do {
 				network_socket *recv_sock;
+				guint first_chunk;
 
 				recv_sock = con->server;
 
 				g_assert(events == 0 || event_fd == recv_sock->fd);
 
-				switch (network_mysqld_read(srv, recv_sock)) {
+				if (con->resultset_is_forwarded_raw && !con->resultset_is_needed) {
+					/* the plugin doesn't care about the resultset, forward the raw chunks
+					 *
+					 * drain the socket with large reads, partial packets stay in the queue until the rest arrives */
+					switch (network_mysqld_read_adaptive(recv_sock)) {
+					case NETWORK_SOCKET_SUCCESS:
+						break;
+					case NETWORK_SOCKET_WAIT_FOR_EVENT:
+						timeout = con->read_timeout;
+
+						WAIT_FOR_EVENT(con->server, EV_READ, &timeout);
+						NETWORK_MYSQLD_CON_TRACK_TIME(con, "wait_for_event::read_query_result");
+						return;
+					case NETWORK_SOCKET_ERROR_RETRY:
+					case NETWORK_SOCKET_ERROR:
+						g_critical("%s: network_socket_read_adaptive(CON_STATE_READ_QUERY_RESULT) returned an error", G_STRLOC);
+						con->state = CON_STATE_ERROR;
+						break;
+					}
+					if (con->state != ostate) break; /* the state has changed (e.g. CON_STATE_ERROR) */
+
+					if (0 == con->ts_read_query_result_first) con->ts_read_query_result_first = chassis_get_rel_microseconds();
+					network_mysqld_con_timing_first_byte(&(con->timing), srv->priv->timings);
+
+					first_chunk = con->client->send_queue->chunks->length;
+
+					if (NETWORK_SOCKET_SUCCESS != network_mysqld_con_forward_query_result(srv, con)) {
+						con->state = CON_STATE_ERROR;
+						break;
+					}
+
+					if (con->spool_threshold > 0 && !network_mysqld_con_spool(srv, con, first_chunk)) {
+						con->state = CON_STATE_ERROR;
+						break;
+					}
+
+					if (con->resultset_is_finished) {
+						con->ts_read_query_result_last = chassis_get_rel_microseconds();
+
+						/* reset the packet-id checks as the server-side is finished */
+						network_mysqld_queue_reset(recv_sock);
+						network_mysqld_queue_reset(con->client);
+
+						con->state = CON_STATE_SEND_QUERY_RESULT;
+					} else if (network_mysqld_con_result_should_pause(srv, con)) {
+						/* stop reading from the server until the client caught up */
+						con->state = CON_STATE_SEND_QUERY_RESULT;
+					} else if (recv_sock->to_read == 0) {
+						/* we forwarded all we had, wait for more */
+						timeout = con->read_timeout;
+
+						WAIT_FOR_EVENT(con->server, EV_READ, &timeout);
+						NETWORK_MYSQLD_CON_TRACK_TIME(con, "wait_for_event::read_query_result");
+						return;
+					}
+
+					continue;
+				}
+
+				call_ret = network_mysqld_read(srv, recv_sock);
+
+				if (call_ret == NETWORK_SOCKET_WAIT_FOR_EVENT && recv_sock->recv_queue_raw->len > 0 &&
+				    reads_handled++ < NETWORK_MYSQLD_CON_READ_BUDGET) {
+					/* we only have the start of the next packet, its rest is usually in the socket
+					 * by now: fetch it without a round-trip through the event-loop */
+					if (NETWORK_SOCKET_SUCCESS == network_mysqld_read_adaptive(recv_sock)) {
+						call_ret = network_mysqld_con_get_packet(srv, recv_sock);
+					}
+				}
+
+				switch (call_ret) {
 				case NETWORK_SOCKET_SUCCESS:
 					break;
 				case NETWORK_SOCKET_WAIT_FOR_EVENT:
 					timeout = con->read_timeout;
 
 					WAIT_FOR_EVENT(con->server, EV_READ, &timeout);
-				NETWORK_MYSQLD_CON_TRACK_TIME(con, "wait_for_event::read_query_result");
+					NETWORK_MYSQLD_CON_TRACK_TIME(con, "wait_for_event::read_query_result");
 					return;
 				case NETWORK_SOCKET_ERROR_RETRY:
 				case NETWORK_SOCKET_ERROR:
@@ -1731,12 +2887,26 @@ void network_mysqld_con_handle(int event_fd, short events, void *user_data) {
 				}
 				if (con->state != ostate) break; /* the state has changed (e.g. CON_STATE_ERROR) */
 
+				if (0 == con->ts_read_query_result_first) con->ts_read_query_result_first = chassis_get_rel_microseconds();
+				network_mysqld_con_timing_first_byte(&(con->timing), srv->priv->timings);
+
+				first_chunk = con->client->send_queue->chunks->length;
+
 				switch (plugin_call(srv, con, con->state)) {
 				case NETWORK_SOCKET_SUCCESS:
+					if (con->spool_threshold > 0 && !network_mysqld_con_spool(srv, con, first_chunk)) {
+						con->state = CON_STATE_ERROR;
+						break;
+					}
+
+					if (con->resultset_is_finished && 0 == con->ts_read_query_result_last) {
+						con->ts_read_query_result_last = chassis_get_rel_microseconds();
+					}
+
 					/* if we don't need the resultset, forward it to the client */
 					if (!con->resultset_is_finished && !con->resultset_is_needed) {
-						/* check how much data we have in the queue waiting, no need to try to send 5 bytes */
-						if (con->client->send_queue->len > 64 * 1024) {
+						/* stop reading from the server until the client caught up */
+						if (network_mysqld_con_result_should_pause(srv, con)) {
 							con->state = CON_STATE_SEND_QUERY_RESULT;
 						}
 					}
@@ -1757,26 +2927,49 @@ void network_mysqld_con_handle(int event_fd, short events, void *user_data) {
 			break; 
 		case CON_STATE_SEND_QUERY_RESULT:
 			/**
-			 * send the query result-set to the client */
-			switch (network_mysqld_write(srv, con->client)) {
-			case NETWORK_SOCKET_SUCCESS:
-				break;
-			case NETWORK_SOCKET_WAIT_FOR_EVENT:
-				timeout = con->write_timeout;
+			 * send the query result-set to the client
+			 *
+			 * while more of the result follows, the tail of the write waits for it instead of
+			 * going out as a short segment */
+			network_socket_set_cork(con->client, !con->resultset_is_finished && con->server);
 
-				WAIT_FOR_EVENT(con->client, EV_WRITE, &timeout);
-				NETWORK_MYSQLD_CON_TRACK_TIME(con, "wait_for_event::send_query_result");
-				return;
-			case NETWORK_SOCKET_ERROR_RETRY:
-			case NETWORK_SOCKET_ERROR:
-				/**
-				 * client is gone away
-				 *
-				 * close the connection and clean up
-				 */
-				con->state = CON_STATE_ERROR;
-				break;
-			}
+			/* a spooled result is sent in parts, the client may take several of them at once */
+			do {
+				if (!network_mysqld_con_spool_refill(con)) {
+					con->state = CON_STATE_ERROR;
+					break;
+				}
+
+				switch (network_mysqld_write(srv, con->client)) {
+				case NETWORK_SOCKET_SUCCESS:
+					network_flow_control_account(srv->priv->flow_control, &(con->send_queue_accounted), 0);
+					break;
+				case NETWORK_SOCKET_WAIT_FOR_EVENT:
+					network_flow_control_account(srv->priv->flow_control, &(con->send_queue_accounted), con->client->send_queue->len);
+
+					/* drained to the low watermark, read from the server again while the client catches up */
+					if (!con->resultset_is_finished && con->server &&
+					    network_flow_control_may_resume(srv->priv->flow_control, con->client->send_queue->len, con->send_queue_low_watermark)) {
+						con->state = CON_STATE_READ_QUERY_RESULT;
+						break;
+					}
+
+					timeout = con->write_timeout;
+
+					WAIT_FOR_EVENT(con->client, EV_WRITE, &timeout);
+					NETWORK_MYSQLD_CON_TRACK_TIME(con, "wait_for_event::send_query_result");
+					return;
+				case NETWORK_SOCKET_ERROR_RETRY:
+				case NETWORK_SOCKET_ERROR:
+					/**
+					 * client is gone away
+					 *
+					 * close the connection and clean up
+					 */
+					con->state = CON_STATE_ERROR;
+					break;
+				}
+			} while (con->state == ostate && con->spool);
 
 			/* if the write failed, don't call the plugin handlers */
 			if (con->state != ostate) break; /* the state has changed (e.g. CON_STATE_ERROR) */
@@ -1800,6 +2993,10 @@ void network_mysqld_con_handle(int event_fd, short events, void *user_data) {
 			if (con->state != CON_STATE_ERROR &&
 			    con->parse.command == COM_QUERY &&
 			    1 == network_mysqld_com_query_result_is_local_infile(con->parse.data)) {
+				con->local_file_data_is_finished = FALSE;
+				con->stream_packet_left = 0;
+				con->stream_packet_is_continued = FALSE;
+
 				con->state = CON_STATE_READ_LOCAL_INFILE_DATA;
 			}
 
@@ -1812,6 +3009,51 @@ void network_mysqld_con_handle(int event_fd, short events, void *user_data) {
 
 			recv_sock = con->client;
 
+			if (con->local_infile_is_forwarded_raw && con->server) {
+				/* drain the client with large reads and forward the data as is
+				 *
+				 * the send-queue of the server is flushed before we read again, at most one read is buffered */
+				switch (network_mysqld_read_adaptive(recv_sock)) {
+				case NETWORK_SOCKET_SUCCESS:
+					break;
+				case NETWORK_SOCKET_WAIT_FOR_EVENT:
+					timeout = con->read_timeout;
+
+					WAIT_FOR_EVENT(recv_sock, EV_READ, &timeout);
+					NETWORK_MYSQLD_CON_TRACK_TIME(con, "wait_for_event::read_load_infile_data");
+
+					return;
+				case NETWORK_SOCKET_ERROR_RETRY:
+				case NETWORK_SOCKET_ERROR:
+					g_critical("%s: network_socket_read_adaptive(%s) returned an error",
+							G_STRLOC,
+							network_mysqld_con_state_get_name(ostate));
+					con->state = CON_STATE_ERROR;
+					break;
+				}
+
+				if (con->state != ostate) break; /* the state has changed (e.g. CON_STATE_ERROR) */
+
+				if (NETWORK_SOCKET_SUCCESS != network_mysqld_con_forward_local_infile_data(con)) {
+					con->state = CON_STATE_ERROR;
+					break;
+				}
+
+				if (con->local_file_data_is_finished || con->server->send_queue->chunks->length > 0) {
+					con->state = CON_STATE_SEND_LOCAL_INFILE_DATA;
+				} else {
+					/* only a part of a header came in, wait for the rest */
+					timeout = con->read_timeout;
+
+					WAIT_FOR_EVENT(recv_sock, EV_READ, &timeout);
+					NETWORK_MYSQLD_CON_TRACK_TIME(con, "wait_for_event::read_load_infile_data");
+
+					return;
+				}
+
+				break;
+			}
+
 			/**
 			 * LDLI is usually a whole set of packets
 			 */
@@ -1996,6 +3238,99 @@ void network_mysqld_con_handle(int event_fd, short events, void *user_data) {
 				break;
 			}
 
+			break;
+		case CON_STATE_READ_LONG_DATA:
+			/* read the rest of the streamed COM_STMT_SEND_LONG_DATA from the client
+			 *
+			 * the send-queue of the server is flushed before we read again, at most one read is buffered */
+			switch (network_mysqld_read_adaptive(con->client)) {
+			case NETWORK_SOCKET_SUCCESS:
+				break;
+			case NETWORK_SOCKET_WAIT_FOR_EVENT:
+				timeout = con->read_timeout;
+
+				WAIT_FOR_EVENT(con->client, EV_READ, &timeout);
+				NETWORK_MYSQLD_CON_TRACK_TIME(con, "wait_for_event::read_long_data");
+				return;
+			case NETWORK_SOCKET_ERROR_RETRY:
+			case NETWORK_SOCKET_ERROR:
+				g_critical("%s: network_socket_read_adaptive(CON_STATE_READ_LONG_DATA) returned an error", G_STRLOC);
+				con->state = CON_STATE_ERROR;
+				break;
+			}
+
+			if (con->state != ostate) break; /* the state has changed (e.g. CON_STATE_ERROR) */
+
+			if (NETWORK_SOCKET_SUCCESS != network_mysqld_con_forward_long_data(con, con->server)) {
+				con->state = CON_STATE_ERROR;
+				break;
+			}
+
+			if (con->server->send_queue->chunks->length > 0) {
+				con->state = CON_STATE_SEND_LONG_DATA;
+			} else {
+				/* only a part of a header came in, wait for the rest */
+				timeout = con->read_timeout;
+
+				WAIT_FOR_EVENT(con->client, EV_READ, &timeout);
+				NETWORK_MYSQLD_CON_TRACK_TIME(con, "wait_for_event::read_long_data");
+				return;
+			}
+
+			break;
+		case CON_STATE_SEND_LONG_DATA:
+			switch (network_mysqld_write(srv, con->server)) {
+			case NETWORK_SOCKET_SUCCESS:
+				break;
+			case NETWORK_SOCKET_WAIT_FOR_EVENT:
+				timeout = con->write_timeout;
+
+				WAIT_FOR_EVENT(con->server, EV_WRITE, &timeout);
+				NETWORK_MYSQLD_CON_TRACK_TIME(con, "wait_for_event::send_long_data");
+				return;
+			case NETWORK_SOCKET_ERROR_RETRY:
+			case NETWORK_SOCKET_ERROR:
+				con->state = CON_STATE_ERROR;
+				break;
+			}
+
+			if (con->state != ostate) break; /* the state has changed (e.g. CON_STATE_ERROR) */
+
+			if (con->long_data_is_streamed || con->long_data_packet_left > 0) {
+				con->state = CON_STATE_READ_LONG_DATA;
+			} else {
+				/* the command is complete, it has no response */
+				network_mysqld_queue_reset(con->client);
+				network_mysqld_queue_reset(con->server);
+
+				con->state = CON_STATE_READ_QUERY;
+			}
+
+			break;
+		case CON_STATE_WAIT_ASYNC:
+			/* the plugin waits for the queries it sent on other connections
+			 *
+			 * it calls network_mysqld_con_handle() whenever one of them is done, we just
+			 * ask it if it can go on */
+			switch ((call_ret = plugin_call(srv, con, con->state))) {
+			case NETWORK_SOCKET_SUCCESS:
+				break;
+			case NETWORK_SOCKET_WAIT_FOR_EVENT:
+				/* the plugin wakes us up, not the sockets */
+				if (con->persistent_wait_sock) network_socket_event_del(con->persistent_wait_sock);
+
+				NETWORK_MYSQLD_CON_TRACK_TIME(con, "wait_for_event::wait_async");
+				return;
+			default:
+				g_critical("%s: plugin_call(%s) unexpected return value: %d",
+						G_STRLOC,
+						network_mysqld_con_state_get_name(ostate),
+						call_ret);
+
+				con->state = CON_STATE_ERROR;
+				break;
+			}
+
 			break;
 		case CON_STATE_SEND_ERROR:
 			/**
@@ -2024,6 +3359,8 @@ void network_mysqld_con_handle(int event_fd, short events, void *user_data) {
 			break;
 		}
 
+		if (ostate != con->state) MYSQLPROXY_STATE_DONE(con, ostate, con->state);
+
 		event_fd = -1;
 		events   = 0;
 	} while (ostate != con->state);
@@ -2049,29 +3386,26 @@ void network_mysqld_con_handle(int event_fd, short events, void *user_data) {
 /**
  * accept a connection
  *
- * event handler for listening connections
- *
- * @param event_fd     fd on which the event was fired
- * @param events       the event that was fired
- * @param user_data    the listening connection handle
- * 
+ * @param listen_con   the listening connection handle
+ * @return FALSE if there was no connection to accept
  */
-void network_mysqld_con_accept(int G_GNUC_UNUSED event_fd, short events, void *user_data) {
-	network_mysqld_con *listen_con = user_data;
+static gboolean network_mysqld_con_accept_one(network_mysqld_con *listen_con) {
 	network_mysqld_con *client_con;
 	network_socket *client;
 
-	g_assert(events == EV_READ);
-	g_assert(listen_con->server);
-
 	client = network_socket_accept(listen_con->server);
-	if (!client) return;
+	if (!client) return FALSE;
 
 	/* looks like we open a client connection */
 	client_con = network_mysqld_con_new();
 	client_con->client = client;
 
 	NETWORK_MYSQLD_CON_TRACK_TIME(client_con, "accept");
+	network_mysqld_con_timing_accept(&(client_con->timing));
+
+	client_con->is_accepted = TRUE;
+	NETWORK_MYSQLD_METRICS_ADD(connections_total, 1);
+	NETWORK_MYSQLD_METRICS_ADD(connections, 1);
 
 	network_mysqld_add_connection(listen_con->srv, client_con);
 
@@ -2082,23 +3416,86 @@ void network_mysqld_con_accept(int G_GNUC_UNUSED event_fd, short events, void *u
 
 	client_con->plugins = listen_con->plugins;
 	client_con->config  = listen_con->config;
+
+	/**
+	 * bind the connection to the lua-scope of one of the event-threads
+	 *
+	 * the events of a connection may be handled by any event-thread, we
+	 * spread the connections round-robin over the scopes to spread the lock-contention
+	 *
+	 * a listener with a lua-scope of its own keeps its connections to it
+	 */
+	if (listen_con->sc) {
+		client_con->sc = listen_con->sc;
+	} else if (listen_con->srv->lua_per_event_thread) {
+		static volatile gint lua_scope_ndx = 0;
+
+		client_con->sc = chassis_event_threads_get_lua_scope(listen_con->srv->threads,
+				g_atomic_int_exchange_and_add(&lua_scope_ndx, 1));
+	}
 	
+	/* its first wait picks the event-thread of the connection, see chassis_event_add_with_timeout() */
 	network_mysqld_con_handle(-1, 0, client_con);
 
+	return TRUE;
+}
+
+/**
+ * accept the waiting connections
+ *
+ * event handler for listening connections
+ *
+ * takes up to srv->accept_batch connections per wakeup, a connect-storm doesn't cost a
+ * wakeup per connection and doesn't overflow the backlog. The rest waits for the next
+ * wakeup to let the other events of the thread run in between.
+ *
+ * @param event_fd     fd on which the event was fired
+ * @param events       the event that was fired
+ * @param user_data    the listening connection handle
+ * 
+ */
+void network_mysqld_con_accept(int G_GNUC_UNUSED event_fd, short events, void *user_data) {
+	network_mysqld_con *listen_con = user_data;
+	gint i;
+
+	g_assert(events == EV_READ);
+	g_assert(listen_con->server);
+
+	chassis_coarse_clock_update();
+
+	/* we handed the socket to a new proxy on a hot upgrade, it takes the connections */
+	if (chassis_handoff_is_draining()) {
+		event_del(&(listen_con->server->event));
+		return;
+	}
+
+	for (i = 0; i < MAX(listen_con->srv->accept_batch, 1); i++) {
+		if (!network_mysqld_con_accept_one(listen_con)) break;
+	}
+
 	return;
 }
 
+/**
+ * get the lua-scope of the connection
+ *
+ * @return the lua-scope the connection is bound to or the global lua-scope
+ */
+lua_scope *network_mysqld_con_get_lua_scope(network_mysqld_con *con) {
+	if (con->sc) return con->sc;
+
+	return con->srv->priv->sc;
+}
+
 /**
  * @todo move to network_mysqld_proto
  */
 int network_mysqld_con_send_resultset(network_socket *con, GPtrArray *fields, GPtrArray *rows) {
-	GString *s;
-	gsize i, j;
+	network_mysqld_resultset_writer_t *w;
+	gsize i;
 
 	g_assert(fields->len > 0);
 
-	s = g_string_new(NULL);
-
 	/* - len = 99
 	 *  \1\0\0\1 
 	 *    \1 - one field
@@ -2124,71 +3521,16 @@ int network_mysqld_con_send_resultset(network_socket *con, GPtrArray *fields, GP
 	 *    \376\0\0\2\0
 	 */
 
-	network_mysqld_proto_append_lenenc_int(s, fields->len); /* the field-count */
-	network_mysqld_queue_append(con, con->send_queue, S(s));
-
-	for (i = 0; i < fields->len; i++) {
-		MYSQL_FIELD *field = fields->pdata[i];
-		
-		g_string_truncate(s, 0);
-
-		network_mysqld_proto_append_lenenc_string(s, field->catalog ? field->catalog : "def");   /* catalog */
-		network_mysqld_proto_append_lenenc_string(s, field->db ? field->db : "");                /* database */
-		network_mysqld_proto_append_lenenc_string(s, field->table ? field->table : "");          /* table */
-		network_mysqld_proto_append_lenenc_string(s, field->org_table ? field->org_table : "");  /* org_table */
-		network_mysqld_proto_append_lenenc_string(s, field->name ? field->name : "");            /* name */
-		network_mysqld_proto_append_lenenc_string(s, field->org_name ? field->org_name : "");    /* org_name */
-
-		g_string_append_c(s, '\x0c');                  /* length of the following block, 12 byte */
-		g_string_append_len(s, "\x08\x00", 2);         /* charset */
-		g_string_append_c(s, (field->length >> 0) & 0xff); /* len */
-		g_string_append_c(s, (field->length >> 8) & 0xff); /* len */
-		g_string_append_c(s, (field->length >> 16) & 0xff); /* len */
-		g_string_append_c(s, (field->length >> 24) & 0xff); /* len */
-		g_string_append_c(s, field->type);             /* type */
-		g_string_append_c(s, field->flags & 0xff);     /* flags */
-		g_string_append_c(s, (field->flags >> 8) & 0xff); /* flags */
-		g_string_append_c(s, 0);                       /* decimals */
-		g_string_append_len(s, "\x00\x00", 2);         /* filler */
-#if 0
-		/* this is in the docs, but not on the network */
-		network_mysqld_proto_append_lenenc_string(s, field->def);         /* default-value */
-#endif
-		network_mysqld_queue_append(con, con->send_queue, S(s));
-	}
+	w = network_mysqld_resultset_writer_new(con);
 
-	g_string_truncate(s, 0);
-	
-	/* EOF */	
-	g_string_append_len(s, "\xfe", 1); /* EOF */
-	g_string_append_len(s, "\x00\x00", 2); /* warning count */
-	g_string_append_len(s, "\x02\x00", 2); /* flags */
-	
-	network_mysqld_queue_append(con, con->send_queue, S(s));
+	network_mysqld_resultset_writer_write_fields(w, fields);
 
 	for (i = 0; i < rows->len; i++) {
-		GPtrArray *row = rows->pdata[i];
-
-		g_string_truncate(s, 0);
-
-		for (j = 0; j < row->len; j++) {
-			network_mysqld_proto_append_lenenc_string(s, row->pdata[j]);
-		}
-
-		network_mysqld_queue_append(con, con->send_queue, S(s));
+		network_mysqld_resultset_writer_write_row(w, rows->pdata[i]);
 	}
 
-	g_string_truncate(s, 0);
-
-	/* EOF */	
-	g_string_append_len(s, "\xfe", 1); /* EOF */
-	g_string_append_len(s, "\x00\x00", 2); /* warning count */
-	g_string_append_len(s, "\x02\x00", 2); /* flags */
-
-	network_mysqld_queue_append(con, con->send_queue, S(s));
-	network_mysqld_queue_reset(con);
-
-	g_string_free(s, TRUE);
+	network_mysqld_resultset_writer_finish(w);
+	network_mysqld_resultset_writer_free(w);
 
 	return 0;
 }
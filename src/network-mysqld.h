@@ -53,13 +53,32 @@
 #include "chassis-plugin.h"
 #include "chassis-mainloop.h"
 #include "chassis-timings.h"
+#include "chassis-event-thread.h"
 #include "sys-pedantic.h"
 #include "lua-scope.h"
 #include "network-backend.h"
+#include "network-query-cache.h"
+#include "network-mysqld-timing.h"
+#include "network-mysqld-activity.h"
+#include "network-query-digest.h"
+#include "network-shared-dict.h"
+#include "network-mysqld-metrics.h"
+#include "network-flow-control.h"
+#include "network-spool.h"
+#include "network-rate-limit.h"
+#include "network-firewall.h"
+#include "network-mysqld-filter.h"
 #include "lua-registry-keys.h"
 
 typedef struct network_mysqld_con network_mysqld_con; /* forward declaration */
 
+/**
+ * rows of this size or more are streamed to the client in the raw forwarding of the result
+ *
+ * smaller rows are buffered until they are complete, copying them is cheaper than splitting them
+ */
+#define NETWORK_MYSQLD_STREAM_PACKET_MIN (64 * 1024)
+
 #undef NETWORK_MYSQLD_WANT_CON_TRACK_TIME
 #ifdef NETWORK_MYSQLD_WANT_CON_TRACK_TIME
 #define NETWORK_MYSQLD_CON_TRACK_TIME(con, name) chassis_timestamps_add(con->timestamps, name, __FILE__, __LINE__)
@@ -152,8 +171,8 @@ typedef struct {
      * Called when an internal timer has elapsed.
      * 
      * This state is meant to give a plugin the opportunity to react to timers.
-     * @note This state is currently unused, as there is no support for setting up timers.
-     * @deprecated Unsupported, there is no way to set timers right now. Might be removed in 1.0.
+     * @note This state is unused, the timers aren't bound to a connection.
+     * @deprecated Use chassis_event_timer_new() or proxy.timer() in the scripts. Might be removed in 1.0.
      */
     NETWORK_MYSQLD_PLUGIN_FUNC(con_timer_elapsed);
     /**
@@ -177,6 +196,13 @@ typedef struct {
 	NETWORK_MYSQLD_PLUGIN_FUNC(con_send_auth_old_password);
 
 	NETWORK_MYSQLD_PLUGIN_FUNC(con_timeout);
+
+	/**
+	 * Called in ::CON_STATE_WAIT_ASYNC when the plugin calls network_mysqld_con_handle() for the connection.
+	 *
+	 * Return NETWORK_SOCKET_WAIT_FOR_EVENT to keep waiting, the plugin has to call network_mysqld_con_handle() again then.
+	 */
+	NETWORK_MYSQLD_PLUGIN_FUNC(con_wait_async);
 } network_mysqld_hooks;
 
 /**
@@ -227,7 +253,13 @@ typedef enum {
 	CON_STATE_READ_LOCAL_INFILE_DATA = 18,
 	CON_STATE_SEND_LOCAL_INFILE_DATA = 19,
 	CON_STATE_READ_LOCAL_INFILE_RESULT = 20,
-	CON_STATE_SEND_LOCAL_INFILE_RESULT = 21
+	CON_STATE_SEND_LOCAL_INFILE_RESULT = 21,
+
+	CON_STATE_WAIT_ASYNC = 22,           /**< The plugin waits for queries it sent on other connections, internal state */
+
+	/* streaming a overlong COM_STMT_SEND_LONG_DATA, see network_mysqld_con::long_data_is_forwarded_raw */
+	CON_STATE_READ_LONG_DATA = 23,       /**< The packets that continue the command are to be read from a client, internal state */
+	CON_STATE_SEND_LONG_DATA = 24        /**< The packets that continue the command are to be sent to a server, internal state */
 } network_mysqld_con_state_t;
 
 /**
@@ -330,6 +362,60 @@ struct network_mysqld_con {
 	 */
 	gboolean resultset_is_finished;
 
+	/**
+	 * Flag indicating that the plugin doesn't want to see the packets of the resultset at all.
+	 *
+	 * If set to TRUE (and resultset_is_needed is FALSE), the con_read_query_result hook isn't called. The
+	 * raw chunks read from the server are parsed in place and moved to the client's send-queue without
+	 * splitting them into packets first.
+	 *
+	 * @see network_mysqld_con_forward_query_result()
+	 */
+	gboolean resultset_is_forwarded_raw;
+
+	/**
+	 * streaming of large rows in the raw forwarding of the result
+	 *
+	 * a row of NETWORK_MYSQLD_STREAM_PACKET_MIN bytes or more is forwarded as it arrives
+	 * instead of being buffered until it is complete. The raw forwarding of the LOAD DATA
+	 * LOCAL INFILE data streams all its packets.
+	 *
+	 * @see network_mysqld_con_forward_query_result(), network_mysqld_con_forward_local_infile_data()
+	 */
+	guint32 stream_packet_left;          /**< bytes of the streamed packet that are still to be forwarded */
+	gboolean stream_packet_is_continued; /**< the last packet was 0xffffff bytes, the next one continues it */
+
+	/**
+	 * flow control of the forwarded results, see network-flow-control.h
+	 *
+	 * the server isn't read while the client's send-queue is above the high watermark, it
+	 * is read again once the send-queue is drained to the low watermark
+	 */
+	gsize send_queue_high_watermark;
+	gsize send_queue_low_watermark;
+	gsize send_queue_accounted;  /**< the bytes of the send-queue accounted in the flow control */
+
+	/**
+	 * spool the result to a temporary file above this many bytes in the send-queue, 0 to disable
+	 *
+	 * with a threshold the server isn't paused by the flow control, the tail of a large result
+	 * goes to the spool and the server is done with it as fast as it can send it
+	 *
+	 * @see network_mysqld_con_spool()
+	 */
+	gsize spool_threshold;
+	network_spool_t *spool;      /**< the tail of the result that waits for the client, NULL if nothing is spooled */
+	gsize spool_unsent;          /**< bytes spooled since the last try to send to the client */
+
+	/**
+	 * microsecond timestamps of the query in flight, for the raw and the plugin path of the result
+	 *
+	 * 0 until they are reached, ts_send_query is set when the query is written to the server
+	 */
+	guint64 ts_send_query;
+	guint64 ts_read_query_result_first;
+	guint64 ts_read_query_result_last;
+
 	/**
 	 * Flag indicating that we have received a COM_QUIT command.
 	 * 
@@ -344,6 +430,30 @@ struct network_mysqld_con {
 	 */
 	gboolean local_file_data_is_finished;
 
+	/**
+	 * Flag indicating that the plugin doesn't need to see the packets of the LOAD DATA LOCAL INFILE data.
+	 *
+	 * If set to TRUE and a server is connected, the con_read_local_infile_data hook isn't called. The
+	 * data is read from the client in large chunks and moved to the server's send-queue as is.
+	 *
+	 * @see network_mysqld_con_forward_local_infile_data()
+	 */
+	gboolean local_infile_is_forwarded_raw;
+
+	/**
+	 * Flag indicating that the plugin only needs the first packet of a overlong COM_STMT_SEND_LONG_DATA.
+	 *
+	 * If set to TRUE, the con_read_query hook is called as soon as the first packet with the statement-
+	 * and the param-id is in. If the command is sent to the server, the packets that continue it are
+	 * forwarded as they arrive in ::CON_STATE_READ_LONG_DATA and ::CON_STATE_SEND_LONG_DATA, otherwise
+	 * they are dropped.
+	 *
+	 * @see network_mysqld_con_forward_long_data()
+	 */
+	gboolean long_data_is_forwarded_raw;
+	gboolean long_data_is_streamed;  /**< another packet of the streamed COM_STMT_SEND_LONG_DATA follows */
+	guint32 long_data_packet_left;   /**< bytes of the current packet of it that are still to be forwarded */
+
 	/**
 	 * Contains the parsed packet.
 	 */
@@ -365,6 +475,40 @@ struct network_mysqld_con {
 	 */
 	chassis_timestamps_t *timestamps;
 
+	/**
+	 * the always-on timings of the connection, see network-mysqld-timing.h
+	 */
+	network_mysqld_con_timing_t timing;
+
+	/**
+	 * the running statement and the open transaction, see network-mysqld-activity.h
+	 */
+	network_mysqld_activity_t activity;
+
+	gboolean is_accepted;  /**< a client connection we accepted, counted in the connection metrics */
+
+	/**
+	 * the lua-scope this connection is bound to
+	 *
+	 * NULL if the global lua-scope (chassis_private.sc) is used
+	 *
+	 * @see network_mysqld_con_get_lua_scope()
+	 */
+	lua_scope *sc;
+
+	lua_scope_mem_account_t lua_mem; /**< the lua memory used by the hooks of this connection */
+
+	gsize memory_bytes;    /**< bytes of the connection and its sockets when it went idle last, see network_mysqld_con_get_memory() */
+	gboolean is_parked;    /**< the client idles with its queues released, see network_socket_park() */
+	GList idle_link;       /**< our link in the idle_cons of .idle_thread */
+	chassis_event_thread_t *idle_thread; /**< the event-thread whose idle_cons we are in, NULL if we aren't, see network_mysqld_con_idle_enter() */
+	guint64 idle_since;    /**< when the client started to wait for its next query, in chassis_get_rel_microseconds(), 0 while it runs one */
+	gboolean client_is_pipelining; /**< the client sent its next query before it got the result of the last one */
+	network_socket *persistent_wait_sock; /**< the socket that stays registered with EV_PERSIST, see network_mysqld_con_wait_for_event() */
+	struct event yield_event; /**< re-enters the state-machine after the connection used up its budget, see network_mysqld_con_yield() */
+	gboolean is_yielding;  /**< the yield_event is pending */
+	chassis_event_thread_t *event_thread; /**< the event-thread that handled the last event of the connection */
+
 	/* connection specific timeouts */
 	struct timeval connect_timeout;
 	struct timeval read_timeout;
@@ -373,17 +517,21 @@ struct network_mysqld_con {
 
 
 
+NETWORK_API void network_mysqld_con_evict(network_mysqld_con *con, const char *errmsg, gsize errmsg_len);
+
 NETWORK_API void g_list_string_free(gpointer data, gpointer UNUSED_PARAM(user_data));
 NETWORK_API gboolean g_hash_table_true(gpointer UNUSED_PARAM(key), gpointer UNUSED_PARAM(value), gpointer UNUSED_PARAM(u));
 
 NETWORK_API network_mysqld_con *network_mysqld_con_init(void) G_GNUC_DEPRECATED;
 NETWORK_API network_mysqld_con *network_mysqld_con_new(void);
 NETWORK_API void network_mysqld_con_free(network_mysqld_con *con);
+NETWORK_API gsize network_mysqld_con_get_memory(network_mysqld_con *con);
 
 /** 
  * should be socket 
  */
 NETWORK_API void network_mysqld_con_accept(int event_fd, short events, void *user_data); /** event handler for accept() */
+NETWORK_API lua_scope *network_mysqld_con_get_lua_scope(network_mysqld_con *con);
 
 NETWORK_API int network_mysqld_con_send_ok(network_socket *con);
 NETWORK_API int network_mysqld_con_send_ok_full(network_socket *con, guint64 affected_rows, guint64 insert_id, guint16 server_status, guint16 warnings);
@@ -404,10 +552,29 @@ NETWORK_API network_socket_retval_t network_mysqld_con_get_packet(chassis G_GNUC
 
 struct chassis_private {
 	GPtrArray *cons;                          /**< array(network_mysqld_con) */
+	GMutex *cons_mutex;                       /**< protects .cons, connections are accepted and closed in all event-threads */
 
 	lua_scope *sc;
 
 	network_backends_t *backends;
+
+	network_query_cache_t *query_cache;       /**< results of read-only queries, disabled until a plugin sets its limits */
+
+	network_mysqld_timings_t *timings;        /**< aggregated timings of all connections */
+
+	network_query_digest_t *query_digest;     /**< stats of the normalized queries, disabled until a plugin sets its limits */
+
+	network_shared_dict_t *shared_dict;       /**< proxy.shared of the scripts, disabled until a plugin sets its limits */
+
+	network_mysqld_metrics_t *metrics;        /**< the metrics of the connections, served by the chassis on /metrics */
+
+	network_flow_control_t *flow_control;     /**< the budget of the send-queues, unlimited until a plugin sets it */
+
+	network_rate_limiter_t *rate_limiter;     /**< token buckets of the queries, no limits until a rule is set */
+
+	network_firewall_t *firewall;             /**< the allow and deny rules of the queries, disabled until a plugin loads them */
+
+	network_mysqld_filters_t *filters;        /**< the filters C modules hooked into the connection states, see plugin_call() */
 };
 
 NETWORK_API int network_mysqld_init(chassis *srv);
@@ -0,0 +1,119 @@
+/* $%BEGINLICENSE%$
+ Copyright (c) 2009, 2012, Oracle and/or its affiliates. All rights reserved.
+
+ This program is free software; you can redistribute it and/or
+ modify it under the terms of the GNU General Public License as
+ published by the Free Software Foundation; version 2 of the
+ License.
+
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ GNU General Public License for more details.
+
+ You should have received a copy of the GNU General Public License
+ along with this program; if not, write to the Free Software
+ Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA
+ 02110-1301  USA
+
+ $%ENDLICENSE%$ */
+ 
+/**
+ * per-thread free-lists for the objects of a connection
+ *
+ * each accepted client creates a network_mysqld_con, two network_sockets with their
+ * network_queues and network_addresses, each of them with a few GStrings. Under
+ * connection churn that's dozens of malloc()s and free()s per connect.
+ *
+ * like the buffer-pool the objects are kept in a small LIFO free-list per thread. The
+ * idle objects keep the memory they own (the GQueue of a network_queue, the name of
+ * a network_address, ...) and are only reset when they are put back.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include "network-object-pool.h"
+
+typedef struct {
+	GQueue *objects;
+
+	network_object_pool_t *pool;
+} network_object_pool_local_t;
+
+static void network_object_pool_local_free(gpointer _local) {
+	network_object_pool_local_t *local = _local;
+	gpointer obj;
+
+	while ((obj = g_queue_pop_head(local->objects))) {
+		local->pool->free_func(obj);
+		g_atomic_int_add(&(local->pool->idle), -1);
+	}
+	g_queue_free(local->objects);
+
+	g_free(local);
+}
+
+/**
+ * get the free-list of the current thread, create it if it doesn't exist yet
+ */
+static network_object_pool_local_t *network_object_pool_get_local(network_object_pool_t *pool) {
+	network_object_pool_local_t *local;
+
+	if (NULL == (local = g_static_private_get(&(pool->key)))) {
+		local = g_new0(network_object_pool_local_t, 1);
+		local->objects = g_queue_new();
+		local->pool = pool;
+
+		g_static_private_set(&(pool->key), local, network_object_pool_local_free);
+	}
+
+	return local;
+}
+
+/**
+ * get a idle object from the pool of the current thread
+ *
+ * @return the object as it was reset by its _free(), NULL if the pool is empty
+ */
+gpointer network_object_pool_get(network_object_pool_t *pool) {
+	network_object_pool_local_t *local = network_object_pool_get_local(pool);
+	gpointer obj;
+
+	if (NULL == (obj = g_queue_pop_head(local->objects))) {
+		g_atomic_int_inc(&(pool->misses));
+
+		return NULL;
+	}
+
+	g_atomic_int_inc(&(pool->hits));
+	g_atomic_int_add(&(pool->idle), -1);
+
+	return obj;
+}
+
+/**
+ * put a reset object into the pool of the current thread
+ *
+ * @return FALSE if the pool is full, the caller has to free the object then
+ */
+gboolean network_object_pool_put(network_object_pool_t *pool, gpointer obj) {
+	network_object_pool_local_t *local = network_object_pool_get_local(pool);
+
+	if (local->objects->length >= pool->max_idle) return FALSE;
+
+	g_queue_push_head(local->objects, obj); /* LIFO, the last used object is still in the cache */
+	g_atomic_int_inc(&(pool->idle));
+
+	return TRUE;
+}
+
+/**
+ * get the counters of the pool over all threads
+ */
+void network_object_pool_get_stats(network_object_pool_t *pool, network_object_pool_stats_t *stats) {
+	stats->hits   = g_atomic_int_get(&(pool->hits));
+	stats->misses = g_atomic_int_get(&(pool->misses));
+	stats->idle   = g_atomic_int_get(&(pool->idle));
+}
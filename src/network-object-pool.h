@@ -0,0 +1,56 @@
+/* $%BEGINLICENSE%$
+ Copyright (c) 2009, 2012, Oracle and/or its affiliates. All rights reserved.
+
+ This program is free software; you can redistribute it and/or
+ modify it under the terms of the GNU General Public License as
+ published by the Free Software Foundation; version 2 of the
+ License.
+
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ GNU General Public License for more details.
+
+ You should have received a copy of the GNU General Public License
+ along with this program; if not, write to the Free Software
+ Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA
+ 02110-1301  USA
+
+ $%ENDLICENSE%$ */
+#ifndef _NETWORK_OBJECT_POOL_H_
+#define _NETWORK_OBJECT_POOL_H_
+
+#include <glib.h>
+
+#include "network-exports.h"
+
+/**
+ * a per-thread free-list of objects of one type
+ *
+ * declare it statically with NETWORK_OBJECT_POOL_INIT() next to the _new() and _free()
+ * of the type. _free() resets the object and puts it back, _new() takes it from the
+ * pool of its thread before it allocates a new one.
+ */
+typedef struct {
+	GStaticPrivate key;          /**< the network_object_pool_local_t of each thread */
+	guint max_idle;              /**< number of idle objects each thread keeps at most */
+	GDestroyNotify free_func;    /**< frees a idle object when its thread ends */
+
+	volatile gint hits;          /**< objects handed out from the pool */
+	volatile gint misses;        /**< objects that had to be allocated */
+	volatile gint idle;          /**< objects currently idling in all threads */
+} network_object_pool_t;
+
+#define NETWORK_OBJECT_POOL_INIT(max_idle, free_func) { G_STATIC_PRIVATE_INIT, (max_idle), (GDestroyNotify)(free_func), 0, 0, 0 }
+
+typedef struct {
+	guint hits;
+	guint misses;
+	guint idle;
+} network_object_pool_stats_t;
+
+NETWORK_API gpointer network_object_pool_get(network_object_pool_t *pool);
+NETWORK_API gboolean network_object_pool_put(network_object_pool_t *pool, gpointer obj);
+NETWORK_API void network_object_pool_get_stats(network_object_pool_t *pool, network_object_pool_stats_t *stats);
+
+#endif
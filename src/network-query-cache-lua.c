@@ -0,0 +1,80 @@
+/* $%BEGINLICENSE%$
+ Copyright (c) 2008, 2012, Oracle and/or its affiliates. All rights reserved.
+
+ This program is free software; you can redistribute it and/or
+ modify it under the terms of the GNU General Public License as
+ published by the Free Software Foundation; version 2 of the
+ License.
+
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ GNU General Public License for more details.
+
+ You should have received a copy of the GNU General Public License
+ along with this program; if not, write to the Free Software
+ Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA
+ 02110-1301  USA
+
+ $%ENDLICENSE%$ */
+#include <lua.h>
+
+#include "lua-env.h"
+#include "glib-ext.h"
+
+#define C(x) x, sizeof(x) - 1
+
+#include "network-query-cache.h"
+#include "network-query-cache-lua.h"
+
+/**
+ * get the stats of the query-cache
+ *
+ * proxy.global.query_cache.
+ *   hits          => queries answered from the cache
+ *   misses        => cacheable queries that went to a backend
+ *   inserts       => results added to the cache
+ *   evictions     => results dropped to stay below max_bytes
+ *   invalidations => results dropped because their tables were written to
+ *   entries       => results in the cache
+ *   bytes         => size of the results in the cache
+ *   max_bytes     => memory limit of the cache, 0 if it is disabled
+ *
+ * @return nil or requested information
+ */
+static int proxy_query_cache_get(lua_State *L) {
+	network_query_cache_t *cache = *(network_query_cache_t **)luaL_checkself(L);
+	gsize keysize = 0;
+	const char *key = luaL_checklstring(L, 2, &keysize);
+
+	if (strleq(key, keysize, C("hits"))) {
+		lua_pushnumber(L, cache->hits);
+	} else if (strleq(key, keysize, C("misses"))) {
+		lua_pushnumber(L, cache->misses);
+	} else if (strleq(key, keysize, C("inserts"))) {
+		lua_pushnumber(L, cache->inserts);
+	} else if (strleq(key, keysize, C("evictions"))) {
+		lua_pushnumber(L, cache->evictions);
+	} else if (strleq(key, keysize, C("invalidations"))) {
+		lua_pushnumber(L, cache->invalidations);
+	} else if (strleq(key, keysize, C("entries"))) {
+		lua_pushinteger(L, cache->lru.length);
+	} else if (strleq(key, keysize, C("bytes"))) {
+		lua_pushnumber(L, cache->bytes);
+	} else if (strleq(key, keysize, C("max_bytes"))) {
+		lua_pushnumber(L, cache->max_bytes);
+	} else {
+		lua_pushnil(L);
+	}
+
+	return 1;
+}
+
+int network_query_cache_lua_getmetatable(lua_State *L) {
+	static const struct luaL_reg methods[] = {
+		{ "__index", proxy_query_cache_get },
+		{ NULL, NULL },
+	};
+
+	return proxy_getmetatable(L, methods);
+}
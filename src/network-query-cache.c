@@ -0,0 +1,677 @@
+/* $%BEGINLICENSE%$
+ Copyright (c) 2008, 2012, Oracle and/or its affiliates. All rights reserved.
+
+ This program is free software; you can redistribute it and/or
+ modify it under the terms of the GNU General Public License as
+ published by the Free Software Foundation; version 2 of the
+ License.
+
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ GNU General Public License for more details.
+
+ You should have received a copy of the GNU General Public License
+ along with this program; if not, write to the Free Software
+ Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA
+ 02110-1301  USA
+
+ $%ENDLICENSE%$ */
+#include <string.h>
+
+#include "glib-ext.h"
+#include "chassis-timings.h"
+#include "network-mysqld-packet.h"
+#include "network-query-cache.h"
+
+#define C(x) x, sizeof(x) - 1
+#define S(x) x->str, x->len
+
+/**
+ * a single result may take 1/NETWORK_QUERY_CACHE_ENTRY_SHARE of the cache
+ */
+#define NETWORK_QUERY_CACHE_ENTRY_SHARE 8
+
+/**
+ * words that make the result of a SELECT change from call to call
+ */
+static const char *query_cache_volatile_words[] = {
+	"NOW",
+	"SYSDATE",
+	"CURDATE",
+	"CURTIME",
+	"CURRENT_DATE",
+	"CURRENT_TIME",
+	"CURRENT_TIMESTAMP",
+	"LOCALTIME",
+	"LOCALTIMESTAMP",
+	"UTC_DATE",
+	"UTC_TIME",
+	"UTC_TIMESTAMP",
+	"UNIX_TIMESTAMP",
+	"RAND",
+	"UUID",
+	"UUID_SHORT",
+	"CONNECTION_ID",
+	"ROW_COUNT",
+	"SLEEP",
+	"BENCHMARK",
+	"SQL_NO_CACHE",
+	NULL
+};
+
+/**
+ * statements that don't change any table
+ */
+static const char *query_cache_read_words[] = {
+	"SELECT",
+	"SHOW",
+	"SET",
+	"BEGIN",
+	"START",
+	"COMMIT",
+	"ROLLBACK",
+	"SAVEPOINT",
+	"RELEASE",
+	"USE",
+	"EXPLAIN",
+	"DESCRIBE",
+	"DESC",
+	"HELP",
+	"KILL",
+	NULL
+};
+
+typedef enum {
+	QUERY_TOKEN_END,
+	QUERY_TOKEN_WORD,    /**< keywords, identifiers and numbers, without the backquotes */
+	QUERY_TOKEN_STRING,
+	QUERY_TOKEN_OTHER    /**< operators and version-comments, one char at a time */
+} query_token_type_t;
+
+typedef struct {
+	query_token_type_t type;
+	const char *str;
+	gsize len;
+} query_token_t;
+
+/**
+ * get the next token of the query
+ *
+ * @return the position after the token
+ */
+static const char *query_cache_next_token(const char *s, const char *end, query_token_t *tok) {
+	s = network_mysqld_proto_query_skip_space(s, end);
+
+	tok->str = s;
+	tok->len = 0;
+
+	if (s == end) {
+		tok->type = QUERY_TOKEN_END;
+	} else if (*s == '`') {
+		tok->type = QUERY_TOKEN_WORD;
+		tok->str = ++s;
+		while (s < end && *s != '`') s++;
+		tok->len = s - tok->str;
+		if (s < end) s++;
+	} else if (*s == '\'' || *s == '"') {
+		char quote_char = *s++;
+
+		tok->type = QUERY_TOKEN_STRING;
+		while (s < end && *s != quote_char) {
+			s += (*s == '\\') ? 2 : 1;
+		}
+		if (s < end) s++;
+		if (s > end) s = end;
+		tok->len = s - tok->str;
+	} else if (network_mysqld_proto_query_is_word_char(*s)) {
+		tok->type = QUERY_TOKEN_WORD;
+		while (s < end && network_mysqld_proto_query_is_word_char(*s)) s++;
+		tok->len = s - tok->str;
+	} else {
+		tok->type = QUERY_TOKEN_OTHER;
+		tok->len = 1;
+		s++;
+	}
+
+	return s;
+}
+
+static gboolean query_token_is(const query_token_t *tok, const char *word) {
+	return tok->type == QUERY_TOKEN_WORD &&
+		strlen(word) == tok->len &&
+		0 == g_ascii_strncasecmp(tok->str, word, tok->len);
+}
+
+static gboolean query_token_is_one_of(const query_token_t *tok, const char **words) {
+	gsize i;
+
+	for (i = 0; words[i]; i++) {
+		if (query_token_is(tok, words[i])) return TRUE;
+	}
+
+	return FALSE;
+}
+
+/**
+ * check if the result of a query can be cached
+ *
+ * only SELECTs that can go to a read-only backend and that don't call
+ * time, random or session functions are cached
+ *
+ * @param query     the query of a COM_QUERY without the command byte
+ * @param query_len length of the query
+ * @return TRUE if the result can be served from the cache
+ */
+gboolean network_query_cache_is_cacheable(const char *query, gsize query_len) {
+	const char *end = query + query_len;
+	const char *s = query;
+	query_token_t tok;
+
+	if (NETWORK_MYSQLD_QUERY_RO != network_mysqld_proto_get_query_rw_type(query, query_len)) return FALSE;
+
+	do {
+		s = query_cache_next_token(s, end, &tok);
+
+		if (query_token_is_one_of(&tok, query_cache_volatile_words)) return FALSE;
+	} while (tok.type != QUERY_TOKEN_END);
+
+	return TRUE;
+}
+
+/**
+ * the fields in front of the query in the key, each one is terminated by a \0
+ */
+#define NETWORK_QUERY_CACHE_KEY_FIELDS 4
+
+/**
+ * build the cache key of a query
+ *
+ * the same query returns different results for different users, default-dbs and charsets
+ * of the session. With CLIENT_DEPRECATE_EOF the result is framed differently, it can only
+ * be replayed to the clients that negotiated the same.
+ *
+ * @param key           GString to store the key in
+ * @param username      the user of the client, may be NULL
+ * @param default_db    the default-db of the client, may be NULL
+ * @param charset       the charset of the session, may be NULL
+ * @param deprecate_eof TRUE if the client uses CLIENT_DEPRECATE_EOF
+ */
+void network_query_cache_key_set(GString *key, const GString *username, const GString *default_db, const GString *charset, gboolean deprecate_eof, const char *query, gsize query_len) {
+	g_string_truncate(key, 0);
+
+	if (username) g_string_append_len(key, S(username));
+	g_string_append_c(key, '\0');
+	if (default_db) g_string_append_len(key, S(default_db));
+	g_string_append_c(key, '\0');
+	if (charset) g_string_append_len(key, S(charset));
+	g_string_append_c(key, '\0');
+	g_string_append_c(key, deprecate_eof ? '1' : '0');
+	g_string_append_c(key, '\0');
+	g_string_append_len(key, query, query_len);
+}
+
+/**
+ * get the query of a key
+ *
+ * @see network_query_cache_key_set()
+ */
+static const char *network_query_cache_key_get_query(const GString *key) {
+	const char *end = key->str + key->len;
+	const char *s = key->str;
+	guint i;
+
+	for (i = 0; i < NETWORK_QUERY_CACHE_KEY_FIELDS && s < end; i++) {
+		if (NULL == (s = memchr(s, '\0', end - s))) return end;
+		s++;
+	}
+
+	return s;
+}
+
+/**
+ * append the lower-cased word and a trailing space
+ */
+static void query_cache_append_word(GString *dst, const char *word, gsize word_len) {
+	gsize i;
+
+	for (i = 0; i < word_len; i++) {
+		g_string_append_c(dst, g_ascii_tolower(word[i]));
+	}
+	g_string_append_c(dst, ' ');
+}
+
+static network_query_cache_entry_t *network_query_cache_entry_new(const GString *key, GPtrArray *packets) {
+	network_query_cache_entry_t *entry;
+	const char *query, *end;
+	query_token_t tok;
+	guint i;
+
+	entry = g_new0(network_query_cache_entry_t, 1);
+	entry->key = g_string_new_len(S(key));
+	entry->packets = packets;
+	entry->ref_count = 1;
+	entry->link.data = entry;
+
+	for (i = 0; i < packets->len; i++) {
+		GString *packet = packets->pdata[i];
+
+		entry->bytes += packet->len;
+	}
+
+	end = key->str + key->len;
+	query = network_query_cache_key_get_query(key);
+
+	entry->words = g_string_new(" ");
+	do {
+		query = query_cache_next_token(query, end, &tok);
+
+		if (tok.type == QUERY_TOKEN_WORD) query_cache_append_word(entry->words, tok.str, tok.len);
+	} while (tok.type != QUERY_TOKEN_END);
+
+	return entry;
+}
+
+static void network_query_cache_entry_free(network_query_cache_entry_t *entry) {
+	guint i;
+
+	if (!entry) return;
+
+	for (i = 0; i < entry->packets->len; i++) {
+		g_string_free(entry->packets->pdata[i], TRUE);
+	}
+	g_ptr_array_free(entry->packets, TRUE);
+
+	g_string_free(entry->key, TRUE);
+	g_string_free(entry->words, TRUE);
+
+	g_free(entry);
+}
+
+network_query_cache_t *network_query_cache_new(void) {
+	network_query_cache_t *cache;
+
+	cache = g_new0(network_query_cache_t, 1);
+	/* the keys are owned by the entries, the entries by the LRU list */
+	cache->entries = g_hash_table_new(g_hash_table_string_hash, g_hash_table_string_equal);
+	g_queue_init(&cache->lru);
+	cache->mutex = g_mutex_new();
+
+	return cache;
+}
+
+void network_query_cache_free(network_query_cache_t *cache) {
+	GList *l;
+
+	if (!cache) return;
+
+	g_hash_table_destroy(cache->entries);
+
+	while (NULL != (l = g_queue_pop_head_link(&cache->lru))) {
+		network_query_cache_entry_t *entry = l->data;
+
+		/* entries that are still referenced are freed by the last unref() */
+		if (--entry->ref_count == 0) {
+			network_query_cache_entry_free(entry);
+		}
+	}
+
+	g_mutex_free(cache->mutex);
+
+	g_free(cache);
+}
+
+/**
+ * set the memory limit and the time-to-live of the results
+ *
+ * @param max_bytes memory limit of all results, 0 disables the cache
+ * @param ttl_secs  results are served for this long
+ */
+void network_query_cache_set_limits(network_query_cache_t *cache, gsize max_bytes, gdouble ttl_secs) {
+	g_mutex_lock(cache->mutex);
+	cache->max_bytes = max_bytes;
+	cache->max_entry_bytes = max_bytes / NETWORK_QUERY_CACHE_ENTRY_SHARE;
+	cache->ttl_usec = ttl_secs > 0 ? (guint64)(ttl_secs * G_USEC_PER_SEC) : 0;
+	g_mutex_unlock(cache->mutex);
+}
+
+/**
+ * take the entry out of the cache
+ *
+ * @note has to be called with the cache->mutex held
+ */
+static void network_query_cache_remove(network_query_cache_t *cache, network_query_cache_entry_t *entry) {
+	g_hash_table_remove(cache->entries, entry->key);
+	g_queue_unlink(&cache->lru, &entry->link);
+
+	cache->bytes -= entry->bytes;
+
+	if (--entry->ref_count == 0) {
+		network_query_cache_entry_free(entry);
+	}
+}
+
+/**
+ * get the cached result of a query
+ *
+ * expired results are dropped
+ *
+ * @return a referenced entry or NULL, release it with network_query_cache_entry_unref()
+ */
+network_query_cache_entry_t *network_query_cache_get(network_query_cache_t *cache, const GString *key) {
+	network_query_cache_entry_t *entry;
+	guint64 now;
+
+	if (cache->max_bytes == 0) return NULL;
+
+	now = chassis_get_coarse_rel_microseconds();
+
+	g_mutex_lock(cache->mutex);
+	entry = g_hash_table_lookup(cache->entries, key);
+	if (NULL != entry && now >= entry->expires_at) {
+		network_query_cache_remove(cache, entry);
+		entry = NULL;
+	}
+
+	if (NULL != entry) {
+		/* move it to the front of the LRU */
+		g_queue_unlink(&cache->lru, &entry->link);
+		g_queue_push_head_link(&cache->lru, &entry->link);
+
+		entry->ref_count++;
+		cache->hits++;
+	} else {
+		cache->misses++;
+	}
+	g_mutex_unlock(cache->mutex);
+
+	return entry;
+}
+
+void network_query_cache_entry_unref(network_query_cache_t *cache, network_query_cache_entry_t *entry) {
+	gboolean do_free;
+
+	g_mutex_lock(cache->mutex);
+	do_free = (--entry->ref_count == 0);
+	g_mutex_unlock(cache->mutex);
+
+	if (do_free) network_query_cache_entry_free(entry);
+}
+
+/**
+ * cache the result of a query
+ *
+ * replaces an older result of the same query and drops the least recently
+ * used results until we are below the memory limit
+ *
+ * @param packets the raw packets of the result, the cache takes ownership
+ * @return TRUE if the result is cached, FALSE if it is too big or the cache is disabled
+ */
+gboolean network_query_cache_add(network_query_cache_t *cache, const GString *key, GPtrArray *packets) {
+	return network_query_cache_add_ttl(cache, key, packets, -1);
+}
+
+/**
+ * cache the result of a query for a TTL of its own
+ *
+ * @param ttl_usec how long the result is served, -1 for the TTL of the cache
+ * @see network_query_cache_add()
+ */
+gboolean network_query_cache_add_ttl(network_query_cache_t *cache, const GString *key, GPtrArray *packets, gint64 ttl_usec) {
+	network_query_cache_entry_t *entry, *old_entry;
+
+	entry = network_query_cache_entry_new(key, packets);
+
+	g_mutex_lock(cache->mutex);
+	if (cache->max_bytes == 0 || entry->bytes > cache->max_entry_bytes) {
+		g_mutex_unlock(cache->mutex);
+
+		network_query_cache_entry_free(entry);
+
+		return FALSE;
+	}
+
+	if (NULL != (old_entry = g_hash_table_lookup(cache->entries, entry->key))) {
+		network_query_cache_remove(cache, old_entry);
+	}
+
+	entry->expires_at = chassis_get_coarse_rel_microseconds() + (ttl_usec < 0 ? cache->ttl_usec : (guint64)ttl_usec);
+
+	g_hash_table_insert(cache->entries, entry->key, entry);
+	g_queue_push_head_link(&cache->lru, &entry->link);
+	cache->bytes += entry->bytes;
+	cache->inserts++;
+
+	while (cache->bytes > cache->max_bytes) {
+		network_query_cache_remove(cache, g_queue_peek_tail(&cache->lru));
+		cache->evictions++;
+	}
+	g_mutex_unlock(cache->mutex);
+
+	return TRUE;
+}
+
+/**
+ * read a [db.]table and append the lower-cased table name to the tables
+ *
+ * @param tok the first token of the table name, the token after it on return
+ * @return the position after tok, NULL if there is no table name
+ */
+static const char *query_cache_get_table(const char *s, const char *end, query_token_t *tok, GPtrArray *tables) {
+	query_token_t name;
+	GString *table;
+
+	if (tok->type != QUERY_TOKEN_WORD) return NULL;
+
+	name = *tok;
+	s = query_cache_next_token(s, end, tok);
+	if (tok->type == QUERY_TOKEN_OTHER && *tok->str == '.') {
+		s = query_cache_next_token(s, end, tok);
+		if (tok->type != QUERY_TOKEN_WORD) return NULL;
+
+		name = *tok;
+		s = query_cache_next_token(s, end, tok);
+	}
+
+	table = g_string_sized_new(name.len + 1);
+	query_cache_append_word(table, name.str, name.len);
+	g_string_truncate(table, name.len); /* without the trailing space */
+
+	g_ptr_array_add(tables, table);
+
+	return s;
+}
+
+/**
+ * read a comma-separated list of [db.]tables
+ *
+ * @param tok the first token of the list, the token after it on return
+ * @return the position after tok, NULL if a table name is missing
+ */
+static const char *query_cache_get_table_list(const char *s, const char *end, query_token_t *tok, GPtrArray *tables) {
+	for (;;) {
+		if (NULL == (s = query_cache_get_table(s, end, tok, tables))) return NULL;
+
+		if (!(tok->type == QUERY_TOKEN_OTHER && *tok->str == ',')) return s;
+
+		s = query_cache_next_token(s, end, tok);
+	}
+}
+
+/**
+ * get the tables a statement writes to
+ *
+ * we understand single-table INSERTs, REPLACEs, UPDATEs, DELETEs and TRUNCATEs
+ * and the DDL of tables: CREATE TABLE, ALTER TABLE, DROP TABLE and RENAME TABLE.
+ * For everything else that isn't known to be read-only we don't know what
+ * is changed
+ *
+ * @param tables array of GString, the lower-cased table names are appended to it
+ * @return the number of tables appended, 0 if the statement doesn't write, -1 if we don't know
+ */
+int network_query_cache_get_written_tables(const char *query, gsize query_len, GPtrArray *tables) {
+	static const char *insert_modifiers[] = { "LOW_PRIORITY", "DELAYED", "HIGH_PRIORITY", "IGNORE", "INTO", NULL };
+	static const char *update_modifiers[] = { "LOW_PRIORITY", "IGNORE", NULL };
+	static const char *delete_modifiers[] = { "LOW_PRIORITY", "QUICK", "IGNORE", NULL };
+	const char *end = query + query_len;
+	const char *s;
+	query_token_t tok;
+	guint old_len = tables->len;
+
+	s = query_cache_next_token(query, end, &tok);
+	if (tok.type != QUERY_TOKEN_WORD) return -1;
+
+	if (query_token_is_one_of(&tok, query_cache_read_words)) return 0;
+
+	if (query_token_is(&tok, "INSERT") || query_token_is(&tok, "REPLACE")) {
+		do {
+			s = query_cache_next_token(s, end, &tok);
+		} while (query_token_is_one_of(&tok, insert_modifiers));
+
+		if (NULL == query_cache_get_table(s, end, &tok, tables)) return -1;
+	} else if (query_token_is(&tok, "UPDATE")) {
+		do {
+			s = query_cache_next_token(s, end, &tok);
+		} while (query_token_is_one_of(&tok, update_modifiers));
+
+		if (NULL == (s = query_cache_get_table(s, end, &tok, tables))) return -1;
+
+		/* skip the alias, multi-table UPDATEs have something else than a SET here */
+		if (query_token_is(&tok, "AS")) s = query_cache_next_token(s, end, &tok);
+		if (tok.type == QUERY_TOKEN_WORD && !query_token_is(&tok, "SET")) s = query_cache_next_token(s, end, &tok);
+
+		if (!query_token_is(&tok, "SET")) return -1;
+	} else if (query_token_is(&tok, "DELETE")) {
+		do {
+			s = query_cache_next_token(s, end, &tok);
+		} while (query_token_is_one_of(&tok, delete_modifiers));
+
+		if (!query_token_is(&tok, "FROM")) return -1;
+		s = query_cache_next_token(s, end, &tok);
+
+		if (NULL == (s = query_cache_get_table(s, end, &tok, tables))) return -1;
+
+		/* multi-table DELETEs have a USING or a JOIN here */
+		if (!(tok.type == QUERY_TOKEN_END ||
+		      (tok.type == QUERY_TOKEN_OTHER && *tok.str == ';') ||
+		      query_token_is(&tok, "WHERE") ||
+		      query_token_is(&tok, "ORDER") ||
+		      query_token_is(&tok, "LIMIT"))) {
+			return -1;
+		}
+	} else if (query_token_is(&tok, "TRUNCATE")) {
+		s = query_cache_next_token(s, end, &tok);
+		if (query_token_is(&tok, "TABLE")) s = query_cache_next_token(s, end, &tok);
+
+		if (NULL == query_cache_get_table(s, end, &tok, tables)) return -1;
+	} else if (query_token_is(&tok, "CREATE") || query_token_is(&tok, "ALTER")) {
+		do {
+			s = query_cache_next_token(s, end, &tok);
+		} while (query_token_is(&tok, "TEMPORARY") || query_token_is(&tok, "ONLINE") ||
+		         query_token_is(&tok, "OFFLINE") || query_token_is(&tok, "IGNORE"));
+
+		/* CREATE VIEW, ALTER DATABASE, ... */
+		if (!query_token_is(&tok, "TABLE")) return -1;
+		s = query_cache_next_token(s, end, &tok);
+
+		if (query_token_is(&tok, "IF")) { /* IF NOT EXISTS */
+			s = query_cache_next_token(s, end, &tok);
+			if (query_token_is(&tok, "NOT")) s = query_cache_next_token(s, end, &tok);
+			if (!query_token_is(&tok, "EXISTS")) return -1;
+			s = query_cache_next_token(s, end, &tok);
+		}
+
+		if (NULL == query_cache_get_table(s, end, &tok, tables)) return -1;
+	} else if (query_token_is(&tok, "DROP")) {
+		s = query_cache_next_token(s, end, &tok);
+		if (query_token_is(&tok, "TEMPORARY")) s = query_cache_next_token(s, end, &tok);
+
+		if (!query_token_is(&tok, "TABLE")) return -1;
+		s = query_cache_next_token(s, end, &tok);
+
+		if (query_token_is(&tok, "IF")) { /* IF EXISTS */
+			s = query_cache_next_token(s, end, &tok);
+			if (!query_token_is(&tok, "EXISTS")) return -1;
+			s = query_cache_next_token(s, end, &tok);
+		}
+
+		if (NULL == query_cache_get_table_list(s, end, &tok, tables)) return -1;
+	} else if (query_token_is(&tok, "RENAME")) {
+		s = query_cache_next_token(s, end, &tok);
+		if (!query_token_is(&tok, "TABLE")) return -1;
+		s = query_cache_next_token(s, end, &tok);
+
+		/* a TO b, c TO d: all of them change */
+		for (;;) {
+			if (NULL == (s = query_cache_get_table(s, end, &tok, tables))) return -1;
+			if (!query_token_is(&tok, "TO")) return -1;
+			s = query_cache_next_token(s, end, &tok);
+			if (NULL == (s = query_cache_get_table(s, end, &tok, tables))) return -1;
+
+			if (!(tok.type == QUERY_TOKEN_OTHER && *tok.str == ',')) break;
+			s = query_cache_next_token(s, end, &tok);
+		}
+	} else {
+		return -1;
+	}
+
+	return tables->len - old_len;
+}
+
+/**
+ * drop the results of all queries that mention the table
+ *
+ * we don't parse the cached queries, any identifier that matches the
+ * table name invalidates the result
+ *
+ * @param table the lower-cased table name
+ * @return the number of dropped results
+ */
+guint network_query_cache_invalidate_table(network_query_cache_t *cache, const char *table, gsize table_len) {
+	GString *word;
+	GList *l, *l_next;
+	guint dropped = 0;
+
+	word = g_string_sized_new(table_len + 2);
+	g_string_append_c(word, ' ');
+	g_string_append_len(word, table, table_len);
+	g_string_append_c(word, ' ');
+
+	g_mutex_lock(cache->mutex);
+	for (l = cache->lru.head; l; l = l_next) {
+		network_query_cache_entry_t *entry = l->data;
+
+		l_next = l->next;
+
+		if (NULL != strstr(entry->words->str, word->str)) {
+			network_query_cache_remove(cache, entry);
+			dropped++;
+		}
+	}
+	cache->invalidations += dropped;
+	g_mutex_unlock(cache->mutex);
+
+	g_string_free(word, TRUE);
+
+	return dropped;
+}
+
+/**
+ * drop all results
+ *
+ * @return the number of dropped results
+ */
+guint network_query_cache_flush(network_query_cache_t *cache) {
+	network_query_cache_entry_t *entry;
+	guint dropped = 0;
+
+	g_mutex_lock(cache->mutex);
+	while (NULL != (entry = g_queue_peek_head(&cache->lru))) {
+		network_query_cache_remove(cache, entry);
+		dropped++;
+	}
+	cache->invalidations += dropped;
+	g_mutex_unlock(cache->mutex);
+
+	return dropped;
+}
@@ -0,0 +1,84 @@
+/* $%BEGINLICENSE%$
+ Copyright (c) 2008, 2012, Oracle and/or its affiliates. All rights reserved.
+
+ This program is free software; you can redistribute it and/or
+ modify it under the terms of the GNU General Public License as
+ published by the Free Software Foundation; version 2 of the
+ License.
+
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ GNU General Public License for more details.
+
+ You should have received a copy of the GNU General Public License
+ along with this program; if not, write to the Free Software
+ Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA
+ 02110-1301  USA
+
+ $%ENDLICENSE%$ */
+#ifndef __NETWORK_QUERY_CACHE_H__
+#define __NETWORK_QUERY_CACHE_H__
+
+#include <glib.h>
+
+#include "network-exports.h"
+
+/**
+ * a cached result-set
+ *
+ * the entry is immutable once it is in the cache, a reference from
+ * network_query_cache_get() can be used without the lock
+ */
+typedef struct {
+	GString *key;          /**< the user, the default-db, the charset, the framing of the result and the query, see network_query_cache_key_set() */
+	GString *words;        /**< the lower-cased identifiers of the query, separated and enclosed by spaces */
+	GPtrArray *packets;    /**< the raw packets of the result including the network-header */
+	gsize bytes;           /**< size of the packets */
+
+	guint64 expires_at;    /**< in chassis_get_rel_microseconds() */
+
+	gint ref_count;
+	GList link;            /**< our link in the LRU list of the cache */
+} network_query_cache_entry_t;
+
+/**
+ * a cache of the result-sets of read-only queries
+ *
+ * shared by all event-threads
+ */
+typedef struct {
+	GHashTable *entries;   /**< key -> network_query_cache_entry_t */
+	GQueue lru;            /**< most recently used first */
+	GMutex *mutex;
+
+	gsize max_bytes;       /**< memory limit of all results, 0 disables the cache */
+	gsize max_entry_bytes; /**< results bigger than this aren't cached */
+	guint64 ttl_usec;      /**< results are served for this long */
+
+	gsize bytes;           /**< size of the cached results */
+
+	guint64 hits;
+	guint64 misses;
+	guint64 inserts;
+	guint64 evictions;     /**< entries dropped for the memory limit */
+	guint64 invalidations; /**< entries dropped by writes */
+} network_query_cache_t;
+
+NETWORK_API network_query_cache_t *network_query_cache_new(void);
+NETWORK_API void network_query_cache_free(network_query_cache_t *cache);
+NETWORK_API void network_query_cache_set_limits(network_query_cache_t *cache, gsize max_bytes, gdouble ttl_secs);
+
+NETWORK_API gboolean network_query_cache_is_cacheable(const char *query, gsize query_len);
+NETWORK_API void network_query_cache_key_set(GString *key, const GString *username, const GString *default_db, const GString *charset, gboolean deprecate_eof, const char *query, gsize query_len);
+
+NETWORK_API network_query_cache_entry_t *network_query_cache_get(network_query_cache_t *cache, const GString *key);
+NETWORK_API void network_query_cache_entry_unref(network_query_cache_t *cache, network_query_cache_entry_t *entry);
+NETWORK_API gboolean network_query_cache_add(network_query_cache_t *cache, const GString *key, GPtrArray *packets);
+NETWORK_API gboolean network_query_cache_add_ttl(network_query_cache_t *cache, const GString *key, GPtrArray *packets, gint64 ttl_usec);
+
+NETWORK_API int network_query_cache_get_written_tables(const char *query, gsize query_len, GPtrArray *tables);
+NETWORK_API guint network_query_cache_invalidate_table(network_query_cache_t *cache, const char *table, gsize table_len);
+NETWORK_API guint network_query_cache_flush(network_query_cache_t *cache);
+
+#endif
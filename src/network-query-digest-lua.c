@@ -0,0 +1,115 @@
+/* $%BEGINLICENSE%$
+ Copyright (c) 2008, 2012, Oracle and/or its affiliates. All rights reserved.
+
+ This program is free software; you can redistribute it and/or
+ modify it under the terms of the GNU General Public License as
+ published by the Free Software Foundation; version 2 of the
+ License.
+
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ GNU General Public License for more details.
+
+ You should have received a copy of the GNU General Public License
+ along with this program; if not, write to the Free Software
+ Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA
+ 02110-1301  USA
+
+ $%ENDLICENSE%$ */
+#include <string.h>
+
+#include <lua.h>
+
+#include "lua-env.h"
+#include "glib-ext.h"
+
+#define C(x) x, sizeof(x) - 1
+#define S(x) x->str, x->len
+
+#include "network-query-digest.h"
+#include "network-query-digest-lua.h"
+
+static void proxy_query_digest_push_entry(lua_State *L, network_query_digest_entry_t *entry) {
+	lua_newtable(L);
+	lua_pushlstring(L, S(entry->text));
+	lua_setfield(L, -2, "digest");
+	lua_pushnumber(L, entry->count);
+	lua_setfield(L, -2, "count");
+	lua_pushnumber(L, entry->sum_usec);
+	lua_setfield(L, -2, "sum_usec");
+	lua_pushnumber(L, entry->count > 0 ? entry->sum_usec / entry->count : 0);
+	lua_setfield(L, -2, "avg_usec");
+	lua_pushnumber(L, entry->max_usec);
+	lua_setfield(L, -2, "max_usec");
+	lua_pushnumber(L, entry->rows);
+	lua_setfield(L, -2, "rows");
+	lua_pushnumber(L, entry->bytes);
+	lua_setfield(L, -2, "bytes");
+	lua_pushnumber(L, entry->errors);
+	lua_setfield(L, -2, "errors");
+	lua_pushinteger(L, entry->backend_ndx + 1); /* lua starts at 1, 0 if no backend was used */
+	lua_setfield(L, -2, "backend_ndx");
+}
+
+/**
+ * get the stats of the normalized queries
+ *
+ * proxy.global.query_digest.
+ *   entries     => array of the normalized queries of all event-threads
+ *   evicted     => the sum of the entries that were dropped for the limit
+ *   max_entries => normalized queries kept per event-thread, 0 if it is disabled
+ *
+ * each entry is a table of digest, count, sum_usec, avg_usec, max_usec, rows, bytes,
+ * errors and backend_ndx
+ *
+ * @return nil or requested information
+ */
+static int proxy_query_digest_get(lua_State *L) {
+	network_query_digest_t *digest = *(network_query_digest_t **)luaL_checkself(L);
+	gsize keysize = 0;
+	const char *key = luaL_checklstring(L, 2, &keysize);
+
+	if (strleq(key, keysize, C("entries"))) {
+		GPtrArray *entries = network_query_digest_get_entries(digest, NULL);
+		guint i;
+
+		lua_newtable(L);
+		for (i = 0; i < entries->len; i++) {
+			network_query_digest_entry_t *entry = entries->pdata[i];
+
+			proxy_query_digest_push_entry(L, entry);
+			lua_rawseti(L, -2, i + 1);
+
+			network_query_digest_entry_free(entry);
+		}
+		g_ptr_array_free(entries, TRUE);
+	} else if (strleq(key, keysize, C("evicted"))) {
+		network_query_digest_entry_t *evicted = network_query_digest_entry_new();
+		GPtrArray *entries = network_query_digest_get_entries(digest, evicted);
+		guint i;
+
+		for (i = 0; i < entries->len; i++) {
+			network_query_digest_entry_free(entries->pdata[i]);
+		}
+		g_ptr_array_free(entries, TRUE);
+
+		proxy_query_digest_push_entry(L, evicted);
+		network_query_digest_entry_free(evicted);
+	} else if (strleq(key, keysize, C("max_entries"))) {
+		lua_pushinteger(L, digest->max_entries);
+	} else {
+		lua_pushnil(L);
+	}
+
+	return 1;
+}
+
+int network_query_digest_lua_getmetatable(lua_State *L) {
+	static const struct luaL_reg methods[] = {
+		{ "__index", proxy_query_digest_get },
+		{ NULL, NULL },
+	};
+
+	return proxy_getmetatable(L, methods);
+}
@@ -0,0 +1,377 @@
+/* $%BEGINLICENSE%$
+ Copyright (c) 2008, 2012, Oracle and/or its affiliates. All rights reserved.
+
+ This program is free software; you can redistribute it and/or
+ modify it under the terms of the GNU General Public License as
+ published by the Free Software Foundation; version 2 of the
+ License.
+
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ GNU General Public License for more details.
+
+ You should have received a copy of the GNU General Public License
+ along with this program; if not, write to the Free Software
+ Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA
+ 02110-1301  USA
+
+ $%ENDLICENSE%$ */
+/**
+ * the stats of the normalized queries
+ *
+ * each event-thread has its own table, the admin interface merges them when it
+ * reads them. The tables are limited to max_entries: the least recently used
+ * entries are dropped and only their sum is kept.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <string.h>
+
+#include <glib.h>
+
+#include "network-query-digest.h"
+
+#define S(x) x->str, x->len
+
+#define FNV1A_64_INIT  G_GUINT64_CONSTANT(14695981039346656037)
+#define FNV1A_64_PRIME G_GUINT64_CONSTANT(1099511628211)
+
+static guint network_query_digest_hash_func(gconstpointer key) {
+	guint64 h = *(const guint64 *)key;
+
+	return (guint)(h ^ (h >> 32));
+}
+
+static gboolean network_query_digest_equal_func(gconstpointer a, gconstpointer b) {
+	return *(const guint64 *)a == *(const guint64 *)b;
+}
+
+network_query_digest_entry_t *network_query_digest_entry_new(void) {
+	network_query_digest_entry_t *entry;
+
+	entry = g_new0(network_query_digest_entry_t, 1);
+	entry->text = g_string_new(NULL);
+	entry->backend_ndx = -1;
+	entry->link.data = entry;
+
+	return entry;
+}
+
+void network_query_digest_entry_free(network_query_digest_entry_t *entry) {
+	if (!entry) return;
+
+	g_string_free(entry->text, TRUE);
+
+	g_free(entry);
+}
+
+static void network_query_digest_entry_merge(network_query_digest_entry_t *dst, const network_query_digest_entry_t *src) {
+	dst->count    += src->count;
+	dst->sum_usec += src->sum_usec;
+	dst->max_usec  = MAX(dst->max_usec, src->max_usec);
+	dst->rows     += src->rows;
+	dst->bytes    += src->bytes;
+	dst->errors   += src->errors;
+	if (src->backend_ndx != -1) dst->backend_ndx = src->backend_ndx;
+}
+
+static network_query_digest_shard_t *network_query_digest_shard_new(void) {
+	network_query_digest_shard_t *shard;
+
+	shard = g_new0(network_query_digest_shard_t, 1);
+	shard->entries = g_hash_table_new_full(network_query_digest_hash_func, network_query_digest_equal_func,
+			NULL, (GDestroyNotify)network_query_digest_entry_free);
+	shard->mutex = g_mutex_new();
+	shard->evicted = network_query_digest_entry_new();
+
+	return shard;
+}
+
+static void network_query_digest_shard_free(network_query_digest_shard_t *shard) {
+	if (!shard) return;
+
+	g_hash_table_destroy(shard->entries);
+	g_mutex_free(shard->mutex);
+	network_query_digest_entry_free(shard->evicted);
+
+	g_free(shard);
+}
+
+network_query_digest_t *network_query_digest_new(void) {
+	network_query_digest_t *digest;
+
+	digest = g_new0(network_query_digest_t, 1);
+	digest->shards = g_ptr_array_new();
+
+	return digest;
+}
+
+void network_query_digest_free(network_query_digest_t *digest) {
+	guint i;
+
+	if (!digest) return;
+
+	for (i = 0; i < digest->shards->len; i++) {
+		network_query_digest_shard_free(digest->shards->pdata[i]);
+	}
+	g_ptr_array_free(digest->shards, TRUE);
+
+	g_free(digest);
+}
+
+/**
+ * enable the digests
+ *
+ * call it with the number of event-threads before the threads are started
+ *
+ * @param shards      number of event-threads
+ * @param max_entries normalized queries to keep per event-thread, 0 to disable
+ */
+void network_query_digest_set_limits(network_query_digest_t *digest, guint shards, guint max_entries) {
+	if (shards < 1) shards = 1;
+
+	while (digest->shards->len < shards) {
+		g_ptr_array_add(digest->shards, network_query_digest_shard_new());
+	}
+
+	digest->max_entries = max_entries;
+}
+
+gboolean network_query_digest_is_enabled(network_query_digest_t *digest) {
+	return digest->max_entries > 0 && digest->shards->len > 0;
+}
+
+static gboolean network_query_digest_is_ident_char(gchar c) {
+	return g_ascii_isalnum(c) || c == '_' || c == '$' || (guchar)c >= 0x80;
+}
+
+/**
+ * append a ? for a literal
+ *
+ * a list of literals like "IN (1, 2, 3)" becomes "IN (?+)" to give the lists of all
+ * lengths the same digest
+ */
+static void network_query_digest_append_placeholder(GString *dst, gsize start) {
+	gsize p = dst->len;
+
+	if (p > start && dst->str[p - 1] == ' ') p--;
+
+	if (p > start && dst->str[p - 1] == ',') {
+		p--;
+		if (p > start && dst->str[p - 1] == ' ') p--;
+
+		if (p > start + 1 && dst->str[p - 1] == '+' && dst->str[p - 2] == '?') {
+			g_string_truncate(dst, p);
+
+			return;
+		} else if (p > start && dst->str[p - 1] == '?') {
+			g_string_truncate(dst, p);
+			g_string_append_c(dst, '+');
+
+			return;
+		}
+	}
+
+	g_string_append_c(dst, '?');
+}
+
+/**
+ * normalize a query
+ *
+ * - comments are removed and whitespace is collapsed to one space
+ * - strings and numbers are replaced by ?, lists of them by ?+
+ * - identifiers and keywords are kept as they are
+ *
+ * It is a small scanner of its own as the tokenizer in lib/ isn't linked into
+ * libmysql-proxy, sql_tokenizer_fingerprint() also uppercases the keywords.
+ *
+ * @param dst       the normalized query is appended to it
+ * @param hash      the 64bit FNV-1a hash of the normalized query
+ * @param query     the query
+ * @param query_len length of the query
+ * @return 0
+ */
+int network_query_digest_fingerprint(GString *dst, guint64 *hash, const char *query, gsize query_len) {
+	gsize start = dst->len;
+	gsize i = 0;
+	gboolean need_space = FALSE;
+	guint64 h = FNV1A_64_INIT;
+
+	while (i < query_len) {
+		gchar c = query[i];
+
+		if (g_ascii_isspace(c)) {
+			need_space = TRUE;
+			i++;
+			continue;
+		}
+
+		if (c == '#' ||
+		    (c == '-' && i + 1 < query_len && query[i + 1] == '-' &&
+		     (i + 2 == query_len || g_ascii_isspace(query[i + 2])))) {
+			while (i < query_len && query[i] != '\n') i++;
+
+			need_space = TRUE;
+			continue;
+		}
+
+		if (c == '/' && i + 1 < query_len && query[i + 1] == '*') {
+			for (i += 2; i + 1 < query_len && !(query[i] == '*' && query[i + 1] == '/'); i++);
+			i = MIN(i + 2, query_len);
+
+			need_space = TRUE;
+			continue;
+		}
+
+		if (need_space && dst->len > start) g_string_append_c(dst, ' ');
+		need_space = FALSE;
+
+		if (c == '\'' || c == '"') {
+			for (i++; i < query_len; i++) {
+				if (query[i] == '\\') {
+					i++;
+				} else if (query[i] == c) {
+					if (i + 1 < query_len && query[i + 1] == c) { /* a doubled quote */
+						i++;
+					} else {
+						break;
+					}
+				}
+			}
+			i = MIN(i + 1, query_len);
+
+			network_query_digest_append_placeholder(dst, start);
+		} else if (c == '`') {
+			gsize s = i;
+
+			for (i++; i < query_len && query[i] != '`'; i++);
+			i = MIN(i + 1, query_len);
+
+			g_string_append_len(dst, query + s, i - s);
+		} else if (g_ascii_isdigit(c) ||
+		           (c == '.' && i + 1 < query_len && g_ascii_isdigit(query[i + 1]))) {
+			/* 12, 1.5, .5, 1e-3, 0x1f */
+			for (i++; i < query_len; i++) {
+				if (g_ascii_isalnum(query[i]) || query[i] == '.') continue;
+				if ((query[i] == '+' || query[i] == '-') && (query[i - 1] == 'e' || query[i - 1] == 'E')) continue;
+
+				break;
+			}
+
+			network_query_digest_append_placeholder(dst, start);
+		} else if (network_query_digest_is_ident_char(c)) {
+			gsize s = i;
+
+			for (i++; i < query_len && network_query_digest_is_ident_char(query[i]); i++);
+
+			g_string_append_len(dst, query + s, i - s);
+		} else {
+			g_string_append_c(dst, c);
+			i++;
+		}
+	}
+
+	for (i = start; i < dst->len; i++) {
+		h ^= (guchar)dst->str[i];
+		h *= FNV1A_64_PRIME;
+	}
+	*hash = h;
+
+	return 0;
+}
+
+/**
+ * add a execution of a query to the digests of a event-thread
+ *
+ * @param ndx         the index of the event-thread, see chassis_event_thread_get_local_index()
+ * @param hash        the hash of the normalized query
+ * @param text        the normalized query, copied if we don't know the hash yet
+ * @param usec        time from sending the query to the last packet of the result
+ * @param backend_ndx backend the query was sent to, -1 if none
+ */
+void network_query_digest_add(network_query_digest_t *digest, guint ndx, guint64 hash, const GString *text,
+		guint64 usec, guint64 rows, guint64 bytes, gboolean is_error, gint backend_ndx) {
+	network_query_digest_shard_t *shard;
+	network_query_digest_entry_t *entry;
+
+	if (!network_query_digest_is_enabled(digest)) return;
+
+	shard = digest->shards->pdata[ndx < digest->shards->len ? ndx : 0];
+
+	g_mutex_lock(shard->mutex);
+	if ((entry = g_hash_table_lookup(shard->entries, &hash))) {
+		g_queue_unlink(&shard->lru, &entry->link);
+	} else {
+		/* make room by folding the least recently used entries into the evicted sum */
+		while (g_hash_table_size(shard->entries) >= digest->max_entries) {
+			network_query_digest_entry_t *old = g_queue_pop_tail_link(&shard->lru)->data;
+
+			network_query_digest_entry_merge(shard->evicted, old);
+			g_hash_table_remove(shard->entries, &old->hash);
+		}
+
+		entry = network_query_digest_entry_new();
+		entry->hash = hash;
+		g_string_append_len(entry->text, S(text));
+
+		g_hash_table_insert(shard->entries, &entry->hash, entry);
+	}
+	g_queue_push_head_link(&shard->lru, &entry->link);
+
+	entry->count++;
+	entry->sum_usec += usec;
+	entry->max_usec  = MAX(entry->max_usec, usec);
+	entry->rows     += rows;
+	entry->bytes    += bytes;
+	if (is_error) entry->errors++;
+	entry->backend_ndx = backend_ndx;
+	g_mutex_unlock(shard->mutex);
+}
+
+/**
+ * merge the digests of all event-threads
+ *
+ * @param evicted if not NULL, the sum of the evicted entries is added to it
+ * @return a array of network_query_digest_entry_t, free them with network_query_digest_entry_free()
+ */
+GPtrArray *network_query_digest_get_entries(network_query_digest_t *digest, network_query_digest_entry_t *evicted) {
+	GHashTable *merged;
+	GPtrArray *entries;
+	guint i;
+
+	entries = g_ptr_array_new();
+	merged = g_hash_table_new(network_query_digest_hash_func, network_query_digest_equal_func);
+
+	for (i = 0; i < digest->shards->len; i++) {
+		network_query_digest_shard_t *shard = digest->shards->pdata[i];
+		GList *node;
+
+		g_mutex_lock(shard->mutex);
+		for (node = shard->lru.head; node; node = node->next) {
+			network_query_digest_entry_t *src = node->data;
+			network_query_digest_entry_t *dst;
+
+			if (NULL == (dst = g_hash_table_lookup(merged, &src->hash))) {
+				dst = network_query_digest_entry_new();
+				dst->hash = src->hash;
+				g_string_append_len(dst->text, S(src->text));
+
+				g_hash_table_insert(merged, &dst->hash, dst);
+				g_ptr_array_add(entries, dst);
+			}
+
+			network_query_digest_entry_merge(dst, src);
+		}
+
+		if (evicted) network_query_digest_entry_merge(evicted, shard->evicted);
+		g_mutex_unlock(shard->mutex);
+	}
+
+	g_hash_table_destroy(merged);
+
+	return entries;
+}
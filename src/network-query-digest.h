@@ -0,0 +1,76 @@
+/* $%BEGINLICENSE%$
+ Copyright (c) 2008, 2012, Oracle and/or its affiliates. All rights reserved.
+
+ This program is free software; you can redistribute it and/or
+ modify it under the terms of the GNU General Public License as
+ published by the Free Software Foundation; version 2 of the
+ License.
+
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ GNU General Public License for more details.
+
+ You should have received a copy of the GNU General Public License
+ along with this program; if not, write to the Free Software
+ Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA
+ 02110-1301  USA
+
+ $%ENDLICENSE%$ */
+#ifndef __NETWORK_QUERY_DIGEST_H__
+#define __NETWORK_QUERY_DIGEST_H__
+
+#include <glib.h>
+
+#include "network-exports.h"
+
+/**
+ * the stats of a normalized query
+ */
+typedef struct {
+	guint64 hash;        /**< FNV-1a hash of the text, the key of the entry */
+	GString *text;       /**< the normalized query, see network_query_digest_fingerprint() */
+
+	guint64 count;
+	guint64 sum_usec;    /**< time from sending the query to the last packet of the result */
+	guint64 max_usec;
+	guint64 rows;        /**< rows of the result-sets */
+	guint64 bytes;       /**< bytes of the rows */
+	guint64 errors;      /**< ERR packets */
+	gint backend_ndx;    /**< backend of the last execution, -1 if it didn't need one */
+
+	GList link;          /**< our link in the LRU list of the shard */
+} network_query_digest_entry_t;
+
+/**
+ * the digests of one event-thread
+ *
+ * only its event-thread adds to it, the mutex is only contended while a reader merges the shards
+ */
+typedef struct {
+	GHashTable *entries;   /**< hash -> network_query_digest_entry_t */
+	GQueue lru;            /**< most recently used first */
+	GMutex *mutex;
+
+	network_query_digest_entry_t *evicted; /**< the sum of the entries that were dropped for the limit */
+} network_query_digest_shard_t;
+
+typedef struct {
+	GPtrArray *shards;      /**< a network_query_digest_shard_t per event-thread */
+	guint max_entries;      /**< per shard, 0 disables the digests */
+} network_query_digest_t;
+
+NETWORK_API network_query_digest_t *network_query_digest_new(void);
+NETWORK_API void network_query_digest_free(network_query_digest_t *digest);
+NETWORK_API void network_query_digest_set_limits(network_query_digest_t *digest, guint shards, guint max_entries);
+NETWORK_API gboolean network_query_digest_is_enabled(network_query_digest_t *digest);
+
+NETWORK_API int network_query_digest_fingerprint(GString *dst, guint64 *hash, const char *query, gsize query_len);
+
+NETWORK_API network_query_digest_entry_t *network_query_digest_entry_new(void);
+NETWORK_API void network_query_digest_entry_free(network_query_digest_entry_t *entry);
+NETWORK_API void network_query_digest_add(network_query_digest_t *digest, guint ndx, guint64 hash, const GString *text,
+		guint64 usec, guint64 rows, guint64 bytes, gboolean is_error, gint backend_ndx);
+NETWORK_API GPtrArray *network_query_digest_get_entries(network_query_digest_t *digest, network_query_digest_entry_t *evicted);
+
+#endif
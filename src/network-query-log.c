@@ -0,0 +1,362 @@
+/* $%BEGINLICENSE%$
+ Copyright (c) 2008, 2012, Oracle and/or its affiliates. All rights reserved.
+
+ This program is free software; you can redistribute it and/or
+ modify it under the terms of the GNU General Public License as
+ published by the Free Software Foundation; version 2 of the
+ License.
+
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ GNU General Public License for more details.
+
+ You should have received a copy of the GNU General Public License
+ along with this program; if not, write to the Free Software
+ Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA
+ 02110-1301  USA
+
+ $%ENDLICENSE%$ */
+/**
+ * the slow-query and audit log
+ *
+ * the event-threads filter the queries by time and sampling before they build an entry,
+ * the entries are queued for the writer-thread which formats them as JSON lines and
+ * writes them in batches.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#ifndef WIN32
+#include <unistd.h> /* write, close */
+#else
+#include <io.h>
+#endif
+
+#include <glib.h>
+
+#include "network-query-log.h"
+
+#define C(x) x, sizeof(x) - 1
+#define S(x) x->str, x->len
+
+GQuark network_query_log_error(void) {
+	return g_quark_from_static_string("network-query-log-error-quark");
+}
+
+network_query_log_entry_t *network_query_log_entry_new(void) {
+	network_query_log_entry_t *entry;
+
+	entry = g_new0(network_query_log_entry_t, 1);
+	entry->query = g_string_new(NULL);
+
+	return entry;
+}
+
+void network_query_log_entry_free(network_query_log_entry_t *entry) {
+	if (!entry) return;
+
+	if (entry->user) g_free(entry->user);
+	if (entry->db) g_free(entry->db);
+	if (entry->client) g_free(entry->client);
+	if (entry->backend) g_free(entry->backend);
+	g_string_free(entry->query, TRUE);
+
+	g_free(entry);
+}
+
+/**
+ * append a JSON string
+ *
+ * the bytes >= 0x80 are copied as they are, the queries are in the charset of the client
+ */
+static void network_query_log_append_json_string(GString *out, const gchar *s, gsize s_len) {
+	gsize i;
+
+	if (NULL == s) {
+		g_string_append_len(out, C("null"));
+		return;
+	}
+
+	g_string_append_c(out, '"');
+	for (i = 0; i < s_len; i++) {
+		guchar c = s[i];
+
+		switch (c) {
+		case '"':  g_string_append_len(out, C("\\\"")); break;
+		case '\\': g_string_append_len(out, C("\\\\")); break;
+		case '\n': g_string_append_len(out, C("\\n")); break;
+		case '\r': g_string_append_len(out, C("\\r")); break;
+		case '\t': g_string_append_len(out, C("\\t")); break;
+		default:
+			if (c < 0x20) {
+				g_string_append_printf(out, "\\u%04x", c);
+			} else {
+				g_string_append_c(out, c);
+			}
+			break;
+		}
+	}
+	g_string_append_c(out, '"');
+}
+
+/**
+ * format an entry as one line of JSON
+ *
+ * the times are in seconds
+ */
+void network_query_log_entry_to_json(GString *out, network_query_log_entry_t *entry) {
+	g_string_append_printf(out, "{\"ts\":%ld.%06ld,\"query_time\":%.6f,\"first_byte_time\":%.6f",
+			(long)entry->ts.tv_sec, (long)entry->ts.tv_usec,
+			entry->usec / 1000000.0,
+			entry->first_usec / 1000000.0);
+
+	g_string_append_len(out, C(",\"user\":"));
+	network_query_log_append_json_string(out, entry->user, entry->user ? strlen(entry->user) : 0);
+	g_string_append_len(out, C(",\"db\":"));
+	network_query_log_append_json_string(out, entry->db, entry->db ? strlen(entry->db) : 0);
+	g_string_append_len(out, C(",\"client\":"));
+	network_query_log_append_json_string(out, entry->client, entry->client ? strlen(entry->client) : 0);
+	g_string_append_len(out, C(",\"backend\":"));
+	network_query_log_append_json_string(out, entry->backend, entry->backend ? strlen(entry->backend) : 0);
+
+	g_string_append_printf(out, ",\"command\":%d,\"rows\":%"G_GUINT64_FORMAT",\"bytes\":%"G_GUINT64_FORMAT",\"status\":\"%s\",\"injected\":%s",
+			entry->command,
+			entry->rows,
+			entry->bytes,
+			entry->is_error ? "error" : "ok",
+			entry->is_injected ? "true" : "false");
+
+	g_string_append_len(out, C(",\"query\":"));
+	network_query_log_append_json_string(out, S(entry->query));
+
+	g_string_append_len(out, C("}\n"));
+}
+
+network_query_log_t *network_query_log_new(void) {
+	network_query_log_t *log;
+
+	log = g_new0(network_query_log_t, 1);
+	log->fd = -1;
+	log->sample = 1;
+	log->queue = g_queue_new();
+	log->mutex = g_mutex_new();
+	log->cond = g_cond_new();
+
+	return log;
+}
+
+/**
+ * write the buffer, retry on short writes
+ */
+static int network_query_log_write(network_query_log_t *log, GString *buf) {
+	gsize written = 0;
+
+	while (written < buf->len) {
+		gssize len = write(log->fd, buf->str + written, buf->len - written);
+
+		if (len < 0) {
+			if (errno == EINTR) continue;
+
+			return -1;
+		}
+
+		written += len;
+	}
+
+	return 0;
+}
+
+/**
+ * write batches of entries until we are shut down
+ */
+static gpointer network_query_log_writer_thread(gpointer user_data) {
+	network_query_log_t *log = user_data;
+	GQueue *batch = g_queue_new();
+	GString *buf = g_string_sized_new(64 * 1024);
+	gboolean is_write_failed = FALSE;
+
+	for (;;) {
+		network_query_log_entry_t *entry;
+		gboolean is_shutdown;
+		GQueue *q;
+
+		g_mutex_lock(log->mutex);
+		while (0 == log->queue->length && !g_atomic_int_get(&log->is_shutdown)) {
+			GTimeVal timeout;
+
+			g_get_current_time(&timeout);
+			g_time_val_add(&timeout, G_USEC_PER_SEC);
+
+			g_cond_timed_wait(log->cond, log->mutex, &timeout);
+		}
+		is_shutdown = g_atomic_int_get(&log->is_shutdown);
+
+		/* take all the entries and leave an empty queue for the producers */
+		q = log->queue;
+		log->queue = batch;
+		batch = q;
+		g_mutex_unlock(log->mutex);
+
+		g_string_truncate(buf, 0);
+		while ((entry = g_queue_pop_head(batch))) {
+			network_query_log_entry_to_json(buf, entry);
+			network_query_log_entry_free(entry);
+
+			g_atomic_int_inc(&log->written);
+		}
+
+		if (buf->len > 0 && 0 != network_query_log_write(log, buf)) {
+			/* don't flood the error-log, one message until a write works again */
+			if (!is_write_failed) {
+				g_critical("%s: writing to the query-log %s failed: %s (%d)",
+						G_STRLOC,
+						log->filename,
+						g_strerror(errno), errno);
+			}
+			is_write_failed = TRUE;
+		} else {
+			is_write_failed = FALSE;
+		}
+
+		if (is_shutdown) break;
+	}
+
+	g_queue_free(batch);
+	g_string_free(buf, TRUE);
+
+	return NULL;
+}
+
+/**
+ * open the log and start the writer-thread
+ *
+ * @return 0 on success, -1 on error
+ */
+int network_query_log_open(network_query_log_t *log, const gchar *filename, GError **gerr) {
+	GError *thread_gerr = NULL;
+
+	g_return_val_if_fail(-1 == log->fd, -1);
+
+	log->fd = open(filename, O_WRONLY | O_CREAT | O_APPEND, 0660);
+	if (-1 == log->fd) {
+		g_set_error(gerr, NETWORK_QUERY_LOG_ERROR, NETWORK_QUERY_LOG_ERROR_OPEN,
+				"opening %s failed: %s (%d)",
+				filename,
+				g_strerror(errno), errno);
+
+		return -1;
+	}
+	log->filename = g_strdup(filename);
+
+	log->is_shutdown = 0;
+	log->writer_thread = g_thread_create(network_query_log_writer_thread, log, TRUE, &thread_gerr);
+	if (NULL == log->writer_thread) {
+		g_set_error(gerr, NETWORK_QUERY_LOG_ERROR, NETWORK_QUERY_LOG_ERROR_THREAD,
+				"starting the writer of %s failed: %s",
+				filename,
+				thread_gerr->message);
+		g_error_free(thread_gerr);
+
+		close(log->fd);
+		log->fd = -1;
+
+		return -1;
+	}
+
+	return 0;
+}
+
+/**
+ * flush the queued entries and close the log
+ */
+void network_query_log_free(network_query_log_t *log) {
+	network_query_log_entry_t *entry;
+
+	if (!log) return;
+
+	if (log->writer_thread) {
+		g_mutex_lock(log->mutex);
+		g_atomic_int_set(&log->is_shutdown, 1);
+		g_cond_signal(log->cond);
+		g_mutex_unlock(log->mutex);
+
+		g_thread_join(log->writer_thread);
+	}
+
+	if (-1 != log->fd) close(log->fd);
+	if (log->filename) g_free(log->filename);
+
+	while ((entry = g_queue_pop_head(log->queue))) network_query_log_entry_free(entry);
+	g_queue_free(log->queue);
+	g_mutex_free(log->mutex);
+	g_cond_free(log->cond);
+
+	g_free(log);
+}
+
+/**
+ * only log the queries that took at least <min_usec>, and every <sample>th of them
+ */
+void network_query_log_set_filter(network_query_log_t *log, guint64 min_usec, guint sample) {
+	log->min_usec = min_usec;
+	log->sample = MAX(sample, 1);
+}
+
+gboolean network_query_log_is_open(network_query_log_t *log) {
+	return log != NULL && log->writer_thread != NULL;
+}
+
+/**
+ * check if a query that took <usec> should be logged
+ *
+ * call it before building the entry, most queries are filtered here
+ */
+gboolean network_query_log_wants(network_query_log_t *log, guint64 usec) {
+	if (!network_query_log_is_open(log)) return FALSE;
+
+	if (usec < log->min_usec) return FALSE;
+
+	if (log->sample > 1 &&
+	    0 != ((guint)g_atomic_int_exchange_and_add(&log->sample_counter, 1) % log->sample)) {
+		return FALSE;
+	}
+
+	return TRUE;
+}
+
+/**
+ * queue an entry for the writer
+ *
+ * takes the ownership of the entry
+ *
+ * @return FALSE if the queue was full and the entry got dropped
+ */
+gboolean network_query_log_push(network_query_log_t *log, network_query_log_entry_t *entry) {
+	guint len;
+
+	g_mutex_lock(log->mutex);
+	len = log->queue->length;
+	if (len < NETWORK_QUERY_LOG_MAX_QUEUED) {
+		g_queue_push_tail(log->queue, entry);
+		entry = NULL;
+
+		/* the writer wakes up every second anyway */
+		if (len + 1 == NETWORK_QUERY_LOG_BATCH) g_cond_signal(log->cond);
+	}
+	g_mutex_unlock(log->mutex);
+
+	if (NULL != entry) {
+		g_atomic_int_inc(&log->dropped);
+		network_query_log_entry_free(entry);
+
+		return FALSE;
+	}
+
+	return TRUE;
+}
@@ -0,0 +1,108 @@
+/* $%BEGINLICENSE%$
+ Copyright (c) 2008, 2012, Oracle and/or its affiliates. All rights reserved.
+
+ This program is free software; you can redistribute it and/or
+ modify it under the terms of the GNU General Public License as
+ published by the Free Software Foundation; version 2 of the
+ License.
+
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ GNU General Public License for more details.
+
+ You should have received a copy of the GNU General Public License
+ along with this program; if not, write to the Free Software
+ Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA
+ 02110-1301  USA
+
+ $%ENDLICENSE%$ */
+#ifndef __NETWORK_QUERY_LOG_H__
+#define __NETWORK_QUERY_LOG_H__
+
+#include <glib.h>
+
+#include "network-exports.h"
+
+/**
+ * entries that may wait for the writer, more are dropped
+ */
+#define NETWORK_QUERY_LOG_MAX_QUEUED 8192
+
+/**
+ * wake up the writer once that many entries are queued
+ */
+#define NETWORK_QUERY_LOG_BATCH 256
+
+/**
+ * queries are logged with at most that many bytes
+ */
+#define NETWORK_QUERY_LOG_MAX_QUERY_LEN 4096
+
+/**
+ * an executed query
+ */
+typedef struct {
+	GTimeVal ts;             /**< when the result was received */
+	guint64 usec;            /**< query sent until the last packet of the result */
+	guint64 first_usec;      /**< query sent until the first packet of the result */
+	guint64 rows;
+	guint64 bytes;
+	guint8 command;
+	gboolean is_error;       /**< the server sent an ERR packet */
+	gboolean is_injected;    /**< the query came from proxy.queries */
+
+	gchar *user;             /**< NULL if unknown */
+	gchar *db;
+	gchar *client;
+	gchar *backend;
+	GString *query;          /**< the query without the command-byte, truncated to NETWORK_QUERY_LOG_MAX_QUERY_LEN */
+} network_query_log_entry_t;
+
+/**
+ * a slow-query and audit log written as JSON lines by a thread of its own
+ *
+ * the event-threads only queue their entries. The writer takes all the entries of the
+ * queue at once and writes them with one write(), a slow disk only fills the queue and
+ * drops entries, it never blocks a client.
+ */
+typedef struct {
+	gchar *filename;
+	int fd;                          /**< -1 if not open */
+
+	guint64 min_usec;                /**< only log queries that took at least <usec> */
+	guint sample;                    /**< only log every <n>th of them, 1 to log all */
+	volatile gint sample_counter;
+
+	GQueue *queue;                   /**< network_query_log_entry_t waiting for the writer */
+	GMutex *mutex;                   /**< protects .queue */
+	GCond *cond;
+
+	GThread *writer_thread;
+	volatile gint is_shutdown;
+
+	volatile gint dropped;           /**< entries dropped as the queue was full */
+	volatile gint written;           /**< entries written to the file */
+} network_query_log_t;
+
+NETWORK_API network_query_log_t *network_query_log_new(void);
+NETWORK_API void network_query_log_free(network_query_log_t *log);
+NETWORK_API int network_query_log_open(network_query_log_t *log, const gchar *filename, GError **gerr);
+NETWORK_API void network_query_log_set_filter(network_query_log_t *log, guint64 min_usec, guint sample);
+NETWORK_API gboolean network_query_log_is_open(network_query_log_t *log);
+NETWORK_API gboolean network_query_log_wants(network_query_log_t *log, guint64 usec);
+NETWORK_API gboolean network_query_log_push(network_query_log_t *log, network_query_log_entry_t *entry);
+
+NETWORK_API network_query_log_entry_t *network_query_log_entry_new(void);
+NETWORK_API void network_query_log_entry_free(network_query_log_entry_t *entry);
+NETWORK_API void network_query_log_entry_to_json(GString *out, network_query_log_entry_t *entry);
+
+#define NETWORK_QUERY_LOG_ERROR network_query_log_error()
+NETWORK_API GQuark network_query_log_error(void);
+
+typedef enum {
+	NETWORK_QUERY_LOG_ERROR_OPEN,   /**< the file couldn't be opened */
+	NETWORK_QUERY_LOG_ERROR_THREAD  /**< the writer-thread couldn't be started */
+} network_query_log_error_t;
+
+#endif
@@ -0,0 +1,363 @@
+/* $%BEGINLICENSE%$
+ Copyright (c) 2008, 2012, Oracle and/or its affiliates. All rights reserved.
+
+ This program is free software; you can redistribute it and/or
+ modify it under the terms of the GNU General Public License as
+ published by the Free Software Foundation; version 2 of the
+ License.
+
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ GNU General Public License for more details.
+
+ You should have received a copy of the GNU General Public License
+ along with this program; if not, write to the Free Software
+ Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA
+ 02110-1301  USA
+
+ $%ENDLICENSE%$ */
+/** @file
+ * the routing rules of --proxy-query-rules-file
+ *
+ * the file is a keyfile with a group per rule. A rule matches on the user and the default
+ * db of the client, the command and the class of the statement, and gives the queries it
+ * matches the same hints as a /\*proxy: ... *\/ comment:
+ *
+ *   [reports]
+ *   user = report
+ *   class = select
+ *   hints = ro, group=analytics, cache_ttl=30s, timeout=10s
+ *
+ *   [batch]
+ *   user = batch
+ *   db = orders
+ *   command = query
+ *   hints = timeout=300s
+ *
+ * a missing field matches all queries, the first rule in the file that matches decides.
+ * The commands are those of network_mysqld_command_get_name() ("query", "init_db",
+ * "stmt_execute", ...), the classes those of network_mysqld_proto_get_query_class(). The hints of the
+ * comment of a query override those of the rule.
+ */
+
+#include <string.h>
+
+#include "network-query-rules.h"
+
+GQuark network_query_rules_error(void) {
+	return g_quark_from_static_string("network-query-rules-error-quark");
+}
+
+network_query_rule_t *network_query_rule_new(void) {
+	network_query_rule_t *rule;
+
+	rule = g_new0(network_query_rule_t, 1);
+	rule->command = NETWORK_QUERY_RULE_ANY;
+	rule->query_class = NETWORK_QUERY_RULE_ANY;
+	rule->hints = network_mysqld_query_hints_new();
+
+	return rule;
+}
+
+void network_query_rule_free(network_query_rule_t *rule) {
+	if (!rule) return;
+
+	if (rule->name) g_free(rule->name);
+	if (rule->user) g_free(rule->user);
+	if (rule->db) g_free(rule->db);
+	network_mysqld_query_hints_free(rule->hints);
+
+	g_free(rule);
+}
+
+/**
+ * set the hints of the rule the query doesn't have already
+ */
+void network_query_rule_apply(network_query_rule_t *rule, network_mysqld_query_hints_t *hints) {
+	network_mysqld_query_hints_t *rule_hints = rule->hints;
+
+	if (hints->route == NETWORK_MYSQLD_QUERY_HINT_ROUTE_DEFAULT) hints->route = rule_hints->route;
+	if (hints->group->len == 0) g_string_assign(hints->group, rule_hints->group->str);
+	if (hints->cache_ttl_ms == -1) hints->cache_ttl_ms = rule_hints->cache_ttl_ms;
+	if (hints->timeout_ms == 0) hints->timeout_ms = rule_hints->timeout_ms;
+}
+
+static gboolean network_query_rule_has_hints(network_query_rule_t *rule) {
+	network_mysqld_query_hints_t *hints = rule->hints;
+
+	return hints->route != NETWORK_MYSQLD_QUERY_HINT_ROUTE_DEFAULT ||
+		hints->group->len > 0 ||
+		hints->cache_ttl_ms != -1 ||
+		hints->timeout_ms != 0;
+}
+
+/**
+ * the fields of a rule that are set, a combination of the NETWORK_QUERY_RULE_MASK_*
+ */
+static guint network_query_rule_get_mask(network_query_rule_t *rule) {
+	guint mask = 0;
+
+	if (rule->user) mask |= NETWORK_QUERY_RULE_MASK_USER;
+	if (rule->db) mask |= NETWORK_QUERY_RULE_MASK_DB;
+	if (rule->command != NETWORK_QUERY_RULE_ANY) mask |= NETWORK_QUERY_RULE_MASK_COMMAND;
+	if (rule->query_class != NETWORK_QUERY_RULE_ANY) mask |= NETWORK_QUERY_RULE_MASK_CLASS;
+
+	return mask;
+}
+
+/**
+ * hash the fields a rule matches on
+ */
+static guint network_query_rule_hash(gconstpointer _rule) {
+	const network_query_rule_t *rule = _rule;
+	guint h;
+
+	h = rule->user ? g_str_hash(rule->user) : 0;
+	h = h * 31 + (rule->db ? g_str_hash(rule->db) : 0);
+	h = h * 31 + (guint)(rule->command + 1);
+	h = h * 31 + (guint)(rule->query_class + 1);
+
+	return h;
+}
+
+static gboolean network_query_rule_equal(gconstpointer _a, gconstpointer _b) {
+	const network_query_rule_t *a = _a;
+	const network_query_rule_t *b = _b;
+
+	return a->command == b->command &&
+		a->query_class == b->query_class &&
+		0 == g_strcmp0(a->user, b->user) &&
+		0 == g_strcmp0(a->db, b->db);
+}
+
+network_query_ruleset_t *network_query_ruleset_new(void) {
+	network_query_ruleset_t *ruleset;
+
+	ruleset = g_new0(network_query_ruleset_t, 1);
+	ruleset->rules = g_ptr_array_new();
+	ruleset->index = g_hash_table_new(network_query_rule_hash, network_query_rule_equal);
+
+	return ruleset;
+}
+
+void network_query_ruleset_free(network_query_ruleset_t *ruleset) {
+	guint i;
+
+	if (!ruleset) return;
+
+	for (i = 0; i < ruleset->rules->len; i++) {
+		network_query_rule_free(ruleset->rules->pdata[i]);
+	}
+	g_ptr_array_free(ruleset->rules, TRUE);
+	g_hash_table_destroy(ruleset->index);
+
+	g_free(ruleset);
+}
+
+/**
+ * append a rule and index it
+ *
+ * the ruleset takes the ownership of the rule. A rule with the same fields as an earlier
+ * one never matches, the earlier one decides.
+ */
+void network_query_ruleset_add(network_query_ruleset_t *ruleset, network_query_rule_t *rule) {
+	rule->ndx = ruleset->rules->len;
+	g_ptr_array_add(ruleset->rules, rule);
+
+	if (NULL == g_hash_table_lookup(ruleset->index, rule)) {
+		g_hash_table_insert(ruleset->index, rule, rule);
+	}
+
+	ruleset->masks |= 1 << network_query_rule_get_mask(rule);
+}
+
+/**
+ * set a <key> = <value> of a rule
+ *
+ * @return 0 on success, -1 if the key is unknown or the value doesn't parse
+ */
+static int network_query_rule_set(network_query_rule_t *rule, const gchar *key, const gchar *value) {
+	if (0 == strcmp(key, "user")) {
+		if (rule->user) g_free(rule->user);
+		rule->user = g_strdup(value);
+	} else if (0 == strcmp(key, "db")) {
+		if (rule->db) g_free(rule->db);
+		rule->db = g_strdup(value);
+	} else if (0 == strcmp(key, "command")) {
+		if (-1 == (rule->command = network_mysqld_command_from_name(value))) return -1;
+	} else if (0 == strcmp(key, "class")) {
+		if (-1 == (rule->query_class = network_mysqld_query_class_from_name(value))) return -1;
+	} else if (0 == strcmp(key, "hints")) {
+		network_mysqld_query_hints_parse(rule->hints, value, strlen(value));
+	} else {
+		return -1;
+	}
+
+	return 0;
+}
+
+/**
+ * add the rules of a keyfile
+ *
+ * @return 0 on success, -1 on error
+ */
+int network_query_ruleset_load(network_query_ruleset_t *ruleset, const gchar *filename, GError **gerr) {
+	GKeyFile *keyfile = g_key_file_new();
+	GError *read_gerr = NULL;
+	gchar **groups;
+	int ret = 0;
+	guint i;
+
+	if (!g_key_file_load_from_file(keyfile, filename, G_KEY_FILE_NONE, &read_gerr)) {
+		g_set_error(gerr, NETWORK_QUERY_RULES_ERROR, NETWORK_QUERY_RULES_ERROR_READ,
+				"reading %s failed: %s",
+				filename,
+				read_gerr->message);
+		g_error_free(read_gerr);
+		g_key_file_free(keyfile);
+
+		return -1;
+	}
+
+	groups = g_key_file_get_groups(keyfile, NULL);
+	for (i = 0; groups[i] && ret == 0; i++) {
+		network_query_rule_t *rule = network_query_rule_new();
+		gchar **keys = g_key_file_get_keys(keyfile, groups[i], NULL, NULL);
+		guint j;
+
+		rule->name = g_strdup(groups[i]);
+
+		for (j = 0; keys && keys[j] && ret == 0; j++) {
+			gchar *value = g_key_file_get_string(keyfile, groups[i], keys[j], NULL);
+
+			if (NULL == value || '\0' == *g_strstrip(value) || 0 != network_query_rule_set(rule, keys[j], value)) {
+				g_set_error(gerr, NETWORK_QUERY_RULES_ERROR, NETWORK_QUERY_RULES_ERROR_PARSE,
+						"%s: [%s] %s = %s: expected user, db, command, class or hints with a valid value",
+						filename, groups[i], keys[j], value ? value : "");
+				ret = -1;
+			}
+
+			if (value) g_free(value);
+		}
+		g_strfreev(keys);
+
+		if (ret == 0 && !network_query_rule_has_hints(rule)) {
+			g_set_error(gerr, NETWORK_QUERY_RULES_ERROR, NETWORK_QUERY_RULES_ERROR_PARSE,
+					"%s: [%s] has no hints, expected hints = ro|rw, group=<name>, cache_ttl=<duration>, nocache or timeout=<duration>",
+					filename, groups[i]);
+			ret = -1;
+		}
+
+		if (ret == 0) {
+			network_query_ruleset_add(ruleset, rule);
+		} else {
+			network_query_rule_free(rule);
+		}
+	}
+	g_strfreev(groups);
+	g_key_file_free(keyfile);
+
+	return ret;
+}
+
+/**
+ * find the first rule that matches a query
+ *
+ * @param user        the user of the client, NULL if not known
+ * @param db          the default db of the client, NULL if none
+ * @param query_class the network_mysqld_query_class_t of a COM_QUERY, NETWORK_QUERY_RULE_ANY for the other commands
+ * @return the rule, NULL if none matches
+ */
+network_query_rule_t *network_query_ruleset_match(network_query_ruleset_t *ruleset,
+		const char *user, const char *db, guint8 command, gint query_class) {
+	network_query_rule_t *match = NULL;
+	network_query_rule_t key;
+	guint mask;
+
+	for (mask = 0; mask < NETWORK_QUERY_RULE_MASKS; mask++) {
+		network_query_rule_t *rule;
+
+		if (!(ruleset->masks & (1 << mask))) continue;
+
+		/* the query doesn't have the field the rules of the mask need */
+		if ((mask & NETWORK_QUERY_RULE_MASK_USER) && NULL == user) continue;
+		if ((mask & NETWORK_QUERY_RULE_MASK_DB) && NULL == db) continue;
+		if ((mask & NETWORK_QUERY_RULE_MASK_CLASS) && NETWORK_QUERY_RULE_ANY == query_class) continue;
+
+		key.user = (mask & NETWORK_QUERY_RULE_MASK_USER) ? (gchar *)user : NULL;
+		key.db = (mask & NETWORK_QUERY_RULE_MASK_DB) ? (gchar *)db : NULL;
+		key.command = (mask & NETWORK_QUERY_RULE_MASK_COMMAND) ? command : NETWORK_QUERY_RULE_ANY;
+		key.query_class = (mask & NETWORK_QUERY_RULE_MASK_CLASS) ? query_class : NETWORK_QUERY_RULE_ANY;
+
+		rule = g_hash_table_lookup(ruleset->index, &key);
+
+		if (rule && (NULL == match || rule->ndx < match->ndx)) match = rule;
+	}
+
+	return match;
+}
+
+network_query_rules_t *network_query_rules_new(void) {
+	network_query_rules_t *rules;
+
+	rules = g_new0(network_query_rules_t, 1);
+	rules->mutex = g_mutex_new();
+	rules->retired = g_ptr_array_new();
+
+	return rules;
+}
+
+void network_query_rules_free(network_query_rules_t *rules) {
+	guint i;
+
+	if (!rules) return;
+
+	for (i = 0; i < rules->retired->len; i++) {
+		network_query_ruleset_free(rules->retired->pdata[i]);
+	}
+	g_ptr_array_free(rules->retired, TRUE);
+
+	network_query_ruleset_free(rules->ruleset);
+	g_mutex_free(rules->mutex);
+
+	g_free(rules);
+}
+
+/**
+ * load the rules of a file and make them the current ones
+ *
+ * if the file has errors the current rules stay
+ *
+ * @return 0 on success, -1 on error
+ */
+int network_query_rules_load(network_query_rules_t *rules, const gchar *filename, GError **gerr) {
+	network_query_ruleset_t *ruleset = network_query_ruleset_new();
+	network_query_ruleset_t *old_ruleset;
+
+	if (0 != network_query_ruleset_load(ruleset, filename, gerr)) {
+		network_query_ruleset_free(ruleset);
+
+		return -1;
+	}
+
+	g_mutex_lock(rules->mutex);
+	old_ruleset = rules->ruleset;
+
+	g_atomic_pointer_set((gpointer *)&rules->ruleset, ruleset);
+
+	/* the event-threads may still match against the old ones */
+	if (old_ruleset) g_ptr_array_add(rules->retired, old_ruleset);
+	g_mutex_unlock(rules->mutex);
+
+	return 0;
+}
+
+/**
+ * get the current rules without locking
+ *
+ * @return the rules, they stay valid until the rules are freed. NULL if none were loaded
+ */
+network_query_ruleset_t *network_query_rules_get(network_query_rules_t *rules) {
+	return g_atomic_pointer_get((gpointer *)&rules->ruleset);
+}
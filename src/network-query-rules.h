@@ -0,0 +1,110 @@
+/* $%BEGINLICENSE%$
+ Copyright (c) 2008, 2012, Oracle and/or its affiliates. All rights reserved.
+
+ This program is free software; you can redistribute it and/or
+ modify it under the terms of the GNU General Public License as
+ published by the Free Software Foundation; version 2 of the
+ License.
+
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ GNU General Public License for more details.
+
+ You should have received a copy of the GNU General Public License
+ along with this program; if not, write to the Free Software
+ Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA
+ 02110-1301  USA
+
+ $%ENDLICENSE%$ */
+#ifndef __NETWORK_QUERY_RULES_H__
+#define __NETWORK_QUERY_RULES_H__
+
+#include <glib.h>
+
+#include "network-mysqld-packet.h"
+
+#include "network-exports.h"
+
+#define NETWORK_QUERY_RULE_ANY -1  /**< the .command or .query_class of a rule that matches all */
+
+/**
+ * a rule of a --proxy-query-rules-file
+ *
+ * the queries that match all of its fields get its hints
+ */
+typedef struct {
+	gchar *name;                       /**< the group of the rule in the file */
+
+	gchar *user;                       /**< the user of the client, NULL for any */
+	gchar *db;                         /**< the default db of the client, NULL for any */
+	gint command;                      /**< the command-byte, NETWORK_QUERY_RULE_ANY for any */
+	gint query_class;                  /**< the network_mysqld_query_class_t of a COM_QUERY, NETWORK_QUERY_RULE_ANY for any */
+
+	network_mysqld_query_hints_t *hints; /**< applied to the query, see network_query_rule_apply() */
+
+	guint ndx;                         /**< the position in the file, the first rule that matches decides */
+} network_query_rule_t;
+
+NETWORK_API network_query_rule_t *network_query_rule_new(void);
+NETWORK_API void network_query_rule_free(network_query_rule_t *rule);
+NETWORK_API void network_query_rule_apply(network_query_rule_t *rule, network_mysqld_query_hints_t *hints);
+
+/**
+ * the rules of a file, compiled into a decision table
+ *
+ * the rules are indexed by the fields they match on: each combination of the fields
+ * that are set (user, db, command, class) is a hash-table lookup. A query costs at
+ * most one lookup per combination the file uses, however many rules there are, and the
+ * rule with the lowest position of all lookups decides.
+ *
+ * the rules are only read after they are compiled, the event-threads share them without
+ * a lock.
+ */
+typedef struct {
+	GPtrArray *rules;                  /**< network_query_rule_t in the order of the file */
+
+	GHashTable *index;                 /**< network_query_rule_t -> the first rule with the same fields, see network_query_rule_hash() */
+	guint masks;                       /**< bit n is set if a rule sets the fields of mask n, see NETWORK_QUERY_RULE_MASK_USER */
+} network_query_ruleset_t;
+
+#define NETWORK_QUERY_RULE_MASK_USER    (1 << 0)
+#define NETWORK_QUERY_RULE_MASK_DB      (1 << 1)
+#define NETWORK_QUERY_RULE_MASK_COMMAND (1 << 2)
+#define NETWORK_QUERY_RULE_MASK_CLASS   (1 << 3)
+#define NETWORK_QUERY_RULE_MASKS        (1 << 4)
+
+NETWORK_API network_query_ruleset_t *network_query_ruleset_new(void);
+NETWORK_API void network_query_ruleset_free(network_query_ruleset_t *ruleset);
+NETWORK_API void network_query_ruleset_add(network_query_ruleset_t *ruleset, network_query_rule_t *rule);
+NETWORK_API int network_query_ruleset_load(network_query_ruleset_t *ruleset, const gchar *filename, GError **gerr);
+NETWORK_API network_query_rule_t *network_query_ruleset_match(network_query_ruleset_t *ruleset,
+		const char *user, const char *db, guint8 command, gint query_class);
+
+/**
+ * the current rules of --proxy-query-rules-file, replaced by a reload
+ *
+ * readers don't lock, like the shard router: writers take .mutex, publish the new rules
+ * and retire the old ones. As readers may still use retired rules, those are only freed
+ * in network_query_rules_free().
+ */
+typedef struct {
+	network_query_ruleset_t *ruleset; /**< the current rules, get them with network_query_rules_get() */
+	GMutex *mutex;                     /**< serializes the writers */
+	GPtrArray *retired;                /**< the rules that got replaced */
+} network_query_rules_t;
+
+NETWORK_API network_query_rules_t *network_query_rules_new(void);
+NETWORK_API void network_query_rules_free(network_query_rules_t *rules);
+NETWORK_API int network_query_rules_load(network_query_rules_t *rules, const gchar *filename, GError **gerr);
+NETWORK_API network_query_ruleset_t *network_query_rules_get(network_query_rules_t *rules);
+
+#define NETWORK_QUERY_RULES_ERROR network_query_rules_error()
+NETWORK_API GQuark network_query_rules_error(void);
+
+typedef enum {
+	NETWORK_QUERY_RULES_ERROR_READ,    /**< the file couldn't be read */
+	NETWORK_QUERY_RULES_ERROR_PARSE    /**< a rule doesn't parse */
+} network_query_rules_error_t;
+
+#endif
@@ -0,0 +1,154 @@
+/* $%BEGINLICENSE%$
+ Copyright (c) 2008, 2012, Oracle and/or its affiliates. All rights reserved.
+
+ This program is free software; you can redistribute it and/or
+ modify it under the terms of the GNU General Public License as
+ published by the Free Software Foundation; version 2 of the
+ License.
+
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ GNU General Public License for more details.
+
+ You should have received a copy of the GNU General Public License
+ along with this program; if not, write to the Free Software
+ Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA
+ 02110-1301  USA
+
+ $%ENDLICENSE%$ */
+
+/** @file
+ * the execution budgets of the queries for --proxy-query-timeout-file
+ *
+ * the file has a budget in seconds and a query per line, separated by whitespace:
+ *
+ *   0.5    SELECT * FROM orders WHERE customer_id = 1
+ *
+ * the literals of the query don't matter, it stands for all queries with its fingerprint.
+ * Empty lines and lines starting with a # are ignored.
+ */
+
+#include <string.h>
+
+#include "network-query-digest.h"
+#include "network-query-timeout.h"
+
+static guint network_query_timeouts_hash_func(gconstpointer key) {
+	guint64 h = *(const guint64 *)key;
+
+	return (guint)(h ^ (h >> 32));
+}
+
+static gboolean network_query_timeouts_equal_func(gconstpointer a, gconstpointer b) {
+	return *(const guint64 *)a == *(const guint64 *)b;
+}
+
+GQuark network_query_timeouts_error(void) {
+	return g_quark_from_static_string("network-query-timeouts-error-quark");
+}
+
+network_query_timeouts_t *network_query_timeouts_new(void) {
+	network_query_timeouts_t *timeouts;
+
+	timeouts = g_new0(network_query_timeouts_t, 1);
+	timeouts->budgets = g_hash_table_new_full(network_query_timeouts_hash_func, network_query_timeouts_equal_func, g_free, g_free);
+
+	return timeouts;
+}
+
+void network_query_timeouts_free(network_query_timeouts_t *timeouts) {
+	if (!timeouts) return;
+
+	g_hash_table_destroy(timeouts->budgets);
+
+	g_free(timeouts);
+}
+
+/**
+ * set the budget of the queries with the fingerprint of a query
+ */
+void network_query_timeouts_set(network_query_timeouts_t *timeouts, const char *query, gsize query_len, guint64 budget_ms) {
+	GString *fingerprint = g_string_new(NULL);
+	guint64 *hash = g_new(guint64, 1);
+	guint64 *budget = g_new(guint64, 1);
+
+	network_query_digest_fingerprint(fingerprint, hash, query, query_len);
+	*budget = budget_ms;
+
+	g_hash_table_insert(timeouts->budgets, hash, budget);
+
+	g_string_free(fingerprint, TRUE);
+}
+
+/**
+ * add the budgets of a file
+ *
+ * @return 0 on success, -1 on error
+ */
+int network_query_timeouts_load(network_query_timeouts_t *timeouts, const gchar *filename, GError **gerr) {
+	GError *read_gerr = NULL;
+	gchar *contents;
+	gchar **lines;
+	int ret = 0;
+	guint i;
+
+	if (!g_file_get_contents(filename, &contents, NULL, &read_gerr)) {
+		g_set_error(gerr, NETWORK_QUERY_TIMEOUTS_ERROR, NETWORK_QUERY_TIMEOUTS_ERROR_READ,
+				"reading %s failed: %s",
+				filename,
+				read_gerr->message);
+		g_error_free(read_gerr);
+
+		return -1;
+	}
+
+	lines = g_strsplit(contents, "\n", -1);
+	for (i = 0; lines[i] && ret == 0; i++) {
+		gchar *line = g_strstrip(lines[i]);
+		gchar *query = NULL;
+		gdouble budget_secs;
+
+		if (line[0] == '\0' || line[0] == '#') continue;
+
+		budget_secs = g_ascii_strtod(line, &query);
+
+		if (query == line ||
+		    budget_secs <= 0 ||
+		    !g_ascii_isspace(*query) ||
+		    *(query = g_strchug(query)) == '\0') {
+			g_set_error(gerr, NETWORK_QUERY_TIMEOUTS_ERROR, NETWORK_QUERY_TIMEOUTS_ERROR_PARSE,
+					"%s:%u: expected a budget in seconds and a query",
+					filename, i + 1);
+
+			ret = -1;
+			continue;
+		}
+
+		network_query_timeouts_set(timeouts, query, strlen(query), MAX(1, (guint64)(budget_secs * 1000.0 + 0.5)));
+	}
+	g_strfreev(lines);
+	g_free(contents);
+
+	return ret;
+}
+
+gboolean network_query_timeouts_is_empty(network_query_timeouts_t *timeouts) {
+	return 0 == g_hash_table_size(timeouts->budgets);
+}
+
+/**
+ * get the budget of a query
+ *
+ * @param hash the fingerprint hash of the query, see network_query_digest_fingerprint()
+ * @return FALSE if the fingerprint has no budget of its own
+ */
+gboolean network_query_timeouts_get(network_query_timeouts_t *timeouts, guint64 hash, guint64 *budget_ms) {
+	guint64 *budget;
+
+	if (NULL == (budget = g_hash_table_lookup(timeouts->budgets, &hash))) return FALSE;
+
+	*budget_ms = *budget;
+
+	return TRUE;
+}
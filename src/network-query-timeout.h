@@ -0,0 +1,54 @@
+/* $%BEGINLICENSE%$
+ Copyright (c) 2008, 2012, Oracle and/or its affiliates. All rights reserved.
+
+ This program is free software; you can redistribute it and/or
+ modify it under the terms of the GNU General Public License as
+ published by the Free Software Foundation; version 2 of the
+ License.
+
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ GNU General Public License for more details.
+
+ You should have received a copy of the GNU General Public License
+ along with this program; if not, write to the Free Software
+ Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA
+ 02110-1301  USA
+
+ $%ENDLICENSE%$ */
+#ifndef __NETWORK_QUERY_TIMEOUT_H__
+#define __NETWORK_QUERY_TIMEOUT_H__
+
+#include <glib.h>
+
+#include "network-exports.h"
+
+/**
+ * the execution budgets of the queries by their fingerprint
+ *
+ * the queries of the file are normalized by network_query_digest_fingerprint(), all
+ * queries with the same fingerprint share the budget. The budgets are only read after
+ * the load, the event-threads share them without a lock.
+ */
+typedef struct {
+	GHashTable *budgets;               /**< fingerprint hash -> budget in milliseconds, both guint64 * */
+} network_query_timeouts_t;
+
+NETWORK_API network_query_timeouts_t *network_query_timeouts_new(void);
+NETWORK_API void network_query_timeouts_free(network_query_timeouts_t *timeouts);
+
+NETWORK_API void network_query_timeouts_set(network_query_timeouts_t *timeouts, const char *query, gsize query_len, guint64 budget_ms);
+NETWORK_API int network_query_timeouts_load(network_query_timeouts_t *timeouts, const gchar *filename, GError **gerr);
+NETWORK_API gboolean network_query_timeouts_is_empty(network_query_timeouts_t *timeouts);
+NETWORK_API gboolean network_query_timeouts_get(network_query_timeouts_t *timeouts, guint64 hash, guint64 *budget_ms);
+
+#define NETWORK_QUERY_TIMEOUTS_ERROR network_query_timeouts_error()
+NETWORK_API GQuark network_query_timeouts_error(void);
+
+typedef enum {
+	NETWORK_QUERY_TIMEOUTS_ERROR_READ,  /**< the file couldn't be read */
+	NETWORK_QUERY_TIMEOUTS_ERROR_PARSE  /**< a line isn't a budget and a query */
+} network_query_timeouts_error_t;
+
+#endif
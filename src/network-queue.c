@@ -24,6 +24,8 @@
 #endif
 
 #include "network-queue.h"
+#include "network-buffer-pool.h"
+#include "network-object-pool.h"
 
 #ifndef DISABLE_DEPRECATED_DECL
 network_queue *network_queue_init() {
@@ -31,9 +33,24 @@ network_queue *network_queue_init() {
 }
 #endif
 
+/**
+ * each connection has 3 queues per socket
+ */
+#define NETWORK_QUEUE_POOL_MAX_IDLE 256
+
+static void network_queue_destroy(network_queue *queue) {
+	g_queue_free(queue->chunks);
+
+	g_free(queue);
+}
+
+static network_object_pool_t queue_pool = NETWORK_OBJECT_POOL_INIT(NETWORK_QUEUE_POOL_MAX_IDLE, network_queue_destroy);
+
 network_queue *network_queue_new() {
 	network_queue *queue;
 
+	if (NULL != (queue = network_object_pool_get(&queue_pool))) return queue;
+
 	queue = g_new0(network_queue, 1);
 
 	queue->chunks = g_queue_new();
@@ -41,16 +58,26 @@ network_queue *network_queue_new() {
 	return queue;
 }
 
-void network_queue_free(network_queue *queue) {
+/**
+ * drop the chunks of the queue
+ */
+void network_queue_reset(network_queue *queue) {
 	GString *packet;
 
+	while ((packet = g_queue_pop_head(queue->chunks))) network_buffer_pool_put(packet);
+
+	queue->len = 0;
+	queue->offset = 0;
+}
+
+void network_queue_free(network_queue *queue) {
 	if (!queue) return;
 
-	while ((packet = g_queue_pop_head(queue->chunks))) g_string_free(packet, TRUE);
+	network_queue_reset(queue);
 
-	g_queue_free(queue->chunks);
+	if (network_object_pool_put(&queue_pool, queue)) return;
 
-	g_free(queue);
+	network_queue_destroy(queue);
 }
 
 int network_queue_append(network_queue *queue, GString *s) {
@@ -108,6 +135,25 @@ GString *network_queue_peek_string(network_queue *queue, gsize peek_len, GString
 	return dest;
 }
 
+/**
+ * get a pointer to the first bytes of the queue without copying them
+ *
+ * @param  queue    the queue to read from
+ * @param  peek_len bytes we want to look at
+ * @return NULL if not enough data or the data spans chunks, a pointer into the first chunk otherwise 
+ */
+const gchar *network_queue_peek_str(network_queue *queue, gsize peek_len) {
+	GString *chunk;
+
+	if (queue->len < peek_len) return NULL;
+
+	if (NULL == (chunk = g_queue_peek_head(queue->chunks))) return NULL;
+
+	if (chunk->len - queue->offset < peek_len) return NULL;
+
+	return chunk->str + queue->offset;
+}
+
 /**
  * get a string from the head of the queue and remove the chunks from the queue 
  */
@@ -144,8 +190,8 @@ GString *network_queue_pop_string(network_queue *queue, gsize steal_len, GString
 		we_want -= we_have;
 
 		if (chunk->len == queue->offset) {
-			/* the chunk is done, remove it */
-			g_string_free(g_queue_pop_head(queue->chunks), TRUE);
+			/* the chunk is done, remove it and give the buffer back to the pool */
+			network_buffer_pool_put(g_queue_pop_head(queue->chunks));
 			queue->offset = 0;
 		} else {
 			break;
@@ -155,4 +201,71 @@ GString *network_queue_pop_string(network_queue *queue, gsize steal_len, GString
 	return dest;
 }
 
+/**
+ * remove the first bytes of the queue without copying them
+ *
+ * the chunks that are fully consumed go back into the buffer-pool
+ *
+ * @param  queue the queue to advance
+ * @param  len   bytes to remove, at most queue->len
+ */
+void network_queue_advance(network_queue *queue, gsize len) {
+	GString *chunk;
+
+	queue->offset += len;
+	queue->len    -= len;
+
+	while ((chunk = g_queue_peek_head(queue->chunks)) && queue->offset >= chunk->len) {
+		queue->offset -= chunk->len;
+
+		network_buffer_pool_put(g_queue_pop_head(queue->chunks));
+	}
+}
+
+#ifndef _WIN32
+/**
+ * point a iovec at each of the first chunks of the queue
+ *
+ * the first iovec starts at the offset of the queue. Send them with writev() and
+ * network_queue_advance() the queue by the bytes that were written.
+ *
+ * @param  queue   the queue to send
+ * @param  iov     the iovecs to fill
+ * @param  max_iov the size of iov
+ * @return the number of iovecs that were filled
+ */
+guint network_queue_get_iovec(network_queue *queue, struct iovec *iov, guint max_iov) {
+	GList *node;
+	guint n;
+
+	for (node = queue->chunks->head, n = 0; node && n < max_iov; node = node->next, n++) {
+		GString *chunk = node->data;
+		gsize offset = (n == 0) ? queue->offset : 0;
 
+		iov[n].iov_base = chunk->str + offset;
+		iov[n].iov_len  = chunk->len - offset;
+	}
+
+	return n;
+}
+#endif
+
+/**
+ * get the bytes allocated by the queue and its chunks
+ */
+gsize network_queue_get_memory(network_queue *queue) {
+	gsize bytes;
+	GList *node;
+
+	if (!queue) return 0;
+
+	bytes = sizeof(*queue) + sizeof(*queue->chunks);
+
+	for (node = queue->chunks->head; node; node = node->next) {
+		GString *chunk = node->data;
+
+		bytes += sizeof(GList) + sizeof(*chunk) + chunk->allocated_len;
+	}
+
+	return bytes;
+}
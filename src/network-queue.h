@@ -26,6 +26,10 @@
 
 #include <glib.h>
 
+#ifndef _WIN32
+#include <sys/uio.h> /* struct iovec */
+#endif
+
 /* a input or output stream */
 typedef struct {
 	GQueue *chunks;
@@ -37,8 +41,15 @@ typedef struct {
 NETWORK_API network_queue *network_queue_init(void) G_GNUC_DEPRECATED;
 NETWORK_API network_queue *network_queue_new(void);
 NETWORK_API void network_queue_free(network_queue *queue);
+NETWORK_API void network_queue_reset(network_queue *queue);
 NETWORK_API int network_queue_append(network_queue *queue, GString *chunk);
 NETWORK_API GString *network_queue_pop_string(network_queue *queue, gsize steal_len, GString *dest);
 NETWORK_API GString *network_queue_peek_string(network_queue *queue, gsize peek_len, GString *dest);
+NETWORK_API const gchar *network_queue_peek_str(network_queue *queue, gsize peek_len);
+NETWORK_API gsize network_queue_get_memory(network_queue *queue);
+NETWORK_API void network_queue_advance(network_queue *queue, gsize len);
+#ifndef _WIN32
+NETWORK_API guint network_queue_get_iovec(network_queue *queue, struct iovec *iov, guint max_iov);
+#endif
 
 #endif
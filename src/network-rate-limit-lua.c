@@ -0,0 +1,151 @@
+/* $%BEGINLICENSE%$
+ Copyright (c) 2008, 2012, Oracle and/or its affiliates. All rights reserved.
+
+ This program is free software; you can redistribute it and/or
+ modify it under the terms of the GNU General Public License as
+ published by the Free Software Foundation; version 2 of the
+ License.
+
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ GNU General Public License for more details.
+
+ You should have received a copy of the GNU General Public License
+ along with this program; if not, write to the Free Software
+ Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA
+ 02110-1301  USA
+
+ $%ENDLICENSE%$ */
+#include <lua.h>
+#include <lauxlib.h>
+
+#include "lua-env.h"
+#include "glib-ext.h"
+
+#include "network-rate-limit.h"
+#include "network-rate-limit-lua.h"
+
+static network_rate_limit_key_t proxy_rate_limits_check_key(lua_State *L, int idx) {
+	const char *name = luaL_checkstring(L, idx);
+	network_rate_limit_key_t key;
+
+	if (0 != network_rate_limit_key_from_name(name, &key)) {
+		luaL_argerror(L, idx, "expected user, client or digest");
+	}
+
+	return key;
+}
+
+/**
+ * proxy.global.rate_limits:set(key, match, rate[, burst[, max_wait_ms]])
+ *
+ * add a rule or replace the rule with the same key and match
+ *
+ * @return true on success, nil and the error otherwise
+ */
+static int proxy_rate_limits_set(lua_State *L) {
+	network_rate_limiter_t *limiter = *(network_rate_limiter_t **)luaL_checkself(L);
+	network_rate_limit_key_t key = proxy_rate_limits_check_key(L, 2);
+	const char *match = luaL_checkstring(L, 3);
+	lua_Number rate = luaL_checknumber(L, 4);
+	lua_Number burst = luaL_optnumber(L, 5, 0);
+	lua_Number max_wait_ms = luaL_optnumber(L, 6, 0);
+	GError *gerr = NULL;
+
+	if (max_wait_ms < 0 || max_wait_ms > G_MAXUINT) luaL_argerror(L, 6, "the max_wait_ms is out of range");
+
+	if (0 != network_rate_limiter_set_rule(limiter, key, match, rate, burst, (guint)max_wait_ms, &gerr)) {
+		lua_pushnil(L);
+		lua_pushstring(L, gerr->message);
+		g_clear_error(&gerr);
+
+		return 2;
+	}
+
+	lua_pushboolean(L, TRUE);
+
+	return 1;
+}
+
+/**
+ * proxy.global.rate_limits:remove(key, match)
+ *
+ * @return true if the rule existed
+ */
+static int proxy_rate_limits_remove(lua_State *L) {
+	network_rate_limiter_t *limiter = *(network_rate_limiter_t **)luaL_checkself(L);
+	network_rate_limit_key_t key = proxy_rate_limits_check_key(L, 2);
+	const char *match = luaL_checkstring(L, 3);
+
+	lua_pushboolean(L, network_rate_limiter_remove_rule(limiter, key, match));
+
+	return 1;
+}
+
+/**
+ * proxy.global.rate_limits:rules()
+ *
+ * @return a array of tables in the order the rules are checked
+ *   key         => user, client or digest
+ *   match       => the value of the key, "*" for a bucket per value
+ *   rate        => queries per second
+ *   burst       => queries a bucket holds at most
+ *   max_wait_ms => how long a query over the limit is delayed, 0 if it is rejected
+ *   allowed     => queries that got a token
+ *   delayed     => queries that waited for a token
+ *   rejected    => queries that got a error
+ */
+static int proxy_rate_limits_rules(lua_State *L) {
+	network_rate_limiter_t *limiter = *(network_rate_limiter_t **)luaL_checkself(L);
+	GPtrArray *rules = network_rate_limiter_get_rules(limiter);
+	guint i;
+
+	lua_newtable(L);
+
+	for (i = 0; i < rules->len; i++) {
+		network_rate_limit_rule_t *rule = rules->pdata[i];
+
+		lua_newtable(L);
+
+		lua_pushstring(L, network_rate_limit_key_get_name(rule->key));
+		lua_setfield(L, -2, "key");
+		lua_pushstring(L, rule->match);
+		lua_setfield(L, -2, "match");
+		lua_pushnumber(L, rule->rate);
+		lua_setfield(L, -2, "rate");
+		lua_pushnumber(L, rule->burst);
+		lua_setfield(L, -2, "burst");
+		lua_pushnumber(L, rule->max_wait_ms);
+		lua_setfield(L, -2, "max_wait_ms");
+		lua_pushnumber(L, rule->allowed);
+		lua_setfield(L, -2, "allowed");
+		lua_pushnumber(L, rule->delayed);
+		lua_setfield(L, -2, "delayed");
+		lua_pushnumber(L, rule->rejected);
+		lua_setfield(L, -2, "rejected");
+
+		lua_rawseti(L, -2, i + 1);
+
+		network_rate_limit_rule_free(rule);
+	}
+	g_ptr_array_free(rules, TRUE);
+
+	return 1;
+}
+
+static const struct luaL_reg methods_proxy_rate_limits[] = {
+	{ "set", proxy_rate_limits_set },
+	{ "remove", proxy_rate_limits_remove },
+	{ "rules", proxy_rate_limits_rules },
+	{ NULL, NULL },
+};
+
+int network_rate_limiter_lua_getmetatable(lua_State *L) {
+	proxy_getmetatable(L, methods_proxy_rate_limits);
+
+	lua_pushvalue(L, -1); /* meta.__index = meta */
+	lua_setfield(L, -2, "__index");
+
+	return 1;
+}
@@ -0,0 +1,688 @@
+/* $%BEGINLICENSE%$
+ Copyright (c) 2008, 2012, Oracle and/or its affiliates. All rights reserved.
+
+ This program is free software; you can redistribute it and/or
+ modify it under the terms of the GNU General Public License as
+ published by the Free Software Foundation; version 2 of the
+ License.
+
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ GNU General Public License for more details.
+
+ You should have received a copy of the GNU General Public License
+ along with this program; if not, write to the Free Software
+ Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA
+ 02110-1301  USA
+
+ $%ENDLICENSE%$ */
+
+/** @file
+ * token buckets for --proxy-rate-limit and the SET RATE LIMIT of the admin plugin
+ *
+ * a bucket is refilled with .rate tokens per second up to .burst and a query takes one
+ * token of each rule it matches. The event-threads take a lease of up to 10ms worth of
+ * tokens from the bucket and use it up without taking the lock again. The tokens taken
+ * for a earlier rule aren't given back if a later rule has none left.
+ */
+
+#include <string.h>
+
+#include "network-rate-limit.h"
+
+#define NETWORK_RATE_LIMIT_SWEEP_USEC (10 * G_USEC_PER_SEC)
+
+typedef struct {
+	gdouble tokens;
+	guint64 usec;            /**< when .tokens was refilled the last time */
+	gdouble rate;
+	gdouble burst;
+} network_rate_limit_bucket_t;
+
+typedef struct {
+	gdouble tokens;          /**< left of the tokens taken from the bucket */
+	guint64 usec;            /**< when they were taken */
+} network_rate_limit_lease_t;
+
+typedef struct {
+	guint64 allowed;
+	guint64 delayed;
+	guint64 rejected;
+} network_rate_limit_stats_t;
+
+GQuark network_rate_limit_error(void) {
+	return g_quark_from_static_string("network-rate-limit-error-quark");
+}
+
+static const gchar *key_names[NETWORK_RATE_LIMIT_KEYS] = {
+	"user",
+	"client",
+	"digest"
+};
+
+const gchar *network_rate_limit_key_get_name(network_rate_limit_key_t key) {
+	return key_names[key];
+}
+
+/**
+ * @return 0 if the name is a key, -1 otherwise
+ */
+int network_rate_limit_key_from_name(const gchar *name, network_rate_limit_key_t *key) {
+	guint i;
+
+	for (i = 0; i < NETWORK_RATE_LIMIT_KEYS; i++) {
+		if (0 == g_ascii_strcasecmp(name, key_names[i])) {
+			*key = i;
+
+			return 0;
+		}
+	}
+
+	return -1;
+}
+
+network_rate_limit_rule_t *network_rate_limit_rule_new(void) {
+	return g_new0(network_rate_limit_rule_t, 1);
+}
+
+void network_rate_limit_rule_free(network_rate_limit_rule_t *rule) {
+	if (!rule) return;
+
+	g_free(rule->match);
+
+	g_free(rule);
+}
+
+static network_rate_limit_rule_t *network_rate_limit_rule_copy(network_rate_limit_rule_t *rule) {
+	network_rate_limit_rule_t *copy = network_rate_limit_rule_new();
+
+	*copy = *rule;
+	copy->match = g_strdup(rule->match);
+
+	return copy;
+}
+
+static network_rate_limit_rules_t *network_rate_limit_rules_new(void) {
+	network_rate_limit_rules_t *rules;
+
+	rules = g_new0(network_rate_limit_rules_t, 1);
+	rules->rules = g_ptr_array_new();
+
+	return rules;
+}
+
+static void network_rate_limit_rules_free(network_rate_limit_rules_t *rules) {
+	guint i;
+
+	if (!rules) return;
+
+	for (i = 0; i < rules->rules->len; i++) {
+		network_rate_limit_rule_free(rules->rules->pdata[i]);
+	}
+	g_ptr_array_free(rules->rules, TRUE);
+
+	g_free(rules);
+}
+
+static network_rate_limit_thread_t *network_rate_limit_thread_new(void) {
+	network_rate_limit_thread_t *thr;
+
+	thr = g_new0(network_rate_limit_thread_t, 1);
+	thr->leases = g_hash_table_new_full(g_str_hash, g_str_equal, g_free, g_free);
+	thr->name = g_string_new(NULL);
+	thr->mutex = g_mutex_new();
+	thr->stats = g_hash_table_new_full(g_direct_hash, g_direct_equal, NULL, g_free);
+
+	return thr;
+}
+
+static void network_rate_limit_thread_free(network_rate_limit_thread_t *thr) {
+	if (!thr) return;
+
+	g_hash_table_destroy(thr->leases);
+	g_string_free(thr->name, TRUE);
+	g_hash_table_destroy(thr->stats);
+	g_mutex_free(thr->mutex);
+
+	g_free(thr);
+}
+
+network_rate_limiter_t *network_rate_limiter_new(void) {
+	network_rate_limiter_t *limiter;
+
+	limiter = g_new0(network_rate_limiter_t, 1);
+	limiter->mutex = g_mutex_new();
+	limiter->buckets = g_hash_table_new_full(g_str_hash, g_str_equal, g_free, g_free);
+	limiter->retired = g_ptr_array_new();
+	limiter->threads = g_ptr_array_new();
+	limiter->next_id = 1;
+	limiter->max_waiting = 1024;
+
+	network_rate_limiter_set_threads(limiter, 1);
+
+	return limiter;
+}
+
+void network_rate_limiter_free(network_rate_limiter_t *limiter) {
+	guint i;
+
+	if (!limiter) return;
+
+	for (i = 0; i < limiter->threads->len; i++) {
+		network_rate_limit_thread_free(limiter->threads->pdata[i]);
+	}
+	g_ptr_array_free(limiter->threads, TRUE);
+
+	for (i = 0; i < limiter->retired->len; i++) {
+		network_rate_limit_rules_free(limiter->retired->pdata[i]);
+	}
+	g_ptr_array_free(limiter->retired, TRUE);
+
+	network_rate_limit_rules_free(limiter->rules);
+	g_hash_table_destroy(limiter->buckets);
+	g_mutex_free(limiter->mutex);
+
+	g_free(limiter);
+}
+
+/**
+ * make room for the leases of the event-threads
+ *
+ * has to be called before the event-threads are started
+ */
+void network_rate_limiter_set_threads(network_rate_limiter_t *limiter, guint threads) {
+	while (limiter->threads->len < threads) {
+		g_ptr_array_add(limiter->threads, network_rate_limit_thread_new());
+	}
+}
+
+gboolean network_rate_limiter_is_enabled(network_rate_limiter_t *limiter) {
+	network_rate_limit_rules_t *rules = g_atomic_pointer_get((gpointer *)&limiter->rules);
+
+	return rules && rules->rules->len > 0;
+}
+
+/**
+ * check if a rule is keyed by the user, client or digest
+ *
+ * lets the caller skip building the values that no rule looks at
+ */
+gboolean network_rate_limiter_uses_key(network_rate_limiter_t *limiter, network_rate_limit_key_t key) {
+	network_rate_limit_rules_t *rules = g_atomic_pointer_get((gpointer *)&limiter->rules);
+
+	return rules && rules->uses_key[key];
+}
+
+/**
+ * publish a new set of rules
+ *
+ * the limiter->mutex has to be held
+ */
+static void network_rate_limiter_publish(network_rate_limiter_t *limiter, network_rate_limit_rules_t *rules) {
+	network_rate_limit_rules_t *old_rules = limiter->rules;
+	guint i;
+
+	for (i = 0; i < rules->rules->len; i++) {
+		network_rate_limit_rule_t *rule = rules->rules->pdata[i];
+
+		rules->uses_key[rule->key] = TRUE;
+	}
+
+	g_atomic_pointer_set((gpointer *)&limiter->rules, rules);
+
+	/* the event-threads may still look at the old ones */
+	if (old_rules) g_ptr_array_add(limiter->retired, old_rules);
+}
+
+/**
+ * add a rule or replace the rule with the same key and match
+ *
+ * @param burst  tokens a bucket holds at most, 0 to use the rate
+ * @return 0 on success, -1 if the rule is invalid
+ */
+int network_rate_limiter_set_rule(network_rate_limiter_t *limiter, network_rate_limit_key_t key, const gchar *match,
+		gdouble rate, gdouble burst, guint max_wait_ms, GError **gerr) {
+	network_rate_limit_rules_t *rules;
+	network_rate_limit_rule_t *rule;
+	gboolean is_replaced = FALSE;
+	guint i;
+
+	if (key >= NETWORK_RATE_LIMIT_KEYS) {
+		g_set_error(gerr, NETWORK_RATE_LIMIT_ERROR, NETWORK_RATE_LIMIT_ERROR_INVALID,
+				"unknown key %d", key);
+		return -1;
+	}
+
+	if (!match || *match == '\0') {
+		g_set_error(gerr, NETWORK_RATE_LIMIT_ERROR, NETWORK_RATE_LIMIT_ERROR_INVALID,
+				"the match of a %s rate limit is empty", key_names[key]);
+		return -1;
+	}
+
+	if (!(rate > 0)) {
+		g_set_error(gerr, NETWORK_RATE_LIMIT_ERROR, NETWORK_RATE_LIMIT_ERROR_INVALID,
+				"the rate of the %s rate limit '%s' has to be greater than 0, got %f", key_names[key], match, rate);
+		return -1;
+	}
+
+	if (burst == 0) burst = MAX(1.0, rate);
+
+	if (burst < 1) {
+		g_set_error(gerr, NETWORK_RATE_LIMIT_ERROR, NETWORK_RATE_LIMIT_ERROR_INVALID,
+				"the burst of the %s rate limit '%s' has to be at least 1, got %f", key_names[key], match, burst);
+		return -1;
+	}
+
+	rule = network_rate_limit_rule_new();
+	rule->key = key;
+	rule->match = g_strdup(match);
+	rule->rate = rate;
+	rule->burst = burst;
+	rule->max_wait_ms = max_wait_ms;
+
+	g_mutex_lock(limiter->mutex);
+	rule->id = limiter->next_id++;
+
+	rules = network_rate_limit_rules_new();
+	if (limiter->rules) {
+		for (i = 0; i < limiter->rules->rules->len; i++) {
+			network_rate_limit_rule_t *old_rule = limiter->rules->rules->pdata[i];
+
+			/* the changed rule gets new buckets */
+			if (old_rule->key == key && 0 == strcmp(old_rule->match, match)) {
+				g_ptr_array_add(rules->rules, rule);
+				is_replaced = TRUE;
+			} else {
+				g_ptr_array_add(rules->rules, network_rate_limit_rule_copy(old_rule));
+			}
+		}
+	}
+	if (!is_replaced) g_ptr_array_add(rules->rules, rule);
+
+	network_rate_limiter_publish(limiter, rules);
+	g_mutex_unlock(limiter->mutex);
+
+	return 0;
+}
+
+/**
+ * add a rule of --proxy-rate-limit
+ *
+ * the rule is written as <key>:<rate>[:<burst>[:<max-wait-ms>]]=<match> like
+ *
+ *   user:50=batch
+ *   digest:10:20:500=SELECT * FROM `orders` WHERE `customer_id` = ?
+ *
+ * the match is everything after the first =, fingerprints and IPv6 addresses may contain
+ * the other separators.
+ *
+ * @return 0 on success, -1 if the rule can't be parsed
+ */
+int network_rate_limiter_add_rule_string(network_rate_limiter_t *limiter, const gchar *str, GError **gerr) {
+	const gchar *eq = strchr(str, '=');
+	gchar *head;
+	gchar **fields;
+	network_rate_limit_key_t key;
+	gdouble rate, burst = 0;
+	guint64 max_wait_ms = 0;
+	guint n_fields;
+	int ret = -1;
+
+	if (!eq) {
+		g_set_error(gerr, NETWORK_RATE_LIMIT_ERROR, NETWORK_RATE_LIMIT_ERROR_INVALID,
+				"expected <key>:<rate>[:<burst>[:<max-wait-ms>]]=<match>, got '%s'", str);
+		return -1;
+	}
+
+	head = g_strndup(str, eq - str);
+	fields = g_strsplit(head, ":", -1);
+	n_fields = g_strv_length(fields);
+
+	if (n_fields < 2 || n_fields > 4) {
+		g_set_error(gerr, NETWORK_RATE_LIMIT_ERROR, NETWORK_RATE_LIMIT_ERROR_INVALID,
+				"expected <key>:<rate>[:<burst>[:<max-wait-ms>]]=<match>, got '%s'", str);
+		goto out;
+	}
+
+	if (0 != network_rate_limit_key_from_name(fields[0], &key)) {
+		g_set_error(gerr, NETWORK_RATE_LIMIT_ERROR, NETWORK_RATE_LIMIT_ERROR_INVALID,
+				"unknown key '%s' in '%s', expected user, client or digest", fields[0], str);
+		goto out;
+	}
+
+	rate = g_ascii_strtod(fields[1], NULL);
+	if (n_fields > 2) burst = g_ascii_strtod(fields[2], NULL);
+	if (n_fields > 3) {
+		gchar *end = NULL;
+
+		max_wait_ms = g_ascii_strtoull(fields[3], &end, 10);
+		if (end == fields[3] || *end != '\0' || max_wait_ms > G_MAXUINT) {
+			g_set_error(gerr, NETWORK_RATE_LIMIT_ERROR, NETWORK_RATE_LIMIT_ERROR_INVALID,
+					"invalid max-wait-ms '%s' in '%s'", fields[3], str);
+			goto out;
+		}
+	}
+
+	ret = network_rate_limiter_set_rule(limiter, key, eq + 1, rate, burst, max_wait_ms, gerr);
+out:
+	g_strfreev(fields);
+	g_free(head);
+
+	return ret;
+}
+
+/**
+ * @return TRUE if the rule existed
+ */
+gboolean network_rate_limiter_remove_rule(network_rate_limiter_t *limiter, network_rate_limit_key_t key, const gchar *match) {
+	network_rate_limit_rules_t *rules;
+	gboolean is_removed = FALSE;
+	guint i;
+
+	g_mutex_lock(limiter->mutex);
+	if (!limiter->rules) {
+		g_mutex_unlock(limiter->mutex);
+		return FALSE;
+	}
+
+	rules = network_rate_limit_rules_new();
+	for (i = 0; i < limiter->rules->rules->len; i++) {
+		network_rate_limit_rule_t *rule = limiter->rules->rules->pdata[i];
+
+		if (rule->key == key && 0 == strcmp(rule->match, match)) {
+			is_removed = TRUE;
+		} else {
+			g_ptr_array_add(rules->rules, network_rate_limit_rule_copy(rule));
+		}
+	}
+
+	if (is_removed) {
+		network_rate_limiter_publish(limiter, rules);
+	} else {
+		network_rate_limit_rules_free(rules);
+	}
+	g_mutex_unlock(limiter->mutex);
+
+	return is_removed;
+}
+
+/**
+ * get a copy of the rules with the counters of all event-threads
+ *
+ * @return a GPtrArray of network_rate_limit_rule_t, free them with network_rate_limit_rule_free()
+ */
+GPtrArray *network_rate_limiter_get_rules(network_rate_limiter_t *limiter) {
+	GPtrArray *copies = g_ptr_array_new();
+	guint i, j;
+
+	g_mutex_lock(limiter->mutex);
+	if (limiter->rules) {
+		for (i = 0; i < limiter->rules->rules->len; i++) {
+			g_ptr_array_add(copies, network_rate_limit_rule_copy(limiter->rules->rules->pdata[i]));
+		}
+	}
+	g_mutex_unlock(limiter->mutex);
+
+	for (i = 0; i < limiter->threads->len; i++) {
+		network_rate_limit_thread_t *thr = limiter->threads->pdata[i];
+
+		g_mutex_lock(thr->mutex);
+		for (j = 0; j < copies->len; j++) {
+			network_rate_limit_rule_t *rule = copies->pdata[j];
+			network_rate_limit_stats_t *stats = g_hash_table_lookup(thr->stats, GUINT_TO_POINTER(rule->id));
+
+			if (!stats) continue;
+
+			rule->allowed += stats->allowed;
+			rule->delayed += stats->delayed;
+			rule->rejected += stats->rejected;
+		}
+		g_mutex_unlock(thr->mutex);
+	}
+
+	return copies;
+}
+
+/**
+ * get the counters of a rule in the event-thread
+ *
+ * the thr->mutex has to be held
+ */
+static network_rate_limit_stats_t *network_rate_limit_thread_get_stats(network_rate_limit_thread_t *thr, guint rule_id) {
+	network_rate_limit_stats_t *stats;
+
+	stats = g_hash_table_lookup(thr->stats, GUINT_TO_POINTER(rule_id));
+	if (!stats) {
+		stats = g_new0(network_rate_limit_stats_t, 1);
+		g_hash_table_insert(thr->stats, GUINT_TO_POINTER(rule_id), stats);
+	}
+
+	return stats;
+}
+
+/**
+ * add the tokens that passed since the last refill
+ */
+static void network_rate_limit_bucket_refill(network_rate_limit_bucket_t *bucket, guint64 now_usec) {
+	if (now_usec > bucket->usec) {
+		bucket->tokens += (now_usec - bucket->usec) * bucket->rate / G_USEC_PER_SEC;
+		if (bucket->tokens > bucket->burst) bucket->tokens = bucket->burst;
+	}
+	bucket->usec = now_usec;
+}
+
+static gboolean network_rate_limit_bucket_is_full(gpointer key, gpointer value, gpointer user_data) {
+	network_rate_limit_bucket_t *bucket = value;
+	guint64 now_usec = *(guint64 *)user_data;
+
+	network_rate_limit_bucket_refill(bucket, now_usec);
+
+	return bucket->tokens >= bucket->burst;
+}
+
+typedef struct {
+	network_rate_limiter_t *limiter;
+	guint64 now_usec;
+} network_rate_limit_sweep_t;
+
+/**
+ * give the tokens of a stale lease back to its bucket
+ *
+ * the limiter->mutex has to be held
+ */
+static gboolean network_rate_limit_lease_is_stale(gpointer key, gpointer value, gpointer user_data) {
+	network_rate_limit_lease_t *lease = value;
+	network_rate_limit_sweep_t *sweep = user_data;
+	network_rate_limit_bucket_t *bucket;
+
+	if (sweep->now_usec - lease->usec < NETWORK_RATE_LIMIT_LEASE_USEC) return FALSE;
+
+	bucket = g_hash_table_lookup(sweep->limiter->buckets, key);
+	if (bucket) {
+		bucket->tokens = MIN(bucket->burst, bucket->tokens + lease->tokens);
+	}
+
+	return TRUE;
+}
+
+/**
+ * return the stale leases of the thread and drop the full buckets
+ *
+ * a full bucket is the same as a bucket that doesn't exist, the ones of a "*" rule would
+ * pile up otherwise. Buckets of changed or removed rules fill up and go away too.
+ */
+static void network_rate_limiter_sweep(network_rate_limiter_t *limiter, network_rate_limit_thread_t *thr, guint64 now_usec) {
+	network_rate_limit_sweep_t sweep;
+
+	if (now_usec - thr->last_sweep_usec < NETWORK_RATE_LIMIT_SWEEP_USEC) return;
+	thr->last_sweep_usec = now_usec;
+
+	sweep.limiter = limiter;
+	sweep.now_usec = now_usec;
+
+	g_mutex_lock(limiter->mutex);
+	g_hash_table_foreach_remove(thr->leases, network_rate_limit_lease_is_stale, &sweep);
+
+	if (now_usec - limiter->last_sweep_usec >= NETWORK_RATE_LIMIT_SWEEP_USEC) {
+		limiter->last_sweep_usec = now_usec;
+
+		g_hash_table_foreach_remove(limiter->buckets, network_rate_limit_bucket_is_full, &now_usec);
+	}
+	g_mutex_unlock(limiter->mutex);
+}
+
+/**
+ * take a token from the bucket, lease some more for the next queries
+ *
+ * @return TRUE if a token was taken, FALSE with verdict->wait_usec set otherwise
+ */
+static gboolean network_rate_limiter_take(network_rate_limiter_t *limiter, network_rate_limit_thread_t *thr,
+		network_rate_limit_rule_t *rule, guint64 now_usec, network_rate_limit_verdict_t *verdict) {
+	network_rate_limit_lease_t *lease;
+	network_rate_limit_bucket_t *bucket;
+	gdouble take;
+
+	lease = g_hash_table_lookup(thr->leases, thr->name->str);
+	if (lease && lease->tokens >= 1 && now_usec - lease->usec < NETWORK_RATE_LIMIT_LEASE_USEC) {
+		lease->tokens -= 1;
+
+		return TRUE;
+	}
+
+	g_mutex_lock(limiter->mutex);
+	bucket = g_hash_table_lookup(limiter->buckets, thr->name->str);
+	if (!bucket) {
+		bucket = g_new0(network_rate_limit_bucket_t, 1);
+		bucket->tokens = rule->burst;
+		bucket->usec = now_usec;
+		bucket->rate = rule->rate;
+		bucket->burst = rule->burst;
+
+		g_hash_table_insert(limiter->buckets, g_strdup(thr->name->str), bucket);
+	}
+	network_rate_limit_bucket_refill(bucket, now_usec);
+
+	if (lease) {
+		bucket->tokens = MIN(bucket->burst, bucket->tokens + lease->tokens);
+		lease->tokens = 0;
+	}
+
+	if (bucket->tokens < 1) {
+		verdict->rule_id = rule->id;
+		verdict->max_wait_ms = rule->max_wait_ms;
+		verdict->wait_usec = (guint64)((1 - bucket->tokens) * G_USEC_PER_SEC / bucket->rate) + 1;
+		g_mutex_unlock(limiter->mutex);
+
+		return FALSE;
+	}
+
+	take = (guint64)MIN(bucket->tokens, MAX(1.0, rule->rate / 100));
+	bucket->tokens -= take;
+	g_mutex_unlock(limiter->mutex);
+
+	if (!lease) {
+		lease = g_new0(network_rate_limit_lease_t, 1);
+		g_hash_table_insert(thr->leases, g_strdup(thr->name->str), lease);
+	}
+	lease->tokens = take - 1;
+	lease->usec = now_usec;
+
+	return TRUE;
+}
+
+/**
+ * take a token for a query of the event-thread
+ *
+ * @param ndx     the index of the event-thread
+ * @param values  the user, client address and fingerprint of the query, NULL if unknown
+ * @return TRUE if the query may run, FALSE if it is over a limit and the verdict is set
+ */
+gboolean network_rate_limiter_acquire(network_rate_limiter_t *limiter, guint ndx,
+		const gchar *values[NETWORK_RATE_LIMIT_KEYS], guint64 now_usec,
+		network_rate_limit_verdict_t *verdict) {
+	network_rate_limit_rules_t *rules = g_atomic_pointer_get((gpointer *)&limiter->rules);
+	network_rate_limit_thread_t *thr;
+	guint matched[16];
+	guint n_matched = 0;
+	gboolean is_allowed = TRUE;
+	guint i;
+
+	if (!rules || rules->rules->len == 0) return TRUE;
+
+	g_assert_cmpint(ndx, <, limiter->threads->len);
+	thr = limiter->threads->pdata[ndx];
+
+	if (thr->rules != rules) {
+		/* the leases may belong to a rule that changed */
+		g_hash_table_remove_all(thr->leases);
+		thr->rules = rules;
+	}
+
+	network_rate_limiter_sweep(limiter, thr, now_usec);
+
+	for (i = 0; i < rules->rules->len; i++) {
+		network_rate_limit_rule_t *rule = rules->rules->pdata[i];
+		const gchar *value = values[rule->key];
+
+		if (!value) continue;
+		if (0 != strcmp(rule->match, "*") && 0 != strcmp(rule->match, value)) continue;
+
+		g_string_printf(thr->name, "%u:%s", rule->id, value);
+
+		if (!network_rate_limiter_take(limiter, thr, rule, now_usec, verdict)) {
+			is_allowed = FALSE;
+			break;
+		}
+
+		if (n_matched < G_N_ELEMENTS(matched)) matched[n_matched++] = rule->id;
+	}
+
+	if (is_allowed && n_matched > 0) {
+		g_mutex_lock(thr->mutex);
+		for (i = 0; i < n_matched; i++) {
+			network_rate_limit_thread_get_stats(thr, matched[i])->allowed++;
+		}
+		g_mutex_unlock(thr->mutex);
+	}
+
+	return is_allowed;
+}
+
+/**
+ * check if a query over the limit may wait for its token
+ *
+ * a query that waits has to call network_rate_limiter_undelay() when it is done waiting
+ *
+ * @return TRUE if it may wait, FALSE if it has to be rejected
+ */
+gboolean network_rate_limiter_delay(network_rate_limiter_t *limiter, guint ndx, network_rate_limit_verdict_t *verdict) {
+	network_rate_limit_thread_t *thr = limiter->threads->pdata[ndx];
+
+	if (verdict->max_wait_ms == 0) return FALSE;
+	if (verdict->wait_usec > (guint64)verdict->max_wait_ms * 1000) return FALSE;
+
+	if ((guint)g_atomic_int_exchange_and_add(&limiter->waiting, 1) >= limiter->max_waiting) {
+		g_atomic_int_add(&limiter->waiting, -1);
+
+		return FALSE;
+	}
+
+	g_mutex_lock(thr->mutex);
+	network_rate_limit_thread_get_stats(thr, verdict->rule_id)->delayed++;
+	g_mutex_unlock(thr->mutex);
+
+	return TRUE;
+}
+
+void network_rate_limiter_undelay(network_rate_limiter_t *limiter) {
+	g_atomic_int_add(&limiter->waiting, -1);
+}
+
+void network_rate_limiter_reject(network_rate_limiter_t *limiter, guint ndx, network_rate_limit_verdict_t *verdict) {
+	network_rate_limit_thread_t *thr = limiter->threads->pdata[ndx];
+
+	g_mutex_lock(thr->mutex);
+	network_rate_limit_thread_get_stats(thr, verdict->rule_id)->rejected++;
+	g_mutex_unlock(thr->mutex);
+}
@@ -0,0 +1,139 @@
+/* $%BEGINLICENSE%$
+ Copyright (c) 2008, 2012, Oracle and/or its affiliates. All rights reserved.
+
+ This program is free software; you can redistribute it and/or
+ modify it under the terms of the GNU General Public License as
+ published by the Free Software Foundation; version 2 of the
+ License.
+
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ GNU General Public License for more details.
+
+ You should have received a copy of the GNU General Public License
+ along with this program; if not, write to the Free Software
+ Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA
+ 02110-1301  USA
+
+ $%ENDLICENSE%$ */
+#ifndef __NETWORK_RATE_LIMIT_H__
+#define __NETWORK_RATE_LIMIT_H__
+
+#include <glib.h>
+
+#include "network-exports.h"
+
+/**
+ * token buckets for the queries of the clients
+ *
+ * a rule limits the queries of a user, a client address or a fingerprint to a rate.
+ * Each key of a rule has its bucket, a rule with the match "*" has a bucket per user,
+ * address or fingerprint.
+ *
+ * the event-threads lease a few tokens at once from the shared bucket and take them
+ * without a lock. Leases that weren't used up within NETWORK_RATE_LIMIT_LEASE_USEC go
+ * back to the bucket the next time the key is seen.
+ */
+
+typedef enum {
+	NETWORK_RATE_LIMIT_USER,
+	NETWORK_RATE_LIMIT_CLIENT,          /**< the address of the client without the port */
+	NETWORK_RATE_LIMIT_DIGEST           /**< the fingerprint of the query, see network_query_digest_fingerprint() */
+} network_rate_limit_key_t;
+
+#define NETWORK_RATE_LIMIT_KEYS 3
+
+#define NETWORK_RATE_LIMIT_LEASE_USEC (100 * 1000)
+
+typedef struct {
+	guint id;                          /**< a new id for each change, the buckets belong to it */
+	network_rate_limit_key_t key;
+	gchar *match;                      /**< the user, address or fingerprint, "*" for a bucket per each */
+	gdouble rate;                      /**< queries per second */
+	gdouble burst;                     /**< tokens a bucket holds at most */
+	guint max_wait_ms;                 /**< delay the queries over the limit this long at most, 0 to reject them */
+
+	guint64 allowed;                   /**< the counters of all event-threads, only set by network_rate_limiter_get_rules() */
+	guint64 delayed;
+	guint64 rejected;
+} network_rate_limit_rule_t;
+
+NETWORK_API network_rate_limit_rule_t *network_rate_limit_rule_new(void);
+NETWORK_API void network_rate_limit_rule_free(network_rate_limit_rule_t *rule);
+
+/**
+ * the rules, replaced as a whole when they change
+ */
+typedef struct {
+	GPtrArray *rules;                  /**< network_rate_limit_rule_t in the order they are checked */
+	gboolean uses_key[NETWORK_RATE_LIMIT_KEYS];
+} network_rate_limit_rules_t;
+
+/**
+ * the leases and counters of one event-thread
+ */
+typedef struct {
+	network_rate_limit_rules_t *rules; /**< the rules the leases belong to */
+	GHashTable *leases;                /**< bucket-name -> network_rate_limit_lease_t */
+	guint64 last_sweep_usec;
+	GString *name;                     /**< scratch space for the bucket-name */
+
+	GMutex *mutex;                     /**< protects .stats, only contended while they are read */
+	GHashTable *stats;                 /**< rule-id -> the counters of the rule */
+} network_rate_limit_thread_t;
+
+typedef struct {
+	network_rate_limit_rules_t *rules; /**< the current rules, get them with g_atomic_pointer_get() */
+
+	GMutex *mutex;                     /**< protects the fields below, serializes the writers of .rules */
+	GHashTable *buckets;               /**< bucket-name -> network_rate_limit_bucket_t */
+	GPtrArray *retired;                /**< replaced rules, the event-threads may still use them */
+	guint next_id;
+	guint64 last_sweep_usec;
+
+	GPtrArray *threads;                /**< a network_rate_limit_thread_t per event-thread */
+
+	guint max_waiting;                 /**< queries that wait for a token at once, more are rejected */
+	volatile gint waiting;
+} network_rate_limiter_t;
+
+/**
+ * why a query isn't allowed
+ */
+typedef struct {
+	guint rule_id;
+	guint64 wait_usec;                 /**< until the bucket has a token again */
+	guint max_wait_ms;                 /**< of the rule */
+} network_rate_limit_verdict_t;
+
+NETWORK_API network_rate_limiter_t *network_rate_limiter_new(void);
+NETWORK_API void network_rate_limiter_free(network_rate_limiter_t *limiter);
+NETWORK_API void network_rate_limiter_set_threads(network_rate_limiter_t *limiter, guint threads);
+NETWORK_API gboolean network_rate_limiter_is_enabled(network_rate_limiter_t *limiter);
+NETWORK_API gboolean network_rate_limiter_uses_key(network_rate_limiter_t *limiter, network_rate_limit_key_t key);
+
+NETWORK_API int network_rate_limiter_set_rule(network_rate_limiter_t *limiter, network_rate_limit_key_t key, const gchar *match,
+		gdouble rate, gdouble burst, guint max_wait_ms, GError **gerr);
+NETWORK_API int network_rate_limiter_add_rule_string(network_rate_limiter_t *limiter, const gchar *str, GError **gerr);
+NETWORK_API gboolean network_rate_limiter_remove_rule(network_rate_limiter_t *limiter, network_rate_limit_key_t key, const gchar *match);
+NETWORK_API GPtrArray *network_rate_limiter_get_rules(network_rate_limiter_t *limiter);
+
+NETWORK_API gboolean network_rate_limiter_acquire(network_rate_limiter_t *limiter, guint ndx,
+		const gchar *values[NETWORK_RATE_LIMIT_KEYS], guint64 now_usec,
+		network_rate_limit_verdict_t *verdict);
+NETWORK_API gboolean network_rate_limiter_delay(network_rate_limiter_t *limiter, guint ndx, network_rate_limit_verdict_t *verdict);
+NETWORK_API void network_rate_limiter_undelay(network_rate_limiter_t *limiter);
+NETWORK_API void network_rate_limiter_reject(network_rate_limiter_t *limiter, guint ndx, network_rate_limit_verdict_t *verdict);
+
+NETWORK_API const gchar *network_rate_limit_key_get_name(network_rate_limit_key_t key);
+NETWORK_API int network_rate_limit_key_from_name(const gchar *name, network_rate_limit_key_t *key);
+
+#define NETWORK_RATE_LIMIT_ERROR network_rate_limit_error()
+NETWORK_API GQuark network_rate_limit_error(void);
+
+typedef enum {
+	NETWORK_RATE_LIMIT_ERROR_INVALID   /**< the key, rate or burst of the rule is invalid */
+} network_rate_limit_error_t;
+
+#endif
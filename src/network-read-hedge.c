@@ -0,0 +1,182 @@
+/* $%BEGINLICENSE%$
+ Copyright (c) 2008, 2012, Oracle and/or its affiliates. All rights reserved.
+
+ This program is free software; you can redistribute it and/or
+ modify it under the terms of the GNU General Public License as
+ published by the Free Software Foundation; version 2 of the
+ License.
+
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ GNU General Public License for more details.
+
+ You should have received a copy of the GNU General Public License
+ along with this program; if not, write to the Free Software
+ Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA
+ 02110-1301  USA
+
+ $%ENDLICENSE%$ */
+/**
+ * the delays and the budget of the hedged reads
+ *
+ * a read-only backend that stalls (purge, backup, a slow disk) holds up the reads that
+ * went to it. A read that didn't get its first packet within the usual time of its
+ * fingerprint is sent to a second read-only backend, the first answer wins.
+ *
+ * each event-thread keeps the time to the first packet of the fingerprints it saw in a
+ * histogram, and the credits it earned for hedges. No locks are needed.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <glib.h>
+
+#include "network-read-hedge.h"
+
+static guint network_read_hedge_hash_func(gconstpointer key) {
+	guint64 h = *(const guint64 *)key;
+
+	return (guint)(h ^ (h >> 32));
+}
+
+static gboolean network_read_hedge_equal_func(gconstpointer a, gconstpointer b) {
+	return *(const guint64 *)a == *(const guint64 *)b;
+}
+
+static network_read_hedge_thread_t *network_read_hedge_thread_new(void) {
+	network_read_hedge_thread_t *thr;
+
+	thr = g_new0(network_read_hedge_thread_t, 1);
+	thr->entries = g_hash_table_new_full(network_read_hedge_hash_func, network_read_hedge_equal_func,
+			NULL, g_free);
+	thr->credits = NETWORK_READ_HEDGE_MAX_CREDITS;
+
+	return thr;
+}
+
+static void network_read_hedge_thread_free(network_read_hedge_thread_t *thr) {
+	if (!thr) return;
+
+	g_hash_table_destroy(thr->entries);
+
+	g_free(thr);
+}
+
+network_read_hedge_t *network_read_hedge_new(void) {
+	network_read_hedge_t *hedge;
+
+	hedge = g_new0(network_read_hedge_t, 1);
+	hedge->percentile = 95.0;
+	hedge->budget = 5.0;
+	hedge->threads = g_ptr_array_new();
+
+	return hedge;
+}
+
+void network_read_hedge_free(network_read_hedge_t *hedge) {
+	guint i;
+
+	if (!hedge) return;
+
+	for (i = 0; i < hedge->threads->len; i++) {
+		network_read_hedge_thread_free(hedge->threads->pdata[i]);
+	}
+	g_ptr_array_free(hedge->threads, TRUE);
+
+	g_free(hedge);
+}
+
+/**
+ * call it with the number of event-threads before the threads are started
+ */
+void network_read_hedge_set_threads(network_read_hedge_t *hedge, guint threads) {
+	if (threads < 1) threads = 1;
+
+	while (hedge->threads->len < threads) {
+		g_ptr_array_add(hedge->threads, network_read_hedge_thread_new());
+	}
+}
+
+static network_read_hedge_thread_t *network_read_hedge_get_thread(network_read_hedge_t *hedge, guint ndx) {
+	if (hedge->threads->len == 0) return NULL;
+
+	return hedge->threads->pdata[ndx < hedge->threads->len ? ndx : 0];
+}
+
+/**
+ * a read of the fingerprint is about to be sent
+ *
+ * the read earns budget / 100 credits for the hedges of the thread
+ *
+ * @return the microseconds to wait for its first packet before it is hedged, 0 to not hedge it
+ */
+guint64 network_read_hedge_get_delay(network_read_hedge_t *hedge, guint ndx, guint64 hash) {
+	network_read_hedge_thread_t *thr = network_read_hedge_get_thread(hedge, ndx);
+	network_read_hedge_entry_t *entry;
+
+	if (NULL == thr) return 0;
+
+	thr->credits = MIN(thr->credits + hedge->budget / 100.0, NETWORK_READ_HEDGE_MAX_CREDITS);
+
+	if (NULL == (entry = g_hash_table_lookup(thr->entries, &hash))) return 0;
+
+	return entry->delay_usec;
+}
+
+/**
+ * take the credit for a hedge
+ *
+ * @return FALSE if the thread is out of its budget
+ */
+gboolean network_read_hedge_spend(network_read_hedge_t *hedge, guint ndx) {
+	network_read_hedge_thread_t *thr = network_read_hedge_get_thread(hedge, ndx);
+
+	if (NULL == thr || thr->credits < 1.0) return FALSE;
+
+	thr->credits -= 1.0;
+
+	return TRUE;
+}
+
+/**
+ * add the time to the first packet of a read
+ *
+ * the percentile is only computed again every NETWORK_READ_HEDGE_MIN_SAMPLES reads
+ */
+void network_read_hedge_record(network_read_hedge_t *hedge, guint ndx, guint64 hash, guint64 first_byte_usec) {
+	network_read_hedge_thread_t *thr = network_read_hedge_get_thread(hedge, ndx);
+	network_read_hedge_entry_t *entry;
+
+	if (NULL == thr) return;
+
+	if (NULL != (entry = g_hash_table_lookup(thr->entries, &hash))) {
+		g_queue_unlink(&(thr->lru), &(entry->link));
+	} else {
+		if (g_hash_table_size(thr->entries) >= NETWORK_READ_HEDGE_MAX_ENTRIES) {
+			network_read_hedge_entry_t *lru = g_queue_peek_tail(&(thr->lru));
+
+			g_queue_unlink(&(thr->lru), &(lru->link));
+			g_hash_table_remove(thr->entries, &(lru->hash));
+		}
+
+		entry = g_new0(network_read_hedge_entry_t, 1);
+		entry->hash = hash;
+		entry->link.data = entry;
+		g_hash_table_insert(thr->entries, &(entry->hash), entry);
+	}
+	g_queue_push_head_link(&(thr->lru), &(entry->link));
+
+	network_histogram_add(&(entry->first_byte), first_byte_usec);
+
+	if (entry->first_byte.count >= NETWORK_READ_HEDGE_MAX_SAMPLES) {
+		network_histogram_halve(&(entry->first_byte));
+	}
+
+	if (entry->first_byte.count >= NETWORK_READ_HEDGE_MIN_SAMPLES &&
+	    (entry->delay_usec == 0 || entry->first_byte.count % NETWORK_READ_HEDGE_MIN_SAMPLES == 0)) {
+		entry->delay_usec = MAX(network_histogram_get_percentile(&(entry->first_byte), hedge->percentile), 1);
+	}
+}
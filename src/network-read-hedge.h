@@ -0,0 +1,71 @@
+/* $%BEGINLICENSE%$
+ Copyright (c) 2008, 2012, Oracle and/or its affiliates. All rights reserved.
+
+ This program is free software; you can redistribute it and/or
+ modify it under the terms of the GNU General Public License as
+ published by the Free Software Foundation; version 2 of the
+ License.
+
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ GNU General Public License for more details.
+
+ You should have received a copy of the GNU General Public License
+ along with this program; if not, write to the Free Software
+ Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA
+ 02110-1301  USA
+
+ $%ENDLICENSE%$ */
+#ifndef __NETWORK_READ_HEDGE_H__
+#define __NETWORK_READ_HEDGE_H__
+
+#include <glib.h>
+
+#include "network-histogram.h"
+#include "network-exports.h"
+
+#define NETWORK_READ_HEDGE_MIN_SAMPLES 20    /**< a fingerprint isn't hedged before we know its latency */
+#define NETWORK_READ_HEDGE_MAX_SAMPLES 1000  /**< the histogram is halved then, the recent latencies weigh more */
+#define NETWORK_READ_HEDGE_MAX_ENTRIES 256   /**< fingerprints per event-thread, the least recently used is dropped */
+#define NETWORK_READ_HEDGE_MAX_CREDITS 10.0  /**< hedges that may be sent in a burst */
+
+/**
+ * the time to the first packet of the reads of a fingerprint
+ */
+typedef struct {
+	guint64 hash;               /**< the hash of the fingerprint, see network_query_digest_fingerprint() */
+	network_histogram_t first_byte; /**< in microseconds */
+	guint64 delay_usec;         /**< the percentile of the histogram, 0 until it has NETWORK_READ_HEDGE_MIN_SAMPLES */
+	GList link;                 /**< our link in the LRU list of the thread */
+} network_read_hedge_entry_t;
+
+/**
+ * the fingerprints and the budget of one event-thread, only used by it
+ */
+typedef struct {
+	GHashTable *entries;        /**< hash -> network_read_hedge_entry_t */
+	GQueue lru;                 /**< most recently used first */
+	gdouble credits;            /**< hedges this thread may send, each read earns budget / 100 */
+} network_read_hedge_thread_t;
+
+/**
+ * send a read that waits for its first packet longer than usual to a second read-only backend
+ *
+ * the delay is the percentile of the time to the first packet of the fingerprint. At most
+ * budget percent of the reads are hedged.
+ */
+typedef struct {
+	gdouble percentile;         /**< 0 to 100 */
+	gdouble budget;             /**< percent of the reads that may be hedged */
+	GPtrArray *threads;         /**< a network_read_hedge_thread_t per event-thread */
+} network_read_hedge_t;
+
+NETWORK_API network_read_hedge_t *network_read_hedge_new(void);
+NETWORK_API void network_read_hedge_free(network_read_hedge_t *hedge);
+NETWORK_API void network_read_hedge_set_threads(network_read_hedge_t *hedge, guint threads);
+NETWORK_API guint64 network_read_hedge_get_delay(network_read_hedge_t *hedge, guint ndx, guint64 hash);
+NETWORK_API gboolean network_read_hedge_spend(network_read_hedge_t *hedge, guint ndx);
+NETWORK_API void network_read_hedge_record(network_read_hedge_t *hedge, guint ndx, guint64 hash, guint64 first_byte_usec);
+
+#endif
@@ -0,0 +1,291 @@
+/* $%BEGINLICENSE%$
+ Copyright (c) 2008, 2012, Oracle and/or its affiliates. All rights reserved.
+
+ This program is free software; you can redistribute it and/or
+ modify it under the terms of the GNU General Public License as
+ published by the Free Software Foundation; version 2 of the
+ License.
+
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ GNU General Public License for more details.
+
+ You should have received a copy of the GNU General Public License
+ along with this program; if not, write to the Free Software
+ Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA
+ 02110-1301  USA
+
+ $%ENDLICENSE%$ */
+
+/** @file
+ * proxy.resultset_builder()
+ *
+ * encodes a resultset row by row into packets instead of building it up in lua-tables
+ * first. The packets are collected in the builder and moved to the client when the
+ * builder is returned as proxy.response.resultset:
+ *
+ *   local rs = proxy.resultset_builder({ { name = "id", type = proxy.MYSQL_TYPE_LONG } })
+ *   for i = 1, 1000 do
+ *     rs:add_row(i)
+ *   end
+ *   rs:finish()
+ *
+ *   proxy.response = { type = proxy.MYSQLD_PACKET_OK, resultset = rs }
+ *   return proxy.PROXY_SEND_RESULT
+ */
+
+#include <lua.h>
+#include <lauxlib.h>
+
+#include "lua-env.h"
+#include "glib-ext.h"
+
+#include "network-mysqld-proto.h"
+#include "network-mysqld-resultset-writer.h"
+#include "network-resultset-builder-lua.h"
+
+typedef struct {
+	network_socket *sink;                  /**< holds the send-queue the packets are encoded into */
+	network_mysqld_resultset_writer_t *w;
+
+	gsize field_count;
+
+	gboolean is_finished;                  /**< the EOF packet is written */
+	gboolean is_sent;                      /**< the packets were moved to the client */
+} network_resultset_builder_t;
+
+static network_resultset_builder_t *network_resultset_builder_new(void) {
+	network_resultset_builder_t *rs;
+
+	rs = g_slice_new0(network_resultset_builder_t);
+	rs->sink = network_socket_new();
+
+	return rs;
+}
+
+static void network_resultset_builder_free(network_resultset_builder_t *rs) {
+	if (!rs) return;
+
+	if (rs->w) network_mysqld_resultset_writer_free(rs->w);
+	network_socket_free(rs->sink);
+
+	g_slice_free(network_resultset_builder_t, rs);
+}
+
+/**
+ * set the packet-ids of the collected packets, starting at packet_id
+ *
+ * the writer packs whole packets into each chunk of the send-queue
+ */
+static void network_resultset_builder_renumber(network_resultset_builder_t *rs, guint8 packet_id) {
+	GList *chunk;
+
+	for (chunk = rs->sink->send_queue->chunks->head; chunk; chunk = chunk->next) {
+		GString *s = chunk->data;
+		gsize offset;
+
+		for (offset = 0; offset + NET_HEADER_SIZE <= s->len; ) {
+			guint32 packet_len;
+
+			packet_len = (guchar)s->str[offset] |
+				((guchar)s->str[offset + 1] << 8) |
+				((guchar)s->str[offset + 2] << 16);
+
+			s->str[offset + 3] = packet_id++;
+
+			offset += NET_HEADER_SIZE + packet_len;
+		}
+	}
+}
+
+/**
+ * proxy.resultset_builder(fields)
+ *
+ * @param fields the field-defs like proxy.response.resultset.fields: { { name = ..., type = ... }, ... }
+ * @return a builder to add the rows to
+ */
+int network_resultset_builder_lua_new(lua_State *L) {
+	network_resultset_builder_t *rs, **rs_p;
+	GPtrArray *fields;
+	int i;
+
+	luaL_checktype(L, 1, LUA_TTABLE);
+
+	fields = network_mysqld_proto_fielddefs_new();
+
+	for (i = 1; ; i++) {
+		MYSQL_FIELD *field;
+
+		lua_rawgeti(L, 1, i);
+		if (lua_isnil(L, -1)) {
+			lua_pop(L, 1);
+			break;
+		} else if (!lua_istable(L, -1)) {
+			network_mysqld_proto_fielddefs_free(fields);
+
+			return luaL_error(L, "fields[%d] should be a table, but is a %s", i, luaL_typename(L, -1));
+		}
+
+		field = network_mysqld_proto_fielddef_new();
+
+		lua_getfield(L, -1, "name");
+		field->name = g_strdup(lua_isstring(L, -1) ? lua_tostring(L, -1) : "no-field-name");
+		lua_pop(L, 1);
+
+		lua_getfield(L, -1, "type");
+		field->type = lua_isnumber(L, -1) ? lua_tointeger(L, -1) : MYSQL_TYPE_STRING;
+		lua_pop(L, 1);
+
+		field->flags = PRI_KEY_FLAG;
+		field->length = 32;
+		g_ptr_array_add(fields, field);
+
+		lua_pop(L, 1); /* fields[i] */
+	}
+
+	if (fields->len == 0) {
+		network_mysqld_proto_fielddefs_free(fields);
+
+		return luaL_argerror(L, 1, "expected at least one field");
+	}
+
+	rs = network_resultset_builder_new();
+	rs->field_count = fields->len;
+	rs->w = network_mysqld_resultset_writer_new(rs->sink);
+	network_mysqld_resultset_writer_write_fields(rs->w, fields);
+
+	network_mysqld_proto_fielddefs_free(fields);
+
+	rs_p = lua_newuserdata(L, sizeof(network_resultset_builder_t *));
+	*rs_p = rs;
+
+	network_resultset_builder_lua_getmetatable(L);
+	lua_setmetatable(L, -2);
+
+	return 1;
+}
+
+/**
+ * rs:add_row(...)
+ *
+ * one value per field, nil is sent as NULL
+ */
+static int proxy_resultset_builder_add_row(lua_State *L) {
+	network_resultset_builder_t *rs = *(network_resultset_builder_t **)luaL_checkself(L);
+	int n = lua_gettop(L) - 1;
+	int i;
+
+	if (rs->is_finished) return luaL_error(L, "rs:add_row() called after rs:finish()");
+
+	if ((gsize)n != rs->field_count) {
+		return luaL_error(L, "rs:add_row() expects %d values, got %d", (int)rs->field_count, n);
+	}
+
+	/* check all values before we start the row, a error would leave it half-written */
+	for (i = 2; i <= n + 1; i++) {
+		if (!lua_isnil(L, i) && !lua_isstring(L, i)) {
+			luaL_typerror(L, i, "string, number or nil");
+		}
+	}
+
+	network_mysqld_resultset_writer_row_start(rs->w);
+
+	for (i = 2; i <= n + 1; i++) {
+		if (lua_isnil(L, i)) {
+			network_mysqld_resultset_writer_row_append(rs->w, NULL, 0);
+		} else {
+			const char *value;
+			size_t value_len;
+
+			value = lua_tolstring(L, i, &value_len);
+			network_mysqld_resultset_writer_row_append(rs->w, value, value_len);
+		}
+	}
+
+	network_mysqld_resultset_writer_row_end(rs->w);
+
+	return 0;
+}
+
+/**
+ * rs:finish()
+ *
+ * terminate the rows, called implicitly when the builder is sent
+ */
+static int proxy_resultset_builder_finish(lua_State *L) {
+	network_resultset_builder_t *rs = *(network_resultset_builder_t **)luaL_checkself(L);
+
+	if (!rs->is_finished) {
+		network_mysqld_resultset_writer_finish(rs->w);
+		rs->is_finished = TRUE;
+	}
+
+	return 0;
+}
+
+static int proxy_resultset_builder_gc(lua_State *L) {
+	network_resultset_builder_t *rs = *(network_resultset_builder_t **)luaL_checkself(L);
+
+	network_resultset_builder_free(rs);
+
+	return 0;
+}
+
+static const struct luaL_reg methods_proxy_resultset_builder[] = {
+	{ "add_row", proxy_resultset_builder_add_row },
+	{ "finish", proxy_resultset_builder_finish },
+	{ "__gc", proxy_resultset_builder_gc },
+	{ NULL, NULL },
+};
+
+int network_resultset_builder_lua_getmetatable(lua_State *L) {
+	proxy_getmetatable(L, methods_proxy_resultset_builder);
+
+	lua_pushvalue(L, -1); /* meta.__index = meta */
+	lua_setfield(L, -2, "__index");
+
+	return 1;
+}
+
+/**
+ * move the packets of the builder at idx to the send-queue of sock
+ *
+ * @return 0 on success, -1 if idx isn't a builder or it was sent already
+ */
+int network_resultset_builder_lua_send(lua_State *L, int idx, network_socket *sock) {
+	network_resultset_builder_t *rs;
+	GString *packets;
+	gboolean is_builder;
+
+	if (!lua_isuserdata(L, idx) || !lua_getmetatable(L, idx)) return -1;
+
+	proxy_getmetatable(L, methods_proxy_resultset_builder);
+	is_builder = lua_rawequal(L, -1, -2);
+	lua_pop(L, 2);
+
+	if (!is_builder) return -1;
+
+	rs = *(network_resultset_builder_t **)lua_touserdata(L, idx);
+	if (rs->is_sent) return -1;
+
+	if (!rs->is_finished) {
+		network_mysqld_resultset_writer_finish(rs->w);
+		rs->is_finished = TRUE;
+	}
+
+	/* the builder started with packet-id 0, continue with the packet-ids of the client */
+	if (!sock->packet_id_is_reset) {
+		network_resultset_builder_renumber(rs, sock->last_packet_id + 1);
+	}
+
+	while ((packets = g_queue_pop_head(rs->sink->send_queue->chunks))) {
+		network_queue_append(sock->send_queue, packets);
+	}
+	rs->sink->send_queue->len = 0;
+
+	sock->packet_id_is_reset = TRUE;
+	rs->is_sent = TRUE;
+
+	return 0;
+}
@@ -0,0 +1,848 @@
+/* $%BEGINLICENSE%$
+ Copyright (c) 2008, 2012, Oracle and/or its affiliates. All rights reserved.
+
+ This program is free software; you can redistribute it and/or
+ modify it under the terms of the GNU General Public License as
+ published by the Free Software Foundation; version 2 of the
+ License.
+
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ GNU General Public License for more details.
+
+ You should have received a copy of the GNU General Public License
+ along with this program; if not, write to the Free Software
+ Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA
+ 02110-1301  USA
+
+ $%ENDLICENSE%$ */
+
+/** @file
+ * merge the results of the shards of a cross-shard query
+ *
+ * only the text protocol of COM_QUERY is merged. The ORDER BY compares the values of
+ * numeric columns as numbers and the others byte by byte, which matches binary and
+ * *_bin collations only.
+ */
+
+#include <string.h>
+#include <stdlib.h>
+
+#include <mysqld_error.h>
+
+#include "network-mysqld-proto.h"
+#include "network-mysqld-packet.h"
+#include "network-scatter-merge.h"
+#include "glib-ext.h"
+
+#define C(x) x, sizeof(x) - 1
+#define S(x) x->str, x->len
+
+static void network_scatter_queue_free(GQueue *queue) {
+	GString *packet;
+
+	while ((packet = g_queue_pop_head(queue))) g_string_free(packet, TRUE);
+	g_queue_free(queue);
+}
+
+network_scatter_merge_t *network_scatter_merge_new(guint shards_len, gboolean deprecate_eof) {
+	network_scatter_merge_t *merge;
+	guint i;
+
+	merge = g_new0(network_scatter_merge_t, 1);
+	merge->shards = g_new0(network_scatter_shard_t, shards_len);
+	merge->shards_len = shards_len;
+	merge->deprecate_eof = deprecate_eof;
+	merge->orders = g_ptr_array_new();
+	merge->aggregates = g_array_new(FALSE, TRUE, sizeof(network_scatter_aggregate_t));
+	merge->limit = G_MAXUINT64;
+	merge->packet_id = 1; /* the COM_QUERY was 0 */
+
+	for (i = 0; i < shards_len; i++) {
+		network_scatter_shard_t *shard = &(merge->shards[i]);
+
+		shard->state = NETWORK_SCATTER_SHARD_FIELD_COUNT;
+		shard->header = g_queue_new();
+		shard->fields = network_mysqld_proto_fielddefs_new();
+		shard->rows = g_queue_new();
+	}
+
+	return merge;
+}
+
+void network_scatter_merge_free(network_scatter_merge_t *merge) {
+	guint i;
+
+	if (!merge) return;
+
+	for (i = 0; i < merge->shards_len; i++) {
+		network_scatter_shard_t *shard = &(merge->shards[i]);
+
+		network_scatter_queue_free(shard->header);
+		network_mysqld_proto_fielddefs_free(shard->fields);
+		if (shard->fields_arena) network_mysqld_proto_fielddefs_arena_unref(shard->fields_arena);
+		network_scatter_queue_free(shard->rows);
+
+		if (shard->ok) network_mysqld_ok_packet_free(shard->ok);
+		if (shard->err) g_string_free(shard->err, TRUE);
+	}
+	g_free(merge->shards);
+
+	for (i = 0; i < merge->orders->len; i++) {
+		network_scatter_order_t *order = merge->orders->pdata[i];
+
+		if (order->name) g_string_free(order->name, TRUE);
+		g_free(order);
+	}
+	g_ptr_array_free(merge->orders, TRUE);
+
+	g_array_free(merge->aggregates, TRUE);
+
+	if (merge->aggregated) {
+		for (i = 0; i < merge->aggregated->len; i++) {
+			if (merge->aggregated->pdata[i]) g_string_free(merge->aggregated->pdata[i], TRUE);
+		}
+		g_ptr_array_free(merge->aggregated, TRUE);
+	}
+
+	g_free(merge);
+}
+
+/**
+ * sort the rows by a column
+ *
+ * @param name     the name of the column, NULL to use the position
+ * @param position the position of the column, counts from 1
+ */
+void network_scatter_merge_add_order(network_scatter_merge_t *merge, const char *name, gsize name_len, guint position, gboolean is_desc) {
+	network_scatter_order_t *order;
+
+	order = g_new0(network_scatter_order_t, 1);
+	order->name = name ? g_string_new_len(name, name_len) : NULL;
+	order->position = position;
+	order->is_desc = is_desc;
+
+	g_ptr_array_add(merge->orders, order);
+}
+
+/**
+ * combine the rows of the shards into one row
+ *
+ * the columns without a aggregate get the value of the first shard
+ */
+void network_scatter_merge_set_aggregate(network_scatter_merge_t *merge, guint column, network_scatter_aggregate_t aggregate) {
+	if (column >= merge->aggregates->len) g_array_set_size(merge->aggregates, column + 1);
+
+	g_array_index(merge->aggregates, network_scatter_aggregate_t, column) = aggregate;
+}
+
+void network_scatter_merge_set_limit(network_scatter_merge_t *merge, guint64 limit) {
+	merge->limit = limit;
+}
+
+static GString *network_scatter_err_packet_new(const char *errmsg) {
+	network_mysqld_err_packet_t *err_packet;
+	GString *packet;
+
+	packet = g_string_new(NULL);
+	g_string_append_len(packet, C("\x00\x00\x00\x01")); /* the network-header */
+
+	err_packet = network_mysqld_err_packet_new();
+	err_packet->errcode = ER_UNKNOWN_ERROR;
+	g_string_assign(err_packet->errmsg, errmsg);
+	network_mysqld_proto_append_err_packet(packet, err_packet);
+	network_mysqld_err_packet_free(err_packet);
+
+	network_mysqld_proto_set_packet_len(packet, packet->len - NET_HEADER_SIZE);
+
+	return packet;
+}
+
+static void network_scatter_shard_fail(network_scatter_shard_t *shard, const char *errmsg) {
+	if (!shard->err) shard->err = network_scatter_err_packet_new(errmsg);
+
+	shard->state = NETWORK_SCATTER_SHARD_DONE;
+}
+
+/**
+ * the result of a shard failed without a ERR of the backend, like a broken connection
+ *
+ * a shard whose result is complete already keeps it
+ */
+void network_scatter_merge_add_error(network_scatter_merge_t *merge, guint shard_ndx, const char *errmsg) {
+	network_scatter_shard_t *shard = &(merge->shards[shard_ndx]);
+
+	if (shard->state == NETWORK_SCATTER_SHARD_DONE) return;
+
+	network_scatter_shard_fail(shard, errmsg);
+}
+
+/**
+ * add a packet of the result of a shard
+ *
+ * @param packet the packet with its network-header, owned by the merge from now on
+ */
+void network_scatter_merge_add_packet(network_scatter_merge_t *merge, guint shard_ndx, GString *packet) {
+	network_scatter_shard_t *shard = &(merge->shards[shard_ndx]);
+	network_packet p;
+	guint8 status;
+	int err = 0;
+
+	if (merge->is_finished || shard->state == NETWORK_SCATTER_SHARD_DONE) {
+		g_string_free(packet, TRUE);
+		return;
+	}
+
+	p.data = packet;
+	p.offset = 0;
+
+	if (0 != network_mysqld_proto_skip_network_header(&p) ||
+	    0 != network_mysqld_proto_peek_int8(&p, &status)) {
+		g_string_free(packet, TRUE);
+		network_scatter_shard_fail(shard, "(proxy) a shard sent a empty packet");
+		return;
+	}
+
+	if (status == MYSQLD_PACKET_ERR) {
+		shard->err = packet;
+		shard->state = NETWORK_SCATTER_SHARD_DONE;
+		return;
+	}
+
+	switch (shard->state) {
+	case NETWORK_SCATTER_SHARD_FIELD_COUNT:
+		if (status == MYSQLD_PACKET_OK) {
+			shard->ok = network_mysqld_ok_packet_new();
+			err = err || network_mysqld_proto_get_ok_packet(&p, shard->ok);
+
+			if (!err) {
+				shard->server_status = shard->ok->server_status;
+				shard->warnings = shard->ok->warnings;
+			}
+
+			g_string_free(packet, TRUE);
+			shard->state = NETWORK_SCATTER_SHARD_DONE;
+			break;
+		}
+
+		/* a LOCAL INFILE request isn't a field-count */
+		err = err || (status == MYSQLD_PACKET_NULL);
+		err = err || network_mysqld_proto_get_lenenc_int(&p, &shard->field_count);
+		err = err || (shard->field_count == 0);
+
+		/* about 64 bytes for the names of a field, the arena grows if they need more */
+		if (!err) shard->fields_arena = network_mysqld_proto_fielddefs_arena_new(MIN(shard->field_count, 1024) * (sizeof(network_mysqld_proto_fielddef_t) + 64));
+
+		g_queue_push_tail(shard->header, packet);
+		shard->state = NETWORK_SCATTER_SHARD_FIELDS;
+		break;
+	case NETWORK_SCATTER_SHARD_FIELDS: {
+		network_mysqld_proto_fielddef_t *field = network_mysqld_proto_fielddef_new_in(shard->fields_arena);
+
+		err = err || network_mysqld_proto_get_fielddef(&p, field, CLIENT_PROTOCOL_41);
+		g_ptr_array_add(shard->fields, field); /* even if we had an error, append it so that we can free it later */
+
+		g_queue_push_tail(shard->header, packet);
+
+		if (shard->fields->len == shard->field_count) {
+			shard->state = merge->deprecate_eof ? NETWORK_SCATTER_SHARD_ROWS : NETWORK_SCATTER_SHARD_FIELDS_EOF;
+		}
+		break; }
+	case NETWORK_SCATTER_SHARD_FIELDS_EOF:
+		err = err || (status != MYSQLD_PACKET_EOF);
+
+		g_queue_push_tail(shard->header, packet);
+		shard->state = NETWORK_SCATTER_SHARD_ROWS;
+		break;
+	case NETWORK_SCATTER_SHARD_ROWS:
+		/* a row may start with 0xfe too if its first value is longer than 16M */
+		if (status == MYSQLD_PACKET_EOF &&
+		    packet->len - NET_HEADER_SIZE < (merge->deprecate_eof ? PACKET_LEN_MAX : 9)) {
+			if (merge->deprecate_eof) {
+				network_mysqld_ok_packet_t *ok_packet = network_mysqld_ok_packet_new();
+
+				err = err || network_mysqld_proto_get_eof_ok_packet(&p, ok_packet);
+				if (!err) {
+					shard->server_status = ok_packet->server_status;
+					shard->warnings = ok_packet->warnings;
+				}
+				network_mysqld_ok_packet_free(ok_packet);
+			} else {
+				network_mysqld_eof_packet_t *eof_packet = network_mysqld_eof_packet_new();
+
+				err = err || network_mysqld_proto_get_eof_packet(&p, eof_packet);
+				if (!err) {
+					shard->server_status = eof_packet->server_status;
+					shard->warnings = eof_packet->warnings;
+				}
+				network_mysqld_eof_packet_free(eof_packet);
+			}
+
+			g_string_free(packet, TRUE);
+			shard->state = NETWORK_SCATTER_SHARD_DONE;
+			break;
+		}
+
+		g_queue_push_tail(shard->rows, packet);
+		break;
+	case NETWORK_SCATTER_SHARD_DONE:
+		g_assert_not_reached();
+	}
+
+	if (err) network_scatter_shard_fail(shard, "(proxy) a shard sent a result we can't merge");
+}
+
+/**
+ * get a value of a text row
+ *
+ * @return 1 if the column has a value, 0 for NULL, -1 if the row is too short
+ */
+static int network_scatter_row_get_value(GString *row, guint column, const char **value, gsize *value_len) {
+	gsize offset = NET_HEADER_SIZE;
+	guint i;
+
+	for (i = 0; ; i++) {
+		guint64 len;
+		guchar c;
+
+		if (offset >= row->len) return -1;
+
+		c = row->str[offset++];
+
+		if (c == MYSQLD_PACKET_NULL) {
+			if (i == column) return 0;
+			continue;
+		}
+
+		if (c < 0xfb) {
+			len = c;
+		} else {
+			gsize len_bytes = (c == 0xfc) ? 2 : (c == 0xfd) ? 3 : 8;
+			gsize j;
+
+			if (offset + len_bytes > row->len) return -1;
+
+			for (len = 0, j = 0; j < len_bytes; j++) {
+				len |= (guint64)(guchar)row->str[offset + j] << (8 * j);
+			}
+			offset += len_bytes;
+		}
+
+		if (len > row->len - offset) return -1;
+
+		if (i == column) {
+			*value = row->str + offset;
+			*value_len = len;
+
+			return 1;
+		}
+
+		offset += len;
+	}
+}
+
+static gdouble network_scatter_value_to_double(const char *value, gsize value_len) {
+	gchar buf[64];
+	gchar *str;
+	gdouble d;
+
+	if (value_len < sizeof(buf)) {
+		memcpy(buf, value, value_len);
+		buf[value_len] = '\0';
+
+		return g_ascii_strtod(buf, NULL);
+	}
+
+	str = g_strndup(value, value_len);
+	d = g_ascii_strtod(str, NULL);
+	g_free(str);
+
+	return d;
+}
+
+static gint network_scatter_value_cmp(const char *a, gsize a_len, const char *b, gsize b_len, gboolean is_numeric) {
+	int r;
+
+	if (is_numeric) {
+		gdouble a_d = network_scatter_value_to_double(a, a_len);
+		gdouble b_d = network_scatter_value_to_double(b, b_len);
+
+		return (a_d < b_d) ? -1 : (a_d > b_d) ? 1 : 0;
+	}
+
+	if (0 != (r = memcmp(a, b, MIN(a_len, b_len)))) return r;
+
+	return (a_len < b_len) ? -1 : (a_len > b_len) ? 1 : 0;
+}
+
+/**
+ * compare two rows by the ORDER BY, NULLs come first like in MySQL
+ */
+static gint network_scatter_row_cmp(network_scatter_merge_t *merge, GString *a, GString *b) {
+	guint i;
+
+	for (i = 0; i < merge->orders->len; i++) {
+		network_scatter_order_t *order = merge->orders->pdata[i];
+		const char *a_value = NULL, *b_value = NULL;
+		gsize a_len = 0, b_len = 0;
+		gboolean a_is_null, b_is_null;
+		gint r;
+
+		a_is_null = (1 != network_scatter_row_get_value(a, order->column, &a_value, &a_len));
+		b_is_null = (1 != network_scatter_row_get_value(b, order->column, &b_value, &b_len));
+
+		if (a_is_null || b_is_null) {
+			r = (a_is_null == b_is_null) ? 0 : a_is_null ? -1 : 1;
+		} else {
+			r = network_scatter_value_cmp(a_value, a_len, b_value, b_len, order->is_numeric);
+		}
+
+		if (r != 0) return order->is_desc ? -r : r;
+	}
+
+	return 0;
+}
+
+/**
+ * parse a plain decimal like -12.50
+ *
+ * @return FALSE if it has a exponent or more than 18 digits
+ */
+static gboolean network_scatter_decimal_parse(const char *s, gsize len, gint64 *mantissa, guint *scale) {
+	gboolean is_negative = FALSE;
+	gboolean has_point = FALSE;
+	guint digits = 0;
+	gsize i = 0;
+
+	*mantissa = 0;
+	*scale = 0;
+
+	if (len > 0 && (s[0] == '-' || s[0] == '+')) {
+		is_negative = (s[0] == '-');
+		i++;
+	}
+
+	for (; i < len; i++) {
+		if (s[i] == '.' && !has_point) {
+			has_point = TRUE;
+			continue;
+		}
+
+		if (!g_ascii_isdigit(s[i]) || ++digits > 18) return FALSE;
+
+		*mantissa = *mantissa * 10 + (s[i] - '0');
+		if (has_point) (*scale)++;
+	}
+
+	if (digits == 0) return FALSE;
+
+	if (is_negative) *mantissa = -*mantissa;
+
+	return TRUE;
+}
+
+static gboolean network_scatter_decimal_rescale(gint64 *mantissa, guint from_scale, guint to_scale) {
+	for (; from_scale < to_scale; from_scale++) {
+		if (*mantissa > G_MAXINT64 / 10 || *mantissa < G_MININT64 / 10) return FALSE;
+
+		*mantissa *= 10;
+	}
+
+	return TRUE;
+}
+
+/**
+ * add a value to the sum
+ *
+ * integers and decimals are added exactly, everything else as double
+ */
+static void network_scatter_value_add(GString *sum, const char *value, gsize value_len) {
+	gint64 a, b;
+	guint a_scale, b_scale, scale;
+
+	if (network_scatter_decimal_parse(S(sum), &a, &a_scale) &&
+	    network_scatter_decimal_parse(value, value_len, &b, &b_scale) &&
+	    network_scatter_decimal_rescale(&a, a_scale, (scale = MAX(a_scale, b_scale))) &&
+	    network_scatter_decimal_rescale(&b, b_scale, scale) &&
+	    !(b > 0 && a > G_MAXINT64 - b) &&
+	    !(b < 0 && a < G_MININT64 - b)) {
+		guint64 abs_sum;
+		guint64 pow10 = 1;
+		guint i;
+
+		a += b;
+		abs_sum = (a < 0) ? -(guint64)a : (guint64)a;
+
+		for (i = 0; i < scale; i++) pow10 *= 10;
+
+		g_string_printf(sum, "%s%"G_GUINT64_FORMAT, a < 0 ? "-" : "", abs_sum / pow10);
+		if (scale > 0) {
+			g_string_append_printf(sum, ".%0*"G_GUINT64_FORMAT, scale, abs_sum % pow10);
+		}
+	} else {
+		gchar buf[G_ASCII_DTOSTR_BUF_SIZE];
+
+		g_ascii_formatd(buf, sizeof(buf), "%.17g",
+				network_scatter_value_to_double(S(sum)) + network_scatter_value_to_double(value, value_len));
+		g_string_assign(sum, buf);
+	}
+}
+
+static gboolean network_scatter_field_is_numeric(network_mysqld_proto_fielddef_t *field) {
+	return IS_NUM(field->type);
+}
+
+/**
+ * fold a row into the aggregated row
+ */
+static void network_scatter_merge_aggregate(network_scatter_merge_t *merge, GString *row) {
+	guint i;
+
+	if (NULL == merge->aggregated) {
+		merge->aggregated = g_ptr_array_new();
+		g_ptr_array_set_size(merge->aggregated, merge->first->fields->len);
+	}
+
+	for (i = 0; i < merge->aggregated->len; i++) {
+		network_scatter_aggregate_t aggregate = NETWORK_SCATTER_AGGREGATE_FIRST;
+		GString *cur = merge->aggregated->pdata[i];
+		const char *value;
+		gsize value_len;
+		gint r;
+
+		if (i < merge->aggregates->len) aggregate = g_array_index(merge->aggregates, network_scatter_aggregate_t, i);
+
+		/* NULLs don't count, the value of the first shard may be NULL though */
+		if (1 != network_scatter_row_get_value(row, i, &value, &value_len)) continue;
+
+		if (NULL == cur) {
+			if (!merge->has_aggregated || aggregate != NETWORK_SCATTER_AGGREGATE_FIRST) {
+				merge->aggregated->pdata[i] = g_string_new_len(value, value_len);
+			}
+			continue;
+		}
+
+		switch (aggregate) {
+		case NETWORK_SCATTER_AGGREGATE_FIRST:
+			break;
+		case NETWORK_SCATTER_AGGREGATE_SUM:
+			network_scatter_value_add(cur, value, value_len);
+			break;
+		case NETWORK_SCATTER_AGGREGATE_MIN:
+		case NETWORK_SCATTER_AGGREGATE_MAX:
+			r = network_scatter_value_cmp(value, value_len, S(cur),
+					network_scatter_field_is_numeric(merge->first->fields->pdata[i]));
+
+			if ((aggregate == NETWORK_SCATTER_AGGREGATE_MIN && r < 0) ||
+			    (aggregate == NETWORK_SCATTER_AGGREGATE_MAX && r > 0)) {
+				g_string_assign_len(cur, value, value_len);
+			}
+			break;
+		}
+	}
+
+	merge->has_aggregated = TRUE;
+}
+
+static void network_scatter_merge_emit(network_scatter_merge_t *merge, GQueue *packets, GString *packet) {
+	network_mysqld_proto_set_packet_id(packet, merge->packet_id++);
+
+	g_queue_push_tail(packets, packet);
+}
+
+/**
+ * end the merged result with a ERR
+ */
+static void network_scatter_merge_emit_error(network_scatter_merge_t *merge, GQueue *packets, const char *errmsg) {
+	network_scatter_merge_emit(merge, packets, network_scatter_err_packet_new(errmsg));
+
+	merge->is_finished = TRUE;
+}
+
+static GString *network_scatter_packet_new(void) {
+	return g_string_new_len(C("\x00\x00\x00\x00")); /* the network-header */
+}
+
+static void network_scatter_packet_finish(GString *packet) {
+	network_mysqld_proto_set_packet_len(packet, packet->len - NET_HEADER_SIZE);
+}
+
+/**
+ * the status of the merged result
+ *
+ * the server-status of the first shard that has one, the warnings of all shards
+ */
+static void network_scatter_merge_get_status(network_scatter_merge_t *merge, guint16 *server_status, guint16 *warnings) {
+	gboolean has_status = FALSE;
+	guint i;
+
+	*server_status = SERVER_STATUS_AUTOCOMMIT;
+	*warnings = 0;
+
+	for (i = 0; i < merge->shards_len; i++) {
+		network_scatter_shard_t *shard = &(merge->shards[i]);
+
+		if (shard->state != NETWORK_SCATTER_SHARD_DONE) continue;
+
+		if (!has_status) {
+			*server_status = shard->server_status & ~SERVER_MORE_RESULTS_EXISTS;
+			has_status = TRUE;
+		}
+		*warnings = MIN(G_MAXUINT16, *warnings + shard->warnings);
+	}
+}
+
+/**
+ * end the rows with a EOF, or the OK that replaces it
+ */
+static void network_scatter_merge_emit_end(network_scatter_merge_t *merge, GQueue *packets) {
+	GString *packet = network_scatter_packet_new();
+	guint16 server_status, warnings;
+
+	network_scatter_merge_get_status(merge, &server_status, &warnings);
+
+	if (merge->deprecate_eof) {
+		network_mysqld_proto_append_int8(packet, MYSQLD_PACKET_EOF);
+		network_mysqld_proto_append_lenenc_int(packet, 0); /* affected rows */
+		network_mysqld_proto_append_lenenc_int(packet, 0); /* insert-id */
+		network_mysqld_proto_append_int16(packet, server_status);
+		network_mysqld_proto_append_int16(packet, warnings);
+	} else {
+		network_mysqld_eof_packet_t *eof_packet = network_mysqld_eof_packet_new();
+
+		eof_packet->server_status = server_status;
+		eof_packet->warnings = warnings;
+		network_mysqld_proto_append_eof_packet(packet, eof_packet);
+		network_mysqld_eof_packet_free(eof_packet);
+	}
+	network_scatter_packet_finish(packet);
+
+	network_scatter_merge_emit(merge, packets, packet);
+
+	merge->is_finished = TRUE;
+}
+
+/**
+ * the shards had no result-set, add up their OKs
+ */
+static void network_scatter_merge_emit_ok(network_scatter_merge_t *merge, GQueue *packets) {
+	network_mysqld_ok_packet_t *ok_packet = network_mysqld_ok_packet_new();
+	GString *packet = network_scatter_packet_new();
+	guint i;
+
+	for (i = 0; i < merge->shards_len; i++) {
+		ok_packet->affected_rows += merge->shards[i].ok->affected_rows;
+	}
+	network_scatter_merge_get_status(merge, &ok_packet->server_status, &ok_packet->warnings);
+
+	network_mysqld_proto_append_ok_packet(packet, ok_packet);
+	network_mysqld_ok_packet_free(ok_packet);
+	network_scatter_packet_finish(packet);
+
+	network_scatter_merge_emit(merge, packets, packet);
+
+	merge->is_finished = TRUE;
+}
+
+/**
+ * check that all shards sent the same fields and find the columns of the ORDER BY
+ *
+ * @return NULL on success, the error otherwise
+ */
+static const char *network_scatter_merge_check_fields(network_scatter_merge_t *merge) {
+	network_mysqld_proto_fielddefs_t *fields = merge->first->fields;
+	guint i, j;
+
+	for (i = 0; i < merge->shards_len; i++) {
+		network_scatter_shard_t *shard = &(merge->shards[i]);
+
+		if (shard->fields->len != fields->len) return "(proxy) the shards sent different fields";
+
+		for (j = 0; j < fields->len; j++) {
+			network_mysqld_proto_fielddef_t *a = fields->pdata[j];
+			network_mysqld_proto_fielddef_t *b = shard->fields->pdata[j];
+
+			if (a->type != b->type ||
+			    0 != g_strcmp0(a->name, b->name)) {
+				return "(proxy) the shards sent different fields";
+			}
+		}
+	}
+
+	for (i = 0; i < merge->orders->len; i++) {
+		network_scatter_order_t *order = merge->orders->pdata[i];
+
+		if (order->name) {
+			for (j = 0; j < fields->len; j++) {
+				network_mysqld_proto_fielddef_t *field = fields->pdata[j];
+
+				if (field->name && 0 == g_ascii_strcasecmp(field->name, order->name->str)) break;
+			}
+		} else {
+			j = order->position - 1;
+		}
+
+		if (j >= fields->len) return "(proxy) the columns of the ORDER BY of a cross-shard query have to be in the result";
+
+		order->column = j;
+		order->is_numeric = network_scatter_field_is_numeric(fields->pdata[j]);
+	}
+
+	if (merge->aggregates->len > fields->len) return "(proxy) the shards sent less fields than expected";
+
+	return NULL;
+}
+
+static void network_scatter_merge_emit_aggregated(network_scatter_merge_t *merge, GQueue *packets) {
+	GString *packet = network_scatter_packet_new();
+	guint i;
+
+	for (i = 0; i < merge->aggregated->len; i++) {
+		GString *value = merge->aggregated->pdata[i];
+
+		if (value) {
+			network_mysqld_proto_append_lenenc_string_len(packet, S(value));
+		} else {
+			network_mysqld_proto_append_lenenc_string_len(packet, NULL, 0);
+		}
+	}
+	network_scatter_packet_finish(packet);
+
+	network_scatter_merge_emit(merge, packets, packet);
+	merge->rows_sent++;
+}
+
+/**
+ * take the merged packets that are known by now
+ *
+ * @param packets gets the packets with their network-headers
+ */
+void network_scatter_merge_get_packets(network_scatter_merge_t *merge, GQueue *packets) {
+	gboolean is_all_done = TRUE;
+	guint oks = 0;
+	guint i;
+
+	if (merge->is_finished) return;
+
+	for (i = 0; i < merge->shards_len; i++) {
+		network_scatter_shard_t *shard = &(merge->shards[i]);
+
+		if (shard->err) {
+			network_scatter_merge_emit(merge, packets, shard->err);
+			shard->err = NULL;
+			merge->is_finished = TRUE;
+
+			return;
+		}
+
+		if (shard->state != NETWORK_SCATTER_SHARD_DONE) is_all_done = FALSE;
+		if (shard->ok) oks++;
+	}
+
+	if (!merge->header_is_sent) {
+		const char *errmsg;
+		GString *packet;
+
+		for (i = 0; i < merge->shards_len; i++) {
+			if (merge->shards[i].state < NETWORK_SCATTER_SHARD_ROWS) return;
+		}
+
+		if (oks == merge->shards_len) {
+			network_scatter_merge_emit_ok(merge, packets);
+			return;
+		} else if (oks > 0) {
+			network_scatter_merge_emit_error(merge, packets, "(proxy) some shards sent a result-set, others didn't");
+			return;
+		}
+
+		merge->first = &(merge->shards[0]);
+
+		if (NULL != (errmsg = network_scatter_merge_check_fields(merge))) {
+			network_scatter_merge_emit_error(merge, packets, errmsg);
+			return;
+		}
+
+		while ((packet = g_queue_pop_head(merge->first->header))) {
+			network_scatter_merge_emit(merge, packets, packet);
+		}
+		merge->header_is_sent = TRUE;
+	}
+
+	if (merge->aggregates->len > 0) {
+		for (i = 0; i < merge->shards_len; i++) {
+			GString *row;
+
+			while ((row = g_queue_pop_head(merge->shards[i].rows))) {
+				network_scatter_merge_aggregate(merge, row);
+				g_string_free(row, TRUE);
+			}
+		}
+
+		if (!is_all_done) return;
+
+		if (merge->has_aggregated && merge->limit > 0) network_scatter_merge_emit_aggregated(merge, packets);
+
+		network_scatter_merge_emit_end(merge, packets);
+		return;
+	}
+
+	if (merge->orders->len == 0) {
+		/* the rows of the shards in the order they arrive */
+		for (i = 0; i < merge->shards_len && merge->rows_sent < merge->limit; i++) {
+			GQueue *rows = merge->shards[i].rows;
+
+			while (rows->length > 0 && merge->rows_sent < merge->limit) {
+				network_scatter_merge_emit(merge, packets, g_queue_pop_head(rows));
+				merge->rows_sent++;
+			}
+		}
+	} else {
+		/* the smallest row, once we know the next row of each shard */
+		while (merge->rows_sent < merge->limit) {
+			network_scatter_shard_t *min_shard = NULL;
+
+			for (i = 0; i < merge->shards_len; i++) {
+				network_scatter_shard_t *shard = &(merge->shards[i]);
+
+				if (shard->rows->length == 0) {
+					if (shard->state != NETWORK_SCATTER_SHARD_DONE) return;
+
+					continue;
+				}
+
+				if (NULL == min_shard ||
+				    network_scatter_row_cmp(merge, g_queue_peek_head(shard->rows), g_queue_peek_head(min_shard->rows)) < 0) {
+					min_shard = shard;
+				}
+			}
+
+			if (NULL == min_shard) break;
+
+			network_scatter_merge_emit(merge, packets, g_queue_pop_head(min_shard->rows));
+			merge->rows_sent++;
+		}
+	}
+
+	if (merge->rows_sent >= merge->limit) {
+		network_scatter_merge_emit_end(merge, packets);
+		return;
+	}
+
+	if (!is_all_done) return;
+
+	for (i = 0; i < merge->shards_len; i++) {
+		if (merge->shards[i].rows->length > 0) return;
+	}
+
+	network_scatter_merge_emit_end(merge, packets);
+}
+
+/**
+ * the merged result is complete
+ *
+ * the packets the shards send from now on are dropped
+ */
+gboolean network_scatter_merge_is_finished(network_scatter_merge_t *merge) {
+	return merge->is_finished;
+}
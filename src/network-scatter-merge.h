@@ -0,0 +1,119 @@
+/* $%BEGINLICENSE%$
+ Copyright (c) 2008, 2012, Oracle and/or its affiliates. All rights reserved.
+
+ This program is free software; you can redistribute it and/or
+ modify it under the terms of the GNU General Public License as
+ published by the Free Software Foundation; version 2 of the
+ License.
+
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ GNU General Public License for more details.
+
+ You should have received a copy of the GNU General Public License
+ along with this program; if not, write to the Free Software
+ Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA
+ 02110-1301  USA
+
+ $%ENDLICENSE%$ */
+#ifndef __NETWORK_SCATTER_MERGE_H__
+#define __NETWORK_SCATTER_MERGE_H__
+
+#include <glib.h>
+
+#include "network-mysqld-proto.h"
+
+#include "network-exports.h"
+
+/**
+ * how the values of a column of the shards are combined into one row
+ */
+typedef enum {
+	NETWORK_SCATTER_AGGREGATE_FIRST,   /**< the value of the first shard */
+	NETWORK_SCATTER_AGGREGATE_SUM,     /**< COUNT() and SUM(), NULLs are skipped */
+	NETWORK_SCATTER_AGGREGATE_MIN,
+	NETWORK_SCATTER_AGGREGATE_MAX
+} network_scatter_aggregate_t;
+
+typedef enum {
+	NETWORK_SCATTER_SHARD_FIELD_COUNT, /**< waits for the first packet of the result */
+	NETWORK_SCATTER_SHARD_FIELDS,
+	NETWORK_SCATTER_SHARD_FIELDS_EOF,
+	NETWORK_SCATTER_SHARD_ROWS,
+	NETWORK_SCATTER_SHARD_DONE         /**< the result is complete */
+} network_scatter_shard_state_t;
+
+typedef struct {
+	network_scatter_shard_state_t state;
+
+	GQueue *header;                    /**< the packets of the field-count and the fields */
+	network_mysqld_proto_fielddefs_t *fields;
+	network_mysqld_proto_fielddefs_arena_t *fields_arena; /**< the fields are parsed into it, NULL until the field-count is known */
+	guint64 field_count;
+
+	GQueue *rows;                      /**< the rows that aren't merged yet */
+
+	network_mysqld_ok_packet_t *ok;    /**< the OK of a result without a result-set */
+	GString *err;                      /**< the ERR packet of the shard */
+
+	guint16 server_status;
+	guint16 warnings;
+} network_scatter_shard_t;
+
+typedef struct {
+	GString *name;                     /**< the column of the ORDER BY, NULL if it is a position */
+	guint position;                    /**< ORDER BY <n>, counts from 1 */
+	gboolean is_desc;
+
+	guint column;                      /**< the index of the column, once the fields are known */
+	gboolean is_numeric;
+} network_scatter_order_t;
+
+/**
+ * merges the text results of the same query from several shards into one result
+ *
+ * the packets of the shards are added as they arrive, the merged packets can be
+ * taken as soon as they are known:
+ *
+ * - the fields once all shards sent theirs, they have to be the same
+ * - without ORDER BY the rows of all shards as they arrive
+ * - with ORDER BY the smallest row once each shard has a row or is done
+ * - with aggregates a single row once all shards are done
+ * - the OKs of results without a result-set add up their affected rows
+ *
+ * a ERR of a shard ends the merged result with that ERR.
+ */
+typedef struct {
+	network_scatter_shard_t *shards;
+	guint shards_len;
+
+	gboolean deprecate_eof;            /**< CLIENT_DEPRECATE_EOF: no EOF after the fields, a OK ends the rows */
+
+	GPtrArray *orders;                 /**< network_scatter_order_t */
+	GArray *aggregates;                /**< network_scatter_aggregate_t per column, empty if the rows aren't aggregated */
+	guint64 limit;                     /**< send at most this many rows, G_MAXUINT64 for all */
+
+	network_scatter_shard_t *first;    /**< the shard whose fields we send */
+	GPtrArray *aggregated;             /**< the values of the aggregated row, NULL for SQL NULL */
+	gboolean has_aggregated;           /**< a shard sent a row */
+
+	gboolean header_is_sent;
+	gboolean is_finished;              /**< the merged result is complete, the packets of the shards are dropped */
+	guint64 rows_sent;
+	guint8 packet_id;                  /**< the packet-id of the next merged packet */
+} network_scatter_merge_t;
+
+NETWORK_API network_scatter_merge_t *network_scatter_merge_new(guint shards_len, gboolean deprecate_eof);
+NETWORK_API void network_scatter_merge_free(network_scatter_merge_t *merge);
+
+NETWORK_API void network_scatter_merge_add_order(network_scatter_merge_t *merge, const char *name, gsize name_len, guint position, gboolean is_desc);
+NETWORK_API void network_scatter_merge_set_aggregate(network_scatter_merge_t *merge, guint column, network_scatter_aggregate_t aggregate);
+NETWORK_API void network_scatter_merge_set_limit(network_scatter_merge_t *merge, guint64 limit);
+
+NETWORK_API void network_scatter_merge_add_packet(network_scatter_merge_t *merge, guint shard_ndx, GString *packet);
+NETWORK_API void network_scatter_merge_add_error(network_scatter_merge_t *merge, guint shard_ndx, const char *errmsg);
+NETWORK_API void network_scatter_merge_get_packets(network_scatter_merge_t *merge, GQueue *packets);
+NETWORK_API gboolean network_scatter_merge_is_finished(network_scatter_merge_t *merge);
+
+#endif
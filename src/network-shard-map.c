@@ -0,0 +1,1041 @@
+/* $%BEGINLICENSE%$
+ Copyright (c) 2008, 2012, Oracle and/or its affiliates. All rights reserved.
+
+ This program is free software; you can redistribute it and/or
+ modify it under the terms of the GNU General Public License as
+ published by the Free Software Foundation; version 2 of the
+ License.
+
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ GNU General Public License for more details.
+
+ You should have received a copy of the GNU General Public License
+ along with this program; if not, write to the Free Software
+ Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA
+ 02110-1301  USA
+
+ $%ENDLICENSE%$ */
+
+/** @file
+ * the shard map of --proxy-shard-map-file
+ *
+ * the file names the key column and the method once and lists the backends of each shard:
+ *
+ *   key customer_id hash
+ *   shard 0 10.0.1.1:3306,10.0.1.2:3306
+ *   shard 1 10.0.2.1:3306
+ *
+ * the hash shards are numbered from 0, a key goes to the shard CRC32(key) % shards. With
+ * "range" the number is the first key of the shard instead. The backends are written like
+ * in --proxy-backend-addresses. Empty lines and lines starting with a # are ignored.
+ *
+ * the key of a query is taken from a "<key> = <literal>" in the WHERE clause and from the
+ * column list and VALUES of a INSERT or REPLACE. Queries we can't route to one shard, like
+ * a OR in the WHERE clause or rows of several keys, have no key.
+ *
+ * the optional "table <name>[,<name>...]" lines list the sharded tables. A query on them
+ * without a key is sent to all shards and their results are merged, see
+ * network_shard_map_plan_scatter().
+ */
+
+#include <string.h>
+#include <stdlib.h>
+
+#include "network-mysqld-crc32.h"
+#include "network-scatter-merge.h"
+#include "network-shard-map.h"
+
+GQuark network_shard_map_error(void) {
+	return g_quark_from_static_string("network-shard-map-error-quark");
+}
+
+static void network_shard_free(network_shard_t *shard) {
+	g_strfreev(shard->backends);
+
+	g_free(shard);
+}
+
+network_shard_map_t *network_shard_map_new(void) {
+	network_shard_map_t *map;
+
+	map = g_new0(network_shard_map_t, 1);
+	map->shards = g_ptr_array_new();
+	map->tables = g_ptr_array_new();
+
+	return map;
+}
+
+void network_shard_map_free(network_shard_map_t *map) {
+	guint i;
+
+	if (!map) return;
+
+	for (i = 0; i < map->shards->len; i++) {
+		network_shard_free(map->shards->pdata[i]);
+	}
+	g_ptr_array_free(map->shards, TRUE);
+
+	for (i = 0; i < map->tables->len; i++) {
+		g_string_free(map->tables->pdata[i], TRUE);
+	}
+	g_ptr_array_free(map->tables, TRUE);
+
+	if (map->key) g_string_free(map->key, TRUE);
+
+	g_free(map);
+}
+
+static gint network_shard_cmp(gconstpointer _a, gconstpointer _b) {
+	const network_shard_t *a = *(const network_shard_t **)_a;
+	const network_shard_t *b = *(const network_shard_t **)_b;
+
+	if (a->first_key < b->first_key) return -1;
+	if (a->first_key > b->first_key) return 1;
+
+	return 0;
+}
+
+/**
+ * parse a integer that fills the whole string
+ */
+static gboolean network_shard_map_parse_int(const gchar *str, gint64 *value) {
+	gchar *str_end = NULL;
+
+	if (*str == '\0') return FALSE;
+
+	*value = g_ascii_strtoll(str, &str_end, 10);
+
+	return *str_end == '\0';
+}
+
+/**
+ * split a line at the whitespace
+ */
+static gchar **network_shard_map_split(gchar *line) {
+	gchar **fields = g_strsplit_set(line, " \t", -1);
+	guint i, j;
+
+	/* drop the empty fields between multiple spaces */
+	for (i = 0, j = 0; fields[i]; i++) {
+		if (fields[i][0] == '\0') {
+			g_free(fields[i]);
+		} else {
+			fields[j++] = fields[i];
+		}
+	}
+	fields[j] = NULL;
+
+	return fields;
+}
+
+static int network_shard_map_add_line(network_shard_map_t *map, gchar **fields) {
+	network_shard_t *shard;
+	gint64 first_key;
+	guint i;
+
+	if (0 == g_ascii_strcasecmp(fields[0], "key")) {
+		if (map->key ||
+		    NULL == fields[1] ||
+		    NULL == fields[2] ||
+		    NULL != fields[3]) {
+			return -1;
+		}
+
+		if (0 == g_ascii_strcasecmp(fields[2], "hash")) {
+			map->method = NETWORK_SHARD_MAP_HASH;
+		} else if (0 == g_ascii_strcasecmp(fields[2], "range")) {
+			map->method = NETWORK_SHARD_MAP_RANGE;
+		} else {
+			return -1;
+		}
+
+		map->key = g_string_new(fields[1]);
+		g_string_ascii_down(map->key);
+
+		return 0;
+	}
+
+	if (0 == g_ascii_strcasecmp(fields[0], "table")) {
+		gchar **tables;
+
+		if (NULL == fields[1] ||
+		    NULL != fields[2]) {
+			return -1;
+		}
+
+		tables = g_strsplit(fields[1], ",", -1);
+		for (i = 0; tables[i]; i++) {
+			GString *table;
+
+			if (tables[i][0] == '\0') continue;
+
+			table = g_string_new(tables[i]);
+			g_string_ascii_down(table);
+			g_ptr_array_add(map->tables, table);
+		}
+		g_strfreev(tables);
+
+		return 0;
+	}
+
+	if (0 != g_ascii_strcasecmp(fields[0], "shard") ||
+	    NULL == fields[1] ||
+	    NULL == fields[2] ||
+	    NULL != fields[3] ||
+	    !network_shard_map_parse_int(fields[1], &first_key)) {
+		return -1;
+	}
+
+	shard = g_new0(network_shard_t, 1);
+	shard->first_key = first_key;
+	shard->backends = g_strsplit(fields[2], ",", -1);
+
+	g_ptr_array_add(map->shards, shard);
+
+	for (i = 0; shard->backends[i]; i++) {
+		if (shard->backends[i][0] == '\0') return -1;
+	}
+
+	return 0;
+}
+
+/**
+ * load the shard map from a file
+ *
+ * @return 0 on success, -1 on error
+ */
+int network_shard_map_load(network_shard_map_t *map, const gchar *filename, GError **gerr) {
+	GError *read_gerr = NULL;
+	gchar *contents;
+	gchar **lines;
+	int ret = 0;
+	guint i;
+
+	if (!g_file_get_contents(filename, &contents, NULL, &read_gerr)) {
+		g_set_error(gerr, NETWORK_SHARD_MAP_ERROR, NETWORK_SHARD_MAP_ERROR_READ,
+				"reading %s failed: %s",
+				filename,
+				read_gerr->message);
+		g_error_free(read_gerr);
+
+		return -1;
+	}
+
+	lines = g_strsplit(contents, "\n", -1);
+	for (i = 0; lines[i] && ret == 0; i++) {
+		gchar *line = g_strstrip(lines[i]);
+		gchar **fields;
+
+		if (line[0] == '\0' || line[0] == '#') continue;
+
+		fields = network_shard_map_split(line);
+
+		if (0 != network_shard_map_add_line(map, fields)) {
+			g_set_error(gerr, NETWORK_SHARD_MAP_ERROR, NETWORK_SHARD_MAP_ERROR_PARSE,
+					"%s:%u: expected \"key <column> hash|range\" once, \"table <name>[,<name>...]\" or \"shard <n> <backend>[,<backend>...]\"",
+					filename, i + 1);
+
+			ret = -1;
+		}
+
+		g_strfreev(fields);
+	}
+	g_strfreev(lines);
+	g_free(contents);
+
+	if (ret != 0) return ret;
+
+	if (NULL == map->key || 0 == map->shards->len) {
+		g_set_error(gerr, NETWORK_SHARD_MAP_ERROR, NETWORK_SHARD_MAP_ERROR_PARSE,
+				"%s: expected a key and at least one shard",
+				filename);
+
+		return -1;
+	}
+
+	g_ptr_array_sort(map->shards, network_shard_cmp);
+
+	for (i = 0; i < map->shards->len; i++) {
+		network_shard_t *shard = map->shards->pdata[i];
+
+		if ((map->method == NETWORK_SHARD_MAP_HASH && shard->first_key != i) ||
+		    (i > 0 && shard->first_key == ((network_shard_t *)map->shards->pdata[i - 1])->first_key)) {
+			g_set_error(gerr, NETWORK_SHARD_MAP_ERROR, NETWORK_SHARD_MAP_ERROR_PARSE,
+					"%s: shard %"G_GINT64_FORMAT" is a duplicate or out of order, hash shards are numbered from 0 to <shards> - 1",
+					filename, shard->first_key);
+
+			return -1;
+		}
+	}
+
+	return 0;
+}
+
+typedef enum {
+	SHARD_TOKEN_END,
+	SHARD_TOKEN_WORD,                  /* keywords and identifiers, without the backticks */
+	SHARD_TOKEN_NUMBER,
+	SHARD_TOKEN_STRING,                /* without the quotes */
+	SHARD_TOKEN_CHAR                   /* everything else, one char per token */
+} shard_token_type_t;
+
+typedef struct {
+	shard_token_type_t type;
+
+	const char *str;
+	gsize len;
+} shard_token_t;
+
+#define SHARD_TOKEN_IS_WORD(tok, word) \
+	((tok)->type == SHARD_TOKEN_WORD && \
+	 (tok)->len == sizeof(word) - 1 && \
+	 0 == g_ascii_strncasecmp((tok)->str, word, (tok)->len))
+#define SHARD_TOKEN_IS_CHAR(tok, c) \
+	((tok)->type == SHARD_TOKEN_CHAR && (tok)->str[0] == (c))
+
+static gboolean shard_is_word_char(char c) {
+	return g_ascii_isalnum(c) || c == '_' || c == '$' || (c & 0x80);
+}
+
+/**
+ * get the next token of the query
+ *
+ * comments are skipped
+ *
+ * @return the position after the token
+ */
+static const char *shard_token_next(const char *s, const char *end, shard_token_t *tok) {
+	for (;;) {
+		while (s < end && g_ascii_isspace(*s)) s++;
+
+		if (s + 1 < end && s[0] == '/' && s[1] == '*') {
+			for (s += 2; s < end && !(s[0] == '*' && s + 1 < end && s[1] == '/'); s++);
+			s = MIN(s + 2, end);
+		} else if (s < end &&
+		           (s[0] == '#' ||
+		            (s + 1 < end && s[0] == '-' && s[1] == '-' && (s + 2 == end || g_ascii_isspace(s[2]))))) {
+			while (s < end && *s != '\n') s++;
+		} else {
+			break;
+		}
+	}
+
+	tok->str = s;
+	tok->len = 0;
+
+	if (s == end) {
+		tok->type = SHARD_TOKEN_END;
+
+		return s;
+	}
+
+	if (g_ascii_isdigit(*s) || (*s == '.' && s + 1 < end && g_ascii_isdigit(s[1]))) {
+		tok->type = SHARD_TOKEN_NUMBER;
+
+		/* 1.5e-3, 0x1f */
+		for (s++; s < end; s++) {
+			if (shard_is_word_char(*s) || *s == '.') continue;
+			if ((*s == '-' || *s == '+') && (s[-1] == 'e' || s[-1] == 'E')) continue;
+
+			break;
+		}
+		tok->len = s - tok->str;
+	} else if (shard_is_word_char(*s)) {
+		tok->type = SHARD_TOKEN_WORD;
+
+		for (s++; s < end && shard_is_word_char(*s); s++);
+		tok->len = s - tok->str;
+	} else if (*s == '`' || *s == '\'' || *s == '"') {
+		char quote = *s;
+
+		tok->type = (quote == '`') ? SHARD_TOKEN_WORD : SHARD_TOKEN_STRING;
+		tok->str = ++s;
+
+		for (; s < end; s++) {
+			if (*s == '\\' && quote != '`') {
+				s++;
+			} else if (*s == quote) {
+				if (s + 1 < end && s[1] == quote) {
+					s++;
+				} else {
+					break;
+				}
+			}
+		}
+		s = MIN(s, end);
+		tok->len = s - tok->str;
+
+		if (s < end) s++; /* the closing quote */
+	} else {
+		tok->type = SHARD_TOKEN_CHAR;
+		tok->len = 1;
+		s++;
+	}
+
+	return s;
+}
+
+/**
+ * get the next token, a qualified column like orders.customer_id is one word
+ */
+static const char *shard_token_next_column(const char *s, const char *end, shard_token_t *tok) {
+	s = shard_token_next(s, end, tok);
+
+	while (tok->type == SHARD_TOKEN_WORD) {
+		shard_token_t dot, name;
+		const char *p;
+
+		p = shard_token_next(s, end, &dot);
+		if (!SHARD_TOKEN_IS_CHAR(&dot, '.')) break;
+
+		p = shard_token_next(p, end, &name);
+		if (name.type != SHARD_TOKEN_WORD) break;
+
+		*tok = name;
+		s = p;
+	}
+
+	return s;
+}
+
+static gboolean shard_token_is_key(network_shard_map_t *map, shard_token_t *tok) {
+	return tok->type == SHARD_TOKEN_WORD &&
+		tok->len == map->key->len &&
+		0 == g_ascii_strncasecmp(tok->str, map->key->str, tok->len);
+}
+
+/**
+ * read a literal, starting with the current token
+ *
+ * integers are normalized to their decimal form, 042 and '42' are the same key
+ *
+ * @return the position after the literal, NULL if the token doesn't start a literal
+ */
+static const char *shard_token_read_value(const char *s, const char *end, shard_token_t *tok, GString *value) {
+	gboolean is_negative = FALSE;
+	gsize i;
+
+	if (SHARD_TOKEN_IS_CHAR(tok, '-')) {
+		s = shard_token_next(s, end, tok);
+		if (tok->type != SHARD_TOKEN_NUMBER) return NULL;
+
+		is_negative = TRUE;
+	}
+
+	g_string_truncate(value, 0);
+
+	switch (tok->type) {
+	case SHARD_TOKEN_STRING:
+		g_string_append_len(value, tok->str, tok->len);
+
+		return s;
+	case SHARD_TOKEN_NUMBER:
+		if (is_negative) g_string_append_c(value, '-');
+
+		for (i = 0; i < tok->len && g_ascii_isdigit(tok->str[i]); i++);
+
+		if (i == tok->len && tok->len < 19) {
+			/* skip the leading zeros */
+			for (i = 0; i + 1 < tok->len && tok->str[i] == '0'; i++);
+
+			if (is_negative && tok->len - i == 1 && tok->str[i] == '0') g_string_truncate(value, 0);
+
+			g_string_append_len(value, tok->str + i, tok->len - i);
+		} else {
+			g_string_append_len(value, tok->str, tok->len);
+		}
+
+		return s;
+	default:
+		return NULL;
+	}
+}
+
+/**
+ * TRUE if the literal isn't followed by a operator, "key = 1 + 1" has no key
+ */
+static gboolean shard_token_ends_value(const char *s, const char *end) {
+	shard_token_t tok;
+
+	shard_token_next(s, end, &tok);
+
+	return tok.type == SHARD_TOKEN_END ||
+		tok.type == SHARD_TOKEN_WORD ||
+		SHARD_TOKEN_IS_CHAR(&tok, ';') ||
+		SHARD_TOKEN_IS_CHAR(&tok, ',') ||
+		SHARD_TOKEN_IS_CHAR(&tok, ')');
+}
+
+/**
+ * get the key of the "<key> = <literal>" in the conditions
+ *
+ * @param in_conditions TRUE if s points to the conditions already, FALSE to look for the WHERE
+ */
+static gboolean shard_get_conditions_key(network_shard_map_t *map, const char *s, const char *end, gboolean in_conditions, GString *key) {
+	GString *value = g_string_new(NULL);
+	gboolean has_key = FALSE;
+	gboolean is_routable = TRUE;
+	shard_token_t tok;
+	int depth = 0;
+
+	for (s = shard_token_next_column(s, end, &tok);
+	     tok.type != SHARD_TOKEN_END && is_routable;
+	     s = shard_token_next_column(s, end, &tok)) {
+		shard_token_t op;
+		const char *p;
+
+		if (SHARD_TOKEN_IS_CHAR(&tok, '(')) {
+			depth++;
+			continue;
+		}
+		if (SHARD_TOKEN_IS_CHAR(&tok, ')')) {
+			if (--depth < 0) is_routable = FALSE;
+			continue;
+		}
+
+		/* the conditions of sub-queries don't restrict the rows of the query */
+		if (depth > 0) continue;
+
+		if (SHARD_TOKEN_IS_WORD(&tok, "union")) {
+			is_routable = FALSE;
+		} else if (!in_conditions) {
+			in_conditions = SHARD_TOKEN_IS_WORD(&tok, "where");
+		} else if (SHARD_TOKEN_IS_WORD(&tok, "or") ||
+		           SHARD_TOKEN_IS_WORD(&tok, "xor") ||
+		           SHARD_TOKEN_IS_CHAR(&tok, '|')) {
+			is_routable = FALSE;
+		} else if (SHARD_TOKEN_IS_WORD(&tok, "group") ||
+		           SHARD_TOKEN_IS_WORD(&tok, "order") ||
+		           SHARD_TOKEN_IS_WORD(&tok, "having") ||
+		           SHARD_TOKEN_IS_WORD(&tok, "limit") ||
+		           SHARD_TOKEN_IS_WORD(&tok, "for") ||
+		           SHARD_TOKEN_IS_WORD(&tok, "lock")) {
+			in_conditions = FALSE;
+		} else if (shard_token_is_key(map, &tok)) {
+			p = shard_token_next(s, end, &op);
+			if (!SHARD_TOKEN_IS_CHAR(&op, '=')) continue;
+
+			p = shard_token_next(p, end, &op);
+			if (NULL == (p = shard_token_read_value(p, end, &op, value)) ||
+			    !shard_token_ends_value(p, end)) {
+				continue;
+			}
+
+			if (has_key && !g_string_equal(key, value)) {
+				/* "key = 1 AND key = 2" */
+				is_routable = FALSE;
+			} else {
+				g_string_assign(key, value->str);
+				has_key = TRUE;
+			}
+
+			s = p;
+		}
+	}
+
+	g_string_free(value, TRUE);
+
+	return has_key && is_routable;
+}
+
+/**
+ * get the key of the rows of a INSERT or REPLACE
+ *
+ * all rows have to have the same key, the INSERT ... SELECT has none
+ */
+static gboolean shard_get_insert_key(network_shard_map_t *map, const char *s, const char *end, GString *key) {
+	GString *value = g_string_new(NULL);
+	gboolean has_key = FALSE;
+	shard_token_t tok;
+	int key_ndx = -1;
+	int ndx;
+
+	/* skip the modifiers and the table */
+	for (s = shard_token_next_column(s, end, &tok); ; s = shard_token_next_column(s, end, &tok)) {
+		if (SHARD_TOKEN_IS_CHAR(&tok, '(')) break;
+
+		if (SHARD_TOKEN_IS_WORD(&tok, "set")) {
+			g_string_free(value, TRUE);
+
+			return shard_get_conditions_key(map, s, end, TRUE, key);
+		}
+
+		if (tok.type != SHARD_TOKEN_WORD ||
+		    SHARD_TOKEN_IS_WORD(&tok, "values") ||
+		    SHARD_TOKEN_IS_WORD(&tok, "value") ||
+		    SHARD_TOKEN_IS_WORD(&tok, "select")) {
+			goto no_key;
+		}
+	}
+
+	/* the column list */
+	for (ndx = 0, s = shard_token_next_column(s, end, &tok); ; s = shard_token_next_column(s, end, &tok)) {
+		if (shard_token_is_key(map, &tok)) {
+			key_ndx = ndx;
+		} else if (SHARD_TOKEN_IS_CHAR(&tok, ',')) {
+			ndx++;
+		} else if (SHARD_TOKEN_IS_CHAR(&tok, ')')) {
+			break;
+		} else if (tok.type != SHARD_TOKEN_WORD) {
+			goto no_key;
+		}
+	}
+
+	if (key_ndx < 0) goto no_key;
+
+	s = shard_token_next(s, end, &tok);
+	if (!SHARD_TOKEN_IS_WORD(&tok, "values") && !SHARD_TOKEN_IS_WORD(&tok, "value")) goto no_key;
+
+	/* the rows */
+	do {
+		s = shard_token_next(s, end, &tok);
+		if (!SHARD_TOKEN_IS_CHAR(&tok, '(')) goto no_key;
+
+		for (ndx = 0; ; ndx++) {
+			if (ndx == key_ndx) {
+				s = shard_token_next(s, end, &tok);
+				if (NULL == (s = shard_token_read_value(s, end, &tok, value))) goto no_key;
+
+				s = shard_token_next(s, end, &tok);
+				if (!SHARD_TOKEN_IS_CHAR(&tok, ',') && !SHARD_TOKEN_IS_CHAR(&tok, ')')) goto no_key;
+
+				if (has_key && !g_string_equal(key, value)) goto no_key;
+
+				g_string_assign(key, value->str);
+				has_key = TRUE;
+			} else {
+				int depth = 0;
+
+				/* skip the value up to the , or the ) of the row */
+				for (;;) {
+					s = shard_token_next(s, end, &tok);
+
+					if (tok.type == SHARD_TOKEN_END) goto no_key;
+
+					if (SHARD_TOKEN_IS_CHAR(&tok, '(')) {
+						depth++;
+					} else if (SHARD_TOKEN_IS_CHAR(&tok, ')')) {
+						if (depth-- == 0) break;
+					} else if (SHARD_TOKEN_IS_CHAR(&tok, ',') && depth == 0) {
+						break;
+					}
+				}
+			}
+
+			if (SHARD_TOKEN_IS_CHAR(&tok, ')')) break;
+		}
+
+		if (ndx < key_ndx) goto no_key;
+
+		s = shard_token_next(s, end, &tok);
+	} while (SHARD_TOKEN_IS_CHAR(&tok, ','));
+
+	g_string_free(value, TRUE);
+
+	return has_key;
+no_key:
+	g_string_free(value, TRUE);
+
+	return FALSE;
+}
+
+/**
+ * get the shard key of a query
+ *
+ * @param key gets the key, integers in their decimal form
+ * @return FALSE if the query has no key or the rows of several keys
+ */
+gboolean network_shard_map_get_key(network_shard_map_t *map, const char *query, gsize query_len, GString *key) {
+	const char *end = query + query_len;
+	const char *s;
+	shard_token_t tok;
+
+	s = shard_token_next(query, end, &tok);
+
+	if (SHARD_TOKEN_IS_WORD(&tok, "insert") ||
+	    SHARD_TOKEN_IS_WORD(&tok, "replace")) {
+		return shard_get_insert_key(map, s, end, key);
+	}
+
+	if (SHARD_TOKEN_IS_WORD(&tok, "select") ||
+	    SHARD_TOKEN_IS_WORD(&tok, "update") ||
+	    SHARD_TOKEN_IS_WORD(&tok, "delete")) {
+		return shard_get_conditions_key(map, s, end, FALSE, key);
+	}
+
+	return FALSE;
+}
+
+/**
+ * check if the query uses one of the sharded tables
+ */
+gboolean network_shard_map_is_sharded(network_shard_map_t *map, const char *query, gsize query_len) {
+	const char *end = query + query_len;
+	const char *s;
+	shard_token_t tok;
+	guint i;
+
+	for (s = shard_token_next_column(query, end, &tok); tok.type != SHARD_TOKEN_END; s = shard_token_next_column(s, end, &tok)) {
+		if (tok.type != SHARD_TOKEN_WORD) continue;
+
+		for (i = 0; i < map->tables->len; i++) {
+			GString *table = map->tables->pdata[i];
+
+			if (tok.len == table->len &&
+			    0 == g_ascii_strncasecmp(tok.str, table->str, tok.len)) {
+				return TRUE;
+			}
+		}
+	}
+
+	return FALSE;
+}
+
+/**
+ * skip to the ) that closes the ( we just read
+ */
+static const char *shard_token_skip_parens(const char *s, const char *end, shard_token_t *tok) {
+	int depth = 1;
+
+	while (depth > 0) {
+		s = shard_token_next(s, end, tok);
+
+		if (tok->type == SHARD_TOKEN_END) break;
+
+		if (SHARD_TOKEN_IS_CHAR(tok, '(')) depth++;
+		if (SHARD_TOKEN_IS_CHAR(tok, ')')) depth--;
+	}
+
+	return s;
+}
+
+/**
+ * plan the columns of a SELECT sent to all shards
+ *
+ * a column that is just COUNT(), SUM(), MIN() or MAX() is aggregated over the shards
+ *
+ * @return the position of the FROM, NULL if the columns can't be merged
+ */
+static const char *shard_plan_select_columns(const char *s, const char *end, network_scatter_merge_t *merge, const char **errmsg) {
+	guint column = 0;
+	shard_token_t tok;
+	gboolean is_first = TRUE;
+
+	for (s = shard_token_next(s, end, &tok); ; s = shard_token_next(s, end, &tok)) {
+		const char *p;
+		shard_token_t next;
+
+		if (tok.type == SHARD_TOKEN_END || SHARD_TOKEN_IS_WORD(&tok, "from")) return s;
+
+		if (SHARD_TOKEN_IS_WORD(&tok, "distinct") ||
+		    SHARD_TOKEN_IS_WORD(&tok, "distinctrow")) {
+			*errmsg = "SELECT DISTINCT";
+			return NULL;
+		}
+
+		if (SHARD_TOKEN_IS_CHAR(&tok, ',')) {
+			column++;
+			is_first = TRUE;
+			continue;
+		}
+
+		if (SHARD_TOKEN_IS_CHAR(&tok, '(')) {
+			s = shard_token_skip_parens(s, end, &tok);
+			is_first = FALSE;
+			continue;
+		}
+
+		p = shard_token_next(s, end, &next);
+
+		if (tok.type == SHARD_TOKEN_WORD && SHARD_TOKEN_IS_CHAR(&next, '(')) {
+			network_scatter_aggregate_t aggregate;
+			gboolean is_aggregate = TRUE;
+
+			if (SHARD_TOKEN_IS_WORD(&tok, "count") ||
+			    SHARD_TOKEN_IS_WORD(&tok, "sum")) {
+				aggregate = NETWORK_SCATTER_AGGREGATE_SUM;
+			} else if (SHARD_TOKEN_IS_WORD(&tok, "min")) {
+				aggregate = NETWORK_SCATTER_AGGREGATE_MIN;
+			} else if (SHARD_TOKEN_IS_WORD(&tok, "max")) {
+				aggregate = NETWORK_SCATTER_AGGREGATE_MAX;
+			} else if (SHARD_TOKEN_IS_WORD(&tok, "avg") ||
+			           SHARD_TOKEN_IS_WORD(&tok, "group_concat") ||
+			           SHARD_TOKEN_IS_WORD(&tok, "std") ||
+			           SHARD_TOKEN_IS_WORD(&tok, "stddev") ||
+			           SHARD_TOKEN_IS_WORD(&tok, "variance") ||
+			           SHARD_TOKEN_IS_WORD(&tok, "bit_and") ||
+			           SHARD_TOKEN_IS_WORD(&tok, "bit_or") ||
+			           SHARD_TOKEN_IS_WORD(&tok, "bit_xor")) {
+				*errmsg = "the aggregate function can't be merged";
+				return NULL;
+			} else {
+				is_aggregate = FALSE;
+			}
+
+			if (is_aggregate) {
+				shard_token_t arg;
+
+				shard_token_next(p, end, &arg);
+
+				if (!is_first || SHARD_TOKEN_IS_WORD(&arg, "distinct")) {
+					*errmsg = "the aggregate function can't be merged";
+					return NULL;
+				}
+
+				/* nothing but a alias may follow */
+				s = shard_token_skip_parens(p, end, &tok);
+				shard_token_next(s, end, &next);
+				if (next.type == SHARD_TOKEN_CHAR && !SHARD_TOKEN_IS_CHAR(&next, ',')) {
+					*errmsg = "the aggregate function can't be merged";
+					return NULL;
+				}
+
+				network_scatter_merge_set_aggregate(merge, column, aggregate);
+			} else {
+				s = shard_token_skip_parens(p, end, &tok);
+			}
+		}
+
+		is_first = FALSE;
+	}
+}
+
+/**
+ * plan the ORDER BY of a SELECT sent to all shards
+ *
+ * only columns of the result and their positions can be merged
+ *
+ * @return the position after the ORDER BY, NULL if it can't be merged
+ */
+static const char *shard_plan_select_order(const char *s, const char *end, network_scatter_merge_t *merge, const char **errmsg) {
+	shard_token_t tok;
+
+	do {
+		shard_token_t name;
+		gint64 position = 0;
+		gboolean is_desc = FALSE;
+		gchar *position_str;
+
+		s = shard_token_next_column(s, end, &name);
+
+		if (name.type == SHARD_TOKEN_NUMBER) {
+			position_str = g_strndup(name.str, name.len);
+			if (!network_shard_map_parse_int(position_str, &position) || position < 1) position = 0;
+			g_free(position_str);
+
+			if (position == 0) {
+				*errmsg = "ORDER BY of a expression";
+				return NULL;
+			}
+		} else if (name.type != SHARD_TOKEN_WORD) {
+			*errmsg = "ORDER BY of a expression";
+			return NULL;
+		}
+
+		s = shard_token_next(s, end, &tok);
+		if (SHARD_TOKEN_IS_WORD(&tok, "asc") || SHARD_TOKEN_IS_WORD(&tok, "desc")) {
+			is_desc = SHARD_TOKEN_IS_WORD(&tok, "desc");
+			s = shard_token_next(s, end, &tok);
+		}
+
+		if (tok.type != SHARD_TOKEN_END &&
+		    tok.type != SHARD_TOKEN_WORD &&
+		    !SHARD_TOKEN_IS_CHAR(&tok, ',') &&
+		    !SHARD_TOKEN_IS_CHAR(&tok, ';')) {
+			*errmsg = "ORDER BY of a expression";
+			return NULL;
+		}
+
+		if (position > 0) {
+			network_scatter_merge_add_order(merge, NULL, 0, position, is_desc);
+		} else {
+			network_scatter_merge_add_order(merge, name.str, name.len, 0, is_desc);
+		}
+	} while (SHARD_TOKEN_IS_CHAR(&tok, ','));
+
+	/* let the caller look at the token that ended the ORDER BY */
+	return tok.str;
+}
+
+/**
+ * plan how the results of a query sent to all shards are merged
+ *
+ * - SELECTs are concatenated, merged by their ORDER BY, cut at their LIMIT and
+ *   their COUNT(), SUM(), MIN() and MAX() are aggregated into one row
+ * - the OKs of UPDATEs and DELETEs add up their affected rows
+ *
+ * @param merge gets the ORDER BY, aggregates and LIMIT
+ * @return NULL if the query can be sent to all shards, why it can't otherwise
+ */
+const char *network_shard_map_plan_scatter(const char *query, gsize query_len, network_scatter_merge_t *merge) {
+	const char *end = query + query_len;
+	const char *errmsg = NULL;
+	const char *s;
+	shard_token_t tok;
+
+	s = shard_token_next(query, end, &tok);
+
+	if (SHARD_TOKEN_IS_WORD(&tok, "update") ||
+	    SHARD_TOKEN_IS_WORD(&tok, "delete")) {
+		for (s = shard_token_next(s, end, &tok); tok.type != SHARD_TOKEN_END; s = shard_token_next(s, end, &tok)) {
+			/* the LIMIT of each shard adds up */
+			if (SHARD_TOKEN_IS_WORD(&tok, "limit")) return "UPDATE or DELETE with a LIMIT";
+		}
+
+		return NULL;
+	}
+
+	if (SHARD_TOKEN_IS_WORD(&tok, "insert") ||
+	    SHARD_TOKEN_IS_WORD(&tok, "replace")) {
+		return "the rows of a INSERT need the shard key";
+	}
+
+	if (!SHARD_TOKEN_IS_WORD(&tok, "select")) return "only SELECT, UPDATE and DELETE can be sent to all shards";
+
+	if (NULL == (s = shard_plan_select_columns(s, end, merge, &errmsg))) return errmsg;
+
+	for (s = shard_token_next(s, end, &tok); tok.type != SHARD_TOKEN_END; s = shard_token_next(s, end, &tok)) {
+		shard_token_t next;
+		const char *p;
+
+		if (SHARD_TOKEN_IS_CHAR(&tok, '(')) {
+			s = shard_token_skip_parens(s, end, &tok);
+			continue;
+		}
+
+		if (SHARD_TOKEN_IS_WORD(&tok, "union")) return "UNION";
+		if (SHARD_TOKEN_IS_WORD(&tok, "having")) return "HAVING";
+
+		p = shard_token_next(s, end, &next);
+
+		if (SHARD_TOKEN_IS_WORD(&tok, "group") && SHARD_TOKEN_IS_WORD(&next, "by")) return "GROUP BY";
+
+		if (SHARD_TOKEN_IS_WORD(&tok, "order") && SHARD_TOKEN_IS_WORD(&next, "by")) {
+			if (NULL == (s = shard_plan_select_order(p, end, merge, &errmsg))) return errmsg;
+			continue;
+		}
+
+		if (SHARD_TOKEN_IS_WORD(&tok, "limit")) {
+			gint64 limit;
+			gchar *limit_str;
+			gboolean is_int;
+
+			if (next.type != SHARD_TOKEN_NUMBER) return "LIMIT with a placeholder";
+
+			limit_str = g_strndup(next.str, next.len);
+			is_int = network_shard_map_parse_int(limit_str, &limit);
+			g_free(limit_str);
+
+			if (!is_int || limit < 0) return "LIMIT with a placeholder";
+
+			s = shard_token_next(p, end, &next);
+			if (SHARD_TOKEN_IS_CHAR(&next, ',') || SHARD_TOKEN_IS_WORD(&next, "offset")) return "LIMIT with a offset";
+
+			network_scatter_merge_set_limit(merge, limit);
+			s = p;
+		}
+	}
+
+	return NULL;
+}
+
+/**
+ * get the shard of a key
+ *
+ * @return NULL if no shard has the key, like a range key before the first shard
+ */
+network_shard_t *network_shard_map_get_shard(network_shard_map_t *map, const char *key, gsize key_len) {
+	gint64 key_int;
+	gchar *key_str;
+	gboolean is_int;
+	guint lo, hi;
+
+	if (map->method == NETWORK_SHARD_MAP_HASH) {
+		return map->shards->pdata[network_mysqld_crc32(0, key, key_len) % map->shards->len];
+	}
+
+	key_str = g_strndup(key, key_len);
+	is_int = network_shard_map_parse_int(key_str, &key_int);
+	g_free(key_str);
+
+	if (!is_int) return NULL;
+
+	/* the last shard with first_key <= key */
+	for (lo = 0, hi = map->shards->len; lo < hi; ) {
+		guint mid = lo + (hi - lo) / 2;
+
+		if (((network_shard_t *)map->shards->pdata[mid])->first_key <= key_int) {
+			lo = mid + 1;
+		} else {
+			hi = mid;
+		}
+	}
+
+	return lo > 0 ? map->shards->pdata[lo - 1] : NULL;
+}
+
+network_shard_router_t *network_shard_router_new(void) {
+	network_shard_router_t *router;
+
+	router = g_new0(network_shard_router_t, 1);
+	router->map_mutex = g_mutex_new();
+	router->retired = g_ptr_array_new();
+
+	return router;
+}
+
+void network_shard_router_free(network_shard_router_t *router) {
+	guint i;
+
+	if (!router) return;
+
+	for (i = 0; i < router->retired->len; i++) {
+		network_shard_map_free(router->retired->pdata[i]);
+	}
+	g_ptr_array_free(router->retired, TRUE);
+
+	network_shard_map_free(router->map);
+	g_mutex_free(router->map_mutex);
+
+	g_free(router);
+}
+
+/**
+ * load a shard map and make it the current one
+ *
+ * if the file has errors the current map stays
+ *
+ * @return 0 on success, -1 on error
+ */
+int network_shard_router_load(network_shard_router_t *router, const gchar *filename, GError **gerr) {
+	network_shard_map_t *map = network_shard_map_new();
+	network_shard_map_t *old_map;
+
+	if (0 != network_shard_map_load(map, filename, gerr)) {
+		network_shard_map_free(map);
+
+		return -1;
+	}
+
+	g_mutex_lock(router->map_mutex);
+	old_map = router->map;
+
+	g_atomic_pointer_set((gpointer *)&router->map, map);
+
+	/* readers may still look at the old one */
+	if (old_map) g_ptr_array_add(router->retired, old_map);
+	g_mutex_unlock(router->map_mutex);
+
+	return 0;
+}
+
+/**
+ * get the current shard map without locking
+ *
+ * @return the map, it stays valid until the router is freed. NULL if none was loaded
+ */
+network_shard_map_t *network_shard_router_get_map(network_shard_router_t *router) {
+	return g_atomic_pointer_get((gpointer *)&router->map);
+}
@@ -0,0 +1,90 @@
+/* $%BEGINLICENSE%$
+ Copyright (c) 2008, 2012, Oracle and/or its affiliates. All rights reserved.
+
+ This program is free software; you can redistribute it and/or
+ modify it under the terms of the GNU General Public License as
+ published by the Free Software Foundation; version 2 of the
+ License.
+
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ GNU General Public License for more details.
+
+ You should have received a copy of the GNU General Public License
+ along with this program; if not, write to the Free Software
+ Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA
+ 02110-1301  USA
+
+ $%ENDLICENSE%$ */
+#ifndef __NETWORK_SHARD_MAP_H__
+#define __NETWORK_SHARD_MAP_H__
+
+#include <glib.h>
+
+#include "network-scatter-merge.h"
+
+#include "network-exports.h"
+
+typedef enum {
+	NETWORK_SHARD_MAP_HASH,            /**< the shard is CRC32(key) % shards, like the CRC32() of MySQL */
+	NETWORK_SHARD_MAP_RANGE            /**< the shard with the highest first key <= key, integer keys only */
+} network_shard_map_method_t;
+
+typedef struct {
+	gint64 first_key;                  /**< RANGE: the first key of the shard, HASH: the index of the shard */
+	gchar **backends;                  /**< the addresses of the backends of the shard */
+} network_shard_t;
+
+/**
+ * the shards of the tables that have the key column
+ *
+ * a map isn't changed once it is loaded
+ */
+typedef struct {
+	GString *key;                      /**< the name of the key column, lower-case */
+	network_shard_map_method_t method;
+
+	GPtrArray *shards;                 /**< network_shard_t, ordered by .first_key */
+	GPtrArray *tables;                 /**< GString, the sharded tables in lower-case, their queries without a key go to all shards */
+} network_shard_map_t;
+
+NETWORK_API network_shard_map_t *network_shard_map_new(void);
+NETWORK_API void network_shard_map_free(network_shard_map_t *map);
+
+NETWORK_API int network_shard_map_load(network_shard_map_t *map, const gchar *filename, GError **gerr);
+NETWORK_API gboolean network_shard_map_get_key(network_shard_map_t *map, const char *query, gsize query_len, GString *key);
+NETWORK_API network_shard_t *network_shard_map_get_shard(network_shard_map_t *map, const char *key, gsize key_len);
+NETWORK_API gboolean network_shard_map_is_sharded(network_shard_map_t *map, const char *query, gsize query_len);
+NETWORK_API const char *network_shard_map_plan_scatter(const char *query, gsize query_len, network_scatter_merge_t *merge);
+
+/**
+ * the current shard map, replaced by a reload
+ *
+ * readers don't lock, like the list of the backends: writers take map_mutex,
+ * publish the new map and retire the old one. As readers may still use a
+ * retired map, those are only freed in network_shard_router_free().
+ *
+ * @see network_backends_t
+ */
+typedef struct {
+	network_shard_map_t *map;          /**< the current map, get it with network_shard_router_get_map() */
+	GMutex *map_mutex;                 /**< serializes the writers */
+	GPtrArray *retired;                /**< the maps that got replaced */
+} network_shard_router_t;
+
+NETWORK_API network_shard_router_t *network_shard_router_new(void);
+NETWORK_API void network_shard_router_free(network_shard_router_t *router);
+
+NETWORK_API int network_shard_router_load(network_shard_router_t *router, const gchar *filename, GError **gerr);
+NETWORK_API network_shard_map_t *network_shard_router_get_map(network_shard_router_t *router);
+
+#define NETWORK_SHARD_MAP_ERROR network_shard_map_error()
+NETWORK_API GQuark network_shard_map_error(void);
+
+typedef enum {
+	NETWORK_SHARD_MAP_ERROR_READ,      /**< the file couldn't be read */
+	NETWORK_SHARD_MAP_ERROR_PARSE      /**< a line isn't a key or a shard, or the shards don't fit the method */
+} network_shard_map_error_t;
+
+#endif
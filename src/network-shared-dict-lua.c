@@ -0,0 +1,255 @@
+/* $%BEGINLICENSE%$
+ Copyright (c) 2008, 2012, Oracle and/or its affiliates. All rights reserved.
+
+ This program is free software; you can redistribute it and/or
+ modify it under the terms of the GNU General Public License as
+ published by the Free Software Foundation; version 2 of the
+ License.
+
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ GNU General Public License for more details.
+
+ You should have received a copy of the GNU General Public License
+ along with this program; if not, write to the Free Software
+ Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA
+ 02110-1301  USA
+
+ $%ENDLICENSE%$ */
+#include <lua.h>
+#include <lauxlib.h>
+
+#include "lua-env.h"
+#include "glib-ext.h"
+
+#include "network-shared-dict.h"
+#include "network-shared-dict-lua.h"
+
+/**
+ * convert the optional time-to-live in seconds at idx
+ */
+static guint64 proxy_shared_dict_check_ttl(lua_State *L, int idx) {
+	lua_Number ttl = luaL_optnumber(L, idx, 0);
+
+	if (ttl < 0) luaL_argerror(L, idx, "the ttl has to be >= 0");
+
+	return (guint64)(ttl * G_USEC_PER_SEC);
+}
+
+/**
+ * proxy.shared:get(key)
+ *
+ * @return the string or number, nil if the key isn't found or expired
+ */
+static int proxy_shared_dict_get(lua_State *L) {
+	network_shared_dict_t *dict = *(network_shared_dict_t **)luaL_checkself(L);
+	gsize key_len;
+	const char *key = luaL_checklstring(L, 2, &key_len);
+	network_shared_dict_value_t value;
+
+	network_shared_dict_get(dict, key, key_len, &value);
+
+	switch (value.type) {
+	case NETWORK_SHARED_DICT_NUMBER:
+		lua_pushnumber(L, value.num);
+		break;
+	case NETWORK_SHARED_DICT_STRING:
+		lua_pushlstring(L, value.str->str, value.str->len);
+		break;
+	default:
+		lua_pushnil(L);
+		break;
+	}
+
+	network_shared_dict_value_reset(&value);
+
+	return 1;
+}
+
+static int proxy_shared_dict_set_value(lua_State *L, gboolean only_add) {
+	network_shared_dict_t *dict = *(network_shared_dict_t **)luaL_checkself(L);
+	gsize key_len;
+	const char *key = luaL_checklstring(L, 2, &key_len);
+	guint64 ttl_usec = proxy_shared_dict_check_ttl(L, 4);
+	network_shared_dict_value_t value;
+	GString str;
+	gboolean is_stored;
+
+	value.str = NULL;
+	value.num = 0;
+
+	switch (lua_type(L, 3)) {
+	case LUA_TNUMBER:
+		value.type = NETWORK_SHARED_DICT_NUMBER;
+		value.num = lua_tonumber(L, 3);
+		break;
+	case LUA_TSTRING:
+		value.type = NETWORK_SHARED_DICT_STRING;
+		str.str = (char *)lua_tolstring(L, 3, &str.len);
+		str.allocated_len = 0;
+		value.str = &str;
+		break;
+	case LUA_TNIL:
+		if (!only_add) {
+			/* :set(key, nil) removes the key */
+			network_shared_dict_delete(dict, key, key_len);
+			lua_pushboolean(L, TRUE);
+
+			return 1;
+		}
+		/* fall through */
+	default:
+		return luaL_argerror(L, 3, "expected a string or a number");
+	}
+
+	is_stored = network_shared_dict_set(dict, key, key_len, &value, ttl_usec, only_add);
+
+	lua_pushboolean(L, is_stored);
+
+	return 1;
+}
+
+/**
+ * proxy.shared:set(key, value[, ttl])
+ *
+ * @param value a string or a number, nil removes the key
+ * @param ttl   the key expires after <ttl> seconds, default: never
+ * @return true, false if the value doesn't fit into the memory limit
+ */
+static int proxy_shared_dict_set(lua_State *L) {
+	return proxy_shared_dict_set_value(L, FALSE);
+}
+
+/**
+ * proxy.shared:add(key, value[, ttl])
+ *
+ * like :set(), but only if the key doesn't exist yet
+ *
+ * @return true if the key was added
+ */
+static int proxy_shared_dict_add(lua_State *L) {
+	return proxy_shared_dict_set_value(L, TRUE);
+}
+
+/**
+ * proxy.shared:incr(key, delta[, init[, ttl]])
+ *
+ * atomically add delta to the number of the key
+ *
+ * @param init a missing key starts with this value, if not set a missing key is an error
+ * @param ttl  the expiry of a key created from init in seconds, default: never
+ * @return the new value, nil and a error-msg on error
+ */
+static int proxy_shared_dict_incr(lua_State *L) {
+	network_shared_dict_t *dict = *(network_shared_dict_t **)luaL_checkself(L);
+	gsize key_len;
+	const char *key = luaL_checklstring(L, 2, &key_len);
+	gdouble delta = luaL_checknumber(L, 3);
+	gdouble init, result;
+	gboolean has_init = !lua_isnoneornil(L, 4);
+	guint64 ttl_usec = proxy_shared_dict_check_ttl(L, 5);
+
+	if (has_init) init = luaL_checknumber(L, 4);
+
+	switch (network_shared_dict_incr(dict, key, key_len, delta, has_init ? &init : NULL, ttl_usec, &result)) {
+	case 0:
+		lua_pushnumber(L, result);
+		return 1;
+	case -1:
+		lua_pushnil(L);
+		lua_pushliteral(L, "not found");
+		return 2;
+	case -2:
+		lua_pushnil(L);
+		lua_pushliteral(L, "not a number");
+		return 2;
+	default:
+		lua_pushnil(L);
+		lua_pushliteral(L, "no memory");
+		return 2;
+	}
+}
+
+/**
+ * proxy.shared:delete(key)
+ *
+ * @return true if the key existed
+ */
+static int proxy_shared_dict_delete(lua_State *L) {
+	network_shared_dict_t *dict = *(network_shared_dict_t **)luaL_checkself(L);
+	gsize key_len;
+	const char *key = luaL_checklstring(L, 2, &key_len);
+
+	lua_pushboolean(L, network_shared_dict_delete(dict, key, key_len));
+
+	return 1;
+}
+
+/**
+ * proxy.shared:flush()
+ *
+ * @return the number of removed keys
+ */
+static int proxy_shared_dict_flush(lua_State *L) {
+	network_shared_dict_t *dict = *(network_shared_dict_t **)luaL_checkself(L);
+
+	lua_pushinteger(L, network_shared_dict_flush(dict));
+
+	return 1;
+}
+
+/**
+ * proxy.shared:stats()
+ *
+ * @return a table of
+ *   entries   => keys in the dictionary
+ *   bytes     => memory used by them
+ *   max_bytes => memory limit, 0 if the dictionary is disabled
+ *   hits      => :get() that found the key
+ *   misses    => :get() that didn't
+ *   evictions => keys dropped to stay below max_bytes
+ */
+static int proxy_shared_dict_stats(lua_State *L) {
+	network_shared_dict_t *dict = *(network_shared_dict_t **)luaL_checkself(L);
+	network_shared_dict_stats_t stats;
+
+	network_shared_dict_get_stats(dict, &stats);
+
+	lua_newtable(L);
+
+	lua_pushinteger(L, stats.entries);
+	lua_setfield(L, -2, "entries");
+	lua_pushnumber(L, stats.bytes);
+	lua_setfield(L, -2, "bytes");
+	lua_pushnumber(L, dict->max_bytes);
+	lua_setfield(L, -2, "max_bytes");
+	lua_pushnumber(L, stats.hits);
+	lua_setfield(L, -2, "hits");
+	lua_pushnumber(L, stats.misses);
+	lua_setfield(L, -2, "misses");
+	lua_pushnumber(L, stats.evictions);
+	lua_setfield(L, -2, "evictions");
+
+	return 1;
+}
+
+static const struct luaL_reg methods_proxy_shared_dict[] = {
+	{ "get", proxy_shared_dict_get },
+	{ "set", proxy_shared_dict_set },
+	{ "add", proxy_shared_dict_add },
+	{ "incr", proxy_shared_dict_incr },
+	{ "delete", proxy_shared_dict_delete },
+	{ "flush", proxy_shared_dict_flush },
+	{ "stats", proxy_shared_dict_stats },
+	{ NULL, NULL },
+};
+
+int network_shared_dict_lua_getmetatable(lua_State *L) {
+	proxy_getmetatable(L, methods_proxy_shared_dict);
+
+	lua_pushvalue(L, -1); /* meta.__index = meta */
+	lua_setfield(L, -2, "__index");
+
+	return 1;
+}
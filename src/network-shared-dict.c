@@ -0,0 +1,404 @@
+/* $%BEGINLICENSE%$
+ Copyright (c) 2008, 2012, Oracle and/or its affiliates. All rights reserved.
+
+ This program is free software; you can redistribute it and/or
+ modify it under the terms of the GNU General Public License as
+ published by the Free Software Foundation; version 2 of the
+ License.
+
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ GNU General Public License for more details.
+
+ You should have received a copy of the GNU General Public License
+ along with this program; if not, write to the Free Software
+ Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA
+ 02110-1301  USA
+
+ $%ENDLICENSE%$ */
+
+/** @file
+ * a key/value dictionary shared by the scripts of all event-threads
+ *
+ * the keys are spread over NETWORK_SHARED_DICT_SHARDS shards by their hash. Each
+ * shard has its own lock, hash-table and LRU list, scripts in different threads
+ * only contend if their keys land in the same shard.
+ */
+
+#include <string.h>
+
+#include "glib-ext.h"
+#include "chassis-timings.h"
+#include "network-shared-dict.h"
+
+static network_shared_dict_entry_t *network_shared_dict_entry_new(const char *key, gsize key_len, const network_shared_dict_value_t *value) {
+	network_shared_dict_entry_t *entry;
+
+	entry = g_new0(network_shared_dict_entry_t, 1);
+	entry->key = g_string_new_len(key, key_len);
+	entry->value.type = value->type;
+	entry->value.num = value->num;
+	if (value->type == NETWORK_SHARED_DICT_STRING) {
+		entry->value.str = g_string_new_len(value->str->str, value->str->len);
+	}
+	entry->link.data = entry;
+
+	entry->bytes = sizeof(*entry) + key_len + (entry->value.str ? entry->value.str->len : 0);
+
+	return entry;
+}
+
+static void network_shared_dict_entry_free(network_shared_dict_entry_t *entry) {
+	if (!entry) return;
+
+	g_string_free(entry->key, TRUE);
+	network_shared_dict_value_reset(&(entry->value));
+
+	g_free(entry);
+}
+
+/**
+ * free the string of a value and set it to nil
+ */
+void network_shared_dict_value_reset(network_shared_dict_value_t *value) {
+	if (value->str) g_string_free(value->str, TRUE);
+
+	value->str = NULL;
+	value->num = 0;
+	value->type = NETWORK_SHARED_DICT_NIL;
+}
+
+network_shared_dict_t *network_shared_dict_new(void) {
+	network_shared_dict_t *dict;
+	guint i;
+
+	dict = g_new0(network_shared_dict_t, 1);
+
+	for (i = 0; i < NETWORK_SHARED_DICT_SHARDS; i++) {
+		network_shared_dict_shard_t *shard = &(dict->shards[i]);
+
+		/* the keys are owned by the entries, the entries by the LRU list */
+		shard->entries = g_hash_table_new(g_hash_table_string_hash, g_hash_table_string_equal);
+		g_queue_init(&shard->lru);
+		shard->mutex = g_mutex_new();
+	}
+
+	return dict;
+}
+
+void network_shared_dict_free(network_shared_dict_t *dict) {
+	guint i;
+
+	if (!dict) return;
+
+	for (i = 0; i < NETWORK_SHARED_DICT_SHARDS; i++) {
+		network_shared_dict_shard_t *shard = &(dict->shards[i]);
+		GList *l;
+
+		g_hash_table_destroy(shard->entries);
+
+		while (NULL != (l = g_queue_pop_head_link(&shard->lru))) {
+			network_shared_dict_entry_free(l->data);
+		}
+
+		g_mutex_free(shard->mutex);
+	}
+
+	g_free(dict);
+}
+
+/**
+ * set the memory limit
+ *
+ * each shard may use 1/NETWORK_SHARED_DICT_SHARDS of it, a entry bigger than that
+ * can't be stored. Shards that are above their new limit shrink on the next set.
+ *
+ * @param max_bytes memory limit of all entries, 0 disables the dictionary
+ */
+void network_shared_dict_set_limits(network_shared_dict_t *dict, gsize max_bytes) {
+	dict->max_bytes = max_bytes;
+}
+
+/**
+ * get the shard of a key
+ */
+static network_shared_dict_shard_t *network_shared_dict_get_shard(network_shared_dict_t *dict, const GString *key) {
+	return &(dict->shards[g_hash_table_string_hash(key) % NETWORK_SHARED_DICT_SHARDS]);
+}
+
+/**
+ * take the entry out of the shard and free it
+ *
+ * @note has to be called with the shard->mutex held
+ */
+static void network_shared_dict_remove(network_shared_dict_shard_t *shard, network_shared_dict_entry_t *entry) {
+	g_hash_table_remove(shard->entries, entry->key);
+	g_queue_unlink(&shard->lru, &entry->link);
+
+	shard->bytes -= entry->bytes;
+
+	network_shared_dict_entry_free(entry);
+}
+
+/**
+ * find a entry that isn't expired yet
+ *
+ * an expired entry is dropped
+ *
+ * @note has to be called with the shard->mutex held
+ */
+static network_shared_dict_entry_t *network_shared_dict_lookup(network_shared_dict_shard_t *shard, const GString *key, guint64 now) {
+	network_shared_dict_entry_t *entry;
+
+	entry = g_hash_table_lookup(shard->entries, key);
+	if (NULL != entry && entry->expires_at != 0 && now >= entry->expires_at) {
+		network_shared_dict_remove(shard, entry);
+		entry = NULL;
+	}
+
+	return entry;
+}
+
+/**
+ * add the entry to the shard and drop the least recently used ones until we are below the limit
+ *
+ * @note has to be called with the shard->mutex held
+ */
+static void network_shared_dict_insert(network_shared_dict_t *dict, network_shared_dict_shard_t *shard, network_shared_dict_entry_t *entry) {
+	gsize max_shard_bytes = dict->max_bytes / NETWORK_SHARED_DICT_SHARDS;
+
+	g_hash_table_insert(shard->entries, entry->key, entry);
+	g_queue_push_head_link(&shard->lru, &entry->link);
+	shard->bytes += entry->bytes;
+
+	while (shard->bytes > max_shard_bytes) {
+		network_shared_dict_remove(shard, g_queue_peek_tail(&shard->lru));
+		shard->evictions++;
+	}
+}
+
+/**
+ * get a copy of the value of a key
+ *
+ * @param value is set to the value, nil if the key isn't found
+ * @return TRUE if the key is found
+ */
+gboolean network_shared_dict_get(network_shared_dict_t *dict, const char *key, gsize key_len, network_shared_dict_value_t *value) {
+	network_shared_dict_shard_t *shard;
+	network_shared_dict_entry_t *entry;
+	GString key_s;
+	guint64 now = chassis_get_coarse_rel_microseconds();
+
+	key_s.str = (char *)key;
+	key_s.len = key_len;
+	key_s.allocated_len = 0;
+
+	value->type = NETWORK_SHARED_DICT_NIL;
+	value->num = 0;
+	value->str = NULL;
+
+	shard = network_shared_dict_get_shard(dict, &key_s);
+
+	g_mutex_lock(shard->mutex);
+	entry = network_shared_dict_lookup(shard, &key_s, now);
+	if (NULL != entry) {
+		/* move it to the front of the LRU */
+		g_queue_unlink(&shard->lru, &entry->link);
+		g_queue_push_head_link(&shard->lru, &entry->link);
+
+		value->type = entry->value.type;
+		value->num = entry->value.num;
+		if (entry->value.str) {
+			value->str = g_string_new_len(entry->value.str->str, entry->value.str->len);
+		}
+
+		shard->hits++;
+	} else {
+		shard->misses++;
+	}
+	g_mutex_unlock(shard->mutex);
+
+	return NULL != entry;
+}
+
+/**
+ * set the value of a key
+ *
+ * @param ttl_usec the key expires after this many microseconds, 0 to keep it until it is evicted
+ * @param only_add if TRUE, don't replace the value of a key that exists
+ * @return TRUE if the value is stored, FALSE if the key exists and only_add is set,
+ *         the entry is too big for the memory limit or the dictionary is disabled
+ */
+gboolean network_shared_dict_set(network_shared_dict_t *dict, const char *key, gsize key_len, const network_shared_dict_value_t *value, guint64 ttl_usec, gboolean only_add) {
+	network_shared_dict_shard_t *shard;
+	network_shared_dict_entry_t *entry, *old_entry;
+	guint64 now = chassis_get_coarse_rel_microseconds();
+
+	g_return_val_if_fail(value->type != NETWORK_SHARED_DICT_NIL, FALSE);
+
+	/* copy the key and the value before we take the lock */
+	entry = network_shared_dict_entry_new(key, key_len, value);
+	if (ttl_usec > 0) entry->expires_at = now + ttl_usec;
+
+	if (entry->bytes > dict->max_bytes / NETWORK_SHARED_DICT_SHARDS) {
+		network_shared_dict_entry_free(entry);
+
+		return FALSE;
+	}
+
+	shard = network_shared_dict_get_shard(dict, entry->key);
+
+	g_mutex_lock(shard->mutex);
+	if (NULL != (old_entry = network_shared_dict_lookup(shard, entry->key, now))) {
+		if (only_add) {
+			g_mutex_unlock(shard->mutex);
+
+			network_shared_dict_entry_free(entry);
+
+			return FALSE;
+		}
+
+		network_shared_dict_remove(shard, old_entry);
+	}
+
+	network_shared_dict_insert(dict, shard, entry);
+	g_mutex_unlock(shard->mutex);
+
+	return TRUE;
+}
+
+/**
+ * add delta to the number of a key
+ *
+ * the read and the write are done under the lock of the shard, concurrent
+ * increments from several threads don't get lost
+ *
+ * @param init     if the key doesn't exist it is created with this value before delta is added, NULL to fail instead
+ * @param ttl_usec the expiry of a key created from init, 0 for none. A existing key keeps its expiry.
+ * @param result   is set to the new value
+ * @return 0 on success
+ *         -1 if the key doesn't exist and init is NULL
+ *         -2 if the value of the key isn't a number
+ *         -3 if the key couldn't be created because of the memory limit
+ */
+int network_shared_dict_incr(network_shared_dict_t *dict, const char *key, gsize key_len, gdouble delta, const gdouble *init, guint64 ttl_usec, gdouble *result) {
+	network_shared_dict_shard_t *shard;
+	network_shared_dict_entry_t *entry;
+	GString key_s;
+	guint64 now = chassis_get_coarse_rel_microseconds();
+	int ret = 0;
+
+	key_s.str = (char *)key;
+	key_s.len = key_len;
+	key_s.allocated_len = 0;
+
+	shard = network_shared_dict_get_shard(dict, &key_s);
+
+	g_mutex_lock(shard->mutex);
+	entry = network_shared_dict_lookup(shard, &key_s, now);
+	if (NULL != entry) {
+		if (entry->value.type == NETWORK_SHARED_DICT_NUMBER) {
+			entry->value.num += delta;
+			*result = entry->value.num;
+
+			g_queue_unlink(&shard->lru, &entry->link);
+			g_queue_push_head_link(&shard->lru, &entry->link);
+		} else {
+			ret = -2;
+		}
+	} else if (NULL == init) {
+		ret = -1;
+	} else {
+		network_shared_dict_value_t value;
+
+		value.type = NETWORK_SHARED_DICT_NUMBER;
+		value.num = *init + delta;
+		value.str = NULL;
+
+		entry = network_shared_dict_entry_new(key, key_len, &value);
+		if (ttl_usec > 0) entry->expires_at = now + ttl_usec;
+
+		if (entry->bytes > dict->max_bytes / NETWORK_SHARED_DICT_SHARDS) {
+			network_shared_dict_entry_free(entry);
+			ret = -3;
+		} else {
+			*result = value.num;
+			network_shared_dict_insert(dict, shard, entry);
+		}
+	}
+	g_mutex_unlock(shard->mutex);
+
+	return ret;
+}
+
+/**
+ * remove a key
+ *
+ * @return TRUE if the key existed
+ */
+gboolean network_shared_dict_delete(network_shared_dict_t *dict, const char *key, gsize key_len) {
+	network_shared_dict_shard_t *shard;
+	network_shared_dict_entry_t *entry;
+	GString key_s;
+	guint64 now = chassis_get_coarse_rel_microseconds();
+
+	key_s.str = (char *)key;
+	key_s.len = key_len;
+	key_s.allocated_len = 0;
+
+	shard = network_shared_dict_get_shard(dict, &key_s);
+
+	g_mutex_lock(shard->mutex);
+	if (NULL != (entry = network_shared_dict_lookup(shard, &key_s, now))) {
+		network_shared_dict_remove(shard, entry);
+	}
+	g_mutex_unlock(shard->mutex);
+
+	return NULL != entry;
+}
+
+/**
+ * remove all keys
+ *
+ * @return the number of dropped entries
+ */
+guint network_shared_dict_flush(network_shared_dict_t *dict) {
+	guint dropped = 0;
+	guint i;
+
+	for (i = 0; i < NETWORK_SHARED_DICT_SHARDS; i++) {
+		network_shared_dict_shard_t *shard = &(dict->shards[i]);
+		network_shared_dict_entry_t *entry;
+
+		g_mutex_lock(shard->mutex);
+		while (NULL != (entry = g_queue_peek_head(&shard->lru))) {
+			network_shared_dict_remove(shard, entry);
+			dropped++;
+		}
+		g_mutex_unlock(shard->mutex);
+	}
+
+	return dropped;
+}
+
+/**
+ * sum up the stats of the shards
+ */
+void network_shared_dict_get_stats(network_shared_dict_t *dict, network_shared_dict_stats_t *stats) {
+	guint i;
+
+	memset(stats, 0, sizeof(*stats));
+
+	for (i = 0; i < NETWORK_SHARED_DICT_SHARDS; i++) {
+		network_shared_dict_shard_t *shard = &(dict->shards[i]);
+
+		g_mutex_lock(shard->mutex);
+		stats->entries   += g_hash_table_size(shard->entries);
+		stats->bytes     += shard->bytes;
+		stats->hits      += shard->hits;
+		stats->misses    += shard->misses;
+		stats->evictions += shard->evictions;
+		g_mutex_unlock(shard->mutex);
+	}
+}
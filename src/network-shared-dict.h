@@ -0,0 +1,107 @@
+/* $%BEGINLICENSE%$
+ Copyright (c) 2008, 2012, Oracle and/or its affiliates. All rights reserved.
+
+ This program is free software; you can redistribute it and/or
+ modify it under the terms of the GNU General Public License as
+ published by the Free Software Foundation; version 2 of the
+ License.
+
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ GNU General Public License for more details.
+
+ You should have received a copy of the GNU General Public License
+ along with this program; if not, write to the Free Software
+ Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA
+ 02110-1301  USA
+
+ $%ENDLICENSE%$ */
+#ifndef __NETWORK_SHARED_DICT_H__
+#define __NETWORK_SHARED_DICT_H__
+
+#include <glib.h>
+
+#include "network-exports.h"
+
+/**
+ * the keys are spread over this many shards, each with its own lock
+ */
+#define NETWORK_SHARED_DICT_SHARDS 16
+
+typedef enum {
+	NETWORK_SHARED_DICT_NIL,
+	NETWORK_SHARED_DICT_NUMBER,
+	NETWORK_SHARED_DICT_STRING
+} network_shared_dict_type_t;
+
+/**
+ * a value of the dictionary
+ *
+ * values returned by network_shared_dict_get() are copies, free .str with network_shared_dict_value_reset()
+ */
+typedef struct {
+	network_shared_dict_type_t type;
+
+	gdouble num;
+	GString *str;
+} network_shared_dict_value_t;
+
+typedef struct {
+	GString *key;
+	network_shared_dict_value_t value;
+	gsize bytes;           /**< size of the key, the value and the entry */
+
+	guint64 expires_at;    /**< in chassis_get_rel_microseconds(), 0 if it doesn't expire */
+
+	GList link;            /**< our link in the LRU list of the shard */
+} network_shared_dict_entry_t;
+
+/**
+ * a part of the keys, only its lock is taken to access them
+ */
+typedef struct {
+	GHashTable *entries;   /**< key -> network_shared_dict_entry_t */
+	GQueue lru;            /**< most recently used first */
+	GMutex *mutex;
+
+	gsize bytes;           /**< size of the entries */
+
+	guint64 hits;
+	guint64 misses;
+	guint64 evictions;     /**< entries dropped for the memory limit */
+} network_shared_dict_shard_t;
+
+/**
+ * a key/value dictionary shared by the scripts of all event-threads
+ *
+ * see proxy.shared
+ */
+typedef struct {
+	network_shared_dict_shard_t shards[NETWORK_SHARED_DICT_SHARDS];
+
+	gsize max_bytes;       /**< memory limit of all entries, each shard gets its share of it */
+} network_shared_dict_t;
+
+typedef struct {
+	guint entries;
+	gsize bytes;
+	guint64 hits;
+	guint64 misses;
+	guint64 evictions;
+} network_shared_dict_stats_t;
+
+NETWORK_API network_shared_dict_t *network_shared_dict_new(void);
+NETWORK_API void network_shared_dict_free(network_shared_dict_t *dict);
+NETWORK_API void network_shared_dict_set_limits(network_shared_dict_t *dict, gsize max_bytes);
+
+NETWORK_API void network_shared_dict_value_reset(network_shared_dict_value_t *value);
+
+NETWORK_API gboolean network_shared_dict_get(network_shared_dict_t *dict, const char *key, gsize key_len, network_shared_dict_value_t *value);
+NETWORK_API gboolean network_shared_dict_set(network_shared_dict_t *dict, const char *key, gsize key_len, const network_shared_dict_value_t *value, guint64 ttl_usec, gboolean only_add);
+NETWORK_API int network_shared_dict_incr(network_shared_dict_t *dict, const char *key, gsize key_len, gdouble delta, const gdouble *init, guint64 ttl_usec, gdouble *result);
+NETWORK_API gboolean network_shared_dict_delete(network_shared_dict_t *dict, const char *key, gsize key_len);
+NETWORK_API guint network_shared_dict_flush(network_shared_dict_t *dict);
+NETWORK_API void network_shared_dict_get_stats(network_shared_dict_t *dict, network_shared_dict_stats_t *stats);
+
+#endif
@@ -49,6 +49,12 @@ static int proxy_socket_get(lua_State *L) {
 		return network_address_lua_push(L, sock->src);
 	} else if (strleq(key, keysize, C("dst"))) {
 		return network_address_lua_push(L, sock->dst);
+	} else if (strleq(key, keysize, C("write_syscalls"))) {
+		lua_pushnumber(L, sock->write_syscalls);
+		return 1;
+	} else if (strleq(key, keysize, C("write_bytes"))) {
+		lua_pushnumber(L, sock->write_bytes);
+		return 1;
 	}
       
 	if (sock->response) {
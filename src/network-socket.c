@@ -18,6 +18,9 @@
 
  $%ENDLICENSE%$ */
  
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE /* for accept4() */
+#endif
 
 #ifdef HAVE_CONFIG_H
 #include "config.h"
@@ -68,10 +71,14 @@
 #define E_NET_CONNABORTED WSAECONNABORTED
 #define E_NET_WOULDBLOCK WSAEWOULDBLOCK
 #define E_NET_INPROGRESS WSAEINPROGRESS
+#define E_NET_ADDRINUSE WSAEADDRINUSE
+#define E_NET_ADDRNOTAVAIL WSAEADDRNOTAVAIL
 #else
 #define E_NET_CONNRESET ECONNRESET
 #define E_NET_CONNABORTED ECONNABORTED
 #define E_NET_INPROGRESS EINPROGRESS
+#define E_NET_ADDRINUSE EADDRINUSE
+#define E_NET_ADDRNOTAVAIL EADDRNOTAVAIL
 #if EWOULDBLOCK == EAGAIN
 /**
  * some system make EAGAIN == EWOULDBLOCK which would lead to a 
@@ -87,10 +94,24 @@
 
 #include "network-debug.h"
 #include "network-socket.h"
+#include "network-buffer-pool.h"
+#include "network-object-pool.h"
 #include "network-mysqld-proto.h"
 #include "network-mysqld-packet.h"
+#include "network-mysqld-compress.h"
+#include "network-ssl.h"
+#include "network-mysqld-metrics.h"
 #include "string-len.h"
 #include "glib-ext.h"
+#include "chassis-handoff.h"
+#include "chassis-event-iocp.h"
+
+#if defined(HAVE_SYS_SDT_H) && defined(ENABLE_DTRACE)
+#include <sys/sdt.h>
+#include "proxy-dtrace-provider.h"
+#else
+#include "disable-dtrace.h"
+#endif
 
 #ifndef DISABLE_DEPRECATED_DECL
 network_socket *network_socket_init() {
@@ -98,16 +119,200 @@ network_socket *network_socket_init() {
 }
 #endif
 
+/**
+ * each connection has a client and a server socket
+ */
+#define NETWORK_SOCKET_POOL_MAX_IDLE 64
+
+static void network_socket_destroy(network_socket *s) {
+	g_string_free(s->default_db, TRUE);
+	g_free(s);
+}
+
+static network_object_pool_t socket_pool = NETWORK_OBJECT_POOL_INIT(NETWORK_SOCKET_POOL_MAX_IDLE, network_socket_destroy);
+
+/**
+ * the backlog of the listening sockets
+ *
+ * @see network_socket_set_listen_backlog()
+ */
+static gint network_socket_listen_backlog = 128;
+
+/**
+ * seconds a listening socket waits for the first data of a connection before it is accepted
+ *
+ * @see network_socket_set_defer_accept()
+ */
+static gint network_socket_defer_accept = 0;
+
+/**
+ * the queue of the TCP Fast Open requests of the listening sockets, 0 to disable
+ *
+ * @see network_socket_set_fast_open()
+ */
+static gint network_socket_fast_open = 0;
+
+/**
+ * open the connections to the backends with a TCP Fast Open SYN
+ *
+ * @see network_socket_set_fast_open_connect()
+ */
+static gboolean network_socket_fast_open_connect = FALSE;
+
+/**
+ * microseconds a read on the sockets may busy-poll the device queue, 0 to disable
+ *
+ * @see network_socket_set_busy_poll()
+ */
+static gint network_socket_busy_poll = 0;
+
+/**
+ * bind all listening TCP sockets with SO_REUSEPORT
+ *
+ * @see network_socket_set_reuse_port()
+ */
+static gboolean network_socket_reuse_port = FALSE;
+
+/**
+ * set the backlog of the listening sockets bound from now on
+ *
+ * the kernel caps it at net.core.somaxconn
+ *
+ * @see --listen-backlog
+ */
+void network_socket_set_listen_backlog(gint backlog) {
+	network_socket_listen_backlog = backlog > 0 ? backlog : 128;
+}
+
+/**
+ * let several processes bind the same addresses
+ *
+ * the listening TCP sockets bound from now on get SO_REUSEPORT like with
+ * network_socket.reuse_port, the kernel spreads the connections over the processes.
+ * Unix-sockets can't be shared that way, binding one fails.
+ *
+ * @see --worker-processes
+ */
+void network_socket_set_reuse_port(gboolean reuse_port) {
+	network_socket_reuse_port = reuse_port;
+}
+
+/**
+ * only accept the connections of the listening sockets once they can be read from
+ *
+ * the client speaks first in most protocols, but not in the MySQL protocol: the server
+ * sends the handshake first. The kernel completes the connection anyway once the
+ * timeout expired, the accept is only delayed by it. Only done with TCP_DEFER_ACCEPT.
+ *
+ * @param secs    seconds to defer the accept, 0 to disable
+ * @see --tcp-defer-accept
+ */
+void network_socket_set_defer_accept(gint secs) {
+	network_socket_defer_accept = MAX(secs, 0);
+}
+
+/**
+ * accept the connections of the listening TCP sockets bound from now on with TCP Fast Open
+ *
+ * a client that got a cookie from us earlier sends it in its SYN and the connection is
+ * accepted right away, the handshake goes out without waiting for the last ACK of the
+ * client. Only done with TCP_FASTOPEN and net.ipv4.tcp_fastopen & 2.
+ *
+ * @param qlen    the pending Fast Open connections, 0 to disable
+ * @see --tcp-fast-open
+ */
+void network_socket_set_fast_open(gint qlen) {
+	network_socket_fast_open = MAX(qlen, 0);
+}
+
+/**
+ * connect to TCP addresses with TCP Fast Open from now on
+ *
+ * the SYN carries the cookie of the server and no data: the MySQL server speaks first.
+ * A server that accepts Fast Open, like a mysql-proxy with --tcp-fast-open, accepts the
+ * connection on the SYN and sends its handshake one round-trip earlier. The first connect
+ * to a server only fetches the cookie. Only done with MSG_FASTOPEN and
+ * net.ipv4.tcp_fastopen & 1, else connect() is used.
+ *
+ * @see --tcp-fast-open-connect
+ */
+void network_socket_set_fast_open_connect(gboolean fast_open_connect) {
+	network_socket_fast_open_connect = fast_open_connect;
+}
+
+/**
+ * trade CPU for latency on the connections accepted and connected from now on
+ *
+ * the sockets get SO_BUSY_POLL: a read or a poll on them spins on the queue of the
+ * device for up to usecs before it sleeps. The quick ACKs get re-armed after each read
+ * as the kernel falls back to delayed ACKs on its own. Going above net.core.busy_read
+ * needs CAP_NET_ADMIN.
+ *
+ * @param usecs   microseconds to busy-poll, 0 to disable
+ * @see --tcp-busy-poll
+ */
+void network_socket_set_busy_poll(gint usecs) {
+	network_socket_busy_poll = MAX(usecs, 0);
+}
+
+#if defined(SO_BUSY_POLL) || defined(TCP_QUICKACK)
+static gboolean network_socket_is_tcp(network_socket *sock) {
+	return sock->dst->addr.common.sa_family == AF_INET ||
+	       sock->dst->addr.common.sa_family == AF_INET6;
+}
+#endif
+
+/**
+ * set the options of --tcp-busy-poll on a connected socket
+ */
+static void network_socket_set_low_latency(network_socket *sock) {
+#ifdef SO_BUSY_POLL
+	int val = network_socket_busy_poll;
+
+	if (0 == network_socket_busy_poll || !network_socket_is_tcp(sock)) return;
+
+	if (0 != setsockopt(sock->fd, SOL_SOCKET, SO_BUSY_POLL, &val, sizeof(val))) {
+		g_debug("%s: setsockopt(%d, SO_BUSY_POLL, %d) failed: %s (%d)",
+				G_STRLOC,
+				sock->fd, val,
+				g_strerror(errno), errno);
+	}
+#else
+	(void)sock;
+#endif
+}
+
+/**
+ * ACK what we just read right away instead of waiting for a reply to piggy-back on
+ *
+ * TCP_QUICKACK isn't sticky, it has to be set again after each read
+ */
+static void network_socket_quickack(network_socket *sock) {
+#ifdef TCP_QUICKACK
+	int val = 1;
+
+	if (0 == network_socket_busy_poll || !network_socket_is_tcp(sock)) return;
+
+	setsockopt(sock->fd, IPPROTO_TCP, TCP_QUICKACK, &val, sizeof(val));
+#else
+	(void)sock;
+#endif
+}
+
 network_socket *network_socket_new() {
 	network_socket *s;
 	
-	s = g_new0(network_socket, 1);
+	/* a socket from the pool is zero'ed, only the default-db is kept */
+	if (NULL == (s = network_object_pool_get(&socket_pool))) {
+		s = g_new0(network_socket, 1);
+		s->default_db = g_string_new(NULL);
+	}
 
 	s->send_queue = network_queue_new();
 	s->recv_queue = network_queue_new();
 	s->recv_queue_raw = network_queue_new();
 
-	s->default_db = g_string_new(NULL);
+	s->server_status = SERVER_STATUS_AUTOCOMMIT;
 	s->fd           = -1;
 	s->socket_type  = SOCK_STREAM; /* let's default to TCP */
 	s->packet_id_is_reset = TRUE;
@@ -118,12 +323,37 @@ network_socket *network_socket_new() {
 	return s;
 }
 
+/**
+ * remove the event of the socket from its event-base
+ *
+ * call it before the event is set up for something else: it may still be registered from
+ * a persistent wait of its connection, see network_mysqld_con_wait_for_event()
+ */
+void network_socket_event_del(network_socket *s) {
+	if (s->persistent_wait_ref) {
+		*(s->persistent_wait_ref) = NULL;
+		s->persistent_wait_ref = NULL;
+	}
+
+	if (s->event.ev_base) { /* if .ev_base isn't set, the event never got added */
+		chassis_event_iocp_del(&(s->event));
+		event_del(&(s->event));
+	}
+	chassis_timer_wheel_remove(&(s->event_timer));
+}
+
 void network_socket_free(network_socket *s) {
+	GString *default_db;
+
 	if (!s) return;
 
+	network_ssl_free(s);
+
 	network_queue_free(s->send_queue);
 	network_queue_free(s->recv_queue);
 	network_queue_free(s->recv_queue_raw);
+	network_queue_free(s->recv_queue_compressed);
+	network_queue_free(s->send_queue_compressed);
 
 	if (s->response) network_mysqld_auth_response_free(s->response);
 	if (s->challenge) network_mysqld_auth_challenge_free(s->challenge);
@@ -131,17 +361,98 @@ void network_socket_free(network_socket *s) {
 	network_address_free(s->dst);
 	network_address_free(s->src);
 
-	if (s->event.ev_base) { /* if .ev_base isn't set, the event never got added */
-		event_del(&(s->event));
-	}
+	network_socket_event_del(s);
 
 	if (s->fd != -1) {
 		closesocket(s->fd);
 	}
 
-	g_string_free(s->default_db, TRUE);
+	network_stmt_cache_free(s->prepared_stmts);
+	if (s->session_vars) g_hash_table_destroy(s->session_vars);
 
-	g_free(s);
+	default_db = s->default_db;
+	g_string_truncate(default_db, 0);
+	memset(s, 0, sizeof(*s));
+	s->default_db = default_db;
+
+	if (network_object_pool_put(&socket_pool, s)) return;
+
+	network_socket_destroy(s);
+}
+
+static gboolean network_queue_is_empty(network_queue *queue) {
+	return queue == NULL || queue->chunks->length == 0;
+}
+
+/**
+ * release the queues of a idling socket
+ *
+ * a idle connection only needs its fd and its event. The queues are freed and
+ * network_socket_unpark() creates them again before the socket is used.
+ *
+ * @return TRUE if the socket is parked, FALSE if a queue still has data
+ */
+gboolean network_socket_park(network_socket *sock) {
+	if (sock->is_parked) return TRUE;
+
+	if (!network_queue_is_empty(sock->send_queue) ||
+	    !network_queue_is_empty(sock->recv_queue) ||
+	    !network_queue_is_empty(sock->recv_queue_raw) ||
+	    !network_queue_is_empty(sock->recv_queue_compressed) ||
+	    !network_queue_is_empty(sock->send_queue_compressed)) {
+		return FALSE;
+	}
+
+	network_queue_free(sock->send_queue);
+	network_queue_free(sock->recv_queue);
+	network_queue_free(sock->recv_queue_raw);
+	network_queue_free(sock->recv_queue_compressed);
+	network_queue_free(sock->send_queue_compressed);
+	sock->send_queue = NULL;
+	sock->recv_queue = NULL;
+	sock->recv_queue_raw = NULL;
+	sock->recv_queue_compressed = NULL;
+	sock->send_queue_compressed = NULL;
+
+	sock->is_parked = TRUE;
+
+	return TRUE;
+}
+
+/**
+ * create the queues of a parked socket again
+ */
+void network_socket_unpark(network_socket *sock) {
+	if (!sock->is_parked) return;
+
+	sock->send_queue = network_queue_new();
+	sock->recv_queue = network_queue_new();
+	sock->recv_queue_raw = network_queue_new();
+	if (sock->is_compressed) {
+		sock->recv_queue_compressed = network_queue_new();
+		sock->send_queue_compressed = network_queue_new();
+	}
+
+	sock->is_parked = FALSE;
+}
+
+/**
+ * get the bytes allocated for the socket and its queues
+ */
+gsize network_socket_get_memory(network_socket *sock) {
+	gsize bytes;
+
+	if (!sock) return 0;
+
+	bytes = sizeof(*sock);
+	bytes += network_queue_get_memory(sock->send_queue);
+	bytes += network_queue_get_memory(sock->recv_queue);
+	bytes += network_queue_get_memory(sock->recv_queue_raw);
+	bytes += network_queue_get_memory(sock->recv_queue_compressed);
+	bytes += network_queue_get_memory(sock->send_queue_compressed);
+	if (sock->default_db) bytes += sizeof(*sock->default_db) + sock->default_db->allocated_len;
+
+	return bytes;
 }
 
 /**
@@ -172,6 +483,41 @@ network_socket_retval_t network_socket_set_non_blocking(network_socket *sock) {
 	return NETWORK_SOCKET_SUCCESS;
 }
 
+/**
+ * hold back partial segments while more data for the socket is on its way
+ *
+ * TCP_NODELAY sends each write() as soon as it can, the tail of a write that doesn't
+ * fill a segment goes out on its own. Corked, the kernel only sends full segments until
+ * the socket is uncorked again, which flushes the rest. Only done with TCP_CORK, a
+ * no-op on unix-domain sockets and platforms without it.
+ *
+ * @param sock    a connected socket
+ * @param cork    TRUE to cork, FALSE to uncork and flush
+ */
+void network_socket_set_cork(network_socket *sock, gboolean cork) {
+#ifdef TCP_CORK
+	int val = cork ? 1 : 0;
+
+	if (sock->is_corked == cork) return;
+
+	if (sock->src->addr.common.sa_family != AF_INET &&
+	    sock->src->addr.common.sa_family != AF_INET6) return;
+
+	if (0 != setsockopt(sock->fd, IPPROTO_TCP, TCP_CORK, &val, sizeof(val))) {
+		g_debug("%s: setsockopt(%d, TCP_CORK, %d) failed: %s (%d)",
+				G_STRLOC,
+				sock->fd, val,
+				g_strerror(errno), errno);
+		return;
+	}
+
+	sock->is_corked = cork;
+#else
+	(void)sock;
+	(void)cork;
+#endif
+}
+
 /**
  * accept a connection
  *
@@ -188,26 +534,32 @@ network_socket *network_socket_accept(network_socket *srv) {
 
 	client = network_socket_new();
 
-	if (-1 == (client->fd = accept(srv->fd, &client->src->addr.common, &(client->src->len)))) {
+#ifdef HAVE_ACCEPT4
+	/* saves the fcntl() of network_socket_set_non_blocking() per connection */
+	client->fd = accept4(srv->fd, &client->src->addr.common, &(client->src->len), SOCK_NONBLOCK | SOCK_CLOEXEC);
+	if (-1 == client->fd && errno == ENOSYS) {
+		client->fd = accept(srv->fd, &client->src->addr.common, &(client->src->len));
+		if (-1 != client->fd) network_socket_set_non_blocking(client);
+	}
+#else
+	client->fd = accept(srv->fd, &client->src->addr.common, &(client->src->len));
+	if (-1 != client->fd) network_socket_set_non_blocking(client);
+#endif
+	if (-1 == client->fd) {
 		network_socket_free(client);
 
 		return NULL;
 	}
 
-	network_socket_set_non_blocking(client);
-
-	if (network_address_refresh_name(client->src)) {
-		network_socket_free(client);
-		return NULL;
-	}
+	/* the names are formatted when they are used, see network_address_get_name() */
 
 	/* the listening side may be INADDR_ANY, let's get which address the client really connected to */
 	if (-1 == getsockname(client->fd, &client->dst->addr.common, &(client->dst->len))) {
 		network_address_reset(client->dst);
-	} else if (network_address_refresh_name(client->dst)) {
-		network_address_reset(client->dst);
 	}
 
+	network_socket_set_low_latency(client);
+
 	return client;
 }
 
@@ -236,12 +588,10 @@ static network_socket_retval_t network_socket_connect_setopts(network_socket *so
 				g_strerror(errno),
 				errno);
 		network_address_reset(sock->src);
-	} else if (network_address_refresh_name(sock->src)) {
-		g_debug("%s: network_address_refresh_name() failed",
-				G_STRLOC);
-		network_address_reset(sock->src);
 	}
 
+	network_socket_set_low_latency(sock);
+
 	return NETWORK_SOCKET_SUCCESS;
 }
 
@@ -284,6 +634,27 @@ network_socket_retval_t network_socket_connect_finish(network_socket *sock) {
 	}
 }
 
+/**
+ * connect() the fd of a socket, with a TCP Fast Open SYN if enabled
+ *
+ * @return 0 on success, -1 and errno on error like connect()
+ * @see network_socket_set_fast_open_connect()
+ */
+static int network_socket_connect_fd(network_socket *sock) {
+#ifdef MSG_FASTOPEN
+	if (network_socket_fast_open_connect &&
+	    (sock->dst->addr.common.sa_family == AF_INET || sock->dst->addr.common.sa_family == AF_INET6)) {
+		/* sendto() connects like connect() and fails with EINPROGRESS on a non-blocking socket */
+		if (-1 != sendto(sock->fd, "", 0, MSG_FASTOPEN, &sock->dst->addr.common, sock->dst->len)) return 0;
+
+		/* disabled in net.ipv4.tcp_fastopen, the socket isn't connecting yet */
+		if (errno != EOPNOTSUPP) return -1;
+	}
+#endif
+
+	return connect(sock->fd, &sock->dst->addr.common, sock->dst->len);
+}
+
 /**
  * connect a socket
  *
@@ -320,7 +691,30 @@ network_socket_retval_t network_socket_connect(network_socket *sock) {
 	 */
 	network_socket_set_non_blocking(sock);
 
-	if (-1 == connect(sock->fd, &sock->dst->addr.common, sock->dst->len)) {
+	if (sock->bind_src) {
+#ifdef IP_BIND_ADDRESS_NO_PORT
+		int val = 1;
+
+		/* leave the port to connect(): it only has to be unique for the destination, not for the source IP */
+		setsockopt(sock->fd, IPPROTO_IP, IP_BIND_ADDRESS_NO_PORT, &val, sizeof(val));
+#endif
+		if (-1 == bind(sock->fd, &sock->src->addr.common, sock->src->len)) {
+#ifdef _WIN32
+			errno = WSAGetLastError();
+#endif
+			if (errno == E_NET_ADDRINUSE || errno == E_NET_ADDRNOTAVAIL) {
+				NETWORK_MYSQLD_METRICS_ADD(connect_ports_exhausted_total, 1);
+			}
+			g_critical("%s.%d: bind(%s) for connect(%s) failed: %s (%d)",
+					__FILE__, __LINE__,
+					sock->src->name->str,
+					sock->dst->name->str,
+					g_strerror(errno), errno);
+			return NETWORK_SOCKET_ERROR;
+		}
+	}
+
+	if (-1 == network_socket_connect_fd(sock)) {
 #ifdef _WIN32
 		errno = WSAGetLastError();
 #endif
@@ -332,6 +726,10 @@ network_socket_retval_t network_socket_connect(network_socket *sock) {
 		case E_NET_INPROGRESS:
 		case E_NET_WOULDBLOCK: /* win32 uses WSAEWOULDBLOCK */
 			return NETWORK_SOCKET_ERROR_RETRY;
+		case E_NET_ADDRNOTAVAIL:
+			/* no local port left for this destination */
+			NETWORK_MYSQLD_METRICS_ADD(connect_ports_exhausted_total, 1);
+			/* fall through */
 		default:
 			g_critical("%s.%d: connect(%s) failed: %s (%d)", 
 					__FILE__, __LINE__,
@@ -374,6 +772,18 @@ network_socket_retval_t network_socket_bind(network_socket * con) {
 		g_return_val_if_fail(con->dst, NETWORK_SOCKET_ERROR);
 		g_return_val_if_fail(con->dst->name->len > 0, NETWORK_SOCKET_ERROR);
 
+		/* the old proxy handed us its socket for this address, it is already listening */
+		if (-1 != (con->fd = chassis_handoff_take_fd(con->dst->name->str))) {
+			g_debug("%s: took over the listening socket of %s",
+					G_STRLOC,
+					con->dst->name->str);
+
+			chassis_handoff_add_fd(con->dst->name->str, con->fd);
+			network_socket_set_non_blocking(con);
+			con->dst->can_unlink_socket = TRUE;
+			return NETWORK_SOCKET_SUCCESS;
+		}
+
 		if (-1 == (con->fd = socket(con->dst->addr.common.sa_family, con->socket_type, 0))) {
 			g_critical("%s: socket(%s) failed: %s (%d)", 
 					G_STRLOC,
@@ -408,7 +818,34 @@ network_socket_retval_t network_socket_bind(network_socket * con) {
 						g_strerror(errno), errno);
 				return NETWORK_SOCKET_ERROR;
 			}
+
+			if (con->reuse_port || network_socket_reuse_port) {
+#ifdef SO_REUSEPORT
+				/* let several sockets bind() to the same address, the kernel spreads the connections over them */
+				if (0 != setsockopt(con->fd, SOL_SOCKET, SO_REUSEPORT, SETSOCKOPT_OPTVAL_CAST &val, sizeof(val))) {
+					g_critical("%s: setsockopt(%s, SOL_SOCKET, SO_REUSEPORT) failed: %s (%d)", 
+							G_STRLOC,
+							con->dst->name->str,
+							g_strerror(errno), errno);
+					return NETWORK_SOCKET_ERROR;
+				}
+#else
+				g_critical("%s: SO_REUSEPORT isn't supported on this platform, can't bind %s", 
+						G_STRLOC,
+						con->dst->name->str);
+				return NETWORK_SOCKET_ERROR;
+#endif
+			}
+		}
+
+#ifndef WIN32
+		if (network_socket_reuse_port && con->dst->addr.common.sa_family == AF_UNIX) {
+			g_critical("%s: the worker-processes can't share the unix-socket %s, listen on a TCP address instead",
+					G_STRLOC,
+					con->dst->name->str);
+			return NETWORK_SOCKET_ERROR;
 		}
+#endif
 
 		if (con->dst->addr.common.sa_family == AF_INET6) {
 #ifdef IPV6_V6ONLY
@@ -523,13 +960,50 @@ network_socket_retval_t network_socket_bind(network_socket * con) {
 			con->dst->addr.ipv6.sin6_port  = a.sin6_port;
 		}
 
-		if (-1 == listen(con->fd, 128)) {
-			g_critical("%s: listen(%s, 128) failed: %s (%d)",
+#ifdef TCP_DEFER_ACCEPT
+		if (network_socket_defer_accept > 0 &&
+		    (con->dst->addr.common.sa_family == AF_INET || con->dst->addr.common.sa_family == AF_INET6)) {
+			int val = network_socket_defer_accept;
+
+			if (0 != setsockopt(con->fd, IPPROTO_TCP, TCP_DEFER_ACCEPT, &val, sizeof(val))) {
+				g_warning("%s: setsockopt(%s, TCP_DEFER_ACCEPT, %d) failed: %s (%d)",
+						G_STRLOC,
+						con->dst->name->str,
+						val,
+						g_strerror(errno), errno);
+			}
+		}
+#endif
+
+#ifdef TCP_FASTOPEN
+		if (network_socket_fast_open > 0 &&
+		    (con->dst->addr.common.sa_family == AF_INET || con->dst->addr.common.sa_family == AF_INET6)) {
+			int val = network_socket_fast_open;
+
+			if (0 != setsockopt(con->fd, IPPROTO_TCP, TCP_FASTOPEN, &val, sizeof(val))) {
+				g_warning("%s: setsockopt(%s, TCP_FASTOPEN, %d) failed: %s (%d)",
+						G_STRLOC,
+						con->dst->name->str,
+						val,
+						g_strerror(errno), errno);
+			}
+		}
+#endif
+
+		if (-1 == listen(con->fd, network_socket_listen_backlog)) {
+			g_critical("%s: listen(%s, %d) failed: %s (%d)",
 					G_STRLOC,
 					con->dst->name->str,
+					network_socket_listen_backlog,
 					g_strerror(errno), errno);
 			return NETWORK_SOCKET_ERROR;
 		}
+
+		/* network_mysqld_con_accept() accepts until the backlog is empty */
+		network_socket_set_non_blocking(con);
+
+		/* hand it to the next proxy on a hot upgrade */
+		chassis_handoff_add_fd(con->dst->name->str, con->fd);
 	} else {
 		/* UDP sockets bind the ->src address */
 		g_return_val_if_fail(con->src, NETWORK_SOCKET_ERROR);
@@ -556,6 +1030,39 @@ network_socket_retval_t network_socket_bind(network_socket * con) {
 	return NETWORK_SOCKET_SUCCESS;
 }
 
+/**
+ * uncompress the compressed packets we read into the recv-queue-raw
+ */
+static network_socket_retval_t network_socket_decompress(network_socket *sock) {
+	if (0 != network_mysqld_decompress_queue(sock->recv_queue_raw, sock->recv_queue_compressed, &(sock->compressed_packet_id))) {
+		g_critical("%s: uncompressing the packets from %s failed",
+				G_STRLOC,
+				sock->dst->name->str);
+		return NETWORK_SOCKET_ERROR;
+	}
+	sock->compress_read_since_write = TRUE;
+
+	return NETWORK_SOCKET_SUCCESS;
+}
+
+/**
+ * bytes missing for the first packet in the queue to be complete
+ */
+static gsize network_socket_packet_remaining(network_queue *queue) {
+	char header_str[NET_HEADER_SIZE + 1] = "";
+	GString header;
+
+	if (queue->len < NET_HEADER_SIZE) return NET_HEADER_SIZE - queue->len;
+
+	header.str = header_str;
+	header.len = 0;
+	header.allocated_len = sizeof(header_str);
+
+	network_queue_peek_string(queue, NET_HEADER_SIZE, &header);
+
+	return NET_HEADER_SIZE + network_mysqld_proto_get_packet_len(&header) - queue->len;
+}
+
 /**
  * read a data from the socket
  *
@@ -564,10 +1071,26 @@ network_socket_retval_t network_socket_bind(network_socket * con) {
 network_socket_retval_t network_socket_read(network_socket *sock) {
 	gssize len;
 
+	if (sock->ssl) {
+		network_socket_retval_t ret;
+
+		ret = network_ssl_read(sock, sock->is_compressed ? sock->recv_queue_compressed : sock->recv_queue_raw);
+		if (ret == NETWORK_SOCKET_SUCCESS && sock->is_compressed) return network_socket_decompress(sock);
+
+		return ret;
+	}
+
+	if (sock->ssl_is_expected && sock->to_read > 0) {
+		/* the client may send the SSL request and the TLS handshake back to back,
+		 * the handshake has to be left in the socket for OpenSSL */
+		sock->to_read = MIN(sock->to_read, (off_t)network_socket_packet_remaining(sock->recv_queue_raw));
+	}
+
 	if (sock->to_read > 0) {
-		GString *packet = g_string_sized_new(sock->to_read);
+		network_queue *raw = sock->is_compressed ? sock->recv_queue_compressed : sock->recv_queue_raw;
+		GString *packet = network_buffer_pool_get(sock->to_read);
 
-		g_queue_push_tail(sock->recv_queue_raw->chunks, packet);
+		g_queue_push_tail(raw->chunks, packet);
 
 		if (sock->socket_type == SOCK_STREAM) {
 			len = recv(sock->fd, packet->str, sock->to_read, 0);
@@ -601,26 +1124,156 @@ network_socket_retval_t network_socket_read(network_socket *sock) {
 		}
 
 		sock->to_read -= len;
-		sock->recv_queue_raw->len += len;
+		raw->len += len;
+		NETWORK_MYSQLD_METRICS_ADD(received_bytes_total, len);
+		MYSQLPROXY_SOCKET_READ(sock->fd, len);
 #if 0
-		sock->recv_queue_raw->offset = 0; /* offset into the first packet */
+		raw->offset = 0; /* offset into the first packet */
 #endif
 		packet->len = len;
+
+		network_socket_quickack(sock);
+
+		if (sock->is_compressed) return network_socket_decompress(sock);
 	}
 
 	return NETWORK_SOCKET_SUCCESS;
 }
 
+/**
+ * read as much as the socket has without asking FIONREAD first
+ *
+ * to_read is only taken as a lower bound. Instead we recv() into buffers of
+ * sock->read_size bytes until the socket is drained. The read-size adapts to what
+ * we get per recv(): it doubles if a buffer got filled and halves if it stayed
+ * mostly empty. Bulk resultsets end up in fewer, larger chunks with fewer syscalls.
+ *
+ * the caller has to be able to handle partial packets in the recv_queue_raw
+ *
+ * @param sock the socket
+ * @return NETWORK_SOCKET_SUCCESS if we read something, NETWORK_SOCKET_WAIT_FOR_EVENT if there is nothing to read
+ */
+network_socket_retval_t network_socket_read_adaptive(network_socket *sock) {
+	network_queue *raw = sock->is_compressed ? sock->recv_queue_compressed : sock->recv_queue_raw;
+	gsize total = 0;
+
+	if (sock->socket_type != SOCK_STREAM || sock->ssl) return network_socket_read(sock);
+
+	if (sock->read_size == 0) sock->read_size = NETWORK_SOCKET_READ_SIZE_MIN;
+
+	/* don't starve the other connections of this thread */
+	while (total < NETWORK_SOCKET_READ_SIZE_MAX) {
+		GString *packet = network_buffer_pool_get(MAX(sock->read_size, (gsize)sock->to_read));
+		gsize want = packet->allocated_len - 1; /* use all the room the buffer has */
+		gssize len;
+
+		len = recv(sock->fd, packet->str, want, 0);
+		if (-1 == len) {
+#ifdef _WIN32
+			errno = WSAGetLastError();
+#endif
+			network_buffer_pool_put(packet);
+
+			switch (errno) {
+			case E_NET_CONNABORTED:
+			case E_NET_CONNRESET: /** nothing to read, let's let ioctl() handle the close for us */
+			case E_NET_WOULDBLOCK: /** the buffers are empty, try again later */
+			case EAGAIN:     
+				break;
+			default:
+				g_debug("%s: recv() failed: %s (errno=%d)", G_STRLOC, g_strerror(errno), errno);
+				return NETWORK_SOCKET_ERROR;
+			}
+			break;
+		} else if (len == 0) {
+			/* connection close, let the ioctl() handle it for us */
+			network_buffer_pool_put(packet);
+			break;
+		}
+
+		packet->len = len;
+		packet->str[len] = '\0';
+		g_queue_push_tail(raw->chunks, packet);
+		raw->len += len;
+		total += len;
+		NETWORK_MYSQLD_METRICS_ADD(received_bytes_total, len);
+		MYSQLPROXY_SOCKET_READ(sock->fd, len);
+
+		if ((gsize)len == want) {
+			if (sock->read_size < NETWORK_SOCKET_READ_SIZE_MAX) sock->read_size *= 2;
+		} else {
+			if (sock->read_size > NETWORK_SOCKET_READ_SIZE_MIN && (gsize)len < want / 2) sock->read_size /= 2;
+
+			break; /* a short read, the socket is drained */
+		}
+	}
+
+	sock->to_read = 0;
+
+	if (total > 0) network_socket_quickack(sock);
+
+	if (total > 0 && sock->is_compressed) return network_socket_decompress(sock);
+
+	return total > 0 ? NETWORK_SOCKET_SUCCESS : NETWORK_SOCKET_WAIT_FOR_EVENT;
+}
+
 #ifdef HAVE_WRITEV
+/**
+ * a per-thread iovec array for writev()
+ *
+ * allocated once per thread with the max. number of iovecs writev() accepts
+ */
+typedef struct {
+	struct iovec *iov;
+	gint iov_max;
+} network_socket_iov_t;
+
+static GStaticPrivate iov_key = G_STATIC_PRIVATE_INIT;
+
+static void network_socket_iov_free(gpointer _iov) {
+	network_socket_iov_t *iov = _iov;
+
+	g_free(iov->iov);
+	g_free(iov);
+}
+
+/**
+ * get the iovec array of the current thread
+ */
+static network_socket_iov_t *network_socket_iov_get_local(void) {
+	network_socket_iov_t *iov;
+
+	if (NULL != (iov = g_static_private_get(&iov_key))) return iov;
+
+	iov = g_new0(network_socket_iov_t, 1);
+	iov->iov_max = sysconf(_SC_IOV_MAX);
+
+	if (iov->iov_max < 0) { /* option is unknown */
+#if defined(UIO_MAXIOV)
+		iov->iov_max = UIO_MAXIOV; /* as defined in POSIX */
+#elif defined(IOV_MAX)
+		iov->iov_max = IOV_MAX; /* on older Linux'es */
+#else
+		g_assert_not_reached(); /* make sure we provide a work-around in case sysconf() fails on us */
+#endif
+	}
+	iov->iov = g_new0(struct iovec, iov->iov_max);
+
+	g_static_private_set(&iov_key, iov, network_socket_iov_free);
+
+	return iov;
+}
+
 /**
  * write data to the socket
  *
+ * all chunks (up to IOV_MAX) are sent with one writev(), tiny packets like the rows of a
+ * resultset get batched into one syscall that way
  */
-static network_socket_retval_t network_socket_write_writev(network_socket *con, int send_chunks) {
+static network_socket_retval_t network_socket_write_writev(network_socket *con, network_queue *send_queue, int send_chunks) {
 	/* send the whole queue */
-	GList *chunk;
+	network_socket_iov_t *iov_local;
 	struct iovec *iov;
-	gint chunk_id;
 	gint chunk_count;
 	gssize len;
 	int os_errno;
@@ -628,48 +1281,26 @@ static network_socket_retval_t network_socket_write_writev(network_socket *con,
 
 	if (send_chunks == 0) return NETWORK_SOCKET_SUCCESS;
 
-	chunk_count = send_chunks > 0 ? send_chunks : (gint)con->send_queue->chunks->length;
+	chunk_count = send_chunks > 0 ? send_chunks : (gint)send_queue->chunks->length;
 	
 	if (chunk_count == 0) return NETWORK_SOCKET_SUCCESS;
 
-	max_chunk_count = sysconf(_SC_IOV_MAX);
-
-	if (max_chunk_count < 0) { /* option is unknown */
-#if defined(UIO_MAXIOV)
-		max_chunk_count = UIO_MAXIOV; /* as defined in POSIX */
-#elif defined(IOV_MAX)
-		max_chunk_count = IOV_MAX; /* on older Linux'es */
-#else
-		g_assert_not_reached(); /* make sure we provide a work-around in case sysconf() fails on us */
-#endif
-	}
+	iov_local = network_socket_iov_get_local();
+	iov = iov_local->iov;
+	max_chunk_count = iov_local->iov_max;
 
 	chunk_count = chunk_count > max_chunk_count ? max_chunk_count : chunk_count;
 
 	g_assert_cmpint(chunk_count, >, 0); /* make sure it is never negative */
 
-	iov = g_new0(struct iovec, chunk_count);
-
-	for (chunk = con->send_queue->chunks->head, chunk_id = 0; 
-	     chunk && chunk_id < chunk_count; 
-	     chunk_id++, chunk = chunk->next) {
-		GString *s = chunk->data;
-	
-		if (chunk_id == 0) {
-			g_assert(con->send_queue->offset < s->len);
+	g_assert(send_queue->offset < ((GString *)g_queue_peek_head(send_queue->chunks))->len);
 
-			iov[chunk_id].iov_base = s->str + con->send_queue->offset;
-			iov[chunk_id].iov_len  = s->len - con->send_queue->offset;
-		} else {
-			iov[chunk_id].iov_base = s->str;
-			iov[chunk_id].iov_len  = s->len;
-		}
-	}
+	chunk_count = network_queue_get_iovec(send_queue, iov, chunk_count);
 
 	len = writev(con->fd, iov, chunk_count);
 	os_errno = errno;
 
-	g_free(iov);
+	con->write_syscalls++;
 
 	if (-1 == len) {
 		switch (os_errno) {
@@ -692,30 +1323,25 @@ static network_socket_retval_t network_socket_write_writev(network_socket *con,
 		return NETWORK_SOCKET_ERROR;
 	}
 
-	con->send_queue->offset += len;
-	con->send_queue->len    -= len;
-
-	/* check all the chunks which we have sent out */
-	for (chunk = con->send_queue->chunks->head; chunk; ) {
-		GString *s = chunk->data;
-
-		if (con->send_queue->offset >= s->len) {
-			con->send_queue->offset -= s->len;
 #ifdef NETWORK_DEBUG_TRACE_IO
-			/* to trace the data we sent to the socket, enable this */
-			g_debug_hexdump(G_STRLOC, S(s));
-#endif
-			g_string_free(s, TRUE);
-			
-			g_queue_delete_link(con->send_queue->chunks, chunk);
+	/* to trace the data we sent to the socket, enable this */
+	{
+		gssize traced;
+		gint i;
 
-			chunk = con->send_queue->chunks->head;
-		} else {
-			return NETWORK_SOCKET_WAIT_FOR_EVENT;
+		for (i = 0, traced = 0; i < chunk_count && traced < len; traced += iov[i].iov_len, i++) {
+			g_debug_hexdump(G_STRLOC, iov[i].iov_base, MIN((gssize)iov[i].iov_len, len - traced));
 		}
 	}
+#endif
 
-	return NETWORK_SOCKET_SUCCESS;
+	/* drops the chunks which we have sent out */
+	network_queue_advance(send_queue, len);
+	con->write_bytes        += len;
+	NETWORK_MYSQLD_METRICS_ADD(sent_bytes_total, len);
+	MYSQLPROXY_SOCKET_WRITE(con->fd, len);
+
+	return send_queue->chunks->length > 0 ? NETWORK_SOCKET_WAIT_FOR_EVENT : NETWORK_SOCKET_SUCCESS;
 }
 #endif
 
@@ -724,23 +1350,24 @@ static network_socket_retval_t network_socket_write_writev(network_socket *con,
  *
  * use a loop over send() to be compatible with win32
  */
-static network_socket_retval_t network_socket_write_send(network_socket *con, int send_chunks) {
+static network_socket_retval_t network_socket_write_send(network_socket *con, network_queue *send_queue, int send_chunks) {
 	/* send the whole queue */
 	GList *chunk;
 
 	if (send_chunks == 0) return NETWORK_SOCKET_SUCCESS;
 
-	for (chunk = con->send_queue->chunks->head; chunk; ) {
+	for (chunk = send_queue->chunks->head; chunk; ) {
 		GString *s = chunk->data;
 		gssize len;
 
-		g_assert(con->send_queue->offset < s->len);
+		g_assert(send_queue->offset < s->len);
 
 		if (con->socket_type == SOCK_STREAM) {
-			len = send(con->fd, s->str + con->send_queue->offset, s->len - con->send_queue->offset, 0);
+			len = send(con->fd, s->str + send_queue->offset, s->len - send_queue->offset, 0);
 		} else {
-			len = sendto(con->fd, s->str + con->send_queue->offset, s->len - con->send_queue->offset, 0, &(con->dst->addr.common), con->dst->len);
+			len = sendto(con->fd, s->str + send_queue->offset, s->len - send_queue->offset, 0, &(con->dst->addr.common), con->dst->len);
 		}
+		con->write_syscalls++;
 		if (-1 == len) {
 #ifdef _WIN32
 			errno = WSAGetLastError();
@@ -758,7 +1385,7 @@ static network_socket_retval_t network_socket_write_send(network_socket *con, in
 				g_message("%s: send(%s, %"G_GSIZE_FORMAT") failed: %s", 
 						G_STRLOC, 
 						con->dst->name->str, 
-						s->len - con->send_queue->offset, 
+						s->len - send_queue->offset, 
 						g_strerror(errno));
 				return NETWORK_SOCKET_ERROR;
 			}
@@ -766,17 +1393,20 @@ static network_socket_retval_t network_socket_write_send(network_socket *con, in
 			return NETWORK_SOCKET_ERROR;
 		}
 
-		con->send_queue->offset += len;
+		send_queue->offset += len;
+		con->write_bytes += len;
+		NETWORK_MYSQLD_METRICS_ADD(sent_bytes_total, len);
+		MYSQLPROXY_SOCKET_WRITE(con->fd, len);
 
-		if (con->send_queue->offset == s->len) {
-			g_string_free(s, TRUE);
+		if (send_queue->offset == s->len) {
+			network_buffer_pool_put(s);
 			
-			g_queue_delete_link(con->send_queue->chunks, chunk);
-			con->send_queue->offset = 0;
+			g_queue_delete_link(send_queue->chunks, chunk);
+			send_queue->offset = 0;
 
 			if (send_chunks > 0 && --send_chunks == 0) break;
 
-			chunk = con->send_queue->chunks->head;
+			chunk = send_queue->chunks->head;
 		} else {
 			return NETWORK_SOCKET_WAIT_FOR_EVENT;
 		}
@@ -785,6 +1415,46 @@ static network_socket_retval_t network_socket_write_send(network_socket *con, in
 	return NETWORK_SOCKET_SUCCESS;
 }
 
+/**
+ * switch the socket to the compressed protocol
+ *
+ * call it right after the handshake-response is read or written, the packet-ids
+ * of the compressed packets continue the ones of the handshake
+ */
+void network_socket_set_compressed(network_socket *sock) {
+	if (sock->is_compressed) return;
+
+	if (!sock->recv_queue_compressed) sock->recv_queue_compressed = network_queue_new();
+	if (!sock->send_queue_compressed) sock->send_queue_compressed = network_queue_new();
+
+	sock->is_compressed = TRUE;
+	sock->compress_pending = FALSE;
+	sock->compressed_packet_id = sock->last_packet_id + 1;
+}
+
+/**
+ * move the send-queue as compressed packets to the compressed send-queue
+ *
+ * the packet-ids of the compressed packets start at 0 with each new command. We
+ * can't see the command-boundaries here: if we read something since our last
+ * write and the first packet we send has the packet-id 0, it is a new command.
+ * Otherwise we continue the packet-ids of the packets we read or wrote last.
+ */
+static int network_socket_compress(network_socket *con) {
+	const gchar *header;
+
+	if (con->send_queue->len == 0) return 0;
+
+	if (con->compress_read_since_write &&
+	    NULL != (header = network_queue_peek_str(con->send_queue, NET_HEADER_SIZE)) &&
+	    header[3] == 0) {
+		con->compressed_packet_id = 0;
+	}
+	con->compress_read_since_write = FALSE;
+
+	return network_mysqld_compress_queue(con->send_queue_compressed, con->send_queue, &(con->compressed_packet_id));
+}
+
 /**
  * write a content of con->send_queue to the socket
  *
@@ -794,15 +1464,42 @@ static network_socket_retval_t network_socket_write_send(network_socket *con, in
  * @returns NETWORK_SOCKET_SUCCESS on success, NETWORK_SOCKET_ERROR on error and NETWORK_SOCKET_WAIT_FOR_EVENT if the call would have blocked 
  */
 network_socket_retval_t network_socket_write(network_socket *con, int send_chunks) {
-	if (con->socket_type == SOCK_STREAM) {
+	network_queue *send_queue = con->send_queue;
+	network_socket_retval_t ret;
+
+	if (con->is_compressed) {
+		if (0 != network_socket_compress(con)) return NETWORK_SOCKET_ERROR;
+
+		/* the compressed packets don't map to the chunks of the send-queue */
+		send_queue = con->send_queue_compressed;
+		send_chunks = -1;
+	}
+
+	/* the SSL request goes out in plain-text before the TLS handshake starts */
+	while (con->ssl && con->ssl_plain_chunks > 0) {
+		if (NETWORK_SOCKET_SUCCESS != (ret = network_socket_write_send(con, send_queue, 1))) return ret;
+
+		con->ssl_plain_chunks--;
+	}
+
+	if (con->ssl && !con->ssl_is_ktls_send) {
+		ret = network_ssl_write(con, send_queue);
+	} else if (con->socket_type == SOCK_STREAM) {
 #ifdef HAVE_WRITEV
-		return network_socket_write_writev(con, send_chunks);
+		ret = network_socket_write_writev(con, send_queue, send_chunks);
 #else
-		return network_socket_write_send(con, send_chunks);
+		ret = network_socket_write_send(con, send_queue, send_chunks);
 #endif
 	} else {
-		return network_socket_write_send(con, send_chunks);
+		ret = network_socket_write_send(con, send_queue, send_chunks);
 	}
+
+	if (ret == NETWORK_SOCKET_SUCCESS && con->compress_pending && con->send_queue->chunks->length == 0) {
+		/* the handshake-response is out, the answer to it is compressed already */
+		network_socket_set_compressed(con);
+	}
+
+	return ret;
 }
 
 network_socket_retval_t network_socket_to_read(network_socket *sock) {
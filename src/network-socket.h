@@ -60,6 +60,14 @@
 #include <event.h>
 
 #include "network-address.h"
+#include "network-stmt-cache.h"
+#include "chassis-timer-wheel.h"
+
+/**
+ * bounds of the adaptive read-size of network_socket_read_adaptive()
+ */
+#define NETWORK_SOCKET_READ_SIZE_MIN (16 * 1024)
+#define NETWORK_SOCKET_READ_SIZE_MAX (256 * 1024)
 
 typedef enum {
 	NETWORK_SOCKET_SUCCESS,
@@ -74,6 +82,7 @@ typedef struct network_mysqld_auth_response network_mysqld_auth_response;
 typedef struct {
 	int fd;             /**< socket-fd */
 	struct event event; /**< events for this fd */
+	chassis_timer_wheel_timer_t event_timer; /**< the timeout of .event, see chassis_event_add_with_timer() */
 
 	network_address *src; /**< getsockname() */
 	network_address *dst; /**< getpeername() */
@@ -89,6 +98,7 @@ typedef struct {
 
 	off_t header_read;
 	off_t to_read;
+	gsize read_size;    /**< current read-size of network_socket_read_adaptive() */
 	
 	/**
 	 * data extracted from the handshake  
@@ -105,19 +115,71 @@ typedef struct {
 	 * statement balancing
 	 */	
 	GString *default_db;     /** default-db of this side of the connection */
+
+	guint16 server_status;   /** server-status of the last OK/EOF we saw (autocommit, ...) */
+
+	gboolean reuse_port;     /** set SO_REUSEPORT before bind()ing the socket */
+	gboolean bind_src;       /** bind to .src before connect()ing, see network_backend_get_source_address() */
+	gboolean is_corked;      /** TCP_CORK is set, see network_socket_set_cork() */
+
+	guint64 write_syscalls;  /** number of writev()/send() calls on this socket */
+	guint64 write_bytes;     /** bytes written, write_bytes / write_syscalls is the batching ratio */
+
+	network_stmt_cache_t *prepared_stmts; /** statements prepared on this server-side connection, NULL until the first one */
+	GHashTable *session_vars;             /** session variables the clients SET on this server-side connection, name -> value, NULL until the first one */
+	gboolean session_is_dirty;            /** a client may have left session-state on this server-side connection since the last reset */
+
+	/**
+	 * the compressed protocol
+	 *
+	 * if is_compressed is set, recv_queue_raw and send_queue carry the uncompressed stream
+	 * and the compressed packets are buffered in the _compressed queues
+	 */
+	gboolean is_compressed;           /** CLIENT_COMPRESS was negotiated for this side of the connection */
+	gboolean compress_pending;        /** switch to the compressed protocol as soon as the send-queue is flushed */
+	gboolean compress_read_since_write; /** we got a compressed packet since the last write */
+	guint8   compressed_packet_id;    /** packet-id of the next compressed packet we send */
+	network_queue *recv_queue_compressed;
+	network_queue *send_queue_compressed;
+
+	/**
+	 * TLS, see network-ssl.h
+	 */
+	struct ssl_st *ssl;               /** TLS of this side of the connection, NULL if it isn't used */
+	gboolean ssl_is_expected;         /** the client may send a SSL request next, don't read beyond the next packet */
+	guint    ssl_plain_chunks;        /** chunks of the send-queue to send in plain-text before the TLS handshake */
+	gboolean ssl_is_ktls_send;        /** the kernel encrypts what we write, the plain write path can be used */
+	short    wait_events;             /** if set, the event to wait for instead of the one of the current state */
+
+	gboolean is_parked;               /** the queues are released while the socket idles, see network_socket_park() */
+
+	gpointer *persistent_wait_ref;    /** the connection whose persistent wait keeps .event registered, cleared by network_socket_event_del() */
 } network_socket;
 
 NETWORK_API network_socket *network_socket_init(void) G_GNUC_DEPRECATED;
 NETWORK_API network_socket *network_socket_new(void);
 NETWORK_API void network_socket_free(network_socket *s);
+NETWORK_API void network_socket_event_del(network_socket *s);
 NETWORK_API network_socket_retval_t network_socket_write(network_socket *con, int send_chunks);
 NETWORK_API network_socket_retval_t network_socket_read(network_socket *con);
+NETWORK_API network_socket_retval_t network_socket_read_adaptive(network_socket *sock);
 NETWORK_API network_socket_retval_t network_socket_to_read(network_socket *sock);
 NETWORK_API network_socket_retval_t network_socket_set_non_blocking(network_socket *sock);
+NETWORK_API void network_socket_set_cork(network_socket *sock, gboolean cork);
 NETWORK_API network_socket_retval_t network_socket_connect(network_socket *con);
 NETWORK_API network_socket_retval_t network_socket_connect_finish(network_socket *sock);
 NETWORK_API network_socket_retval_t network_socket_bind(network_socket *con);
+NETWORK_API void network_socket_set_compressed(network_socket *sock);
 NETWORK_API network_socket *network_socket_accept(network_socket *srv);
+NETWORK_API void network_socket_set_listen_backlog(gint backlog);
+NETWORK_API void network_socket_set_reuse_port(gboolean reuse_port);
+NETWORK_API void network_socket_set_defer_accept(gint secs);
+NETWORK_API void network_socket_set_busy_poll(gint usecs);
+NETWORK_API void network_socket_set_fast_open(gint qlen);
+NETWORK_API void network_socket_set_fast_open_connect(gboolean fast_open_connect);
+NETWORK_API gboolean network_socket_park(network_socket *sock);
+NETWORK_API void network_socket_unpark(network_socket *sock);
+NETWORK_API gsize network_socket_get_memory(network_socket *sock);
 
 #endif
 
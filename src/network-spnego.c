@@ -225,11 +225,77 @@ network_spnego_proto_get_init_token(network_packet *packet, network_spnego_init_
 	return TRUE;
 }
 
-gboolean
-network_spnego_proto_get_response_token(network_packet *packet, network_spnego_response_token *token, GError **gerr) {
+/**
+ * get the ENUMERATED of the negState of a response-token
+ */
+static gboolean
+network_spnego_proto_get_neg_state(network_packet *packet, network_spnego_response_state *state, GError **gerr) {
+	ASN1Identifier sub_id;
+	ASN1Length sub_len;
+	guint8 negState;
+
+	if (FALSE == network_asn1_proto_get_header(packet, &sub_id, &sub_len, gerr)) {
+		return FALSE;
+	}
+
+	if (sub_id.klass != ASN1_IDENTIFIER_KLASS_UNIVERSAL ||
+	    sub_id.value != ASN1_IDENTIFIER_UNIVERSAL_ENUM) {
+		g_set_error(gerr,
+				NETWORK_ASN1_ERROR,
+				NETWORK_ASN1_ERROR_INVALID,
+				"%s: ...", 
+				G_STRLOC);
+
+		return FALSE;
+	}
+
+	/* we should only get one byte */
+
+	if (FALSE == network_packet_get_data(packet, &negState, 1)) {
+		g_set_error(gerr,
+				NETWORK_ASN1_ERROR,
+				NETWORK_ASN1_ERROR_INVALID,
+				"%s: ...", 
+				G_STRLOC);
+
+		return FALSE;
+	}
+
+	switch (negState) {
+	case 0:
+		*state = SPNEGO_RESPONSE_STATE_ACCEPT_COMPLETED;
+		break;
+	case 1:
+		*state = SPNEGO_RESPONSE_STATE_ACCEPT_INCOMPLETE;
+		break;
+	case 2:
+		*state = SPNEGO_RESPONSE_STATE_ACCEPT_INCOMPLETE;
+		break;
+	case 3:
+		*state = SPNEGO_RESPONSE_STATE_ACCEPT_INCOMPLETE;
+		break;
+	default:
+		g_set_error(gerr,
+				NETWORK_ASN1_ERROR,
+				NETWORK_ASN1_ERROR_INVALID,
+				"%s: ...", 
+				G_STRLOC);
+
+		return FALSE;
+	}
+
+	return TRUE;
+}
+
+/**
+ * get the header of a response-token up to its SEQUENCE
+ *
+ * @param end_offset  the offset behind the SEQUENCE
+ */
+static gboolean
+network_spnego_proto_get_response_header(network_packet *packet, gsize *end_offset, GError **gerr) {
 	ASN1Identifier seq_id;
 	ASN1Length seq_len;
-	gsize end_offset;
 	ASN1Identifier spnego_id;
 	ASN1Length spnego_len;
 
@@ -263,14 +329,24 @@ network_spnego_proto_get_response_token(network_packet *packet, network_spnego_r
 		return FALSE;
 	}
 
-	end_offset = packet->offset + seq_len;
+	*end_offset = packet->offset + seq_len;
+
+	return TRUE;
+}
+
+gboolean
+network_spnego_proto_get_response_token(network_packet *packet, network_spnego_response_token *token, GError **gerr) {
+	gsize end_offset;
+
+	if (FALSE == network_spnego_proto_get_response_header(packet, &end_offset, gerr)) {
+		return FALSE;
+	}
 
 	while (packet->offset < end_offset) {
 		ASN1Identifier app_id;
 		ASN1Length app_len;
 		ASN1Identifier sub_id;
 		ASN1Length sub_len;
-		guint8 negState;
 
 		if (FALSE == network_asn1_proto_get_header(packet, &app_id, &app_len, gerr)) {
 			return FALSE;
@@ -287,53 +363,7 @@ network_spnego_proto_get_response_token(network_packet *packet, network_spnego_r
 
 		switch (app_id.value) {
 		case 0: /* negState */
-			if (FALSE == network_asn1_proto_get_header(packet, &sub_id, &sub_len, gerr)) {
-				return FALSE;
-			}
-
-			if (sub_id.klass != ASN1_IDENTIFIER_KLASS_UNIVERSAL ||
-			    sub_id.value != ASN1_IDENTIFIER_UNIVERSAL_ENUM) {
-				g_set_error(gerr,
-						NETWORK_ASN1_ERROR,
-						NETWORK_ASN1_ERROR_INVALID,
-						"%s: ...", 
-						G_STRLOC);
-
-				return FALSE;
-			}
-
-			/* we should only get one byte */
-
-			if (FALSE == network_packet_get_data(packet, &negState, 1)) {
-				g_set_error(gerr,
-						NETWORK_ASN1_ERROR,
-						NETWORK_ASN1_ERROR_INVALID,
-						"%s: ...", 
-						G_STRLOC);
-
-				return FALSE;
-			}
-
-			switch (negState) {
-			case 0:
-				token->negState = SPNEGO_RESPONSE_STATE_ACCEPT_COMPLETED;
-				break;
-			case 1:
-				token->negState = SPNEGO_RESPONSE_STATE_ACCEPT_INCOMPLETE;
-				break;
-			case 2:
-				token->negState = SPNEGO_RESPONSE_STATE_ACCEPT_INCOMPLETE;
-				break;
-			case 3:
-				token->negState = SPNEGO_RESPONSE_STATE_ACCEPT_INCOMPLETE;
-				break;
-			default:
-				g_set_error(gerr,
-						NETWORK_ASN1_ERROR,
-						NETWORK_ASN1_ERROR_INVALID,
-						"%s: ...", 
-						G_STRLOC);
-
+			if (FALSE == network_spnego_proto_get_neg_state(packet, &(token->negState), gerr)) {
 				return FALSE;
 			}
 
@@ -435,6 +465,60 @@ network_spnego_proto_get_response_token(network_packet *packet, network_spnego_r
 	return TRUE;
 }
 
+/**
+ * get the negState of a response-token without copying its fields
+ *
+ * the proxy only needs to know which side sends the next packet of the auth exchange. The
+ * supportedMech, the responseToken (a kerberos ticket can be several kbyte) and the
+ * mechListMIC are skipped. A response-token without a negState continues the exchange.
+ */
+gboolean
+network_spnego_proto_get_response_state(network_packet *packet, network_spnego_response_state *state, GError **gerr) {
+	gsize end_offset;
+
+	if (FALSE == network_spnego_proto_get_response_header(packet, &end_offset, gerr)) {
+		return FALSE;
+	}
+
+	*state = SPNEGO_RESPONSE_STATE_ACCEPT_INCOMPLETE;
+
+	while (packet->offset < end_offset) {
+		ASN1Identifier app_id;
+		ASN1Length app_len;
+
+		if (FALSE == network_asn1_proto_get_header(packet, &app_id, &app_len, gerr)) {
+			return FALSE;
+		}
+
+		if (app_id.klass != ASN1_IDENTIFIER_KLASS_CONTEXT_SPECIFIC) {
+			g_set_error(gerr,
+					NETWORK_ASN1_ERROR,
+					NETWORK_ASN1_ERROR_INVALID,
+					"expected a context specific tag");
+
+			return FALSE;
+		}
+
+		if (app_id.value == 0) { /* negState */
+			return network_spnego_proto_get_neg_state(packet, state, gerr);
+		}
+
+		if (FALSE == network_packet_skip(packet, app_len)) {
+			g_set_error(gerr,
+					NETWORK_ASN1_ERROR,
+					NETWORK_ASN1_ERROR_INVALID,
+					"%s: skipping %"G_GUINT64_FORMAT" bytes of tag %"G_GUINT64_FORMAT" failed",
+					G_STRLOC,
+					app_len,
+					app_id.value);
+
+			return FALSE;
+		}
+	}
+
+	return TRUE;
+}
+
 gboolean
 network_gssapi_proto_get_message_header(network_packet *packet, GString *oid, GError **gerr) {
 	ASN1Identifier gss_id;
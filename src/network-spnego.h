@@ -75,6 +75,9 @@ network_spnego_response_token_free(network_spnego_response_token *);
 gboolean
 network_spnego_proto_get_response_token(network_packet *packet, network_spnego_response_token *token, GError **gerr);
 
+gboolean
+network_spnego_proto_get_response_state(network_packet *packet, network_spnego_response_state *state, GError **gerr);
+
 network_spnego_init_token *
 network_spnego_init_token_new(void);
 
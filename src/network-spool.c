@@ -0,0 +1,229 @@
+/* $%BEGINLICENSE%$
+ Copyright (c) 2008, 2012, Oracle and/or its affiliates. All rights reserved.
+
+ This program is free software; you can redistribute it and/or
+ modify it under the terms of the GNU General Public License as
+ published by the Free Software Foundation; version 2 of the
+ License.
+
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ GNU General Public License for more details.
+
+ You should have received a copy of the GNU General Public License
+ along with this program; if not, write to the Free Software
+ Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA
+ 02110-1301  USA
+
+ $%ENDLICENSE%$ */
+#ifndef __NETWORK_FLOW_CONTROL_H__
+
+/** @file
+ * the spool of the results that don't fit into the send-queue
+ *
+ * the writes are collected in a buffer and go to the file in blocks. Once everything
+ * is read back the file is truncated, its space is reused by the next result.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <sys/types.h>
+#include <errno.h>
+#include <string.h>
+
+#ifdef _WIN32
+#include <io.h>
+#define ftruncate _chsize
+#else
+#include <unistd.h>
+#endif
+
+#include <glib.h>
+#include <glib/gstdio.h>
+
+#include "network-spool.h"
+
+/**
+ * the writes are flushed to the file in blocks of this size
+ */
+#define NETWORK_SPOOL_WBUF_SIZE (64 * 1024)
+
+GQuark network_spool_error(void) {
+	return g_quark_from_static_string("network-spool-error-quark");
+}
+
+network_spool_t *network_spool_new(void) {
+	network_spool_t *spool;
+
+	spool = g_new0(network_spool_t, 1);
+	spool->fd = -1;
+	spool->wbuf = g_string_new(NULL);
+
+	return spool;
+}
+
+void network_spool_free(network_spool_t *spool) {
+	if (!spool) return;
+
+	if (spool->fd != -1) close(spool->fd);
+	g_string_free(spool->wbuf, TRUE);
+
+	g_free(spool);
+}
+
+/**
+ * create the temporary file in g_get_tmp_dir() and unlink it right away
+ */
+static gboolean network_spool_open(network_spool_t *spool, GError **gerr) {
+	gchar *filename = NULL;
+	GError *open_err = NULL;
+
+	if (-1 == (spool->fd = g_file_open_tmp("mysql-proxy-spool-XXXXXX", &filename, &open_err))) {
+		g_set_error(gerr,
+				NETWORK_SPOOL_ERROR,
+				NETWORK_SPOOL_ERROR_OPEN,
+				"creating the spool-file failed: %s",
+				open_err->message);
+		g_error_free(open_err);
+
+		return FALSE;
+	}
+
+	/* on win32 a open file can't be unlinked, it stays until the temp-dir is cleaned up */
+	g_unlink(filename);
+	g_free(filename);
+
+	return TRUE;
+}
+
+static gboolean network_spool_flush(network_spool_t *spool, GError **gerr) {
+	gsize written = 0;
+
+	if (spool->wbuf->len == 0) return TRUE;
+
+	if (spool->fd == -1 && !network_spool_open(spool, gerr)) return FALSE;
+
+	if (-1 == lseek(spool->fd, spool->write_offset, SEEK_SET)) {
+		g_set_error(gerr,
+				NETWORK_SPOOL_ERROR,
+				NETWORK_SPOOL_ERROR_IO,
+				"lseek() on the spool-file failed: %s (%d)",
+				g_strerror(errno), errno);
+		return FALSE;
+	}
+
+	while (written < spool->wbuf->len) {
+		gssize len = write(spool->fd, spool->wbuf->str + written, spool->wbuf->len - written);
+
+		if (-1 == len) {
+			if (errno == EINTR) continue;
+
+			g_set_error(gerr,
+					NETWORK_SPOOL_ERROR,
+					NETWORK_SPOOL_ERROR_IO,
+					"writing to the spool-file failed: %s (%d)",
+					g_strerror(errno), errno);
+			return FALSE;
+		}
+
+		written += len;
+	}
+
+	spool->write_offset += written;
+	g_string_truncate(spool->wbuf, 0);
+
+	return TRUE;
+}
+
+/**
+ * append data to the spool
+ *
+ * @return FALSE if the temporary file couldn't be created or written, the data isn't in the spool then
+ */
+gboolean network_spool_write(network_spool_t *spool, const char *data, gsize len, GError **gerr) {
+	if (spool->wbuf->len + len > NETWORK_SPOOL_WBUF_SIZE && !network_spool_flush(spool, gerr)) {
+		return FALSE;
+	}
+
+	g_string_append_len(spool->wbuf, data, len);
+
+	return TRUE;
+}
+
+/**
+ * take the next bytes from the spool
+ *
+ * @param max_len   bytes to take at most
+ * @return the bytes, NULL if the spool is empty or on error (gerr is set then)
+ */
+GString *network_spool_read(network_spool_t *spool, gsize max_len, GError **gerr) {
+	GString *chunk;
+	gsize want;
+
+	if (spool->read_offset == spool->write_offset) {
+		/* all of the file is read back, the rest is still in the buffer */
+		if (spool->wbuf->len == 0) return NULL;
+
+		want = MIN(max_len, spool->wbuf->len);
+		chunk = g_string_new_len(spool->wbuf->str, want);
+		g_string_erase(spool->wbuf, 0, want);
+
+		return chunk;
+	}
+
+	want = MIN(max_len, (gsize)(spool->write_offset - spool->read_offset));
+	chunk = g_string_sized_new(want);
+
+	if (-1 == lseek(spool->fd, spool->read_offset, SEEK_SET)) {
+		g_set_error(gerr,
+				NETWORK_SPOOL_ERROR,
+				NETWORK_SPOOL_ERROR_IO,
+				"lseek() on the spool-file failed: %s (%d)",
+				g_strerror(errno), errno);
+		g_string_free(chunk, TRUE);
+		return NULL;
+	}
+
+	while (chunk->len < want) {
+		gssize len = read(spool->fd, chunk->str + chunk->len, want - chunk->len);
+
+		if (-1 == len && errno == EINTR) continue;
+
+		if (len <= 0) {
+			g_set_error(gerr,
+					NETWORK_SPOOL_ERROR,
+					NETWORK_SPOOL_ERROR_IO,
+					"reading from the spool-file failed: %s (%d)",
+					len == 0 ? "unexpected end of file" : g_strerror(errno), len == 0 ? 0 : errno);
+			g_string_free(chunk, TRUE);
+			return NULL;
+		}
+
+		chunk->len += len;
+	}
+	chunk->str[chunk->len] = '\0';
+
+	spool->read_offset += chunk->len;
+
+	if (spool->read_offset == spool->write_offset) {
+		/* give the space back, the next result starts at the beginning again */
+		if (0 != ftruncate(spool->fd, 0)) {
+			g_debug("%s: ftruncate() of the spool-file failed: %s (%d)",
+					G_STRLOC,
+					g_strerror(errno), errno);
+		}
+		spool->read_offset = spool->write_offset = 0;
+	}
+
+	return chunk;
+}
+
+/**
+ * bytes in the spool that are not read back yet
+ */
+guint64 network_spool_get_len(network_spool_t *spool) {
+	return (spool->write_offset - spool->read_offset) + spool->wbuf->len;
+}
@@ -0,0 +1,62 @@
+/* $%BEGINLICENSE%$
+ Copyright (c) 2008, 2012, Oracle and/or its affiliates. All rights reserved.
+
+ This program is free software; you can redistribute it and/or
+ modify it under the terms of the GNU General Public License as
+ published by the Free Software Foundation; version 2 of the
+ License.
+
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ GNU General Public License for more details.
+
+ You should have received a copy of the GNU General Public License
+ along with this program; if not, write to the Free Software
+ Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA
+ 02110-1301  USA
+
+ $%ENDLICENSE%$ */
+#ifndef __NETWORK_SPOOL_H__
+#define __NETWORK_SPOOL_H__
+
+#include <glib.h>
+
+#include "network-exports.h"
+
+/**
+ * a temporary file the tail of a result waits in for the client
+ *
+ * a slow client keeps its backend busy until it took the whole result: the server
+ * thread and the locks of the statement are held for as long as the client needs.
+ * Above a threshold the result goes to the spool instead of the send-queue, the
+ * server is read at full speed and is done with the statement as soon as the result
+ * is in the spool. The client is then served from it.
+ *
+ * the file is unlinked right after it is created, it goes away with the spool or the
+ * process. The bytes are read back in the order they were written.
+ */
+typedef struct {
+	int fd;                  /**< the unlinked temporary file, -1 until the first write */
+
+	GString *wbuf;           /**< the writes that are not in the file yet */
+
+	gint64 write_offset;     /**< end of the data in the file */
+	gint64 read_offset;      /**< start of the data not read back yet */
+} network_spool_t;
+
+#define NETWORK_SPOOL_ERROR network_spool_error()
+NETWORK_API GQuark network_spool_error(void);
+
+typedef enum {
+	NETWORK_SPOOL_ERROR_OPEN,    /**< the temporary file couldn't be created */
+	NETWORK_SPOOL_ERROR_IO       /**< writing or reading the temporary file failed */
+} network_spool_error_t;
+
+NETWORK_API network_spool_t *network_spool_new(void);
+NETWORK_API void network_spool_free(network_spool_t *spool);
+NETWORK_API gboolean network_spool_write(network_spool_t *spool, const char *data, gsize len, GError **gerr);
+NETWORK_API GString *network_spool_read(network_spool_t *spool, gsize max_len, GError **gerr);
+NETWORK_API guint64 network_spool_get_len(network_spool_t *spool);
+
+#endif
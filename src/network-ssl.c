@@ -0,0 +1,498 @@
+/* $%BEGINLICENSE%$
+ Copyright (c) 2008, 2012, Oracle and/or its affiliates. All rights reserved.
+
+ This program is free software; you can redistribute it and/or
+ modify it under the terms of the GNU General Public License as
+ published by the Free Software Foundation; version 2 of the
+ License.
+
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ GNU General Public License for more details.
+
+ You should have received a copy of the GNU General Public License
+ along with this program; if not, write to the Free Software
+ Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA
+ 02110-1301  USA
+
+ $%ENDLICENSE%$ */
+/**
+ * TLS for the client and the backend connections
+ *
+ * the TLS records are handled at the socket: network_socket_read() decrypts into
+ * the recv-queue-raw and network_socket_write() encrypts the send-queue. If the
+ * kernel supports it, the records we send are encrypted by the kernel (kTLS) and
+ * the send-queue is written with the plain writev() as before.
+ *
+ * the handshakes are non-blocking. As a handshake may have to read while the
+ * state-machine wants to write (and the other way around), the socket's
+ * ->wait_events tells the state-machine which event it has to wait for.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <string.h>
+#include <errno.h>
+
+#ifdef HAVE_OPENSSL_SSL_H
+#include <openssl/ssl.h>
+#include <openssl/err.h>
+#if OPENSSL_VERSION_NUMBER >= 0x10100000L
+/* older versions need locking callbacks to be thread-safe */
+#define HAVE_NETWORK_SSL
+#endif
+#endif
+
+#include "network-ssl.h"
+#include "network-buffer-pool.h"
+#include "network-mysqld-metrics.h"
+
+#if defined(HAVE_SYS_SDT_H) && defined(ENABLE_DTRACE)
+#include <sys/sdt.h>
+#include "proxy-dtrace-provider.h"
+#else
+#include "disable-dtrace.h"
+#endif
+
+#define C(x) x, sizeof(x) - 1
+
+#ifdef HAVE_NETWORK_SSL
+gboolean network_ssl_is_available(void) {
+	return TRUE;
+}
+
+/**
+ * log the errors of the OpenSSL error-queue
+ */
+static void network_ssl_log_errors(const gchar *op) {
+	unsigned long err;
+
+	while (0 != (err = ERR_get_error())) {
+		gchar errmsg[256];
+
+		ERR_error_string_n(err, errmsg, sizeof(errmsg));
+
+		g_critical("%s: %s failed: %s", G_STRLOC, op, errmsg);
+	}
+}
+
+/**
+ * remember the session of a backend to resume it on the next connect
+ */
+static int network_ssl_new_session(SSL *ssl, SSL_SESSION *sess) {
+	network_socket *sock = SSL_get_app_data(ssl);
+	network_ssl_ctx_t *ctx = SSL_CTX_get_app_data(SSL_get_SSL_CTX(ssl));
+
+	if (!sock || !sock->dst->name->len) return 0;
+
+	g_mutex_lock(ctx->sessions_mutex);
+	g_hash_table_insert(ctx->sessions, g_strdup(sock->dst->name->str), sess);
+	g_mutex_unlock(ctx->sessions_mutex);
+
+	return 1; /* we took the reference */
+}
+
+network_ssl_ctx_t *network_ssl_ctx_new(gboolean is_server) {
+	network_ssl_ctx_t *ctx;
+
+	ctx = g_new0(network_ssl_ctx_t, 1);
+	ctx->is_server = is_server;
+
+	if (NULL == (ctx->ctx = SSL_CTX_new(is_server ? TLS_server_method() : TLS_client_method()))) {
+		network_ssl_log_errors("SSL_CTX_new()");
+		g_free(ctx);
+		return NULL;
+	}
+	SSL_CTX_set_app_data(ctx->ctx, ctx);
+
+	SSL_CTX_set_min_proto_version(ctx->ctx, TLS1_2_VERSION);
+
+	/* we retry a write with the rest of the chunk, which may have moved */
+	SSL_CTX_set_mode(ctx->ctx, SSL_MODE_ENABLE_PARTIAL_WRITE | SSL_MODE_ACCEPT_MOVING_WRITE_BUFFER | SSL_MODE_RELEASE_BUFFERS);
+#ifdef SSL_OP_ENABLE_KTLS
+	SSL_CTX_set_options(ctx->ctx, SSL_OP_ENABLE_KTLS);
+#endif
+
+	if (is_server) {
+		/* clients reconnecting with a session-ticket skip the full handshake */
+		SSL_CTX_set_session_cache_mode(ctx->ctx, SSL_SESS_CACHE_SERVER);
+		SSL_CTX_set_session_id_context(ctx->ctx, (const unsigned char *)C("mysql-proxy"));
+	} else {
+		ctx->sessions = g_hash_table_new_full(g_str_hash, g_str_equal, g_free, (GDestroyNotify)SSL_SESSION_free);
+		ctx->sessions_mutex = g_mutex_new();
+
+		SSL_CTX_set_session_cache_mode(ctx->ctx, SSL_SESS_CACHE_CLIENT | SSL_SESS_CACHE_NO_INTERNAL_STORE);
+		SSL_CTX_sess_set_new_cb(ctx->ctx, network_ssl_new_session);
+
+		/* like the mysql client we don't verify the backend's certificate unless we got a CA */
+		SSL_CTX_set_verify(ctx->ctx, SSL_VERIFY_NONE, NULL);
+	}
+
+	return ctx;
+}
+
+void network_ssl_ctx_free(network_ssl_ctx_t *ctx) {
+	if (!ctx) return;
+
+	if (ctx->sessions) g_hash_table_destroy(ctx->sessions);
+	if (ctx->sessions_mutex) g_mutex_free(ctx->sessions_mutex);
+
+	SSL_CTX_free(ctx->ctx);
+
+	g_free(ctx);
+}
+
+/**
+ * load the certificate and the private key
+ *
+ * @return 0 on success, -1 on error
+ */
+int network_ssl_ctx_set_cert(network_ssl_ctx_t *ctx, const gchar *cert_file, const gchar *key_file) {
+	if (1 != SSL_CTX_use_certificate_chain_file(ctx->ctx, cert_file)) {
+		network_ssl_log_errors("SSL_CTX_use_certificate_chain_file()");
+		return -1;
+	}
+
+	if (1 != SSL_CTX_use_PrivateKey_file(ctx->ctx, key_file ? key_file : cert_file, SSL_FILETYPE_PEM)) {
+		network_ssl_log_errors("SSL_CTX_use_PrivateKey_file()");
+		return -1;
+	}
+
+	if (1 != SSL_CTX_check_private_key(ctx->ctx)) {
+		network_ssl_log_errors("SSL_CTX_check_private_key()");
+		return -1;
+	}
+
+	return 0;
+}
+
+/**
+ * verify the certificate of the peer against the CAs in ca_file
+ *
+ * @return 0 on success, -1 on error
+ */
+int network_ssl_ctx_set_ca(network_ssl_ctx_t *ctx, const gchar *ca_file) {
+	if (1 != SSL_CTX_load_verify_locations(ctx->ctx, ca_file, NULL)) {
+		network_ssl_log_errors("SSL_CTX_load_verify_locations()");
+		return -1;
+	}
+
+	SSL_CTX_set_verify(ctx->ctx, SSL_VERIFY_PEER, NULL);
+	ctx->verify_peer = TRUE;
+
+	return 0;
+}
+
+/**
+ * use the session-ticket key from key_file
+ *
+ * all proxies which share the key can resume the sessions of each other. Without
+ * it each proxy uses a random key and the clients only resume at the same proxy.
+ *
+ * @return 0 on success, -1 on error
+ */
+int network_ssl_ctx_set_ticket_key(network_ssl_ctx_t *ctx, const gchar *key_file) {
+	gchar *key;
+	gsize key_len;
+	GError *gerr = NULL;
+	int ret = 0;
+
+	if (!g_file_get_contents(key_file, &key, &key_len, &gerr)) {
+		g_critical("%s: reading the session-ticket key failed: %s", G_STRLOC, gerr->message);
+		g_error_free(gerr);
+		return -1;
+	}
+
+	if (key_len != NETWORK_SSL_TICKET_KEY_LEN) {
+		g_critical("%s: %s has to contain %d bytes, has %"G_GSIZE_FORMAT,
+				G_STRLOC, key_file, NETWORK_SSL_TICKET_KEY_LEN, key_len);
+		ret = -1;
+	} else if (1 != SSL_CTX_set_tlsext_ticket_keys(ctx->ctx, key, key_len)) {
+		network_ssl_log_errors("SSL_CTX_set_tlsext_ticket_keys()");
+		ret = -1;
+	}
+
+	memset(key, 0, key_len);
+	g_free(key);
+
+	return ret;
+}
+
+static int network_ssl_new(network_ssl_ctx_t *ctx, network_socket *sock) {
+	if (sock->ssl) {
+		g_critical("%s: TLS is already active on the socket", G_STRLOC);
+		return -1;
+	}
+
+	if (NULL == (sock->ssl = SSL_new(ctx->ctx))) {
+		network_ssl_log_errors("SSL_new()");
+		return -1;
+	}
+
+	if (1 != SSL_set_fd(sock->ssl, sock->fd)) {
+		network_ssl_log_errors("SSL_set_fd()");
+		SSL_free(sock->ssl);
+		sock->ssl = NULL;
+		return -1;
+	}
+	SSL_set_app_data(sock->ssl, sock);
+
+	return 0;
+}
+
+/**
+ * start a TLS handshake as server
+ *
+ * the handshake is driven by the next network_socket_read()
+ *
+ * @return 0 on success, -1 on error
+ */
+int network_ssl_accept(network_ssl_ctx_t *ctx, network_socket *sock) {
+	if (0 != network_ssl_new(ctx, sock)) return -1;
+
+	SSL_set_accept_state(sock->ssl);
+
+	return 0;
+}
+
+/**
+ * start a TLS handshake as client
+ *
+ * the session of the last connection to the same backend is resumed if possible.
+ * The handshake is driven by the next network_socket_write()
+ *
+ * @return 0 on success, -1 on error
+ */
+int network_ssl_connect(network_ssl_ctx_t *ctx, network_socket *sock, const gchar *host) {
+	SSL_SESSION *sess;
+
+	if (0 != network_ssl_new(ctx, sock)) return -1;
+
+	SSL_set_connect_state(sock->ssl);
+
+	/* the certificate has to be issued for the host we wanted to connect to, not just by our CA */
+	if (ctx->verify_peer) {
+		X509_VERIFY_PARAM *param = SSL_get0_param(sock->ssl);
+
+		if (NULL == host) {
+			g_critical("%s: can't verify the certificate of %s without its host", G_STRLOC, sock->dst->name->str);
+			network_ssl_free(sock);
+			return -1;
+		}
+
+		/* a IP-address is checked against the IP-addresses of the certificate */
+		if (1 != X509_VERIFY_PARAM_set1_ip_asc(param, host) &&
+		    1 != X509_VERIFY_PARAM_set1_host(param, host, 0)) {
+			network_ssl_log_errors("X509_VERIFY_PARAM_set1_host()");
+			network_ssl_free(sock);
+			return -1;
+		}
+	}
+
+	g_mutex_lock(ctx->sessions_mutex);
+	if (NULL != (sess = g_hash_table_lookup(ctx->sessions, sock->dst->name->str))) {
+		SSL_set_session(sock->ssl, sess);
+	}
+	g_mutex_unlock(ctx->sessions_mutex);
+
+	return 0;
+}
+
+void network_ssl_free(network_socket *sock) {
+	if (!sock->ssl) return;
+
+	/* send the close-notify if we can, but don't wait for the answer */
+	if (SSL_is_init_finished(sock->ssl)) SSL_shutdown(sock->ssl);
+	ERR_clear_error();
+
+	SSL_free(sock->ssl);
+	sock->ssl = NULL;
+}
+
+/**
+ * map the result of a SSL_*() call to the return value of the socket functions
+ */
+static network_socket_retval_t network_ssl_get_retval(network_socket *sock, int ret, const gchar *op) {
+	switch (SSL_get_error(sock->ssl, ret)) {
+	case SSL_ERROR_WANT_READ:
+		sock->wait_events = EV_READ;
+		return NETWORK_SOCKET_WAIT_FOR_EVENT;
+	case SSL_ERROR_WANT_WRITE:
+		sock->wait_events = EV_WRITE;
+		return NETWORK_SOCKET_WAIT_FOR_EVENT;
+	case SSL_ERROR_ZERO_RETURN:
+		/* the peer sent the close-notify, let the ioctl() handle the close for us */
+		return NETWORK_SOCKET_WAIT_FOR_EVENT;
+	case SSL_ERROR_SYSCALL:
+		g_debug("%s: %s failed: %s (errno=%d)", G_STRLOC, op, g_strerror(errno), errno);
+		ERR_clear_error();
+		return NETWORK_SOCKET_ERROR;
+	default:
+		network_ssl_log_errors(op);
+		return NETWORK_SOCKET_ERROR;
+	}
+}
+
+/**
+ * continue the handshake
+ *
+ * @return NETWORK_SOCKET_SUCCESS if the handshake is finished
+ */
+static network_socket_retval_t network_ssl_handshake(network_socket *sock) {
+	network_ssl_ctx_t *ctx;
+	int ret;
+
+	if (SSL_is_init_finished(sock->ssl)) return NETWORK_SOCKET_SUCCESS;
+
+	if (1 != (ret = SSL_do_handshake(sock->ssl))) {
+		return network_ssl_get_retval(sock, ret, "SSL_do_handshake()");
+	}
+
+	ctx = SSL_CTX_get_app_data(SSL_get_SSL_CTX(sock->ssl));
+	g_atomic_int_inc(&(ctx->handshakes));
+	if (SSL_session_reused(sock->ssl)) g_atomic_int_inc(&(ctx->resumed));
+
+#ifdef BIO_get_ktls_send
+	/* the kernel took over the encryption, we can write in plain-text from now on */
+	sock->ssl_is_ktls_send = BIO_get_ktls_send(SSL_get_wbio(sock->ssl)) ? TRUE : FALSE;
+#endif
+
+	return NETWORK_SOCKET_SUCCESS;
+}
+
+/**
+ * read and decrypt what the socket has
+ *
+ * @param sock the socket
+ * @param raw  the queue to append the plain-text to
+ * @return NETWORK_SOCKET_SUCCESS if we got something, NETWORK_SOCKET_WAIT_FOR_EVENT if not
+ */
+network_socket_retval_t network_ssl_read(network_socket *sock, network_queue *raw) {
+	network_socket_retval_t ret;
+	gsize total = 0;
+
+	sock->wait_events = 0;
+	sock->to_read = 0; /* FIONREAD counts the encrypted bytes, we read until SSL_read() wants more */
+
+	ERR_clear_error();
+
+	if (NETWORK_SOCKET_SUCCESS != (ret = network_ssl_handshake(sock))) return ret;
+
+	/* don't starve the other connections of this thread, but empty what OpenSSL buffered already
+	 * as we won't get a event for it */
+	while (total < NETWORK_SOCKET_READ_SIZE_MAX || SSL_pending(sock->ssl) > 0) {
+		GString *packet = network_buffer_pool_get(NETWORK_BUFFER_POOL_CHUNK_SIZE - 1);
+		int len;
+
+		len = SSL_read(sock->ssl, packet->str, packet->allocated_len - 1);
+		if (len <= 0) {
+			network_buffer_pool_put(packet);
+
+			if (NETWORK_SOCKET_ERROR == network_ssl_get_retval(sock, len, "SSL_read()")) return NETWORK_SOCKET_ERROR;
+			break;
+		}
+
+		packet->len = len;
+		packet->str[len] = '\0';
+		g_queue_push_tail(raw->chunks, packet);
+		raw->len += len;
+		total += len;
+		NETWORK_MYSQLD_METRICS_ADD(received_bytes_total, len);
+		MYSQLPROXY_SOCKET_READ(sock->fd, len);
+	}
+
+	if (total == 0) return NETWORK_SOCKET_WAIT_FOR_EVENT;
+
+	sock->wait_events = 0;
+
+	return NETWORK_SOCKET_SUCCESS;
+}
+
+/**
+ * encrypt and write the send-queue
+ *
+ * each chunk becomes at least one TLS record, the result-set writer already packs
+ * the small packets into chunks
+ */
+network_socket_retval_t network_ssl_write(network_socket *sock, network_queue *send_queue) {
+	network_socket_retval_t ret;
+	GString *s;
+
+	sock->wait_events = 0;
+
+	ERR_clear_error();
+
+	if (NETWORK_SOCKET_SUCCESS != (ret = network_ssl_handshake(sock))) return ret;
+
+	while ((s = g_queue_peek_head(send_queue->chunks))) {
+		int len;
+
+		g_assert(send_queue->offset < s->len);
+
+		len = SSL_write(sock->ssl, s->str + send_queue->offset, s->len - send_queue->offset);
+		sock->write_syscalls++;
+
+		if (len <= 0) return network_ssl_get_retval(sock, len, "SSL_write()");
+
+		send_queue->offset += len;
+		send_queue->len    -= len;
+		sock->write_bytes  += len;
+		NETWORK_MYSQLD_METRICS_ADD(sent_bytes_total, len);
+		MYSQLPROXY_SOCKET_WRITE(sock->fd, len);
+
+		if (send_queue->offset == s->len) {
+			network_buffer_pool_put(g_queue_pop_head(send_queue->chunks));
+			send_queue->offset = 0;
+		}
+	}
+
+	return NETWORK_SOCKET_SUCCESS;
+}
+#else
+gboolean network_ssl_is_available(void) {
+	return FALSE;
+}
+
+network_ssl_ctx_t *network_ssl_ctx_new(gboolean G_GNUC_UNUSED is_server) {
+	g_critical("%s: built without OpenSSL (>= 1.1.0), TLS isn't supported", G_STRLOC);
+
+	return NULL;
+}
+
+void network_ssl_ctx_free(network_ssl_ctx_t G_GNUC_UNUSED *ctx) {
+}
+
+int network_ssl_ctx_set_cert(network_ssl_ctx_t G_GNUC_UNUSED *ctx, const gchar G_GNUC_UNUSED *cert_file, const gchar G_GNUC_UNUSED *key_file) {
+	return -1;
+}
+
+int network_ssl_ctx_set_ca(network_ssl_ctx_t G_GNUC_UNUSED *ctx, const gchar G_GNUC_UNUSED *ca_file) {
+	return -1;
+}
+
+int network_ssl_ctx_set_ticket_key(network_ssl_ctx_t G_GNUC_UNUSED *ctx, const gchar G_GNUC_UNUSED *key_file) {
+	return -1;
+}
+
+int network_ssl_accept(network_ssl_ctx_t G_GNUC_UNUSED *ctx, network_socket G_GNUC_UNUSED *sock) {
+	return -1;
+}
+
+int network_ssl_connect(network_ssl_ctx_t G_GNUC_UNUSED *ctx, network_socket G_GNUC_UNUSED *sock, const gchar G_GNUC_UNUSED *host) {
+	return -1;
+}
+
+void network_ssl_free(network_socket G_GNUC_UNUSED *sock) {
+}
+
+network_socket_retval_t network_ssl_read(network_socket G_GNUC_UNUSED *sock, network_queue G_GNUC_UNUSED *raw) {
+	return NETWORK_SOCKET_ERROR;
+}
+
+network_socket_retval_t network_ssl_write(network_socket G_GNUC_UNUSED *sock, network_queue G_GNUC_UNUSED *send_queue) {
+	return NETWORK_SOCKET_ERROR;
+}
+#endif
@@ -0,0 +1,71 @@
+/* $%BEGINLICENSE%$
+ Copyright (c) 2008, 2012, Oracle and/or its affiliates. All rights reserved.
+
+ This program is free software; you can redistribute it and/or
+ modify it under the terms of the GNU General Public License as
+ published by the Free Software Foundation; version 2 of the
+ License.
+
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ GNU General Public License for more details.
+
+ You should have received a copy of the GNU General Public License
+ along with this program; if not, write to the Free Software
+ Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA
+ 02110-1301  USA
+
+ $%ENDLICENSE%$ */
+#ifndef __NETWORK_SSL_H__
+#define __NETWORK_SSL_H__
+
+#include <glib.h>
+
+#include "network-socket.h"
+
+#include "network-exports.h"
+
+/**
+ * a TLS context for one side of the connections
+ *
+ * the server-side context terminates the TLS of the clients, the client-side
+ * context is used for the connections to the backends
+ */
+typedef struct {
+	struct ssl_ctx_st *ctx;
+
+	gboolean is_server;
+
+	GHashTable *sessions;  /**< backend-address -> SSL_SESSION, the last session of each backend to resume */
+	GMutex *sessions_mutex;
+
+	gboolean verify_peer;       /**< a CA is set: the peer has to use TLS and have a certificate for its host */
+
+	volatile gint handshakes;   /**< finished handshakes */
+	volatile gint resumed;      /**< handshakes which resumed a session */
+} network_ssl_ctx_t;
+
+/**
+ * size of a session-ticket key file
+ *
+ * 16 bytes key-name, 16 bytes HMAC-secret, 16 bytes AES-key
+ */
+#define NETWORK_SSL_TICKET_KEY_LEN 48
+
+NETWORK_API gboolean network_ssl_is_available(void);
+
+NETWORK_API network_ssl_ctx_t *network_ssl_ctx_new(gboolean is_server);
+NETWORK_API void network_ssl_ctx_free(network_ssl_ctx_t *ctx);
+NETWORK_API int network_ssl_ctx_set_cert(network_ssl_ctx_t *ctx, const gchar *cert_file, const gchar *key_file);
+NETWORK_API int network_ssl_ctx_set_ca(network_ssl_ctx_t *ctx, const gchar *ca_file);
+NETWORK_API int network_ssl_ctx_set_ticket_key(network_ssl_ctx_t *ctx, const gchar *key_file);
+
+NETWORK_API int network_ssl_accept(network_ssl_ctx_t *ctx, network_socket *sock);
+NETWORK_API int network_ssl_connect(network_ssl_ctx_t *ctx, network_socket *sock, const gchar *host);
+NETWORK_API void network_ssl_free(network_socket *sock);
+
+NETWORK_API network_socket_retval_t network_ssl_read(network_socket *sock, network_queue *raw);
+NETWORK_API network_socket_retval_t network_ssl_write(network_socket *sock, network_queue *send_queue);
+
+#endif
@@ -0,0 +1,332 @@
+/* $%BEGINLICENSE%$
+ Copyright (c) 2008, 2012, Oracle and/or its affiliates. All rights reserved.
+
+ This program is free software; you can redistribute it and/or
+ modify it under the terms of the GNU General Public License as
+ published by the Free Software Foundation; version 2 of the
+ License.
+
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ GNU General Public License for more details.
+
+ You should have received a copy of the GNU General Public License
+ along with this program; if not, write to the Free Software
+ Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA
+ 02110-1301  USA
+
+ $%ENDLICENSE%$ */
+#include <string.h>
+
+#include "glib-ext.h"
+#include "network-mysqld-proto.h"
+#include "network-mysqld-packet.h"
+#include "network-stmt-cache.h"
+
+#define S(x) x->str, x->len
+
+static network_stmt_cache_entry_t *network_stmt_cache_entry_new(const GString *key, guint32 stmt_id, GPtrArray *packets) {
+	network_stmt_cache_entry_t *entry;
+
+	entry = g_new0(network_stmt_cache_entry_t, 1);
+	entry->key = g_string_new_len(S(key));
+	entry->stmt_id = stmt_id;
+	entry->packets = packets;
+	entry->link.data = entry;
+
+	return entry;
+}
+
+static void network_stmt_cache_entry_free(network_stmt_cache_entry_t *entry) {
+	guint i;
+
+	if (!entry) return;
+
+	for (i = 0; i < entry->packets->len; i++) {
+		g_string_free(entry->packets->pdata[i], TRUE);
+	}
+	g_ptr_array_free(entry->packets, TRUE);
+
+	g_string_free(entry->key, TRUE);
+
+	g_free(entry);
+}
+
+static void network_stmt_cache_coldefs_free(network_stmt_cache_coldefs_t *coldefs) {
+	if (!coldefs) return;
+
+	g_string_free(coldefs->packets, TRUE);
+	g_ref_unref(coldefs->fields);
+
+	g_free(coldefs);
+}
+
+network_stmt_cache_t *network_stmt_cache_new(guint max_entries) {
+	network_stmt_cache_t *cache;
+
+	cache = g_new0(network_stmt_cache_t, 1);
+	/* the keys are owned by the entries, the entries by the LRU list */
+	cache->entries = g_hash_table_new(g_hash_table_string_hash, g_hash_table_string_equal);
+	g_queue_init(&cache->lru);
+	cache->coldefs = g_hash_table_new_full(g_direct_hash, g_direct_equal, NULL, (GDestroyNotify)network_stmt_cache_coldefs_free);
+	cache->max_entries = max_entries;
+
+	return cache;
+}
+
+void network_stmt_cache_free(network_stmt_cache_t *cache) {
+	GList *l;
+
+	if (!cache) return;
+
+	g_hash_table_destroy(cache->entries);
+	g_hash_table_destroy(cache->coldefs);
+
+	while (NULL != (l = g_queue_pop_head_link(&cache->lru))) {
+		network_stmt_cache_entry_free(l->data);
+	}
+
+	g_free(cache);
+}
+
+/**
+ * build the key of a prepared statement
+ *
+ * the same statement refers to other tables in another default-db
+ *
+ * @param key        GString to store the key in
+ * @param default_db the default-db of the connection, may be NULL
+ */
+void network_stmt_cache_key_set(GString *key, const GString *default_db, const char *stmt_text, gsize stmt_text_len) {
+	g_string_truncate(key, 0);
+
+	if (default_db) g_string_append_len(key, S(default_db));
+	g_string_append_c(key, '\0');
+	g_string_append_len(key, stmt_text, stmt_text_len);
+}
+
+/**
+ * look up a prepared statement and mark it as recently used
+ *
+ * @return NULL if the statement isn't prepared on this connection
+ */
+network_stmt_cache_entry_t *network_stmt_cache_get(network_stmt_cache_t *cache, const GString *key) {
+	network_stmt_cache_entry_t *entry;
+
+	entry = g_hash_table_lookup(cache->entries, key);
+	if (NULL == entry) return NULL;
+
+	g_queue_unlink(&cache->lru, &entry->link);
+	g_queue_push_head_link(&cache->lru, &entry->link);
+
+	return entry;
+}
+
+/**
+ * remember the response of a successful COM_STMT_PREPARE
+ *
+ * takes over the packets, the statement-id is taken from the prepare-OK packet
+ *
+ * @return the new entry, NULL if the packets aren't a prepare-OK or the statement is already known
+ */
+network_stmt_cache_entry_t *network_stmt_cache_add(network_stmt_cache_t *cache, const GString *key, GPtrArray *packets) {
+	network_stmt_cache_entry_t *entry = NULL;
+	network_mysqld_stmt_prepare_ok_packet_t *prepare_ok;
+	network_packet p;
+	guint i;
+	int err = 0;
+
+	if (packets->len == 0 ||
+	    ((GString *)packets->pdata[0])->len <= NET_HEADER_SIZE ||
+	    ((GString *)packets->pdata[0])->str[NET_HEADER_SIZE] != MYSQLD_PACKET_OK ||
+	    NULL != g_hash_table_lookup(cache->entries, key)) {
+		err = 1;
+	}
+
+	if (!err) {
+		p.data = packets->pdata[0];
+		p.offset = 0;
+
+		prepare_ok = network_mysqld_stmt_prepare_ok_packet_new();
+		err = err || network_mysqld_proto_skip_network_header(&p);
+		err = err || network_mysqld_proto_get_stmt_prepare_ok_packet(&p, prepare_ok);
+
+		if (!err) {
+			entry = network_stmt_cache_entry_new(key, prepare_ok->stmt_id, packets);
+		}
+		network_mysqld_stmt_prepare_ok_packet_free(prepare_ok);
+	}
+
+	if (err) {
+		for (i = 0; i < packets->len; i++) {
+			g_string_free(packets->pdata[i], TRUE);
+		}
+		g_ptr_array_free(packets, TRUE);
+
+		return NULL;
+	}
+
+	g_hash_table_insert(cache->entries, entry->key, entry);
+	g_queue_push_head_link(&cache->lru, &entry->link);
+
+	return entry;
+}
+
+gboolean network_stmt_cache_is_full(network_stmt_cache_t *cache) {
+	return cache->lru.length >= cache->max_entries;
+}
+
+/**
+ * forget the least recently used statement
+ *
+ * the caller has to send a COM_STMT_CLOSE for it to the server
+ *
+ * @return the statement-id of the statement, 0 if the cache is empty
+ */
+guint32 network_stmt_cache_evict(network_stmt_cache_t *cache) {
+	network_stmt_cache_entry_t *entry;
+	GList *l;
+	guint32 stmt_id;
+
+	if (NULL == (l = g_queue_pop_tail_link(&cache->lru))) return 0;
+
+	entry = l->data;
+	stmt_id = entry->stmt_id;
+
+	g_hash_table_remove(cache->entries, entry->key);
+	g_hash_table_remove(cache->coldefs, GUINT_TO_POINTER(stmt_id));
+	network_stmt_cache_entry_free(entry);
+
+	return stmt_id;
+}
+
+/**
+ * check if the column-defs of a result-set are the ones we parsed before
+ *
+ * @param chunk the field-count packet of the result-set
+ */
+static gboolean network_stmt_cache_coldefs_match(network_stmt_cache_coldefs_t *coldefs, GList *chunk) {
+	network_mysqld_proto_fielddefs_t *fields = coldefs->fields->udata;
+	gsize offset = 0;
+	guint i;
+
+	for (i = 0; i <= fields->len; i++, chunk = chunk->next) {
+		GString *packet;
+		gsize len;
+
+		if (NULL == chunk) return FALSE;
+
+		packet = chunk->data;
+		if (packet->len < NET_HEADER_SIZE) return FALSE;
+
+		len = packet->len - NET_HEADER_SIZE;
+
+		if (offset + len > coldefs->packets->len ||
+		    0 != memcmp(coldefs->packets->str + offset, packet->str + NET_HEADER_SIZE, len)) {
+			return FALSE;
+		}
+		offset += len;
+	}
+
+	return offset == coldefs->packets->len;
+}
+
+/**
+ * get the column-defs of a result-set of a prepared statement
+ *
+ * they are only parsed for the first result-set of the statement and when they
+ * changed, e.g. after a ALTER TABLE made the server prepare it again
+ *
+ * @param stmt_id the statement-id on this backend connection
+ * @param chunk   the field-count packet of the result-set
+ * @return a new reference to the network_mysqld_proto_fielddefs_t, NULL if the
+ *         packets aren't a result-set
+ */
+GRef *network_stmt_cache_get_coldefs(network_stmt_cache_t *cache, guint32 stmt_id, GList *chunk) {
+	network_stmt_cache_coldefs_t *coldefs;
+	network_mysqld_proto_fielddefs_t *fields;
+	guint i;
+
+	coldefs = g_hash_table_lookup(cache->coldefs, GUINT_TO_POINTER(stmt_id));
+	if (NULL != coldefs && network_stmt_cache_coldefs_match(coldefs, chunk)) {
+		g_ref_ref(coldefs->fields);
+
+		return coldefs->fields;
+	}
+
+	fields = network_mysqld_proto_fielddefs_new();
+	if (NULL == network_mysqld_proto_get_fielddefs(chunk, fields)) {
+		network_mysqld_proto_fielddefs_free(fields);
+
+		return NULL;
+	}
+
+	/* the statement-ids of a connection aren't reused, a client that never closes
+	 * its statements leaves them behind */
+	if (NULL == coldefs && g_hash_table_size(cache->coldefs) >= cache->max_entries) {
+		g_hash_table_remove_all(cache->coldefs);
+	}
+
+	coldefs = g_new0(network_stmt_cache_coldefs_t, 1);
+	coldefs->packets = g_string_new(NULL);
+	for (i = 0; i <= fields->len; i++, chunk = chunk->next) {
+		GString *packet = chunk->data;
+
+		g_string_append_len(coldefs->packets, packet->str + NET_HEADER_SIZE, packet->len - NET_HEADER_SIZE);
+	}
+	coldefs->fields = g_ref_new();
+	g_ref_set(coldefs->fields, fields, (GDestroyNotify)network_mysqld_proto_fielddefs_free);
+
+	g_hash_table_replace(cache->coldefs, GUINT_TO_POINTER(stmt_id), coldefs);
+
+	g_ref_ref(coldefs->fields);
+
+	return coldefs->fields;
+}
+
+/**
+ * forget the column-defs of a statement that got closed
+ */
+void network_stmt_cache_forget_coldefs(network_stmt_cache_t *cache, guint32 stmt_id) {
+	g_hash_table_remove(cache->coldefs, GUINT_TO_POINTER(stmt_id));
+}
+
+/**
+ * get the statement-id of a prepare-OK or a COM_STMT_* packet
+ *
+ * in all of them it is the 4 bytes after the packet-type
+ *
+ * @param packet a packet including the network-header
+ */
+int network_stmt_cache_packet_get_stmt_id(const GString *packet, guint32 *stmt_id) {
+	const guchar *s;
+
+	if (packet->len < NET_HEADER_SIZE + 1 + 4) return -1;
+
+	s = (const guchar *)packet->str + NET_HEADER_SIZE + 1;
+
+	*stmt_id = s[0] | (s[1] << 8) | (s[2] << 16) | ((guint32)s[3] << 24);
+
+	return 0;
+}
+
+/**
+ * replace the statement-id of a prepare-OK or a COM_STMT_* packet
+ *
+ * @see network_stmt_cache_packet_get_stmt_id()
+ */
+int network_stmt_cache_packet_set_stmt_id(GString *packet, guint32 stmt_id) {
+	guchar *s;
+
+	if (packet->len < NET_HEADER_SIZE + 1 + 4) return -1;
+
+	s = (guchar *)packet->str + NET_HEADER_SIZE + 1;
+
+	s[0] = (stmt_id >>  0) & 0xff;
+	s[1] = (stmt_id >>  8) & 0xff;
+	s[2] = (stmt_id >> 16) & 0xff;
+	s[3] = (stmt_id >> 24) & 0xff;
+
+	return 0;
+}
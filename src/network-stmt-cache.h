@@ -0,0 +1,85 @@
+/* $%BEGINLICENSE%$
+ Copyright (c) 2008, 2012, Oracle and/or its affiliates. All rights reserved.
+
+ This program is free software; you can redistribute it and/or
+ modify it under the terms of the GNU General Public License as
+ published by the Free Software Foundation; version 2 of the
+ License.
+
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ GNU General Public License for more details.
+
+ You should have received a copy of the GNU General Public License
+ along with this program; if not, write to the Free Software
+ Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA
+ 02110-1301  USA
+
+ $%ENDLICENSE%$ */
+#ifndef __NETWORK_STMT_CACHE_H__
+#define __NETWORK_STMT_CACHE_H__
+
+#include <glib.h>
+
+#include "glib-ext-ref.h"
+#include "network-exports.h"
+
+/**
+ * prepared statements a backend connection keeps at most
+ */
+#define NETWORK_STMT_CACHE_MAX_ENTRIES 256
+
+/**
+ * a statement that is prepared on a backend connection
+ */
+typedef struct {
+	GString *key;          /**< the default-db and the statement, see network_stmt_cache_key_set() */
+	guint32 stmt_id;       /**< the statement-id the server assigned */
+	GPtrArray *packets;    /**< the response to the COM_STMT_PREPARE: the prepare-OK, the param and column defs */
+
+	GList link;            /**< our link in the LRU list of the cache */
+} network_stmt_cache_entry_t;
+
+/**
+ * the column-defs of the result-sets of a prepared statement
+ *
+ * the server sends them again with each COM_STMT_EXECUTE, they are only parsed
+ * again if they differ from the last ones
+ */
+typedef struct {
+	GString *packets;      /**< the field-count and the column-def packets, without their network-headers */
+	GRef *fields;          /**< the network_mysqld_proto_fielddefs_t parsed from them, shared with the result-sets */
+} network_stmt_cache_coldefs_t;
+
+/**
+ * the prepared statements of a backend connection
+ *
+ * lives as long as the server-side of the connection. A connection is only
+ * used by one client at a time, so there is no locking.
+ */
+typedef struct {
+	GHashTable *entries;   /**< key -> network_stmt_cache_entry_t */
+	GQueue lru;            /**< most recently used first */
+
+	GHashTable *coldefs;   /**< statement-id -> network_stmt_cache_coldefs_t */
+
+	guint max_entries;
+} network_stmt_cache_t;
+
+NETWORK_API network_stmt_cache_t *network_stmt_cache_new(guint max_entries);
+NETWORK_API void network_stmt_cache_free(network_stmt_cache_t *cache);
+NETWORK_API void network_stmt_cache_key_set(GString *key, const GString *default_db, const char *stmt_text, gsize stmt_text_len);
+
+NETWORK_API network_stmt_cache_entry_t *network_stmt_cache_get(network_stmt_cache_t *cache, const GString *key);
+NETWORK_API network_stmt_cache_entry_t *network_stmt_cache_add(network_stmt_cache_t *cache, const GString *key, GPtrArray *packets);
+NETWORK_API gboolean network_stmt_cache_is_full(network_stmt_cache_t *cache);
+NETWORK_API guint32 network_stmt_cache_evict(network_stmt_cache_t *cache);
+
+NETWORK_API GRef *network_stmt_cache_get_coldefs(network_stmt_cache_t *cache, guint32 stmt_id, GList *chunk);
+NETWORK_API void network_stmt_cache_forget_coldefs(network_stmt_cache_t *cache, guint32 stmt_id);
+
+NETWORK_API int network_stmt_cache_packet_get_stmt_id(const GString *packet, guint32 *stmt_id);
+NETWORK_API int network_stmt_cache_packet_set_stmt_id(GString *packet, guint32 stmt_id);
+
+#endif
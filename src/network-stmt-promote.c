@@ -0,0 +1,479 @@
+/* $%BEGINLICENSE%$
+ Copyright (c) 2008, 2012, Oracle and/or its affiliates. All rights reserved.
+
+ This program is free software; you can redistribute it and/or
+ modify it under the terms of the GNU General Public License as
+ published by the Free Software Foundation; version 2 of the
+ License.
+
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ GNU General Public License for more details.
+
+ You should have received a copy of the GNU General Public License
+ along with this program; if not, write to the Free Software
+ Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA
+ 02110-1301  USA
+
+ $%ENDLICENSE%$ */
+
+/** @file
+ * promote the hot text queries to server-side prepared statements
+ *
+ * a SELECT is split into the text of a prepared statement and its literals:
+ *
+ *   SELECT name FROM users WHERE id = 12 AND state = 'active' LIMIT 10
+ *
+ * becomes "SELECT name FROM users WHERE id = ? AND state = ? LIMIT ?" with the params
+ * 12, 'active' and 10. Only the literals behind FROM, WHERE, HAVING, LIMIT and ON are
+ * replaced, the ones of the select-list stay: a ? there would change the column-defs
+ * of the result. The positions of ORDER BY and GROUP BY stay as well.
+ *
+ * Unlike network_query_digest_fingerprint() lists aren't collapsed, the text has to
+ * have a ? for each param. Queries we can't split without changing their meaning
+ * aren't promoted: double-quoted strings (ANSI_QUOTES), strings with a backslash
+ * (NO_BACKSLASH_ESCAPES), introducers and typed literals like _utf8'a' or DATE '2010-10-27',
+ * hex, bit and float literals, executable comments, placeholders and multi-statements.
+ */
+
+#include <string.h>
+
+#ifdef _WIN32
+/* mysql.h needs SOCKET defined */
+#include <winsock2.h>
+#endif
+#include <mysql.h>
+
+#include "network_mysqld_type.h"
+#include "network-stmt-promote.h"
+
+#define FNV1A_64_INIT  G_GUINT64_CONSTANT(14695981039346656037)
+#define FNV1A_64_PRIME G_GUINT64_CONSTANT(1099511628211)
+
+/**
+ * subqueries and parentheses we follow at most
+ */
+#define NETWORK_STMT_PROMOTE_MAX_DEPTH 32
+
+typedef struct {
+	guint count;            /**< executions seen, stops at the threshold */
+	gboolean is_blocked;    /**< the backend couldn't prepare it */
+} network_stmt_promote_shape_t;
+
+typedef enum {
+	NETWORK_STMT_PROMOTE_TOKEN_NONE,
+	NETWORK_STMT_PROMOTE_TOKEN_WORD,
+	NETWORK_STMT_PROMOTE_TOKEN_BY,
+	NETWORK_STMT_PROMOTE_TOKEN_TYPE,    /**< DATE, TIME or TIMESTAMP, a string behind it is a typed literal */
+	NETWORK_STMT_PROMOTE_TOKEN_STRING,
+	NETWORK_STMT_PROMOTE_TOKEN_NUMBER,
+	NETWORK_STMT_PROMOTE_TOKEN_COMMA,
+	NETWORK_STMT_PROMOTE_TOKEN_OTHER
+} network_stmt_promote_token_t;
+
+static guint network_stmt_promote_hash_func(gconstpointer key) {
+	guint64 h = *(const guint64 *)key;
+
+	return (guint)(h ^ (h >> 32));
+}
+
+static gboolean network_stmt_promote_equal_func(gconstpointer a, gconstpointer b) {
+	return *(const guint64 *)a == *(const guint64 *)b;
+}
+
+network_stmt_promote_t *network_stmt_promote_new(guint threshold) {
+	network_stmt_promote_t *promote;
+
+	promote = g_new0(network_stmt_promote_t, 1);
+	promote->mutex = g_mutex_new();
+	promote->shapes = g_hash_table_new_full(network_stmt_promote_hash_func, network_stmt_promote_equal_func, g_free, g_free);
+	promote->threshold = MAX(threshold, 1);
+	promote->max_shapes = NETWORK_STMT_PROMOTE_MAX_SHAPES;
+
+	return promote;
+}
+
+void network_stmt_promote_free(network_stmt_promote_t *promote) {
+	if (!promote) return;
+
+	g_hash_table_destroy(promote->shapes);
+	g_mutex_free(promote->mutex);
+
+	g_free(promote);
+}
+
+static gboolean network_stmt_promote_is_ident_char(gchar c) {
+	return g_ascii_isalnum(c) || c == '_' || c == '$' || c == '@' || (guchar)c >= 0x80;
+}
+
+static gboolean network_stmt_promote_word_is(const char *word, gsize word_len, const char *keyword) {
+	return word_len == strlen(keyword) && 0 == g_ascii_strncasecmp(word, keyword, word_len);
+}
+
+/**
+ * a number literal as param: BIGINT if it fits, DECIMAL otherwise
+ */
+static void network_stmt_promote_params_add_number(GPtrArray *params, const char *s, gsize s_len, gboolean is_decimal) {
+	network_mysqld_type_t *param;
+	guint64 i = 0;
+	gsize ndx;
+
+	for (ndx = 0; !is_decimal && ndx < s_len; ndx++) {
+		guint digit = s[ndx] - '0';
+
+		if (i > (G_MAXINT64 - digit) / 10) {
+			is_decimal = TRUE;
+		} else {
+			i = i * 10 + digit;
+		}
+	}
+
+	if (is_decimal) {
+		param = network_mysqld_type_new(MYSQL_TYPE_NEWDECIMAL);
+		network_mysqld_type_set_string(param, s, s_len);
+	} else {
+		param = network_mysqld_type_new(MYSQL_TYPE_LONGLONG);
+		network_mysqld_type_set_int(param, i, FALSE);
+	}
+
+	g_ptr_array_add(params, param);
+}
+
+/**
+ * split a SELECT into the text of a prepared statement and its literals
+ *
+ * comments are removed and whitespace is collapsed to one space like in
+ * network_query_digest_fingerprint()
+ *
+ * @param stmt_text the text of the statement is appended to it
+ * @param hash      the 64bit FNV-1a hash of the text
+ * @param params    the literals are appended as network_mysqld_type_t, free them with network_mysqld_type_free()
+ * @param query     the query
+ * @param query_len length of the query
+ * @return 0 on success, -1 if the query can't be promoted (the params are left empty)
+ */
+int network_stmt_promote_parameterize(GString *stmt_text, guint64 *hash, GPtrArray *params, const char *query, gsize query_len) {
+	gboolean is_value[NETWORK_STMT_PROMOTE_MAX_DEPTH + 1]; /**< the literals at the depth are values */
+	gboolean is_by_list[NETWORK_STMT_PROMOTE_MAX_DEPTH + 1]; /**< we are in a ORDER BY or GROUP BY list */
+	gboolean is_query[NETWORK_STMT_PROMOTE_MAX_DEPTH + 1]; /**< the depth has a SELECT, not only a function call */
+	network_stmt_promote_token_t prev = NETWORK_STMT_PROMOTE_TOKEN_NONE;
+	guint params_start = params->len;
+	gsize start = stmt_text->len;
+	guint depth = 0;
+	gsize i = 0;
+	gboolean need_space = FALSE;
+	guint64 h = FNV1A_64_INIT;
+	GString *value = NULL;
+	int err = 0;
+
+	is_value[0] = FALSE;
+	is_by_list[0] = FALSE;
+	is_query[0] = FALSE;
+
+	while (0 == err && i < query_len) {
+		gchar c = query[i];
+
+		if (g_ascii_isspace(c)) {
+			need_space = TRUE;
+			i++;
+			continue;
+		}
+
+		if (c == '#' ||
+		    (c == '-' && i + 1 < query_len && query[i + 1] == '-' &&
+		     (i + 2 == query_len || g_ascii_isspace(query[i + 2])))) {
+			while (i < query_len && query[i] != '\n') i++;
+
+			need_space = TRUE;
+			continue;
+		}
+
+		if (c == '/' && i + 1 < query_len && query[i + 1] == '*') {
+			/* the executable comments are part of the statement */
+			if (i + 2 < query_len && query[i + 2] == '!') {
+				err = -1;
+				break;
+			}
+			for (i += 2; i + 1 < query_len && !(query[i] == '*' && query[i + 1] == '/'); i++);
+			i = MIN(i + 2, query_len);
+
+			need_space = TRUE;
+			continue;
+		}
+
+		/* the statement has to start with SELECT */
+		if (prev == NETWORK_STMT_PROMOTE_TOKEN_NONE && !g_ascii_isalpha(c)) {
+			err = -1;
+			break;
+		}
+
+		if (c == '\'') {
+			gsize s = i;
+
+			/* 'a' 'b' is one string, a string behind DATE is a typed literal */
+			if (prev == NETWORK_STMT_PROMOTE_TOKEN_STRING ||
+			    prev == NETWORK_STMT_PROMOTE_TOKEN_TYPE) {
+				err = -1;
+				break;
+			}
+
+			if (NULL == value) value = g_string_new(NULL);
+			g_string_truncate(value, 0);
+
+			for (i++; i < query_len; i++) {
+				if (query[i] == '\\') {
+					/* we don't know if NO_BACKSLASH_ESCAPES is set */
+					err = -1;
+					break;
+				} else if (query[i] == '\'') {
+					if (i + 1 < query_len && query[i + 1] == '\'') { /* a doubled quote */
+						i++;
+					} else {
+						break;
+					}
+				}
+				g_string_append_c(value, query[i]);
+			}
+			if (0 != err) break;
+			if (i == query_len) { /* not terminated */
+				err = -1;
+				break;
+			}
+			i++;
+
+			if (need_space && stmt_text->len > start) g_string_append_c(stmt_text, ' ');
+
+			if (is_value[depth]) {
+				network_mysqld_type_t *param;
+
+				param = network_mysqld_type_new(MYSQL_TYPE_STRING);
+				network_mysqld_type_set_string(param, value->str, value->len);
+				g_ptr_array_add(params, param);
+
+				g_string_append_c(stmt_text, '?');
+			} else {
+				g_string_append_len(stmt_text, query + s, i - s);
+			}
+			prev = NETWORK_STMT_PROMOTE_TOKEN_STRING;
+		} else if (c == '"' || c == '?' || c == ';') {
+			err = -1;
+			break;
+		} else if (c == '`') {
+			gsize s = i;
+
+			for (i++; i < query_len; i++) {
+				if (query[i] != '`') continue;
+
+				if (i + 1 < query_len && query[i + 1] == '`') { /* a doubled backtick */
+					i++;
+				} else {
+					break;
+				}
+			}
+			if (i == query_len) {
+				err = -1;
+				break;
+			}
+			i++;
+
+			if (need_space && stmt_text->len > start) g_string_append_c(stmt_text, ' ');
+			g_string_append_len(stmt_text, query + s, i - s);
+
+			prev = NETWORK_STMT_PROMOTE_TOKEN_WORD;
+		} else if (g_ascii_isdigit(c) ||
+		           (c == '.' && i + 1 < query_len && g_ascii_isdigit(query[i + 1]) &&
+		            (need_space || (prev != NETWORK_STMT_PROMOTE_TOKEN_WORD && prev != NETWORK_STMT_PROMOTE_TOKEN_BY)))) {
+			gsize s = i;
+			gboolean is_decimal = FALSE;
+
+			/* 12, 1.5, .5 ... but not 1e3, 0x1f, 0b01 or 1st */
+			for (; i < query_len; i++) {
+				if (g_ascii_isdigit(query[i])) continue;
+				if (query[i] == '.' && !is_decimal) {
+					is_decimal = TRUE;
+					continue;
+				}
+
+				break;
+			}
+			if (i < query_len && (network_stmt_promote_is_ident_char(query[i]) || query[i] == '.')) {
+				err = -1;
+				break;
+			}
+
+			if (need_space && stmt_text->len > start) g_string_append_c(stmt_text, ' ');
+
+			if (is_value[depth] &&
+			    !(is_by_list[depth] && (prev == NETWORK_STMT_PROMOTE_TOKEN_BY || prev == NETWORK_STMT_PROMOTE_TOKEN_COMMA))) {
+				network_stmt_promote_params_add_number(params, query + s, i - s, is_decimal);
+
+				g_string_append_c(stmt_text, '?');
+			} else {
+				g_string_append_len(stmt_text, query + s, i - s);
+			}
+			prev = NETWORK_STMT_PROMOTE_TOKEN_NUMBER;
+		} else if (network_stmt_promote_is_ident_char(c)) {
+			const char *word = query + i;
+			gsize word_len;
+
+			for (i++; i < query_len && network_stmt_promote_is_ident_char(query[i]); i++);
+			word_len = query + i - word;
+
+			/* N'a', _utf8'a', X'1f', @'a' */
+			if (i < query_len && (query[i] == '\'' || query[i] == '"' || query[i] == '`')) {
+				err = -1;
+				break;
+			}
+
+			if (prev == NETWORK_STMT_PROMOTE_TOKEN_NONE && !network_stmt_promote_word_is(word, word_len, "SELECT")) {
+				err = -1;
+				break;
+			}
+
+			prev = NETWORK_STMT_PROMOTE_TOKEN_WORD;
+
+			if (network_stmt_promote_word_is(word, word_len, "SELECT")) {
+				is_value[depth] = FALSE;
+				is_by_list[depth] = FALSE;
+				is_query[depth] = TRUE;
+			} else if (!is_query[depth]) {
+				/* the FROM of EXTRACT(YEAR FROM d) doesn't start the values */
+			} else if (network_stmt_promote_word_is(word, word_len, "FROM") ||
+			           network_stmt_promote_word_is(word, word_len, "WHERE") ||
+			           network_stmt_promote_word_is(word, word_len, "ON")) {
+				is_value[depth] = TRUE;
+			} else if (network_stmt_promote_word_is(word, word_len, "HAVING") ||
+			           network_stmt_promote_word_is(word, word_len, "LIMIT")) {
+				is_value[depth] = TRUE;
+				is_by_list[depth] = FALSE;
+			} else if (network_stmt_promote_word_is(word, word_len, "BY")) {
+				is_by_list[depth] = TRUE;
+				prev = NETWORK_STMT_PROMOTE_TOKEN_BY;
+			} else if (network_stmt_promote_word_is(word, word_len, "UNION") ||
+			           network_stmt_promote_word_is(word, word_len, "FOR") ||
+			           network_stmt_promote_word_is(word, word_len, "LOCK") ||
+			           network_stmt_promote_word_is(word, word_len, "WINDOW") ||
+			           network_stmt_promote_word_is(word, word_len, "PROCEDURE")) {
+				is_by_list[depth] = FALSE;
+			} else if (network_stmt_promote_word_is(word, word_len, "INTO")) {
+				/* SELECT ... INTO writes */
+				err = -1;
+				break;
+			} else if (network_stmt_promote_word_is(word, word_len, "DATE") ||
+			           network_stmt_promote_word_is(word, word_len, "TIME") ||
+			           network_stmt_promote_word_is(word, word_len, "TIMESTAMP")) {
+				prev = NETWORK_STMT_PROMOTE_TOKEN_TYPE;
+			}
+
+			if (need_space && stmt_text->len > start) g_string_append_c(stmt_text, ' ');
+			g_string_append_len(stmt_text, word, word_len);
+		} else {
+			if (c == '(') {
+				if (depth == NETWORK_STMT_PROMOTE_MAX_DEPTH) {
+					err = -1;
+					break;
+				}
+				depth++;
+				is_value[depth] = is_value[depth - 1];
+				is_by_list[depth] = FALSE;
+				is_query[depth] = FALSE;
+			} else if (c == ')') {
+				if (depth == 0) {
+					err = -1;
+					break;
+				}
+				depth--;
+			}
+
+			if (need_space && stmt_text->len > start) g_string_append_c(stmt_text, ' ');
+			g_string_append_c(stmt_text, c);
+			i++;
+
+			prev = (c == ',') ? NETWORK_STMT_PROMOTE_TOKEN_COMMA : NETWORK_STMT_PROMOTE_TOKEN_OTHER;
+		}
+		need_space = FALSE;
+	}
+
+	if (value) g_string_free(value, TRUE);
+
+	if (0 != err || prev == NETWORK_STMT_PROMOTE_TOKEN_NONE || depth != 0) {
+		while (params->len > params_start) {
+			network_mysqld_type_free(g_ptr_array_remove_index(params, params->len - 1));
+		}
+		g_string_truncate(stmt_text, start);
+
+		return -1;
+	}
+
+	for (i = start; i < stmt_text->len; i++) {
+		h ^= (guchar)stmt_text->str[i];
+		h *= FNV1A_64_PRIME;
+	}
+	*hash = h;
+
+	return 0;
+}
+
+/**
+ * count a execution of a shape
+ *
+ * a full table forgets the shapes that didn't get hot, new shapes aren't counted
+ * while it stays full
+ *
+ * @return TRUE if the shape is hot and not blocked
+ */
+gboolean network_stmt_promote_is_hot(network_stmt_promote_t *promote, guint64 hash) {
+	network_stmt_promote_shape_t *shape;
+	gboolean is_hot = FALSE;
+
+	g_mutex_lock(promote->mutex);
+	if (NULL == (shape = g_hash_table_lookup(promote->shapes, &hash))) {
+		if (g_hash_table_size(promote->shapes) >= promote->max_shapes) {
+			GHashTableIter iter;
+			gpointer value;
+
+			g_hash_table_iter_init(&iter, promote->shapes);
+			while (g_hash_table_iter_next(&iter, NULL, &value)) {
+				network_stmt_promote_shape_t *cold = value;
+
+				if (!cold->is_blocked && cold->count < promote->threshold) g_hash_table_iter_remove(&iter);
+			}
+		}
+
+		if (g_hash_table_size(promote->shapes) < promote->max_shapes) {
+			guint64 *key = g_new(guint64, 1);
+
+			*key = hash;
+			shape = g_new0(network_stmt_promote_shape_t, 1);
+			g_hash_table_insert(promote->shapes, key, shape);
+		}
+	}
+
+	if (shape && !shape->is_blocked) {
+		if (shape->count < promote->threshold) shape->count++;
+
+		is_hot = (shape->count >= promote->threshold);
+	}
+	g_mutex_unlock(promote->mutex);
+
+	return is_hot;
+}
+
+/**
+ * don't promote a shape again, the backend couldn't prepare or execute it
+ */
+void network_stmt_promote_block(network_stmt_promote_t *promote, guint64 hash) {
+	network_stmt_promote_shape_t *shape;
+
+	g_mutex_lock(promote->mutex);
+	if (NULL == (shape = g_hash_table_lookup(promote->shapes, &hash))) {
+		guint64 *key = g_new(guint64, 1);
+
+		*key = hash;
+		shape = g_new0(network_stmt_promote_shape_t, 1);
+		g_hash_table_insert(promote->shapes, key, shape);
+	}
+	shape->is_blocked = TRUE;
+	g_mutex_unlock(promote->mutex);
+}
@@ -0,0 +1,55 @@
+/* $%BEGINLICENSE%$
+ Copyright (c) 2008, 2012, Oracle and/or its affiliates. All rights reserved.
+
+ This program is free software; you can redistribute it and/or
+ modify it under the terms of the GNU General Public License as
+ published by the Free Software Foundation; version 2 of the
+ License.
+
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ GNU General Public License for more details.
+
+ You should have received a copy of the GNU General Public License
+ along with this program; if not, write to the Free Software
+ Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA
+ 02110-1301  USA
+
+ $%ENDLICENSE%$ */
+#ifndef __NETWORK_STMT_PROMOTE_H__
+#define __NETWORK_STMT_PROMOTE_H__
+
+#include <glib.h>
+
+#include "network-exports.h"
+
+/**
+ * shapes we count the executions of at most
+ */
+#define NETWORK_STMT_PROMOTE_MAX_SHAPES 4096
+
+/**
+ * the statement shapes of the text queries that are promoted to prepared statements
+ *
+ * a shape is the text of the query with its literals replaced by ?, see
+ * network_stmt_promote_parameterize(). It is hot once it was seen --proxy-stmt-promote-threshold
+ * times, a shape the backend couldn't prepare is blocked. The event-threads share the
+ * shapes, a connection only asks for the ones it hasn't prepared yet.
+ */
+typedef struct {
+	GMutex *mutex;          /**< protects .shapes */
+	GHashTable *shapes;     /**< shape hash -> network_stmt_promote_shape_t */
+
+	guint threshold;        /**< executions before a shape is promoted */
+	guint max_shapes;
+} network_stmt_promote_t;
+
+NETWORK_API network_stmt_promote_t *network_stmt_promote_new(guint threshold);
+NETWORK_API void network_stmt_promote_free(network_stmt_promote_t *promote);
+
+NETWORK_API int network_stmt_promote_parameterize(GString *stmt_text, guint64 *hash, GPtrArray *params, const char *query, gsize query_len);
+NETWORK_API gboolean network_stmt_promote_is_hot(network_stmt_promote_t *promote, guint64 hash);
+NETWORK_API void network_stmt_promote_block(network_stmt_promote_t *promote, guint64 hash);
+
+#endif
@@ -0,0 +1,169 @@
+/* $%BEGINLICENSE%$
+ Copyright (c) 2008, 2012, Oracle and/or its affiliates. All rights reserved.
+
+ This program is free software; you can redistribute it and/or
+ modify it under the terms of the GNU General Public License as
+ published by the Free Software Foundation; version 2 of the
+ License.
+
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ GNU General Public License for more details.
+
+ You should have received a copy of the GNU General Public License
+ along with this program; if not, write to the Free Software
+ Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA
+ 02110-1301  USA
+
+ $%ENDLICENSE%$ */
+/** @file
+ * proxy.timer()
+ *
+ * run a function of the script periodically, off the path of the queries:
+ *
+ *   if not proxy.global.flush_timer then
+ *     proxy.global.flush_timer = proxy.timer(10, function (timer)
+ *       -- flush the stats every 10 seconds
+ *     end)
+ *   end
+ *
+ * the timer runs on the event-thread that called proxy.timer(), see chassis_event_timer_new(),
+ * and calls the function with the lua-scope of the script locked. The script runs for each
+ * new connection, guard the call like above to only start one timer per lua-scope.
+ */
+
+#include <lua.h>
+#include <lauxlib.h>
+
+#include "lua-env.h"
+#include "lua-scope.h"
+#include "lua-registry-keys.h"
+#include "chassis-event-thread.h"
+
+#include "network-timer-lua.h"
+
+/**
+ * the timer of a proxy.timer()
+ */
+typedef struct {
+	lua_scope *sc;       /**< the scope of the script that started the timer */
+	int handle_ref;      /**< the handle of the timer, keeps it and the function alive while the timer runs */
+	gboolean is_cancelled;
+} network_timer_lua_t;
+
+static void network_timer_lua_fire(chassis_event_timer_t *timer, gpointer user_data) {
+	network_timer_lua_t *t = user_data;
+	lua_State *L;
+
+	LOCK_LUA(t->sc);
+
+	if (t->is_cancelled) {
+		/* cancelled by another event-thread, only we may free it */
+		UNLOCK_LUA(t->sc);
+
+		chassis_event_timer_free(timer);
+
+		return;
+	}
+
+	L = t->sc->L;
+
+	lua_rawgeti(L, LUA_REGISTRYINDEX, t->handle_ref);
+	lua_getfenv(L, -1);
+	lua_rawgeti(L, -1, 1);  /* the function */
+	lua_pushvalue(L, -3);   /* the handle */
+
+	if (0 != lua_pcall(L, 1, 0, 0)) {
+		g_critical("(lua-error) proxy.timer(): %s", lua_tostring(L, -1));
+
+		lua_pop(L, 1); /* errmsg */
+	}
+
+	lua_pop(L, 2); /* the handle and its fenv */
+
+	UNLOCK_LUA(t->sc);
+}
+
+/**
+ * timer:cancel()
+ *
+ * stop the timer, it may be called from the function of the timer itself
+ */
+static int proxy_timer_cancel(lua_State *L) {
+	chassis_event_timer_t **timer_p = luaL_checkself(L);
+	chassis_event_timer_t *timer;
+	network_timer_lua_t *t;
+
+	if (NULL == timer_p || NULL == (timer = *timer_p)) return 0; /* already cancelled */
+
+	*timer_p = NULL;
+
+	t = timer->user_data;
+	t->is_cancelled = TRUE;
+	luaL_unref(L, LUA_REGISTRYINDEX, t->handle_ref);
+
+	/* the timer-wheels aren't thread-safe, the other threads leave it to the next run of the timer */
+	if (timer->event_thread == chassis_event_thread_get_local()) {
+		chassis_event_timer_free(timer);
+	}
+
+	return 0;
+}
+
+static const struct luaL_reg methods_proxy_timer[] = {
+	{ "cancel", proxy_timer_cancel },
+	{ NULL, NULL },
+};
+
+/**
+ * proxy.timer(interval, fn)
+ *
+ * call fn(timer) every <interval> seconds until timer:cancel() is called
+ *
+ * @return the timer
+ */
+int network_timer_lua_new(lua_State *L) {
+	lua_Number interval = luaL_checknumber(L, 1);
+	chassis_event_thread_t *event_thread = chassis_event_thread_get_local();
+	chassis_event_timer_t **timer_p;
+	network_timer_lua_t *t;
+	lua_scope *sc;
+
+	luaL_checktype(L, 2, LUA_TFUNCTION);
+	if (interval <= 0) luaL_argerror(L, 1, "the interval has to be > 0");
+
+	if (NULL == event_thread || NULL == event_thread->timer_wheel) {
+		return luaL_error(L, "proxy.timer() can only be called on a event-thread");
+	}
+
+	lua_getfield(L, LUA_REGISTRYINDEX, CHASSIS_LUA_SCOPE_REGISTRY_KEY);
+	sc = lua_touserdata(L, -1);
+	lua_pop(L, 1);
+
+	if (NULL == sc) return luaL_error(L, "proxy.timer() can only be called from a lua-scope");
+
+	timer_p = lua_newuserdata(L, sizeof(chassis_event_timer_t *));
+	*timer_p = NULL;
+
+	proxy_getmetatable(L, methods_proxy_timer);
+	lua_pushvalue(L, -1); /* meta.__index = meta */
+	lua_setfield(L, -2, "__index");
+	lua_setmetatable(L, -2);
+
+	lua_newtable(L);      /* the fenv of the handle holds the function */
+	lua_pushvalue(L, 2);
+	lua_rawseti(L, -2, 1);
+	lua_setfenv(L, -2);
+
+	t = g_new0(network_timer_lua_t, 1);
+	t->sc = sc;
+
+	lua_pushvalue(L, -1);
+	t->handle_ref = luaL_ref(L, LUA_REGISTRYINDEX);
+
+	*timer_p = chassis_event_timer_new(event_thread, MAX((guint64)(interval * 1000), 1),
+			network_timer_lua_fire, t, g_free);
+
+	return 1;
+}
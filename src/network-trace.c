@@ -0,0 +1,538 @@
+/* $%BEGINLICENSE%$
+ Copyright (c) 2008, 2012, Oracle and/or its affiliates. All rights reserved.
+
+ This program is free software; you can redistribute it and/or
+ modify it under the terms of the GNU General Public License as
+ published by the Free Software Foundation; version 2 of the
+ License.
+
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ GNU General Public License for more details.
+
+ You should have received a copy of the GNU General Public License
+ along with this program; if not, write to the Free Software
+ Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA
+ 02110-1301  USA
+
+ $%ENDLICENSE%$ */
+/**
+ * the trace spans of sampled queries
+ *
+ * the event-threads only queue the timestamps of a sampled query. The sender-thread turns
+ * them into spans in the OTLP/JSON encoding and sends them as UDP datagrams, several queries
+ * per datagram.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <string.h>
+#include <errno.h>
+#ifndef WIN32
+#include <unistd.h> /* close */
+#include <sys/types.h>
+#include <sys/socket.h>
+#define closesocket(x) close(x)
+#else
+#include <winsock2.h>
+#endif
+
+#include <glib.h>
+
+#include "network-trace.h"
+
+#define C(x) x, sizeof(x) - 1
+#define S(x) x->str, x->len
+
+#define NETWORK_TRACE_SPAN_KIND_INTERNAL 1
+#define NETWORK_TRACE_SPAN_KIND_SERVER   2
+
+#define NETWORK_TRACE_STATUS_ERROR       2
+
+GQuark network_trace_error(void) {
+	return g_quark_from_static_string("network-trace-error-quark");
+}
+
+/**
+ * check that a string is <len> lower-case hex digits and not all zero
+ */
+static gboolean network_trace_is_id(const gchar *s, gsize len) {
+	gboolean is_zero = TRUE;
+	gsize i;
+
+	for (i = 0; i < len; i++) {
+		if (!g_ascii_isxdigit(s[i]) || g_ascii_isupper(s[i])) return FALSE;
+		if (s[i] != '0') is_zero = FALSE;
+	}
+
+	return !is_zero;
+}
+
+/**
+ * parse a W3C traceparent
+ *
+ *   00-0af7651916cd43dd8448eb211c80319c-b7ad6b7169203331-01
+ *
+ * versions after 00 may append fields, they are ignored
+ *
+ * @return TRUE if it parsed, ctx->is_set is FALSE otherwise
+ */
+gboolean network_trace_context_parse(network_trace_context_t *ctx, const gchar *s, gsize s_len) {
+	memset(ctx, 0, sizeof(*ctx));
+
+	if (s_len < 55) return FALSE;
+	if (s[2] != '-' || s[35] != '-' || s[52] != '-') return FALSE;
+	if (!g_ascii_isxdigit(s[0]) || !g_ascii_isxdigit(s[1])) return FALSE;
+	if (0 == strncmp(s, "ff", 2)) return FALSE; /* an invalid version */
+	if (0 == strncmp(s, "00", 2) && s_len != 55) return FALSE;
+	if (s_len > 55 && s[55] != '-') return FALSE;
+
+	if (!network_trace_is_id(s + 3, 32) ||
+	    !network_trace_is_id(s + 36, 16) ||
+	    !g_ascii_isxdigit(s[53]) || !g_ascii_isxdigit(s[54])) {
+		return FALSE;
+	}
+
+	memcpy(ctx->trace_id, s + 3, 32);
+	memcpy(ctx->parent_id, s + 36, 16);
+	ctx->flags = (g_ascii_xdigit_value(s[53]) << 4) | g_ascii_xdigit_value(s[54]);
+	ctx->is_set = TRUE;
+
+	return TRUE;
+}
+
+network_trace_query_t *network_trace_query_new(void) {
+	return g_new0(network_trace_query_t, 1);
+}
+
+void network_trace_query_free(network_trace_query_t *query) {
+	if (!query) return;
+
+	if (query->user) g_free(query->user);
+	if (query->db) g_free(query->db);
+	if (query->backend) g_free(query->backend);
+
+	g_free(query);
+}
+
+/**
+ * append a JSON string
+ */
+static void network_trace_append_json_string(GString *out, const gchar *s) {
+	g_string_append_c(out, '"');
+	for (; *s; s++) {
+		guchar c = *s;
+
+		switch (c) {
+		case '"':  g_string_append_len(out, C("\\\"")); break;
+		case '\\': g_string_append_len(out, C("\\\\")); break;
+		default:
+			if (c < 0x20) {
+				g_string_append_printf(out, "\\u%04x", c);
+			} else {
+				g_string_append_c(out, c);
+			}
+			break;
+		}
+	}
+	g_string_append_c(out, '"');
+}
+
+static void network_trace_append_attribute(GString *out, gboolean is_first, const gchar *key, const gchar *value) {
+	if (!is_first) g_string_append_c(out, ',');
+	g_string_append_printf(out, "{\"key\":\"%s\",\"value\":{\"stringValue\":", key);
+	network_trace_append_json_string(out, value);
+	g_string_append_len(out, C("}}"));
+}
+
+/**
+ * append a span as OTLP/JSON
+ *
+ * @param query the query to take the attributes from, NULL for a span without them
+ */
+static void network_trace_span_to_json(GString *out,
+		const gchar *trace_id, const gchar *span_id, const gchar *parent_id,
+		const gchar *name, int kind,
+		gint64 start_usec, gint64 end_usec,
+		network_trace_query_t *query) {
+	g_string_append_printf(out, "{\"traceId\":\"%s\",\"spanId\":\"%s\"", trace_id, span_id);
+	if (parent_id) g_string_append_printf(out, ",\"parentSpanId\":\"%s\"", parent_id);
+	g_string_append_printf(out, ",\"name\":\"%s\",\"kind\":%d"
+			",\"startTimeUnixNano\":\"%"G_GINT64_FORMAT"000\",\"endTimeUnixNano\":\"%"G_GINT64_FORMAT"000\"",
+			name, kind,
+			start_usec, MAX(start_usec, end_usec));
+
+	if (query) {
+		gchar command[4];
+
+		g_snprintf(command, sizeof(command), "%u", query->command);
+
+		g_string_append_len(out, C(",\"attributes\":["));
+		network_trace_append_attribute(out, TRUE, "db.system", "mysql");
+		network_trace_append_attribute(out, FALSE, "db.mysql.command", command);
+		if (query->user) network_trace_append_attribute(out, FALSE, "db.user", query->user);
+		if (query->db) network_trace_append_attribute(out, FALSE, "db.name", query->db);
+		if (query->backend) network_trace_append_attribute(out, FALSE, "net.peer.name", query->backend);
+		g_string_append_c(out, ']');
+
+		if (query->is_error) g_string_append_printf(out, ",\"status\":{\"code\":%d}", NETWORK_TRACE_STATUS_ERROR);
+	}
+
+	g_string_append_c(out, '}');
+}
+
+static void network_trace_new_id(gchar *id, guint words) {
+	guint i;
+
+	for (i = 0; i < words; i++) {
+		g_snprintf(id + i * 8, 9, "%08x", g_random_int());
+	}
+}
+
+/**
+ * append the spans of a query, separated by commas
+ *
+ * the query is a span of the client's span, the steps are spans of the query:
+ *
+ * - queue_wait: it waited in the admission queue
+ * - backend_selection: the lua-hooks, the routing and the query-cache until it was admitted
+ * - time_to_first_byte: it was sent until the first packet of the result arrived
+ * - result_streaming: until the last packet arrived
+ *
+ * a step that didn't happen has no span
+ *
+ * @return the number of spans
+ */
+guint network_trace_query_to_json(GString *out, network_trace_query_t *query) {
+	gint64 offset = query->unix_offset_usec;
+	gchar trace_id[33];
+	gchar query_span_id[17];
+	gchar span_id[17];
+	guint64 end_usec;
+	guint spans = 1;
+
+	if (query->ctx.is_set) {
+		memcpy(trace_id, query->ctx.trace_id, sizeof(trace_id));
+	} else {
+		network_trace_new_id(trace_id, 4);
+	}
+	network_trace_new_id(query_span_id, 2);
+
+	end_usec = MAX(query->last_usec, query->read_usec);
+
+	network_trace_span_to_json(out, trace_id, query_span_id,
+			query->ctx.is_set ? query->ctx.parent_id : NULL,
+			"query", NETWORK_TRACE_SPAN_KIND_SERVER,
+			offset + query->read_usec, offset + end_usec,
+			query);
+
+	if (query->admitted_usec) {
+		guint64 selected_usec = query->queued_usec ? query->queued_usec : query->admitted_usec;
+
+		network_trace_new_id(span_id, 2);
+		g_string_append_c(out, ',');
+		network_trace_span_to_json(out, trace_id, span_id, query_span_id,
+				"backend_selection", NETWORK_TRACE_SPAN_KIND_INTERNAL,
+				offset + query->read_usec, offset + selected_usec,
+				NULL);
+		spans++;
+
+		if (query->queued_usec) {
+			network_trace_new_id(span_id, 2);
+			g_string_append_c(out, ',');
+			network_trace_span_to_json(out, trace_id, span_id, query_span_id,
+					"queue_wait", NETWORK_TRACE_SPAN_KIND_INTERNAL,
+					offset + query->queued_usec, offset + query->admitted_usec,
+					NULL);
+			spans++;
+		}
+	}
+
+	if (query->sent_usec && query->first_usec >= query->sent_usec) {
+		network_trace_new_id(span_id, 2);
+		g_string_append_c(out, ',');
+		network_trace_span_to_json(out, trace_id, span_id, query_span_id,
+				"time_to_first_byte", NETWORK_TRACE_SPAN_KIND_INTERNAL,
+				offset + query->sent_usec, offset + query->first_usec,
+				NULL);
+		spans++;
+
+		if (query->last_usec >= query->first_usec) {
+			network_trace_new_id(span_id, 2);
+			g_string_append_c(out, ',');
+			network_trace_span_to_json(out, trace_id, span_id, query_span_id,
+					"result_streaming", NETWORK_TRACE_SPAN_KIND_INTERNAL,
+					offset + query->first_usec, offset + query->last_usec,
+					NULL);
+			spans++;
+		}
+	}
+
+	return spans;
+}
+
+/**
+ * wrap the spans of network_trace_query_to_json() into a OTLP/JSON export request
+ */
+void network_trace_spans_to_json(GString *out, const gchar *spans, gsize spans_len) {
+	g_string_append_len(out, C("{\"resourceSpans\":[{\"resource\":{\"attributes\":["
+			"{\"key\":\"service.name\",\"value\":{\"stringValue\":\"mysql-proxy\"}}]},"
+			"\"scopeSpans\":[{\"scope\":{\"name\":\"mysql-proxy\"},\"spans\":["));
+	g_string_append_len(out, spans, spans_len);
+	g_string_append_len(out, C("]}]}]}"));
+}
+
+network_trace_t *network_trace_new(void) {
+	network_trace_t *trace;
+
+	trace = g_new0(network_trace_t, 1);
+	trace->fd = -1;
+	trace->queue = g_queue_new();
+	trace->mutex = g_mutex_new();
+	trace->cond = g_cond_new();
+
+	return trace;
+}
+
+/**
+ * send the spans as one datagram
+ *
+ * UDP may drop it, like the receiver may
+ */
+static int network_trace_send(network_trace_t *trace, GString *buf, GString *spans) {
+	g_string_truncate(buf, 0);
+	network_trace_spans_to_json(buf, S(spans));
+	g_string_truncate(spans, 0);
+
+	if (-1 == send(trace->fd, buf->str, buf->len, 0)) return -1;
+
+	return 0;
+}
+
+/**
+ * send batches of spans until we are shut down
+ */
+static gpointer network_trace_sender_thread(gpointer user_data) {
+	network_trace_t *trace = user_data;
+	GQueue *batch = g_queue_new();
+	GString *buf = g_string_sized_new(NETWORK_TRACE_MAX_DATAGRAM);
+	GString *spans = g_string_sized_new(NETWORK_TRACE_MAX_DATAGRAM);
+	GString *query_spans = g_string_new(NULL);
+	gsize max_spans_len;
+	gboolean is_send_failed = FALSE;
+
+	/* the room for the spans is what the export request around them leaves */
+	network_trace_spans_to_json(buf, NULL, 0);
+	max_spans_len = NETWORK_TRACE_MAX_DATAGRAM - buf->len;
+
+	for (;;) {
+		network_trace_query_t *query;
+		gboolean is_shutdown;
+		int ret = 0;
+		GQueue *q;
+
+		g_mutex_lock(trace->mutex);
+		while (0 == trace->queue->length && !g_atomic_int_get(&trace->is_shutdown)) {
+			GTimeVal timeout;
+
+			g_get_current_time(&timeout);
+			g_time_val_add(&timeout, G_USEC_PER_SEC);
+
+			g_cond_timed_wait(trace->cond, trace->mutex, &timeout);
+		}
+		is_shutdown = g_atomic_int_get(&trace->is_shutdown);
+
+		/* take all the queries and leave an empty queue for the producers */
+		q = trace->queue;
+		trace->queue = batch;
+		batch = q;
+		g_mutex_unlock(trace->mutex);
+
+		while ((query = g_queue_pop_head(batch))) {
+			guint n;
+
+			g_string_truncate(query_spans, 0);
+			n = network_trace_query_to_json(query_spans, query);
+			network_trace_query_free(query);
+
+			/* a query whose spans don't fit into a datagram of their own is dropped */
+			if (query_spans->len > max_spans_len) {
+				g_atomic_int_inc(&trace->dropped);
+				continue;
+			}
+
+			if (spans->len > 0 && spans->len + 1 + query_spans->len > max_spans_len) {
+				if (0 != network_trace_send(trace, buf, spans)) ret = -1;
+			}
+
+			if (spans->len > 0) g_string_append_c(spans, ',');
+			g_string_append_len(spans, S(query_spans));
+
+			g_atomic_int_add(&trace->sent, n);
+		}
+
+		if (spans->len > 0 && 0 != network_trace_send(trace, buf, spans)) ret = -1;
+
+		if (0 != ret) {
+			/* don't flood the error-log, one message until a send works again */
+			if (!is_send_failed) {
+				g_critical("%s: sending the trace spans to %s failed: %s (%d)",
+						G_STRLOC,
+						network_address_get_name(trace->addr),
+						g_strerror(errno), errno);
+			}
+			is_send_failed = TRUE;
+		} else {
+			is_send_failed = FALSE;
+		}
+
+		if (is_shutdown) break;
+	}
+
+	g_queue_free(batch);
+	g_string_free(buf, TRUE);
+	g_string_free(spans, TRUE);
+	g_string_free(query_spans, TRUE);
+
+	return NULL;
+}
+
+/**
+ * connect the socket to the receiver and start the sender-thread
+ *
+ * takes the ownership of the address
+ *
+ * @return 0 on success, -1 on error
+ */
+int network_trace_open(network_trace_t *trace, network_address *addr, GError **gerr) {
+	GError *thread_gerr = NULL;
+
+	g_return_val_if_fail(-1 == trace->fd, -1);
+
+	trace->addr = addr;
+
+	trace->fd = socket(addr->addr.common.sa_family, SOCK_DGRAM, 0);
+	if (-1 == trace->fd) {
+		g_set_error(gerr, NETWORK_TRACE_ERROR, NETWORK_TRACE_ERROR_SOCKET,
+				"socket() failed: %s (%d)",
+				g_strerror(errno), errno);
+
+		return -1;
+	}
+
+	if (0 != connect(trace->fd, &(addr->addr.common), addr->len)) {
+		g_set_error(gerr, NETWORK_TRACE_ERROR, NETWORK_TRACE_ERROR_SOCKET,
+				"connect() failed: %s (%d)",
+				g_strerror(errno), errno);
+
+		closesocket(trace->fd);
+		trace->fd = -1;
+
+		return -1;
+	}
+
+	trace->is_shutdown = 0;
+	trace->sender_thread = g_thread_create(network_trace_sender_thread, trace, TRUE, &thread_gerr);
+	if (NULL == trace->sender_thread) {
+		g_set_error(gerr, NETWORK_TRACE_ERROR, NETWORK_TRACE_ERROR_THREAD,
+				"starting the sender of the trace spans failed: %s",
+				thread_gerr->message);
+		g_error_free(thread_gerr);
+
+		closesocket(trace->fd);
+		trace->fd = -1;
+
+		return -1;
+	}
+
+	return 0;
+}
+
+/**
+ * send the queued spans and close the socket
+ */
+void network_trace_free(network_trace_t *trace) {
+	network_trace_query_t *query;
+
+	if (!trace) return;
+
+	if (trace->sender_thread) {
+		g_mutex_lock(trace->mutex);
+		g_atomic_int_set(&trace->is_shutdown, 1);
+		g_cond_signal(trace->cond);
+		g_mutex_unlock(trace->mutex);
+
+		g_thread_join(trace->sender_thread);
+	}
+
+	if (-1 != trace->fd) closesocket(trace->fd);
+	if (trace->addr) network_address_free(trace->addr);
+
+	while ((query = g_queue_pop_head(trace->queue))) network_trace_query_free(query);
+	g_queue_free(trace->queue);
+	g_mutex_free(trace->mutex);
+	g_cond_free(trace->cond);
+
+	g_free(trace);
+}
+
+/**
+ * also trace every <sample>th query that doesn't come with a trace-context, 0 for none
+ */
+void network_trace_set_sample(network_trace_t *trace, guint sample) {
+	trace->sample = sample;
+}
+
+gboolean network_trace_is_open(network_trace_t *trace) {
+	return trace != NULL && trace->sender_thread != NULL;
+}
+
+/**
+ * check if a query gets traced
+ *
+ * a query with a trace-context follows the sampling decision of the client, the
+ * others are sampled by network_trace_set_sample()
+ */
+gboolean network_trace_wants(network_trace_t *trace, network_trace_context_t *ctx) {
+	if (!network_trace_is_open(trace)) return FALSE;
+
+	if (ctx && ctx->is_set) return (ctx->flags & 0x01) != 0;
+
+	if (trace->sample == 0) return FALSE;
+
+	return 0 == ((guint)g_atomic_int_exchange_and_add(&trace->sample_counter, 1) % trace->sample);
+}
+
+/**
+ * queue a query for the sender
+ *
+ * takes the ownership of the query
+ *
+ * @return FALSE if the queue was full and the query got dropped
+ */
+gboolean network_trace_push(network_trace_t *trace, network_trace_query_t *query) {
+	guint len;
+
+	g_mutex_lock(trace->mutex);
+	len = trace->queue->length;
+	if (len < NETWORK_TRACE_MAX_QUEUED) {
+		g_queue_push_tail(trace->queue, query);
+		query = NULL;
+
+		/* the sender wakes up every second anyway */
+		if (len + 1 == NETWORK_TRACE_BATCH) g_cond_signal(trace->cond);
+	}
+	g_mutex_unlock(trace->mutex);
+
+	if (NULL != query) {
+		g_atomic_int_inc(&trace->dropped);
+		network_trace_query_free(query);
+
+		return FALSE;
+	}
+
+	return TRUE;
+}
@@ -0,0 +1,130 @@
+/* $%BEGINLICENSE%$
+ Copyright (c) 2008, 2012, Oracle and/or its affiliates. All rights reserved.
+
+ This program is free software; you can redistribute it and/or
+ modify it under the terms of the GNU General Public License as
+ published by the Free Software Foundation; version 2 of the
+ License.
+
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ GNU General Public License for more details.
+
+ You should have received a copy of the GNU General Public License
+ along with this program; if not, write to the Free Software
+ Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA
+ 02110-1301  USA
+
+ $%ENDLICENSE%$ */
+#ifndef __NETWORK_TRACE_H__
+#define __NETWORK_TRACE_H__
+
+#include <glib.h>
+
+#include "network-exports.h"
+#include "network-address.h"
+
+/**
+ * queries that may wait for the sender, more are dropped
+ */
+#define NETWORK_TRACE_MAX_QUEUED 4096
+
+/**
+ * wake up the sender once that many queries are queued
+ */
+#define NETWORK_TRACE_BATCH 64
+
+/**
+ * the spans are sent in datagrams of at most that many bytes
+ */
+#define NETWORK_TRACE_MAX_DATAGRAM 16384
+
+/**
+ * a W3C trace-context
+ *
+ *   00-<trace-id>-<parent-id>-<flags>
+ *
+ * @see network_trace_context_parse()
+ */
+typedef struct {
+	gchar trace_id[33];          /**< 32 lower-case hex digits */
+	gchar parent_id[17];         /**< 16 lower-case hex digits, the span of the client */
+	guint8 flags;                /**< bit 0: the client samples the trace */
+	gboolean is_set;
+} network_trace_context_t;
+
+/**
+ * the timestamps of a sampled query, in chassis_get_rel_microseconds()
+ *
+ * the sender turns them into spans: the query itself and its queue-wait, backend-selection,
+ * time-to-first-byte and result-streaming
+ */
+typedef struct {
+	network_trace_context_t ctx; /**< the context of the client, a new trace if it isn't set */
+	gint64 unix_offset_usec;     /**< add it to the timestamps below to get the unix-time */
+
+	guint64 read_usec;           /**< the query was read from the client */
+	guint64 queued_usec;         /**< it entered the admission queue, 0 if it didn't wait */
+	guint64 admitted_usec;       /**< it was routed and admitted, 0 if the proxy answered it */
+	guint64 sent_usec;           /**< it was sent to the backend, 0 if it wasn't */
+	guint64 first_usec;          /**< the first packet of the result arrived */
+	guint64 last_usec;           /**< the last packet of the result arrived */
+
+	guint8 command;
+	gboolean is_error;           /**< the server sent an ERR packet */
+
+	gchar *user;                 /**< NULL if unknown */
+	gchar *db;
+	gchar *backend;
+} network_trace_query_t;
+
+/**
+ * the spans of sampled queries, sent as OTLP/JSON datagrams by a thread of its own
+ *
+ * the event-threads decide about the sampling when the query is read and only queue the
+ * timestamps of the sampled ones. The sender builds the spans and packs the queries of a
+ * batch into as few datagrams as possible, the unsampled queries don't pay for it.
+ */
+typedef struct {
+	network_address *addr;           /**< the receiver of the datagrams */
+	int fd;                          /**< -1 if not open */
+
+	guint sample;                    /**< trace every <n>th query without a trace-context, 0 for none */
+	volatile gint sample_counter;
+
+	GQueue *queue;                   /**< network_trace_query_t waiting for the sender */
+	GMutex *mutex;                   /**< protects .queue */
+	GCond *cond;
+
+	GThread *sender_thread;
+	volatile gint is_shutdown;
+
+	volatile gint dropped;           /**< queries dropped as the queue was full */
+	volatile gint sent;              /**< spans sent */
+} network_trace_t;
+
+NETWORK_API network_trace_t *network_trace_new(void);
+NETWORK_API void network_trace_free(network_trace_t *trace);
+NETWORK_API int network_trace_open(network_trace_t *trace, network_address *addr, GError **gerr);
+NETWORK_API void network_trace_set_sample(network_trace_t *trace, guint sample);
+NETWORK_API gboolean network_trace_is_open(network_trace_t *trace);
+NETWORK_API gboolean network_trace_wants(network_trace_t *trace, network_trace_context_t *ctx);
+NETWORK_API gboolean network_trace_push(network_trace_t *trace, network_trace_query_t *query);
+
+NETWORK_API gboolean network_trace_context_parse(network_trace_context_t *ctx, const gchar *s, gsize s_len);
+
+NETWORK_API network_trace_query_t *network_trace_query_new(void);
+NETWORK_API void network_trace_query_free(network_trace_query_t *query);
+NETWORK_API guint network_trace_query_to_json(GString *out, network_trace_query_t *query);
+NETWORK_API void network_trace_spans_to_json(GString *out, const gchar *spans, gsize spans_len);
+
+#define NETWORK_TRACE_ERROR network_trace_error()
+NETWORK_API GQuark network_trace_error(void);
+
+typedef enum {
+	NETWORK_TRACE_ERROR_SOCKET,  /**< the socket couldn't be created */
+	NETWORK_TRACE_ERROR_THREAD   /**< the sender-thread couldn't be started */
+} network_trace_error_t;
+
+#endif
@@ -45,6 +45,7 @@ static int network_mysqld_proto_binary_get_int_type(network_packet *packet, netw
 		err = err || network_mysqld_type_set_int(type, (guint64)i8, type->is_unsigned);
 		break;
 	case MYSQL_TYPE_SHORT:
+	case MYSQL_TYPE_YEAR:
 		err = err || network_mysqld_proto_get_int16(packet, &i16);
 		err = err || network_mysqld_type_set_int(type, (guint64)i16, type->is_unsigned);
 		break;
@@ -70,9 +71,10 @@ static int network_mysqld_proto_binary_append_int_type(GString *packet, network_
 	guint8  i8;
 	guint16 i16;
 	guint32 i32;
+	gboolean is_unsigned;
 	int err = 0;
 
-	err = err || network_mysqld_type_get_int(type, &i64, NULL);
+	err = err || network_mysqld_type_get_int(type, &i64, &is_unsigned);
 	if (0 != err) return -1;
 
 	switch (type->type) {
@@ -83,6 +85,7 @@ static int network_mysqld_proto_binary_append_int_type(GString *packet, network_
 		err = err || network_mysqld_proto_append_int8(packet, i8);
 		break;
 	case MYSQL_TYPE_SHORT:
+	case MYSQL_TYPE_YEAR:
 		i16 = i64;
 
 		err = err || network_mysqld_proto_append_int16(packet, i16);
@@ -410,6 +413,7 @@ int network_mysqld_proto_binary_get_type(network_packet *packet, network_mysqld_
 	case MYSQL_TYPE_LONG:
 	case MYSQL_TYPE_INT24:
 	case MYSQL_TYPE_LONGLONG:
+	case MYSQL_TYPE_YEAR:
 		return network_mysqld_proto_binary_get_int_type(packet, type);
 	case MYSQL_TYPE_DATE:
 	case MYSQL_TYPE_DATETIME:
@@ -422,7 +426,11 @@ int network_mysqld_proto_binary_get_type(network_packet *packet, network_mysqld_
 	case MYSQL_TYPE_DOUBLE:
 		return network_mysqld_proto_binary_get_double_type(packet, type);
 	case MYSQL_TYPE_BIT:
+	case MYSQL_TYPE_DECIMAL:
 	case MYSQL_TYPE_NEWDECIMAL:
+	case MYSQL_TYPE_ENUM:
+	case MYSQL_TYPE_SET:
+	case MYSQL_TYPE_GEOMETRY:
 	case MYSQL_TYPE_BLOB:
 	case MYSQL_TYPE_TINY_BLOB:
 	case MYSQL_TYPE_MEDIUM_BLOB:
@@ -436,6 +444,60 @@ int network_mysqld_proto_binary_get_type(network_packet *packet, network_mysqld_
 	return -1;
 }
 
+/**
+ * skip a value of the binary protocol without decoding it
+ *
+ * @param type the MYSQL_TYPE_* of the value
+ * @return 0 on success, -1 if the packet is too short or the type is unknown
+ */
+int network_mysqld_proto_binary_skip_type(network_packet *packet, guint type) {
+	guint64 len;
+	guint8 len8;
+	int err = 0;
+
+	switch (type) {
+	case MYSQL_TYPE_TINY:
+		return network_mysqld_proto_skip(packet, 1);
+	case MYSQL_TYPE_SHORT:
+	case MYSQL_TYPE_YEAR:
+		return network_mysqld_proto_skip(packet, 2);
+	case MYSQL_TYPE_LONG:
+	case MYSQL_TYPE_INT24:
+	case MYSQL_TYPE_FLOAT:
+		return network_mysqld_proto_skip(packet, 4);
+	case MYSQL_TYPE_LONGLONG:
+	case MYSQL_TYPE_DOUBLE:
+		return network_mysqld_proto_skip(packet, 8);
+	case MYSQL_TYPE_DATE:
+	case MYSQL_TYPE_DATETIME:
+	case MYSQL_TYPE_TIMESTAMP:
+	case MYSQL_TYPE_TIME:
+		err = err || network_mysqld_proto_get_int8(packet, &len8);
+		err = err || network_mysqld_proto_skip(packet, len8);
+
+		return err ? -1 : 0;
+	case MYSQL_TYPE_BIT:
+	case MYSQL_TYPE_DECIMAL:
+	case MYSQL_TYPE_NEWDECIMAL:
+	case MYSQL_TYPE_ENUM:
+	case MYSQL_TYPE_SET:
+	case MYSQL_TYPE_GEOMETRY:
+	case MYSQL_TYPE_BLOB:
+	case MYSQL_TYPE_TINY_BLOB:
+	case MYSQL_TYPE_MEDIUM_BLOB:
+	case MYSQL_TYPE_LONG_BLOB:
+	case MYSQL_TYPE_STRING:
+	case MYSQL_TYPE_VAR_STRING:
+		err = err || network_mysqld_proto_get_lenenc_int(packet, &len);
+		err = err || (len > packet->data->len); /* don't let the offset wrap */
+		err = err || network_mysqld_proto_skip(packet, len);
+
+		return err ? -1 : 0;
+	}
+
+	return -1;
+}
+
 int network_mysqld_proto_binary_append_type(GString *packet, network_mysqld_type_t *type) {
 	switch (type->type) {
 	case MYSQL_TYPE_TINY:
@@ -443,6 +505,7 @@ int network_mysqld_proto_binary_append_type(GString *packet, network_mysqld_type
 	case MYSQL_TYPE_LONG:
 	case MYSQL_TYPE_INT24:
 	case MYSQL_TYPE_LONGLONG:
+	case MYSQL_TYPE_YEAR:
 		return network_mysqld_proto_binary_append_int_type(packet, type);
 	case MYSQL_TYPE_DATE:
 	case MYSQL_TYPE_DATETIME:
@@ -455,7 +518,11 @@ int network_mysqld_proto_binary_append_type(GString *packet, network_mysqld_type
 	case MYSQL_TYPE_DOUBLE:
 		return network_mysqld_proto_binary_append_double_type(packet, type);
 	case MYSQL_TYPE_BIT:
+	case MYSQL_TYPE_DECIMAL:
 	case MYSQL_TYPE_NEWDECIMAL:
+	case MYSQL_TYPE_ENUM:
+	case MYSQL_TYPE_SET:
+	case MYSQL_TYPE_GEOMETRY:
 	case MYSQL_TYPE_BLOB:
 	case MYSQL_TYPE_TINY_BLOB:
 	case MYSQL_TYPE_MEDIUM_BLOB:
@@ -29,5 +29,6 @@
 
 NETWORK_API int network_mysqld_proto_binary_get_type(network_packet *packet, network_mysqld_type_t *type);
 NETWORK_API int network_mysqld_proto_binary_append_type(GString *packet, network_mysqld_type_t *type);
+NETWORK_API int network_mysqld_proto_binary_skip_type(network_packet *packet, guint type);
 
 #endif
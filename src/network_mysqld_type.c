@@ -531,6 +531,7 @@ network_mysqld_type_t *network_mysqld_type_new(enum enum_field_types field_type)
 	case MYSQL_TYPE_LONG:
 	case MYSQL_TYPE_INT24:
 	case MYSQL_TYPE_LONGLONG:
+	case MYSQL_TYPE_YEAR:
 		type = g_slice_new0(network_mysqld_type_t);
 
 		network_mysqld_type_data_int_init(type, field_type);
@@ -557,7 +558,12 @@ network_mysqld_type_t *network_mysqld_type_new(enum enum_field_types field_type)
 
 		network_mysqld_type_data_time_init(type, field_type);
 		break;
+	case MYSQL_TYPE_DECIMAL:
 	case MYSQL_TYPE_NEWDECIMAL:
+	case MYSQL_TYPE_BIT:
+	case MYSQL_TYPE_ENUM:
+	case MYSQL_TYPE_SET:
+	case MYSQL_TYPE_GEOMETRY:
 	case MYSQL_TYPE_BLOB:
 	case MYSQL_TYPE_TINY_BLOB:
 	case MYSQL_TYPE_MEDIUM_BLOB:
@@ -673,3 +679,156 @@ int network_mysqld_type_set_time(network_mysqld_type_t *type, network_mysqld_typ
 }
 
 
+/**
+ * the decimals of a FLOAT or DOUBLE column without a fixed scale
+ */
+#define NETWORK_MYSQLD_TYPE_NOT_FIXED_DEC 31
+
+/**
+ * append the digits of the fraction of a second that the column shows
+ *
+ * the binary protocol has the micro-seconds in ->nsec
+ */
+static void network_mysqld_type_append_text_fraction(GString *dst, guint32 usec, guint decimals) {
+	guint div = 1;
+	guint i;
+
+	if (decimals == 0 || decimals > 6) return;
+
+	for (i = decimals; i < 6; i++) div *= 10;
+
+	g_string_append_printf(dst, ".%0*u", decimals, usec / div);
+}
+
+/**
+ * append the shortest %g that reads back as the same value, like the server does
+ *
+ * glibc writes the exponent as e+20, the server as e20
+ */
+static void network_mysqld_type_append_text_double(GString *dst, double d, gboolean is_float) {
+	char buf[G_ASCII_DTOSTR_BUF_SIZE];
+	char *e;
+	int precision;
+
+	for (precision = is_float ? 6 : 15; precision < (is_float ? 9 : 17); precision++) {
+		g_snprintf(buf, sizeof(buf), "%.*g", precision, d);
+
+		if (is_float ? (float)g_ascii_strtod(buf, NULL) == (float)d : g_ascii_strtod(buf, NULL) == d) break;
+	}
+	g_snprintf(buf, sizeof(buf), "%.*g", precision, d);
+
+	if (NULL != (e = strchr(buf, 'e'))) {
+		char *digits = e + 1;
+
+		g_string_append_len(dst, buf, e - buf + 1);
+		if (*digits == '+') {
+			digits++;
+		} else if (*digits == '-') {
+			g_string_append_c(dst, '-');
+			digits++;
+		}
+		while (*digits == '0' && *(digits + 1) != '\0') digits++;
+		g_string_append(dst, digits);
+	} else {
+		g_string_append(dst, buf);
+	}
+}
+
+/**
+ * append the value of a field of a binary row as the text protocol has it
+ *
+ * the ints are sign-extended unless the column is UNSIGNED and padded for ZEROFILL,
+ * the fractions of the temporal types and of the FLOAT(M,D) and DOUBLE(M,D) columns
+ * get the decimals of the column
+ *
+ * @param type  the value, not NULL
+ * @param field the column-def of the field
+ * @param dst   the text is appended to it
+ * @return 0 on success, -1 if the type has no text form
+ */
+int network_mysqld_type_append_text(network_mysqld_type_t *type, network_mysqld_proto_fielddef_t *field, GString *dst) {
+	gboolean is_unsigned = (field->flags & UNSIGNED_FLAG) != 0;
+	network_mysqld_type_date_t date;
+	network_mysqld_type_time_t t;
+	const char *s;
+	gsize s_len;
+	guint64 i;
+	gboolean data_is_unsigned;
+	double d;
+	gsize start = dst->len;
+
+	switch (type->type) {
+	case MYSQL_TYPE_TINY:
+	case MYSQL_TYPE_SHORT:
+	case MYSQL_TYPE_INT24:
+	case MYSQL_TYPE_LONG:
+	case MYSQL_TYPE_LONGLONG:
+	case MYSQL_TYPE_YEAR:
+		if (0 != network_mysqld_type_get_int(type, &i, &data_is_unsigned)) return -1;
+
+		if (type->type == MYSQL_TYPE_YEAR) {
+			g_string_append_printf(dst, field->length == 2 ? "%02u" : "%04u", (guint)i);
+			break;
+		}
+
+		if (!is_unsigned) {
+			gint64 v;
+
+			switch (type->type) {
+			case MYSQL_TYPE_TINY:  v = (gint8)i; break;
+			case MYSQL_TYPE_SHORT: v = (gint16)i; break;
+			case MYSQL_TYPE_INT24:
+			case MYSQL_TYPE_LONG:  v = (gint32)i; break;
+			default:               v = (gint64)i; break;
+			}
+			g_string_append_printf(dst, "%"G_GINT64_FORMAT, v);
+		} else {
+			g_string_append_printf(dst, "%"G_GUINT64_FORMAT, i);
+		}
+
+		if ((field->flags & ZEROFILL_FLAG) && dst->len - start < field->length) {
+			gsize pad = field->length - (dst->len - start);
+
+			g_string_insert_len(dst, start, "00000000000000000000", MIN(pad, 20));
+		}
+		break;
+	case MYSQL_TYPE_FLOAT:
+	case MYSQL_TYPE_DOUBLE:
+		if (0 != network_mysqld_type_get_double(type, &d)) return -1;
+
+		if (field->decimals < NETWORK_MYSQLD_TYPE_NOT_FIXED_DEC) {
+			g_string_append_printf(dst, "%.*f", field->decimals, d);
+		} else {
+			network_mysqld_type_append_text_double(dst, d, type->type == MYSQL_TYPE_FLOAT);
+		}
+		break;
+	case MYSQL_TYPE_DATE:
+	case MYSQL_TYPE_DATETIME:
+	case MYSQL_TYPE_TIMESTAMP:
+		if (0 != network_mysqld_type_get_date(type, &date)) return -1;
+
+		g_string_append_printf(dst, "%04u-%02u-%02u", date.year, date.month, date.day);
+		if (type->type != MYSQL_TYPE_DATE) {
+			g_string_append_printf(dst, " %02u:%02u:%02u", date.hour, date.min, date.sec);
+			network_mysqld_type_append_text_fraction(dst, date.nsec, field->decimals);
+		}
+		break;
+	case MYSQL_TYPE_TIME:
+		if (0 != network_mysqld_type_get_time(type, &t)) return -1;
+
+		g_string_append_printf(dst, "%s%02"G_GUINT64_FORMAT":%02u:%02u",
+				t.sign ? "-" : "",
+				(guint64)t.days * 24 + t.hour,
+				t.min,
+				t.sec);
+		network_mysqld_type_append_text_fraction(dst, t.nsec, field->decimals);
+		break;
+	default:
+		if (0 != network_mysqld_type_get_string_const(type, &s, &s_len)) return -1;
+
+		g_string_append_len(dst, s, s_len);
+		break;
+	}
+
+	return 0;
+}
@@ -169,4 +169,6 @@ NETWORK_API int network_mysqld_type_set_date(network_mysqld_type_t *type, networ
 NETWORK_API int network_mysqld_type_get_time(network_mysqld_type_t *type, network_mysqld_type_time_t *t);
 NETWORK_API int network_mysqld_type_set_time(network_mysqld_type_t *type, network_mysqld_type_time_t *t);
 
+NETWORK_API int network_mysqld_type_append_text(network_mysqld_type_t *type, network_mysqld_proto_fielddef_t *field, GString *dst);
+
 #endif
@@ -0,0 +1,33 @@
+--[[ $%BEGINLICENSE%$
+ Copyright (c) 2012, 2014, Oracle and/or its affiliates. All rights reserved.
+
+ This program is free software; you can redistribute it and/or
+ modify it under the terms of the GNU General Public License as
+ published by the Free Software Foundation; version 2 of the
+ License.
+
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ GNU General Public License for more details.
+
+ You should have received a copy of the GNU General Public License
+ along with this program; if not, write to the Free Software
+ Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA
+ 02110-1301  USA
+
+ $%ENDLICENSE%$ --]]
+
+---
+-- hooks that do nothing, proxy-bench.sh measures the cost of calling them
+--
+-- read_query() injects the query to get read_query_result() called too
+
+function read_query(packet)
+	proxy.queries:append(1, packet, { resultset_is_needed = false })
+
+	return proxy.PROXY_SEND_QUERY
+end
+
+function read_query_result(inj)
+end
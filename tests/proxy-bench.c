@@ -0,0 +1,528 @@
+/* $%BEGINLICENSE%$
+ Copyright (c) 2012, 2014, Oracle and/or its affiliates. All rights reserved.
+
+ This program is free software; you can redistribute it and/or
+ modify it under the terms of the GNU General Public License as
+ published by the Free Software Foundation; version 2 of the
+ License.
+
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ GNU General Public License for more details.
+
+ You should have received a copy of the GNU General Public License
+ along with this program; if not, write to the Free Software
+ Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA
+ 02110-1301  USA
+
+ $%BEGINLICENSE%$ */
+/**
+ * throughput and latency of named scenarios against a MySQL server or a proxy
+ *
+ * each scenario runs --threads connections with a fixed number of operations
+ * after a warm-up, so two runs against the same setup do the same work. The result
+ * of each scenario is printed as one line of JSON with the QPS and the latency
+ * percentiles, run it once against the proxy and once against the backend to
+ * compare them. See proxy-bench.sh for the setups (event-threads, Lua hooks).
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <mysql.h>
+
+#include <glib.h>
+
+#define C(x) (x), sizeof(x) - 1
+
+#define TEST_QUERY_LARGE    "SELECT REPEAT('x', POW(2, 16)) FROM dual"
+#define TEST_QUERY_SMALL    "SELECT 1 FROM dual WHERE 1 = 1"
+#define TEST_QUERY_SMALL_PS "SELECT 1 FROM dual WHERE 1 = ?"
+
+/**
+ * 10^6 rows without a table, works on all MySQL versions
+ */
+#define TEST_QUERY_DIGITS   "(SELECT 0 n UNION ALL SELECT 1 UNION ALL SELECT 2 UNION ALL SELECT 3 UNION ALL SELECT 4 " \
+                            "UNION ALL SELECT 5 UNION ALL SELECT 6 UNION ALL SELECT 7 UNION ALL SELECT 8 UNION ALL SELECT 9)"
+#define TEST_QUERY_1M_ROWS  "SELECT t1.n + t2.n * 10 + t3.n * 100 + t4.n * 1000 + t5.n * 10000 + t6.n * 100000 FROM " \
+                            TEST_QUERY_DIGITS " t1, " TEST_QUERY_DIGITS " t2, " TEST_QUERY_DIGITS " t3, " \
+                            TEST_QUERY_DIGITS " t4, " TEST_QUERY_DIGITS " t5, " TEST_QUERY_DIGITS " t6"
+
+typedef struct {
+	gchar *hostname;
+	gchar *username;
+	gchar *password;
+	gchar *schemaname;
+	gchar *socketpath;
+	gint port;
+
+	gint threads;
+	gint ops;          /**< operations per thread, 0 for the default of the scenario */
+	gint warmup;       /**< operations per thread before we measure */
+	gchar *label;      /**< copied into the output to tell the runs apart, e.g. "proxy,event-threads=4" */
+} bench_config;
+
+typedef struct bench_scenario bench_scenario;
+
+/**
+ * the state of one connection of a scenario
+ */
+typedef struct {
+	bench_config *config;
+	bench_scenario *scenario;
+
+	MYSQL *mysql;
+	MYSQL_STMT *stmt;
+
+	GArray *latencies;    /**< guint64 usec of each measured operation */
+	guint errors;
+} bench_thread;
+
+struct bench_scenario {
+	const gchar *name;
+	const gchar *desc;
+	gint default_ops;
+
+	gboolean (*setup)(bench_thread *thr);
+	gboolean (*op)(bench_thread *thr);    /**< one operation, its time is measured */
+	void (*teardown)(bench_thread *thr);
+
+	const gchar *query;
+};
+
+static GMutex *bench_start_mutex = NULL;
+static GCond *bench_start_cond = NULL;
+static gint bench_threads_ready = 0;
+static gboolean bench_is_started = FALSE;
+
+static gboolean bench_connect(bench_thread *thr) {
+	bench_config *config = thr->config;
+
+	thr->mysql = mysql_init(NULL);
+
+	if (NULL == mysql_real_connect(thr->mysql, config->hostname, config->username, config->password,
+				config->schemaname, config->port, config->socketpath, CLIENT_MULTI_RESULTS)) {
+		g_critical("%s: connecting to mysql failed: %s", G_STRLOC, mysql_error(thr->mysql));
+
+		mysql_close(thr->mysql);
+		thr->mysql = NULL;
+
+		return FALSE;
+	}
+
+	return TRUE;
+}
+
+static void bench_disconnect(bench_thread *thr) {
+	if (thr->stmt) mysql_stmt_close(thr->stmt);
+	thr->stmt = NULL;
+
+	if (thr->mysql) mysql_close(thr->mysql);
+	thr->mysql = NULL;
+}
+
+/**
+ * run the query of the scenario and read all of its result
+ *
+ * the rows are streamed with mysql_use_result(), the 1M-row result doesn't have to fit into memory
+ */
+static gboolean bench_op_query(bench_thread *thr) {
+	MYSQL_RES *res;
+
+	if (0 != mysql_real_query(thr->mysql, thr->scenario->query, strlen(thr->scenario->query))) {
+		g_critical("%s: %s failed: %s", G_STRLOC, thr->scenario->query, mysql_error(thr->mysql));
+		return FALSE;
+	}
+
+	if (NULL != (res = mysql_use_result(thr->mysql))) {
+		while (NULL != mysql_fetch_row(res));
+
+		mysql_free_result(res);
+	}
+
+	return 0 == mysql_errno(thr->mysql);
+}
+
+/**
+ * connect, run a query and disconnect again
+ */
+static gboolean bench_op_churn(bench_thread *thr) {
+	gboolean is_ok;
+
+	if (!bench_connect(thr)) return FALSE;
+
+	is_ok = bench_op_query(thr);
+
+	bench_disconnect(thr);
+
+	return is_ok;
+}
+
+static gboolean bench_setup_prepared(bench_thread *thr) {
+	if (NULL == (thr->stmt = mysql_stmt_init(thr->mysql))) {
+		g_critical("%s: mysql_stmt_init() failed: %s", G_STRLOC, mysql_error(thr->mysql));
+		return FALSE;
+	}
+
+	if (0 != mysql_stmt_prepare(thr->stmt, C(TEST_QUERY_SMALL_PS))) {
+		g_critical("%s: mysql_stmt_prepare(%s) failed: %s", G_STRLOC, TEST_QUERY_SMALL_PS, mysql_stmt_error(thr->stmt));
+		return FALSE;
+	}
+
+	return TRUE;
+}
+
+static gboolean bench_op_prepared(bench_thread *thr) {
+	MYSQL_BIND params[1];
+	long one = 1;
+
+	memset(params, 0, sizeof(params));
+	params[0].buffer_type = MYSQL_TYPE_LONG;
+	params[0].buffer = &one;
+
+	if (0 != mysql_stmt_bind_param(thr->stmt, params) ||
+	    0 != mysql_stmt_execute(thr->stmt) ||
+	    0 != mysql_stmt_store_result(thr->stmt)) {
+		g_critical("%s: executing %s failed: %s", G_STRLOC, TEST_QUERY_SMALL_PS, mysql_stmt_error(thr->stmt));
+		return FALSE;
+	}
+
+	while (0 == mysql_stmt_fetch(thr->stmt));
+
+	mysql_stmt_free_result(thr->stmt);
+
+	return TRUE;
+}
+
+static gboolean bench_setup_connect(bench_thread *thr) {
+	return bench_connect(thr);
+}
+
+static gboolean bench_setup_none(bench_thread G_GNUC_UNUSED *thr) {
+	return TRUE;
+}
+
+static bench_scenario bench_scenarios[] = {
+	{ "point-select", "small point selects",
+		10000, bench_setup_connect, bench_op_query, bench_disconnect, TEST_QUERY_SMALL },
+	{ "large-row", "rows of 64KB",
+		1000, bench_setup_connect, bench_op_query, bench_disconnect, TEST_QUERY_LARGE },
+	{ "big-result", "results with 1M rows",
+		5, bench_setup_connect, bench_op_query, bench_disconnect, TEST_QUERY_1M_ROWS },
+	{ "connect-churn", "a new connection for each query",
+		1000, bench_setup_none, bench_op_churn, bench_disconnect, TEST_QUERY_SMALL },
+	{ "prepared", "executing a prepared statement",
+		10000, bench_setup_connect, bench_op_prepared, bench_disconnect, NULL },
+
+	{ NULL, NULL, 0, NULL, NULL, NULL, NULL }
+};
+
+static bench_scenario *bench_scenario_get(const gchar *name) {
+	gint i;
+
+	for (i = 0; bench_scenarios[i].name; i++) {
+		if (0 == strcmp(bench_scenarios[i].name, name)) return &(bench_scenarios[i]);
+	}
+
+	return NULL;
+}
+
+static guint64 bench_get_microseconds(void) {
+	GTimeVal tv;
+
+	g_get_current_time(&tv);
+
+	return (guint64)tv.tv_sec * G_USEC_PER_SEC + tv.tv_usec;
+}
+
+/**
+ * set up the connection, wait for the others and run the operations
+ */
+static gpointer bench_thread_run(gpointer user_data) {
+	bench_thread *thr = user_data;
+	gint ops = thr->config->ops > 0 ? thr->config->ops : thr->scenario->default_ops;
+	gboolean is_setup;
+	gint i;
+
+	mysql_thread_init();
+
+	is_setup = thr->scenario->setup(thr);
+
+	/* start the clock for all threads at once */
+	g_mutex_lock(bench_start_mutex);
+	bench_threads_ready++;
+	g_cond_broadcast(bench_start_cond);
+	while (!bench_is_started) g_cond_wait(bench_start_cond, bench_start_mutex);
+	g_mutex_unlock(bench_start_mutex);
+
+	if (!is_setup) {
+		thr->errors++;
+	} else {
+		for (i = 0; i < thr->config->warmup + ops; i++) {
+			guint64 start = bench_get_microseconds();
+			gboolean is_ok = thr->scenario->op(thr);
+			guint64 usec = bench_get_microseconds() - start;
+
+			if (!is_ok) {
+				thr->errors++;
+				break;
+			}
+
+			if (i >= thr->config->warmup) g_array_append_val(thr->latencies, usec);
+		}
+	}
+
+	thr->scenario->teardown(thr);
+
+	mysql_thread_end();
+
+	return thr;
+}
+
+static gint bench_cmp_guint64(gconstpointer _a, gconstpointer _b) {
+	const guint64 *a = _a;
+	const guint64 *b = _b;
+
+	return *a < *b ? -1 : (*a > *b ? 1 : 0);
+}
+
+/**
+ * the latency that <pct> percent of the operations didn't exceed
+ */
+static guint64 bench_percentile(GArray *sorted, gdouble pct) {
+	guint ndx;
+
+	if (sorted->len == 0) return 0;
+
+	ndx = (guint)(pct / 100.0 * sorted->len);
+	if (ndx >= sorted->len) ndx = sorted->len - 1;
+
+	return g_array_index(sorted, guint64, ndx);
+}
+
+/**
+ * a JSON string of a option, null if not set
+ */
+static void bench_append_json_string(GString *out, const gchar *s) {
+	const gchar *c;
+
+	if (NULL == s) {
+		g_string_append_len(out, C("null"));
+		return;
+	}
+
+	g_string_append_c(out, '"');
+	for (c = s; *c; c++) {
+		if (*c == '"' || *c == '\\') g_string_append_c(out, '\\');
+		g_string_append_c(out, *c);
+	}
+	g_string_append_c(out, '"');
+}
+
+/**
+ * run a scenario and print its results as one line of JSON
+ *
+ * @return the number of errors
+ */
+static guint bench_scenario_run(bench_config *config, bench_scenario *scenario) {
+	bench_thread *thrs;
+	GThread **threads;
+	GArray *latencies;
+	GString *out;
+	guint64 start, usec, sum = 0;
+	guint errors = 0;
+	gdouble secs;
+	gint i;
+
+	thrs = g_new0(bench_thread, config->threads);
+	threads = g_new0(GThread *, config->threads);
+
+	bench_threads_ready = 0;
+	bench_is_started = FALSE;
+
+	for (i = 0; i < config->threads; i++) {
+		GError *gerr = NULL;
+
+		thrs[i].config = config;
+		thrs[i].scenario = scenario;
+		thrs[i].latencies = g_array_new(FALSE, FALSE, sizeof(guint64));
+
+		if (NULL == (threads[i] = g_thread_create(bench_thread_run, &(thrs[i]), TRUE, &gerr))) {
+			g_error("%s: creating thread failed: %s", G_STRLOC, gerr->message);
+		}
+	}
+
+	g_mutex_lock(bench_start_mutex);
+	while (bench_threads_ready < config->threads) g_cond_wait(bench_start_cond, bench_start_mutex);
+	start = bench_get_microseconds();
+	bench_is_started = TRUE;
+	g_cond_broadcast(bench_start_cond);
+	g_mutex_unlock(bench_start_mutex);
+
+	latencies = g_array_new(FALSE, FALSE, sizeof(guint64));
+	for (i = 0; i < config->threads; i++) {
+		g_thread_join(threads[i]);
+
+		g_array_append_vals(latencies, thrs[i].latencies->data, thrs[i].latencies->len);
+		errors += thrs[i].errors;
+
+		g_array_free(thrs[i].latencies, TRUE);
+	}
+	usec = bench_get_microseconds() - start;
+	secs = usec / 1000000.0;
+
+	g_array_sort(latencies, bench_cmp_guint64);
+	for (i = 0; i < (gint)latencies->len; i++) {
+		sum += g_array_index(latencies, guint64, i);
+	}
+
+	out = g_string_new(NULL);
+	g_string_append_len(out, C("{\"scenario\":"));
+	bench_append_json_string(out, scenario->name);
+	g_string_append_len(out, C(",\"label\":"));
+	bench_append_json_string(out, config->label);
+	g_string_append_len(out, C(",\"host\":"));
+	bench_append_json_string(out, config->socketpath ? config->socketpath : config->hostname);
+	g_string_append_printf(out, ",\"port\":%d,\"threads\":%d,\"ops\":%u,\"errors\":%u,\"seconds\":%.3f,\"qps\":%.1f",
+			config->port,
+			config->threads,
+			latencies->len,
+			errors,
+			secs,
+			secs > 0 ? latencies->len / secs : 0.0);
+	g_string_append_printf(out, ",\"latency_usec\":{\"min\":%"G_GUINT64_FORMAT",\"avg\":%.1f,\"p50\":%"G_GUINT64_FORMAT
+			",\"p90\":%"G_GUINT64_FORMAT",\"p99\":%"G_GUINT64_FORMAT",\"p999\":%"G_GUINT64_FORMAT",\"max\":%"G_GUINT64_FORMAT"}}",
+			latencies->len ? g_array_index(latencies, guint64, 0) : 0,
+			latencies->len ? (gdouble)sum / latencies->len : 0.0,
+			bench_percentile(latencies, 50),
+			bench_percentile(latencies, 90),
+			bench_percentile(latencies, 99),
+			bench_percentile(latencies, 99.9),
+			latencies->len ? g_array_index(latencies, guint64, latencies->len - 1) : 0);
+
+	g_print("%s\n", out->str);
+
+	g_string_free(out, TRUE);
+	g_array_free(latencies, TRUE);
+	g_free(threads);
+	g_free(thrs);
+
+	return errors;
+}
+
+int
+main(int argc, char **argv) {
+	GError *gerr = NULL;
+	GOptionContext *opt_context;
+	gchar *scenarios = NULL;
+	gchar **names;
+	gboolean list_scenarios = FALSE;
+	guint errors = 0;
+	int i;
+	bench_config config = {
+		NULL, NULL, NULL, NULL, NULL, 4040,
+		8, 0, 100, NULL
+	};
+	GOptionEntry opt_entries[] = {
+		{ "scenarios", 0, 0, G_OPTION_ARG_STRING, NULL, "comma-separated scenarios to run (default: all)", "<names>" },
+		{ "list", 0, 0, G_OPTION_ARG_NONE, NULL, "list the scenarios", NULL },
+		{ "threads", 0, 0, G_OPTION_ARG_INT, NULL, "number of client connections (default: 8)", "<num>" },
+		{ "ops", 0, 0, G_OPTION_ARG_INT, NULL, "operations per connection (default: depends on the scenario)", "<num>" },
+		{ "warmup", 0, 0, G_OPTION_ARG_INT, NULL, "unmeasured operations per connection before the run (default: 100)", "<num>" },
+		{ "label", 0, 0, G_OPTION_ARG_STRING, NULL, "label of the run in the output, e.g. proxy or direct", "<string>" },
+		{ "port", 0, 0, G_OPTION_ARG_INT, NULL, "port to connect to (default: 4040)", "<num>" },
+		{ "hostname", 0, 0, G_OPTION_ARG_STRING, NULL, "hostname to connect to (default: 127.0.0.1)", "<name>" },
+		{ "username", 0, 0, G_OPTION_ARG_STRING, NULL, "username (default: root)", "<name>" },
+		{ "password", 0, 0, G_OPTION_ARG_STRING, NULL, "password (default: <empty>)", "<name>" },
+		{ "schema", 0, 0, G_OPTION_ARG_STRING, NULL, "default schema", "<name>" },
+		{ "socket", 0, 0, G_OPTION_ARG_FILENAME, NULL, "socket", "<path>" },
+
+		{ NULL, 0, 0, G_OPTION_ARG_INT, NULL, "", "" }
+	};
+
+	i = 0;
+	opt_entries[i++].arg_data = &scenarios;
+	opt_entries[i++].arg_data = &list_scenarios;
+	opt_entries[i++].arg_data = &config.threads;
+	opt_entries[i++].arg_data = &config.ops;
+	opt_entries[i++].arg_data = &config.warmup;
+	opt_entries[i++].arg_data = &config.label;
+	opt_entries[i++].arg_data = &config.port;
+	opt_entries[i++].arg_data = &config.hostname;
+	opt_entries[i++].arg_data = &config.username;
+	opt_entries[i++].arg_data = &config.password;
+	opt_entries[i++].arg_data = &config.schemaname;
+	opt_entries[i++].arg_data = &config.socketpath;
+
+	opt_context = g_option_context_new("- benchmark a MySQL server or proxy");
+	g_option_context_add_main_entries(opt_context, opt_entries, NULL);
+
+	if (FALSE == g_option_context_parse(opt_context, &argc, &argv, &gerr)) {
+		g_critical("%s: %s", G_STRLOC, gerr->message);
+
+		g_clear_error(&gerr);
+
+		return EXIT_FAILURE;
+	}
+	g_option_context_free(opt_context);
+
+	if (list_scenarios) {
+		for (i = 0; bench_scenarios[i].name; i++) {
+			g_print("%-15s %s\n", bench_scenarios[i].name, bench_scenarios[i].desc);
+		}
+
+		return EXIT_SUCCESS;
+	}
+
+	if (config.threads < 1 || config.ops < 0 || config.warmup < 0) {
+		g_critical("%s: --threads has to be > 0, --ops and --warmup >= 0", G_STRLOC);
+
+		return EXIT_FAILURE;
+	}
+
+	if (NULL == config.hostname) config.hostname = g_strdup("127.0.0.1");
+	if (NULL == config.username) config.username = g_strdup("root");
+
+	if (NULL == scenarios) {
+		GString *all = g_string_new(NULL);
+
+		for (i = 0; bench_scenarios[i].name; i++) {
+			if (all->len) g_string_append_c(all, ',');
+			g_string_append(all, bench_scenarios[i].name);
+		}
+
+		scenarios = g_string_free(all, FALSE);
+	}
+
+	/* check the names before we start anything */
+	names = g_strsplit(scenarios, ",", -1);
+	for (i = 0; names[i]; i++) {
+		if (NULL == bench_scenario_get(names[i])) {
+			g_critical("%s: unknown scenario '%s', see --list", G_STRLOC, names[i]);
+
+			return EXIT_FAILURE;
+		}
+	}
+
+	g_thread_init(NULL);
+	mysql_library_init(argc, argv, NULL);
+
+	bench_start_mutex = g_mutex_new();
+	bench_start_cond = g_cond_new();
+
+	for (i = 0; names[i]; i++) {
+		errors += bench_scenario_run(&config, bench_scenario_get(names[i]));
+	}
+
+	g_cond_free(bench_start_cond);
+	g_mutex_free(bench_start_mutex);
+
+	mysql_library_end();
+
+	g_strfreev(names);
+	g_free(scenarios);
+
+	return errors ? EXIT_FAILURE : EXIT_SUCCESS;
+}
@@ -0,0 +1,96 @@
+#!/bin/sh
+#  $%BEGINLICENSE%$
+#  Copyright (c) 2012, 2014, Oracle and/or its affiliates. All rights reserved.
+# 
+#  This program is free software; you can redistribute it and/or
+#  modify it under the terms of the GNU General Public License as
+#  published by the Free Software Foundation; version 2 of the
+#  License.
+# 
+#  This program is distributed in the hope that it will be useful,
+#  but WITHOUT ANY WARRANTY; without even the implied warranty of
+#  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+#  GNU General Public License for more details.
+# 
+#  You should have received a copy of the GNU General Public License
+#  along with this program; if not, write to the Free Software
+#  Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA
+#  02110-1301  USA
+# 
+#  $%ENDLICENSE%$
+
+## run the scenarios of proxy-bench against the backend and against mysql-proxy
+## with different event-thread counts, with and without a Lua script
+##
+## the JSON lines of all runs go to stdout, e.g.
+##
+##   BACKEND_PORT=3306 ./proxy-bench.sh > bench-0.8.6.json
+##
+## the settings are taken from the environment
+
+MYSQL_PROXY=${MYSQL_PROXY:-../src/mysql-proxy}
+PROXY_BENCH=${PROXY_BENCH:-./proxy-bench}
+BACKEND_HOST=${BACKEND_HOST:-127.0.0.1}
+BACKEND_PORT=${BACKEND_PORT:-3306}
+BENCH_USER=${BENCH_USER:-root}
+BENCH_PASSWORD=${BENCH_PASSWORD:-}
+PROXY_PORT=${PROXY_PORT:-14040}
+EVENT_THREADS=${EVENT_THREADS:-"1 2 4 8"}
+BENCH_THREADS=${BENCH_THREADS:-8}
+BENCH_SCENARIOS=${BENCH_SCENARIOS:-}
+srcdir=${srcdir:-`dirname $0`}
+
+bench() {
+	label=$1
+	port=$2
+
+	$PROXY_BENCH \
+		--hostname="$BACKEND_HOST" \
+		--port="$port" \
+		--username="$BENCH_USER" \
+		--password="$BENCH_PASSWORD" \
+		--threads="$BENCH_THREADS" \
+		${BENCH_SCENARIOS:+--scenarios="$BENCH_SCENARIOS"} \
+		--label="$label"
+}
+
+## start the proxy, wait until it listens, run the benchmark and stop it again
+bench_proxy() {
+	label=$1
+	shift
+
+	$MYSQL_PROXY \
+		--plugins=proxy \
+		--proxy-address="$BACKEND_HOST:$PROXY_PORT" \
+		--proxy-backend-addresses="$BACKEND_HOST:$BACKEND_PORT" \
+		"$@" &
+	proxy_pid=$!
+
+	i=0
+	while ! $PROXY_BENCH --hostname="$BACKEND_HOST" --port="$PROXY_PORT" \
+			--username="$BENCH_USER" --password="$BENCH_PASSWORD" \
+			--scenarios=point-select --threads=1 --ops=1 --warmup=0 > /dev/null 2>&1; do
+		i=`expr $i + 1`
+		if [ $i -gt 50 ]; then
+			echo "$0: mysql-proxy didn't start" >&2
+			kill $proxy_pid
+			exit 1
+		fi
+		sleep 0.1
+	done
+
+	bench "$label" "$PROXY_PORT"
+
+	kill $proxy_pid
+	wait $proxy_pid 2> /dev/null
+}
+
+bench "direct" "$BACKEND_PORT"
+
+for n in $EVENT_THREADS; do
+	bench_proxy "proxy,event-threads=$n" --event-threads="$n"
+done
+
+## the cost of calling the Lua hooks
+bench_proxy "proxy,event-threads=1,lua=noop" --event-threads=1 \
+	--proxy-lua-script="$srcdir/proxy-bench-noop.lua"
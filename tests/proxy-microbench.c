@@ -0,0 +1,888 @@
+/* $%BEGINLICENSE%$
+ Copyright (c) 2012, 2014, Oracle and/or its affiliates. All rights reserved.
+
+ This program is free software; you can redistribute it and/or
+ modify it under the terms of the GNU General Public License as
+ published by the Free Software Foundation; version 2 of the
+ License.
+
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ GNU General Public License for more details.
+
+ You should have received a copy of the GNU General Public License
+ along with this program; if not, write to the Free Software
+ Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA
+ 02110-1301  USA
+
+ $%BEGINLICENSE%$ */
+/**
+ * the time and the allocations of the protocol codecs and the tokenizer
+ *
+ * each benchmark runs one decoder or encoder in a loop over the same input, without a
+ * socket or an event-loop around it. The result is printed as one line of JSON with the
+ * ns/op and the allocations/op, the allocations are counted with a GMemVTable that wraps
+ * malloc().
+ *
+ * the allocations are only counted if glib still supports g_mem_set_vtable(), otherwise
+ * they are reported as null.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <glib.h>
+
+#include "network-mysqld-proto.h"
+#include "network-mysqld-packet.h"
+#include "network-mysqld.h"
+#include "network-packet.h"
+
+#ifdef HAVE_SQL_TOKENIZER
+#include "sql-tokenizer.h"
+#include "sql-tokenizer-keywords.h"
+#endif
+
+#define C(x) (x), sizeof(x) - 1
+
+/**
+ * rows of the result-set of the query-result benchmark
+ */
+#define MICROBENCH_RESULTSET_ROWS 1000
+
+/**
+ * columns of the result-set of the fielddefs benchmark
+ */
+#define MICROBENCH_FIELDDEFS_COLUMNS 16
+
+typedef struct microbench microbench;
+
+/**
+ * the input and the scratch space of a benchmark
+ */
+typedef struct {
+	microbench *bench;
+
+	network_mysqld_con *con;
+	GString *cmd;                     /**< the COM_QUERY the result-set belongs to */
+
+	GQueue *packets;                  /**< GString's, a captured result-set */
+	gsize packets_len;                /**< bytes of all the packets */
+
+	network_packet packet;            /**< a single packet for the auth and row codecs */
+	network_mysqld_proto_fielddefs_t *coldefs;
+	network_mysqld_auth_challenge *shake;
+	network_mysqld_auth_response *auth;
+
+	GPtrArray *corpus;                /**< the queries of the tokenizer */
+	guint corpus_ndx;
+	GPtrArray *words;                 /**< GString's, the identifiers of the corpus for the keyword lookups */
+
+	gsize bytes;                      /**< bytes processed per operation */
+} microbench_state;
+
+struct microbench {
+	const gchar *name;
+	const gchar *desc;
+	gint default_ops;
+
+	gboolean (*setup)(microbench_state *st);
+	gboolean (*op)(microbench_state *st);   /**< one operation, timed */
+	void (*teardown)(microbench_state *st);
+};
+
+static guint64 microbench_allocs = 0;
+static guint64 microbench_alloc_bytes = 0;
+static gboolean microbench_allocs_are_counted = FALSE;
+
+/**
+ * the corpus of the tokenizer if no --corpus is given
+ */
+static const gchar *microbench_default_corpus[] = {
+	"SELECT 1",
+	"SELECT * FROM t1 WHERE id = 1",
+	"SELECT a, b, c FROM t1 WHERE a IN (1, 2, 3, 4, 5) AND b LIKE 'abc%' ORDER BY c DESC LIMIT 10",
+	"INSERT INTO t1 (id, name, created) VALUES (1, 'foo', NOW()), (2, 'bar', NOW()), (3, 'baz', NOW())",
+	"UPDATE t1 SET name = 'foo', updated = NOW() WHERE id = 42 /* from the app */",
+	"DELETE FROM t1 WHERE created < DATE_SUB(NOW(), INTERVAL 7 DAY)",
+	"SELECT u.id, u.name, COUNT(o.id) AS orders FROM users u LEFT JOIN orders o ON o.user_id = u.id "
+		"WHERE u.active = 1 GROUP BY u.id, u.name HAVING COUNT(o.id) > 5 ORDER BY orders DESC LIMIT 100",
+	"SET autocommit = 1",
+	"SELECT @@version_comment LIMIT 1",
+	"SHOW FULL PROCESSLIST",
+	NULL
+};
+
+static gpointer microbench_malloc(gsize n_bytes) {
+	microbench_allocs++;
+	microbench_alloc_bytes += n_bytes;
+
+	return malloc(n_bytes);
+}
+
+static gpointer microbench_realloc(gpointer mem, gsize n_bytes) {
+	microbench_allocs++;
+	microbench_alloc_bytes += n_bytes;
+
+	return realloc(mem, n_bytes);
+}
+
+static gpointer microbench_calloc(gsize n_blocks, gsize n_block_bytes) {
+	microbench_allocs++;
+	microbench_alloc_bytes += n_blocks * n_block_bytes;
+
+	return calloc(n_blocks, n_block_bytes);
+}
+
+static void microbench_free(gpointer mem) {
+	free(mem);
+}
+
+static GMemVTable microbench_mem_vtable = {
+	microbench_malloc,
+	microbench_realloc,
+	microbench_free,
+	microbench_calloc,
+	microbench_malloc,
+	microbench_realloc
+};
+
+/**
+ * append a packet with its network-header
+ */
+static void microbench_packets_append(microbench_state *st, guint8 packet_id, GString *payload) {
+	GString *packet = g_string_sized_new(payload->len + NET_HEADER_SIZE);
+
+	network_mysqld_proto_append_packet_len(packet, payload->len);
+	network_mysqld_proto_append_packet_id(packet, packet_id);
+	g_string_append_len(packet, payload->str, payload->len);
+
+	g_queue_push_tail(st->packets, packet);
+	st->packets_len += packet->len;
+}
+
+static void microbench_append_fielddef(GString *payload, const gchar *name, guint8 type, guint32 length) {
+	network_mysqld_proto_append_lenenc_string(payload, "def");
+	network_mysqld_proto_append_lenenc_string(payload, "test");
+	network_mysqld_proto_append_lenenc_string(payload, "t1");
+	network_mysqld_proto_append_lenenc_string(payload, "t1");
+	network_mysqld_proto_append_lenenc_string(payload, name);
+	network_mysqld_proto_append_lenenc_string(payload, name);
+	network_mysqld_proto_append_int8(payload, 0x0c);  /* length of the fixed fields */
+	network_mysqld_proto_append_int16(payload, 8);    /* charset */
+	network_mysqld_proto_append_int32(payload, length);
+	network_mysqld_proto_append_int8(payload, type);
+	network_mysqld_proto_append_int16(payload, 0);    /* flags */
+	network_mysqld_proto_append_int8(payload, 0);     /* decimals */
+	network_mysqld_proto_append_int16(payload, 0);    /* filler */
+}
+
+/**
+ * the field-count, the field-defs and the EOF of a result-set
+ *
+ * @return the packet-id of the next packet
+ */
+static guint8 microbench_packets_append_fields(microbench_state *st, guint columns) {
+	GString *payload = g_string_new(NULL);
+	guint8 packet_id = 1;
+	guint i;
+
+	network_mysqld_proto_append_lenenc_int(payload, columns);
+	microbench_packets_append(st, packet_id++, payload);
+
+	for (i = 0; i < columns; i++) {
+		gchar name[16];
+
+		g_snprintf(name, sizeof(name), "col%u", i);
+
+		g_string_truncate(payload, 0);
+		microbench_append_fielddef(payload, name, MYSQL_TYPE_VAR_STRING, 255);
+		microbench_packets_append(st, packet_id++, payload);
+	}
+
+	g_string_truncate(payload, 0);
+	g_string_append_len(payload, C("\xfe\x00\x00\x02\x00"));
+	microbench_packets_append(st, packet_id++, payload);
+
+	g_string_free(payload, TRUE);
+
+	return packet_id;
+}
+
+static void microbench_packets_free(microbench_state *st) {
+	GString *packet;
+
+	if (!st->packets) return;
+
+	while ((packet = g_queue_pop_head(st->packets))) g_string_free(packet, TRUE);
+	g_queue_free(st->packets);
+	st->packets = NULL;
+}
+
+/**
+ * a text result-set of 4 columns as a COM_QUERY would get it
+ */
+static gboolean microbench_setup_query_result(microbench_state *st) {
+	GString *payload = g_string_new(NULL);
+	guint8 packet_id;
+	guint i;
+
+	st->packets = g_queue_new();
+	packet_id = microbench_packets_append_fields(st, 4);
+
+	for (i = 0; i < MICROBENCH_RESULTSET_ROWS; i++) {
+		gchar num[16];
+
+		g_snprintf(num, sizeof(num), "%u", i);
+
+		g_string_truncate(payload, 0);
+		network_mysqld_proto_append_lenenc_string(payload, num);
+		network_mysqld_proto_append_lenenc_string(payload, "some text of a varchar column");
+		network_mysqld_proto_append_int8(payload, 0xfb); /* NULL */
+		network_mysqld_proto_append_lenenc_string(payload, "2014-01-01 00:00:00");
+		microbench_packets_append(st, packet_id++, payload);
+	}
+
+	g_string_truncate(payload, 0);
+	g_string_append_len(payload, C("\xfe\x00\x00\x02\x00"));
+	microbench_packets_append(st, packet_id++, payload);
+
+	g_string_free(payload, TRUE);
+
+	st->cmd = g_string_new(NULL);
+	network_mysqld_proto_append_packet_len(st->cmd, sizeof("\x03SELECT * FROM t1") - 1);
+	network_mysqld_proto_append_packet_id(st->cmd, 0);
+	g_string_append_len(st->cmd, C("\x03SELECT * FROM t1"));
+
+	st->con = network_mysqld_con_new();
+	st->bytes = st->packets_len;
+
+	return TRUE;
+}
+
+/**
+ * track the whole result-set like the proxy does in READ_QUERY_RESULT
+ */
+static gboolean microbench_op_query_result(microbench_state *st) {
+	network_packet packet;
+	GList *chunk;
+	int is_finished = 0;
+
+	packet.data = st->cmd;
+	packet.offset = 0;
+	if (0 != network_mysqld_con_command_states_init(st->con, &packet)) return FALSE;
+
+	for (chunk = st->packets->head; chunk && !is_finished; chunk = chunk->next) {
+		packet.data = chunk->data;
+		packet.offset = 0;
+
+		is_finished = network_mysqld_proto_get_query_result(&packet, st->con);
+		if (is_finished < 0) return FALSE;
+	}
+
+	network_mysqld_con_reset_command_response_state(st->con);
+
+	return is_finished == 1;
+}
+
+static void microbench_teardown_query_result(microbench_state *st) {
+	microbench_packets_free(st);
+	g_string_free(st->cmd, TRUE);
+	network_mysqld_con_free(st->con);
+}
+
+static gboolean microbench_setup_fielddefs(microbench_state *st) {
+	st->packets = g_queue_new();
+	microbench_packets_append_fields(st, MICROBENCH_FIELDDEFS_COLUMNS);
+
+	st->bytes = st->packets_len;
+
+	return TRUE;
+}
+
+static gboolean microbench_op_fielddefs(microbench_state *st) {
+	network_mysqld_proto_fielddefs_t *fields = network_mysqld_proto_fielddefs_new();
+	gboolean is_ok;
+
+	is_ok = (NULL != network_mysqld_proto_get_fielddefs(st->packets->head, fields));
+
+	network_mysqld_proto_fielddefs_free(fields);
+
+	return is_ok;
+}
+
+static void microbench_teardown_fielddefs(microbench_state *st) {
+	microbench_packets_free(st);
+}
+
+/**
+ * a binary row of a COM_STMT_EXECUTE with a INT, BIGINT, DOUBLE and VARCHAR
+ */
+static gboolean microbench_setup_binary_row(microbench_state *st) {
+	network_mysqld_proto_fielddef_t *coldef;
+	guint8 types[] = { MYSQL_TYPE_LONG, MYSQL_TYPE_LONGLONG, MYSQL_TYPE_DOUBLE, MYSQL_TYPE_VAR_STRING };
+	gdouble d = 3.14159;
+	guint i;
+
+	st->coldefs = network_mysqld_proto_fielddefs_new();
+	for (i = 0; i < G_N_ELEMENTS(types); i++) {
+		coldef = network_mysqld_proto_fielddef_new();
+		coldef->type = types[i];
+
+		g_ptr_array_add(st->coldefs, coldef);
+	}
+
+	st->packet.data = g_string_new(NULL);
+	st->packet.offset = 0;
+
+	network_mysqld_proto_append_int8(st->packet.data, 0x00); /* the header of the binary row */
+	network_mysqld_proto_append_int8(st->packet.data, 0x00); /* the NULL-bitmap, (4 + 7 + 2) / 8 bytes */
+	network_mysqld_proto_append_int32(st->packet.data, 42);
+	network_mysqld_proto_append_int64(st->packet.data, G_GINT64_CONSTANT(1) << 40);
+	g_string_append_len(st->packet.data, (gchar *)&d, sizeof(d));
+	network_mysqld_proto_append_lenenc_string(st->packet.data, "some text of a varchar column");
+
+	st->bytes = st->packet.data->len;
+
+	return TRUE;
+}
+
+static gboolean microbench_op_binary_row(microbench_state *st) {
+	network_mysqld_resultset_row_t *row = network_mysqld_resultset_row_new();
+	int err;
+
+	st->packet.offset = 0;
+	err = network_mysqld_proto_get_binary_row(&st->packet, st->coldefs, row);
+
+	network_mysqld_resultset_row_free(row);
+
+	return 0 == err;
+}
+
+static void microbench_teardown_binary_row(microbench_state *st) {
+	network_mysqld_proto_fielddefs_free(st->coldefs);
+	g_string_free(st->packet.data, TRUE);
+}
+
+/**
+ * the handshake of a 5.6 server with plugin-auth
+ */
+static gboolean microbench_setup_auth_challenge(microbench_state *st) {
+	const char raw_packet[] =
+		"\x0a"
+		"\x35\x2e\x36\x2e\x32\x2d\x6d\x35\x2d\x6c\x6f\x67\x00"
+		"\x4d\x00\x00\x00"
+		"\x3d\x25\x3d\x43\x76\x4d\x5e\x6d\x00"
+		"\xff\xff" /* capabilities - part 1 */
+		"\x08"     /* charset */
+		"\x02\x00" /* status */
+		"\x0f\xc0" /* capabilities - part 2 */
+		"\x15" /* auth-plugin-part-len */
+		"\x00\x00\x00\x00\x00\x00\x00\x00\x00\x00" /* fillers */
+		"\x2d\x37\x69\x2d\x41\x3f\x58\x7c\x2c\x5f\x7d\x75\x00" /* auth-plugin-part-2 */
+		"mysql_native_password\x00"
+		;
+
+	st->packet.data = g_string_new_len(C(raw_packet));
+	st->packet.offset = 0;
+
+	st->shake = network_mysqld_auth_challenge_new();
+	if (0 != network_mysqld_proto_get_auth_challenge(&st->packet, st->shake)) return FALSE;
+
+	st->bytes = st->packet.data->len;
+
+	return TRUE;
+}
+
+static gboolean microbench_op_auth_challenge_get(microbench_state *st) {
+	network_mysqld_auth_challenge *shake = network_mysqld_auth_challenge_new();
+	int err;
+
+	st->packet.offset = 0;
+	err = network_mysqld_proto_get_auth_challenge(&st->packet, shake);
+
+	network_mysqld_auth_challenge_free(shake);
+
+	return 0 == err;
+}
+
+static gboolean microbench_op_auth_challenge_append(microbench_state *st) {
+	GString *packet = g_string_sized_new(128);
+	int err;
+
+	err = network_mysqld_proto_append_auth_challenge(packet, st->shake);
+
+	g_string_free(packet, TRUE);
+
+	return 0 == err;
+}
+
+static void microbench_teardown_auth_challenge(microbench_state *st) {
+	network_mysqld_auth_challenge_free(st->shake);
+	g_string_free(st->packet.data, TRUE);
+}
+
+/**
+ * the auth-response of a 4.1 client
+ */
+static gboolean microbench_setup_auth_response(microbench_state *st) {
+	const char raw_packet[] =
+		"\205\246\3\0"
+		"\0\0\0\1"
+		"\10"
+		"\0\0\0\0\0\0\0\0\0\0\0\0\0\0\0\0\0\0\0\0\0\0\0"
+		"root\0"
+		"\24\241\304\260>\255\1:F,\256\337K\323\340\4\273\354I\256\204"
+		;
+
+	st->packet.data = g_string_new_len(C(raw_packet));
+	st->packet.offset = 0;
+
+	st->auth = network_mysqld_auth_response_new(CLIENT_PROTOCOL_41 | CLIENT_SECURE_CONNECTION);
+	if (0 != network_mysqld_proto_get_auth_response(&st->packet, st->auth)) return FALSE;
+
+	st->bytes = st->packet.data->len;
+
+	return TRUE;
+}
+
+static gboolean microbench_op_auth_response_get(microbench_state *st) {
+	network_mysqld_auth_response *auth = network_mysqld_auth_response_new(CLIENT_PROTOCOL_41 | CLIENT_SECURE_CONNECTION);
+	int err;
+
+	st->packet.offset = 0;
+	err = network_mysqld_proto_get_auth_response(&st->packet, auth);
+
+	network_mysqld_auth_response_free(auth);
+
+	return 0 == err;
+}
+
+static gboolean microbench_op_auth_response_append(microbench_state *st) {
+	GString *packet = g_string_sized_new(128);
+	int err;
+
+	err = network_mysqld_proto_append_auth_response(packet, st->auth);
+
+	g_string_free(packet, TRUE);
+
+	return 0 == err;
+}
+
+static void microbench_teardown_auth_response(microbench_state *st) {
+	network_mysqld_auth_response_free(st->auth);
+	g_string_free(st->packet.data, TRUE);
+}
+
+#ifdef HAVE_SQL_TOKENIZER
+static gboolean microbench_setup_tokenizer(microbench_state *st) {
+	guint i;
+
+	for (i = 0; i < st->corpus->len; i++) {
+		st->bytes += strlen(st->corpus->pdata[i]);
+	}
+	st->bytes /= st->corpus->len;
+
+	return TRUE;
+}
+
+/**
+ * tokenize the next query of the corpus
+ */
+static gboolean microbench_op_tokenizer(microbench_state *st) {
+	GPtrArray *tokens = sql_tokens_new();
+	const gchar *query;
+	int err;
+
+	query = st->corpus->pdata[st->corpus_ndx++ % st->corpus->len];
+
+	err = sql_tokenizer(tokens, query, strlen(query));
+
+	sql_tokens_free(tokens);
+
+	return 0 == err;
+}
+
+/**
+ * split the corpus into the identifiers the tokenizer looks up as keywords
+ */
+static gboolean microbench_setup_keywords(microbench_state *st) {
+	guint i;
+
+	st->words = g_ptr_array_new();
+
+	for (i = 0; i < st->corpus->len; i++) {
+		const gchar *s = st->corpus->pdata[i];
+
+		while (*s) {
+			const gchar *word = s;
+
+			if (!g_ascii_isalpha(*s) && *s != '_') {
+				s++;
+				continue;
+			}
+
+			while (g_ascii_isalnum(*s) || *s == '_') s++;
+
+			g_ptr_array_add(st->words, g_string_new_len(word, s - word));
+			st->bytes += s - word;
+		}
+	}
+
+	if (st->words->len == 0) return FALSE;
+
+	st->bytes /= st->words->len;
+
+	return TRUE;
+}
+
+/**
+ * look up the next identifier with the perfect hash of the keywords
+ */
+static gboolean microbench_op_keywords_hash(microbench_state *st) {
+	GString *word = st->words->pdata[st->corpus_ndx++ % st->words->len];
+
+	sql_token_get_id_len(word->str, word->len);
+
+	return TRUE;
+}
+
+typedef struct {
+	const char *name;
+	size_t name_len;
+} microbench_keyword_cmp_data;
+
+/**
+ * the case-insensitive compare of the binary search the tokenizer used before the perfect hash
+ */
+static int microbench_keyword_cmp(const void *_a, const void *_b) {
+	const microbench_keyword_cmp_data *name = _a;
+	int id = *(int *)_b;
+	const char *keyword;
+	size_t keyword_len;
+	size_t i;
+
+	keyword = sql_token_get_name(id, &keyword_len);
+
+	keyword += sizeof("TK_SQL_") - 1;
+	keyword_len -= sizeof("TK_SQL_") - 1;
+
+	for (i = 0; i < keyword_len && i < name->name_len; i++) {
+		int c_diff = g_ascii_tolower(name->name[i]) - g_ascii_tolower(keyword[i]);
+
+		if (0 != c_diff) return c_diff;
+	}
+
+	return name->name_len - keyword_len;
+}
+
+/**
+ * look up the next identifier with a binary search on the sorted keywords
+ */
+static gboolean microbench_op_keywords_bsearch(microbench_state *st) {
+	GString *word = st->words->pdata[st->corpus_ndx++ % st->words->len];
+	microbench_keyword_cmp_data data;
+
+	data.name = word->str;
+	data.name_len = word->len;
+
+	bsearch(&data,
+		sql_keywords_get(),
+		sql_keywords_get_count(),
+		sizeof(int),
+		microbench_keyword_cmp);
+
+	return TRUE;
+}
+
+static void microbench_teardown_keywords(microbench_state *st) {
+	guint i;
+
+	for (i = 0; i < st->words->len; i++) {
+		g_string_free(st->words->pdata[i], TRUE);
+	}
+	g_ptr_array_free(st->words, TRUE);
+}
+#endif
+
+static microbench microbench_benches[] = {
+	{ "query-result", "track a text result-set of " G_STRINGIFY(MICROBENCH_RESULTSET_ROWS) " rows, per result-set", 1000,
+		microbench_setup_query_result, microbench_op_query_result, microbench_teardown_query_result },
+	{ "fielddefs", "decode the " G_STRINGIFY(MICROBENCH_FIELDDEFS_COLUMNS) " field-defs of a result-set", 100000,
+		microbench_setup_fielddefs, microbench_op_fielddefs, microbench_teardown_fielddefs },
+	{ "binary-row", "decode a binary row of 4 columns", 1000000,
+		microbench_setup_binary_row, microbench_op_binary_row, microbench_teardown_binary_row },
+	{ "auth-challenge-get", "decode the handshake of the server", 1000000,
+		microbench_setup_auth_challenge, microbench_op_auth_challenge_get, microbench_teardown_auth_challenge },
+	{ "auth-challenge-append", "encode the handshake of the server", 1000000,
+		microbench_setup_auth_challenge, microbench_op_auth_challenge_append, microbench_teardown_auth_challenge },
+	{ "auth-response-get", "decode the auth-response of the client", 1000000,
+		microbench_setup_auth_response, microbench_op_auth_response_get, microbench_teardown_auth_response },
+	{ "auth-response-append", "encode the auth-response of the client", 1000000,
+		microbench_setup_auth_response, microbench_op_auth_response_append, microbench_teardown_auth_response },
+#ifdef HAVE_SQL_TOKENIZER
+	{ "tokenizer", "tokenize a query of the corpus, per query", 1000000,
+		microbench_setup_tokenizer, microbench_op_tokenizer, NULL },
+	{ "keywords-hash", "look up an identifier of the corpus in the perfect hash of the keywords", 10000000,
+		microbench_setup_keywords, microbench_op_keywords_hash, microbench_teardown_keywords },
+	{ "keywords-bsearch", "look up an identifier of the corpus with a binary search, for comparison", 10000000,
+		microbench_setup_keywords, microbench_op_keywords_bsearch, microbench_teardown_keywords },
+#endif
+
+	{ NULL, NULL, 0, NULL, NULL, NULL }
+};
+
+static microbench *microbench_get(const gchar *name) {
+	int i;
+
+	for (i = 0; microbench_benches[i].name; i++) {
+		if (0 == strcmp(microbench_benches[i].name, name)) return &microbench_benches[i];
+	}
+
+	return NULL;
+}
+
+/**
+ * run a benchmark and print its result
+ *
+ * @return 0 on success, 1 if the setup or an operation failed
+ */
+static int microbench_run(microbench *bench, GPtrArray *corpus, gint ops, gint warmup) {
+	microbench_state st;
+	GTimer *timer;
+	guint64 allocs, alloc_bytes;
+	gdouble secs;
+	gint i;
+	int ret = 0;
+
+	memset(&st, 0, sizeof(st));
+	st.bench = bench;
+	st.corpus = corpus;
+
+	if (0 == ops) ops = bench->default_ops;
+	if (warmup < 0) warmup = MAX(ops / 10, 1);
+
+	if (!bench->setup(&st)) {
+		g_critical("%s: setting up %s failed", G_STRLOC, bench->name);
+
+		ret = 1;
+		goto teardown;
+	}
+
+	for (i = 0; i < warmup; i++) {
+		if (!bench->op(&st)) {
+			g_critical("%s: %s failed", G_STRLOC, bench->name);
+
+			ret = 1;
+			goto teardown;
+		}
+	}
+
+	timer = g_timer_new();
+
+	allocs = microbench_allocs;
+	alloc_bytes = microbench_alloc_bytes;
+
+	g_timer_start(timer);
+	for (i = 0; i < ops; i++) {
+		if (!bench->op(&st)) break;
+	}
+	g_timer_stop(timer);
+
+	allocs = microbench_allocs - allocs;
+	alloc_bytes = microbench_alloc_bytes - alloc_bytes;
+
+	secs = g_timer_elapsed(timer, NULL);
+	g_timer_destroy(timer);
+
+	if (i < ops) {
+		g_critical("%s: %s failed after %d operations", G_STRLOC, bench->name, i);
+
+		ret = 1;
+		goto teardown;
+	}
+
+	g_print("{\"bench\":\"%s\",\"ops\":%d,\"seconds\":%.3f,\"ns_per_op\":%.1f,\"bytes_per_op\":%"G_GSIZE_FORMAT",\"mb_per_sec\":%.1f",
+			bench->name,
+			ops,
+			secs,
+			secs * 1e9 / ops,
+			st.bytes,
+			secs > 0 ? st.bytes * (gdouble)ops / secs / (1024 * 1024) : 0.0);
+	if (microbench_allocs_are_counted) {
+		g_print(",\"allocs_per_op\":%.2f,\"alloc_bytes_per_op\":%.1f}\n",
+				(gdouble)allocs / ops,
+				(gdouble)alloc_bytes / ops);
+	} else {
+		g_print(",\"allocs_per_op\":null,\"alloc_bytes_per_op\":null}\n");
+	}
+
+teardown:
+	if (bench->teardown) bench->teardown(&st);
+
+	return ret;
+}
+
+/**
+ * read the corpus of the tokenizer, one query per line
+ */
+static GPtrArray *microbench_corpus_new(const gchar *filename, GError **gerr) {
+	GPtrArray *corpus = g_ptr_array_new();
+	gchar *contents;
+	gchar **lines;
+	int i;
+
+	if (NULL == filename) {
+		for (i = 0; microbench_default_corpus[i]; i++) {
+			g_ptr_array_add(corpus, g_strdup(microbench_default_corpus[i]));
+		}
+
+		return corpus;
+	}
+
+	if (!g_file_get_contents(filename, &contents, NULL, gerr)) {
+		g_ptr_array_free(corpus, TRUE);
+
+		return NULL;
+	}
+
+	lines = g_strsplit(contents, "\n", -1);
+	for (i = 0; lines[i]; i++) {
+		if (lines[i][0] == '\0') {
+			g_free(lines[i]);
+		} else {
+			g_ptr_array_add(corpus, lines[i]); /* the corpus owns the line now */
+		}
+	}
+	g_free(lines);
+	g_free(contents);
+
+	if (0 == corpus->len) {
+		g_set_error(gerr, G_FILE_ERROR, G_FILE_ERROR_INVAL,
+				"%s contains no queries",
+				filename);
+
+		g_ptr_array_free(corpus, TRUE);
+
+		return NULL;
+	}
+
+	return corpus;
+}
+
+static void microbench_corpus_free(GPtrArray *corpus) {
+	guint i;
+
+	for (i = 0; i < corpus->len; i++) {
+		g_free(corpus->pdata[i]);
+	}
+	g_ptr_array_free(corpus, TRUE);
+}
+
+int
+main(int argc, char **argv) {
+	GError *gerr = NULL;
+	GOptionContext *opt_context;
+	GPtrArray *corpus;
+	gchar *benches = NULL;
+	gchar *corpus_filename = NULL;
+	gchar **names;
+	gboolean list_benches = FALSE;
+	gint ops = 0;
+	gint warmup = -1;
+	int errors = 0;
+	int i;
+
+	GOptionEntry opt_entries[] = {
+		{ "benches", 0, 0, G_OPTION_ARG_STRING, NULL, "comma-separated benchmarks to run (default: all)", "<names>" },
+		{ "list", 0, 0, G_OPTION_ARG_NONE, NULL, "list the benchmarks", NULL },
+		{ "ops", 0, 0, G_OPTION_ARG_INT, NULL, "operations per benchmark (default: depends on the benchmark)", "<num>" },
+		{ "warmup", 0, 0, G_OPTION_ARG_INT, NULL, "unmeasured operations before the run (default: a tenth of --ops)", "<num>" },
+		{ "corpus", 0, 0, G_OPTION_ARG_FILENAME, NULL, "queries for the tokenizer, one per line (default: built-in)", "<file>" },
+
+		{ NULL, 0, 0, G_OPTION_ARG_INT, NULL, "", "" }
+	};
+
+	/* has to be set before glib allocates anything. With G_SLICE=always-malloc the
+	 * g_slice_*() allocations are counted too */
+	g_mem_set_vtable(&microbench_mem_vtable);
+	g_setenv("G_SLICE", "always-malloc", TRUE);
+
+	/* newer glib ignores the vtable */
+	g_free(g_malloc(1));
+	microbench_allocs_are_counted = (microbench_allocs > 0);
+
+	i = 0;
+	opt_entries[i++].arg_data = &benches;
+	opt_entries[i++].arg_data = &list_benches;
+	opt_entries[i++].arg_data = &ops;
+	opt_entries[i++].arg_data = &warmup;
+	opt_entries[i++].arg_data = &corpus_filename;
+
+	opt_context = g_option_context_new("- time the protocol codecs and the tokenizer");
+	g_option_context_add_main_entries(opt_context, opt_entries, NULL);
+
+	if (FALSE == g_option_context_parse(opt_context, &argc, &argv, &gerr)) {
+		g_critical("%s: %s", G_STRLOC, gerr->message);
+
+		g_clear_error(&gerr);
+
+		return EXIT_FAILURE;
+	}
+	g_option_context_free(opt_context);
+
+	if (list_benches) {
+		for (i = 0; microbench_benches[i].name; i++) {
+			g_print("%-22s %s\n", microbench_benches[i].name, microbench_benches[i].desc);
+		}
+
+		return EXIT_SUCCESS;
+	}
+
+	if (ops < 0) {
+		g_critical("%s: --ops has to be >= 0", G_STRLOC);
+
+		return EXIT_FAILURE;
+	}
+
+	if (NULL == benches) {
+		GString *all = g_string_new(NULL);
+
+		for (i = 0; microbench_benches[i].name; i++) {
+			if (all->len) g_string_append_c(all, ',');
+			g_string_append(all, microbench_benches[i].name);
+		}
+
+		benches = g_string_free(all, FALSE);
+	}
+
+	names = g_strsplit(benches, ",", -1);
+	for (i = 0; names[i]; i++) {
+		if (NULL == microbench_get(names[i])) {
+			g_critical("%s: unknown benchmark '%s', see --list", G_STRLOC, names[i]);
+
+			return EXIT_FAILURE;
+		}
+	}
+
+	if (NULL == (corpus = microbench_corpus_new(corpus_filename, &gerr))) {
+		g_critical("%s: %s", G_STRLOC, gerr->message);
+
+		g_clear_error(&gerr);
+
+		return EXIT_FAILURE;
+	}
+
+	for (i = 0; names[i]; i++) {
+		errors += microbench_run(microbench_get(names[i]), corpus, ops, warmup);
+	}
+
+	microbench_corpus_free(corpus);
+	g_strfreev(names);
+	g_free(benches);
+	if (corpus_filename) g_free(corpus_filename);
+
+	return errors ? EXIT_FAILURE : EXIT_SUCCESS;
+}
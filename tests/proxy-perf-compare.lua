@@ -0,0 +1,185 @@
+--[[ $%BEGINLICENSE%$
+ Copyright (c) 2012, 2014, Oracle and/or its affiliates. All rights reserved.
+
+ This program is free software; you can redistribute it and/or
+ modify it under the terms of the GNU General Public License as
+ published by the Free Software Foundation; version 2 of the
+ License.
+
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ GNU General Public License for more details.
+
+ You should have received a copy of the GNU General Public License
+ along with this program; if not, write to the Free Software
+ Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA
+ 02110-1301  USA
+
+ $%ENDLICENSE%$ --]]
+
+---
+-- compare the results of proxy-perf.sh to a baseline
+--
+--   lua proxy-perf-compare.lua <baseline.json> <results.json>
+--
+-- the QPS and the p99 of a proxy run are taken relative to the direct run of the same
+-- backend and scenario, so a baseline recorded on another machine stays comparable.
+-- The allocations/op of proxy-microbench don't depend on the machine and are compared
+-- as they are.
+--
+-- exits with 1 if a run is worse than the baseline by more than its tolerance, the
+-- tolerances can be set from the environment:
+--
+--   PERF_QPS_TOLERANCE    the QPS may drop by that fraction (default: 0.10)
+--   PERF_P99_TOLERANCE    the p99 may grow by that fraction (default: 0.20)
+--   PERF_ALLOC_TOLERANCE  the allocations/op may grow by that fraction (default: 0.05)
+
+local baseline_file = assert(arg[1], "usage: proxy-perf-compare.lua <baseline.json> <results.json>")
+local results_file  = assert(arg[2], "usage: proxy-perf-compare.lua <baseline.json> <results.json>")
+
+local qps_tolerance   = tonumber(os.getenv("PERF_QPS_TOLERANCE") or 0.10)
+local p99_tolerance   = tonumber(os.getenv("PERF_P99_TOLERANCE") or 0.20)
+local alloc_tolerance = tonumber(os.getenv("PERF_ALLOC_TOLERANCE") or 0.05)
+
+---
+-- the lines are written by proxy-bench and proxy-microbench, we only need a few
+-- of their fields and don't need a full JSON parser
+local function get_string(line, key)
+	return line:match('"' .. key .. '":"([^"]*)"')
+end
+
+local function get_number(line, key)
+	return tonumber(line:match('"' .. key .. '":(%-?[%d%.eE%+]+)'))
+end
+
+---
+-- read the runs of a file
+--
+-- @return the runs of proxy-bench by "<label>/<scenario>", the runs of proxy-microbench by name
+local function load_runs(filename)
+	local f = io.open(filename, "r")
+	local scenarios, benches = {}, {}
+
+	if not f then
+		return nil, nil
+	end
+
+	for line in f:lines() do
+		local scenario = get_string(line, "scenario")
+		local bench = get_string(line, "bench")
+
+		if line:sub(1, 1) == "#" then
+			-- a comment
+		elseif scenario then
+			scenarios[get_string(line, "label") .. "/" .. scenario] = {
+				label    = get_string(line, "label"),
+				scenario = scenario,
+				qps      = get_number(line, "qps"),
+				p99      = get_number(line, "p99"),
+				errors   = get_number(line, "errors"),
+			}
+		elseif bench then
+			benches[bench] = {
+				allocs_per_op = get_number(line, "allocs_per_op"),
+				ns_per_op     = get_number(line, "ns_per_op"),
+			}
+		end
+	end
+	f:close()
+
+	return scenarios, benches
+end
+
+---
+-- the direct run a proxy run is relative to: "mock,proxy,event-threads=4" -> "mock,direct"
+local function get_reference(scenarios, run)
+	local backend = run.label:match("^([^,]+),")
+
+	if not backend or run.label == backend .. ",direct" then
+		return nil
+	end
+
+	return scenarios[backend .. ",direct/" .. run.scenario]
+end
+
+local base_scenarios, base_benches = load_runs(baseline_file)
+local scenarios, benches = load_runs(results_file)
+local regressions = 0
+
+if not scenarios then
+	io.stderr:write(("%s: can't open %s\n"):format(arg[0], results_file))
+	os.exit(1)
+end
+
+if not base_scenarios then
+	print(("no baseline in %s, record it with PERF_UPDATE_BASELINE=1"):format(baseline_file))
+	base_scenarios, base_benches = {}, {}
+end
+
+local function report(name, what, base, now, is_regression)
+	if is_regression then
+		regressions = regressions + 1
+	end
+
+	print(("%-10s %-50s %-12s %10.3f -> %10.3f"):format(
+		is_regression and "REGRESSION" or "ok",
+		name, what, base, now))
+end
+
+local names = {}
+for name in pairs(scenarios) do
+	names[#names + 1] = name
+end
+table.sort(names)
+
+for _, name in ipairs(names) do
+	local run = scenarios[name]
+	local ref = get_reference(scenarios, run)
+	local base = base_scenarios[name]
+	local base_ref = base and get_reference(base_scenarios, base)
+
+	if run.errors and run.errors > 0 then
+		report(name, "errors", 0, run.errors, true)
+	end
+
+	if not ref then
+		-- a direct run, the yardstick of the others
+	elseif not (base and base_ref) then
+		print(("%-10s %s"):format("new", name))
+	elseif ref.qps > 0 and base_ref.qps > 0 and ref.p99 > 0 and base_ref.p99 > 0 then
+		local qps_ratio      = run.qps / ref.qps
+		local base_qps_ratio = base.qps / base_ref.qps
+		local p99_ratio      = run.p99 / ref.p99
+		local base_p99_ratio = base.p99 / base_ref.p99
+
+		report(name, "qps/direct", base_qps_ratio, qps_ratio,
+			qps_ratio < base_qps_ratio * (1 - qps_tolerance))
+		report(name, "p99/direct", base_p99_ratio, p99_ratio,
+			p99_ratio > base_p99_ratio * (1 + p99_tolerance))
+	end
+end
+
+names = {}
+for name in pairs(benches) do
+	names[#names + 1] = name
+end
+table.sort(names)
+
+for _, name in ipairs(names) do
+	local run = benches[name]
+	local base = base_benches[name]
+
+	if not (base and base.allocs_per_op) then
+		print(("%-10s %s"):format("new", name))
+	elseif run.allocs_per_op then
+		-- +0.5 to let a bench that didn't allocate start with a allocation now and then
+		report(name, "allocs/op", base.allocs_per_op, run.allocs_per_op,
+			run.allocs_per_op > base.allocs_per_op * (1 + alloc_tolerance) + 0.5)
+	end
+end
+
+if regressions > 0 then
+	print(("%d regressions"):format(regressions))
+	os.exit(1)
+end
@@ -0,0 +1,184 @@
+#!/bin/sh
+#  $%BEGINLICENSE%$
+#  Copyright (c) 2012, 2014, Oracle and/or its affiliates. All rights reserved.
+#
+#  This program is free software; you can redistribute it and/or
+#  modify it under the terms of the GNU General Public License as
+#  published by the Free Software Foundation; version 2 of the
+#  License.
+#
+#  This program is distributed in the hope that it will be useful,
+#  but WITHOUT ANY WARRANTY; without even the implied warranty of
+#  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+#  GNU General Public License for more details.
+#
+#  You should have received a copy of the GNU General Public License
+#  along with this program; if not, write to the Free Software
+#  Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA
+#  02110-1301  USA
+#
+#  $%ENDLICENSE%$
+
+## the performance regression suite: run the benchmarks and compare them to the baseline
+##
+## - proxy-bench against the mock plugin, directly and through mysql-proxy
+## - proxy-bench against a MySQL server, directly and through mysql-proxy, if BACKEND_PORT is set
+## - proxy-microbench for the allocations/op of the codecs
+##
+## the mock backend doesn't need a MySQL server, its results only depend on the proxy.
+## proxy-perf-compare.lua compares the runs to proxy-perf-baseline.json and exits
+## non-zero on a regression:
+##
+##   ./proxy-perf.sh                          # run and compare
+##   PERF_UPDATE_BASELINE=1 ./proxy-perf.sh   # run and record the new baseline
+##
+## the settings are taken from the environment like in proxy-bench.sh
+##
+## PERF_LOW_LATENCY_OPTIONS adds a run of each proxy with these options, e.g.
+## "--tcp-busy-poll=50 --event-threads-spin=50"
+
+MYSQL_PROXY=${MYSQL_PROXY:-../src/mysql-proxy}
+PROXY_BENCH=${PROXY_BENCH:-./proxy-bench}
+PROXY_MICROBENCH=${PROXY_MICROBENCH:-./proxy-microbench}
+PROXY_PLUGIN_DIR=${PROXY_PLUGIN_DIR:-}
+LUA=${LUA:-lua}
+BACKEND_HOST=${BACKEND_HOST:-127.0.0.1}
+BACKEND_PORT=${BACKEND_PORT:-}
+BENCH_USER=${BENCH_USER:-root}
+BENCH_PASSWORD=${BENCH_PASSWORD:-}
+MOCK_PORT=${MOCK_PORT:-14044}
+PROXY_PORT=${PROXY_PORT:-14040}
+EVENT_THREADS=${EVENT_THREADS:-"1 4"}
+BENCH_THREADS=${BENCH_THREADS:-8}
+PERF_RESULTS=${PERF_RESULTS:-proxy-perf-results.json}
+PERF_LOW_LATENCY_OPTIONS=${PERF_LOW_LATENCY_OPTIONS:-}
+srcdir=${srcdir:-`dirname $0`}
+PERF_BASELINE=${PERF_BASELINE:-$srcdir/proxy-perf-baseline.json}
+
+## the mock backend only answers COM_QUERY, the other scenarios need a MySQL server
+MOCK_SCENARIOS="point-select,connect-churn"
+
+bench() {
+	label=$1
+	port=$2
+	scenarios=$3
+
+	$PROXY_BENCH \
+		--hostname="$BACKEND_HOST" \
+		--port="$port" \
+		--username="$BENCH_USER" \
+		--password="$BENCH_PASSWORD" \
+		--threads="$BENCH_THREADS" \
+		${scenarios:+--scenarios="$scenarios"} \
+		--label="$label" >> "$PERF_RESULTS"
+}
+
+## wait until something answers on the port
+wait_for_port() {
+	port=$1
+
+	i=0
+	while ! $PROXY_BENCH --hostname="$BACKEND_HOST" --port="$port" \
+			--username="$BENCH_USER" --password="$BENCH_PASSWORD" \
+			--scenarios=point-select --threads=1 --ops=1 --warmup=0 > /dev/null 2>&1; do
+		i=`expr $i + 1`
+		if [ $i -gt 50 ]; then
+			return 1
+		fi
+		sleep 0.1
+	done
+
+	return 0
+}
+
+## start a mysql-proxy with the options, its pid goes to $started_pid
+start_proxy() {
+	port=$1
+	shift
+
+	$MYSQL_PROXY \
+		${PROXY_PLUGIN_DIR:+--plugin-dir="$PROXY_PLUGIN_DIR"} \
+		"$@" &
+	started_pid=$!
+
+	if ! wait_for_port "$port"; then
+		echo "$0: mysql-proxy $* didn't start" >&2
+		kill $started_pid
+		stop_all
+		exit 1
+	fi
+}
+
+stop_proxy() {
+	kill $1
+	wait $1 2> /dev/null
+}
+
+stop_all() {
+	if [ -n "$mock_pid" ]; then
+		stop_proxy $mock_pid
+	fi
+}
+
+## the proxy in front of a backend with each of the event-thread counts
+bench_proxy() {
+	backend=$1
+	backend_port=$2
+	scenarios=$3
+
+	for n in $EVENT_THREADS; do
+		start_proxy "$PROXY_PORT" \
+			--plugins=proxy \
+			--event-threads="$n" \
+			--proxy-address="$BACKEND_HOST:$PROXY_PORT" \
+			--proxy-backend-addresses="$BACKEND_HOST:$backend_port"
+
+		bench "$backend,proxy,event-threads=$n" "$PROXY_PORT" "$scenarios"
+
+		stop_proxy $started_pid
+
+		if [ -n "$PERF_LOW_LATENCY_OPTIONS" ]; then
+			start_proxy "$PROXY_PORT" \
+				--plugins=proxy \
+				--event-threads="$n" \
+				--proxy-address="$BACKEND_HOST:$PROXY_PORT" \
+				--proxy-backend-addresses="$BACKEND_HOST:$backend_port" \
+				$PERF_LOW_LATENCY_OPTIONS
+
+			bench "$backend,proxy,event-threads=$n,low-latency" "$PROXY_PORT" "$scenarios"
+
+			stop_proxy $started_pid
+		fi
+	done
+}
+
+: > "$PERF_RESULTS"
+
+start_proxy "$MOCK_PORT" \
+	--plugins=mock \
+	--mock-address="$BACKEND_HOST:$MOCK_PORT"
+mock_pid=$started_pid
+
+bench "mock,direct" "$MOCK_PORT" "$MOCK_SCENARIOS"
+bench_proxy "mock" "$MOCK_PORT" "$MOCK_SCENARIOS"
+
+stop_all
+mock_pid=
+
+if [ -n "$BACKEND_PORT" ]; then
+	bench "mysql,direct" "$BACKEND_PORT" ""
+	bench_proxy "mysql" "$BACKEND_PORT" ""
+fi
+
+$PROXY_MICROBENCH >> "$PERF_RESULTS"
+
+if [ -n "$PERF_UPDATE_BASELINE" ]; then
+	{
+		echo "# recorded by proxy-perf.sh on `uname -n`, `date`"
+		cat "$PERF_RESULTS"
+	} > "$PERF_BASELINE"
+	echo "$0: recorded the baseline in $PERF_BASELINE"
+	exit 0
+fi
+
+exec $LUA "$srcdir/proxy-perf-compare.lua" "$PERF_BASELINE" "$PERF_RESULTS"
@@ -250,7 +250,45 @@ test_log_set_log_func(void) {
 	chassis_log_free(log);
 }
 
+/**
+ * @test the messages are written by the log-writer and flushed when it stops
+ */
+static void
+test_log_writer(void) {
+	chassis_log *l;
+	GLogFunc old_log_func;
+	int i;
+
+	l = chassis_log_new();
+
+	g_log_set_always_fatal(G_LOG_FATAL_MASK);
+	old_log_func = g_log_set_default_handler(chassis_log_func, l);
+
+	g_assert_cmpint(0, ==, chassis_log_start_writer(l));
+	g_assert(NULL != l->ring);
+
+	for (i = 0; i < 10; i++) {
+		g_critical("queued message %d", i);
+	}
+
+	chassis_log_stop_writer(l);
+	g_assert(NULL == l->ring);
+
+	/* the last message was written by the writer before it stopped */
+	g_assert_cmpstr("queued message 9", ==, l->last_msg->str);
+
+	/* without a writer we log synchronously again */
+	g_critical("synchronous message");
+	g_assert_cmpstr("synchronous message", ==, l->last_msg->str);
+
+	g_log_set_default_handler(old_log_func, NULL);
+
+	chassis_log_free(l);
+}
+
 int main(int argc, char **argv) {
+	g_thread_init(NULL);
+
 	g_test_init(&argc, &argv, NULL);
 	g_test_bug_base("http://bugs.mysql.com/");
 
@@ -258,6 +296,7 @@ int main(int argc, char **argv) {
 	g_test_add_func("/core/log_timestamp", test_log_timestamp);
 	g_test_add_func("/core/log_strip_absfilename", test_log_skip_topsrcdir);
 	g_test_add_func("/core/log_set_log_func", test_log_set_log_func);
+	g_test_add_func("/core/log_writer", test_log_writer);
 
 	return g_test_run();
 }
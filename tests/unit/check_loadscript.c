@@ -48,6 +48,7 @@
 
 #include "lua-scope.h"
 #include "lua-load-factory.h"
+#include "lua-profiler.h"
 
 #if GLIB_CHECK_VERSION(2, 16, 0)
 #define C(x) x, sizeof(x) - 1
@@ -124,6 +125,172 @@ START_TEST(test_luaL_loadfile_factory_errors) {
 #endif
 } END_TEST
 
+/**
+ * @test the memory of a lua-state is accounted and limited
+ */
+START_TEST(test_lua_scope_mem_limit) {
+#ifdef HAVE_LUA_H
+	lua_scope *sc = lua_scope_new();
+	gint64 base;
+
+	base = sc->mem.bytes;
+	g_assert_cmpint(base, >, 0);
+	g_assert_cmpint(sc->mem.bytes_max, >=, base);
+
+	/* a allocation beyond the limit fails with a error in Lua */
+	lua_scope_set_mem_limit(sc, base + 64 * 1024);
+	g_assert_cmpint(0, ==, luaL_loadstring(sc->L, "local s = string.rep('x', 1024 * 1024)"));
+	g_assert_cmpint(LUA_ERRMEM, ==, lua_pcall(sc->L, 0, 0, 0));
+	lua_pop(sc->L, 1);
+
+	/* ... and small ones still work */
+	g_assert_cmpint(0, ==, luaL_loadstring(sc->L, "local s = string.rep('x', 16)"));
+	g_assert_cmpint(0, ==, lua_pcall(sc->L, 0, 0, 0));
+
+	g_assert_cmpint(sc->mem.bytes, <=, base + 64 * 1024);
+
+	lua_scope_free(sc);
+#endif
+} END_TEST
+
+/**
+ * @test the allocations of a hook are counted into the account of the connection and
+ *   the freed small blocks are cached
+ */
+START_TEST(test_lua_scope_mem_account) {
+#ifdef HAVE_LUA_H
+	lua_scope *sc;
+	lua_scope_mem_account_t account;
+
+	lua_scope_set_alloc_cache(TRUE);
+	sc = lua_scope_new();
+	memset(&account, 0, sizeof(account));
+
+	lua_scope_set_mem_account(sc, &account);
+	g_assert_cmpint(0, ==, luaL_loadstring(sc->L, "local t = { } for i = 1, 100 do t[i] = { i } end"));
+	g_assert_cmpint(0, ==, lua_pcall(sc->L, 0, 0, 0));
+	lua_gc(sc->L, LUA_GCCOLLECT, 0);
+	lua_scope_set_mem_account(sc, NULL);
+
+	g_assert_cmpint(account.allocs, >=, 100);
+	g_assert_cmpint(account.alloc_bytes, >, 0);
+	g_assert_cmpint(account.call_bytes_max, ==, account.call_bytes);
+	g_assert_cmpint(sc->mem.cached_bytes, >, 0);
+
+	/* the counting stops without a account */
+	g_assert_cmpint(0, ==, luaL_loadstring(sc->L, "local s = string.rep('x', 1024)"));
+	g_assert_cmpint(0, ==, lua_pcall(sc->L, 0, 0, 0));
+	g_assert_cmpint(account.call_bytes, ==, account.call_bytes_max);
+
+	/* a hook beyond its limit fails */
+	account.call_bytes_limit = 16 * 1024;
+	lua_scope_set_mem_account(sc, &account);
+	g_assert_cmpint(0, ==, luaL_loadstring(sc->L, "local s = string.rep('x', 1024 * 1024)"));
+	g_assert_cmpint(LUA_ERRMEM, ==, lua_pcall(sc->L, 0, 0, 0));
+	lua_pop(sc->L, 1);
+	lua_scope_set_mem_account(sc, NULL);
+
+	lua_scope_free(sc);
+	lua_scope_set_alloc_cache(FALSE);
+#endif
+} END_TEST
+
+/**
+ * @test the profiler samples the stacks of a attached lua-state
+ */
+START_TEST(test_lua_profiler) {
+#ifdef HAVE_LUA_H
+	lua_scope *sc = lua_scope_new();
+	GString *folded;
+
+	/* not attached while the profiler is stopped */
+	lua_profiler_attach(sc->L);
+	g_assert(NULL == lua_gethook(sc->L));
+
+	lua_profiler_reset();
+	lua_profiler_start(100);
+	lua_profiler_attach(sc->L);
+	g_assert(NULL != lua_gethook(sc->L));
+
+	g_assert_cmpint(0, ==, luaL_loadstring(sc->L,
+				"function busy() local n = 0 for i = 1, 100000 do n = n + i end return n end\n"
+				"busy()"));
+	g_assert_cmpint(0, ==, lua_pcall(sc->L, 0, 0, 0));
+
+	folded = lua_profiler_get_folded();
+	g_assert(NULL != strstr(folded->str, ":main:"));
+	g_assert(NULL != strstr(folded->str, ":busy:1 "));
+	g_string_free(folded, TRUE);
+
+	/* the hook removes itself once the profiler is stopped */
+	lua_profiler_stop();
+	g_assert_cmpint(0, ==, luaL_loadstring(sc->L, "busy()"));
+	g_assert_cmpint(0, ==, lua_pcall(sc->L, 0, 0, 0));
+	g_assert(NULL == lua_gethook(sc->L));
+
+	lua_profiler_reset();
+	folded = lua_profiler_get_folded();
+	g_assert_cmpint(folded->len, ==, 0);
+	g_string_free(folded, TRUE);
+
+	lua_scope_free(sc);
+#endif
+} END_TEST
+
+/**
+ * @test the second lua-scope loads the bytecode of the first one
+ */
+START_TEST(test_lua_scope_chunks) {
+#ifdef HAVE_LUA_H
+	lua_scope *sc1 = lua_scope_new();
+	lua_scope *sc2 = lua_scope_new();
+	lua_scope *sc3 = lua_scope_new();
+	guint compiled, loaded, base_compiled, base_loaded;
+	gchar *tmp_file;
+	int fd;
+
+	fd = g_file_open_tmp("TestFile-XXXXXX", &tmp_file, NULL);
+	g_assert_cmpint(fd, >=, 0);
+	g_assert_cmpint(14, ==, write(fd, C("return 40 + 2\n")));
+	close(fd);
+
+	lua_scope_chunks_get_stats(&base_compiled, &base_loaded);
+
+	/* the factory returns the script, the script returns 42 */
+	lua_scope_load_script(sc1, tmp_file);
+	g_assert(lua_isfunction(sc1->L, -1));
+	g_assert_cmpint(0, ==, lua_pcall(sc1->L, 0, 1, 0));
+	g_assert_cmpint(42, ==, lua_tointeger(sc1->L, -1));
+	lua_pop(sc1->L, 1);
+
+	lua_scope_load_script(sc2, tmp_file);
+	g_assert(lua_isfunction(sc2->L, -1));
+	g_assert_cmpint(0, ==, lua_pcall(sc2->L, 0, 1, 0));
+	g_assert_cmpint(42, ==, lua_tointeger(sc2->L, -1));
+	lua_pop(sc2->L, 1);
+
+	lua_scope_chunks_get_stats(&compiled, &loaded);
+	g_assert_cmpint(compiled - base_compiled, ==, 1);
+	g_assert_cmpint(loaded - base_loaded, ==, 1);
+
+	/* a reload compiles the script again */
+	lua_scope_scripts_reload();
+	lua_scope_load_script(sc3, tmp_file);
+	g_assert(lua_isfunction(sc3->L, -1));
+	lua_pop(sc3->L, 1);
+
+	lua_scope_chunks_get_stats(&compiled, &loaded);
+	g_assert_cmpint(compiled - base_compiled, ==, 2);
+	g_assert_cmpint(loaded - base_loaded, ==, 1);
+
+	g_unlink(tmp_file);
+	g_free(tmp_file);
+
+	lua_scope_free(sc1);
+	lua_scope_free(sc2);
+	lua_scope_free(sc3);
+#endif
+} END_TEST
 
 /*@}*/
 
@@ -137,6 +304,10 @@ int main(int argc, char **argv) {
 
 	g_test_add_func("/core/lua-load-factory", test_luaL_loadfile_factory);
 	g_test_add_func("/core/lua-loadfile-factory-dir", test_luaL_loadfile_factory_errors);
+	g_test_add_func("/core/lua-scope-mem-limit", test_lua_scope_mem_limit);
+	g_test_add_func("/core/lua-scope-mem-account", test_lua_scope_mem_account);
+	g_test_add_func("/core/lua-profiler", test_lua_profiler);
+	g_test_add_func("/core/lua-scope-chunks", test_lua_scope_chunks);
 
 	return g_test_run();
 }
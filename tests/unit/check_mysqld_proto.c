@@ -22,11 +22,14 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <unistd.h> /* close() */
 
 #include <glib.h>
+#include <glib/gstdio.h> /* g_unlink() */
 
 #include "network-mysqld-proto.h"
 #include "network-mysqld-binlog.h"
+#include "network-mysqld-crc32.h"
 #include "glib-ext.h"
 
 #if GLIB_CHECK_VERSION(2, 16, 0)
@@ -207,6 +210,163 @@ void test_mysqld_proto_int(void) {
 
 	g_string_free(packet.data, TRUE);
 }
+
+/**
+ * @test network_mysqld_proto_get_lenenc_int() with 8 byte values and short packets
+ */
+void test_mysqld_proto_lenenc_int_bounds(void) {
+	guint64 value;
+	network_packet packet;
+
+	packet.data = g_string_new(NULL);
+
+	/* all bits set, the high bytes must not be sign-extended */
+	packet.offset = 0;
+	g_string_assign_len(packet.data, C("\xfe\xff\xff\xff\xff\xff\xff\xff\xff"));
+	g_assert_cmpint(0, ==, network_mysqld_proto_get_lenenc_int(&packet, &value));
+	g_assert_cmpint(packet.offset, ==, 9);
+	g_assert_cmpuint(G_MAXUINT64, ==, value);
+
+	packet.offset = 0;
+	g_string_assign_len(packet.data, C("\xfe\x01\x02\x03\x04\x85\x06\x07\x08"));
+	g_assert_cmpint(0, ==, network_mysqld_proto_get_lenenc_int(&packet, &value));
+	g_assert_cmpuint(G_GUINT64_CONSTANT(0x0807068504030201), ==, value);
+
+	/* one byte short */
+	packet.offset = 0;
+	g_string_assign_len(packet.data, C("\xfe\x01\x02\x03\x04\x05\x06\x07"));
+	g_assert_cmpint(0, !=, network_mysqld_proto_get_lenenc_int(&packet, &value));
+	g_assert_cmpint(packet.offset, ==, 0);
+
+	packet.offset = 0;
+	g_string_assign_len(packet.data, C("\xfd\x01\x02"));
+	g_assert_cmpint(0, !=, network_mysqld_proto_get_lenenc_int(&packet, &value));
+
+	packet.offset = 0;
+	g_string_assign_len(packet.data, C("\xfc\x01"));
+	g_assert_cmpint(0, !=, network_mysqld_proto_get_lenenc_int(&packet, &value));
+
+	/* fixed-length ints at the end of the packet */
+	packet.offset = 1;
+	g_string_assign_len(packet.data, C("\x00\x01\x02\x03"));
+	g_assert_cmpint(0, ==, network_mysqld_proto_get_int_len(&packet, &value, 3));
+	g_assert_cmpint(0x030201, ==, value);
+	g_assert_cmpint(0, !=, network_mysqld_proto_get_int_len(&packet, &value, 1));
+
+	g_string_free(packet.data, TRUE);
+}
+
+/**
+ * the byte-by-byte decoder we had before, as reference for the benchmark
+ */
+static int ref_get_lenenc_int(network_packet *packet, guint64 *v) {
+	guint off = packet->offset;
+	guint64 ret = 0;
+	unsigned char *bytestream = (unsigned char *)packet->data->str;
+	int i, size;
+
+	if (off >= packet->data->len) return -1;
+
+	if (bytestream[off] < 251) {
+		size = 0;
+		ret = bytestream[off];
+	} else if (bytestream[off] == 252) {
+		size = 2;
+	} else if (bytestream[off] == 253) {
+		size = 3;
+	} else if (bytestream[off] == 254) {
+		size = 8;
+	} else {
+		return -1;
+	}
+
+	for (i = 0; i < size; i++) {
+		if (off + 1 + i >= packet->data->len) return -1;
+
+		ret |= (guint64)bytestream[off + 1 + i] << (i * 8);
+	}
+
+	packet->offset = off + 1 + size;
+	*v = ret;
+
+	return 0;
+}
+
+static int ref_get_int_len(network_packet *packet, guint64 *v, gsize size) {
+	gsize i;
+	guint64 ret = 0;
+
+	for (i = 0; i < size; i++) {
+		if (packet->offset + i >= packet->data->len) return -1;
+
+		ret |= (guint64)(guchar)packet->data->str[packet->offset + i] << (i * 8);
+	}
+
+	packet->offset += size;
+	*v = ret;
+
+	return 0;
+}
+
+/**
+ * @test the integer decoders against the byte-by-byte ones
+ *
+ * decodes a field-def like mix of ints, run with -m perf to see the timings
+ */
+void test_mysqld_proto_int_decode_perf(void) {
+	network_packet packet;
+	guint64 value, sum_ref = 0, sum = 0;
+	gdouble t_ref, t_new;
+	guint i, round, rounds = g_test_perf() ? 2000 : 2;
+
+	packet.data = g_string_new(NULL);
+
+	for (i = 0; i < 1000; i++) {
+		network_mysqld_proto_append_lenenc_int(packet.data, i);
+		network_mysqld_proto_append_lenenc_int(packet.data, i * 1000);
+		network_mysqld_proto_append_int16(packet.data, i);
+		network_mysqld_proto_append_int32(packet.data, i * 100000);
+		network_mysqld_proto_append_int64(packet.data, i);
+	}
+
+	g_test_timer_start();
+	for (round = 0; round < rounds; round++) {
+		packet.offset = 0;
+		while (packet.offset < packet.data->len) {
+			g_assert_cmpint(0, ==, ref_get_lenenc_int(&packet, &value)); sum_ref += value;
+			g_assert_cmpint(0, ==, ref_get_lenenc_int(&packet, &value)); sum_ref += value;
+			g_assert_cmpint(0, ==, ref_get_int_len(&packet, &value, 2)); sum_ref += value;
+			g_assert_cmpint(0, ==, ref_get_int_len(&packet, &value, 4)); sum_ref += value;
+			g_assert_cmpint(0, ==, ref_get_int_len(&packet, &value, 8)); sum_ref += value;
+		}
+	}
+	t_ref = g_test_timer_elapsed();
+
+	g_test_timer_start();
+	for (round = 0; round < rounds; round++) {
+		packet.offset = 0;
+		while (packet.offset < packet.data->len) {
+			guint16 v16;
+			guint32 v32;
+
+			g_assert_cmpint(0, ==, network_mysqld_proto_get_lenenc_int(&packet, &value)); sum += value;
+			g_assert_cmpint(0, ==, network_mysqld_proto_get_lenenc_int(&packet, &value)); sum += value;
+			g_assert_cmpint(0, ==, network_mysqld_proto_get_int16(&packet, &v16)); sum += v16;
+			g_assert_cmpint(0, ==, network_mysqld_proto_get_int32(&packet, &v32)); sum += v32;
+			g_assert_cmpint(0, ==, network_mysqld_proto_get_int64(&packet, &value)); sum += value;
+		}
+	}
+	t_new = g_test_timer_elapsed();
+
+	g_assert_cmpuint(sum_ref, ==, sum);
+
+	if (g_test_perf()) {
+		g_test_minimized_result(t_new, "decoding %u rounds took %.3f secs (%.3f secs byte by byte, %.2fx)",
+				rounds, t_new, t_ref, t_new > 0 ? t_ref / t_new : 0.0);
+	}
+
+	g_string_free(packet.data, TRUE);
+}
 /*@}*/
 
 void test_mysqld_binlog_events(void) {
@@ -344,6 +504,406 @@ void test_mysqld_binlog_events(void) {
 	network_mysqld_binlog_free(binlog);
 }
 
+/**
+ * an unchanged TABLE_MAP reuses the decoded table, a changed one replaces it
+ */
+void test_mysqld_binlog_table_map_cache(void) {
+	network_mysqld_binlog *binlog;
+	network_mysqld_binlog_event *event;
+	network_mysqld_table *tbl, *cached_tbl;
+
+	binlog = network_mysqld_binlog_new();
+
+	event = network_mysqld_binlog_event_new();
+	event->event_type = TABLE_MAP_EVENT;
+	event->event.table_map_event.table_id = 42;
+	event->event.table_map_event.db_name = g_strdup("test");
+	event->event.table_map_event.db_name_len = 4;
+	event->event.table_map_event.table_name = g_strdup("t1");
+	event->event.table_map_event.table_name_len = 2;
+	event->event.table_map_event.columns = g_strdup("\3"); /* INT */
+	event->event.table_map_event.columns_len = 1;
+	event->event.table_map_event.metadata = g_strdup("");
+	event->event.table_map_event.metadata_len = 0;
+	event->event.table_map_event.null_bits = g_strdup("\1");
+	event->event.table_map_event.null_bits_len = 1;
+
+	g_assert(NULL == network_mysqld_binlog_get_table(binlog, 42));
+	g_assert(FALSE == network_mysqld_binlog_table_map_is_cached(binlog, event));
+
+	tbl = network_mysqld_binlog_table_map_get(binlog, event);
+	g_assert(tbl != NULL);
+	g_assert_cmpint(tbl->table_id, ==, 42);
+	g_assert_cmpstr(tbl->table_name->str, ==, "t1");
+	g_assert_cmpint(tbl->fields->len, ==, 1);
+	g_assert(tbl == network_mysqld_binlog_get_table(binlog, 42));
+
+	/* same TABLE_MAP again */
+	g_assert(TRUE == network_mysqld_binlog_table_map_is_cached(binlog, event));
+	cached_tbl = network_mysqld_binlog_table_map_get(binlog, event);
+	g_assert(cached_tbl == tbl);
+
+	/* the table was altered, the table-id is reused */
+	g_free(event->event.table_map_event.columns);
+	event->event.table_map_event.columns = g_strdup("\10"); /* BIGINT */
+
+	g_assert(FALSE == network_mysqld_binlog_table_map_is_cached(binlog, event));
+	tbl = network_mysqld_binlog_table_map_get(binlog, event);
+	g_assert(tbl != NULL);
+	g_assert(tbl == network_mysqld_binlog_get_table(binlog, 42));
+	g_assert_cmpint(g_hash_table_size(binlog->rbr_tables), ==, 1);
+
+	network_mysqld_binlog_event_free(event);
+	network_mysqld_binlog_free(binlog);
+}
+
+/**
+ * the filter drops TABLE_MAPs and row-events of unwanted tables by their table-id
+ */
+void test_mysqld_binlog_filter(void) {
+	const char table_map_t1[] =
+		"\x2a\0\0\0\0\0" /* table-id 42 */
+		"\0\0"           /* flags */
+		"\4" "test\0"     /* db */
+		"\2" "t1\0";      /* table */
+	const char table_map_t2[] =
+		"\x2b\0\0\0\0\0" /* table-id 43 */
+		"\0\0"           /* flags */
+		"\4" "test\0"     /* db */
+		"\2" "t2\0";      /* table */
+	const char rows_t1[] = "\x2a\0\0\0\0\0";
+	const char rows_t2[] = "\x2b\0\0\0\0\0";
+	const char rows_t3[] = "\x2c\0\0\0\0\0"; /* no TABLE_MAP seen */
+
+	network_mysqld_binlog_filter *filter;
+	network_mysqld_binlog_event *event;
+	network_packet packet;
+	GString s;
+
+	packet.data = &s;
+
+	filter = network_mysqld_binlog_filter_new();
+	network_mysqld_binlog_filter_add_table(filter, "test.t1");
+
+	event = network_mysqld_binlog_event_new();
+
+	event->event_type = TABLE_MAP_EVENT;
+	s.str = (char *)table_map_t1; s.len = sizeof(table_map_t1) - 1; packet.offset = 0;
+	g_assert(FALSE == network_mysqld_binlog_filter_skip_event(filter, &packet, event));
+	g_assert_cmpint(packet.offset, ==, 0);
+
+	s.str = (char *)table_map_t2; s.len = sizeof(table_map_t2) - 1; packet.offset = 0;
+	g_assert(TRUE == network_mysqld_binlog_filter_skip_event(filter, &packet, event));
+
+	event->event_type = WRITE_ROWS_EVENT;
+	s.str = (char *)rows_t1; s.len = sizeof(rows_t1) - 1; packet.offset = 0;
+	g_assert(FALSE == network_mysqld_binlog_filter_skip_event(filter, &packet, event));
+
+	s.str = (char *)rows_t2; s.len = sizeof(rows_t2) - 1; packet.offset = 0;
+	g_assert(TRUE == network_mysqld_binlog_filter_skip_event(filter, &packet, event));
+
+	s.str = (char *)rows_t3; s.len = sizeof(rows_t3) - 1; packet.offset = 0;
+	g_assert(FALSE == network_mysqld_binlog_filter_skip_event(filter, &packet, event));
+
+	/* only the INSERTs */
+	network_mysqld_binlog_filter_add_event_type(filter, WRITE_ROWS_EVENT);
+
+	event->event_type = DELETE_ROWS_EVENT;
+	s.str = (char *)rows_t1; s.len = sizeof(rows_t1) - 1; packet.offset = 0;
+	g_assert(TRUE == network_mysqld_binlog_filter_skip_event(filter, &packet, event));
+
+	event->event_type = FORMAT_DESCRIPTION_EVENT;
+	g_assert(FALSE == network_mysqld_binlog_filter_skip_event(filter, &packet, event));
+
+	event->event_type = UNKNOWN_EVENT; /* nothing to free */
+	network_mysqld_binlog_event_free(event);
+	network_mysqld_binlog_filter_free(filter);
+}
+
+/**
+ * append a event with only a header and one byte of body
+ */
+static void binlog_append_event(GString *binlog, guint32 timestamp) {
+	guint32 event_size = NETWORK_MYSQLD_BINLOG_EVENT_HEADER_LEN + 1;
+
+	network_mysqld_proto_append_int32(binlog, timestamp);
+	network_mysqld_proto_append_int8(binlog, QUERY_EVENT);
+	network_mysqld_proto_append_int32(binlog, 1); /* server-id */
+	network_mysqld_proto_append_int32(binlog, event_size);
+	network_mysqld_proto_append_int32(binlog, binlog->len - 13 + event_size); /* log-pos */
+	network_mysqld_proto_append_int16(binlog, 0); /* flags */
+	g_string_append_c(binlog, '\0');
+}
+
+void test_mysqld_binlog_index(void) {
+	network_mysqld_binlog_index *index;
+	network_mysqld_binlog_file file;
+	GString *binlog;
+	GError *gerr = NULL;
+	gchar *index_filename;
+	int fd;
+
+	binlog = g_string_new(NULL);
+	g_string_append_len(binlog, NETWORK_MYSQLD_BINLOG_HEADER, NETWORK_MYSQLD_BINLOG_HEADER_LEN);
+	binlog_append_event(binlog, 100); /* at 4 */
+	binlog_append_event(binlog, 101); /* at 24 */
+	binlog_append_event(binlog, 100); /* at 44, older than the event before */
+	binlog_append_event(binlog, 105); /* at 64 */
+	binlog_append_event(binlog, 110); /* at 84 */
+
+	memset(&file, 0, sizeof(file));
+	file.data = binlog->str;
+	file.len = binlog->len - 10; /* the last event is half-written */
+
+	index = network_mysqld_binlog_index_new(2);
+	g_assert_cmpint(0, ==, network_mysqld_binlog_index_update(index, &file));
+	g_assert_cmpint(index->entries->len, ==, 2);
+	g_assert_cmpint(index->indexed_len, ==, 84);
+
+	file.len = binlog->len;
+	g_assert_cmpint(0, ==, network_mysqld_binlog_index_update(index, &file));
+	g_assert_cmpint(index->entries->len, ==, 3);
+	g_assert_cmpint(index->indexed_len, ==, binlog->len);
+
+	g_assert_cmpint(g_array_index(index->entries, network_mysqld_binlog_index_entry, 1).offset, ==, 44);
+	g_assert_cmpint(g_array_index(index->entries, network_mysqld_binlog_index_entry, 1).timestamp, ==, 101);
+
+	g_assert_cmpint(network_mysqld_binlog_index_lookup_timestamp(index, 50), ==, 4);
+	g_assert_cmpint(network_mysqld_binlog_index_lookup_timestamp(index, 101), ==, 4);
+	g_assert_cmpint(network_mysqld_binlog_index_lookup_timestamp(index, 105), ==, 44);
+	g_assert_cmpint(network_mysqld_binlog_index_lookup_timestamp(index, 200), ==, 84);
+
+	g_assert_cmpint(network_mysqld_binlog_index_lookup_offset(index, 0), ==, 4);
+	g_assert_cmpint(network_mysqld_binlog_index_lookup_offset(index, 70), ==, 44);
+	g_assert_cmpint(network_mysqld_binlog_index_lookup_offset(index, 84), ==, 84);
+
+	/* save and load it again */
+	fd = g_file_open_tmp("check-binlog-index-XXXXXX", &index_filename, &gerr);
+	g_assert(fd >= 0);
+	close(fd);
+
+	g_assert_cmpint(0, ==, network_mysqld_binlog_index_save(index, index_filename, &gerr));
+	network_mysqld_binlog_index_free(index);
+
+	index = network_mysqld_binlog_index_new(1);
+	g_assert_cmpint(0, ==, network_mysqld_binlog_index_load(index, index_filename, &gerr));
+	g_assert_cmpint(index->interval, ==, 2);
+	g_assert_cmpint(index->entries->len, ==, 3);
+	g_assert_cmpint(index->indexed_len, ==, binlog->len);
+	g_assert_cmpint(network_mysqld_binlog_index_lookup_timestamp(index, 105), ==, 44);
+
+	/* not a index */
+	g_assert(g_file_set_contents(index_filename, "foo", -1, NULL));
+	g_assert_cmpint(-1, ==, network_mysqld_binlog_index_load(index, index_filename, &gerr));
+	g_assert(gerr != NULL);
+	g_clear_error(&gerr);
+
+	g_unlink(index_filename);
+	g_free(index_filename);
+
+	network_mysqld_binlog_index_free(index);
+	g_string_free(binlog, TRUE);
+}
+
+/**
+ * @test network_mysqld_binlog_file_open() maps the file and network_mysqld_binlog_file_get_event()
+ *   walks it, a truncated event or a broken event-size is reported
+ */
+void test_mysqld_binlog_file(void) {
+	network_mysqld_binlog_file *file;
+	network_packet packet;
+	GString *binlog;
+	GError *gerr = NULL;
+	gchar *filename;
+	guint32 timestamp;
+	int fd;
+
+	binlog = g_string_new(NULL);
+	g_string_append_len(binlog, NETWORK_MYSQLD_BINLOG_HEADER, NETWORK_MYSQLD_BINLOG_HEADER_LEN);
+	binlog_append_event(binlog, 100); /* at 4 */
+	binlog_append_event(binlog, 101); /* at 24 */
+	binlog_append_event(binlog, 102); /* at 44 */
+
+	fd = g_file_open_tmp("check-binlog-file-XXXXXX", &filename, &gerr);
+	g_assert(fd >= 0);
+	close(fd);
+
+	g_assert(g_file_set_contents(filename, S(binlog), NULL));
+
+	file = network_mysqld_binlog_file_open(filename, &gerr);
+	g_assert(file != NULL);
+	g_assert_cmpint(file->pos, ==, NETWORK_MYSQLD_BINLOG_HEADER_LEN);
+
+	for (timestamp = 100; timestamp <= 102; timestamp++) {
+		guint32 ts;
+
+		g_assert_cmpint(0, ==, network_mysqld_binlog_file_get_event(file, &packet));
+		g_assert_cmpint(packet.data->len, ==, NETWORK_MYSQLD_BINLOG_EVENT_HEADER_LEN + 1);
+		g_assert_cmpint(packet.offset, ==, 0);
+
+		/* a view into the mapping, not a copy */
+		g_assert(packet.data->str >= file->data && packet.data->str < file->data + file->len);
+
+		g_assert_cmpint(0, ==, network_mysqld_proto_get_int32(&packet, &ts));
+		g_assert_cmpint(ts, ==, timestamp);
+	}
+	g_assert_cmpint(1, ==, network_mysqld_binlog_file_get_event(file, &packet));
+
+	/* seek back to the 2nd event */
+	g_assert_cmpint(0, ==, network_mysqld_binlog_file_seek(file, 24));
+	g_assert_cmpint(0, ==, network_mysqld_binlog_file_get_event(file, &packet));
+	g_assert_cmpint(file->pos, ==, 44);
+	g_assert_cmpint(-1, ==, network_mysqld_binlog_file_seek(file, binlog->len + 1));
+
+	network_mysqld_binlog_file_free(file);
+
+	/* the last event is half-written: its header is complete, the body isn't */
+	g_assert(g_file_set_contents(filename, binlog->str, binlog->len - 1, NULL));
+
+	file = network_mysqld_binlog_file_open(filename, &gerr);
+	g_assert(file != NULL);
+	g_assert_cmpint(0, ==, network_mysqld_binlog_file_get_event(file, &packet));
+	g_assert_cmpint(0, ==, network_mysqld_binlog_file_get_event(file, &packet));
+	g_assert_cmpint(-1, ==, network_mysqld_binlog_file_get_event(file, &packet));
+	network_mysqld_binlog_file_free(file);
+
+	/* event-size smaller than the event-header */
+	binlog->str[24 + 9] = 1;
+	binlog->str[24 + 10] = 0;
+	binlog->str[24 + 11] = 0;
+	binlog->str[24 + 12] = 0;
+	g_assert(g_file_set_contents(filename, S(binlog), NULL));
+
+	file = network_mysqld_binlog_file_open(filename, &gerr);
+	g_assert(file != NULL);
+	g_assert_cmpint(0, ==, network_mysqld_binlog_file_get_event(file, &packet));
+	g_assert_cmpint(-1, ==, network_mysqld_binlog_file_get_event(file, &packet));
+	network_mysqld_binlog_file_free(file);
+
+	/* not a binlog */
+	g_assert(g_file_set_contents(filename, "foo", -1, NULL));
+	g_assert(NULL == network_mysqld_binlog_file_open(filename, &gerr));
+	g_assert(gerr != NULL);
+	g_clear_error(&gerr);
+
+	g_unlink(filename);
+	g_free(filename);
+
+	g_string_free(binlog, TRUE);
+}
+
+void test_mysqld_crc32(void) {
+	GString *data;
+	guint32 crc;
+	gsize i, len;
+
+	g_assert_cmphex(network_mysqld_crc32(0, C("123456789")), ==, 0xcbf43926);
+	g_assert_cmphex(network_mysqld_crc32(0, NULL, 0), ==, 0);
+
+	data = g_string_new(NULL);
+	for (i = 0; i < 1024; i++) {
+		g_string_append_c(data, (i * 7) ^ (i >> 3));
+	}
+
+	/* the fast paths have to match the tables for all the lengths and alignments, in one go and in pieces */
+	for (len = 0; len < 300; len++) {
+		for (i = 0; i < 8; i++) {
+			crc = network_mysqld_crc32_table(0, data->str + i, len);
+
+			g_assert_cmphex(network_mysqld_crc32(0, data->str + i, len), ==, crc);
+			g_assert_cmphex(network_mysqld_crc32(network_mysqld_crc32(0, data->str + i, len / 3), data->str + i + len / 3, len - len / 3), ==, crc);
+		}
+	}
+
+	g_string_free(data, TRUE);
+}
+
+void test_mysqld_crc32_perf(void) {
+	GString *data;
+	guint32 crc_ref = 0, crc = 0;
+	gdouble t_ref, t_new;
+	guint i, round, rounds = g_test_perf() ? 20000 : 2;
+
+	/* about the size of a row-event */
+	data = g_string_new(NULL);
+	for (i = 0; i < 8192; i++) {
+		g_string_append_c(data, i * 31);
+	}
+
+	g_test_timer_start();
+	for (round = 0; round < rounds; round++) {
+		crc_ref = network_mysqld_crc32_table(crc_ref, S(data));
+	}
+	t_ref = g_test_timer_elapsed();
+
+	g_test_timer_start();
+	for (round = 0; round < rounds; round++) {
+		crc = network_mysqld_crc32(crc, S(data));
+	}
+	t_new = g_test_timer_elapsed();
+
+	g_assert_cmphex(crc_ref, ==, crc);
+
+	if (g_test_perf()) {
+		g_test_minimized_result(t_new, "CRC32 (%s) of %u x %"G_GSIZE_FORMAT" bytes took %.3f secs (%.3f secs with slicing-by-8, %.2fx)",
+				network_mysqld_crc32_get_impl_name(),
+				rounds, data->len, t_new, t_ref, t_new > 0 ? t_ref / t_new : 0.0);
+	}
+
+	g_string_free(data, TRUE);
+}
+
+void test_mysqld_binlog_checksum(void) {
+	network_mysqld_binlog *binlog;
+	network_mysqld_binlog_event *event;
+	network_packet packet;
+
+	binlog = network_mysqld_binlog_new();
+	binlog->checksum = NETWORK_MYSQLD_BINLOG_CHECKSUM_CRC32;
+
+	packet.data = g_string_new(NULL);
+
+	/* a STOP_EVENT with a checksum */
+	network_mysqld_proto_append_int32(packet.data, 0);         /* timestamp */
+	network_mysqld_proto_append_int8(packet.data, STOP_EVENT);
+	network_mysqld_proto_append_int32(packet.data, 1);         /* server-id */
+	network_mysqld_proto_append_int32(packet.data, 19 + 4);    /* event-size */
+	network_mysqld_proto_append_int32(packet.data, 4 + 19 + 4); /* log-pos */
+	network_mysqld_proto_append_int16(packet.data, 0);         /* flags */
+	network_mysqld_binlog_event_append_checksum(packet.data, 0);
+
+	g_assert_cmpint(packet.data->len, ==, 19 + 4);
+	g_assert(TRUE == network_mysqld_binlog_event_checksum_is_valid(S(packet.data)));
+
+	event = network_mysqld_binlog_event_new();
+	packet.offset = 0;
+	g_assert_cmpint(0, ==, network_mysqld_proto_get_binlog_event_header(&packet, event));
+	g_assert_cmpint(0, ==, network_mysqld_proto_get_binlog_event(&packet, binlog, event));
+	network_mysqld_binlog_event_free(event);
+
+	/* flip a bit */
+	packet.data->str[5] ^= 0x10;
+	g_assert(FALSE == network_mysqld_binlog_event_checksum_is_valid(S(packet.data)));
+
+	event = network_mysqld_binlog_event_new();
+	packet.offset = 0;
+	g_assert_cmpint(0, ==, network_mysqld_proto_get_binlog_event_header(&packet, event));
+	g_assert_cmpint(0, !=, network_mysqld_proto_get_binlog_event(&packet, binlog, event));
+	network_mysqld_binlog_event_free(event);
+
+	/* ... unless we don't check */
+	binlog->verify_checksums = FALSE;
+
+	event = network_mysqld_binlog_event_new();
+	packet.offset = 0;
+	g_assert_cmpint(0, ==, network_mysqld_proto_get_binlog_event_header(&packet, event));
+	g_assert_cmpint(0, ==, network_mysqld_proto_get_binlog_event(&packet, binlog, event));
+	network_mysqld_binlog_event_free(event);
+
+	g_string_free(packet.data, TRUE);
+	network_mysqld_binlog_free(binlog);
+}
+
 void test_mysqld_proto_gstring_len(void) {
 	guint64 length;
 	network_packet packet;
@@ -440,6 +1000,28 @@ void test_mysqld_password(void) {
 	g_string_free(cleartext, TRUE);
 }
 
+/**
+ * the caching_sha2_password scramble
+ */
+void test_mysqld_password_sha256(void) {
+	GString *response = g_string_new(NULL);
+
+	g_assert_cmpint(0, ==, network_mysqld_proto_password_scramble_sha256(response,
+			C("01234567890123456789"),
+			C("123")));
+
+	g_assert_cmpint(TRUE, ==, g_memeq(S(response), C("\x16\x76\xd3\xef\x5b\x98\xcb\x00\x50\xf2\x0c\xbf\x96\x85\xda\x54\x62\xf8\x4f\x83\xf5\xe6\xdc\xa9\x2d\x8f\x3f\x0a\xb9\xaa\x3d\x1f")));
+
+	/* the trailing '\0' of auth-plugin-data-2 is ignored */
+	g_assert_cmpint(0, ==, network_mysqld_proto_password_scramble_sha256(response,
+			"01234567890123456789", 21,
+			C("123")));
+
+	g_assert_cmpint(TRUE, ==, g_memeq(S(response), C("\x16\x76\xd3\xef\x5b\x98\xcb\x00\x50\xf2\x0c\xbf\x96\x85\xda\x54\x62\xf8\x4f\x83\xf5\xe6\xdc\xa9\x2d\x8f\x3f\x0a\xb9\xaa\x3d\x1f")));
+
+	g_string_free(response, TRUE);
+}
+
 int main(int argc, char **argv) {
 	g_test_init(&argc, &argv, NULL);
 	g_test_bug_base("http://bugs.mysql.com/");
@@ -447,11 +1029,21 @@ int main(int argc, char **argv) {
 	g_test_add_func("/core/mysqld-proto-header", test_mysqld_proto_header);
 	g_test_add_func("/core/mysqld-proto-lenenc-int", test_mysqld_proto_lenenc_int);
 	g_test_add_func("/core/mysqld-proto-int", test_mysqld_proto_int);
+	g_test_add_func("/core/mysqld-proto-lenenc-int-bounds", test_mysqld_proto_lenenc_int_bounds);
+	g_test_add_func("/core/mysqld-proto-int-decode-perf", test_mysqld_proto_int_decode_perf);
 	g_test_add_func("/core/mysqld-proto-gstring-len", test_mysqld_proto_gstring_len);
 	g_test_add_func("/core/mysqld-proto-gstring", test_mysqld_proto_gstring);
 
 	g_test_add_func("/core/mysqld-proto-binlog-event", test_mysqld_binlog_events);
+	g_test_add_func("/core/mysqld-proto-binlog-table-map-cache", test_mysqld_binlog_table_map_cache);
+	g_test_add_func("/core/mysqld-proto-binlog-filter", test_mysqld_binlog_filter);
+	g_test_add_func("/core/mysqld-proto-binlog-index", test_mysqld_binlog_index);
+	g_test_add_func("/core/mysqld-proto-binlog-file", test_mysqld_binlog_file);
+	g_test_add_func("/core/mysqld-proto-binlog-checksum", test_mysqld_binlog_checksum);
+	g_test_add_func("/core/mysqld-proto-crc32", test_mysqld_crc32);
+	g_test_add_func("/core/mysqld-proto-crc32-perf", test_mysqld_crc32_perf);
 	g_test_add_func("/core/mysqld-proto-password", test_mysqld_password);
+	g_test_add_func("/core/mysqld-proto-password-sha256", test_mysqld_password_sha256);
 
 	return g_test_run();
 }
@@ -29,6 +29,7 @@
 
 #if GLIB_CHECK_VERSION(2, 16, 0)
 #define C(x) x, sizeof(x) - 1
+#define S(x) x->str, x->len
 
 #define START_TEST(x) void (x)(void)
 #define END_TEST
@@ -271,6 +272,51 @@ g_assert_cmpstr(token->text->str, ==, t_text);
 	
 } END_TEST
 
+/**
+ * long strings and comments are skipped in blocks, check the quotes and escapes at all offsets
+ */
+START_TEST(test_tokenizer_long_literals) {
+	gsize i;
+
+	for (i = 0; i < 40; i++) {
+		GPtrArray *tokens = sql_tokens_new();
+		GString *query = g_string_new("SELECT '");
+		GString *expected = g_string_new(NULL);
+		sql_token *token;
+
+		g_string_append_len(query, "0123456789012345678901234567890123456789", i);
+		g_string_append_len(expected, "0123456789012345678901234567890123456789", i);
+		g_string_append(query, "\\'x\"`''0123456789012345678901234567890123456789'");
+		g_string_append(expected, "\\'x\"`'0123456789012345678901234567890123456789");
+		g_string_append(query, " /* 0123456789012345678901234567890123456789 ** 0123456789 */ `");
+		g_string_append_len(query, "0123456789012345678901234567890123456789", i);
+		g_string_append(query, "` 'unterminated 0123456789012345678901234567890123456789");
+
+		g_assert_cmpint(0, ==, sql_tokenizer(tokens, query->str, query->len));
+		g_assert_cmpint(tokens->len, ==, 5);
+
+		token = tokens->pdata[1];
+		g_assert_cmpint(token->token_id, ==, TK_STRING);
+		g_assert_cmpstr(token->text->str, ==, expected->str);
+
+		token = tokens->pdata[2];
+		g_assert_cmpint(token->token_id, ==, TK_COMMENT);
+		g_assert_cmpstr(token->text->str, ==, " 0123456789012345678901234567890123456789 ** 0123456789 ");
+
+		token = tokens->pdata[3];
+		g_assert_cmpint(token->token_id, ==, TK_LITERAL);
+		g_assert_cmpint(token->text->len, ==, i);
+
+		token = tokens->pdata[4];
+		g_assert_cmpint(token->token_id, ==, TK_STRING);
+		g_assert_cmpstr(token->text->str, ==, "unterminated 0123456789012345678901234567890123456789");
+
+		g_string_free(query, TRUE);
+		g_string_free(expected, TRUE);
+		sql_tokens_free(tokens);
+	}
+} END_TEST
+
 /**
  * @test Second test for bug 36506, where EOF encountered while the tokenizer is in a start start
  *       corrupts its internal state resulting in failure to correctly tokenize the subsequent query.
@@ -345,6 +391,8 @@ g_assert_cmpstr(token->text->str, ==, t_text);
  */
 void test_tokenizer_keywords() {
 	gsize i;
+	gchar *lower_keyword;
+	sql_token_id id;
 
 	for (i = 0; sql_token_get_name(i, NULL); i++) {
 		const char *keyword;
@@ -359,11 +407,22 @@ void test_tokenizer_keywords() {
 		keyword_len -= sizeof("TK_SQL_") - 1;
 
 		g_assert_cmpint(sql_token_get_id_len(keyword, keyword_len), ==, i);
+
+		/* keywords are case-insensitive */
+		lower_keyword = g_ascii_strdown(keyword, keyword_len);
+		g_assert_cmpint(sql_token_get_id_len(lower_keyword, keyword_len), ==, i);
+		g_free(lower_keyword);
+
+		/* a prefix of a keyword only matches if it is a keyword itself */
+		id = sql_token_get_id_len(keyword, keyword_len - 1);
+		g_assert_cmpint(id, !=, i);
 	}
 	
 	/* check that some SQL commands are not keywords */
 	g_assert_cmpint(sql_token_get_id_len(C("COMMIT")), ==, TK_LITERAL);
 	g_assert_cmpint(sql_token_get_id_len(C("TRUNCATE")), ==, TK_LITERAL);
+	g_assert_cmpint(sql_token_get_id_len(C("SELECTS")), ==, TK_LITERAL);
+	g_assert_cmpint(sql_token_get_id_len(C("")), ==, TK_LITERAL);
 }
 
 /**
@@ -714,6 +773,322 @@ void test_literal_digit() {
 
 }
 
+/**
+ * @test the statement types of the common statements
+ */
+START_TEST(test_stmt_type) {
+	struct {
+		const char *query;
+		sql_stmt_type_t stmt_type;
+	} queries[] = {
+		{ "SELECT 1", SQL_STMT_READ },
+		{ "/* comment */ select * FROM tbl", SQL_STMT_READ },
+		{ "SHOW TABLES", SQL_STMT_READ },
+		{ "SELECT * FROM tbl FOR UPDATE", SQL_STMT_WRITE },
+		{ "SELECT * FROM tbl LOCK IN SHARE MODE", SQL_STMT_WRITE },
+		{ "SELECT 1 INTO @a", SQL_STMT_WRITE },
+		{ "INSERT INTO tbl VALUES (1)", SQL_STMT_WRITE },
+		{ "begin", SQL_STMT_TRANSACTION },
+		{ "START TRANSACTION", SQL_STMT_TRANSACTION },
+		{ "ROLLBACK", SQL_STMT_TRANSACTION },
+		{ "SET autocommit = 0", SQL_STMT_TRANSACTION },
+		{ "SET NAMES utf8", SQL_STMT_WRITE },
+		{ "/* only a comment */", SQL_STMT_UNKNOWN },
+		{ NULL, SQL_STMT_UNKNOWN }
+	};
+	gsize i;
+
+	for (i = 0; queries[i].query; i++) {
+		GPtrArray *tokens = sql_tokens_new();
+
+		sql_tokenizer(tokens, queries[i].query, strlen(queries[i].query));
+
+		g_assert_cmpstr(sql_stmt_type_get_name(sql_tokens_get_stmt_type(tokens)), ==, sql_stmt_type_get_name(queries[i].stmt_type));
+
+		sql_tokens_free(tokens);
+	}
+} END_TEST
+
+/**
+ * @test the statement cache returns the same tokens and evicts the oldest entries
+ */
+START_TEST(test_tokenizer_cache) {
+	sql_tokenizer_cache_t *cache;
+	sql_tokenizer_cache_entry_t *e1, *e2, *e3;
+
+	cache = sql_tokenizer_cache_new(2);
+
+	e1 = sql_tokenizer_cache_get(cache, C("SELECT 1"));
+	g_assert_cmpint(e1->stmt_type, ==, SQL_STMT_READ);
+	g_assert_cmpint(e1->tokens->len, ==, 2);
+
+	e2 = sql_tokenizer_cache_get(cache, C("SELECT 1"));
+	g_assert(e1 == e2);
+	g_assert_cmpint(cache->hits, ==, 1);
+	g_assert_cmpint(cache->misses, ==, 1);
+	sql_tokenizer_cache_entry_unref(cache, e2);
+
+	e2 = sql_tokenizer_cache_get(cache, C("SELECT 2"));
+	e3 = sql_tokenizer_cache_get(cache, C("COMMIT"));
+	g_assert_cmpint(e3->stmt_type, ==, SQL_STMT_TRANSACTION);
+
+	/* "SELECT 1" was pushed out, but we still hold a reference */
+	g_assert_cmpint(cache->lru.length, ==, 2);
+	g_assert_cmpint(e1->tokens->len, ==, 2);
+	sql_tokenizer_cache_entry_unref(cache, e1);
+
+	e1 = sql_tokenizer_cache_get(cache, C("SELECT 1"));
+	g_assert_cmpint(cache->misses, ==, 4);
+	sql_tokenizer_cache_entry_unref(cache, e1);
+
+	sql_tokenizer_cache_entry_unref(cache, e2);
+	sql_tokenizer_cache_entry_unref(cache, e3);
+
+	sql_tokenizer_cache_free(cache);
+} END_TEST
+
+/**
+ * @test the fingerprint replaces the constants and hashes the normalized query
+ */
+START_TEST(test_tokenizer_fingerprint) {
+	GString *norm_1 = g_string_new(NULL);
+	GString *norm_2 = g_string_new(NULL);
+	guint64 hash_1, hash_2;
+
+	g_assert_cmpint(0, ==, sql_tokenizer_fingerprint(norm_1, &hash_1, C("SELECT a, 'abc' FROM t WHERE id = 1 -- comment\n")));
+	g_assert_cmpstr(norm_1->str, ==, "SELECT `a` , ? FROM `t` WHERE `id` = ? ");
+
+	g_assert_cmpint(0, ==, sql_tokenizer_fingerprint(norm_2, &hash_2, C("select a, \"xyz\" from t where id = 42")));
+	g_assert_cmpstr(norm_1->str, ==, norm_2->str);
+	g_assert(hash_1 == hash_2);
+
+	g_string_truncate(norm_2, 0);
+	g_assert_cmpint(0, ==, sql_tokenizer_fingerprint(norm_2, &hash_2, C("SELECT b FROM t")));
+	g_assert(hash_1 != hash_2);
+
+	g_string_free(norm_1, TRUE);
+	g_string_free(norm_2, TRUE);
+} END_TEST
+
+/**
+ * @test the stream only scans as far as needed and returns complete tokens
+ */
+START_TEST(test_tokenizer_stream) {
+	sql_tokenizer_stream_t *stream;
+	sql_token *token;
+
+	stream = sql_tokenizer_stream_new(C("SELECT 'a''b' FROM tbl"));
+	g_assert(stream);
+
+	token = sql_tokenizer_stream_next(stream);
+	g_assert(token);
+	g_assert_cmpint(token->token_id, ==, TK_SQL_SELECT);
+
+	token = sql_tokenizer_stream_next(stream);
+	g_assert(token);
+	g_assert_cmpint(token->token_id, ==, TK_STRING);
+	g_assert_cmpstr(token->text->str, ==, "a'b");
+
+	token = sql_tokenizer_stream_next(stream);
+	g_assert(token);
+	g_assert_cmpint(token->token_id, ==, TK_SQL_FROM);
+
+	token = sql_tokenizer_stream_next(stream);
+	g_assert(token);
+	g_assert_cmpstr(token->text->str, ==, "tbl");
+
+	g_assert(NULL == sql_tokenizer_stream_next(stream));
+	g_assert(NULL == sql_tokenizer_stream_next(stream));
+
+	sql_tokenizer_stream_free(stream);
+} END_TEST
+
+/**
+ * a sink that tokenizes its tokens again while the outer scan is running
+ */
+static void nested_sink_append(sql_tokenizer_sink_t *sink, sql_token_id G_GNUC_UNUSED token_id, const gchar *text, gsize text_len) {
+	GPtrArray *tokens = sql_tokens_new();
+
+	g_assert_cmpint(0, ==, sql_tokenizer(tokens, text, text_len));
+	g_assert_cmpint(tokens->len, ==, 1);
+	sql_tokens_free(tokens);
+
+	*(guint *)sink->udata += 1;
+}
+
+static void nested_sink_append_last(sql_tokenizer_sink_t G_GNUC_UNUSED *sink, sql_token_id G_GNUC_UNUSED token_id, const gchar G_GNUC_UNUSED *text, gsize G_GNUC_UNUSED text_len) {
+}
+
+/**
+ * @test the scanner of the thread is reused, a scan from inside a sink gets a scanner of its own
+ */
+START_TEST(test_tokenizer_thread_scanner) {
+	sql_tokenizer_sink_t sink;
+	GPtrArray *tokens;
+	GString *long_query;
+	guint count = 0;
+
+	memset(&sink, 0, sizeof(sink));
+	sink.append = nested_sink_append;
+	sink.append_last = nested_sink_append_last;
+	sink.udata = &count;
+
+	g_assert_cmpint(0, ==, sql_tokenizer_scan(&sink, C("SELECT a FROM tbl")));
+	g_assert_cmpint(count, ==, 4);
+
+	/* the outer scan went on after the nested ones */
+	tokens = sql_tokens_new();
+	g_assert_cmpint(0, ==, sql_tokenizer(tokens, C("SELECT 1")));
+	g_assert_cmpint(tokens->len, ==, 2);
+	sql_tokens_free(tokens);
+
+	/* a query that doesn't fit into the buffer of the thread */
+	long_query = g_string_new("SELECT '");
+	while (long_query->len < 128 * 1024) g_string_append_c(long_query, 'x');
+	g_string_append(long_query, "' FROM tbl");
+
+	tokens = sql_tokens_new();
+	g_assert_cmpint(0, ==, sql_tokenizer(tokens, S(long_query)));
+	g_assert_cmpint(tokens->len, ==, 4);
+	sql_tokens_free(tokens);
+
+	tokens = sql_tokens_new();
+	g_assert_cmpint(0, ==, sql_tokenizer(tokens, C("SELECT 1")));
+	g_assert_cmpint(tokens->len, ==, 2);
+	sql_tokens_free(tokens);
+
+	g_string_free(long_query, TRUE);
+} END_TEST
+
+/**
+ * tokenize a query and extract its refs
+ */
+static sql_tokens_refs_t *get_refs(const gchar *str, gsize len) {
+	GPtrArray *tokens = sql_tokens_new();
+	sql_tokens_refs_t *refs = sql_tokens_refs_new();
+
+	g_assert_cmpint(0, ==, sql_tokenizer(tokens, str, len));
+	sql_tokens_get_refs(tokens, refs);
+	sql_tokens_free(tokens);
+
+	return refs;
+}
+
+/**
+ * @test the tables and predicates of the common statements
+ */
+START_TEST(test_tokenizer_refs) {
+	sql_tokens_refs_t *refs;
+	sql_table_ref_t *ref;
+	sql_predicate_t *pred;
+
+	refs = get_refs(C("SELECT a.x FROM db1.tbl1 AS a JOIN tbl2 b ON a.id = b.id WHERE a.id = 1 AND `name` = 'abc' ORDER BY x"));
+	g_assert_cmpint(refs->tables->len, ==, 2);
+	ref = refs->tables->pdata[0];
+	g_assert_cmpstr(ref->db->str, ==, "db1");
+	g_assert_cmpstr(ref->name->str, ==, "tbl1");
+	g_assert_cmpstr(ref->alias->str, ==, "a");
+	g_assert(!ref->is_write);
+	ref = refs->tables->pdata[1];
+	g_assert(NULL == ref->db);
+	g_assert_cmpstr(ref->name->str, ==, "tbl2");
+	g_assert_cmpstr(ref->alias->str, ==, "b");
+
+	g_assert_cmpint(refs->predicates->len, ==, 2);
+	pred = refs->predicates->pdata[0];
+	g_assert_cmpstr(pred->qualifier->str, ==, "a");
+	g_assert_cmpstr(pred->column->str, ==, "id");
+	g_assert_cmpstr(pred->value->str, ==, "1");
+	g_assert_cmpint(pred->value_token_id, ==, TK_INTEGER);
+	pred = refs->predicates->pdata[1];
+	g_assert(NULL == pred->qualifier);
+	g_assert_cmpstr(pred->column->str, ==, "name");
+	g_assert_cmpstr(pred->value->str, ==, "abc");
+	g_assert_cmpint(pred->value_token_id, ==, TK_STRING);
+	sql_tokens_refs_free(refs);
+
+	/* a OR makes the predicates useless, the constant has to stand alone */
+	refs = get_refs(C("SELECT * FROM t1, t2 WHERE id = 1 OR id = 2"));
+	g_assert_cmpint(refs->tables->len, ==, 2);
+	g_assert_cmpint(refs->predicates->len, ==, 0);
+	sql_tokens_refs_free(refs);
+
+	refs = get_refs(C("SELECT * FROM t1 WHERE id = 1 + 1 AND x = 2 AND (y = 3 OR z = 4)"));
+	g_assert_cmpint(refs->predicates->len, ==, 1);
+	pred = refs->predicates->pdata[0];
+	g_assert_cmpstr(pred->column->str, ==, "x");
+	sql_tokens_refs_free(refs);
+
+	/* the target is written, the sub-query is read */
+	refs = get_refs(C("INSERT INTO db1.t1 (a) SELECT a FROM t2 WHERE id = 1"));
+	g_assert_cmpint(refs->tables->len, ==, 2);
+	ref = refs->tables->pdata[0];
+	g_assert_cmpstr(ref->name->str, ==, "t1");
+	g_assert(ref->is_write);
+	ref = refs->tables->pdata[1];
+	g_assert_cmpstr(ref->name->str, ==, "t2");
+	g_assert(!ref->is_write);
+	sql_tokens_refs_free(refs);
+
+	refs = get_refs(C("UPDATE t1 SET a = 1 WHERE id IN (SELECT id FROM t2 WHERE b = 2)"));
+	g_assert_cmpint(refs->tables->len, ==, 2);
+	ref = refs->tables->pdata[0];
+	g_assert_cmpstr(ref->name->str, ==, "t1");
+	g_assert(ref->is_write);
+	ref = refs->tables->pdata[1];
+	g_assert_cmpstr(ref->name->str, ==, "t2");
+	g_assert(!ref->is_write);
+	/* the predicates of the sub-query don't restrict the UPDATE */
+	g_assert_cmpint(refs->predicates->len, ==, 0);
+	sql_tokens_refs_free(refs);
+
+	refs = get_refs(C("DELETE FROM t1 WHERE id = 42"));
+	g_assert_cmpint(refs->tables->len, ==, 1);
+	ref = refs->tables->pdata[0];
+	g_assert_cmpstr(ref->name->str, ==, "t1");
+	g_assert(ref->is_write);
+	g_assert_cmpint(refs->predicates->len, ==, 1);
+	sql_tokens_refs_free(refs);
+
+	refs = get_refs(C("DROP TABLE IF EXISTS t1, db2.t2"));
+	g_assert_cmpint(refs->tables->len, ==, 2);
+	ref = refs->tables->pdata[1];
+	g_assert_cmpstr(ref->db->str, ==, "db2");
+	g_assert_cmpstr(ref->name->str, ==, "t2");
+	g_assert(ref->is_write);
+	sql_tokens_refs_free(refs);
+
+	refs = get_refs(C("/* comment */ COMMIT"));
+	g_assert_cmpint(refs->tables->len, ==, 0);
+	g_assert_cmpint(refs->predicates->len, ==, 0);
+	sql_tokens_refs_free(refs);
+} END_TEST
+
+/**
+ * @test the refs are extracted once per cache-entry
+ */
+START_TEST(test_tokenizer_cache_refs) {
+	sql_tokenizer_cache_t *cache;
+	sql_tokenizer_cache_entry_t *e1, *e2;
+	const sql_tokens_refs_t *refs;
+
+	cache = sql_tokenizer_cache_new(2);
+
+	e1 = sql_tokenizer_cache_get(cache, C("SELECT * FROM t1 WHERE id = 1"));
+	g_assert(NULL == e1->refs);
+	refs = sql_tokenizer_cache_get_refs(cache, e1);
+	g_assert_cmpint(refs->tables->len, ==, 1);
+	g_assert_cmpint(refs->predicates->len, ==, 1);
+
+	e2 = sql_tokenizer_cache_get(cache, C("SELECT * FROM t1 WHERE id = 1"));
+	g_assert(e1 == e2);
+	g_assert(refs == sql_tokenizer_cache_get_refs(cache, e2));
+
+	sql_tokenizer_cache_entry_unref(cache, e1);
+	sql_tokenizer_cache_entry_unref(cache, e2);
+
+	sql_tokenizer_cache_free(cache);
+} END_TEST
 
 int main(int argc, char **argv) {
 	g_test_init(&argc, &argv, NULL);
@@ -729,9 +1104,18 @@ int main(int argc, char **argv) {
 	g_test_add_func("/core/tokenizer_doubleminus", test_doubleminus);
 	g_test_add_func("/core/tokenizer_startstate_reset_quoted", test_startstate_reset_quoted);
 	g_test_add_func("/core/tokenizer_startstate_reset_comment", test_startstate_reset_comment);
+	g_test_add_func("/core/tokenizer_long_literals", test_tokenizer_long_literals);
 
 	g_test_add_func("/core/tokenizer_literal_digit", test_literal_digit);
 
+	g_test_add_func("/core/tokenizer_stmt_type", test_stmt_type);
+	g_test_add_func("/core/tokenizer_cache", test_tokenizer_cache);
+	g_test_add_func("/core/tokenizer_fingerprint", test_tokenizer_fingerprint);
+	g_test_add_func("/core/tokenizer_stream", test_tokenizer_stream);
+	g_test_add_func("/core/tokenizer_thread_scanner", test_tokenizer_thread_scanner);
+	g_test_add_func("/core/tokenizer_refs", test_tokenizer_refs);
+	g_test_add_func("/core/tokenizer_cache_refs", test_tokenizer_cache_refs);
+
 	return g_test_run();
 }
 #else
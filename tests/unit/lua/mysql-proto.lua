@@ -372,3 +372,41 @@ for ndx, expected_param in ipairs(expected_params) do
 	assertEquals(param.value, expected_param.value)
 end
 
+-- the lazy EXECUTE decodes the params it is asked for
+local lazy = proto.lazy_from_stmt_execute_packet(packet, 14)
+assert(lazy)
+assertEquals(lazy.stmt_id, 1)
+assertEquals(lazy.flags, 0)
+assertEquals(lazy.iteration_count, 1)
+assertEquals(lazy.new_params_bound, true)
+assertEquals(lazy.param_count, 14)
+
+for ndx, expected_param in ipairs(expected_params) do
+	local value, param_type = lazy:param(ndx)
+	assertEquals(param_type, expected_param.type)
+	assertEquals(value, expected_param.value)
+end
+assert(false == pcall(lazy.param, lazy, 15))
+
+local params = lazy.params
+assertEquals(#params, 14)
+assertEquals(params[3].value, "foo")
+
+local lazy = proto.lazy_from_stmt_execute_packet("\023\001\000\000\000\000\001\000\000\000", 0)
+assertEquals(lazy.stmt_id, 1)
+assertEquals(lazy.new_params_bound, false)
+assertEquals(lazy.params, nil)
+
+-- a truncated packet fails like the table
+assert(false == pcall(proto.lazy_from_stmt_execute_packet, packet:sub(1, -2), 14))
+
+-- the lazy challenge and response
+local lazy = proto.lazy_from_challenge_packet(challenge_packet)
+assertEquals(lazy.server_status, 2)
+assertEquals(lazy.server_version, 50034)
+assertEquals(lazy.no_such_field, nil)
+
+local lazy = proto.lazy_from_response_packet(response_packet, protocol_41_default_capabilities)
+assertEquals(lazy.username, "foobar")
+assertEquals(lazy.database, "db")
+
@@ -44,6 +44,56 @@ function TestScript:testNormalize()
 	assertEquals(norm_query, "SET `GLOBAL` `unknown` . `unknown` = ? ")
 end
 
+---
+-- the lazy tokenizer returns the same tokens as tokenize()
+function TestScript:testLazy()
+	local query = "/* c */ SELECT 'a''b', `c` FROM tbl -- end"
+	local tokens = tokenizer.tokenize(query)
+	local stream = tokenizer.tokenize_lazy(query)
+
+	for i = 1, #tokens do
+		local token = stream:next()
+
+		assertEquals(token.token_name, tokens[i].token_name)
+		assertEquals(token.text, tokens[i].text)
+	end
+	assertEquals(stream:next(), nil)
+
+	-- the token keeps its stream alive
+	local token = tokenizer.tokenize_lazy("SELECT 1"):next()
+	collectgarbage("collect")
+	assertEquals(token.token_name, "TK_SQL_SELECT")
+	assertEquals(token.text, "SELECT")
+
+	local token_name, text = tokenizer.first_keyword("/* comment */ insert INTO tbl VALUES (1)")
+	assertEquals(token_name, "TK_SQL_INSERT")
+	assertEquals(text, "insert")
+
+	assertEquals(tokenizer.first_keyword("/* only a comment */"), nil)
+end
+
+---
+-- the native fingerprint has to match normalize()
+function TestScript:testFingerprint()
+	local queries = {
+		"SET GLOBAL unknown.unknown = 1",
+		"/* comment */ select `a`, 'b', 1.5 FROM tbl WHERE id = @a",
+		"start transaction",
+		"SELECT CONCAT(\"it's\", name) /*!40001 SQL_NO_CACHE */ FROM `db`.`tbl`",
+	}
+
+	for i, query in ipairs(queries) do
+		local norm_query, hash = tokenizer.fingerprint(query)
+
+		assertEquals(norm_query, tokenizer.normalize(tokenizer.tokenize(query)))
+		assertEquals(#hash, 16)
+	end
+
+	local _, hash_1 = tokenizer.fingerprint("SELECT * FROM tbl WHERE id = 1")
+	local _, hash_2 = tokenizer.fingerprint("select * from tbl where id = 42")
+	assertEquals(hash_1, hash_2)
+end
+
 ---
 -- test if we can access the fields step-by-step and out-of-range
 function TestScript:testFields()
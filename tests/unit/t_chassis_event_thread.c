@@ -0,0 +1,323 @@
+/* $%BEGINLICENSE%$
+ Copyright (c) 2008, 2012, Oracle and/or its affiliates. All rights reserved.
+
+ This program is free software; you can redistribute it and/or
+ modify it under the terms of the GNU General Public License as
+ published by the Free Software Foundation; version 2 of the
+ License.
+
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ GNU General Public License for more details.
+
+ You should have received a copy of the GNU General Public License
+ along with this program; if not, write to the Free Software
+ Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA
+ 02110-1301  USA
+
+ $%ENDLICENSE%$ */
+#include <string.h>
+
+#include <glib.h>
+
+#include "chassis-event-thread.h"
+#include "chassis-timings.h"
+
+#if GLIB_CHECK_VERSION(2, 16, 0)
+
+/**
+ * the busy time is summed up and turned into a permille per load-window
+ */
+void t_chassis_event_thread_account() {
+	chassis_event_thread_t *event_thread = chassis_event_thread_new();
+	guint64 start = 10 * G_USEC_PER_SEC;
+
+	/* the first event opens the window */
+	chassis_event_thread_account(event_thread, start, start + 100);
+	g_assert_cmpint(event_thread->events, ==, 1);
+	g_assert_cmpint(event_thread->busy_usec, ==, 100);
+	g_assert_cmpint(event_thread->load, ==, 0);
+
+	/* busy for half of the window */
+	chassis_event_thread_account(event_thread, start + 1000, start + 1000 + G_USEC_PER_SEC / 4);
+	chassis_event_thread_account(event_thread, start + G_USEC_PER_SEC / 2, start + 3 * G_USEC_PER_SEC / 4 + 100);
+	g_assert_cmpint(event_thread->load, ==, 0);
+
+	/* the event that ends the window is part of it */
+	chassis_event_thread_account(event_thread, start + G_USEC_PER_SEC + 100, start + G_USEC_PER_SEC + 100);
+	g_assert_cmpint(event_thread->events, ==, 4);
+	g_assert_cmpint(event_thread->load, ==, 500);
+
+	/* a thread without events is idle, whatever it was before */
+	g_assert_cmpint(chassis_event_thread_get_load(event_thread, start + G_USEC_PER_SEC + 200), ==, 500);
+	g_assert_cmpint(chassis_event_thread_get_load(event_thread, start + 4 * G_USEC_PER_SEC), ==, 0);
+
+	chassis_event_thread_free(event_thread);
+}
+
+static chassis_event_thread_t *t_thread_new(guint ndx, gint load, guint64 now) {
+	chassis_event_thread_t *event_thread = chassis_event_thread_new();
+
+	event_thread->index = ndx;
+	event_thread->load = load;
+	event_thread->load_start_usec = now;
+
+	return event_thread;
+}
+
+/**
+ * idle connections only move from a busy thread to a thread that is much less busy
+ */
+void t_chassis_event_threads_pick_idle() {
+	chassis_event_threads_t threads;
+	chassis_event_thread_t *main_thread, *busy, *idle, *other;
+	guint64 now = chassis_get_rel_microseconds();
+	guint i;
+
+	memset(&threads, 0, sizeof(threads));
+	threads.event_threads = g_ptr_array_new();
+
+	g_ptr_array_add(threads.event_threads, main_thread = t_thread_new(0, 0, now));
+	g_ptr_array_add(threads.event_threads, busy = t_thread_new(1, 900, now));
+	g_ptr_array_add(threads.event_threads, other = t_thread_new(2, 300, now));
+	g_ptr_array_add(threads.event_threads, idle = t_thread_new(3, 100, now));
+
+	/* the least busy thread, never the main-thread */
+	g_assert(idle == chassis_event_threads_pick_idle(&threads, busy));
+	g_assert_cmpint(busy->migrations, ==, 1);
+
+	/* not busy enough to give connections away */
+	g_assert(NULL == chassis_event_threads_pick_idle(&threads, other));
+
+	/* the others are about as busy */
+	idle->load = 500;
+	other->load = 600;
+	g_assert(NULL == chassis_event_threads_pick_idle(&threads, busy));
+
+	/* a few connections per window only */
+	idle->load = 0;
+	for (i = 1; i < CHASSIS_EVENT_THREAD_MAX_MIGRATIONS; i++) {
+		g_assert(idle == chassis_event_threads_pick_idle(&threads, busy));
+	}
+	g_assert(NULL == chassis_event_threads_pick_idle(&threads, busy));
+	g_assert_cmpint(busy->migrations, ==, CHASSIS_EVENT_THREAD_MAX_MIGRATIONS);
+
+	for (i = 0; i < threads.event_threads->len; i++) {
+		chassis_event_thread_free(threads.event_threads->pdata[i]);
+	}
+	g_ptr_array_free(threads.event_threads, TRUE);
+}
+
+/**
+ * the draining threads don't get connections, they give theirs to the active ones
+ */
+void t_chassis_event_threads_set_active() {
+	chassis_event_threads_t threads;
+	chassis_event_thread_t *main_thread, *first, *second, *third;
+	guint64 now = chassis_get_rel_microseconds();
+	guint i;
+
+	memset(&threads, 0, sizeof(threads));
+	threads.event_threads = g_ptr_array_new();
+
+	g_ptr_array_add(threads.event_threads, main_thread = t_thread_new(0, 0, now));
+	g_ptr_array_add(threads.event_threads, first = t_thread_new(1, 100, now));
+	g_ptr_array_add(threads.event_threads, second = t_thread_new(2, 0, now));
+	g_ptr_array_add(threads.event_threads, third = t_thread_new(3, 400, now));
+
+	/* all threads are active by default */
+	g_assert_cmpint(chassis_event_threads_get_active(&threads), ==, 4);
+	g_assert(!chassis_event_threads_is_draining(&threads, third));
+
+	/* at least one thread besides the main-thread, at most all */
+	g_assert_cmpint(chassis_event_threads_set_active(&threads, 0), ==, 2);
+	g_assert_cmpint(chassis_event_threads_set_active(&threads, 10), ==, 4);
+
+	g_assert_cmpint(chassis_event_threads_set_active(&threads, 2), ==, 2);
+	g_assert(!chassis_event_threads_is_draining(&threads, main_thread));
+	g_assert(!chassis_event_threads_is_draining(&threads, first));
+	g_assert(chassis_event_threads_is_draining(&threads, second));
+	g_assert(chassis_event_threads_is_draining(&threads, third));
+
+	/* a draining thread isn't busy, but hands its connections to the active thread anyway */
+	g_assert(first == chassis_event_threads_pick_idle(&threads, third));
+	g_assert(first == chassis_event_threads_pick_idle(&threads, second));
+
+	/* a busy active thread doesn't give its connections to the draining ones */
+	first->load = 900;
+	g_assert(NULL == chassis_event_threads_pick_idle(&threads, first));
+
+	for (i = 0; i < threads.event_threads->len; i++) {
+		chassis_event_thread_free(threads.event_threads->pdata[i]);
+	}
+	g_ptr_array_free(threads.event_threads, TRUE);
+}
+
+/**
+ * busy threads get one more thread active right away, idle ones get one less after a while
+ */
+void t_chassis_event_threads_autoscale() {
+	chassis_event_threads_t threads;
+	guint64 now = chassis_get_rel_microseconds();
+	guint i;
+
+	memset(&threads, 0, sizeof(threads));
+	threads.event_threads = g_ptr_array_new();
+
+	for (i = 0; i < 5; i++) {
+		g_ptr_array_add(threads.event_threads, t_thread_new(i, 0, now));
+	}
+	chassis_event_threads_set_active(&threads, 2);
+
+#define T_LOAD(ndx, l) ((chassis_event_thread_t *)threads.event_threads->pdata[ndx])->load = l
+
+	/* the only active thread is busy */
+	T_LOAD(1, 800);
+	g_assert_cmpint(chassis_event_threads_autoscale(&threads, 2, now), ==, 3);
+
+	/* the two are busy on average */
+	T_LOAD(2, 700);
+	g_assert_cmpint(chassis_event_threads_autoscale(&threads, 2, now), ==, 4);
+
+	/* not busy enough for one more, not idle enough for one less */
+	T_LOAD(1, 300);
+	T_LOAD(2, 300);
+	T_LOAD(3, 300);
+	for (i = 0; i < 2 * CHASSIS_EVENT_THREADS_AUTOSCALE_IDLE_WINDOWS; i++) {
+		g_assert_cmpint(chassis_event_threads_autoscale(&threads, 2, now), ==, 4);
+	}
+
+	/* two threads would do, but only after some windows in a row */
+	T_LOAD(1, 200);
+	T_LOAD(2, 100);
+	T_LOAD(3, 100);
+	for (i = 1; i < CHASSIS_EVENT_THREADS_AUTOSCALE_IDLE_WINDOWS; i++) {
+		g_assert_cmpint(chassis_event_threads_autoscale(&threads, 2, now), ==, 4);
+	}
+	T_LOAD(1, 600);
+	g_assert_cmpint(chassis_event_threads_autoscale(&threads, 2, now), ==, 4);
+	T_LOAD(1, 200);
+	for (i = 1; i < CHASSIS_EVENT_THREADS_AUTOSCALE_IDLE_WINDOWS; i++) {
+		g_assert_cmpint(chassis_event_threads_autoscale(&threads, 2, now), ==, 4);
+	}
+	g_assert_cmpint(chassis_event_threads_autoscale(&threads, 2, now), ==, 3);
+
+	/* never below the minimum */
+	T_LOAD(1, 0);
+	T_LOAD(2, 0);
+	for (i = 0; i < 2 * CHASSIS_EVENT_THREADS_AUTOSCALE_IDLE_WINDOWS; i++) {
+		g_assert_cmpint(chassis_event_threads_autoscale(&threads, 3, now), ==, 3);
+	}
+
+#undef T_LOAD
+
+	for (i = 0; i < threads.event_threads->len; i++) {
+		chassis_event_thread_free(threads.event_threads->pdata[i]);
+	}
+	g_ptr_array_free(threads.event_threads, TRUE);
+}
+
+/**
+ * the subsystems are only accounted while a handler runs
+ */
+void t_chassis_event_thread_cpu() {
+	chassis_event_thread_t *event_thread = chassis_event_thread_new();
+	int cpu;
+
+	g_assert_cmpint(event_thread->cpu_current, ==, CHASSIS_EVENT_THREAD_CPU_NONE);
+
+	/* no event-thread in the test, entering a subsystem is a no-op */
+	g_assert_cmpint(chassis_event_thread_cpu_enter(CHASSIS_EVENT_THREAD_CPU_LUA), ==, CHASSIS_EVENT_THREAD_CPU_NONE);
+	chassis_event_thread_cpu_leave(CHASSIS_EVENT_THREAD_CPU_NONE);
+
+	chassis_event_thread_cpu_start(event_thread);
+	g_assert_cmpint(event_thread->cpu_current, ==, CHASSIS_EVENT_THREAD_CPU_CORE);
+	chassis_event_thread_cpu_stop(event_thread);
+	g_assert_cmpint(event_thread->cpu_current, ==, CHASSIS_EVENT_THREAD_CPU_NONE);
+
+	for (cpu = 0; cpu < CHASSIS_EVENT_THREAD_CPU_MAX; cpu++) {
+		g_assert(NULL != chassis_event_thread_cpu_get_name(cpu));
+		if (cpu != CHASSIS_EVENT_THREAD_CPU_CORE) g_assert_cmpint(event_thread->cpu_cycles[cpu], ==, 0);
+	}
+	g_assert_cmpstr(chassis_event_thread_cpu_get_name(CHASSIS_EVENT_THREAD_CPU_TOKENIZER), ==, "tokenizer");
+
+	chassis_event_thread_free(event_thread);
+}
+
+static void t_timer_run(chassis_event_timer_t *timer, gpointer user_data) {
+	guint *runs = user_data;
+
+	(*runs)++;
+
+	/* the timer may free itself */
+	if (*runs == 3) chassis_event_timer_free(timer);
+}
+
+static void t_timer_user_data_free(gpointer user_data) {
+	guint *runs = user_data;
+
+	*runs = 1000;
+}
+
+/**
+ * the timers fire at the multiples of their interval until they are freed
+ */
+void t_chassis_event_timer() {
+	chassis_event_thread_t *event_thread = chassis_event_thread_new();
+	chassis_event_timer_t *timer;
+	guint runs = 0, other_runs = 0;
+	guint64 start;
+
+	/* a thread without a timer-wheel can't have timers */
+	g_assert(NULL == chassis_event_timer_new(event_thread, 20, t_timer_run, &runs, NULL));
+
+	event_thread->timer_wheel = chassis_timer_wheel_new(NULL);
+
+	g_assert(NULL == chassis_event_timer_new(event_thread, 0, t_timer_run, &runs, NULL));
+
+	chassis_coarse_clock_update();
+
+	timer = chassis_event_timer_new(event_thread, 20, t_timer_run, &runs, t_timer_user_data_free);
+	g_assert(timer);
+	g_assert_cmpint((timer->wheel_timer.expires * CHASSIS_TIMER_WHEEL_TICK_MS) % 20, ==, 0);
+
+	g_assert(chassis_event_timer_new(event_thread, 60 * 1000, t_timer_run, &other_runs, t_timer_user_data_free));
+	g_assert_cmpint(event_thread->timers.length, ==, 2);
+
+	start = chassis_get_rel_microseconds();
+	while (runs < 3 && chassis_get_rel_microseconds() - start < 5 * G_USEC_PER_SEC) {
+		g_usleep(5 * 1000);
+
+		chassis_coarse_clock_update();
+		chassis_timer_wheel_run(event_thread->timer_wheel, chassis_get_coarse_rel_milliseconds());
+	}
+
+	/* freed by itself on the 3rd run */
+	g_assert_cmpint(runs, ==, 1000);
+	g_assert_cmpint(event_thread->timers.length, ==, 1);
+	g_assert_cmpint(event_thread->timer_wheel->count, ==, 1);
+
+	/* the thread frees the timers that are left */
+	chassis_event_thread_free(event_thread);
+	g_assert_cmpint(other_runs, ==, 1000);
+}
+
+int main(int argc, char **argv) {
+	g_test_init(&argc, &argv, NULL);
+	g_test_bug_base("http://bugs.mysql.com/");
+
+	g_test_add_func("/core/chassis_event_thread_account", t_chassis_event_thread_account);
+	g_test_add_func("/core/chassis_event_threads_pick_idle", t_chassis_event_threads_pick_idle);
+	g_test_add_func("/core/chassis_event_threads_set_active", t_chassis_event_threads_set_active);
+	g_test_add_func("/core/chassis_event_threads_autoscale", t_chassis_event_threads_autoscale);
+	g_test_add_func("/core/chassis_event_thread_cpu", t_chassis_event_thread_cpu);
+	g_test_add_func("/core/chassis_event_timer", t_chassis_event_timer);
+
+	return g_test_run();
+}
+#else
+int main() {
+	return 77;
+}
+#endif
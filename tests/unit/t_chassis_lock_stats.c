@@ -0,0 +1,164 @@
+/* $%BEGINLICENSE%$
+ Copyright (c) 2008, 2012, Oracle and/or its affiliates. All rights reserved.
+
+ This program is free software; you can redistribute it and/or
+ modify it under the terms of the GNU General Public License as
+ published by the Free Software Foundation; version 2 of the
+ License.
+
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ GNU General Public License for more details.
+
+ You should have received a copy of the GNU General Public License
+ along with this program; if not, write to the Free Software
+ Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA
+ 02110-1301  USA
+
+ $%ENDLICENSE%$ */
+#include <string.h>
+
+#include <glib.h>
+
+#include "chassis-lock-stats.h"
+
+#if GLIB_CHECK_VERSION(2, 16, 0)
+
+static chassis_lock_stats_entry_t *t_lock_stats_find(GPtrArray *entries, const gchar *name) {
+	guint i;
+
+	for (i = 0; i < entries->len; i++) {
+		chassis_lock_stats_entry_t *entry = entries->pdata[i];
+
+		if (0 == strcmp(entry->name, name)) return entry;
+	}
+
+	return NULL;
+}
+
+/**
+ * the locks of a name are summed up, unregistered ones are dropped
+ */
+void t_chassis_lock_stats_get_all() {
+	chassis_lock_stats_t stats_a, stats_b;
+	GMutex *mutex = g_mutex_new();
+	GPtrArray *entries;
+	chassis_lock_stats_entry_t *entry;
+
+	chassis_lock_stats_init(&stats_a, "t_lock");
+	chassis_lock_stats_init(&stats_b, "t_lock");
+
+	chassis_lock_stats_mutex_lock(mutex, &stats_a);
+	chassis_lock_stats_mutex_unlock(mutex, &stats_a);
+	chassis_lock_stats_mutex_lock(mutex, &stats_b);
+	chassis_lock_stats_mutex_unlock(mutex, &stats_b);
+	chassis_lock_stats_mutex_lock(mutex, &stats_b);
+	chassis_lock_stats_mutex_unlock(mutex, &stats_b);
+
+	entries = chassis_lock_stats_get_all();
+	entry = t_lock_stats_find(entries, "t_lock");
+	g_assert(entry);
+	g_assert_cmpint(entry->acquisitions, ==, 3);
+	g_assert_cmpint(entry->contended, ==, 0);
+	chassis_lock_stats_entries_free(entries);
+
+	chassis_lock_stats_unregister(&stats_b);
+
+	entries = chassis_lock_stats_get_all();
+	g_assert_cmpint(t_lock_stats_find(entries, "t_lock")->acquisitions, ==, 1);
+	chassis_lock_stats_entries_free(entries);
+
+	chassis_lock_stats_unregister(&stats_a);
+
+	entries = chassis_lock_stats_get_all();
+	g_assert(NULL == t_lock_stats_find(entries, "t_lock"));
+	chassis_lock_stats_entries_free(entries);
+
+	g_mutex_free(mutex);
+}
+
+typedef struct {
+	GMutex *mutex;
+	chassis_lock_stats_t *stats;
+	GMutex *ready_mutex;
+	GCond *ready_cond;
+	gboolean is_locked;
+} t_holder;
+
+static gpointer t_hold_lock(gpointer user_data) {
+	t_holder *holder = user_data;
+
+	chassis_lock_stats_mutex_lock(holder->mutex, holder->stats);
+
+	g_mutex_lock(holder->ready_mutex);
+	holder->is_locked = TRUE;
+	g_cond_signal(holder->ready_cond);
+	g_mutex_unlock(holder->ready_mutex);
+
+	g_usleep(20 * 1000);
+
+	chassis_lock_stats_mutex_unlock(holder->mutex, holder->stats);
+
+	return NULL;
+}
+
+/**
+ * a lock that is held by another thread is contended
+ */
+void t_chassis_lock_stats_contended() {
+	chassis_lock_stats_t stats = CHASSIS_LOCK_STATS_INIT("t_contended");
+	t_holder holder;
+	GThread *thr;
+
+	chassis_lock_stats_set_enabled(TRUE);
+	g_assert(chassis_lock_stats_is_enabled());
+
+	memset(&holder, 0, sizeof(holder));
+	holder.mutex = g_mutex_new();
+	holder.stats = &stats;
+	holder.ready_mutex = g_mutex_new();
+	holder.ready_cond = g_cond_new();
+
+	thr = g_thread_create(t_hold_lock, &holder, TRUE, NULL);
+	g_assert(thr);
+
+	g_mutex_lock(holder.ready_mutex);
+	while (!holder.is_locked) g_cond_wait(holder.ready_cond, holder.ready_mutex);
+	g_mutex_unlock(holder.ready_mutex);
+
+	chassis_lock_stats_mutex_lock(holder.mutex, &stats);
+	chassis_lock_stats_mutex_unlock(holder.mutex, &stats);
+
+	g_thread_join(thr);
+
+	g_assert_cmpint(stats.acquisitions, ==, 2);
+	g_assert_cmpint(stats.contended, ==, 1);
+	g_assert_cmpint(stats.wait_cycles, >, 0);
+	g_assert_cmpint(stats.hold_cycles, >, 0);
+	g_assert_cmpint(stats.locked_at, ==, 0);
+	g_assert(stats.is_registered);
+
+	chassis_lock_stats_unregister(&stats);
+	chassis_lock_stats_set_enabled(FALSE);
+
+	g_cond_free(holder.ready_cond);
+	g_mutex_free(holder.ready_mutex);
+	g_mutex_free(holder.mutex);
+}
+
+int main(int argc, char **argv) {
+	g_thread_init(NULL);
+	g_test_init(&argc, &argv, NULL);
+	g_test_bug_base("http://bugs.mysql.com/");
+
+	g_test_add_func("/core/chassis_lock_stats_get_all", t_chassis_lock_stats_get_all);
+	g_test_add_func("/core/chassis_lock_stats_contended", t_chassis_lock_stats_contended);
+
+	return g_test_run();
+}
+#else
+int main() {
+	return 77;
+}
+#endif
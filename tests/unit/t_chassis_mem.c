@@ -0,0 +1,85 @@
+/* $%BEGINLICENSE%$
+ Copyright (c) 2008, 2012, Oracle and/or its affiliates. All rights reserved.
+
+ This program is free software; you can redistribute it and/or
+ modify it under the terms of the GNU General Public License as
+ published by the Free Software Foundation; version 2 of the
+ License.
+
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ GNU General Public License for more details.
+
+ You should have received a copy of the GNU General Public License
+ along with this program; if not, write to the Free Software
+ Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA
+ 02110-1301  USA
+
+ $%ENDLICENSE%$ */
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <stdlib.h>
+#include <string.h>
+
+#include <glib.h>
+#include <glib/gstdio.h>
+
+#include "chassis-mem.h"
+
+#if GLIB_CHECK_VERSION(2, 16, 0)
+void t_chassis_mem_get_stats() {
+	chassis_mem_stats_t stats;
+	gpointer p;
+
+	/* keep something allocated */
+	p = malloc(1024 * 1024);
+	memset(p, 0, 1024 * 1024);
+
+	if (0 != chassis_mem_get_stats(&stats)) {
+		free(p);
+		return; /* the allocator can't tell */
+	}
+
+	g_assert(stats.allocator != NULL);
+	g_assert_cmpint(stats.allocated, >=, 1024 * 1024);
+	g_assert_cmpint(stats.resident, >=, stats.allocated);
+
+	free(p);
+}
+
+void t_chassis_mem_dump_profile() {
+	GError *gerr = NULL;
+	gchar *filename;
+
+	if (NULL == (filename = chassis_mem_dump_profile(&gerr))) {
+		/* no malloc_info() or jemalloc without profiling */
+		g_assert(gerr != NULL);
+		g_assert(gerr->domain == CHASSIS_MEM_ERROR);
+		g_clear_error(&gerr);
+
+		return;
+	}
+
+	g_assert(g_file_test(filename, G_FILE_TEST_IS_REGULAR));
+	g_unlink(filename);
+	g_free(filename);
+}
+
+int main(int argc, char **argv) {
+	g_thread_init(NULL);
+	g_test_init(&argc, &argv, NULL);
+	g_test_bug_base("http://bugs.mysql.com/");
+
+	g_test_add_func("/chassis/mem/get_stats", t_chassis_mem_get_stats);
+	g_test_add_func("/chassis/mem/dump_profile", t_chassis_mem_dump_profile);
+
+	return g_test_run();
+}
+#else
+int main() {
+	return 77;
+}
+#endif
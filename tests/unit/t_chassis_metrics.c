@@ -0,0 +1,287 @@
+/* $%BEGINLICENSE%$
+ Copyright (c) 2008, 2012, Oracle and/or its affiliates. All rights reserved.
+
+ This program is free software; you can redistribute it and/or
+ modify it under the terms of the GNU General Public License as
+ published by the Free Software Foundation; version 2 of the
+ License.
+
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ GNU General Public License for more details.
+
+ You should have received a copy of the GNU General Public License
+ along with this program; if not, write to the Free Software
+ Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA
+ 02110-1301  USA
+
+ $%ENDLICENSE%$ */
+#include <string.h>
+#ifndef _WIN32
+#include <unistd.h>
+#endif
+
+#include <glib.h>
+#include <glib/gstdio.h>
+
+#include "chassis-metrics.h"
+#include "chassis-stats-shm.h"
+#include "chassis-prefork.h"
+
+#if GLIB_CHECK_VERSION(2, 16, 0)
+
+static void t_assert_contains(GString *out, const char *line) {
+	if (NULL == strstr(out->str, line)) {
+		g_error("%s: expected '%s' in:\n%s", G_STRLOC, line, out->str);
+	}
+}
+
+void t_chassis_metrics_counter() {
+	chassis_metrics_t *metrics = chassis_metrics_new();
+	chassis_metric_t *counter, *gauge;
+	GString *out = g_string_new(NULL);
+
+	counter = chassis_metrics_register_counter(metrics, "t_total", "a counter");
+	gauge = chassis_metrics_register_gauge(metrics, "t_open", "a gauge");
+
+	chassis_metric_inc(counter);
+	chassis_metric_add(counter, 41);
+	chassis_metric_inc(gauge);
+	chassis_metric_inc(gauge);
+	chassis_metric_dec(gauge);
+
+	g_assert_cmpint(chassis_metric_get(counter, 0), ==, 42);
+	g_assert_cmpint(chassis_metric_get(gauge, 0), ==, 1);
+
+	/* the shards start on their own cache-lines */
+	g_assert_cmpint((gsize)counter->values % CHASSIS_METRICS_CACHE_LINE_SIZE, ==, 0);
+	g_assert_cmpint((counter->stride * sizeof(gint64)) % CHASSIS_METRICS_CACHE_LINE_SIZE, ==, 0);
+
+	chassis_metrics_render(metrics, out);
+	t_assert_contains(out, "# HELP t_total a counter\n# TYPE t_total counter\nt_total 42\n");
+	t_assert_contains(out, "# TYPE t_open gauge\nt_open 1\n");
+
+	g_string_free(out, TRUE);
+	chassis_metrics_free(metrics);
+}
+
+void t_chassis_metrics_counter_vec() {
+	chassis_metrics_t *metrics = chassis_metrics_new();
+	const gchar *commands[] = { "quit", "query" };
+	chassis_metric_t *counter;
+	GString *out = g_string_new(NULL);
+
+	counter = chassis_metrics_register_counter_vec(metrics, "t_queries_total", "by command", "command", commands, G_N_ELEMENTS(commands));
+
+	chassis_metric_add_label(counter, 1, 3);
+	chassis_metric_add_label(counter, 2, 1); /* out of range, ignored */
+
+	g_assert_cmpint(chassis_metric_get(counter, 0), ==, 0);
+	g_assert_cmpint(chassis_metric_get(counter, 1), ==, 3);
+
+	chassis_metrics_render(metrics, out);
+	t_assert_contains(out, "t_queries_total{command=\"quit\"} 0\n");
+	t_assert_contains(out, "t_queries_total{command=\"query\"} 3\n");
+
+	g_string_free(out, TRUE);
+	chassis_metrics_free(metrics);
+}
+
+void t_chassis_metrics_histogram() {
+	chassis_metrics_t *metrics = chassis_metrics_new();
+	const guint64 bounds[] = { 1000, 10000 };
+	chassis_metric_t *h;
+	GString *out = g_string_new(NULL);
+
+	h = chassis_metrics_register_histogram(metrics, "t_duration_seconds", "a histogram", bounds, G_N_ELEMENTS(bounds), 1e-6);
+
+	chassis_metric_observe(h, 500);
+	chassis_metric_observe(h, 1000);
+	chassis_metric_observe(h, 5000);
+	chassis_metric_observe(h, 20000);
+
+	chassis_metrics_render(metrics, out);
+	t_assert_contains(out, "t_duration_seconds_bucket{le=\"0.001\"} 2\n");
+	t_assert_contains(out, "t_duration_seconds_bucket{le=\"0.01\"} 3\n");
+	t_assert_contains(out, "t_duration_seconds_bucket{le=\"+Inf\"} 4\n");
+	t_assert_contains(out, "t_duration_seconds_sum 0.0265\n");
+	t_assert_contains(out, "t_duration_seconds_count 4\n");
+
+	g_string_free(out, TRUE);
+	chassis_metrics_free(metrics);
+}
+
+static void t_collector(chassis_metrics_t G_GNUC_UNUSED *metrics, GString *out, gpointer user_data) {
+	chassis_metrics_append_header(out, "t_backend_up", "set at scrape-time", CHASSIS_METRIC_GAUGE);
+	chassis_metrics_append_value(out, "t_backend_up", "backend=\"127.0.0.1:3306\"", *(gint *)user_data);
+}
+
+void t_chassis_metrics_collector() {
+	chassis_metrics_t *metrics = chassis_metrics_new();
+	GString *out = g_string_new(NULL);
+	gint up = 1;
+
+	chassis_metrics_register_collector(metrics, t_collector, &up);
+
+	chassis_metrics_render(metrics, out);
+	t_assert_contains(out, "t_backend_up{backend=\"127.0.0.1:3306\"} 1\n");
+
+	g_string_free(out, TRUE);
+	chassis_metrics_free(metrics);
+}
+
+#ifndef _WIN32
+/**
+ * the samples published in the shared-memory segment can be read back by a reader
+ */
+void t_chassis_stats_shm() {
+	chassis_metrics_t *metrics = chassis_metrics_new();
+	chassis_metric_t *counter;
+	chassis_stats_shm_t *writer, *reader;
+	GArray *records = g_array_new(FALSE, FALSE, sizeof(chassis_stats_shm_record_t));
+	GError *gerr = NULL;
+	gchar *filename;
+	guint64 updated_at = 0;
+	gint up = 1;
+	int fd;
+
+	fd = g_file_open_tmp("t_chassis_stats_shm-XXXXXX", &filename, &gerr);
+	g_assert(fd != -1);
+	close(fd);
+
+	counter = chassis_metrics_register_counter(metrics, "t_total", "a counter");
+	chassis_metric_add(counter, 42);
+	chassis_metrics_register_collector(metrics, t_collector, &up);
+
+	writer = chassis_stats_shm_create(filename, &gerr);
+	g_assert(writer != NULL);
+
+	reader = chassis_stats_shm_open(filename, &gerr);
+	g_assert(reader != NULL);
+
+	/* nothing published yet */
+	g_assert_cmpint(TRUE, ==, chassis_stats_shm_read(reader, records, &updated_at));
+	g_assert_cmpint(records->len, ==, 0);
+
+	chassis_stats_shm_publish(writer, metrics);
+	g_assert_cmpint(writer->header->seq % 2, ==, 0);
+
+	g_assert_cmpint(TRUE, ==, chassis_stats_shm_read(reader, records, &updated_at));
+	g_assert_cmpint(records->len, ==, 2);
+	g_assert_cmpstr(g_array_index(records, chassis_stats_shm_record_t, 0).key, ==, "t_total");
+	g_assert_cmpfloat(g_array_index(records, chassis_stats_shm_record_t, 0).value, ==, 42);
+	g_assert_cmpstr(g_array_index(records, chassis_stats_shm_record_t, 1).key, ==, "t_backend_up{backend=\"127.0.0.1:3306\"}");
+	g_assert_cmpfloat(g_array_index(records, chassis_stats_shm_record_t, 1).value, ==, 1);
+	g_assert_cmpint(updated_at, >, 0);
+
+	/* a writer in the middle of a update makes the reader give up */
+	g_atomic_int_inc(&(writer->header->seq));
+	g_assert_cmpint(FALSE, ==, chassis_stats_shm_read(reader, records, NULL));
+	g_atomic_int_inc(&(writer->header->seq));
+
+	chassis_stats_shm_free(reader);
+	chassis_stats_shm_free(writer);
+
+	/* the writer removes its file */
+	g_assert_cmpint(FALSE, ==, g_file_test(filename, G_FILE_TEST_EXISTS));
+
+	/* not a segment */
+	g_file_set_contents(filename, "hello", -1, NULL);
+	g_assert(NULL == chassis_stats_shm_open(filename, &gerr));
+	g_assert_cmpint(gerr->code, ==, CHASSIS_STATS_SHM_ERROR_FORMAT);
+	g_clear_error(&gerr);
+	g_unlink(filename);
+
+	g_free(filename);
+	g_array_free(records, TRUE);
+	chassis_metrics_free(metrics);
+}
+
+/**
+ * the metrics of a worker get the samples the other workers published in their slots added
+ */
+void t_chassis_prefork_merge_metrics() {
+	chassis_metrics_t *metrics = chassis_metrics_new();
+	chassis_metrics_t *other_metrics = chassis_metrics_new();
+	chassis_prefork_t *prefork;
+	chassis_prefork_slot_t *slot;
+	chassis_stats_shm_t *other;
+	GString *out = g_string_new(NULL);
+	GError *gerr = NULL;
+	gchar *rendered;
+
+	g_assert(NULL == chassis_prefork_new(0, &gerr));
+	g_assert_cmpint(gerr->code, ==, CHASSIS_PREFORK_ERROR_WORKERS);
+	g_clear_error(&gerr);
+
+	g_assert(NULL == chassis_prefork_new(CHASSIS_PREFORK_MAX_WORKERS + 1, &gerr));
+	g_assert_cmpint(gerr->code, ==, CHASSIS_PREFORK_ERROR_WORKERS);
+	g_clear_error(&gerr);
+
+	prefork = chassis_prefork_new(3, &gerr);
+	g_assert_no_error(gerr);
+	g_assert_cmpint(prefork->ndx, ==, -1);
+
+	chassis_prefork_attach(prefork, 0);
+	slot = chassis_prefork_get_slot(prefork, 0);
+	g_assert_cmpint(slot->pid, ==, getpid());
+	g_assert_cmpint(slot->restarts, ==, 0);
+
+	chassis_metric_add(chassis_metrics_register_counter(metrics, "t_total", "a counter"), 40);
+
+	/* without the others our metrics stay as they are */
+	chassis_metrics_render(metrics, out);
+	rendered = g_strdup(out->str);
+	chassis_prefork_merge_metrics(metrics, out, prefork);
+	g_assert_cmpstr(out->str, ==, rendered);
+	g_free(rendered);
+
+	/* worker 1 published its samples, worker 2 never started */
+	slot = chassis_prefork_get_slot(prefork, 1);
+	slot->pid = 4711;
+	other = chassis_stats_shm_new_mapped(slot + 1, prefork->slot_size - sizeof(*slot), TRUE);
+	chassis_metric_add(chassis_metrics_register_counter(other_metrics, "t_total", "a counter"), 2);
+	chassis_metric_add(chassis_metrics_register_gauge(other_metrics, "t_other", "a gauge"), 5);
+	chassis_stats_shm_publish(other, other_metrics);
+
+	g_string_truncate(out, 0);
+	chassis_metrics_render(metrics, out);
+	chassis_prefork_merge_metrics(metrics, out, prefork);
+	t_assert_contains(out, "# HELP t_total a counter\n# TYPE t_total counter\nt_total 42\n");
+	t_assert_contains(out, "\nt_other 5\n");
+
+	/* a worker that is started again counts the restart */
+	chassis_stats_shm_free(prefork->stats);
+	chassis_prefork_attach(prefork, 0);
+	g_assert_cmpint(chassis_prefork_get_slot(prefork, 0)->restarts, ==, 1);
+
+	chassis_stats_shm_free(other);
+	chassis_prefork_free(prefork);
+	g_string_free(out, TRUE);
+	chassis_metrics_free(other_metrics);
+	chassis_metrics_free(metrics);
+}
+#endif
+
+int main(int argc, char **argv) {
+	g_thread_init(NULL);
+	g_test_init(&argc, &argv, NULL);
+	g_test_bug_base("http://bugs.mysql.com/");
+
+	g_test_add_func("/core/chassis_metrics_counter", t_chassis_metrics_counter);
+	g_test_add_func("/core/chassis_metrics_counter_vec", t_chassis_metrics_counter_vec);
+	g_test_add_func("/core/chassis_metrics_histogram", t_chassis_metrics_histogram);
+	g_test_add_func("/core/chassis_metrics_collector", t_chassis_metrics_collector);
+#ifndef _WIN32
+	g_test_add_func("/core/chassis_stats_shm", t_chassis_stats_shm);
+	g_test_add_func("/core/chassis_prefork_merge_metrics", t_chassis_prefork_merge_metrics);
+#endif
+
+	return g_test_run();
+}
+#else
+int main() {
+	return 77;
+}
+#endif
@@ -0,0 +1,215 @@
+/* $%BEGINLICENSE%$
+ Copyright (c) 2008, 2012, Oracle and/or its affiliates. All rights reserved.
+
+ This program is free software; you can redistribute it and/or
+ modify it under the terms of the GNU General Public License as
+ published by the Free Software Foundation; version 2 of the
+ License.
+
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ GNU General Public License for more details.
+
+ You should have received a copy of the GNU General Public License
+ along with this program; if not, write to the Free Software
+ Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA
+ 02110-1301  USA
+
+ $%ENDLICENSE%$ */
+#include <string.h>
+
+#include <glib.h>
+
+#include "chassis-timer-wheel.h"
+
+#if GLIB_CHECK_VERSION(2, 16, 0)
+
+typedef struct {
+	chassis_timer_wheel_timer_t timer;
+
+	guint64 deadline_ms;   /**< the timer shall not fire before */
+	guint64 fired_ms;      /**< the time of the run that fired it, 0 if not fired yet */
+} t_timer;
+
+static guint64 t_now_ms;
+
+static void t_fired(chassis_timer_wheel_timer_t G_GNUC_UNUSED *timer, gpointer user_data) {
+	t_timer *t = user_data;
+
+	g_assert_cmpint(t->fired_ms, ==, 0);
+	t->fired_ms = t_now_ms;
+}
+
+static void t_add(chassis_timer_wheel_t *wheel, t_timer *t, guint64 timeout_ms) {
+	t->deadline_ms = t_now_ms + timeout_ms;
+	t->fired_ms = 0;
+	chassis_timer_wheel_add(wheel, &(t->timer), t_now_ms, timeout_ms, t_fired, t);
+}
+
+static void t_run(chassis_timer_wheel_t *wheel, guint64 now_ms) {
+	t_now_ms = now_ms;
+	chassis_timer_wheel_run(wheel, now_ms);
+}
+
+/**
+ * timers fire once their time is reached, not before
+ */
+void t_chassis_timer_wheel_expire() {
+	chassis_timer_wheel_t *wheel = chassis_timer_wheel_new(NULL);
+	t_timer t[3];
+
+	memset(t, 0, sizeof(t));
+	t_now_ms = 1000005;
+
+	t_add(wheel, &t[0], 50);
+	t_add(wheel, &t[1], 2000);
+	t_add(wheel, &t[2], 10 * 60 * 1000);
+	g_assert_cmpint(wheel->count, ==, 3);
+
+	t_run(wheel, 1000050);
+	g_assert_cmpint(t[0].fired_ms, ==, 0);
+	t_run(wheel, 1000060);
+	g_assert_cmpint(t[0].fired_ms, ==, 1000060);
+	g_assert_cmpint(FALSE, ==, chassis_timer_wheel_timer_is_armed(&(t[0].timer)));
+
+	t_run(wheel, 1002000);
+	g_assert_cmpint(t[1].fired_ms, ==, 0);
+	t_run(wheel, 1002010);
+	g_assert_cmpint(t[1].fired_ms, ==, 1002010);
+
+	/* a late run catches up with all the ticks it missed */
+	t_run(wheel, 1000005 + 10 * 60 * 1000 - 10);
+	g_assert_cmpint(t[2].fired_ms, ==, 0);
+	t_run(wheel, 1000005 + 10 * 60 * 1000 + 5000);
+	g_assert_cmpint(t[2].fired_ms, ==, 1000005 + 10 * 60 * 1000 + 5000);
+	g_assert_cmpint(wheel->count, ==, 0);
+
+	chassis_timer_wheel_free(wheel);
+}
+
+/**
+ * removed and re-added timers only fire with their last timeout
+ */
+void t_chassis_timer_wheel_remove() {
+	chassis_timer_wheel_t *wheel = chassis_timer_wheel_new(NULL);
+	t_timer t[2];
+
+	memset(t, 0, sizeof(t));
+	t_now_ms = 0;
+
+	t_add(wheel, &t[0], 100);
+	t_add(wheel, &t[1], 100);
+	chassis_timer_wheel_remove(&(t[0].timer));
+	chassis_timer_wheel_remove(&(t[0].timer)); /* not armed anymore, ignored */
+
+	/* re-arming moves the timer */
+	t_add(wheel, &t[1], 5000);
+	g_assert_cmpint(wheel->count, ==, 1);
+
+	t_run(wheel, 1000);
+	g_assert_cmpint(t[0].fired_ms, ==, 0);
+	g_assert_cmpint(t[1].fired_ms, ==, 0);
+
+	t_run(wheel, 5000);
+	g_assert_cmpint(t[1].fired_ms, ==, 5000);
+
+	/* freeing the wheel disarms the timers */
+	t_add(wheel, &t[0], 100);
+	chassis_timer_wheel_free(wheel);
+	g_assert_cmpint(FALSE, ==, chassis_timer_wheel_timer_is_armed(&(t[0].timer)));
+}
+
+/**
+ * timers beyond the end of the wheel wait at its end and go on from there
+ */
+void t_chassis_timer_wheel_clamped() {
+	chassis_timer_wheel_t *wheel = chassis_timer_wheel_new(NULL);
+	t_timer t;
+	guint64 timeout_ms = G_GUINT64_CONSTANT(100) * 60 * 60 * 1000; /* 100 hours */
+	guint64 now;
+
+	memset(&t, 0, sizeof(t));
+	t_now_ms = 0;
+
+	t_add(wheel, &t, timeout_ms);
+
+	for (now = 0; now < timeout_ms; now += 60 * 1000) {
+		t_run(wheel, now);
+		g_assert_cmpint(t.fired_ms, ==, 0);
+	}
+
+	t_run(wheel, timeout_ms);
+	g_assert_cmpint(t.fired_ms, ==, timeout_ms);
+
+	chassis_timer_wheel_free(wheel);
+}
+
+/**
+ * random timeouts over all levels fire in the first run at or after their deadline
+ */
+void t_chassis_timer_wheel_random() {
+	chassis_timer_wheel_t *wheel = chassis_timer_wheel_new(NULL);
+	GRand *rnd = g_rand_new_with_seed(42);
+	t_timer t[1000];
+	guint64 last_run_ms;
+	guint i;
+
+	memset(t, 0, sizeof(t));
+	t_now_ms = 123456;
+
+	for (i = 0; i < G_N_ELEMENTS(t); i++) {
+		/* from a few ticks up to a few hours */
+		t_add(wheel, &t[i], g_rand_int_range(rnd, 0, 4) == 0 ?
+				g_rand_int_range(rnd, 0, 1000) :
+				g_rand_int_range(rnd, 0, 4 * 60 * 60 * 1000));
+	}
+
+	while (wheel->count > 0) {
+		last_run_ms = t_now_ms;
+
+		t_run(wheel, t_now_ms + g_rand_int_range(rnd, 1, 30 * 1000));
+
+		for (i = 0; i < G_N_ELEMENTS(t); i++) {
+			if (t[i].fired_ms == t_now_ms) {
+				g_assert_cmpint(t[i].fired_ms, >=, t[i].deadline_ms);
+				g_assert_cmpint(last_run_ms, <, t[i].deadline_ms + CHASSIS_TIMER_WHEEL_TICK_MS);
+			} else if (t[i].fired_ms == 0) {
+				g_assert_cmpint(t_now_ms, <, t[i].deadline_ms + CHASSIS_TIMER_WHEEL_TICK_MS);
+			}
+		}
+
+		/* re-arm some of the timers, like connections that got data */
+		for (i = 0; i < 10; i++) {
+			t_timer *re = &t[g_rand_int_range(rnd, 0, G_N_ELEMENTS(t))];
+
+			if (chassis_timer_wheel_timer_is_armed(&(re->timer))) {
+				t_add(wheel, re, g_rand_int_range(rnd, 0, 60 * 1000));
+			}
+		}
+	}
+
+	for (i = 0; i < G_N_ELEMENTS(t); i++) {
+		g_assert_cmpint(t[i].fired_ms, !=, 0);
+	}
+
+	g_rand_free(rnd);
+	chassis_timer_wheel_free(wheel);
+}
+
+int main(int argc, char **argv) {
+	g_test_init(&argc, &argv, NULL);
+	g_test_bug_base("http://bugs.mysql.com/");
+
+	g_test_add_func("/core/chassis_timer_wheel_expire", t_chassis_timer_wheel_expire);
+	g_test_add_func("/core/chassis_timer_wheel_remove", t_chassis_timer_wheel_remove);
+	g_test_add_func("/core/chassis_timer_wheel_clamped", t_chassis_timer_wheel_clamped);
+	g_test_add_func("/core/chassis_timer_wheel_random", t_chassis_timer_wheel_random);
+
+	return g_test_run();
+}
+#else
+int main() {
+	return 77;
+}
+#endif
@@ -59,11 +59,37 @@ void t_chassis_timings() {
 	chassis_timestamps_free(ts);
 }
 
+/**
+ * the coarse clock only moves when it is updated
+ */
+void t_chassis_coarse_clock() {
+	GTimeVal tv, tv2;
+	guint64 usec;
+
+	chassis_coarse_clock_update();
+
+	usec = chassis_get_coarse_rel_microseconds();
+	chassis_get_coarse_current_time(&tv);
+	g_assert_cmpint(chassis_get_coarse_rel_milliseconds(), ==, (guint64)tv.tv_sec * 1000 + tv.tv_usec / 1000);
+
+	g_usleep(2000);
+
+	g_assert_cmpint(chassis_get_coarse_rel_microseconds(), ==, usec);
+	chassis_get_coarse_current_time(&tv2);
+	g_assert_cmpint(tv2.tv_sec, ==, tv.tv_sec);
+	g_assert_cmpint(tv2.tv_usec, ==, tv.tv_usec);
+
+	chassis_coarse_clock_update();
+
+	g_assert_cmpint(chassis_get_coarse_rel_microseconds(), >, usec);
+}
+
 int main(int argc, char **argv) {
 	g_test_init(&argc, &argv, NULL);
 	g_test_bug_base("http://bugs.mysql.com/");
 
 	g_test_add_func("/core/chassis_timings", t_chassis_timings);
+	g_test_add_func("/core/chassis_coarse_clock", t_chassis_coarse_clock);
 
 	return g_test_run();
 }
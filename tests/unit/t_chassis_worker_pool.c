@@ -0,0 +1,135 @@
+/* $%BEGINLICENSE%$
+ Copyright (c) 2008, 2012, Oracle and/or its affiliates. All rights reserved.
+
+ This program is free software; you can redistribute it and/or
+ modify it under the terms of the GNU General Public License as
+ published by the Free Software Foundation; version 2 of the
+ License.
+
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ GNU General Public License for more details.
+
+ You should have received a copy of the GNU General Public License
+ along with this program; if not, write to the Free Software
+ Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA
+ 02110-1301  USA
+
+ $%ENDLICENSE%$ */
+#include <string.h>
+
+#include <glib.h>
+
+#include "chassis-worker-pool.h"
+
+#if GLIB_CHECK_VERSION(2, 16, 0)
+typedef struct {
+	GMutex *mutex;
+	GCond *cond;
+	guint done;
+} t_jobs;
+
+typedef struct {
+	t_jobs *jobs;
+
+	gboolean is_run;
+	gboolean is_done;
+} t_job;
+
+static void t_job_run(gpointer user_data) {
+	t_job *job = user_data;
+
+	g_usleep(1000);
+	job->is_run = TRUE;
+}
+
+static void t_job_done(gpointer user_data) {
+	t_job *job = user_data;
+
+	g_assert_cmpint(job->is_run, ==, TRUE);
+
+	g_mutex_lock(job->jobs->mutex);
+	job->is_done = TRUE;
+	job->jobs->done++;
+	g_cond_signal(job->jobs->cond);
+	g_mutex_unlock(job->jobs->mutex);
+}
+
+/**
+ * all pushed jobs are run, their done-function is called after they ran
+ *
+ * the test isn't a event-thread, the done-functions are called in the workers
+ */
+void t_chassis_worker_pool_push() {
+	chassis_worker_pool_t *workers;
+	t_jobs jobs;
+	t_job job[20];
+	guint i;
+
+	memset(&jobs, 0, sizeof(jobs));
+	memset(job, 0, sizeof(job));
+	jobs.mutex = g_mutex_new();
+	jobs.cond = g_cond_new();
+
+	workers = chassis_worker_pool_new(4, NULL);
+	g_assert(workers);
+
+	for (i = 0; i < G_N_ELEMENTS(job); i++) {
+		job[i].jobs = &jobs;
+		chassis_worker_pool_push(workers, t_job_run, t_job_done, &job[i]);
+	}
+
+	g_mutex_lock(jobs.mutex);
+	while (jobs.done < G_N_ELEMENTS(job)) {
+		g_cond_wait(jobs.cond, jobs.mutex);
+	}
+	g_mutex_unlock(jobs.mutex);
+
+	chassis_worker_pool_free(workers);
+
+	for (i = 0; i < G_N_ELEMENTS(job); i++) {
+		g_assert_cmpint(job[i].is_done, ==, TRUE);
+	}
+
+	g_cond_free(jobs.cond);
+	g_mutex_free(jobs.mutex);
+}
+
+/**
+ * freeing the pool waits for the jobs, the done-function is optional
+ */
+void t_chassis_worker_pool_free() {
+	chassis_worker_pool_t *workers;
+	t_job job[4];
+	guint i;
+
+	memset(job, 0, sizeof(job));
+
+	workers = chassis_worker_pool_new(1, NULL);
+
+	for (i = 0; i < G_N_ELEMENTS(job); i++) {
+		chassis_worker_pool_push(workers, t_job_run, NULL, &job[i]);
+	}
+	chassis_worker_pool_free(workers);
+
+	for (i = 0; i < G_N_ELEMENTS(job); i++) {
+		g_assert_cmpint(job[i].is_run, ==, TRUE);
+	}
+}
+
+int main(int argc, char **argv) {
+	g_thread_init(NULL);
+	g_test_init(&argc, &argv, NULL);
+	g_test_bug_base("http://bugs.mysql.com/");
+
+	g_test_add_func("/core/chassis_worker_pool_push", t_chassis_worker_pool_push);
+	g_test_add_func("/core/chassis_worker_pool_free", t_chassis_worker_pool_free);
+
+	return g_test_run();
+}
+#else
+int main() {
+	return 77;
+}
+#endif
@@ -0,0 +1,298 @@
+/* $%BEGINLICENSE%$
+ Copyright (c) 2008, 2012, Oracle and/or its affiliates. All rights reserved.
+
+ This program is free software; you can redistribute it and/or
+ modify it under the terms of the GNU General Public License as
+ published by the Free Software Foundation; version 2 of the
+ License.
+
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ GNU General Public License for more details.
+
+ You should have received a copy of the GNU General Public License
+ along with this program; if not, write to the Free Software
+ Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA
+ 02110-1301  USA
+
+ $%ENDLICENSE%$ */
+
+/**
+ * the decoders of mysql-binlog-dump are static, test them in place
+ */
+#define main mysql_binlog_dump_main
+#include "mysql-binlog-dump.c"
+#undef main
+
+#if GLIB_CHECK_VERSION(2, 16, 0)
+#define C(x) x, sizeof(x) - 1
+
+#define T_TABLE_ID 42
+
+/**
+ * TABLE_MAP for test.t1 (field_0 INT NOT NULL, field_1 VARCHAR(64) NULL)
+ */
+static network_mysqld_binlog_event *t_table_map_event_new(void) {
+	network_mysqld_binlog_event *event;
+
+	event = network_mysqld_binlog_event_new();
+	event->event_type = TABLE_MAP_EVENT;
+	event->timestamp = 1000;
+	event->event.table_map_event.table_id = T_TABLE_ID;
+	event->event.table_map_event.db_name = g_strdup("test");
+	event->event.table_map_event.db_name_len = 4;
+	event->event.table_map_event.table_name = g_strdup("t1");
+	event->event.table_map_event.table_name_len = 2;
+	event->event.table_map_event.columns = g_memdup("\3\17", 2); /* INT, VARCHAR */
+	event->event.table_map_event.columns_len = 2;
+	event->event.table_map_event.metadata = g_memdup("\100\0", 2); /* VARCHAR(64) */
+	event->event.table_map_event.metadata_len = 2;
+	event->event.table_map_event.null_bits = g_strdup("\2");
+	event->event.table_map_event.null_bits_len = 1;
+
+	return event;
+}
+
+/**
+ * a row-event of test.t1 with all columns in the images
+ *
+ * @param row the null-bits and fields of the before-image (and the after-image of a UPDATE)
+ */
+static network_mysqld_binlog_event *t_rows_event_new(enum Log_event_type event_type, guint32 log_pos, const char *row, gsize row_len) {
+	network_mysqld_binlog_event *event;
+
+	event = network_mysqld_binlog_event_new();
+	event->event_type = event_type;
+	event->timestamp = 1000;
+	event->log_pos = log_pos;
+	event->event.row_event.table_id = T_TABLE_ID;
+	event->event.row_event.columns_len = 2;
+	event->event.row_event.used_columns_before = g_strdup("\3");
+	event->event.row_event.used_columns_before_len = 1;
+	event->event.row_event.null_bits_before_len = 1;
+	if (event_type == UPDATE_ROWS_EVENT) {
+		event->event.row_event.used_columns_after = g_strdup("\3");
+		event->event.row_event.used_columns_after_len = 1;
+		event->event.row_event.null_bits_after_len = 1;
+	}
+	event->event.row_event.row = g_memdup(row, row_len);
+	event->event.row_event.row_len = row_len;
+
+	return event;
+}
+
+static network_mysqld_binlog_event *t_insert_event_new(void) {
+	return t_rows_event_new(WRITE_ROWS_EVENT, 200, C("\0" "\1\0\0\0" "\3" "a\"b"));
+}
+
+static network_mysqld_binlog_event *t_update_event_new(void) {
+	return t_rows_event_new(UPDATE_ROWS_EVENT, 300, C(
+				"\0" "\1\0\0\0" "\3" "a\"b"
+				"\2" "\2\0\0\0"));     /* field_1 is NULL now */
+}
+
+static network_mysqld_binlog_event *t_delete_event_new(void) {
+	return t_rows_event_new(DELETE_ROWS_EVENT, 400, C("\0" "\2\0\0\0" "\2" "c\n"));
+}
+
+/**
+ * decode the events into CDC records
+ */
+static GString *t_events_append_cdc(binlog_dump_format format) {
+	network_mysqld_binlog *binlog;
+	network_mysqld_binlog_event *events[4];
+	GString *out = g_string_new(NULL);
+	guint i;
+
+	binlog = network_mysqld_binlog_new();
+
+	events[0] = t_table_map_event_new();
+	events[1] = t_insert_event_new();
+	events[2] = t_update_event_new();
+	events[3] = t_delete_event_new();
+
+	for (i = 0; i < G_N_ELEMENTS(events); i++) {
+		g_assert_cmpint(0, ==, network_mysqld_binlog_event_append_to_string(out, format, binlog, events[i]));
+		network_mysqld_binlog_event_free(events[i]);
+	}
+
+	network_mysqld_binlog_free(binlog);
+
+	return out;
+}
+
+/**
+ * @test a JSON object per row-change, the TABLE_MAP writes nothing
+ */
+static void t_binlog_dump_cdc_json(void) {
+	GString *out;
+
+	out = t_events_append_cdc(BINLOG_DUMP_FORMAT_JSON);
+
+	g_assert_cmpstr(out->str, ==,
+			"{\"type\":\"insert\",\"timestamp\":1000,\"log_pos\":200,\"db\":\"test\",\"table\":\"t1\","
+				"\"after\":{\"field_0\":1,\"field_1\":\"a\\\"b\"}}\n"
+			"{\"type\":\"update\",\"timestamp\":1000,\"log_pos\":300,\"db\":\"test\",\"table\":\"t1\","
+				"\"before\":{\"field_0\":1,\"field_1\":\"a\\\"b\"},"
+				"\"after\":{\"field_0\":2,\"field_1\":null}}\n"
+			"{\"type\":\"delete\",\"timestamp\":1000,\"log_pos\":400,\"db\":\"test\",\"table\":\"t1\","
+				"\"before\":{\"field_0\":2,\"field_1\":\"c\\n\"}}\n");
+
+	g_string_free(out, TRUE);
+}
+
+/**
+ * @test a length-prefixed record per row-change, NULL is 0xfb
+ */
+static void t_binlog_dump_cdc_binary(void) {
+	GString *out;
+	const char expected[] =
+		"\x19\0\0\0"                 /* record-length */
+		  "\1"                       /* INSERT */
+		  "\xe8\3\0\0"               /* timestamp */
+		  "\xc8\0\0\0"               /* log-pos */
+		  "\4test" "\2t1" "\2"       /* db, table, columns */
+		  "\3" "\1" "1" "\3" "a\"b"  /* after */
+		"\x1d\0\0\0"
+		  "\2"                       /* UPDATE */
+		  "\xe8\3\0\0"
+		  "\x2c\1\0\0"
+		  "\4test" "\2t1" "\2"
+		  "\3" "\1" "1" "\3" "a\"b"  /* before */
+		  "\3" "\1" "2" "\xfb"       /* after */
+		"\x18\0\0\0"
+		  "\3"                       /* DELETE */
+		  "\xe8\3\0\0"
+		  "\x90\1\0\0"
+		  "\4test" "\2t1" "\2"
+		  "\3" "\1" "2" "\2" "c\n";  /* before */
+
+	out = t_events_append_cdc(BINLOG_DUMP_FORMAT_BINARY);
+
+	g_assert_cmpint(out->len, ==, sizeof(expected) - 1);
+	g_assert_cmpint(0, ==, memcmp(out->str, expected, out->len));
+
+	g_string_free(out, TRUE);
+}
+
+#define T_PIPELINE_ROUNDS 1000
+
+/**
+ * the ndx-th event of the binlog for the pipeline
+ *
+ * TABLE_MAP, WRITE_ROWS, XID per round. Half-way the table is altered to
+ * (field_0 INT NOT NULL, field_1 INT NOT NULL) and keeps its table-id.
+ */
+static network_mysqld_binlog_event *t_pipeline_event_new(guint ndx) {
+	network_mysqld_binlog_event *event;
+	guint32 round = ndx / 3;
+	gboolean is_altered = (round >= T_PIPELINE_ROUNDS / 2);
+	GString *row;
+
+	switch (ndx % 3) {
+	case 0:
+		event = t_table_map_event_new();
+		if (is_altered) {
+			event->event.table_map_event.columns[1] = MYSQL_TYPE_LONG;
+			event->event.table_map_event.metadata_len = 0;
+			event->event.table_map_event.null_bits[0] = 0;
+		}
+		break;
+	case 1:
+		row = g_string_new(NULL);
+		g_string_append_c(row, '\0'); /* null-bits */
+		network_mysqld_proto_append_int32(row, round);
+		if (is_altered) {
+			network_mysqld_proto_append_int32(row, round * 2);
+		} else {
+			network_mysqld_proto_append_lenenc_string(row, "x");
+		}
+		event = t_rows_event_new(WRITE_ROWS_EVENT, 0, S(row));
+		g_string_free(row, TRUE);
+		break;
+	default:
+		event = network_mysqld_binlog_event_new();
+		event->event_type = XID_EVENT;
+		event->timestamp = 1000;
+		event->event.xid.xid_id = round;
+		break;
+	}
+	event->log_pos = 1000 + ndx;
+
+	return event;
+}
+
+/**
+ * @test the workers decode the rows in parallel, the output is the same as
+ *   the one of the serial decoder, also across a TABLE_MAP that replaces the table
+ */
+static void t_binlog_dump_pipeline(void) {
+	binlog_dump_pipeline *pipeline;
+	binlog_dump_output *output;
+	network_mysqld_binlog *binlog;
+	GString *expected = g_string_new(NULL);
+	GError *gerr = NULL;
+	gchar *filename;
+	gchar *content;
+	gsize content_len;
+	guint i;
+	int fd;
+
+	/* the serial decoder */
+	binlog = network_mysqld_binlog_new();
+	for (i = 0; i < T_PIPELINE_ROUNDS * 3; i++) {
+		network_mysqld_binlog_event *event = t_pipeline_event_new(i);
+
+		g_assert_cmpint(0, ==, network_mysqld_binlog_event_append_to_string(expected, BINLOG_DUMP_FORMAT_JSON, binlog, event));
+		network_mysqld_binlog_event_free(event);
+	}
+	network_mysqld_binlog_free(binlog);
+
+	g_assert(NULL != strstr(expected->str, "\"after\":{\"field_0\":0,\"field_1\":\"x\"}"));
+	g_assert(NULL != strstr(expected->str, "\"after\":{\"field_0\":999,\"field_1\":1998}"));
+
+	/* the pipeline */
+	fd = g_file_open_tmp("t-binlog-dump-XXXXXX", &filename, &gerr);
+	g_assert_cmpint(-1, !=, fd);
+
+	output = binlog_dump_output_new(fd, TRUE);
+	pipeline = binlog_dump_pipeline_new(4, BINLOG_DUMP_FORMAT_JSON, output, &gerr);
+	g_assert(pipeline != NULL);
+
+	binlog = network_mysqld_binlog_new();
+	for (i = 0; i < T_PIPELINE_ROUNDS * 3; i++) {
+		/* the pipeline owns the event and its output */
+		binlog_dump_pipeline_decode(pipeline, binlog, t_pipeline_event_new(i), g_string_new(NULL));
+	}
+	binlog_dump_pipeline_free(pipeline);
+	network_mysqld_binlog_free(binlog);
+
+	g_assert_cmpint(0, ==, binlog_dump_output_free(output));
+
+	g_assert(g_file_get_contents(filename, &content, &content_len, &gerr));
+	g_assert_cmpint(content_len, ==, expected->len);
+	g_assert(0 == memcmp(content, expected->str, content_len));
+
+	g_free(content);
+	g_unlink(filename);
+	g_free(filename);
+	g_string_free(expected, TRUE);
+}
+
+int main(int argc, char **argv) {
+	g_thread_init(NULL);
+	g_test_init(&argc, &argv, NULL);
+	g_test_bug_base("http://bugs.mysql.com/");
+
+	g_test_add_func("/core/binlog_dump_cdc_json", t_binlog_dump_cdc_json);
+	g_test_add_func("/core/binlog_dump_cdc_binary", t_binlog_dump_cdc_binary);
+	g_test_add_func("/core/binlog_dump_pipeline", t_binlog_dump_pipeline);
+
+	return g_test_run();
+}
+#else
+int main() {
+	return 77;
+}
+#endif
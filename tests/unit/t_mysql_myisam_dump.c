@@ -0,0 +1,204 @@
+/* $%BEGINLICENSE%$
+ Copyright (c) 2008, 2012, Oracle and/or its affiliates. All rights reserved.
+
+ This program is free software; you can redistribute it and/or
+ modify it under the terms of the GNU General Public License as
+ published by the Free Software Foundation; version 2 of the
+ License.
+
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ GNU General Public License for more details.
+
+ You should have received a copy of the GNU General Public License
+ along with this program; if not, write to the Free Software
+ Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA
+ 02110-1301  USA
+
+ $%ENDLICENSE%$ */
+
+/**
+ * the .MYD decoder of mysql-myisam-dump is static, test it in place
+ */
+#define main mysql_myisam_dump_main
+#include "mysql-myisam-dump.c"
+#undef main
+
+#if GLIB_CHECK_VERSION(2, 16, 0)
+
+/** null-bits, id INT NOT NULL, name VARCHAR(10) NULL */
+#define T_REC_LENGTH (1 + 4 + 1 + 10)
+
+/** just enough rows for two ranges */
+#define T_ROWS (MYD_DUMP_RANGE_SIZE / T_REC_LENGTH + 100)
+
+static void t_frm_add_column(network_mysqld_frm *frm, const char *name, guint8 field_type, guint16 field_len, guint32 rec_pos, guint16 pack_flags) {
+	network_mysqld_column_def *col;
+
+	col = network_mysqld_column_def_new();
+	g_string_assign(col->name, name);
+	col->field_type = field_type;
+	col->field_len = field_len;
+	col->rec_pos = rec_pos;
+	col->pack_flags = pack_flags;
+
+	g_ptr_array_add(frm->columns, col);
+}
+
+/**
+ * the .frm of CREATE TABLE t1 (id INT NOT NULL, name VARCHAR(10)) ROW_FORMAT=FIXED
+ */
+static network_mysqld_frm *t_frm_new(void) {
+	network_mysqld_frm *frm;
+
+	frm = network_mysqld_frm_new();
+	frm->rec_length = T_REC_LENGTH;
+
+	t_frm_add_column(frm, "id", MYSQL_TYPE_LONG, 11, 2, FIELDFLAG_DECIMAL);
+	t_frm_add_column(frm, "name", MYSQL_TYPE_VARCHAR, 10, 6, FIELDFLAG_MAYBE_NULL);
+
+	return frm;
+}
+
+static gchar *t_tmp_filename(void) {
+	gchar *filename;
+	int fd;
+
+	fd = g_file_open_tmp("t-myisam-dump-XXXXXX", &filename, NULL);
+	g_assert_cmpint(-1, !=, fd);
+	close(fd);
+
+	return filename;
+}
+
+/**
+ * @test the rows of a .MYD that spans two ranges are written in file order,
+ *   deleted records are skipped and NULLs are \N
+ */
+static void t_myd_dump_csv(void) {
+	network_mysqld_frm *frm;
+	GString *myd = g_string_new(NULL);
+	GString *expected = g_string_new(NULL);
+	gchar *myd_filename, *out_filename;
+	gchar *content;
+	gsize content_len;
+	gint32 i;
+	int fd;
+
+	for (i = 0; i < T_ROWS; i++) {
+		gchar name[11];
+		gsize name_len;
+		gint32 id = (i % 2) ? i : -i;
+
+		name_len = g_snprintf(name, sizeof(name), "n\"%d", i % 100000);
+
+		if (i % 1000 == 999) {
+			/* deleted */
+			g_string_append_len(myd, "\0", 1);
+		} else if (i % 7 == 0) {
+			g_string_append_c(myd, 0x01 | 0x02); /* name is NULL */
+			g_string_append_printf(expected, "%d,\\N\n", id);
+		} else {
+			g_string_append_c(myd, 0x01);
+			g_string_append_printf(expected, "%d,\"n\"\"%d\"\n", id, i % 100000);
+		}
+		network_mysqld_proto_append_int32(myd, id);
+		g_string_append_c(myd, name_len);
+		g_string_append_len(myd, name, name_len);
+		g_string_set_size(myd, myd->len + (10 - name_len));
+		memset(myd->str + myd->len - (10 - name_len), 0, 10 - name_len);
+	}
+	g_assert_cmpint(myd->len, ==, T_ROWS * T_REC_LENGTH);
+
+	myd_filename = t_tmp_filename();
+	out_filename = t_tmp_filename();
+	g_assert(g_file_set_contents(myd_filename, myd->str, myd->len, NULL));
+
+	frm = t_frm_new();
+
+	fd = g_open(out_filename, O_WRONLY | O_TRUNC, 0);
+	g_assert_cmpint(-1, !=, fd);
+	g_assert_cmpint(0, ==, network_mysqld_myd_dump(frm, myd_filename, MYD_DUMP_FORMAT_CSV, 4, fd));
+	close(fd);
+
+	g_assert(g_file_get_contents(out_filename, &content, &content_len, NULL));
+	g_assert_cmpint(content_len, ==, expected->len);
+	g_assert(0 == memcmp(content, expected->str, content_len));
+	g_free(content);
+
+	network_mysqld_frm_free(frm);
+
+	g_unlink(out_filename);
+	g_unlink(myd_filename);
+	g_free(out_filename);
+	g_free(myd_filename);
+	g_string_free(expected, TRUE);
+	g_string_free(myd, TRUE);
+}
+
+/**
+ * @test tables with dynamic rows or with columns that aren't in the fixed-length
+ *   record are rejected before anything is written
+ */
+static void t_myd_dump_unsupported(void) {
+	network_mysqld_frm *frm;
+	gchar rec[T_REC_LENGTH] = { 0x01, 0x01 }; /* id = 1, name = '' */
+	gchar *myd_filename, *out_filename;
+	gchar *content;
+	gsize content_len;
+	int fd;
+
+	g_log_set_always_fatal(G_LOG_FATAL_MASK); /* we log g_critical() which is fatal for the test-suite */
+
+	myd_filename = t_tmp_filename();
+	out_filename = t_tmp_filename();
+	g_assert(g_file_set_contents(myd_filename, rec, sizeof(rec), NULL));
+
+	fd = g_open(out_filename, O_WRONLY | O_TRUNC, 0);
+	g_assert_cmpint(-1, !=, fd);
+
+	/* ROW_FORMAT=DYNAMIC */
+	frm = t_frm_new();
+	frm->table_options |= HA_OPTION_PACK_RECORD;
+	g_assert_cmpint(-1, ==, network_mysqld_myd_dump(frm, myd_filename, MYD_DUMP_FORMAT_CSV, 2, fd));
+	network_mysqld_frm_free(frm);
+
+	/* a BLOB is stored outside of the record */
+	frm = t_frm_new();
+	t_frm_add_column(frm, "b", MYSQL_TYPE_BLOB, 10, 16, FIELDFLAG_MAYBE_NULL);
+	g_assert_cmpint(-1, ==, network_mysqld_myd_dump(frm, myd_filename, MYD_DUMP_FORMAT_CSV, 2, fd));
+	network_mysqld_frm_free(frm);
+
+	/* the .MYD doesn't exist */
+	frm = t_frm_new();
+	g_assert_cmpint(-1, ==, network_mysqld_myd_dump(frm, "/nonexistent/t1.MYD", MYD_DUMP_FORMAT_CSV, 2, fd));
+	network_mysqld_frm_free(frm);
+
+	close(fd);
+
+	g_assert(g_file_get_contents(out_filename, &content, &content_len, NULL));
+	g_assert_cmpint(content_len, ==, 0);
+	g_free(content);
+
+	g_unlink(out_filename);
+	g_unlink(myd_filename);
+	g_free(out_filename);
+	g_free(myd_filename);
+}
+
+int main(int argc, char **argv) {
+	g_thread_init(NULL);
+	g_test_init(&argc, &argv, NULL);
+	g_test_bug_base("http://bugs.mysql.com/");
+
+	g_test_add_func("/core/myd_dump_csv", t_myd_dump_csv);
+	g_test_add_func("/core/myd_dump_unsupported", t_myd_dump_unsupported);
+
+	return g_test_run();
+}
+#else
+int main() {
+	return 77;
+}
+#endif
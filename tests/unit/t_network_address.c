@@ -215,6 +215,58 @@ t_network_address_tostring_unix() {
 #endif
 }
 
+/**
+ * a address filled in by accept() gets its name on first use and a key without the port
+ */
+static void
+t_network_address_get_name(void) {
+	network_address *addr, *addr_2;
+
+	addr = network_address_new();
+	addr->addr.ipv4.sin_family = AF_INET;
+	addr->addr.ipv4.sin_addr.s_addr = htonl(0x7f000001);
+	addr->addr.ipv4.sin_port = htons(40000);
+	addr->len = sizeof(addr->addr.ipv4);
+
+	g_assert_cmpint(addr->name->len, ==, 0);
+	g_assert_cmpstr(network_address_get_name(addr), ==, "127.0.0.1:40000");
+	g_assert_cmpstr(addr->name->str, ==, "127.0.0.1:40000");
+
+	addr_2 = network_address_new();
+	g_assert_cmpint(network_address_set_address(addr_2, "127.0.0.1:3306"), ==, 0);
+	g_assert_cmpint(network_address_get_key(addr), !=, 0);
+	g_assert(network_address_get_key(addr) == network_address_get_key(addr_2));
+
+	g_assert_cmpint(network_address_set_address(addr_2, "127.0.0.2:3306"), ==, 0);
+	g_assert(network_address_get_key(addr) != network_address_get_key(addr_2));
+
+	network_address_free(addr_2);
+	network_address_free(addr);
+}
+
+/**
+ * the host a certificate is checked against
+ */
+static void
+t_network_address_get_host(void) {
+	gchar *host;
+
+	host = network_address_get_host("db1.example.com:3306");
+	g_assert_cmpstr(host, ==, "db1.example.com");
+	g_free(host);
+
+	host = network_address_get_host("127.0.0.1");
+	g_assert_cmpstr(host, ==, "127.0.0.1");
+	g_free(host);
+
+	host = network_address_get_host("[::1]:3307");
+	g_assert_cmpstr(host, ==, "::1");
+	g_free(host);
+
+	g_assert(NULL == network_address_get_host("/tmp/mysql.sock"));
+	g_assert(NULL == network_address_get_host(":3306"));
+}
+
 int main(int argc, char **argv) {
 	g_test_init(&argc, &argv, NULL);
 	g_test_bug_base("http://bugs.mysql.com/");
@@ -227,6 +279,8 @@ int main(int argc, char **argv) {
 	g_test_add_func("/core/network_address_tostring_unix", t_network_address_tostring_unix);
 	g_test_add_func("/core/network_address_resolve", t_network_address_resolve);
 	g_test_add_func("/core/network_address_resolve_ipv6", t_network_address_resolve_ipv6);
+	g_test_add_func("/core/network_address_get_name", t_network_address_get_name);
+	g_test_add_func("/core/network_address_get_host", t_network_address_get_host);
 
 	return g_test_run();
 }
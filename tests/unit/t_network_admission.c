@@ -0,0 +1,325 @@
+/* $%BEGINLICENSE%$
+ Copyright (c) 2008, 2012, Oracle and/or its affiliates. All rights reserved.
+
+ This program is free software; you can redistribute it and/or
+ modify it under the terms of the GNU General Public License as
+ published by the Free Software Foundation; version 2 of the
+ License.
+
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ GNU General Public License for more details.
+
+ You should have received a copy of the GNU General Public License
+ along with this program; if not, write to the Free Software
+ Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA
+ 02110-1301  USA
+
+ $%ENDLICENSE%$ */
+#include <string.h>
+
+#include <glib.h>
+
+#include "network-admission.h"
+
+#if GLIB_CHECK_VERSION(2, 16, 0)
+static void t_assert_contains(GString *out, const char *line) {
+	if (NULL == strstr(out->str, line)) {
+		g_error("%s: expected '%s' in:\n%s", G_STRLOC, line, out->str);
+	}
+}
+
+static void t_wakeup(network_admission_ticket_t G_GNUC_UNUSED *ticket, gpointer user_data) {
+	guint *woken = user_data;
+
+	(*woken)++;
+}
+
+/**
+ * the per-backend limit queues the queries, a full queue rejects them
+ */
+void t_network_admission_backend() {
+	network_admission_t *adm;
+	network_admission_ticket_t tickets[5];
+	network_admission_stats_t stats;
+	guint woken[5];
+	guint i;
+
+	memset(tickets, 0, sizeof(tickets));
+	memset(woken, 0, sizeof(woken));
+	for (i = 0; i < G_N_ELEMENTS(tickets); i++) {
+		network_admission_ticket_set_wakeup(&(tickets[i]), t_wakeup, &(woken[i]));
+	}
+
+	adm = network_admission_new();
+	g_assert_cmpint(FALSE, ==, network_admission_is_enabled(adm));
+
+	network_admission_set_limits(adm, 2, 0, 2);
+	g_assert_cmpint(TRUE, ==, network_admission_is_enabled(adm));
+
+	g_assert_cmpint(NETWORK_ADMISSION_ADMITTED, ==, network_admission_enter(adm, &(tickets[0]), "127.0.0.1:3306", "root"));
+	g_assert_cmpint(NETWORK_ADMISSION_ADMITTED, ==, network_admission_enter(adm, &(tickets[1]), "127.0.0.1:3306", "root"));
+	g_assert_cmpint(NETWORK_ADMISSION_QUEUED, ==, network_admission_enter(adm, &(tickets[2]), "127.0.0.1:3306", "root"));
+	g_assert_cmpint(NETWORK_ADMISSION_QUEUED, ==, network_admission_enter(adm, &(tickets[3]), "127.0.0.1:3306", "root"));
+	g_assert_cmpint(NETWORK_ADMISSION_REJECTED, ==, network_admission_enter(adm, &(tickets[4]), "127.0.0.1:3306", "root"));
+	g_assert_cmpint(NETWORK_ADMISSION_TICKET_IDLE, ==, tickets[4].state);
+
+	/* another backend isn't affected */
+	g_assert_cmpint(NETWORK_ADMISSION_ADMITTED, ==, network_admission_enter(adm, &(tickets[4]), "127.0.0.1:3307", "root"));
+
+	network_admission_get_backend_stats(adm, "127.0.0.1:3306", &stats);
+	g_assert_cmpint(2, ==, stats.in_flight);
+	g_assert_cmpint(2, ==, stats.waiting);
+
+	/* the oldest waiting query gets the slot */
+	network_admission_leave(adm, &(tickets[0]));
+	g_assert_cmpint(NETWORK_ADMISSION_TICKET_IDLE, ==, tickets[0].state);
+	g_assert_cmpint(NETWORK_ADMISSION_TICKET_ADMITTED, ==, tickets[2].state);
+	g_assert_cmpint(1, ==, woken[2]);
+	g_assert_cmpint(NETWORK_ADMISSION_TICKET_WAITING, ==, tickets[3].state);
+	g_assert_cmpint(0, ==, woken[3]);
+
+	/* the queue-timeout */
+	g_assert_cmpint(TRUE, ==, network_admission_cancel(adm, &(tickets[3])));
+	g_assert_cmpint(NETWORK_ADMISSION_TICKET_IDLE, ==, tickets[3].state);
+	g_assert_cmpint(FALSE, ==, network_admission_cancel(adm, &(tickets[2])));
+
+	network_admission_leave(adm, &(tickets[1]));
+	network_admission_leave(adm, &(tickets[2]));
+	network_admission_leave(adm, &(tickets[4]));
+	g_assert_cmpint(0, ==, woken[3]);
+
+	network_admission_get_stats(adm, &stats);
+	g_assert_cmpint(0, ==, stats.in_flight);
+	g_assert_cmpint(0, ==, stats.waiting);
+	g_assert_cmpint(3, ==, stats.admitted);
+	g_assert_cmpint(2, ==, stats.queued);
+	g_assert_cmpint(1, ==, stats.rejected);
+	g_assert_cmpint(1, ==, stats.timeouts);
+
+	network_admission_free(adm);
+}
+
+/**
+ * a query waiting for the limit of its user doesn't block the other users
+ */
+void t_network_admission_user() {
+	network_admission_t *adm;
+	network_admission_ticket_t tickets[4];
+	guint woken[4];
+	guint i;
+
+	memset(tickets, 0, sizeof(tickets));
+	memset(woken, 0, sizeof(woken));
+	for (i = 0; i < G_N_ELEMENTS(tickets); i++) {
+		network_admission_ticket_set_wakeup(&(tickets[i]), t_wakeup, &(woken[i]));
+	}
+
+	adm = network_admission_new();
+	network_admission_set_limits(adm, 2, 1, 10);
+
+	g_assert_cmpint(NETWORK_ADMISSION_ADMITTED, ==, network_admission_enter(adm, &(tickets[0]), "127.0.0.1:3306", "app"));
+	g_assert_cmpint(NETWORK_ADMISSION_QUEUED, ==, network_admission_enter(adm, &(tickets[1]), "127.0.0.1:3306", "app"));
+	g_assert_cmpint(NETWORK_ADMISSION_ADMITTED, ==, network_admission_enter(adm, &(tickets[2]), "127.0.0.1:3306", "report"));
+	g_assert_cmpint(NETWORK_ADMISSION_QUEUED, ==, network_admission_enter(adm, &(tickets[3]), "127.0.0.1:3306", "batch"));
+
+	/* the backend has room again: "app" is still at its limit, "batch" goes first */
+	network_admission_leave(adm, &(tickets[2]));
+	g_assert_cmpint(NETWORK_ADMISSION_TICKET_WAITING, ==, tickets[1].state);
+	g_assert_cmpint(NETWORK_ADMISSION_TICKET_ADMITTED, ==, tickets[3].state);
+	g_assert_cmpint(1, ==, woken[3]);
+
+	network_admission_leave(adm, &(tickets[0]));
+	g_assert_cmpint(NETWORK_ADMISSION_TICKET_ADMITTED, ==, tickets[1].state);
+	g_assert_cmpint(1, ==, woken[1]);
+
+	/* leaving a waiting ticket takes it out of the queue */
+	g_assert_cmpint(NETWORK_ADMISSION_QUEUED, ==, network_admission_enter(adm, &(tickets[0]), "127.0.0.1:3306", "app"));
+	network_admission_leave(adm, &(tickets[0]));
+	g_assert_cmpint(NETWORK_ADMISSION_TICKET_IDLE, ==, tickets[0].state);
+
+	network_admission_leave(adm, &(tickets[1]));
+	network_admission_leave(adm, &(tickets[3]));
+	g_assert_cmpint(0, ==, woken[0]);
+
+	network_admission_free(adm);
+}
+
+/**
+ * the backends of a group share the limit of the group
+ */
+void t_network_admission_group() {
+	network_admission_t *adm;
+	network_admission_ticket_t tickets[4];
+	guint woken[4];
+	guint i;
+
+	memset(tickets, 0, sizeof(tickets));
+	memset(woken, 0, sizeof(woken));
+	for (i = 0; i < G_N_ELEMENTS(tickets); i++) {
+		network_admission_ticket_set_wakeup(&(tickets[i]), t_wakeup, &(woken[i]));
+	}
+
+	adm = network_admission_new();
+	network_admission_set_limits(adm, 0, 0, 10);
+	g_assert_cmpint(FALSE, ==, network_admission_is_enabled(adm));
+
+	network_admission_set_group_limit(adm, "analytics", 2);
+	g_assert_cmpint(TRUE, ==, network_admission_is_enabled(adm));
+
+	g_assert_cmpint(NETWORK_ADMISSION_ADMITTED, ==, network_admission_enter_group(adm, &(tickets[0]), "127.0.0.1:3306", "analytics", "app"));
+	g_assert_cmpint(NETWORK_ADMISSION_ADMITTED, ==, network_admission_enter_group(adm, &(tickets[1]), "127.0.0.1:3307", "analytics", "app"));
+	g_assert_cmpint(NETWORK_ADMISSION_QUEUED, ==, network_admission_enter_group(adm, &(tickets[2]), "127.0.0.1:3307", "analytics", "app"));
+
+	/* another group isn't affected */
+	g_assert_cmpint(NETWORK_ADMISSION_ADMITTED, ==, network_admission_enter_group(adm, &(tickets[3]), "127.0.0.1:3308", "orders", "app"));
+
+	network_admission_leave(adm, &(tickets[0]));
+	g_assert_cmpint(NETWORK_ADMISSION_TICKET_ADMITTED, ==, tickets[2].state);
+	g_assert_cmpint(1, ==, woken[2]);
+
+	network_admission_leave(adm, &(tickets[1]));
+	network_admission_leave(adm, &(tickets[2]));
+	network_admission_leave(adm, &(tickets[3]));
+
+	/* without a limit the group is unlimited again */
+	network_admission_set_group_limit(adm, "analytics", 0);
+	g_assert_cmpint(FALSE, ==, network_admission_is_enabled(adm));
+
+	network_admission_free(adm);
+}
+
+typedef struct {
+	network_admission_t *adm;
+	network_admission_ticket_t *ticket;
+} t_leave_t;
+
+static gpointer t_leave_thread(gpointer user_data) {
+	t_leave_t *leave = user_data;
+
+	g_assert_cmpint(TRUE, ==, network_admission_leave(leave->adm, leave->ticket));
+
+	return NULL;
+}
+
+typedef struct {
+	volatile gint is_waking;
+	volatile gint is_woken;
+} t_slow_wakeup_t;
+
+static void t_slow_wakeup(network_admission_ticket_t G_GNUC_UNUSED *ticket, gpointer user_data) {
+	t_slow_wakeup_t *w = user_data;
+
+	g_atomic_int_set(&(w->is_waking), 1);
+	g_usleep(G_USEC_PER_SEC / 10);
+	g_atomic_int_set(&(w->is_woken), 1);
+}
+
+/**
+ * the owner of a ticket that is admitted but not woken up yet can leave and free it
+ *
+ * leaving waits until the wakeup of the other thread returned
+ */
+void t_network_admission_leave_waking() {
+	network_admission_t *adm;
+	network_admission_ticket_t first;
+	network_admission_ticket_t *waiting;
+	network_admission_stats_t stats;
+	t_slow_wakeup_t w;
+	t_leave_t leave;
+	GThread *thread;
+
+	memset(&first, 0, sizeof(first));
+	memset(&w, 0, sizeof(w));
+	waiting = g_new0(network_admission_ticket_t, 1);
+	network_admission_ticket_set_wakeup(waiting, t_slow_wakeup, &w);
+
+	adm = network_admission_new();
+	network_admission_set_limits(adm, 1, 0, 1);
+
+	g_assert_cmpint(NETWORK_ADMISSION_ADMITTED, ==, network_admission_enter(adm, &first, "127.0.0.1:3306", "root"));
+	g_assert_cmpint(NETWORK_ADMISSION_QUEUED, ==, network_admission_enter(adm, waiting, "127.0.0.1:3306", "root"));
+
+	leave.adm = adm;
+	leave.ticket = &first;
+	thread = g_thread_create(t_leave_thread, &leave, TRUE, NULL);
+	g_assert(thread != NULL);
+
+	while (!g_atomic_int_get(&(w.is_waking))) {
+		g_usleep(1000);
+	}
+
+	/* the connection is closed before it got woken up */
+	g_assert_cmpint(TRUE, ==, network_admission_leave(adm, waiting));
+	g_assert_cmpint(1, ==, g_atomic_int_get(&(w.is_woken)));
+	g_assert_cmpint(NETWORK_ADMISSION_TICKET_IDLE, ==, waiting->state);
+	g_free(waiting);
+
+	g_thread_join(thread);
+
+	network_admission_get_stats(adm, &stats);
+	g_assert_cmpint(0, ==, stats.in_flight);
+	g_assert_cmpint(0, ==, stats.waiting);
+
+	network_admission_free(adm);
+}
+
+/**
+ * the /metrics report the queries per backend and the decisions
+ */
+void t_network_admission_metrics() {
+	network_admission_t *adm;
+	network_admission_ticket_t tickets[3];
+	GPtrArray *backends = g_ptr_array_new();
+	GString *out = g_string_new(NULL);
+
+	memset(tickets, 0, sizeof(tickets));
+
+	adm = network_admission_new();
+	network_admission_set_limits(adm, 1, 0, 1);
+
+	g_assert_cmpint(NETWORK_ADMISSION_ADMITTED, ==, network_admission_enter(adm, &(tickets[0]), "127.0.0.1:3306", "root"));
+	g_assert_cmpint(NETWORK_ADMISSION_QUEUED, ==, network_admission_enter(adm, &(tickets[1]), "127.0.0.1:3306", "root"));
+	g_assert_cmpint(NETWORK_ADMISSION_REJECTED, ==, network_admission_enter(adm, &(tickets[2]), "127.0.0.1:3306", "root"));
+
+	g_ptr_array_add(backends, "127.0.0.1:3306");
+	g_ptr_array_add(backends, "127.0.0.1:3307");
+
+	network_admission_append_metrics(adm, out, backends);
+	t_assert_contains(out, "# TYPE mysql_proxy_admission_in_flight gauge\n");
+	t_assert_contains(out, "mysql_proxy_admission_in_flight{backend=\"127.0.0.1:3306\"} 1\n");
+	t_assert_contains(out, "mysql_proxy_admission_in_flight{backend=\"127.0.0.1:3307\"} 0\n");
+	t_assert_contains(out, "mysql_proxy_admission_queue_depth{backend=\"127.0.0.1:3306\"} 1\n");
+	t_assert_contains(out, "mysql_proxy_admission_queue_depth{backend=\"127.0.0.1:3307\"} 0\n");
+	t_assert_contains(out, "mysql_proxy_admission_total{result=\"admitted\"} 1\n");
+	t_assert_contains(out, "mysql_proxy_admission_total{result=\"queued\"} 1\n");
+	t_assert_contains(out, "mysql_proxy_admission_total{result=\"rejected\"} 1\n");
+	t_assert_contains(out, "mysql_proxy_admission_total{result=\"timeout\"} 0\n");
+
+	network_admission_leave(adm, &(tickets[1]));
+	network_admission_leave(adm, &(tickets[0]));
+
+	g_string_free(out, TRUE);
+	g_ptr_array_free(backends, TRUE);
+	network_admission_free(adm);
+}
+
+int main(int argc, char **argv) {
+	g_thread_init(NULL);
+	g_test_init(&argc, &argv, NULL);
+	g_test_bug_base("http://bugs.mysql.com/");
+
+	g_test_add_func("/core/network_admission_backend", t_network_admission_backend);
+	g_test_add_func("/core/network_admission_user", t_network_admission_user);
+	g_test_add_func("/core/network_admission_group", t_network_admission_group);
+	g_test_add_func("/core/network_admission_leave_waking", t_network_admission_leave_waking);
+	g_test_add_func("/core/network_admission_metrics", t_network_admission_metrics);
+
+	return g_test_run();
+}
+#else
+int main() {
+	return 77;
+}
+#endif
@@ -0,0 +1,195 @@
+/* $%BEGINLICENSE%$
+ Copyright (c) 2008, 2012, Oracle and/or its affiliates. All rights reserved.
+
+ This program is free software; you can redistribute it and/or
+ modify it under the terms of the GNU General Public License as
+ published by the Free Software Foundation; version 2 of the
+ License.
+
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ GNU General Public License for more details.
+
+ You should have received a copy of the GNU General Public License
+ along with this program; if not, write to the Free Software
+ Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA
+ 02110-1301  USA
+
+ $%ENDLICENSE%$ */
+#include <string.h>
+#include <unistd.h>
+
+#include <glib.h>
+
+#include "network-mysqld-proto.h"
+#include "network-auth-cache.h"
+
+#if GLIB_CHECK_VERSION(2, 16, 0)
+#define C(x) x, sizeof(x) - 1
+#define S(x) x->str, x->len
+
+#define CHALLENGE "01234567890123456789"
+
+/**
+ * the mysql.user format of a password: * and the hex of the double-SHA1
+ */
+static gchar *t_double_hashed_str(const char *password) {
+	GString *hashed = g_string_new(NULL);
+	GString *double_hashed = g_string_new(NULL);
+	GString *str = g_string_new("*");
+	gsize i;
+
+	network_mysqld_proto_password_hash(hashed, password, strlen(password));
+	network_mysqld_proto_password_hash(double_hashed, S(hashed));
+
+	for (i = 0; i < double_hashed->len; i++) {
+		g_string_append_printf(str, "%02X", (guchar)double_hashed->str[i]);
+	}
+
+	g_string_free(hashed, TRUE);
+	g_string_free(double_hashed, TRUE);
+
+	return g_string_free(str, FALSE);
+}
+
+static GString *t_response(const char *password) {
+	GString *hashed = g_string_new(NULL);
+	GString *response = g_string_new(NULL);
+
+	network_mysqld_proto_password_hash(hashed, password, strlen(password));
+	network_mysqld_proto_password_scramble(response, C(CHALLENGE), S(hashed));
+
+	g_string_free(hashed, TRUE);
+
+	return response;
+}
+
+/**
+ * a hash is only used after a login confirmed it, a mismatching login drops it
+ */
+void t_network_auth_cache_confirm() {
+	network_auth_cache_t *cache = network_auth_cache_new();
+	gchar *hashed_str = t_double_hashed_str("secret");
+	GString *good = t_response("secret");
+	GString *bad = t_response("wrong");
+
+	g_assert_cmpint(TRUE, ==, network_auth_cache_set(cache, "app", hashed_str));
+	g_assert_cmpint(FALSE, ==, network_auth_cache_set(cache, "app", "*0123"));
+
+	/* not confirmed yet */
+	g_assert_cmpint(FALSE, ==, network_auth_cache_check(cache, "app", C(CHALLENGE), S(good)));
+
+	network_auth_cache_confirm(cache, "app", C(CHALLENGE), S(good));
+	g_assert_cmpint(TRUE, ==, network_auth_cache_check(cache, "app", C(CHALLENGE), S(good)));
+	g_assert_cmpint(FALSE, ==, network_auth_cache_check(cache, "app", C(CHALLENGE), S(bad)));
+	g_assert_cmpint(FALSE, ==, network_auth_cache_check(cache, "other", C(CHALLENGE), S(good)));
+	/* a empty password or another auth-method */
+	g_assert_cmpint(FALSE, ==, network_auth_cache_check(cache, "app", C(CHALLENGE), NULL, 0));
+
+	g_assert_cmpint(1, ==, cache->hits);
+	g_assert_cmpint(4, ==, cache->misses);
+
+	/* the password changed on the backend */
+	network_auth_cache_confirm(cache, "app", C(CHALLENGE), S(bad));
+	g_assert_cmpint(0, ==, g_hash_table_size(cache->users));
+
+	g_string_free(good, TRUE);
+	g_string_free(bad, TRUE);
+	g_free(hashed_str);
+	network_auth_cache_free(cache);
+}
+
+/**
+ * load the hashes from a file, bad lines fail the load
+ */
+void t_network_auth_cache_load() {
+	network_auth_cache_t *cache = network_auth_cache_new();
+	gchar *hashed_str = t_double_hashed_str("secret");
+	GString *good = t_response("secret");
+	gchar *filename;
+	gchar *contents;
+	GError *gerr = NULL;
+	int fd;
+
+	fd = g_file_open_tmp("t_network_auth_cache-XXXXXX", &filename, &gerr);
+	g_assert_no_error(gerr);
+	close(fd);
+
+	contents = g_strdup_printf("# user\tauthentication_string\n\napp\t%s\nreport   %s\n", hashed_str, hashed_str + 1);
+	g_assert_cmpint(TRUE, ==, g_file_set_contents(filename, contents, -1, NULL));
+	g_free(contents);
+
+	g_assert_cmpint(0, ==, network_auth_cache_load(cache, filename, &gerr));
+	g_assert_no_error(gerr);
+	g_assert_cmpint(2, ==, g_hash_table_size(cache->users));
+
+	network_auth_cache_confirm(cache, "report", C(CHALLENGE), S(good));
+	g_assert_cmpint(TRUE, ==, network_auth_cache_check(cache, "report", C(CHALLENGE), S(good)));
+
+	g_assert_cmpint(TRUE, ==, g_file_set_contents(filename, "app\n", -1, NULL));
+	g_assert_cmpint(-1, ==, network_auth_cache_load(cache, filename, &gerr));
+	g_assert_error(gerr, NETWORK_AUTH_CACHE_ERROR, NETWORK_AUTH_CACHE_ERROR_PARSE);
+	g_clear_error(&gerr);
+
+	unlink(filename);
+	g_assert_cmpint(-1, ==, network_auth_cache_load(cache, filename, &gerr));
+	g_assert_error(gerr, NETWORK_AUTH_CACHE_ERROR, NETWORK_AUTH_CACHE_ERROR_READ);
+	g_clear_error(&gerr);
+
+	g_free(filename);
+	g_string_free(good, TRUE);
+	g_free(hashed_str);
+	network_auth_cache_free(cache);
+}
+
+/**
+ * a login checked by the proxy itself gets the SHA1() of the password to log in to the backend
+ */
+void t_network_auth_cache_unscramble() {
+	network_auth_cache_t *cache = network_auth_cache_new();
+	gchar *hashed_str = t_double_hashed_str("secret");
+	GString *good = t_response("secret");
+	GString *bad = t_response("wrong");
+	GString *hashed = g_string_new(NULL);
+	GString *expected = g_string_new(NULL);
+
+	network_mysqld_proto_password_hash(expected, C("secret"));
+
+	g_assert_cmpint(TRUE, ==, network_auth_cache_set(cache, "app", hashed_str));
+
+	/* no confirmation needed */
+	g_assert_cmpint(TRUE, ==, network_auth_cache_unscramble(cache, "app", C(CHALLENGE), S(good), hashed));
+	g_assert_cmpint(TRUE, ==, g_string_equal(expected, hashed));
+
+	/* with the trailing \0 of the challenge */
+	g_assert_cmpint(TRUE, ==, network_auth_cache_unscramble(cache, "app", CHALLENGE, sizeof(CHALLENGE), S(good), hashed));
+
+	g_assert_cmpint(FALSE, ==, network_auth_cache_unscramble(cache, "app", C(CHALLENGE), S(bad), hashed));
+	g_assert_cmpint(FALSE, ==, network_auth_cache_unscramble(cache, "other", C(CHALLENGE), S(good), hashed));
+	g_assert_cmpint(FALSE, ==, network_auth_cache_unscramble(cache, "app", C(CHALLENGE), NULL, 0, hashed));
+
+	g_string_free(expected, TRUE);
+	g_string_free(hashed, TRUE);
+	g_string_free(good, TRUE);
+	g_string_free(bad, TRUE);
+	g_free(hashed_str);
+	network_auth_cache_free(cache);
+}
+
+int main(int argc, char **argv) {
+	g_thread_init(NULL);
+	g_test_init(&argc, &argv, NULL);
+	g_test_bug_base("http://bugs.mysql.com/");
+
+	g_test_add_func("/core/network_auth_cache_confirm", t_network_auth_cache_confirm);
+	g_test_add_func("/core/network_auth_cache_load", t_network_auth_cache_load);
+	g_test_add_func("/core/network_auth_cache_unscramble", t_network_auth_cache_unscramble);
+
+	return g_test_run();
+}
+#else
+int main() {
+	return 77;
+}
+#endif
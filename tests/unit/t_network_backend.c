@@ -20,9 +20,12 @@
 #include <glib.h>
 
 #include "network-backend.h"
+#include "network-conn-pool.h"
+#include "network-mysqld-packet.h"
 
 #if GLIB_CHECK_VERSION(2, 16, 0)
 #define C(x) x, sizeof(x) - 1
+#define S(x) x->str, x->len
 
 /**
  * test of network_backends_new() allocates a memory 
@@ -78,6 +81,688 @@ void t_network_backends_add() {
 	network_backends_free(backends);
 }
 
+/**
+ * readers keep their snapshot while backends get added
+ */
+void t_network_backends_snapshot() {
+	network_backends_t *backends;
+	network_backend_t *backend;
+	GPtrArray *snapshot;
+
+	backends = network_backends_new();
+	g_assert_cmpint(network_backends_add(backends, "127.0.0.1", BACKEND_TYPE_RW), ==, 0);
+
+	snapshot = network_backends_get_snapshot(backends);
+	backend = network_backends_get(backends, 0);
+	g_assert_cmpint(snapshot->len, ==, 1);
+
+	g_assert_cmpint(network_backends_add(backends, "127.0.0.2", BACKEND_TYPE_RO), ==, 0);
+
+	/* the old snapshot is unchanged, the new one has both */
+	g_assert_cmpint(snapshot->len, ==, 1);
+	g_assert(snapshot->pdata[0] == backend);
+	g_assert(network_backends_get_snapshot(backends) != snapshot);
+	g_assert_cmpint(network_backends_count(backends), ==, 2);
+	g_assert(network_backends_get(backends, 0) == backend);
+	g_assert(network_backends_get(backends, 2) == NULL);
+
+	network_backends_free(backends);
+}
+
+/**
+ * each event-thread gets its own pool
+ */
+void t_network_backends_pool_shards() {
+	network_backends_t *backends;
+	network_backend_t *backend;
+
+	backends = network_backends_new();
+	g_assert_cmpint(network_backends_add(backends, "127.0.0.1", BACKEND_TYPE_RW), ==, 0);
+
+	network_backends_set_pool_shards(backends, 3);
+	g_assert_cmpint(network_backends_add(backends, "127.0.0.2", BACKEND_TYPE_RW), ==, 0);
+
+	backend = network_backends_get(backends, 0);
+	g_assert_cmpint(backend->pools->len, ==, 3);
+	g_assert(network_backend_get_pool(backend, 0) == backend->pool);
+	g_assert(network_backend_get_pool(backend, 1) != backend->pool);
+	/* unknown threads fall back to the main-thread's pool */
+	g_assert(network_backend_get_pool(backend, 3) == backend->pool);
+
+	backend = network_backends_get(backends, 1);
+	g_assert_cmpint(backend->pools->len, ==, 3);
+
+	network_backends_free(backends);
+}
+
+/**
+ * pick the backend with the fewest clients, skip the ones that are down
+ */
+void t_network_backends_get_least_connected() {
+	network_backends_t *backends;
+
+	backends = network_backends_new();
+	g_assert_cmpint(network_backends_add(backends, "127.0.0.1", BACKEND_TYPE_RW), ==, 0);
+	g_assert_cmpint(network_backends_add(backends, "127.0.0.2", BACKEND_TYPE_RO), ==, 0);
+	g_assert_cmpint(network_backends_add(backends, "127.0.0.3", BACKEND_TYPE_RO), ==, 0);
+	g_assert_cmpint(network_backends_add(backends, "127.0.0.4", BACKEND_TYPE_RO), ==, 0);
+
+	network_backends_get(backends, 1)->connected_clients = 5;
+	network_backends_get(backends, 2)->connected_clients = 1;
+	network_backends_get(backends, 3)->connected_clients = 0;
+	network_backends_get(backends, 3)->state = BACKEND_STATE_DOWN;
+
+	g_assert_cmpint(network_backends_get_least_connected(backends, BACKEND_TYPE_RW), ==, 0);
+	g_assert_cmpint(network_backends_get_least_connected(backends, BACKEND_TYPE_RO), ==, 2);
+
+	network_backends_get(backends, 0)->state = BACKEND_STATE_DOWN;
+	g_assert_cmpint(network_backends_get_least_connected(backends, BACKEND_TYPE_RW), ==, -1);
+
+	/* lagging slaves are skipped too */
+	g_assert(network_backend_set_state(network_backends_get(backends, 2), BACKEND_STATE_LAGGING));
+	g_assert(!network_backend_set_state(network_backends_get(backends, 2), BACKEND_STATE_LAGGING));
+	g_assert_cmpint(network_backends_get_least_connected(backends, BACKEND_TYPE_RO), ==, 1);
+	g_assert_cmpint(network_backends_get_least_latency(backends, BACKEND_TYPE_RO), ==, 1);
+
+	network_backends_free(backends);
+}
+
+/**
+ * the groups pick their backends by their policy and apply their pool limits
+ */
+void t_network_backends_group() {
+	network_backends_t *backends;
+	network_backend_group_t *group;
+	GError *gerr = NULL;
+
+	backends = network_backends_new();
+	g_assert_cmpint(network_backends_add(backends, "127.0.0.1:3306", BACKEND_TYPE_RW), ==, 0);
+	g_assert_cmpint(network_backends_add(backends, "127.0.0.2:3306", BACKEND_TYPE_RO), ==, 0);
+	g_assert_cmpint(network_backends_add(backends, "127.0.0.3:3306", BACKEND_TYPE_RO), ==, 0);
+	g_assert_cmpint(network_backends_add(backends, "127.0.0.4:3306", BACKEND_TYPE_RO), ==, 0);
+
+	g_assert_cmpint(network_backends_add_group(backends, "orders-primary(policy=first)=127.0.0.1:3306,127.0.0.4:3306", &gerr), ==, 0);
+	g_assert_cmpint(network_backends_add_group(backends, "orders-replicas ( max-queries=64, pool-max-idle=5, max-lag=10 ) = 127.0.0.2:3306, 127.0.0.3:3306", &gerr), ==, 0);
+
+	g_assert(NULL == network_backends_get_group(backends, "analytics"));
+
+	group = network_backends_get_group(backends, "orders-replicas");
+	g_assert(group != NULL);
+	g_assert_cmpint(group->policy, ==, NETWORK_BACKEND_GROUP_POLICY_LEAST_CONNECTED);
+	g_assert_cmpint(group->members->len, ==, 2);
+	g_assert_cmpint(group->max_queries, ==, 64);
+	g_assert_cmpint(group->max_lag, ==, 10);
+	g_assert(network_backends_get(backends, 1)->group == group);
+	g_assert_cmpint(network_backends_get(backends, 1)->pool->max_idle_connections, ==, 5);
+
+	/* pools added later get the limits too */
+	network_backends_set_pool_shards(backends, 2);
+	g_assert_cmpint(network_backend_get_pool(network_backends_get(backends, 2), 1)->max_idle_connections, ==, 5);
+
+	network_backends_get(backends, 1)->connected_clients = 3;
+	g_assert_cmpint(network_backends_get_from_group(backends, group), ==, 2);
+	network_backends_get(backends, 2)->state = BACKEND_STATE_LAGGING;
+	g_assert_cmpint(network_backends_get_from_group(backends, group), ==, 1);
+	network_backends_get(backends, 1)->state = BACKEND_STATE_DOWN;
+	g_assert_cmpint(network_backends_get_from_group(backends, group), ==, -1);
+
+	/* the first one that is up, in the configured order */
+	group = network_backends_get_group(backends, "orders-primary");
+	g_assert_cmpint(network_backends_get_from_group(backends, group), ==, 0);
+	network_backends_get(backends, 0)->state = BACKEND_STATE_DOWN;
+	g_assert_cmpint(network_backends_get_from_group(backends, group), ==, 3);
+
+	/* unknown backends, backends in another group, duplicate names and bad options are refused */
+	g_assert_cmpint(network_backends_add_group(backends, "analytics=127.0.0.5:3306", &gerr), ==, -1);
+	g_assert_cmpint(gerr->code, ==, NETWORK_BACKENDS_ERROR_GROUP_MEMBER);
+	g_clear_error(&gerr);
+	g_assert_cmpint(network_backends_add_group(backends, "analytics=127.0.0.2:3306", &gerr), ==, -1);
+	g_assert_cmpint(gerr->code, ==, NETWORK_BACKENDS_ERROR_GROUP_MEMBER);
+	g_clear_error(&gerr);
+	g_assert_cmpint(network_backends_add_group(backends, "orders-primary=127.0.0.1:3306", &gerr), ==, -1);
+	g_clear_error(&gerr);
+	g_assert_cmpint(network_backends_add_group(backends, "analytics(policy=random)=127.0.0.2:3306", &gerr), ==, -1);
+	g_assert_cmpint(gerr->code, ==, NETWORK_BACKENDS_ERROR_GROUP_PARSE);
+	g_clear_error(&gerr);
+	g_assert_cmpint(network_backends_add_group(backends, "analytics", &gerr), ==, -1);
+	g_clear_error(&gerr);
+	g_assert(NULL == network_backends_get_group(backends, "analytics"));
+
+	network_backends_free(backends);
+}
+
+/**
+ * the fastest backend wins, weighted by its clients
+ */
+void t_network_backends_get_least_latency() {
+	network_backends_t *backends;
+	network_backend_t *b;
+
+	backends = network_backends_new();
+	g_assert_cmpint(network_backends_add(backends, "127.0.0.1", BACKEND_TYPE_RO), ==, 0);
+	g_assert_cmpint(network_backends_add(backends, "127.0.0.2", BACKEND_TYPE_RO), ==, 0);
+
+	/* the first sample sets the average, the next ones move it by 1/8 */
+	b = network_backends_get(backends, 0);
+	network_backend_add_latency(b, 100, 1000);
+	g_assert_cmpint(b->latency_first, ==, 100);
+	g_assert_cmpint(b->latency_total, ==, 1000);
+	network_backend_add_latency(b, 100, 1800);
+	g_assert_cmpint(b->latency_total, ==, 1100);
+
+	/* no samples yet, try it */
+	g_assert_cmpint(network_backends_get_least_latency(backends, BACKEND_TYPE_RO), ==, 1);
+
+	b = network_backends_get(backends, 1);
+	network_backend_add_latency(b, 100, 4000);
+	g_assert_cmpint(network_backends_get_least_latency(backends, BACKEND_TYPE_RO), ==, 0);
+
+	/* the fast one is busy */
+	network_backends_get(backends, 0)->connected_clients = 4;
+	g_assert_cmpint(network_backends_get_least_latency(backends, BACKEND_TYPE_RO), ==, 1);
+
+	g_assert_cmpint(network_backends_get_least_latency(backends, BACKEND_TYPE_RW), ==, -1);
+
+	network_backends_free(backends);
+}
+
+/**
+ * only the backends that caught up to the binlog position are picked
+ */
+void t_network_backends_get_least_latency_at_pos() {
+	network_backends_t *backends;
+	guint64 pos, pos_usec;
+
+	backends = network_backends_new();
+	g_assert_cmpint(network_backends_add(backends, "127.0.0.1", BACKEND_TYPE_RO), ==, 0);
+	g_assert_cmpint(network_backends_add(backends, "127.0.0.2", BACKEND_TYPE_RO), ==, 0);
+
+	network_backend_add_latency(network_backends_get(backends, 0), 100, 1000);
+	network_backend_add_latency(network_backends_get(backends, 1), 100, 4000);
+
+	/* the positions are unknown */
+	g_assert_cmpint(network_backends_get_least_latency_at_pos(backends, BACKEND_TYPE_RO, 0), ==, 0);
+	g_assert_cmpint(network_backends_get_least_latency_at_pos(backends, BACKEND_TYPE_RO, 100), ==, -1);
+
+	network_backend_set_binlog_pos(network_backends_get(backends, 0), 50, 10);
+	network_backend_set_binlog_pos(network_backends_get(backends, 1), 150, 10);
+
+	network_backend_get_binlog_pos(network_backends_get(backends, 1), &pos, &pos_usec);
+	g_assert_cmpint(pos, ==, 150);
+	g_assert_cmpint(pos_usec, ==, 10);
+
+	/* the fast one is behind */
+	g_assert_cmpint(network_backends_get_least_latency_at_pos(backends, BACKEND_TYPE_RO, 100), ==, 1);
+	g_assert_cmpint(network_backends_get_least_latency_at_pos(backends, BACKEND_TYPE_RO, 50), ==, 0);
+	g_assert_cmpint(network_backends_get_least_latency_at_pos(backends, BACKEND_TYPE_RO, 200), ==, -1);
+
+	network_backends_free(backends);
+}
+
+/**
+ * a key sticks to its backend, only the keys of a backend that goes away move
+ */
+void t_network_backends_get_by_key_at_pos() {
+	network_backends_t *backends;
+	GString *key = g_string_new(NULL);
+	int owner[200];
+	guint per_backend[4] = { 0, 0, 0, 0 };
+	int i, ndx;
+
+	backends = network_backends_new();
+	g_assert_cmpint(network_backends_add(backends, "127.0.0.1", BACKEND_TYPE_RW), ==, 0);
+	g_assert_cmpint(network_backends_add(backends, "127.0.0.2", BACKEND_TYPE_RO), ==, 0);
+	g_assert_cmpint(network_backends_add(backends, "127.0.0.3", BACKEND_TYPE_RO), ==, 0);
+	g_assert_cmpint(network_backends_add(backends, "127.0.0.4", BACKEND_TYPE_RO), ==, 0);
+
+	for (i = 0; i < 200; i++) {
+		g_string_printf(key, "tenant-%d", i);
+
+		owner[i] = network_backends_get_by_key_at_pos(backends, BACKEND_TYPE_RO, S(key), 0, 125);
+		g_assert_cmpint(owner[i], >=, 1);
+		g_assert_cmpint(owner[i], <=, 3);
+
+		/* ... and stays there */
+		g_assert_cmpint(network_backends_get_by_key_at_pos(backends, BACKEND_TYPE_RO, S(key), 0, 125), ==, owner[i]);
+
+		per_backend[owner[i]]++;
+	}
+
+	/* each backend gets its share of the keys */
+	g_assert_cmpint(per_backend[1], >, 30);
+	g_assert_cmpint(per_backend[2], >, 30);
+	g_assert_cmpint(per_backend[3], >, 30);
+
+	/* only the keys of the backend that is down move */
+	network_backends_get(backends, 2)->state = BACKEND_STATE_DOWN;
+
+	for (i = 0; i < 200; i++) {
+		g_string_printf(key, "tenant-%d", i);
+
+		ndx = network_backends_get_by_key_at_pos(backends, BACKEND_TYPE_RO, S(key), 0, 125);
+		if (owner[i] == 2) {
+			g_assert_cmpint(ndx, !=, 2);
+		} else {
+			g_assert_cmpint(ndx, ==, owner[i]);
+		}
+	}
+
+	/* ... and come back with it */
+	network_backends_get(backends, 2)->state = BACKEND_STATE_UP;
+
+	for (i = 0; i < 200; i++) {
+		g_string_printf(key, "tenant-%d", i);
+
+		g_assert_cmpint(network_backends_get_by_key_at_pos(backends, BACKEND_TYPE_RO, S(key), 0, 125), ==, owner[i]);
+	}
+
+	g_assert_cmpint(network_backends_get_by_key_at_pos(backends, BACKEND_TYPE_RO, C("tenant-0"), 100, 125), ==, -1);
+	g_assert_cmpint(network_backends_get_by_key_at_pos(backends, BACKEND_TYPE_UNKNOWN, C("tenant-0"), 0, 125), ==, -1);
+
+	g_string_free(key, TRUE);
+	network_backends_free(backends);
+}
+
+/**
+ * a backend with more than its share of the clients passes the keys on
+ */
+void t_network_backends_get_by_key_bounded_load() {
+	network_backends_t *backends;
+	int i, ndx;
+
+	backends = network_backends_new();
+	g_assert_cmpint(network_backends_add(backends, "127.0.0.1", BACKEND_TYPE_RO), ==, 0);
+	g_assert_cmpint(network_backends_add(backends, "127.0.0.2", BACKEND_TYPE_RO), ==, 0);
+	g_assert_cmpint(network_backends_add(backends, "127.0.0.3", BACKEND_TYPE_RO), ==, 0);
+	g_assert_cmpint(network_backends_add(backends, "127.0.0.4", BACKEND_TYPE_RO), ==, 0);
+
+	ndx = network_backends_get_by_key_at_pos(backends, BACKEND_TYPE_RO, C("tenant-0"), 0, 125);
+	g_assert_cmpint(ndx, >=, 0);
+
+	/* 2 clients each, a backend takes ceil((8 + 1) * 1.25 / 4) = 3 */
+	for (i = 0; i < 4; i++) {
+		network_backends_get(backends, i)->connected_clients = 2;
+	}
+	g_assert_cmpint(network_backends_get_by_key_at_pos(backends, BACKEND_TYPE_RO, C("tenant-0"), 0, 125), ==, ndx);
+
+	/* 10 clients are over the bound of ceil((16 + 1) * 1.25 / 4) = 6 */
+	network_backends_get(backends, ndx)->connected_clients = 10;
+	g_assert_cmpint(network_backends_get_by_key_at_pos(backends, BACKEND_TYPE_RO, C("tenant-0"), 0, 125), !=, ndx);
+
+	/* ... unless the others have as many */
+	for (i = 0; i < 4; i++) {
+		network_backends_get(backends, i)->connected_clients = 10;
+	}
+	g_assert_cmpint(network_backends_get_by_key_at_pos(backends, BACKEND_TYPE_RO, C("tenant-0"), 0, 125), ==, ndx);
+
+	network_backends_free(backends);
+}
+
+/**
+ * a backend whose connects keep failing stays down longer
+ */
+void t_network_backend_connect_failed() {
+	network_backend_t *b;
+	int i;
+
+	b = network_backend_new();
+	g_assert_cmpint(network_backend_get_down_secs(b), ==, NETWORK_BACKEND_DOWN_SECS);
+
+	network_backend_connect_failed(b);
+	g_assert_cmpint(b->state, ==, BACKEND_STATE_DOWN);
+	g_assert_cmpint(network_backend_get_down_secs(b), ==, 4);
+
+	network_backend_connect_failed(b);
+	g_assert_cmpint(network_backend_get_down_secs(b), ==, 8);
+
+	network_backend_connect_failed(b);
+	network_backend_connect_failed(b);
+	network_backend_connect_failed(b);
+	g_assert_cmpint(network_backend_get_down_secs(b), ==, 64);
+
+	network_backend_connect_failed(b);
+	g_assert_cmpint(network_backend_get_down_secs(b), ==, NETWORK_BACKEND_MAX_DOWN_SECS);
+
+	/* woken up, it is on probation until enough connects succeeded */
+	g_assert_cmpint(network_backend_set_state(b, BACKEND_STATE_UNKNOWN), ==, TRUE);
+	g_assert_cmpint(b->breaker.state, ==, NETWORK_BACKEND_BREAKER_HALF_OPEN);
+
+	for (i = 0; i < NETWORK_BACKEND_BREAKER_CLOSE_AFTER; i++) {
+		g_assert_cmpint(b->breaker.state, ==, NETWORK_BACKEND_BREAKER_HALF_OPEN);
+		network_backend_connect_succeeded(b);
+		g_assert_cmpint(b->state, ==, BACKEND_STATE_UP);
+	}
+	g_assert_cmpint(b->breaker.state, ==, NETWORK_BACKEND_BREAKER_CLOSED);
+	g_assert_cmpint(network_backend_get_down_secs(b), ==, NETWORK_BACKEND_DOWN_SECS);
+
+	/* a connect says nothing about the replication */
+	b->state = BACKEND_STATE_LAGGING;
+	network_backend_connect_succeeded(b);
+	g_assert_cmpint(b->state, ==, BACKEND_STATE_LAGGING);
+
+	network_backend_free(b);
+}
+
+/**
+ * the breaker opens on too many failed or slow queries, a HALF_OPEN backend gets some of the picks
+ */
+void t_network_backends_breaker() {
+	network_backends_t *backends;
+	network_backend_t *b;
+	int i, admitted;
+
+	backends = network_backends_new();
+	backends->breaker_error_rate = 50;
+	backends->breaker_slow_usec = 1000;
+	g_assert_cmpint(network_backends_add(backends, "127.0.0.1", BACKEND_TYPE_RO), ==, 0);
+	g_assert_cmpint(network_backends_add(backends, "127.0.0.2", BACKEND_TYPE_RO), ==, 0);
+
+	b = network_backends_get(backends, 0);
+	b->state = BACKEND_STATE_UP;
+	network_backends_get(backends, 1)->state = BACKEND_STATE_UP;
+	network_backends_get(backends, 1)->connected_clients = 10;
+
+	/* too few requests to judge */
+	for (i = 0; i < NETWORK_BACKEND_BREAKER_MIN_REQUESTS - 1; i++) {
+		network_backends_breaker_record(backends, b, i % 2 == 0, 100, 1000 + i);
+	}
+	g_assert_cmpint(b->breaker.state, ==, NETWORK_BACKEND_BREAKER_CLOSED);
+
+	/* the slow query is the 11th failure of 20 */
+	network_backends_breaker_record(backends, b, FALSE, 2000, 2000);
+	g_assert_cmpint(b->breaker.state, ==, NETWORK_BACKEND_BREAKER_OPEN);
+	g_assert_cmpint(b->state, ==, BACKEND_STATE_DOWN);
+	g_assert_cmpint(network_backends_get_least_connected(backends, BACKEND_TYPE_RO), ==, 1);
+
+	/* back on probation, it takes part in 10% of the picks */
+	g_assert_cmpint(network_backend_set_state(b, BACKEND_STATE_UP), ==, TRUE);
+	g_assert_cmpint(b->breaker.state, ==, NETWORK_BACKEND_BREAKER_HALF_OPEN);
+
+	for (i = 0, admitted = 0; i < 100; i++) {
+		if (network_backends_get_least_connected(backends, BACKEND_TYPE_RO) == 0) admitted++;
+	}
+	g_assert_cmpint(admitted, ==, 10);
+
+	/* ... but all of them if there is no other */
+	network_backends_get(backends, 1)->state = BACKEND_STATE_DOWN;
+	g_assert_cmpint(network_backends_get_least_connected(backends, BACKEND_TYPE_RO), ==, 0);
+	g_assert_cmpint(network_backends_get_least_latency(backends, BACKEND_TYPE_RO), ==, 0);
+
+	/* a failure on probation opens it again, for longer */
+	network_backends_breaker_record(backends, b, TRUE, 100, 3000);
+	g_assert_cmpint(b->breaker.state, ==, NETWORK_BACKEND_BREAKER_OPEN);
+	g_assert_cmpint(b->state, ==, BACKEND_STATE_DOWN);
+	g_assert_cmpint(network_backend_get_down_secs(b), ==, 8);
+
+	/* enough successes close it */
+	g_assert_cmpint(network_backend_set_state(b, BACKEND_STATE_UP), ==, TRUE);
+	for (i = 0; i < NETWORK_BACKEND_BREAKER_CLOSE_AFTER; i++) {
+		network_backends_breaker_record(backends, b, FALSE, 100, 4000 + i);
+	}
+	g_assert_cmpint(b->breaker.state, ==, NETWORK_BACKEND_BREAKER_CLOSED);
+	g_assert_cmpint(network_backend_get_down_secs(b), ==, NETWORK_BACKEND_DOWN_SECS);
+
+	network_backends_free(backends);
+}
+
+/**
+ * a reload adds and removes backends, but keeps the indexes and the unchanged backends
+ */
+void t_network_backends_reload() {
+	network_backends_t *backends;
+	network_backend_t *b0, *b1;
+	gchar *rw_1[] = { "127.0.0.1:3306", NULL };
+	gchar *ro_1[] = { "127.0.0.2:3306", "127.0.0.3:3306", NULL };
+	gchar *ro_2[] = { "127.0.0.3:3306", "127.0.0.1:3306", NULL };
+	gchar *ro_bad[] = { "127.0.0.3:notaport", NULL };
+
+	backends = network_backends_new();
+	g_assert_cmpint(network_backends_add(backends, "127.0.0.1:3306", BACKEND_TYPE_RW), ==, 0);
+	g_assert_cmpint(network_backends_add(backends, "127.0.0.2:3306", BACKEND_TYPE_RO), ==, 0);
+
+	b0 = network_backends_get(backends, 0);
+	b1 = network_backends_get(backends, 1);
+	b0->state = BACKEND_STATE_UP;
+
+	/* only the new one is added, the others stay as they are */
+	g_assert_cmpint(network_backends_reload(backends, rw_1, ro_1), ==, 1);
+	g_assert_cmpint(network_backends_count(backends), ==, 3);
+	g_assert(b0 == network_backends_get(backends, 0));
+	g_assert(b1 == network_backends_get(backends, 1));
+	g_assert_cmpint(b0->state, ==, BACKEND_STATE_UP);
+	g_assert_cmpint(network_backends_get(backends, 2)->type, ==, BACKEND_TYPE_RO);
+
+	/* nothing changed */
+	g_assert_cmpint(network_backends_reload(backends, rw_1, ro_1), ==, 0);
+
+	/* .2 is gone and keeps its index, .1 becomes a read-only backend */
+	g_assert_cmpint(network_backends_reload(backends, NULL, ro_2), ==, 2);
+	g_assert_cmpint(network_backends_count(backends), ==, 3);
+	g_assert_cmpint(b0->type, ==, BACKEND_TYPE_RO);
+	g_assert_cmpint(b0->state, ==, BACKEND_STATE_UP);
+	g_assert(b1->is_removed);
+	g_assert_cmpint(b1->state, ==, BACKEND_STATE_DOWN);
+	g_assert_cmpint(network_backends_get_least_connected(backends, BACKEND_TYPE_RW), ==, -1);
+
+	/* a removed backend stays down */
+	g_assert(!network_backend_set_state(b1, BACKEND_STATE_UP));
+	g_assert_cmpint(b1->state, ==, BACKEND_STATE_DOWN);
+
+	/* a broken list changes nothing */
+	g_assert_cmpint(network_backends_reload(backends, rw_1, ro_bad), ==, -1);
+	g_assert(b1->is_removed);
+	g_assert_cmpint(b0->type, ==, BACKEND_TYPE_RO);
+
+	/* .2 comes back */
+	g_assert_cmpint(network_backends_reload(backends, rw_1, ro_1), ==, 2);
+	g_assert_cmpint(network_backends_count(backends), ==, 3);
+	g_assert(!b1->is_removed);
+	g_assert_cmpint(b1->state, ==, BACKEND_STATE_UNKNOWN);
+	g_assert_cmpint(b0->type, ==, BACKEND_TYPE_RW);
+
+	network_backends_free(backends);
+}
+
+/**
+ * new connections take turns over the addresses of a host-name
+ */
+void t_network_backend_resolved() {
+	network_backend_t *b;
+	network_address *dst;
+	GPtrArray *addrs;
+	gchar *records[] = { "127.0.0.2:3306", "127.0.0.3:3306", NULL };
+	guint i;
+
+	b = network_backend_new();
+	dst = network_address_new();
+	g_assert_cmpint(network_address_set_address(b->addr, "127.0.0.1:3306"), ==, 0);
+
+	/* a IP is used as is */
+	g_assert_cmpint(network_address_is_hostname("127.0.0.1:3306"), ==, FALSE);
+	network_backend_get_address(b, dst);
+	g_assert_cmpstr(dst->name->str, ==, "127.0.0.1:3306");
+
+	b->hostname = g_strdup("db.example.com:3306");
+
+	addrs = g_ptr_array_new();
+	for (i = 0; records[i]; i++) {
+		network_address *addr = network_address_new();
+
+		g_assert_cmpint(network_address_set_address(addr, records[i]), ==, 0);
+		g_ptr_array_add(addrs, addr);
+	}
+	g_assert_cmpint(network_backend_set_resolved(b, addrs), ==, TRUE);
+
+	network_backend_get_address(b, dst);
+	g_assert_cmpstr(dst->name->str, ==, "127.0.0.2:3306");
+	network_backend_get_address(b, dst);
+	g_assert_cmpstr(dst->name->str, ==, "127.0.0.3:3306");
+	network_backend_get_address(b, dst);
+	g_assert_cmpstr(dst->name->str, ==, "127.0.0.2:3306");
+
+	/* the same records in another order */
+	addrs = g_ptr_array_new();
+	for (i = 2; i > 0; i--) {
+		network_address *addr = network_address_new();
+
+		g_assert_cmpint(network_address_set_address(addr, records[i - 1]), ==, 0);
+		g_ptr_array_add(addrs, addr);
+	}
+	g_assert_cmpint(network_backend_set_resolved(b, addrs), ==, FALSE);
+
+	/* the backend is still known under its first address */
+	g_assert_cmpstr(b->addr->name->str, ==, "127.0.0.1:3306");
+
+	network_address_free(dst);
+	network_backend_free(b);
+}
+
+#ifndef WIN32
+/**
+ * the backends on this host connect through the unix-socket until it fails
+ */
+void t_network_backend_local_socket() {
+	network_backends_t *bs;
+	network_backend_t *b;
+	network_address *dst;
+
+	bs = network_backends_new();
+	dst = network_address_new();
+
+	g_assert_cmpint(0, ==, network_address_set_address(dst, "127.0.0.2:3306"));
+	g_assert_cmpint(TRUE, ==, network_address_is_on_host(dst));
+	g_assert_cmpint(0, ==, network_address_set_address(dst, "/tmp/mysql.sock"));
+	g_assert_cmpint(FALSE, ==, network_address_is_on_host(dst));
+
+	network_backends_use_local_sockets(bs, "/tmp/t-network-backend.sock");
+
+	g_assert_cmpint(0, ==, network_backends_add(bs, "127.0.0.1:3307", BACKEND_TYPE_RW));
+	g_assert_cmpint(0, ==, network_backends_add(bs, "192.0.2.1:3306", BACKEND_TYPE_RO));
+
+	/* on this host */
+	b = network_backends_get(bs, 0);
+	network_backend_get_address(b, dst);
+	g_assert_cmpstr(dst->name->str, ==, "/tmp/t-network-backend.sock");
+
+	/* TEST-NET-1 isn't */
+	network_backend_get_address(network_backends_get(bs, 1), dst);
+	g_assert_cmpstr(dst->name->str, ==, "192.0.2.1:3306");
+
+	/* the socket went away: TCP from now on, the backend isn't marked as down */
+	network_backend_get_address(b, dst);
+	g_assert_cmpint(TRUE, ==, network_backend_local_socket_failed(b, dst));
+	g_assert_cmpint(FALSE, ==, network_backend_local_socket_failed(b, dst));
+	network_backend_get_address(b, dst);
+	g_assert_cmpstr(dst->name->str, ==, "127.0.0.1:3307");
+
+	network_address_free(dst);
+	network_backends_free(bs);
+}
+#endif
+
+/**
+ * the connects take turns over the source addresses of the family of the backend
+ */
+void t_network_backend_source_addresses() {
+	network_backends_t *bs;
+	network_backend_t *b;
+	network_address *dst, *src;
+	GError *gerr = NULL;
+
+	bs = network_backends_new();
+	dst = network_address_new();
+	src = network_address_new();
+
+	g_assert_cmpint(0, ==, network_backends_add(bs, "192.0.2.1:3306", BACKEND_TYPE_RW));
+	g_assert_cmpint(0, ==, network_backends_add(bs, "192.0.2.2:3306", BACKEND_TYPE_RO));
+
+	b = network_backends_get(bs, 0);
+	network_backend_get_address(b, dst);
+	g_assert_cmpint(FALSE, ==, network_backend_get_source_address(b, dst, src));
+
+	g_assert_cmpint(0, ==, network_backends_set_source_addresses(bs, "192.0.2.2:3306=198.51.100.9", &gerr));
+	g_assert_cmpint(0, ==, network_backends_set_source_addresses(bs, "198.51.100.1, 198.51.100.2,::1", &gerr));
+
+	g_assert_cmpint(TRUE, ==, network_backend_get_source_address(b, dst, src));
+	g_assert_cmpstr(src->name->str, ==, "198.51.100.1:0");
+	g_assert_cmpint(TRUE, ==, network_backend_get_source_address(b, dst, src));
+	g_assert_cmpstr(src->name->str, ==, "198.51.100.2:0");
+	/* the IPv6 address is skipped for an IPv4 backend */
+	g_assert_cmpint(TRUE, ==, network_backend_get_source_address(b, dst, src));
+	g_assert_cmpstr(src->name->str, ==, "198.51.100.1:0");
+
+	/* the backend keeps its own */
+	b = network_backends_get(bs, 1);
+	network_backend_get_address(b, dst);
+	g_assert_cmpint(TRUE, ==, network_backend_get_source_address(b, dst, src));
+	g_assert_cmpstr(src->name->str, ==, "198.51.100.9:0");
+
+	/* the backends that are added later get the default */
+	g_assert_cmpint(0, ==, network_backends_add(bs, "192.0.2.3:3306", BACKEND_TYPE_RO));
+	b = network_backends_get(bs, 2);
+	network_backend_get_address(b, dst);
+	g_assert_cmpint(TRUE, ==, network_backend_get_source_address(b, dst, src));
+	g_assert_cmpstr(src->name->str, ==, "198.51.100.1:0");
+
+	g_assert_cmpint(-1, ==, network_backends_set_source_addresses(bs, "192.0.2.9:3306=198.51.100.1", &gerr));
+	g_assert_cmpint(gerr->code, ==, NETWORK_BACKENDS_ERROR_SOURCE_PARSE);
+	g_clear_error(&gerr);
+	g_assert_cmpint(-1, ==, network_backends_set_source_addresses(bs, "198.51.100.1,/tmp/mysql.sock", &gerr));
+	g_clear_error(&gerr);
+
+	network_address_free(src);
+	network_address_free(dst);
+	network_backends_free(bs);
+}
+
+/**
+ * the latency histograms of the event-threads are merged on read
+ */
+void t_network_backend_latency_histogram() {
+	network_backend_t *b;
+	network_histogram_t *h;
+	guint64 i;
+
+	b = network_backend_new();
+	network_backend_set_pool_shards(b, 2);
+	h = network_histogram_new();
+
+	for (i = 1; i <= 1000; i++) {
+		network_backend_record_latency(b, 0, NETWORK_BACKEND_LATENCY_QUERY, i);
+		network_backend_record_latency(b, 1, NETWORK_BACKEND_LATENCY_QUERY, 1000 + i);
+	}
+	/* unknown event-threads end up in the first shard */
+	network_backend_record_latency(b, 5, NETWORK_BACKEND_LATENCY_CONNECT, 250);
+
+	network_backend_get_latency(b, NETWORK_BACKEND_LATENCY_QUERY, h);
+	g_assert_cmpint(h->count, ==, 2000);
+	g_assert_cmpint(h->max, ==, 2000);
+
+	/* the buckets are 1/16 wide */
+	g_assert_cmpint(network_histogram_get_percentile(h, 50), >=, 1000);
+	g_assert_cmpint(network_histogram_get_percentile(h, 50), <=, 1000 + 1000 / 16);
+	g_assert_cmpint(network_histogram_get_percentile(h, 99), >=, 1980);
+	g_assert_cmpint(network_histogram_get_percentile(h, 99.9), <=, 2000);
+
+	network_backend_get_latency(b, NETWORK_BACKEND_LATENCY_CONNECT, h);
+	g_assert_cmpint(h->count, ==, 1);
+	g_assert_cmpint(network_histogram_get_percentile(h, 50), ==, 250);
+
+	network_backend_get_latency(b, NETWORK_BACKEND_LATENCY_FIRST_BYTE, h);
+	g_assert_cmpint(h->count, ==, 0);
+	g_assert_cmpint(network_histogram_get_percentile(h, 99), ==, 0);
+
+	/* small values are exact */
+	network_histogram_reset(h);
+	network_histogram_add(h, 3);
+	network_histogram_add(h, 7);
+	g_assert_cmpint(network_histogram_get_percentile(h, 50), ==, 3);
+	g_assert_cmpint(network_histogram_get_percentile(h, 100), ==, 7);
+
+	network_histogram_free(h);
+	network_backend_free(b);
+}
+
 /**
  * check if the timeout handle of backends_check() works 
  *
@@ -128,6 +813,274 @@ void t_network_backends_check() {
 	network_backends_free(backends);
 }
 
+static network_socket *t_pool_socket_new(const char *username, const char *default_db) {
+	network_socket *sock;
+
+	sock = network_socket_new();
+	sock->response = network_mysqld_auth_response_new(0);
+	g_string_assign(sock->response->username, username);
+	g_string_assign(sock->default_db, default_db);
+
+	return sock;
+}
+
+/**
+ * check that the pool prefers the user+default-db and only donates surplus connections
+ */
+void t_network_connection_pool_get() {
+	network_connection_pool *pool;
+	network_socket *sock;
+	GString *user_a = g_string_new("a");
+	GString *user_b = g_string_new("b");
+	GString *user_c = g_string_new("c");
+	GString *db2 = g_string_new("db2");
+	GString *db9 = g_string_new("db9");
+
+	pool = network_connection_pool_new();
+	pool->min_idle_connections = 1;
+
+	network_connection_pool_add(pool, t_pool_socket_new("a", "db1"));
+	network_connection_pool_add(pool, t_pool_socket_new("a", "db2"));
+	network_connection_pool_add(pool, t_pool_socket_new("b", "db1"));
+
+	/* 'a' has one connection more than min-idle, it is the only donor */
+	g_assert(network_connection_pool_get_conns(pool, user_c, NULL) == network_connection_pool_get_conns(pool, user_a, NULL));
+	g_assert_cmpint(pool->donors->length, ==, 1);
+
+	/* take the one with the matching default-db even if it isn't the oldest */
+	sock = network_connection_pool_get(pool, user_a, db2);
+	g_assert(sock);
+	g_assert_cmpstr(sock->default_db->str, ==, "db2");
+	network_socket_free(sock);
+
+	/* no surplus left */
+	g_assert(NULL == network_connection_pool_get(pool, user_c, NULL));
+	g_assert_cmpint(pool->donors->length, ==, 0);
+
+	/* no matching db, any connection of the user is fine */
+	sock = network_connection_pool_get(pool, user_b, db9);
+	g_assert(sock);
+	g_assert_cmpstr(sock->response->username->str, ==, "b");
+	network_socket_free(sock);
+
+	/* the bucket of 'b' is gone */
+	g_assert_cmpint(g_hash_table_size(pool->users), ==, 1);
+
+	network_connection_pool_free(pool);
+
+	g_string_free(user_a, TRUE);
+	g_string_free(user_b, TRUE);
+	g_string_free(user_c, TRUE);
+	g_string_free(db2, TRUE);
+	g_string_free(db9, TRUE);
+}
+
+/**
+ * check that get_full() prefers the connection with the same session state
+ */
+void t_network_connection_pool_get_full() {
+	network_connection_pool *pool;
+	network_socket *sock;
+	GString *user_a = g_string_new("a");
+	GString *db1 = g_string_new("db1");
+
+	pool = network_connection_pool_new();
+
+	sock = t_pool_socket_new("a", "db1");
+	sock->response->charset = 8; /* latin1 */
+	network_connection_pool_add(pool, sock);
+
+	sock = t_pool_socket_new("a", "db1");
+	sock->response->charset = 33; /* utf8 */
+	sock->server_status = 0; /* autocommit off */
+	network_connection_pool_add(pool, sock);
+
+	sock = t_pool_socket_new("a", "db1");
+	sock->response->charset = 33; /* utf8 */
+	network_connection_pool_add(pool, sock);
+
+	sock = network_connection_pool_get_full(pool, user_a, db1, 33, TRUE, FALSE);
+	g_assert(sock);
+	g_assert_cmpint(sock->response->charset, ==, 33);
+	g_assert_cmpint(sock->server_status & SERVER_STATUS_AUTOCOMMIT, !=, 0);
+	network_socket_free(sock);
+	g_assert_cmpint(pool->stats.hits_session, ==, 1);
+
+	/* no session-match left, fall back to the same default-db */
+	sock = network_connection_pool_get_full(pool, user_a, db1, 33, TRUE, FALSE);
+	g_assert(sock);
+	network_socket_free(sock);
+	g_assert_cmpint(pool->stats.hits_default_db, ==, 1);
+
+	/* CLIENT_DEPRECATE_EOF is fixed by the handshake, only a client that uses it too gets the connection */
+	sock = t_pool_socket_new("a", "db1");
+	sock->challenge = network_mysqld_auth_challenge_new();
+	sock->challenge->capabilities = CLIENT_DEPRECATE_EOF;
+	sock->response->client_capabilities = CLIENT_DEPRECATE_EOF;
+	sock->response->charset = 33; /* utf8 */
+	network_connection_pool_add(pool, sock);
+
+	sock = network_connection_pool_get_full(pool, user_a, db1, 33, TRUE, TRUE);
+	g_assert(sock);
+	g_assert(network_mysqld_socket_is_deprecate_eof(sock));
+	network_socket_free(sock);
+	g_assert_cmpint(pool->stats.hits_session, ==, 2);
+
+	g_assert(NULL == network_connection_pool_get_full(pool, user_a, db1, 33, TRUE, TRUE));
+
+	sock = network_connection_pool_get_full(pool, user_a, db1, 33, TRUE, FALSE);
+	g_assert(sock);
+	g_assert(!network_mysqld_socket_is_deprecate_eof(sock));
+	network_socket_free(sock);
+
+	network_connection_pool_free(pool);
+
+	g_string_free(user_a, TRUE);
+	g_string_free(db1, TRUE);
+}
+
+/**
+ * a multiplexed client only takes over its own sessions
+ */
+void t_network_connection_pool_get_session() {
+	network_connection_pool *pool;
+	network_socket *sock;
+	network_socket *client;
+	GString *db1 = g_string_new("db1");
+
+	pool = network_connection_pool_new();
+
+	network_connection_pool_add(pool, t_pool_socket_new("b", "db1")); /* a donor */
+
+	sock = t_pool_socket_new("a", "db1");
+	sock->response->charset = 8;
+	network_connection_pool_add(pool, sock);
+
+	client = t_pool_socket_new("a", "db1");
+	client->response->charset = 33;
+
+	/* neither the donor nor the other charset qualify */
+	g_assert(NULL == network_connection_pool_get_session(pool, client->response, db1, TRUE));
+	g_assert_cmpint(pool->stats.misses, ==, 1);
+
+	client->response->charset = 8;
+	sock = network_connection_pool_get_session(pool, client->response, db1, TRUE);
+	g_assert(sock);
+	g_assert_cmpint(pool->stats.hits_session, ==, 1);
+	network_socket_free(sock);
+
+	network_socket_free(client);
+	network_connection_pool_free(pool);
+
+	g_string_free(db1, TRUE);
+}
+
+static void t_pool_wakeup(network_connection_pool_waiter G_GNUC_UNUSED *waiter, gpointer user_data) {
+	guint *woken = user_data;
+
+	(*woken)++;
+}
+
+/**
+ * a multiplexed client whose session is taken by another client waits for it to come back
+ */
+void t_network_connection_pool_wait() {
+	network_connection_pool *pool;
+	network_connection_pool_waiter *waiter_a, *waiter_b;
+	network_socket *sock;
+	network_socket *client;
+	GString *db1 = g_string_new("db1");
+	GString *user_b = g_string_new("b");
+	guint woken_a = 0, woken_b = 0;
+
+	pool = network_connection_pool_new();
+
+	client = t_pool_socket_new("a", "db1");
+
+	waiter_a = network_connection_pool_waiter_new(pool, client->response->username, t_pool_wakeup, &woken_a);
+	waiter_b = network_connection_pool_waiter_new(pool, user_b, t_pool_wakeup, &woken_b);
+
+	/* the pool is exhausted, the clients queue up */
+	g_assert(NULL == network_connection_pool_get_session(pool, client->response, db1, TRUE));
+	network_connection_pool_wait(waiter_a);
+	network_connection_pool_wait(waiter_a); /* already waiting */
+	network_connection_pool_wait(waiter_b);
+	g_assert_cmpint(pool->waiters->length, ==, 2);
+
+	/* a connection of another user doesn't wake us up */
+	network_connection_pool_add(pool, t_pool_socket_new("c", "db1"));
+	g_assert_cmpint(woken_a, ==, 0);
+	g_assert_cmpint(woken_b, ==, 0);
+
+	/* the session comes back, only the waiter of its user is woken up and takes it */
+	network_connection_pool_add(pool, t_pool_socket_new("a", "db1"));
+	g_assert_cmpint(woken_a, ==, 1);
+	g_assert_cmpint(woken_b, ==, 0);
+	g_assert(!waiter_a->is_waiting);
+	g_assert_cmpint(pool->waiters->length, ==, 1);
+
+	sock = network_connection_pool_get_session(pool, client->response, db1, TRUE);
+	g_assert(sock);
+	network_socket_free(sock);
+
+	/* a connection of the user with another charset doesn't fit, the client waits again */
+	network_connection_pool_wait(waiter_a);
+
+	sock = t_pool_socket_new("a", "db1");
+	sock->response->charset = 8;
+	network_connection_pool_add(pool, sock);
+	g_assert_cmpint(woken_a, ==, 2);
+
+	g_assert(NULL == network_connection_pool_get_session(pool, client->response, db1, TRUE));
+	network_connection_pool_wait(waiter_a);
+	g_assert_cmpint(pool->waiters->length, ==, 2);
+
+	/* ... until its wait-timeout cancels it */
+	network_connection_pool_cancel_wait(waiter_a);
+	g_assert(!waiter_a->is_waiting);
+	g_assert_cmpint(pool->waiters->length, ==, 1);
+
+	/* the waiters outlive the pool */
+	network_connection_pool_free(pool);
+	g_assert(!waiter_b->is_waiting);
+	g_assert(NULL == waiter_b->pool);
+
+	network_connection_pool_wait(waiter_b);
+	g_assert(!waiter_b->is_waiting);
+
+	network_connection_pool_waiter_free(waiter_a);
+	network_connection_pool_waiter_free(waiter_b);
+	network_socket_free(client);
+
+	g_string_free(db1, TRUE);
+	g_string_free(user_b, TRUE);
+}
+
+/**
+ * check that connections idling for too long are closed
+ */
+void t_network_connection_pool_expire() {
+	network_connection_pool *pool;
+	network_connection_pool_entry *entry;
+	GTimeVal now;
+
+	pool = network_connection_pool_new();
+
+	entry = network_connection_pool_add(pool, t_pool_socket_new("a", "db1"));
+	entry->added_ts.tv_sec -= 100; /* pretend it is idling for a while */
+	network_connection_pool_add(pool, t_pool_socket_new("a", "db1"));
+	entry = network_connection_pool_add(pool, t_pool_socket_new("b", "db1"));
+	entry->added_ts.tv_sec -= 100;
+
+	g_get_current_time(&now);
+
+	g_assert_cmpint(network_connection_pool_expire(pool, &now, 60), ==, 2);
+	g_assert_cmpint(g_hash_table_size(pool->users), ==, 1);
+	g_assert_cmpint(network_connection_pool_expire(pool, &now, 60), ==, 0);
+
+	network_connection_pool_free(pool);
+}
+
 int main(int argc, char **argv) {
 #ifdef WIN32
 	WSADATA wsaData;
@@ -148,6 +1101,28 @@ int main(int argc, char **argv) {
 	g_test_add_func("/core/network_backend_new", t_network_backend_new);
 	g_test_add_func("/core/network_backends_add", t_network_backends_add);
 	g_test_add_func("/core/network_backends_check", t_network_backends_check);
+	g_test_add_func("/core/network_backends_snapshot", t_network_backends_snapshot);
+	g_test_add_func("/core/network_backends_pool_shards", t_network_backends_pool_shards);
+	g_test_add_func("/core/network_backends_get_least_connected", t_network_backends_get_least_connected);
+	g_test_add_func("/core/network_backends_group", t_network_backends_group);
+	g_test_add_func("/core/network_backends_get_least_latency", t_network_backends_get_least_latency);
+	g_test_add_func("/core/network_backends_get_least_latency_at_pos", t_network_backends_get_least_latency_at_pos);
+	g_test_add_func("/core/network_backends_get_by_key_at_pos", t_network_backends_get_by_key_at_pos);
+	g_test_add_func("/core/network_backends_get_by_key_bounded_load", t_network_backends_get_by_key_bounded_load);
+	g_test_add_func("/core/network_backend_connect_failed", t_network_backend_connect_failed);
+	g_test_add_func("/core/network_backends_breaker", t_network_backends_breaker);
+	g_test_add_func("/core/network_backends_reload", t_network_backends_reload);
+	g_test_add_func("/core/network_backend_resolved", t_network_backend_resolved);
+#ifndef WIN32
+	g_test_add_func("/core/network_backend_local_socket", t_network_backend_local_socket);
+#endif
+	g_test_add_func("/core/network_backend_source_addresses", t_network_backend_source_addresses);
+	g_test_add_func("/core/network_backend_latency_histogram", t_network_backend_latency_histogram);
+	g_test_add_func("/core/network_connection_pool_get", t_network_connection_pool_get);
+	g_test_add_func("/core/network_connection_pool_get_full", t_network_connection_pool_get_full);
+	g_test_add_func("/core/network_connection_pool_get_session", t_network_connection_pool_get_session);
+	g_test_add_func("/core/network_connection_pool_wait", t_network_connection_pool_wait);
+	g_test_add_func("/core/network_connection_pool_expire", t_network_connection_pool_expire);
 
 	return g_test_run();
 }
@@ -0,0 +1,150 @@
+/* $%BEGINLICENSE%$
+ Copyright (c) 2008, 2012, Oracle and/or its affiliates. All rights reserved.
+
+ This program is free software; you can redistribute it and/or
+ modify it under the terms of the GNU General Public License as
+ published by the Free Software Foundation; version 2 of the
+ License.
+
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ GNU General Public License for more details.
+
+ You should have received a copy of the GNU General Public License
+ along with this program; if not, write to the Free Software
+ Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA
+ 02110-1301  USA
+
+ $%ENDLICENSE%$ */
+#include <string.h>
+#include <stdlib.h>
+#ifndef WIN32
+#include <unistd.h>
+#else
+#include <io.h>
+#endif
+
+#include <glib.h>
+#include <glib/gstdio.h>
+
+#include "network-capture.h"
+
+#if GLIB_CHECK_VERSION(2, 16, 0)
+#define C(x) x, sizeof(x) - 1
+
+/**
+ * the records come back in the order they were pushed
+ */
+void t_network_capture_write_read() {
+	network_capture_t *capture;
+	network_capture_reader_t *reader;
+	network_capture_record_t *record;
+	GError *gerr = NULL;
+	gchar *filename;
+	guint32 con_id;
+	int fd;
+
+	fd = g_file_open_tmp(NULL, &filename, &gerr);
+	g_assert_cmpint(-1, !=, fd);
+	close(fd);
+
+	capture = network_capture_new();
+	g_assert_cmpint(FALSE, ==, network_capture_is_open(capture));
+	g_assert_cmpint(0, ==, network_capture_open(capture, filename, &gerr));
+	g_assert_cmpint(TRUE, ==, network_capture_is_open(capture));
+
+	con_id = network_capture_con_id_new(capture);
+	g_assert_cmpint(con_id, ==, 1);
+	g_assert_cmpint(network_capture_con_id_new(capture), ==, 2);
+
+	g_assert_cmpint(TRUE, ==, network_capture_push(capture, con_id, NETWORK_CAPTURE_CONNECT, C("root\0test")));
+	g_assert_cmpint(TRUE, ==, network_capture_push(capture, con_id, NETWORK_CAPTURE_PACKET, C("\x09\x00\x00\x00\x03SELECT 1")));
+	g_assert_cmpint(TRUE, ==, network_capture_push(capture, con_id, NETWORK_CAPTURE_CLOSE, NULL, 0));
+
+	/* flushes the queue */
+	network_capture_free(capture);
+
+	reader = network_capture_reader_open(filename, &gerr);
+	g_assert(NULL != reader);
+
+	record = network_capture_record_new();
+
+	g_assert_cmpint(1, ==, network_capture_reader_next(reader, record));
+	g_assert_cmpint(record->con_id, ==, 1);
+	g_assert_cmpint(record->type, ==, NETWORK_CAPTURE_CONNECT);
+	g_assert_cmpint(record->payload->len, ==, sizeof("root\0test") - 1);
+	g_assert_cmpint(0, ==, memcmp(record->payload->str, C("root\0test")));
+	g_assert_cmpint(record->ts_usec, >, 0);
+
+	g_assert_cmpint(1, ==, network_capture_reader_next(reader, record));
+	g_assert_cmpint(record->type, ==, NETWORK_CAPTURE_PACKET);
+	g_assert_cmpint(0, ==, memcmp(record->payload->str, C("\x09\x00\x00\x00\x03SELECT 1")));
+
+	g_assert_cmpint(1, ==, network_capture_reader_next(reader, record));
+	g_assert_cmpint(record->type, ==, NETWORK_CAPTURE_CLOSE);
+	g_assert_cmpint(record->payload->len, ==, 0);
+
+	g_assert_cmpint(0, ==, network_capture_reader_next(reader, record));
+
+	network_capture_record_free(record);
+	network_capture_reader_free(reader);
+
+	g_unlink(filename);
+	g_free(filename);
+}
+
+/**
+ * a file without the magic isn't read, a truncated record is an error
+ */
+void t_network_capture_invalid() {
+	network_capture_reader_t *reader;
+	network_capture_record_t *record;
+	GString *content = g_string_new(NULL);
+	GError *gerr = NULL;
+	gchar *filename;
+	int fd;
+
+	fd = g_file_open_tmp(NULL, &filename, &gerr);
+	g_assert_cmpint(-1, !=, fd);
+	close(fd);
+
+	g_assert_cmpint(TRUE, ==, g_file_set_contents(filename, C("{\"ts\":1}\n"), &gerr));
+	g_assert(NULL == network_capture_reader_open(filename, &gerr));
+	g_assert_cmpint(gerr->code, ==, NETWORK_CAPTURE_ERROR_FORMAT);
+	g_clear_error(&gerr);
+
+	g_string_append_len(content, C(NETWORK_CAPTURE_MAGIC));
+	network_capture_record_append(content, 1, 1, NETWORK_CAPTURE_PACKET, C("\x01\x00\x00\x00\x0e"));
+	g_string_truncate(content, content->len - 1);
+	g_assert_cmpint(TRUE, ==, g_file_set_contents(filename, content->str, content->len, &gerr));
+
+	reader = network_capture_reader_open(filename, &gerr);
+	g_assert(NULL != reader);
+
+	record = network_capture_record_new();
+	g_assert_cmpint(-1, ==, network_capture_reader_next(reader, record));
+	network_capture_record_free(record);
+
+	network_capture_reader_free(reader);
+	g_string_free(content, TRUE);
+
+	g_unlink(filename);
+	g_free(filename);
+}
+
+int main(int argc, char **argv) {
+	g_thread_init(NULL);
+	g_test_init(&argc, &argv, NULL);
+	g_test_bug_base("http://bugs.mysql.com/");
+
+	g_test_add_func("/core/network_capture_write_read", t_network_capture_write_read);
+	g_test_add_func("/core/network_capture_invalid", t_network_capture_invalid);
+
+	return g_test_run();
+}
+#else
+int main() {
+	return 77;
+}
+#endif
@@ -0,0 +1,220 @@
+/* $%BEGINLICENSE%$
+ Copyright (c) 2008, 2012, Oracle and/or its affiliates. All rights reserved.
+
+ This program is free software; you can redistribute it and/or
+ modify it under the terms of the GNU General Public License as
+ published by the Free Software Foundation; version 2 of the
+ License.
+
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ GNU General Public License for more details.
+
+ You should have received a copy of the GNU General Public License
+ along with this program; if not, write to the Free Software
+ Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA
+ 02110-1301  USA
+
+ $%ENDLICENSE%$ */
+#include <string.h>
+#include <unistd.h>
+
+#include <glib.h>
+
+#include "network-query-digest.h"
+#include "network-firewall.h"
+
+#if GLIB_CHECK_VERSION(2, 16, 0)
+#define C(x) x, sizeof(x) - 1
+
+static gchar *t_rules_file(const char *contents) {
+	gchar *filename;
+	GError *gerr = NULL;
+	int fd;
+
+	fd = g_file_open_tmp("t_network_firewall-XXXXXX", &filename, &gerr);
+	g_assert_no_error(gerr);
+	close(fd);
+
+	g_assert_cmpint(TRUE, ==, g_file_set_contents(filename, contents, -1, NULL));
+
+	return filename;
+}
+
+/**
+ * @return the index of the rule that matches the query, -1 if none
+ */
+static gint t_match(network_firewall_rules_t *rules, const char *query) {
+	GString *fingerprint = g_string_new(NULL);
+	network_firewall_rule_t *rule;
+	guint64 hash;
+	guint i;
+
+	network_query_digest_fingerprint(fingerprint, &hash, query, strlen(query));
+	rule = network_firewall_rules_match(rules, fingerprint->str, fingerprint->len);
+	g_string_free(fingerprint, TRUE);
+
+	if (!rule) return -1;
+
+	for (i = 0; i < rules->rules->len; i++) {
+		if (rules->rules->pdata[i] == rule) return i;
+	}
+
+	g_assert_not_reached();
+
+	return -1;
+}
+
+/**
+ * a query matches the whole fingerprint, a prefix its start and contains any part of it
+ */
+void t_network_firewall_rules_match() {
+	network_firewall_rules_t *rules = network_firewall_rules_new();
+
+	g_assert_cmpint(-1, ==, t_match(rules, "SELECT 1"));
+
+	g_assert_cmpint(0, ==, network_firewall_rules_add(rules, NETWORK_FIREWALL_ALLOW, NETWORK_FIREWALL_MATCH_QUERY, C("SELECT * FROM orders WHERE id = 1"), NULL));
+	g_assert_cmpint(0, ==, network_firewall_rules_add(rules, NETWORK_FIREWALL_DENY, NETWORK_FIREWALL_MATCH_PREFIX, C("DELETE FROM orders"), NULL));
+	g_assert_cmpint(0, ==, network_firewall_rules_add(rules, NETWORK_FIREWALL_DENY, NETWORK_FIREWALL_MATCH_CONTAINS, C("sleep("), NULL));
+	g_assert_cmpint(0, ==, network_firewall_rules_add(rules, NETWORK_FIREWALL_DENY, NETWORK_FIREWALL_MATCH_CONTAINS, C("FROM orders"), NULL));
+	network_firewall_rules_compile(rules);
+
+	/* the literals and the case don't matter */
+	g_assert_cmpint(0, ==, t_match(rules, "select *   from ORDERS where id = 42"));
+	g_assert_cmpint(3, ==, t_match(rules, "SELECT * FROM orders WHERE id = 1 AND status = 'new'"));
+	g_assert_cmpint(3, ==, t_match(rules, "SELECT id FROM orders"));
+
+	g_assert_cmpint(1, ==, t_match(rules, "DELETE FROM orders WHERE id = 1"));
+	g_assert_cmpint(3, ==, t_match(rules, "/* cleanup */ SELECT 1; DELETE FROM orders"));
+
+	g_assert_cmpint(2, ==, t_match(rules, "SELECT SLEEP(10)"));
+	g_assert_cmpint(2, ==, t_match(rules, "SELECT * FROM orders WHERE id = 1 OR sleep(1)"));
+
+	g_assert_cmpint(-1, ==, t_match(rules, "SELECT * FROM customers"));
+	g_assert_cmpint(-1, ==, t_match(rules, "SELECT sleep"));
+	g_assert_cmpint(-1, ==, t_match(rules, ""));
+
+	/* the pattern can't be empty */
+	g_assert_cmpint(-1, ==, network_firewall_rules_add(rules, NETWORK_FIREWALL_DENY, NETWORK_FIREWALL_MATCH_CONTAINS, C("  /* */ "), NULL));
+
+	network_firewall_rules_free(rules);
+}
+
+/**
+ * patterns that share a prefix or are part of each other
+ */
+void t_network_firewall_rules_match_overlap() {
+	network_firewall_rules_t *rules = network_firewall_rules_new();
+
+	g_assert_cmpint(0, ==, network_firewall_rules_add(rules, NETWORK_FIREWALL_DENY, NETWORK_FIREWALL_MATCH_CONTAINS, C("abcd"), NULL));
+	g_assert_cmpint(0, ==, network_firewall_rules_add(rules, NETWORK_FIREWALL_DENY, NETWORK_FIREWALL_MATCH_CONTAINS, C("bc"), NULL));
+	g_assert_cmpint(0, ==, network_firewall_rules_add(rules, NETWORK_FIREWALL_DENY, NETWORK_FIREWALL_MATCH_PREFIX, C("abx"), NULL));
+	g_assert_cmpint(0, ==, network_firewall_rules_add(rules, NETWORK_FIREWALL_DENY, NETWORK_FIREWALL_MATCH_QUERY, C("bcd"), NULL));
+	network_firewall_rules_compile(rules);
+
+	g_assert_cmpint(0, ==, t_match(rules, "xabcdx"));
+	g_assert_cmpint(1, ==, t_match(rules, "xabcx"));
+	g_assert_cmpint(1, ==, t_match(rules, "abxbc"));
+	g_assert_cmpint(2, ==, t_match(rules, "abx"));
+	g_assert_cmpint(1, ==, t_match(rules, "bcd"));
+	g_assert_cmpint(-1, ==, t_match(rules, "aabx"));
+
+	network_firewall_rules_free(rules);
+}
+
+/**
+ * the rules of a file, the first rule that matches decides
+ */
+void t_network_firewall_check() {
+	network_firewall_t *fw = network_firewall_new();
+	network_firewall_rules_t *rules;
+	network_firewall_rule_t *rule;
+	GError *gerr = NULL;
+	gchar *filename;
+
+	/* without rules all queries are allowed */
+	g_assert_cmpint(FALSE, ==, network_firewall_is_enabled(fw));
+	g_assert_cmpint(NETWORK_FIREWALL_ALLOW, ==, network_firewall_check(fw, C("DROP TABLE orders")));
+
+	g_assert_cmpint(-1, ==, network_firewall_reload(fw, &gerr));
+	g_assert_error(gerr, NETWORK_FIREWALL_ERROR, NETWORK_FIREWALL_ERROR_NOT_LOADED);
+	g_clear_error(&gerr);
+
+	filename = t_rules_file(
+			"# the reports only read\n"
+			"default deny\n"
+			"\n"
+			"deny  contains  SLEEP(\n"
+			"allow prefix    SELECT\n"
+			"allow query     SET NAMES utf8\n");
+
+	g_assert_cmpint(0, ==, network_firewall_load(fw, filename, &gerr));
+	g_assert_no_error(gerr);
+	g_assert_cmpint(TRUE, ==, network_firewall_is_enabled(fw));
+
+	g_assert_cmpint(NETWORK_FIREWALL_ALLOW, ==, network_firewall_check(fw, C("SELECT ?")));
+	g_assert_cmpint(NETWORK_FIREWALL_ALLOW, ==, network_firewall_check(fw, C("SELECT * FROM orders")));
+	g_assert_cmpint(NETWORK_FIREWALL_DENY, ==, network_firewall_check(fw, C("SELECT sleep(?)")));
+	g_assert_cmpint(NETWORK_FIREWALL_ALLOW, ==, network_firewall_check(fw, C("set names utf8")));
+	g_assert_cmpint(NETWORK_FIREWALL_DENY, ==, network_firewall_check(fw, C("SET NAMES latin1")));
+	g_assert_cmpint(NETWORK_FIREWALL_DENY, ==, network_firewall_check(fw, C("DROP TABLE orders")));
+
+	rules = network_firewall_get_rules(fw);
+	g_assert_cmpint(rules->rules->len, ==, 3);
+	g_assert_cmpint(rules->default_action, ==, NETWORK_FIREWALL_DENY);
+	g_assert_cmpint(rules->default_hits, ==, 2);
+
+	rule = rules->rules->pdata[0];
+	g_assert_cmpint(rule->action, ==, NETWORK_FIREWALL_DENY);
+	g_assert_cmpint(rule->match, ==, NETWORK_FIREWALL_MATCH_CONTAINS);
+	g_assert_cmpstr(rule->pattern->str, ==, "SLEEP(");
+	g_assert_cmpint(rule->hits, ==, 1);
+
+	rule = rules->rules->pdata[1];
+	g_assert_cmpint(rule->hits, ==, 2);
+
+	/* a broken file keeps the old rules */
+	g_assert_cmpint(TRUE, ==, g_file_set_contents(filename, "deny everything\n", -1, NULL));
+	g_assert_cmpint(-1, ==, network_firewall_reload(fw, &gerr));
+	g_assert_error(gerr, NETWORK_FIREWALL_ERROR, NETWORK_FIREWALL_ERROR_PARSE);
+	g_clear_error(&gerr);
+	g_assert(rules == network_firewall_get_rules(fw));
+
+	g_assert_cmpint(TRUE, ==, g_file_set_contents(filename, "deny prefix DROP\n", -1, NULL));
+	g_assert_cmpint(0, ==, network_firewall_reload(fw, &gerr));
+	g_assert_no_error(gerr);
+	g_assert(rules != network_firewall_get_rules(fw));
+	g_assert_cmpint(NETWORK_FIREWALL_ALLOW, ==, network_firewall_check(fw, C("SELECT sleep(?)")));
+	g_assert_cmpint(NETWORK_FIREWALL_DENY, ==, network_firewall_check(fw, C("drop table orders")));
+
+	g_assert_cmpint(TRUE, ==, g_file_set_contents(filename, "default block\n", -1, NULL));
+	g_assert_cmpint(-1, ==, network_firewall_reload(fw, &gerr));
+	g_assert_error(gerr, NETWORK_FIREWALL_ERROR, NETWORK_FIREWALL_ERROR_PARSE);
+	g_clear_error(&gerr);
+
+	unlink(filename);
+	g_assert_cmpint(-1, ==, network_firewall_reload(fw, &gerr));
+	g_assert_error(gerr, NETWORK_FIREWALL_ERROR, NETWORK_FIREWALL_ERROR_READ);
+	g_clear_error(&gerr);
+
+	g_free(filename);
+	network_firewall_free(fw);
+}
+
+int main(int argc, char **argv) {
+	g_thread_init(NULL);
+	g_test_init(&argc, &argv, NULL);
+	g_test_bug_base("http://bugs.mysql.com/");
+
+	g_test_add_func("/core/network_firewall_rules_match", t_network_firewall_rules_match);
+	g_test_add_func("/core/network_firewall_rules_match_overlap", t_network_firewall_rules_match_overlap);
+	g_test_add_func("/core/network_firewall_check", t_network_firewall_check);
+
+	return g_test_run();
+}
+#else
+int main() {
+	return 77;
+}
+#endif
@@ -0,0 +1,100 @@
+/* $%BEGINLICENSE%$
+ Copyright (c) 2008, 2012, Oracle and/or its affiliates. All rights reserved.
+
+ This program is free software; you can redistribute it and/or
+ modify it under the terms of the GNU General Public License as
+ published by the Free Software Foundation; version 2 of the
+ License.
+
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ GNU General Public License for more details.
+
+ You should have received a copy of the GNU General Public License
+ along with this program; if not, write to the Free Software
+ Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA
+ 02110-1301  USA
+
+ $%ENDLICENSE%$ */
+#include <glib.h>
+
+#include "network-flow-control.h"
+
+#if GLIB_CHECK_VERSION(2, 16, 0)
+/**
+ * a connection pauses above its high watermark and resumes below its low watermark
+ */
+void t_network_flow_control_watermarks() {
+	network_flow_control_t *fc = network_flow_control_new();
+	gsize accounted = 0;
+
+	g_assert_cmpint(FALSE, ==, network_flow_control_should_pause(fc, &accounted, 1000, 64 * 1024, 16 * 1024));
+	g_assert_cmpint(1000, ==, accounted);
+	g_assert_cmpint(1000, ==, network_flow_control_get_buffered(fc));
+
+	g_assert_cmpint(TRUE, ==, network_flow_control_should_pause(fc, &accounted, 100 * 1024, 64 * 1024, 16 * 1024));
+	g_assert_cmpint(100 * 1024, ==, network_flow_control_get_buffered(fc));
+	g_assert_cmpint(1, ==, network_flow_control_get_pauses(fc));
+
+	/* the client took some, but not enough */
+	g_assert_cmpint(FALSE, ==, network_flow_control_may_resume(fc, 32 * 1024, 16 * 1024));
+	g_assert_cmpint(TRUE, ==, network_flow_control_may_resume(fc, 16 * 1024, 16 * 1024));
+	g_assert_cmpint(TRUE, ==, network_flow_control_may_resume(fc, 0, 0));
+
+	/* the result is done */
+	network_flow_control_account(fc, &accounted, 0);
+	g_assert_cmpint(0, ==, accounted);
+	g_assert_cmpint(0, ==, network_flow_control_get_buffered(fc));
+
+	network_flow_control_free(fc);
+}
+
+/**
+ * over the budget the connections pause at their low watermark and resume with a empty send-queue
+ */
+void t_network_flow_control_budget() {
+	network_flow_control_t *fc = network_flow_control_new();
+	gsize accounted[2] = { 0, 0 };
+
+	network_flow_control_set_budget(fc, 100 * 1024);
+
+	g_assert_cmpint(FALSE, ==, network_flow_control_should_pause(fc, &accounted[0], 60 * 1024, 64 * 1024, 16 * 1024));
+
+	/* the second one goes over the budget and pauses below its high watermark */
+	g_assert_cmpint(TRUE, ==, network_flow_control_should_pause(fc, &accounted[1], 50 * 1024, 64 * 1024, 16 * 1024));
+	g_assert_cmpint(110 * 1024, ==, network_flow_control_get_buffered(fc));
+
+	/* below the low watermark it doesn't pause, even over the budget */
+	network_flow_control_account(fc, &accounted[1], 100 * 1024);
+	g_assert_cmpint(FALSE, ==, network_flow_control_should_pause(fc, &accounted[0], 10 * 1024, 64 * 1024, 16 * 1024));
+	g_assert_cmpint(110 * 1024, ==, network_flow_control_get_buffered(fc));
+
+	g_assert_cmpint(FALSE, ==, network_flow_control_may_resume(fc, 10 * 1024, 16 * 1024));
+	g_assert_cmpint(TRUE, ==, network_flow_control_may_resume(fc, 0, 16 * 1024));
+
+	/* back under the budget, the low watermark counts again */
+	network_flow_control_account(fc, &accounted[1], 0);
+	g_assert_cmpint(TRUE, ==, network_flow_control_may_resume(fc, 10 * 1024, 16 * 1024));
+
+	network_flow_control_account(fc, &accounted[0], 0);
+	g_assert_cmpint(0, ==, network_flow_control_get_buffered(fc));
+
+	network_flow_control_free(fc);
+}
+
+int main(int argc, char **argv) {
+	g_thread_init(NULL);
+	g_test_init(&argc, &argv, NULL);
+	g_test_bug_base("http://bugs.mysql.com/");
+
+	g_test_add_func("/core/network_flow_control_watermarks", t_network_flow_control_watermarks);
+	g_test_add_func("/core/network_flow_control_budget", t_network_flow_control_budget);
+
+	return g_test_run();
+}
+#else
+int main() {
+	return 77;
+}
+#endif
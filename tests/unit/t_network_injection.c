@@ -20,6 +20,7 @@
 #include <glib.h>
 
 #include "network-injection.h"
+#include "network-mysqld-proto.h"
 
 #if GLIB_CHECK_VERSION(2, 16, 0)
 #define C(x) x, sizeof(x) - 1
@@ -48,6 +49,29 @@ void t_network_injection_new_null() {
 	injection_free(inj);
 }
 
+/**
+ * a freed injection and its query buffer are reused by the next one
+ */
+void t_network_injection_new_len() {
+	injection *inj, *inj_2;
+	GString *query;
+
+	inj = injection_new_len(1, C("SELECT 1"));
+	g_assert_cmpstr(inj->query->str, ==, "SELECT 1");
+	inj->resultset_is_needed = TRUE;
+	query = inj->query;
+	injection_free(inj);
+
+	inj_2 = injection_new_len(2, C("SELECT 22"));
+	g_assert(inj_2 == inj);
+	g_assert(inj_2->query == query);
+	g_assert_cmpint(inj_2->id, ==, 2);
+	g_assert_cmpint(inj_2->resultset_is_needed, ==, FALSE);
+	g_assert_cmpstr(inj_2->query->str, ==, "SELECT 22");
+
+	injection_free(inj_2);
+}
+
 void t_network_injection_queue_new() {
 	network_injection_queue *q;
 
@@ -113,6 +137,67 @@ void t_network_injection_queue_reset() {
 	network_injection_queue_free(q);
 }
 
+/**
+ * the result-sets of a multi-statement are split at SERVER_MORE_RESULTS_EXISTS
+ */
+void t_proxy_resultset_get_next() {
+	const struct {
+		const char *s;
+		gsize s_len;
+	} packets[] = {
+		{ C("\7\0\0\1\0\1\0\10\0\0\0") }, /* OK, more results */
+		{ C("\1\0\0\1\1") },
+		{ C("&\0\0\2\3def\0\6STATUS\0\5Value\5Value\f\10\0\0\2\0\0\375\1\0\0\0\0") },
+		{ C("\5\0\0\3\376\0\0\12\0") },
+		{ C("\3\0\0\4\00298") },
+		{ C("\2\0\0\5\0011") },
+		{ C("\5\0\0\6\376\1\0\12\0") }, /* EOF, more results */
+		{ C("\7\0\0\7\0\0\0\2\0\0\0") }  /* OK, the last one */
+	};
+	GQueue *result_queue = g_queue_new();
+	proxy_resultset_t *res, *res_1, *res_2;
+	GString *s;
+	gsize i;
+
+	for (i = 0; i < G_N_ELEMENTS(packets); i++) {
+		g_queue_push_tail(result_queue, g_string_new_len(packets[i].s, packets[i].s_len));
+	}
+
+	res = proxy_resultset_new();
+	res->result_queue = result_queue;
+	res->head = result_queue->head;
+
+	res_1 = proxy_resultset_get_next(res);
+	g_assert(res_1);
+	g_assert(res_1->head == g_queue_peek_nth_link(result_queue, 1));
+	g_assert_cmpint(2, ==, res_1->rows);
+	g_assert_cmpint(TRUE, ==, res_1->qstat.was_resultset);
+	g_assert_cmpint(MYSQLD_PACKET_OK, ==, res_1->qstat.query_status);
+	g_assert_cmpint(1, ==, res_1->qstat.warning_count);
+	g_assert_cmpint(SERVER_STATUS_AUTOCOMMIT | SERVER_MORE_RESULTS_EXISTS, ==, res_1->qstat.server_status);
+
+	res_2 = proxy_resultset_get_next(res_1);
+	g_assert(res_2);
+	g_assert(res_2->head == result_queue->tail);
+	g_assert_cmpint(0, ==, res_2->rows);
+	g_assert_cmpint(FALSE, ==, res_2->qstat.was_resultset);
+	g_assert_cmpint(SERVER_STATUS_AUTOCOMMIT, ==, res_2->qstat.server_status);
+
+	g_assert(NULL == proxy_resultset_get_next(res_2));
+
+	/* a response that ends early has no next result-set */
+	s = g_queue_pop_tail(result_queue);
+	g_string_free(s, TRUE);
+	g_assert(NULL == proxy_resultset_get_next(res_1));
+
+	proxy_resultset_free(res);
+	proxy_resultset_free(res_1);
+	proxy_resultset_free(res_2);
+
+	while ((s = g_queue_pop_head(result_queue))) g_string_free(s, TRUE);
+	g_queue_free(result_queue);
+}
+
 int main(int argc, char **argv) {
 	g_thread_init(NULL);
 	g_test_init(&argc, &argv, NULL);
@@ -120,10 +205,12 @@ int main(int argc, char **argv) {
 
 	g_test_add_func("/core/network_injection_new", t_network_injection_new);
 	g_test_add_func("/core/network_injection_new_null", t_network_injection_new_null);
+	g_test_add_func("/core/network_injection_new_len", t_network_injection_new_len);
 	g_test_add_func("/core/network_injection_queue_new", t_network_injection_queue_new);
 	g_test_add_func("/core/network_injection_queue_append", t_network_injection_queue_append);
 	g_test_add_func("/core/network_injection_queue_prepend", t_network_injection_queue_prepend);
 	g_test_add_func("/core/network_injection_queue_reset", t_network_injection_queue_reset);
+	g_test_add_func("/core/proxy_resultset_get_next", t_proxy_resultset_get_next);
 
 	return g_test_run();
 }
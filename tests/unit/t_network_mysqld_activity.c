@@ -0,0 +1,173 @@
+/* $%BEGINLICENSE%$
+ Copyright (c) 2008, 2012, Oracle and/or its affiliates. All rights reserved.
+
+ This program is free software; you can redistribute it and/or
+ modify it under the terms of the GNU General Public License as
+ published by the Free Software Foundation; version 2 of the
+ License.
+
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ GNU General Public License for more details.
+
+ You should have received a copy of the GNU General Public License
+ along with this program; if not, write to the Free Software
+ Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA
+ 02110-1301  USA
+
+ $%ENDLICENSE%$ */
+#include <string.h>
+
+#include <glib.h>
+#include <mysql.h>
+
+#include "network-mysqld-activity.h"
+
+#if GLIB_CHECK_VERSION(2, 16, 0)
+#define C(x) x, sizeof(x) - 1
+
+/**
+ * a statement runs until its result is in, the transaction starts with the statement
+ * that opened it and ends when the server doesn't report it anymore
+ */
+static void t_network_mysqld_activity_trx(void) {
+	network_mysqld_activity_t a;
+	network_mysqld_activity_snapshot_t snap;
+
+	network_mysqld_activity_init(&a);
+	network_mysqld_activity_get(&a, &snap);
+	g_assert_cmpint(snap.command, ==, -1);
+	g_assert_cmpint(snap.in_trans, ==, FALSE);
+
+	/* autocommit */
+	network_mysqld_activity_query_start(&a, COM_QUERY, C("SELECT 1"), 100);
+	network_mysqld_activity_get(&a, &snap);
+	g_assert_cmpint(snap.command, ==, COM_QUERY);
+	g_assert_cmpint(snap.ts_query, ==, 100);
+	g_assert_cmpint(snap.query_len, ==, sizeof("SELECT 1") - 1);
+	g_assert_cmpint(0, ==, memcmp(snap.query, C("SELECT 1")));
+
+	network_mysqld_activity_query_end(&a, SERVER_STATUS_AUTOCOMMIT, 0);
+	network_mysqld_activity_get(&a, &snap);
+	g_assert_cmpint(snap.command, ==, -1);
+	g_assert_cmpint(snap.in_trans, ==, FALSE);
+	g_assert_cmpint(snap.trx_statements, ==, 0);
+
+	/* a transaction of 3 statements */
+	network_mysqld_activity_query_start(&a, COM_QUERY, C("BEGIN"), 200);
+	network_mysqld_activity_query_end(&a, SERVER_STATUS_AUTOCOMMIT | SERVER_STATUS_IN_TRANS, 0);
+	network_mysqld_activity_query_start(&a, COM_QUERY, C("UPDATE t SET a = 1"), 300);
+	network_mysqld_activity_query_end(&a, SERVER_STATUS_AUTOCOMMIT | SERVER_STATUS_IN_TRANS, 0);
+	network_mysqld_activity_query_start(&a, COM_QUERY, C("COMMIT"), 400);
+
+	network_mysqld_activity_get(&a, &snap);
+	g_assert_cmpint(snap.in_trans, ==, TRUE);
+	g_assert_cmpint(snap.ts_trx, ==, 200);
+	g_assert_cmpint(snap.trx_statements, ==, 3);
+	g_assert_cmpint(snap.trx_query_len, ==, sizeof("BEGIN") - 1);
+	g_assert_cmpint(0, ==, memcmp(snap.trx_query, C("BEGIN")));
+	g_assert_cmpint(0, ==, memcmp(snap.query, C("COMMIT")));
+
+	network_mysqld_activity_query_end(&a, SERVER_STATUS_AUTOCOMMIT, 0);
+	network_mysqld_activity_get(&a, &snap);
+	g_assert_cmpint(snap.in_trans, ==, FALSE);
+	g_assert_cmpint(snap.trx_statements, ==, 0);
+
+	/* with autocommit=0 the first statement opens it */
+	network_mysqld_activity_query_start(&a, COM_QUERY, C("INSERT INTO t VALUES (1)"), 500);
+	network_mysqld_activity_query_end(&a, SERVER_STATUS_IN_TRANS, 0);
+	network_mysqld_activity_get(&a, &snap);
+	g_assert_cmpint(snap.in_trans, ==, TRUE);
+	g_assert_cmpint(snap.ts_trx, ==, 500);
+	g_assert_cmpint(snap.trx_statements, ==, 1);
+	g_assert_cmpint(0, ==, memcmp(snap.trx_query, C("INSERT INTO t VALUES (1)")));
+}
+
+/**
+ * long statements are truncated, but keep their length
+ */
+static void t_network_mysqld_activity_truncate(void) {
+	network_mysqld_activity_t a;
+	network_mysqld_activity_snapshot_t snap;
+	GString *query = g_string_new("SELECT ");
+
+	while (query->len < 2 * NETWORK_MYSQLD_ACTIVITY_QUERY_LEN) {
+		g_string_append(query, "1, ");
+	}
+
+	network_mysqld_activity_init(&a);
+	network_mysqld_activity_query_start(&a, COM_QUERY, query->str, query->len, 100);
+	network_mysqld_activity_get(&a, &snap);
+	g_assert_cmpint(snap.query_len, ==, query->len);
+	g_assert_cmpint(0, ==, memcmp(snap.query, query->str, NETWORK_MYSQLD_ACTIVITY_QUERY_LEN));
+
+	/* commands without a text */
+	network_mysqld_activity_query_start(&a, COM_PING, NULL, 0, 200);
+	network_mysqld_activity_get(&a, &snap);
+	g_assert_cmpint(snap.command, ==, COM_PING);
+	g_assert_cmpint(snap.query_len, ==, 0);
+
+	g_string_free(query, TRUE);
+}
+
+/**
+ * the user and the backend are only written when they change, the end of a statement marks the idle time
+ */
+static void t_network_mysqld_activity_peers(void) {
+	network_mysqld_activity_t a;
+	network_mysqld_activity_snapshot_t snap;
+	gint seq;
+
+	network_mysqld_activity_init(&a);
+	network_mysqld_activity_set_peers(&a, NULL, 0, NULL, 0, 0);
+	network_mysqld_activity_get(&a, &snap);
+	g_assert_cmpint(snap.user_len, ==, 0);
+	g_assert_cmpint(snap.backend_len, ==, 0);
+
+	network_mysqld_activity_set_peers(&a, C("root"), C("127.0.0.1:3306"), 10);
+	network_mysqld_activity_get(&a, &snap);
+	g_assert_cmpint(snap.user_len, ==, sizeof("root") - 1);
+	g_assert_cmpint(0, ==, memcmp(snap.user, C("root")));
+	g_assert_cmpint(0, ==, memcmp(snap.backend, C("127.0.0.1:3306")));
+	g_assert_cmpint(snap.thread_id, ==, 10);
+
+	/* unchanged, no update */
+	seq = a.seq;
+	network_mysqld_activity_set_peers(&a, C("root"), C("127.0.0.1:3306"), 10);
+	g_assert_cmpint(a.seq, ==, seq);
+
+	network_mysqld_activity_set_peers(&a, C("root"), C("127.0.0.1:3307"), 10);
+	g_assert_cmpint(a.seq, !=, seq);
+	network_mysqld_activity_get(&a, &snap);
+	g_assert_cmpint(0, ==, memcmp(snap.backend, C("127.0.0.1:3307")));
+
+	/* another connection of the same backend */
+	seq = a.seq;
+	network_mysqld_activity_set_peers(&a, C("root"), C("127.0.0.1:3307"), 11);
+	g_assert_cmpint(a.seq, !=, seq);
+	network_mysqld_activity_get(&a, &snap);
+	g_assert_cmpint(snap.thread_id, ==, 11);
+
+	network_mysqld_activity_query_start(&a, COM_QUERY, C("SELECT 1"), 100);
+	network_mysqld_activity_query_end(&a, SERVER_STATUS_AUTOCOMMIT, 150);
+	network_mysqld_activity_get(&a, &snap);
+	g_assert_cmpint(snap.ts_idle, ==, 150);
+}
+
+int main(int argc, char **argv) {
+	g_thread_init(NULL);
+	g_test_init(&argc, &argv, NULL);
+	g_test_bug_base("http://bugs.mysql.com/");
+
+	g_test_add_func("/core/network_mysqld_activity_trx", t_network_mysqld_activity_trx);
+	g_test_add_func("/core/network_mysqld_activity_truncate", t_network_mysqld_activity_truncate);
+	g_test_add_func("/core/network_mysqld_activity_peers", t_network_mysqld_activity_peers);
+
+	return g_test_run();
+}
+#else
+int main() {
+	return 77;
+}
+#endif
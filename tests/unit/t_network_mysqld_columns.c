@@ -0,0 +1,174 @@
+/* $%BEGINLICENSE%$
+ Copyright (c) 2008, 2012, Oracle and/or its affiliates. All rights reserved.
+
+ This program is free software; you can redistribute it and/or
+ modify it under the terms of the GNU General Public License as
+ published by the Free Software Foundation; version 2 of the
+ License.
+
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ GNU General Public License for more details.
+
+ You should have received a copy of the GNU General Public License
+ along with this program; if not, write to the Free Software
+ Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA
+ 02110-1301  USA
+
+ $%ENDLICENSE%$ */
+#include <string.h>
+
+#include <glib.h>
+
+#include "network-mysqld-columns.h"
+
+#if GLIB_CHECK_VERSION(2, 16, 0)
+#define C(x) x, sizeof(x) - 1
+#define S(x) x->str, x->len
+
+/**
+ * a INT, a DOUBLE and a VARCHAR column
+ */
+static network_mysqld_proto_fielddefs_t *t_fielddefs_new(void) {
+	network_mysqld_proto_fielddefs_t *fielddefs = network_mysqld_proto_fielddefs_new();
+	network_mysqld_proto_fielddef_t *fielddef;
+
+	fielddef = network_mysqld_proto_fielddef_new();
+	fielddef->type = MYSQL_TYPE_LONG;
+	g_ptr_array_add(fielddefs, fielddef);
+
+	fielddef = network_mysqld_proto_fielddef_new();
+	fielddef->type = MYSQL_TYPE_DOUBLE;
+	g_ptr_array_add(fielddefs, fielddef);
+
+	fielddef = network_mysqld_proto_fielddef_new();
+	fielddef->type = MYSQL_TYPE_VAR_STRING;
+	g_ptr_array_add(fielddefs, fielddef);
+
+	return fielddefs;
+}
+
+void t_network_mysqld_columns_new() {
+	network_mysqld_proto_fielddefs_t *fielddefs = t_fielddefs_new();
+	network_mysqld_proto_fielddef_t *fielddef;
+	network_mysqld_columns_t *cols;
+
+	cols = network_mysqld_columns_new(fielddefs, 0);
+	g_assert(NULL != cols);
+	g_assert_cmpint(3, ==, cols->columns_len);
+	g_assert_cmpint(0, ==, cols->rows);
+	g_assert_cmpint(NETWORK_MYSQLD_COLUMN_INT, ==, cols->columns[0].kind);
+	g_assert_cmpint(NETWORK_MYSQLD_COLUMN_DOUBLE, ==, cols->columns[1].kind);
+	g_assert_cmpint(NETWORK_MYSQLD_COLUMN_STRING, ==, cols->columns[2].kind);
+	network_mysqld_columns_free(cols);
+
+	/* no binary decoder for GEOMETRY */
+	fielddef = network_mysqld_proto_fielddef_new();
+	fielddef->type = MYSQL_TYPE_GEOMETRY;
+	g_ptr_array_add(fielddefs, fielddef);
+
+	g_assert(NULL == network_mysqld_columns_new(fielddefs, 0));
+
+	network_mysqld_proto_fielddefs_free(fielddefs);
+}
+
+void t_network_mysqld_columns_add_binary_rows() {
+	network_mysqld_proto_fielddefs_t *fielddefs = t_fielddefs_new();
+	network_mysqld_columns_t *cols;
+	GQueue *packets = g_queue_new();
+	GString *packet;
+	const char *s;
+	gsize s_len;
+
+	/* -1, 1.5, "abc" */
+	g_queue_push_tail(packets, g_string_new_len(C("\x12\x00\x00\x01" "\x00" "\x00"
+					"\xff\xff\xff\xff"
+					"\x00\x00\x00\x00\x00\x00\xf8\x3f"
+					"\x03" "abc")));
+	/* NULL, 2.0, "" */
+	g_queue_push_tail(packets, g_string_new_len(C("\x0b\x00\x00\x02" "\x00" "\x04"
+					"\x00\x00\x00\x00\x00\x00\x00\x40"
+					"\x00")));
+	/* EOF */
+	g_queue_push_tail(packets, g_string_new_len(C("\x05\x00\x00\x03" "\xfe" "\x00\x00" "\x02\x00")));
+
+	/* start small to let the vectors grow */
+	cols = network_mysqld_columns_new(fielddefs, 1);
+	g_assert(packets->tail == network_mysqld_columns_add_binary_rows(cols, packets->head));
+	g_assert_cmpint(2, ==, cols->rows);
+
+	g_assert_cmpint(0, ==, cols->columns[0].is_null[0]);
+	g_assert_cmpint(-1, ==, cols->columns[0].v.i[0]);
+	g_assert_cmpint(1, ==, cols->columns[0].is_null[1]);
+
+	g_assert_cmpfloat(1.5, ==, cols->columns[1].v.d[0]);
+	g_assert_cmpfloat(2.0, ==, cols->columns[1].v.d[1]);
+
+	g_assert_cmpint(0, ==, network_mysqld_columns_get_string(cols, 2, 0, &s, &s_len));
+	g_assert_cmpint(3, ==, s_len);
+	g_assert_cmpint(0, ==, memcmp(s, "abc", 3));
+	g_assert_cmpint(0, ==, network_mysqld_columns_get_string(cols, 2, 1, &s, &s_len));
+	g_assert_cmpint(0, ==, s_len);
+
+	/* not a string column, out of range */
+	g_assert_cmpint(-1, ==, network_mysqld_columns_get_string(cols, 0, 0, &s, &s_len));
+	g_assert_cmpint(-1, ==, network_mysqld_columns_get_string(cols, 2, 2, &s, &s_len));
+
+	/* a truncated row isn't added */
+	packet = g_string_new_len(C("\x08\x00\x00\x01" "\x00" "\x00" "\xff\xff\xff\xff" "\x05" "ab"));
+	g_assert_cmpint(-1, ==, network_mysqld_columns_add_binary_row(cols, packet));
+	g_assert_cmpint(2, ==, cols->rows);
+	g_string_free(packet, TRUE);
+
+	network_mysqld_columns_free(cols);
+
+	while (NULL != (packet = g_queue_pop_head(packets))) {
+		g_string_free(packet, TRUE);
+	}
+	g_queue_free(packets);
+	network_mysqld_proto_fielddefs_free(fielddefs);
+}
+
+void t_network_mysqld_columns_unsigned() {
+	network_mysqld_proto_fielddefs_t *fielddefs = network_mysqld_proto_fielddefs_new();
+	network_mysqld_proto_fielddef_t *fielddef;
+	network_mysqld_columns_t *cols;
+	GString *packet;
+
+	fielddef = network_mysqld_proto_fielddef_new();
+	fielddef->type = MYSQL_TYPE_TINY;
+	fielddef->flags = UNSIGNED_FLAG;
+	g_ptr_array_add(fielddefs, fielddef);
+
+	fielddef = network_mysqld_proto_fielddef_new();
+	fielddef->type = MYSQL_TYPE_TINY;
+	g_ptr_array_add(fielddefs, fielddef);
+
+	packet = g_string_new_len(C("\x04\x00\x00\x01" "\x00" "\x00" "\xff" "\xff"));
+
+	cols = network_mysqld_columns_new(fielddefs, 0);
+	g_assert_cmpint(0, ==, network_mysqld_columns_add_binary_row(cols, packet));
+	g_assert_cmpint(255, ==, cols->columns[0].v.i[0]);
+	g_assert_cmpint(-1, ==, cols->columns[1].v.i[0]);
+
+	network_mysqld_columns_free(cols);
+	g_string_free(packet, TRUE);
+	network_mysqld_proto_fielddefs_free(fielddefs);
+}
+
+int main(int argc, char **argv) {
+	g_test_init(&argc, &argv, NULL);
+	g_test_bug_base("http://bugs.mysql.com/");
+
+	g_test_add_func("/core/network_mysqld_columns_new", t_network_mysqld_columns_new);
+	g_test_add_func("/core/network_mysqld_columns_add_binary_rows", t_network_mysqld_columns_add_binary_rows);
+	g_test_add_func("/core/network_mysqld_columns_unsigned", t_network_mysqld_columns_unsigned);
+
+	return g_test_run();
+}
+#else
+int main() {
+	return 77;
+}
+#endif
@@ -0,0 +1,171 @@
+/* $%BEGINLICENSE%$
+ Copyright (c) 2008, 2012, Oracle and/or its affiliates. All rights reserved.
+
+ This program is free software; you can redistribute it and/or
+ modify it under the terms of the GNU General Public License as
+ published by the Free Software Foundation; version 2 of the
+ License.
+
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ GNU General Public License for more details.
+
+ You should have received a copy of the GNU General Public License
+ along with this program; if not, write to the Free Software
+ Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA
+ 02110-1301  USA
+
+ $%ENDLICENSE%$ */
+#include <string.h>
+
+#include <glib.h>
+
+#include "network-queue.h"
+#include "network-buffer-pool.h"
+#include "network-mysqld-compress.h"
+
+#if GLIB_CHECK_VERSION(2, 16, 0)
+#define C(x) x, sizeof(x) - 1
+#define S(x) x->str, x->len
+
+/**
+ * append a copy of the string to the queue
+ */
+static void t_queue_append(network_queue *q, const char *s, gsize s_len) {
+	network_queue_append(q, g_string_new_len(s, s_len));
+}
+
+/**
+ * get all of the queue as one string
+ */
+static GString *t_queue_pop_all(network_queue *q) {
+	if (q->len == 0) return g_string_new(NULL);
+
+	return network_queue_pop_string(q, q->len, NULL);
+}
+
+/**
+ * short payloads are sent uncompressed
+ */
+static void t_network_mysqld_compress_short(void) {
+	GString *packet = g_string_new(NULL);
+
+	g_assert_cmpint(0, ==, network_mysqld_compress_append(packet, C("\x01\x00\x00\x00\x0e"), 3));
+
+	g_assert_cmpint(packet->len, ==, NETWORK_MYSQLD_COMPRESS_HEADER_SIZE + 5);
+	g_assert_cmpint(0, ==, memcmp(packet->str, C("\x05\x00\x00" "\x03" "\x00\x00\x00" "\x01\x00\x00\x00\x0e")));
+
+	g_string_free(packet, TRUE);
+}
+
+/**
+ * compress a large packet and uncompress it again
+ */
+static void t_network_mysqld_compress_roundtrip(void) {
+	network_queue *plain = network_queue_new();
+	network_queue *compressed = network_queue_new();
+	network_queue *uncompressed = network_queue_new();
+	GString *payload = g_string_new(NULL);
+	GString *out;
+	guint8 send_id = 0, recv_id = 0;
+	guint i;
+
+	if (!network_mysqld_compress_is_available()) return;
+
+	for (i = 0; i < 1000; i++) {
+		g_string_append_len(payload, C("\x10\x00\x00\x01" "0123456789abcdef"));
+	}
+	t_queue_append(plain, S(payload));
+
+	g_assert_cmpint(0, ==, network_mysqld_compress_queue(compressed, plain, &send_id));
+	g_assert_cmpint(0, ==, plain->len);
+	g_assert_cmpint(1, ==, send_id);
+	g_assert_cmpint(compressed->len, <, payload->len); /* it got smaller */
+
+	g_assert_cmpint(0, ==, network_mysqld_decompress_queue(uncompressed, compressed, &recv_id));
+	g_assert_cmpint(0, ==, compressed->len);
+	g_assert_cmpint(1, ==, recv_id); /* the next packet-id to send */
+
+	out = t_queue_pop_all(uncompressed);
+	g_assert(g_string_equal(payload, out));
+
+	g_string_free(out, TRUE);
+	g_string_free(payload, TRUE);
+	network_queue_free(uncompressed);
+	network_queue_free(compressed);
+	network_queue_free(plain);
+}
+
+/**
+ * incomplete compressed packets stay in the queue until the rest arrives
+ */
+static void t_network_mysqld_decompress_partial(void) {
+	network_queue *src = network_queue_new();
+	network_queue *dst = network_queue_new();
+	GString *packet = g_string_new(NULL);
+	GString *out;
+	guint8 packet_id = 0;
+
+	g_assert_cmpint(0, ==, network_mysqld_compress_append(packet, C("\x01\x00\x00\x00\x0e"), 3));
+	g_assert_cmpint(0, ==, network_mysqld_compress_append(packet, C("\x01\x00\x00\x01\x0e"), 4));
+
+	/* split the 2nd packet in the header */
+	t_queue_append(src, packet->str, 12 + 3);
+
+	g_assert_cmpint(0, ==, network_mysqld_decompress_queue(dst, src, &packet_id));
+	g_assert_cmpint(5, ==, dst->len);
+	g_assert_cmpint(3, ==, src->len);
+	g_assert_cmpint(4, ==, packet_id);
+
+	t_queue_append(src, packet->str + 12 + 3, packet->len - 12 - 3);
+
+	g_assert_cmpint(0, ==, network_mysqld_decompress_queue(dst, src, &packet_id));
+	g_assert_cmpint(10, ==, dst->len);
+	g_assert_cmpint(0, ==, src->len);
+	g_assert_cmpint(5, ==, packet_id);
+
+	out = t_queue_pop_all(dst);
+	g_assert_cmpint(0, ==, memcmp(out->str, C("\x01\x00\x00\x00\x0e" "\x01\x00\x00\x01\x0e")));
+
+	g_string_free(out, TRUE);
+	g_string_free(packet, TRUE);
+	network_queue_free(dst);
+	network_queue_free(src);
+}
+
+/**
+ * a broken compressed payload is a protocol error
+ */
+static void t_network_mysqld_decompress_broken(void) {
+	network_queue *src = network_queue_new();
+	network_queue *dst = network_queue_new();
+	guint8 packet_id = 0;
+
+	g_log_set_always_fatal(G_LOG_FATAL_MASK); /* we log g_critical() which is fatal for the test-suite */
+
+	/* claims to be 100 bytes when uncompressed, but it isn't zlib */
+	t_queue_append(src, C("\x04\x00\x00" "\x00" "\x64\x00\x00" "abcd"));
+
+	g_assert_cmpint(-1, ==, network_mysqld_decompress_queue(dst, src, &packet_id));
+
+	network_queue_free(dst);
+	network_queue_free(src);
+}
+
+int main(int argc, char **argv) {
+	g_test_init(&argc, &argv, NULL);
+	g_test_bug_base("http://bugs.mysql.com/");
+
+	g_test_add_func("/core/network_mysqld_compress_short", t_network_mysqld_compress_short);
+	g_test_add_func("/core/network_mysqld_compress_roundtrip", t_network_mysqld_compress_roundtrip);
+	g_test_add_func("/core/network_mysqld_decompress_partial", t_network_mysqld_decompress_partial);
+	g_test_add_func("/core/network_mysqld_decompress_broken", t_network_mysqld_decompress_broken);
+
+	return g_test_run();
+}
+#else
+int main() {
+	return 77;
+}
+#endif
@@ -0,0 +1,118 @@
+/* $%BEGINLICENSE%$
+ Copyright (c) 2008, 2012, Oracle and/or its affiliates. All rights reserved.
+
+ This program is free software; you can redistribute it and/or
+ modify it under the terms of the GNU General Public License as
+ published by the Free Software Foundation; version 2 of the
+ License.
+
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ GNU General Public License for more details.
+
+ You should have received a copy of the GNU General Public License
+ along with this program; if not, write to the Free Software
+ Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA
+ 02110-1301  USA
+
+ $%ENDLICENSE%$ */
+#include <string.h>
+
+#include <glib.h>
+
+#include "network-mysqld-filter.h"
+
+#if GLIB_CHECK_VERSION(2, 16, 0)
+#define STATE_READ_QUERY 10
+
+/**
+ * the filters append their name to the GString that stands in for the connection
+ */
+static network_mysqld_filter_ret_t t_filter_next(struct chassis G_GNUC_UNUSED *chas, struct network_mysqld_con *con, gpointer user_data) {
+	g_string_append((GString *)con, user_data);
+
+	return NETWORK_MYSQLD_FILTER_NEXT;
+}
+
+static network_mysqld_filter_ret_t t_filter_done(struct chassis G_GNUC_UNUSED *chas, struct network_mysqld_con *con, gpointer user_data) {
+	g_string_append((GString *)con, user_data);
+
+	return NETWORK_MYSQLD_FILTER_DONE;
+}
+
+void t_network_mysqld_filters_order() {
+	network_mysqld_filters_t *filters;
+	GString *calls = g_string_new(NULL);
+	struct network_mysqld_con *con = (struct network_mysqld_con *)calls;
+
+	filters = network_mysqld_filters_new();
+
+	/* a state without filters */
+	g_assert_cmpint(NETWORK_MYSQLD_FILTER_NEXT, ==, network_mysqld_filters_call(filters, NULL, con, STATE_READ_QUERY));
+
+	g_assert_cmpint(0, ==, network_mysqld_filters_add(filters, STATE_READ_QUERY, "router", 200, t_filter_next, "r", NULL, NULL));
+	g_assert_cmpint(0, ==, network_mysqld_filters_add(filters, STATE_READ_QUERY, "firewall", 100, t_filter_next, "f", NULL, NULL));
+	g_assert_cmpint(0, ==, network_mysqld_filters_add(filters, STATE_READ_QUERY, "audit", 100, t_filter_next, "a", NULL, NULL));
+
+	/* by priority, in the order they were added for the same priority */
+	g_assert_cmpint(NETWORK_MYSQLD_FILTER_NEXT, ==, network_mysqld_filters_call(filters, NULL, con, STATE_READ_QUERY));
+	g_assert_cmpstr(calls->str, ==, "far");
+
+	/* the cache answers the query, the router isn't asked */
+	g_assert_cmpint(0, ==, network_mysqld_filters_add(filters, STATE_READ_QUERY, "cache", 150, t_filter_done, "c", NULL, NULL));
+	g_string_truncate(calls, 0);
+	g_assert_cmpint(NETWORK_MYSQLD_FILTER_DONE, ==, network_mysqld_filters_call(filters, NULL, con, STATE_READ_QUERY));
+	g_assert_cmpstr(calls->str, ==, "fac");
+
+	/* the other states are left alone */
+	g_string_truncate(calls, 0);
+	g_assert_cmpint(NETWORK_MYSQLD_FILTER_NEXT, ==, network_mysqld_filters_call(filters, NULL, con, STATE_READ_QUERY + 1));
+	g_assert_cmpstr(calls->str, ==, "");
+
+	g_assert_cmpint(TRUE, ==, network_mysqld_filters_remove(filters, STATE_READ_QUERY, "cache"));
+	g_assert_cmpint(FALSE, ==, network_mysqld_filters_remove(filters, STATE_READ_QUERY, "cache"));
+	g_assert_cmpint(TRUE, ==, network_mysqld_filters_remove(filters, STATE_READ_QUERY, "audit"));
+	g_assert_cmpint(NETWORK_MYSQLD_FILTER_NEXT, ==, network_mysqld_filters_call(filters, NULL, con, STATE_READ_QUERY));
+	g_assert_cmpstr(calls->str, ==, "fr");
+
+	network_mysqld_filters_free(filters);
+	g_string_free(calls, TRUE);
+}
+
+void t_network_mysqld_filters_add_errors() {
+	network_mysqld_filters_t *filters;
+	GString *user_data;
+	GError *gerr = NULL;
+
+	filters = network_mysqld_filters_new();
+
+	g_assert_cmpint(-1, ==, network_mysqld_filters_add(filters, NETWORK_MYSQLD_FILTER_MAX_STATES, "audit", 0, t_filter_next, "a", NULL, &gerr));
+	g_assert_error(gerr, NETWORK_MYSQLD_FILTERS_ERROR, NETWORK_MYSQLD_FILTERS_ERROR_STATE);
+	g_clear_error(&gerr);
+
+	/* the user_data is freed with the filter */
+	user_data = g_string_new("a");
+	g_assert_cmpint(0, ==, network_mysqld_filters_add(filters, STATE_READ_QUERY, "audit", 0, t_filter_next, user_data, (GDestroyNotify)g_string_free, NULL));
+	g_assert_cmpint(-1, ==, network_mysqld_filters_add(filters, STATE_READ_QUERY, "audit", 10, t_filter_next, "a", NULL, &gerr));
+	g_assert_error(gerr, NETWORK_MYSQLD_FILTERS_ERROR, NETWORK_MYSQLD_FILTERS_ERROR_DUPLICATE);
+	g_clear_error(&gerr);
+
+	network_mysqld_filters_free(filters);
+}
+
+int main(int argc, char **argv) {
+	g_thread_init(NULL);
+	g_test_init(&argc, &argv, NULL);
+	g_test_bug_base("http://bugs.mysql.com/");
+
+	g_test_add_func("/core/network_mysqld_filters_order", t_network_mysqld_filters_order);
+	g_test_add_func("/core/network_mysqld_filters_add_errors", t_network_mysqld_filters_add_errors);
+
+	return g_test_run();
+}
+#else
+int main() {
+	return 77;
+}
+#endif
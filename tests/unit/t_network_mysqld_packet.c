@@ -1134,6 +1134,122 @@ static void t_resultset_fields_parse_high(void) {
 /* prepared statements */
 
 /* COM_STMT_PREPARE */
+/**
+ * get the Seconds_Behind_Master out of a SHOW SLAVE STATUS
+ */
+static gint t_slave_lag_get(const char *row, gsize row_len, int *ret) {
+	strings packets[] = {
+		{ C("\1\0\0\1\2") }, /* 2 fields */
+		{ C("2\0\0\2\3def\0\0\0\16Slave_IO_State\16Slave_IO_State\14\10\0\0\2\0\0\375\1\0\0\0\0") },
+		{ C("@\0\0\3\3def\0\0\0\25Seconds_Behind_Master\25Seconds_Behind_Master\14\10\0\0\2\0\0\375\1\0\0\0\0") },
+		{ C("\5\0\0\4\376\0\0\"\0") }, /* EOF */
+		{ row, row_len },
+		{ C("\5\0\0\6\376\0\0\"\0") }, /* EOF */
+		{ NULL, 0 }
+	};
+	network_queue *q;
+	gint lag = -2;
+	int i;
+
+	q = network_queue_new();
+
+	for (i = 0; packets[i].s; i++) {
+		network_queue_append(q, g_string_new_len(packets[i].s, packets[i].s_len));
+	}
+
+	*ret = network_mysqld_proto_get_slave_lag(q->chunks->head, &lag);
+
+	network_queue_free(q);
+
+	return lag;
+}
+
+static void t_slave_lag(void) {
+	strings packets[] = {
+		{ C("\1\0\0\1\2") }, /* 2 fields */
+		{ C("6\0\0\2\3def\0\6STATUS\0\rVariable_name\rVariable_name\f\10\0P\0\0\0\375\1\0\0\0\0") },
+		{ C("&\0\0\3\3def\0\6STATUS\0\5Value\5Value\f\10\0\0\2\0\0\375\1\0\0\0\0") },
+		{ C("\5\0\0\4\376\0\0\"\0") }, /* EOF */
+		{ C("\23\0\0\5\17Aborted_clients\00298") },
+		{ C("\5\0\0\4\376\0\0\"\0") }, /* EOF */
+		{ NULL, 0 }
+	};
+	network_queue *q;
+	gint lag;
+	int ret;
+	int i;
+
+	g_assert_cmpint(t_slave_lag_get(C("\13\0\0\5\7Waiting\2""42"), &ret), ==, 42);
+	g_assert_cmpint(ret, ==, 0);
+
+	/* the SQL thread isn't running */
+	g_assert_cmpint(t_slave_lag_get(C("\11\0\0\5\7Waiting\373"), &ret), ==, -1);
+	g_assert_cmpint(ret, ==, 0);
+
+	/* no rows, not a slave */
+	g_assert_cmpint(t_slave_lag_get(C("\5\0\0\5\376\0\0\"\0"), &ret), ==, 0);
+	g_assert_cmpint(ret, ==, 0);
+
+	/* the row is cut short */
+	t_slave_lag_get(C("\10\0\0\5\7Waiting"), &ret);
+	g_assert_cmpint(ret, ==, -1);
+
+	/* not a SHOW SLAVE STATUS */
+	q = network_queue_new();
+	for (i = 0; packets[i].s; i++) {
+		network_queue_append(q, g_string_new_len(packets[i].s, packets[i].s_len));
+	}
+	g_assert_cmpint(network_mysqld_proto_get_slave_lag(q->chunks->head, &lag), ==, -1);
+	network_queue_free(q);
+}
+
+/**
+ * get the binlog position out of a SHOW MASTER STATUS
+ */
+static int t_binlog_pos_get(const char *row, gsize row_len, guint64 *pos) {
+	strings packets[] = {
+		{ C("\1\0\0\1\2") }, /* 2 fields */
+		{ C("\36\0\0\2\3def\0\0\0\4File\4File\14\10\0\0\2\0\0\375\1\0\0\0\0") },
+		{ C("&\0\0\3\3def\0\0\0\10Position\10Position\14\10\0\0\2\0\0\375\1\0\0\0\0") },
+		{ C("\5\0\0\4\376\0\0\"\0") }, /* EOF */
+		{ row, row_len },
+		{ C("\5\0\0\6\376\0\0\"\0") }, /* EOF */
+		{ NULL, 0 }
+	};
+	network_queue *q;
+	int ret;
+	int i;
+
+	q = network_queue_new();
+
+	for (i = 0; packets[i].s; i++) {
+		network_queue_append(q, g_string_new_len(packets[i].s, packets[i].s_len));
+	}
+
+	ret = network_mysqld_proto_get_binlog_pos(q->chunks->head, "File", "Position", pos);
+
+	network_queue_free(q);
+
+	return ret;
+}
+
+static void t_binlog_pos(void) {
+	guint64 pos = 0;
+
+	g_assert_cmpint(t_binlog_pos_get(C("\25\0\0\5\20mysql-bin.000042\3""154"), &pos), ==, 0);
+	g_assert_cmpint(pos, ==, (G_GUINT64_CONSTANT(42) << 32) | 154);
+
+	/* positions of a later binlog-file are bigger */
+	g_assert_cmpint(t_binlog_pos_get(C("\23\0\0\5\20mysql-bin.000043\1""4"), &pos), ==, 0);
+	g_assert_cmpint(pos, >, (G_GUINT64_CONSTANT(42) << 32) | 154);
+
+	/* no rows, the binlog is disabled */
+	g_assert_cmpint(t_binlog_pos_get(C("\5\0\0\5\376\0\0\"\0"), &pos), ==, -1);
+
+	/* the file is NULL */
+	g_assert_cmpint(t_binlog_pos_get(C("\3\0\0\5\373\1""4"), &pos), ==, -1);
+}
+
 static void t_com_stmt_prepare_new(void) {
 	network_mysqld_stmt_prepare_packet_t *cmd;
 
@@ -1272,6 +1388,54 @@ static void t_com_stmt_prepare_ok_from_packet(void) {
 	g_string_free(packet.data, TRUE);
 }
 
+/**
+ * the field-defs of a result-set are parsed into one arena that is freed with the last field
+ */
+static void t_fielddefs_arena(void) {
+	strings packets[] = {
+		{ C("\x01\x00\x00\x01\x02") }, /* 2 fields */
+		{ C("\x17\x00\x00\x02\x03\x64\x65\x66\x00\x00\x00\x01\x3f\x00\x0c\x3f\x00\x00\x00\x00\x00\xfd\x80\x00\x00\x00\x00") }, /* ? */
+		{ C("\x1a\x00\x00\x03\x03\x64\x65\x66\x00\x00\x00\x04\x63\x6f\x6c\x31\x00\x0c\x3f\x00\x00\x00\x00\x00\xfd\x80\x00\x1f\x00\x00") }, /* col1 */
+		{ C("\x05\x00\x00\x04\xfe\x00\x00\x02\x00") }, /* EOF */
+		{ C("\x05\x00\x00\x05\x01\x31\x01\x32") }, /* a row */
+		{ C("\x05\x00\x00\x06\xfe\x00\x00\x02\x00") } /* EOF */
+	};
+	network_mysqld_proto_fielddefs_t *fields;
+	network_mysqld_proto_fielddef_t *field;
+	GQueue *chunks = g_queue_new();
+	GString *packet;
+	guint i;
+
+	for (i = 0; i < G_N_ELEMENTS(packets); i++) {
+		g_queue_push_tail(chunks, g_string_new_len(packets[i].s, packets[i].s_len));
+	}
+
+	fields = network_mysqld_proto_fielddefs_new();
+	g_assert(NULL != network_mysqld_proto_get_fielddefs(chunks->head, fields));
+	g_assert_cmpint(fields->len, ==, 2);
+
+	/* the strings don't point into the packets */
+	while ((packet = g_queue_pop_head(chunks))) g_string_free(packet, TRUE);
+	g_queue_free(chunks);
+
+	field = fields->pdata[0];
+	g_assert_cmpstr(field->catalog, ==, "def");
+	g_assert_cmpstr(field->name, ==, "?");
+	g_assert(NULL == field->db);
+	g_assert_cmpint(field->type, ==, MYSQL_TYPE_VAR_STRING);
+
+	field = fields->pdata[1];
+	g_assert_cmpstr(field->name, ==, "col1");
+	g_assert_cmpint(field->decimals, ==, 0x1f);
+
+	/* plain fields can be mixed into it */
+	field = network_mysqld_proto_fielddef_new();
+	field->name = g_strdup("added");
+	g_ptr_array_add(fields, field);
+
+	network_mysqld_proto_fielddefs_free(fields);
+}
+
 /* COM_STMT_EXECUTE */
 
 static void t_com_stmt_execute_new(void) {
@@ -1724,6 +1888,59 @@ static void t_com_stmt_execute_result_from_packet(void) {
 	network_mysqld_proto_fielddefs_free(coldefs);
 }
 
+/**
+ * test if the binary rows of a COM_STMT_EXECUTE result are rewritten as text rows
+ */
+static void t_com_stmt_execute_result_to_text(void) {
+	/* response for a
+	 *   SELECT ? AS col2, ? AS col1
+	 * with a STRING and a LONGLONG column
+	 */
+	strings packets[] = {
+		{ C("\x01\x00\x00\x01\x02") },
+		{ C("\x1a\x00\x00\x02\x03\x64\x65\x66\x00\x00\x00\x04\x63\x6f\x6c\x32\x00\x0c\x3f\x00\x00\x00\x00\x00\xfe\x80\x00\x00\x00\x00") },
+		{ C("\x1a\x00\x00\x03\x03\x64\x65\x66\x00\x00\x00\x04\x63\x6f\x6c\x31\x00\x0c\x3f\x00\x14\x00\x00\x00\x08\x00\x00\x00\x00\x00") },
+		{ C("\x05\x00\x00\x04\xfe\x00\x00\x02\x00") },
+		{ C("\x0a\x00\x00\x05\x00\x04" "\xfd\xff\xff\xff\xff\xff\xff\xff") },
+		{ C("\x0c\x00\x00\x06\x00\x00" "\x01" "x" "\x07\x00\x00\x00\x00\x00\x00\x00") },
+		{ C("\x05\x00\x00\x07\xfe\x00\x00\x02\x00") }
+	};
+	GQueue *q = g_queue_new();
+	GString *packet;
+	guint i;
+
+	for (i = 0; i < G_N_ELEMENTS(packets); i++) {
+		g_queue_push_tail(q, g_string_new_len(packets[i].s, packets[i].s_len));
+	}
+
+	g_assert_cmpint(0, ==, network_mysqld_proto_binary_result_to_text(q->head));
+
+	/* NULL and -3 */
+	packet = g_queue_peek_nth(q, 4);
+	g_assert_cmpint(packet->len, ==, 8);
+	g_assert_cmpint(0, ==, memcmp(packet->str, C("\x04\x00\x00\x05" "\xfb" "\x02" "-3")));
+
+	/* 'x' and 7 */
+	packet = g_queue_peek_nth(q, 5);
+	g_assert_cmpint(packet->len, ==, 8);
+	g_assert_cmpint(0, ==, memcmp(packet->str, C("\x04\x00\x00\x06" "\x01" "x" "\x01" "7")));
+
+	/* the field-defs and the EOFs are left alone */
+	packet = g_queue_peek_nth(q, 6);
+	g_assert_cmpint(0, ==, memcmp(packet->str, packets[6].s, packets[6].s_len));
+
+	while ((packet = g_queue_pop_head(q))) g_string_free(packet, TRUE);
+
+	/* a OK packet is the same in both protocols */
+	g_queue_push_tail(q, g_string_new_len(C("\x07\x00\x00\x01\x00\x00\x00\x02\x00\x00\x00")));
+	g_assert_cmpint(0, ==, network_mysqld_proto_binary_result_to_text(q->head));
+	packet = g_queue_pop_head(q);
+	g_assert_cmpint(packet->len, ==, 11);
+	g_string_free(packet, TRUE);
+
+	g_queue_free(q);
+}
+
 /* COM_STMT_CLOSE */
 static void t_com_stmt_close_new(void) {
 	network_mysqld_stmt_close_packet_t *cmd;
@@ -1749,6 +1966,460 @@ static void t_com_stmt_close_from_packet(void) {
 	network_mysqld_stmt_close_packet_free(cmd);
 }
 
+/**
+ * only plain SELECTs may go to a read-only backend
+ */
+static void t_query_rw_type(void) {
+	struct {
+		const char *query;
+		network_mysqld_query_rw_type_t rw_type;
+	} queries[] = {
+		{ "SELECT 1", NETWORK_MYSQLD_QUERY_RO },
+		{ "  /* comment */ select * FROM tbl WHERE a = 'FOR UPDATE';", NETWORK_MYSQLD_QUERY_RO },
+		{ "(SELECT 1) UNION (SELECT 2)", NETWORK_MYSQLD_QUERY_RO },
+		{ "SELECT a - 1 FROM tbl -- LOCK\n", NETWORK_MYSQLD_QUERY_RO },
+		{ "SELECT * FROM tbl FOR UPDATE", NETWORK_MYSQLD_QUERY_RW },
+		{ "SELECT * FROM tbl LOCK IN SHARE MODE", NETWORK_MYSQLD_QUERY_RW },
+		{ "SELECT 1 INTO @a", NETWORK_MYSQLD_QUERY_RW },
+		{ "SELECT LAST_INSERT_ID()", NETWORK_MYSQLD_QUERY_RW },
+		{ "SELECT @@autocommit", NETWORK_MYSQLD_QUERY_RW },
+		{ "SELECT 1; DELETE FROM tbl", NETWORK_MYSQLD_QUERY_RW },
+		{ "SELECT /*!40001 SQL_NO_CACHE */ 1", NETWORK_MYSQLD_QUERY_RW },
+		{ "INSERT INTO tbl VALUES (1)", NETWORK_MYSQLD_QUERY_RW },
+		{ "SELECTx", NETWORK_MYSQLD_QUERY_RW },
+		{ "", NETWORK_MYSQLD_QUERY_RW },
+		{ NULL, NETWORK_MYSQLD_QUERY_RW }
+	};
+	int i;
+
+	for (i = 0; queries[i].query; i++) {
+		g_assert_cmpint(network_mysqld_proto_get_query_rw_type(queries[i].query, strlen(queries[i].query)), ==, queries[i].rw_type);
+	}
+}
+
+/**
+ * queries that leave state on the connection can't be multiplexed
+ */
+static void t_query_has_session_state(void) {
+	struct {
+		const char *query;
+		gboolean has_session_state;
+	} queries[] = {
+		{ "SELECT * FROM tbl WHERE a = '@b'", FALSE },
+		{ "INSERT INTO tbl VALUES (1)", FALSE },
+		{ "DROP TABLE tbl", FALSE },
+		{ "SET NAMES utf8", TRUE },
+		{ " use db", TRUE },
+		{ "PREPARE stmt FROM 'SELECT 1'", TRUE },
+		{ "LOCK TABLES tbl READ", TRUE },
+		{ "CREATE TEMPORARY TABLE tmp (a INT)", TRUE },
+		{ "SELECT SQL_CALC_FOUND_ROWS * FROM tbl LIMIT 1", TRUE },
+		{ "SELECT GET_LOCK('a', 1)", TRUE },
+		{ "SELECT @a := 1", TRUE },
+		{ "/*!40101 SET NAMES utf8 */", TRUE },
+		{ NULL, FALSE }
+	};
+	int i;
+
+	for (i = 0; queries[i].query; i++) {
+		g_assert_cmpint(network_mysqld_proto_query_has_session_state(queries[i].query, strlen(queries[i].query)), ==, queries[i].has_session_state);
+	}
+}
+
+/**
+ * the hints of a leading /\*proxy: ... *\/ comment
+ */
+static void t_query_hints(void) {
+	network_mysqld_query_hints_t *hints;
+	const char *q;
+
+	hints = network_mysqld_query_hints_new();
+
+	q = " /*proxy: ro, cache_ttl=30, timeout=2s */ SELECT 1";
+	g_assert_cmpint(TRUE, ==, network_mysqld_proto_get_query_hints(q, strlen(q), hints));
+	g_assert_cmpint(hints->route, ==, NETWORK_MYSQLD_QUERY_HINT_ROUTE_RO);
+	g_assert_cmpint(hints->group->len, ==, 0);
+	g_assert_cmpint(hints->cache_ttl_ms, ==, 30000);
+	g_assert_cmpint(hints->timeout_ms, ==, 2000);
+
+	q = "/*PROXY: rw group = analytics nocache timeout=500ms unknown=1 */ UPDATE tbl SET a = 1";
+	g_assert_cmpint(TRUE, ==, network_mysqld_proto_get_query_hints(q, strlen(q), hints));
+	g_assert_cmpint(hints->route, ==, NETWORK_MYSQLD_QUERY_HINT_ROUTE_RW);
+	g_assert_cmpstr(hints->group->str, ==, "analytics");
+	g_assert_cmpint(hints->cache_ttl_ms, ==, 0);
+	g_assert_cmpint(hints->timeout_ms, ==, 500);
+
+	/* a value that doesn't parse is ignored */
+	q = "/*proxy: timeout=soon */ SELECT 1";
+	g_assert_cmpint(TRUE, ==, network_mysqld_proto_get_query_hints(q, strlen(q), hints));
+	g_assert_cmpint(hints->route, ==, NETWORK_MYSQLD_QUERY_HINT_ROUTE_DEFAULT);
+	g_assert_cmpint(hints->timeout_ms, ==, 0);
+
+	q = "/*proxy: ro, traceparent=00-0af7651916cd43dd8448eb211c80319c-b7ad6b7169203331-01 */ SELECT 1";
+	g_assert_cmpint(TRUE, ==, network_mysqld_proto_get_query_hints(q, strlen(q), hints));
+	g_assert_cmpint(hints->route, ==, NETWORK_MYSQLD_QUERY_HINT_ROUTE_RO);
+	g_assert_cmpstr(hints->traceparent->str, ==, "00-0af7651916cd43dd8448eb211c80319c-b7ad6b7169203331-01");
+
+	/* not terminated */
+	q = "/*proxy: ro SELECT 1";
+	g_assert_cmpint(FALSE, ==, network_mysqld_proto_get_query_hints(q, strlen(q), hints));
+	g_assert_cmpint(hints->route, ==, NETWORK_MYSQLD_QUERY_HINT_ROUTE_DEFAULT);
+
+	/* no hints, resets the hints of the last query */
+	q = "/*proxy: group=a */ SELECT 1";
+	g_assert_cmpint(TRUE, ==, network_mysqld_proto_get_query_hints(q, strlen(q), hints));
+	q = "/* ro */ SELECT 1";
+	g_assert_cmpint(FALSE, ==, network_mysqld_proto_get_query_hints(q, strlen(q), hints));
+	g_assert_cmpint(hints->group->len, ==, 0);
+	g_assert_cmpint(hints->cache_ttl_ms, ==, -1);
+	g_assert_cmpint(hints->traceparent->len, ==, 0);
+
+	network_mysqld_query_hints_free(hints);
+}
+
+/**
+ * the class of a statement by its first word
+ */
+static void t_query_class(void) {
+	struct {
+		const char *query;
+		network_mysqld_query_class_t query_class;
+	} queries[] = {
+		{ "SELECT 1", NETWORK_MYSQLD_QUERY_CLASS_SELECT },
+		{ "/*proxy: ro */ (select a from tbl)", NETWORK_MYSQLD_QUERY_CLASS_SELECT },
+		{ "replace INTO tbl VALUES (1)", NETWORK_MYSQLD_QUERY_CLASS_INSERT },
+		{ "-- a comment\nDELETE FROM tbl", NETWORK_MYSQLD_QUERY_CLASS_DELETE },
+		{ "TRUNCATE tbl", NETWORK_MYSQLD_QUERY_CLASS_DDL },
+		{ "START TRANSACTION", NETWORK_MYSQLD_QUERY_CLASS_TRANSACTION },
+		{ "desc tbl", NETWORK_MYSQLD_QUERY_CLASS_SHOW },
+		{ "SELECTED", NETWORK_MYSQLD_QUERY_CLASS_OTHER },
+		{ "", NETWORK_MYSQLD_QUERY_CLASS_OTHER },
+		{ NULL, NETWORK_MYSQLD_QUERY_CLASS_OTHER }
+	};
+	int i;
+
+	for (i = 0; queries[i].query; i++) {
+		g_assert_cmpint(network_mysqld_proto_get_query_class(queries[i].query, strlen(queries[i].query)), ==, queries[i].query_class);
+	}
+
+	for (i = 0; i < NETWORK_MYSQLD_QUERY_CLASS_MAX; i++) {
+		g_assert_cmpint(network_mysqld_query_class_from_name(network_mysqld_query_class_get_name(i)), ==, i);
+	}
+	g_assert_cmpint(network_mysqld_query_class_from_name("selects"), ==, -1);
+}
+
+/**
+ * the trivial queries the proxy may answer itself
+ */
+static void t_query_trivial_type(void) {
+	struct {
+		const char *query;
+		network_mysqld_query_trivial_type_t trivial_type;
+		const char *names;
+	} queries[] = {
+		{ "select @@version_comment limit 1", NETWORK_MYSQLD_QUERY_TRIVIAL_VERSION_COMMENT, NULL },
+		{ "SELECT  @@version_comment LIMIT 1;", NETWORK_MYSQLD_QUERY_TRIVIAL_VERSION_COMMENT, NULL },
+		{ "SELECT @@version_comment", NETWORK_MYSQLD_QUERY_TRIVIAL_NONE, NULL },
+		{ "SET NAMES utf8mb4", NETWORK_MYSQLD_QUERY_TRIVIAL_SET_NAMES, "utf8mb4" },
+		{ "set names 'UTF8MB4'  COLLATE utf8mb4_bin ;", NETWORK_MYSQLD_QUERY_TRIVIAL_SET_NAMES, "'utf8mb4' collate utf8mb4_bin" },
+		{ "SET NAMES utf8, autocommit = 0", NETWORK_MYSQLD_QUERY_TRIVIAL_NONE, NULL },
+		{ "SET NAMES utf8; DROP TABLE tbl", NETWORK_MYSQLD_QUERY_TRIVIAL_NONE, NULL },
+		{ "SET NAMES utf8 /* a comment */", NETWORK_MYSQLD_QUERY_TRIVIAL_NONE, NULL },
+		{ "SET autocommit=1", NETWORK_MYSQLD_QUERY_TRIVIAL_SET_AUTOCOMMIT_ON, NULL },
+		{ "set @@session.autocommit = ON", NETWORK_MYSQLD_QUERY_TRIVIAL_SET_AUTOCOMMIT_ON, NULL },
+		{ "SET autocommit=0", NETWORK_MYSQLD_QUERY_TRIVIAL_NONE, NULL },
+		{ "SET autocommit=1, sql_mode = ''", NETWORK_MYSQLD_QUERY_TRIVIAL_NONE, NULL },
+		{ "SET GLOBAL autocommit=1", NETWORK_MYSQLD_QUERY_TRIVIAL_NONE, NULL },
+		{ NULL, NETWORK_MYSQLD_QUERY_TRIVIAL_NONE, NULL }
+	};
+	GString *names = g_string_new(NULL);
+	int i;
+
+	for (i = 0; queries[i].query; i++) {
+		g_string_truncate(names, 0);
+
+		g_assert_cmpint(network_mysqld_proto_get_query_trivial_type(queries[i].query, strlen(queries[i].query), names), ==, queries[i].trivial_type);
+		if (queries[i].names) g_assert_cmpstr(names->str, ==, queries[i].names);
+	}
+
+	g_string_free(names, TRUE);
+}
+
+/**
+ * only SETs of literals to session variables are tracked
+ */
+static void t_query_session_vars(void) {
+	const char *untracked[] = {
+		"SELECT 1",
+		"SET @x = 1",
+		"SET GLOBAL sql_mode = ''",
+		"SET @@global.sql_mode = ''",
+		"SET sql_mode = CONCAT(@@sql_mode, ',ANSI')",
+		"SET autocommit = 0",
+		"SET NAMES utf8",
+		"SET character_set_results = NULL",
+		"SET SESSION TRANSACTION ISOLATION LEVEL READ COMMITTED",
+		"SET time_zone = '+00:00', @x = 1",
+		"SET time_zone = '+00:00'; SELECT 1",
+		"SET time_zone = '+00:00' /* comment */",
+		"SET time_zone = '+00:00',",
+		NULL
+	};
+	GHashTable *vars = g_hash_table_new_full(g_str_hash, g_str_equal, g_free, g_free);
+	int i;
+
+	for (i = 0; untracked[i]; i++) {
+		g_assert_cmpint(FALSE, ==, network_mysqld_proto_get_query_session_vars(untracked[i], strlen(untracked[i]), vars));
+	}
+	g_assert_cmpint(0, ==, g_hash_table_size(vars));
+
+#define Q "set @@session.Time_Zone = 'Europe/Berlin', SESSION sql_mode=ANSI, local max_execution_time = 1.5, @@wait_timeout = -10, sql_select_limit = DEFAULT;"
+	g_assert_cmpint(TRUE, ==, network_mysqld_proto_get_query_session_vars(C(Q), vars));
+#undef Q
+	g_assert_cmpint(5, ==, g_hash_table_size(vars));
+	g_assert_cmpstr("'Europe/Berlin'", ==, g_hash_table_lookup(vars, "time_zone"));
+	g_assert_cmpstr("ansi", ==, g_hash_table_lookup(vars, "sql_mode"));
+	g_assert_cmpstr("1.5", ==, g_hash_table_lookup(vars, "max_execution_time"));
+	g_assert_cmpstr("-10", ==, g_hash_table_lookup(vars, "wait_timeout"));
+	g_assert_cmpstr("default", ==, g_hash_table_lookup(vars, "sql_select_limit"));
+
+	/* only a check */
+	g_assert_cmpint(TRUE, ==, network_mysqld_proto_get_query_session_vars(C("SET sql_mode = ''"), NULL));
+
+	g_hash_table_destroy(vars);
+}
+
+/**
+ * the SETs that may change the charset of the session
+ */
+static void t_query_sets_charset(void) {
+	struct {
+		const char *query;
+		gboolean sets_charset;
+	} queries[] = {
+		{ "SET NAMES utf8mb4", TRUE },
+		{ "set names 'latin1' COLLATE 'latin1_bin'", TRUE },
+		{ "SET CHARACTER SET utf8", TRUE },
+		{ "SET CHARSET DEFAULT", TRUE },
+		{ "SET @@session.character_set_results = NULL", TRUE },
+		{ "SET sql_mode = '', collation_connection = utf8_bin", TRUE },
+		{ "SET sql_mode = '' /* names */", TRUE },
+		{ "SET sql_mode = 'names'", FALSE },
+		{ "SET @names = 1", FALSE },
+		{ "SELECT 'SET NAMES utf8'", FALSE },
+		{ "USE names", FALSE },
+		{ NULL, FALSE }
+	};
+	int i;
+
+	for (i = 0; queries[i].query; i++) {
+		g_assert_cmpint(network_mysqld_proto_query_sets_charset(queries[i].query, strlen(queries[i].query)), ==, queries[i].sets_charset);
+	}
+}
+
+/**
+ * a run of rows is skipped up to the EOF, their packet-ids are rewritten
+ */
+void t_query_result_skip_rows(void) {
+	network_mysqld_con con;
+	network_mysqld_com_query_result_t *query;
+	/* 3 rows, the EOF */
+	gchar packets[] =
+		"\x02\x00\x00\x05" "\x01" "a"
+		"\x02\x00\x00\x06" "\x01" "b"
+		"\x03\x00\x00\x07" "\xfb" "\x01" "c"
+		"\x05\x00\x00\x08" "\xfe" "\x00\x00\x02\x00";
+	gsize len = sizeof(packets) - 1;
+	guint8 recv_id = 4, send_id = 1;
+
+	memset(&con, 0, sizeof(con));
+	con.parse.command = COM_QUERY;
+	con.parse.data = query = network_mysqld_com_query_result_new();
+
+	query->state = PARSE_COM_QUERY_FIELD;
+	g_assert_cmpint(0, ==, network_mysqld_proto_skip_query_result_rows(&con, packets, len, &recv_id, &send_id));
+
+	query->state = PARSE_COM_QUERY_RESULT;
+	g_assert_cmpint(6 + 6 + 7, ==, network_mysqld_proto_skip_query_result_rows(&con, packets, len, &recv_id, &send_id));
+	g_assert_cmpint(3, ==, query->rows);
+	g_assert_cmpint(6 + 6 + 7, ==, query->bytes);
+	g_assert_cmpint(7, ==, recv_id);
+	g_assert_cmpint(4, ==, send_id);
+	g_assert_cmpint(2, ==, packets[3]);
+	g_assert_cmpint(4, ==, packets[6 + 6 + 3]);
+	g_assert_cmpint(8, ==, packets[6 + 6 + 7 + 3]); /* the EOF is left alone */
+
+	/* a packet out of sequence is left to the parser */
+	recv_id = 0;
+	g_assert_cmpint(0, ==, network_mysqld_proto_skip_query_result_rows(&con, packets, len, &recv_id, &send_id));
+
+	/* a row that continues after the buffer */
+	recv_id = 4;
+	g_assert_cmpint(0, ==, network_mysqld_proto_skip_query_result_rows(&con, packets, 5, &recv_id, &send_id));
+
+	network_mysqld_com_query_result_free(query);
+}
+
+/**
+ * only the rows of a result may be streamed, they are counted like parsed rows
+ */
+void t_query_result_row(void) {
+	network_mysqld_con con;
+	network_mysqld_com_query_result_t *query;
+
+	memset(&con, 0, sizeof(con));
+	con.parse.command = COM_QUERY;
+	con.parse.data = query = network_mysqld_com_query_result_new();
+
+	/* the field-defs are parsed */
+	query->state = PARSE_COM_QUERY_FIELD;
+	g_assert_cmpint(FALSE, ==, network_mysqld_proto_get_query_result_row(&con, 0x03, 100000));
+
+	query->state = PARSE_COM_QUERY_RESULT;
+	g_assert_cmpint(TRUE, ==, network_mysqld_proto_get_query_result_row(&con, 0x03, 100000));
+	/* a row that starts with a 8 byte length fills the packet */
+	g_assert_cmpint(TRUE, ==, network_mysqld_proto_get_query_result_row(&con, MYSQLD_PACKET_EOF, PACKET_LEN_MAX));
+	g_assert_cmpint(2, ==, query->rows);
+	g_assert_cmpint(NET_HEADER_SIZE + 100000 + NET_HEADER_SIZE + PACKET_LEN_MAX, ==, query->bytes);
+
+	/* the end of the result: the EOF or the OK with CLIENT_DEPRECATE_EOF */
+	g_assert_cmpint(FALSE, ==, network_mysqld_proto_get_query_result_row(&con, MYSQLD_PACKET_EOF, 5));
+	g_assert_cmpint(FALSE, ==, network_mysqld_proto_get_query_result_row(&con, MYSQLD_PACKET_EOF, 100000));
+	g_assert_cmpint(FALSE, ==, network_mysqld_proto_get_query_result_row(&con, MYSQLD_PACKET_ERR, 100000));
+	g_assert_cmpint(2, ==, query->rows);
+
+	con.parse.command = COM_STMT_PREPARE;
+	g_assert_cmpint(FALSE, ==, network_mysqld_proto_get_query_result_row(&con, 0x03, 100000));
+
+	network_mysqld_com_query_result_free(query);
+}
+
+/**
+ * feed the packets to the parser of the result of a COM_QUERY
+ *
+ * @return the result for the last packet
+ */
+static int t_com_query_result_feed(network_mysqld_com_query_result_t *query, strings *packets) {
+	int ret = -1;
+	int i;
+
+	for (i = 0; packets[i].s; i++) {
+		network_packet packet;
+
+		packet.data = g_string_new_len(packets[i].s, packets[i].s_len);
+		packet.offset = NET_HEADER_SIZE;
+
+		ret = network_mysqld_proto_get_com_query_result(&packet, query, FALSE);
+
+		g_string_free(packet.data, TRUE);
+
+		/* only the last packet ends the result */
+		if (packets[i + 1].s) g_assert_cmpint(ret, ==, 0);
+	}
+
+	return ret;
+}
+
+/**
+ * with CLIENT_DEPRECATE_EOF the field-defs are counted and a OK with a 0xfe header ends the rows
+ */
+static void t_com_query_result_deprecate_eof(void) {
+	strings packets[] = {
+		{ C("\1\0\0\1\2") }, /* 2 fields */
+		{ C("6\0\0\2\3def\0\6STATUS\0\rVariable_name\rVariable_name\f\10\0P\0\0\0\375\1\0\0\0\0") },
+		{ C("&\0\0\3\3def\0\6STATUS\0\5Value\5Value\f\10\0\0\2\0\0\375\1\0\0\0\0") },
+		{ C("\23\0\0\4\17Aborted_clients\00298") },
+		{ C("\7\0\0\5\376\0\0\"\0\1\0") }, /* OK with the EOF header */
+		{ NULL, 0 }
+	};
+	strings no_rows[] = {
+		{ C("\1\0\0\1\1") }, /* 1 field */
+		{ C("&\0\0\2\3def\0\6STATUS\0\5Value\5Value\f\10\0\0\2\0\0\375\1\0\0\0\0") },
+		{ C("\7\0\0\3\376\0\0\2\0\0\0") }, /* OK with the EOF header */
+		{ NULL, 0 }
+	};
+	network_mysqld_com_query_result_t *query;
+	network_queue *q;
+	GPtrArray *fields;
+	GList *chunk;
+	int i;
+
+	query = network_mysqld_com_query_result_new();
+	query->deprecate_eof = TRUE;
+
+	g_assert_cmpint(1, ==, t_com_query_result_feed(query, packets));
+	g_assert_cmpint(1, ==, query->rows);
+	g_assert_cmpint(1, ==, query->was_resultset);
+	g_assert_cmpint(0x22, ==, query->server_status);
+	g_assert_cmpint(1, ==, query->warning_count);
+
+	network_mysqld_com_query_result_free(query);
+
+	query = network_mysqld_com_query_result_new();
+	query->deprecate_eof = TRUE;
+
+	g_assert_cmpint(1, ==, t_com_query_result_feed(query, no_rows));
+	g_assert_cmpint(0, ==, query->rows);
+
+	network_mysqld_com_query_result_free(query);
+
+	/* the field-defs are followed by the rows directly */
+	q = network_queue_new();
+	for (i = 0; packets[i].s; i++) {
+		network_queue_append(q, g_string_new_len(packets[i].s, packets[i].s_len));
+	}
+
+	fields = g_ptr_array_new();
+	chunk = network_mysqld_proto_get_fielddefs(q->chunks->head, fields);
+	g_assert(NULL != chunk);
+	g_assert_cmpint(fields->len, ==, 2);
+	g_assert(chunk->next == q->chunks->tail->prev); /* the row */
+	network_mysqld_proto_fielddefs_free(fields);
+	network_queue_free(q);
+
+	q = network_queue_new();
+	for (i = 0; no_rows[i].s; i++) {
+		network_queue_append(q, g_string_new_len(no_rows[i].s, no_rows[i].s_len));
+	}
+
+	fields = g_ptr_array_new();
+	chunk = network_mysqld_proto_get_fielddefs(q->chunks->head, fields);
+	g_assert(NULL != chunk);
+	g_assert(chunk->next == q->chunks->tail); /* the OK, no rows */
+	network_mysqld_proto_fielddefs_free(fields);
+	network_queue_free(q);
+}
+
+/**
+ * with CLIENT_DEPRECATE_EOF the param- and field-defs of a COM_STMT_PREPARE are counted
+ */
+static void t_com_stmt_prepare_result_deprecate_eof(void) {
+	strings packets[] = {
+		{ C("\14\0\0\1\0\1\0\0\0\1\0\2\0\0\0\0") }, /* 1 field, 2 params */
+		{ C("&\0\0\2\3def\0\6STATUS\0\5Value\5Value\f\10\0\0\2\0\0\375\1\0\0\0\0") },
+		{ C("&\0\0\3\3def\0\6STATUS\0\5Value\5Value\f\10\0\0\2\0\0\375\1\0\0\0\0") },
+		{ C("&\0\0\4\3def\0\6STATUS\0\5Value\5Value\f\10\0\0\2\0\0\375\1\0\0\0\0") },
+		{ NULL, 0 }
+	};
+	network_mysqld_com_stmt_prepare_result_t *udata;
+	int i;
+
+	udata = network_mysqld_com_stmt_prepare_result_new();
+	udata->deprecate_eof = TRUE;
+
+	for (i = 0; packets[i].s; i++) {
+		network_packet packet;
+
+		packet.data = g_string_new_len(packets[i].s, packets[i].s_len);
+		packet.offset = NET_HEADER_SIZE;
+
+		g_assert_cmpint(packets[i + 1].s ? 0 : 1, ==, network_mysqld_proto_get_com_stmt_prepare_result(&packet, udata));
+
+		g_string_free(packet.data, TRUE);
+	}
+
+	network_mysqld_com_stmt_prepare_result_free(udata);
+}
 
 /**
  * @cond
@@ -1786,6 +2457,8 @@ int main(int argc, char **argv) {
 	g_test_add_func("/core/resultset-fields-broken-proto-null", t_resultset_fields_parse_null);
 	g_test_add_func("/core/resultset-fields-broken-proto-field-count-low", t_resultset_fields_parse_low);
 	g_test_add_func("/core/resultset-fields-broken-proto-field-count-high", t_resultset_fields_parse_high);
+	g_test_add_func("/core/resultset-slave-lag", t_slave_lag);
+	g_test_add_func("/core/resultset-binlog-pos", t_binlog_pos);
 
 	/* prepared statements */
 	g_test_add_func("/core/com_stmt_prepare_new", t_com_stmt_prepare_new);
@@ -1800,10 +2473,24 @@ int main(int argc, char **argv) {
 	g_test_add_func("/core/com_stmt_execute_from_packet_invalid", t_com_stmt_execute_from_packet_invalid);
 	
 	g_test_add_func("/core/com_stmt_execute_result_from_packet", t_com_stmt_execute_result_from_packet);
+	g_test_add_func("/core/com_stmt_execute_result_to_text", t_com_stmt_execute_result_to_text);
 
 	g_test_add_func("/core/com_stmt_close_new", t_com_stmt_close_new);
 	g_test_add_func("/core/com_stmt_close_from_packet", t_com_stmt_close_from_packet);
 
+	g_test_add_func("/core/query_rw_type", t_query_rw_type);
+	g_test_add_func("/core/query_has_session_state", t_query_has_session_state);
+	g_test_add_func("/core/query_hints", t_query_hints);
+	g_test_add_func("/core/query_class", t_query_class);
+	g_test_add_func("/core/query_trivial_type", t_query_trivial_type);
+	g_test_add_func("/core/query_session_vars", t_query_session_vars);
+	g_test_add_func("/core/query_sets_charset", t_query_sets_charset);
+	g_test_add_func("/core/query_result_row", t_query_result_row);
+	g_test_add_func("/core/query_result_skip_rows", t_query_result_skip_rows);
+	g_test_add_func("/core/com_query_result_deprecate_eof", t_com_query_result_deprecate_eof);
+	g_test_add_func("/core/com_stmt_prepare_result_deprecate_eof", t_com_stmt_prepare_result_deprecate_eof);
+	g_test_add_func("/core/fielddefs_arena", t_fielddefs_arena);
+
 	return g_test_run();
 }
 /** @endcond */
@@ -0,0 +1,236 @@
+/* $%BEGINLICENSE%$
+ Copyright (c) 2008, 2012, Oracle and/or its affiliates. All rights reserved.
+
+ This program is free software; you can redistribute it and/or
+ modify it under the terms of the GNU General Public License as
+ published by the Free Software Foundation; version 2 of the
+ License.
+
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ GNU General Public License for more details.
+
+ You should have received a copy of the GNU General Public License
+ along with this program; if not, write to the Free Software
+ Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA
+ 02110-1301  USA
+
+ $%ENDLICENSE%$ */
+#include <string.h>
+
+#include <glib.h>
+
+#include "network-socket.h"
+#include "network-mysqld-proto.h"
+#include "network-mysqld-resultset-writer.h"
+
+#if GLIB_CHECK_VERSION(2, 16, 0)
+#define C(x) x, sizeof(x) - 1
+#define S(x) x->str, x->len
+
+static GPtrArray *t_fields_new(void) {
+	GPtrArray *fields = network_mysqld_proto_fielddefs_new();
+	MYSQL_FIELD *field;
+
+	field = network_mysqld_proto_fielddef_new();
+	field->name = g_strdup("a");
+	field->type = MYSQL_TYPE_STRING;
+	g_ptr_array_add(fields, field);
+
+	field = network_mysqld_proto_fielddef_new();
+	field->name = g_strdup("b");
+	field->type = MYSQL_TYPE_STRING;
+	g_ptr_array_add(fields, field);
+
+	return fields;
+}
+
+/**
+ * split the chunks of the send-queue into packets again
+ */
+static GPtrArray *t_send_queue_get_packets(network_socket *sock) {
+	GPtrArray *packets = g_ptr_array_new();
+	GList *cur;
+
+	for (cur = sock->send_queue->chunks->head; cur; cur = cur->next) {
+		GString *chunk = cur->data;
+		gsize offset = 0;
+
+		while (offset < chunk->len) {
+			GString header;
+			gsize packet_len;
+
+			header.str = chunk->str + offset;
+			header.len = NET_HEADER_SIZE;
+			header.allocated_len = 0;
+
+			packet_len = NET_HEADER_SIZE + network_mysqld_proto_get_packet_len(&header);
+			g_assert_cmpint(offset + packet_len, <=, chunk->len);
+
+			g_ptr_array_add(packets, g_string_new_len(chunk->str + offset, packet_len));
+			offset += packet_len;
+		}
+	}
+
+	return packets;
+}
+
+static void t_packets_free(GPtrArray *packets) {
+	guint i;
+
+	for (i = 0; i < packets->len; i++) {
+		g_string_free(packets->pdata[i], TRUE);
+	}
+	g_ptr_array_free(packets, TRUE);
+}
+
+/**
+ * the packets are packed into one chunk
+ */
+void t_network_mysqld_resultset_writer_write() {
+	network_socket *sock = network_socket_new();
+	network_mysqld_resultset_writer_t *w;
+	GPtrArray *fields = t_fields_new();
+	GPtrArray *row = g_ptr_array_new();
+	GPtrArray *packets;
+	GString *packet;
+	guint i;
+
+	g_ptr_array_add(row, "1");
+	g_ptr_array_add(row, NULL);
+
+	w = network_mysqld_resultset_writer_new(sock);
+	g_assert_cmpint(0, ==, network_mysqld_resultset_writer_write_fields(w, fields));
+	g_assert_cmpint(0, ==, network_mysqld_resultset_writer_write_row(w, row));
+	g_assert_cmpint(0, ==, network_mysqld_resultset_writer_write_row(w, row));
+	g_assert_cmpint(0, ==, network_mysqld_resultset_writer_finish(w));
+	g_assert_cmpint(2, ==, w->rows);
+	network_mysqld_resultset_writer_free(w);
+
+	g_assert_cmpint(1, ==, sock->send_queue->chunks->length);
+	g_assert(sock->packet_id_is_reset);
+
+	/* field-count, 2 fields, EOF, 2 rows, EOF */
+	packets = t_send_queue_get_packets(sock);
+	g_assert_cmpint(7, ==, packets->len);
+
+	for (i = 0; i < packets->len; i++) {
+		g_assert_cmpint(i, ==, network_mysqld_proto_get_packet_id(packets->pdata[i]));
+	}
+
+	packet = packets->pdata[0];
+	g_assert_cmpint(packet->len, ==, NET_HEADER_SIZE + 1);
+	g_assert_cmpint(packet->str[NET_HEADER_SIZE], ==, 2);
+
+	packet = packets->pdata[3];
+	g_assert_cmpint(0, ==, memcmp(packet->str + NET_HEADER_SIZE, C("\xfe\x00\x00\x02\x00")));
+
+	packet = packets->pdata[4];
+	g_assert_cmpint(packet->len, ==, NET_HEADER_SIZE + 3);
+	g_assert_cmpint(0, ==, memcmp(packet->str + NET_HEADER_SIZE, C("\x01" "1" "\xfb")));
+
+	t_packets_free(packets);
+	g_ptr_array_free(row, TRUE);
+	network_mysqld_proto_fielddefs_free(fields);
+	network_socket_free(sock);
+}
+
+/**
+ * a row written field by field is the same as a row written in one go
+ */
+void t_network_mysqld_resultset_writer_row_append() {
+	network_socket *sock = network_socket_new();
+	network_mysqld_resultset_writer_t *w;
+	GPtrArray *fields = t_fields_new();
+	GPtrArray *packets;
+	const char *values[] = { "abc", "" };
+	gsize values_len[] = { 3, 0 };
+	GString *big;
+
+	big = g_string_new(NULL);
+	g_string_set_size(big, 300);
+	memset(big->str, 'x', big->len);
+
+	w = network_mysqld_resultset_writer_new(sock);
+	network_mysqld_resultset_writer_write_fields(w, fields);
+
+	network_mysqld_resultset_writer_write_row_len(w, values, values_len);
+
+	network_mysqld_resultset_writer_row_start(w);
+	network_mysqld_resultset_writer_row_append(w, C("abc"));
+	network_mysqld_resultset_writer_row_append(w, C(""));
+	network_mysqld_resultset_writer_row_end(w);
+
+	/* a field with a 3-byte length */
+	network_mysqld_resultset_writer_row_start(w);
+	network_mysqld_resultset_writer_row_append(w, S(big));
+	network_mysqld_resultset_writer_row_append(w, NULL, 0);
+	network_mysqld_resultset_writer_row_end(w);
+
+	network_mysqld_resultset_writer_finish(w);
+	network_mysqld_resultset_writer_free(w);
+
+	packets = t_send_queue_get_packets(sock);
+	g_assert_cmpint(8, ==, packets->len);
+
+	g_assert_cmpint(((GString *)packets->pdata[4])->len, ==, NET_HEADER_SIZE + 5);
+	g_assert_cmpint(0, ==, memcmp(((GString *)packets->pdata[4])->str + NET_HEADER_SIZE, ((GString *)packets->pdata[5])->str + NET_HEADER_SIZE, 5));
+
+	g_assert_cmpint(((GString *)packets->pdata[6])->len, ==, NET_HEADER_SIZE + 3 + 300 + 1);
+	g_assert_cmpint(0, ==, memcmp(((GString *)packets->pdata[6])->str + NET_HEADER_SIZE, C("\xfc\x2c\x01")));
+	g_assert_cmpint(6, ==, network_mysqld_proto_get_packet_id(packets->pdata[6]));
+
+	t_packets_free(packets);
+	g_string_free(big, TRUE);
+	network_mysqld_proto_fielddefs_free(fields);
+	network_socket_free(sock);
+}
+
+/**
+ * full batches are moved to the send-queue while the rows are written
+ */
+void t_network_mysqld_resultset_writer_flush() {
+	network_socket *sock = network_socket_new();
+	network_mysqld_resultset_writer_t *w;
+	GPtrArray *fields = t_fields_new();
+	GPtrArray *packets;
+	const char *values[] = { "a", "b" };
+	gsize values_len[] = { 1, 1 };
+
+	w = network_mysqld_resultset_writer_new(sock);
+	w->batch_size = 1; /* one packet per batch */
+
+	network_mysqld_resultset_writer_write_fields(w, fields);
+	network_mysqld_resultset_writer_write_row_len(w, values, values_len);
+	g_assert_cmpint(4, ==, sock->send_queue->chunks->length);
+
+	network_mysqld_resultset_writer_finish(w);
+	network_mysqld_resultset_writer_free(w);
+
+	g_assert_cmpint(6, ==, sock->send_queue->chunks->length);
+
+	packets = t_send_queue_get_packets(sock);
+	g_assert_cmpint(6, ==, packets->len);
+	g_assert_cmpint(5, ==, network_mysqld_proto_get_packet_id(packets->pdata[5]));
+
+	t_packets_free(packets);
+	network_mysqld_proto_fielddefs_free(fields);
+	network_socket_free(sock);
+}
+
+int main(int argc, char **argv) {
+	g_test_init(&argc, &argv, NULL);
+	g_test_bug_base("http://bugs.mysql.com/");
+
+	g_test_add_func("/core/network_mysqld_resultset_writer_write", t_network_mysqld_resultset_writer_write);
+	g_test_add_func("/core/network_mysqld_resultset_writer_row_append", t_network_mysqld_resultset_writer_row_append);
+	g_test_add_func("/core/network_mysqld_resultset_writer_flush", t_network_mysqld_resultset_writer_flush);
+
+	return g_test_run();
+}
+#else
+int main() {
+	return 77;
+}
+#endif
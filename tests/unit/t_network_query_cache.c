@@ -0,0 +1,270 @@
+/* $%BEGINLICENSE%$
+ Copyright (c) 2008, 2012, Oracle and/or its affiliates. All rights reserved.
+
+ This program is free software; you can redistribute it and/or
+ modify it under the terms of the GNU General Public License as
+ published by the Free Software Foundation; version 2 of the
+ License.
+
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ GNU General Public License for more details.
+
+ You should have received a copy of the GNU General Public License
+ along with this program; if not, write to the Free Software
+ Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA
+ 02110-1301  USA
+
+ $%ENDLICENSE%$ */
+#include <string.h>
+
+#include <glib.h>
+
+#include "network-query-cache.h"
+
+#if GLIB_CHECK_VERSION(2, 16, 0)
+#define C(x) x, sizeof(x) - 1
+#define S(x) x->str, x->len
+
+/**
+ * a result of a single packet
+ */
+static GPtrArray *t_packets_new(const char *s, gsize len) {
+	GPtrArray *packets = g_ptr_array_new();
+
+	g_ptr_array_add(packets, g_string_new_len(s, len));
+
+	return packets;
+}
+
+static GString *t_key_new(const char *query, gsize query_len) {
+	GString *key = g_string_new(NULL);
+	GString *username = g_string_new("root");
+	GString *default_db = g_string_new("test");
+
+	network_query_cache_key_set(key, username, default_db, NULL, FALSE, query, query_len);
+
+	g_string_free(username, TRUE);
+	g_string_free(default_db, TRUE);
+
+	return key;
+}
+
+void t_network_query_cache_is_cacheable() {
+	g_assert_cmpint(TRUE, ==, network_query_cache_is_cacheable(C("SELECT * FROM flags")));
+	g_assert_cmpint(TRUE, ==, network_query_cache_is_cacheable(C("SELECT 'NOW()' FROM flags")));
+
+	g_assert_cmpint(FALSE, ==, network_query_cache_is_cacheable(C("SELECT NOW()")));
+	g_assert_cmpint(FALSE, ==, network_query_cache_is_cacheable(C("SELECT rand() FROM flags")));
+	g_assert_cmpint(FALSE, ==, network_query_cache_is_cacheable(C("SELECT SQL_NO_CACHE * FROM flags")));
+	g_assert_cmpint(FALSE, ==, network_query_cache_is_cacheable(C("SELECT * FROM flags FOR UPDATE")));
+	g_assert_cmpint(FALSE, ==, network_query_cache_is_cacheable(C("UPDATE flags SET a = 1")));
+}
+
+void t_network_query_cache_key_set() {
+	GString *key = g_string_new(NULL);
+	GString *username = g_string_new("root");
+	GString *charset = g_string_new("33 utf8");
+
+	network_query_cache_key_set(key, username, NULL, NULL, FALSE, C("SELECT 1"));
+	g_assert_cmpint(key->len, ==, sizeof("root\0\0\0" "0\0SELECT 1") - 1);
+	g_assert(0 == memcmp(key->str, C("root\0\0\0" "0\0SELECT 1")));
+
+	/* the result is framed differently with CLIENT_DEPRECATE_EOF */
+	network_query_cache_key_set(key, username, NULL, NULL, TRUE, C("SELECT 1"));
+	g_assert(0 == memcmp(key->str, C("root\0\0\0" "1\0SELECT 1")));
+
+	/* the same bytes mean something else in another charset */
+	network_query_cache_key_set(key, username, NULL, charset, FALSE, C("SELECT 1"));
+	g_assert(0 == memcmp(key->str, C("root\0\0" "33 utf8\0" "0\0SELECT 1")));
+
+	g_string_free(charset, TRUE);
+	g_string_free(username, TRUE);
+	g_string_free(key, TRUE);
+}
+
+void t_network_query_cache_get() {
+	network_query_cache_t *cache;
+	network_query_cache_entry_t *entry;
+	GString *key;
+	gchar big[200];
+
+	cache = network_query_cache_new();
+	key = t_key_new(C("SELECT * FROM flags"));
+	memset(big, 'x', sizeof(big));
+
+	/* disabled by default */
+	g_assert_cmpint(FALSE, ==, network_query_cache_add(cache, key, t_packets_new(C("\x01\x00\x00\x01\x01"))));
+	g_assert(NULL == network_query_cache_get(cache, key));
+
+	network_query_cache_set_limits(cache, 1024, 60);
+
+	g_assert(NULL == network_query_cache_get(cache, key));
+	g_assert_cmpint(cache->misses, ==, 1);
+
+	g_assert_cmpint(TRUE, ==, network_query_cache_add(cache, key, t_packets_new(C("\x01\x00\x00\x01\x01"))));
+	g_assert_cmpint(cache->bytes, ==, 5);
+
+	entry = network_query_cache_get(cache, key);
+	g_assert(NULL != entry);
+	g_assert_cmpint(cache->hits, ==, 1);
+	g_assert_cmpint(entry->packets->len, ==, 1);
+
+	/* flushing keeps our reference valid */
+	g_assert_cmpint(network_query_cache_flush(cache), ==, 1);
+	g_assert_cmpint(cache->bytes, ==, 0);
+	g_assert_cmpint(((GString *)entry->packets->pdata[0])->len, ==, 5);
+	network_query_cache_entry_unref(cache, entry);
+
+	g_assert(NULL == network_query_cache_get(cache, key));
+
+	/* bigger than 1/8 of the cache */
+	g_assert_cmpint(FALSE, ==, network_query_cache_add(cache, key, t_packets_new(big, sizeof(big))));
+
+	g_string_free(key, TRUE);
+	network_query_cache_free(cache);
+}
+
+void t_network_query_cache_ttl() {
+	network_query_cache_t *cache;
+	GString *key;
+
+	cache = network_query_cache_new();
+	network_query_cache_set_limits(cache, 1024, 0);
+
+	key = t_key_new(C("SELECT * FROM flags"));
+
+	/* without a ttl the result expires right away */
+	g_assert_cmpint(TRUE, ==, network_query_cache_add(cache, key, t_packets_new(C("\x01\x00\x00\x01\x01"))));
+	g_assert(NULL == network_query_cache_get(cache, key));
+	g_assert_cmpint(cache->bytes, ==, 0);
+	g_assert_cmpint(cache->lru.length, ==, 0);
+
+	g_string_free(key, TRUE);
+	network_query_cache_free(cache);
+}
+
+void t_network_query_cache_evict() {
+	network_query_cache_t *cache;
+	GString *key1, *key2;
+	network_query_cache_entry_t *entry;
+
+	cache = network_query_cache_new();
+	network_query_cache_set_limits(cache, 80, 60); /* 10 bytes per result */
+
+	key1 = t_key_new(C("SELECT 1"));
+	key2 = t_key_new(C("SELECT 2"));
+
+	g_assert_cmpint(TRUE, ==, network_query_cache_add(cache, key1, t_packets_new(C("1234567890"))));
+	cache->max_bytes = 15; /* make room for one result only */
+	g_assert_cmpint(TRUE, ==, network_query_cache_add(cache, key2, t_packets_new(C("1234567890"))));
+
+	/* the least recently used result is gone */
+	g_assert_cmpint(cache->evictions, ==, 1);
+	g_assert(NULL == network_query_cache_get(cache, key1));
+
+	entry = network_query_cache_get(cache, key2);
+	g_assert(NULL != entry);
+	network_query_cache_entry_unref(cache, entry);
+
+	g_string_free(key1, TRUE);
+	g_string_free(key2, TRUE);
+	network_query_cache_free(cache);
+}
+
+void t_network_query_cache_get_written_tables() {
+	GPtrArray *tables = g_ptr_array_new();
+	guint i;
+
+	g_assert_cmpint(0, ==, network_query_cache_get_written_tables(C("SELECT * FROM flags"), tables));
+	g_assert_cmpint(0, ==, network_query_cache_get_written_tables(C("COMMIT"), tables));
+	g_assert_cmpint(0, ==, network_query_cache_get_written_tables(C("SET autocommit = 1"), tables));
+
+	g_assert_cmpint(1, ==, network_query_cache_get_written_tables(C("INSERT IGNORE INTO `Flags` VALUES (1)"), tables));
+	g_assert_cmpstr(((GString *)tables->pdata[0])->str, ==, "flags");
+
+	g_assert_cmpint(1, ==, network_query_cache_get_written_tables(C("UPDATE test.flags f SET f.a = 1"), tables));
+	g_assert_cmpstr(((GString *)tables->pdata[1])->str, ==, "flags");
+
+	g_assert_cmpint(1, ==, network_query_cache_get_written_tables(C("DELETE FROM /* c */ users WHERE id = 1"), tables));
+	g_assert_cmpstr(((GString *)tables->pdata[2])->str, ==, "users");
+
+	g_assert_cmpint(1, ==, network_query_cache_get_written_tables(C("TRUNCATE TABLE sessions"), tables));
+	g_assert_cmpstr(((GString *)tables->pdata[3])->str, ==, "sessions");
+
+	/* the DDL */
+	g_assert_cmpint(1, ==, network_query_cache_get_written_tables(C("ALTER TABLE flags ADD b INT"), tables));
+	g_assert_cmpstr(((GString *)tables->pdata[4])->str, ==, "flags");
+
+	g_assert_cmpint(2, ==, network_query_cache_get_written_tables(C("DROP TABLE IF EXISTS test.a, `B`"), tables));
+	g_assert_cmpstr(((GString *)tables->pdata[5])->str, ==, "a");
+	g_assert_cmpstr(((GString *)tables->pdata[6])->str, ==, "b");
+
+	g_assert_cmpint(2, ==, network_query_cache_get_written_tables(C("RENAME TABLE users TO users_old"), tables));
+	g_assert_cmpstr(((GString *)tables->pdata[7])->str, ==, "users");
+	g_assert_cmpstr(((GString *)tables->pdata[8])->str, ==, "users_old");
+
+	g_assert_cmpint(1, ==, network_query_cache_get_written_tables(C("CREATE TABLE IF NOT EXISTS t1 (id INT)"), tables));
+	g_assert_cmpstr(((GString *)tables->pdata[9])->str, ==, "t1");
+
+	/* we don't know what these change */
+	g_assert_cmpint(-1, ==, network_query_cache_get_written_tables(C("UPDATE a, b SET a.x = b.x"), tables));
+	g_assert_cmpint(-1, ==, network_query_cache_get_written_tables(C("DELETE a FROM a JOIN b USING (id)"), tables));
+	g_assert_cmpint(-1, ==, network_query_cache_get_written_tables(C("CREATE VIEW v AS SELECT 1"), tables));
+	g_assert_cmpint(-1, ==, network_query_cache_get_written_tables(C("DROP DATABASE test"), tables));
+	g_assert_cmpint(-1, ==, network_query_cache_get_written_tables(C("CALL proc()"), tables));
+
+	for (i = 0; i < tables->len; i++) {
+		g_string_free(tables->pdata[i], TRUE);
+	}
+	g_ptr_array_free(tables, TRUE);
+}
+
+void t_network_query_cache_invalidate_table() {
+	network_query_cache_t *cache;
+	GString *key1, *key2;
+
+	cache = network_query_cache_new();
+	network_query_cache_set_limits(cache, 1024, 60);
+
+	key1 = t_key_new(C("SELECT * FROM `Flags` WHERE name = 'users'"));
+	key2 = t_key_new(C("SELECT * FROM users"));
+
+	g_assert_cmpint(TRUE, ==, network_query_cache_add(cache, key1, t_packets_new(C("\x01\x00\x00\x01\x01"))));
+	g_assert_cmpint(TRUE, ==, network_query_cache_add(cache, key2, t_packets_new(C("\x01\x00\x00\x01\x01"))));
+
+	/* strings don't count, the identifiers are matched case-insensitive */
+	g_assert_cmpint(1, ==, network_query_cache_invalidate_table(cache, C("users")));
+	g_assert_cmpint(0, ==, network_query_cache_invalidate_table(cache, C("flag")));
+	g_assert_cmpint(1, ==, network_query_cache_invalidate_table(cache, C("flags")));
+	g_assert_cmpint(cache->invalidations, ==, 2);
+
+	g_assert(NULL == network_query_cache_get(cache, key1));
+	g_assert(NULL == network_query_cache_get(cache, key2));
+
+	g_string_free(key1, TRUE);
+	g_string_free(key2, TRUE);
+	network_query_cache_free(cache);
+}
+
+int main(int argc, char **argv) {
+	g_thread_init(NULL);
+	g_test_init(&argc, &argv, NULL);
+	g_test_bug_base("http://bugs.mysql.com/");
+
+	g_test_add_func("/core/network_query_cache_is_cacheable", t_network_query_cache_is_cacheable);
+	g_test_add_func("/core/network_query_cache_key_set", t_network_query_cache_key_set);
+	g_test_add_func("/core/network_query_cache_get", t_network_query_cache_get);
+	g_test_add_func("/core/network_query_cache_ttl", t_network_query_cache_ttl);
+	g_test_add_func("/core/network_query_cache_evict", t_network_query_cache_evict);
+	g_test_add_func("/core/network_query_cache_get_written_tables", t_network_query_cache_get_written_tables);
+	g_test_add_func("/core/network_query_cache_invalidate_table", t_network_query_cache_invalidate_table);
+
+	return g_test_run();
+}
+#else
+int main() {
+	return 77;
+}
+#endif
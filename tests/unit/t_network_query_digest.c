@@ -0,0 +1,169 @@
+/* $%BEGINLICENSE%$
+ Copyright (c) 2008, 2012, Oracle and/or its affiliates. All rights reserved.
+
+ This program is free software; you can redistribute it and/or
+ modify it under the terms of the GNU General Public License as
+ published by the Free Software Foundation; version 2 of the
+ License.
+
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ GNU General Public License for more details.
+
+ You should have received a copy of the GNU General Public License
+ along with this program; if not, write to the Free Software
+ Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA
+ 02110-1301  USA
+
+ $%ENDLICENSE%$ */
+#include <string.h>
+
+#include <glib.h>
+
+#include "network-query-digest.h"
+
+#if GLIB_CHECK_VERSION(2, 16, 0)
+#define C(x) x, sizeof(x) - 1
+#define S(x) x->str, x->len
+
+static void t_fingerprint_cmp(const char *query, const char *expected) {
+	GString *dst = g_string_new(NULL);
+	guint64 hash;
+
+	network_query_digest_fingerprint(dst, &hash, query, strlen(query));
+	g_assert_cmpstr(dst->str, ==, expected);
+
+	g_string_free(dst, TRUE);
+}
+
+static guint64 t_fingerprint_hash(const char *query) {
+	GString *dst = g_string_new(NULL);
+	guint64 hash;
+
+	network_query_digest_fingerprint(dst, &hash, query, strlen(query));
+
+	g_string_free(dst, TRUE);
+
+	return hash;
+}
+
+void t_network_query_digest_fingerprint() {
+	t_fingerprint_cmp("SELECT 1", "SELECT ?");
+	t_fingerprint_cmp("  SELECT\t*\n  FROM t1   WHERE id = 12 ", "SELECT * FROM t1 WHERE id = ?");
+	t_fingerprint_cmp("SELECT * FROM t1 WHERE name = 'it''s' AND v = \"a\\\"b\"", "SELECT * FROM t1 WHERE name = ? AND v = ?");
+	t_fingerprint_cmp("SELECT 1.5, .5, 1e-3, 0x1f", "SELECT ?+");
+	t_fingerprint_cmp("SELECT * FROM t1 WHERE id IN (1, 2, 3)", "SELECT * FROM t1 WHERE id IN (?+)");
+	t_fingerprint_cmp("SELECT * FROM t1 WHERE id IN (1)", "SELECT * FROM t1 WHERE id IN (?)");
+	t_fingerprint_cmp("SELECT /* hint */ id FROM t1 -- trailing\n", "SELECT id FROM t1");
+	t_fingerprint_cmp("SELECT id FROM t1 # comment", "SELECT id FROM t1");
+	t_fingerprint_cmp("SELECT 5-- 3", "SELECT ?");
+	t_fingerprint_cmp("SELECT col1, `col 2` FROM t2", "SELECT col1, `col 2` FROM t2");
+	t_fingerprint_cmp("INSERT INTO t1 VALUES ('a', 1), ('b', 2)", "INSERT INTO t1 VALUES (?+), (?+)");
+
+	/* the same digest for different literals, a different one for other tables */
+	g_assert(t_fingerprint_hash("SELECT * FROM t1 WHERE id = 1") == t_fingerprint_hash("SELECT  *  FROM t1 WHERE id = 'abc'"));
+	g_assert(t_fingerprint_hash("SELECT * FROM t1 WHERE id = 1") != t_fingerprint_hash("SELECT * FROM t2 WHERE id = 1"));
+}
+
+static void t_digest_add(network_query_digest_t *digest, guint ndx, const char *query, guint64 usec) {
+	GString *text = g_string_new(NULL);
+	guint64 hash;
+
+	network_query_digest_fingerprint(text, &hash, query, strlen(query));
+	network_query_digest_add(digest, ndx, hash, text, usec, 1, 10, FALSE, 0);
+
+	g_string_free(text, TRUE);
+}
+
+static void t_entries_free(GPtrArray *entries) {
+	guint i;
+
+	for (i = 0; i < entries->len; i++) {
+		network_query_digest_entry_free(entries->pdata[i]);
+	}
+	g_ptr_array_free(entries, TRUE);
+}
+
+void t_network_query_digest_merge() {
+	network_query_digest_t *digest;
+	network_query_digest_entry_t *entry;
+	GPtrArray *entries;
+
+	digest = network_query_digest_new();
+	g_assert_cmpint(FALSE, ==, network_query_digest_is_enabled(digest));
+
+	/* disabled, nothing is recorded */
+	t_digest_add(digest, 0, "SELECT 1", 10);
+
+	network_query_digest_set_limits(digest, 2, 16);
+	g_assert_cmpint(TRUE, ==, network_query_digest_is_enabled(digest));
+
+	t_digest_add(digest, 0, "SELECT * FROM t1 WHERE id = 1", 10);
+	t_digest_add(digest, 1, "SELECT * FROM t1 WHERE id = 2", 30);
+	t_digest_add(digest, 5, "SELECT * FROM t1 WHERE id = 3", 20); /* out of range, goes to the first shard */
+
+	entries = network_query_digest_get_entries(digest, NULL);
+	g_assert_cmpint(entries->len, ==, 1);
+
+	entry = entries->pdata[0];
+	g_assert_cmpstr(entry->text->str, ==, "SELECT * FROM t1 WHERE id = ?");
+	g_assert_cmpint(entry->count, ==, 3);
+	g_assert_cmpint(entry->sum_usec, ==, 60);
+	g_assert_cmpint(entry->max_usec, ==, 30);
+	g_assert_cmpint(entry->rows, ==, 3);
+	g_assert_cmpint(entry->bytes, ==, 30);
+	g_assert_cmpint(entry->errors, ==, 0);
+
+	t_entries_free(entries);
+	network_query_digest_free(digest);
+}
+
+void t_network_query_digest_evict() {
+	network_query_digest_t *digest;
+	network_query_digest_entry_t *evicted;
+	GPtrArray *entries;
+	guint i;
+
+	digest = network_query_digest_new();
+	network_query_digest_set_limits(digest, 1, 2);
+
+	t_digest_add(digest, 0, "SELECT * FROM t1", 10);
+	t_digest_add(digest, 0, "SELECT * FROM t2", 20);
+	t_digest_add(digest, 0, "SELECT * FROM t1", 10); /* t1 is the most recently used now */
+	t_digest_add(digest, 0, "SELECT * FROM t3", 40); /* evicts t2 */
+
+	evicted = network_query_digest_entry_new();
+	entries = network_query_digest_get_entries(digest, evicted);
+	g_assert_cmpint(entries->len, ==, 2);
+
+	for (i = 0; i < entries->len; i++) {
+		network_query_digest_entry_t *entry = entries->pdata[i];
+
+		g_assert_cmpstr(entry->text->str, !=, "SELECT * FROM t2");
+	}
+
+	g_assert_cmpint(evicted->count, ==, 1);
+	g_assert_cmpint(evicted->sum_usec, ==, 20);
+
+	network_query_digest_entry_free(evicted);
+	t_entries_free(entries);
+	network_query_digest_free(digest);
+}
+
+int main(int argc, char **argv) {
+	g_thread_init(NULL);
+	g_test_init(&argc, &argv, NULL);
+	g_test_bug_base("http://bugs.mysql.com/");
+
+	g_test_add_func("/core/network_query_digest_fingerprint", t_network_query_digest_fingerprint);
+	g_test_add_func("/core/network_query_digest_merge", t_network_query_digest_merge);
+	g_test_add_func("/core/network_query_digest_evict", t_network_query_digest_evict);
+
+	return g_test_run();
+}
+#else
+int main() {
+	return 77;
+}
+#endif
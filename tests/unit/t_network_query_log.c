@@ -0,0 +1,158 @@
+/* $%BEGINLICENSE%$
+ Copyright (c) 2008, 2012, Oracle and/or its affiliates. All rights reserved.
+
+ This program is free software; you can redistribute it and/or
+ modify it under the terms of the GNU General Public License as
+ published by the Free Software Foundation; version 2 of the
+ License.
+
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ GNU General Public License for more details.
+
+ You should have received a copy of the GNU General Public License
+ along with this program; if not, write to the Free Software
+ Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA
+ 02110-1301  USA
+
+ $%ENDLICENSE%$ */
+#include <string.h>
+#include <string.h>
+#include <stdlib.h>
+#ifndef WIN32
+#include <unistd.h>
+#else
+#include <io.h>
+#endif
+
+#include <glib.h>
+#include <glib/gstdio.h>
+
+#include "network-query-log.h"
+
+#if GLIB_CHECK_VERSION(2, 16, 0)
+#define C(x) x, sizeof(x) - 1
+#define S(x) x->str, x->len
+
+void t_network_query_log_json() {
+	network_query_log_entry_t *entry;
+	GString *out = g_string_new(NULL);
+
+	entry = network_query_log_entry_new();
+	entry->ts.tv_sec = 1300000000;
+	entry->ts.tv_usec = 5;
+	entry->usec = 1500000;
+	entry->first_usec = 250;
+	entry->user = g_strdup("root");
+	entry->client = g_strdup("127.0.0.1:34567");
+	entry->backend = g_strdup("127.0.0.1:3306");
+	entry->command = 3;
+	entry->rows = 2;
+	entry->bytes = 40;
+	g_string_assign(entry->query, "SELECT \"a\\b\"\n\001");
+
+	network_query_log_entry_to_json(out, entry);
+	g_assert_cmpstr(out->str, ==,
+			"{\"ts\":1300000000.000005,\"query_time\":1.500000,\"first_byte_time\":0.000250,"
+			"\"user\":\"root\",\"db\":null,\"client\":\"127.0.0.1:34567\",\"backend\":\"127.0.0.1:3306\","
+			"\"command\":3,\"rows\":2,\"bytes\":40,\"status\":\"ok\",\"injected\":false,"
+			"\"query\":\"SELECT \\\"a\\\\b\\\"\\n\\u0001\"}\n");
+
+	network_query_log_entry_free(entry);
+	g_string_free(out, TRUE);
+}
+
+void t_network_query_log_filter() {
+	network_query_log_t *log;
+	GError *gerr = NULL;
+	gchar *filename;
+	int fd;
+	int i, wanted = 0;
+
+	log = network_query_log_new();
+
+	/* not open yet, we don't want anything */
+	g_assert_cmpint(FALSE, ==, network_query_log_wants(log, 1000));
+
+	fd = g_file_open_tmp(NULL, &filename, &gerr);
+	g_assert_cmpint(-1, !=, fd);
+	close(fd);
+
+	g_assert_cmpint(0, ==, network_query_log_open(log, filename, &gerr));
+
+	network_query_log_set_filter(log, 100, 4);
+
+	g_assert_cmpint(FALSE, ==, network_query_log_wants(log, 99));
+
+	for (i = 0; i < 40; i++) {
+		if (network_query_log_wants(log, 100)) wanted++;
+	}
+	g_assert_cmpint(wanted, ==, 10);
+
+	network_query_log_free(log);
+
+	g_unlink(filename);
+	g_free(filename);
+}
+
+void t_network_query_log_write() {
+	network_query_log_t *log;
+	GError *gerr = NULL;
+	gchar *filename;
+	gchar *content;
+	gchar **lines;
+	gsize content_len;
+	int fd;
+	int i;
+
+	log = network_query_log_new();
+
+	fd = g_file_open_tmp(NULL, &filename, &gerr);
+	g_assert_cmpint(-1, !=, fd);
+	close(fd);
+
+	g_assert_cmpint(0, ==, network_query_log_open(log, filename, &gerr));
+
+	for (i = 0; i < 10; i++) {
+		network_query_log_entry_t *entry = network_query_log_entry_new();
+
+		g_string_printf(entry->query, "SELECT %d", i);
+
+		g_assert_cmpint(TRUE, ==, network_query_log_push(log, entry));
+	}
+
+	/* flushes the queue */
+	network_query_log_free(log);
+
+	g_assert_cmpint(TRUE, ==, g_file_get_contents(filename, &content, &content_len, &gerr));
+
+	lines = g_strsplit(content, "\n", -1);
+	g_assert_cmpint(g_strv_length(lines), ==, 11); /* the last line is empty */
+	g_assert(NULL != strstr(lines[0], "\"query\":\"SELECT 0\""));
+	g_assert(NULL != strstr(lines[9], "\"query\":\"SELECT 9\""));
+	g_assert_cmpstr(lines[10], ==, "");
+
+	g_strfreev(lines);
+	g_free(content);
+
+	g_unlink(filename);
+	g_free(filename);
+}
+
+int main(int argc, char **argv) {
+	g_thread_init(NULL);
+	g_test_init(&argc, &argv, NULL);
+	g_test_bug_base("http://bugs.mysql.com/");
+
+	g_test_add_func("/core/network_query_log_json", t_network_query_log_json);
+	g_test_add_func("/core/network_query_log_filter", t_network_query_log_filter);
+	g_test_add_func("/core/network_query_log_write", t_network_query_log_write);
+
+	return g_test_run();
+}
+#else
+int main() {
+	return 77;
+}
+#endif
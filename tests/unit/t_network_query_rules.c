@@ -0,0 +1,211 @@
+/* $%BEGINLICENSE%$
+ Copyright (c) 2008, 2012, Oracle and/or its affiliates. All rights reserved.
+
+ This program is free software; you can redistribute it and/or
+ modify it under the terms of the GNU General Public License as
+ published by the Free Software Foundation; version 2 of the
+ License.
+
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ GNU General Public License for more details.
+
+ You should have received a copy of the GNU General Public License
+ along with this program; if not, write to the Free Software
+ Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA
+ 02110-1301  USA
+
+ $%ENDLICENSE%$ */
+#include <string.h>
+#include <unistd.h>
+
+#include <glib.h>
+
+#include "network-query-rules.h"
+
+#if GLIB_CHECK_VERSION(2, 16, 0)
+#define C(x) x, sizeof(x) - 1
+
+static gchar *t_rules_file(const char *contents) {
+	gchar *filename;
+	GError *gerr = NULL;
+	int fd;
+
+	fd = g_file_open_tmp("t_network_query_rules-XXXXXX", &filename, &gerr);
+	g_assert_no_error(gerr);
+	close(fd);
+
+	g_assert_cmpint(TRUE, ==, g_file_set_contents(filename, contents, -1, NULL));
+
+	return filename;
+}
+
+static network_query_rule_t *t_rule(const char *user, const char *db, gint command, gint query_class, const char *hints) {
+	network_query_rule_t *rule = network_query_rule_new();
+
+	rule->user = g_strdup(user);
+	rule->db = g_strdup(db);
+	rule->command = command;
+	rule->query_class = query_class;
+	network_mysqld_query_hints_parse(rule->hints, hints, strlen(hints));
+
+	return rule;
+}
+
+/**
+ * @return the position of the rule that matches, -1 if none
+ */
+static gint t_match(network_query_ruleset_t *ruleset, const char *user, const char *db, guint8 command, gint query_class) {
+	network_query_rule_t *rule;
+
+	rule = network_query_ruleset_match(ruleset, user, db, command, query_class);
+
+	return rule ? (gint)rule->ndx : -1;
+}
+
+/**
+ * the first rule of the file that matches decides, whatever fields it matches on
+ */
+void t_network_query_ruleset_match() {
+	network_query_ruleset_t *ruleset = network_query_ruleset_new();
+
+	g_assert_cmpint(-1, ==, t_match(ruleset, "app", "orders", COM_QUERY, NETWORK_MYSQLD_QUERY_CLASS_SELECT));
+
+	network_query_ruleset_add(ruleset, t_rule("report", NULL, NETWORK_QUERY_RULE_ANY, NETWORK_MYSQLD_QUERY_CLASS_SELECT, "ro"));
+	network_query_ruleset_add(ruleset, t_rule(NULL, "orders", COM_QUERY, NETWORK_QUERY_RULE_ANY, "group=orders"));
+	network_query_ruleset_add(ruleset, t_rule("report", NULL, NETWORK_QUERY_RULE_ANY, NETWORK_MYSQLD_QUERY_CLASS_SELECT, "rw"));
+	network_query_ruleset_add(ruleset, t_rule(NULL, NULL, NETWORK_QUERY_RULE_ANY, NETWORK_QUERY_RULE_ANY, "timeout=1s"));
+
+	g_assert_cmpint(4, ==, ruleset->rules->len);
+
+	/* a rule with the same fields as an earlier one never matches */
+	g_assert_cmpint(0, ==, t_match(ruleset, "report", "orders", COM_QUERY, NETWORK_MYSQLD_QUERY_CLASS_SELECT));
+	g_assert_cmpint(1, ==, t_match(ruleset, "report", "orders", COM_QUERY, NETWORK_MYSQLD_QUERY_CLASS_INSERT));
+	g_assert_cmpint(1, ==, t_match(ruleset, "app", "orders", COM_QUERY, NETWORK_MYSQLD_QUERY_CLASS_SELECT));
+	g_assert_cmpint(3, ==, t_match(ruleset, "app", "orders", COM_STMT_EXECUTE, NETWORK_QUERY_RULE_ANY));
+
+	/* the rules on a class don't match the commands that have none */
+	g_assert_cmpint(3, ==, t_match(ruleset, "report", NULL, COM_PING, NETWORK_QUERY_RULE_ANY));
+
+	/* no user or db only matches the rules that don't care */
+	g_assert_cmpint(3, ==, t_match(ruleset, NULL, NULL, COM_QUERY, NETWORK_MYSQLD_QUERY_CLASS_SELECT));
+
+	network_query_ruleset_free(ruleset);
+}
+
+/**
+ * the hints of the comment of a query win over those of the rule
+ */
+void t_network_query_rule_apply() {
+	network_query_rule_t *rule = t_rule(NULL, NULL, NETWORK_QUERY_RULE_ANY, NETWORK_QUERY_RULE_ANY, "ro, group=analytics, cache_ttl=30s, timeout=2s");
+	network_mysqld_query_hints_t *hints = network_mysqld_query_hints_new();
+
+	network_query_rule_apply(rule, hints);
+	g_assert_cmpint(NETWORK_MYSQLD_QUERY_HINT_ROUTE_RO, ==, hints->route);
+	g_assert_cmpstr("analytics", ==, hints->group->str);
+	g_assert_cmpint(30000, ==, hints->cache_ttl_ms);
+	g_assert_cmpint(2000, ==, hints->timeout_ms);
+
+	network_mysqld_query_hints_reset(hints);
+	g_assert_cmpint(TRUE, ==, network_mysqld_proto_get_query_hints(C("/*proxy: rw, nocache */ SELECT 1"), hints));
+
+	network_query_rule_apply(rule, hints);
+	g_assert_cmpint(NETWORK_MYSQLD_QUERY_HINT_ROUTE_RW, ==, hints->route);
+	g_assert_cmpstr("analytics", ==, hints->group->str);
+	g_assert_cmpint(0, ==, hints->cache_ttl_ms);
+	g_assert_cmpint(2000, ==, hints->timeout_ms);
+
+	network_mysqld_query_hints_free(hints);
+	network_query_rule_free(rule);
+}
+
+/**
+ * the rules of a file replace the current ones, a file with errors keeps them
+ */
+void t_network_query_rules_load() {
+	network_query_rules_t *rules = network_query_rules_new();
+	network_query_ruleset_t *ruleset;
+	network_query_rule_t *rule;
+	GError *gerr = NULL;
+	gchar *filename;
+
+	g_assert(NULL == network_query_rules_get(rules));
+
+	filename = t_rules_file(
+			"[reports]\n"
+			"user = report\n"
+			"class = SELECT\n"
+			"hints = ro, group=analytics\n"
+			"\n"
+			"[batch]\n"
+			"db = orders\n"
+			"command = stmt_execute\n"
+			"hints = timeout=300s\n");
+
+	g_assert_cmpint(0, ==, network_query_rules_load(rules, filename, &gerr));
+	g_assert_no_error(gerr);
+
+	ruleset = network_query_rules_get(rules);
+	g_assert_cmpint(2, ==, ruleset->rules->len);
+
+	rule = network_query_ruleset_match(ruleset, "report", "orders", COM_QUERY, NETWORK_MYSQLD_QUERY_CLASS_SELECT);
+	g_assert(NULL != rule);
+	g_assert_cmpstr("reports", ==, rule->name);
+	g_assert_cmpint(NETWORK_MYSQLD_QUERY_HINT_ROUTE_RO, ==, rule->hints->route);
+
+	rule = network_query_ruleset_match(ruleset, "report", "orders", COM_STMT_EXECUTE, NETWORK_QUERY_RULE_ANY);
+	g_assert(NULL != rule);
+	g_assert_cmpstr("batch", ==, rule->name);
+	g_assert_cmpint(300000, ==, rule->hints->timeout_ms);
+
+	g_assert(NULL == network_query_ruleset_match(ruleset, "app", "orders", COM_QUERY, NETWORK_MYSQLD_QUERY_CLASS_SELECT));
+
+	/* an unknown key, command or class, or a rule without hints, rejects the whole file */
+	g_assert_cmpint(TRUE, ==, g_file_set_contents(filename, "[a]\nuser = app\nhost = 10.0.0.1\nhints = ro\n", -1, NULL));
+	g_assert_cmpint(-1, ==, network_query_rules_load(rules, filename, &gerr));
+	g_assert_error(gerr, NETWORK_QUERY_RULES_ERROR, NETWORK_QUERY_RULES_ERROR_PARSE);
+	g_clear_error(&gerr);
+
+	g_assert_cmpint(TRUE, ==, g_file_set_contents(filename, "[a]\ncommand = select\nhints = ro\n", -1, NULL));
+	g_assert_cmpint(-1, ==, network_query_rules_load(rules, filename, &gerr));
+	g_assert_error(gerr, NETWORK_QUERY_RULES_ERROR, NETWORK_QUERY_RULES_ERROR_PARSE);
+	g_clear_error(&gerr);
+
+	g_assert_cmpint(TRUE, ==, g_file_set_contents(filename, "[a]\nclass = query\nhints = ro\n", -1, NULL));
+	g_assert_cmpint(-1, ==, network_query_rules_load(rules, filename, &gerr));
+	g_assert_error(gerr, NETWORK_QUERY_RULES_ERROR, NETWORK_QUERY_RULES_ERROR_PARSE);
+	g_clear_error(&gerr);
+
+	g_assert_cmpint(TRUE, ==, g_file_set_contents(filename, "[a]\nuser = app\nhints = routing=fast\n", -1, NULL));
+	g_assert_cmpint(-1, ==, network_query_rules_load(rules, filename, &gerr));
+	g_assert_error(gerr, NETWORK_QUERY_RULES_ERROR, NETWORK_QUERY_RULES_ERROR_PARSE);
+	g_clear_error(&gerr);
+
+	unlink(filename);
+	g_assert_cmpint(-1, ==, network_query_rules_load(rules, filename, &gerr));
+	g_assert_error(gerr, NETWORK_QUERY_RULES_ERROR, NETWORK_QUERY_RULES_ERROR_READ);
+	g_clear_error(&gerr);
+
+	g_assert(ruleset == network_query_rules_get(rules));
+
+	g_free(filename);
+	network_query_rules_free(rules);
+}
+
+int main(int argc, char **argv) {
+	g_thread_init(NULL);
+	g_test_init(&argc, &argv, NULL);
+	g_test_bug_base("http://bugs.mysql.com/");
+
+	g_test_add_func("/core/network_query_ruleset_match", t_network_query_ruleset_match);
+	g_test_add_func("/core/network_query_rule_apply", t_network_query_rule_apply);
+	g_test_add_func("/core/network_query_rules_load", t_network_query_rules_load);
+
+	return g_test_run();
+}
+#else
+int main() {
+	return 77;
+}
+#endif
@@ -0,0 +1,121 @@
+/* $%BEGINLICENSE%$
+ Copyright (c) 2008, 2012, Oracle and/or its affiliates. All rights reserved.
+
+ This program is free software; you can redistribute it and/or
+ modify it under the terms of the GNU General Public License as
+ published by the Free Software Foundation; version 2 of the
+ License.
+
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ GNU General Public License for more details.
+
+ You should have received a copy of the GNU General Public License
+ along with this program; if not, write to the Free Software
+ Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA
+ 02110-1301  USA
+
+ $%ENDLICENSE%$ */
+#include <string.h>
+#include <unistd.h>
+
+#include <glib.h>
+
+#include "network-query-digest.h"
+#include "network-query-timeout.h"
+
+#if GLIB_CHECK_VERSION(2, 16, 0)
+#define C(x) x, sizeof(x) - 1
+
+static guint64 t_hash(const char *query) {
+	GString *fingerprint = g_string_new(NULL);
+	guint64 hash;
+
+	network_query_digest_fingerprint(fingerprint, &hash, query, strlen(query));
+	g_string_free(fingerprint, TRUE);
+
+	return hash;
+}
+
+/**
+ * the budget applies to all queries with the fingerprint
+ */
+void t_network_query_timeouts_get() {
+	network_query_timeouts_t *timeouts = network_query_timeouts_new();
+	guint64 budget_ms = 0;
+
+	g_assert_cmpint(TRUE, ==, network_query_timeouts_is_empty(timeouts));
+
+	network_query_timeouts_set(timeouts, C("SELECT * FROM orders WHERE id = 1"), 500);
+	g_assert_cmpint(FALSE, ==, network_query_timeouts_is_empty(timeouts));
+
+	g_assert_cmpint(TRUE, ==, network_query_timeouts_get(timeouts, t_hash("select *  from orders where id = 42"), &budget_ms));
+	g_assert_cmpint(500, ==, budget_ms);
+
+	g_assert_cmpint(FALSE, ==, network_query_timeouts_get(timeouts, t_hash("SELECT * FROM customers WHERE id = 1"), &budget_ms));
+
+	network_query_timeouts_free(timeouts);
+}
+
+/**
+ * load the budgets from a file, bad lines fail the load
+ */
+void t_network_query_timeouts_load() {
+	network_query_timeouts_t *timeouts = network_query_timeouts_new();
+	guint64 budget_ms = 0;
+	gchar *filename;
+	GError *gerr = NULL;
+	int fd;
+
+	fd = g_file_open_tmp("t_network_query_timeout-XXXXXX", &filename, &gerr);
+	g_assert_no_error(gerr);
+	close(fd);
+
+	g_assert_cmpint(TRUE, ==, g_file_set_contents(filename,
+				"# seconds\tquery\n"
+				"\n"
+				"0.25\tSELECT * FROM orders WHERE id = 1\n"
+				"30   SELECT COUNT(*) FROM orders\n", -1, NULL));
+
+	g_assert_cmpint(0, ==, network_query_timeouts_load(timeouts, filename, &gerr));
+	g_assert_no_error(gerr);
+
+	g_assert_cmpint(TRUE, ==, network_query_timeouts_get(timeouts, t_hash("SELECT * FROM orders WHERE id = 2"), &budget_ms));
+	g_assert_cmpint(250, ==, budget_ms);
+	g_assert_cmpint(TRUE, ==, network_query_timeouts_get(timeouts, t_hash("SELECT COUNT(*) FROM orders"), &budget_ms));
+	g_assert_cmpint(30000, ==, budget_ms);
+
+	g_assert_cmpint(TRUE, ==, g_file_set_contents(filename, "SELECT 1\n", -1, NULL));
+	g_assert_cmpint(-1, ==, network_query_timeouts_load(timeouts, filename, &gerr));
+	g_assert_error(gerr, NETWORK_QUERY_TIMEOUTS_ERROR, NETWORK_QUERY_TIMEOUTS_ERROR_PARSE);
+	g_clear_error(&gerr);
+
+	g_assert_cmpint(TRUE, ==, g_file_set_contents(filename, "0 SELECT 1\n", -1, NULL));
+	g_assert_cmpint(-1, ==, network_query_timeouts_load(timeouts, filename, &gerr));
+	g_assert_error(gerr, NETWORK_QUERY_TIMEOUTS_ERROR, NETWORK_QUERY_TIMEOUTS_ERROR_PARSE);
+	g_clear_error(&gerr);
+
+	unlink(filename);
+	g_assert_cmpint(-1, ==, network_query_timeouts_load(timeouts, filename, &gerr));
+	g_assert_error(gerr, NETWORK_QUERY_TIMEOUTS_ERROR, NETWORK_QUERY_TIMEOUTS_ERROR_READ);
+	g_clear_error(&gerr);
+
+	g_free(filename);
+	network_query_timeouts_free(timeouts);
+}
+
+int main(int argc, char **argv) {
+	g_test_init(&argc, &argv, NULL);
+	g_test_bug_base("http://bugs.mysql.com/");
+
+	g_test_add_func("/core/network_query_timeouts_get", t_network_query_timeouts_get);
+	g_test_add_func("/core/network_query_timeouts_load", t_network_query_timeouts_load);
+
+	return g_test_run();
+}
+#else
+int main() {
+	return 77;
+}
+#endif
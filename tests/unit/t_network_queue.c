@@ -26,6 +26,8 @@
 #include <glib.h>
 
 #include "network-socket.h"
+#include "network-buffer-pool.h"
+#include "network-object-pool.h"
 
 #if GLIB_CHECK_VERSION(2, 16, 0)
 #define C(x) x, sizeof(x) - 1
@@ -74,6 +76,32 @@ void test_network_queue_peek_string() {
 	network_queue_free(q);
 }
 
+void test_network_queue_peek_str() {
+	network_queue *q;
+	GString *s;
+
+	q = network_queue_new();
+	g_assert(q);
+
+	network_queue_append(q, g_string_new("123"));
+	network_queue_append(q, g_string_new("456"));
+
+	/* in the first chunk, no copy */
+	g_assert(0 == memcmp(network_queue_peek_str(q, 3), "123", 3));
+
+	/* spans chunks */
+	g_assert(NULL == network_queue_peek_str(q, 4));
+	g_assert(NULL == network_queue_peek_str(q, 7));
+
+	/* the offset into the first chunk is respected */
+	s = network_queue_pop_string(q, 2, NULL);
+	g_string_free(s, TRUE);
+	g_assert(0 == memcmp(network_queue_peek_str(q, 1), "3", 1));
+	g_assert(NULL == network_queue_peek_str(q, 2));
+
+	network_queue_free(q);
+}
+
 void test_network_queue_pop_string() {
 	network_queue *q;
 	GString *s;
@@ -123,13 +151,192 @@ void test_network_queue_pop_string() {
 	network_queue_free(q);
 }
 
+/**
+ * chunks that are fully consumed by network_queue_pop_string() go back into the buffer-pool
+ */
+void test_network_queue_buffer_pool() {
+	network_queue *q;
+	network_buffer_pool_stats_t stats_before, stats_after;
+	GString *s;
+	GString *chunk;
+
+	q = network_queue_new();
+	g_assert(q);
+
+	chunk = network_buffer_pool_get(6);
+	g_assert(chunk);
+	g_assert_cmpint(chunk->len, ==, 0);
+	g_assert_cmpint(chunk->allocated_len, >, NETWORK_BUFFER_POOL_CHUNK_SIZE);
+	g_string_append_len(chunk, C("123456"));
+
+	network_queue_append(q, chunk);
+
+	/* take the chunk in 2 steps, the 2nd one releases the chunk to the pool */
+	s = network_queue_pop_string(q, 3, NULL);
+	g_assert_cmpstr(s->str, ==, "123");
+	g_string_free(s, TRUE);
+
+	network_buffer_pool_get_stats(&stats_before);
+	s = network_queue_pop_string(q, 3, NULL);
+	g_assert_cmpstr(s->str, ==, "456");
+	g_string_free(s, TRUE);
+	network_buffer_pool_get_stats(&stats_after);
+
+	g_assert_cmpint(stats_after.idle, ==, stats_before.idle + 1);
+	g_assert_cmpint(stats_after.idle_max, >=, stats_after.idle);
+
+	/* ... and we get it back on the next request */
+	chunk = network_buffer_pool_get(6);
+	g_assert_cmpint(chunk->len, ==, 0);
+	network_buffer_pool_get_stats(&stats_before);
+	g_assert_cmpint(stats_before.hits, ==, stats_after.hits + 1);
+	g_assert_cmpint(stats_before.idle, ==, stats_after.idle - 1);
+	g_string_free(chunk, TRUE);
+
+	/* reads larger than the largest size-class are not taken from the pool */
+	chunk = network_buffer_pool_get((NETWORK_BUFFER_POOL_CHUNK_SIZE << NETWORK_BUFFER_POOL_CLASSES) + 1);
+	g_assert_cmpint(chunk->allocated_len, >, NETWORK_BUFFER_POOL_CHUNK_SIZE << NETWORK_BUFFER_POOL_CLASSES);
+	network_buffer_pool_put(chunk);
+	network_buffer_pool_get_stats(&stats_after);
+	g_assert_cmpint(stats_after.idle, ==, stats_before.idle);
+
+	network_queue_free(q);
+}
+
+/**
+ * the read-sizes of network_socket_read_adaptive() are served from the pool
+ *
+ * a buffer that is put back is handed out again for the next read of the same size-class
+ */
+void test_network_buffer_pool_reuse() {
+	gsize sizes[] = {
+		NETWORK_SOCKET_READ_SIZE_MIN,
+		NETWORK_SOCKET_READ_SIZE_MIN * 2,
+		NETWORK_SOCKET_READ_SIZE_MAX
+	};
+	network_buffer_pool_stats_t stats_before, stats_after;
+	gsize i;
+
+	for (i = 0; i < G_N_ELEMENTS(sizes); i++) {
+		GString *chunk, *reused;
+
+		chunk = network_buffer_pool_get(sizes[i]);
+		g_assert_cmpint(chunk->allocated_len, >, sizes[i]);
+		g_string_append_len(chunk, C("123456"));
+
+		network_buffer_pool_get_stats(&stats_before);
+		network_buffer_pool_put(chunk);
+		network_buffer_pool_get_stats(&stats_after);
+		g_assert_cmpint(stats_after.idle, ==, stats_before.idle + 1);
+
+		/* the same buffer comes back, empty */
+		reused = network_buffer_pool_get(sizes[i]);
+		g_assert(reused == chunk);
+		g_assert_cmpint(reused->len, ==, 0);
+
+		network_buffer_pool_get_stats(&stats_before);
+		g_assert_cmpint(stats_before.hits, ==, stats_after.hits + 1);
+		g_assert_cmpint(stats_before.misses, ==, stats_after.misses);
+		g_assert_cmpint(stats_before.idle, ==, stats_after.idle - 1);
+
+		network_buffer_pool_put(reused);
+	}
+}
+
+#ifndef _WIN32
+/**
+ * the chunks are sent without copying them, the sent ones are dropped
+ */
+void test_network_queue_iovec() {
+	network_queue *q;
+	struct iovec iov[4];
+	const gchar *str;
+
+	q = network_queue_new();
+	network_queue_append(q, g_string_new("123"));
+	network_queue_append(q, g_string_new("45"));
+	network_queue_append(q, g_string_new("6789"));
+
+	g_assert_cmpint(network_queue_get_iovec(q, iov, 2), ==, 2);
+	g_assert_cmpint(iov[0].iov_len, ==, 3);
+	g_assert_cmpint(iov[1].iov_len, ==, 2);
+
+	/* a partial write of the 1st chunk */
+	network_queue_advance(q, 2);
+	g_assert_cmpint(q->len, ==, 7);
+	g_assert_cmpint(q->chunks->length, ==, 3);
+
+	g_assert_cmpint(network_queue_get_iovec(q, iov, G_N_ELEMENTS(iov)), ==, 3);
+	g_assert_cmpint(iov[0].iov_len, ==, 1);
+	g_assert_cmpint(0, ==, memcmp(iov[0].iov_base, "3", 1));
+
+	/* ... finishing the 1st and 2nd chunk and a part of the 3rd */
+	network_queue_advance(q, 4);
+	g_assert_cmpint(q->len, ==, 3);
+	g_assert_cmpint(q->chunks->length, ==, 1);
+
+	g_assert(NULL != (str = network_queue_peek_str(q, 3)));
+	g_assert_cmpint(0, ==, memcmp(str, "789", 3));
+
+	network_queue_advance(q, 3);
+	g_assert_cmpint(q->len, ==, 0);
+	g_assert_cmpint(q->chunks->length, ==, 0);
+	g_assert_cmpint(network_queue_get_iovec(q, iov, G_N_ELEMENTS(iov)), ==, 0);
+
+	network_queue_free(q);
+}
+#endif
+
+/**
+ * a freed queue is reset and handed out again by the next network_queue_new()
+ */
+void test_network_queue_object_pool() {
+	static network_object_pool_t pool = NETWORK_OBJECT_POOL_INIT(1, g_free);
+	network_object_pool_stats_t stats;
+	network_queue *q, *q2;
+	gpointer obj;
+
+	q = network_queue_new();
+	network_queue_append(q, g_string_new("123"));
+	network_queue_free(q);
+
+	q2 = network_queue_new();
+	g_assert(q2 == q);
+	g_assert_cmpint(q2->len, ==, 0);
+	g_assert_cmpint(q2->offset, ==, 0);
+	g_assert_cmpint(q2->chunks->length, ==, 0);
+	network_queue_free(q2);
+
+	/* the pool keeps at most max_idle objects per thread */
+	g_assert(NULL == network_object_pool_get(&pool));
+
+	obj = g_malloc(16);
+	g_assert_cmpint(TRUE, ==, network_object_pool_put(&pool, obj));
+	g_assert_cmpint(FALSE, ==, network_object_pool_put(&pool, &pool));
+	g_assert(obj == network_object_pool_get(&pool));
+
+	network_object_pool_get_stats(&pool, &stats);
+	g_assert_cmpint(stats.hits, ==, 1);
+	g_assert_cmpint(stats.misses, ==, 1);
+	g_assert_cmpint(stats.idle, ==, 0);
+
+	g_free(obj);
+}
+
 int main(int argc, char **argv) {
 	g_test_init(&argc, &argv, NULL);
 	g_test_bug_base("http://bugs.mysql.com/");
 
 	g_test_add_func("/core/network_queue_append", test_network_queue_append);
 	g_test_add_func("/core/network_queue_peek_string", test_network_queue_peek_string);
+	g_test_add_func("/core/network_queue_peek_str", test_network_queue_peek_str);
 	g_test_add_func("/core/network_queue_pop_string", test_network_queue_pop_string);
+	g_test_add_func("/core/network_queue_buffer_pool", test_network_queue_buffer_pool);
+	g_test_add_func("/core/network_buffer_pool_reuse", test_network_buffer_pool_reuse);
+	g_test_add_func("/core/network_queue_object_pool", test_network_queue_object_pool);
+#ifndef _WIN32
+	g_test_add_func("/core/network_queue_iovec", test_network_queue_iovec);
+#endif
 
 	return g_test_run();
 }
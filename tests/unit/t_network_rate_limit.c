@@ -0,0 +1,273 @@
+/* $%BEGINLICENSE%$
+ Copyright (c) 2008, 2012, Oracle and/or its affiliates. All rights reserved.
+
+ This program is free software; you can redistribute it and/or
+ modify it under the terms of the GNU General Public License as
+ published by the Free Software Foundation; version 2 of the
+ License.
+
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ GNU General Public License for more details.
+
+ You should have received a copy of the GNU General Public License
+ along with this program; if not, write to the Free Software
+ Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA
+ 02110-1301  USA
+
+ $%ENDLICENSE%$ */
+#include <string.h>
+
+#include <glib.h>
+
+#include "network-rate-limit.h"
+
+#if GLIB_CHECK_VERSION(2, 16, 0)
+#define T_SEC(x) ((guint64)(x) * G_USEC_PER_SEC)
+
+static gboolean t_acquire(network_rate_limiter_t *limiter, const gchar *user, const gchar *digest, guint64 now_usec, network_rate_limit_verdict_t *verdict) {
+	const gchar *values[NETWORK_RATE_LIMIT_KEYS] = { NULL, "127.0.0.1", NULL };
+
+	values[NETWORK_RATE_LIMIT_USER] = user;
+	values[NETWORK_RATE_LIMIT_DIGEST] = digest;
+
+	return network_rate_limiter_acquire(limiter, 0, values, now_usec, verdict);
+}
+
+/**
+ * a bucket starts full and is refilled with .rate tokens per second
+ */
+void t_network_rate_limiter_acquire() {
+	network_rate_limiter_t *limiter = network_rate_limiter_new();
+	network_rate_limit_verdict_t verdict;
+
+	g_assert_cmpint(FALSE, ==, network_rate_limiter_is_enabled(limiter));
+	g_assert_cmpint(TRUE, ==, t_acquire(limiter, "batch", NULL, T_SEC(1), &verdict));
+
+	g_assert_cmpint(0, ==, network_rate_limiter_set_rule(limiter, NETWORK_RATE_LIMIT_USER, "batch", 10, 2, 0, NULL));
+	g_assert_cmpint(TRUE, ==, network_rate_limiter_is_enabled(limiter));
+	g_assert_cmpint(TRUE, ==, network_rate_limiter_uses_key(limiter, NETWORK_RATE_LIMIT_USER));
+	g_assert_cmpint(FALSE, ==, network_rate_limiter_uses_key(limiter, NETWORK_RATE_LIMIT_DIGEST));
+
+	/* the burst */
+	g_assert_cmpint(TRUE, ==, t_acquire(limiter, "batch", NULL, T_SEC(1), &verdict));
+	g_assert_cmpint(TRUE, ==, t_acquire(limiter, "batch", NULL, T_SEC(1), &verdict));
+	g_assert_cmpint(FALSE, ==, t_acquire(limiter, "batch", NULL, T_SEC(1), &verdict));
+	g_assert_cmpint(verdict.wait_usec, >=, 100000);
+	g_assert_cmpint(verdict.wait_usec, <=, 100001);
+	g_assert_cmpint(verdict.max_wait_ms, ==, 0);
+
+	/* other users have no limit */
+	g_assert_cmpint(TRUE, ==, t_acquire(limiter, "web", NULL, T_SEC(1), &verdict));
+	g_assert_cmpint(TRUE, ==, t_acquire(limiter, NULL, NULL, T_SEC(1), &verdict));
+
+	/* a token per 100ms */
+	g_assert_cmpint(TRUE, ==, t_acquire(limiter, "batch", NULL, T_SEC(1) + verdict.wait_usec, &verdict));
+	g_assert_cmpint(FALSE, ==, t_acquire(limiter, "batch", NULL, T_SEC(1) + 100001, &verdict));
+
+	/* ... but not more than the burst */
+	g_assert_cmpint(TRUE, ==, t_acquire(limiter, "batch", NULL, T_SEC(60), &verdict));
+	g_assert_cmpint(TRUE, ==, t_acquire(limiter, "batch", NULL, T_SEC(60), &verdict));
+	g_assert_cmpint(FALSE, ==, t_acquire(limiter, "batch", NULL, T_SEC(60), &verdict));
+
+	network_rate_limiter_free(limiter);
+}
+
+/**
+ * a rule with the match "*" has a bucket per value
+ */
+void t_network_rate_limiter_acquire_each() {
+	network_rate_limiter_t *limiter = network_rate_limiter_new();
+	network_rate_limit_verdict_t verdict;
+	const gchar *digest = "SELECT * FROM `t` WHERE `id` = ?";
+
+	g_assert_cmpint(0, ==, network_rate_limiter_set_rule(limiter, NETWORK_RATE_LIMIT_DIGEST, "*", 1, 1, 0, NULL));
+
+	g_assert_cmpint(TRUE, ==, t_acquire(limiter, "batch", digest, T_SEC(1), &verdict));
+	g_assert_cmpint(FALSE, ==, t_acquire(limiter, "batch", digest, T_SEC(1), &verdict));
+	g_assert_cmpint(FALSE, ==, t_acquire(limiter, "web", digest, T_SEC(1), &verdict));
+	g_assert_cmpint(TRUE, ==, t_acquire(limiter, "batch", "SELECT ?", T_SEC(1), &verdict));
+
+	/* queries that aren't a COM_QUERY have no fingerprint */
+	g_assert_cmpint(TRUE, ==, t_acquire(limiter, "batch", NULL, T_SEC(1), &verdict));
+
+	network_rate_limiter_free(limiter);
+}
+
+/**
+ * the rules are checked in order, the first rule without a token decides
+ */
+void t_network_rate_limiter_acquire_rules() {
+	network_rate_limiter_t *limiter = network_rate_limiter_new();
+	network_rate_limit_verdict_t verdict;
+	GPtrArray *rules;
+	network_rate_limit_rule_t *rule;
+
+	g_assert_cmpint(0, ==, network_rate_limiter_set_rule(limiter, NETWORK_RATE_LIMIT_USER, "batch", 1, 3, 0, NULL));
+	g_assert_cmpint(0, ==, network_rate_limiter_set_rule(limiter, NETWORK_RATE_LIMIT_CLIENT, "127.0.0.1", 1, 1, 500, NULL));
+
+	g_assert_cmpint(TRUE, ==, t_acquire(limiter, "batch", NULL, T_SEC(1), &verdict));
+	g_assert_cmpint(FALSE, ==, t_acquire(limiter, "batch", NULL, T_SEC(1), &verdict));
+	g_assert_cmpint(verdict.max_wait_ms, ==, 500);
+
+	rules = network_rate_limiter_get_rules(limiter);
+	g_assert_cmpint(rules->len, ==, 2);
+	rule = rules->pdata[0];
+	g_assert_cmpint(rule->key, ==, NETWORK_RATE_LIMIT_USER);
+	g_assert_cmpstr(rule->match, ==, "batch");
+	g_assert_cmpint(rule->allowed, ==, 1);
+	rule = rules->pdata[1];
+	g_assert_cmpint(rule->key, ==, NETWORK_RATE_LIMIT_CLIENT);
+	g_assert_cmpint(rule->allowed, ==, 1);
+	g_assert_cmpint(verdict.rule_id, ==, rule->id);
+
+	network_rate_limiter_reject(limiter, 0, &verdict);
+	g_ptr_array_foreach(rules, (GFunc)network_rate_limit_rule_free, NULL);
+	g_ptr_array_free(rules, TRUE);
+
+	rules = network_rate_limiter_get_rules(limiter);
+	rule = rules->pdata[1];
+	g_assert_cmpint(rule->rejected, ==, 1);
+	g_ptr_array_foreach(rules, (GFunc)network_rate_limit_rule_free, NULL);
+	g_ptr_array_free(rules, TRUE);
+
+	/* a changed rule starts with a full bucket */
+	g_assert_cmpint(0, ==, network_rate_limiter_set_rule(limiter, NETWORK_RATE_LIMIT_CLIENT, "127.0.0.1", 1, 5, 500, NULL));
+	g_assert_cmpint(TRUE, ==, t_acquire(limiter, "batch", NULL, T_SEC(1), &verdict));
+
+	rules = network_rate_limiter_get_rules(limiter);
+	g_assert_cmpint(rules->len, ==, 2);
+	rule = rules->pdata[1];
+	g_assert_cmpint(rule->burst, ==, 5);
+	g_assert_cmpint(rule->allowed, ==, 1);
+	g_assert_cmpint(rule->rejected, ==, 0);
+	g_ptr_array_foreach(rules, (GFunc)network_rate_limit_rule_free, NULL);
+	g_ptr_array_free(rules, TRUE);
+
+	g_assert_cmpint(TRUE, ==, network_rate_limiter_remove_rule(limiter, NETWORK_RATE_LIMIT_USER, "batch"));
+	g_assert_cmpint(FALSE, ==, network_rate_limiter_remove_rule(limiter, NETWORK_RATE_LIMIT_USER, "batch"));
+	g_assert_cmpint(TRUE, ==, network_rate_limiter_remove_rule(limiter, NETWORK_RATE_LIMIT_CLIENT, "127.0.0.1"));
+	g_assert_cmpint(FALSE, ==, network_rate_limiter_is_enabled(limiter));
+
+	network_rate_limiter_free(limiter);
+}
+
+/**
+ * a query waits if the rule allows it and the queue has room
+ */
+void t_network_rate_limiter_delay() {
+	network_rate_limiter_t *limiter = network_rate_limiter_new();
+	network_rate_limit_verdict_t verdict;
+
+	limiter->max_waiting = 1;
+
+	g_assert_cmpint(0, ==, network_rate_limiter_set_rule(limiter, NETWORK_RATE_LIMIT_USER, "batch", 10, 1, 200, NULL));
+
+	g_assert_cmpint(TRUE, ==, t_acquire(limiter, "batch", NULL, T_SEC(1), &verdict));
+	g_assert_cmpint(FALSE, ==, t_acquire(limiter, "batch", NULL, T_SEC(1), &verdict));
+	g_assert_cmpint(TRUE, ==, network_rate_limiter_delay(limiter, 0, &verdict));
+
+	/* the queue is full */
+	g_assert_cmpint(FALSE, ==, network_rate_limiter_delay(limiter, 0, &verdict));
+	network_rate_limiter_undelay(limiter);
+	g_assert_cmpint(TRUE, ==, network_rate_limiter_delay(limiter, 0, &verdict));
+	network_rate_limiter_undelay(limiter);
+
+	/* the token comes too late */
+	verdict.wait_usec = 200001;
+	g_assert_cmpint(FALSE, ==, network_rate_limiter_delay(limiter, 0, &verdict));
+
+	/* the rule rejects */
+	verdict.wait_usec = 1000;
+	verdict.max_wait_ms = 0;
+	g_assert_cmpint(FALSE, ==, network_rate_limiter_delay(limiter, 0, &verdict));
+
+	network_rate_limiter_free(limiter);
+}
+
+/**
+ * the rules of --proxy-rate-limit
+ */
+void t_network_rate_limiter_add_rule_string() {
+	network_rate_limiter_t *limiter = network_rate_limiter_new();
+	network_rate_limit_rule_t *rule;
+	GPtrArray *rules;
+	GError *gerr = NULL;
+
+	g_assert_cmpint(0, ==, network_rate_limiter_add_rule_string(limiter, "user:50=batch", &gerr));
+	g_assert_no_error(gerr);
+	g_assert_cmpint(0, ==, network_rate_limiter_add_rule_string(limiter, "digest:0.5:20:500=SELECT * FROM `t` WHERE `a` = ?", &gerr));
+	g_assert_no_error(gerr);
+	g_assert_cmpint(0, ==, network_rate_limiter_add_rule_string(limiter, "Client:100=::1", &gerr));
+	g_assert_no_error(gerr);
+
+	rules = network_rate_limiter_get_rules(limiter);
+	g_assert_cmpint(rules->len, ==, 3);
+
+	rule = rules->pdata[0];
+	g_assert_cmpint(rule->key, ==, NETWORK_RATE_LIMIT_USER);
+	g_assert_cmpstr(rule->match, ==, "batch");
+	g_assert_cmpint(rule->rate, ==, 50);
+	g_assert_cmpint(rule->burst, ==, 50);
+	g_assert_cmpint(rule->max_wait_ms, ==, 0);
+
+	rule = rules->pdata[1];
+	g_assert_cmpint(rule->key, ==, NETWORK_RATE_LIMIT_DIGEST);
+	g_assert_cmpstr(rule->match, ==, "SELECT * FROM `t` WHERE `a` = ?");
+	g_assert_cmpfloat(rule->rate, ==, 0.5);
+	g_assert_cmpint(rule->burst, ==, 20);
+	g_assert_cmpint(rule->max_wait_ms, ==, 500);
+
+	rule = rules->pdata[2];
+	g_assert_cmpint(rule->key, ==, NETWORK_RATE_LIMIT_CLIENT);
+	g_assert_cmpstr(rule->match, ==, "::1");
+
+	g_ptr_array_foreach(rules, (GFunc)network_rate_limit_rule_free, NULL);
+	g_ptr_array_free(rules, TRUE);
+
+	g_assert_cmpint(-1, ==, network_rate_limiter_add_rule_string(limiter, "user:50", &gerr));
+	g_assert_error(gerr, NETWORK_RATE_LIMIT_ERROR, NETWORK_RATE_LIMIT_ERROR_INVALID);
+	g_clear_error(&gerr);
+
+	g_assert_cmpint(-1, ==, network_rate_limiter_add_rule_string(limiter, "host:50=batch", &gerr));
+	g_assert_error(gerr, NETWORK_RATE_LIMIT_ERROR, NETWORK_RATE_LIMIT_ERROR_INVALID);
+	g_clear_error(&gerr);
+
+	g_assert_cmpint(-1, ==, network_rate_limiter_add_rule_string(limiter, "user:0=batch", &gerr));
+	g_assert_error(gerr, NETWORK_RATE_LIMIT_ERROR, NETWORK_RATE_LIMIT_ERROR_INVALID);
+	g_clear_error(&gerr);
+
+	g_assert_cmpint(-1, ==, network_rate_limiter_add_rule_string(limiter, "user:50:0.5=batch", &gerr));
+	g_assert_error(gerr, NETWORK_RATE_LIMIT_ERROR, NETWORK_RATE_LIMIT_ERROR_INVALID);
+	g_clear_error(&gerr);
+
+	g_assert_cmpint(-1, ==, network_rate_limiter_add_rule_string(limiter, "user:50:10:soon=batch", &gerr));
+	g_assert_error(gerr, NETWORK_RATE_LIMIT_ERROR, NETWORK_RATE_LIMIT_ERROR_INVALID);
+	g_clear_error(&gerr);
+
+	g_assert_cmpint(-1, ==, network_rate_limiter_add_rule_string(limiter, "user:50=", &gerr));
+	g_assert_error(gerr, NETWORK_RATE_LIMIT_ERROR, NETWORK_RATE_LIMIT_ERROR_INVALID);
+	g_clear_error(&gerr);
+
+	network_rate_limiter_free(limiter);
+}
+
+int main(int argc, char **argv) {
+	g_thread_init(NULL);
+	g_test_init(&argc, &argv, NULL);
+	g_test_bug_base("http://bugs.mysql.com/");
+
+	g_test_add_func("/core/network_rate_limiter_acquire", t_network_rate_limiter_acquire);
+	g_test_add_func("/core/network_rate_limiter_acquire_each", t_network_rate_limiter_acquire_each);
+	g_test_add_func("/core/network_rate_limiter_acquire_rules", t_network_rate_limiter_acquire_rules);
+	g_test_add_func("/core/network_rate_limiter_delay", t_network_rate_limiter_delay);
+	g_test_add_func("/core/network_rate_limiter_add_rule_string", t_network_rate_limiter_add_rule_string);
+
+	return g_test_run();
+}
+#else
+int main() {
+	return 77;
+}
+#endif
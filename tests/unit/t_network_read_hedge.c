@@ -0,0 +1,124 @@
+/* $%BEGINLICENSE%$
+ Copyright (c) 2008, 2012, Oracle and/or its affiliates. All rights reserved.
+
+ This program is free software; you can redistribute it and/or
+ modify it under the terms of the GNU General Public License as
+ published by the Free Software Foundation; version 2 of the
+ License.
+
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ GNU General Public License for more details.
+
+ You should have received a copy of the GNU General Public License
+ along with this program; if not, write to the Free Software
+ Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA
+ 02110-1301  USA
+
+ $%ENDLICENSE%$ */
+#include <glib.h>
+
+#include "network-read-hedge.h"
+
+#if GLIB_CHECK_VERSION(2, 16, 0)
+
+/**
+ * a fingerprint isn't hedged before it has enough samples, then after its percentile
+ */
+static void t_network_read_hedge_delay(void) {
+	network_read_hedge_t *hedge = network_read_hedge_new();
+	guint64 delay;
+	guint i;
+
+	network_read_hedge_set_threads(hedge, 2);
+
+	g_assert_cmpint(network_read_hedge_get_delay(hedge, 0, 1), ==, 0);
+
+	/* 1ms, with every 10th read taking 10ms */
+	for (i = 0; i < NETWORK_READ_HEDGE_MIN_SAMPLES - 1; i++) {
+		network_read_hedge_record(hedge, 0, 1, (i % 10 == 9) ? 10000 : 1000);
+	}
+	g_assert_cmpint(network_read_hedge_get_delay(hedge, 0, 1), ==, 0);
+
+	network_read_hedge_record(hedge, 0, 1, 10000);
+	delay = network_read_hedge_get_delay(hedge, 0, 1);
+	g_assert_cmpint(delay, >=, 9000);
+	g_assert_cmpint(delay, <=, 11000);
+
+	/* the other thread and the other fingerprints don't know it */
+	g_assert_cmpint(network_read_hedge_get_delay(hedge, 1, 1), ==, 0);
+	g_assert_cmpint(network_read_hedge_get_delay(hedge, 0, 2), ==, 0);
+
+	network_read_hedge_free(hedge);
+}
+
+/**
+ * a burst may use up the credits, afterwards each read earns budget percent of a hedge
+ */
+static void t_network_read_hedge_budget(void) {
+	network_read_hedge_t *hedge = network_read_hedge_new();
+	guint i;
+
+	hedge->budget = 10.0;
+	network_read_hedge_set_threads(hedge, 1);
+
+	for (i = 0; i < NETWORK_READ_HEDGE_MAX_CREDITS; i++) {
+		g_assert_cmpint(network_read_hedge_spend(hedge, 0), ==, TRUE);
+	}
+	g_assert_cmpint(network_read_hedge_spend(hedge, 0), ==, FALSE);
+
+	for (i = 0; i < 9; i++) {
+		network_read_hedge_get_delay(hedge, 0, 1);
+	}
+	g_assert_cmpint(network_read_hedge_spend(hedge, 0), ==, FALSE);
+
+	/* the 10th read earned a full hedge */
+	network_read_hedge_get_delay(hedge, 0, 1);
+	network_read_hedge_get_delay(hedge, 0, 1);
+	g_assert_cmpint(network_read_hedge_spend(hedge, 0), ==, TRUE);
+	g_assert_cmpint(network_read_hedge_spend(hedge, 0), ==, FALSE);
+
+	network_read_hedge_free(hedge);
+}
+
+/**
+ * the least recently used fingerprint is dropped
+ */
+static void t_network_read_hedge_lru(void) {
+	network_read_hedge_t *hedge = network_read_hedge_new();
+	guint64 hash;
+	guint i;
+
+	network_read_hedge_set_threads(hedge, 1);
+
+	for (i = 0; i < NETWORK_READ_HEDGE_MIN_SAMPLES; i++) {
+		network_read_hedge_record(hedge, 0, 0, 1000);
+	}
+	g_assert_cmpint(network_read_hedge_get_delay(hedge, 0, 0), >, 0);
+
+	for (hash = 1; hash <= NETWORK_READ_HEDGE_MAX_ENTRIES; hash++) {
+		network_read_hedge_record(hedge, 0, hash, 1000);
+	}
+
+	g_assert_cmpint(network_read_hedge_get_delay(hedge, 0, 0), ==, 0);
+
+	network_read_hedge_free(hedge);
+}
+
+int main(int argc, char **argv) {
+	g_thread_init(NULL);
+	g_test_init(&argc, &argv, NULL);
+	g_test_bug_base("http://bugs.mysql.com/");
+
+	g_test_add_func("/core/network_read_hedge_delay", t_network_read_hedge_delay);
+	g_test_add_func("/core/network_read_hedge_budget", t_network_read_hedge_budget);
+	g_test_add_func("/core/network_read_hedge_lru", t_network_read_hedge_lru);
+
+	return g_test_run();
+}
+#else
+int main() {
+	return 77;
+}
+#endif
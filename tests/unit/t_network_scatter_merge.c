@@ -0,0 +1,367 @@
+/* $%BEGINLICENSE%$
+ Copyright (c) 2008, 2012, Oracle and/or its affiliates. All rights reserved.
+
+ This program is free software; you can redistribute it and/or
+ modify it under the terms of the GNU General Public License as
+ published by the Free Software Foundation; version 2 of the
+ License.
+
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ GNU General Public License for more details.
+
+ You should have received a copy of the GNU General Public License
+ along with this program; if not, write to the Free Software
+ Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA
+ 02110-1301  USA
+
+ $%ENDLICENSE%$ */
+#include <string.h>
+
+#include <glib.h>
+
+#include "network-mysqld-proto.h"
+#include "network-mysqld-packet.h"
+#include "network-scatter-merge.h"
+
+#if GLIB_CHECK_VERSION(2, 16, 0)
+#define C(x) x, sizeof(x) - 1
+
+static GString *t_packet_new(void) {
+	return g_string_new_len(C("\x00\x00\x00\x00"));
+}
+
+static GString *t_packet_finish(GString *packet) {
+	network_mysqld_proto_set_packet_len(packet, packet->len - NET_HEADER_SIZE);
+
+	return packet;
+}
+
+static GString *t_field_count(guint8 count) {
+	GString *packet = t_packet_new();
+
+	network_mysqld_proto_append_lenenc_int(packet, count);
+
+	return t_packet_finish(packet);
+}
+
+static GString *t_field(const char *name, guint8 type) {
+	GString *packet = t_packet_new();
+
+	network_mysqld_proto_append_lenenc_string(packet, "def");
+	network_mysqld_proto_append_lenenc_string(packet, "shop");
+	network_mysqld_proto_append_lenenc_string(packet, "orders");
+	network_mysqld_proto_append_lenenc_string(packet, "orders");
+	network_mysqld_proto_append_lenenc_string(packet, name);
+	network_mysqld_proto_append_lenenc_string(packet, name);
+	network_mysqld_proto_append_int8(packet, 0x0c);
+	network_mysqld_proto_append_int16(packet, 0x21);
+	network_mysqld_proto_append_int32(packet, 11);
+	network_mysqld_proto_append_int8(packet, type);
+	network_mysqld_proto_append_int16(packet, 0);
+	network_mysqld_proto_append_int8(packet, 0);
+	network_mysqld_proto_append_int16(packet, 0);
+
+	return t_packet_finish(packet);
+}
+
+static GString *t_eof(guint16 warnings) {
+	GString *packet = t_packet_new();
+
+	network_mysqld_proto_append_int8(packet, MYSQLD_PACKET_EOF);
+	network_mysqld_proto_append_int16(packet, warnings);
+	network_mysqld_proto_append_int16(packet, SERVER_STATUS_AUTOCOMMIT);
+
+	return t_packet_finish(packet);
+}
+
+static GString *t_row(const char *id, const char *name) {
+	GString *packet = t_packet_new();
+
+	network_mysqld_proto_append_lenenc_string_len(packet, id, id ? strlen(id) : 0);
+	network_mysqld_proto_append_lenenc_string_len(packet, name, name ? strlen(name) : 0);
+
+	return t_packet_finish(packet);
+}
+
+/**
+ * the result of a shard: SELECT id, name
+ */
+static void t_add_header(network_scatter_merge_t *merge, guint shard_ndx) {
+	network_scatter_merge_add_packet(merge, shard_ndx, t_field_count(2));
+	network_scatter_merge_add_packet(merge, shard_ndx, t_field("id", MYSQL_TYPE_LONG));
+	network_scatter_merge_add_packet(merge, shard_ndx, t_field("name", MYSQL_TYPE_VAR_STRING));
+	network_scatter_merge_add_packet(merge, shard_ndx, t_eof(0));
+}
+
+/**
+ * take the merged packets, the first value of the rows is appended to ids
+ *
+ * @param last_status gets the first byte of the last packet
+ *
+ * @return the number of packets
+ */
+static guint t_get_packets(network_scatter_merge_t *merge, GString *ids, guint8 *last_status) {
+	GQueue *packets = g_queue_new();
+	GString *packet;
+	guint count = 0;
+
+	network_scatter_merge_get_packets(merge, packets);
+
+	while ((packet = g_queue_pop_head(packets))) {
+		network_packet p;
+		guint8 status;
+
+		p.data = packet;
+		p.offset = 0;
+
+		g_assert_cmpint(0, ==, network_mysqld_proto_skip_network_header(&p));
+		g_assert_cmpint(0, ==, network_mysqld_proto_peek_int8(&p, &status));
+
+		/* the ids of the rows are shorter than the "def" that starts the fields */
+		if (ids &&
+		    status != MYSQLD_PACKET_EOF &&
+		    status != MYSQLD_PACKET_ERR &&
+		    packet->len > NET_HEADER_SIZE + 1) {
+			guint64 len;
+
+			if (0 == network_mysqld_proto_get_lenenc_int(&p, &len) && len < 3) {
+				if (ids->len > 0) g_string_append_c(ids, ',');
+				g_string_append_len(ids, packet->str + p.offset, len);
+			}
+		}
+
+		if (last_status) *last_status = status;
+
+		g_string_free(packet, TRUE);
+		count++;
+	}
+	g_queue_free(packets);
+
+	return count;
+}
+
+/**
+ * without ORDER BY the rows are passed on as they arrive
+ */
+void t_network_scatter_merge_concat() {
+	network_scatter_merge_t *merge = network_scatter_merge_new(2, FALSE);
+	GString *ids = g_string_new(NULL);
+	guint8 status;
+
+	t_add_header(merge, 0);
+	network_scatter_merge_add_packet(merge, 0, t_row("1", "a"));
+
+	/* the fields go out once all shards sent theirs */
+	g_assert_cmpint(0, ==, t_get_packets(merge, ids, NULL));
+
+	t_add_header(merge, 1);
+	network_scatter_merge_add_packet(merge, 1, t_row("2", "b"));
+
+	/* field-count, 2 fields, EOF and the 2 rows */
+	g_assert_cmpint(6, ==, t_get_packets(merge, ids, NULL));
+	g_assert_cmpstr("1,2", ==, ids->str);
+
+	network_scatter_merge_add_packet(merge, 0, t_eof(1));
+	network_scatter_merge_add_packet(merge, 1, t_row("3", NULL));
+	g_assert_cmpint(1, ==, t_get_packets(merge, ids, NULL));
+	g_assert_cmpint(FALSE, ==, network_scatter_merge_is_finished(merge));
+
+	network_scatter_merge_add_packet(merge, 1, t_eof(1));
+	g_assert_cmpint(1, ==, t_get_packets(merge, ids, &status));
+	g_assert_cmpint(MYSQLD_PACKET_EOF, ==, status);
+	g_assert_cmpstr("1,2,3", ==, ids->str);
+	g_assert_cmpint(TRUE, ==, network_scatter_merge_is_finished(merge));
+
+	/* the packets got numbered again */
+	g_assert_cmpint(9, ==, merge->packet_id);
+
+	g_string_free(ids, TRUE);
+	network_scatter_merge_free(merge);
+}
+
+/**
+ * with ORDER BY a row is sent once each shard has a row or is done, the LIMIT ends the result
+ */
+void t_network_scatter_merge_order() {
+	network_scatter_merge_t *merge = network_scatter_merge_new(2, FALSE);
+	GString *ids = g_string_new(NULL);
+	guint8 status;
+
+	network_scatter_merge_add_order(merge, C("ID"), 0, TRUE);
+	network_scatter_merge_set_limit(merge, 3);
+
+	t_add_header(merge, 0);
+	t_add_header(merge, 1);
+	network_scatter_merge_add_packet(merge, 0, t_row("10", "a"));
+	network_scatter_merge_add_packet(merge, 0, t_row("9", "b"));
+
+	/* the first row of the other shard may be bigger */
+	g_assert_cmpint(4, ==, t_get_packets(merge, ids, NULL));
+	g_assert_cmpstr("", ==, ids->str);
+
+	/* numeric columns compare as numbers */
+	network_scatter_merge_add_packet(merge, 1, t_row("11", "c"));
+	network_scatter_merge_add_packet(merge, 1, t_row("2", "d"));
+	g_assert_cmpint(4, ==, t_get_packets(merge, ids, &status));
+	g_assert_cmpstr("11,10,9", ==, ids->str);
+
+	/* the LIMIT is reached, the EOF follows the rows */
+	g_assert_cmpint(MYSQLD_PACKET_EOF, ==, status);
+	g_assert_cmpint(TRUE, ==, network_scatter_merge_is_finished(merge));
+
+	network_scatter_merge_add_packet(merge, 0, t_row("1", "e"));
+	g_assert_cmpint(0, ==, t_get_packets(merge, ids, NULL));
+
+	g_string_free(ids, TRUE);
+	network_scatter_merge_free(merge);
+}
+
+/**
+ * COUNT() and SUM() add up, MIN() and MAX() pick, the other columns are from the first shard
+ */
+void t_network_scatter_merge_aggregate() {
+	network_scatter_merge_t *merge = network_scatter_merge_new(3, FALSE);
+	GQueue *packets = g_queue_new();
+	GString *packet;
+	network_packet p;
+	gchar *value;
+	guint i;
+
+	network_scatter_merge_set_aggregate(merge, 0, NETWORK_SCATTER_AGGREGATE_SUM);
+	network_scatter_merge_set_aggregate(merge, 1, NETWORK_SCATTER_AGGREGATE_MAX);
+
+	for (i = 0; i < 3; i++) t_add_header(merge, i);
+	network_scatter_merge_add_packet(merge, 0, t_row("1.5", "b"));
+	network_scatter_merge_add_packet(merge, 1, t_row("-2.25", NULL));
+	network_scatter_merge_add_packet(merge, 2, t_row("10", "c"));
+
+	/* the row waits for all shards */
+	g_assert_cmpint(4, ==, t_get_packets(merge, NULL, NULL));
+	g_assert_cmpint(0, ==, t_get_packets(merge, NULL, NULL));
+
+	for (i = 0; i < 3; i++) network_scatter_merge_add_packet(merge, i, t_eof(0));
+
+	network_scatter_merge_get_packets(merge, packets);
+	g_assert_cmpint(2, ==, packets->length);
+
+	packet = g_queue_pop_head(packets);
+	p.data = packet;
+	p.offset = 0;
+	g_assert_cmpint(0, ==, network_mysqld_proto_skip_network_header(&p));
+	g_assert_cmpint(0, ==, network_mysqld_proto_get_lenenc_string(&p, &value, NULL));
+	g_assert_cmpstr("9.25", ==, value);
+	g_free(value);
+	g_assert_cmpint(0, ==, network_mysqld_proto_get_lenenc_string(&p, &value, NULL));
+	g_assert_cmpstr("c", ==, value);
+	g_free(value);
+	g_string_free(packet, TRUE);
+
+	while ((packet = g_queue_pop_head(packets))) g_string_free(packet, TRUE);
+	g_queue_free(packets);
+
+	g_assert_cmpint(TRUE, ==, network_scatter_merge_is_finished(merge));
+	network_scatter_merge_free(merge);
+}
+
+/**
+ * the OKs of the shards add up their affected rows
+ */
+void t_network_scatter_merge_ok() {
+	network_scatter_merge_t *merge = network_scatter_merge_new(2, FALSE);
+	network_mysqld_ok_packet_t *ok_packet;
+	GQueue *packets = g_queue_new();
+	GString *packet;
+	network_packet p;
+	guint i;
+
+	for (i = 0; i < 2; i++) {
+		packet = t_packet_new();
+		ok_packet = network_mysqld_ok_packet_new();
+		ok_packet->affected_rows = 3 + i;
+		ok_packet->server_status = SERVER_STATUS_AUTOCOMMIT;
+		network_mysqld_proto_append_ok_packet(packet, ok_packet);
+		network_mysqld_ok_packet_free(ok_packet);
+
+		network_scatter_merge_add_packet(merge, i, t_packet_finish(packet));
+	}
+
+	network_scatter_merge_get_packets(merge, packets);
+	g_assert_cmpint(1, ==, packets->length);
+
+	packet = g_queue_pop_head(packets);
+	p.data = packet;
+	p.offset = 0;
+	ok_packet = network_mysqld_ok_packet_new();
+	g_assert_cmpint(0, ==, network_mysqld_proto_skip_network_header(&p));
+	g_assert_cmpint(0, ==, network_mysqld_proto_get_ok_packet(&p, ok_packet));
+	g_assert_cmpint(7, ==, ok_packet->affected_rows);
+	network_mysqld_ok_packet_free(ok_packet);
+	g_string_free(packet, TRUE);
+
+	g_queue_free(packets);
+	network_scatter_merge_free(merge);
+}
+
+/**
+ * different fields and failed shards end the result with a ERR
+ */
+void t_network_scatter_merge_error() {
+	network_scatter_merge_t *merge;
+	GString *ids = g_string_new(NULL);
+	guint8 status;
+
+	merge = network_scatter_merge_new(2, FALSE);
+	t_add_header(merge, 0);
+	network_scatter_merge_add_packet(merge, 1, t_field_count(1));
+	network_scatter_merge_add_packet(merge, 1, t_field("id", MYSQL_TYPE_LONG));
+	network_scatter_merge_add_packet(merge, 1, t_eof(0));
+
+	g_assert_cmpint(1, ==, t_get_packets(merge, NULL, &status));
+	g_assert_cmpint(MYSQLD_PACKET_ERR, ==, status);
+	g_assert_cmpint(TRUE, ==, network_scatter_merge_is_finished(merge));
+	network_scatter_merge_free(merge);
+
+	/* the rows that were sent stay sent */
+	merge = network_scatter_merge_new(2, FALSE);
+	t_add_header(merge, 0);
+	t_add_header(merge, 1);
+	network_scatter_merge_add_packet(merge, 0, t_row("1", "a"));
+	g_assert_cmpint(5, ==, t_get_packets(merge, ids, NULL));
+	g_assert_cmpstr("1", ==, ids->str);
+
+	network_scatter_merge_add_error(merge, 1, "(proxy) the backend closed the connection");
+	g_assert_cmpint(1, ==, t_get_packets(merge, NULL, &status));
+	g_assert_cmpint(MYSQLD_PACKET_ERR, ==, status);
+	network_scatter_merge_free(merge);
+
+	/* a complete result doesn't fail anymore */
+	merge = network_scatter_merge_new(1, FALSE);
+	t_add_header(merge, 0);
+	network_scatter_merge_add_packet(merge, 0, t_eof(0));
+	network_scatter_merge_add_error(merge, 0, "(proxy) the backend closed the connection");
+	g_assert_cmpint(4 + 1, ==, t_get_packets(merge, NULL, &status));
+	g_assert_cmpint(MYSQLD_PACKET_EOF, ==, status);
+	network_scatter_merge_free(merge);
+
+	g_string_free(ids, TRUE);
+}
+
+int main(int argc, char **argv) {
+	g_test_init(&argc, &argv, NULL);
+	g_test_bug_base("http://bugs.mysql.com/");
+
+	g_test_add_func("/core/network_scatter_merge_concat", t_network_scatter_merge_concat);
+	g_test_add_func("/core/network_scatter_merge_order", t_network_scatter_merge_order);
+	g_test_add_func("/core/network_scatter_merge_aggregate", t_network_scatter_merge_aggregate);
+	g_test_add_func("/core/network_scatter_merge_ok", t_network_scatter_merge_ok);
+	g_test_add_func("/core/network_scatter_merge_error", t_network_scatter_merge_error);
+
+	return g_test_run();
+}
+#else
+int main() {
+	return 77;
+}
+#endif
@@ -0,0 +1,280 @@
+/* $%BEGINLICENSE%$
+ Copyright (c) 2008, 2012, Oracle and/or its affiliates. All rights reserved.
+
+ This program is free software; you can redistribute it and/or
+ modify it under the terms of the GNU General Public License as
+ published by the Free Software Foundation; version 2 of the
+ License.
+
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ GNU General Public License for more details.
+
+ You should have received a copy of the GNU General Public License
+ along with this program; if not, write to the Free Software
+ Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA
+ 02110-1301  USA
+
+ $%ENDLICENSE%$ */
+#include <string.h>
+#include <unistd.h>
+
+#include <glib.h>
+
+#include "network-shard-map.h"
+
+#if GLIB_CHECK_VERSION(2, 16, 0)
+#define C(x) x, sizeof(x) - 1
+
+static gchar *t_map_file(const char *contents) {
+	gchar *filename;
+	GError *gerr = NULL;
+	int fd;
+
+	fd = g_file_open_tmp("t_network_shard_map-XXXXXX", &filename, &gerr);
+	g_assert_no_error(gerr);
+	close(fd);
+
+	g_assert_cmpint(TRUE, ==, g_file_set_contents(filename, contents, -1, NULL));
+
+	return filename;
+}
+
+static gboolean t_get_key(network_shard_map_t *map, const char *query, GString *key) {
+	return network_shard_map_get_key(map, query, strlen(query), key);
+}
+
+/**
+ * the key comes from the WHERE clause or the rows of a INSERT
+ */
+void t_network_shard_map_get_key() {
+	network_shard_map_t *map = network_shard_map_new();
+	GString *key = g_string_new(NULL);
+
+	map->key = g_string_new("customer_id");
+
+	g_assert_cmpint(TRUE, ==, t_get_key(map, "SELECT * FROM orders WHERE customer_id = 42", key));
+	g_assert_cmpstr("42", ==, key->str);
+	g_assert_cmpint(TRUE, ==, t_get_key(map, "select * from orders o where o.status = 'new' and o.`Customer_ID`=042 order by id", key));
+	g_assert_cmpstr("42", ==, key->str);
+	g_assert_cmpint(TRUE, ==, t_get_key(map, "UPDATE orders SET status = 'paid' WHERE id = 7 AND customer_id = 'abc'", key));
+	g_assert_cmpstr("abc", ==, key->str);
+	g_assert_cmpint(TRUE, ==, t_get_key(map, "DELETE FROM orders WHERE customer_id = -5 /* the test customer */", key));
+	g_assert_cmpstr("-5", ==, key->str);
+	/* the condition of the sub-query doesn't count */
+	g_assert_cmpint(TRUE, ==, t_get_key(map, "SELECT * FROM orders WHERE id IN (SELECT order_id FROM items WHERE customer_id = 1) AND customer_id = 2", key));
+	g_assert_cmpstr("2", ==, key->str);
+
+	g_assert_cmpint(TRUE, ==, t_get_key(map, "INSERT INTO orders (id, customer_id, status) VALUES (1, 42, 'new'), (2, 42, CONCAT('n', 'ew'))", key));
+	g_assert_cmpstr("42", ==, key->str);
+	g_assert_cmpint(TRUE, ==, t_get_key(map, "REPLACE INTO shop.orders SET id = 1, customer_id = 7", key));
+	g_assert_cmpstr("7", ==, key->str);
+
+	/* no key or several keys */
+	g_assert_cmpint(FALSE, ==, t_get_key(map, "SELECT * FROM orders WHERE id = 42", key));
+	g_assert_cmpint(FALSE, ==, t_get_key(map, "SELECT * FROM orders WHERE customer_id = 1 OR customer_id = 2", key));
+	g_assert_cmpint(FALSE, ==, t_get_key(map, "SELECT * FROM orders WHERE customer_id = 1 AND customer_id = 2", key));
+	g_assert_cmpint(FALSE, ==, t_get_key(map, "SELECT * FROM orders WHERE customer_id = 1 + 1", key));
+	g_assert_cmpint(FALSE, ==, t_get_key(map, "SELECT * FROM orders WHERE customer_id IN (1, 2)", key));
+	g_assert_cmpint(FALSE, ==, t_get_key(map, "SELECT * FROM orders WHERE customer_id = 1 UNION SELECT * FROM orders WHERE customer_id = 1", key));
+	g_assert_cmpint(FALSE, ==, t_get_key(map, "INSERT INTO orders (id, customer_id) VALUES (1, 42), (2, 43)", key));
+	g_assert_cmpint(FALSE, ==, t_get_key(map, "INSERT INTO orders VALUES (1, 42)", key));
+	g_assert_cmpint(FALSE, ==, t_get_key(map, "INSERT INTO orders (id, customer_id) SELECT id, customer_id FROM old_orders", key));
+	g_assert_cmpint(FALSE, ==, t_get_key(map, "SET @customer_id = 1", key));
+
+	g_string_free(key, TRUE);
+	network_shard_map_free(map);
+}
+
+/**
+ * hash and range maps from a file
+ */
+void t_network_shard_map_get_shard() {
+	network_shard_map_t *map;
+	network_shard_t *shard;
+	GError *gerr = NULL;
+	gchar *filename;
+
+	filename = t_map_file(
+			"# CRC32(customer_id) % 3\n"
+			"key customer_id hash\n"
+			"\n"
+			"shard 2\t10.0.3.1:3306\n"
+			"shard 0 10.0.1.1:3306,10.0.1.2:3306\n"
+			"shard 1 10.0.2.1:3306\n");
+
+	map = network_shard_map_new();
+	g_assert_cmpint(0, ==, network_shard_map_load(map, filename, &gerr));
+	g_assert_no_error(gerr);
+	g_assert_cmpint(NETWORK_SHARD_MAP_HASH, ==, map->method);
+	g_assert_cmpint(3, ==, map->shards->len);
+
+	shard = network_shard_map_get_shard(map, C("42"));
+	g_assert_cmpint(2, ==, shard->first_key);
+	g_assert_cmpstr("10.0.3.1:3306", ==, shard->backends[0]);
+
+	shard = network_shard_map_get_shard(map, C("7"));
+	g_assert_cmpint(0, ==, shard->first_key);
+	g_assert_cmpstr("10.0.1.2:3306", ==, shard->backends[1]);
+	network_shard_map_free(map);
+
+	g_assert_cmpint(TRUE, ==, g_file_set_contents(filename,
+				"key customer_id range\n"
+				"shard 1 10.0.1.1:3306\n"
+				"shard 1000 10.0.2.1:3306\n", -1, NULL));
+
+	map = network_shard_map_new();
+	g_assert_cmpint(0, ==, network_shard_map_load(map, filename, &gerr));
+	g_assert_no_error(gerr);
+
+	g_assert_cmpint(1, ==, network_shard_map_get_shard(map, C("999"))->first_key);
+	g_assert_cmpint(1000, ==, network_shard_map_get_shard(map, C("1000"))->first_key);
+	g_assert_cmpint(1000, ==, network_shard_map_get_shard(map, C("123456"))->first_key);
+	g_assert(NULL == network_shard_map_get_shard(map, C("0")));
+	g_assert(NULL == network_shard_map_get_shard(map, C("abc")));
+	network_shard_map_free(map);
+
+	unlink(filename);
+	g_free(filename);
+}
+
+static const char *t_plan_scatter(const char *query, network_scatter_merge_t **merge) {
+	if (*merge) network_scatter_merge_free(*merge);
+	*merge = network_scatter_merge_new(2, FALSE);
+
+	return network_shard_map_plan_scatter(query, strlen(query), *merge);
+}
+
+/**
+ * the queries on the sharded tables without a key go to all shards if we can merge their results
+ */
+void t_network_shard_map_plan_scatter() {
+	network_scatter_merge_t *merge = NULL;
+	network_scatter_order_t *order;
+	network_shard_map_t *map;
+	GError *gerr = NULL;
+	gchar *filename;
+
+	filename = t_map_file(
+			"key customer_id hash\n"
+			"table orders,Order_Items\n"
+			"shard 0 10.0.1.1:3306\n");
+
+	map = network_shard_map_new();
+	g_assert_cmpint(0, ==, network_shard_map_load(map, filename, &gerr));
+	g_assert_no_error(gerr);
+
+	g_assert_cmpint(TRUE, ==, network_shard_map_is_sharded(map, C("SELECT * FROM shop.`order_items` WHERE id = 1")));
+	g_assert_cmpint(FALSE, ==, network_shard_map_is_sharded(map, C("SELECT * FROM orders_archive")));
+	network_shard_map_free(map);
+	unlink(filename);
+	g_free(filename);
+
+	g_assert(NULL == t_plan_scatter("SELECT id, total FROM orders ORDER BY total DESC, 1 LIMIT 10", &merge));
+	g_assert_cmpint(2, ==, merge->orders->len);
+	order = merge->orders->pdata[0];
+	g_assert_cmpstr("total", ==, order->name->str);
+	g_assert_cmpint(TRUE, ==, order->is_desc);
+	order = merge->orders->pdata[1];
+	g_assert(NULL == order->name);
+	g_assert_cmpint(1, ==, order->position);
+	g_assert_cmpint(10, ==, merge->limit);
+
+	g_assert(NULL == t_plan_scatter("SELECT COUNT(*), status, MAX(total) AS m FROM orders WHERE status IN ('new', 'paid')", &merge));
+	g_assert_cmpint(3, ==, merge->aggregates->len);
+	g_assert_cmpint(NETWORK_SCATTER_AGGREGATE_SUM, ==, g_array_index(merge->aggregates, network_scatter_aggregate_t, 0));
+	g_assert_cmpint(NETWORK_SCATTER_AGGREGATE_FIRST, ==, g_array_index(merge->aggregates, network_scatter_aggregate_t, 1));
+	g_assert_cmpint(NETWORK_SCATTER_AGGREGATE_MAX, ==, g_array_index(merge->aggregates, network_scatter_aggregate_t, 2));
+
+	/* the ORDER BY and LIMIT of the sub-query don't count */
+	g_assert(NULL == t_plan_scatter("SELECT * FROM orders WHERE id IN (SELECT id FROM items ORDER BY price LIMIT 3)", &merge));
+	g_assert_cmpint(0, ==, merge->orders->len);
+	g_assert(G_MAXUINT64 == merge->limit);
+
+	g_assert(NULL == t_plan_scatter("UPDATE orders SET status = 'paid' WHERE status = 'new'", &merge));
+
+	/* results we can't merge */
+	g_assert(NULL != t_plan_scatter("SELECT AVG(total) FROM orders", &merge));
+	g_assert(NULL != t_plan_scatter("SELECT COUNT(*) + 1 FROM orders", &merge));
+	g_assert(NULL != t_plan_scatter("SELECT COUNT(DISTINCT customer_id) FROM orders", &merge));
+	g_assert(NULL != t_plan_scatter("SELECT DISTINCT status FROM orders", &merge));
+	g_assert(NULL != t_plan_scatter("SELECT status, COUNT(*) FROM orders GROUP BY status", &merge));
+	g_assert(NULL != t_plan_scatter("SELECT * FROM orders ORDER BY total * 2", &merge));
+	g_assert(NULL != t_plan_scatter("SELECT * FROM orders LIMIT 10, 5", &merge));
+	g_assert(NULL != t_plan_scatter("SELECT * FROM orders UNION SELECT * FROM old_orders", &merge));
+	g_assert(NULL != t_plan_scatter("DELETE FROM orders LIMIT 10", &merge));
+	g_assert(NULL != t_plan_scatter("INSERT INTO orders (id) VALUES (1)", &merge));
+
+	network_scatter_merge_free(merge);
+}
+
+/**
+ * bad files fail the load, the router keeps the current map then
+ */
+void t_network_shard_router_load() {
+	network_shard_router_t *router = network_shard_router_new();
+	network_shard_map_t *map;
+	GError *gerr = NULL;
+	gchar *filename;
+
+	g_assert(NULL == network_shard_router_get_map(router));
+
+	filename = t_map_file("key customer_id hash\nshard 0 10.0.1.1:3306\n");
+	g_assert_cmpint(0, ==, network_shard_router_load(router, filename, &gerr));
+	g_assert_no_error(gerr);
+	map = network_shard_router_get_map(router);
+	g_assert(NULL != map);
+
+	/* hash shards have to be numbered from 0 */
+	g_assert_cmpint(TRUE, ==, g_file_set_contents(filename, "key customer_id hash\nshard 1 10.0.1.1:3306\n", -1, NULL));
+	g_assert_cmpint(-1, ==, network_shard_router_load(router, filename, &gerr));
+	g_assert_error(gerr, NETWORK_SHARD_MAP_ERROR, NETWORK_SHARD_MAP_ERROR_PARSE);
+	g_clear_error(&gerr);
+
+	g_assert_cmpint(TRUE, ==, g_file_set_contents(filename, "key customer_id modulo\n", -1, NULL));
+	g_assert_cmpint(-1, ==, network_shard_router_load(router, filename, &gerr));
+	g_assert_error(gerr, NETWORK_SHARD_MAP_ERROR, NETWORK_SHARD_MAP_ERROR_PARSE);
+	g_clear_error(&gerr);
+
+	g_assert_cmpint(TRUE, ==, g_file_set_contents(filename, "shard 0 10.0.1.1:3306\n", -1, NULL));
+	g_assert_cmpint(-1, ==, network_shard_router_load(router, filename, &gerr));
+	g_assert_error(gerr, NETWORK_SHARD_MAP_ERROR, NETWORK_SHARD_MAP_ERROR_PARSE);
+	g_clear_error(&gerr);
+
+	g_assert(map == network_shard_router_get_map(router));
+
+	/* a reload replaces the map, the old one stays valid */
+	g_assert_cmpint(TRUE, ==, g_file_set_contents(filename, "key account_id hash\nshard 0 10.0.1.1:3306\nshard 1 10.0.2.1:3306\n", -1, NULL));
+	g_assert_cmpint(0, ==, network_shard_router_load(router, filename, &gerr));
+	g_assert_no_error(gerr);
+	g_assert(map != network_shard_router_get_map(router));
+	g_assert_cmpstr("account_id", ==, network_shard_router_get_map(router)->key->str);
+	g_assert_cmpstr("customer_id", ==, map->key->str);
+
+	unlink(filename);
+	g_assert_cmpint(-1, ==, network_shard_router_load(router, filename, &gerr));
+	g_assert_error(gerr, NETWORK_SHARD_MAP_ERROR, NETWORK_SHARD_MAP_ERROR_READ);
+	g_clear_error(&gerr);
+
+	g_free(filename);
+	network_shard_router_free(router);
+}
+
+int main(int argc, char **argv) {
+	g_thread_init(NULL);
+	g_test_init(&argc, &argv, NULL);
+	g_test_bug_base("http://bugs.mysql.com/");
+
+	g_test_add_func("/core/network_shard_map_get_key", t_network_shard_map_get_key);
+	g_test_add_func("/core/network_shard_map_get_shard", t_network_shard_map_get_shard);
+	g_test_add_func("/core/network_shard_map_plan_scatter", t_network_shard_map_plan_scatter);
+	g_test_add_func("/core/network_shard_router_load", t_network_shard_router_load);
+
+	return g_test_run();
+}
+#else
+int main() {
+	return 77;
+}
+#endif
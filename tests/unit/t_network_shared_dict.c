@@ -0,0 +1,230 @@
+/* $%BEGINLICENSE%$
+ Copyright (c) 2008, 2012, Oracle and/or its affiliates. All rights reserved.
+
+ This program is free software; you can redistribute it and/or
+ modify it under the terms of the GNU General Public License as
+ published by the Free Software Foundation; version 2 of the
+ License.
+
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ GNU General Public License for more details.
+
+ You should have received a copy of the GNU General Public License
+ along with this program; if not, write to the Free Software
+ Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA
+ 02110-1301  USA
+
+ $%ENDLICENSE%$ */
+#include <string.h>
+
+#include <glib.h>
+
+#include "network-shared-dict.h"
+
+#if GLIB_CHECK_VERSION(2, 16, 0)
+#define C(x) x, sizeof(x) - 1
+#define S(x) x->str, x->len
+
+static void t_value_set_string(network_shared_dict_value_t *value, GString *str) {
+	value->type = NETWORK_SHARED_DICT_STRING;
+	value->num = 0;
+	value->str = str;
+}
+
+static void t_value_set_number(network_shared_dict_value_t *value, gdouble num) {
+	value->type = NETWORK_SHARED_DICT_NUMBER;
+	value->num = num;
+	value->str = NULL;
+}
+
+void t_network_shared_dict_get() {
+	network_shared_dict_t *dict;
+	network_shared_dict_value_t value;
+	GString *str = g_string_new("bar");
+
+	dict = network_shared_dict_new();
+
+	/* disabled until it gets a limit */
+	t_value_set_string(&value, str);
+	g_assert_cmpint(FALSE, ==, network_shared_dict_set(dict, C("foo"), &value, 0, FALSE));
+
+	network_shared_dict_set_limits(dict, 64 * 1024);
+	g_assert_cmpint(TRUE, ==, network_shared_dict_set(dict, C("foo"), &value, 0, FALSE));
+	t_value_set_number(&value, 42);
+	g_assert_cmpint(TRUE, ==, network_shared_dict_set(dict, C("n\0um"), &value, 0, FALSE));
+
+	g_assert_cmpint(TRUE, ==, network_shared_dict_get(dict, C("foo"), &value));
+	g_assert_cmpint(value.type, ==, NETWORK_SHARED_DICT_STRING);
+	g_assert_cmpstr(value.str->str, ==, "bar");
+	network_shared_dict_value_reset(&value);
+
+	/* keys are binary-safe */
+	g_assert_cmpint(TRUE, ==, network_shared_dict_get(dict, C("n\0um"), &value));
+	g_assert_cmpint(value.type, ==, NETWORK_SHARED_DICT_NUMBER);
+	g_assert_cmpint(value.num, ==, 42);
+	g_assert_cmpint(FALSE, ==, network_shared_dict_get(dict, C("n"), &value));
+	g_assert_cmpint(value.type, ==, NETWORK_SHARED_DICT_NIL);
+
+	/* only_add doesn't replace */
+	t_value_set_number(&value, 1);
+	g_assert_cmpint(FALSE, ==, network_shared_dict_set(dict, C("foo"), &value, 0, TRUE));
+	g_assert_cmpint(TRUE, ==, network_shared_dict_set(dict, C("bar"), &value, 0, TRUE));
+
+	g_assert_cmpint(TRUE, ==, network_shared_dict_delete(dict, C("foo")));
+	g_assert_cmpint(FALSE, ==, network_shared_dict_delete(dict, C("foo")));
+	g_assert_cmpint(FALSE, ==, network_shared_dict_get(dict, C("foo"), &value));
+
+	g_assert_cmpint(2, ==, network_shared_dict_flush(dict));
+	g_assert_cmpint(FALSE, ==, network_shared_dict_get(dict, C("bar"), &value));
+
+	g_string_free(str, TRUE);
+	network_shared_dict_free(dict);
+}
+
+void t_network_shared_dict_incr() {
+	network_shared_dict_t *dict;
+	network_shared_dict_value_t value;
+	GString *str = g_string_new("bar");
+	gdouble init = 10;
+	gdouble result = 0;
+
+	dict = network_shared_dict_new();
+	network_shared_dict_set_limits(dict, 64 * 1024);
+
+	g_assert_cmpint(-1, ==, network_shared_dict_incr(dict, C("cnt"), 1, NULL, 0, &result));
+	g_assert_cmpint(0, ==, network_shared_dict_incr(dict, C("cnt"), 1, &init, 0, &result));
+	g_assert_cmpint(result, ==, 11);
+	g_assert_cmpint(0, ==, network_shared_dict_incr(dict, C("cnt"), -2, &init, 0, &result));
+	g_assert_cmpint(result, ==, 9);
+
+	t_value_set_string(&value, str);
+	g_assert_cmpint(TRUE, ==, network_shared_dict_set(dict, C("foo"), &value, 0, FALSE));
+	g_assert_cmpint(-2, ==, network_shared_dict_incr(dict, C("foo"), 1, &init, 0, &result));
+
+	g_string_free(str, TRUE);
+	network_shared_dict_free(dict);
+}
+
+#define T_INCR_THREADS 4
+#define T_INCR_LOOPS 10000
+
+static gpointer t_incr_thread(gpointer user_data) {
+	network_shared_dict_t *dict = user_data;
+	gdouble init = 0, result;
+	int i;
+
+	for (i = 0; i < T_INCR_LOOPS; i++) {
+		g_assert_cmpint(0, ==, network_shared_dict_incr(dict, C("cnt"), 1, &init, 0, &result));
+	}
+
+	return NULL;
+}
+
+/**
+ * increments from several threads don't get lost
+ */
+void t_network_shared_dict_incr_threads() {
+	network_shared_dict_t *dict;
+	network_shared_dict_value_t value;
+	GThread *threads[T_INCR_THREADS];
+	int i;
+
+	dict = network_shared_dict_new();
+	network_shared_dict_set_limits(dict, 64 * 1024);
+
+	for (i = 0; i < T_INCR_THREADS; i++) {
+		threads[i] = g_thread_create(t_incr_thread, dict, TRUE, NULL);
+	}
+	for (i = 0; i < T_INCR_THREADS; i++) {
+		g_thread_join(threads[i]);
+	}
+
+	g_assert_cmpint(TRUE, ==, network_shared_dict_get(dict, C("cnt"), &value));
+	g_assert_cmpint(value.num, ==, T_INCR_THREADS * T_INCR_LOOPS);
+
+	network_shared_dict_free(dict);
+}
+
+void t_network_shared_dict_ttl() {
+	network_shared_dict_t *dict;
+	network_shared_dict_value_t value;
+	network_shared_dict_stats_t stats;
+
+	dict = network_shared_dict_new();
+	network_shared_dict_set_limits(dict, 64 * 1024);
+
+	t_value_set_number(&value, 1);
+	g_assert_cmpint(TRUE, ==, network_shared_dict_set(dict, C("short"), &value, 1, FALSE));
+	g_assert_cmpint(TRUE, ==, network_shared_dict_set(dict, C("long"), &value, 60 * G_USEC_PER_SEC, FALSE));
+
+	g_usleep(1000);
+
+	g_assert_cmpint(FALSE, ==, network_shared_dict_get(dict, C("short"), &value));
+	g_assert_cmpint(TRUE, ==, network_shared_dict_get(dict, C("long"), &value));
+
+	/* a expired key can be added again */
+	g_assert_cmpint(TRUE, ==, network_shared_dict_set(dict, C("short"), &value, 0, TRUE));
+
+	network_shared_dict_get_stats(dict, &stats);
+	g_assert_cmpint(stats.entries, ==, 2);
+	g_assert_cmpint(stats.hits, ==, 1);
+	g_assert_cmpint(stats.misses, ==, 1);
+
+	network_shared_dict_free(dict);
+}
+
+void t_network_shared_dict_evict() {
+	network_shared_dict_t *dict;
+	network_shared_dict_value_t value;
+	network_shared_dict_stats_t stats;
+	GString *str = g_string_new(NULL);
+	char key[16];
+	int i;
+
+	dict = network_shared_dict_new();
+	network_shared_dict_set_limits(dict, NETWORK_SHARED_DICT_SHARDS * 1024);
+
+	/* too big for a shard */
+	g_string_set_size(str, 2048);
+	t_value_set_string(&value, str);
+	g_assert_cmpint(FALSE, ==, network_shared_dict_set(dict, C("big"), &value, 0, FALSE));
+
+	g_string_set_size(str, 100);
+	for (i = 0; i < 1000; i++) {
+		g_snprintf(key, sizeof(key), "%d", i);
+		g_assert_cmpint(TRUE, ==, network_shared_dict_set(dict, key, strlen(key), &value, 0, FALSE));
+	}
+
+	network_shared_dict_get_stats(dict, &stats);
+	g_assert_cmpint(stats.bytes, <=, NETWORK_SHARED_DICT_SHARDS * 1024);
+	g_assert_cmpint(stats.evictions, >, 0);
+	g_assert_cmpint(stats.entries + stats.evictions, ==, 1000);
+
+	/* the most recent key is still there */
+	g_assert_cmpint(TRUE, ==, network_shared_dict_get(dict, C("999"), &value));
+	network_shared_dict_value_reset(&value);
+
+	g_string_free(str, TRUE);
+	network_shared_dict_free(dict);
+}
+
+int main(int argc, char **argv) {
+	g_thread_init(NULL);
+	g_test_init(&argc, &argv, NULL);
+	g_test_bug_base("http://bugs.mysql.com/");
+
+	g_test_add_func("/core/network_shared_dict_get", t_network_shared_dict_get);
+	g_test_add_func("/core/network_shared_dict_incr", t_network_shared_dict_incr);
+	g_test_add_func("/core/network_shared_dict_incr_threads", t_network_shared_dict_incr_threads);
+	g_test_add_func("/core/network_shared_dict_ttl", t_network_shared_dict_ttl);
+	g_test_add_func("/core/network_shared_dict_evict", t_network_shared_dict_evict);
+
+	return g_test_run();
+}
+#else
+int main() {
+	return 77;
+}
+#endif
@@ -60,6 +60,41 @@ void test_network_socket_new() {
 	network_socket_free(sock);
 }
 
+/**
+ * a idle socket releases its queues and gets them back before it is used
+ */
+void test_network_socket_park() {
+	network_socket *sock;
+	gsize active_bytes;
+
+	sock = network_socket_new();
+	active_bytes = network_socket_get_memory(sock);
+
+	/* data in a queue keeps the socket active */
+	network_queue_append(sock->send_queue, g_string_new("123"));
+	g_assert_cmpint(FALSE, ==, network_socket_park(sock));
+	g_assert_cmpint(network_socket_get_memory(sock), >, active_bytes);
+	g_string_free(network_queue_pop_string(sock->send_queue, 3, NULL), TRUE);
+
+	g_assert_cmpint(TRUE, ==, network_socket_park(sock));
+	g_assert_cmpint(TRUE, ==, sock->is_parked);
+	g_assert(sock->send_queue == NULL);
+	g_assert(sock->recv_queue == NULL);
+	g_assert(sock->recv_queue_raw == NULL);
+	g_assert_cmpint(network_socket_get_memory(sock), <, active_bytes);
+
+	network_socket_unpark(sock);
+	g_assert_cmpint(FALSE, ==, sock->is_parked);
+	g_assert(sock->send_queue != NULL);
+	g_assert(sock->recv_queue != NULL);
+	g_assert(sock->recv_queue_raw != NULL);
+	g_assert_cmpint(network_socket_get_memory(sock), ==, active_bytes);
+
+	/* a parked socket can be freed as is */
+	g_assert_cmpint(TRUE, ==, network_socket_park(sock));
+	network_socket_free(sock);
+}
+
 void test_network_queue_append() {
 	network_queue *q;
 
@@ -335,6 +370,77 @@ void t_network_socket_connect(void) {
 	network_socket_free(sock);
 }
 
+/**
+ * @test  network_socket_read_adaptive() reads without FIONREAD
+ *   - all chunks that were sent end up in one read
+ *   - a drained socket returns WAIT_FOR_EVENT
+ */
+void t_network_socket_read_adaptive(void) {
+	network_socket *sock;
+	network_socket *client;
+	network_socket *client_connected;
+	fd_set read_fds;
+	struct timeval timeout;
+	network_socket_retval_t ret;
+	int srv_port;
+	char *srv_addr;
+	
+	g_log_set_always_fatal(G_LOG_FATAL_MASK); /* we log g_critical() which is fatal for the test-suite */
+
+	sock = network_socket_new();
+
+	g_assert_cmpint(0, ==, network_address_set_address(sock->dst, "127.0.0.1:0"));
+	
+	g_assert_cmpint(NETWORK_SOCKET_SUCCESS, ==, network_socket_bind(sock));
+	srv_port = ntohs(sock->dst->addr.ipv4.sin_port);
+	srv_addr = g_strdup_printf("127.0.0.1:%d", srv_port);
+	
+	client = network_socket_new();
+	g_assert_cmpint(0, ==, network_address_set_address(client->dst, srv_addr));
+	g_free(srv_addr);
+
+	switch ((ret = network_socket_connect(client))) {
+	case NETWORK_SOCKET_ERROR_RETRY:
+		client_connected = network_socket_accept(sock);
+	
+		g_assert_cmpint(NETWORK_SOCKET_SUCCESS, ==, network_socket_connect_finish(client));
+	
+		break;
+	case NETWORK_SOCKET_SUCCESS:
+		client_connected = network_socket_accept(sock);
+		break;
+	default:
+		client_connected = NULL;
+		g_assert_cmpint(NETWORK_SOCKET_ERROR_RETRY,  ==, ret);
+		break;
+	}
+	
+	g_assert(client_connected);
+
+	network_queue_append(client->send_queue, g_string_new_len(C("foo")));
+	network_queue_append(client->send_queue, g_string_new_len(C("bar")));
+	g_assert_cmpint(NETWORK_SOCKET_SUCCESS, ==, network_socket_write(client, -1)); /* send all */
+	g_assert_cmpint(client->write_bytes, ==, 6);
+
+	FD_ZERO(&read_fds);
+	FD_SET(client_connected->fd, &read_fds);
+	timeout.tv_sec = 1;
+	timeout.tv_usec = 500 * 000; /* wait 500ms */
+	g_assert_cmpint(1, ==, select(client_connected->fd + 1, &read_fds, NULL, NULL, &timeout));
+	
+	/* no network_socket_to_read() needed */
+	g_assert_cmpint(NETWORK_SOCKET_SUCCESS, ==, network_socket_read_adaptive(client_connected));
+	g_assert_cmpint(6, ==, client_connected->recv_queue_raw->len);
+	g_assert_cmpint(0, ==, client_connected->to_read);
+
+	/* drained */
+	g_assert_cmpint(NETWORK_SOCKET_WAIT_FOR_EVENT, ==, network_socket_read_adaptive(client_connected));
+	
+	network_socket_free(client);
+	network_socket_free(client_connected);
+	network_socket_free(sock);
+}
+
 /**
  * @test  check if the network_socket_connect() works by 
  *   - setting up a listening socket
@@ -651,11 +757,13 @@ int main(int argc, char **argv) {
 	g_test_bug_base("http://bugs.mysql.com/");
 
 	g_test_add_func("/core/network_socket_new", test_network_socket_new);
+	g_test_add_func("/core/network_socket_park", test_network_socket_park);
 	g_test_add_func("/core/network_socket_bind_ipv4_no_address", t_network_socket_bind_ipv4_no_address);
 	g_test_add_func("/core/network_socket_bind_ipv4_port_0",t_network_socket_bind_ipv4_port_0);
 	g_test_add_func("/core/network_socket_bind_ipv6_port_0",t_network_socket_bind_ipv6_port_0);
 	g_test_add_func("/core/network_socket_bind_ipv4_rebind", t_network_socket_bind_ipv4_rebind);
 	g_test_add_func("/core/network_socket_connect", t_network_socket_connect);
+	g_test_add_func("/core/network_socket_read_adaptive", t_network_socket_read_adaptive);
 	g_test_add_func("/core/network_queue_append", test_network_queue_append);
 	g_test_add_func("/core/network_queue_peek_string", test_network_queue_peek_string);
 	g_test_add_func("/core/network_queue_pop_string", test_network_queue_pop_string);
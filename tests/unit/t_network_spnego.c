@@ -173,6 +173,44 @@ t_spnego_decode_response_accept_complete(void) {
 	network_spnego_response_token_free(token);
 }
 
+/**
+ * the negState is found without copying the tokens, a response without one continues the exchange
+ */
+static void
+t_spnego_get_response_state(void) {
+	const char accept_complete[] = 
+		"\xa1\x1b\x30\x19\xa0\x03\x0a\x01\x00\xa3\x12"
+		"\x04\x10\x01\x00\x00\x00\x43\x87\xe0\x88\xc1\x36\xe3\xa9\x00\x00"
+		"\x00\x00";
+	const char no_neg_state[] = 
+		"\xa1\x0e\x30\x0c\xa2\x0a\x04\x08\x01\x02\x03\x04\x05\x06\x07\x08";
+	const char truncated[] = 
+		"\xa1\x0e\x30\x0c\xa2\x0a\x04\x08\x01\x02\x03";
+	network_spnego_response_state state;
+	network_packet packet;
+	GError *gerr = NULL;
+
+	packet.data = g_string_new_len(C(accept_complete));
+	packet.offset = 0;
+	g_assert_cmpint(TRUE, ==, network_spnego_proto_get_response_state(&packet, &state, &gerr));
+	g_assert_cmpint(state, ==, SPNEGO_RESPONSE_STATE_ACCEPT_COMPLETED);
+	g_string_free(packet.data, TRUE);
+
+	packet.data = g_string_new_len(C(no_neg_state));
+	packet.offset = 0;
+	g_assert_cmpint(TRUE, ==, network_spnego_proto_get_response_state(&packet, &state, &gerr));
+	g_assert_cmpint(state, ==, SPNEGO_RESPONSE_STATE_ACCEPT_INCOMPLETE);
+	g_assert_cmpint(packet.offset, ==, packet.data->len);
+	g_string_free(packet.data, TRUE);
+
+	packet.data = g_string_new_len(C(truncated));
+	packet.offset = 0;
+	g_assert_cmpint(FALSE, ==, network_spnego_proto_get_response_state(&packet, &state, &gerr));
+	g_assert(gerr != NULL);
+	g_clear_error(&gerr);
+	g_string_free(packet.data, TRUE);
+}
+
 
 int
 main(int argc, char **argv) {
@@ -182,6 +220,7 @@ main(int argc, char **argv) {
 	g_test_add_func("/spnego/decode_init", t_spnego_decode_init);
 	g_test_add_func("/spnego/decode_response_accept_incomplete", t_spnego_decode_response_accept_incomplete);
 	g_test_add_func("/spnego/decode_response_accept_complete", t_spnego_decode_response_accept_complete);
+	g_test_add_func("/spnego/get_response_state", t_spnego_get_response_state);
 
 	return g_test_run();
 
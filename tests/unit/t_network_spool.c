@@ -0,0 +1,131 @@
+/* $%BEGINLICENSE%$
+ Copyright (c) 2008, 2012, Oracle and/or its affiliates. All rights reserved.
+
+ This program is free software; you can redistribute it and/or
+ modify it under the terms of the GNU General Public License as
+ published by the Free Software Foundation; version 2 of the
+ License.
+
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ GNU General Public License for more details.
+
+ You should have received a copy of the GNU General Public License
+ along with this program; if not, write to the Free Software
+ Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA
+ 02110-1301  USA
+
+ $%ENDLICENSE%$ */
+#ifndef __NETWORK_FLOW_CONTROL_H__
+#include <string.h>
+
+#include <glib.h>
+
+#include "network-spool.h"
+
+#if GLIB_CHECK_VERSION(2, 16, 0)
+/**
+ * read back all of the spool in parts of max_len and append it to out
+ */
+static void spool_drain(network_spool_t *spool, gsize max_len, GString *out) {
+	GString *chunk;
+	GError *gerr = NULL;
+
+	while (NULL != (chunk = network_spool_read(spool, max_len, &gerr))) {
+		g_assert_cmpint(chunk->len, <=, max_len);
+		g_string_append_len(out, chunk->str, chunk->len);
+		g_string_free(chunk, TRUE);
+	}
+	g_assert(gerr == NULL);
+}
+
+/**
+ * small writes stay in the buffer, the spool doesn't need a file for them
+ */
+void t_network_spool_buffered() {
+	network_spool_t *spool = network_spool_new();
+	GString *out = g_string_new(NULL);
+	GError *gerr = NULL;
+
+	g_assert(NULL == network_spool_read(spool, 1024, &gerr));
+	g_assert(gerr == NULL);
+
+	g_assert_cmpint(TRUE, ==, network_spool_write(spool, "abc", 3, &gerr));
+	g_assert_cmpint(TRUE, ==, network_spool_write(spool, "def", 3, &gerr));
+	g_assert_cmpint(6, ==, network_spool_get_len(spool));
+	g_assert_cmpint(-1, ==, spool->fd);
+
+	spool_drain(spool, 4, out);
+	g_assert_cmpstr("abcdef", ==, out->str);
+	g_assert_cmpint(0, ==, network_spool_get_len(spool));
+
+	g_string_free(out, TRUE);
+	network_spool_free(spool);
+}
+
+/**
+ * the bytes come back in the order they were written, across the file and the buffer
+ */
+void t_network_spool_file() {
+	network_spool_t *spool = network_spool_new();
+	GString *in = g_string_new(NULL);
+	GString *out = g_string_new(NULL);
+	GError *gerr = NULL;
+	guint i;
+
+	for (i = 0; in->len < 300 * 1024; i++) {
+		gchar line[64];
+		gint len = g_snprintf(line, sizeof(line), "row %u\n", i);
+
+		g_string_append_len(in, line, len);
+		g_assert_cmpint(TRUE, ==, network_spool_write(spool, line, len, &gerr));
+	}
+	g_assert(gerr == NULL);
+	g_assert_cmpint(-1, !=, spool->fd);
+	g_assert_cmpint(in->len, ==, network_spool_get_len(spool));
+
+	/* take a part of it and let more follow */
+	while (out->len < 100 * 1024) {
+		GString *chunk = network_spool_read(spool, 7000, &gerr);
+
+		g_assert(chunk != NULL);
+		g_string_append_len(out, chunk->str, chunk->len);
+		g_string_free(chunk, TRUE);
+	}
+
+	for (i = 0; i < 1000; i++) {
+		g_string_append_len(in, "tail\n", 5);
+		g_assert_cmpint(TRUE, ==, network_spool_write(spool, "tail\n", 5, &gerr));
+	}
+
+	spool_drain(spool, 64 * 1024, out);
+
+	g_assert_cmpint(in->len, ==, out->len);
+	g_assert(0 == memcmp(in->str, out->str, in->len));
+
+	/* the space is given back once everything is read */
+	g_assert_cmpint(0, ==, network_spool_get_len(spool));
+	g_assert_cmpint(0, ==, spool->write_offset);
+	g_assert_cmpint(0, ==, spool->read_offset);
+
+	g_string_free(in, TRUE);
+	g_string_free(out, TRUE);
+	network_spool_free(spool);
+}
+
+int main(int argc, char **argv) {
+	g_thread_init(NULL);
+	g_test_init(&argc, &argv, NULL);
+	g_test_bug_base("http://bugs.mysql.com/");
+
+	g_test_add_func("/core/network_spool_buffered", t_network_spool_buffered);
+	g_test_add_func("/core/network_spool_file", t_network_spool_file);
+
+	return g_test_run();
+}
+#else
+int main() {
+	return 77;
+}
+#endif
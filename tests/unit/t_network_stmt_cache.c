@@ -0,0 +1,252 @@
+/* $%BEGINLICENSE%$
+ Copyright (c) 2008, 2012, Oracle and/or its affiliates. All rights reserved.
+
+ This program is free software; you can redistribute it and/or
+ modify it under the terms of the GNU General Public License as
+ published by the Free Software Foundation; version 2 of the
+ License.
+
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ GNU General Public License for more details.
+
+ You should have received a copy of the GNU General Public License
+ along with this program; if not, write to the Free Software
+ Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA
+ 02110-1301  USA
+
+ $%ENDLICENSE%$ */
+#include <string.h>
+
+#include <glib.h>
+
+#include "network-mysqld-proto.h"
+#include "network-mysqld-packet.h"
+#include "network-stmt-cache.h"
+
+#if GLIB_CHECK_VERSION(2, 16, 0)
+#define C(x) x, sizeof(x) - 1
+#define S(x) x->str, x->len
+
+/**
+ * the response to a COM_STMT_PREPARE without params and columns
+ */
+static GPtrArray *t_prepare_ok_new(guint32 stmt_id) {
+	GPtrArray *packets = g_ptr_array_new();
+	GString *packet;
+
+	packet = g_string_new_len(C("\x0c\x00\x00\x01" "\x00" "\x00\x00\x00\x00" "\x00\x00" "\x00\x00" "\x00" "\x00\x00"));
+	network_stmt_cache_packet_set_stmt_id(packet, stmt_id);
+
+	g_ptr_array_add(packets, packet);
+
+	return packets;
+}
+
+static GString *t_key_new(const char *stmt_text, gsize stmt_text_len) {
+	GString *key = g_string_new(NULL);
+	GString *default_db = g_string_new("test");
+
+	network_stmt_cache_key_set(key, default_db, stmt_text, stmt_text_len);
+
+	g_string_free(default_db, TRUE);
+
+	return key;
+}
+
+void t_network_stmt_cache_key_set() {
+	GString *key = g_string_new(NULL);
+
+	network_stmt_cache_key_set(key, NULL, C("SELECT ?"));
+	g_assert_cmpint(key->len, ==, sizeof("\0SELECT ?") - 1);
+	g_assert(0 == memcmp(key->str, C("\0SELECT ?")));
+
+	g_string_free(key, TRUE);
+}
+
+void t_network_stmt_cache_packet_stmt_id() {
+	GString *packet;
+	guint32 stmt_id = 0;
+
+	/* COM_STMT_EXECUTE of stmt-id 1 */
+	packet = g_string_new_len(C("\x0a\x00\x00\x00" "\x17" "\x01\x00\x00\x00" "\x00" "\x01\x00\x00\x00"));
+
+	g_assert_cmpint(0, ==, network_stmt_cache_packet_get_stmt_id(packet, &stmt_id));
+	g_assert_cmpint(stmt_id, ==, 1);
+
+	g_assert_cmpint(0, ==, network_stmt_cache_packet_set_stmt_id(packet, 0x01020304));
+	g_assert(0 == memcmp(packet->str, C("\x0a\x00\x00\x00" "\x17" "\x04\x03\x02\x01" "\x00" "\x01\x00\x00\x00")));
+
+	g_assert_cmpint(0, ==, network_stmt_cache_packet_get_stmt_id(packet, &stmt_id));
+	g_assert_cmpint(stmt_id, ==, 0x01020304);
+
+	/* too short */
+	g_string_truncate(packet, 6);
+	g_assert_cmpint(-1, ==, network_stmt_cache_packet_get_stmt_id(packet, &stmt_id));
+	g_assert_cmpint(-1, ==, network_stmt_cache_packet_set_stmt_id(packet, 1));
+
+	g_string_free(packet, TRUE);
+}
+
+void t_network_stmt_cache_get() {
+	network_stmt_cache_t *cache;
+	network_stmt_cache_entry_t *entry;
+	GPtrArray *packets;
+	GString *key;
+
+	cache = network_stmt_cache_new(NETWORK_STMT_CACHE_MAX_ENTRIES);
+	key = t_key_new(C("SELECT ?"));
+
+	g_assert(NULL == network_stmt_cache_get(cache, key));
+
+	entry = network_stmt_cache_add(cache, key, t_prepare_ok_new(7));
+	g_assert(NULL != entry);
+	g_assert_cmpint(entry->stmt_id, ==, 7);
+
+	entry = network_stmt_cache_get(cache, key);
+	g_assert(NULL != entry);
+	g_assert_cmpint(entry->stmt_id, ==, 7);
+	g_assert_cmpint(entry->packets->len, ==, 1);
+
+	/* the statement is already known */
+	g_assert(NULL == network_stmt_cache_add(cache, key, t_prepare_ok_new(8)));
+	g_assert_cmpint(network_stmt_cache_get(cache, key)->stmt_id, ==, 7);
+
+	/* an ERR isn't a prepared statement */
+	packets = g_ptr_array_new();
+	g_ptr_array_add(packets, g_string_new_len(C("\x0a\x00\x00\x01" "\xff" "\x7a\x04" "#42S02" "x")));
+	g_string_assign(key, "other");
+	g_assert(NULL == network_stmt_cache_add(cache, key, packets));
+	g_assert(NULL == network_stmt_cache_get(cache, key));
+
+	g_string_free(key, TRUE);
+	network_stmt_cache_free(cache);
+}
+
+void t_network_stmt_cache_evict() {
+	network_stmt_cache_t *cache;
+	GString *key1, *key2, *key3;
+
+	cache = network_stmt_cache_new(2);
+	key1 = t_key_new(C("SELECT 1"));
+	key2 = t_key_new(C("SELECT 2"));
+	key3 = t_key_new(C("SELECT 3"));
+
+	g_assert_cmpint(0, ==, network_stmt_cache_evict(cache));
+
+	g_assert(NULL != network_stmt_cache_add(cache, key1, t_prepare_ok_new(1)));
+	g_assert_cmpint(FALSE, ==, network_stmt_cache_is_full(cache));
+	g_assert(NULL != network_stmt_cache_add(cache, key2, t_prepare_ok_new(2)));
+	g_assert_cmpint(TRUE, ==, network_stmt_cache_is_full(cache));
+
+	/* key1 is used again, key2 is the oldest now */
+	g_assert(NULL != network_stmt_cache_get(cache, key1));
+	g_assert_cmpint(2, ==, network_stmt_cache_evict(cache));
+	g_assert(NULL == network_stmt_cache_get(cache, key2));
+
+	g_assert(NULL != network_stmt_cache_add(cache, key3, t_prepare_ok_new(3)));
+	g_assert_cmpint(1, ==, network_stmt_cache_evict(cache));
+	g_assert_cmpint(3, ==, network_stmt_cache_evict(cache));
+	g_assert_cmpint(0, ==, network_stmt_cache_evict(cache));
+
+	g_string_free(key1, TRUE);
+	g_string_free(key2, TRUE);
+	g_string_free(key3, TRUE);
+	network_stmt_cache_free(cache);
+}
+
+/**
+ * a result-set of a COM_STMT_EXECUTE with 2 columns
+ *
+ * @param value_name the name of the 2nd column, 5 chars
+ */
+static GQueue *t_resultset_new(const char *value_name) {
+	GQueue *q = g_queue_new();
+	GString *packet;
+
+	g_queue_push_tail(q, g_string_new_len(C("\1\0\0\1\2")));
+	g_queue_push_tail(q, g_string_new_len(C("6\0\0\2\3def\0\6STATUS\0\rVariable_name\rVariable_name\f\10\0P\0\0\0\375\1\0\0\0\0")));
+
+	packet = g_string_new_len(C("&\0\0\3\3def\0\6STATUS\0\5Value\5Value\f\10\0\0\2\0\0\375\1\0\0\0\0"));
+	memcpy(packet->str + 18, value_name, 5);
+	g_queue_push_tail(q, packet);
+
+	g_queue_push_tail(q, g_string_new_len(C("\5\0\0\4\376\0\0\"\0")));
+	g_queue_push_tail(q, g_string_new_len(C("\5\0\0\5\376\0\0\"\0")));
+
+	return q;
+}
+
+static void t_resultset_free(GQueue *q) {
+	GString *packet;
+
+	while ((packet = g_queue_pop_head(q))) g_string_free(packet, TRUE);
+
+	g_queue_free(q);
+}
+
+/**
+ * the column-defs of a statement are parsed once and shared by its result-sets
+ */
+void t_network_stmt_cache_coldefs() {
+	network_stmt_cache_t *cache;
+	network_mysqld_proto_fielddef_t *field;
+	GQueue *q1, *q2, *q3;
+	GRef *ref1, *ref2, *ref3;
+
+	cache = network_stmt_cache_new(2);
+	q1 = t_resultset_new("Value");
+	q2 = t_resultset_new("Value");
+	q3 = t_resultset_new("Other");
+
+	ref1 = network_stmt_cache_get_coldefs(cache, 1, q1->head);
+	g_assert(NULL != ref1);
+	g_assert_cmpint(((GPtrArray *)ref1->udata)->len, ==, 2);
+
+	/* the same column-defs again */
+	ref2 = network_stmt_cache_get_coldefs(cache, 1, q2->head);
+	g_assert(ref1 == ref2);
+
+	/* they changed, the result-sets that have the old ones keep them */
+	ref3 = network_stmt_cache_get_coldefs(cache, 1, q3->head);
+	g_assert(ref1 != ref3);
+	field = ((GPtrArray *)ref3->udata)->pdata[1];
+	g_assert_cmpstr(field->name, ==, "Other");
+	field = ((GPtrArray *)ref1->udata)->pdata[1];
+	g_assert_cmpstr(field->name, ==, "Value");
+
+	/* the rows start after the EOF */
+	g_assert(q1->head->next->next->next == network_mysqld_proto_skip_fielddefs(q1->head, 2));
+
+	network_stmt_cache_forget_coldefs(cache, 1);
+	g_ref_unref(ref1);
+	g_ref_unref(ref2);
+	g_ref_unref(ref3);
+
+	/* not a result-set */
+	g_assert(NULL == network_stmt_cache_get_coldefs(cache, 2, q1->tail));
+
+	t_resultset_free(q1);
+	t_resultset_free(q2);
+	t_resultset_free(q3);
+	network_stmt_cache_free(cache);
+}
+
+int main(int argc, char **argv) {
+	g_test_init(&argc, &argv, NULL);
+	g_test_bug_base("http://bugs.mysql.com/");
+
+	g_test_add_func("/core/network_stmt_cache_key_set", t_network_stmt_cache_key_set);
+	g_test_add_func("/core/network_stmt_cache_packet_stmt_id", t_network_stmt_cache_packet_stmt_id);
+	g_test_add_func("/core/network_stmt_cache_get", t_network_stmt_cache_get);
+	g_test_add_func("/core/network_stmt_cache_evict", t_network_stmt_cache_evict);
+	g_test_add_func("/core/network_stmt_cache_coldefs", t_network_stmt_cache_coldefs);
+
+	return g_test_run();
+}
+#else
+int main() {
+	return 77;
+}
+#endif
@@ -0,0 +1,192 @@
+/* $%BEGINLICENSE%$
+ Copyright (c) 2008, 2012, Oracle and/or its affiliates. All rights reserved.
+
+ This program is free software; you can redistribute it and/or
+ modify it under the terms of the GNU General Public License as
+ published by the Free Software Foundation; version 2 of the
+ License.
+
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ GNU General Public License for more details.
+
+ You should have received a copy of the GNU General Public License
+ along with this program; if not, write to the Free Software
+ Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA
+ 02110-1301  USA
+
+ $%ENDLICENSE%$ */
+#include <string.h>
+
+#include <glib.h>
+
+#include "network-mysqld-proto.h"
+#include "network_mysqld_type.h"
+#include "network-stmt-promote.h"
+
+#if GLIB_CHECK_VERSION(2, 16, 0)
+#define C(x) x, sizeof(x) - 1
+#define S(x) x->str, x->len
+
+static void t_params_free(GPtrArray *params) {
+	guint i;
+
+	for (i = 0; i < params->len; i++) {
+		network_mysqld_type_free(params->pdata[i]);
+	}
+	g_ptr_array_free(params, TRUE);
+}
+
+static void t_assert_int_param(network_mysqld_type_t *param, guint64 expected) {
+	guint64 i;
+	gboolean is_unsigned;
+
+	g_assert_cmpint(param->type, ==, MYSQL_TYPE_LONGLONG);
+	g_assert_cmpint(0, ==, network_mysqld_type_get_int(param, &i, &is_unsigned));
+	g_assert_cmpint(i, ==, expected);
+}
+
+static void t_assert_string_param(network_mysqld_type_t *param, enum enum_field_types type, const char *expected) {
+	const char *s;
+	gsize s_len;
+
+	g_assert_cmpint(param->type, ==, type);
+	g_assert_cmpint(0, ==, network_mysqld_type_get_string_const(param, &s, &s_len));
+	g_assert_cmpint(s_len, ==, strlen(expected));
+	g_assert_cmpint(0, ==, memcmp(s, expected, s_len));
+}
+
+/**
+ * the literals in the value positions are replaced by ?
+ */
+void t_network_stmt_promote_parameterize() {
+	GString *stmt_text = g_string_new(NULL);
+	GPtrArray *params = g_ptr_array_new();
+	guint64 hash1, hash2;
+
+	g_assert_cmpint(0, ==, network_stmt_promote_parameterize(stmt_text, &hash1, params,
+				C("SELECT name FROM users WHERE id = 12 AND  state = 'active' LIMIT 10")));
+	g_assert_cmpstr(stmt_text->str, ==, "SELECT name FROM users WHERE id = ? AND state = ? LIMIT ?");
+	g_assert_cmpint(params->len, ==, 3);
+	t_assert_int_param(params->pdata[0], 12);
+	t_assert_string_param(params->pdata[1], MYSQL_TYPE_STRING, "active");
+	t_assert_int_param(params->pdata[2], 10);
+	t_params_free(params);
+
+	/* the same shape with other literals has the same hash */
+	params = g_ptr_array_new();
+	g_string_truncate(stmt_text, 0);
+	g_assert_cmpint(0, ==, network_stmt_promote_parameterize(stmt_text, &hash2, params,
+				C("/* from the app */ select name from users where id = 99 and state = 'it''s' limit 1")));
+	g_assert_cmpstr(stmt_text->str, ==, "select name from users where id = ? and state = ? limit ?");
+	t_assert_string_param(params->pdata[1], MYSQL_TYPE_STRING, "it's");
+	t_params_free(params);
+
+	params = g_ptr_array_new();
+	g_string_truncate(stmt_text, 0);
+	g_assert_cmpint(0, ==, network_stmt_promote_parameterize(stmt_text, &hash2, params,
+				C("SELECT name FROM users WHERE id = 99 AND state = 'x' LIMIT 1")));
+	g_assert_cmpint(hash1, ==, hash2);
+	t_params_free(params);
+
+	/* the select-list, ORDER BY and GROUP BY positions stay as they are */
+	params = g_ptr_array_new();
+	g_string_truncate(stmt_text, 0);
+	g_assert_cmpint(0, ==, network_stmt_promote_parameterize(stmt_text, &hash1, params,
+				C("select a, 1, 'x' from t where b in (1, 2, 3) order by 1, a desc limit 5, 10")));
+	g_assert_cmpstr(stmt_text->str, ==, "select a, 1, 'x' from t where b in (?, ?, ?) order by 1, a desc limit ?, ?");
+	g_assert_cmpint(params->len, ==, 5);
+	t_params_free(params);
+
+	/* decimals and numbers that don't fit into a BIGINT */
+	params = g_ptr_array_new();
+	g_string_truncate(stmt_text, 0);
+	g_assert_cmpint(0, ==, network_stmt_promote_parameterize(stmt_text, &hash1, params,
+				C("SELECT * FROM t WHERE a = 1.50 AND b = 99999999999999999999")));
+	g_assert_cmpstr(stmt_text->str, ==, "SELECT * FROM t WHERE a = ? AND b = ?");
+	t_assert_string_param(params->pdata[0], MYSQL_TYPE_NEWDECIMAL, "1.50");
+	t_assert_string_param(params->pdata[1], MYSQL_TYPE_NEWDECIMAL, "99999999999999999999");
+	t_params_free(params);
+
+	g_string_free(stmt_text, TRUE);
+}
+
+/**
+ * the queries we can't promote without changing what they mean
+ */
+void t_network_stmt_promote_parameterize_fails() {
+	const char *queries[] = {
+		"UPDATE t SET a = 1",
+		"SELECT * FROM t WHERE a = 'x\\'y'",
+		"SELECT * FROM t WHERE a = \"x\"",
+		"SELECT * FROM t WHERE d = DATE '2012-01-01'",
+		"SELECT * FROM t WHERE a = _utf8'x'",
+		"SELECT * FROM t WHERE a = 0x1f",
+		"SELECT * FROM t WHERE a = 1e3",
+		"SELECT * FROM t WHERE a = ?",
+		"SELECT 1; SELECT 2",
+		"SELECT /*!40001 SQL_NO_CACHE */ * FROM t",
+		"SELECT a INTO @a FROM t WHERE b = 1",
+		"SELECT * FROM t WHERE a = 'x' 'y'",
+		"SELECT * FROM t WHERE (a = 1",
+		NULL
+	};
+	GString *stmt_text = g_string_new(NULL);
+	GPtrArray *params = g_ptr_array_new();
+	guint64 hash;
+	guint i;
+
+	for (i = 0; queries[i]; i++) {
+		g_assert_cmpint(-1, ==, network_stmt_promote_parameterize(stmt_text, &hash, params, queries[i], strlen(queries[i])));
+		g_assert_cmpint(0, ==, stmt_text->len);
+		g_assert_cmpint(0, ==, params->len);
+	}
+
+	t_params_free(params);
+	g_string_free(stmt_text, TRUE);
+}
+
+/**
+ * a shape gets hot after threshold executions, unless it is blocked
+ */
+void t_network_stmt_promote_is_hot() {
+	network_stmt_promote_t *promote;
+
+	promote = network_stmt_promote_new(3);
+
+	g_assert(!network_stmt_promote_is_hot(promote, 1));
+	g_assert(!network_stmt_promote_is_hot(promote, 1));
+	g_assert(network_stmt_promote_is_hot(promote, 1));
+	g_assert(network_stmt_promote_is_hot(promote, 1));
+
+	g_assert(!network_stmt_promote_is_hot(promote, 2));
+
+	network_stmt_promote_block(promote, 1);
+	g_assert(!network_stmt_promote_is_hot(promote, 1));
+
+	/* a full table forgets the cold shapes, the hot and blocked ones stay */
+	promote->max_shapes = 2;
+	g_assert(!network_stmt_promote_is_hot(promote, 3));
+	g_assert_cmpint(g_hash_table_size(promote->shapes), ==, 2);
+	g_assert(!network_stmt_promote_is_hot(promote, 1));
+
+	network_stmt_promote_free(promote);
+}
+
+int main(int argc, char **argv) {
+	g_thread_init(NULL);
+	g_test_init(&argc, &argv, NULL);
+	g_test_bug_base("http://bugs.mysql.com/");
+
+	g_test_add_func("/core/network_stmt_promote_parameterize", t_network_stmt_promote_parameterize);
+	g_test_add_func("/core/network_stmt_promote_parameterize_fails", t_network_stmt_promote_parameterize_fails);
+	g_test_add_func("/core/network_stmt_promote_is_hot", t_network_stmt_promote_is_hot);
+
+	return g_test_run();
+}
+#else
+int main() {
+	return 77;
+}
+#endif
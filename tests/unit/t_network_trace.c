@@ -0,0 +1,197 @@
+/* $%BEGINLICENSE%$
+ Copyright (c) 2008, 2012, Oracle and/or its affiliates. All rights reserved.
+
+ This program is free software; you can redistribute it and/or
+ modify it under the terms of the GNU General Public License as
+ published by the Free Software Foundation; version 2 of the
+ License.
+
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ GNU General Public License for more details.
+
+ You should have received a copy of the GNU General Public License
+ along with this program; if not, write to the Free Software
+ Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA
+ 02110-1301  USA
+
+ $%ENDLICENSE%$ */
+#include <string.h>
+#ifndef WIN32
+#include <unistd.h>
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#endif
+
+#include <glib.h>
+
+#include "network-trace.h"
+
+#if GLIB_CHECK_VERSION(2, 16, 0)
+#define C(x) x, sizeof(x) - 1
+
+void t_network_trace_context_parse() {
+	network_trace_context_t ctx;
+
+	g_assert_cmpint(TRUE, ==, network_trace_context_parse(&ctx, C("00-0af7651916cd43dd8448eb211c80319c-b7ad6b7169203331-01")));
+	g_assert_cmpint(TRUE, ==, ctx.is_set);
+	g_assert_cmpstr(ctx.trace_id, ==, "0af7651916cd43dd8448eb211c80319c");
+	g_assert_cmpstr(ctx.parent_id, ==, "b7ad6b7169203331");
+	g_assert_cmpint(ctx.flags, ==, 1);
+
+	/* a later version may append fields */
+	g_assert_cmpint(TRUE, ==, network_trace_context_parse(&ctx, C("01-0af7651916cd43dd8448eb211c80319c-b7ad6b7169203331-00-xyz")));
+	g_assert_cmpint(ctx.flags, ==, 0);
+
+	/* upper-case, all-zero ids, a bad version or length */
+	g_assert_cmpint(FALSE, ==, network_trace_context_parse(&ctx, C("00-0AF7651916CD43DD8448EB211C80319C-b7ad6b7169203331-01")));
+	g_assert_cmpint(FALSE, ==, ctx.is_set);
+	g_assert_cmpint(FALSE, ==, network_trace_context_parse(&ctx, C("00-00000000000000000000000000000000-b7ad6b7169203331-01")));
+	g_assert_cmpint(FALSE, ==, network_trace_context_parse(&ctx, C("00-0af7651916cd43dd8448eb211c80319c-0000000000000000-01")));
+	g_assert_cmpint(FALSE, ==, network_trace_context_parse(&ctx, C("ff-0af7651916cd43dd8448eb211c80319c-b7ad6b7169203331-01")));
+	g_assert_cmpint(FALSE, ==, network_trace_context_parse(&ctx, C("00-0af7651916cd43dd8448eb211c80319c-b7ad6b7169203331-01-")));
+	g_assert_cmpint(FALSE, ==, network_trace_context_parse(&ctx, C("00-0af7651916cd43dd8448eb211c80319c-b7ad6b7169203331")));
+}
+
+/**
+ * a query sent to the backend after waiting in the admission queue has all the spans
+ */
+void t_network_trace_query_json() {
+	network_trace_query_t *query = network_trace_query_new();
+	GString *out = g_string_new(NULL);
+
+	g_assert_cmpint(TRUE, ==, network_trace_context_parse(&query->ctx, C("00-0af7651916cd43dd8448eb211c80319c-b7ad6b7169203331-01")));
+	query->unix_offset_usec = 1300000000000000;
+	query->read_usec = 10;
+	query->queued_usec = 20;
+	query->admitted_usec = 30;
+	query->sent_usec = 40;
+	query->first_usec = 50;
+	query->last_usec = 60;
+	query->command = 3;
+	query->user = g_strdup("root");
+	query->backend = g_strdup("127.0.0.1:3306");
+	query->is_error = TRUE;
+
+	g_assert_cmpint(5, ==, network_trace_query_to_json(out, query));
+
+	g_assert(NULL != strstr(out->str, "\"traceId\":\"0af7651916cd43dd8448eb211c80319c\""));
+	g_assert(NULL != strstr(out->str, "\"parentSpanId\":\"b7ad6b7169203331\",\"name\":\"query\",\"kind\":2,"
+				"\"startTimeUnixNano\":\"1300000000000010000\",\"endTimeUnixNano\":\"1300000000000060000\""));
+	g_assert(NULL != strstr(out->str, "{\"key\":\"db.user\",\"value\":{\"stringValue\":\"root\"}}"));
+	g_assert(NULL != strstr(out->str, "\"status\":{\"code\":2}"));
+	g_assert(NULL != strstr(out->str, "\"name\":\"backend_selection\",\"kind\":1,"
+				"\"startTimeUnixNano\":\"1300000000000010000\",\"endTimeUnixNano\":\"1300000000000020000\""));
+	g_assert(NULL != strstr(out->str, "\"name\":\"queue_wait\""));
+	g_assert(NULL != strstr(out->str, "\"name\":\"time_to_first_byte\""));
+	g_assert(NULL != strstr(out->str, "\"name\":\"result_streaming\""));
+
+	/* answered by the proxy: only the query itself, in a new trace */
+	g_string_truncate(out, 0);
+	memset(&query->ctx, 0, sizeof(query->ctx));
+	query->admitted_usec = 0;
+	query->sent_usec = 0;
+	g_assert_cmpint(1, ==, network_trace_query_to_json(out, query));
+	g_assert(NULL == strstr(out->str, "parentSpanId"));
+
+	network_trace_query_free(query);
+	g_string_free(out, TRUE);
+}
+
+#ifndef WIN32
+/**
+ * the queries a client samples are traced, the others every <n>th time, and the spans arrive
+ */
+void t_network_trace_send() {
+	network_trace_t *trace;
+	network_trace_context_t ctx;
+	network_address *addr;
+	struct sockaddr_in sin;
+	socklen_t sin_len = sizeof(sin);
+	GError *gerr = NULL;
+	gchar *address;
+	char buf[NETWORK_TRACE_MAX_DATAGRAM];
+	ssize_t len;
+	int fd;
+	int i, wanted = 0;
+
+	fd = socket(AF_INET, SOCK_DGRAM, 0);
+	g_assert_cmpint(-1, !=, fd);
+
+	memset(&sin, 0, sizeof(sin));
+	sin.sin_family = AF_INET;
+	sin.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+	g_assert_cmpint(0, ==, bind(fd, (struct sockaddr *)&sin, sizeof(sin)));
+	g_assert_cmpint(0, ==, getsockname(fd, (struct sockaddr *)&sin, &sin_len));
+
+	trace = network_trace_new();
+
+	/* not open yet, we don't want anything */
+	g_assert_cmpint(FALSE, ==, network_trace_wants(trace, NULL));
+
+	addr = network_address_new();
+	address = g_strdup_printf("127.0.0.1:%d", ntohs(sin.sin_port));
+	g_assert_cmpint(0, ==, network_address_set_address(addr, address));
+	g_free(address);
+
+	g_assert_cmpint(0, ==, network_trace_open(trace, addr, &gerr));
+
+	/* without a sample only the queries the client samples */
+	g_assert_cmpint(FALSE, ==, network_trace_wants(trace, NULL));
+	g_assert_cmpint(TRUE, ==, network_trace_context_parse(&ctx, C("00-0af7651916cd43dd8448eb211c80319c-b7ad6b7169203331-01")));
+	g_assert_cmpint(TRUE, ==, network_trace_wants(trace, &ctx));
+	g_assert_cmpint(TRUE, ==, network_trace_context_parse(&ctx, C("00-0af7651916cd43dd8448eb211c80319c-b7ad6b7169203331-00")));
+	g_assert_cmpint(FALSE, ==, network_trace_wants(trace, &ctx));
+
+	network_trace_set_sample(trace, 4);
+	for (i = 0; i < 40; i++) {
+		if (network_trace_wants(trace, NULL)) wanted++;
+	}
+	g_assert_cmpint(wanted, ==, 10);
+
+	for (i = 0; i < 3; i++) {
+		network_trace_query_t *query = network_trace_query_new();
+
+		query->read_usec = 100;
+		query->last_usec = 200;
+
+		g_assert_cmpint(TRUE, ==, network_trace_push(trace, query));
+	}
+
+	/* flushes the queue */
+	network_trace_free(trace);
+
+	/* the three queries fit into one datagram */
+	len = recv(fd, buf, sizeof(buf) - 1, MSG_DONTWAIT);
+	g_assert_cmpint(len, >, 0);
+	buf[len] = '\0';
+	g_assert(0 == strncmp(buf, C("{\"resourceSpans\":[")));
+	g_assert(NULL != strstr(buf, "\"name\":\"query\""));
+
+	g_assert_cmpint(-1, ==, recv(fd, buf, sizeof(buf), MSG_DONTWAIT));
+
+	close(fd);
+}
+#endif
+
+int main(int argc, char **argv) {
+	g_thread_init(NULL);
+	g_test_init(&argc, &argv, NULL);
+	g_test_bug_base("http://bugs.mysql.com/");
+
+	g_test_add_func("/core/network_trace_context_parse", t_network_trace_context_parse);
+	g_test_add_func("/core/network_trace_query_json", t_network_trace_query_json);
+#ifndef WIN32
+	g_test_add_func("/core/network_trace_send", t_network_trace_send);
+#endif
+
+	return g_test_run();
+}
+#else
+int main() {
+	return 77;
+}
+#endif
@@ -0,0 +1,350 @@
+/* $%BEGINLICENSE%$
+ Copyright (c) 2008, 2012, Oracle and/or its affiliates. All rights reserved.
+
+ This program is free software; you can redistribute it and/or
+ modify it under the terms of the GNU General Public License as
+ published by the Free Software Foundation; version 2 of the
+ License.
+
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ GNU General Public License for more details.
+
+ You should have received a copy of the GNU General Public License
+ along with this program; if not, write to the Free Software
+ Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA
+ 02110-1301  USA
+
+ $%ENDLICENSE%$ */
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <string.h>
+#ifdef HAVE_UNISTD_H
+#include <unistd.h> /* close() */
+#endif
+
+#include <glib.h>
+#include <glib/gstdio.h> /* g_unlink() */
+
+#include "network-mysqld-binlog.h"
+#include "replicant-spool.h"
+
+#if GLIB_CHECK_VERSION(2, 16, 0)
+#define C(x) x, sizeof(x) - 1
+#define S(x) x->str, x->len
+
+/**
+ * create a event that ends at log_pos
+ */
+static GString *t_event_new(guint8 event_type, guint32 log_pos, guint16 flags, const char *body, gsize body_len) {
+	GString *event = g_string_new(NULL);
+	guint32 event_size = REPLICANT_EVENT_HEADER_SIZE + body_len;
+	guint32 v[4];
+	int i;
+
+	v[0] = 1000;       /* timestamp */
+	v[1] = 1;          /* server-id */
+	v[2] = event_size;
+	v[3] = log_pos;
+
+	for (i = 0; i < 4; i++) {
+		g_string_append_c(event, v[i] & 0xff);
+		g_string_append_c(event, (v[i] >> 8) & 0xff);
+		g_string_append_c(event, (v[i] >> 16) & 0xff);
+		g_string_append_c(event, (v[i] >> 24) & 0xff);
+
+		if (i == 0) g_string_append_c(event, event_type);
+	}
+	g_string_append_c(event, flags & 0xff);
+	g_string_append_c(event, (flags >> 8) & 0xff);
+
+	g_string_append_len(event, body, body_len);
+
+	return event;
+}
+
+/**
+ * append query-events to the spool and remember them
+ *
+ * @param pos the position of the first event, moved behind the last one
+ */
+static void t_spool_append_queries(replicant_spool_t *spool, GPtrArray *events, guint32 *pos, int count) {
+	int i;
+
+	for (i = 0; i < count; i++) {
+		gchar *query = g_strdup_printf("INSERT INTO t VALUES (%d)", i);
+		GString *event;
+
+		event = t_event_new(QUERY_EVENT, *pos + REPLICANT_EVENT_HEADER_SIZE + strlen(query), 0, query, strlen(query));
+		g_free(query);
+
+		g_assert_cmpint(0, ==, replicant_spool_append(spool, S(event)));
+
+		*pos += event->len;
+		g_ptr_array_add(events, event);
+	}
+}
+
+/**
+ * append the rotate-event the master writes at the end of a binlog
+ */
+static void t_spool_append_rotate(replicant_spool_t *spool, GPtrArray *events, guint32 *pos, const gchar *binlog_file) {
+	GString *body = g_string_new(NULL);
+	GString *event;
+
+	g_string_append_len(body, C("\x04\x00\x00\x00" "\x00\x00\x00\x00"));
+	g_string_append(body, binlog_file);
+
+	event = t_event_new(ROTATE_EVENT, *pos + REPLICANT_EVENT_HEADER_SIZE + body->len, 0, S(body));
+	g_string_free(body, TRUE);
+
+	g_assert_cmpint(0, ==, replicant_spool_append(spool, S(event)));
+
+	*pos = REPLICANT_BINLOG_HEADER_SIZE;
+	g_ptr_array_add(events, event);
+}
+
+/**
+ * a fresh spool in a new temp-dir, the master starts at binlog_file:4
+ */
+static replicant_spool_t *t_spool_new(gchar **dir, const gchar *binlog_file) {
+	replicant_spool_t *spool;
+	GString *rotate = g_string_new(NULL);
+	GError *gerr = NULL;
+	int fd;
+
+	/* use the name of a temp-file as our dir */
+	fd = g_file_open_tmp("t-replicant-spool-XXXXXX", dir, &gerr);
+	g_assert_cmpint(-1, !=, fd);
+	close(fd);
+	g_unlink(*dir);
+
+	spool = replicant_spool_new();
+	g_assert_cmpint(0, ==, replicant_spool_open(spool, *dir));
+	replicant_spool_set_master(spool, "5.5.30-log", FALSE);
+
+	replicant_binlog_append_rotate_event(rotate, 1, binlog_file, REPLICANT_BINLOG_HEADER_SIZE, FALSE);
+	g_assert_cmpint(0, ==, replicant_spool_append(spool, S(rotate)));
+	g_string_free(rotate, TRUE);
+
+	return spool;
+}
+
+static void t_spool_remove(const gchar *dir) {
+	GDir *d;
+	const gchar *name;
+
+	d = g_dir_open(dir, 0, NULL);
+	g_assert(d != NULL);
+
+	while ((name = g_dir_read_name(d))) {
+		gchar *filename = g_build_filename(dir, name, NULL);
+
+		g_unlink(filename);
+		g_free(filename);
+	}
+	g_dir_close(d);
+
+	g_rmdir(dir);
+}
+
+/**
+ * read the events from the reader and compare them to the ones we spooled
+ */
+static void t_spool_read_events(replicant_spool_t *spool, replicant_spool_reader_t *reader, GPtrArray *events, guint from) {
+	GString *event = g_string_new(NULL);
+	guint i;
+
+	for (i = from; i < events->len; i++) {
+		GString *expected = events->pdata[i];
+
+		g_string_truncate(event, 0);
+		g_assert_cmpint(REPLICANT_SPOOL_READ_EVENT, ==, replicant_spool_read(spool, reader, event));
+		g_assert_cmpint(event->len, ==, expected->len);
+		g_assert_cmpint(0, ==, memcmp(event->str, expected->str, expected->len));
+	}
+
+	g_string_free(event, TRUE);
+}
+
+static void t_events_free(GPtrArray *events) {
+	guint i;
+
+	for (i = 0; i < events->len; i++) {
+		g_string_free(events->pdata[i], TRUE);
+	}
+	g_ptr_array_free(events, TRUE);
+}
+
+/**
+ * @test the events are read back as they were spooled, across the rotate-event and from
+ *   the compressed segment
+ */
+static void t_replicant_spool_roundtrip(void) {
+	replicant_spool_t *spool;
+	replicant_spool_reader_t *reader;
+	GPtrArray *events = g_ptr_array_new();
+	GString *event = g_string_new(NULL);
+	gchar *dir;
+	gchar *binlog_file = NULL;
+	guint32 pos = REPLICANT_BINLOG_HEADER_SIZE;
+	guint32 spool_pos;
+#ifdef HAVE_ZLIB_H
+	gchar *filename;
+	gchar *compressed_filename;
+	guint32 second_event_pos;
+#endif
+
+	spool = t_spool_new(&dir, "binlog.000001");
+
+	t_spool_append_queries(spool, events, &pos, 3);
+	t_spool_append_rotate(spool, events, &pos, "binlog.000002");
+	t_spool_append_queries(spool, events, &pos, 1);
+
+	g_assert_cmpint(TRUE, ==, replicant_spool_get_position(spool, &binlog_file, &spool_pos));
+	g_assert_cmpstr(binlog_file, ==, "binlog.000002");
+	g_assert_cmpint(spool_pos, ==, pos);
+	g_free(binlog_file);
+
+	/* events we have already are skipped */
+	g_assert_cmpint(0, ==, replicant_spool_append(spool, S(((GString *)events->pdata[4]))));
+	g_assert_cmpint(TRUE, ==, replicant_spool_get_position(spool, &binlog_file, &spool_pos));
+	g_assert_cmpint(spool_pos, ==, pos);
+	g_free(binlog_file);
+
+	reader = replicant_spool_reader_new();
+	g_assert_cmpint(-1, ==, replicant_spool_reader_seek(spool, reader, "binlog.000009", REPLICANT_BINLOG_HEADER_SIZE));
+	g_assert_cmpint(0, ==, replicant_spool_reader_seek(spool, reader, "", REPLICANT_BINLOG_HEADER_SIZE));
+	g_assert_cmpstr(reader->binlog_file, ==, "binlog.000001");
+
+	/* the rotate-event takes the reader to the next segment */
+	t_spool_read_events(spool, reader, events, 0);
+	g_assert_cmpstr(reader->binlog_file, ==, "binlog.000002");
+	g_assert_cmpint(REPLICANT_SPOOL_READ_WAIT, ==, replicant_spool_read(spool, reader, event));
+
+#ifdef HAVE_ZLIB_H
+	/* replay the sealed segment from its compressed copy */
+	filename = g_build_filename(dir, "binlog.000001", NULL);
+	compressed_filename = g_strconcat(filename, REPLICANT_SPOOL_COMPRESSED_SUFFIX, NULL);
+
+	g_assert_cmpint(0, ==, replicant_spool_compress_segment(filename, 6));
+	g_assert(!g_file_test(filename, G_FILE_TEST_EXISTS));
+	g_assert(g_file_test(compressed_filename, G_FILE_TEST_EXISTS));
+
+	g_assert_cmpint(0, ==, replicant_spool_reader_seek(spool, reader, "binlog.000001", REPLICANT_BINLOG_HEADER_SIZE));
+	g_assert_cmpint(TRUE, ==, reader->is_compressed);
+	t_spool_read_events(spool, reader, events, 0);
+	g_assert_cmpstr(reader->binlog_file, ==, "binlog.000002");
+
+	/* start in the middle of the compressed segment */
+	second_event_pos = REPLICANT_BINLOG_HEADER_SIZE + ((GString *)events->pdata[0])->len;
+	g_assert_cmpint(0, ==, replicant_spool_reader_seek(spool, reader, "binlog.000001", second_event_pos));
+	t_spool_read_events(spool, reader, events, 1);
+	g_assert_cmpint(REPLICANT_SPOOL_READ_WAIT, ==, replicant_spool_read(spool, reader, event));
+
+	g_free(compressed_filename);
+	g_free(filename);
+#endif
+
+	replicant_spool_reader_free(reader);
+	replicant_spool_free(spool);
+
+	t_spool_remove(dir);
+	g_free(dir);
+
+	g_string_free(event, TRUE);
+	t_events_free(events);
+}
+
+/**
+ * @test a half-written event at the end of the last segment is cut off when the spool
+ *   is opened again, a truncated sealed segment is a read-error
+ */
+static void t_replicant_spool_truncated(void) {
+	replicant_spool_t *spool;
+	replicant_spool_reader_t *reader;
+	GPtrArray *events = g_ptr_array_new();
+	GString *event = g_string_new(NULL);
+	gchar *dir;
+	gchar *filename;
+	gchar *content;
+	gsize content_len;
+	gchar *binlog_file = NULL;
+	guint32 pos = REPLICANT_BINLOG_HEADER_SIZE;
+	guint32 spool_pos;
+
+	spool = t_spool_new(&dir, "binlog.000001");
+	t_spool_append_queries(spool, events, &pos, 2);
+	replicant_spool_free(spool);
+
+	/* we crashed in the middle of writing the next event */
+	filename = g_build_filename(dir, "binlog.000001", NULL);
+	g_assert(g_file_get_contents(filename, &content, &content_len, NULL));
+	g_assert_cmpint(content_len, ==, pos);
+	{
+		GString *half = g_string_new_len(content, content_len);
+
+		g_string_append_len(half, C("\x00\x00\x00\x00" "\x02" "\x01\x00\x00\x00" "\x40\x00\x00\x00"));
+		g_assert(g_file_set_contents(filename, S(half), NULL));
+		g_string_free(half, TRUE);
+	}
+	g_free(content);
+
+	spool = replicant_spool_new();
+	g_assert_cmpint(0, ==, replicant_spool_open(spool, dir));
+	replicant_spool_set_master(spool, "5.5.30-log", FALSE);
+
+	g_assert_cmpint(TRUE, ==, replicant_spool_get_position(spool, &binlog_file, &spool_pos));
+	g_assert_cmpstr(binlog_file, ==, "binlog.000001");
+	g_assert_cmpint(spool_pos, ==, pos);
+	g_free(binlog_file);
+
+	/* the master sends the event again */
+	t_spool_append_queries(spool, events, &pos, 1);
+	t_spool_append_rotate(spool, events, &pos, "binlog.000002");
+
+	reader = replicant_spool_reader_new();
+	g_assert_cmpint(0, ==, replicant_spool_reader_seek(spool, reader, "", REPLICANT_BINLOG_HEADER_SIZE));
+	t_spool_read_events(spool, reader, events, 0);
+	g_assert_cmpint(REPLICANT_SPOOL_READ_WAIT, ==, replicant_spool_read(spool, reader, event));
+
+	/* the sealed segment lost the end of its rotate-event */
+	g_assert(g_file_get_contents(filename, &content, &content_len, NULL));
+	g_assert(g_file_set_contents(filename, content, content_len - 5, NULL));
+	g_free(content);
+
+	g_assert_cmpint(0, ==, replicant_spool_reader_seek(spool, reader, "binlog.000001", REPLICANT_BINLOG_HEADER_SIZE));
+	g_string_free(g_ptr_array_remove_index(events, events->len - 1), TRUE); /* the rotate-event */
+	t_spool_read_events(spool, reader, events, 0);
+	g_string_truncate(event, 0);
+	g_assert_cmpint(REPLICANT_SPOOL_READ_ERROR, ==, replicant_spool_read(spool, reader, event));
+
+	replicant_spool_reader_free(reader);
+	replicant_spool_free(spool);
+
+	g_free(filename);
+	t_spool_remove(dir);
+	g_free(dir);
+
+	g_string_free(event, TRUE);
+	t_events_free(events);
+}
+
+int main(int argc, char **argv) {
+	g_thread_init(NULL);
+	g_test_init(&argc, &argv, NULL);
+	g_test_bug_base("http://bugs.mysql.com/");
+
+	g_test_add_func("/core/replicant_spool_roundtrip", t_replicant_spool_roundtrip);
+	g_test_add_func("/core/replicant_spool_truncated", t_replicant_spool_truncated);
+
+	return g_test_run();
+}
+#else
+int main() {
+	return 77;
+}
+#endif